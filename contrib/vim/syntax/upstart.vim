@@ -34,7 +34,7 @@ syn cluster upstartShellCluster contains=@Shell
 syn keyword upstartStatement description author version instance expect
 syn keyword upstartStatement pid kill normal console env exit export
 syn keyword upstartStatement umask nice oom chroot chdir exec setuid setgid
-syn keyword upstartStatement usage
+syn keyword upstartStatement usage pool
 
 " two arguments
 syn keyword upstartStatement limit
@@ -52,6 +52,8 @@ syn keyword upstartOption pre-start post-start pre-stop post-stop
 
 " option for kill
 syn keyword upstartOption timeout signal
+" option for respawn
+syn keyword upstartOption delay
 " option for oom
 syn keyword upstartOption score never
 " options for console
@@ -0,0 +1,1260 @@
+/* upstart
+ *
+ * test_file_bridge.c - test suite for extra/upstart-file-bridge.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+/* The bridge is a single program, so include it whole to reach the
+ * static path trie functions; its main() is renamed out of the way.
+ */
+#define main file_bridge_main
+#include "upstart-file-bridge.c"
+#undef main
+
+#include "test_util.h"
+
+
+static WatchedDir *
+new_dir (const char *path)
+{
+	WatchedDir *dir;
+
+	dir = NIH_MUST (nih_new (NULL, WatchedDir));
+	nih_list_init (&dir->entry);
+	nih_alloc_set_destructor (dir, nih_list_destroy);
+
+	dir->path = NIH_MUST (nih_strdup (dir, path));
+	dir->files = NULL;
+	dir->watch = NULL;
+	dir->handle = NULL;
+
+	return dir;
+}
+
+static WatchedFile *
+new_file (WatchedDir *dir,
+	  const char *path)
+{
+	WatchedFile *file;
+
+	file = watched_file_new (path, NULL, IN_CREATE, NULL);
+	nih_assert (file != NULL);
+
+	file->parent = dir;
+
+	file->node = path_node_lookup (file->path, TRUE);
+	file->node_entry = NIH_MUST (nih_list_entry_new (file));
+	file->node_entry->data = file;
+	nih_list_add (&file->node->files, &file->node_entry->entry);
+
+	return file;
+}
+
+
+static int
+strcmp_compar (const void *a,
+	       const void *b)
+{
+	return strcmp (*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * bridge_connect:
+ * @log: set to stream of events emitted.
+ *
+ * Starts a fake Upstart and connects the bridge to it.
+ *
+ * Returns: pid of fake Upstart.
+ **/
+static pid_t
+bridge_connect (FILE **log)
+{
+	DBusConnection *conn;
+	char            address[PATH_MAX];
+	pid_t           pid;
+
+	sprintf (address, "unix:abstract=/com/ubuntu/upstart/test/file-bridge-%d",
+		 getpid ());
+
+	pid = fake_upstart_start (address, TRUE, log);
+
+	conn = nih_dbus_connect (address, NULL);
+	assert (conn != NULL);
+
+	upstart = nih_dbus_proxy_new (NULL, conn, NULL, DBUS_PATH_UPSTART,
+				      NULL, NULL);
+	assert (upstart != NULL);
+
+	return pid;
+}
+
+static void
+bridge_disconnect (pid_t  pid,
+		   FILE  *log)
+{
+	DBusConnection *conn;
+
+	conn = upstart->connection;
+	nih_free (upstart);
+	upstart = NULL;
+
+	dbus_connection_close (conn);
+	dbus_connection_unref (conn);
+
+	fake_upstart_stop (pid, log);
+}
+
+/**
+ * run_main_loop:
+ * @seconds: seconds to run for.
+ *
+ * Runs the main loop, so that timers fire and replies are handled, for
+ * @seconds.
+ **/
+static void
+run_main_loop (int seconds)
+{
+	assert (nih_timer_add_timeout (NULL, seconds,
+				       (NihTimerCb)nih_main_term_signal, NULL));
+	nih_main_loop ();
+}
+
+
+void
+test_lookup (void)
+{
+	WatchedDir  *dir;
+	WatchedFile *file;
+	PathNode    *node;
+
+	TEST_FUNCTION ("path_node_lookup");
+	dir = new_dir ("/a");
+
+
+	/* Check that nothing is found before any file is watched, and that
+	 * the trie is not created by a lookup alone.
+	 */
+	TEST_FEATURE ("with empty trie");
+	TEST_EQ_P (path_node_lookup ("/a/b/c", FALSE), NULL);
+	TEST_EQ_P (path_trie, NULL);
+
+
+	/* Check that a nested path is held by a node for each of its
+	 * components, each the child of the one before, and that the
+	 * deepest is the node of the file.
+	 */
+	TEST_FEATURE ("with nested path");
+	file = new_file (dir, "/a/b/c");
+
+	TEST_NE_P (path_trie, NULL);
+	TEST_EQ_P (path_trie->parent, NULL);
+
+	node = file->node;
+	TEST_NE_P (node, NULL);
+	TEST_EQ_STR (node->name, "c");
+	TEST_LIST_NOT_EMPTY (&node->files);
+	TEST_EQ_P (node->children, NULL);
+
+	TEST_EQ_STR (node->parent->name, "b");
+	TEST_EQ_STR (node->parent->parent->name, "a");
+	TEST_EQ_P (node->parent->parent->parent, path_trie);
+
+	TEST_EQ_P (path_node_lookup ("/a/b/c", FALSE), node);
+	TEST_EQ_P (path_node_lookup ("/a/b", FALSE), node->parent);
+	TEST_EQ_P (path_node_lookup ("/a", FALSE), node->parent->parent);
+
+
+	/* Check that repeated and trailing slashes are passed over. */
+	TEST_FEATURE ("with repeated slashes");
+	TEST_EQ_P (path_node_lookup ("//a///b/c/", FALSE), node);
+
+
+	/* Check that paths not in the trie are not found, whether below a
+	 * watched file, beside it or merely sharing the start of a name.
+	 */
+	TEST_FEATURE ("with path not in trie");
+	TEST_EQ_P (path_node_lookup ("/a/b/c/d", FALSE), NULL);
+	TEST_EQ_P (path_node_lookup ("/a/b/d", FALSE), NULL);
+	TEST_EQ_P (path_node_lookup ("/a/bc", FALSE), NULL);
+	TEST_EQ_P (path_node_lookup ("/x", FALSE), NULL);
+
+	nih_free (file);
+	nih_free (dir);
+
+	TEST_HASH_EMPTY (path_trie->children);
+}
+
+void
+test_shared_prefix (void)
+{
+	WatchedDir  *dir;
+	WatchedFile *file1;
+	WatchedFile *file2;
+	WatchedFile *file3;
+	WatchedFile *file4;
+	size_t       len;
+
+	TEST_FUNCTION ("path_node_lookup");
+	dir = new_dir ("/a");
+
+
+	/* Check that paths sharing leading components share the nodes for
+	 * them, and that a component that is a prefix of another's name
+	 * is a different node.
+	 */
+	TEST_FEATURE ("with shared prefixes");
+	file1 = new_file (dir, "/a/b/c");
+	file2 = new_file (dir, "/a/b/d");
+	file3 = new_file (dir, "/a/bc");
+
+	TEST_NE_P (file1->node, file2->node);
+	TEST_EQ_P (file1->node->parent, file2->node->parent);
+	TEST_EQ_P (file3->node->parent, file1->node->parent->parent);
+	TEST_NE_P (file3->node, file1->node->parent);
+	TEST_EQ_STR (file3->node->name, "bc");
+
+
+	/* Check that a second file for the same path is held by the same
+	 * node.
+	 */
+	TEST_FEATURE ("with same path twice");
+	file4 = new_file (dir, "/a/b/c");
+
+	TEST_EQ_P (file4->node, file1->node);
+
+	len = 0;
+	NIH_LIST_FOREACH (&file1->node->files, iter)
+		len++;
+	TEST_EQ (len, 2);
+
+	nih_free (file4);
+	nih_free (file3);
+	nih_free (file2);
+	nih_free (file1);
+	nih_free (dir);
+}
+
+void
+test_prune (void)
+{
+	WatchedDir  *dir;
+	WatchedFile *file1;
+	WatchedFile *file2;
+	WatchedFile *file3;
+	WatchedFile *file4;
+	PathNode    *a;
+	PathNode    *b;
+	PathNode    *c;
+
+	TEST_FUNCTION ("path_node_prune");
+	dir = new_dir ("/a");
+
+	file1 = new_file (dir, "/a/b/c");
+	file2 = new_file (dir, "/a/b/d");
+	file3 = new_file (dir, "/a/bc");
+	file4 = new_file (dir, "/a/b/c");
+
+	c = file1->node;
+	b = c->parent;
+	a = b->parent;
+
+	TEST_FREE_TAG (a);
+	TEST_FREE_TAG (b);
+	TEST_FREE_TAG (c);
+
+
+	/* Check that a node is kept while another file still has its
+	 * path.
+	 */
+	TEST_FEATURE ("with other file for path");
+	nih_free (file4);
+
+	TEST_NOT_FREE (c);
+	TEST_EQ_P (path_node_lookup ("/a/b/c", FALSE), c);
+
+
+	/* Check that the node of the last file for a path is removed, but
+	 * that its parent is kept while it has other children.
+	 */
+	TEST_FEATURE ("with sibling");
+	nih_free (file1);
+
+	TEST_FREE (c);
+	TEST_NOT_FREE (b);
+	TEST_EQ_P (path_node_lookup ("/a/b/c", FALSE), NULL);
+	TEST_EQ_P (path_node_lookup ("/a/b/d", FALSE), file2->node);
+
+
+	/* Check that once the last child goes, the parent goes with it, up
+	 * to the first node that still leads to another file.
+	 */
+	TEST_FEATURE ("with no other child");
+	nih_free (file2);
+
+	TEST_FREE (b);
+	TEST_NOT_FREE (a);
+	TEST_EQ_P (path_node_lookup ("/a/b", FALSE), NULL);
+	TEST_EQ_P (path_node_lookup ("/a/bc", FALSE), file3->node);
+
+
+	/* Check that removing the last file empties the trie, but that the
+	 * root itself is kept.
+	 */
+	TEST_FEATURE ("with last file");
+	TEST_FREE_TAG (path_trie);
+
+	nih_free (file3);
+
+	TEST_FREE (a);
+	TEST_NOT_FREE (path_trie);
+	TEST_EQ_P (path_node_lookup ("/a", FALSE), NULL);
+
+	TEST_HASH_EMPTY (path_trie->children);
+
+	nih_free (dir);
+}
+
+void
+test_find (void)
+{
+	WatchedDir   *dir;
+	WatchedDir   *other_dir;
+	WatchedFile  *dir_file;
+	WatchedFile  *file1;
+	WatchedFile  *file2;
+	WatchedFile  *other_file;
+	WatchedFile **files;
+	size_t        len;
+
+	TEST_FUNCTION ("watched_files_find");
+	dir = new_dir ("/a");
+	other_dir = new_dir ("/a/b");
+
+	dir_file = new_file (dir, "/a/");
+	file1 = new_file (dir, "/a/b/c");
+	file2 = new_file (dir, "/a/b/c/d");
+	other_file = new_file (other_dir, "/a/b/c");
+
+
+	/* Check that the files for the directory itself and for the path
+	 * are found, but not those watched by another directory.
+	 */
+	TEST_FEATURE ("without descendants");
+	files = watched_files_find (NULL, dir, "/a/b/c", FALSE, &len);
+
+	TEST_EQ (len, 2);
+	TEST_ALLOC_SIZE (files, sizeof (WatchedFile *) * 2);
+	TEST_EQ_P (files[0], dir_file);
+	TEST_EQ_P (files[1], file1);
+
+	nih_free (files);
+
+
+	/* Check that files below the path are found when asked for. */
+	TEST_FEATURE ("with descendants");
+	files = watched_files_find (NULL, dir, "/a/b", TRUE, &len);
+
+	TEST_EQ (len, 3);
+	TEST_EQ_P (files[0], dir_file);
+	TEST_EQ_P (files[1], file1);
+	TEST_EQ_P (files[2], file2);
+
+	nih_free (files);
+
+
+	/* Check that a path outside the trie finds only the directory. */
+	TEST_FEATURE ("with path not in trie");
+	files = watched_files_find (NULL, dir, "/a/x", TRUE, &len);
+
+	TEST_EQ (len, 1);
+	TEST_EQ_P (files[0], dir_file);
+
+	nih_free (files);
+
+
+	/* Check that file_filter() passes paths within a watched directory
+	 * and those leading to a watched file, and ignores the rest.
+	 */
+	TEST_FUNCTION ("file_filter");
+	TEST_FEATURE ("with path in trie");
+	TEST_FALSE (file_filter (dir, "/a/b/c", FALSE));
+	TEST_FALSE (file_filter (dir, "/a/anything", FALSE));
+
+	nih_free (dir_file);
+
+	TEST_FEATURE ("with path leading to watched file");
+	TEST_FALSE (file_filter (dir, "/a/b", TRUE));
+
+	TEST_FEATURE ("with path not in trie");
+	TEST_TRUE (file_filter (dir, "/a/x", FALSE));
+	TEST_TRUE (file_filter (dir, "/x", FALSE));
+
+	nih_free (other_file);
+	nih_free (file2);
+	nih_free (file1);
+	nih_free (other_dir);
+	nih_free (dir);
+}
+
+
+void
+test_queue_event (void)
+{
+	FILE    *log;
+	pid_t    pid;
+	char   **events;
+	size_t   len;
+
+	TEST_FUNCTION ("queue_event");
+	pid = bridge_connect (&log);
+
+
+	/* Check that without a coalescing window, an event is emitted as
+	 * soon as it is queued.
+	 */
+	TEST_FEATURE ("without coalescing window");
+	queue_event ("/test/a", IN_MODIFY, NULL, -1);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify");
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+
+
+	/* Check that repeats of an event within its window are dropped,
+	 * the event being emitted once when the window has passed with
+	 * the DEBOUNCE value the jobs gave.
+	 */
+	TEST_FEATURE ("with repeats within window");
+	queue_event ("/test/a", IN_MODIFY, NULL, 1);
+	queue_event ("/test/a", IN_MODIFY, NULL, 1);
+	queue_event ("/test/a", IN_MODIFY, NULL, 1);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_NE_P (pending_timer, NULL);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify DEBOUNCE=1");
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+	TEST_HASH_EMPTY (pending_events);
+
+
+	/* Check that a different event for the same file within the
+	 * window causes the one held back to be emitted first, keeping
+	 * them in order, while the new one is held back in turn.
+	 */
+	TEST_FEATURE ("with different event within window");
+	queue_event ("/test/a", IN_MODIFY, NULL, 1);
+	queue_event ("/test/a", IN_DELETE, NULL, 1);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify DEBOUNCE=1");
+	nih_free (events);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=delete DEBOUNCE=1");
+	nih_free (events);
+
+	TEST_HASH_EMPTY (pending_events);
+
+
+	/* Check that the same event for different matches of a glob is
+	 * not coalesced.
+	 */
+	TEST_FEATURE ("with different matches within window");
+	queue_event ("/test/*", IN_CREATE, "/test/a", 1);
+	queue_event ("/test/*", IN_CREATE, "/test/b", 1);
+	queue_event ("/test/*", IN_CREATE, "/test/a", 1);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 2);
+	qsort (events, len, sizeof (events[0]), strcmp_compar);
+	TEST_EQ_STR (events[0], "file FILE=/test/* EVENT=create MATCH=/test/a DEBOUNCE=1");
+	TEST_EQ_STR (events[1], "file FILE=/test/* EVENT=create MATCH=/test/b DEBOUNCE=1");
+	nih_free (events);
+
+	TEST_HASH_EMPTY (pending_events);
+
+
+	/* Check that an event with a shorter window than one already held
+	 * back is emitted when its own window has passed rather than
+	 * waiting for the other.
+	 */
+	TEST_FEATURE ("with shorter window than event held back");
+	queue_event ("/test/a", IN_MODIFY, NULL, 4);
+	queue_event ("/test/b", IN_MODIFY, NULL, 1);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/b EVENT=modify DEBOUNCE=1");
+	nih_free (events);
+
+	TEST_NE_P (pending_timer, NULL);
+
+	run_main_loop (3);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify DEBOUNCE=4");
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+	TEST_HASH_EMPTY (pending_events);
+
+
+	/* Check that the window given by --debounce applies to jobs that
+	 * don't give DEBOUNCE, which is then not part of the event.
+	 */
+	TEST_FEATURE ("with default window");
+	debounce_default = 1;
+
+	queue_event ("/test/a", IN_MODIFY, NULL, -1);
+	queue_event ("/test/a", IN_MODIFY, NULL, -1);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify");
+	nih_free (events);
+
+
+	/* Check that DEBOUNCE=0 given by a job overrides the default,
+	 * the event being emitted at once.
+	 */
+	TEST_FEATURE ("with zero window overriding default");
+	queue_event ("/test/a", IN_MODIFY, NULL, 0);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "file FILE=/test/a EVENT=modify DEBOUNCE=0");
+	nih_free (events);
+
+	debounce_default = 0;
+
+	bridge_disconnect (pid, log);
+}
+
+
+void
+test_job_add_file (void)
+{
+	char             dirname[PATH_MAX];
+	char             filename[PATH_MAX];
+	char            *file_info[5];
+	const char      *invalid[] = { "x", "5s", "-1", "", NULL };
+	nih_local char  *event = NULL;
+	Job             *job;
+	WatchedFile     *file;
+	WatchedDir      *dir;
+	FILE            *output;
+	FILE            *log;
+	FILE            *f;
+	pid_t            pid;
+	char           **events;
+	size_t           len;
+	struct stat      statbuf;
+
+	TEST_FUNCTION ("job_add_file");
+	program_name = "test";
+	output = tmpfile ();
+
+	pid = bridge_connect (&log);
+
+	if (! jobs)
+		jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	TEST_FILENAME (dirname);
+	assert0 (mkdir (dirname, 0755));
+
+	sprintf (filename, "%s/foo", dirname);
+	event = NIH_MUST (nih_sprintf (NULL, "FILE=%s", filename));
+
+	file_info[0] = FILE_EVENT;
+	file_info[1] = event;
+	file_info[2] = "EVENT=modify";
+	file_info[4] = NULL;
+
+
+	/* Check that the DEBOUNCE value given by a job is kept with the
+	 * file it watches, and is used for the events emitted for it.
+	 */
+	TEST_FEATURE ("with DEBOUNCE");
+	job = job_new ("/com/ubuntu/Upstart/jobs/test");
+	file_info[3] = "DEBOUNCE=5";
+
+	job_add_file (job, file_info);
+
+	TEST_LIST_NOT_EMPTY (&job->files);
+	file = ((NihListEntry *)job->files.next)->data;
+	TEST_EQ_STR (file->path, filename);
+	TEST_EQ (file->events, IN_MODIFY | IN_CLOSE_WRITE);
+	TEST_EQ (file->debounce, 5);
+
+	dir = file->parent;
+	TEST_NE_P (dir, NULL);
+	TEST_EQ_STR (dir->path, dirname);
+
+	f = fopen (filename, "w");
+	assert (f != NULL);
+	fclose (f);
+	assert0 (stat (filename, &statbuf));
+
+	modify_handler (dir, dir->watch, filename, &statbuf);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_NE_P (pending_timer, NULL);
+	TEST_NE_P (pending_events, NULL);
+
+	NIH_HASH_FOREACH_SAFE (pending_events, iter) {
+		PendingEvent *pending = (PendingEvent *)iter;
+
+		TEST_EQ_STR (pending->path, filename);
+		TEST_EQ (pending->event, IN_MODIFY);
+		TEST_EQ (pending->debounce, 5);
+		TEST_GE (pending->due, time (NULL) + 4);
+
+		nih_free (pending);
+	}
+
+	nih_free (pending_timer);
+	pending_timer = NULL;
+
+	assert0 (unlink (filename));
+	nih_free (job);
+	nih_free (dir);
+
+
+	/* Check that a DEBOUNCE value that isn't a number of seconds
+	 * causes the file event to be ignored with a warning.
+	 */
+	for (const char **val = invalid; *val; val++) {
+		nih_local char *feature = NULL;
+		nih_local char *expected = NULL;
+
+		feature = NIH_MUST (nih_sprintf (NULL, "with invalid DEBOUNCE=%s",
+						 *val));
+		TEST_FEATURE (feature);
+
+		job = job_new ("/com/ubuntu/Upstart/jobs/test");
+		file_info[3] = NIH_MUST (nih_sprintf (job, "DEBOUNCE=%s", *val));
+
+		TEST_DIVERT_STDERR (output) {
+			job_add_file (job, file_info);
+		}
+		rewind (output);
+
+		TEST_LIST_EMPTY (&job->files);
+
+		expected = NIH_MUST (nih_sprintf (NULL, "test: %s: Ignored %s "
+						  "event with invalid DEBOUNCE=%s\n",
+						  job->path, FILE_EVENT, *val));
+		TEST_FILE_EQ (output, expected);
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		nih_free (job);
+	}
+
+	fclose (output);
+
+	assert0 (rmdir (dirname));
+
+	bridge_disconnect (pid, log);
+}
+
+
+/**
+ * fanotify_dir:
+ * @path: path of directory,
+ * @key: key to give it.
+ *
+ * Creates a WatchedDir for @path as watched through fanotify, with a
+ * single WatchedFile for @path/foo interested in all events.
+ *
+ * Returns: new WatchedDir.
+ **/
+static WatchedDir *
+fanotify_dir (const char *path,
+	      const char *key)
+{
+	WatchedDir      *dir;
+	WatchedFile     *file;
+	FanotifyHandle  *handle;
+	nih_local char  *file_path = NULL;
+
+	watched_dir_init ();
+
+	if (! fanotify_dirs)
+		fanotify_dirs = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	dir = new_dir (path);
+	dir->files = NIH_MUST (nih_hash_string_new (dir, 0));
+	nih_hash_add (watched_dirs, &dir->entry);
+
+	handle = NIH_MUST (nih_new (dir, FanotifyHandle));
+	nih_list_init (&handle->entry);
+	nih_alloc_set_destructor (handle, nih_list_destroy);
+
+	handle->key = NIH_MUST (nih_strdup (handle, key));
+	handle->dir = dir;
+
+	nih_hash_add (fanotify_dirs, &handle->entry);
+	dir->handle = handle;
+
+	file_path = NIH_MUST (nih_sprintf (NULL, "%s/foo", path));
+	file = new_file (dir, file_path);
+	file->events = ALL_FILE_EVENTS;
+	nih_ref (file, dir);
+	nih_hash_add (dir->files, &file->entry);
+
+	return dir;
+}
+
+/**
+ * fanotify_event:
+ * @fd: file descriptor to write event to,
+ * @mask: fanotify events,
+ * @fsid: filesystem id,
+ * @handle: file handle of directory,
+ * @name: name of entry in directory, or NULL.
+ *
+ * Writes an event to @fd as fanotify would with FAN_REPORT_DFID_NAME.
+ **/
+static void
+fanotify_event (int                        fd,
+		uint64_t                   mask,
+		const int                  fsid[2],
+		const struct file_handle  *handle,
+		const char                *name)
+{
+	char  buf[4096] __attribute__ ((aligned (__alignof__ (struct fanotify_event_metadata))));
+	struct fanotify_event_metadata *metadata;
+	struct fanotify_event_info_fid *fid;
+	size_t                          len;
+
+	memset (buf, 0, sizeof (buf));
+
+	metadata = (struct fanotify_event_metadata *)buf;
+	fid = (struct fanotify_event_info_fid *)(metadata + 1);
+
+	fid->hdr.info_type = name ? FAN_EVENT_INFO_TYPE_DFID_NAME
+		: FAN_EVENT_INFO_TYPE_DFID;
+	memcpy (&fid->fsid, fsid, sizeof (fid->fsid));
+	memcpy (fid->handle, handle,
+		sizeof (struct file_handle) + handle->handle_bytes);
+
+	len = sizeof (*fid) + sizeof (struct file_handle) + handle->handle_bytes;
+	if (name) {
+		strcpy ((char *)fid + len, name);
+		len += strlen (name) + 1;
+	}
+
+	/* Records are padded to keep the next one aligned */
+	len = (len + 7) & ~7;
+	fid->hdr.len = len;
+
+	metadata->metadata_len = sizeof (*metadata);
+	metadata->event_len = sizeof (*metadata) + len;
+	metadata->vers = FANOTIFY_METADATA_VERSION;
+	metadata->mask = mask;
+	metadata->fd = FAN_NOFD;
+	metadata->pid = getpid ();
+
+	assert (write (fd, buf, metadata->event_len) == metadata->event_len);
+}
+
+
+void
+test_fanotify_dispatch (void)
+{
+	char             dirname[PATH_MAX];
+	char             filename[PATH_MAX];
+	nih_local char  *expected = NULL;
+	WatchedDir      *dir;
+	FILE            *log;
+	FILE            *f;
+	pid_t            pid;
+	char           **events;
+	size_t           len;
+
+	TEST_FUNCTION ("fanotify_dispatch");
+	pid = bridge_connect (&log);
+
+	TEST_FILENAME (dirname);
+	assert0 (mkdir (dirname, 0755));
+	sprintf (filename, "%s/foo", dirname);
+
+	dir = fanotify_dir (dirname, "key");
+
+
+	/* Check that the creation of a watched file is given to the
+	 * create handler, as inotify's would be.
+	 */
+	TEST_FEATURE ("with created file");
+	f = fopen (filename, "w");
+	assert (f != NULL);
+	fclose (f);
+
+	fanotify_dispatch ("key", "foo", FAN_CREATE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=create",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+
+	/* Check that a watched file closed after writing is given to the
+	 * modify handler.
+	 */
+	TEST_FEATURE ("with file closed after writing");
+	fanotify_dispatch ("key", "foo", FAN_CLOSE_WRITE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=modify",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+
+	/* Check that a file moved into the directory is given to the
+	 * create handler.
+	 */
+	TEST_FEATURE ("with file moved in");
+	fanotify_dispatch ("key", "foo", FAN_MOVED_TO);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=create",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+
+	/* Check that events for a file that isn't watched, for a file
+	 * that has gone by the time the event is read, and for a
+	 * directory that isn't watched are all ignored.
+	 */
+	TEST_FEATURE ("with file not watched");
+	fanotify_dispatch ("key", "bar", FAN_CREATE | FAN_CLOSE_WRITE | FAN_DELETE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_FEATURE ("with directory not watched");
+	fanotify_dispatch ("other", "foo", FAN_CREATE | FAN_CLOSE_WRITE | FAN_DELETE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_FEATURE ("with created file already gone");
+	assert0 (unlink (filename));
+
+	fanotify_dispatch ("key", "foo", FAN_CREATE | FAN_CLOSE_WRITE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+
+	/* Check that the deletion of a watched file, or its move out of
+	 * the directory, is given to the delete handler.
+	 */
+	TEST_FEATURE ("with deleted file");
+	fanotify_dispatch ("key", "foo", FAN_DELETE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=delete",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+	TEST_FEATURE ("with file moved out");
+	fanotify_dispatch ("key", "foo", FAN_MOVED_FROM);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+
+	/* Check that events for the directory itself other than its
+	 * deletion are ignored.
+	 */
+	TEST_FEATURE ("with event for directory itself");
+	fanotify_dispatch ("key", NULL, FAN_CREATE | FAN_CLOSE_WRITE);
+	fanotify_dispatch ("key", ".", FAN_CREATE | FAN_CLOSE_WRITE);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	nih_free (dir);
+	assert0 (rmdir (dirname));
+
+	bridge_disconnect (pid, log);
+}
+
+
+void
+test_fanotify_reader (void)
+{
+	char             dirname[PATH_MAX];
+	char             filename[PATH_MAX];
+	char             key[FANOTIFY_KEY_MAX];
+	nih_local char  *expected = NULL;
+	struct {
+		struct file_handle  handle;
+		unsigned char       f_handle[8];
+	} buf;
+	const int        fsid[2] = { 0x1234, 0x5678 };
+	WatchedDir      *dir;
+	FILE            *output;
+	FILE            *log;
+	FILE            *f;
+	pid_t            pid;
+	char           **events;
+	size_t           len;
+	int              fds[2];
+
+	TEST_FUNCTION ("fanotify_reader");
+	program_name = "test";
+	output = tmpfile ();
+
+	pid = bridge_connect (&log);
+
+	TEST_FILENAME (dirname);
+	assert0 (mkdir (dirname, 0755));
+	sprintf (filename, "%s/foo", dirname);
+
+	buf.handle.handle_bytes = 8;
+	buf.handle.handle_type = 1;
+	memcpy (buf.handle.f_handle, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+
+	fanotify_key (key, fsid, &buf.handle);
+	TEST_EQ_STR (key, "0000123400005678:00000001:0102030405060708");
+
+	dir = fanotify_dir (dirname, key);
+
+	/* The events are read from a pipe standing in for the group */
+	assert0 (pipe2 (fds, O_NONBLOCK | O_CLOEXEC));
+	fanotify_fd = fds[0];
+
+	f = fopen (filename, "w");
+	assert (f != NULL);
+	fclose (f);
+
+
+	/* Check that each event read is dispatched to the directory with
+	 * the file handle and filesystem id it gives, with the name that
+	 * follows the handle.
+	 */
+	TEST_FEATURE ("with events for watched directory");
+	fanotify_event (fds[1], FAN_CREATE, fsid, &buf.handle, "foo");
+	fanotify_event (fds[1], FAN_CLOSE_WRITE, fsid, &buf.handle, "foo");
+
+	fanotify_reader (NULL, NULL, NIH_IO_READ);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 2);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=create",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=modify",
+					  filename));
+	TEST_EQ_STR (events[1], expected);
+	nih_free (events);
+
+
+	/* Check that events for another filesystem with the same handle
+	 * are ignored.
+	 */
+	TEST_FEATURE ("with event for other filesystem");
+	fanotify_event (fds[1], FAN_CLOSE_WRITE, (const int[2]){ 1, 2 },
+			&buf.handle, "foo");
+
+	fanotify_reader (NULL, NULL, NIH_IO_READ);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+
+	/* Check that an overflow of the queue is warned about, and that
+	 * events following it are still dispatched.
+	 */
+	TEST_FEATURE ("with queue overflow");
+	{
+		struct fanotify_event_metadata overflow;
+
+		memset (&overflow, 0, sizeof (overflow));
+		overflow.event_len = sizeof (overflow);
+		overflow.metadata_len = sizeof (overflow);
+		overflow.vers = FANOTIFY_METADATA_VERSION;
+		overflow.mask = FAN_Q_OVERFLOW;
+		overflow.fd = FAN_NOFD;
+
+		assert (write (fds[1], &overflow, sizeof (overflow))
+			== sizeof (overflow));
+	}
+	assert0 (unlink (filename));
+	fanotify_event (fds[1], FAN_DELETE, fsid, &buf.handle, "foo");
+
+	TEST_DIVERT_STDERR (output) {
+		fanotify_reader (NULL, NULL, NIH_IO_READ);
+	}
+	rewind (output);
+
+	TEST_FILE_EQ (output, "test: fanotify queue overflowed, events lost\n");
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=delete",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+	fanotify_fd = -1;
+	close (fds[0]);
+	close (fds[1]);
+
+	fclose (output);
+
+	nih_free (dir);
+	assert0 (rmdir (dirname));
+
+	bridge_disconnect (pid, log);
+}
+
+
+void
+test_fanotify_watch (void)
+{
+	char             dirname[PATH_MAX];
+	char             filename[PATH_MAX];
+	char            *file_info[4];
+	nih_local char  *event = NULL;
+	nih_local char  *expected = NULL;
+	NihIoWatch      *io_watch;
+	WatchedFile     *file;
+	WatchedDir      *dir;
+	Job             *job;
+	FILE            *output;
+	FILE            *log;
+	FILE            *f;
+	pid_t            pid;
+	char           **events;
+	size_t           len;
+	int              fds[2];
+
+	TEST_FUNCTION ("fanotify_watch");
+	program_name = "test";
+	output = tmpfile ();
+
+	pid = bridge_connect (&log);
+
+	if (! jobs)
+		jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	TEST_FILENAME (dirname);
+	assert0 (mkdir (dirname, 0755));
+	sprintf (filename, "%s/foo", dirname);
+
+	event = NIH_MUST (nih_sprintf (NULL, "FILE=%s", filename));
+
+	file_info[0] = FILE_EVENT;
+	file_info[1] = event;
+	file_info[2] = "EVENT=create";
+	file_info[3] = NULL;
+
+
+	/* Check that a directory is watched through inotify instead when
+	 * its filesystem cannot be marked, here since the descriptor is
+	 * not a fanotify group at all, and that its events are then
+	 * handled as before.
+	 */
+	TEST_FEATURE ("with filesystem that cannot be marked");
+	assert0 (pipe2 (fds, O_CLOEXEC));
+	fanotify_fd = fds[0];
+
+	job = job_new ("/com/ubuntu/Upstart/jobs/test");
+
+	TEST_DIVERT_STDERR (output) {
+		job_add_file (job, file_info);
+	}
+	rewind (output);
+
+	TEST_LIST_NOT_EMPTY (&job->files);
+	file = ((NihListEntry *)job->files.next)->data;
+
+	dir = file->parent;
+	TEST_NE_P (dir, NULL);
+	TEST_NE_P (dir->watch, NULL);
+	TEST_EQ_P (dir->handle, NULL);
+
+	if (fanotify_marks)
+		TEST_HASH_EMPTY (fanotify_marks);
+
+	fanotify_fd = -1;
+	close (fds[0]);
+	close (fds[1]);
+
+	f = fopen (filename, "w");
+	assert (f != NULL);
+	fclose (f);
+
+	run_main_loop (1);
+
+	events = fake_upstart_events (NULL, upstart->connection, log, &len);
+	TEST_EQ (len, 1);
+	expected = NIH_MUST (nih_sprintf (NULL, "file FILE=%s EVENT=create",
+					  filename));
+	TEST_EQ_STR (events[0], expected);
+	nih_free (events);
+
+	assert0 (unlink (filename));
+	nih_free (job);
+	nih_free (dir);
+
+	TEST_FILE_RESET (output);
+
+
+	/* Check that with a fanotify group, the directory is watched
+	 * through it rather than inotify, and a file created in it is
+	 * reported just the same.  Marking a filesystem needs privilege.
+	 */
+	TEST_FEATURE ("with fanotify group");
+	fanotify_fd = fanotify_init (FAN_CLASS_NOTIF | FAN_CLOEXEC
+				     | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+				     O_RDONLY | O_CLOEXEC);
+	if (fanotify_fd < 0) {
+		printf ("INFO: skipping %s fanotify test: %s\n",
+			__func__, strerror (errno));
+		fflush (NULL);
+		goto out;
+	}
+
+	io_watch = NIH_MUST (nih_io_add_watch (NULL, fanotify_fd, NIH_IO_READ,
+					       fanotify_reader, NULL));
+
+	job = job_new ("/com/ubuntu/Upstart/jobs/test");
+
+	TEST_DIVERT_STDERR (output) {
+		job_add_file (job, file_info);
+	}
+	rewind (output);
+
+	TEST_LIST_NOT_EMPTY (&job->files);
+	file = ((NihListEntry *)job->files.next)->data;
+
+	dir = file->parent;
+	TEST_NE_P (dir, NULL);
+
+	if (! dir->handle) {
+		printf ("INFO: skipping %s fanotify test: "
+			"filesystem of %s cannot be marked\n",
+			__func__, dirname);
+		fflush (NULL);
+	} else {
+		TEST_EQ_P (dir->watch, NULL);
+		TEST_EQ_P (dir->handle->dir, dir);
+		TEST_EQ_P (nih_hash_lookup (fanotify_dirs, dir->handle->key),
+			   dir->handle);
+
+		f = fopen (filename, "w");
+		assert (f != NULL);
+		fclose (f);
+
+		run_main_loop (1);
+
+		events = fake_upstart_events (NULL, upstart->connection, log,
+					      &len);
+		TEST_EQ (len, 1);
+		TEST_EQ_STR (events[0], expected);
+		nih_free (events);
+
+		assert0 (unlink (filename));
+	}
+
+	nih_free (job);
+	nih_free (dir);
+	nih_free (io_watch);
+
+	close (fanotify_fd);
+	fanotify_fd = -1;
+
+out:
+	TEST_FILE_RESET (output);
+	fclose (output);
+
+	assert0 (rmdir (dirname));
+
+	bridge_disconnect (pid, log);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_lookup ();
+	test_shared_prefix ();
+	test_prune ();
+	test_find ();
+	test_queue_event ();
+	test_job_add_file ();
+	test_fanotify_dispatch ();
+	test_fanotify_reader ();
+	test_fanotify_watch ();
+
+	return 0;
+}
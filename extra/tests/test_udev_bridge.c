@@ -0,0 +1,313 @@
+/* upstart
+ *
+ * test_udev_bridge.c - test suite for extra/upstart-udev-bridge.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+/* The bridge is a single program, so include it whole to reach the
+ * static coalescing functions; its main() is renamed out of the way.
+ */
+#define main udev_bridge_main
+#include "upstart-udev-bridge.c"
+#undef main
+
+#include "test_util.h"
+
+
+/**
+ * TestUevent:
+ * @action: action of uevent,
+ * @devpath: device path of uevent.
+ *
+ * Uevent given to receive_uevents().
+ **/
+typedef struct test_uevent {
+	const char *action;
+	const char *devpath;
+} TestUevent;
+
+/**
+ * seqnum:
+ *
+ * Sequence number of the last uevent made by receive_uevents(), so that
+ * the tests can tell which of several changes of a device was emitted.
+ **/
+static int seqnum = 0;
+
+
+static int
+strcmp_compar (const void *a,
+	       const void *b)
+{
+	return strcmp (*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * receive_uevents:
+ * @uevents: uevents, terminated by one with a NULL action.
+ *
+ * Handles @uevents as udev_monitor_watcher() does those it receives in
+ * one go, the event for each being named "test-device-ACTION" with
+ * DEVPATH and SEQNUM in its environment.
+ **/
+static void
+receive_uevents (const TestUevent *uevents)
+{
+	nih_local UpstartEmitEventsEventsElement **batch = NULL;
+	size_t                                     batch_len = 0;
+	const TestUevent *                         uevent;
+
+	batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+	batch[0] = NULL;
+
+	for (uevent = uevents; uevent->action; uevent++) {
+		UpstartEmitEventsEventsElement *event;
+
+		event = NIH_MUST (nih_new (batch, UpstartEmitEventsEventsElement));
+		event->item0 = NIH_MUST (nih_sprintf (event, "test-device-%s",
+						      uevent->action));
+
+		event->item1 = NIH_MUST (nih_alloc (event, sizeof (char *) * 3));
+		event->item1[0] = NIH_MUST (nih_sprintf (event->item1,
+							 "DEVPATH=%s",
+							 uevent->devpath));
+		event->item1[1] = NIH_MUST (nih_sprintf (event->item1,
+							 "SEQNUM=%d",
+							 ++seqnum));
+		event->item1[2] = NULL;
+
+		coalesce_event (&batch, &batch_len, event, uevent->devpath,
+				! strcmp (uevent->action, "change"));
+	}
+
+	emit_batch (batch, batch_len);
+}
+
+/**
+ * run_main_loop:
+ * @seconds: seconds to run for.
+ *
+ * Runs the main loop, so that timers fire and replies are handled, for
+ * @seconds.
+ **/
+static void
+run_main_loop (int seconds)
+{
+	assert (nih_timer_add_timeout (NULL, seconds,
+				       (NihTimerCb)nih_main_term_signal, NULL));
+	nih_main_loop ();
+}
+
+
+void
+test_coalesce_event (void)
+{
+	DBusConnection  *conn;
+	FILE            *log;
+	char             address[PATH_MAX];
+	pid_t            pid;
+	char           **events;
+	size_t           len;
+
+	TEST_FUNCTION ("coalesce_event");
+	sprintf (address, "unix:abstract=/com/ubuntu/upstart/test/udev-bridge-%d",
+		 getpid ());
+
+	pid = fake_upstart_start (address, TRUE, &log);
+
+	conn = nih_dbus_connect (address, NULL);
+	assert (conn != NULL);
+
+	upstart = nih_dbus_proxy_new (NULL, conn, NULL, DBUS_PATH_UPSTART,
+				      NULL, NULL);
+	assert (upstart != NULL);
+
+	coalesce = 1;
+
+
+	/* Check that repeated changes of a device within the window are
+	 * held back, only the latest being emitted once it has passed.
+	 */
+	TEST_FEATURE ("with repeated changes of device");
+	seqnum = 0;
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { NULL, NULL } });
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { "change", "/devices/a" },
+					  { NULL, NULL } });
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_NE_P (pending_timer, NULL);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0],
+		     "test-device-change DEVPATH=/devices/a SEQNUM=3");
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+	TEST_HASH_EMPTY (pending_changes);
+
+
+	/* Check that another uevent for a device causes the change held
+	 * back for it to be emitted first, in the same method call, so
+	 * that the two are still emitted in order.
+	 */
+	TEST_FEATURE ("with other uevent for device");
+	seqnum = 0;
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { NULL, NULL } });
+	receive_uevents ((TestUevent []){ { "remove", "/devices/a" },
+					  { NULL, NULL } });
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 3);
+	TEST_EQ_STR (events[0], "EmitEvents 2");
+	TEST_EQ_STR (events[1],
+		     "test-device-change DEVPATH=/devices/a SEQNUM=1");
+	TEST_EQ_STR (events[2],
+		     "test-device-remove DEVPATH=/devices/a SEQNUM=2");
+	nih_free (events);
+
+	TEST_HASH_EMPTY (pending_changes);
+
+	/* The timer is still due, but finds nothing to emit */
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+
+
+	/* Check that another uevent received along with a change of the
+	 * same device is still emitted after it.
+	 */
+	TEST_FEATURE ("with other uevent in same batch");
+	seqnum = 0;
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { "change", "/devices/a" },
+					  { "remove", "/devices/a" },
+					  { NULL, NULL } });
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 3);
+	TEST_EQ_STR (events[0], "EmitEvents 2");
+	TEST_EQ_STR (events[1],
+		     "test-device-change DEVPATH=/devices/a SEQNUM=2");
+	TEST_EQ_STR (events[2],
+		     "test-device-remove DEVPATH=/devices/a SEQNUM=3");
+	nih_free (events);
+
+	TEST_HASH_EMPTY (pending_changes);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+
+	/* Check that a uevent for another device is emitted at once,
+	 * leaving the change held back for the first device alone.
+	 */
+	TEST_FEATURE ("with uevent for other device");
+	seqnum = 0;
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { NULL, NULL } });
+	receive_uevents ((TestUevent []){ { "add", "/devices/b" },
+					  { NULL, NULL } });
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0], "test-device-add DEVPATH=/devices/b SEQNUM=2");
+	nih_free (events);
+
+	TEST_NE_P (nih_hash_lookup (pending_changes, "/devices/a"), NULL);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 1);
+	TEST_EQ_STR (events[0],
+		     "test-device-change DEVPATH=/devices/a SEQNUM=1");
+	nih_free (events);
+
+	TEST_HASH_EMPTY (pending_changes);
+
+
+	/* Check that changes of several devices are each held back, and
+	 * that they are emitted together with a single method call once
+	 * the window has passed.
+	 */
+	TEST_FEATURE ("with changes of several devices");
+	seqnum = 0;
+	receive_uevents ((TestUevent []){ { "change", "/devices/a" },
+					  { "change", "/devices/b" },
+					  { "change", "/devices/a" },
+					  { NULL, NULL } });
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 0);
+	nih_free (events);
+
+	run_main_loop (2);
+
+	events = fake_upstart_events (NULL, conn, log, &len);
+	TEST_EQ (len, 3);
+	TEST_EQ_STR (events[0], "EmitEvents 2");
+
+	/* Order of the hash is not defined */
+	qsort (events + 1, 2, sizeof (char *), strcmp_compar);
+	TEST_EQ_STR (events[1],
+		     "test-device-change DEVPATH=/devices/a SEQNUM=3");
+	TEST_EQ_STR (events[2],
+		     "test-device-change DEVPATH=/devices/b SEQNUM=2");
+	nih_free (events);
+
+	TEST_EQ_P (pending_timer, NULL);
+	TEST_HASH_EMPTY (pending_changes);
+
+
+	coalesce = 0;
+
+	nih_free (upstart);
+	upstart = NULL;
+
+	dbus_connection_close (conn);
+	dbus_connection_unref (conn);
+
+	fake_upstart_stop (pid, log);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_coalesce_event ();
+
+	return 0;
+}
@@ -0,0 +1,303 @@
+/* upstart
+ *
+ * test_util.c - common functions for the bridge test suites
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <dbus/dbus.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/main.h>
+
+#include <nih-dbus/dbus_connection.h>
+
+#include "dbus/upstart.h"
+
+#include "test_util.h"
+
+
+/**
+ * FAKE_UPSTART_MARKER:
+ *
+ * Name of the event sent by fake_upstart_events() to find the end of
+ * those emitted before it.
+ **/
+#define FAKE_UPSTART_MARKER "fake-upstart-marker"
+
+/**
+ * fake_upstart_log:
+ *
+ * Stream the fake Upstart writes the events it receives to.
+ **/
+static FILE *fake_upstart_log = NULL;
+
+/**
+ * fake_upstart_emit_events:
+ *
+ * FALSE if the fake Upstart should reply to EmitEvents as an Upstart
+ * that predates the method would.
+ **/
+static int fake_upstart_emit_events = TRUE;
+
+
+/**
+ * fake_upstart_log_event:
+ * @iter: iterator at name of event.
+ *
+ * Writes the name and environment of the event at @iter to the log as
+ * a single line separated by spaces.
+ **/
+static void
+fake_upstart_log_event (DBusMessageIter *iter)
+{
+	DBusMessageIter  env_iter;
+	const char      *str;
+
+	assert (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_STRING);
+	dbus_message_iter_get_basic (iter, &str);
+	fprintf (fake_upstart_log, "%s", str);
+
+	assert (dbus_message_iter_next (iter));
+	assert (dbus_message_iter_get_arg_type (iter) == DBUS_TYPE_ARRAY);
+	dbus_message_iter_recurse (iter, &env_iter);
+
+	while (dbus_message_iter_get_arg_type (&env_iter) == DBUS_TYPE_STRING) {
+		dbus_message_iter_get_basic (&env_iter, &str);
+		fprintf (fake_upstart_log, " %s", str);
+		dbus_message_iter_next (&env_iter);
+	}
+
+	fprintf (fake_upstart_log, "\n");
+}
+
+/**
+ * fake_upstart_filter:
+ *
+ * Logs each event emitted by the client, a batch given to EmitEvents
+ * being preceded by a line giving its size, and replies.
+ **/
+static DBusHandlerResult
+fake_upstart_filter (DBusConnection *conn,
+		     DBusMessage    *message,
+		     void           *data)
+{
+	DBusMessageIter  iter;
+	DBusMessageIter  array_iter;
+	DBusMessageIter  struct_iter;
+	DBusMessage     *reply;
+	const char      *member;
+	size_t           len = 0;
+
+	if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	member = dbus_message_get_member (message);
+	assert (dbus_message_iter_init (message, &iter));
+
+	if (! strcmp (member, "EmitEvent")) {
+		fake_upstart_log_event (&iter);
+		reply = dbus_message_new_method_return (message);
+	} else if (! strcmp (member, "EmitEvents")
+		   && fake_upstart_emit_events) {
+		dbus_message_iter_recurse (&iter, &array_iter);
+		while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT) {
+			len++;
+			dbus_message_iter_next (&array_iter);
+		}
+
+		fprintf (fake_upstart_log, "EmitEvents %zu\n", len);
+
+		dbus_message_iter_recurse (&iter, &array_iter);
+		while (dbus_message_iter_get_arg_type (&array_iter) == DBUS_TYPE_STRUCT) {
+			dbus_message_iter_recurse (&array_iter, &struct_iter);
+			fake_upstart_log_event (&struct_iter);
+			dbus_message_iter_next (&array_iter);
+		}
+
+		reply = dbus_message_new_method_return (message);
+	} else {
+		reply = dbus_message_new_error (message,
+						DBUS_ERROR_UNKNOWN_METHOD,
+						"Unknown method");
+	}
+
+	fflush (fake_upstart_log);
+
+	assert (reply != NULL);
+	assert (dbus_connection_send (conn, reply, NULL));
+	dbus_message_unref (reply);
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static int
+fake_upstart_connect (DBusServer     *server,
+		      DBusConnection *conn)
+{
+	assert (dbus_connection_add_filter (conn, fake_upstart_filter,
+					    NULL, NULL));
+
+	return TRUE;
+}
+
+/**
+ * fake_upstart_start:
+ * @address: address to listen on,
+ * @emit_events: FALSE to reject EmitEvents as an unknown method,
+ * @log: set to stream of events received.
+ *
+ * Starts a child process acting as Upstart, which writes each event it
+ * is asked to emit to @log as its name followed by its environment.
+ *
+ * Returns: pid of child.
+ **/
+pid_t
+fake_upstart_start (const char  *address,
+		    int          emit_events,
+		    FILE       **log)
+{
+	DBusServer *server;
+	pid_t       pid;
+	int         fds[2];
+	int         wait_fd = -1;
+
+	nih_assert (address != NULL);
+	nih_assert (log != NULL);
+
+	assert0 (pipe (fds));
+
+	fake_upstart_emit_events = emit_events;
+
+	TEST_CHILD_WAIT (pid, wait_fd) {
+		close (fds[0]);
+		fake_upstart_log = fdopen (fds[1], "w");
+		assert (fake_upstart_log != NULL);
+
+		server = nih_dbus_server (address, fake_upstart_connect,
+					  NULL);
+		assert (server != NULL);
+
+		TEST_CHILD_RELEASE (wait_fd);
+
+		nih_main_loop ();
+
+		_exit (0);
+	}
+
+	close (fds[1]);
+	*log = fdopen (fds[0], "r");
+	assert (*log != NULL);
+
+	return pid;
+}
+
+/**
+ * fake_upstart_events:
+ * @parent: parent object for new array,
+ * @conn: connection to the fake Upstart,
+ * @log: stream of events received by it,
+ * @len: set to number of lines returned.
+ *
+ * Sends a marker event over @conn, which is received after everything
+ * sent before it, then reads the lines logged up to that marker.
+ *
+ * Returns: newly allocated NULL-terminated array of lines, without
+ * their newlines.
+ **/
+char **
+fake_upstart_events (const void      *parent,
+		     DBusConnection  *conn,
+		     FILE            *log,
+		     size_t          *len)
+{
+	DBusMessage      *message;
+	DBusMessageIter   iter;
+	DBusMessageIter   env_iter;
+	const char       *name = FAKE_UPSTART_MARKER;
+	dbus_bool_t       wait_for = FALSE;
+	char            **lines;
+	char              line[4096];
+
+	nih_assert (conn != NULL);
+	nih_assert (log != NULL);
+	nih_assert (len != NULL);
+
+	message = dbus_message_new_method_call (NULL, DBUS_PATH_UPSTART,
+						DBUS_INTERFACE_UPSTART,
+						"EmitEvent");
+	assert (message != NULL);
+
+	dbus_message_iter_init_append (message, &iter);
+	assert (dbus_message_iter_append_basic (&iter, DBUS_TYPE_STRING,
+						&name));
+	assert (dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+						  "s", &env_iter));
+	assert (dbus_message_iter_close_container (&iter, &env_iter));
+	assert (dbus_message_iter_append_basic (&iter, DBUS_TYPE_BOOLEAN,
+						&wait_for));
+
+	dbus_message_set_no_reply (message, TRUE);
+	assert (dbus_connection_send (conn, message, NULL));
+	dbus_connection_flush (conn);
+	dbus_message_unref (message);
+
+	*len = 0;
+	lines = NIH_MUST (nih_str_array_new (parent));
+
+	while (fgets (line, sizeof (line), log)) {
+		line[strcspn (line, "\n")] = '\0';
+
+		if (! strcmp (line, FAKE_UPSTART_MARKER))
+			return lines;
+
+		NIH_MUST (nih_str_array_add (&lines, parent, len, line));
+	}
+
+	nih_assert_not_reached ();
+}
+
+/**
+ * fake_upstart_stop:
+ * @pid: pid of fake Upstart,
+ * @log: stream of events received by it.
+ *
+ * Stops the fake Upstart started by fake_upstart_start().
+ **/
+void
+fake_upstart_stop (pid_t  pid,
+		   FILE  *log)
+{
+	int status;
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+
+	fclose (log);
+}
@@ -0,0 +1,20 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <dbus/dbus.h>
+
+/* Prototypes */
+pid_t fake_upstart_start (const char *address, int emit_events,
+			  FILE **log)
+	__attribute__ ((warn_unused_result));
+
+char **fake_upstart_events (const void *parent, DBusConnection *conn,
+			    FILE *log, size_t *len)
+	__attribute__ ((warn_unused_result));
+
+void fake_upstart_stop (pid_t pid, FILE *log);
+
+#endif /* TEST_UTIL_H */
@@ -52,6 +52,40 @@
  **/
 #define DBUS_EVENT "dbus"
 
+/**
+ * Structure we use for tracking jobs
+ *
+ * @entry: list header, 
+ * @path: D-Bus path of job being tracked,
+ * @rules: NULL-terminated list of match rules added for the job,
+ * @signals: NULL-terminated list of names of signals the job's
+ * conditions match,
+ * @any_signal: TRUE if any of the job's conditions match any signal.
+ **/
+typedef struct job {
+	NihList   entry;
+	char     *path;
+	char    **rules;
+	char    **signals;
+	int       any_signal;
+} Job;
+
+/**
+ * Subscription:
+ *
+ * @entry: list header,
+ * @key: match rule or signal name,
+ * @refs: number of jobs that need @key.
+ *
+ * Structure we use for counting the jobs that need each match rule
+ * and each signal name.
+ **/
+typedef struct subscription {
+	NihList  entry;
+	char    *key;
+	int      refs;
+} Subscription;
+
 /* Prototypes for static functions */
 static int               bus_name_setter      (NihOption *option, const char *arg);
 static int               dbus_bus_setter      (NihOption *option, const char *arg);
@@ -64,6 +98,13 @@ static void              upstart_job_added    (void *data, NihDBusMessage *messa
 					       const char *job);
 static void              upstart_job_removed  (void *data, NihDBusMessage *message,
 					       const char *job);
+static int               job_destroy          (Job *job);
+static char *            job_condition_rule   (const void *parent,
+					       char * const *operand,
+					       const char **signal)
+	__attribute__ ((warn_unused_result));
+static int               subscription_ref     (NihHash *hash, const char *key);
+static int               subscription_unref   (NihHash *hash, const char *key);
 
 /**
  * daemonise:
@@ -102,22 +143,41 @@ DBusBusType dbus_bus = (DBusBusType)-1;
 static const char * bus_name = NULL;
 
 /**
- * Structure we use for tracking jobs
+ * jobs:
  *
- * @entry: list header, 
- * @path: D-Bus path of job being tracked.
+ * Jobs that we're monitoring.
  **/
-typedef struct job {
-	NihList entry;
-	char *path;
-} Job;
+static NihHash *jobs = NULL;
 
 /**
- * jobs:
+ * matches:
  *
- * Jobs that we're monitoring.
+ * Match rules added to the bus for jobs, as Subscription objects.
  **/
-static NihHash *jobs = NULL;
+static NihHash *matches = NULL;
+
+/**
+ * signals:
+ *
+ * Names of the signals that jobs match, as Subscription objects, so that
+ * other signals delivered by a broader rule can be dropped without
+ * looking at the jobs.
+ **/
+static NihHash *signals = NULL;
+
+/**
+ * any_signal:
+ *
+ * Number of jobs with a condition that matches any signal.
+ **/
+static int any_signal = 0;
+
+/**
+ * bus_connection:
+ *
+ * Connection to the D-Bus bus that signals are bridged from.
+ **/
+static DBusConnection *bus_connection = NULL;
 
 /**
  * always:
@@ -198,14 +258,21 @@ main (int   argc,
 		exit (EXIT_FAILURE);
 	}
 
-	dbus_bus_add_match (dbus_connection, "type='signal'", &error);
+	bus_connection = dbus_connection;
 
-	if (dbus_error_is_set (&error)) {
-		nih_fatal ("%s: %s %s", _("Could not add D-Bus signal match"),
-			   error.name, error.message);
-		dbus_error_free (&error);
+	/* Otherwise match rules are added for the signals that each job
+	 * needs as it is added.
+	 */
+	if (always) {
+		dbus_bus_add_match (dbus_connection, "type='signal'", &error);
 
-		exit (EXIT_FAILURE);
+		if (dbus_error_is_set (&error)) {
+			nih_fatal ("%s: %s %s", _("Could not add D-Bus signal match"),
+				   error.name, error.message);
+			dbus_error_free (&error);
+
+			exit (EXIT_FAILURE);
+		}
 	}
 
 	dbus_connection_add_filter (dbus_connection, signal_filter, NULL, NULL);
@@ -238,6 +305,8 @@ main (int   argc,
 
 	/* Allocate jobs hash table */
 	jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+	matches = NIH_MUST (nih_hash_string_new (NULL, 0));
+	signals = NIH_MUST (nih_hash_string_new (NULL, 0));
 
 	upstart = NIH_SHOULD (nih_dbus_proxy_new (NULL, connection,
 				NULL, DBUS_PATH_UPSTART,
@@ -441,7 +510,6 @@ signal_filter (DBusConnection  *connection,
 	       DBusMessage     *message,
 	       void            *user_data)
 {
-	int                 emit = FALSE;
 	DBusPendingCall    *pending_call;
 	DBusError           error;
 	DBusMessageIter     message_iter;
@@ -456,21 +524,18 @@ signal_filter (DBusConnection  *connection,
 	nih_assert (connection);
 	nih_assert (message);
 
-	if (! always) {
-		NIH_HASH_FOREACH (jobs, iter) {
-			emit = TRUE;
-			break;
-		}
+	signal = dbus_message_get_member (message);
 
-		/* No jobs care about DBUS_EVENT, so ignore it */
-		if (! emit)
+	if (! always) {
+		/* No jobs care about this signal, so ignore it */
+		if ((! any_signal)
+		    && ! (signal && nih_hash_lookup (signals, signal)))
 			goto out;
 	}
 
 	dbus_error_init (&error);
 
 	sender = dbus_message_get_sender (message);
-	signal = dbus_message_get_member (message);
 	interface = dbus_message_get_interface (message);
 	path = dbus_message_get_path (message);
 	destination = dbus_message_get_destination (message);
@@ -670,6 +735,7 @@ upstart_job_added (void            *data,
 	int                       add = FALSE;
 
 	Job                      *job;
+	Job                      *old_job;
 	nih_local NihDBusProxy   *job_class = NULL;
 	nih_local char         ***start_on = NULL;
 	nih_local char         ***stop_on = NULL;
@@ -716,38 +782,82 @@ upstart_job_added (void            *data,
 		return;
 	}
 
-	/* Find out whether this job listens for any DBUS events */
-	for (char ***event = start_on; event && *event && **event; event++)
-		if (! strcmp (**event, DBUS_EVENT)) {
+	/* Create new record for the job, with a match rule for each
+	 * DBUS event in its conditions.
+	 */
+	job = NIH_MUST (nih_new (NULL, Job));
+	job->path = NIH_MUST (nih_strdup (job, job_class_path));
+	job->rules = NIH_MUST (nih_str_array_new (job));
+	job->signals = NIH_MUST (nih_str_array_new (job));
+	job->any_signal = FALSE;
+
+	nih_list_init (&job->entry);
+
+	for (int i = 0; i < 2; i++) {
+		char ***condition = i ? stop_on : start_on;
+
+		for (char ***event = condition; event && *event && **event; event++) {
+			nih_local char *rule = NULL;
+			const char     *signal = NULL;
+
+			if (strcmp (**event, DBUS_EVENT))
+				continue;
+
 			add = TRUE;
-			break;
+
+			rule = NIH_MUST (job_condition_rule (NULL, *event, &signal));
+			NIH_MUST (nih_str_array_add (&job->rules, job, NULL, rule));
+
+			if (signal) {
+				NIH_MUST (nih_str_array_add (&job->signals, job,
+							     NULL, signal));
+			} else {
+				job->any_signal = TRUE;
+			}
 		}
+	}
 
-	for (char ***event = stop_on; ! add && event && *event && **event; event++)
-		if (! strcmp (**event, DBUS_EVENT)) {
-			add = TRUE;
-			break;
+	if (! add) {
+		nih_free (job);
+		job = NULL;
+	} else {
+		nih_debug ("Job got added %s for event %s", job_class_path, DBUS_EVENT);
+
+		for (char **rule = job->rules; *rule; rule++) {
+			DBusError error;
+
+			if ((! subscription_ref (matches, *rule)) || always)
+				continue;
+
+			dbus_error_init (&error);
+			dbus_bus_add_match (bus_connection, *rule, &error);
+
+			if (dbus_error_is_set (&error)) {
+				nih_warn ("%s: %s: %s", _("Could not add D-Bus signal match"),
+					  *rule, error.message);
+				dbus_error_free (&error);
+			}
 		}
 
-	if (! add)
-		return;
+		for (char **signal = job->signals; *signal; signal++)
+			subscription_ref (signals, *signal);
 
-	nih_debug ("Job got added %s for event %s", job_class_path, DBUS_EVENT);
+		if (job->any_signal)
+			any_signal++;
+	}
 
 	/* Free any existing record for the job (should never happen,
-	 * but worth being safe).
+	 * but worth being safe); only once the new one holds its match
+	 * rules, so that signals are not lost in between.
 	 */
-	job = (Job *)nih_hash_lookup (jobs, job_class_path);
-	if (job)
-		nih_free (job);
-
-	/* Create new record for the job */
-	job = NIH_MUST (nih_new (NULL, Job));
-	job->path = NIH_MUST (nih_strdup (job, job_class_path));
+	old_job = (Job *)nih_hash_lookup (jobs, job_class_path);
+	if (old_job)
+		nih_free (old_job);
 
-	nih_list_init (&job->entry);
-	nih_alloc_set_destructor (job, nih_list_destroy);
-	nih_hash_add (jobs, &job->entry);
+	if (job) {
+		nih_alloc_set_destructor (job, job_destroy);
+		nih_hash_add (jobs, &job->entry);
+	}
 }
 
 static void
@@ -766,3 +876,181 @@ upstart_job_removed (void            *data,
 	}
 }
 
+/**
+ * job_destroy:
+ * @job: job being destroyed.
+ *
+ * Destructor for Job that removes it from the jobs hash and drops its
+ * references to match rules and signal names, removing the match rules
+ * from the bus that no other job needs.
+ *
+ * Returns: zero.
+ **/
+static int
+job_destroy (Job *job)
+{
+	nih_assert (job != NULL);
+
+	nih_list_destroy (&job->entry);
+
+	for (char **rule = job->rules; rule && *rule; rule++) {
+		if ((! subscription_unref (matches, *rule)) || always)
+			continue;
+
+		/* Don't wait for the reply */
+		dbus_bus_remove_match (bus_connection, *rule, NULL);
+	}
+
+	for (char **signal = job->signals; signal && *signal; signal++)
+		subscription_unref (signals, *signal);
+
+	if (job->any_signal)
+		any_signal--;
+
+	return 0;
+}
+
+/**
+ * job_condition_rule:
+ * @parent: parent object for new string,
+ * @operand: DBUS_EVENT operand of a job condition,
+ * @signal: pointer to set to the signal name matched.
+ *
+ * Derive the D-Bus match rule for the signals that could match @operand
+ * from those of its environment matches that compare SIGNAL, INTERFACE,
+ * OBJPATH and SENDER exactly; matches using globs or negation, and those
+ * of other variables, are left for Upstart to check.  The first match
+ * without a name is taken as SIGNAL, since that is always first in the
+ * environment of the event.
+ *
+ * @signal is set to point into @operand when the signal name is matched
+ * exactly, or to NULL when any signal could match.
+ *
+ * Returns: newly allocated match rule or NULL if insufficient memory.
+ **/
+static char *
+job_condition_rule (const void    *parent,
+		    char * const  *operand,
+		    const char   **signal)
+{
+	char *rule;
+
+	nih_assert (operand != NULL);
+	nih_assert (*operand != NULL);
+	nih_assert (signal != NULL);
+
+	*signal = NULL;
+
+	rule = nih_strdup (parent, "type='signal'");
+	if (! rule)
+		return NULL;
+
+	for (int i = 1; operand[i]; i++) {
+		const char *arg = operand[i];
+		const char *value;
+		const char *key;
+		size_t      len;
+
+		value = strchr (arg, '=');
+		if (! value) {
+			if (i > 1)
+				continue;
+
+			key = "member";
+			value = arg;
+		} else {
+			len = value - arg;
+			value++;
+
+			if (len == strlen ("SIGNAL") && ! strncmp (arg, "SIGNAL", len)) {
+				key = "member";
+			} else if (len == strlen ("INTERFACE") && ! strncmp (arg, "INTERFACE", len)) {
+				key = "interface";
+			} else if (len == strlen ("OBJPATH") && ! strncmp (arg, "OBJPATH", len)) {
+				key = "path";
+			} else if (len == strlen ("SENDER") && ! strncmp (arg, "SENDER", len)) {
+				key = "sender";
+			} else {
+				/* Includes negated matches, whose name ends with '!' */
+				continue;
+			}
+		}
+
+		if ((! *value) || strpbrk (value, "*?[\\'"))
+			continue;
+
+		if (! strcmp (key, "member"))
+			*signal = value;
+
+		if (! nih_strcat_sprintf (&rule, parent, ",%s='%s'", key, value)) {
+			nih_free (rule);
+			return NULL;
+		}
+	}
+
+	return rule;
+}
+
+/**
+ * subscription_ref:
+ * @hash: hash of Subscription objects,
+ * @key: match rule or signal name.
+ *
+ * Add a reference to @key in @hash, adding it if necessary.
+ *
+ * Returns: TRUE if @key was added to @hash, FALSE if it was already there.
+ **/
+static int
+subscription_ref (NihHash    *hash,
+		  const char *key)
+{
+	Subscription *subscription;
+
+	nih_assert (hash != NULL);
+	nih_assert (key != NULL);
+
+	subscription = (Subscription *)nih_hash_lookup (hash, key);
+	if (subscription) {
+		subscription->refs++;
+		return FALSE;
+	}
+
+	subscription = NIH_MUST (nih_new (hash, Subscription));
+	subscription->key = NIH_MUST (nih_strdup (subscription, key));
+	subscription->refs = 1;
+
+	nih_list_init (&subscription->entry);
+	nih_alloc_set_destructor (subscription, nih_list_destroy);
+	nih_hash_add (hash, &subscription->entry);
+
+	return TRUE;
+}
+
+/**
+ * subscription_unref:
+ * @hash: hash of Subscription objects,
+ * @key: match rule or signal name.
+ *
+ * Drop a reference to @key in @hash, removing it once no references
+ * remain.
+ *
+ * Returns: TRUE if @key was removed from @hash, otherwise FALSE.
+ **/
+static int
+subscription_unref (NihHash    *hash,
+		    const char *key)
+{
+	Subscription *subscription;
+
+	nih_assert (hash != NULL);
+	nih_assert (key != NULL);
+
+	subscription = (Subscription *)nih_hash_lookup (hash, key);
+	if ((! subscription) || (--subscription->refs > 0))
+		return FALSE;
+
+	nih_free (subscription);
+
+	return TRUE;
+}
+
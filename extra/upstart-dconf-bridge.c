@@ -67,23 +67,73 @@ static void handle_upstart_job (GDBusProxy *proxy, gchar *sender_name,
 static int handle_existing_jobs (GDBusProxy *upstart_proxy)
 	__attribute__ ((warn_unused_result));
 
-static int job_needs_event (const char *object_path)
+static char **job_watch_paths (const void *parent, const char *class_path)
 	__attribute__ ((warn_unused_result));
 
+static int condition_watch_paths (char ***paths, GVariant *conditions);
+
+static char *watch_path (const void *parent, const char *key)
+	__attribute__ ((warn_unused_result, malloc));
+
 static int jobs_need_event (void)
 	__attribute__ ((warn_unused_result));
 
+static void update_watches (void);
+
+static void add_watch (NihHash *hash, const char *path);
+
+static int path_covered (NihHash *hash, const char *path)
+	__attribute__ ((warn_unused_result));
+
+static int key_named (const char *key)
+	__attribute__ ((warn_unused_result));
+
+static void queue_change (const char *key);
+
+static void emit_pending (GDBusProxy *upstart);
+
+static void emit_change (GDBusProxy *upstart, const char *path,
+			 char * const *keys);
+
+static gboolean coalesce_timeout (gpointer data);
+
 /**
  * Structure we use for tracking jobs
  *
  * @entry: list header, 
- * @path: D-Bus path of job being tracked.
+ * @path: D-Bus path of job being tracked,
+ * @paths: dconf keys and directories named by the job's dconf conditions.
  **/
 typedef struct job {
 	NihList entry;
 	char *path;
+	char **paths;
 } Job;
 
+/**
+ * Watch:
+ * @entry: list header,
+ * @path: dconf key, or directory ending in "/", being watched.
+ **/
+typedef struct watch {
+	NihList entry;
+	char *path;
+} Watch;
+
+/**
+ * PendingChange:
+ * @entry: list header,
+ * @path: key named by a job, or directory of the keys,
+ * @keys: keys changed during the coalescing window.
+ *
+ * Changes held back for the coalescing window, emitted as a single event.
+ **/
+typedef struct pending_change {
+	NihList   entry;
+	char     *path;
+	char    **keys;
+} PendingChange;
+
 /**
  * daemonise:
  *
@@ -114,6 +164,43 @@ static NihHash *jobs = NULL;
  **/
 GDBusConnection *connection = NULL;
 
+/**
+ * client:
+ *
+ * Connection to dconf.
+ **/
+static DConfClient *client = NULL;
+
+/**
+ * watches:
+ *
+ * Paths being watched for changes, as Watch objects.
+ **/
+static NihHash *watches = NULL;
+
+/**
+ * coalesce:
+ *
+ * Milliseconds that changes are held back for, so that those to keys in
+ * the same directory are emitted together; zero to emit an event for
+ * each change as soon as it is received.
+ **/
+static int coalesce = 100;
+
+/**
+ * pending_changes:
+ *
+ * Changes held back for the coalescing window, as PendingChange objects.
+ **/
+static NihList *pending_changes = NULL;
+
+/**
+ * pending_source:
+ *
+ * Source emitting pending_changes, or zero if there is none.
+ **/
+static guint pending_source = 0;
+
 /**
  * options:
  *
@@ -122,6 +209,8 @@ GDBusConnection *connection = NULL;
 static NihOption options[] = {
 	{ 0, "always", N_("Always emit an event on a dconf change"),
 	  NULL, NULL, &always, NULL },
+	{ 0, "coalesce", N_("Emit one event for the changes in a directory within MILLISECONDS"),
+	  NULL, "MILLISECONDS", &coalesce, nih_option_int },
 	{ 0, "daemon", N_("Detach and run in the background"),
 	  NULL, NULL, &daemonise, NULL },
 	NIH_OPTION_LAST
@@ -132,7 +221,6 @@ main (int   argc,
       char *argv[])
 {
 	char             **args;
-	DConfClient       *client;
 	GMainLoop         *mainloop;
 	GDBusProxy        *upstart_proxy;
 	GError            *error = NULL;
@@ -178,8 +266,10 @@ main (int   argc,
 		exit (1);
 	}
 
-	/* Allocate jobs hash table */
+	/* Allocate jobs and watches hash tables */
 	jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+	watches = NIH_MUST (nih_hash_string_new (NULL, 0));
+	pending_changes = NIH_MUST (nih_list_new (NULL));
 
 	/* Get an Upstart proxy object */
 	upstart_proxy = g_dbus_proxy_new_sync (connection,
@@ -249,9 +339,9 @@ main (int   argc,
 	nih_signal_set_handler (SIGTERM, nih_signal_handler);
 	NIH_MUST (nih_signal_add_handler (NULL, SIGTERM, nih_main_term_signal, NULL));
 
-	/* Listen for any dconf change */
+	/* Listen for changes to the keys jobs are interested in */
 	g_signal_connect (client, "changed", (GCallback) dconf_changed, upstart_proxy);
-	dconf_client_watch_sync (client, "/");
+	update_watches ();
 
 	/* Start the glib mainloop */
 	g_main_loop_run (mainloop);
@@ -280,6 +370,7 @@ handle_upstart_job (GDBusProxy *proxy,
 	GVariant      *child;
 	const gchar   *job_class_path;
 	Job           *job;
+	char         **paths = NULL;
 	int            add;
 
 	nih_assert (signal_name);
@@ -313,7 +404,7 @@ handle_upstart_job (GDBusProxy *proxy,
 		nih_free (job);
 
 	/* Job isn't interested in DCONF_EVENT */
-	if (add && ! job_needs_event (job_class_path))
+	if (add && ! (paths = job_watch_paths (NULL, job_class_path)))
 		goto out;
 
 	if (add)
@@ -328,19 +419,24 @@ handle_upstart_job (GDBusProxy *proxy,
 	/* Create new record for the job */
 	job = NIH_MUST (nih_new (NULL, Job));
 	job->path = NIH_MUST (nih_strdup (job, job_class_path));
+	job->paths = paths;
+	nih_ref (job->paths, job);
 
 	nih_list_init (&job->entry);
 	nih_alloc_set_destructor (job, nih_list_destroy);
 	nih_hash_add (jobs, &job->entry);
 
 out:
+	update_watches ();
+
 	g_variant_unref (child);
 }
 
 /**
  * dconf_changed:
  *
- * Emit an Upstart event corresponding to a dconf key change.
+ * Queue the changes to dconf keys that jobs are interested in, emitting
+ * them now or once the coalescing window has passed.
  **/
 static void
 dconf_changed (DConfClient         *client,
@@ -349,67 +445,352 @@ dconf_changed (DConfClient         *client,
 	       const gchar         *tag,
 	       GDBusProxy          *upstart)
 {
-	GVariant         *value;
-	gchar            *value_str = NULL;
-	gchar            *path = NULL;
-	gchar            *env_key = NULL;
-	gchar            *env_value = NULL;
+	if (! jobs_need_event () && ! always)
+		return;
+
+	/* Iterate through the various changes */
+	for (int i = 0; changes[i] != NULL; i++) {
+		nih_local char *key = NULL;
+		int             watched = FALSE;
+
+		key = NIH_MUST (nih_sprintf (NULL, "%s%s", prefix, changes[i]));
+
+		NIH_HASH_FOREACH (watches, iter) {
+			Watch *watch = (Watch *)iter;
+			size_t len = strlen (watch->path);
+
+			if ((! strcmp (watch->path, key))
+			    || ((watch->path[len - 1] == '/')
+				&& (! strncmp (watch->path, key, len)))) {
+				watched = TRUE;
+				break;
+			}
+		}
+
+		if (watched)
+			queue_change (key);
+	}
+
+	if (coalesce <= 0) {
+		emit_pending (upstart);
+	} else if ((! pending_source) && (! NIH_LIST_EMPTY (pending_changes))) {
+		pending_source = g_timeout_add (coalesce, coalesce_timeout,
+						upstart);
+	}
+}
+
+/**
+ * queue_change:
+ * @key: dconf key that changed.
+ *
+ * Hold back the change of @key for the coalescing window, along with
+ * those of other keys in the same directory; keys that a job names
+ * exactly are held back on their own, so that they are still emitted
+ * with their value.
+ **/
+static void
+queue_change (const char *key)
+{
+	nih_local char *path = NULL;
+	PendingChange  *pending = NULL;
+
+	nih_assert (key != NULL);
+
+	if (key_named (key) || (key[strlen (key) - 1] == '/')) {
+		path = NIH_MUST (nih_strdup (NULL, key));
+	} else {
+		path = NIH_MUST (nih_strndup (NULL, key,
+					      strrchr (key, '/') - key + 1));
+	}
+
+	NIH_LIST_FOREACH (pending_changes, iter) {
+		PendingChange *change = (PendingChange *)iter;
+
+		if (! strcmp (change->path, path)) {
+			pending = change;
+			break;
+		}
+	}
+
+	if (! pending) {
+		pending = NIH_MUST (nih_new (pending_changes, PendingChange));
+		nih_list_init (&pending->entry);
+		nih_alloc_set_destructor (pending, nih_list_destroy);
+
+		pending->path = NIH_MUST (nih_strdup (pending, path));
+		pending->keys = NIH_MUST (nih_str_array_new (pending));
+
+		nih_list_add (pending_changes, &pending->entry);
+	}
+
+	for (char **changed = pending->keys; *changed; changed++) {
+		if (! strcmp (*changed, key)) {
+			nih_debug ("Coalesced change of %s", key);
+			return;
+		}
+	}
+
+	NIH_MUST (nih_str_array_add (&pending->keys, pending, NULL, key));
+}
+
+/**
+ * coalesce_timeout:
+ * @data: Upstart proxy.
+ *
+ * Called once the coalescing window has passed to emit the changes
+ * held back.
+ *
+ * Returns: FALSE so that the source is removed.
+ **/
+static gboolean
+coalesce_timeout (gpointer data)
+{
+	pending_source = 0;
+
+	emit_pending ((GDBusProxy *)data);
+
+	return FALSE;
+}
+
+/**
+ * emit_pending:
+ * @upstart: Upstart proxy.
+ *
+ * Emit an event for each of the changes held back.
+ **/
+static void
+emit_pending (GDBusProxy *upstart)
+{
+	nih_assert (upstart);
+
+	NIH_LIST_FOREACH_SAFE (pending_changes, iter) {
+		PendingChange *pending = (PendingChange *)iter;
+
+		emit_change (upstart, pending->path, pending->keys);
+		nih_free (pending);
+	}
+}
+
+/**
+ * emit_change:
+ * @upstart: Upstart proxy,
+ * @path: directory of @keys,
+ * @keys: NULL-terminated list of keys that changed.
+ *
+ * Emit an Upstart event corresponding to the change of @keys; a single
+ * key is given with its value, several with @path and their names
+ * relative to it.
+ **/
+static void
+emit_change (GDBusProxy   *upstart,
+	     const char   *path,
+	     char * const *keys)
+{
 	GVariant         *event;
 	GVariantBuilder   builder;
-	int               i = 0;
+	nih_local char   *env_key = NULL;
+	nih_local char   *env_value = NULL;
 
 	/* dconf currently only currently supports the changed signal,
 	 * but parameterise to allow for a future API change.
 	 */
 	const gchar      *event_type = "TYPE=changed";
 
-	if (! jobs_need_event () && ! always)
-		return;
+	nih_assert (upstart);
+	nih_assert (path);
+	nih_assert (keys && keys[0]);
 
-	/* Iterate through the various changes */
-	while (changes[i] != NULL) {
-		path = g_strconcat (prefix, changes[i], NULL);
-
-		value = dconf_client_read (client, path);
-		value_str = g_variant_print (value, FALSE);
-
-		env_key = g_strconcat ("KEY=", path, NULL);
-		env_value = g_strconcat ("VALUE=", value_str, NULL);
-
-		/* Build event environment as GVariant */
-		g_variant_builder_init (&builder, G_VARIANT_TYPE_TUPLE);
-
-		g_variant_builder_add (&builder, "s", DCONF_EVENT);
-
-		g_variant_builder_open (&builder, G_VARIANT_TYPE_ARRAY);
-		g_variant_builder_add (&builder, "s", event_type);
-		g_variant_builder_add (&builder, "s", env_key);
-		g_variant_builder_add (&builder, "s", env_value);
-		g_variant_builder_close (&builder);
-
-		g_variant_builder_add (&builder, "b", FALSE);
-		event = g_variant_builder_end (&builder);
-
-		/* Send the event */
-		g_dbus_proxy_call (upstart,
-				"EmitEvent",
-				event,
-				G_DBUS_CALL_FLAGS_NONE,
-				-1,
-				NULL,
-				NULL, /* GAsyncReadyCallback
-					 we don't care about the answer */
-				NULL);
-
-		g_variant_builder_clear (&builder);
-		g_variant_unref (value);
-		g_free (path);
+	if (! keys[1]) {
+		GVariant *value;
+		gchar    *value_str;
+
+		/* Reset keys have no value */
+		value = dconf_client_read (client, keys[0]);
+		value_str = value ? g_variant_print (value, FALSE) : NULL;
+
+		env_key = NIH_MUST (nih_sprintf (NULL, "KEY=%s", keys[0]));
+		env_value = NIH_MUST (nih_sprintf (NULL, "VALUE=%s",
+						   value_str ? value_str : ""));
+
+		if (value)
+			g_variant_unref (value);
 		g_free (value_str);
-		g_free (env_key);
-		g_free (env_value);
+	} else {
+		env_key = NIH_MUST (nih_sprintf (NULL, "KEY=%s", path));
+		env_value = NIH_MUST (nih_strdup (NULL, "KEYS="));
 
-		i += 1;
+		for (char * const *key = keys; *key; key++)
+			NIH_MUST (nih_strcat_sprintf (&env_value, NULL, "%s%s",
+						      key == keys ? "" : " ",
+						      *key + strlen (path)));
 	}
+
+	/* Build event environment as GVariant */
+	g_variant_builder_init (&builder, G_VARIANT_TYPE_TUPLE);
+
+	g_variant_builder_add (&builder, "s", DCONF_EVENT);
+
+	g_variant_builder_open (&builder, G_VARIANT_TYPE_ARRAY);
+	g_variant_builder_add (&builder, "s", event_type);
+	g_variant_builder_add (&builder, "s", env_key);
+	g_variant_builder_add (&builder, "s", env_value);
+	g_variant_builder_close (&builder);
+
+	g_variant_builder_add (&builder, "b", FALSE);
+	event = g_variant_builder_end (&builder);
+
+	/* Send the event */
+	g_dbus_proxy_call (upstart,
+			"EmitEvent",
+			event,
+			G_DBUS_CALL_FLAGS_NONE,
+			-1,
+			NULL,
+			NULL, /* GAsyncReadyCallback
+				 we don't care about the answer */
+			NULL);
+
+	g_variant_builder_clear (&builder);
+}
+
+/**
+ * key_named:
+ * @key: dconf key.
+ *
+ * Returns: TRUE if a job names @key exactly in its dconf conditions,
+ * else FALSE.
+ **/
+static int
+key_named (const char *key)
+{
+	nih_assert (key);
+
+	NIH_HASH_FOREACH (jobs, iter) {
+		Job *job = (Job *)iter;
+
+		for (char **path = job->paths; path && *path; path++)
+			if (! strcmp (*path, key))
+				return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * update_watches:
+ *
+ * Watch the dconf keys and directories named by the jobs' dconf
+ * conditions, or everything if --always was given, and stop watching
+ * those no longer named.
+ **/
+static void
+update_watches (void)
+{
+	nih_local NihHash *wanted = NULL;
+
+	nih_assert (watches);
+
+	wanted = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	if (always) {
+		add_watch (wanted, "/");
+	} else {
+		NIH_HASH_FOREACH (jobs, iter) {
+			Job *job = (Job *)iter;
+
+			for (char **path = job->paths; path && *path; path++)
+				add_watch (wanted, *path);
+		}
+	}
+
+	/* No need to watch paths within directories being watched */
+	NIH_HASH_FOREACH_SAFE (wanted, iter) {
+		Watch *watch = (Watch *)iter;
+
+		if (path_covered (wanted, watch->path))
+			nih_free (watch);
+	}
+
+	NIH_HASH_FOREACH_SAFE (watches, iter) {
+		Watch *watch = (Watch *)iter;
+
+		if (nih_hash_lookup (wanted, watch->path))
+			continue;
+
+		nih_debug ("Unwatching %s", watch->path);
+		dconf_client_unwatch_fast (client, watch->path);
+		nih_free (watch);
+	}
+
+	NIH_HASH_FOREACH_SAFE (wanted, iter) {
+		Watch *watch = (Watch *)iter;
+
+		if (nih_hash_lookup (watches, watch->path))
+			continue;
+
+		nih_debug ("Watching %s", watch->path);
+		dconf_client_watch_fast (client, watch->path);
+
+		nih_ref (watch, watches);
+		nih_unref (watch, wanted);
+		nih_hash_add (watches, &watch->entry);
+	}
+}
+
+/**
+ * add_watch:
+ * @hash: hash of Watch objects,
+ * @path: dconf key or directory.
+ *
+ * Add @path to @hash, unless it is already there.
+ **/
+static void
+add_watch (NihHash    *hash,
+	   const char *path)
+{
+	Watch *watch;
+
+	nih_assert (hash);
+	nih_assert (path);
+
+	if (nih_hash_lookup (hash, path))
+		return;
+
+	watch = NIH_MUST (nih_new (hash, Watch));
+	nih_list_init (&watch->entry);
+	nih_alloc_set_destructor (watch, nih_list_destroy);
+
+	watch->path = NIH_MUST (nih_strdup (watch, path));
+
+	nih_hash_add (hash, &watch->entry);
+}
+
+/**
+ * path_covered:
+ * @hash: hash of Watch objects,
+ * @path: dconf key or directory.
+ *
+ * Returns: TRUE if @path lies within another directory in @hash,
+ * else FALSE.
+ **/
+static int
+path_covered (NihHash    *hash,
+	      const char *path)
+{
+	nih_assert (hash);
+	nih_assert (path);
+
+	NIH_HASH_FOREACH (hash, iter) {
+		Watch *watch = (Watch *)iter;
+		size_t len = strlen (watch->path);
+
+		if ((watch->path[len - 1] == '/')
+		    && strcmp (watch->path, path)
+		    && (! strncmp (watch->path, path, len)))
+			return TRUE;
+	}
+
+	return FALSE;
 }
 
 /**
@@ -428,33 +809,28 @@ jobs_need_event (void)
 }
 
 /**
- * job_needs_event:
- * @object_path: Full D-Bus object path for job.
+ * job_watch_paths:
+ * @parent: parent object for new array,
+ * @class_path: Full D-Bus object path for job.
  *
- * Returns: TRUE if job specified by @object_path specifies DCONF_EVENT
- * in its 'start on' or 'stop on' stanza, else FALSE.
+ * Returns: newly allocated array of the dconf keys and directories that
+ * the job specified by @class_path needs to be watched for DCONF_EVENT
+ * in its 'start on' or 'stop on' stanza, or NULL if it names no such
+ * event.
  **/
-static int
-job_needs_event (const char *class_path)
+static char **
+job_watch_paths (const void *parent,
+		 const char *class_path)
 {
 	GDBusProxy    *job_proxy;
 	GError        *error = NULL;
-	GVariantIter   iter;
-	const gchar   *event_name;
-	int            ret = FALSE;
+	char         **paths;
+	int            found = FALSE;
 
 	/* Arrays of arrays of strings (aas) */
 	GVariant      *start_on = NULL;
 	GVariant      *stop_on = NULL;
 
-	/* Array containing event name and optional environment
-	 * variable elements.
-	 */
-	GVariant      *event_element;
-
-	/* Either an event name or "/AND" or "/OR" */
-	GVariant      *event;
-
 	nih_assert (class_path);
 
 	job_proxy = g_dbus_proxy_new_sync (connection,
@@ -466,65 +842,142 @@ job_needs_event (const char *class_path)
 			NULL, /* GCancellable */
 			&error);
 
+	paths = NIH_MUST (nih_str_array_new (parent));
+
 	start_on = g_dbus_proxy_get_cached_property (job_proxy, "start_on");
 	nih_assert (g_variant_is_of_type (start_on, G_VARIANT_TYPE_ARRAY));
 
-	g_variant_iter_init (&iter, start_on);
-
-	while ((event_element = g_variant_iter_next_value (&iter))) {
-		nih_assert (g_variant_is_of_type (event_element, G_VARIANT_TYPE_ARRAY));
+	if (condition_watch_paths (&paths, start_on))
+		found = TRUE;
 
-		/* First element is always the event name */
-		event = g_variant_get_child_value (event_element, 0);
-		nih_assert (g_variant_is_of_type (event, G_VARIANT_TYPE_STRING));
+	/* Now handle stop on */
+	stop_on = g_dbus_proxy_get_cached_property (job_proxy, "stop_on");
+	nih_assert (g_variant_is_of_type (stop_on, G_VARIANT_TYPE_ARRAY));
 
-		event_name = g_variant_get_string (event, NULL);
+	if (condition_watch_paths (&paths, stop_on))
+		found = TRUE;
 
-		if (! strcmp (event_name, DCONF_EVENT))
-			ret = TRUE;
+	g_variant_unref (start_on);
+	g_variant_unref (stop_on);
 
-		g_variant_unref (event_element);
-		g_variant_unref (event);
+	g_object_unref (job_proxy);
 
-		if (ret)
-			goto out;
+	if (! found) {
+		nih_free (paths);
+		return NULL;
 	}
 
-	/* Now handle stop on */
-	stop_on = g_dbus_proxy_get_cached_property (job_proxy, "stop_on");
-	nih_assert (g_variant_is_of_type (stop_on, G_VARIANT_TYPE_ARRAY));
+	return paths;
+}
 
-	g_variant_iter_init (&iter, stop_on);
+/**
+ * condition_watch_paths:
+ * @paths: pointer to array to append to,
+ * @conditions: 'start on' or 'stop on' property of a job.
+ *
+ * Append to @paths the dconf key or directory that must be watched for
+ * each DCONF_EVENT in @conditions; "/" for those that do not match a
+ * KEY, or do so in a way that can't be narrowed down.
+ *
+ * Returns: TRUE if @conditions names DCONF_EVENT, else FALSE.
+ **/
+static int
+condition_watch_paths (char     ***paths,
+		       GVariant   *conditions)
+{
+	GVariantIter   iter;
+	int            found = FALSE;
+
+	/* Array containing event name and optional environment
+	 * variable elements.
+	 */
+	GVariant      *event_element;
+
+	nih_assert (paths);
+	nih_assert (conditions);
+
+	g_variant_iter_init (&iter, conditions);
 
 	while ((event_element = g_variant_iter_next_value (&iter))) {
+		/* Either an event name or "/AND" or "/OR" */
+		GVariant       *event;
+		nih_local char *key = NULL;
+		nih_local char *path = NULL;
+		int             pos = 0;
+		size_t          n;
+
 		nih_assert (g_variant_is_of_type (event_element, G_VARIANT_TYPE_ARRAY));
 
 		/* First element is always the event name */
 		event = g_variant_get_child_value (event_element, 0);
 		nih_assert (g_variant_is_of_type (event, G_VARIANT_TYPE_STRING));
 
-		event_name = g_variant_get_string (event, NULL);
+		if (strcmp (g_variant_get_string (event, NULL), DCONF_EVENT)) {
+			g_variant_unref (event_element);
+			g_variant_unref (event);
+			continue;
+		}
+
+		found = TRUE;
 
-		if (! strcmp (event_name, DCONF_EVENT))
-			ret = TRUE;
+		/* KEY is the second positional argument, after TYPE */
+		n = g_variant_n_children (event_element);
+		for (size_t i = 1; i < n; i++) {
+			GVariant    *env;
+			const gchar *str;
+
+			env = g_variant_get_child_value (event_element, i);
+			str = g_variant_get_string (env, NULL);
+
+			if (! strncmp (str, "KEY=", 4)) {
+				key = NIH_MUST (nih_strdup (NULL, str + 4));
+			} else if (! strncmp (str, "KEY!=", 5)) {
+				key = NIH_MUST (nih_strdup (NULL, "/"));
+			} else if ((! strchr (str, '=')) && (pos++ == 1)) {
+				key = NIH_MUST (nih_strdup (NULL, str));
+			}
+
+			g_variant_unref (env);
+		}
+
+		path = watch_path (NULL, key ? key : "/");
+		NIH_MUST (nih_str_array_add (paths, NULL, NULL, path));
 
 		g_variant_unref (event_element);
 		g_variant_unref (event);
-
-		if (ret)
-			goto out;
 	}
 
-out:
-	if (start_on)
-		g_variant_unref (start_on);
+	return found;
+}
+
+/**
+ * watch_path:
+ * @parent: parent object for new string,
+ * @key: KEY matched by a dconf condition.
+ *
+ * Keys containing glob characters or variables are narrowed down to the
+ * directory holding the literal part of them.
+ *
+ * Returns: newly allocated dconf key or directory to watch for @key.
+ **/
+static char *
+watch_path (const void *parent,
+	    const char *key)
+{
+	size_t len;
 
-	if (stop_on)
-		g_variant_unref (stop_on);
+	nih_assert (key);
 
-	g_object_unref (job_proxy);
+	len = strcspn (key, "*?[$");
+	if (key[len]) {
+		while (len && (key[len - 1] != '/'))
+			len--;
+	}
+
+	if ((! len) || (key[0] != '/'))
+		return NIH_MUST (nih_strdup (parent, "/"));
 
-	return ret;
+	return NIH_MUST (nih_strndup (parent, key, len));
 }
 
 /**
@@ -547,6 +1000,7 @@ handle_existing_jobs (GDBusProxy *upstart_proxy)
 	GError        *error = NULL;
 	GVariantIter   iter;
 	Job           *job;
+	char         **paths;
 
 	nih_assert (upstart_proxy);
 
@@ -586,10 +1040,13 @@ handle_existing_jobs (GDBusProxy *upstart_proxy)
 		if (job)
 			nih_free (job);
 
-		if (job_needs_event (job_class_path)) {
+		paths = job_watch_paths (NULL, job_class_path);
+		if (paths) {
 			/* Create new record for the job */
 			job = NIH_MUST (nih_new (NULL, Job));
 			job->path = NIH_MUST (nih_strdup (job, job_class_path));
+			job->paths = paths;
+			nih_ref (job->paths, job);
 
 			nih_list_init (&job->entry);
 			nih_alloc_set_destructor (job, nih_list_destroy);
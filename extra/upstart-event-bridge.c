@@ -30,6 +30,7 @@
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/string.h>
+#include <nih/hash.h>
 #include <nih/io.h>
 #include <nih/option.h>
 #include <nih/main.h>
@@ -41,15 +42,64 @@
 
 #include "dbus/upstart.h"
 #include "com.ubuntu.Upstart.h"
+#include "com.ubuntu.Upstart.Job.h"
 
 
+/**
+ * SYS_EVENT_PREFIX:
+ *
+ * Prefix given to the names of system events in the session.
+ **/
+#define SYS_EVENT_PREFIX ":sys:"
+
+/**
+ * Job:
+ *
+ * @entry: list header,
+ * @path: D-Bus path of session job class,
+ * @events: NULL-terminated list of names of the system events the job's
+ * conditions reference, without SYS_EVENT_PREFIX.
+ *
+ * Structure we use for tracking the system events that session jobs
+ * need forwarding.
+ **/
+typedef struct job {
+	NihList   entry;
+	char     *path;
+	char    **events;
+} Job;
+
+/**
+ * Subscription:
+ *
+ * @entry: list header,
+ * @key: event name,
+ * @refs: number of references to @key by jobs.
+ *
+ * Structure we use for counting the jobs that need each system event.
+ **/
+typedef struct subscription {
+	NihList  entry;
+	char    *key;
+	int      refs;
+} Subscription;
+
 /* Prototypes for static functions */
 static void upstart_disconnected (DBusConnection *connection);
 static void upstart_forward_event    (void *data, NihDBusMessage *message,
 				  const char *path);
 static void upstart_forward_restarted    (void *data, NihDBusMessage *message,
 				  const char *path);
+static void forward_event        (DBusMessage *message);
 static void emit_event_error     (void *data, NihDBusMessage *message);
+static DBusHandlerResult event_filter (DBusConnection *connection,
+				       DBusMessage *message, void *user_data);
+static void session_job_added    (void *data, NihDBusMessage *message,
+				  const char *job_class_path);
+static void session_job_removed  (void *data, NihDBusMessage *message,
+				  const char *job_class_path);
+static int  job_destroy          (Job *job);
+static char *event_rule          (const void *parent, const char *name);
 
 /**
  * daemonise:
@@ -73,6 +123,37 @@ static NihDBusProxy *system_upstart = NULL;
  **/
 static NihDBusProxy *user_upstart = NULL;
 
+/**
+ * filter:
+ *
+ * If TRUE, only forward the system events referenced by the conditions
+ * of session jobs.
+ **/
+static int filter = FALSE;
+
+/**
+ * jobs:
+ *
+ * Hash of Job objects for the session job classes whose conditions
+ * reference system events, keyed by D-Bus path; only used with filter.
+ **/
+static NihHash *jobs = NULL;
+
+/**
+ * events:
+ *
+ * Hash of Subscription objects for the names of the system events to
+ * forward; only used with filter.
+ **/
+static NihHash *events = NULL;
+
+/**
+ * system_bus:
+ *
+ * Connection to the system bus.
+ **/
+static DBusConnection *system_bus = NULL;
+
 /**
  * options:
  *
@@ -81,6 +162,8 @@ static NihDBusProxy *user_upstart = NULL;
 static NihOption options[] = {
 	{ 0, "daemon", N_("Detach and run in the background"),
 	  NULL, NULL, &daemonise, NULL },
+	{ 0, "filter", N_("Only forward events that session jobs wait for"),
+	  NULL, NULL, &filter, NULL },
 
 	NIH_OPTION_LAST
 };
@@ -147,8 +230,22 @@ main (int   argc,
 		exit (1);
 	}
 
-	if (! nih_dbus_proxy_connect (system_upstart, &upstart_com_ubuntu_Upstart0_6, "EventEmitted",
-				      (NihDBusSignalHandler)upstart_forward_event, NULL)) {
+	system_bus = system_connection;
+
+	/* When filtering, a match rule is added for each event name that
+	 * session jobs reference instead of one for every event.
+	 */
+	if (filter) {
+		jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+		events = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+		if (! dbus_connection_add_filter (system_connection, event_filter,
+						  NULL, NULL)) {
+			nih_fatal (_("Could not add EventEmitted filter"));
+			exit (1);
+		}
+	} else if (! nih_dbus_proxy_connect (system_upstart, &upstart_com_ubuntu_Upstart0_6, "EventEmitted",
+					     (NihDBusSignalHandler)upstart_forward_event, NULL)) {
 		NihError *err;
 
 		err = nih_error_get ();
@@ -199,6 +296,54 @@ main (int   argc,
 		exit (1);
 	}
 
+	if (filter) {
+		char **job_class_paths;
+
+		/* Connect signals to be notified when session jobs come
+		 * and go.
+		 */
+		if (! nih_dbus_proxy_connect (user_upstart, &upstart_com_ubuntu_Upstart0_6, "JobAdded",
+					      (NihDBusSignalHandler)session_job_added, NULL)) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not create JobAdded signal connection"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		if (! nih_dbus_proxy_connect (user_upstart, &upstart_com_ubuntu_Upstart0_6, "JobRemoved",
+					      (NihDBusSignalHandler)session_job_removed, NULL)) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not create JobRemoved signal connection"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		if (upstart_get_all_jobs_sync (NULL, user_upstart, &job_class_paths) < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not obtain job list"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		for (char **job_class_path = job_class_paths;
+		     job_class_path && *job_class_path; job_class_path++)
+			session_job_added (NULL, NULL, *job_class_path);
+
+		nih_free (job_class_paths);
+	}
+
 	/* Become daemon */
 	if (daemonise) {
 		/* Deal with the pidfile location when becoming a daemon.
@@ -270,6 +415,19 @@ static void
 upstart_forward_event (void *          data,
 		     NihDBusMessage *message,
 		     const char *    path)
+{
+	forward_event (message->message);
+}
+
+/**
+ * forward_event:
+ * @message: EventEmitted signal from the system init.
+ *
+ * Emits the event given by @message in the session, with its name
+ * prefixed by SYS_EVENT_PREFIX.
+ **/
+static void
+forward_event (DBusMessage *message)
 {
 	char *              event_name = NULL;
 	nih_local char *    new_event_name = NULL;
@@ -281,7 +439,7 @@ upstart_forward_event (void *          data,
 	dbus_error_init (&error);
 
 	/* Extract information from the original event */
-	if (!dbus_message_get_args (message->message, &error,
+	if (!dbus_message_get_args (message, &error,
 	        DBUS_TYPE_STRING, &event_name,
 	        DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &event_env, &event_env_count,
 	        DBUS_TYPE_INVALID)) {
@@ -293,7 +451,7 @@ upstart_forward_event (void *          data,
 	nih_assert (event_name != NULL);
 
 	/* Build the new event name */
-	NIH_MUST (nih_strcat_sprintf (&new_event_name, NULL, ":sys:%s", event_name));
+	NIH_MUST (nih_strcat_sprintf (&new_event_name, NULL, SYS_EVENT_PREFIX "%s", event_name));
 
 	/* Re-transmit the event */
 	pending_call = upstart_emit_event (user_upstart,
@@ -345,3 +503,265 @@ emit_event_error (void *          data,
 	nih_warn ("%s", err->message);
 	nih_free (err);
 }
+
+/**
+ * event_filter:
+ * @connection: connection to the system bus,
+ * @message: message received,
+ * @user_data: not used.
+ *
+ * Connection filter used in place of an EventEmitted signal handler when
+ * filtering, forwarding only the events named in events; other match
+ * rules of the connection may deliver the rest.
+ *
+ * Returns: DBUS_HANDLER_RESULT_NOT_YET_HANDLED so that other filters
+ * see the message too.
+ **/
+static DBusHandlerResult
+event_filter (DBusConnection *connection,
+	      DBusMessage *   message,
+	      void *          user_data)
+{
+	const char *name = NULL;
+
+	nih_assert (connection != NULL);
+	nih_assert (message != NULL);
+
+	if ((! dbus_message_is_signal (message, DBUS_INTERFACE_UPSTART, "EventEmitted"))
+	    || (! dbus_message_has_path (message, DBUS_PATH_UPSTART)))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (! dbus_message_get_args (message, NULL,
+				     DBUS_TYPE_STRING, &name,
+				     DBUS_TYPE_INVALID))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (nih_hash_lookup (events, name))
+		forward_event (message);
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * session_job_added:
+ * @data: not used,
+ * @message: D-Bus message (not used),
+ * @job_class_path: D-Bus path of session job class.
+ *
+ * Called for each session job class when the bridge starts, and for
+ * each new one thereafter, to forward the system events its conditions
+ * reference.
+ **/
+static void
+session_job_added (void *          data,
+		   NihDBusMessage *message,
+		   const char *    job_class_path)
+{
+	Job *                   job;
+	Job *                   old_job;
+	nih_local NihDBusProxy *job_class = NULL;
+	nih_local char ***      start_on = NULL;
+	nih_local char ***      stop_on = NULL;
+
+	nih_assert (job_class_path != NULL);
+
+	job_class = nih_dbus_proxy_new (NULL, user_upstart->connection,
+					user_upstart->name, job_class_path,
+					NULL, NULL);
+	if (! job_class) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not create proxy for job %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	job_class->auto_start = FALSE;
+
+	if (job_class_get_start_on_sync (NULL, job_class, &start_on) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not obtain job start condition %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	if (job_class_get_stop_on_sync (NULL, job_class, &stop_on) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not obtain job stop condition %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	job = NIH_MUST (nih_new (NULL, Job));
+	nih_list_init (&job->entry);
+
+	job->path = NIH_MUST (nih_strdup (job, job_class_path));
+	job->events = NIH_MUST (nih_str_array_new (job));
+
+	for (int i = 0; i < 2; i++) {
+		char ***condition = i ? stop_on : start_on;
+
+		for (char ***event = condition; event && *event && **event; event++) {
+			const char *name = **event;
+
+			if (strncmp (name, SYS_EVENT_PREFIX, strlen (SYS_EVENT_PREFIX)))
+				continue;
+
+			name += strlen (SYS_EVENT_PREFIX);
+			if (! *name)
+				continue;
+
+			NIH_MUST (nih_str_array_add (&job->events, job, NULL, name));
+		}
+	}
+
+	if (*job->events) {
+		nih_debug ("Job got added %s", job_class_path);
+
+		for (char **name = job->events; *name; name++) {
+			Subscription *   subscription;
+			nih_local char * rule = NULL;
+			DBusError        error;
+
+			subscription = (Subscription *)nih_hash_lookup (events, *name);
+			if (subscription) {
+				subscription->refs++;
+				continue;
+			}
+
+			subscription = NIH_MUST (nih_new (events, Subscription));
+			nih_list_init (&subscription->entry);
+			nih_alloc_set_destructor (subscription, nih_list_destroy);
+
+			subscription->key = NIH_MUST (nih_strdup (subscription, *name));
+			subscription->refs = 1;
+
+			nih_hash_add (events, &subscription->entry);
+
+			rule = event_rule (NULL, *name);
+			if (! rule) {
+				nih_warn ("%s: %s", _("Cannot match event name"), *name);
+				continue;
+			}
+
+			dbus_error_init (&error);
+			dbus_bus_add_match (system_bus, rule, &error);
+
+			if (dbus_error_is_set (&error)) {
+				nih_warn ("%s: %s: %s", _("Could not add D-Bus signal match"),
+					  rule, error.message);
+				dbus_error_free (&error);
+			}
+		}
+	}
+
+	/* Free any existing record for the job only once the new one
+	 * holds its match rules, so that events are not lost in between.
+	 */
+	old_job = (Job *)nih_hash_lookup (jobs, job_class_path);
+	if (old_job)
+		nih_free (old_job);
+
+	if (*job->events) {
+		nih_alloc_set_destructor (job, job_destroy);
+		nih_hash_add (jobs, &job->entry);
+	} else {
+		nih_free (job);
+	}
+}
+
+/**
+ * session_job_removed:
+ * @data: not used,
+ * @message: D-Bus message (not used),
+ * @job_class_path: D-Bus path of session job class.
+ *
+ * Called when a session job class goes away.
+ **/
+static void
+session_job_removed (void *          data,
+		     NihDBusMessage *message,
+		     const char *    job_class_path)
+{
+	Job *job;
+
+	nih_assert (job_class_path != NULL);
+
+	job = (Job *)nih_hash_lookup (jobs, job_class_path);
+	if (job) {
+		nih_debug ("Job went away %s", job_class_path);
+		nih_free (job);
+	}
+}
+
+/**
+ * job_destroy:
+ * @job: job being destroyed.
+ *
+ * Destructor for Job that removes it from the jobs hash and drops its
+ * references to event names, removing the match rules of those that no
+ * other job needs.
+ *
+ * Returns: zero.
+ **/
+static int
+job_destroy (Job *job)
+{
+	nih_assert (job != NULL);
+
+	nih_list_destroy (&job->entry);
+
+	for (char **name = job->events; name && *name; name++) {
+		Subscription *   subscription;
+		nih_local char * rule = NULL;
+
+		subscription = (Subscription *)nih_hash_lookup (events, *name);
+		if ((! subscription) || (--subscription->refs > 0))
+			continue;
+
+		nih_free (subscription);
+
+		/* Don't wait for the reply */
+		rule = event_rule (NULL, *name);
+		if (rule)
+			dbus_bus_remove_match (system_bus, rule, NULL);
+	}
+
+	return 0;
+}
+
+/**
+ * event_rule:
+ * @parent: parent object for new string,
+ * @name: event name.
+ *
+ * Returns: newly allocated match rule for the EventEmitted signals of
+ * the system init for events named @name, or NULL if @name cannot be
+ * given in a match rule.
+ **/
+static char *
+event_rule (const void *parent,
+	    const char *name)
+{
+	nih_assert (name != NULL);
+
+	if (strchr (name, '\''))
+		return NULL;
+
+	return NIH_MUST (nih_sprintf (parent, "type='signal',sender='%s',"
+				      "path='%s',interface='%s',"
+				      "member='EventEmitted',arg0='%s'",
+				      DBUS_SERVICE_UPSTART, DBUS_PATH_UPSTART,
+				      DBUS_INTERFACE_UPSTART, name));
+}
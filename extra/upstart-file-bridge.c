@@ -47,6 +47,11 @@
  *   create requests. And for a combination of requests who share
  *   a parent directory, it's easier to just watch the parent alone.
  *
+ * Every watched file is also indexed in a trie of path components, so
+ * that the handlers find the files interested in an inotify event by
+ * walking the components of its path, rather than by comparing the
+ * path against every file watched by the directory.
+ *
  * = Limitations =
  *
  * Since inotify is used, this bridge has a number of significant
@@ -100,12 +105,25 @@
  *
  * + Supports recursive watches.
  *
+ * + A single mark observes a whole filesystem, so the cost of setting
+ *   up the watches does not grow with the number of directories.
+ *
  * == Cons ==
  *
- * - Does not support a file delete event.
+ * - Only supports directory entry events (including delete) when
+ *   reporting file handles with names (Linux 5.9 and later).
+ *
+ * - Requires CAP_SYS_ADMIN, so is not available to the bridges of
+ *   user sessions.
  *
  * - Potentially high system performance impact since _every_ file
- *   operation on the partition (except delete) is inspected.
+ *   operation on the partition is inspected.
+ *
+ * The --fanotify option has the bridge mark the filesystems of its
+ * WatchedDirs instead of creating inotify watches for them.  Events are
+ * matched to a WatchedDir by the file handle of their directory and
+ * passed to the same handlers as inotify events; WatchedDirs are still
+ * moved as directories come and go, which only costs a hash update.
  *
  *---------- 
  *
@@ -118,13 +136,18 @@
 # include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
 #include <fnmatch.h>
 #include <glob.h>
 #include <pwd.h>
@@ -199,6 +222,23 @@
 	while (*(path) == '/' && (path)+1 && *((path)+1) == '/') \
 		(path)++
 
+/**
+ * FANOTIFY_EVENTS:
+ *
+ * Events that filesystems are marked for, equivalent to those NihWatch
+ * asks inotify for.
+ **/
+#define FANOTIFY_EVENTS (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM \
+			 | FAN_MOVED_TO | FAN_CLOSE_WRITE | FAN_DELETE_SELF \
+			 | FAN_MOVE_SELF | FAN_ONDIR)
+
+/**
+ * FANOTIFY_KEY_MAX:
+ *
+ * Size of the buffer needed by fanotify_key().
+ **/
+#define FANOTIFY_KEY_MAX (16 + 1 + 8 + 1 + (MAX_HANDLE_SZ * 2) + 1)
+
 /**
  * Job:
  *
@@ -221,7 +261,8 @@ typedef struct job {
  * @path: full path of directory being watched,
  * @files: hash of WatchedFile objects representing all files
  *         watched in directory @path and sub-directories,
- * @watch: watch object.
+ * @watch: watch object (or NULL if watched through fanotify),
+ * @handle: entry in fanotify_dirs (or NULL if watched through inotify).
  *
  * Every watched file is handled by watching the first parent
  * directory that currently exists. This allows use to:
@@ -243,12 +284,29 @@ typedef struct job {
  *
  **/
 typedef struct watched_dir {
-	NihList    entry;
-	char      *path;
-	NihHash   *files;
-	NihWatch  *watch;
+	NihList                  entry;
+	char                    *path;
+	NihHash                 *files;
+	NihWatch                *watch;
+	struct fanotify_handle  *handle;
 } WatchedDir;
 
+/**
+ * FanotifyHandle:
+ *
+ * @entry: list header,
+ * @key: filesystem id and file handle of @dir, as given by fanotify_key(),
+ * @dir: WatchedDir.
+ *
+ * Entry in fanotify_dirs mapping the file handle that fanotify reports
+ * for events in a directory to the WatchedDir for it.
+ **/
+typedef struct fanotify_handle {
+	NihList      entry;
+	char        *key;
+	WatchedDir  *dir;
+} FanotifyHandle;
+
 /**
  * WatchedFile:
  *
@@ -259,7 +317,10 @@ typedef struct watched_dir {
  * @glob: glob file pattern (or NULL if globbing disabled),
  * @dir: TRUE if @path is a directory,
  * @events: mask of inotify events file is interested in,
- * @parent: parent who is watching over us.
+ * @debounce: seconds given by DEBOUNCE, or -1 to use debounce_default,
+ * @parent: parent who is watching over us,
+ * @node: node of path_trie for @path (or NULL if not yet watched),
+ * @node_entry: entry in the files list of @node.
  *
  * Details of the file being watched.
  *
@@ -272,17 +333,43 @@ typedef struct watched_file {
 	char        *original;
 	char        *glob;
 	int          dir;
-	uint32_t     events;
-	WatchedDir  *parent;
+	uint32_t             events;
+	int                  debounce;
+	WatchedDir          *parent;
+	struct path_node    *node;
+	NihListEntry        *node_entry;
 } WatchedFile;
 
+/**
+ * PathNode:
+ *
+ * @entry: list header,
+ * @name: path component,
+ * @parent: node of the parent directory (or NULL for the root),
+ * @children: hash of PathNode objects for the entries below this one
+ *  (or NULL if there are none yet),
+ * @files: list of NihListEntry objects whose data are the WatchedFiles
+ *  whose path this node represents.
+ *
+ * Node of path_trie.  Glob WatchedFiles, whose path is their directory,
+ * are held by the node for that directory.
+ **/
+typedef struct path_node {
+	NihList            entry;
+	char              *name;
+	struct path_node  *parent;
+	NihHash           *children;
+	NihList            files;
+} PathNode;
+
 /**
  * FileEvent:
  *
  * @entry: list header,
  * @path: full path to file being watched,
  * @event: event to emit,
- * @match: optional file match if @path is a directory or glob.
+ * @match: optional file match if @path is a directory or glob,
+ * @debounce: DEBOUNCE value of the jobs interested, or -1.
  *
  * Details of the event to be emitted.
  **/
@@ -291,8 +378,32 @@ typedef struct file_event {
 	char        *path;
 	uint32_t     event;
 	char        *match;
+	int          debounce;
 } FileEvent;
 
+/**
+ * PendingEvent:
+ *
+ * @entry: list header,
+ * @key: @debounce, @path and @match combined,
+ * @path: path that event should contain,
+ * @event: latest inotify event for @path,
+ * @match: file match if @path contains glob wildcards (or NULL),
+ * @debounce: DEBOUNCE value of the jobs interested, or -1,
+ * @due: time at which the event is emitted.
+ *
+ * Details of an event held back for its coalescing window.
+ **/
+typedef struct pending_event {
+	NihList      entry;
+	char        *key;
+	char        *path;
+	uint32_t     event;
+	char        *match;
+	int          debounce;
+	time_t       due;
+} PendingEvent;
+
 /* Prototypes for static functions */
 static WatchedDir *watched_dir_new (const char *path, const struct stat *statbuf)
 	__attribute__ ((warn_unused_result));
@@ -327,15 +438,21 @@ static void job_add_file (Job *job, char **file_info);
 
 static void emit_event_error (void *data, NihDBusMessage *message);
 static int  emit_event (const char *path, uint32_t event_type,
-				  const char  *match);
+				  const char  *match, int debounce);
 
 static FileEvent *file_event_new (void *parent, const char *path,
-				  uint32_t event, const char *match);
+				  uint32_t event, const char *match,
+				  int debounce);
 
 static void upstart_disconnected (DBusConnection *connection);
 
 static void handle_event (NihHash *handled, const char  *path,
-			  uint32_t event, const char  *match);
+			  uint32_t event, const char  *match, int debounce);
+
+static void queue_event (const char *path, uint32_t event,
+			 const char *match, int debounce);
+
+static void pending_event_timer (void *data, NihTimer *timer);
 
 static int job_destroy (Job *job);
 
@@ -355,6 +472,38 @@ char * expand_path (const void *parent, const char *path)
 static int path_valid (const char *path)
 	__attribute__ ((warn_unused_result));
 
+static int watched_file_destroy (WatchedFile *file);
+
+static WatchedFile **watched_files_find (const void *parent, WatchedDir *dir,
+					 const char *path, int descendants,
+					 size_t *len)
+	__attribute__ ((warn_unused_result));
+
+static PathNode *path_node_new (PathNode *parent, const char *name)
+	__attribute__ ((warn_unused_result));
+
+static PathNode *path_node_next (PathNode *node, const char **path,
+				 int create);
+
+static PathNode *path_node_lookup (const char *path, int create);
+
+static void path_node_prune (PathNode *node);
+
+static void path_node_files (const void *parent, PathNode *node,
+			     WatchedDir *dir, int descendants,
+			     WatchedFile ***files, size_t *len);
+
+static int  fanotify_watch (WatchedDir *dir, const char *path);
+
+static void fanotify_key (char *key, const void *fsid,
+			  const struct file_handle *handle);
+
+static void fanotify_reader (void *data, NihIoWatch *watch,
+			     NihIoEvents events);
+
+static void fanotify_dispatch (const char *key, const char *name,
+			       uint64_t mask);
+
 /**
  * daemonise:
  *
@@ -378,6 +527,75 @@ static NihHash *jobs = NULL;
  **/
 static NihHash *watched_dirs = NULL;
 
+/**
+ * debounce_default:
+ *
+ * Seconds that events are held back for jobs that don't give DEBOUNCE,
+ * during which further events of the same kind for the same file are
+ * dropped; zero to emit events as soon as they happen.
+ **/
+static int debounce_default = 0;
+
+/**
+ * pending_events:
+ *
+ * Hash of PendingEvent objects held back, or NULL if there have been none.
+ **/
+static NihHash *pending_events = NULL;
+
+/**
+ * pending_timer:
+ *
+ * Timer for emitting the first of pending_events to fall due, or NULL.
+ **/
+static NihTimer *pending_timer = NULL;
+
+/**
+ * pending_timer_due:
+ *
+ * Time at which pending_timer fires, comparable with the due times of
+ * pending_events; the timer's own is not, being of another clock.
+ **/
+static time_t pending_timer_due = 0;
+
+/**
+ * use_fanotify:
+ *
+ * If TRUE, watch directories through fanotify marks on their
+ * filesystems rather than through inotify.
+ **/
+static int use_fanotify = FALSE;
+
+/**
+ * fanotify_fd:
+ *
+ * fanotify group, or -1 if inotify is used.
+ **/
+static int fanotify_fd = -1;
+
+/**
+ * fanotify_marks:
+ *
+ * Hash of NihListEntry objects whose strings are the ids of the
+ * filesystems marked, or NULL if there are none yet.
+ **/
+static NihHash *fanotify_marks = NULL;
+
+/**
+ * fanotify_dirs:
+ *
+ * Hash of FanotifyHandle objects for the WatchedDirs watched through
+ * fanotify, or NULL if there are none yet.
+ **/
+static NihHash *fanotify_dirs = NULL;
+
+/**
+ * path_trie:
+ *
+ * Root of the trie of path components of all WatchedFiles.
+ **/
+static PathNode *path_trie = NULL;
+
 /**
  * upstart:
  *
@@ -411,6 +629,10 @@ static NihOption options[] = {
 	  NULL, NULL, &daemonise, NULL },
 	{ 0, "user", N_("Connect to user session"),
 	  NULL, NULL, &user, NULL },
+	{ 0, "debounce", N_("Emit one event for the same change to a file within SECONDS"),
+	  NULL, "SECONDS", &debounce_default, nih_option_int },
+	{ 0, "fanotify", N_("Watch whole filesystems with fanotify rather than directories with inotify"),
+	  NULL, NULL, &use_fanotify, NULL },
 
 	NIH_OPTION_LAST
 };
@@ -466,6 +688,20 @@ main (int   argc,
 	/* Allocate jobs hash table */
 	jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
 
+	if (use_fanotify) {
+		fanotify_fd = fanotify_init (FAN_CLASS_NOTIF | FAN_CLOEXEC
+					     | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+					     O_RDONLY | O_CLOEXEC);
+		if (fanotify_fd < 0) {
+			nih_warn ("%s: %s",
+				  _("Could not initialise fanotify, using inotify"),
+				  strerror (errno));
+		} else {
+			NIH_MUST (nih_io_add_watch (NULL, fanotify_fd, NIH_IO_READ,
+						    fanotify_reader, NULL));
+		}
+	}
+
 	/* Initialise the connection to Upstart */
 	connection = NIH_SHOULD (nih_dbus_connect (user
 				? user_session_addr
@@ -756,6 +992,7 @@ job_add_file (Job    *job,
 	      char  **file_info)
 {
 	uint32_t         events = 0x0;
+	int              debounce = -1;
 	WatchedFile     *file = NULL;
 	nih_local char  *error = NULL;
 	nih_local char  *glob_expr = NULL;
@@ -835,6 +1072,15 @@ job_add_file (Job    *job,
 			} else if (! strcmp (val, "delete")) {
 				events |= IN_DELETE;
 			}
+		} else if (! strncmp (*env, "DEBOUNCE", name_len)) {
+			char *endptr;
+
+			debounce = strtol (val, &endptr, 10);
+			if (*endptr || endptr == val || debounce < 0) {
+				nih_warn ("%s: Ignored %s event with invalid DEBOUNCE=%s",
+						job->path, FILE_EVENT, val);
+				return;
+			}
 		}
 	}
 
@@ -854,6 +1100,8 @@ job_add_file (Job    *job,
 		return;
 	}
 
+	file->debounce = debounce;
+
 	/* If the job cares about the file or directory existing and it
 	 * _already_ exists, emit the event.
 	 *
@@ -883,14 +1131,16 @@ job_add_file (Job    *job,
 
 				/* emit one event per matching file */
 				for (i = 0; i < globbuf.gl_pathc; i++) {
-					emit_event (pattern, IN_CREATE, results[i]);
+					emit_event (pattern, IN_CREATE, results[i],
+						    file->debounce);
 				}
 			}
 
 			globfree (&globbuf);
 		} else {
 			if (! stat (file->path, &statbuf))
-				emit_event (file->path, IN_CREATE, NULL);
+				emit_event (file->path, IN_CREATE, NULL,
+					    file->debounce);
 		}
 	}
 
@@ -913,23 +1163,35 @@ file_filter (WatchedDir  *dir,
 	     const char  *path,
 	     int          is_dir)
 {
+	PathNode *node;
+
 	nih_assert (dir);
 	nih_assert (path);
 
 	skip_slashes (path);
 
-	NIH_HASH_FOREACH_SAFE (dir->files, iter) {
-		WatchedFile *file = (WatchedFile *)iter;
+	node = path_trie;
 
-		if (strstr (file->path, path) == file->path) {
-			/* Either an exact match or path is a child of the watched file.
-			 * Paths in the latter category will be inspected more closely by
-			 * the handlers.
-			 */
-			return FALSE;
-		} else if ((file->dir || file->glob) && strstr (path, file->path) == path) {
-			return FALSE;
+	while (node) {
+		/* path is within a watched directory, or matched against a
+		 * glob in it.
+		 */
+		NIH_LIST_FOREACH (&node->files, iter) {
+			WatchedFile *file = (WatchedFile *)((NihListEntry *)iter)->data;
+
+			if (file->dir || file->glob)
+				return FALSE;
 		}
+
+		/* Either an exact match or path is a parent of a watched
+		 * file, since nodes without files below them are pruned.
+		 * Paths in the latter category will be inspected more
+		 * closely by the handlers.
+		 */
+		if (! *path)
+			return FALSE;
+
+		node = path_node_next (node, &path, FALSE);
 	}
 
 	return TRUE;
@@ -939,7 +1201,7 @@ file_filter (WatchedDir  *dir,
  * create_handler:
  *
  * @dir: WatchedDir,
- * @watch: NihWatch for directory tree,
+ * @watch: NihWatch for directory tree (or NULL for fanotify),
  * @path: full path to file,
  * @statbuf: stat of @path.
  *
@@ -951,10 +1213,12 @@ create_handler (WatchedDir   *dir,
 		const char   *path,
 		struct stat  *statbuf)
 {
-	WatchedDir         *new_dir;
-	char               *p;
-	int                 add_dir = FALSE;
-	int                 empty;
+	WatchedDir            *new_dir;
+	char                  *p;
+	int                    add_dir = FALSE;
+	int                    empty;
+	nih_local WatchedFile **files = NULL;
+	size_t                 len = 0;
 
 	/* Hash of events already emitted (required to avoid sending
 	 * same event multiple times).
@@ -968,7 +1232,6 @@ create_handler (WatchedDir   *dir,
 	NihList             entries;
 
 	nih_assert (dir);
-	nih_assert (watch);
 	nih_assert (path);
 	nih_assert (statbuf);
 
@@ -980,8 +1243,12 @@ create_handler (WatchedDir   *dir,
 	nih_list_init (&entries);
 	handled = NIH_MUST (nih_hash_string_new (NULL, 0));
 
-	NIH_HASH_FOREACH_SAFE (dir->files, iter) {
-		WatchedFile *file = (WatchedFile *)iter;
+	/* Files below @path can only be affected when it's a directory */
+	files = watched_files_find (NULL, dir, path,
+				    S_ISDIR (statbuf->st_mode), &len);
+
+	for (size_t i = 0; i < len; i++) {
+		WatchedFile *file = files[i];
 
 		if (file->dir) {
 			if (! strcmp (file->path, dir->path)) {
@@ -990,10 +1257,10 @@ create_handler (WatchedDir   *dir,
 				 * was modified.
 				 */
 				if (file->events & IN_MODIFY)
-					handle_event (handled, original_path (file), IN_MODIFY, path);
+					handle_event (handled, original_path (file), IN_MODIFY, path, file->debounce);
 			} else if (! strcmp (file->path, path)) {
 				/* Directory has been created */
-				handle_event (handled, original_path (file), IN_CREATE, NULL);
+				handle_event (handled, original_path (file), IN_CREATE, NULL, file->debounce);
 				add_dir = TRUE;
 				nih_list_add (&entries, &file->entry);
 			}
@@ -1004,11 +1271,11 @@ create_handler (WatchedDir   *dir,
 			full_path = NIH_MUST (nih_sprintf (NULL, "%s/%s", file->path, file->glob));
 
 			if (! fnmatch (full_path, path, FNM_PATHNAME) && (file->events & IN_CREATE))
-				handle_event (handled, full_path, IN_CREATE, path);
+				handle_event (handled, full_path, IN_CREATE, path, file->debounce);
 		} else {
 			if (! strcmp (file->path, path) && (file->events & IN_CREATE)) {
 				/* exact match, so emit event */
-				handle_event (handled, file->path, IN_CREATE, NULL);
+				handle_event (handled, file->path, IN_CREATE, NULL, file->debounce);
 
 			} else if ((p=strstr (file->path, path)) && p == file->path
 					&& S_ISDIR (statbuf->st_mode)) {
@@ -1052,6 +1319,7 @@ create_handler (WatchedDir   *dir,
 	NIH_LIST_FOREACH_SAFE (&entries, iter) {
 		WatchedFile *file = (WatchedFile *)iter;
 
+		file->parent = new_dir;
 		nih_hash_add (new_dir->files, &file->entry);
 	}
 
@@ -1071,7 +1339,7 @@ create_handler (WatchedDir   *dir,
  * modify_handler:
  *
  * @dir: WatchedDir,
- * @watch: NihWatch for directory tree,
+ * @watch: NihWatch for directory tree (or NULL for fanotify),
  * @path: full path to file,
  * @statbuf: stat of @path.
  *
@@ -1083,10 +1351,11 @@ modify_handler (WatchedDir   *dir,
 		const char   *path,
 		struct stat  *statbuf)
 {
-	nih_local NihHash  *handled = NULL;
+	nih_local NihHash     *handled = NULL;
+	nih_local WatchedFile **files = NULL;
+	size_t                 len = 0;
 
 	nih_assert (dir);
-	nih_assert (watch);
 	nih_assert (path);
 	nih_assert (statbuf);
 
@@ -1097,8 +1366,10 @@ modify_handler (WatchedDir   *dir,
 
 	handled = NIH_MUST (nih_hash_string_new (NULL, 0));
 
-	NIH_HASH_FOREACH_SAFE (dir->files, iter) {
-		WatchedFile *file = (WatchedFile *)iter;
+	files = watched_files_find (NULL, dir, path, FALSE, &len);
+
+	for (size_t i = 0; i < len; i++) {
+		WatchedFile *file = files[i];
 
 		if (! (file->events & IN_MODIFY))
 			continue;
@@ -1109,7 +1380,7 @@ modify_handler (WatchedDir   *dir,
 				 * watched directory was modified, hence emit the _directory_
 				 * was modified.
 				 */
-				handle_event (handled, original_path (file), IN_MODIFY, path);
+				handle_event (handled, original_path (file), IN_MODIFY, path, file->debounce);
 			}
 		} else if (file->glob) {
 			nih_local char *full_path = NULL;
@@ -1118,14 +1389,14 @@ modify_handler (WatchedDir   *dir,
 			full_path = NIH_MUST (nih_sprintf (NULL, "%s/%s", file->path, file->glob));
 
 			if (! fnmatch (full_path, path, FNM_PATHNAME) && (file->events & IN_MODIFY))
-				handle_event (handled, full_path, IN_MODIFY, path);
+				handle_event (handled, full_path, IN_MODIFY, path, file->debounce);
 		} else {
 			if (! strcmp (file->path, path)) {
 				/* exact match, so emit event */
-				handle_event (handled, original_path (file), IN_MODIFY, NULL);
+				handle_event (handled, original_path (file), IN_MODIFY, NULL, file->debounce);
 			} else if (file->dir && strstr (path, file->path) == path) {
 				/* file in watched directory modified, so emit event */
-				handle_event (handled, path, IN_MODIFY, NULL);
+				handle_event (handled, path, IN_MODIFY, NULL, file->debounce);
 			}
 		}
 	}
@@ -1135,7 +1406,7 @@ modify_handler (WatchedDir   *dir,
  * delete_handler:
  *
  * @dir: WatchedDir,
- * @watch: NihWatch for directory tree,
+ * @watch: NihWatch for directory tree (or NULL for fanotify),
  * @path: full path to file that was deleted.
  *
  * Watch handler function called when a WatchedFile is deleted in @dir.
@@ -1145,12 +1416,14 @@ delete_handler (WatchedDir  *dir,
 		NihWatch    *watch,
 		const char  *path)
 {
-	WatchedDir         *new_dir;
-	char               *parent;
-	char               *p;
-	struct stat         statbuf;
-	int                 rm_dir = FALSE;
-	nih_local NihHash  *handled = NULL;
+	WatchedDir            *new_dir;
+	char                  *parent;
+	char                  *p;
+	struct stat            statbuf;
+	int                    rm_dir = FALSE;
+	nih_local NihHash     *handled = NULL;
+	nih_local WatchedFile **files = NULL;
+	size_t                 len = 0;
 
 	/* List of existing WatchedFiles that need to be added against
 	 * @path (since @path either exactly matches their path, or
@@ -1159,7 +1432,6 @@ delete_handler (WatchedDir  *dir,
 	NihList     entries;
 
 	nih_assert (dir);
-	nih_assert (watch);
 	nih_assert (path);
 
 	/* path should be a file below the WatchedDir */
@@ -1170,20 +1442,22 @@ delete_handler (WatchedDir  *dir,
 	nih_list_init (&entries);
 	handled = NIH_MUST (nih_hash_string_new (NULL, 0));
 
-	NIH_HASH_FOREACH_SAFE (dir->files, iter) {
-		WatchedFile *file = (WatchedFile *)iter;
+	files = watched_files_find (NULL, dir, path, TRUE, &len);
+
+	for (size_t i = 0; i < len; i++) {
+		WatchedFile *file = files[i];
 
 		if (file->dir) {
 			if (! strcmp (file->path, path)) {
 				/* Directory itself was deleted */
-				handle_event (handled, original_path (file), IN_DELETE, NULL);
+				handle_event (handled, original_path (file), IN_DELETE, NULL, file->debounce);
 			} else if (! strcmp (file->path, dir->path)) {
 				/* Watch is on the directory itself and a file within that
 				 * watched directory was deleted, hence emit the directory was
 				 * modified.
 				 */
 				if (file->events & IN_MODIFY)
-					handle_event (handled, original_path (file), IN_MODIFY, path);
+					handle_event (handled, original_path (file), IN_MODIFY, path, file->debounce);
 			}
 		} else if (file->glob) {
 			nih_local char *full_path = NULL;
@@ -1192,10 +1466,10 @@ delete_handler (WatchedDir  *dir,
 			full_path = NIH_MUST (nih_sprintf (NULL, "%s/%s", file->path, file->glob));
 
 			if (! fnmatch (full_path, path, FNM_PATHNAME) && (file->events & IN_DELETE))
-				handle_event (handled, full_path, IN_DELETE, path);
+				handle_event (handled, full_path, IN_DELETE, path, file->debounce);
 		} else {
 			if (! strcmp (file->path, path) && (file->events & IN_DELETE)) {
-				handle_event (handled, original_path (file), IN_DELETE, NULL);
+				handle_event (handled, original_path (file), IN_DELETE, NULL, file->debounce);
 			} else if ((p=strstr (file->path, path)) && p == file->path) {
 				/* Create a new directory watch for all
 				 * WatchedFiles whose immediate parent directory
@@ -1214,7 +1488,7 @@ delete_handler (WatchedDir  *dir,
 				nih_list_add (&entries, &file->entry);
 			} else if (file->dir && strstr (path, file->path) == path && (file->events & IN_DELETE)) {
 				/* file in watched directory deleted, so emit event */
-				handle_event (handled, path, IN_DELETE, NULL);
+				handle_event (handled, path, IN_DELETE, NULL, file->debounce);
 			}
 		}
 	}
@@ -1222,18 +1496,19 @@ delete_handler (WatchedDir  *dir,
 	if (! rm_dir)
 		return;
 
-	/* Remove the old directory watch */
-	nih_free (dir);
-
 	nih_assert (! NIH_LIST_EMPTY (&entries));
 
 	parent = find_first_parent (dir->path);
 	if (! parent) {
 		nih_warn ("%s: %s",
 				_("Failed to find parent directory"), dir->path);
+		nih_free (dir);
 		return;
 	}
 
+	/* Remove the old directory watch */
+	nih_free (dir);
+
 	/* Check to see if there is already an existing watch for the
 	 * parent.
 	 */
@@ -1258,6 +1533,7 @@ delete_handler (WatchedDir  *dir,
 	NIH_LIST_FOREACH_SAFE (&entries, iter) {
 		WatchedFile *file = (WatchedFile *)iter;
 
+		file->parent = new_dir;
 		nih_hash_add (new_dir->files, &file->entry);
 	}
 }
@@ -1340,6 +1616,12 @@ lookup:
 	file->parent = dir;
 	nih_hash_add (dir->files, &file->entry);
 
+	/* Index the file so that the handlers can find it */
+	file->node = path_node_lookup (file->path, TRUE);
+	file->node_entry = NIH_MUST (nih_list_entry_new (file));
+	file->node_entry->data = file;
+	nih_list_add (&file->node->files, &file->node_entry->entry);
+
 	/* Create a link from the job to the WatchedFile.
 	*/
 	entry = NIH_MUST (nih_list_entry_new (job));
@@ -1365,14 +1647,16 @@ watched_dir_init (void)
  * @path: original path as specified by a registered job,
  * @event_type: inotify event type that occured,
  * @match: file match that resulted from @path if it contains glob
- *  wildcards (or NULL).
+ *  wildcards (or NULL),
+ * @debounce: DEBOUNCE value of the jobs interested, or -1.
  *
  * Emit an Upstart event.
  **/
 static int
 emit_event (const char   *path,
 	    uint32_t      event_type,
-	    const char   *match)
+	    const char   *match,
+	    int           debounce)
 {
 	DBusPendingCall    *pending_call;
 	nih_local char    **env = NULL;
@@ -1400,6 +1684,12 @@ emit_event (const char   *path,
 		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
 	}
 
+	/* Needed for the conditions that gave it to match */
+	if (debounce >= 0) {
+		var = NIH_MUST (nih_sprintf (NULL, "DEBOUNCE=%d", debounce));
+		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+	}
+
 	pending_call = NIH_SHOULD (upstart_emit_event (upstart,
 				FILE_EVENT, env, FALSE,
 				NULL, emit_event_error, NULL,
@@ -1495,6 +1785,9 @@ watched_dir_new (const char         *path,
 
 	nih_alloc_set_destructor (dir, nih_list_destroy);
 
+	dir->watch = NULL;
+	dir->handle = NULL;
+
 	dir->path = nih_strdup (dir, path);
 	if (! dir->path)
 		goto error;
@@ -1505,6 +1798,10 @@ watched_dir_new (const char         *path,
 
 	nih_hash_add (watched_dirs, &dir->entry);
 
+	/* Filesystems that can't give file handles are left to inotify */
+	if (fanotify_fd >= 0 && ! fanotify_watch (dir, watched_path))
+		return dir;
+
 	/* Create a watch on the specified directory.
 	 *
 	 * Don't set a recursive watch as there is no need
@@ -1538,6 +1835,265 @@ error:
 	return NULL;
 }
 
+/**
+ * fanotify_watch:
+ *
+ * @dir: WatchedDir,
+ * @path: path of @dir without any trailing slash.
+ *
+ * Watch @dir through fanotify, marking its filesystem unless this has
+ * already been done for another WatchedDir.
+ *
+ * Returns: 0 on success, negative value if @dir must be watched through
+ * inotify instead.
+ **/
+static int
+fanotify_watch (WatchedDir  *dir,
+		const char  *path)
+{
+	struct {
+		struct file_handle  handle;
+		unsigned char       f_handle[MAX_HANDLE_SZ];
+	} buf;
+	struct statfs           statfsbuf;
+	char                    key[FANOTIFY_KEY_MAX];
+	char                    id[16 + 1];
+	int                     mount_id;
+	FanotifyHandle         *handle;
+
+	nih_assert (dir);
+	nih_assert (path);
+	nih_assert (fanotify_fd >= 0);
+
+	buf.handle.handle_bytes = MAX_HANDLE_SZ;
+	if (name_to_handle_at (AT_FDCWD, path, &buf.handle, &mount_id, 0) < 0)
+		return -1;
+
+	if (statfs (path, &statfsbuf) < 0)
+		return -1;
+
+	fanotify_key (key, &statfsbuf.f_fsid, &buf.handle);
+
+	if (! fanotify_marks)
+		fanotify_marks = NIH_MUST (nih_hash_string_new (NULL, 0));
+	if (! fanotify_dirs)
+		fanotify_dirs = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	/* The id is the first part of the key */
+	memcpy (id, key, 16);
+	id[16] = '\0';
+
+	if (! nih_hash_lookup (fanotify_marks, id)) {
+		NihListEntry *entry;
+
+		if (fanotify_mark (fanotify_fd,
+				   FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+				   FANOTIFY_EVENTS, AT_FDCWD, path) < 0) {
+			nih_warn ("%s %s: %s",
+				  _("Could not mark filesystem of path"),
+				  path, strerror (errno));
+			return -1;
+		}
+
+		entry = NIH_MUST (nih_list_entry_new (fanotify_marks));
+		entry->str = NIH_MUST (nih_strdup (entry, id));
+		nih_hash_add (fanotify_marks, &entry->entry);
+	}
+
+	handle = NIH_MUST (nih_new (dir, FanotifyHandle));
+	nih_list_init (&handle->entry);
+	nih_alloc_set_destructor (handle, nih_list_destroy);
+
+	handle->key = NIH_MUST (nih_strdup (handle, key));
+	handle->dir = dir;
+
+	nih_hash_add (fanotify_dirs, &handle->entry);
+	dir->handle = handle;
+
+	return 0;
+}
+
+/**
+ * fanotify_key:
+ *
+ * @key: buffer of FANOTIFY_KEY_MAX bytes,
+ * @fsid: filesystem id,
+ * @handle: file handle.
+ *
+ * Write the key identifying the file given by @fsid and @handle, the
+ * former being as given by statfs(2) and by fanotify alike, to @key.
+ **/
+static void
+fanotify_key (char                      *key,
+	      const void                *fsid,
+	      const struct file_handle  *handle)
+{
+	int val[2];
+
+	nih_assert (key);
+	nih_assert (fsid);
+	nih_assert (handle);
+	nih_assert (handle->handle_bytes <= MAX_HANDLE_SZ);
+
+	memcpy (val, fsid, sizeof (val));
+
+	key += sprintf (key, "%08x%08x:%08x:", (unsigned)val[0],
+			(unsigned)val[1], (unsigned)handle->handle_type);
+
+	for (unsigned int i = 0; i < handle->handle_bytes; i++)
+		key += sprintf (key, "%02x", handle->f_handle[i]);
+}
+
+/**
+ * fanotify_reader:
+ *
+ * @data: (unused),
+ * @watch: NihIoWatch for fanotify_fd,
+ * @events: events that occurred.
+ *
+ * Read the events queued on fanotify_fd and dispatch those for watched
+ * directories.
+ **/
+static void
+fanotify_reader (void        *data,
+		 NihIoWatch  *watch,
+		 NihIoEvents  events)
+{
+	char     buf[8192] __attribute__ ((aligned (__alignof__ (struct fanotify_event_metadata))));
+	ssize_t  len;
+
+	nih_assert (fanotify_fd >= 0);
+
+	while ((len = read (fanotify_fd, buf, sizeof (buf))) > 0) {
+		struct fanotify_event_metadata *metadata;
+
+		metadata = (struct fanotify_event_metadata *)buf;
+
+		for (; FAN_EVENT_OK (metadata, len);
+		     metadata = FAN_EVENT_NEXT (metadata, len)) {
+			struct fanotify_event_info_fid  *fid;
+			struct file_handle              *handle;
+			const char                      *name = NULL;
+			char                             key[FANOTIFY_KEY_MAX];
+
+			if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+				nih_fatal (_("Mismatched fanotify metadata version"));
+				nih_main_loop_exit (1);
+				return;
+			}
+
+			if (metadata->mask & FAN_Q_OVERFLOW) {
+				nih_warn (_("fanotify queue overflowed, events lost"));
+				continue;
+			}
+
+			if (metadata->event_len < metadata->metadata_len + sizeof (*fid))
+				continue;
+
+			fid = (struct fanotify_event_info_fid *)(metadata + 1);
+			handle = (struct file_handle *)fid->handle;
+
+			if (handle->handle_bytes > MAX_HANDLE_SZ)
+				continue;
+
+			if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+				name = (const char *)handle->f_handle
+					+ handle->handle_bytes;
+			} else if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID
+				   && fid->hdr.info_type != FAN_EVENT_INFO_TYPE_FID) {
+				continue;
+			}
+
+			fanotify_key (key, &fid->fsid, handle);
+			fanotify_dispatch (key, name, metadata->mask);
+		}
+	}
+
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		nih_warn ("%s: %s", _("Failed to read fanotify events"),
+			  strerror (errno));
+}
+
+/**
+ * fanotify_dispatch:
+ *
+ * @key: key of directory, as given by fanotify_key(),
+ * @name: name of entry in directory, or NULL or "." if the event is for
+ *  the directory itself,
+ * @mask: fanotify events.
+ *
+ * Call the handlers that NihWatch would for the inotify events
+ * equivalent to @mask, if the directory is a WatchedDir.
+ **/
+static void
+fanotify_dispatch (const char  *key,
+		   const char  *name,
+		   uint64_t     mask)
+{
+	FanotifyHandle  *handle;
+	WatchedDir      *dir;
+	nih_local char  *path = NULL;
+	size_t           len;
+	struct stat      statbuf;
+
+	nih_assert (key);
+
+	if (! fanotify_dirs)
+		return;
+
+	handle = (FanotifyHandle *)nih_hash_lookup (fanotify_dirs, key);
+	if (! handle)
+		return;
+
+	dir = handle->dir;
+
+	/* Handlers expect paths as NihWatch gives them, without the
+	 * trailing slash of the directory.
+	 */
+	len = strlen (dir->path);
+	if (len > 1 && dir->path[len-1] == '/')
+		len--;
+
+	if ((! name) || (! *name) || (! strcmp (name, "."))) {
+		if (mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+			path = NIH_MUST (nih_strndup (NULL, dir->path, len));
+			delete_handler (dir, dir->watch, path);
+		}
+		return;
+	}
+
+	path = NIH_MUST (nih_sprintf (NULL, "%.*s/%s", (int)len, dir->path, name));
+
+	if (file_filter (dir, path, (mask & FAN_ONDIR) != 0))
+		return;
+
+	/* Handlers may free or replace the WatchedDir, so it is looked
+	 * up again before each.
+	 */
+	if (mask & (FAN_CREATE | FAN_MOVED_TO)) {
+		if (! stat (path, &statbuf))
+			create_handler (dir, dir->watch, path, &statbuf);
+
+		handle = (FanotifyHandle *)nih_hash_lookup (fanotify_dirs, key);
+		if (! handle)
+			return;
+		dir = handle->dir;
+	}
+
+	if (mask & FAN_CLOSE_WRITE) {
+		if (! stat (path, &statbuf))
+			modify_handler (dir, dir->watch, path, &statbuf);
+
+		handle = (FanotifyHandle *)nih_hash_lookup (fanotify_dirs, key);
+		if (! handle)
+			return;
+		dir = handle->dir;
+	}
+
+	if (mask & (FAN_DELETE | FAN_MOVED_FROM))
+		delete_handler (dir, dir->watch, path);
+}
+
 /**
  * watched_file_new:
  *
@@ -1574,7 +2130,11 @@ watched_file_new (const char  *path,
 
 	nih_list_init (&file->entry);
 
-	nih_alloc_set_destructor (file, nih_list_destroy);
+	file->node = NULL;
+	file->node_entry = NULL;
+	file->debounce = -1;
+
+	nih_alloc_set_destructor (file, watched_file_destroy);
 
 	len = strlen (path);
 
@@ -1627,6 +2187,272 @@ error:
 	return NULL;
 }
 
+/**
+ * watched_file_destroy:
+ *
+ * @file: WatchedFile.
+ *
+ * Destructor that removes @file from its WatchedDir and from
+ * path_trie, pruning nodes that no longer lead to any file.
+ *
+ * Returns: zero.
+ **/
+static int
+watched_file_destroy (WatchedFile *file)
+{
+	nih_assert (file);
+
+	nih_list_destroy (&file->entry);
+
+	if (file->node_entry) {
+		nih_free (file->node_entry);
+		file->node_entry = NULL;
+
+		path_node_prune (file->node);
+		file->node = NULL;
+	}
+
+	return 0;
+}
+
+/**
+ * watched_files_find:
+ *
+ * @parent: parent of returned array,
+ * @dir: WatchedDir,
+ * @path: full path below @dir that an inotify event is for,
+ * @descendants: TRUE to include files below @path,
+ * @len: set to the number of entries in the returned array.
+ *
+ * Find the WatchedFiles of @dir that could be interested in an inotify
+ * event for @path: those for @dir itself and globs within it, those for
+ * @path and, if @descendants is TRUE, files below @path.
+ *
+ * Returns: newly-allocated array of WatchedFiles, or NULL if there are
+ * none.
+ **/
+static WatchedFile **
+watched_files_find (const void   *parent,
+		    WatchedDir   *dir,
+		    const char   *path,
+		    int           descendants,
+		    size_t       *len)
+{
+	WatchedFile  **files = NULL;
+	PathNode      *dir_node;
+	PathNode      *node;
+
+	nih_assert (dir);
+	nih_assert (path);
+	nih_assert (len);
+
+	*len = 0;
+
+	dir_node = path_node_lookup (dir->path, FALSE);
+	node = path_node_lookup (path, FALSE);
+
+	if (dir_node != node)
+		path_node_files (parent, dir_node, dir, FALSE, &files, len);
+
+	path_node_files (parent, node, dir, descendants, &files, len);
+
+	return files;
+}
+
+/**
+ * path_node_new:
+ *
+ * @parent: parent node, or NULL for the root,
+ * @name: path component.
+ *
+ * Create a new node of path_trie below @parent.
+ *
+ * Returns: PathNode (never fails).
+ **/
+static PathNode *
+path_node_new (PathNode    *parent,
+	       const char  *name)
+{
+	PathNode *node;
+
+	nih_assert (name);
+
+	node = NIH_MUST (nih_new (parent, PathNode));
+
+	nih_list_init (&node->entry);
+	nih_list_init (&node->files);
+
+	nih_alloc_set_destructor (node, nih_list_destroy);
+
+	node->name = NIH_MUST (nih_strdup (node, name));
+	node->parent = parent;
+	node->children = NULL;
+
+	if (parent) {
+		if (! parent->children)
+			parent->children = NIH_MUST (nih_hash_string_new (parent, 0));
+
+		nih_hash_add (parent->children, &node->entry);
+	}
+
+	return node;
+}
+
+/**
+ * path_node_next:
+ *
+ * @node: PathNode,
+ * @path: pointer to remainder of path below @node,
+ * @create: TRUE to create the node if it does not exist.
+ *
+ * Find the child of @node for the first component of *@path, advancing
+ * *@path past it and any slashes either side.
+ *
+ * Returns: PathNode, or NULL if it does not exist and @create is FALSE.
+ **/
+static PathNode *
+path_node_next (PathNode     *node,
+		const char  **path,
+		int           create)
+{
+	char       name[PATH_MAX];
+	PathNode  *child = NULL;
+	size_t     len;
+
+	nih_assert (node);
+	nih_assert (path);
+	nih_assert (*path);
+
+	while (**path == '/')
+		(*path)++;
+
+	len = strcspn (*path, "/");
+	nih_assert (len < sizeof (name));
+
+	memcpy (name, *path, len);
+	name[len] = '\0';
+
+	*path += len;
+	while (**path == '/')
+		(*path)++;
+
+	if (node->children)
+		child = (PathNode *)nih_hash_lookup (node->children, name);
+
+	if (! child && create)
+		child = path_node_new (node, name);
+
+	return child;
+}
+
+/**
+ * path_node_lookup:
+ *
+ * @path: full path,
+ * @create: TRUE to create nodes that do not exist.
+ *
+ * Find the node of path_trie for @path.
+ *
+ * Returns: PathNode, or NULL if it does not exist and @create is FALSE.
+ **/
+static PathNode *
+path_node_lookup (const char  *path,
+		  int          create)
+{
+	PathNode *node;
+
+	nih_assert (path);
+
+	if (! path_trie) {
+		if (! create)
+			return NULL;
+
+		path_trie = path_node_new (NULL, "");
+	}
+
+	node = path_trie;
+
+	while (*path == '/')
+		path++;
+
+	while (node && *path)
+		node = path_node_next (node, &path, create);
+
+	return node;
+}
+
+/**
+ * path_node_prune:
+ *
+ * @node: PathNode.
+ *
+ * Free @node, and then its parents in turn, while it has neither
+ * files nor children.
+ **/
+static void
+path_node_prune (PathNode *node)
+{
+	while (node && node != path_trie) {
+		PathNode *parent = node->parent;
+
+		if (! NIH_LIST_EMPTY (&node->files))
+			return;
+
+		if (node->children) {
+			NIH_HASH_FOREACH (node->children, iter)
+				return;
+		}
+
+		nih_free (node);
+		node = parent;
+	}
+}
+
+/**
+ * path_node_files:
+ *
+ * @parent: parent of @files if it needs to be allocated,
+ * @node: PathNode, or NULL,
+ * @dir: WatchedDir,
+ * @descendants: TRUE to include files of nodes below @node,
+ * @files: pointer to array to append to,
+ * @len: pointer to number of entries in @files.
+ *
+ * Append the WatchedFiles of @node that are watched by @dir to @files.
+ **/
+static void
+path_node_files (const void     *parent,
+		 PathNode       *node,
+		 WatchedDir     *dir,
+		 int             descendants,
+		 WatchedFile  ***files,
+		 size_t         *len)
+{
+	nih_assert (dir);
+	nih_assert (files);
+	nih_assert (len);
+
+	if (! node)
+		return;
+
+	NIH_LIST_FOREACH (&node->files, iter) {
+		WatchedFile *file = (WatchedFile *)((NihListEntry *)iter)->data;
+
+		if (file->parent != dir)
+			continue;
+
+		*files = NIH_MUST (nih_realloc (*files, parent,
+						sizeof (WatchedFile *) * (*len + 1)));
+		(*files)[(*len)++] = file;
+	}
+
+	if (descendants && node->children) {
+		NIH_HASH_FOREACH (node->children, iter)
+			path_node_files (parent, (PathNode *)iter, dir, TRUE,
+					 files, len);
+	}
+}
+
 /**
  * job_new:
  *
@@ -1765,12 +2591,14 @@ find_first_parent (const char *path)
  * @parent: parent,
  * @path: path that event should contain,
  * @event: inotify event,
- * @match: file match if @path contains glob wildcards.
+ * @match: file match if @path contains glob wildcards,
+ * @debounce: DEBOUNCE value of the jobs interested, or -1.
  *
  * Returns: newly-allocated FileEvent or NULL on insufficient memory.
  **/
 static FileEvent *
-file_event_new (void *parent, const char *path, uint32_t event, const char *match)
+file_event_new (void *parent, const char *path, uint32_t event, const char *match,
+		int debounce)
 {
 	FileEvent *file_event;
 
@@ -1790,6 +2618,7 @@ file_event_new (void *parent, const char *path, uint32_t event, const char *matc
 	file_event->match = match
 		? NIH_MUST (nih_strdup (file_event, match))
 		: NULL;
+	file_event->debounce = debounce;
 
 	return file_event;
 }
@@ -1798,16 +2627,20 @@ file_event_new (void *parent, const char *path, uint32_t event, const char *matc
  * handle_event:
  *
  * @handled: hash of FileEvents already handled,
- * @file_event: FileEvent to consider.
+ * @path: path that event should contain,
+ * @event: inotify event,
+ * @match: file match if @path contains glob wildcards,
+ * @debounce: DEBOUNCE value of the jobs interested, or -1.
  *
- * Determine if @file_event has already been handled; if not emit the
+ * Determine if the event has already been handled; if not queue the
  * event and record its details in @handled.
  **/
 static void
 handle_event (NihHash    *handled,
 	     const char  *path,
 	     uint32_t     event,
-	     const char  *match)
+	     const char  *match,
+	     int          debounce)
 {
 	FileEvent  *file_event;
 
@@ -1818,7 +2651,8 @@ handle_event (NihHash    *handled,
 	file_event = (FileEvent *)nih_hash_search (handled, path, NULL);
 
 	while (file_event) {
-		if ((file_event->event & event) && string_match (file_event->match, match)) {
+		if ((file_event->event & event) && string_match (file_event->match, match)
+		    && file_event->debounce == debounce) {
 			return;
 		}
 
@@ -1831,10 +2665,135 @@ handle_event (NihHash    *handled,
 	/* Event has not yet been handled, so emit it and record fact
 	 * it's now been handled.
 	 */
-	file_event = NIH_MUST (file_event_new (handled, path, event, match));
+	file_event = NIH_MUST (file_event_new (handled, path, event, match, debounce));
 	nih_hash_add (handled, &file_event->entry);
 
-	emit_event (path, event, match);
+	queue_event (path, event, match, debounce);
+}
+
+/**
+ * queue_event:
+ *
+ * @path: path that event should contain,
+ * @event: inotify event,
+ * @match: file match if @path contains glob wildcards,
+ * @debounce: DEBOUNCE value of the jobs interested, or -1.
+ *
+ * Emit the event now if it has no coalescing window, else hold it back
+ * until the window has passed; the event is dropped if the same one is
+ * already held back, while a different event for the same file causes
+ * that one to be emitted first so that they remain in order.
+ **/
+static void
+queue_event (const char  *path,
+	     uint32_t     event,
+	     const char  *match,
+	     int          debounce)
+{
+	PendingEvent    *pending;
+	nih_local char  *key = NULL;
+	int              window;
+	time_t           now;
+
+	nih_assert (path);
+	nih_assert (event);
+
+	window = debounce >= 0 ? debounce : debounce_default;
+	if (! window) {
+		emit_event (path, event, match, debounce);
+		return;
+	}
+
+	if (! pending_events)
+		pending_events = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	key = NIH_MUST (nih_sprintf (NULL, "%d:%s:%s", debounce, path,
+				     match ? match : ""));
+
+	pending = (PendingEvent *)nih_hash_lookup (pending_events, key);
+	if (pending) {
+		if (pending->event == event) {
+			nih_debug ("%s: %s", _("Coalesced event"), path);
+			return;
+		}
+
+		emit_event (pending->path, pending->event, pending->match,
+			    pending->debounce);
+		nih_free (pending);
+	}
+
+	now = time (NULL);
+
+	pending = NIH_MUST (nih_new (pending_events, PendingEvent));
+	nih_list_init (&pending->entry);
+	nih_alloc_set_destructor (pending, nih_list_destroy);
+
+	pending->key = NIH_MUST (nih_strdup (pending, key));
+	pending->path = NIH_MUST (nih_strdup (pending, path));
+	pending->event = event;
+	pending->match = match ? NIH_MUST (nih_strdup (pending, match)) : NULL;
+	pending->debounce = debounce;
+	pending->due = now + window;
+
+	nih_hash_add (pending_events, &pending->entry);
+
+	/* Windows differ between jobs, so the new event may fall due
+	 * before those already held back.
+	 */
+	if (pending_timer && pending_timer_due > pending->due) {
+		nih_free (pending_timer);
+		pending_timer = NULL;
+	}
+
+	if (! pending_timer) {
+		pending_timer = NIH_MUST (nih_timer_add_timeout (NULL, window,
+					pending_event_timer, NULL));
+		pending_timer_due = pending->due;
+	}
+}
+
+/**
+ * pending_event_timer:
+ *
+ * @data: (unused),
+ * @timer: timer that fired.
+ *
+ * Emit the events held back whose coalescing window has passed, and set
+ * the timer again for the next of those remaining.
+ **/
+static void
+pending_event_timer (void      *data,
+		     NihTimer  *timer)
+{
+	time_t  now;
+	time_t  next = 0;
+
+	nih_assert (pending_events);
+
+	/* Timer is freed by NIH on return */
+	pending_timer = NULL;
+
+	now = time (NULL);
+
+	NIH_HASH_FOREACH_SAFE (pending_events, iter) {
+		PendingEvent *pending = (PendingEvent *)iter;
+
+		if (pending->due > now) {
+			if (! next || pending->due < next)
+				next = pending->due;
+			continue;
+		}
+
+		emit_event (pending->path, pending->event, pending->match,
+			    pending->debounce);
+		nih_free (pending);
+	}
+
+	if (next) {
+		pending_timer = NIH_MUST (nih_timer_add_timeout (NULL, next - now,
+					pending_event_timer, NULL));
+		pending_timer_due = next;
+	}
 }
 
 /**
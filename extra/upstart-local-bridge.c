@@ -90,7 +90,10 @@ typedef struct socket {
  *
  * @sock: socket client connected via,
  * @fd: file descriptor client connected on,
- * @ucred: client credentials.
+ * @ucred: client credentials,
+ * @io: NihIo for @fd,
+ * @frames: list of Frames awaiting a reply from Upstart,
+ * @next_seq: sequence number of the next frame.
  *
  * Representation of a connected client.
  **/
@@ -98,8 +101,44 @@ typedef struct client_connection {
 	Socket        *sock;
 	int            fd;
 	struct ucred   ucred;
+	NihIo         *io;
+	NihList        frames;
+	unsigned int   next_seq;
 } ClientConnection;
 
+/**
+ * Frame:
+ *
+ * @entry: list header,
+ * @client: client that sent the frame, or NULL if it has gone away,
+ * @seq: sequence number of the frame,
+ * @count: number of events in the frame.
+ *
+ * Frame of events emitted with a single method call, whose status is
+ * written back to the client once Upstart replies.
+ **/
+typedef struct frame {
+	NihList            entry;
+	ClientConnection  *client;
+	unsigned int       seq;
+	size_t             count;
+} Frame;
+
+/**
+ * FRAME_HEADER:
+ *
+ * Line that starts a frame, followed by the number of name=value pairs
+ * in it.
+ **/
+#define FRAME_HEADER "FRAME "
+
+/**
+ * FRAME_EVENTS_MAX:
+ *
+ * Maximum number of events in a single frame.
+ **/
+#define FRAME_EVENTS_MAX 1024
+
 static void upstart_job_added    (void *data, NihDBusMessage *message,
 				  const char *job);
 static void upstart_job_removed  (void *data, NihDBusMessage *message,
@@ -121,6 +160,23 @@ static void emit_event_error (void *data, NihDBusMessage *message);
 
 static void emit_event (ClientConnection *client, const char *pair, size_t len);
 
+static char **event_env (const void *parent, ClientConnection *client,
+			 const char *pair, size_t len);
+
+static int  check_pair (char *pair, size_t *len);
+
+static char *read_frame (ClientConnection *client, char *header);
+
+static void emit_frame (ClientConnection *client, unsigned int seq,
+			char **pairs, size_t count);
+
+static void frame_reply (void *data, NihDBusMessage *message);
+
+static void frame_error (void *data, NihDBusMessage *message);
+
+static void frame_status (ClientConnection *client, unsigned int seq,
+			  size_t count, const char *error);
+
 static void signal_handler (void *data, NihSignal *signal);
 
 static void cleanup (void);
@@ -527,6 +583,7 @@ socket_watcher (Socket *sock,
 	client = NIH_MUST (nih_new (NULL, ClientConnection));
 	memset (client, 0, sizeof (ClientConnection));
 	client->sock = sock;
+	nih_list_init (&client->frames);
 
 	client_len = sizeof (struct sockaddr);
 
@@ -561,7 +618,7 @@ socket_watcher (Socket *sock,
 			client->ucred.gid);
 
 	/* Wait for remote end to send data */
-	NIH_MUST (nih_io_reopen (sock, client->fd,
+	client->io = NIH_MUST (nih_io_reopen (sock, client->fd,
 			NIH_IO_STREAM, 
 			(NihIoReader)socket_reader, 
 			(NihIoCloseHandler)close_handler,
@@ -585,6 +642,10 @@ error:
  *
  * NihIoReader function called when data has been read from the
  * connected client.
+ *
+ * Each line is a name=value pair emitted as an event of its own, unless
+ * it is a FRAME_HEADER, in which case the number of lines it gives are
+ * emitted together by read_frame() once all of them have been received.
  **/
 static void
 socket_reader (ClientConnection  *client,
@@ -594,62 +655,56 @@ socket_reader (ClientConnection  *client,
 {
 	nih_local char     *pairs = NULL;
 	char               *pair;
+	char               *next;
 	size_t              used_len = 0;
-	size_t              i;
-
-	/* Ignore messages that are too short.
-	 * (minimum message is of form "a=").
-	 */
-	size_t              min_len = 2;
+	size_t              consumed = len;
 
 	nih_assert (sock);
 	nih_assert (client);
 	nih_assert (io);
 	nih_assert (buf);
 
-	if (len < min_len)
+	/* Ignore messages that are too short.
+	 * (minimum message is of form "a=").
+	 */
+	if (len < 2)
 		goto error;
 
-	pairs = nih_strdup (NULL, buf);
+	pairs = nih_strndup (NULL, buf, len);
 	if (! pairs)
 		return;
 
-	for (pair = strsep (&pairs, "\n");
-	     pair;
-	     pair = strsep (&pairs, "\n")) {
+	for (pair = pairs; *pair; pair = next) {
+		char *eol;
 
-		used_len = strlen (pair);
+		if (! strncmp (pair, FRAME_HEADER, strlen (FRAME_HEADER))) {
+			next = read_frame (client, pair);
 
-		if (used_len < min_len)
-			continue;
+			/* Keep incomplete frames until the rest arrives */
+			if (! next) {
+				consumed = pair - pairs;
+				break;
+			}
 
-		/* Ensure the data is a 'name=value' pair */
-		if (! strchr (pair, '=') || pair[0] == '=')
 			continue;
-
-		/* Remove extraneous line ending */
-		if (pair[used_len-1] == '\r') {
-			pair[used_len-1] = '\0';
-			used_len--;
 		}
 
-		/* Ignore invalid input */
-		for (i = 0; i < used_len; i++) {
-			if (! isprint (pair[i]) && ! isspace (pair[i]))
-				continue;
+		eol = strchr (pair, '\n');
+		if (eol) {
+			*eol = '\0';
+			next = eol + 1;
+		} else {
+			next = pair + strlen (pair);
 		}
 
-		/* Yet another check to ensure overly short messages are ignored
-		 * (required since we may have adjusted used_len
-		 */
-		if (used_len < min_len)
+		if (check_pair (pair, &used_len) < 0)
 			continue;
 
 		emit_event (client, pair, used_len);
 	}
 
-	/* Consume the entire length */
-	nih_io_buffer_shrink (io->recv_buf, len);
+	/* Consume everything but an incomplete frame */
+	nih_io_buffer_shrink (io->recv_buf, consumed);
 
 	return;
 
@@ -661,6 +716,143 @@ error:
 	nih_io_buffer_shrink (io->recv_buf, len);
 }
 
+/**
+ * check_pair:
+ *
+ * @pair: line read from client,
+ * @len: set to length of @pair.
+ *
+ * Checks that @pair is a name=value pair, removing any carriage return
+ * at its end.
+ *
+ * Returns: 0 if @pair is valid, negative value otherwise.
+ **/
+static int
+check_pair (char    *pair,
+	    size_t  *len)
+{
+	size_t  used_len;
+	size_t  i;
+
+	/* Ignore messages that are too short.
+	 * (minimum message is of form "a=").
+	 */
+	size_t  min_len = 2;
+
+	nih_assert (pair);
+	nih_assert (len);
+
+	used_len = strlen (pair);
+
+	if (used_len < min_len)
+		return -1;
+
+	/* Ensure the data is a 'name=value' pair */
+	if (! strchr (pair, '=') || pair[0] == '=')
+		return -1;
+
+	/* Remove extraneous line ending */
+	if (pair[used_len-1] == '\r') {
+		pair[used_len-1] = '\0';
+		used_len--;
+	}
+
+	/* Ignore invalid input */
+	for (i = 0; i < used_len; i++) {
+		if (! isprint (pair[i]) && ! isspace (pair[i]))
+			continue;
+	}
+
+	/* Yet another check to ensure overly short messages are ignored
+	 * (required since we may have adjusted used_len
+	 */
+	if (used_len < min_len)
+		return -1;
+
+	*len = used_len;
+
+	return 0;
+}
+
+/**
+ * read_frame:
+ *
+ * @client: client connection,
+ * @header: FRAME_HEADER line read from client, followed by the rest of
+ *  the data read.
+ *
+ * Emits the name=value pairs of the frame starting at @header with a
+ * single method call, or writes a failed status back to the client if
+ * the frame is invalid.
+ *
+ * Returns: pointer to the data following the frame, or NULL if the
+ * frame has not been completely received yet.
+ **/
+static char *
+read_frame (ClientConnection  *client,
+	    char              *header)
+{
+	nih_local char  **pairs = NULL;
+	char             *line;
+	char             *eol;
+	char             *end;
+	char             *endptr;
+	unsigned long     count;
+	unsigned int      seq;
+
+	nih_assert (client);
+	nih_assert (header);
+
+	eol = strchr (header, '\n');
+	if (! eol)
+		return NULL;
+
+	count = strtoul (header + strlen (FRAME_HEADER), &endptr, 10);
+	if (*endptr == '\r')
+		endptr++;
+
+	if ((endptr != eol) || (! count) || (count > FRAME_EVENTS_MAX)) {
+		*eol = '\0';
+		nih_debug ("ignoring invalid frame header '%s'", header);
+		frame_status (client, client->next_seq++, 0, "invalid frame header");
+		return eol + 1;
+	}
+
+	/* Wait until every line of the frame is here */
+	end = eol + 1;
+	for (unsigned long i = 0; i < count; i++) {
+		eol = strchr (end, '\n');
+		if (! eol)
+			return NULL;
+
+		end = eol + 1;
+	}
+
+	seq = client->next_seq++;
+	pairs = NIH_MUST (nih_alloc (NULL, sizeof (char *) * count));
+
+	line = strchr (header, '\n') + 1;
+	for (unsigned long i = 0; i < count; i++) {
+		size_t used_len;
+
+		eol = strchr (line, '\n');
+		*eol = '\0';
+
+		/* A frame is emitted in full or not at all */
+		if (check_pair (line, &used_len) < 0) {
+			frame_status (client, seq, count, "invalid name=value pair");
+			return end;
+		}
+
+		pairs[i] = line;
+		line = eol + 1;
+	}
+
+	emit_frame (client, seq, pairs, count);
+
+	return end;
+}
+
 static void
 close_handler (ClientConnection *client, NihIo *io)
 {
@@ -669,6 +861,14 @@ close_handler (ClientConnection *client, NihIo *io)
 
 	nih_debug ("Remote end closed connection");
 
+	/* Replies still to come have nowhere to go */
+	NIH_LIST_FOREACH_SAFE (&client->frames, iter) {
+		Frame *frame = (Frame *)iter;
+
+		frame->client = NULL;
+		nih_list_remove (&frame->entry);
+	}
+
 	close (client->fd);
 	nih_free (client);
 	nih_free (io);
@@ -787,11 +987,52 @@ emit_event (ClientConnection  *client,
 {
 	DBusPendingCall    *pending_call;
 	nih_local char    **env = NULL;
+
+	nih_assert  (client);
+	nih_assert  (pair);
+	nih_assert  (len);
+
+	env = event_env (NULL, client, pair, len);
+
+	pending_call = upstart_emit_event (upstart,
+			event_name, env, FALSE,
+			NULL, emit_event_error, NULL,
+			NIH_DBUS_TIMEOUT_NEVER);
+
+	if (! pending_call) {
+		NihError *err;
+		err = nih_error_get ();
+		nih_warn ("%s", err->message);
+		nih_free (err);
+		return;
+	}
+
+	dbus_pending_call_unref (pending_call);
+}
+
+/**
+ * event_env:
+ *
+ * @parent: parent object for new array,
+ * @client: client connection,
+ * @pair: name=value pair,
+ * @len: length of @pair.
+ *
+ * Returns: newly-allocated environment of the event for @pair.
+ **/
+static char **
+event_env (const void        *parent,
+	   ClientConnection  *client,
+	   const char        *pair,
+	   size_t             len)
+{
+	char              **env;
 	nih_local char     *var = NULL;
 
 	nih_assert  (client);
 	nih_assert  (pair);
 	nih_assert  (len);
+
 	/* Construct the event environment.
 	 *
 	 * Note that although the client could conceivably specify one
@@ -805,42 +1046,173 @@ emit_event (ClientConnection  *client,
 	 * occurence of a variable. In summary, a malicious client
 	 * cannot spoof the standard variables we set.
 	 */
-	env = NIH_MUST (nih_str_array_new (NULL));
+	env = NIH_MUST (nih_str_array_new (parent));
 
 	/* Specify type to allow for other types to be added in the future */
 	var = NIH_MUST (nih_sprintf (NULL, "SOCKET_TYPE=%s", socket_type));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	var = NIH_MUST (nih_sprintf (NULL, "SOCKET_VARIANT=%s",
 				sock->sun_addr.sun_path[0] ? "named" : "abstract"));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	var = NIH_MUST (nih_sprintf (NULL, "CLIENT_UID=%u", (unsigned int)client->ucred.uid));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	var = NIH_MUST (nih_sprintf (NULL, "CLIENT_GID=%u", (unsigned int)client->ucred.gid));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	var = NIH_MUST (nih_sprintf (NULL, "CLIENT_PID=%u", (unsigned int)client->ucred.pid));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	var = NIH_MUST (nih_sprintf (NULL, "SOCKET_PATH=%s", socket_path));
-	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	NIH_MUST (nih_str_array_addp (&env, parent, NULL, var));
 
 	/* Add the name=value pair */
-	NIH_MUST (nih_str_array_addn (&env, NULL, NULL, pair, len));
+	NIH_MUST (nih_str_array_addn (&env, parent, NULL, pair, len));
 
-	pending_call = upstart_emit_event (upstart,
-			event_name, env, FALSE,
-			NULL, emit_event_error, NULL,
+	return env;
+}
+
+/**
+ * emit_frame:
+ *
+ * @client: client connection,
+ * @seq: sequence number of frame,
+ * @pairs: name=value pairs of frame,
+ * @count: number of entries in @pairs.
+ *
+ * Emits an event for each of @pairs with a single EmitEvents method
+ * call, without waiting for the reply; the status of the frame is
+ * written back to @client once it arrives.
+ **/
+static void
+emit_frame (ClientConnection   *client,
+	    unsigned int        seq,
+	    char              **pairs,
+	    size_t              count)
+{
+	DBusPendingCall                           *pending_call;
+	nih_local UpstartEmitEventsEventsElement **events = NULL;
+	Frame                                     *frame;
+
+	nih_assert (client);
+	nih_assert (pairs);
+	nih_assert (count);
+
+	events = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)
+				      * (count + 1)));
+
+	for (size_t i = 0; i < count; i++) {
+		events[i] = NIH_MUST (nih_new (events, UpstartEmitEventsEventsElement));
+		events[i]->item0 = event_name;
+		events[i]->item1 = event_env (events[i], client, pairs[i],
+					      strlen (pairs[i]));
+	}
+	events[count] = NULL;
+
+	frame = NIH_MUST (nih_new (NULL, Frame));
+	nih_list_init (&frame->entry);
+	nih_alloc_set_destructor (frame, nih_list_destroy);
+
+	frame->client = client;
+	frame->seq = seq;
+	frame->count = count;
+
+	pending_call = upstart_emit_events (upstart, events,
+			frame_reply, frame_error, frame,
 			NIH_DBUS_TIMEOUT_NEVER);
 
 	if (! pending_call) {
 		NihError *err;
+
 		err = nih_error_get ();
-		nih_warn ("%s", err->message);
+		frame_status (client, seq, count, err->message);
 		nih_free (err);
+		nih_free (frame);
+		return;
 	}
 
+	nih_list_add (&client->frames, &frame->entry);
+
 	dbus_pending_call_unref (pending_call);
 }
+
+/**
+ * frame_reply:
+ *
+ * @data: Frame emitted,
+ * @message: D-Bus message (unused).
+ *
+ * Called when Upstart has accepted the events of the frame.
+ **/
+static void
+frame_reply (void            *data,
+	     NihDBusMessage  *message)
+{
+	Frame *frame = data;
+
+	nih_assert (frame);
+
+	if (frame->client)
+		frame_status (frame->client, frame->seq, frame->count, NULL);
+
+	nih_free (frame);
+}
+
+/**
+ * frame_error:
+ *
+ * @data: Frame emitted,
+ * @message: D-Bus message (unused).
+ *
+ * Called when Upstart has failed to emit the events of the frame.
+ **/
+static void
+frame_error (void            *data,
+	     NihDBusMessage  *message)
+{
+	Frame    *frame = data;
+	NihError *err;
+
+	nih_assert (frame);
+
+	err = nih_error_get ();
+	nih_warn ("%s", err->message);
+
+	if (frame->client)
+		frame_status (frame->client, frame->seq, frame->count,
+			      err->message);
+
+	nih_free (err);
+	nih_free (frame);
+}
+
+/**
+ * frame_status:
+ *
+ * @client: client connection,
+ * @seq: sequence number of frame,
+ * @count: number of events in frame,
+ * @error: reason the frame failed, or NULL if it was accepted.
+ *
+ * Writes a line with the status of a frame back to @client, of the form
+ * "SEQ OK COUNT" or "SEQ FAILED COUNT ERROR".
+ **/
+static void
+frame_status (ClientConnection  *client,
+	      unsigned int       seq,
+	      size_t             count,
+	      const char        *error)
+{
+	nih_assert (client);
+	nih_assert (client->io);
+
+	if (error) {
+		NIH_ZERO (nih_io_printf (client->io, "%u FAILED %zu %s\n",
+					 seq, count, error));
+	} else {
+		NIH_ZERO (nih_io_printf (client->io, "%u OK %zu\n",
+					 seq, count));
+	}
+}
@@ -62,6 +62,14 @@ typedef struct job {
 	NihList sockets;
 } Job;
 
+/**
+ * SOCKET_QUEUE_DEFAULT:
+ *
+ * Number of accepted connections held by the bridge for a socket with
+ * ACCEPT=yes while no instance can take them, unless QUEUE is given.
+ **/
+#define SOCKET_QUEUE_DEFAULT 64
+
 /* Structure we use for tracking listening sockets */
 typedef struct socket {
 	NihList entry;
@@ -75,8 +83,43 @@ typedef struct socket {
 	socklen_t addrlen;
 
 	int sock;
+
+	/* With REUSEPORT, further sockets bound to the same address that
+	 * the kernel balances connections across; all are passed to the job.
+	 */
+	int      reuse_port;
+	int     *reuse;
+	int      num_reuse;
+
+	/* Only used with ACCEPT=yes: the bridge accepts connections itself
+	 * and passes them to instances of the job over channels, holding up
+	 * to queue_max of them in queue while none can take them.
+	 */
+	int      accept;
+	int      queue_max;
+	int      pool_max;
+	char   **options;
+	int     *queue;
+	int      queue_head;
+	int      queue_len;
+	int      paused;
+	NihList  channels;
 } Socket;
 
+/* Structure we use for tracking the channel to an instance of a job
+ * that we pass accepted connections to
+ */
+typedef struct channel {
+	NihList entry;
+	Socket *sock;
+
+	int index;
+	int fd;
+	int blocked;
+
+	NihIoWatch *watch;
+} Channel;
+
 
 /* Prototypes for static functions */
 static void epoll_watcher        (void *data, NihIoWatch *watch,
@@ -90,6 +133,18 @@ static void socket_destroy       (Socket *socket);
 static void upstart_disconnected (DBusConnection *connection);
 static void emit_event_reply     (Socket *sock, NihDBusMessage *message);
 static void emit_event_error     (Socket *sock, NihDBusMessage *message);
+static char **socket_env         (const void *parent, Socket *sock);
+static void socket_emit          (Socket *sock, char **env,
+				  const int *fds, size_t num_fds);
+static int  socket_listen        (Socket *sock, Job *job);
+static void socket_accept        (Socket *sock);
+static void socket_dispatch      (Socket *sock);
+static void socket_flush         (Socket *sock);
+static Channel *channel_new      (Socket *sock);
+static int  channel_destroy      (Channel *channel);
+static int  channel_send         (Channel *channel, int fd);
+static void channel_watcher      (Channel *channel, NihIoWatch *watch,
+				  NihIoEvents events);
 
 
 /**
@@ -293,10 +348,6 @@ epoll_watcher (void *      data,
 	for (int i = 0; i < num_events; i++) {
 		Socket *sock = (Socket *)event[i].data.ptr;
 		nih_local char **env = NULL;
-		size_t env_len = 0;
-		char *var;
-		DBusPendingCall *pending_call;
-		char buffer[INET6_ADDRSTRLEN];
 
 		if (event[i].events & EPOLLIN)
 			nih_debug ("%p EPOLLIN", sock);
@@ -305,77 +356,490 @@ epoll_watcher (void *      data,
 		if (event[i].events & EPOLLHUP)
 			nih_debug ("%p EPOLLHUP", sock);
 
-		env = NIH_MUST (nih_str_array_new (NULL));
-
-		switch (sock->addr.sa_family) {
-		case AF_INET:
-			NIH_MUST (nih_str_array_add (&env, NULL, &env_len,
-							"PROTO=inet"));
-
-			var = NIH_MUST (nih_sprintf (NULL, "PORT=%d",
-							ntohs (sock->sin_addr.sin_port)));
-			NIH_MUST (nih_str_array_addp (&env, NULL, &env_len,
-							var));
-			nih_discard (var);
-
-			var = NIH_MUST (nih_sprintf (NULL, "ADDR=%s",
-							inet_ntoa (sock->sin_addr.sin_addr)));
-			NIH_MUST (nih_str_array_addp (&env, NULL, &env_len,
-							var));
-			nih_discard (var);
-			break;
- 		case AF_INET6:
-			NIH_MUST (nih_str_array_add (&env, NULL, &env_len,
-							"PROTO=inet6"));
-
-			var = NIH_MUST (nih_sprintf (NULL, "PORT=%d",
-							ntohs (sock->sin6_addr.sin6_port)));
-			NIH_MUST (nih_str_array_addp (&env, NULL, &env_len,
-							var));
-			nih_discard (var);
-
-			var = NIH_MUST (nih_sprintf (NULL, "ADDR=%s",
-							inet_ntop(AF_INET6, &sock->sin6_addr.sin6_addr, buffer, INET6_ADDRSTRLEN)));
-
-			NIH_MUST (nih_str_array_addp (&env, NULL, &env_len,
-							var));
-			nih_discard (var);
-			break;
-		case AF_UNIX:
-			NIH_MUST (nih_str_array_add (&env, NULL, &env_len,
-						     "PROTO=unix"));
-
-			var = NIH_MUST (nih_sprintf (NULL, "SOCKET_PATH=%s",
-						     sock->sun_addr.sun_path));
-			NIH_MUST (nih_str_array_addp (&env, NULL, &env_len,
-						      var));
-			nih_discard (var);
-			break;
-		default:
-			nih_assert_not_reached ();
+		if (sock->accept) {
+			socket_accept (sock);
+			continue;
+		}
+
+		env = socket_env (NULL, sock);
+
+		if (sock->num_reuse) {
+			int fds[sock->num_reuse + 1];
+
+			fds[0] = sock->sock;
+			memcpy (fds + 1, sock->reuse, sizeof (int) * sock->num_reuse);
+
+			socket_emit (sock, env, fds, sock->num_reuse + 1);
+		} else {
+			socket_emit (sock, env, &sock->sock, 1);
 		}
 
+		// might be EPOLLIN
+		// might be EPOLLERR
+		// might be EPOLLHUP
+	}
+}
+
+/**
+ * socket_env:
+ * @parent: parent object for new array,
+ * @sock: socket to describe.
+ *
+ * Builds the environment of a socket event for @sock, including any
+ * ACCEPT, QUEUE and POOL variables of the condition so that it still
+ * matches.
+ *
+ * Returns: newly allocated environment array.
+ **/
+static char **
+socket_env (const void *parent,
+	    Socket *    sock)
+{
+	char **env;
+	size_t env_len = 0;
+	char *var;
+	char buffer[INET6_ADDRSTRLEN];
+
+	nih_assert (sock != NULL);
+
+	env = NIH_MUST (nih_str_array_new (parent));
+
+	switch (sock->addr.sa_family) {
+	case AF_INET:
+		NIH_MUST (nih_str_array_add (&env, parent, &env_len,
+						"PROTO=inet"));
+
+		var = NIH_MUST (nih_sprintf (NULL, "PORT=%d",
+						ntohs (sock->sin_addr.sin_port)));
+		NIH_MUST (nih_str_array_addp (&env, parent, &env_len,
+						var));
+		nih_discard (var);
+
+		var = NIH_MUST (nih_sprintf (NULL, "ADDR=%s",
+						inet_ntoa (sock->sin_addr.sin_addr)));
+		NIH_MUST (nih_str_array_addp (&env, parent, &env_len,
+						var));
+		nih_discard (var);
+		break;
+	case AF_INET6:
+		NIH_MUST (nih_str_array_add (&env, parent, &env_len,
+						"PROTO=inet6"));
+
+		var = NIH_MUST (nih_sprintf (NULL, "PORT=%d",
+						ntohs (sock->sin6_addr.sin6_port)));
+		NIH_MUST (nih_str_array_addp (&env, parent, &env_len,
+						var));
+		nih_discard (var);
+
+		var = NIH_MUST (nih_sprintf (NULL, "ADDR=%s",
+						inet_ntop(AF_INET6, &sock->sin6_addr.sin6_addr, buffer, INET6_ADDRSTRLEN)));
+
+		NIH_MUST (nih_str_array_addp (&env, parent, &env_len,
+						var));
+		nih_discard (var);
+		break;
+	case AF_UNIX:
+		NIH_MUST (nih_str_array_add (&env, parent, &env_len,
+					     "PROTO=unix"));
+
+		var = NIH_MUST (nih_sprintf (NULL, "SOCKET_PATH=%s",
+					     sock->sun_addr.sun_path));
+		NIH_MUST (nih_str_array_addp (&env, parent, &env_len,
+					      var));
+		nih_discard (var);
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	for (char **option = sock->options; option && *option; option++)
+		NIH_MUST (nih_str_array_add (&env, parent, &env_len, *option));
+
+	return env;
+}
+
+/**
+ * socket_emit:
+ * @sock: socket event is for,
+ * @env: environment of event,
+ * @fds: file descriptors to pass with event,
+ * @num_fds: number of entries in @fds.
+ *
+ * Emits a socket event with @env, passing @fds to the job; Upstart is
+ * given its own copies of @fds.  A single file descriptor is passed with
+ * EmitEventWithFile so that older versions of Upstart still work.
+ **/
+static void
+socket_emit (Socket *    sock,
+	     char **     env,
+	     const int * fds,
+	     size_t      num_fds)
+{
+	DBusPendingCall *pending_call;
+
+	nih_assert (sock != NULL);
+	nih_assert (env != NULL);
+	nih_assert (fds != NULL);
+	nih_assert (num_fds > 0);
+
+	if (num_fds == 1) {
 		pending_call = NIH_SHOULD (upstart_emit_event_with_file (
 						   upstart, "socket", env, TRUE,
-						   sock->sock,
+						   fds[0],
 						   (UpstartEmitEventWithFileReply)emit_event_reply,
 						   (NihDBusErrorHandler)emit_event_error,
 						   sock,
 						   NIH_DBUS_TIMEOUT_NEVER));
-		if (! pending_call) {
-			NihError *err;
+	} else {
+		pending_call = NIH_SHOULD (upstart_emit_event_with_files (
+						   upstart, "socket", env, TRUE,
+						   (int *)fds, num_fds,
+						   (UpstartEmitEventWithFilesReply)emit_event_reply,
+						   (NihDBusErrorHandler)emit_event_error,
+						   sock,
+						   NIH_DBUS_TIMEOUT_NEVER));
+	}
+	if (! pending_call) {
+		NihError *err;
 
-			err = nih_error_get ();
-			nih_warn ("%s: %s", _("Could not send socket event"),
-				  err->message);
-			nih_free (err);
+		err = nih_error_get ();
+		nih_warn ("%s: %s", _("Could not send socket event"),
+			  err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	dbus_pending_call_unref (pending_call);
+}
+
+/**
+ * socket_accept:
+ * @sock: listening socket with ACCEPT=yes.
+ *
+ * Accepts connections on @sock and passes them to instances of its job,
+ * until none are waiting or the queue is full; in the latter case the
+ * rest are left in the listen backlog until socket_dispatch() makes room.
+ **/
+static void
+socket_accept (Socket *sock)
+{
+	nih_assert (sock != NULL);
+	nih_assert (sock->accept);
+
+	while (sock->queue_len < sock->queue_max) {
+		int fd;
+
+		fd = accept4 (sock->sock, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if ((errno == EINTR) || (errno == ECONNABORTED))
+				continue;
+
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				nih_warn ("Failed to accept connection on socket: %s",
+					  strerror (errno));
+
+			return;
 		}
 
-		dbus_pending_call_unref (pending_call);
+		sock->queue[(sock->queue_head + sock->queue_len)
+			    % sock->queue_max] = fd;
+		sock->queue_len++;
 
-		// might be EPOLLIN
-		// might be EPOLLERR
-		// might be EPOLLHUP
+		socket_dispatch (sock);
+	}
+
+	/* Being edge-triggered, we won't hear about the connections left
+	 * in the backlog again until the socket is re-armed.
+	 */
+	nih_debug ("%p queue full", sock);
+	sock->paused = TRUE;
+}
+
+/**
+ * socket_dispatch:
+ * @sock: listening socket with ACCEPT=yes.
+ *
+ * Passes queued connections of @sock to the channels of instances that
+ * can take them, in turn, emitting a socket event for a new instance
+ * while all are busy and fewer than POOL exist.
+ **/
+static void
+socket_dispatch (Socket *sock)
+{
+	nih_assert (sock != NULL);
+	nih_assert (sock->accept);
+
+	while (sock->queue_len) {
+		Channel *channel = NULL;
+		int      channels = 0;
+		int      created = FALSE;
+		int      fd;
+
+		NIH_LIST_FOREACH (&sock->channels, iter) {
+			Channel *ch = (Channel *)iter;
+
+			channels++;
+			if ((! channel) && (! ch->blocked))
+				channel = ch;
+		}
+
+		if (! channel) {
+			if (channels >= sock->pool_max)
+				break;
+
+			channel = channel_new (sock);
+			if (! channel)
+				break;
+
+			created = TRUE;
+		}
+
+		fd = sock->queue[sock->queue_head];
+
+		if (channel_send (channel, fd) < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				channel->blocked = TRUE;
+				channel->watch->events |= NIH_IO_WRITE;
+				continue;
+			}
+
+			nih_warn ("Failed to pass connection to instance: %s",
+				  strerror (errno));
+			nih_free (channel);
+
+			if (created)
+				break;
+
+			continue;
+		}
+
+		close (fd);
+		sock->queue_head = (sock->queue_head + 1) % sock->queue_max;
+		sock->queue_len--;
+
+		/* Move to the back so the next gets the next connection */
+		nih_list_add (&sock->channels, &channel->entry);
+	}
+
+	if (sock->paused && (sock->queue_len < sock->queue_max)) {
+		struct epoll_event event;
+
+		/* Re-arm to be told about the connections left waiting */
+		event.events = EPOLLIN | EPOLLET;
+		event.data.ptr = sock;
+
+		sock->paused = FALSE;
+		if (epoll_ctl (epoll_fd, EPOLL_CTL_MOD, sock->sock, &event) < 0)
+			nih_warn ("Failed to watch socket: %s", strerror (errno));
+	}
+}
+
+/**
+ * socket_flush:
+ * @sock: listening socket with ACCEPT=yes.
+ *
+ * Closes the connections queued for @sock, used when the last instance
+ * of its job goes away rather than starting another for them; the next
+ * connection does that instead.
+ **/
+static void
+socket_flush (Socket *sock)
+{
+	nih_assert (sock != NULL);
+
+	while (sock->queue_len) {
+		close (sock->queue[sock->queue_head]);
+		sock->queue_head = (sock->queue_head + 1) % sock->queue_max;
+		sock->queue_len--;
+	}
+
+	socket_dispatch (sock);
+}
+
+
+/**
+ * channel_new:
+ * @sock: listening socket with ACCEPT=yes.
+ *
+ * Creates a new channel for @sock and emits a socket event passing the
+ * other end of it to a new instance of its job, with CHANNEL set to the
+ * lowest index not in use by another channel.
+ *
+ * Returns: new channel or NULL on failure.
+ **/
+static Channel *
+channel_new (Socket *sock)
+{
+	Channel         *channel;
+	nih_local char **env = NULL;
+	char            *var;
+	int              fds[2];
+	int              index = 0;
+
+	nih_assert (sock != NULL);
+
+	if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		nih_warn ("Failed to create channel: %s", strerror (errno));
+		return NULL;
+	}
+
+	for (int found = TRUE; found; ) {
+		found = FALSE;
+
+		NIH_LIST_FOREACH (&sock->channels, iter) {
+			Channel *ch = (Channel *)iter;
+
+			if (ch->index == index) {
+				found = TRUE;
+				index++;
+				break;
+			}
+		}
+	}
+
+	channel = NIH_MUST (nih_new (sock, Channel));
+	nih_list_init (&channel->entry);
+	channel->sock = sock;
+	channel->index = index;
+	channel->fd = fds[0];
+	channel->blocked = FALSE;
+
+	channel->watch = NIH_MUST (nih_io_add_watch (channel, channel->fd,
+						     NIH_IO_READ,
+						     (NihIoWatcher)channel_watcher,
+						     channel));
+
+	nih_alloc_set_destructor (channel, channel_destroy);
+	nih_list_add (&sock->channels, &channel->entry);
+
+	nih_debug ("%p new channel %d", sock, index);
+
+	env = socket_env (NULL, sock);
+
+	var = NIH_MUST (nih_sprintf (NULL, "CHANNEL=%d", index));
+	NIH_MUST (nih_str_array_addp (&env, NULL, NULL, var));
+	nih_discard (var);
+
+	socket_emit (sock, env, &fds[1], 1);
+	close (fds[1]);
+
+	return channel;
+}
+
+/**
+ * channel_destroy:
+ * @channel: channel being destroyed.
+ *
+ * Closes the channel, which the instance sees as end of file.
+ *
+ * Returns: zero.
+ **/
+static int
+channel_destroy (Channel *channel)
+{
+	nih_assert (channel != NULL);
+
+	close (channel->fd);
+	nih_list_destroy (&channel->entry);
+
+	return 0;
+}
+
+/**
+ * channel_send:
+ * @channel: channel to send on,
+ * @fd: connection to pass.
+ *
+ * Passes @fd over @channel as a single byte message carrying it in an
+ * SCM_RIGHTS control message, without blocking.
+ *
+ * Returns: zero on success, negative value with errno set on failure.
+ **/
+static int
+channel_send (Channel *channel,
+	      int      fd)
+{
+	struct msghdr   msg;
+	struct iovec    iov;
+	struct cmsghdr *cmsg;
+	char            byte = 0;
+	union {
+		struct cmsghdr cmsg;
+		char           buf[CMSG_SPACE (sizeof (int))];
+	} control;
+
+	nih_assert (channel != NULL);
+
+	memset (&msg, 0, sizeof (msg));
+	memset (&control, 0, sizeof (control));
+
+	iov.iov_base = &byte;
+	iov.iov_len = sizeof (byte);
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+
+	cmsg = CMSG_FIRSTHDR (&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+	memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+
+	if (sendmsg (channel->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * channel_watcher:
+ * @channel: channel with activity,
+ * @watch: watch on channel,
+ * @events: events that occurred.
+ *
+ * Called when the instance at the other end of @channel closes it, or
+ * when a blocked channel can take connections again.
+ **/
+static void
+channel_watcher (Channel *   channel,
+		 NihIoWatch *watch,
+		 NihIoEvents events)
+{
+	Socket *sock;
+
+	nih_assert (channel != NULL);
+
+	sock = channel->sock;
+
+	if (events & NIH_IO_READ) {
+		char    buf[64];
+		ssize_t len;
+
+		/* Instances aren't expected to say anything */
+		len = recv (channel->fd, buf, sizeof (buf), MSG_DONTWAIT);
+		if ((len == 0)
+		    || ((len < 0) && (errno != EAGAIN) && (errno != EINTR))) {
+			nih_debug ("%p channel %d closed", sock, channel->index);
+			nih_free (channel);
+
+			if (NIH_LIST_EMPTY (&sock->channels)) {
+				socket_flush (sock);
+			} else {
+				socket_dispatch (sock);
+			}
+
+			return;
+		}
+	}
+
+	if ((events & NIH_IO_WRITE) && channel->blocked) {
+		channel->blocked = FALSE;
+		watch->events &= ~NIH_IO_WRITE;
+
+		socket_dispatch (sock);
 	}
 }
 
@@ -490,7 +954,6 @@ job_add_socket (Job *  job,
 	Socket *sock;
 	nih_local char *error = NULL;
 	int     components = 0;
-	struct epoll_event event;
 
 	nih_assert (job != NULL);
 	nih_assert (socket_info != NULL);
@@ -499,8 +962,11 @@ job_add_socket (Job *  job,
 	sock = NIH_MUST (nih_new (job, Socket));
 	memset (sock, 0, sizeof (Socket));
 	sock->sock = -1;
+	sock->queue_max = SOCKET_QUEUE_DEFAULT;
+	sock->pool_max = 1;
 
 	nih_list_init (&sock->entry);
+	nih_list_init (&sock->channels);
 
 	nih_debug ("Found socket");
 	for (char **env = socket_info + 1; env && *env; env++) {
@@ -570,6 +1036,60 @@ job_add_socket (Job *  job,
 
 			components--;
 
+		} else if (! strncmp (*env, "ACCEPT", name_len)) {
+			if (! strcmp (val, "yes")) {
+				sock->accept = TRUE;
+			} else if (strcmp (val, "no")) {
+				nih_warn ("Ignored socket event with invalid ACCEPT=%s in %s",
+					  val, job->path);
+				goto error;
+			}
+
+			NIH_MUST (nih_str_array_add (&sock->options, sock,
+						     NULL, *env));
+		} else if (! strncmp (*env, "QUEUE", name_len)) {
+			sock->queue_max = atoi (val);
+			if (sock->queue_max <= 0) {
+				nih_warn ("Ignored socket event with invalid QUEUE=%s in %s",
+					  val, job->path);
+				goto error;
+			}
+
+			NIH_MUST (nih_str_array_add (&sock->options, sock,
+						     NULL, *env));
+		} else if (! strncmp (*env, "REUSEPORT", name_len)) {
+			int count;
+
+			if (! strcmp (val, "yes")) {
+				count = sysconf (_SC_NPROCESSORS_ONLN);
+				if (count < 1)
+					count = 1;
+			} else if (! strcmp (val, "no")) {
+				count = 0;
+			} else {
+				count = atoi (val);
+				if (count <= 0) {
+					nih_warn ("Ignored socket event with invalid REUSEPORT=%s in %s",
+						  val, job->path);
+					goto error;
+				}
+			}
+
+			sock->reuse_port = (count > 0);
+			sock->num_reuse = count ? count - 1 : 0;
+
+			NIH_MUST (nih_str_array_add (&sock->options, sock,
+						     NULL, *env));
+		} else if (! strncmp (*env, "POOL", name_len)) {
+			sock->pool_max = atoi (val);
+			if (sock->pool_max <= 0) {
+				nih_warn ("Ignored socket event with invalid POOL=%s in %s",
+					  val, job->path);
+				goto error;
+			}
+
+			NIH_MUST (nih_str_array_add (&sock->options, sock,
+						     NULL, *env));
 		} else {
 			nih_warn ("Ignored socket event with unknown variable %.*s in %s",
 				  (int)name_len, *env, job->path);
@@ -584,38 +1104,119 @@ job_add_socket (Job *  job,
 		goto error;
 	}
 
-	/* Let's try and set this baby up */
-	sock->sock = socket (sock->addr.sa_family, SOCK_STREAM, 0);
-	if (sock->sock < 0) {
+	if (sock->accept)
+		sock->queue = NIH_MUST (nih_alloc (sock, sizeof (int)
+						   * sock->queue_max));
+
+	if (sock->reuse_port && (sock->addr.sa_family == AF_UNIX)) {
+		nih_warn ("Ignored socket event with REUSEPORT for unix socket in %s",
+			  job->path);
+		goto error;
+	}
+
+	if (sock->num_reuse && sock->accept) {
+		nih_warn ("Ignored socket event with both ACCEPT and REUSEPORT in %s",
+			  job->path);
+		goto error;
+	}
+
+	if (sock->num_reuse) {
+		sock->reuse = NIH_MUST (nih_alloc (sock, sizeof (int)
+						   * sock->num_reuse));
+		for (int i = 0; i < sock->num_reuse; i++)
+			sock->reuse[i] = -1;
+	}
+
+	sock->sock = socket_listen (sock, job);
+	if (sock->sock < 0)
+		goto error;
+
+	for (int i = 0; i < sock->num_reuse; i++) {
+		sock->reuse[i] = socket_listen (sock, job);
+		if (sock->reuse[i] < 0)
+			goto error;
+	}
+
+	/* Okay then, add to the job */
+	nih_alloc_set_destructor (sock, socket_destroy);
+	nih_list_add (&job->sockets, &sock->entry);
+
+	return;
+
+error:
+	if (sock->sock != -1)
+		close (sock->sock);
+	for (int i = 0; sock->reuse && (i < sock->num_reuse); i++)
+		if (sock->reuse[i] != -1)
+			close (sock->reuse[i]);
+	nih_free (sock);
+}
+
+/**
+ * socket_listen:
+ * @sock: socket to listen on,
+ * @job: job socket is for.
+ *
+ * Creates a socket listening on the address of @sock, with SO_REUSEPORT
+ * set when REUSEPORT was given, and adds it to the epoll descriptor.
+ *
+ * Returns: new socket or -1 on failure.
+ **/
+static int
+socket_listen (Socket *sock,
+	       Job *   job)
+{
+	struct epoll_event event;
+	int fd;
+
+	nih_assert (sock != NULL);
+	nih_assert (job != NULL);
+
+	/* Let's try and set this baby up; when accepting connections
+	 * ourselves we take all of them each time we're woken, so need
+	 * to know when there are no more.
+	 */
+	fd = socket (sock->addr.sa_family,
+		     SOCK_STREAM | (sock->accept ? SOCK_NONBLOCK : 0),
+		     0);
+	if (fd < 0) {
 		nih_warn ("Failed to create socket in %s: %s",
 			  job->path, strerror (errno));
-		goto error;
+		return -1;
 	}
 
 	int opt = 1;
-	if (setsockopt (sock->sock, SOL_SOCKET, SO_REUSEADDR,
+	if (setsockopt (fd, SOL_SOCKET, SO_REUSEADDR,
 			&opt, sizeof opt) < 0) {
 		nih_warn ("Failed to set socket reuse in %s: %s",
 			  job->path, strerror (errno));
 		goto error;
 	}
 
+	if (sock->reuse_port
+	    && setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+			   &opt, sizeof opt) < 0) {
+		nih_warn ("Failed to set socket port reuse in %s: %s",
+			  job->path, strerror (errno));
+		goto error;
+	}
+
 	/* If socket is ipv6, need to set IPV6_V6ONLY option */
 	if (sock->sin6_addr.sin6_family == AF_INET6 && 
-	    setsockopt (sock->sock, SOL_IPV6, IPV6_V6ONLY,
+	    setsockopt (fd, SOL_IPV6, IPV6_V6ONLY,
 	                &opt, sizeof opt) < 0) {
 		nih_warn ("Failed to set IPV6 only option in %s: %s",
 		          job->path, strerror (errno));
 		goto error;
 	}
 
-	if (bind (sock->sock, &sock->addr, sock->addrlen) < 0) {
+	if (bind (fd, &sock->addr, sock->addrlen) < 0) {
 		nih_warn ("Failed to bind socket in %s: %s",
 			  job->path, strerror (errno));
 		goto error;
 	}
 
-	if (listen (sock->sock, SOMAXCONN) < 0) {
+	if (listen (fd, SOMAXCONN) < 0) {
 		nih_warn ("Failed to listen on socket in %s: %s",
 			  job->path, strerror (errno));
 		goto error;
@@ -626,27 +1227,23 @@ job_add_socket (Job *  job,
 	 * a DDoS of wake-ups while waiting for the service to start.
 	 *
 	 * The solution is to use epoll in edge-triggered mode, this will
-	 * fire only on initial connection until a new one comes in.
+	 * fire only on initial connection until a new one comes in.  With
+	 * ACCEPT=yes that's the time to accept them all.
 	 */
 	event.events = EPOLLIN | EPOLLET;
 	event.data.ptr = sock;
 
-	if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, sock->sock, &event) < 0) {
+	if (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
 		nih_warn ("Failed to watch socket in %s: %s",
 			  job->path, strerror (errno));
 		goto error;
 	}
 
-	/* Okay then, add to the job */
-	nih_alloc_set_destructor (sock, socket_destroy);
-	nih_list_add (&job->sockets, &sock->entry);
-
-	return;
+	return fd;
 
 error:
-	if (sock->sock != -1)
-		close (sock->sock);
-	nih_free (sock);
+	close (fd);
+	return -1;
 }
 
 static void
@@ -655,6 +1252,17 @@ socket_destroy (Socket *sock)
 	epoll_ctl (epoll_fd, EPOLL_CTL_DEL, sock->sock, NULL);
 	close (sock->sock);
 
+	for (int i = 0; i < sock->num_reuse; i++) {
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, sock->reuse[i], NULL);
+		close (sock->reuse[i]);
+	}
+
+	while (sock->queue_len) {
+		close (sock->queue[sock->queue_head]);
+		sock->queue_head = (sock->queue_head + 1) % sock->queue_max;
+		sock->queue_len--;
+	}
+
 	nih_list_destroy (&sock->entry);
 }
 
@@ -24,6 +24,7 @@
 
 #include <libudev.h>
 
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -33,16 +34,20 @@
 #include <nih/alloc.h>
 #include <nih/string.h>
 #include <nih/io.h>
+#include <nih/hash.h>
+#include <nih/timer.h>
 #include <nih/option.h>
 #include <nih/main.h>
 #include <nih/logging.h>
 #include <nih/error.h>
 
 #include <nih-dbus/dbus_connection.h>
+#include <nih-dbus/dbus_error.h>
 #include <nih-dbus/dbus_proxy.h>
 
 #include "dbus/upstart.h"
 #include "com.ubuntu.Upstart.h"
+#include "com.ubuntu.Upstart.Job.h"
 
 
 /* Prototypes for static functions */
@@ -50,8 +55,84 @@ static void udev_monitor_watcher (struct udev_monitor *udev_monitor,
 				  NihIoWatch *watch, NihIoEvents events);
 static void upstart_disconnected (DBusConnection *connection);
 static void emit_event_error     (void *data, NihDBusMessage *message);
+static void emit_events_reply    (void *data, NihDBusMessage *message);
+static void emit_events_error    (void *data, NihDBusMessage *message);
+static UpstartEmitEventsEventsElement *udev_device_event (const void *parent,
+							   struct udev_device *udev_device,
+							   const char *action);
+static void coldplug             (struct udev *udev);
+static void emit_event           (UpstartEmitEventsEventsElement *event);
+static void emit_events          (UpstartEmitEventsEventsElement **batch);
+static void emit_batch           (UpstartEmitEventsEventsElement **batch,
+				  size_t batch_len);
+static void coalesce_event       (UpstartEmitEventsEventsElement ***batch,
+				  size_t *batch_len,
+				  UpstartEmitEventsEventsElement *event,
+				  const char *devpath, int change);
+static void coalesce_timer       (void *data, NihTimer *timer);
+static void upstart_job_added    (void *data, NihDBusMessage *message,
+				  const char *job_class_path);
+static void upstart_job_removed  (void *data, NihDBusMessage *message,
+				  const char *job_class_path);
+static void update_filters       (void);
+
+static int   env_reserved        (const char *name);
+static void  env_size            (size_t *num, size_t *size,
+				  const char *name, const char *value);
+static const char *env_add       (char **env, size_t *env_len, char **next,
+				  const char *name, const char *value);
+static char *copy_safe_string    (char *dest, const char *original);
 
-static char *make_safe_string    (const void *parent, const char *original);
+/**
+ * PendingChange:
+ * @entry: list header,
+ * @devpath: device path,
+ * @event: latest change event for the device.
+ *
+ * Change uevent held back for the coalescing window.
+ **/
+typedef struct pending_change {
+	NihList                         entry;
+	char                           *devpath;
+	UpstartEmitEventsEventsElement *event;
+} PendingChange;
+
+/**
+ * Job:
+ * @entry: list header,
+ * @path: D-Bus path of job class,
+ * @subsystems: subsystems of the uevents in the conditions of the job.
+ *
+ * Job class whose start or stop condition includes uevents.
+ **/
+typedef struct job {
+	NihList   entry;
+	char     *path;
+	char    **subsystems;
+} Job;
+
+/**
+ * DEVICE_EVENT_INFIX:
+ *
+ * Part of the names of events emitted for uevents that follows the
+ * subsystem.
+ **/
+#define DEVICE_EVENT_INFIX "-device-"
+
+/**
+ * EMIT_EVENTS_MAX:
+ *
+ * Maximum number of uevents emitted with a single method call.
+ **/
+#define EMIT_EVENTS_MAX 256
+
+/**
+ * COLDPLUG_COMPLETE_EVENT:
+ *
+ * Name of event emitted once the events for every device found at
+ * startup with --coldplug have been emitted.
+ **/
+#define COLDPLUG_COMPLETE_EVENT "udev-coldplug-complete"
 
 /**
  * daemonise:
@@ -72,10 +153,79 @@ static NihDBusProxy *upstart = NULL;
  * no_strip_udev_data:
  *
  * If TRUE, do not modify any udev message data (old behaviour).
- * If FALSE, use make_safe_string () to cleanse udev strings.
+ * If FALSE, use copy_safe_string () to cleanse udev strings.
  **/
 static int no_strip_udev_data = FALSE;
 
+/**
+ * emit_events_supported:
+ *
+ * FALSE once Upstart has been found not to support the EmitEvents method.
+ **/
+static int emit_events_supported = TRUE;
+
+/**
+ * coalesce:
+ *
+ * Seconds that change uevents are held back for, during which further
+ * change uevents for the same device replace them; zero to emit every
+ * uevent as soon as it is received.
+ **/
+static int coalesce = 0;
+
+/**
+ * pending_changes:
+ *
+ * Hash of PendingChange objects held back, keyed by device path.
+ **/
+static NihHash *pending_changes = NULL;
+
+/**
+ * pending_timer:
+ *
+ * Timer for emitting pending_changes, or NULL if there are none.
+ **/
+static NihTimer *pending_timer = NULL;
+
+/**
+ * filter_subsystems:
+ *
+ * If TRUE, only receive the uevents of subsystems that jobs have in
+ * their start or stop conditions.
+ **/
+static int filter_subsystems = FALSE;
+
+/**
+ * coldplug_devices:
+ *
+ * If TRUE, emit an added event for every device that already exists when
+ * the bridge starts, followed by COLDPLUG_COMPLETE_EVENT.
+ **/
+static int coldplug_devices = FALSE;
+
+/**
+ * jobs:
+ *
+ * Hash of Job objects for the job classes with uevents in their
+ * conditions, keyed by D-Bus path; only used with filter_subsystems.
+ **/
+static NihHash *jobs = NULL;
+
+/**
+ * jobs_loaded:
+ *
+ * TRUE once the initial list of job classes has been obtained, after
+ * which every change to jobs updates the filters.
+ **/
+static int jobs_loaded = FALSE;
+
+/**
+ * monitor:
+ *
+ * Monitor for uevents.
+ **/
+static struct udev_monitor *monitor = NULL;
+
 /**
  * options:
  *
@@ -86,6 +236,12 @@ static NihOption options[] = {
 	  NULL, NULL, &daemonise, NULL },
 	{ 0, "no-strip", N_("Do not strip non-printable bytes from udev message data"),
 	  NULL, NULL, &no_strip_udev_data, NULL },
+	{ 0, "coalesce", N_("Emit one event for the change uevents of a device within SECONDS"),
+	  NULL, "SECONDS", &coalesce, nih_option_int },
+	{ 0, "filter-subsystems", N_("Only receive uevents of subsystems that jobs wait for"),
+	  NULL, NULL, &filter_subsystems, NULL },
+	{ 0, "coldplug", N_("Emit events for the devices that already exist"),
+	  NULL, NULL, &coldplug_devices, NULL },
 
 	NIH_OPTION_LAST
 };
@@ -99,6 +255,7 @@ main (int   argc,
 	DBusConnection *     connection;
 	struct udev *        udev;
 	struct udev_monitor *udev_monitor;
+	int                  fd;
 	int                  ret;
 
 	nih_main_init (argv[0]);
@@ -146,6 +303,66 @@ main (int   argc,
 	nih_assert (udev_monitor_enable_receiving (udev_monitor) == 0);
 	udev_monitor_set_receive_buffer_size(udev_monitor, 128*1024*1024);
 
+	monitor = udev_monitor;
+
+	if (filter_subsystems) {
+		char **job_class_paths;
+
+		jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+		/* Connect signals to be notified when jobs come and go */
+		if (! nih_dbus_proxy_connect (upstart, &upstart_com_ubuntu_Upstart0_6, "JobAdded",
+					      (NihDBusSignalHandler)upstart_job_added, NULL)) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not create JobAdded signal connection"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		if (! nih_dbus_proxy_connect (upstart, &upstart_com_ubuntu_Upstart0_6, "JobRemoved",
+					      (NihDBusSignalHandler)upstart_job_removed, NULL)) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not create JobRemoved signal connection"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		/* Request a list of all current jobs */
+		if (upstart_get_all_jobs_sync (NULL, upstart, &job_class_paths) < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", _("Could not obtain job list"),
+				   err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+
+		for (char **job_class_path = job_class_paths;
+		     job_class_path && *job_class_path; job_class_path++)
+			upstart_job_added (NULL, NULL, *job_class_path);
+
+		nih_free (job_class_paths);
+
+		jobs_loaded = TRUE;
+		update_filters ();
+	}
+
+	/* Never block reading the monitor, so that the watcher can drain
+	 * every queued uevent before emitting them.
+	 */
+	fd = udev_monitor_get_fd (udev_monitor);
+	nih_assert (fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK) == 0);
+
 	NIH_MUST (nih_io_add_watch (NULL, udev_monitor_get_fd (udev_monitor),
 				    NIH_IO_READ,
 				    (NihIoWatcher)udev_monitor_watcher,
@@ -178,6 +395,12 @@ main (int   argc,
 		NIH_MUST (nih_signal_add_handler (NULL, SIGINT, nih_main_term_signal, NULL));
 	}
 
+	/* Only now that the monitor is receiving, so that no device added
+	 * meanwhile is missed.
+	 */
+	if (coldplug_devices)
+		coldplug (udev);
+
 	ret = nih_main_loop ();
 
 	return ret;
@@ -189,124 +412,512 @@ udev_monitor_watcher (struct udev_monitor *udev_monitor,
 		      NihIoWatch *         watch,
 		      NihIoEvents          events)
 {
-	struct udev_device *    udev_device;
-	nih_local char *        subsystem = NULL;
-	nih_local char *        action = NULL;
-	nih_local char *        kernel = NULL;
-	nih_local char *        devpath = NULL;
-	nih_local char *        devname = NULL;
-	nih_local char *        name = NULL;
-	nih_local char **       env = NULL;
-	const char *            value = NULL;
-	size_t                  env_len = 0;
-	DBusPendingCall *       pending_call;
-	char                 *(*copy_string)(const void *, const char *) = NULL;
-
-
-	udev_device = udev_monitor_receive_device (udev_monitor);
-	if (! udev_device)
-		return;
+	nih_local UpstartEmitEventsEventsElement **batch = NULL;
+	size_t                                     batch_len = 0;
+	struct udev_device *                       udev_device;
 
-	copy_string = no_strip_udev_data ? nih_strdup : make_safe_string;
+	batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+	batch[0] = NULL;
 
-	value = udev_device_get_subsystem (udev_device);
-	subsystem = value ? copy_string (NULL, value) : NULL;
+	/* Gather every uevent already queued on the monitor, such as
+	 * during coldplug, so that they can be emitted together.
+	 */
+	while ((batch_len < EMIT_EVENTS_MAX)
+	       && (udev_device = udev_monitor_receive_device (udev_monitor))) {
+		UpstartEmitEventsEventsElement *event;
+		const char *                    devpath;
+		const char *                    action;
 
-	value = udev_device_get_action (udev_device);
-	action = value ? copy_string (NULL, value) : NULL;
+		devpath = udev_device_get_devpath (udev_device);
+		action = udev_device_get_action (udev_device);
 
-	value = udev_device_get_sysname (udev_device);
-	kernel = value ? copy_string (NULL, value) : NULL;
+		event = udev_device_event (batch, udev_device, action);
 
-	value = udev_device_get_devpath (udev_device);
-	devpath = value ? copy_string (NULL, value) : NULL;
+		if (! event) {
+			udev_device_unref (udev_device);
+			continue;
+		}
 
-	value = udev_device_get_devnode (udev_device);
-	devname = value ? copy_string (NULL, value) : NULL;
+		if (coalesce > 0 && devpath) {
+			coalesce_event (&batch, &batch_len, event, devpath,
+					! strcmp (action, "change"));
+		} else {
+			batch = NIH_MUST (nih_realloc (batch, NULL,
+						       (sizeof (UpstartEmitEventsEventsElement *)
+							* (batch_len + 2))));
+			batch[batch_len++] = event;
+			batch[batch_len] = NULL;
+		}
 
-	/* Protect against the "impossible" */
-	if (! action)
-		goto out;
+		udev_device_unref (udev_device);
+	}
 
-	if (! strcmp (action, "add")) {
-		name = NIH_MUST (nih_sprintf (NULL, "%s-device-added",
-					      subsystem));
-	} else if (! strcmp (action, "change")) {
-		name = NIH_MUST (nih_sprintf (NULL, "%s-device-changed",
-					      subsystem));
-	} else if (! strcmp (action, "remove")) {
-		name = NIH_MUST (nih_sprintf (NULL, "%s-device-removed",
-					      subsystem));
-	} else {
-		name = NIH_MUST (nih_sprintf (NULL, "%s-device-%s",
-					      subsystem, action));
+	emit_batch (batch, batch_len);
+}
+
+/**
+ * coldplug:
+ * @udev: udev context.
+ *
+ * Emits an added event for every device that udev has already
+ * processed, or only those of the subsystems that jobs wait for with
+ * --filter-subsystems, in batches of EMIT_EVENTS_MAX; then emits
+ * COLDPLUG_COMPLETE_EVENT, so that jobs need only wait for that rather
+ * than for a replay of every uevent.
+ **/
+static void
+coldplug (struct udev *udev)
+{
+	struct udev_enumerate *                    udev_enumerate;
+	nih_local UpstartEmitEventsEventsElement **batch = NULL;
+	size_t                                     batch_len = 0;
+	size_t                                     num_subsystems = 0;
+	size_t                                     num_devices = 0;
+	UpstartEmitEventsEventsElement *           complete;
+
+	nih_assert (udev != NULL);
+
+	nih_assert (udev_enumerate = udev_enumerate_new (udev));
+
+	/* Devices that udev has yet to process will be received by the
+	 * monitor once it has.
+	 */
+	udev_enumerate_add_match_is_initialized (udev_enumerate);
+
+	if (filter_subsystems) {
+		NIH_HASH_FOREACH (jobs, iter) {
+			Job *job = (Job *)iter;
+
+			for (char **subsystem = job->subsystems; *subsystem; subsystem++) {
+				udev_enumerate_add_match_subsystem (udev_enumerate,
+								    *subsystem);
+				num_subsystems++;
+			}
+		}
+	}
+
+	/* Without any match every device would be enumerated */
+	if ((! filter_subsystems) || num_subsystems) {
+		if (udev_enumerate_scan_devices (udev_enumerate) < 0)
+			nih_warn (_("Could not enumerate devices"));
 	}
 
-	env = NIH_MUST (nih_str_array_new (NULL));
+	batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+	batch[0] = NULL;
+
+	for (struct udev_list_entry *list_entry = udev_enumerate_get_list_entry (udev_enumerate);
+	     list_entry != NULL;
+	     list_entry = udev_list_entry_get_next (list_entry)) {
+		struct udev_device *            udev_device;
+		UpstartEmitEventsEventsElement *event;
+
+		udev_device = udev_device_new_from_syspath (
+			udev, udev_list_entry_get_name (list_entry));
+		if (! udev_device)
+			continue;
 
-	if (kernel) {
-		nih_local char *var = NULL;
+		event = udev_device_event (batch, udev_device, "add");
+		udev_device_unref (udev_device);
 
-		var = NIH_MUST (nih_sprintf (NULL, "KERNEL=%s", kernel));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+		if (! event)
+			continue;
+
+		batch = NIH_MUST (nih_realloc (batch, NULL,
+					       (sizeof (UpstartEmitEventsEventsElement *)
+						* (batch_len + 2))));
+		batch[batch_len++] = event;
+		batch[batch_len] = NULL;
+		num_devices++;
+
+		/* Keep within the limit of a single method call */
+		if (batch_len == EMIT_EVENTS_MAX) {
+			emit_batch (batch, batch_len);
+
+			nih_discard (batch);
+			batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+			batch[0] = NULL;
+			batch_len = 0;
+		}
 	}
 
-	if (devpath) {
-		nih_local char *var = NULL;
+	emit_batch (batch, batch_len);
+
+	udev_enumerate_unref (udev_enumerate);
+
+	nih_info (_("Emitted events for %zu existing devices"), num_devices);
+
+	complete = NIH_MUST (nih_new (NULL, UpstartEmitEventsEventsElement));
+	complete->item0 = NIH_MUST (nih_strdup (complete, COLDPLUG_COMPLETE_EVENT));
+	complete->item1 = NIH_MUST (nih_str_array_new (complete));
+	NIH_MUST (nih_str_array_addp (&complete->item1, complete, NULL,
+				      NIH_MUST (nih_sprintf (NULL, "DEVICES=%zu",
+							     num_devices))));
+
+	emit_event (complete);
+	nih_free (complete);
+}
+
+/**
+ * emit_batch:
+ * @batch: NULL-terminated array of events to emit,
+ * @batch_len: number of events in @batch.
+ *
+ * Emits the events in @batch, with a single method call if there are
+ * several and Upstart supports it.
+ **/
+static void
+emit_batch (UpstartEmitEventsEventsElement **batch,
+	    size_t                           batch_len)
+{
+	size_t i;
+
+	nih_assert (batch != NULL);
 
-		var = NIH_MUST (nih_sprintf (NULL, "DEVPATH=%s", devpath));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+	if ((batch_len > 1) && emit_events_supported) {
+		emit_events (batch);
+	} else {
+		for (i = 0; i < batch_len; i++)
+			emit_event (batch[i]);
 	}
+}
+
+/**
+ * coalesce_event:
+ * @batch: pointer to NULL-terminated array of events to emit,
+ * @batch_len: pointer to number of events in @batch,
+ * @event: event for uevent,
+ * @devpath: device path of uevent,
+ * @change: TRUE if the uevent is a change.
+ *
+ * Holds back @event if it is the change of a device, replacing any
+ * change already held back for it, for the coalescing window; other
+ * uevents are appended to @batch, after any change held back for the
+ * same device so that they are still emitted in order.
+ **/
+static void
+coalesce_event (UpstartEmitEventsEventsElement ***batch,
+		size_t *                          batch_len,
+		UpstartEmitEventsEventsElement *  event,
+		const char *                      devpath,
+		int                               change)
+{
+	PendingChange *pending;
 
-	if (devname) {
-		nih_local char *var = NULL;
+	nih_assert (batch != NULL);
+	nih_assert (batch_len != NULL);
+	nih_assert (event != NULL);
+	nih_assert (devpath != NULL);
 
-		var = NIH_MUST (nih_sprintf (NULL, "DEVNAME=%s", devname));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+	if (! pending_changes)
+		pending_changes = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	pending = (PendingChange *)nih_hash_lookup (pending_changes, devpath);
+
+	if (change) {
+		if (pending) {
+			nih_debug ("Coalesced change of %s", devpath);
+
+			nih_unref (pending->event, pending);
+			pending->event = event;
+			nih_ref (pending->event, pending);
+			nih_unref (event, *batch);
+			return;
+		}
+
+		pending = NIH_MUST (nih_new (pending_changes, PendingChange));
+		nih_list_init (&pending->entry);
+		nih_alloc_set_destructor (pending, nih_list_destroy);
+
+		pending->devpath = NIH_MUST (nih_strdup (pending, devpath));
+		pending->event = event;
+		nih_ref (pending->event, pending);
+		nih_unref (event, *batch);
+
+		nih_hash_add (pending_changes, &pending->entry);
+
+		if (! pending_timer)
+			pending_timer = NIH_MUST (nih_timer_add_timeout (
+							  NULL, coalesce,
+							  coalesce_timer, NULL));
+		return;
 	}
 
-	if (subsystem) {
-		nih_local char *var = NULL;
+	if (pending) {
+		*batch = NIH_MUST (nih_realloc (*batch, NULL,
+						(sizeof (UpstartEmitEventsEventsElement *)
+						 * (*batch_len + 2))));
+		(*batch)[(*batch_len)++] = pending->event;
+		(*batch)[*batch_len] = NULL;
 
-		var = NIH_MUST (nih_sprintf (NULL, "SUBSYSTEM=%s", subsystem));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+		nih_ref (pending->event, *batch);
+		nih_free (pending);
 	}
 
-	if (action) {
-		nih_local char *var = NULL;
+	*batch = NIH_MUST (nih_realloc (*batch, NULL,
+					(sizeof (UpstartEmitEventsEventsElement *)
+					 * (*batch_len + 2))));
+	(*batch)[(*batch_len)++] = event;
+	(*batch)[*batch_len] = NULL;
+}
 
-		var = NIH_MUST (nih_sprintf (NULL, "ACTION=%s", action));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+/**
+ * coalesce_timer:
+ * @data: not used,
+ * @timer: timer that fired.
+ *
+ * Called once the coalescing window has passed to emit the change
+ * uevents held back.
+ **/
+static void
+coalesce_timer (void *    data,
+		NihTimer *timer)
+{
+	nih_local UpstartEmitEventsEventsElement **batch = NULL;
+	size_t                                     batch_len = 0;
+
+	/* Timer is freed by NIH on return */
+	pending_timer = NULL;
+
+	batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+	batch[0] = NULL;
+
+	NIH_HASH_FOREACH_SAFE (pending_changes, iter) {
+		PendingChange *pending = (PendingChange *)iter;
+
+		batch = NIH_MUST (nih_realloc (batch, NULL,
+					       (sizeof (UpstartEmitEventsEventsElement *)
+						* (batch_len + 2))));
+		batch[batch_len++] = pending->event;
+		batch[batch_len] = NULL;
+
+		nih_ref (pending->event, batch);
+		nih_free (pending);
+
+		/* Keep within the limit of a single method call */
+		if (batch_len == EMIT_EVENTS_MAX) {
+			emit_batch (batch, batch_len);
+
+			nih_discard (batch);
+			batch = NIH_MUST (nih_alloc (NULL, sizeof (UpstartEmitEventsEventsElement *)));
+			batch[0] = NULL;
+			batch_len = 0;
+		}
 	}
 
+	emit_batch (batch, batch_len);
+}
+
+/**
+ * udev_device_event:
+ * @parent: parent object for new element,
+ * @udev_device: device to convert,
+ * @action: action of the uevent.
+ *
+ * Converts the uevent for @udev_device into the name and environment of
+ * the event to be emitted for it.
+ *
+ * Returns: newly allocated element or NULL if the uevent has no action.
+ **/
+static UpstartEmitEventsEventsElement *
+udev_device_event (const void *        parent,
+		   struct udev_device *udev_device,
+		   const char *        action)
+{
+	UpstartEmitEventsEventsElement *event;
+	const char *                    subsystem;
+	const char *                    kernel;
+	const char *                    devpath;
+	const char *                    devname;
+	char **                         env;
+	char *                          next;
+	size_t                          env_len = 0;
+	size_t                          num = 0;
+	size_t                          size = 0;
+	char *                          name;
+
+	subsystem = udev_device_get_subsystem (udev_device);
+	kernel = udev_device_get_sysname (udev_device);
+	devpath = udev_device_get_devpath (udev_device);
+	devname = udev_device_get_devnode (udev_device);
+
+	/* Protect against the "impossible" */
+	if (! action)
+		return NULL;
+
+	/* Size the environment so that it can be built within a single
+	 * allocation, since coldplug may give thousands of uevents each
+	 * with dozens of properties; stripping bytes only ever makes the
+	 * strings shorter.
+	 */
+	env_size (&num, &size, "KERNEL", kernel);
+	env_size (&num, &size, "DEVPATH", devpath);
+	env_size (&num, &size, "DEVNAME", devname);
+	env_size (&num, &size, "SUBSYSTEM", subsystem);
+	env_size (&num, &size, "ACTION", action);
+
 	for (struct udev_list_entry *list_entry = udev_device_get_properties_list_entry (udev_device);
 	     list_entry != NULL;
 	     list_entry = udev_list_entry_get_next (list_entry)) {
-		nih_local char *udev_name = NULL;
-		nih_local char *udev_value = NULL;
-		nih_local char *var = NULL;
-
-		udev_name = copy_string (NULL, udev_list_entry_get_name (list_entry));
+		const char *udev_name = udev_list_entry_get_name (list_entry);
 
-		if (! strcmp (udev_name, "DEVPATH"))
+		if (env_reserved (udev_name))
 			continue;
-		if (! strcmp (udev_name, "DEVNAME"))
-			continue;
-		if (! strcmp (udev_name, "SUBSYSTEM"))
-			continue;
-		if (! strcmp (udev_name, "ACTION"))
+
+		env_size (&num, &size, udev_name,
+			  udev_list_entry_get_value (list_entry));
+	}
+
+	event = NIH_MUST (nih_new (parent, UpstartEmitEventsEventsElement));
+
+	env = NIH_MUST (nih_alloc (event, (sizeof (char *) * (num + 1)) + size));
+	env[0] = NULL;
+	next = (char *)(env + num + 1);
+
+	kernel = env_add (env, &env_len, &next, "KERNEL", kernel);
+	devpath = env_add (env, &env_len, &next, "DEVPATH", devpath);
+	devname = env_add (env, &env_len, &next, "DEVNAME", devname);
+	subsystem = env_add (env, &env_len, &next, "SUBSYSTEM", subsystem);
+	action = env_add (env, &env_len, &next, "ACTION", action);
+
+	for (struct udev_list_entry *list_entry = udev_device_get_properties_list_entry (udev_device);
+	     list_entry != NULL;
+	     list_entry = udev_list_entry_get_next (list_entry)) {
+		const char *udev_name = udev_list_entry_get_name (list_entry);
+
+		if (env_reserved (udev_name))
 			continue;
 
-		udev_value = copy_string (NULL, udev_list_entry_get_value (list_entry));
+		env_add (env, &env_len, &next, udev_name,
+			 udev_list_entry_get_value (list_entry));
+	}
+
+	nih_assert (env_len <= num);
 
-		var = NIH_MUST (nih_sprintf (NULL, "%s=%s", udev_name, udev_value));
-		NIH_MUST (nih_str_array_addp (&env, NULL, &env_len, var));
+	if (! strcmp (action, "add")) {
+		name = NIH_MUST (nih_sprintf (event, "%s-device-added",
+					      subsystem));
+	} else if (! strcmp (action, "change")) {
+		name = NIH_MUST (nih_sprintf (event, "%s-device-changed",
+					      subsystem));
+	} else if (! strcmp (action, "remove")) {
+		name = NIH_MUST (nih_sprintf (event, "%s-device-removed",
+					      subsystem));
+	} else {
+		name = NIH_MUST (nih_sprintf (event, "%s-device-%s",
+					      subsystem, action));
 	}
 
 	nih_debug ("%s %s", name, devname ? devname : "");
 
+	event->item0 = name;
+	event->item1 = env;
+
+	return event;
+}
+
+/**
+ * env_reserved:
+ * @name: name of udev property.
+ *
+ * Returns: TRUE if @name is one of the variables always placed in the
+ * environment by udev_device_event() and should not be repeated.
+ **/
+static int
+env_reserved (const char *name)
+{
+	nih_assert (name != NULL);
+
+	return ((! strcmp (name, "DEVPATH"))
+		|| (! strcmp (name, "DEVNAME"))
+		|| (! strcmp (name, "SUBSYSTEM"))
+		|| (! strcmp (name, "ACTION")));
+}
+
+/**
+ * env_size:
+ * @num: pointer to number of variables,
+ * @size: pointer to number of bytes of variables,
+ * @name: name of variable,
+ * @value: value of variable, or NULL.
+ *
+ * Adds the space needed by the variable @name with @value, unless @value
+ * is NULL, to @num and @size.
+ **/
+static void
+env_size (size_t *    num,
+	  size_t *    size,
+	  const char *name,
+	  const char *value)
+{
+	nih_assert (num != NULL);
+	nih_assert (size != NULL);
+	nih_assert (name != NULL);
+
+	if (! value)
+		return;
+
+	(*num)++;
+	*size += strlen (name) + 1 + strlen (value) + 1;
+}
+
+/**
+ * env_add:
+ * @env: environment array,
+ * @env_len: pointer to number of entries in @env,
+ * @next: pointer to next free byte after @env,
+ * @name: name of variable,
+ * @value: value of variable, or NULL.
+ *
+ * Copies the variable @name with @value, unless @value is NULL, to the
+ * space at @next, cleansing both with copy_safe_string(), and appends it
+ * to @env; the space must have been accounted for by env_size().
+ *
+ * Returns: copy of @value within @env, or NULL if @value is NULL.
+ **/
+static const char *
+env_add (char **     env,
+	 size_t *    env_len,
+	 char **     next,
+	 const char *name,
+	 const char *value)
+{
+	char *copy;
+
+	nih_assert (env != NULL);
+	nih_assert (env_len != NULL);
+	nih_assert (next != NULL);
+	nih_assert (name != NULL);
+
+	if (! value)
+		return NULL;
+
+	env[(*env_len)++] = *next;
+	env[*env_len] = NULL;
+
+	*next = copy_safe_string (*next, name);
+	*(*next)++ = '=';
+
+	copy = *next;
+	*next = copy_safe_string (*next, value) + 1;
+
+	return copy;
+}
+
+/**
+ * emit_event:
+ * @event: event to emit.
+ *
+ * Emits @event with its own method call, without waiting for it.
+ **/
+static void
+emit_event (UpstartEmitEventsEventsElement *event)
+{
+	DBusPendingCall *pending_call;
+
+	nih_assert (event != NULL);
+
 	pending_call = upstart_emit_event (upstart,
-			name, env, FALSE,
+			event->item0, event->item1, FALSE,
 			NULL, emit_event_error, NULL,
 			NIH_DBUS_TIMEOUT_NEVER);
 
@@ -317,18 +928,51 @@ udev_monitor_watcher (struct udev_monitor *udev_monitor,
 		err = nih_error_get ();
 		nih_warn ("%s", err->message);
 
-		if (saved != ENOMEM && subsystem)
-			nih_warn ("Likely that udev '%s' event contains binary garbage", subsystem);
+		if (saved != ENOMEM)
+			nih_warn ("Likely that udev '%s' event contains binary garbage",
+				  event->item0);
 
 		nih_free (err);
+		return;
 	}
 
 	dbus_pending_call_unref (pending_call);
-
-out:
-	udev_device_unref (udev_device);
 }
 
+/**
+ * emit_events:
+ * @batch: NULL-terminated array of events to emit.
+ *
+ * Emits all of the events in @batch with a single EmitEvents method call
+ * without waiting for them; @batch is kept until the reply arrives so that
+ * the events may be emitted individually should Upstart be too old to
+ * support the method.
+ **/
+static void
+emit_events (UpstartEmitEventsEventsElement **batch)
+{
+	DBusPendingCall *pending_call;
+
+	nih_assert (batch != NULL);
+
+	pending_call = upstart_emit_events (upstart, batch,
+			emit_events_reply,
+			emit_events_error, batch,
+			NIH_DBUS_TIMEOUT_NEVER);
+
+	if (! pending_call) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("%s", err->message);
+		nih_free (err);
+		return;
+	}
+
+	nih_ref (batch, upstart);
+
+	dbus_pending_call_unref (pending_call);
+}
 
 static void
 upstart_disconnected (DBusConnection *connection)
@@ -348,12 +992,232 @@ emit_event_error (void *          data,
 	nih_free (err);
 }
 
+static void
+emit_events_reply (void *          data,
+		   NihDBusMessage *message)
+{
+	nih_unref (data, upstart);
+}
+
+static void
+emit_events_error (void *          data,
+		   NihDBusMessage *message)
+{
+	UpstartEmitEventsEventsElement **batch = data;
+	NihDBusError *                   dbus_err;
+	size_t                           i;
+
+	/* Fall back to emitting each event by itself when talking to an
+	 * Upstart that doesn't know the method.
+	 */
+	dbus_err = (NihDBusError *)nih_error_get ();
+	if ((dbus_err->number == NIH_DBUS_ERROR)
+	    && (! strcmp (dbus_err->name, DBUS_ERROR_UNKNOWN_METHOD))) {
+		emit_events_supported = FALSE;
+
+		for (i = 0; batch[i]; i++)
+			emit_event (batch[i]);
+	} else {
+		nih_warn ("%s", dbus_err->message);
+	}
+
+	nih_free (dbus_err);
+
+	nih_unref (batch, upstart);
+}
+
 /**
- * make_safe_string:
- * @parent: parent,
+ * upstart_job_added:
+ * @data: not used,
+ * @message: D-Bus message (not used),
+ * @job_class_path: D-Bus path of job class.
+ *
+ * Called for each job class when the bridge starts, and for each new
+ * job class thereafter, to record the subsystems of the uevents in its
+ * conditions.
+ **/
+static void
+upstart_job_added (void *          data,
+		   NihDBusMessage *message,
+		   const char *    job_class_path)
+{
+	Job *                   job;
+	Job *                   old_job;
+	nih_local NihDBusProxy *job_class = NULL;
+	nih_local char ***      start_on = NULL;
+	nih_local char ***      stop_on = NULL;
+
+	nih_assert (job_class_path != NULL);
+
+	job_class = nih_dbus_proxy_new (NULL, upstart->connection,
+					upstart->name, job_class_path,
+					NULL, NULL);
+	if (! job_class) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not create proxy for job %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	job_class->auto_start = FALSE;
+
+	if (job_class_get_start_on_sync (NULL, job_class, &start_on) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not obtain job start condition %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	if (job_class_get_stop_on_sync (NULL, job_class, &stop_on) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("Could not obtain job stop condition %s: %s",
+			   job_class_path, err->message);
+		nih_free (err);
+
+		return;
+	}
+
+	job = NIH_MUST (nih_new (NULL, Job));
+	nih_list_init (&job->entry);
+	nih_alloc_set_destructor (job, nih_list_destroy);
+
+	job->path = NIH_MUST (nih_strdup (job, job_class_path));
+	job->subsystems = NIH_MUST (nih_str_array_new (job));
+
+	for (int i = 0; i < 2; i++) {
+		char ***condition = i ? stop_on : start_on;
+
+		for (char ***event = condition; event && *event && **event; event++) {
+			const char *     infix = NULL;
+			nih_local char * subsystem = NULL;
+
+			/* Subsystems may themselves contain the infix */
+			for (const char *p = strstr (**event, DEVICE_EVENT_INFIX); p;
+			     p = strstr (p + 1, DEVICE_EVENT_INFIX))
+				infix = p;
+
+			if ((! infix) || (infix == **event))
+				continue;
+
+			subsystem = NIH_MUST (nih_strndup (NULL, **event,
+							   infix - **event));
+			NIH_MUST (nih_str_array_add (&job->subsystems, job,
+						     NULL, subsystem));
+		}
+	}
+
+	old_job = (Job *)nih_hash_lookup (jobs, job_class_path);
+	if (old_job)
+		nih_free (old_job);
+
+	if (*job->subsystems) {
+		nih_debug ("Job got added %s", job_class_path);
+		nih_hash_add (jobs, &job->entry);
+	} else {
+		nih_free (job);
+	}
+
+	update_filters ();
+}
+
+/**
+ * upstart_job_removed:
+ * @data: not used,
+ * @message: D-Bus message (not used),
+ * @job_class_path: D-Bus path of job class.
+ *
+ * Called when a job class goes away to forget the subsystems of the
+ * uevents in its conditions.
+ **/
+static void
+upstart_job_removed (void *          data,
+		     NihDBusMessage *message,
+		     const char *    job_class_path)
+{
+	Job *job;
+
+	nih_assert (job_class_path != NULL);
+
+	job = (Job *)nih_hash_lookup (jobs, job_class_path);
+	if (job) {
+		nih_debug ("Job went away %s", job_class_path);
+		nih_free (job);
+
+		update_filters ();
+	}
+}
+
+/**
+ * update_filters:
+ *
+ * Replace the filters of the monitor with a match for each subsystem in
+ * the conditions of jobs, so that the kernel doesn't wake the bridge for
+ * uevents that no job is waiting for.
+ **/
+static void
+update_filters (void)
+{
+	nih_local NihHash *seen = NULL;
+	size_t             num_subsystems = 0;
+
+	nih_assert (monitor != NULL);
+
+	if (! jobs_loaded)
+		return;
+
+	seen = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	udev_monitor_filter_remove (monitor);
+
+	NIH_HASH_FOREACH (jobs, iter) {
+		Job *job = (Job *)iter;
+
+		for (char **subsystem = job->subsystems; *subsystem; subsystem++) {
+			NihListEntry *entry;
+
+			if (nih_hash_lookup (seen, *subsystem))
+				continue;
+
+			entry = NIH_MUST (nih_list_entry_new (seen));
+			entry->str = NIH_MUST (nih_strdup (entry, *subsystem));
+			nih_hash_add (seen, &entry->entry);
+			num_subsystems++;
+
+			if (udev_monitor_filter_add_match_subsystem_devtype (
+				    monitor, *subsystem, NULL) < 0)
+				nih_warn ("%s: %s", _("Could not add uevent filter"),
+					  *subsystem);
+		}
+	}
+
+	/* A monitor without any filter receives every uevent, so match
+	 * a subsystem that no device has instead.
+	 */
+	if (! num_subsystems)
+		udev_monitor_filter_add_match_subsystem_devtype (monitor, "", NULL);
+
+	if (udev_monitor_filter_update (monitor) < 0)
+		nih_warn (_("Could not update uevent filters"));
+}
+
+/**
+ * copy_safe_string:
+ * @dest: buffer to copy to,
  * @original: original string.
  *
- * Strip non-printable and non-blank bytes from specified string.
+ * Copy @original to @dest, which must have space for all of it, stripping
+ * non-printable and non-blank bytes unless the --no-strip option was
+ * given.
  *
  * Notes:
  *
@@ -377,47 +1241,34 @@ emit_event_error (void *          data,
  * by 'upower' (up_device_supply_make_safe_string()), with the exception
  * that we also allow blank characters (such as tabs).
  *
- * Returns a copy of @original stripped of all non-printable and
- * non-blank characters, or NULL if insufficient memory.
+ * Returns: pointer to the terminating nul byte written to @dest.
  **/
-char *
-make_safe_string (const void *parent, const char *original)
+static char *
+copy_safe_string (char *dest, const char *original)
 {
-	size_t   len;
 	size_t   i, j;
-	char    *cleaned;
 
+	nih_assert (dest);
 	nih_assert (original);
 
-	len = strlen (original);
-
-	cleaned = nih_alloc (parent, len + 1);
-
-	if (! cleaned)
-		return NULL;
-
-	for (i=0, j=0; i < len; ) {
+	for (i=0, j=0; original[i]; ) {
 		/* Skip over bogus bytes */
-		if (! (isprint (original[i]) || isblank (original[i]))) {
+		if ((! no_strip_udev_data)
+		    && (! (isprint (original[i]) || isblank (original[i])))) {
 			i++;
 			continue;
 		}
 
 		/* Copy what remains */
-		cleaned[j] = original[i];
+		dest[j] = original[i];
 		i++; j++;
 	}
 
 	/* Terminate */
-	cleaned[j] = '\0';
+	dest[j] = '\0';
 
 	if (i != j)
 		nih_debug ("removed unexpected bytes from udev message data");
 
-	/* Note that strictly we should realloc the string if
-	 * bogus bytes were found (since it will now be shorter).
-	 * However, since all the strings are short (and short-lived) we
-	 * do not do this to avoid the associated overhead.
-	 */
-	return cleaned;
+	return dest + j;
 }
@@ -27,6 +27,8 @@
 #include <sys/stat.h>
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <limits.h>
 
@@ -35,6 +37,13 @@
 
 #include "apparmor.h"
 
+
+/* Prototypes for static functions */
+static int apparmor_stamp       (const char *path, ApparmorStamp *stamp);
+static int apparmor_stamp_equal (const ApparmorStamp *stamp1,
+				 const ApparmorStamp *stamp2);
+
+
 /**
  * apparmor_switch:
  * @profile: AppArmor profile to switch to
@@ -114,3 +123,145 @@ apparmor_available (void)
 	return TRUE;
 }
 
+
+/**
+ * apparmor_load_needed:
+ * @class: job class being started.
+ *
+ * Determine whether the AppArmor profile of @class must be loaded before
+ * starting an instance; it need not be when AppArmor is not available,
+ * nor when the profile file is unchanged since it was last loaded
+ * successfully.
+ *
+ * Returns: TRUE if the profile must be loaded, FALSE otherwise.
+ **/
+int
+apparmor_load_needed (JobClass *class)
+{
+	ApparmorStamp stamp;
+
+	nih_assert (class != NULL);
+
+	if (! class->process[PROCESS_SECURITY])
+		return FALSE;
+
+	if (! apparmor_available ())
+		return FALSE;
+
+	if ((! class->apparmor_load) || (! class->apparmor_loaded.ino))
+		return TRUE;
+
+	if (apparmor_stamp (class->apparmor_load, &stamp) < 0)
+		return TRUE;
+
+	return ! apparmor_stamp_equal (&stamp, &class->apparmor_loaded);
+}
+
+/**
+ * apparmor_load_begin:
+ * @class: job class whose profile is being loaded.
+ *
+ * Note the identity of the profile file of @class as it is about to be
+ * loaded, so that apparmor_load_finished() records the file as it was
+ * when loading began and any change made while it was being loaded
+ * causes it to be loaded again.
+ **/
+void
+apparmor_load_begin (JobClass *class)
+{
+	nih_assert (class != NULL);
+
+	if ((! class->apparmor_load)
+	    || (apparmor_stamp (class->apparmor_load,
+				&class->apparmor_loading) < 0))
+		memset (&class->apparmor_loading, 0, sizeof (ApparmorStamp));
+}
+
+/**
+ * apparmor_load_finished:
+ * @class: job class whose profile was being loaded,
+ * @success: TRUE if the profile was loaded.
+ *
+ * Record whether the profile of @class was loaded, so that it is only
+ * loaded again once the file changes or after loading failed.
+ **/
+void
+apparmor_load_finished (JobClass *class,
+			int       success)
+{
+	nih_assert (class != NULL);
+
+	if (success) {
+		class->apparmor_loaded = class->apparmor_loading;
+	} else {
+		memset (&class->apparmor_loaded, 0, sizeof (ApparmorStamp));
+	}
+}
+
+/**
+ * apparmor_stamp:
+ * @path: path of profile file,
+ * @stamp: stamp to fill in.
+ *
+ * Fill in @stamp to identify the current contents of @path.
+ *
+ * A file that changed within the current clock tick could change again
+ * without its timestamps changing, so cannot be reliably identified;
+ * this is treated as an error so that such a profile is always loaded.
+ *
+ * Returns: zero on success, negative value if @path cannot be stamped.
+ **/
+static int
+apparmor_stamp (const char    *path,
+		ApparmorStamp *stamp)
+{
+	struct stat      statbuf;
+	struct timespec  now;
+
+	nih_assert (path != NULL);
+	nih_assert (stamp != NULL);
+
+	if (stat (path, &statbuf) < 0)
+		return -1;
+
+	/* File timestamps are taken from the coarse clock */
+	if (clock_gettime (CLOCK_REALTIME_COARSE, &now) < 0)
+		return -1;
+
+	if ((statbuf.st_ctim.tv_sec > now.tv_sec)
+	    || ((statbuf.st_ctim.tv_sec == now.tv_sec)
+		&& (statbuf.st_ctim.tv_nsec >= now.tv_nsec)))
+		return -1;
+
+	stamp->dev = statbuf.st_dev;
+	stamp->ino = statbuf.st_ino;
+	stamp->size = statbuf.st_size;
+	stamp->mtime = statbuf.st_mtim;
+	stamp->ctime = statbuf.st_ctim;
+
+	return 0;
+}
+
+/**
+ * apparmor_stamp_equal:
+ * @stamp1: first stamp,
+ * @stamp2: second stamp.
+ *
+ * Returns: TRUE if @stamp1 and @stamp2 identify the same contents of a
+ * profile file, FALSE otherwise.
+ **/
+static int
+apparmor_stamp_equal (const ApparmorStamp *stamp1,
+		      const ApparmorStamp *stamp2)
+{
+	nih_assert (stamp1 != NULL);
+	nih_assert (stamp2 != NULL);
+
+	return ((stamp1->dev == stamp2->dev)
+		&& (stamp1->ino == stamp2->ino)
+		&& (stamp1->size == stamp2->size)
+		&& (stamp1->mtime.tv_sec == stamp2->mtime.tv_sec)
+		&& (stamp1->mtime.tv_nsec == stamp2->mtime.tv_nsec)
+		&& (stamp1->ctime.tv_sec == stamp2->ctime.tv_sec)
+		&& (stamp1->ctime.tv_nsec == stamp2->ctime.tv_nsec));
+}
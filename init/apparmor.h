@@ -47,6 +47,11 @@ int    apparmor_switch (char *profile)
 int    apparmor_available (void)
 	__attribute__ ((warn_unused_result));
 
+int    apparmor_load_needed   (JobClass *class)
+	__attribute__ ((warn_unused_result));
+void   apparmor_load_begin    (JobClass *class);
+void   apparmor_load_finished (JobClass *class, int success);
+
 NIH_END_EXTERN
 
 #endif /* INIT_APPARMOR_H */
@@ -24,7 +24,9 @@
 #endif /* HAVE_CONFIG_H */
 
 #include <string.h>
+#include <stdarg.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
@@ -38,6 +40,7 @@
 #include <nih/hash.h>
 #include <nih/alloc.h>
 #include <nih/io.h>
+#include <nih/error.h>
 
 #include <dbus/dbus.h>
 
@@ -63,6 +66,16 @@ extern int          user_mode;
  **/
 int disable_cgroups = FALSE;
 
+/**
+ * cgroup_root:
+ *
+ * Mount point of a cgroup2 file system in which the cgroups named by the
+ * cgroup stanza are created and entered directly by job processes,
+ * rather than through the cgroup manager.  If NULL, the cgroup manager
+ * is used.
+ **/
+char *cgroup_root = NULL;
+
 /**
  * cgroup_manager_address:
  *
@@ -81,10 +94,60 @@ char *cgroup_manager_address = NULL;
  **/
 NihDBusProxy *cgroup_manager = NULL;
 
+/**
+ * CGroupRequests:
+ * @pending: number of requests awaiting a reply,
+ * @error: first error replied to a request, or NULL.
+ *
+ * Requests sent to the cgroup manager without waiting for the reply
+ * to each in turn; the cgroup manager handles the requests on a
+ * connection in the order they were sent, so later requests may depend
+ * on earlier ones.
+ **/
+typedef struct cgroup_requests {
+	size_t    pending;
+	NihError *error;
+} CGroupRequests;
+
 static void cgroup_manager_disconnected (DBusConnection *connection);
 
 static void cgroup_name_remap (char *str);
 
+static int  cgroup_request_sent   (CGroupRequests *requests,
+				   DBusPendingCall *pending_call);
+static void cgroup_request_reply  (void *data, NihDBusMessage *message);
+static void cgroup_create_reply   (void *data, NihDBusMessage *message,
+				   int32_t existed);
+static void cgroup_request_error  (void *data, NihDBusMessage *message);
+static int  cgroup_requests_wait  (CGroupRequests *requests)
+	__attribute__ ((warn_unused_result));
+
+static int  cgroup_create_send    (CGroupRequests *requests,
+				   const char *controller, const char *path);
+static int  cgroup_enter_send     (CGroupRequests *requests,
+				   const char *controller, const char *path,
+				   pid_t pid);
+static int  cgroup_settings_send  (CGroupRequests *requests,
+				   const char *controller, const char *path,
+				   NihList *settings);
+static int  cgroup_chown_send     (CGroupRequests *requests,
+				   const char *controller, const char *path,
+				   uid_t uid, gid_t gid);
+
+static char **cgroup_environment  (const void *parent, char * const *env)
+	__attribute__ ((warn_unused_result));
+static char  *cgroup_name_expand  (const void *parent, CGroupName *cgname,
+				   char * const *cgroup_env)
+	__attribute__ ((warn_unused_result));
+
+static int  cgroup_native_create  (const char *controller, const char *path,
+				   NihList *settings, int owned,
+				   uid_t uid, gid_t gid)
+	__attribute__ ((warn_unused_result));
+static int  cgroup_native_write   (const char *dir, const char *file,
+				   const char *format, ...)
+	__attribute__ ((warn_unused_result, format (printf, 3, 4)));
+
 /**
  * cgroup_support_enabled:
  *
@@ -317,12 +380,19 @@ error:
 int
 cgroup_clear (NihList *cgroups)
 {
+	CGroupRequests requests = { 0, NULL };
+
 	nih_assert (cgroups);
-	nih_assert (cgroup_manager);
 
 	if (! cgroup_support_enabled ())
 		return TRUE;
 
+	/* Job cgroups are removed by cgroup_remove() instead */
+	if (cgroup_root)
+		return TRUE;
+
+	nih_assert (cgroup_manager);
+
 	if (NIH_LIST_EMPTY (cgroups))
 		return TRUE;
 
@@ -332,24 +402,26 @@ cgroup_clear (NihList *cgroups)
 		NIH_LIST_FOREACH (&cgroup->names, iter2) {
 			CGroupName   *cgname = (CGroupName *)iter2;
 			char         *cgpath;
-			int           ret;
 
 			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
 
 			/* Get the cgroup manager to delete the cgroup once no more job
 			 * processes remain in it.
 			 */
-			ret = cgmanager_remove_on_empty_sync (NULL,
-					cgroup_manager,
-					cgroup->controller,
-					cgpath);
-
-			if (ret < 0) 
-				return FALSE;
+			if (! cgroup_request_sent (&requests,
+					cgmanager_remove_on_empty (cgroup_manager,
+						cgroup->controller,
+						cgpath,
+						cgroup_request_reply,
+						cgroup_request_error,
+						&requests,
+						NIH_DBUS_TIMEOUT_DEFAULT)))
+				goto wait;
 		}
 	}
 
-	return TRUE;
+wait:
+	return cgroup_requests_wait (&requests);
 }
 
 /**
@@ -372,24 +444,10 @@ cgroup_setup (NihList       *cgroups,
 	      uid_t          uid,
 	      gid_t          gid)
 {
-	const char       *upstart_job = NULL;
-	const char       *upstart_instance = NULL;
-	nih_local char   *suffix = NULL;
 	nih_local char  **cgroup_env = NULL;
-	nih_local char   *envvar = NULL;
-	int               instance = FALSE;
 	uid_t             current_uid;
 	gid_t             current_gid;
-
-	/* Value of $UPSTART_CGROUP which takes the form:
-	 *
-	 *     upstart/${UPSTART_JOB}
-	 *
-	 * Or for instance jobs:
-	 *
-	 *     upstart/${UPSTART_JOB}-${UPSTART_INSTANCE}
-	 */
-	nih_local char   *upstart_cgroup = NULL;
+	CGroupRequests    requests = { 0, NULL };
 
 	nih_assert (cgroups);
 	nih_assert (env);
@@ -405,13 +463,238 @@ cgroup_setup (NihList       *cgroups,
 	current_uid = geteuid ();
 	current_gid = getegid ();
 
-	cgroup_env = nih_str_array_new (NULL);
+	cgroup_env = cgroup_environment (NULL, env);
 	if (! cgroup_env)
-		nih_return_no_memory_error (FALSE);
+		return FALSE;
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName   *cgname = (CGroupName *)iter2;
+			char         *cgpath;
+			int           owned;
+
+			cgname->expanded = cgroup_name_expand (cgname, cgname,
+							       cgroup_env);
+			if (! cgname->expanded) {
+				/* Keep the error until the replies to the
+				 * requests already sent have been received.
+				 */
+				cgroup_request_sent (&requests, NULL);
+				goto wait;
+			}
+
+			if (! strcmp (cgname->name, cgname->expanded)) {
+				/* expanded value is the same as the
+				 * original, so don't bother storing the
+				 * former.
+				 */
+				nih_free (cgname->expanded);
+				cgname->expanded = NULL;
+			}
+
+			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
+
+			/* No need to chown if already owned */
+			owned = ((uid == current_uid) && (gid == current_gid));
+
+			if (cgroup_root) {
+				if (! cgroup_native_create (cgroup->controller,
+							    cgpath,
+							    &cgname->settings,
+							    owned, uid, gid))
+					return FALSE;
+
+				continue;
+			}
+
+			/* Requests are only sent here, the replies are all
+			 * waited for together below.
+			 */
+			if (! cgroup_create_send (&requests,
+						cgroup->controller,
+						cgpath))
+				goto wait;
+
+			if (! cgroup_settings_send (&requests,
+						cgroup->controller,
+						cgpath,
+						&cgname->settings))
+				goto wait;
+
+			if (owned)
+				continue;
+
+			if (! cgroup_chown_send (&requests, cgroup->controller,
+						cgpath, uid, gid))
+				goto wait;
+		}
+	}
+
+wait:
+	return cgroup_requests_wait (&requests);
+}
+
+/**
+ * cgroup_remove:
+ *
+ * @cgroups: list of CGroup objects,
+ * @env: environment table.
+ *
+ * Remove the cgroups created by cgroup_setup() for @cgroups and @env
+ * once the job they were created for has finished.  This is only
+ * needed when cgroups are managed directly, since otherwise
+ * cgroup_clear() has the cgroup manager remove them once empty;
+ * cgroups that still contain processes are left alone.
+ **/
+void
+cgroup_remove (NihList       *cgroups,
+	       char * const  *env)
+{
+	nih_local char **cgroup_env = NULL;
+
+	nih_assert (cgroups);
+	nih_assert (env);
+
+	if ((! cgroup_support_enabled ()) || (! cgroup_root))
+		return;
+
+	if (NIH_LIST_EMPTY (cgroups))
+		return;
+
+	cgroup_env = NIH_MUST (cgroup_environment (NULL, env));
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			nih_local char  *cgpath = NULL;
+			nih_local char  *dir = NULL;
+
+			cgpath = cgroup_name_expand (NULL, cgname, cgroup_env);
+			if (! cgpath) {
+				NihError *err;
+
+				err = nih_error_get ();
+				nih_debug ("Failed to expand cgroup %s: %s",
+					   cgname->name, err->message);
+				nih_free (err);
+				continue;
+			}
+
+			dir = NIH_MUST (nih_sprintf (NULL, "%s/%s",
+						     cgroup_root, cgpath));
+
+			/* Names shared between controllers name the same
+			 * cgroup, so it may already have gone.
+			 */
+			if ((rmdir (dir) < 0) && (errno != ENOENT))
+				nih_debug ("Failed to remove cgroup %s: %s",
+					   dir, strerror (errno));
+		}
+	}
+}
+
+/**
+ * cgroup_path:
+ *
+ * @parent: parent object for new string,
+ * @cgroups: list of CGroup objects,
+ * @env: environment table.
+ *
+ * Determine the directory of the first cgroup created by cgroup_setup()
+ * for @cgroups and @env, when managed directly; with the unified
+ * hierarchy any other cgroup a job is placed in is the same one or is
+ * overridden by it.
+ *
+ * Returns: newly allocated path, or NULL if the cgroups are not managed
+ * directly or the path could not be determined.
+ **/
+char *
+cgroup_path (const void    *parent,
+	     NihList       *cgroups,
+	     char * const  *env)
+{
+	nih_local char **cgroup_env = NULL;
+
+	nih_assert (cgroups);
+	nih_assert (env);
+
+	if ((! cgroup_support_enabled ()) || (! cgroup_root))
+		return NULL;
+
+	NIH_LIST_FOREACH (cgroups, iter) {
+		CGroup *cgroup = (CGroup *)iter;
+
+		NIH_LIST_FOREACH (&cgroup->names, iter2) {
+			CGroupName      *cgname = (CGroupName *)iter2;
+			nih_local char  *cgpath = NULL;
+
+			cgroup_env = cgroup_environment (NULL, env);
+			if (cgroup_env)
+				cgpath = cgroup_name_expand (NULL, cgname,
+							     cgroup_env);
+
+			if (! cgpath) {
+				NihError *err;
+
+				err = nih_error_get ();
+				nih_debug ("Failed to expand cgroup %s: %s",
+					   cgname->name, err->message);
+				nih_free (err);
+				return NULL;
+			}
+
+			return nih_sprintf (parent, "%s/%s", cgroup_root, cgpath);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * cgroup_environment:
+ *
+ * @parent: parent object for new table,
+ * @env: environment table.
+ *
+ * Copy @env, adding $UPSTART_CGROUP, to give the table that cgroup
+ * names are expanded against.
+ *
+ * Returns: new environment table or NULL on raised error.
+ **/
+static char **
+cgroup_environment (const void    *parent,
+		    char * const  *env)
+{
+	const char       *upstart_job = NULL;
+	const char       *upstart_instance = NULL;
+	nih_local char   *suffix = NULL;
+	char            **cgroup_env = NULL;
+	nih_local char   *envvar = NULL;
+	int               instance = FALSE;
+
+	/* Value of $UPSTART_CGROUP which takes the form:
+	 *
+	 *     upstart/${UPSTART_JOB}
+	 *
+	 * Or for instance jobs:
+	 *
+	 *     upstart/${UPSTART_JOB}-${UPSTART_INSTANCE}
+	 */
+	nih_local char   *upstart_cgroup = NULL;
+
+	nih_assert (env);
+
+	cgroup_env = nih_str_array_new (parent);
+	if (! cgroup_env)
+		nih_return_no_memory_error (NULL);
 
 	/* Copy the existing environment table */
-	if (! environ_append (&cgroup_env, NULL, NULL, TRUE, env))
-		nih_return_no_memory_error (FALSE);
+	if (! environ_append (&cgroup_env, parent, NULL, TRUE, env))
+		goto error;
 
 	upstart_job = environ_get (cgroup_env, "UPSTART_JOB");
 	nih_assert (upstart_job);
@@ -429,7 +712,7 @@ cgroup_setup (NihList       *cgroups,
 			instance ? upstart_instance : "");
 
 	if (! suffix)
-		nih_return_no_memory_error (FALSE);
+		goto error;
 
 	/* Remap the standard prefix to avoid creating sub-cgroups erroneously */
 	cgroup_name_remap (suffix);
@@ -437,80 +720,72 @@ cgroup_setup (NihList       *cgroups,
 	upstart_cgroup = nih_sprintf (NULL, "upstart/%s", suffix);
 
 	if (! upstart_cgroup)
-		nih_return_no_memory_error (FALSE);
-
-	envvar = NIH_MUST (nih_sprintf (NULL, "%s=%s",
-				UPSTART_CGROUP_ENVVAR,
-				upstart_cgroup));
-
-	if (! environ_add (&cgroup_env, NULL, NULL, TRUE, envvar))
-		nih_return_no_memory_error (FALSE);
-
-	NIH_LIST_FOREACH (cgroups, iter) {
-		CGroup *cgroup = (CGroup *)iter;
-
-		NIH_LIST_FOREACH (&cgroup->names, iter2) {
-			CGroupName   *cgname = (CGroupName *)iter2;
-			char         *cgpath;
-			char         *p;
-
-			/* TRUE if the path *starts with* '$UPSTART_CGROUP' */
-			int           has_var = FALSE;
-			size_t        len;
+		goto error;
 
-			/* Note that we don't support "${UPSTART_CGROUP}" */
-			p = strstr (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR);
+	envvar = nih_sprintf (NULL, "%s=%s",
+			UPSTART_CGROUP_ENVVAR,
+			upstart_cgroup);
+	if (! envvar)
+		goto error;
 
-			/* cgroup specifies UPSTART_CGROUP initially */
-			if (p && p == cgname->name)
-				has_var = TRUE;
+	if (! environ_add (&cgroup_env, parent, NULL, TRUE, envvar))
+		goto error;
 
-			cgname->expanded = environ_expand (cgname,
-						cgname->name,
-						cgroup_env);
+	return cgroup_env;
 
-			if (! cgname->expanded)
-				return FALSE;
+error:
+	nih_free (cgroup_env);
+	nih_return_no_memory_error (NULL);
+}
 
-			len = strlen (cgname->expanded);
+/**
+ * cgroup_name_expand:
+ *
+ * @parent: parent object for new string,
+ * @cgname: CGroupName,
+ * @cgroup_env: environment table from cgroup_environment().
+ *
+ * Expand the variables in the name of @cgname, remapping slashes in
+ * the values substituted so that they cannot create sub-cgroups.
+ *
+ * Returns: newly allocated path or NULL on raised error.
+ **/
+static char *
+cgroup_name_expand (const void    *parent,
+		    CGroupName    *cgname,
+		    char * const  *cgroup_env)
+{
+	char    *expanded;
+	char    *p;
+	size_t   len;
 
-			/* Remap slash to underscore to avoid unexpected
-			 * sub-cgroup creation.
-			 */
-			cgroup_name_remap (has_var && len > strlen (UPSTART_CGROUP_SHELL_ENVVAR)
-					? cgname->expanded + strlen (UPSTART_CGROUP_SHELL_ENVVAR)
-					: cgname->expanded);
+	/* TRUE if the path *starts with* '$UPSTART_CGROUP' */
+	int      has_var = FALSE;
 
-			if (! strcmp (cgname->name, cgname->expanded)) {
-				/* expanded value is the same as the
-				 * original, so don't bother storing the
-				 * former.
-				 */
-				nih_free (cgname->expanded);
-				cgname->expanded = NULL;
-			}
+	nih_assert (cgname);
+	nih_assert (cgroup_env);
 
-			cgpath = cgname->expanded ? cgname->expanded : cgname->name;
+	/* Note that we don't support "${UPSTART_CGROUP}" */
+	p = strstr (cgname->name, UPSTART_CGROUP_SHELL_ENVVAR);
 
-			if (! cgroup_create (cgroup->controller, cgpath))
-				return FALSE;
+	/* cgroup specifies UPSTART_CGROUP initially */
+	if (p && p == cgname->name)
+		has_var = TRUE;
 
-			if (! cgroup_settings_apply (cgroup->controller,
-						cgpath,
-						&cgname->settings))
-				return FALSE;
+	expanded = environ_expand (parent, cgname->name, cgroup_env);
+	if (! expanded)
+		return NULL;
 
-			if ((uid == current_uid) && (gid == current_gid)) {
-				/* No need to chown */
-				continue;
-			}
+	len = strlen (expanded);
 
-			if (! cgroup_chown (cgroup->controller, cgpath, uid, gid))
-				return FALSE;
-		}
-	}
+	/* Remap slash to underscore to avoid unexpected
+	 * sub-cgroup creation.
+	 */
+	cgroup_name_remap (has_var && len > strlen (UPSTART_CGROUP_SHELL_ENVVAR)
+			? expanded + strlen (UPSTART_CGROUP_SHELL_ENVVAR)
+			: expanded);
 
-	return TRUE;
+	return expanded;
 }
 
 /**
@@ -932,14 +1207,15 @@ error:
 /**
  * cgroup_manager_available:
  *
- * Determine if the cgroup manager is running.
+ * Determine if the cgroup manager is running, or if cgroups are managed
+ * directly below cgroup_root and so it is not needed.
  *
  * Returns: TRUE on success, else FALSE.
  **/
 int
 cgroup_manager_available (void)
 {
-	return !! cgroup_manager_address;
+	return cgroup_root || cgroup_manager_address;
 }
 
 /**
@@ -1104,42 +1380,65 @@ cgroup_manager_disconnected (DBusConnection *connection)
 int
 cgroup_create (const char *controller, const char *path)
 {
-	int        ret = 0;
-	int        existed = -1;
-	pid_t      pid;
+	CGroupRequests requests = { 0, NULL };
 
 	nih_assert (controller);
 	nih_assert (path);
 	nih_assert (cgroup_manager);
 
-	if (! user_mode) {
-		pid = getpid ();
+	cgroup_create_send (&requests, controller, path);
+
+	return cgroup_requests_wait (&requests);
+}
 
+/**
+ * cgroup_create_send:
+ * @requests: requests to add to,
+ * @controller: cgroup controller,
+ * @path: relative cgroup path to create.
+ *
+ * Send the requests made by cgroup_create() to the cgroup manager
+ * without waiting for their replies.
+ *
+ * Returns: TRUE on success, FALSE if a request could not be sent, in
+ * which case the error is raised by cgroup_requests_wait().
+ **/
+static int
+cgroup_create_send (CGroupRequests *requests,
+		    const char     *controller,
+		    const char     *path)
+{
+	nih_assert (requests);
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (cgroup_manager);
+
+	if (! user_mode) {
 		/* Escape our existing cgroup for this controller by moving to
 		 * the root cgroup to avoid creating groups below the current
 		 * cgroup.
 		 */
-		ret = cgmanager_move_pid_abs_sync (NULL,
-						   cgroup_manager,
-						   controller,
-						   UPSTART_CGROUP_ROOT,
-						   pid);
-
-		if (ret < 0)
+		if (! cgroup_request_sent (requests,
+				cgmanager_move_pid_abs (cgroup_manager,
+					controller,
+					UPSTART_CGROUP_ROOT,
+					getpid (),
+					cgroup_request_reply,
+					cgroup_request_error,
+					requests,
+					NIH_DBUS_TIMEOUT_DEFAULT)))
 			return FALSE;
 	}
 
 	/* Ask the cgroup manager to create the cgroup */
-	ret = cgmanager_create_sync (NULL,
-			cgroup_manager,
-			controller,
-			path,
-			&existed);
-
-	if (ret < 0)
-		return FALSE;
-
-	return TRUE;
+	return cgroup_request_sent (requests,
+			cgmanager_create (cgroup_manager,
+				controller,
+				path,
+				cgroup_create_reply,
+				cgroup_request_error,
+				requests,
+				NIH_DBUS_TIMEOUT_DEFAULT));
 }
 
 /**
@@ -1156,7 +1455,7 @@ cgroup_create (const char *controller, const char *path)
 int
 cgroup_enter (const char *controller, const char *path, pid_t pid)
 {
-	int     ret;
+	CGroupRequests requests = { 0, NULL };
 
 	nih_assert (controller);
 	nih_assert (path);
@@ -1164,17 +1463,46 @@ cgroup_enter (const char *controller, const char *path, pid_t pid)
 
 	nih_assert (cgroup_manager);
 
-	/* Move the pid into the appropriate cgroup */
-	ret = cgmanager_move_pid_sync (NULL,
-			cgroup_manager,
-			controller,
-			path,
-			pid);
+	cgroup_enter_send (&requests, controller, path, pid);
 
-	if (ret < 0)
-		return FALSE;
+	return cgroup_requests_wait (&requests);
+}
 
-	return TRUE;
+/**
+ * cgroup_enter_send:
+ * @requests: requests to add to,
+ * @controller: cgroup controller,
+ * @path: cgroup path to enter,
+ * @pid: pid to move.
+ *
+ * Send the request made by cgroup_enter() to the cgroup manager without
+ * waiting for its reply.
+ *
+ * Returns: TRUE on success, FALSE if the request could not be sent, in
+ * which case the error is raised by cgroup_requests_wait().
+ **/
+static int
+cgroup_enter_send (CGroupRequests *requests,
+		   const char     *controller,
+		   const char     *path,
+		   pid_t           pid)
+{
+	nih_assert (requests);
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (pid > 0);
+	nih_assert (cgroup_manager);
+
+	/* Move the pid into the appropriate cgroup */
+	return cgroup_request_sent (requests,
+			cgmanager_move_pid (cgroup_manager,
+				controller,
+				path,
+				pid,
+				cgroup_request_reply,
+				cgroup_request_error,
+				requests,
+				NIH_DBUS_TIMEOUT_DEFAULT));
 }
 
 /**
@@ -1351,13 +1679,43 @@ cgroup_settings_apply (const char  *controller,
 		       const char  *path,
 		       NihList     *settings)
 {
-	int               ret;
+	CGroupRequests requests = { 0, NULL };
 
 	nih_assert (controller);
 	nih_assert (path);
 	nih_assert (settings);
 	nih_assert (cgroup_manager);
 
+	cgroup_settings_send (&requests, controller, path, settings);
+
+	return cgroup_requests_wait (&requests);
+}
+
+/**
+ * cgroup_settings_send:
+ * @requests: requests to add to,
+ * @controller: controller,
+ * @path: expanded path name,
+ * @settings: List of CGroupSettings.
+ *
+ * Send the requests made by cgroup_settings_apply() to the cgroup
+ * manager without waiting for their replies.
+ *
+ * Returns: TRUE on success, FALSE if a request could not be sent, in
+ * which case the error is raised by cgroup_requests_wait().
+ **/
+static int
+cgroup_settings_send (CGroupRequests *requests,
+		      const char     *controller,
+		      const char     *path,
+		      NihList        *settings)
+{
+	nih_assert (requests);
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (settings);
+	nih_assert (cgroup_manager);
+
 	NIH_LIST_FOREACH (settings, iter) {
 		nih_local char *setting_key = NULL;
 
@@ -1366,17 +1724,21 @@ cgroup_settings_apply (const char  *controller,
 		/* setting files in a cgroup directory take the form "controller.key" */
 		setting_key = nih_sprintf (NULL, "%s.%s",
 				controller, setting->key);
-		if (! setting_key)
-			nih_return_no_memory_error (FALSE);
-
-		ret = cgmanager_set_value_sync (NULL,
-				cgroup_manager,
-				controller,
-				path,
-				setting_key,
-				setting->value ? setting->value : "");
+		if (! setting_key) {
+			nih_error_raise_no_memory ();
+			return cgroup_request_sent (requests, NULL);
+		}
 
-		if (ret < 0)
+		if (! cgroup_request_sent (requests,
+				cgmanager_set_value (cgroup_manager,
+					controller,
+					path,
+					setting_key,
+					setting->value ? setting->value : "",
+					cgroup_request_reply,
+					cgroup_request_error,
+					requests,
+					NIH_DBUS_TIMEOUT_DEFAULT)))
 			return FALSE;
 	}
 
@@ -1395,10 +1757,11 @@ cgroup_settings_apply (const char  *controller,
 int
 cgroup_enter_groups (NihList  *cgroups)
 {
-	pid_t   pid;
+	CGroupRequests  requests = { 0, NULL };
+	pid_t           pid;
 
 	nih_assert (cgroups);
-	nih_assert (cgroup_manager_address);
+	nih_assert (cgroup_manager_available ());
 	
 	pid = getpid ();
 
@@ -1414,16 +1777,35 @@ cgroup_enter_groups (NihList  *cgroups)
 		NIH_LIST_FOREACH (&cgroup->names, iter2) {
 			CGroupName      *cgname = (CGroupName *)iter2;
 
-			if (! cgroup_enter (cgroup->controller,
+			if (cgroup_root) {
+				nih_local char *dir = NULL;
+
+				dir = nih_sprintf (NULL, "%s/%s", cgroup_root,
+						   cgname->expanded
+						   ? cgname->expanded
+						   : cgname->name);
+				if (! dir)
+					nih_return_no_memory_error (FALSE);
+
+				if (! cgroup_native_write (dir, "cgroup.procs",
+							   "%d", pid))
+					return FALSE;
+
+				continue;
+			}
+
+			if (! cgroup_enter_send (&requests,
+						cgroup->controller,
 						cgname->expanded
 						? cgname->expanded
 						: cgname->name,
 						pid))
-				return FALSE;
+				goto wait;
 		}
 	}
 
-	return TRUE;
+wait:
+	return cgroup_requests_wait (&requests);
 }
 
 /**
@@ -1444,22 +1826,349 @@ cgroup_chown (const char  *controller,
 	      uid_t        uid,
 	      gid_t        gid)
 {
-	int ret = 0;
+	CGroupRequests requests = { 0, NULL };
 
 	nih_assert (controller);
 	nih_assert (path);
 	nih_assert (cgroup_manager);
 
+	cgroup_chown_send (&requests, controller, path, uid, gid);
+
+	return cgroup_requests_wait (&requests);
+}
+
+/**
+ * cgroup_chown_send:
+ * @requests: requests to add to,
+ * @controller: controller,
+ * @path: expanded path name,
+ * @uid: user id to change ownership to,
+ * @gid: group id to change ownership to.
+ *
+ * Send the request made by cgroup_chown() to the cgroup manager without
+ * waiting for its reply.
+ *
+ * Returns: TRUE on success, FALSE if the request could not be sent, in
+ * which case the error is raised by cgroup_requests_wait().
+ **/
+static int
+cgroup_chown_send (CGroupRequests *requests,
+		   const char     *controller,
+		   const char     *path,
+		   uid_t           uid,
+		   gid_t           gid)
+{
+	nih_assert (requests);
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (cgroup_manager);
+
 	/* Ask cgmanager to chown the path */
-	ret = cgmanager_chown_sync (NULL,
-			cgroup_manager,
-			controller,
-			path,
-			uid,
-			gid);
-
-	if (ret < 0)
+	return cgroup_request_sent (requests,
+			cgmanager_chown (cgroup_manager,
+				controller,
+				path,
+				uid,
+				gid,
+				cgroup_request_reply,
+				cgroup_request_error,
+				requests,
+				NIH_DBUS_TIMEOUT_DEFAULT));
+}
+
+/**
+ * cgroup_native_create:
+ * @controller: controller,
+ * @path: expanded path name,
+ * @settings: List of CGroupSettings,
+ * @owned: TRUE if the cgroup need not be chowned,
+ * @uid: user id to change ownership to,
+ * @gid: group id to change ownership to.
+ *
+ * Create @path below cgroup_root, enabling @controller for each new
+ * cgroup on the way, apply @settings to it and delegate it to @uid and
+ * @gid unless @owned; this is what the cgroup manager would do for the
+ * requests made by cgroup_setup().
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_native_create (const char  *controller,
+		      const char  *path,
+		      NihList     *settings,
+		      int          owned,
+		      uid_t        uid,
+		      gid_t        gid)
+{
+	nih_local char    *dir = NULL;
+	const char        *p;
+	const char * const delegated[] = {
+		"cgroup.procs",
+		"cgroup.threads",
+		"cgroup.subtree_control",
+		NULL
+	};
+
+	nih_assert (controller);
+	nih_assert (path);
+	nih_assert (settings);
+	nih_assert (cgroup_root);
+
+	dir = nih_strdup (NULL, cgroup_root);
+	if (! dir)
+		nih_return_no_memory_error (FALSE);
+
+	p = path;
+	while (*p) {
+		size_t len;
+
+		while (*p == '/')
+			p++;
+		if (! *p)
+			break;
+
+		len = strcspn (p, "/");
+
+		/* Controllers are only available in a cgroup when enabled
+		 * in its parent.
+		 */
+		if (! cgroup_native_write (dir, "cgroup.subtree_control",
+					   "+%s", controller))
+			return FALSE;
+
+		if (! nih_strcat_sprintf (&dir, NULL, "/%.*s", (int)len, p))
+			nih_return_no_memory_error (FALSE);
+
+		if ((mkdir (dir, 0755) < 0) && (errno != EEXIST))
+			nih_return_system_error (FALSE);
+
+		p += len;
+	}
+
+	NIH_LIST_FOREACH (settings, iter) {
+		nih_local char *setting_key = NULL;
+
+		CGroupSetting *setting = (CGroupSetting *)iter;
+
+		/* setting files in a cgroup directory take the form "controller.key" */
+		setting_key = nih_sprintf (NULL, "%s.%s",
+				controller, setting->key);
+		if (! setting_key)
+			nih_return_no_memory_error (FALSE);
+
+		if (! cgroup_native_write (dir, setting_key, "%s",
+					   setting->value ? setting->value : ""))
+			return FALSE;
+	}
+
+	if (owned)
+		return TRUE;
+
+	/* Delegate the cgroup by handing over the directory and the files
+	 * used to manage processes and sub-cgroups within it.
+	 */
+	if (chown (dir, uid, gid) < 0)
+		nih_return_system_error (FALSE);
+
+	for (const char * const *file = delegated; *file; file++) {
+		nih_local char *file_path = NULL;
+
+		file_path = nih_sprintf (NULL, "%s/%s", dir, *file);
+		if (! file_path)
+			nih_return_no_memory_error (FALSE);
+
+		if (chown (file_path, uid, gid) < 0)
+			nih_return_system_error (FALSE);
+	}
+
+	return TRUE;
+}
+
+/**
+ * cgroup_native_write:
+ * @dir: cgroup directory,
+ * @file: name of file within @dir,
+ * @format: format string for value.
+ *
+ * Write the value formatted from @format to @file within the cgroup
+ * directory @dir.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+cgroup_native_write (const char *dir,
+		     const char *file,
+		     const char *format,
+		     ...)
+{
+	nih_local char *path = NULL;
+	nih_local char *value = NULL;
+	va_list         args;
+	int             fd;
+
+	nih_assert (dir);
+	nih_assert (file);
+	nih_assert (format);
+
+	path = nih_sprintf (NULL, "%s/%s", dir, file);
+	if (! path)
+		nih_return_no_memory_error (FALSE);
+
+	va_start (args, format);
+	value = nih_vsprintf (NULL, format, args);
+	va_end (args);
+
+	if (! value)
+		nih_return_no_memory_error (FALSE);
+
+	fd = open (path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (FALSE);
+
+	if (write (fd, value, strlen (value)) < 0) {
+		nih_error_raise_system ();
+		close (fd);
+		return FALSE;
+	}
+
+	close (fd);
+
+	return TRUE;
+}
+
+/**
+ * cgroup_request_sent:
+ * @requests: requests to add to,
+ * @pending_call: call returned when sending a request, or NULL.
+ *
+ * Count the request sent as @pending_call as awaiting its reply, the
+ * call itself is released since the reply handlers are passed
+ * @requests.  If @pending_call is NULL, the error raised while sending
+ * the request is kept in @requests.
+ *
+ * Returns: TRUE if @pending_call is not NULL, FALSE otherwise.
+ **/
+static int
+cgroup_request_sent (CGroupRequests  *requests,
+		     DBusPendingCall *pending_call)
+{
+	NihError *err;
+
+	nih_assert (requests);
+
+	if (pending_call) {
+		requests->pending++;
+		dbus_pending_call_unref (pending_call);
+		return TRUE;
+	}
+
+	err = nih_error_steal ();
+	if (requests->error) {
+		nih_free (err);
+	} else {
+		requests->error = err;
+	}
+
+	return FALSE;
+}
+
+/**
+ * cgroup_request_reply:
+ * @data: CGroupRequests,
+ * @message: D-Bus message received.
+ *
+ * Called when the cgroup manager replies to a request not returning
+ * any value.
+ **/
+static void
+cgroup_request_reply (void           *data,
+		      NihDBusMessage *message)
+{
+	CGroupRequests *requests = data;
+
+	nih_assert (requests);
+	nih_assert (requests->pending > 0);
+
+	requests->pending--;
+}
+
+/**
+ * cgroup_create_reply:
+ * @data: CGroupRequests,
+ * @message: D-Bus message received,
+ * @existed: TRUE if the cgroup already existed.
+ *
+ * Called when the cgroup manager replies to a request to create a
+ * cgroup.
+ **/
+static void
+cgroup_create_reply (void           *data,
+		     NihDBusMessage *message,
+		     int32_t         existed)
+{
+	cgroup_request_reply (data, message);
+}
+
+/**
+ * cgroup_request_error:
+ * @data: CGroupRequests,
+ * @message: D-Bus message received.
+ *
+ * Called when the cgroup manager replies to a request with an error,
+ * which is kept in @data if it is the first.
+ **/
+static void
+cgroup_request_error (void           *data,
+		      NihDBusMessage *message)
+{
+	CGroupRequests *requests = data;
+
+	nih_assert (requests);
+	nih_assert (requests->pending > 0);
+
+	requests->pending--;
+
+	cgroup_request_sent (requests, NULL);
+}
+
+/**
+ * cgroup_requests_wait:
+ * @requests: requests sent.
+ *
+ * Wait for the cgroup manager to reply to every request in @requests,
+ * these are handled in the order they were sent so this costs a single
+ * round trip rather than one for each request.
+ *
+ * Returns: TRUE if every request succeeded, FALSE on raised error.
+ **/
+static int
+cgroup_requests_wait (CGroupRequests *requests)
+{
+	DBusConnection *connection;
+
+	nih_assert (requests);
+
+	if (requests->pending) {
+		nih_assert (cgroup_manager);
+
+		connection = dbus_connection_ref (cgroup_manager->connection);
+
+		while (requests->pending
+		       && dbus_connection_read_write_dispatch (connection, -1))
+			;
+
+		dbus_connection_unref (connection);
+	}
+
+	if (requests->error) {
+		nih_error_raise_error (requests->error);
+		requests->error = NULL;
 		return FALSE;
+	}
+
+	if (requests->pending)
+		nih_return_error (FALSE, CGROUP_ERROR,
+				  _("cgroup manager disconnected"));
 
 	return TRUE;
 }
@@ -120,6 +120,8 @@ typedef struct cgroup {
 
 NIH_BEGIN_EXTERN
 
+extern char *cgroup_root;
+
 void cgroup_init (void);
 
 int cgroup_support_enabled (void)
@@ -178,6 +180,11 @@ int cgroup_setup (NihList *cgroups, char * const *env,
 		uid_t uid, gid_t gid)
 	__attribute__ ((warn_unused_result));
 
+void cgroup_remove (NihList *cgroups, char * const *env);
+
+char *cgroup_path (const void *parent, NihList *cgroups, char * const *env)
+	__attribute__ ((warn_unused_result));
+
 int cgroup_chown (const char *controller,
 		  const char *path,
 		  uid_t uid, gid_t gid)
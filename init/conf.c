@@ -25,11 +25,15 @@
 
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <nih/macros.h>
@@ -47,11 +51,16 @@
 #include "parse_job.h"
 #include "parse_conf.h"
 #include "conf.h"
+#include "job_process.h"
+#include "pool.h"
 #include "errors.h"
 #include "paths.h"
 #include "environ.h"
+#include "deadline.h"
+#include "iowatch.h"
 
 /* Prototypes for static functions */
+static StateIndex *conf_source_index_new (const void *parent);
 static int  conf_source_reload_file    (ConfSource *source)
 	__attribute__ ((warn_unused_result));
 static int  conf_source_reload_dir     (ConfSource *source)
@@ -66,11 +75,65 @@ static void conf_create_modify_handler (ConfSource *source, NihWatch *watch,
 					struct stat *statbuf);
 static void conf_delete_handler        (ConfSource *source, NihWatch *watch,
 					const char *path);
+static void conf_file_changed          (ConfSource *source,
+					const char *path);
+static void conf_file_deleted          (ConfSource *source,
+					const char *path);
+static int  conf_mark_dirty            (ConfSource *source,
+					const char *path);
+static void conf_dirty_timeout         (void *data, Deadline *deadline);
+static void conf_dirty_clear           (void);
 static int  conf_file_visitor          (ConfSource *source,
 					const char *dirname, const char *path,
 					struct stat *statbuf)
 	__attribute__ ((warn_unused_result));
+static void conf_source_prefetch       (ConfSource *source);
+static int  conf_prefetch_visitor      (ConfSource *source,
+					const char *dirname, const char *path,
+					struct stat *statbuf);
+static void conf_prefetch_path         (const char *path);
+static int  conf_file_stamp            (const char *path,
+					ConfFileStamp *stamp)
+	__attribute__ ((warn_unused_result));
+static int  conf_file_stamp_equal      (const ConfFileStamp *stamp1,
+					const ConfFileStamp *stamp2)
+	__attribute__ ((warn_unused_result));
+static int  conf_file_unchanged        (const ConfFile *file,
+					const ConfFileStamp *stamp,
+					const char *override_path,
+					const ConfFileStamp *override_stamp)
+	__attribute__ ((warn_unused_result));
+static void conf_file_set_stamp        (ConfFile *file, int stamped,
+					const ConfFileStamp *stamp,
+					char *override_path,
+					const ConfFileStamp *override_stamp);
+static uint64_t conf_digest_update     (uint64_t digest, const char *buf,
+					size_t len)
+	__attribute__ ((warn_unused_result));
+static int  conf_file_digest           (const char *conf_path,
+					const char *override_path,
+					uint64_t *digest)
+	__attribute__ ((warn_unused_result));
 
+static char *conf_file_map             (const void *parent, const char *path,
+					size_t *len, int *mapped)
+	__attribute__ ((warn_unused_result));
+static void conf_file_unmap            (char *buf, size_t len, int mapped);
+static int  conf_lazy_index            (ConfSource *source,
+					const char *conf_path,
+					const char *override_path,
+					const char *job_name)
+	__attribute__ ((warn_unused_result));
+static ConfLazy *conf_lazy_new         (ConfFile *file, const void *parent,
+					NihHash *hash, const char *name);
+static void conf_lazy_scan             (ConfLazy *lazy, const char *buf,
+					size_t len);
+static int  conf_lazy_word             (const char *buf, size_t len,
+					size_t *pos, const char *word);
+static void conf_lazy_scan_on          (ConfLazy *lazy, const char *buf,
+					size_t len, size_t *pos);
+static void conf_file_load_lazy        (ConfFile *file);
+static void conf_file_unindex          (ConfFile *file);
 static int  conf_reload_path           (ConfSource *source, const char *path,
 					const char *override_path)
 	__attribute__ ((warn_unused_result));
@@ -121,6 +184,59 @@ const char *session_file = NULL;
  **/
 NihList *conf_sources = NULL;
 
+/**
+ * conf_prefetch:
+ *
+ * If TRUE, conf_reload() asks the kernel to start reading every
+ * configuration file before any are parsed, so that the reads proceed
+ * in parallel rather than one at a time as each file is parsed.
+ **/
+int conf_prefetch = FALSE;
+
+/**
+ * conf_lazy:
+ *
+ * If TRUE, job files are not parsed when loaded, only indexed by the
+ * names of the job and of the events it may start on; each is parsed
+ * when one of those events is emitted or the job is asked for by name.
+ **/
+int conf_lazy = FALSE;
+
+/**
+ * conf_reload_delay:
+ *
+ * Seconds for which changes to configuration files seen by inotify are
+ * gathered in conf_dirty, so that a storm of them, such as a package
+ * installing many jobs, is handled in a single pass; zero, the default,
+ * handles each change as soon as it is seen.
+ **/
+int conf_reload_delay = 0;
+
+/**
+ * conf_dirty:
+ *
+ * Files changed since the last pass, each entry is a ConfDirty structure
+ * keyed by path; and the timer that handles them.
+ **/
+static NihHash  *conf_dirty = NULL;
+static Deadline *conf_dirty_timer = NULL;
+
+/**
+ * conf_lazy_jobs:
+ *
+ * Index of job files not yet parsed by the name of the job, each entry
+ * is a ConfLazy structure.
+ **/
+static NihHash *conf_lazy_jobs = NULL;
+
+/**
+ * conf_lazy_events:
+ *
+ * Index of job files not yet parsed by each name in their start on
+ * condition, each entry is a ConfLazy structure.
+ **/
+static NihHash *conf_lazy_events = NULL;
+
 extern json_object *json_conf_sources;
 
 /**
@@ -410,6 +526,12 @@ conf_source_new (const void     *parent,
 		return NULL;
 	}
 
+	source->jobs = nih_hash_string_new (source, 0);
+	if (! source->jobs) {
+		nih_free (source);
+		return NULL;
+	}
+
 	nih_alloc_set_destructor (source, nih_list_destroy);
 
 	nih_list_add (conf_sources, &source->entry);
@@ -426,7 +548,9 @@ conf_source_new (const void     *parent,
  * with @path indicating which file it is.
  *
  * The returned structure is automatically placed in the @source's files hash
- * and the flag of the returned ConfFile will be set to that of the @source.
+ * and the flag of the returned ConfFile will be set to that of the @source;
+ * files of job directories are also placed in its jobs hash under the name
+ * of the job that @path defines.
  *
  * Returns: newly allocated ConfFile structure or NULL if insufficient memory.
  **/
@@ -453,8 +577,33 @@ conf_file_new (ConfSource *source,
 
 	file->source = source;
 	file->flag = source->flag;
+	file->stamped = FALSE;
+	file->override_path = NULL;
+	file->digested = FALSE;
+	file->digest = CONF_DIGEST_INIT;
+	file->lazy = NULL;
+	file->named = NULL;
 	file->data = NULL;
 
+	if (source->type == CONF_JOB_DIR) {
+		file->named = nih_new (file, ConfJob);
+		if (! file->named) {
+			nih_free (file);
+			return NULL;
+		}
+
+		nih_list_init (&file->named->entry);
+		nih_alloc_set_destructor (file->named, nih_list_destroy);
+
+		file->named->name = conf_to_job_name (source->path, path);
+		nih_ref (file->named->name, file->named);
+		nih_discard (file->named->name);
+
+		file->named->file = file;
+
+		nih_hash_add (source->jobs, &file->named->entry);
+	}
+
 	nih_alloc_set_destructor (file, conf_file_destroy);
 
 	nih_hash_add (source->files, &file->entry);
@@ -493,6 +642,20 @@ conf_reload (void)
 {
 	conf_init ();
 
+	/* Everything is about to be looked at again anyway */
+	conf_dirty_clear ();
+
+	/* Look up the groups of spawned processes once, not for each */
+	job_process_groups_reload ();
+
+	if (conf_prefetch) {
+		NIH_LIST_FOREACH (conf_sources, iter) {
+			ConfSource *source = (ConfSource *)iter;
+
+			conf_source_prefetch (source);
+		}
+	}
+
 	NIH_LIST_FOREACH (conf_sources, iter) {
 		ConfSource *source = (ConfSource *)iter;
 
@@ -507,6 +670,9 @@ conf_reload (void)
 			nih_free (err);
 		}
 	}
+
+	if (parse_profile_enabled)
+		parse_profile_report ();
 }
 
 /**
@@ -566,8 +732,10 @@ conf_source_reload (ConfSource *source)
 	NIH_HASH_FOREACH_SAFE (source->files, iter) {
 		ConfFile *file = (ConfFile *)iter;
 
-		if (file->flag != source->flag)
+		if (file->flag != source->flag) {
+			conf_file_unindex (file);
 			nih_list_add (&deleted, &file->entry);
+		}
 	}
 	NIH_LIST_FOREACH_SAFE (&deleted, iter) {
 		ConfFile *file = (ConfFile *)iter;
@@ -579,6 +747,101 @@ conf_source_reload (ConfSource *source)
 	return ret;
 }
 
+/**
+ * conf_source_prefetch:
+ * @source: configuration source to prefetch.
+ *
+ * Start reading all of the files of @source into the page cache, ahead
+ * of them being parsed by conf_source_reload().
+ *
+ * Errors are ignored since they will be reported when @source is
+ * actually loaded.
+ **/
+static void
+conf_source_prefetch (ConfSource *source)
+{
+	nih_local char *override_path = NULL;
+
+	nih_assert (source != NULL);
+
+	switch (source->type) {
+	case CONF_FILE:
+		conf_prefetch_path (source->path);
+
+		if (is_conf_file_std (source->path)) {
+			override_path = toggle_conf_name (NULL, source->path);
+			if (override_path)
+				conf_prefetch_path (override_path);
+		}
+		break;
+	case CONF_DIR:
+	case CONF_JOB_DIR:
+		if (nih_dir_walk (source->path, (NihFileFilter)conf_dir_filter,
+				  (NihFileVisitor)conf_prefetch_visitor, NULL,
+				  source) < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_free (err);
+		}
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+}
+
+/**
+ * conf_prefetch_visitor:
+ * @source: configuration source,
+ * @dirname: top-level directory being walked,
+ * @path: path found in directory,
+ * @statbuf: stat of @path.
+ *
+ * This function is called when prefetching a directory tree for each
+ * file found within it, including override files.
+ *
+ * Returns: always zero.
+ **/
+static int
+conf_prefetch_visitor (ConfSource  *source,
+		       const char  *dirname,
+		       const char  *path,
+		       struct stat *statbuf)
+{
+	nih_assert (source != NULL);
+	nih_assert (dirname != NULL);
+	nih_assert (path != NULL);
+	nih_assert (statbuf != NULL);
+
+	if (S_ISREG (statbuf->st_mode))
+		conf_prefetch_path (path);
+
+	return 0;
+}
+
+/**
+ * conf_prefetch_path:
+ * @path: path of file to prefetch.
+ *
+ * Ask the kernel to read @path asynchronously so that it is already
+ * cached when parsed.
+ **/
+static void
+conf_prefetch_path (const char *path)
+{
+	int fd;
+
+	nih_assert (path != NULL);
+
+	fd = open (path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	(void)posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+
+	close (fd);
+}
+
 /**
  * conf_source_reload_file:
  * @source: configuration source to reload.
@@ -626,6 +889,7 @@ conf_source_reload_file (ConfSource *source)
 		 */
 		if (source->watch) {
 			nih_io_set_cloexec (source->watch->fd);
+			(void)iowatch_adopt (source->watch->io->watch);
 		} else {
 			err = nih_error_steal ();
 		}
@@ -716,6 +980,7 @@ conf_source_reload_dir (ConfSource *source)
 		 */
 		if (source->watch) {
 			nih_io_set_cloexec (source->watch->fd);
+			(void)iowatch_adopt (source->watch->io->watch);
 			return 0;
 		} else {
 			err = nih_error_steal ();
@@ -812,68 +1077,752 @@ conf_dir_filter (ConfSource *source,
 	if (is_dir)
 		return nih_file_ignore (NULL, path);
 
-	if (is_conf_file (path))
-		return FALSE;
+	if (is_conf_file (path))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * conf_file_stamp:
+ * @path: path of file,
+ * @stamp: stamp to fill in.
+ *
+ * Fill in @stamp to identify the current version of @path.
+ *
+ * A file that changed within the current clock tick could change again
+ * without its timestamps changing, so cannot be reliably identified;
+ * this is treated as an error so that such a file is always reparsed.
+ *
+ * Returns: zero on success, negative value if @path cannot be stamped.
+ **/
+static int
+conf_file_stamp (const char    *path,
+		 ConfFileStamp *stamp)
+{
+	struct stat      statbuf;
+	struct timespec  now;
+
+	nih_assert (path != NULL);
+	nih_assert (stamp != NULL);
+
+	if (stat (path, &statbuf) < 0)
+		return -1;
+
+	/* File timestamps are taken from the coarse clock */
+	if (clock_gettime (CLOCK_REALTIME_COARSE, &now) < 0)
+		return -1;
+
+	if ((statbuf.st_ctim.tv_sec > now.tv_sec)
+	    || ((statbuf.st_ctim.tv_sec == now.tv_sec)
+		&& (statbuf.st_ctim.tv_nsec >= now.tv_nsec)))
+		return -1;
+
+	stamp->dev = statbuf.st_dev;
+	stamp->ino = statbuf.st_ino;
+	stamp->size = statbuf.st_size;
+	stamp->mtime = statbuf.st_mtim;
+	stamp->ctime = statbuf.st_ctim;
+
+	return 0;
+}
+
+/**
+ * conf_file_stamp_equal:
+ * @stamp1: first stamp,
+ * @stamp2: second stamp.
+ *
+ * Returns: TRUE if @stamp1 and @stamp2 identify the same version of a
+ * file, FALSE otherwise.
+ **/
+static int
+conf_file_stamp_equal (const ConfFileStamp *stamp1,
+		       const ConfFileStamp *stamp2)
+{
+	nih_assert (stamp1 != NULL);
+	nih_assert (stamp2 != NULL);
+
+	return ((stamp1->dev == stamp2->dev)
+		&& (stamp1->ino == stamp2->ino)
+		&& (stamp1->size == stamp2->size)
+		&& (stamp1->mtime.tv_sec == stamp2->mtime.tv_sec)
+		&& (stamp1->mtime.tv_nsec == stamp2->mtime.tv_nsec)
+		&& (stamp1->ctime.tv_sec == stamp2->ctime.tv_sec)
+		&& (stamp1->ctime.tv_nsec == stamp2->ctime.tv_nsec));
+}
+
+/**
+ * conf_file_unchanged:
+ * @file: configuration file,
+ * @stamp: current stamp of @file,
+ * @override_path: path to current best override file, or NULL,
+ * @override_stamp: current stamp of @override_path.
+ *
+ * Determine whether @file and its override were last loaded from the
+ * same versions of the same files as are now present.
+ *
+ * Returns: TRUE if @file need not be reloaded, FALSE otherwise.
+ **/
+static int
+conf_file_unchanged (const ConfFile      *file,
+		     const ConfFileStamp *stamp,
+		     const char          *override_path,
+		     const ConfFileStamp *override_stamp)
+{
+	nih_assert (file != NULL);
+	nih_assert (stamp != NULL);
+
+	if (! file->stamped)
+		return FALSE;
+
+	if (! conf_file_stamp_equal (&file->stamp, stamp))
+		return FALSE;
+
+	if (! override_path || ! file->override_path)
+		return (! override_path && ! file->override_path);
+
+	nih_assert (override_stamp != NULL);
+
+	return ((! strcmp (file->override_path, override_path))
+		&& conf_file_stamp_equal (&file->override_stamp,
+					  override_stamp));
+}
+
+/**
+ * conf_load_path_with_override:
+ * @source: configuration source
+ * @conf_path: path to config file
+ *
+ * Loads given @conf_path as a config file in a given @source. Then it
+ * finds an override file. If an override file is found it applies it
+ * as well.
+ *
+ * If neither file has changed since they were last loaded for @source,
+ * the existing ConfFile is retained without parsing either again.
+ **/
+static void
+conf_load_path_with_override (ConfSource *source,
+			      const char *conf_path)
+{
+	int                     ret = 0;
+	const char             *error_path = NULL;
+	nih_local char         *override_path = NULL;
+	nih_local char         *job_name = NULL;
+	ConfFile               *file;
+	ConfFileStamp           stamp;
+	ConfFileStamp           override_stamp;
+	int                     stamped;
+	uint64_t                digest;
+
+	nih_assert (source != NULL);
+	nih_assert (conf_path != NULL);
+
+	job_name = conf_to_job_name (source->path, conf_path);
+	override_path = conf_get_best_override (job_name, source);
+
+	stamped = ((conf_file_stamp (conf_path, &stamp) == 0)
+		   && (! override_path
+		       || conf_file_stamp (override_path, &override_stamp) == 0));
+
+	file = (ConfFile *)nih_hash_lookup (source->files, conf_path);
+	if (stamped && file
+	    && conf_file_unchanged (file, &stamp, override_path,
+				    &override_stamp)) {
+		nih_debug ("Configuration file %s unchanged", conf_path);
+		file->flag = source->flag;
+		return;
+	}
+
+	/* The files may have been rewritten without their contents
+	 * changing, in which case the existing job is still correct.
+	 */
+	if (file && file->digested
+	    && conf_file_digest (conf_path, override_path, &digest) == 0
+	    && digest == file->digest) {
+		nih_debug ("Configuration file %s content unchanged",
+			   conf_path);
+		file->flag = source->flag;
+		conf_file_set_stamp (file, stamped, &stamp, override_path,
+				     &override_stamp);
+		return;
+	}
+
+	/* Job files that have never been parsed are only indexed, unless
+	 * a job of the same name is already known, since that might need
+	 * replacing by this one.
+	 */
+	if (conf_lazy && (source->type == CONF_JOB_DIR)
+	    && (file ? (file->lazy != NULL)
+		: (! conf_select_job (job_name, source->session)))) {
+		nih_debug ("Indexing configuration file %s", conf_path);
+		if (conf_lazy_index (source, conf_path, override_path,
+				     job_name) < 0) {
+			error_path = conf_path;
+			goto error;
+		}
+
+		file = (ConfFile *)nih_hash_lookup (source->files, conf_path);
+		conf_file_set_stamp (file, stamped, &stamp, override_path,
+				     &override_stamp);
+		return;
+	}
+
+	/* reload conf file */
+	nih_debug ("Loading configuration file %s", conf_path);
+	ret = conf_reload_path (source, conf_path, NULL);
+	if (ret < 0) {
+		error_path = conf_path;
+		goto error;
+	}
+
+	if (override_path) {
+		/* overlay override settings */
+		nih_debug ("Loading override file %s for %s", conf_path, override_path);
+		ret = conf_reload_path (source, conf_path, override_path);
+		if (ret < 0) {
+			error_path = override_path;
+			goto error;
+		}
+	}
+
+	/* Only record the stamps and digest of files that loaded cleanly
+	 * so that errors continue to be reported.
+	 */
+	file = (ConfFile *)nih_hash_lookup (source->files, conf_path);
+	if (file && (source->type != CONF_JOB_DIR || file->job)) {
+		file->digested = TRUE;
+		conf_file_set_stamp (file, stamped, &stamp, override_path,
+				     &override_stamp);
+	}
+
+	return;
+
+error:
+	{
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("%s: %s: %s", error_path,
+			   _("Error while loading configuration file"),
+			   err->message);
+		nih_free (err);
+		return;
+	}
+}
+
+/**
+ * conf_lazy_index:
+ * @source: configuration source,
+ * @conf_path: path to job file,
+ * @override_path: path to override file for @conf_path, or NULL,
+ * @job_name: name of job defined by @conf_path.
+ *
+ * Index @conf_path, and @override_path if given, without parsing them
+ * so that the job is only parsed once it may be needed; replaces any
+ * index entries from when @conf_path was last loaded.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+conf_lazy_index (ConfSource *source,
+		 const char *conf_path,
+		 const char *override_path,
+		 const char *job_name)
+{
+	ConfFile *file;
+	char     *buf;
+	size_t    len;
+	int       mapped;
+
+	nih_assert (source != NULL);
+	nih_assert (conf_path != NULL);
+	nih_assert (job_name != NULL);
+
+	if (! conf_lazy_jobs)
+		conf_lazy_jobs = NIH_MUST (nih_hash_string_new (NULL, 0));
+	if (! conf_lazy_events)
+		conf_lazy_events = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	file = (ConfFile *)nih_hash_lookup (source->files, conf_path);
+
+	buf = conf_file_map (NULL, conf_path, &len, &mapped);
+	if (! buf) {
+		/* Most likely deleted, so forget about it */
+		if (file)
+			nih_unref (file, source);
+
+		return -1;
+	}
+
+	if (! file)
+		file = NIH_MUST (conf_file_new (source, conf_path));
+
+	file->flag = source->flag;
+
+	if (file->lazy)
+		nih_free (file->lazy);
+
+	file->lazy = NIH_MUST (conf_lazy_new (file, file, conf_lazy_jobs,
+					      job_name));
+
+	conf_lazy_scan (file->lazy, buf, len);
+	conf_file_unmap (buf, len, mapped);
+
+	if (! override_path)
+		return 0;
+
+	buf = conf_file_map (NULL, override_path, &len, &mapped);
+	if (! buf)
+		return -1;
+
+	conf_lazy_scan (file->lazy, buf, len);
+	conf_file_unmap (buf, len, mapped);
+
+	return 0;
+}
+
+/**
+ * conf_lazy_new:
+ * @file: configuration file not yet parsed,
+ * @parent: parent object for new entry,
+ * @hash: index to add entry to,
+ * @name: name to index @file by.
+ *
+ * Allocate a new entry in @hash for @file under @name; the entry is
+ * removed from @hash when freed.
+ *
+ * Returns: new entry or NULL if insufficient memory.
+ **/
+static ConfLazy *
+conf_lazy_new (ConfFile   *file,
+	       const void *parent,
+	       NihHash    *hash,
+	       const char *name)
+{
+	ConfLazy *lazy;
+
+	nih_assert (file != NULL);
+	nih_assert (hash != NULL);
+	nih_assert (name != NULL);
+
+	lazy = nih_new (parent, ConfLazy);
+	if (! lazy)
+		return NULL;
+
+	nih_list_init (&lazy->entry);
+	nih_alloc_set_destructor (lazy, nih_list_destroy);
+
+	lazy->name = nih_strdup (lazy, name);
+	if (! lazy->name) {
+		nih_free (lazy);
+		return NULL;
+	}
+
+	lazy->file = file;
+
+	nih_hash_add (hash, &lazy->entry);
+
+	return lazy;
+}
+
+/**
+ * conf_lazy_scan:
+ * @lazy: job entry of file being indexed,
+ * @buf: contents of file,
+ * @len: length of @buf.
+ *
+ * Find each start on stanza in @buf and index the file of @lazy by
+ * every word of its condition that could be the name of an event, and
+ * by CONF_LAZY_SOCKET if it has a socket stanza.
+ *
+ * This does not parse the stanza, so that positional arguments and
+ * words within scripts may be indexed as well; that only means the job
+ * is parsed sooner than needed, never later.
+ **/
+static void
+conf_lazy_scan (ConfLazy   *lazy,
+		const char *buf,
+		size_t      len)
+{
+	size_t pos = 0;
+
+	nih_assert (lazy != NULL);
+	nih_assert (buf != NULL || ! len);
+
+	while (pos < len) {
+		while ((pos < len) && strchr (" \t\r", buf[pos]))
+			pos++;
+
+		if (conf_lazy_word (buf, len, &pos, "start")
+		    && conf_lazy_word (buf, len, &pos, "on"))
+			conf_lazy_scan_on (lazy, buf, len, &pos);
+
+		if (conf_lazy_word (buf, len, &pos, "socket"))
+			NIH_MUST (conf_lazy_new (lazy->file, lazy,
+						 conf_lazy_events,
+						 CONF_LAZY_SOCKET));
+
+		while ((pos < len) && (buf[pos] != '\n'))
+			pos++;
+		pos++;
+	}
+}
+
+/**
+ * conf_lazy_word:
+ * @buf: contents of file,
+ * @len: length of @buf,
+ * @pos: position in @buf,
+ * @word: word to match.
+ *
+ * Check whether @word is found at @pos in @buf followed by whitespace,
+ * and if so move @pos past both.
+ *
+ * Returns: TRUE if @word was found, FALSE otherwise.
+ **/
+static int
+conf_lazy_word (const char *buf,
+		size_t      len,
+		size_t     *pos,
+		const char *word)
+{
+	size_t wlen;
+
+	nih_assert (buf != NULL);
+	nih_assert (pos != NULL);
+	nih_assert (word != NULL);
+
+	wlen = strlen (word);
+
+	if ((len - *pos <= wlen)
+	    || strncmp (buf + *pos, word, wlen)
+	    || (! strchr (" \t", buf[*pos + wlen])))
+		return FALSE;
+
+	*pos += wlen;
+	while ((*pos < len) && strchr (" \t", buf[*pos]))
+		(*pos)++;
+
+	return TRUE;
+}
+
+/**
+ * conf_lazy_scan_on:
+ * @lazy: job entry of file being indexed,
+ * @buf: contents of file,
+ * @len: length of @buf,
+ * @pos: position of the condition of a start on stanza in @buf.
+ *
+ * Index the file of @lazy by each word of the condition at @pos that
+ * is not an operator or a KEY=VALUE pair, following the condition
+ * across escaped newlines and within parentheses; @pos is left at the
+ * end of the condition.
+ **/
+static void
+conf_lazy_scan_on (ConfLazy   *lazy,
+		   const char *buf,
+		   size_t      len,
+		   size_t     *pos)
+{
+	int depth = 0;
+
+	nih_assert (lazy != NULL);
+	nih_assert (buf != NULL);
+	nih_assert (pos != NULL);
+
+	while (*pos < len) {
+		size_t start;
+		int    value = FALSE;
+
+		if (buf[*pos] == '\n') {
+			if (! depth)
+				break;
+
+			(*pos)++;
+		} else if ((buf[*pos] == '\\') && (*pos + 1 < len)
+			   && (buf[*pos + 1] == '\n')) {
+			*pos += 2;
+		} else if (buf[*pos] == '#') {
+			while ((*pos < len) && (buf[*pos] != '\n'))
+				(*pos)++;
+		} else if (strchr (" \t\r\\", buf[*pos])) {
+			(*pos)++;
+		} else if (buf[*pos] == '(') {
+			depth++;
+			(*pos)++;
+		} else if (buf[*pos] == ')') {
+			if (depth)
+				depth--;
+			(*pos)++;
+		} else {
+			start = *pos;
+			while ((*pos < len) && (! strchr (" \t\r\n()", buf[*pos]))) {
+				char c = buf[*pos];
+
+				if ((c == '"') || (c == '\'')) {
+					value = TRUE;
+					for ((*pos)++; (*pos < len) && (buf[*pos] != c);
+					     (*pos)++)
+						;
+				} else if (c == '=') {
+					value = TRUE;
+				}
+
+				if (*pos < len)
+					(*pos)++;
+			}
+
+			if (value)
+				continue;
+
+			if (((*pos - start == 3) && (! strncmp (buf + start, "and", 3)))
+			    || ((*pos - start == 2) && (! strncmp (buf + start, "or", 2))))
+				continue;
+
+			{
+				nih_local char *name = NULL;
+
+				name = NIH_MUST (nih_strndup (NULL, buf + start,
+							      *pos - start));
+				NIH_MUST (conf_lazy_new (lazy->file, lazy,
+							 conf_lazy_events, name));
+			}
+		}
+	}
+}
+
+/**
+ * conf_file_load_lazy:
+ * @file: configuration file not yet parsed.
+ *
+ * Remove @file from the indexes and parse it, along with any override
+ * file.  @file is replaced in its source and should not be used after
+ * calling this function.
+ **/
+static void
+conf_file_load_lazy (ConfFile *file)
+{
+	nih_local char *path = NULL;
+	ConfSource     *source;
+
+	nih_assert (file != NULL);
+	nih_assert (file->lazy != NULL);
+
+	path = NIH_MUST (nih_strdup (NULL, file->path));
+	source = file->source;
+
+	nih_free (file->lazy);
+	file->lazy = NULL;
+	file->stamped = FALSE;
+
+	conf_load_path_with_override (source, path);
+}
+
+/**
+ * conf_lazy_load:
+ * @name: name of job.
+ *
+ * Parse every job file for the job named @name that has not yet been
+ * parsed, so that the best of them is registered; called before
+ * looking up a job by name.
+ **/
+void
+conf_lazy_load (const char *name)
+{
+	ConfLazy *lazy;
+
+	nih_assert (name != NULL);
+
+	if (! conf_lazy_jobs)
+		return;
+
+	while ((lazy = (ConfLazy *)nih_hash_lookup (conf_lazy_jobs,
+						    name)) != NULL)
+		conf_file_load_lazy (lazy->file);
+}
+
+/**
+ * conf_lazy_load_event:
+ * @name: name of event.
+ *
+ * Parse every job whose start on condition may reference the event
+ * @name and has not yet been parsed; called before the event is
+ * handled.
+ **/
+void
+conf_lazy_load_event (const char *name)
+{
+	ConfLazy *lazy;
+
+	nih_assert (name != NULL);
+
+	if (! conf_lazy_events)
+		return;
+
+	while ((lazy = (ConfLazy *)nih_hash_lookup (conf_lazy_events,
+						    name)) != NULL) {
+		nih_local char *job_name = NULL;
+
+		job_name = NIH_MUST (nih_strdup (NULL,
+						 lazy->file->lazy->name));
+		conf_lazy_load (job_name);
+	}
+}
+
+/**
+ * conf_lazy_load_all:
+ *
+ * Parse every job file that has not yet been parsed; called before
+ * listing all jobs.
+ **/
+void
+conf_lazy_load_all (void)
+{
+	if (! conf_lazy_jobs)
+		return;
+
+	for (size_t i = 0; i < conf_lazy_jobs->size; i++) {
+		while (! NIH_LIST_EMPTY (&conf_lazy_jobs->bins[i])) {
+			ConfLazy       *lazy;
+			nih_local char *name = NULL;
+
+			lazy = (ConfLazy *)conf_lazy_jobs->bins[i].next;
+			name = NIH_MUST (nih_strdup (NULL, lazy->name));
+
+			conf_lazy_load (name);
+		}
+	}
+}
+
+/**
+ * conf_file_set_stamp:
+ * @file: configuration file,
+ * @stamped: TRUE if @stamp and @override_stamp are valid,
+ * @stamp: stamp of @file,
+ * @override_path: path to override file applied to @file, or NULL,
+ * @override_stamp: stamp of @override_path.
+ *
+ * Record the versions of the files that @file was loaded from, or
+ * forget them if @stamped is FALSE.
+ **/
+static void
+conf_file_set_stamp (ConfFile            *file,
+		     int                  stamped,
+		     const ConfFileStamp *stamp,
+		     char                *override_path,
+		     const ConfFileStamp *override_stamp)
+{
+	nih_assert (file != NULL);
+
+	if (file->override_path) {
+		nih_unref (file->override_path, file);
+		file->override_path = NULL;
+	}
+
+	file->stamped = stamped;
+	if (! stamped)
+		return;
+
+	nih_assert (stamp != NULL);
+
+	file->stamp = *stamp;
+
+	if (override_path) {
+		nih_assert (override_stamp != NULL);
+
+		file->override_path = override_path;
+		nih_ref (file->override_path, file);
+		file->override_stamp = *override_stamp;
+	}
+}
+
+/**
+ * conf_digest_update:
+ * @digest: digest to update,
+ * @buf: data to add,
+ * @len: length of @buf.
+ *
+ * Add @len and @buf to @digest, which should initially be
+ * CONF_DIGEST_INIT.
+ *
+ * Returns: updated digest.
+ **/
+static uint64_t
+conf_digest_update (uint64_t    digest,
+		    const char *buf,
+		    size_t      len)
+{
+	uint64_t value = len;
+
+	nih_assert (buf != NULL || ! len);
+
+	/* Include the length so that the boundary between the
+	 * configuration and override files is significant.
+	 */
+	for (size_t i = 0; i < sizeof (value); i++) {
+		digest ^= (value >> (i * 8)) & 0xff;
+		digest *= CONF_DIGEST_PRIME;
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		digest ^= (unsigned char)buf[i];
+		digest *= CONF_DIGEST_PRIME;
+	}
 
-	return TRUE;
+	return digest;
 }
 
 /**
- * conf_load_path_with_override:
- * @source: configuration source
- * @conf_path: path to config file
+ * conf_file_digest:
+ * @conf_path: path to configuration file,
+ * @override_path: path to override file, or NULL,
+ * @digest: digest to fill in.
  *
- * Loads given @conf_path as a config file in a given @source. Then it
- * finds an override file. If an override file is found it applies it
- * as well.
+ * Calculate the digest of the current contents of @conf_path and
+ * @override_path, which will match the digest recorded by
+ * conf_reload_path() when the same contents were loaded.
+ *
+ * Returns: zero on success, negative value on error.
  **/
-static void
-conf_load_path_with_override (ConfSource *source,
-			      const char *conf_path)
+static int
+conf_file_digest (const char *conf_path,
+		  const char *override_path,
+		  uint64_t   *digest)
 {
-	int                     ret = 0;
-	const char   *error_path = NULL;
-	char      *override_path = NULL;
-	nih_local char *job_name = NULL;
+	char   *buf;
+	size_t  len;
+	int     mapped;
 
-	nih_assert (source != NULL);
 	nih_assert (conf_path != NULL);
+	nih_assert (digest != NULL);
 
-	/* reload conf file */
-	nih_debug ("Loading configuration file %s", conf_path);
-	ret = conf_reload_path (source, conf_path, NULL);
-	if (ret < 0) {
-		error_path = conf_path;
+	buf = conf_file_map (NULL, conf_path, &len, &mapped);
+	if (! buf)
 		goto error;
-	}
 
-	job_name = conf_to_job_name (source->path, conf_path);
-	override_path = conf_get_best_override (job_name, source);
+	*digest = conf_digest_update (CONF_DIGEST_INIT, buf, len);
+	conf_file_unmap (buf, len, mapped);
+
 	if (! override_path)
-		return;
+		return 0;
 
-	/* overlay override settings */
-	nih_debug ("Loading override file %s for %s", conf_path, override_path);
-	ret = conf_reload_path (source, conf_path, override_path);
-	if (ret < 0) {
-		error_path = override_path;
+	buf = conf_file_map (NULL, override_path, &len, &mapped);
+	if (! buf)
 		goto error;
-	}
-	nih_free (override_path);
-	return;
+
+	*digest = conf_digest_update (*digest, buf, len);
+	conf_file_unmap (buf, len, mapped);
+
+	return 0;
 
 error:
 	{
 		NihError *err;
 
+		/* Any error will be reported when the file is loaded */
 		err = nih_error_get ();
-		nih_error ("%s: %s: %s", error_path,
-			   _("Error while loading configuration file"),
-			   err->message);
 		nih_free (err);
-		if (override_path)
-			nih_free (override_path);
-		return;
+		return -1;
 	}
 }
 
@@ -891,9 +1840,9 @@ error:
  * watch for the latter is on the parent and filtered to only return the
  * path that we're interested in.
  *
- * After checking that it was a regular file that was changed, we reload it;
- * we expect this to fail sometimes since the file may be only partially
- * written.
+ * After checking that it was a regular file that was changed, we reload it
+ * once conf_reload_delay has passed; we expect this to fail sometimes since
+ * the file may be only partially written.
  **/
 static void
 conf_create_modify_handler (ConfSource  *source,
@@ -901,10 +1850,6 @@ conf_create_modify_handler (ConfSource  *source,
 			    const char  *path,
 			    struct stat *statbuf)
 {
-	ConfFile *file = NULL;
-	char *config_path = NULL;
-	nih_local char *job_name = NULL;
-
 	nih_assert (source != NULL);
 	nih_assert (watch != NULL);
 	nih_assert (path != NULL);
@@ -917,30 +1862,10 @@ conf_create_modify_handler (ConfSource  *source,
 	if (! is_conf_file (path))
 		return;
 
-        /* For config file, load it and it's override file */
-	if (is_conf_file_std (path)) {
-		conf_load_path_with_override (source, path);
+	if (conf_mark_dirty (source, path))
 		return;
-	}
-
-	/* For override files, reload all matching conf+override combos */
-	job_name = conf_to_job_name (source->path, path);
-	NIH_LIST_FOREACH (conf_sources, iter) {
-		ConfSource *source = (ConfSource *)iter;
-
-		if (source->type == CONF_FILE)
-			continue;
-
-		config_path = NIH_MUST (nih_sprintf (NULL, "%s/%s%s", source->path, job_name, CONF_EXT_STD));
-		file = (ConfFile *)nih_hash_lookup (source->files, config_path);
-		if (file) {
-			/* Find its override file and reload both */
-			conf_load_path_with_override (source, config_path);
-		}
-		nih_free (config_path);
-	}
 
-	return;
+	conf_file_changed (source, path);
 }
 
 /**
@@ -955,7 +1880,7 @@ conf_create_modify_handler (ConfSource  *source,
  * filtered to only return the path that we're interested in.
  *
  * We lookup the file in our hash table, and if we can find it, perform
- * the usual deletion of it.
+ * the usual deletion of it once conf_reload_delay has passed.
  **/
 static void
 conf_delete_handler (ConfSource *source,
@@ -963,7 +1888,6 @@ conf_delete_handler (ConfSource *source,
 		     const char *path)
 {
 	ConfFile *file;
-	nih_local char *new_path = NULL;
 
 	nih_assert (source != NULL);
 	nih_assert (watch != NULL);
@@ -990,11 +1914,82 @@ conf_delete_handler (ConfSource *source,
 		return;
 	}
 
+	if (conf_mark_dirty (source, path))
+		return;
+
+	conf_file_deleted (source, path);
+}
+
+/**
+ * conf_file_changed:
+ * @source: configuration source,
+ * @path: full path to created or modified file.
+ *
+ * Reload the configuration file @path of @source, or if it is an
+ * override file, each of the configuration files that it applies to.
+ **/
+static void
+conf_file_changed (ConfSource *source,
+		   const char *path)
+{
+	ConfFile *file = NULL;
+	char *config_path = NULL;
+	nih_local char *job_name = NULL;
+
+	nih_assert (source != NULL);
+	nih_assert (path != NULL);
+
+        /* For config file, load it and it's override file */
+	if (is_conf_file_std (path)) {
+		conf_load_path_with_override (source, path);
+		return;
+	}
+
+	/* For override files, reload all matching conf+override combos */
+	job_name = conf_to_job_name (source->path, path);
+	NIH_LIST_FOREACH (conf_sources, iter) {
+		ConfSource *source = (ConfSource *)iter;
+
+		if (source->type == CONF_FILE)
+			continue;
+
+		config_path = NIH_MUST (nih_sprintf (NULL, "%s/%s%s", source->path, job_name, CONF_EXT_STD));
+		file = (ConfFile *)nih_hash_lookup (source->files, config_path);
+		if (file) {
+			/* Find its override file and reload both */
+			conf_load_path_with_override (source, config_path);
+		}
+		nih_free (config_path);
+	}
+
+	return;
+}
+
+/**
+ * conf_file_deleted:
+ * @source: configuration source,
+ * @path: full path to deleted file.
+ *
+ * Discard the configuration file @path of @source, or if it is an
+ * override file, reload each of the configuration files that it
+ * applied to.
+ **/
+static void
+conf_file_deleted (ConfSource *source,
+		   const char *path)
+{
+	ConfFile *file;
+
+	nih_assert (source != NULL);
+	nih_assert (path != NULL);
+
 	/* non-override files (and directories) are the simple case, so handle
 	 * them and leave.
 	 */
 	if (! is_conf_file_override (path)) {
-		nih_unref (file, source);
+		file = (ConfFile *)nih_hash_lookup (source->files, path);
+		if (file)
+			nih_unref (file, source);
 		return;
 	}
 
@@ -1004,7 +1999,154 @@ conf_delete_handler (ConfSource *source,
 	 */
 	nih_debug ("Reloading configuration for matching configs on deletion of override (%s)",
 		   path);
-	conf_create_modify_handler (source, watch, path, NULL);
+	conf_file_changed (source, path);
+}
+
+/**
+ * conf_mark_dirty:
+ * @source: configuration source,
+ * @path: full path to changed file.
+ *
+ * Record that @path of @source has changed, to be handled along with
+ * any other changes once conf_reload_delay has passed since the first.
+ *
+ * Returns: TRUE if the change was recorded, FALSE if it should be handled
+ * now.
+ **/
+static int
+conf_mark_dirty (ConfSource *source,
+		 const char *path)
+{
+	ConfDirty *dirty;
+
+	nih_assert (source != NULL);
+	nih_assert (path != NULL);
+
+	if (conf_reload_delay <= 0)
+		return FALSE;
+
+	if (! conf_dirty)
+		conf_dirty = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	dirty = (ConfDirty *)nih_hash_lookup (conf_dirty, path);
+	if (dirty && (dirty->source == source))
+		return TRUE;
+
+	dirty = NIH_MUST (nih_new (source, ConfDirty));
+
+	nih_list_init (&dirty->entry);
+	nih_alloc_set_destructor (dirty, nih_list_destroy);
+
+	dirty->path = NIH_MUST (nih_strdup (dirty, path));
+	dirty->source = source;
+
+	nih_hash_add (conf_dirty, &dirty->entry);
+
+	/* The delay runs from the first change, so that a steady trickle
+	 * of them can't hold off the rest indefinitely.
+	 */
+	if (! conf_dirty_timer)
+		conf_dirty_timer = NIH_MUST (deadline_add_timeout (
+				NULL, conf_reload_delay,
+				conf_dirty_timeout, NULL));
+
+	return TRUE;
+}
+
+/**
+ * conf_dirty_timeout:
+ * @data: not used,
+ * @deadline: timer that is due.
+ *
+ * Called once conf_reload_delay has passed since a configuration file
+ * was first changed, to handle that and every later change together.
+ **/
+static void
+conf_dirty_timeout (void     *data,
+		    Deadline *deadline)
+{
+	nih_assert (deadline == conf_dirty_timer);
+
+	/* Freed by our caller on return */
+	conf_dirty_timer = NULL;
+
+	conf_reload_dirty ();
+}
+
+/**
+ * conf_reload_dirty:
+ *
+ * Handle every change to configuration files recorded in conf_dirty,
+ * reloading those that still exist and discarding those that don't.
+ * Since the files are looked at afresh, a file created, rewritten many
+ * times and deleted again within the delay causes no work at all.
+ *
+ * This is called when the delay expires, and may be called beforehand
+ * when the changes must not wait, such as before re-exec.
+ **/
+void
+conf_reload_dirty (void)
+{
+	NihList pending;
+
+	if (conf_dirty_timer) {
+		nih_free (conf_dirty_timer);
+		conf_dirty_timer = NULL;
+	}
+
+	if (! conf_dirty)
+		return;
+
+	/* Take the entries out of the hash first, any that belong to a
+	 * source freed by reloading another remove themselves from the
+	 * list as they go.
+	 */
+	nih_list_init (&pending);
+
+	NIH_HASH_FOREACH_SAFE (conf_dirty, iter)
+		nih_list_add (&pending, iter);
+
+	while (! NIH_LIST_EMPTY (&pending)) {
+		ConfDirty      *dirty = (ConfDirty *)pending.next;
+		ConfSource     *source;
+		nih_local char *path = NULL;
+		struct stat     statbuf;
+
+		source = dirty->source;
+		path = NIH_MUST (nih_strdup (NULL, dirty->path));
+		nih_free (dirty);
+
+		if (lstat (path, &statbuf) == 0) {
+			if (S_ISREG (statbuf.st_mode))
+				conf_file_changed (source, path);
+		} else if (errno == ENOENT) {
+			conf_file_deleted (source, path);
+		}
+	}
+}
+
+/**
+ * conf_dirty_clear:
+ *
+ * Discard the changes recorded in conf_dirty, since everything is about
+ * to be reloaded.
+ **/
+static void
+conf_dirty_clear (void)
+{
+	if (conf_dirty_timer) {
+		nih_free (conf_dirty_timer);
+		conf_dirty_timer = NULL;
+	}
+
+	if (! conf_dirty)
+		return;
+
+	NIH_HASH_FOREACH_SAFE (conf_dirty, iter) {
+		ConfDirty *dirty = (ConfDirty *)iter;
+
+		nih_free (dirty);
+	}
 }
 
 /**
@@ -1042,6 +2184,96 @@ conf_file_visitor (ConfSource  *source,
 }
 
 
+/**
+ * conf_file_map:
+ * @parent: parent object for new string,
+ * @path: path of file to load,
+ * @len: pointer to store length of contents in,
+ * @mapped: pointer to store whether the contents were mapped in.
+ *
+ * Load the contents of @path for parsing.  A session init maps files
+ * that it does not own, such as those of the shared session job
+ * directories, read-only straight from the page cache so that every
+ * session shares one copy of their text rather than reading its own.
+ * Files owned by the session user, which its editors could truncate
+ * underneath the mapping, and all files in system mode are read into
+ * memory as before.
+ *
+ * The contents must be released with conf_file_unmap(), passing the
+ * values stored in @len and @mapped, and must not be modified.
+ *
+ * Returns: contents of @path or NULL on raised error.
+ **/
+static char *
+conf_file_map (const void *parent,
+	       const char *path,
+	       size_t     *len,
+	       int        *mapped)
+{
+	struct stat  statbuf;
+	void        *map;
+	int          fd;
+
+	nih_assert (path != NULL);
+	nih_assert (len != NULL);
+	nih_assert (mapped != NULL);
+
+	*mapped = FALSE;
+
+	if (! user_mode)
+		return nih_file_read (parent, path, len);
+
+	fd = open (path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (NULL);
+
+	if (fstat (fd, &statbuf) < 0) {
+		nih_error_raise_system ();
+		close (fd);
+		return NULL;
+	}
+
+	if ((! S_ISREG (statbuf.st_mode))
+	    || (statbuf.st_uid == getuid ())
+	    || (statbuf.st_size <= 0)) {
+		close (fd);
+		return nih_file_read (parent, path, len);
+	}
+
+	map = mmap (NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if (map == MAP_FAILED)
+		return nih_file_read (parent, path, len);
+
+	*len = statbuf.st_size;
+	*mapped = TRUE;
+
+	return map;
+}
+
+/**
+ * conf_file_unmap:
+ * @buf: contents returned by conf_file_map(),
+ * @len: length of @buf,
+ * @mapped: whether @buf was mapped in.
+ *
+ * Release the contents of a file loaded by conf_file_map().
+ **/
+static void
+conf_file_unmap (char   *buf,
+		 size_t  len,
+		 int     mapped)
+{
+	nih_assert (buf != NULL);
+
+	if (mapped) {
+		munmap (buf, len);
+	} else {
+		nih_free (buf);
+	}
+}
+
 /**
  * conf_reload_path:
  * @source: configuration source,
@@ -1071,11 +2303,14 @@ conf_reload_path (ConfSource *source,
 {
 	ConfFile       *file = NULL;
 	ConfFile       *orig = NULL;
-	nih_local char *buf = NULL;
+	char           *buf = NULL;
+	int             mapped;
 	nih_local char *name = NULL;
 	size_t          len, pos, lineno;
 	NihError       *err = NULL;
 	const char     *path_to_load;
+	uint64_t        started = 0;
+	uint64_t        allocs = 0;
 
 	nih_assert (source != NULL);
 	nih_assert (path != NULL);
@@ -1122,13 +2357,14 @@ conf_reload_path (ConfSource *source,
 		 * destroyed.
 		 */
 		nih_list_remove (&orig->entry);
+		conf_file_unindex (orig);
 	}
 
 	/* Read the file into memory for parsing, if this fails we don't
 	 * bother creating a new ConfFile structure for it and bail out
 	 * now.
 	 */
-	buf = nih_file_read (NULL, path_to_load, &len);
+	buf = conf_file_map (NULL, path_to_load, &len, &mapped);
 	if (! buf) {
 		if (! override_path && orig) {
 			/* Failed to reload the file from disk in all
@@ -1150,9 +2386,21 @@ conf_reload_path (ConfSource *source,
 	if (! file)
 		file = NIH_MUST (conf_file_new (source, path));
 
+	/* Record what was loaded so that a later reload can tell whether
+	 * the contents have changed.
+	 */
+	file->digest = conf_digest_update (override_path
+					   ? file->digest : CONF_DIGEST_INIT,
+					   buf, len);
+
 	pos = 0;
 	lineno = 1;
 
+	if (parse_profile_enabled) {
+		started = parse_profile_now ();
+		allocs = pool_stats.allocs;
+	}
+
 	switch (source->type) {
 	case CONF_FILE:
 	case CONF_DIR:
@@ -1201,6 +2449,11 @@ conf_reload_path (ConfSource *source,
 		nih_assert_not_reached ();
 	}
 
+	if (parse_profile_enabled)
+		parse_profile_file (path_to_load, started, allocs);
+
+	conf_file_unmap (buf, len, mapped);
+
 	/* Finally, allow the original ConfFile to be destroyed without
 	 * affecting the new JobClass.
 	 */
@@ -1265,6 +2518,7 @@ conf_file_destroy (ConfFile *file)
 	nih_assert (file != NULL);
 
 	nih_list_destroy (&file->entry);
+	conf_file_unindex (file);
 
 	switch (file->source->type) {
 	case CONF_FILE:
@@ -1297,6 +2551,26 @@ conf_file_destroy (ConfFile *file)
 }
 
 
+/**
+ * conf_file_unindex:
+ * @file: configuration file leaving its source.
+ *
+ * Remove @file from the jobs hash table of its source, so that it is no
+ * longer found by conf_select_job() or conf_file_find(); called whenever
+ * @file is removed from the files hash table.
+ **/
+static void
+conf_file_unindex (ConfFile *file)
+{
+	nih_assert (file != NULL);
+
+	if (! file->named)
+		return;
+
+	nih_free (file->named);
+	file->named = NULL;
+}
+
 /**
  * conf_select_job:
  * @name: name of job class to locate,
@@ -1310,6 +2584,8 @@ conf_file_destroy (ConfFile *file)
 JobClass *
 conf_select_job (const char *name, const Session *session)
 {
+	ConfJob *named = NULL;
+
 	nih_assert (name != NULL);
 
 	conf_init ();
@@ -1323,8 +2599,10 @@ conf_select_job (const char *name, const Session *session)
 		if (source->session != session)
 			continue;
 
-		NIH_HASH_FOREACH (source->files, file_iter) {
-			ConfFile *file = (ConfFile *)file_iter;
+		while ((named = (ConfJob *)nih_hash_search (
+				source->jobs, name,
+				named ? &named->entry : NULL)) != NULL) {
+			ConfFile *file = named->file;
 
 			if (! file->job)
 				continue;
@@ -1422,6 +2700,9 @@ conf_source_serialise_all (void)
 
 	conf_init ();
 
+	/* Changes still being gathered would otherwise be lost */
+	conf_reload_dirty ();
+
 	json = json_object_new_array ();
 	if (! json)
 		return NULL;
@@ -1799,6 +3080,30 @@ error:
 	return -1;
 }
 
+/**
+ * conf_source_index_new:
+ *
+ * @parent: parent object for new index.
+ *
+ * StateIndexBuilder for the list of configuration sources.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+static StateIndex *
+conf_source_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	conf_init ();
+
+	index = NIH_MUST (state_index_new (parent));
+
+	NIH_LIST_FOREACH (conf_sources, iter)
+		NIH_MUST (state_index_add (index, iter));
+
+	return index;
+}
+
 /**
  * conf_source_get_index:
  *
@@ -1816,6 +3121,18 @@ conf_source_get_index (const ConfSource *source)
 
 	conf_init ();
 
+	/* Sources in the list are found directly, otherwise fall back
+	 * to comparing by path and session.
+	 */
+	if (state_context) {
+		i = state_context_get (&state_context->conf_sources,
+				       conf_source_index_new, source);
+		if (i >= 0)
+			return i;
+
+		i = 0;
+	}
+
 	NIH_LIST_FOREACH (conf_sources, iter) {
 		ConfSource *s = (ConfSource *)iter;
 
@@ -1841,34 +3158,26 @@ conf_source_get_index (const ConfSource *source)
 ConfFile *
 conf_file_find (const char *name, const Session *session)
 {
-	nih_local char  *basename = NULL;
+	ConfJob *named = NULL;
 
 	nih_assert (name);
 
 	conf_init ();
 
 	/* There can only be one ConfFile per session with the same
-	 * basename.
+	 * job name.
 	 */
-	basename = NIH_MUST (nih_sprintf (NULL, "/%s%s",
-				name, CONF_EXT_STD));
-
 	NIH_LIST_FOREACH (conf_sources, iter) {
 		ConfSource *source = (ConfSource *)iter;
 
 		if (source->session != session)
 			continue;
 
-		NIH_HASH_FOREACH (source->files, file_iter) {
-			ConfFile *file = (ConfFile *)file_iter;
-			char     *match;
-			char     *slash;
-
-			match = strstr (file->path, basename);
-			slash = strrchr (file->path, '/');
-
-			if (match && match == slash)
-				return file;
+		while ((named = (ConfJob *)nih_hash_search (
+				source->jobs, name,
+				named ? &named->entry : NULL)) != NULL) {
+			if (is_conf_file_std (named->file->path))
+				return named->file;
 		}
 	}
 
@@ -20,6 +20,11 @@
 #ifndef INIT_CONF_H
 #define INIT_CONF_H
 
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <time.h>
+
 #include <nih/macros.h>
 
 #include <nih/hash.h>
@@ -53,7 +58,8 @@ typedef enum conf_source_type {
  * @type: type of source,
  * @watch: NihWatch structure for automatic change notification,
  * @flag: reload flag,
- * @files: hash table of files.
+ * @files: hash table of files,
+ * @jobs: hash table of job files by the name of the job they define.
  *
  * This structure represents a single source of configuration, which may be
  * a single file or a directory of files of various types, depending on
@@ -74,14 +80,69 @@ typedef struct conf_source {
 
 	int                 flag;
 	NihHash            *files;
+	NihHash            *jobs;
 } ConfSource;
 
+/**
+ * CONF_DIGEST_INIT:
+ *
+ * Initial value of the digest of the contents of a configuration file
+ * (the 64-bit FNV-1a offset basis).
+ **/
+#define CONF_DIGEST_INIT 14695981039346656037ULL
+
+/**
+ * CONF_DIGEST_PRIME:
+ *
+ * Multiplier used when calculating the digest of the contents of a
+ * configuration file (the 64-bit FNV prime).
+ **/
+#define CONF_DIGEST_PRIME 1099511628211ULL
+
+/**
+ * CONF_LAZY_SOCKET:
+ *
+ * Name that job files with a socket stanza are indexed by, alongside the
+ * events of their start on condition, when conf_lazy is TRUE; it can't
+ * be the name of an event.
+ **/
+#define CONF_LAZY_SOCKET " socket"
+
+/**
+ * ConfFileStamp:
+ * @dev: device containing file,
+ * @ino: inode number of file,
+ * @size: size of file,
+ * @mtime: modification time of file,
+ * @ctime: status change time of file.
+ *
+ * Identifies the version of a file that was loaded, such that a file
+ * whose stamp is unchanged need not be parsed again.
+ **/
+typedef struct conf_file_stamp {
+	dev_t            dev;
+	ino_t            ino;
+	off_t            size;
+	struct timespec  mtime;
+	struct timespec  ctime;
+} ConfFileStamp;
+
 /**
  * ConfFile:
  * @entry: list header,
  * @path: path to file,
  * @source: configuration source,
  * @flag: reload flag,
+ * @stamped: TRUE if @stamp and @override_stamp are valid,
+ * @stamp: stamp of @path when last loaded,
+ * @override_path: path of override file applied when last loaded, or NULL,
+ * @override_stamp: stamp of @override_path when last loaded,
+ * @digested: TRUE if @digest is valid,
+ * @digest: digest of the contents of @path and its override file when
+ * last loaded,
+ * @lazy: index entry for the job named by @path while it has not yet
+ * been parsed, or NULL,
+ * @named: entry for @path in the @jobs hash table of @source, or NULL,
  * @data: pointer to actual item.
  *
  * This structure represents a file within @source and links to the item
@@ -91,13 +152,33 @@ typedef struct conf_source {
  * created and parsed, it is set to the same value as the source's.  Then
  * the source can trivially see which files have been lost, since they have
  * the wrong flag value.
+ *
+ * The @stamp and @override_stamp members allow a mandatory reload to skip
+ * files that have not changed since they were last loaded, and @digest
+ * allows it to skip those that were rewritten with the same contents.
+ *
+ * When conf_lazy is TRUE, job files are only indexed by the names of
+ * the job and the events its start on condition may reference until
+ * something needs the job; @lazy is set while this is the case and
+ * @job is NULL.
  **/
 typedef struct conf_file {
-	NihList     entry;
-	char       *path;
+	NihList        entry;
+	char          *path;
 
-	ConfSource *source;
-	int         flag;
+	ConfSource    *source;
+	int            flag;
+
+	int            stamped;
+	ConfFileStamp  stamp;
+	char          *override_path;
+	ConfFileStamp  override_stamp;
+
+	int            digested;
+	uint64_t       digest;
+
+	struct conf_lazy *lazy;
+	struct conf_job  *named;
 
 	union {
 		void     *data;
@@ -105,10 +186,63 @@ typedef struct conf_file {
 	};
 } ConfFile;
 
+/**
+ * ConfLazy:
+ * @entry: list header,
+ * @name: name of job or event,
+ * @file: configuration file not yet parsed.
+ *
+ * Entry in the indexes of job files that have not yet been parsed, by
+ * the name of the job they define and by each name that may be an
+ * event in its start on condition.  The job entry is the @lazy member
+ * of @file and the parent of its event entries.
+ **/
+typedef struct conf_lazy {
+	NihList   entry;
+	char     *name;
+	ConfFile *file;
+} ConfLazy;
+
+/**
+ * ConfJob:
+ * @entry: list header,
+ * @name: name of job defined by @file,
+ * @file: job configuration file.
+ *
+ * Entry in the @jobs hash table of a job directory source, so that the
+ * files defining a job of a given name may be found without visiting
+ * every file of the source.  The entry is the @named member of @file,
+ * and is removed as soon as @file leaves the @files hash table.
+ **/
+typedef struct conf_job {
+	NihList   entry;
+	char     *name;
+	ConfFile *file;
+} ConfJob;
+
+/**
+ * ConfDirty:
+ * @entry: list header,
+ * @path: path of changed file,
+ * @source: source the change was seen by.
+ *
+ * Entry in the conf_dirty hash table for each file that a watch has
+ * seen created, modified or deleted in the last conf_reload_delay
+ * seconds; it is a child of @source, so is discarded along with it.
+ **/
+typedef struct conf_dirty {
+	NihList     entry;
+	char       *path;
+	ConfSource *source;
+} ConfDirty;
+
 
 NIH_BEGIN_EXTERN
 
 extern NihList *conf_sources;
+extern int      conf_prefetch;
+extern int      conf_lazy;
+extern int      conf_reload_delay;
 
 
 void        conf_init          (void);
@@ -123,11 +257,16 @@ ConfFile *  conf_file_new      (ConfSource *source, const char *path)
 void        conf_reload        (void);
 int         conf_source_reload (ConfSource *source)
 	__attribute__ ((warn_unused_result));
+void        conf_reload_dirty  (void);
 
 int         conf_file_destroy  (ConfFile *file);
 
 JobClass *  conf_select_job    (const char *name, const Session *session);
 
+void        conf_lazy_load       (const char *name);
+void        conf_lazy_load_event (const char *name);
+void        conf_lazy_load_all   (void);
+
 const char *
 conf_source_type_enum_to_str (ConfSourceType type)
 	__attribute__ ((warn_unused_result));
@@ -26,6 +26,7 @@
 #include <dbus/dbus.h>
 
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -34,6 +35,8 @@
 #include <nih/alloc.h>
 #include <nih/string.h>
 #include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/tree.h>
 #include <nih/io.h>
 #include <nih/main.h>
 #include <nih/logging.h>
@@ -60,6 +63,9 @@
 #include "events.h"
 #include "paths.h"
 #include "xdg.h"
+#include "mem.h"
+#include "pool.h"
+#include "metrics.h"
 
 #include "com.ubuntu.Upstart.h"
 #include "org.freedesktop.DBus.h"
@@ -72,15 +78,42 @@
 static int   control_server_connect      (DBusServer *server, DBusConnection *conn);
 static void  control_disconnected        (DBusConnection *conn);
 static void  control_register_all        (DBusConnection *conn);
+static DBusHandlerResult control_jobs_filter (DBusConnection *conn,
+					      DBusMessage *message,
+					      void *data);
+static StateIndex *control_conn_index_new (const void *parent);
 
 static void  control_bus_flush           (void);
-static int   control_get_origin_uid      (NihDBusMessage *message, uid_t *uid)
-	__attribute__ ((warn_unused_result));
+static DBusHandlerResult control_bus_filter (DBusConnection *conn,
+					     DBusMessage *message, void *data);
+static DBusHandlerResult control_metrics_filter (DBusConnection *conn,
+						 DBusMessage *message,
+						 void *data);
 static int   control_check_permission    (NihDBusMessage *message)
 	__attribute__ ((warn_unused_result));
+static void  control_set_emitter         (Event *event,
+					  NihDBusMessage *message);
 static void  control_session_file_create (void);
+static void  control_close_files         (const int *files, size_t files_len);
 static void  control_session_file_remove (void);
 
+static ControlGraph *control_graph_new   (const void *parent, Session *session,
+					  char * const *ignored_events, int warn);
+static int   control_graph_visible       (ControlGraph *graph, JobClass *class);
+static const char *control_graph_job     (EventOperator *oper);
+static int   control_graph_event_known   (ControlGraph *graph, const char *name);
+static int   control_graph_job_known     (ControlGraph *graph, const char *name);
+static int   control_graph_satisfied     (ControlGraph *graph, EventOperator *oper);
+static EventOperator *control_graph_failed (ControlGraph *graph,
+					    EventOperator *oper, int root);
+static int   control_graph_report        (ControlGraph *graph, EventOperator *oper,
+					  const char *class_name,
+					  const char *condition,
+					  ControlGetDependencyGraphUnreachableElement ***unreachable,
+					  size_t *len)
+	__attribute__ ((warn_unused_result));
+static void *control_graph_add           (void ***list, size_t *len, size_t size);
+
 /**
  * use_session_bus:
  *
@@ -135,6 +168,70 @@ DBusConnection *control_bus = NULL;
  **/
 NihList *control_conns = NULL;
 
+/**
+ * control_lazy_objects:
+ *
+ * If TRUE, job instances are only registered on the connections of
+ * change feed subscribers as they are created, and only those are sent
+ * the InstanceAdded and InstanceRemoved signals; on other connections
+ * each instance is registered when a message is first sent to its path.
+ **/
+int control_lazy_objects = FALSE;
+
+/**
+ * control_changes:
+ *
+ * Records of the change feed, oldest first, including those not yet
+ * sent to subscribers.
+ **/
+static NihList *control_changes = NULL;
+
+/**
+ * control_changes_len:
+ *
+ * Number of records in control_changes.
+ **/
+static size_t control_changes_len = 0;
+
+/**
+ * control_change_seq:
+ *
+ * Sequence number of the most recent change.
+ **/
+static uint64_t control_change_seq = 0;
+
+/**
+ * control_change_sent:
+ *
+ * Sequence number of the most recent change sent to subscribers.
+ **/
+static uint64_t control_change_sent = 0;
+
+/**
+ * control_change_lost:
+ *
+ * Sequence number of the most recent change discarded from the history,
+ * changes since earlier sequence numbers can no longer be obtained.
+ **/
+static uint64_t control_change_lost = 0;
+
+/**
+ * control_subscribers:
+ *
+ * Clients subscribed to the change feed.
+ **/
+static NihList *control_subscribers = NULL;
+
+/**
+ * control_credentials:
+ *
+ * Unix users of clients on the bus that have made method calls, as
+ * ControlCredential structures keyed by unique bus name; and the number
+ * of them.
+ **/
+NihHash *control_credentials = NULL;
+size_t   control_credentials_len = 0;
+
 /* External definitions */
 extern int      user_mode;
 extern int      disable_respawn;
@@ -151,6 +248,15 @@ control_init (void)
 	if (! control_conns)
 		control_conns = NIH_MUST (nih_list_new (NULL));
 
+	if (! control_changes)
+		control_changes = NIH_MUST (nih_list_new (NULL));
+
+	if (! control_subscribers)
+		control_subscribers = NIH_MUST (nih_list_new (NULL));
+
+	if (! control_credentials)
+		control_credentials = NIH_MUST (nih_hash_string_new (NULL, 0));
+
 	if (! control_server_address) {
 		if (user_mode) {
 			NIH_MUST (nih_strcat_sprintf (&control_server_address, NULL,
@@ -310,6 +416,19 @@ control_bus_open (void)
 	/* Register objects on the bus. */
 	control_register_all (conn);
 
+	/* Watch for clients leaving the bus so that their unix users are
+	 * forgotten; the match is added without waiting for a reply.
+	 */
+	if (! dbus_connection_add_filter (conn, control_bus_filter, NULL, NULL)) {
+		dbus_connection_unref (conn);
+		nih_return_no_memory_error (-1);
+	}
+
+	dbus_bus_add_match (conn, ("type='signal',"
+				   "sender='" DBUS_SERVICE_DBUS "',"
+				   "interface='" DBUS_INTERFACE_DBUS "',"
+				   "member='NameOwnerChanged'"), NULL);
+
 	/* Request our well-known name.  We do this last so that once it
 	 * appears on the bus, clients can assume we're ready to talk to
 	 * them.
@@ -401,6 +520,75 @@ control_disconnected (DBusConnection *conn)
 		if (entry->data == conn)
 			nih_free (entry);
 	}
+
+	/* And from the change feed subscribers */
+	NIH_LIST_FOREACH_SAFE (control_subscribers, iter) {
+		ControlSubscriber *subscriber = (ControlSubscriber *)iter;
+
+		if (subscriber->conn == conn)
+			nih_free (subscriber);
+	}
+
+	/* And forget the users of clients reached over it */
+	NIH_HASH_FOREACH_SAFE (control_credentials, iter) {
+		ControlCredential *credential = (ControlCredential *)iter;
+
+		if (credential->conn == conn) {
+			nih_free (credential);
+			control_credentials_len--;
+		}
+	}
+}
+
+/**
+ * control_bus_filter:
+ * @conn: connection to the bus,
+ * @message: message received,
+ * @data: not used.
+ *
+ * Filter function for the connection to the bus, which forgets the unix
+ * user of a client once the NameOwnerChanged signal says that it has
+ * left the bus.  Unique names are never reused, so this only limits the
+ * size of control_credentials.
+ *
+ * Returns: DBUS_HANDLER_RESULT_NOT_YET_HANDLED so that the message is
+ * passed on.
+ **/
+static DBusHandlerResult
+control_bus_filter (DBusConnection *conn,
+		    DBusMessage    *message,
+		    void           *data)
+{
+	const char        *name;
+	const char        *old_owner;
+	const char        *new_owner;
+	ControlCredential *credential;
+
+	nih_assert (conn != NULL);
+	nih_assert (message != NULL);
+
+	if (! dbus_message_is_signal (message, DBUS_INTERFACE_DBUS,
+				      "NameOwnerChanged"))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (! dbus_message_get_args (message, NULL,
+				     DBUS_TYPE_STRING, &name,
+				     DBUS_TYPE_STRING, &old_owner,
+				     DBUS_TYPE_STRING, &new_owner,
+				     DBUS_TYPE_INVALID))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	if (*new_owner || (! control_credentials))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	credential = (ControlCredential *)nih_hash_lookup (control_credentials,
+							  name);
+	if (credential && (credential->conn == conn)) {
+		nih_free (credential);
+		control_credentials_len--;
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
 
@@ -433,6 +621,122 @@ control_register_all (DBusConnection *conn)
 
 		job_class_register (class, conn, FALSE);
 	}
+
+	/* Instances not registered above are found when first used */
+	if (control_lazy_objects)
+		NIH_MUST (dbus_connection_add_filter (conn, control_jobs_filter,
+						      NULL, NULL));
+
+	if (metrics_enabled)
+		NIH_MUST (dbus_connection_add_filter (conn, control_metrics_filter,
+						      NULL, NULL));
+}
+
+/**
+ * control_metrics_filter:
+ * @conn: connection message was received on,
+ * @message: message received,
+ * @data: not used.
+ *
+ * Filter function for every connection objects are registered on, which
+ * counts the method calls made for the metrics socket.
+ *
+ * Returns: DBUS_HANDLER_RESULT_NOT_YET_HANDLED so that the message is
+ * passed on.
+ **/
+static DBusHandlerResult
+control_metrics_filter (DBusConnection *conn,
+			DBusMessage    *message,
+			void           *data)
+{
+	nih_assert (conn != NULL);
+	nih_assert (message != NULL);
+
+	if ((dbus_message_get_type (message) == DBUS_MESSAGE_TYPE_METHOD_CALL)
+	    && dbus_message_get_member (message))
+		metrics_method_called (dbus_message_get_interface (message),
+				       dbus_message_get_member (message));
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * control_jobs_filter:
+ * @conn: connection message was received on,
+ * @message: message received,
+ * @data: not used.
+ *
+ * Filter function for connections objects are registered on when
+ * control_lazy_objects is TRUE, which registers the instance a method
+ * call is sent to if it is not yet registered on @conn.  Filters are run
+ * before the message is dispatched to the objects of @conn, so it then
+ * goes on to the object just registered.
+ *
+ * Returns: DBUS_HANDLER_RESULT_NOT_YET_HANDLED so that the message is
+ * passed on.
+ **/
+static DBusHandlerResult
+control_jobs_filter (DBusConnection *conn,
+		     DBusMessage    *message,
+		     void           *data)
+{
+	const char *path;
+	void       *object = NULL;
+	Job        *job;
+
+	nih_assert (conn != NULL);
+	nih_assert (message != NULL);
+
+	if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	path = dbus_message_get_path (message);
+	if ((! path)
+	    || strncmp (path, DBUS_PATH_UPSTART "/jobs/",
+			strlen (DBUS_PATH_UPSTART "/jobs/")))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	/* Job classes, and instances already used, are registered */
+	if ((! dbus_connection_get_object_path_data (conn, path, &object))
+	    || object)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	job = job_find_by_path (path);
+	if (job)
+		job_register (job, conn, FALSE);
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+/**
+ * control_register_instances:
+ * @conn: connection to check.
+ *
+ * Determines whether job instances should be registered on @conn as
+ * they are created, and InstanceAdded and InstanceRemoved sent for them.
+ *
+ * Returns: TRUE unless control_lazy_objects is set and no client on
+ * @conn has subscribed to the change feed.
+ **/
+int
+control_register_instances (DBusConnection *conn)
+{
+	nih_assert (conn != NULL);
+
+	if (! control_lazy_objects)
+		return TRUE;
+
+	if (! control_subscribers)
+		return FALSE;
+
+	NIH_LIST_FOREACH (control_subscribers, iter) {
+		ControlSubscriber *subscriber = (ControlSubscriber *)iter;
+
+		if (subscriber->conn == conn)
+			return TRUE;
+	}
+
+	return FALSE;
 }
 
 
@@ -497,7 +801,6 @@ control_get_job_by_name (void            *data,
 {
 	Session  *session;
 	JobClass *class = NULL;
-	JobClass *global_class = NULL;
 
 	nih_assert (message != NULL);
 	nih_assert (name != NULL);
@@ -515,26 +818,17 @@ control_get_job_by_name (void            *data,
 	/* Get the relevant session */
 	session = session_from_dbus (NULL, message);
 
-	/* Lookup the job */
-	class = (JobClass *)nih_hash_search (job_classes, name, NULL);
-
-	while (class && (class->session != session)) {
+	/* Parse the job now if it has only been indexed */
+	conf_lazy_load (name);
 
-		/* Found a match in the global session which may be used
-		 * later if no matching user session job exists.
-		 */
-		if ((! class->session) && (session && ! session->chroot))
-			global_class = class;
-
-		class = (JobClass *)nih_hash_search (job_classes, name,
-				&class->entry);
-	}
+	/* Lookup the job */
+	class = job_class_get_registered (name, session);
 
 	/* If no job with the given name exists in the appropriate
 	 * session, look in the global namespace (aka the NULL session).
 	 */ 
-	if (! class)
-		class = global_class;
+	if ((! class) && session && (! session->chroot))
+		class = job_class_get_registered (name, NULL);
 
 	if (! class) {
 		nih_dbus_error_raise_printf (
@@ -587,6 +881,8 @@ control_get_all_jobs (void             *data,
 	/* Get the relevant session */
 	session = session_from_dbus (NULL, message);
 
+	conf_lazy_load_all ();
+
 	NIH_HASH_FOREACH (job_classes, iter) {
 		JobClass *class = (JobClass *)iter;
 
@@ -607,6 +903,166 @@ control_get_all_jobs (void             *data,
 	return 0;
 }
 
+/**
+ * control_job_status_add:
+ * @jobs: pointer to array of status elements,
+ * @len: pointer to number of elements in @jobs,
+ * @class: job class,
+ * @job: instance of @class, or NULL.
+ *
+ * Appends a status element for @job, or for @class without any instance
+ * when @job is NULL, to the NULL-terminated array @jobs which is extended
+ * as required.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+static int
+control_job_status_add (ControlGetAllJobStatusJobsElement ***jobs,
+			size_t                               *len,
+			JobClass                             *class,
+			Job                                  *job)
+{
+	ControlGetAllJobStatusJobsElement  *element;
+	ControlGetAllJobStatusJobsElement **tmp;
+	size_t                              num_processes = 0;
+
+	nih_assert (jobs != NULL);
+	nih_assert (len != NULL);
+	nih_assert (class != NULL);
+
+	element = nih_new (*jobs, ControlGetAllJobStatusJobsElement);
+	if (! element)
+		return -1;
+
+	element->item0 = nih_strdup (element, class->name);
+	element->item1 = nih_strdup (element, job ? job->name : "");
+	element->item2 = nih_strdup (element, job_goal_name (job ? job->goal : JOB_STOP));
+	element->item3 = nih_strdup (element, job_state_name (job ? job->state : JOB_WAITING));
+	element->item4 = nih_alloc (element, sizeof (ControlGetAllJobStatusJobsElementItem4Element *));
+	if (! (element->item0 && element->item1 && element->item2
+	       && element->item3 && element->item4))
+		goto error;
+
+	element->item4[0] = NULL;
+
+	for (int i = 0; job && (i < PROCESS_LAST); i++) {
+		ControlGetAllJobStatusJobsElementItem4Element  *process;
+		ControlGetAllJobStatusJobsElementItem4Element **procs;
+
+		if (job->pid[i] <= 0)
+			continue;
+
+		process = nih_new (element, ControlGetAllJobStatusJobsElementItem4Element);
+		if (! process)
+			goto error;
+
+		process->item0 = nih_strdup (process, process_name (i));
+		if (! process->item0)
+			goto error;
+
+		process->item1 = job->pid[i];
+
+		procs = nih_realloc (element->item4, element,
+				     (sizeof (ControlGetAllJobStatusJobsElementItem4Element *)
+				      * (num_processes + 2)));
+		if (! procs)
+			goto error;
+
+		element->item4 = procs;
+		element->item4[num_processes++] = process;
+		element->item4[num_processes] = NULL;
+	}
+
+	tmp = nih_realloc (*jobs, NULL,
+			   sizeof (ControlGetAllJobStatusJobsElement *) * (*len + 2));
+	if (! tmp)
+		goto error;
+
+	*jobs = tmp;
+	(*jobs)[(*len)++] = element;
+	(*jobs)[*len] = NULL;
+
+	return 0;
+
+error:
+	nih_free (element);
+	return -1;
+}
+
+/**
+ * control_get_all_job_status:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @jobs: pointer for array of job status reply.
+ *
+ * Implements the GetAllJobStatus method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain the name, instance name, goal, state and processes of
+ * every instance of all known jobs, which will be stored in @jobs, sparing
+ * the caller a round trip for each job and instance.  Jobs without any
+ * instances are given once with an empty instance name.  If no jobs are
+ * registered, @jobs will point to an empty array.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_all_job_status (void                                 *data,
+			    NihDBusMessage                       *message,
+			    ControlGetAllJobStatusJobsElement  ***jobs)
+{
+	Session                             *session;
+	ControlGetAllJobStatusJobsElement  **list;
+	size_t                               len;
+
+	nih_assert (message != NULL);
+	nih_assert (jobs != NULL);
+
+	job_class_init ();
+
+	len = 0;
+	list = nih_alloc (message, sizeof (ControlGetAllJobStatusJobsElement *));
+	if (! list)
+		nih_return_no_memory_error (-1);
+
+	list[0] = NULL;
+
+	/* Get the relevant session */
+	session = session_from_dbus (NULL, message);
+
+	conf_lazy_load_all ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+		int       found = FALSE;
+
+		if ((class->session || (session && session->chroot))
+		    && (class->session != session))
+			continue;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			found = TRUE;
+
+			if (control_job_status_add (&list, &len, class, job) < 0)
+				goto error;
+		}
+
+		if ((! found)
+		    && (control_job_status_add (&list, &len, class, NULL) < 0))
+			goto error;
+	}
+
+	*jobs = list;
+
+	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
+}
+
 
 int
 control_emit_event (void            *data,
@@ -639,7 +1095,8 @@ control_emit_event (void            *data,
  *
  * When @wait is TRUE the method call will not return until the event
  * has completed, which means that all jobs affected by the event have
- * finished starting (running for tasks) or stopping; when @wait is FALSE,
+ * finished starting (running for tasks) or stopping, and the event is
+ * handled ahead of those nobody is waiting for; when @wait is FALSE,
  * the method call returns once the event has been queued.
  *
  * Returns: zero on success, negative value on raised error.
@@ -651,6 +1108,37 @@ control_emit_event_with_file (void            *data,
 			      char * const    *env,
 			      int              wait,
 			      int              file)
+{
+	return control_emit_event_with_files (data, message, name, env, wait,
+					      (file >= 0) ? &file : NULL,
+					      (file >= 0) ? 1 : 0);
+}
+
+/**
+ * control_emit_event_with_files:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @name: name of event to emit,
+ * @env: environment of environment,
+ * @wait: whether to wait for event completion before returning,
+ * @files: file descriptors,
+ * @files_len: number of entries in @files.
+ *
+ * Implements the top half of the EmitEventWithFiles method of the
+ * com.ubuntu.Upstart interface, as control_emit_event_with_file() but
+ * passing all of @files to the jobs started by the event in the order
+ * given, such as a set of listening sockets.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_emit_event_with_files (void            *data,
+			       NihDBusMessage  *message,
+			       const char      *name,
+			       char * const    *env,
+			       int              wait,
+			       const int       *files,
+			       size_t           files_len)
 {
 	Event    *event;
 	Blocked  *blocked;
@@ -658,11 +1146,13 @@ control_emit_event_with_file (void            *data,
 	nih_assert (message != NULL);
 	nih_assert (name != NULL);
 	nih_assert (env != NULL);
+	nih_assert ((files != NULL) || (files_len == 0));
 
 	if (! control_check_permission (message)) {
 		nih_dbus_error_raise_printf (
 			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
 			_("You do not have permission to emit an event"));
+		control_close_files (files, files_len);
 		return -1;
 	}
 
@@ -670,7 +1160,7 @@ control_emit_event_with_file (void            *data,
 	if (! strlen (name)) {
 		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
 					     _("Name may not be empty string"));
-		close (file);
+		control_close_files (files, files_len);
 		return -1;
 	}
 
@@ -678,7 +1168,7 @@ control_emit_event_with_file (void            *data,
 	if (! environ_all_valid (env)) {
 		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
 					     _("Env must be KEY=VALUE pairs"));
-		close (file);
+		control_close_files (files, files_len);
 		return -1;
 	}
 
@@ -686,28 +1176,51 @@ control_emit_event_with_file (void            *data,
 	event = event_new (NULL, name, (char **)env);
 	if (! event) {
 		nih_error_raise_system ();
-		close (file);
+		control_close_files (files, files_len);
 		return -1;
 	}
 
-	event->fd = file;
-	if (event->fd >= 0) {
+	control_set_emitter (event, message);
+
+	if (files_len > 1) {
+		event->fds = nih_alloc (event, sizeof (int) * (files_len - 1));
+		if (! event->fds) {
+			nih_error_raise_no_memory ();
+			nih_free (event);
+			control_close_files (files, files_len);
+			return -1;
+		}
+	}
+
+	/* Jobs inherit the file descriptors of the event */
+	for (size_t i = 0; i < files_len; i++) {
 		long flags;
 
-		flags = fcntl (event->fd, F_GETFD);
+		flags = fcntl (files[i], F_GETFD);
 		flags &= ~FD_CLOEXEC;
-		fcntl (event->fd, F_SETFD, flags);
+		fcntl (files[i], F_SETFD, flags);
+
+		if (i) {
+			event->fds[event->num_fds++] = files[i];
+		} else {
+			event->fd = files[i];
+		}
 	}
 
 	/* Obtain the session */
 	event->session = session_from_dbus (NULL, message);
 
+	/* Somebody is waiting for this event, so it goes ahead of those
+	 * nobody is waiting for.
+	 */
 	if (wait) {
+		event_set_priority (event, EVENT_PRIORITY_HIGH);
+
 		blocked = blocked_new (event, BLOCKED_EMIT_METHOD, message);
 		if (! blocked) {
 			nih_error_raise_system ();
 			nih_free (event);
-			close (file);
+			control_close_files (files, files_len);
 			return -1;
 		}
 
@@ -719,600 +1232,2169 @@ control_emit_event_with_file (void            *data,
 	return 0;
 }
 
-
 /**
- * control_get_version:
- * @data: not used,
- * @message: D-Bus connection and message received,
- * @version: pointer for reply string.
- *
- * Implements the get method for the version property of the
- * com.ubuntu.Upstart interface.
- *
- * Called to obtain the version of the init daemon, which will be stored
- * as a string in @version.
+ * control_close_files:
+ * @files: file descriptors,
+ * @files_len: number of entries in @files.
  *
- * Returns: zero on success, negative value on raised error.
+ * Closes @files, passed with a method call that failed.
  **/
-int
-control_get_version (void *          data,
-		     NihDBusMessage *message,
-		     char **         version)
+static void
+control_close_files (const int *files,
+		     size_t     files_len)
 {
-	nih_assert (message != NULL);
-	nih_assert (version != NULL);
-
-	*version = nih_strdup (message, package_string);
-	if (! *version)
-		nih_return_no_memory_error (-1);
-
-	return 0;
+	for (size_t i = 0; i < files_len; i++)
+		close (files[i]);
 }
 
 /**
- * control_get_log_priority:
+ * control_emit_events:
  * @data: not used,
  * @message: D-Bus connection and message received,
- * @log_priority: pointer for reply string.
+ * @events: array of event names and environments.
  *
- * Implements the get method for the log_priority property of the
- * com.ubuntu.Upstart interface.
+ * Implements the EmitEvents method of the com.ubuntu.Upstart
+ * interface.
  *
- * Called to obtain the init daemon's current logging level, which will
- * be stored as a string in @log_priority.
+ * Called to queue an event for each of @events without waiting for any
+ * of them to finish, such that a client with many events to emit, such
+ * as a bridge during coldplug, needs only a single method call.  All of
+ * the events are queued before the queue is next processed.
+ *
+ * No event is queued if any of @events is invalid.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_get_log_priority (void *          data,
-			  NihDBusMessage *message,
-			  char **         log_priority)
+control_emit_events (void                            *data,
+		     NihDBusMessage                  *message,
+		     ControlEmitEventsEventsElement * const *events)
 {
-	const char *priority;
+	Session *session;
 
 	nih_assert (message != NULL);
-	nih_assert (log_priority != NULL);
+	nih_assert (events != NULL);
 
-	switch (nih_log_priority) {
-	case NIH_LOG_DEBUG:
-		priority = "debug";
-		break;
-	case NIH_LOG_INFO:
-		priority = "info";
-		break;
-	case NIH_LOG_MESSAGE:
-		priority = "message";
-		break;
-	case NIH_LOG_WARN:
-		priority = "warn";
-		break;
-	case NIH_LOG_ERROR:
-		priority = "error";
-		break;
-	case NIH_LOG_FATAL:
-		priority = "fatal";
-		break;
-	default:
-		nih_assert_not_reached ();
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to emit an event"));
+		return -1;
 	}
 
-	*log_priority = nih_strdup (message, priority);
-	if (! *log_priority)
-		nih_return_no_memory_error (-1);
+	/* Verify every event before queueing any of them */
+	for (ControlEmitEventsEventsElement * const *e = events; *e; e++) {
+		if (! strlen ((*e)->item0)) {
+			nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+						     _("Name may not be empty string"));
+			return -1;
+		}
+
+		if (! environ_all_valid ((*e)->item1)) {
+			nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+						     _("Env must be KEY=VALUE pairs"));
+			return -1;
+		}
+	}
+
+	session = session_from_dbus (NULL, message);
+
+	for (ControlEmitEventsEventsElement * const *e = events; *e; e++) {
+		Event *event;
+
+		event = NIH_MUST (event_new (NULL, (*e)->item0, (*e)->item1));
+		event->session = session;
+
+		control_set_emitter (event, message);
+	}
 
 	return 0;
 }
 
 /**
- * control_set_log_priority:
+ * control_emit_event_async:
  * @data: not used,
  * @message: D-Bus connection and message received,
- * @log_priority: string log priority to be set.
+ * @name: name of event to emit,
+ * @env: environment of event,
+ * @id: pointer for identifier of event,
+ * @pending: pointer for number of events pending.
  *
- * Implements the get method for the log_priority property of the
- * com.ubuntu.Upstart interface.
+ * Implements the EmitEventAsync method of the com.ubuntu.Upstart
+ * interface.
  *
- * Called to change the init daemon's current logging level to that given
- * as a string in @log_priority.  If the string is not recognised, the
- * com.ubuntu.Upstart.Error.InvalidLogPriority error will be returned.
+ * Called to queue an event with a given @name and @env without waiting
+ * for it to finish.  The identifier of the event is returned in @id, and
+ * the EventFinished signal is sent with it, and whether the event failed,
+ * once the event finishes.  The number of events pending in the queue,
+ * including this one, is returned in @pending so that the caller may
+ * throttle itself when the queue is behind.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_set_log_priority (void *          data,
-			  NihDBusMessage *message,
-			  const char *    log_priority)
+control_emit_event_async (void            *data,
+			  NihDBusMessage  *message,
+			  const char      *name,
+			  char * const    *env,
+			  uint64_t        *id,
+			  uint32_t        *pending)
 {
+	Event *event;
+
 	nih_assert (message != NULL);
-	nih_assert (log_priority != NULL);
+	nih_assert (name != NULL);
+	nih_assert (env != NULL);
+	nih_assert (id != NULL);
+	nih_assert (pending != NULL);
 
 	if (! control_check_permission (message)) {
 		nih_dbus_error_raise_printf (
 			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to set log priority"));
+			_("You do not have permission to emit an event"));
 		return -1;
 	}
 
-	if (! strcmp (log_priority, "debug")) {
-		nih_log_set_priority (NIH_LOG_DEBUG);
+	if (! strlen (name)) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+					     _("Name may not be empty string"));
+		return -1;
+	}
 
-	} else if (! strcmp (log_priority, "info")) {
-		nih_log_set_priority (NIH_LOG_INFO);
+	if (! environ_all_valid (env)) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+					     _("Env must be KEY=VALUE pairs"));
+		return -1;
+	}
 
-	} else if (! strcmp (log_priority, "message")) {
-		nih_log_set_priority (NIH_LOG_MESSAGE);
+	event = event_new (NULL, name, (char **)env);
+	if (! event)
+		nih_return_no_memory_error (-1);
 
-	} else if (! strcmp (log_priority, "warn")) {
-		nih_log_set_priority (NIH_LOG_WARN);
+	event->session = session_from_dbus (NULL, message);
+	event->report = TRUE;
 
-	} else if (! strcmp (log_priority, "error")) {
-		nih_log_set_priority (NIH_LOG_ERROR);
+	control_set_emitter (event, message);
 
-	} else if (! strcmp (log_priority, "fatal")) {
-		nih_log_set_priority (NIH_LOG_FATAL);
+	*id = event->id;
+	*pending = 0;
 
-	} else {
-		nih_dbus_error_raise (DBUS_ERROR_INVALID_ARGS,
-				      _("The log priority given was not recognised"));
-		return -1;
+	NIH_LIST_FOREACH (events, iter) {
+		Event *queued = (Event *)iter;
+
+		if (queued->progress == EVENT_PENDING)
+			(*pending)++;
 	}
 
 	return 0;
 }
 
 /**
- * control_get_bus_type:
+ * control_get_event_stats:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @emitted: pointer for number of events emitted,
+ * @pending: pointer for number of pending events,
+ * @handling: pointer for number of events being handled,
+ * @finished: pointer for number of events awaiting cleanup,
+ * @latency: pointer for histogram of event latency,
+ * @latency_len: pointer for length of @latency,
+ * @poll: pointer for histogram of queue pass duration,
+ * @poll_len: pointer for length of @poll,
+ * @examined: pointer for histogram of subscriptions examined,
+ * @examined_len: pointer for length of @examined.
+ *
+ * Implements the GetEventStats method of the com.ubuntu.Upstart
+ * interface.
  *
- * Determine D-Bus bus type to connect to.
+ * Called to obtain the number of events emitted since startup, the number
+ * currently in the events list by progress, and the histograms kept in
+ * event_stats; each histogram has EVENT_STATS_BUCKETS elements.
  *
- * Returns: Type of D-Bus bus to connect to.
+ * Returns: zero on success, negative value on raised error.
  **/
-DBusBusType
-control_get_bus_type (void)
+int
+control_get_event_stats (void            *data,
+			 NihDBusMessage  *message,
+			 uint64_t        *emitted,
+			 uint32_t        *pending,
+			 uint32_t        *handling,
+			 uint32_t        *finished,
+			 uint64_t       **latency,
+			 size_t          *latency_len,
+			 uint64_t       **poll,
+			 size_t          *poll_len,
+			 uint64_t       **examined,
+			 size_t          *examined_len)
 {
-	return (use_session_bus || user_mode) 
-		? DBUS_BUS_SESSION
-		: DBUS_BUS_SYSTEM;
+	nih_assert (message != NULL);
+	nih_assert (emitted != NULL);
+	nih_assert (pending != NULL);
+	nih_assert (handling != NULL);
+	nih_assert (finished != NULL);
+	nih_assert (latency != NULL);
+	nih_assert (latency_len != NULL);
+	nih_assert (poll != NULL);
+	nih_assert (poll_len != NULL);
+	nih_assert (examined != NULL);
+	nih_assert (examined_len != NULL);
+
+	event_init ();
+
+	*emitted = event_stats.emitted;
+	*pending = *handling = *finished = 0;
+
+	NIH_LIST_FOREACH (events, iter) {
+		Event *event = (Event *)iter;
+
+		switch (event->progress) {
+		case EVENT_PENDING:
+			(*pending)++;
+			break;
+		case EVENT_HANDLING:
+			(*handling)++;
+			break;
+		case EVENT_FINISHED:
+			(*finished)++;
+			break;
+		default:
+			nih_assert_not_reached ();
+		}
+	}
+
+	*latency = nih_alloc (message, sizeof (event_stats.latency));
+	*poll = nih_alloc (message, sizeof (event_stats.poll));
+	*examined = nih_alloc (message, sizeof (event_stats.examined));
+	if (! (*latency && *poll && *examined))
+		nih_return_no_memory_error (-1);
+
+	memcpy (*latency, event_stats.latency, sizeof (event_stats.latency));
+	*latency_len = EVENT_STATS_BUCKETS;
+
+	memcpy (*poll, event_stats.poll, sizeof (event_stats.poll));
+	*poll_len = EVENT_STATS_BUCKETS;
+
+	memcpy (*examined, event_stats.examined, sizeof (event_stats.examined));
+	*examined_len = EVENT_STATS_BUCKETS;
+
+	return 0;
 }
 
 /**
- * control_notify_disk_writeable:
+ * control_get_job_timeline:
  * @data: not used,
  * @message: D-Bus connection and message received,
+ * @records: pointer for array of timeline records.
  *
- * Implements the NotifyDiskWriteable method of the
- * com.ubuntu.Upstart interface.
- *
- * Called to flush the job logs for all jobs that ended before the log
- * disk became writeable.
+ * Implements the GetJobTimeline method of the com.ubuntu.Upstart
+ * interface.
  *
- * Notes: Session Inits are permitted to make this call. In the common
- * case of starting a Session Init as a child of a Display Manager this
- * is somewhat meaningless, but it does mean that if a Session Init were
- * started from a system job, behaviour would be as expected.
+ * Called to obtain the records held in the job timeline, oldest first,
+ * each giving the CLOCK_MONOTONIC time of the record in microseconds,
+ * the job class and instance names, the type of record and either the
+ * state entered or the process spawned or exec'd.  Records of events
+ * give the name of the event in place of the job class, and leave the
+ * instance and value empty.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_notify_disk_writeable (void   *data,
-		     NihDBusMessage *message)
+control_get_job_timeline (void                                  *data,
+			  NihDBusMessage                        *message,
+			  ControlGetJobTimelineRecordsElement ***records)
 {
-	int       ret;
-	Session  *session;
+	ControlGetJobTimelineRecordsElement **list;
+	size_t                                count;
 
 	nih_assert (message != NULL);
+	nih_assert (records != NULL);
 
-	if (! control_check_permission (message)) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to notify disk is writeable"));
-		return -1;
-	}
+	count = job_timeline_count ();
 
-	/* Get the relevant session */
-	session = session_from_dbus (NULL, message);
+	list = nih_alloc (message, sizeof (ControlGetJobTimelineRecordsElement *)
+			  * (count + 1));
+	if (! list)
+		nih_return_no_memory_error (-1);
 
-	/* "nop" when run from a chroot */
-	if (session && session->chroot)
-		return 0;
+	for (size_t i = 0; i < count; i++) {
+		const JobTimelineRecord             *record;
+		ControlGetJobTimelineRecordsElement *element;
+		const char                          *value;
 
-	ret = log_clear_unflushed ();
+		record = job_timeline_get (i);
+		nih_assert (record != NULL);
 
-	if (ret < 0) {
-		nih_error_raise_system ();
-		return -1;
+		element = nih_new (list, ControlGetJobTimelineRecordsElement);
+		if (! element)
+			goto error;
+
+		switch (record->type) {
+		case JOB_TIMELINE_STATE:
+			value = job_state_name (record->state);
+			break;
+		case JOB_TIMELINE_EVENT:
+			value = "";
+			break;
+		default:
+			value = process_name (record->process);
+			break;
+		}
+
+		element->item0 = ((uint64_t)record->time.tv_sec * 1000000
+				  + record->time.tv_nsec / 1000);
+		element->item1 = nih_strdup (element, record->job);
+		element->item2 = nih_strdup (element, record->instance);
+		element->item3 = nih_strdup (element,
+					     job_timeline_type_name (record->type));
+		element->item4 = nih_strdup (element, value);
+		if (! (element->item1 && element->item2 && element->item3
+		       && element->item4))
+			goto error;
+
+		list[i] = element;
 	}
 
+	list[count] = NULL;
+	*records = list;
+
 	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
 }
 
 /**
- * control_notify_dbus_address:
+ * control_get_event_history:
  * @data: not used,
  * @message: D-Bus connection and message received,
- * @address: Address of D-Bus to connect to.
+ * @since: identifier of last event already seen,
+ * @records: pointer for array of history records.
  *
- * Implements the NotifyDBusAddress method of the
- * com.ubuntu.Upstart interface.
+ * Implements the GetEventHistory method of the com.ubuntu.Upstart
+ * interface.
  *
- * Called to allow the Session Init to connect to the D-Bus
- * Session Bus when available.
+ * Called to obtain the records held in the event history of events with
+ * identifiers greater than @since, oldest first, each giving the
+ * identifier, name and emitter of the event, the CLOCK_MONOTONIC times in
+ * microseconds that it was queued, began to be handled and finished, or
+ * zero if it is still being handled, whether it failed, the number of
+ * jobs blocking it, the number of job classes it started or stopped, and
+ * the names of the first EVENT_HISTORY_JOBS of those started and stopped.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_notify_dbus_address (void            *data,
-			     NihDBusMessage  *message,
-			     const char      *address)
+control_get_event_history (void                                   *data,
+			   NihDBusMessage                         *message,
+			   uint64_t                                since,
+			   ControlGetEventHistoryRecordsElement ***records)
 {
-	nih_assert (message);
-	nih_assert (address);
+	ControlGetEventHistoryRecordsElement **list;
+	size_t                                 count;
+	size_t                                 len = 0;
 
-	if (getpid () == 1) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("Not permissible to notify D-Bus address for PID 1"));
-		return -1;
-	}
+	nih_assert (message != NULL);
+	nih_assert (records != NULL);
 
-	if (! control_check_permission (message)) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to notify D-Bus address"));
-		return -1;
-	}
+	count = event_history_count ();
 
-	/* Ignore as already connected */
-	if (control_bus)
-		return 0;
+	list = nih_alloc (message, sizeof (ControlGetEventHistoryRecordsElement *)
+			  * (count + 1));
+	if (! list)
+		nih_return_no_memory_error (-1);
 
-	control_bus_address = nih_strdup (NULL, address);
-	if (! control_bus_address) {
-		nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
-				_("Out of Memory"));
-		return -1;
+	for (size_t i = 0; i < count; i++) {
+		const EventHistoryRecord             *record;
+		ControlGetEventHistoryRecordsElement *element;
+		size_t                                started = 0;
+		size_t                                stopped = 0;
+
+		record = event_history_get (i);
+		nih_assert (record != NULL);
+
+		if (record->id <= since)
+			continue;
+
+		element = nih_new (list, ControlGetEventHistoryRecordsElement);
+		if (! element)
+			goto error;
+
+		element->item0 = record->id;
+		element->item1 = nih_strdup (element, record->name);
+		element->item2 = nih_strdup (element, (record->emitter
+						       ? record->emitter
+						       : "init"));
+		element->item3 = ((uint64_t)record->queued.tv_sec * 1000000
+				  + record->queued.tv_nsec / 1000);
+		element->item4 = ((uint64_t)record->handled.tv_sec * 1000000
+				  + record->handled.tv_nsec / 1000);
+		element->item5 = ((uint64_t)record->finished.tv_sec * 1000000
+				  + record->finished.tv_nsec / 1000);
+		element->item6 = record->failed;
+		element->item7 = record->blockers;
+		element->item8 = record->matched;
+		element->item9 = nih_str_array_new (element);
+		element->item10 = nih_str_array_new (element);
+		if (! (element->item1 && element->item2 && element->item9
+		       && element->item10))
+			goto error;
+
+		for (unsigned int n = 0;
+		     (n < record->matched) && (n < EVENT_HISTORY_JOBS); n++) {
+			if (record->stopped & (1U << n)) {
+				if (! nih_str_array_add (&element->item10, element,
+							 &stopped, record->jobs[n]))
+					goto error;
+			} else {
+				if (! nih_str_array_add (&element->item9, element,
+							 &started, record->jobs[n]))
+					goto error;
+			}
+		}
+
+		list[len++] = element;
 	}
 
-	if (control_bus_open () < 0)
-		return -1;
+	list[len] = NULL;
+	*records = list;
 
 	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
 }
 
 /**
- * control_notify_cgroup_manager_address:
+ * control_get_memory_stats:
  * @data: not used,
  * @message: D-Bus connection and message received,
- * @address: D-Bus address that cgroup manager is connected to.
+ * @categories: pointer for array of usage by category,
+ * @allocated: pointer for number of blocks allocated,
+ * @allocated_bytes: pointer for total size of blocks allocated,
+ * @cached: pointer for number of free blocks kept,
+ * @cached_bytes: pointer for total size of free blocks kept.
  *
- * Implements the NotifyCGroupManagerAddress method of the
- * com.ubuntu.Upstart interface.
+ * Implements the GetMemoryStats method of the com.ubuntu.Upstart
+ * interface.
  *
- * Called to allow the cgroup manager to be contacted,
- * thus enabling the cgroup stanza.
+ * Called to obtain the name, number of objects and total size in bytes
+ * of each category of data structure reported by mem_usage(), along
+ * with the totals kept by the allocation pool; those are zero when the
+ * pool is not in use.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_notify_cgroup_manager_address (void            *data,
-				       NihDBusMessage  *message,
-				       const char      *address)
+control_get_memory_stats (void                                     *data,
+			  NihDBusMessage                           *message,
+			  ControlGetMemoryStatsCategoriesElement ***categories,
+			  uint64_t                                 *allocated,
+			  uint64_t                                 *allocated_bytes,
+			  uint64_t                                 *cached,
+			  uint64_t                                 *cached_bytes)
 {
-	nih_assert (message);
-	nih_assert (address);
+	ControlGetMemoryStatsCategoriesElement **list;
+	MemUsage                                 usage[MEM_CATEGORIES];
 
-	if (! control_check_permission (message)) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to notify cgroup manager address"));
-		return -1;
-	}
+	nih_assert (message != NULL);
+	nih_assert (categories != NULL);
+	nih_assert (allocated != NULL);
+	nih_assert (allocated_bytes != NULL);
+	nih_assert (cached != NULL);
+	nih_assert (cached_bytes != NULL);
 
-#ifdef ENABLE_CGROUPS
-	if (! cgroup_support_enabled ())
-		return 0;
+	mem_usage (usage);
 
-	/* Already called */
-	if (cgroup_manager_available ())
-		return 0;
+	list = nih_alloc (message, sizeof (ControlGetMemoryStatsCategoriesElement *)
+			  * (MEM_CATEGORIES + 1));
+	if (! list)
+		nih_return_no_memory_error (-1);
 
-	if (! cgroup_manager_set_address (address)) {
-		nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
-				_("Out of Memory"));
-		return -1;
+	for (int i = 0; i < MEM_CATEGORIES; i++) {
+		ControlGetMemoryStatsCategoriesElement *element;
+
+		element = nih_new (list, ControlGetMemoryStatsCategoriesElement);
+		if (! element)
+			goto error;
+
+		element->item0 = nih_strdup (element, mem_category_name (i));
+		if (! element->item0)
+			goto error;
+
+		element->item1 = usage[i].objects;
+		element->item2 = usage[i].bytes;
+
+		list[i] = element;
 	}
 
-	nih_debug ("set cgroup manager address");
+	list[MEM_CATEGORIES] = NULL;
+	*categories = list;
 
-	if (! job_class_induct_jobs ()) {
+	*allocated = pool_stats.used;
+	*allocated_bytes = pool_stats.used_bytes;
+	*cached = pool_stats.cached;
+	*cached_bytes = pool_stats.cached_bytes;
+
+	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
+}
+
+
+/**
+ * control_get_dependency_graph:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @ignored_events: events to treat as emitted although no job does,
+ * @warn: whether an unknown event or job on either side of an "or" is
+ *  an error,
+ * @emits: pointer for array of events emitted,
+ * @consumes: pointer for array of events named by conditions,
+ * @unreachable: pointer for array of unknown events and jobs.
+ *
+ * Implements the GetDependencyGraph method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to obtain, in one reply, the graph of the job classes visible
+ * to the caller: each event pattern named by the emits stanza of a
+ * class, as (class, event); each event named by the start on and stop on
+ * conditions of a class, as (class, condition, event, job) where job is
+ * the job named by a job event or the empty string; and each event or
+ * job named by a condition that nothing emits or defines, as (class,
+ * condition, "event" or "job", name).
+ *
+ * Events emitted by the init daemon itself and those in @ignored_events
+ * are always known.  Only the first part of each condition that cannot
+ * be satisfied is reported, in the order initctl check-config has always
+ * shown them.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_dependency_graph (void                                          *data,
+			      NihDBusMessage                                *message,
+			      char * const                                  *ignored_events,
+			      int                                            warn,
+			      ControlGetDependencyGraphEmitsElement       ***emits,
+			      ControlGetDependencyGraphConsumesElement    ***consumes,
+			      ControlGetDependencyGraphUnreachableElement ***unreachable)
+{
+	nih_local ControlGraph *graph = NULL;
+	size_t                  emits_len = 0;
+	size_t                  consumes_len = 0;
+	size_t                  unreachable_len = 0;
+
+	nih_assert (message != NULL);
+	nih_assert (ignored_events != NULL);
+	nih_assert (emits != NULL);
+	nih_assert (consumes != NULL);
+	nih_assert (unreachable != NULL);
+
+	job_class_init ();
+
+	conf_lazy_load_all ();
+
+	*emits = NULL;
+	*consumes = NULL;
+	*unreachable = NULL;
+
+	graph = control_graph_new (NULL, session_from_dbus (NULL, message),
+				   ignored_events, warn);
+	if (! graph)
+		goto error;
+
+	*emits = nih_alloc (message, sizeof (ControlGetDependencyGraphEmitsElement *));
+	*consumes = nih_alloc (message, sizeof (ControlGetDependencyGraphConsumesElement *));
+	*unreachable = nih_alloc (message, sizeof (ControlGetDependencyGraphUnreachableElement *));
+	if ((! *emits) || (! *consumes) || (! *unreachable))
+		goto error;
+
+	(*emits)[0] = NULL;
+	(*consumes)[0] = NULL;
+	(*unreachable)[0] = NULL;
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		if (! control_graph_visible (graph, class))
+			continue;
+
+		for (char **e = class->emits; e && *e; e++) {
+			ControlGetDependencyGraphEmitsElement *element;
+
+			element = control_graph_add ((void ***)emits, &emits_len,
+						     sizeof (ControlGetDependencyGraphEmitsElement));
+			if (! element)
+				goto error;
+
+			element->item0 = nih_strdup (element, class->name);
+			element->item1 = nih_strdup (element, *e);
+			if ((! element->item0) || (! element->item1))
+				goto error;
+		}
+
+		for (int stop = FALSE; stop <= TRUE; stop++) {
+			EventOperator *root = stop ? class->stop_on : class->start_on;
+			const char    *condition = stop ? "stop on" : "start on";
+			EventOperator *failed;
+
+			if (! root)
+				continue;
+
+			NIH_TREE_FOREACH_POST (&root->node, o_iter) {
+				EventOperator                            *oper = (EventOperator *)o_iter;
+				ControlGetDependencyGraphConsumesElement *element;
+				const char                               *job;
+
+				if (oper->type != EVENT_MATCH)
+					continue;
+
+				job = control_graph_job (oper);
+
+				element = control_graph_add ((void ***)consumes, &consumes_len,
+							     sizeof (ControlGetDependencyGraphConsumesElement));
+				if (! element)
+					goto error;
+
+				element->item0 = nih_strdup (element, class->name);
+				element->item1 = nih_strdup (element, condition);
+				element->item2 = nih_strdup (element, oper->name);
+				element->item3 = nih_strdup (element, job ? job : "");
+				if ((! element->item0) || (! element->item1)
+				    || (! element->item2) || (! element->item3))
+					goto error;
+			}
+
+			failed = control_graph_failed (graph, root, TRUE);
+			if (! failed)
+				continue;
+
+			if (control_graph_report (graph, failed, class->name,
+						  condition, unreachable,
+						  &unreachable_len) < 0)
+				goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	if (*emits)
+		nih_free (*emits);
+	if (*consumes)
+		nih_free (*consumes);
+	if (*unreachable)
+		nih_free (*unreachable);
+
+	nih_return_no_memory_error (-1);
+}
+
+/**
+ * control_graph_new:
+ * @parent: parent object for new graph,
+ * @session: session of caller,
+ * @ignored_events: events to treat as known,
+ * @warn: whether both sides of an "or" must be known.
+ *
+ * Collect the names of the job classes visible to @session and the
+ * events they emit, so that each event and job named by a condition can
+ * be looked up in turn.
+ *
+ * Returns: new graph, or NULL on insufficient memory.
+ **/
+static ControlGraph *
+control_graph_new (const void   *parent,
+		   Session      *session,
+		   char * const *ignored_events,
+		   int           warn)
+{
+	ControlGraph *graph;
+	size_t        globs_len = 0;
+
+	nih_assert (ignored_events != NULL);
+
+	graph = nih_new (parent, ControlGraph);
+	if (! graph)
+		return NULL;
+
+	graph->session = session;
+	graph->ignored = ignored_events;
+	graph->warn = warn;
+
+	graph->jobs = nih_hash_string_new (graph, 0);
+	graph->events = nih_hash_string_new (graph, 0);
+	graph->globs = nih_str_array_new (graph);
+	if ((! graph->jobs) || (! graph->events) || (! graph->globs))
+		goto error;
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass     *class = (JobClass *)iter;
+		NihListEntry *entry;
+
+		if (! control_graph_visible (graph, class))
+			continue;
+
+		entry = nih_list_entry_new (graph->jobs);
+		if (! entry)
+			goto error;
+
+		entry->str = class->name;
+		nih_hash_add (graph->jobs, &entry->entry);
+
+		for (char **e = class->emits; e && *e; e++) {
+			if (strpbrk (*e, "*?[")) {
+				if (! nih_str_array_add (&graph->globs, graph,
+							 &globs_len, *e))
+					goto error;
+
+				continue;
+			}
+
+			entry = nih_list_entry_new (graph->events);
+			if (! entry)
+				goto error;
+
+			entry->str = *e;
+			nih_hash_add (graph->events, &entry->entry);
+		}
+	}
+
+	return graph;
+
+error:
+	nih_free (graph);
+	return NULL;
+}
+
+/**
+ * control_graph_visible:
+ * @graph: graph being built,
+ * @class: job class to check.
+ *
+ * Returns: TRUE if @class is visible to the session of @graph, as for
+ * the GetAllJobs method, FALSE otherwise.
+ **/
+static int
+control_graph_visible (ControlGraph *graph,
+		       JobClass     *class)
+{
+	nih_assert (graph != NULL);
+	nih_assert (class != NULL);
+
+	if ((class->session || (graph->session && graph->session->chroot))
+	    && (class->session != graph->session))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * control_graph_job:
+ * @oper: EVENT_MATCH operator.
+ *
+ * Returns: name of the job matched by @oper when it matches one of the
+ * job events, given either as JOB=NAME or as its first positional
+ * value, or NULL.
+ **/
+static const char *
+control_graph_job (EventOperator *oper)
+{
+	nih_assert (oper != NULL);
+	nih_assert (oper->type == EVENT_MATCH);
+
+	if (strcmp (oper->name, JOB_STARTING_EVENT)
+	    && strcmp (oper->name, JOB_STARTED_EVENT)
+	    && strcmp (oper->name, JOB_STOPPING_EVENT)
+	    && strcmp (oper->name, JOB_STOPPED_EVENT))
+		return NULL;
+
+	for (size_t i = 0; oper->env && oper->env[i]; i++) {
+		if (! strncmp (oper->env[i], "JOB=", 4))
+			return oper->env[i] + 4;
+
+		if ((i == 0) && (! strchr (oper->env[i], '=')))
+			return oper->env[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * control_graph_event_known:
+ * @graph: graph being built,
+ * @name: name of event.
+ *
+ * Returns: TRUE if @name is emitted by the init daemon itself, by a job
+ * visible in @graph or is ignored, FALSE otherwise.
+ **/
+static int
+control_graph_event_known (ControlGraph *graph,
+			   const char   *name)
+{
+	nih_assert (graph != NULL);
+	nih_assert (name != NULL);
+
+	if ((! strcmp (name, STARTUP_EVENT))
+	    || (! strcmp (name, "startup"))
+	    || (! strcmp (name, "debug"))
+	    || (! strcmp (name, CTRLALTDEL_EVENT))
+	    || (! strcmp (name, KBDREQUEST_EVENT))
+	    || (! strcmp (name, PWRSTATUS_EVENT))
+	    || (! strcmp (name, TIMER_EVENT))
+	    || (! strcmp (name, CALENDAR_EVENT))
+	    || (! strcmp (name, PRESSURE_EVENT))
+	    || (! strcmp (name, JOB_STARTING_EVENT))
+	    || (! strcmp (name, JOB_STARTED_EVENT))
+	    || (! strcmp (name, JOB_STOPPING_EVENT))
+	    || (! strcmp (name, JOB_STOPPED_EVENT))
+	    || (user_mode && (! strcmp (name, SESSION_END_EVENT))))
+		return TRUE;
+
+	if (nih_hash_lookup (graph->events, name))
+		return TRUE;
+
+	for (char **glob = graph->globs; *glob; glob++)
+		if (! fnmatch (*glob, name, 0))
+			return TRUE;
+
+	for (char * const *e = graph->ignored; *e; e++)
+		if (! strcmp (*e, name))
+			return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * control_graph_job_known:
+ * @graph: graph being built,
+ * @name: name of job, or NULL.
+ *
+ * Returns: TRUE if @name is NULL, names a job class visible in @graph or
+ * is a variable reference, FALSE otherwise.
+ **/
+static int
+control_graph_job_known (ControlGraph *graph,
+			 const char   *name)
+{
+	nih_assert (graph != NULL);
+
+	if ((! name) || (name[0] == '$'))
+		return TRUE;
+
+	return nih_hash_lookup (graph->jobs, name) != NULL;
+}
+
+/**
+ * control_graph_satisfied:
+ * @graph: graph being built,
+ * @oper: operator to check.
+ *
+ * Returns: TRUE if the events and jobs named by @oper and its children
+ * are known well enough for it to be satisfied, FALSE otherwise.  When
+ * warn is set for @graph, both sides of an "or" must be known.
+ **/
+static int
+control_graph_satisfied (ControlGraph  *graph,
+			 EventOperator *oper)
+{
+	EventOperator *left, *right;
+
+	nih_assert (graph != NULL);
+	nih_assert (oper != NULL);
+
+	if (oper->type == EVENT_MATCH)
+		return (control_graph_event_known (graph, oper->name)
+			&& control_graph_job_known (graph,
+						    control_graph_job (oper)));
+
+	left = (EventOperator *)oper->node.left;
+	right = (EventOperator *)oper->node.right;
+
+	if ((oper->type == EVENT_AND) || graph->warn)
+		return (control_graph_satisfied (graph, left)
+			&& control_graph_satisfied (graph, right));
+
+	return (control_graph_satisfied (graph, left)
+		|| control_graph_satisfied (graph, right));
+}
+
+/**
+ * control_graph_failed:
+ * @graph: graph being built,
+ * @oper: operator to check,
+ * @root: TRUE if @oper is the root of its condition.
+ *
+ * Find the first operator, right side first, of @oper that cannot be
+ * satisfied; the root itself is the only EVENT_MATCH operator returned.
+ *
+ * Returns: operator that cannot be satisfied, or NULL.
+ **/
+static EventOperator *
+control_graph_failed (ControlGraph  *graph,
+		      EventOperator *oper,
+		      int            root)
+{
+	EventOperator *failed;
+
+	nih_assert (graph != NULL);
+	nih_assert (oper != NULL);
+
+	if ((oper->type == EVENT_MATCH) && (! root))
+		return NULL;
+
+	if (! control_graph_satisfied (graph, oper))
+		return oper;
+
+	if (oper->type == EVENT_MATCH)
+		return NULL;
+
+	failed = control_graph_failed (graph,
+				       (EventOperator *)oper->node.right, FALSE);
+	if (failed)
+		return failed;
+
+	return control_graph_failed (graph,
+				     (EventOperator *)oper->node.left, FALSE);
+}
+
+/**
+ * control_graph_report:
+ * @graph: graph being built,
+ * @oper: operator that cannot be satisfied,
+ * @class_name: name of job class,
+ * @condition: name of condition,
+ * @unreachable: pointer to array of unknown events and jobs,
+ * @len: pointer to length of @unreachable.
+ *
+ * Append each unknown event and job named by @oper and its children,
+ * right side first, to @unreachable.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+static int
+control_graph_report (ControlGraph                                  *graph,
+		      EventOperator                                 *oper,
+		      const char                                    *class_name,
+		      const char                                    *condition,
+		      ControlGetDependencyGraphUnreachableElement ***unreachable,
+		      size_t                                        *len)
+{
+	const char *job;
+
+	nih_assert (graph != NULL);
+	nih_assert (oper != NULL);
+	nih_assert (class_name != NULL);
+	nih_assert (condition != NULL);
+	nih_assert (unreachable != NULL);
+	nih_assert (len != NULL);
+
+	if (oper->type != EVENT_MATCH) {
+		if (control_graph_report (graph, (EventOperator *)oper->node.right,
+					  class_name, condition,
+					  unreachable, len) < 0)
+			return -1;
+
+		return control_graph_report (graph, (EventOperator *)oper->node.left,
+					     class_name, condition,
+					     unreachable, len);
+	}
+
+	job = control_graph_job (oper);
+
+	for (int is_job = FALSE; is_job <= TRUE; is_job++) {
+		ControlGetDependencyGraphUnreachableElement *element;
+
+		if (is_job ? control_graph_job_known (graph, job)
+		    : control_graph_event_known (graph, oper->name))
+			continue;
+
+		element = control_graph_add ((void ***)unreachable, len,
+					     sizeof (ControlGetDependencyGraphUnreachableElement));
+		if (! element)
+			return -1;
+
+		element->item0 = nih_strdup (element, class_name);
+		element->item1 = nih_strdup (element, condition);
+		element->item2 = nih_strdup (element, is_job ? "job" : "event");
+		element->item3 = nih_strdup (element, is_job ? job : oper->name);
+		if ((! element->item0) || (! element->item1)
+		    || (! element->item2) || (! element->item3))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * control_graph_add:
+ * @list: pointer to NULL-terminated array of elements,
+ * @len: pointer to length of @list,
+ * @size: size of element.
+ *
+ * Extend @list by a new element of @size bytes, allocated as a child of
+ * @list.
+ *
+ * Returns: new element, or NULL on insufficient memory.
+ **/
+static void *
+control_graph_add (void   ***list,
+		   size_t   *len,
+		   size_t    size)
+{
+	void **new_list;
+	void  *element;
+
+	nih_assert (list != NULL);
+	nih_assert (*list != NULL);
+	nih_assert (len != NULL);
+
+	new_list = nih_realloc (*list, NULL, sizeof (void *) * (*len + 2));
+	if (! new_list)
+		return NULL;
+
+	*list = new_list;
+
+	element = nih_alloc (*list, size);
+	if (! element)
+		return NULL;
+
+	memset (element, 0, size);
+
+	(*list)[(*len)++] = element;
+	(*list)[*len] = NULL;
+
+	return element;
+}
+
+/**
+ * control_get_version:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @version: pointer for reply string.
+ *
+ * Implements the get method for the version property of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to obtain the version of the init daemon, which will be stored
+ * as a string in @version.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_version (void *          data,
+		     NihDBusMessage *message,
+		     char **         version)
+{
+	nih_assert (message != NULL);
+	nih_assert (version != NULL);
+
+	*version = nih_strdup (message, package_string);
+	if (! *version)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
+/**
+ * control_get_log_priority:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @log_priority: pointer for reply string.
+ *
+ * Implements the get method for the log_priority property of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to obtain the init daemon's current logging level, which will
+ * be stored as a string in @log_priority.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_log_priority (void *          data,
+			  NihDBusMessage *message,
+			  char **         log_priority)
+{
+	const char *priority;
+
+	nih_assert (message != NULL);
+	nih_assert (log_priority != NULL);
+
+	switch (nih_log_priority) {
+	case NIH_LOG_DEBUG:
+		priority = "debug";
+		break;
+	case NIH_LOG_INFO:
+		priority = "info";
+		break;
+	case NIH_LOG_MESSAGE:
+		priority = "message";
+		break;
+	case NIH_LOG_WARN:
+		priority = "warn";
+		break;
+	case NIH_LOG_ERROR:
+		priority = "error";
+		break;
+	case NIH_LOG_FATAL:
+		priority = "fatal";
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	*log_priority = nih_strdup (message, priority);
+	if (! *log_priority)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
+/**
+ * control_set_log_priority:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @log_priority: string log priority to be set.
+ *
+ * Implements the get method for the log_priority property of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to change the init daemon's current logging level to that given
+ * as a string in @log_priority.  If the string is not recognised, the
+ * com.ubuntu.Upstart.Error.InvalidLogPriority error will be returned.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_set_log_priority (void *          data,
+			  NihDBusMessage *message,
+			  const char *    log_priority)
+{
+	nih_assert (message != NULL);
+	nih_assert (log_priority != NULL);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to set log priority"));
+		return -1;
+	}
+
+	if (! strcmp (log_priority, "debug")) {
+		nih_log_set_priority (NIH_LOG_DEBUG);
+
+	} else if (! strcmp (log_priority, "info")) {
+		nih_log_set_priority (NIH_LOG_INFO);
+
+	} else if (! strcmp (log_priority, "message")) {
+		nih_log_set_priority (NIH_LOG_MESSAGE);
+
+	} else if (! strcmp (log_priority, "warn")) {
+		nih_log_set_priority (NIH_LOG_WARN);
+
+	} else if (! strcmp (log_priority, "error")) {
+		nih_log_set_priority (NIH_LOG_ERROR);
+
+	} else if (! strcmp (log_priority, "fatal")) {
+		nih_log_set_priority (NIH_LOG_FATAL);
+
+	} else {
+		nih_dbus_error_raise (DBUS_ERROR_INVALID_ARGS,
+				      _("The log priority given was not recognised"));
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * control_get_log_unflushed_dropped:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @dropped: pointer for reply value.
+ *
+ * Implements the get method for the log_unflushed_dropped property of
+ * the com.ubuntu.Upstart interface.
+ *
+ * Called to obtain the number of bytes of job output discarded since
+ * it could not be written to disk before the unflushed data limits
+ * were reached, which will be stored in @dropped.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_log_unflushed_dropped (void *          data,
+				   NihDBusMessage *message,
+				   uint64_t *      dropped)
+{
+	nih_assert (message != NULL);
+	nih_assert (dropped != NULL);
+
+	*dropped = log_unflushed_dropped;
+
+	return 0;
+}
+
+/**
+ * control_get_bus_type:
+ *
+ * Determine D-Bus bus type to connect to.
+ *
+ * Returns: Type of D-Bus bus to connect to.
+ **/
+DBusBusType
+control_get_bus_type (void)
+{
+	return (use_session_bus || user_mode) 
+		? DBUS_BUS_SESSION
+		: DBUS_BUS_SYSTEM;
+}
+
+/**
+ * control_notify_disk_writeable:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ *
+ * Implements the NotifyDiskWriteable method of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to flush the job logs for all jobs that ended before the log
+ * disk became writeable.
+ *
+ * Notes: Session Inits are permitted to make this call. In the common
+ * case of starting a Session Init as a child of a Display Manager this
+ * is somewhat meaningless, but it does mean that if a Session Init were
+ * started from a system job, behaviour would be as expected.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_notify_disk_writeable (void   *data,
+		     NihDBusMessage *message)
+{
+	int       ret;
+	Session  *session;
+
+	nih_assert (message != NULL);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to notify disk is writeable"));
+		return -1;
+	}
+
+	/* Get the relevant session */
+	session = session_from_dbus (NULL, message);
+
+	/* "nop" when run from a chroot */
+	if (session && session->chroot)
+		return 0;
+
+	ret = log_clear_unflushed ();
+
+	if (ret < 0) {
+		nih_error_raise_system ();
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * control_notify_dbus_address:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @address: Address of D-Bus to connect to.
+ *
+ * Implements the NotifyDBusAddress method of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to allow the Session Init to connect to the D-Bus
+ * Session Bus when available.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_notify_dbus_address (void            *data,
+			     NihDBusMessage  *message,
+			     const char      *address)
+{
+	nih_assert (message);
+	nih_assert (address);
+
+	if (getpid () == 1) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("Not permissible to notify D-Bus address for PID 1"));
+		return -1;
+	}
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to notify D-Bus address"));
+		return -1;
+	}
+
+	/* Ignore as already connected */
+	if (control_bus)
+		return 0;
+
+	control_bus_address = nih_strdup (NULL, address);
+	if (! control_bus_address) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
+				_("Out of Memory"));
+		return -1;
+	}
+
+	if (control_bus_open () < 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * control_notify_cgroup_manager_address:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @address: D-Bus address that cgroup manager is connected to.
+ *
+ * Implements the NotifyCGroupManagerAddress method of the
+ * com.ubuntu.Upstart interface.
+ *
+ * Called to allow the cgroup manager to be contacted,
+ * thus enabling the cgroup stanza.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_notify_cgroup_manager_address (void            *data,
+				       NihDBusMessage  *message,
+				       const char      *address)
+{
+	nih_assert (message);
+	nih_assert (address);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to notify cgroup manager address"));
+		return -1;
+	}
+
+#ifdef ENABLE_CGROUPS
+	if (! cgroup_support_enabled ())
+		return 0;
+
+	/* Already called */
+	if (cgroup_manager_available ())
+		return 0;
+
+	if (! cgroup_manager_set_address (address)) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
+				_("Out of Memory"));
+		return -1;
+	}
+
+	nih_debug ("set cgroup manager address");
+
+	if (! job_class_induct_jobs ()) {
 		nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
 				_("Out of Memory"));
 		return -1;
 	}
 
-#else
-	nih_debug ("cgroup support not available");
-#endif /* ENABLE_CGROUPS */
+#else
+	nih_debug ("cgroup support not available");
+#endif /* ENABLE_CGROUPS */
+
+	return 0;
+}
+
+/**
+ * control_bus_flush:
+ *
+ * Drain any remaining messages in the D-Bus queue.
+ **/
+static void
+control_bus_flush (void)
+{
+	control_init ();
+
+	if (! control_bus)
+		return;
+
+	while (dbus_connection_dispatch (control_bus) == DBUS_DISPATCH_DATA_REMAINS)
+		;
+}
+
+/**
+ * control_prepare_reexec:
+ *
+ * Prepare for a re-exec by allowing the bus connection to be retained
+ * over re-exec and clearing all queued messages.
+ **/
+void
+control_prepare_reexec (void)
+{
+	control_init ();
+
+	/* Necessary to disallow further commands but also to allow the
+	 * new instance to open the control server.
+	 */
+	if (control_server)
+		control_server_close ();
+
+	control_bus_flush ();
+
+}
+
+
+/**
+ * control_conn_index_new:
+ *
+ * @parent: parent object for new index.
+ *
+ * StateIndexBuilder for the list of control connections.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+static StateIndex *
+control_conn_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	nih_assert (control_conns);
+
+	index = NIH_MUST (state_index_new (parent));
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+
+		NIH_MUST (state_index_add (index, entry->data));
+	}
+
+	return index;
+}
+
+/**
+ * control_conn_to_index:
+ *
+ * @connection: D-Bus connection.
+ *
+ * Convert a control (DBusConnection) connection to an index number
+ * the list of control connections.
+ *
+ * Returns: connection index, or -1 on error.
+ **/
+int
+control_conn_to_index (const DBusConnection *connection)
+{
+	int conn_index = 0;
+	int found = FALSE;
+
+	nih_assert (connection);
+
+	if (state_context)
+		return state_context_get (&state_context->conns,
+					  control_conn_index_new, connection);
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry    *entry = (NihListEntry *)iter;
+		DBusConnection  *conn = (DBusConnection *)entry->data;
+
+		if (connection == conn) {
+			found = TRUE;
+			break;
+		}
+
+		conn_index++;
+	}
+	if (! found)
+		return -1;
+
+	return conn_index;
+}
+
+/**
+ * control_conn_from_index:
+ *
+ * @conn_index: control connection index number.
+ *
+ * Lookup control connection based on index number.
+ *
+ * Returns: existing connection on success, or NULL if connection
+ * not found.
+ **/
+DBusConnection *
+control_conn_from_index (int conn_index)
+{
+	int i = 0;
+
+	nih_assert (conn_index >= 0);
+	nih_assert (control_conns);
+
+	if (state_context)
+		return state_context_lookup (&state_context->conns,
+					     control_conn_index_new,
+					     conn_index);
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry    *entry = (NihListEntry *)iter;
+		DBusConnection  *conn = (DBusConnection *)entry->data;
+
+		if (i == conn_index)
+			return conn;
+		i++;
+	}
+
+	return NULL;
+}
+
+/**
+ * control_bus_release_name:
+ *
+ * Unregister well-known D-Bus name.
+ *
+ * Returns: 0 on success, -1 on raised error.
+ **/
+int
+control_bus_release_name (void)
+{
+	DBusError  error;
+	int        ret;
+
+	if (! control_bus)
+		return 0;
+
+	dbus_error_init (&error);
+	ret = dbus_bus_release_name (control_bus,
+				     DBUS_SERVICE_UPSTART,
+				     &error);
+	if (ret < 0) {
+		nih_dbus_error_raise (error.name, error.message);
+		dbus_error_free (&error);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * control_get_state:
+ *
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @state: output string returned to client.
+ *
+ * Convert internal state to JSON string.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_get_state (void           *data,
+		   NihDBusMessage  *message,
+		   char           **state)
+{
+	Session  *session;
+	size_t    len;
+
+	nih_assert (message);
+	nih_assert (state);
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to request state"));
+		return -1;
+	}
+
+	/* Get the relevant session */
+	session = session_from_dbus (NULL, message);
+
+	/* We don't want chroot sessions snooping outside their domain.
+	 *
+	 * Ideally, we'd allow them to query their own session, but the
+	 * current implementation doesn't lend itself to that.
+	 */
+	if (session && session->chroot) {
+		nih_warn (_("Ignoring state query from chroot session"));
+		return 0;
+	}
+
+	if (state_to_string (state, &len) < 0)
+		goto error;
+
+	nih_ref (*state, message);
 
 	return 0;
+
+error:
+	nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
+			_("Out of Memory"));
+	return -1;
 }
 
 /**
- * control_bus_flush:
+ * control_restart:
  *
- * Drain any remaining messages in the D-Bus queue.
+ * @data: not used,
+ * @message: D-Bus connection and message received.
+ *
+ * Implements the Restart method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to request that Upstart performs a stateful re-exec.
+ *
+ * Returns: zero on success, negative value on raised error.
  **/
-static void
-control_bus_flush (void)
+int
+control_restart (void           *data,
+		 NihDBusMessage *message)
 {
-	control_init ();
+	Session  *session;
 
-	if (! control_bus)
-		return;
+	nih_assert (message != NULL);
 
-	while (dbus_connection_dispatch (control_bus) == DBUS_DISPATCH_DATA_REMAINS)
-		;
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to request restart"));
+		return -1;
+	}
+
+	/* Get the relevant session */
+	session = session_from_dbus (NULL, message);
+
+	/* Chroot sessions must not be able to influence
+	 * the outside system.
+	 *
+	 * Making this a NOP is safe since it is the Upstart outside the
+	 * chroot which manages all chroot jobs.
+	 */
+	if (session && session->chroot) {
+		nih_warn (_("Ignoring restart request from chroot session"));
+		return 0;
+	}
+
+	nih_info (_("Restarting"));
+
+	stateful_reexec ();
+
+	return 0;
 }
 
 /**
- * control_prepare_reexec:
+ * control_notify_event_emitted
  *
- * Prepare for a re-exec by allowing the bus connection to be retained
- * over re-exec and clearing all queued messages.
+ * @event: Event.
+ *
+ * Re-emits an event over DBUS using the EventEmitted signal
  **/
 void
-control_prepare_reexec (void)
+control_notify_event_emitted (Event *event)
 {
-	control_init ();
+	nih_assert (event != NULL);
 
-	/* Necessary to disallow further commands but also to allow the
-	 * new instance to open the control server.
-	 */
-	if (control_server)
-		control_server_close ();
+	control_notify_event (event->name, event->env);
+}
 
-	control_bus_flush ();
+/**
+ * control_notify_event:
+ *
+ * @name: name of event,
+ * @env: environment of event.
+ *
+ * Sends the EventEmitted signal for an event that need not be queued
+ * since nothing is affected by it.
+ **/
+void
+control_notify_event (const char   *name,
+		      char * const *env)
+{
+	nih_assert (name != NULL);
 
-}
+	control_init ();
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry   *entry = (NihListEntry *)iter;
+		DBusConnection *conn = (DBusConnection *)entry->data;
 
+		NIH_ZERO (control_emit_event_emitted (conn, DBUS_PATH_UPSTART,
+							    name, env));
+	}
+}
 
 /**
- * control_conn_to_index:
- *
- * @connection: D-Bus connection.
+ * control_notify_event_finished
  *
- * Convert a control (DBusConnection) connection to an index number
- * the list of control connections.
+ * @event: Event.
  *
- * Returns: connection index, or -1 on error.
+ * Sends the EventFinished signal for an event emitted with the
+ * EmitEventAsync method.
  **/
-int
-control_conn_to_index (const DBusConnection *connection)
+void
+control_notify_event_finished (Event *event)
 {
-	int conn_index = 0;
-	int found = FALSE;
+	nih_assert (event != NULL);
 
-	nih_assert (connection);
+	control_init ();
 
 	NIH_LIST_FOREACH (control_conns, iter) {
-		NihListEntry    *entry = (NihListEntry *)iter;
-		DBusConnection  *conn = (DBusConnection *)entry->data;
+		NihListEntry   *entry = (NihListEntry *)iter;
+		DBusConnection *conn = (DBusConnection *)entry->data;
+
+		NIH_ZERO (control_emit_event_finished (conn, DBUS_PATH_UPSTART,
+							     event->id,
+							     event->name,
+							     event->failed));
+	}
+}
+
+/**
+ * control_notify_restarted
+ *
+ * DBUS signal sent when upstart has re-executed itself.
+ **/
+void
+control_notify_restarted (void)
+{
+	control_init ();
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry   *entry = (NihListEntry *)iter;
+		DBusConnection *conn = (DBusConnection *)entry->data;
+
+		NIH_ZERO (control_emit_restarted (conn, DBUS_PATH_UPSTART));
+	}
+}
+
+/**
+ * control_change_type_name:
+ * @type: kind of change.
+ *
+ * Returns: string giving @type in the change feed.
+ **/
+static const char *
+control_change_type_name (ControlChangeType type)
+{
+	switch (type) {
+	case CONTROL_CHANGE_JOB_ADDED:
+		return "job-added";
+	case CONTROL_CHANGE_JOB_REMOVED:
+		return "job-removed";
+	case CONTROL_CHANGE_INSTANCE_ADDED:
+		return "instance-added";
+	case CONTROL_CHANGE_INSTANCE_REMOVED:
+		return "instance-removed";
+	case CONTROL_CHANGE_STATUS:
+		return "status";
+	default:
+		nih_assert_not_reached ();
+		return NULL;
+	}
+}
+
+/**
+ * control_change:
+ * @type: kind of change,
+ * @path: object path of job or instance,
+ * @goal: goal of instance,
+ * @state: state of instance.
+ *
+ * Records a change to a job or instance in the change feed, to be sent
+ * to subscribers by the next call to control_changes_flush().  @goal and
+ * @state are only given for CONTROL_CHANGE_STATUS and should otherwise
+ * be NULL.
+ *
+ * A status change replaces any earlier one for the same instance that
+ * has not yet been sent, so each batch carries only the latest status
+ * of an instance.
+ **/
+void
+control_change (ControlChangeType  type,
+		const char        *path,
+		const char        *goal,
+		const char        *state)
+{
+	ControlChange *change;
+
+	nih_assert (path != NULL);
+
+	control_init ();
+
+	if (type == CONTROL_CHANGE_STATUS) {
+		nih_assert (goal != NULL);
+		nih_assert (state != NULL);
+
+		for (NihList *iter = control_changes->prev;
+		     iter != control_changes; iter = iter->prev) {
+			ControlChange *old = (ControlChange *)iter;
+
+			if (old->seq <= control_change_sent)
+				break;
+
+			if (strcmp (old->path, path))
+				continue;
+
+			if (old->type == CONTROL_CHANGE_STATUS) {
+				nih_free (old);
+				control_changes_len--;
+			}
 
-		if (connection == conn) {
-			found = TRUE;
 			break;
 		}
-
-		conn_index++;
 	}
-	if (! found)
-		return -1;
 
-	return conn_index;
+	change = NIH_MUST (nih_new (control_changes, ControlChange));
+
+	nih_list_init (&change->entry);
+	nih_alloc_set_destructor (change, nih_list_destroy);
+
+	change->seq = ++control_change_seq;
+	change->type = type;
+	change->path = NIH_MUST (nih_strdup (change, path));
+	change->status = NULL;
+
+	if (type == CONTROL_CHANGE_STATUS)
+		change->status = NIH_MUST (nih_sprintf (change, "%s/%s",
+							 goal, state));
+
+	nih_list_add (control_changes, &change->entry);
+	control_changes_len++;
+
+	/* Discard the oldest changes once they have been sent */
+	while (control_changes_len > CONTROL_CHANGE_HISTORY) {
+		ControlChange *oldest = (ControlChange *)control_changes->next;
+
+		if (oldest->seq > control_change_sent)
+			break;
+
+		control_change_lost = oldest->seq;
+		nih_free (oldest);
+		control_changes_len--;
+	}
 }
 
 /**
- * control_conn_from_index:
- *
- * @conn_index: control connection index number.
+ * control_changes_message:
+ * @first: first change to include,
+ * @destination: unique name of recipient, or NULL.
  *
- * Lookup control connection based on index number.
+ * Builds a Changes signal carrying the change @first and all of those
+ * that follow it.
  *
- * Returns: existing connection on success, or NULL if connection
- * not found.
+ * Returns: new message or NULL if insufficient memory.
  **/
-DBusConnection *
-control_conn_from_index (int conn_index)
+static DBusMessage *
+control_changes_message (NihList    *first,
+			 const char *destination)
 {
-	int i = 0;
+	DBusMessage     *signal;
+	DBusMessageIter  iter;
+	DBusMessageIter  array;
 
-	nih_assert (conn_index >= 0);
-	nih_assert (control_conns);
+	nih_assert (first != NULL);
 
-	NIH_LIST_FOREACH (control_conns, iter) {
-		NihListEntry    *entry = (NihListEntry *)iter;
-		DBusConnection  *conn = (DBusConnection *)entry->data;
+	signal = dbus_message_new_signal (DBUS_PATH_UPSTART,
+					  DBUS_INTERFACE_UPSTART, "Changes");
+	if (! signal)
+		return NULL;
 
-		if (i == conn_index)
-			return conn;
-		i++;
+	if (destination && (! dbus_message_set_destination (signal, destination)))
+		goto error;
+
+	dbus_message_iter_init_append (signal, &iter);
+
+	if (! dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+						"(tsos)", &array))
+		goto error;
+
+	for (NihList *item = first; item != control_changes; item = item->next) {
+		ControlChange   *change = (ControlChange *)item;
+		DBusMessageIter  record;
+		dbus_uint64_t    seq = change->seq;
+		const char      *type = control_change_type_name (change->type);
+		const char      *status = change->status ? change->status : "";
+
+		if (! dbus_message_iter_open_container (&array, DBUS_TYPE_STRUCT,
+							NULL, &record))
+			goto error;
+
+		if ((! dbus_message_iter_append_basic (&record, DBUS_TYPE_UINT64, &seq))
+		    || (! dbus_message_iter_append_basic (&record, DBUS_TYPE_STRING, &type))
+		    || (! dbus_message_iter_append_basic (&record, DBUS_TYPE_OBJECT_PATH,
+							  &change->path))
+		    || (! dbus_message_iter_append_basic (&record, DBUS_TYPE_STRING, &status)))
+			goto error;
+
+		if (! dbus_message_iter_close_container (&array, &record))
+			goto error;
 	}
 
+	if (! dbus_message_iter_close_container (&iter, &array))
+		goto error;
+
+	return signal;
+
+error:
+	dbus_message_unref (signal);
 	return NULL;
 }
 
 /**
- * control_bus_release_name:
- *
- * Unregister well-known D-Bus name.
+ * control_changes_flush:
  *
- * Returns: 0 on success, -1 on raised error.
+ * Called once each time through the main loop to send the changes
+ * recorded since the last call to every subscriber of the change feed,
+ * as a single Changes signal addressed to each.
  **/
-int
-control_bus_release_name (void)
+void
+control_changes_flush (void)
 {
-	DBusError  error;
-	int        ret;
+	NihList *first;
 
-	if (! control_bus)
-		return 0;
+	control_init ();
 
-	dbus_error_init (&error);
-	ret = dbus_bus_release_name (control_bus,
-				     DBUS_SERVICE_UPSTART,
-				     &error);
-	if (ret < 0) {
-		nih_dbus_error_raise (error.name, error.message);
-		dbus_error_free (&error);
-		return -1;
+	/* Find the oldest change not yet sent */
+	first = control_changes;
+	while ((first->prev != control_changes)
+	       && (((ControlChange *)first->prev)->seq > control_change_sent))
+		first = first->prev;
+
+	if (first == control_changes)
+		return;
+
+	NIH_LIST_FOREACH (control_subscribers, iter) {
+		ControlSubscriber *subscriber = (ControlSubscriber *)iter;
+		DBusMessage       *signal;
+
+		signal = NIH_MUST (control_changes_message (first, subscriber->name));
+
+		NIH_ZERO (! dbus_connection_send (subscriber->conn, signal, NULL));
+
+		dbus_message_unref (signal);
 	}
 
-	return 0;
+	control_change_sent = control_change_seq;
+}
+
+/**
+ * control_subscriber_matches:
+ * @subscriber: subscriber to compare,
+ * @conn: connection of client,
+ * @name: unique bus name of client, or NULL.
+ *
+ * Returns: TRUE if @subscriber is the client on @conn with @name.
+ **/
+static int
+control_subscriber_matches (ControlSubscriber *subscriber,
+			    DBusConnection    *conn,
+			    const char        *name)
+{
+	nih_assert (subscriber != NULL);
+
+	if (subscriber->conn != conn)
+		return FALSE;
+
+	if (subscriber->name && name)
+		return ! strcmp (subscriber->name, name);
+
+	return subscriber->name == name;
 }
 
 /**
- * control_get_state:
- *
+ * control_subscribe_changes:
  * @data: not used,
  * @message: D-Bus connection and message received,
- * @state: output string returned to client.
+ * @seq: pointer for sequence number reply.
  *
- * Convert internal state to JSON string.
+ * Implements the SubscribeChanges method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called to have all subsequent changes to jobs and instances sent to the
+ * caller in batches by the Changes signal, rather than relying on the
+ * individual signals of each object.  The sequence number of the most
+ * recent change is stored in @seq, such that changes missed after a later
+ * reconnection may be obtained with GetChanges.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_get_state (void           *data,
-		   NihDBusMessage  *message,
-		   char           **state)
+control_subscribe_changes (void            *data,
+			   NihDBusMessage  *message,
+			   uint64_t        *seq)
 {
-	Session  *session;
-	size_t    len;
+	ControlSubscriber *subscriber;
+	const char        *name;
 
-	nih_assert (message);
-	nih_assert (state);
+	nih_assert (message != NULL);
+	nih_assert (seq != NULL);
 
-	if (! control_check_permission (message)) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to request state"));
-		return -1;
-	}
+	control_init ();
 
-	/* Get the relevant session */
-	session = session_from_dbus (NULL, message);
+	name = (message->message
+		? dbus_message_get_sender (message->message) : NULL);
 
-	/* We don't want chroot sessions snooping outside their domain.
-	 *
-	 * Ideally, we'd allow them to query their own session, but the
-	 * current implementation doesn't lend itself to that.
-	 */
-	if (session && session->chroot) {
-		nih_warn (_("Ignoring state query from chroot session"));
-		return 0;
+	*seq = control_change_seq;
+
+	NIH_LIST_FOREACH (control_subscribers, iter) {
+		subscriber = (ControlSubscriber *)iter;
+
+		if (control_subscriber_matches (subscriber, message->connection, name))
+			return 0;
 	}
 
-	if (state_to_string (state, &len) < 0)
-		goto error;
+	subscriber = nih_new (control_subscribers, ControlSubscriber);
+	if (! subscriber)
+		nih_return_no_memory_error (-1);
 
-	nih_ref (*state, message);
+	nih_list_init (&subscriber->entry);
+	nih_alloc_set_destructor (subscriber, nih_list_destroy);
 
-	return 0;
+	subscriber->conn = message->connection;
+	subscriber->name = NULL;
 
-error:
-	nih_dbus_error_raise_printf (DBUS_ERROR_NO_MEMORY,
-			_("Out of Memory"));
-	return -1;
+	if (name) {
+		subscriber->name = nih_strdup (subscriber, name);
+		if (! subscriber->name) {
+			nih_free (subscriber);
+			nih_return_no_memory_error (-1);
+		}
+	}
+
+	nih_list_add (control_subscribers, &subscriber->entry);
+
+	return 0;
 }
 
 /**
- * control_restart:
- *
+ * control_unsubscribe_changes:
  * @data: not used,
  * @message: D-Bus connection and message received.
  *
- * Implements the Restart method of the com.ubuntu.Upstart
+ * Implements the UnsubscribeChanges method of the com.ubuntu.Upstart
  * interface.
  *
- * Called to request that Upstart performs a stateful re-exec.
+ * Called to stop the Changes signal being sent to the caller.
  *
  * Returns: zero on success, negative value on raised error.
  **/
 int
-control_restart (void           *data,
-		 NihDBusMessage *message)
+control_unsubscribe_changes (void           *data,
+			     NihDBusMessage *message)
 {
-	Session  *session;
+	const char *name;
 
 	nih_assert (message != NULL);
 
-	if (! control_check_permission (message)) {
-		nih_dbus_error_raise_printf (
-			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
-			_("You do not have permission to request restart"));
-		return -1;
-	}
-
-	/* Get the relevant session */
-	session = session_from_dbus (NULL, message);
+	control_init ();
 
-	/* Chroot sessions must not be able to influence
-	 * the outside system.
-	 *
-	 * Making this a NOP is safe since it is the Upstart outside the
-	 * chroot which manages all chroot jobs.
-	 */
-	if (session && session->chroot) {
-		nih_warn (_("Ignoring restart request from chroot session"));
-		return 0;
-	}
+	name = (message->message
+		? dbus_message_get_sender (message->message) : NULL);
 
-	nih_info (_("Restarting"));
+	NIH_LIST_FOREACH_SAFE (control_subscribers, iter) {
+		ControlSubscriber *subscriber = (ControlSubscriber *)iter;
 
-	stateful_reexec ();
+		if (control_subscriber_matches (subscriber, message->connection, name))
+			nih_free (subscriber);
+	}
 
 	return 0;
 }
 
 /**
- * control_notify_event_emitted
+ * control_get_changes:
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @since: sequence number of last change known to caller,
+ * @seq: pointer for sequence number reply,
+ * @changes: pointer for array of changes reply.
  *
- * @event: Event.
+ * Implements the GetChanges method of the com.ubuntu.Upstart
+ * interface.
  *
- * Re-emits an event over DBUS using the EventEmitted signal
+ * Called to obtain the changes to jobs and instances made after the
+ * change with sequence number @since, which will be stored in @changes,
+ * along with the sequence number of the most recent change in @seq.
+ *
+ * If the changes are no longer known, because too many have been made
+ * since or init has been restarted, the ChangesLost error is raised and
+ * the caller should instead start again with GetAllJobs.
+ *
+ * Returns: zero on success, negative value on raised error.
  **/
-void
-control_notify_event_emitted (Event *event)
+int
+control_get_changes (void                               *data,
+		     NihDBusMessage                     *message,
+		     uint64_t                            since,
+		     uint64_t                           *seq,
+		     ControlGetChangesChangesElement  ***changes)
 {
-	nih_assert (event != NULL);
+	ControlGetChangesChangesElement **list;
+	size_t                            len = 0;
 
-	control_init ();
+	nih_assert (message != NULL);
+	nih_assert (seq != NULL);
+	nih_assert (changes != NULL);
 
-	NIH_LIST_FOREACH (control_conns, iter) {
-		NihListEntry   *entry = (NihListEntry *)iter;
-		DBusConnection *conn = (DBusConnection *)entry->data;
+	control_init ();
 
-		NIH_ZERO (control_emit_event_emitted (conn, DBUS_PATH_UPSTART,
-							    event->name, event->env));
+	if ((since < control_change_lost) || (since > control_change_seq)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.ChangesLost",
+			_("Changes since %llu are no longer known"),
+			(unsigned long long)since);
+		return -1;
 	}
-}
 
-/**
- * control_notify_restarted
- *
- * DBUS signal sent when upstart has re-executed itself.
- **/
-void
-control_notify_restarted (void)
-{
-	control_init ();
+	list = nih_alloc (message, sizeof (ControlGetChangesChangesElement *));
+	if (! list)
+		nih_return_no_memory_error (-1);
 
-	NIH_LIST_FOREACH (control_conns, iter) {
-		NihListEntry   *entry = (NihListEntry *)iter;
-		DBusConnection *conn = (DBusConnection *)entry->data;
+	list[0] = NULL;
 
-		NIH_ZERO (control_emit_restarted (conn, DBUS_PATH_UPSTART));
+	NIH_LIST_FOREACH (control_changes, iter) {
+		ControlChange                    *change = (ControlChange *)iter;
+		ControlGetChangesChangesElement  *element;
+		ControlGetChangesChangesElement **tmp;
+
+		if (change->seq <= since)
+			continue;
+
+		element = nih_new (list, ControlGetChangesChangesElement);
+		if (! element)
+			goto error;
+
+		element->item0 = change->seq;
+		element->item1 = nih_strdup (element, control_change_type_name (change->type));
+		element->item2 = nih_strdup (element, change->path);
+		element->item3 = nih_strdup (element, change->status ? change->status : "");
+		if (! (element->item1 && element->item2 && element->item3))
+			goto error;
+
+		tmp = nih_realloc (list, message,
+				   sizeof (ControlGetChangesChangesElement *) * (len + 2));
+		if (! tmp)
+			goto error;
+
+		list = tmp;
+		list[len++] = element;
+		list[len] = NULL;
 	}
+
+	*seq = control_change_seq;
+	*changes = list;
+
+	return 0;
+
+error:
+	nih_free (list);
+	nih_return_no_memory_error (-1);
 }
 
 /**
@@ -1343,11 +3425,13 @@ control_set_env_list (void            *data,
 		      char * const    *vars,
 		      int              replace)
 {
-	Session         *session;
-	Job             *job = NULL;
-	char            *job_name = NULL;
-	char            *instance = NULL;
-	char * const    *var;
+	Session          *session;
+	Job              *job = NULL;
+	char             *job_name = NULL;
+	char             *instance = NULL;
+	char * const     *var;
+	nih_local char  **envvars = NULL;
+	size_t            envvars_len = 0;
 
 	nih_assert (message);
 	nih_assert (job_details);
@@ -1395,10 +3479,15 @@ control_set_env_list (void            *data,
 	/* Lookup the job */
 	control_get_job (session, job, job_name, instance);
 
+	/* Check every variable before changing anything, so that the
+	 * request is applied either entirely or not at all.
+	 */
+	envvars = NIH_MUST (nih_str_array_new (NULL));
+
 	for (var = vars; var && *var; var++) {
 		nih_local char *envvar = NULL;
 
-		if (! *var) {
+		if ((! **var) || (**var == '=')) {
 			nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
 					_("Variable may not be empty string"));
 			return -1;
@@ -1417,53 +3506,60 @@ control_set_env_list (void            *data,
 			envvar = NIH_MUST (nih_strdup (NULL, *var));
 		}
 
-		if (job) {
-			/* Modify job-specific environment */
-			nih_assert (job->env);
+		NIH_MUST (nih_str_array_addp (&envvars, NULL, &envvars_len,
+					      envvar));
+	}
+
+	nih_assert (environ_all_valid (envvars));
+
+	if (! envvars_len)
+		return 0;
+
+	/* Merge all of the variables at once, which indexes the keys of
+	 * large tables rather than searching them for each variable.
+	 */
+	if (job) {
+		/* Modify job-specific environment */
+		nih_assert (job->env);
+
+		NIH_MUST (environ_append (&job->env, job, NULL, replace, envvars));
+
+		return 0;
+	}
+
+	if (job_class_environment_set_list (envvars, replace) < 0)
+		nih_return_no_memory_error (-1);
+
+	if (job_name == NULL && user_mode && control_bus) {
+		ControlDbusUpdateActivationEnvironmentVarsElement **dbus_vars = NULL;
+		NihDBusProxy *dbus_proxy = NULL;
+
+		dbus_vars = NIH_MUST (nih_alloc (NULL, sizeof (ControlDbusUpdateActivationEnvironmentVarsElement *) * (envvars_len + 1)));
+
+		for (size_t i = 0; i < envvars_len; i++) {
+			const char *value = strchr (envvars[i], '=');
+
+			dbus_vars[i] = NIH_MUST (nih_new (dbus_vars, ControlDbusUpdateActivationEnvironmentVarsElement));
+			dbus_vars[i]->item0 = NIH_MUST (nih_strndup (dbus_vars[i], envvars[i], value - envvars[i]));
+			dbus_vars[i]->item1 = NIH_MUST (nih_strdup (dbus_vars[i], value + 1));
+		}
+		dbus_vars[envvars_len] = NULL;
+
+		dbus_proxy = NIH_SHOULD (nih_dbus_proxy_new (dbus_vars, control_bus,
+			"org.freedesktop.DBus", "/org/freedesktop/DBus", NULL, NULL));
 
-			NIH_MUST (environ_add (&job->env, job, NULL, replace, envvar));
+		if (! dbus_proxy) {
+			nih_warn (_("Failed to get dbus_proxy"));
 		} else {
-			if (job_class_environment_set (envvar, replace) < 0) {
-				nih_return_no_memory_error (-1);
-			}
-			if (job_name == NULL && user_mode && control_bus ) {
-				ControlDbusUpdateActivationEnvironmentVarsElement **dbus_vars = NULL;
-				NihDBusProxy *dbus_proxy = NULL;
-				char ** split_vars = NULL;
-				dbus_vars = NIH_MUST (nih_alloc (NULL, sizeof (ControlDbusUpdateActivationEnvironmentVarsElement *) * 2));
-				dbus_vars[0] = NIH_MUST (nih_new (dbus_vars, ControlDbusUpdateActivationEnvironmentVarsElement));
-				dbus_vars[1] = NULL;
-				split_vars = NIH_MUST (nih_str_split (dbus_vars[0], envvar, "=", FALSE));
-				if (*split_vars && *split_vars[0]) {
-					dbus_vars[0]->item0 = *split_vars;
-				} else {
-					dbus_vars[0]->item0 = nih_strdup (dbus_vars[0], "");
-				}
-				if (*(split_vars+1) && *(split_vars+1)[0]) {
-					dbus_vars[0]->item1 = *(split_vars+1);
-				} else {
-					dbus_vars[0]->item1 = nih_strdup (dbus_vars[0], "");
-				}
-
-				dbus_proxy = NIH_SHOULD (nih_dbus_proxy_new (dbus_vars, control_bus,
-					"org.freedesktop.DBus", "/org/freedesktop/DBus", NULL, NULL));
-
-				if (! dbus_proxy) {
-					nih_warn (_("Failed to get dbus_proxy"));
-				} else {
-					if (control_dbus_update_activation_environment_sync (dbus_vars, dbus_proxy, dbus_vars) != 0) {
-						NihDBusError *dbus_err;
-						dbus_err = (NihDBusError *)nih_error_get ();
-						nih_error ("%s", dbus_err->message);
-						nih_free (dbus_err);
-						nih_warn ("dbus_vars[0] item0: %s", dbus_vars[0]->item0);
-						nih_warn ("dbus_vars[0] item1: %s", dbus_vars[0]->item1);
-						nih_warn (_("Failed to update DBus activation environment"));
-					}
-				}
-				nih_free(dbus_vars);
+			if (control_dbus_update_activation_environment_sync (dbus_vars, dbus_proxy, dbus_vars) != 0) {
+				NihDBusError *dbus_err;
+				dbus_err = (NihDBusError *)nih_error_get ();
+				nih_error ("%s", dbus_err->message);
+				nih_free (dbus_err);
+				nih_warn (_("Failed to update DBus activation environment"));
 			}
 		}
+		nih_free (dbus_vars);
 	}
 
 	return 0;
@@ -1586,31 +3682,35 @@ control_unset_env_list (void            *data,
 	/* Lookup the job */
 	control_get_job (session, job, job_name, instance);
 
+	/* Check every name before changing anything, so that the request
+	 * is applied either entirely or not at all.
+	 */
 	for (name = names; name && *name; name++) {
-		if (! *name) {
+		if (! **name) {
 			nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
 					_("Variable may not be empty string"));
 			return -1;
 		}
+	}
+
+	if (! *names)
+		return 0;
 
-		if (job) {
-			/* Modify job-specific environment */
-			nih_assert (job->env);
+	if (job) {
+		/* Modify job-specific environment */
+		nih_assert (job->env);
 
+		for (name = names; name && *name; name++)
 			if (! environ_remove (&job->env, job, NULL, *name))
 				return -1;
-		} else if (job_class_environment_unset (*name) < 0) {
-			goto error;
-		}
+	} else if (job_class_environment_unset_list (names) < 0) {
+		nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
+				"%s: %s",
+				_("No such variable"), *names);
+		return -1;
 	}
 
 	return 0;
-
-error:
-	nih_dbus_error_raise_printf (DBUS_ERROR_INVALID_ARGS,
-			"%s: %s",
-			_("No such variable"), *name);
-	return -1;
 }
 
 /**
@@ -1921,15 +4021,21 @@ control_reset_env (void           *data,
  * @message: D-Bus connection and message received,
  * @uid: returned uid value.
  *
+ * The unix user of a client on a private connection is that of the
+ * peer, obtained by libdbus when the connection was authenticated;
+ * that of a client on the bus must be requested from the bus, and is
+ * kept in control_credentials until the client leaves the bus.
+ *
  * Returns TRUE: if @uid now contains uid corresponding to @message,
  * else FALSE.
  **/
-static int
+int
 control_get_origin_uid (NihDBusMessage *message, uid_t *uid)
 {
-	DBusError       dbus_error;
-	unsigned long   unix_user = 0;
-	const char     *sender;
+	DBusError          dbus_error;
+	unsigned long      unix_user = 0;
+	const char        *sender;
+	ControlCredential *credential;
 
 	nih_assert (message);
 	nih_assert (uid);
@@ -1941,12 +4047,50 @@ control_get_origin_uid (NihDBusMessage *message, uid_t *uid)
 
 	sender = dbus_message_get_sender (message->message);
 	if (sender) {
+		control_init ();
+
+		credential = (ControlCredential *)nih_hash_lookup (
+			control_credentials, sender);
+		if (credential && (credential->conn == message->connection)) {
+			*uid = credential->uid;
+			return TRUE;
+		}
+
 		unix_user = dbus_bus_get_unix_user (message->connection, sender,
 						    &dbus_error);
 		if (unix_user == (unsigned long)-1) {
 			dbus_error_free (&dbus_error);
 			return FALSE;
 		}
+
+		if (credential) {
+			nih_free (credential);
+			control_credentials_len--;
+		}
+
+		if (control_credentials_len >= CONTROL_CREDENTIALS_MAX) {
+			NIH_HASH_FOREACH_SAFE (control_credentials, iter)
+				nih_free (iter);
+			control_credentials_len = 0;
+		}
+
+		/* Failing to keep the user only costs another request */
+		credential = nih_new (control_credentials, ControlCredential);
+		if (credential) {
+			nih_list_init (&credential->entry);
+			nih_alloc_set_destructor (credential, nih_list_destroy);
+
+			credential->conn = message->connection;
+			credential->uid = (uid_t)unix_user;
+			credential->name = nih_strdup (credential, sender);
+			if (credential->name) {
+				nih_hash_add (control_credentials,
+					      &credential->entry);
+				control_credentials_len++;
+			} else {
+				nih_free (credential);
+			}
+		}
 	} else {
 		if (! dbus_connection_get_unix_user (message->connection,
 						     &unix_user)) {
@@ -1996,6 +4140,51 @@ control_check_permission (NihDBusMessage *message)
 	return FALSE;
 }
 
+/**
+ * control_set_emitter:
+ * @event: event emitted,
+ * @message: D-Bus connection and message received.
+ *
+ * Attributes @event in the event history to the sender of @message: its
+ * unique name on a bus, or the name and pid of the peer process on a
+ * private connection.
+ **/
+static void
+control_set_emitter (Event          *event,
+		     NihDBusMessage *message)
+{
+	const char    *sender;
+	unsigned long  pid;
+	char           path[64];
+	char           comm[32] = "";
+	char           emitter[64];
+	FILE          *f;
+
+	nih_assert (event != NULL);
+	nih_assert (message != NULL);
+
+	sender = dbus_message_get_sender (message->message);
+	if (sender) {
+		event_set_emitter (event, sender);
+		return;
+	}
+
+	if (! dbus_connection_get_unix_process_id (message->connection, &pid))
+		return;
+
+	snprintf (path, sizeof (path), "/proc/%lu/comm", pid);
+	f = fopen (path, "re");
+	if (f) {
+		if (fgets (comm, sizeof (comm), f))
+			comm[strcspn (comm, "\n")] = '\0';
+		fclose (f);
+	}
+
+	snprintf (emitter, sizeof (emitter), "%s[%lu]", comm, pid);
+
+	event_set_emitter (event, emitter);
+}
+
 /**
  * control_session_file_create:
  *
@@ -2095,6 +4284,70 @@ control_end_session (void             *data,
 	return 0;
 }
 
+/**
+ * control_quiesce:
+ *
+ * @data: not used,
+ * @message: D-Bus connection and message received,
+ * @timeout: seconds allowed for all jobs to stop, or zero for the
+ * longest kill timeout of the running jobs.
+ *
+ * Implements the Quiesce method of the com.ubuntu.Upstart
+ * interface.
+ *
+ * Called by reboot(8) ahead of a fast reboot to request that the system
+ * init stop all jobs, in dependency order and in parallel, without
+ * running the shutdown scripts; the reply is sent once they have all
+ * stopped, or @timeout expires.  Unlike a Session Init, the system init
+ * keeps running afterwards.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+control_quiesce (void           *data,
+		 NihDBusMessage *message,
+		 int32_t         timeout)
+{
+	Session  *session;
+
+	nih_assert (message);
+
+	/* Session Inits end with EndSession */
+	if (user_mode) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.NotSupported",
+			_("Quiesce is only supported by the system init"));
+		return -1;
+	}
+
+	if (! control_check_permission (message)) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to quiesce"));
+		return -1;
+	}
+
+	/* Get the relevant session */
+	session = session_from_dbus (NULL, message);
+
+	if (session && session->chroot) {
+		nih_dbus_error_raise_printf (
+			DBUS_INTERFACE_UPSTART ".Error.PermissionDenied",
+			_("You do not have permission to quiesce"));
+		return -1;
+	}
+
+	if (timeout > 0)
+		quiesce_timeout = timeout;
+
+	quiesce (QUIESCE_REQUESTER_REBOOT);
+
+	if (quiesce_wait (message) < 0)
+		nih_return_no_memory_error (-1);
+
+	return 0;
+}
+
 /**
  * control_serialise_bus_address:
  *
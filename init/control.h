@@ -20,10 +20,13 @@
 #ifndef INIT_CONTROL_H
 #define INIT_CONTROL_H
 
+#include <stdint.h>
+
 #include <dbus/dbus.h>
 
 #include <nih/macros.h>
 #include <nih/list.h>
+#include <nih/hash.h>
 
 #include <nih-dbus/dbus_connection.h>
 #include <nih-dbus/dbus_message.h>
@@ -31,8 +34,11 @@
 #include <json.h>
 
 #include "event.h"
+#include "session.h"
 #include "quiesce.h"
 
+#include "com.ubuntu.Upstart.h"
+
 /**
  * USE_SESSION_BUS_ENV:
  *
@@ -45,6 +51,108 @@
 #define USE_SESSION_BUS_ENV "UPSTART_USE_SESSION_BUS"
 #endif
 
+/**
+ * CONTROL_CHANGE_HISTORY:
+ *
+ * Number of changes kept in the change feed once sent, so that a
+ * subscriber may obtain those it missed with GetChanges.
+ **/
+#define CONTROL_CHANGE_HISTORY 4096
+
+/**
+ * ControlChangeType:
+ *
+ * Kinds of change recorded in the change feed.
+ **/
+typedef enum control_change_type {
+	CONTROL_CHANGE_JOB_ADDED,
+	CONTROL_CHANGE_JOB_REMOVED,
+	CONTROL_CHANGE_INSTANCE_ADDED,
+	CONTROL_CHANGE_INSTANCE_REMOVED,
+	CONTROL_CHANGE_STATUS
+} ControlChangeType;
+
+/**
+ * ControlChange:
+ * @entry: list header,
+ * @seq: sequence number,
+ * @type: kind of change,
+ * @path: object path of job or instance,
+ * @status: goal and state of instance for CONTROL_CHANGE_STATUS, or NULL.
+ *
+ * A single record of the change feed.
+ **/
+typedef struct control_change {
+	NihList            entry;
+	uint64_t           seq;
+	ControlChangeType  type;
+	char              *path;
+	char              *status;
+} ControlChange;
+
+/**
+ * ControlSubscriber:
+ * @entry: list header,
+ * @conn: connection of subscriber,
+ * @name: unique bus name of subscriber, or NULL on a private connection.
+ *
+ * A client that has subscribed to the change feed.
+ **/
+typedef struct control_subscriber {
+	NihList         entry;
+	DBusConnection *conn;
+	char           *name;
+} ControlSubscriber;
+
+/**
+ * CONTROL_CREDENTIALS_MAX:
+ *
+ * Number of bus clients whose unix user is kept, beyond which all are
+ * forgotten so that the cache cannot grow without bound should
+ * NameOwnerChanged signals not be received.
+ **/
+#define CONTROL_CREDENTIALS_MAX 1024
+
+/**
+ * ControlCredential:
+ * @entry: hash list header,
+ * @name: unique bus name of client,
+ * @conn: connection the client is reached over,
+ * @uid: unix user of client.
+ *
+ * The unix user of a client on the bus, kept so that it need not be
+ * requested from the bus for each method call made by the client.
+ **/
+typedef struct control_credential {
+	NihList         entry;
+	char           *name;
+	DBusConnection *conn;
+	uid_t           uid;
+} ControlCredential;
+
+/**
+ * ControlGraph:
+ * @session: session whose job classes are checked,
+ * @jobs: names of the job classes visible to @session,
+ * @events: names of the events they emit,
+ * @globs: patterns of the events they emit,
+ * @ignored: NULL-terminated array of events known to be emitted elsewhere,
+ * @warn: TRUE if both sides of an "or" must be known.
+ *
+ * Names gathered once by the GetDependencyGraph method, against which
+ * each event and job named by the conditions of job classes is looked
+ * up; @jobs and @events hold NihListEntry structures whose strings
+ * belong to the job classes.
+ **/
+typedef struct control_graph {
+	Session       *session;
+	NihHash       *jobs;
+	NihHash       *events;
+	char         **globs;
+	char * const  *ignored;
+	int            warn;
+} ControlGraph;
+
 /**
  * control_get_job:
  * 
@@ -92,11 +200,17 @@ extern DBusServer     *control_server;
 extern DBusConnection *control_bus;
 
 extern NihList        *control_conns;
+extern int             control_lazy_objects;
+extern NihHash        *control_credentials;
+extern size_t          control_credentials_len;
 
 
 void control_init                 (void);
 void control_cleanup              (void);
 
+int  control_register_instances   (DBusConnection *conn)
+	__attribute__ ((warn_unused_result));
+
 int  control_server_open          (void)
 	__attribute__ ((warn_unused_result));
 void control_server_close         (void);
@@ -105,6 +219,9 @@ int  control_bus_open             (void)
 	__attribute__ ((warn_unused_result));
 void control_bus_close            (void);
 
+int  control_get_origin_uid       (NihDBusMessage *message, uid_t *uid)
+	__attribute__ ((warn_unused_result));
+
 int  control_reload_configuration (void *data, NihDBusMessage *message)
 	__attribute__ ((warn_unused_result));
 
@@ -114,6 +231,9 @@ int  control_get_job_by_name      (void *data, NihDBusMessage *message,
 int  control_get_all_jobs         (void *data, NihDBusMessage *message,
 				   char ***jobs)
 	__attribute__ ((warn_unused_result));
+int  control_get_all_job_status   (void *data, NihDBusMessage *message,
+				   ControlGetAllJobStatusJobsElement ***jobs)
+	__attribute__ ((warn_unused_result));
 
 int  control_emit_event           (void *data, NihDBusMessage *message,
 				   const char *name, char * const *env,
@@ -123,6 +243,50 @@ int  control_emit_event_with_file (void *data, NihDBusMessage *message,
 				   const char *name, char * const *env,
 				   int wait, int file)
 	__attribute__ ((warn_unused_result));
+int  control_emit_event_with_files (void *data, NihDBusMessage *message,
+				    const char *name, char * const *env,
+				    int wait, const int *files,
+				    size_t files_len)
+	__attribute__ ((warn_unused_result));
+
+int  control_emit_events          (void *data, NihDBusMessage *message,
+				   ControlEmitEventsEventsElement * const *events)
+	__attribute__ ((warn_unused_result));
+
+int  control_emit_event_async     (void *data, NihDBusMessage *message,
+				   const char *name, char * const *env,
+				   uint64_t *id, uint32_t *pending)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_stats      (void *data, NihDBusMessage *message,
+				   uint64_t *emitted, uint32_t *pending,
+				   uint32_t *handling, uint32_t *finished,
+				   uint64_t **latency, size_t *latency_len,
+				   uint64_t **poll, size_t *poll_len,
+				   uint64_t **examined, size_t *examined_len)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_job_timeline     (void *data, NihDBusMessage *message,
+				   ControlGetJobTimelineRecordsElement ***records)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_event_history    (void *data, NihDBusMessage *message,
+				   uint64_t since,
+				   ControlGetEventHistoryRecordsElement ***records)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_memory_stats     (void *data, NihDBusMessage *message,
+				   ControlGetMemoryStatsCategoriesElement ***categories,
+				   uint64_t *allocated, uint64_t *allocated_bytes,
+				   uint64_t *cached, uint64_t *cached_bytes)
+	__attribute__ ((warn_unused_result));
+
+int  control_get_dependency_graph (void *data, NihDBusMessage *message,
+				   char * const *ignored_events, int warn,
+				   ControlGetDependencyGraphEmitsElement ***emits,
+				   ControlGetDependencyGraphConsumesElement ***consumes,
+				   ControlGetDependencyGraphUnreachableElement ***unreachable)
+	__attribute__ ((warn_unused_result));
 
 int  control_get_version          (void *data, NihDBusMessage *message,
 				   char **version)
@@ -135,6 +299,10 @@ int  control_set_log_priority     (void *data, NihDBusMessage *message,
 				   const char *log_priority)
 	__attribute__ ((warn_unused_result));
 
+int  control_get_log_unflushed_dropped (void *data, NihDBusMessage *message,
+					uint64_t *dropped)
+	__attribute__ ((warn_unused_result));
+
 DBusBusType control_get_bus_type (void)
 	__attribute__ ((warn_unused_result));
 
@@ -158,9 +326,29 @@ int  control_restart (void *data, NihDBusMessage *message)
 	__attribute__ ((warn_unused_result));
 
 void control_notify_event_emitted (Event *event);
+void control_notify_event (const char *name, char * const *env);
+void control_notify_event_finished (Event *event);
 
 void control_notify_restarted (void);
 
+void control_change (ControlChangeType type, const char *path,
+		     const char *goal, const char *state);
+void control_changes_flush (void);
+
+int  control_subscribe_changes    (void *data, NihDBusMessage *message,
+				   uint64_t *seq)
+	__attribute__ ((warn_unused_result));
+int  control_unsubscribe_changes  (void *data, NihDBusMessage *message)
+	__attribute__ ((warn_unused_result));
+int  control_get_changes          (void *data, NihDBusMessage *message,
+				   uint64_t since, uint64_t *seq,
+				   ControlGetChangesChangesElement ***changes)
+	__attribute__ ((warn_unused_result));
+
+int  control_quiesce              (void *data, NihDBusMessage *message,
+				   int32_t timeout)
+	__attribute__ ((warn_unused_result));
+
 int control_notify_disk_writeable (void   *data,
 		     NihDBusMessage *message)
 	__attribute__ ((warn_unused_result));
@@ -0,0 +1,541 @@
+/* upstart
+ *
+ * deadline.c - heap of timeouts run from a single main loop timer
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/timer.h>
+#include <nih/logging.h>
+
+#include "deadline.h"
+
+
+/* Prototypes for static functions */
+static Deadline *deadline_new      (const void *parent, time_t due,
+				    DeadlineCb callback, void *data);
+static int       deadline_destroy  (Deadline *deadline);
+static void      deadline_insert   (Deadline *deadline);
+static void      deadline_remove   (Deadline *deadline);
+static void      deadline_swap     (size_t i, size_t j);
+static void      deadline_sift_up  (size_t i);
+static void      deadline_sift_down (size_t i);
+static void      deadline_arm      (void);
+static void      deadline_timer    (void *data, NihTimer *timer);
+static time_t    deadline_now      (void);
+
+
+/**
+ * deadline_heap:
+ *
+ * Binary heap of pending deadlines, earliest due first; each deadline
+ * holds its position in @index so that it can be removed or moved
+ * without searching.
+ **/
+static Deadline **deadline_heap = NULL;
+
+/**
+ * deadline_heap_len:
+ *
+ * Number of deadlines in deadline_heap.
+ **/
+static size_t deadline_heap_len = 0;
+
+/**
+ * deadline_heap_size:
+ *
+ * Number of deadlines deadline_heap has room for.
+ **/
+static size_t deadline_heap_size = 0;
+
+/**
+ * deadline_main_timer:
+ *
+ * The one NIH timer, due when the earliest deadline is, that is ever
+ * registered for the deadlines in deadline_heap; NULL while it is
+ * empty.
+ **/
+static NihTimer *deadline_main_timer = NULL;
+
+/**
+ * deadline_polling:
+ *
+ * TRUE while deadline_poll() is running due deadlines, so that
+ * deadline_main_timer is only rearmed once they have all run.
+ **/
+static int deadline_polling = FALSE;
+
+/**
+ * deadline_running:
+ *
+ * Timeout whose callback is being run, cleared if the callback frees
+ * it (or its parent) so that it is not freed again on return.
+ **/
+static Deadline *deadline_running = NULL;
+
+
+/**
+ * deadline_add_timeout:
+ * @parent: parent object for new deadline,
+ * @timeout: seconds to wait,
+ * @callback: function to call,
+ * @data: pointer to pass to @callback.
+ *
+ * Arrange for @callback to be called once, @timeout seconds from now;
+ * the deadline is freed once @callback returns, so any pointer to it
+ * should be cleared by @callback.  It may be cancelled before then by
+ * freeing it.
+ *
+ * If @parent is not NULL, it should be a pointer to another object
+ * which will be used as a parent for the returned deadline.  When all
+ * parents of the returned deadline are freed, the returned deadline
+ * will also be freed.
+ *
+ * Returns: new deadline, or NULL if insufficient memory.
+ **/
+Deadline *
+deadline_add_timeout (const void *parent,
+		      time_t      timeout,
+		      DeadlineCb  callback,
+		      void       *data)
+{
+	Deadline *deadline;
+
+	nih_assert (timeout > 0);
+	nih_assert (callback != NULL);
+
+	deadline = deadline_new (parent, deadline_now () + timeout,
+				 callback, data);
+	if (! deadline)
+		return NULL;
+
+	deadline->timeout = timeout;
+
+	return deadline;
+}
+
+/**
+ * deadline_add_periodic:
+ * @parent: parent object for new deadline,
+ * @period: seconds between calls,
+ * @callback: function to call,
+ * @data: pointer to pass to @callback.
+ *
+ * Arrange for @callback to be called every @period seconds until the
+ * returned deadline is freed, which @callback may do itself.
+ *
+ * If @parent is not NULL, it should be a pointer to another object
+ * which will be used as a parent for the returned deadline.  When all
+ * parents of the returned deadline are freed, the returned deadline
+ * will also be freed.
+ *
+ * Returns: new deadline, or NULL if insufficient memory.
+ **/
+Deadline *
+deadline_add_periodic (const void *parent,
+		       time_t      period,
+		       DeadlineCb  callback,
+		       void       *data)
+{
+	Deadline *deadline;
+
+	nih_assert (period > 0);
+	nih_assert (callback != NULL);
+
+	deadline = deadline_new (parent, deadline_now () + period,
+				 callback, data);
+	if (! deadline)
+		return NULL;
+
+	deadline->period = period;
+
+	return deadline;
+}
+
+/**
+ * deadline_set_due:
+ * @deadline: pending deadline,
+ * @due: monotonic time it is now due.
+ *
+ * Move @deadline to be due at @due, such as to restore the time a
+ * timeout was due before a re-exec.
+ **/
+void
+deadline_set_due (Deadline *deadline,
+		  time_t    due)
+{
+	time_t old_due;
+
+	nih_assert (deadline != NULL);
+	nih_assert (deadline->index != DEADLINE_NONE);
+
+	old_due = deadline->due;
+	deadline->due = due;
+
+	if (due < old_due) {
+		deadline_sift_up (deadline->index);
+	} else {
+		deadline_sift_down (deadline->index);
+	}
+
+	deadline_arm ();
+}
+
+/**
+ * deadline_pending:
+ *
+ * Returns: number of deadlines waiting to be run.
+ **/
+size_t
+deadline_pending (void)
+{
+	return deadline_heap_len;
+}
+
+/**
+ * deadline_next_due:
+ *
+ * Returns: monotonic time the earliest deadline is due, or zero if
+ * there are none.
+ **/
+time_t
+deadline_next_due (void)
+{
+	return deadline_heap_len ? deadline_heap[0]->due : 0;
+}
+
+/**
+ * deadline_poll:
+ *
+ * Run the callback of every deadline that is due, earliest first, and
+ * rearm deadline_main_timer for the next.  Called by that timer, so it
+ * only needs calling directly by test cases.
+ **/
+void
+deadline_poll (void)
+{
+	time_t now;
+
+	now = deadline_now ();
+
+	deadline_polling = TRUE;
+
+	while (deadline_heap_len && (deadline_heap[0]->due <= now)) {
+		Deadline *deadline = deadline_heap[0];
+
+		deadline_remove (deadline);
+
+		if (deadline->period) {
+			deadline->due = now + deadline->period;
+			deadline_insert (deadline);
+
+			deadline->callback (deadline->data, deadline);
+			continue;
+		}
+
+		deadline_running = deadline;
+		deadline->callback (deadline->data, deadline);
+
+		if (deadline_running)
+			nih_free (deadline_running);
+		deadline_running = NULL;
+	}
+
+	deadline_polling = FALSE;
+
+	deadline_arm ();
+}
+
+
+/**
+ * deadline_new:
+ * @parent: parent object for new deadline,
+ * @due: monotonic time it is due,
+ * @callback: function to call,
+ * @data: pointer to pass to @callback.
+ *
+ * Allocate a deadline and add it to deadline_heap.
+ *
+ * Returns: new deadline, or NULL if insufficient memory.
+ **/
+static Deadline *
+deadline_new (const void *parent,
+	      time_t      due,
+	      DeadlineCb  callback,
+	      void       *data)
+{
+	Deadline *deadline;
+
+	if (deadline_heap_len == deadline_heap_size) {
+		Deadline **heap;
+		size_t     size;
+
+		size = deadline_heap_size ? deadline_heap_size * 2 : 16;
+
+		heap = nih_realloc (deadline_heap, NULL,
+				    sizeof (Deadline *) * size);
+		if (! heap)
+			return NULL;
+
+		deadline_heap = heap;
+		deadline_heap_size = size;
+	}
+
+	deadline = nih_new (parent, Deadline);
+	if (! deadline)
+		return NULL;
+
+	deadline->index = DEADLINE_NONE;
+	deadline->timeout = 0;
+	deadline->period = 0;
+	deadline->due = due;
+
+	deadline->callback = callback;
+	deadline->data = data;
+
+	nih_alloc_set_destructor (deadline, deadline_destroy);
+
+	deadline_insert (deadline);
+	deadline_arm ();
+
+	return deadline;
+}
+
+/**
+ * deadline_destroy:
+ * @deadline: deadline being freed.
+ *
+ * Destructor for deadlines that removes @deadline from deadline_heap.
+ *
+ * Returns: zero.
+ **/
+static int
+deadline_destroy (Deadline *deadline)
+{
+	nih_assert (deadline != NULL);
+
+	if (deadline == deadline_running)
+		deadline_running = NULL;
+
+	if (deadline->index != DEADLINE_NONE) {
+		deadline_remove (deadline);
+		deadline_arm ();
+	}
+
+	return 0;
+}
+
+/**
+ * deadline_insert:
+ * @deadline: deadline to add.
+ *
+ * Add @deadline to deadline_heap, which must have room for it;
+ * deadline_new() makes room for each deadline allocated.
+ **/
+static void
+deadline_insert (Deadline *deadline)
+{
+	nih_assert (deadline != NULL);
+	nih_assert (deadline->index == DEADLINE_NONE);
+	nih_assert (deadline_heap_len < deadline_heap_size);
+
+	deadline->index = deadline_heap_len;
+	deadline_heap[deadline_heap_len++] = deadline;
+
+	deadline_sift_up (deadline->index);
+}
+
+/**
+ * deadline_remove:
+ * @deadline: deadline to remove.
+ *
+ * Remove @deadline from deadline_heap, filling its place with the last
+ * deadline.
+ **/
+static void
+deadline_remove (Deadline *deadline)
+{
+	size_t i;
+
+	nih_assert (deadline != NULL);
+	nih_assert (deadline->index < deadline_heap_len);
+	nih_assert (deadline_heap[deadline->index] == deadline);
+
+	i = deadline->index;
+	deadline->index = DEADLINE_NONE;
+
+	if (i == --deadline_heap_len)
+		return;
+
+	deadline_heap[i] = deadline_heap[deadline_heap_len];
+	deadline_heap[i]->index = i;
+
+	deadline_sift_up (i);
+	deadline_sift_down (deadline_heap[i]->index);
+}
+
+/**
+ * deadline_swap:
+ * @i: first index,
+ * @j: second index.
+ *
+ * Exchange two deadlines in deadline_heap.
+ **/
+static void
+deadline_swap (size_t i,
+	       size_t j)
+{
+	Deadline *deadline;
+
+	deadline = deadline_heap[i];
+	deadline_heap[i] = deadline_heap[j];
+	deadline_heap[j] = deadline;
+
+	deadline_heap[i]->index = i;
+	deadline_heap[j]->index = j;
+}
+
+/**
+ * deadline_sift_up:
+ * @i: index of deadline.
+ *
+ * Move the deadline at @i towards the top of deadline_heap until it is
+ * not due before its parent.
+ **/
+static void
+deadline_sift_up (size_t i)
+{
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+
+		if (deadline_heap[parent]->due <= deadline_heap[i]->due)
+			break;
+
+		deadline_swap (i, parent);
+		i = parent;
+	}
+}
+
+/**
+ * deadline_sift_down:
+ * @i: index of deadline.
+ *
+ * Move the deadline at @i towards the bottom of deadline_heap until it
+ * is not due after either child.
+ **/
+static void
+deadline_sift_down (size_t i)
+{
+	for (;;) {
+		size_t left = i * 2 + 1;
+		size_t right = left + 1;
+		size_t earliest = i;
+
+		if ((left < deadline_heap_len)
+		    && (deadline_heap[left]->due < deadline_heap[earliest]->due))
+			earliest = left;
+
+		if ((right < deadline_heap_len)
+		    && (deadline_heap[right]->due < deadline_heap[earliest]->due))
+			earliest = right;
+
+		if (earliest == i)
+			break;
+
+		deadline_swap (i, earliest);
+		i = earliest;
+	}
+}
+
+/**
+ * deadline_arm:
+ *
+ * Make deadline_main_timer due when the earliest deadline is, adding it
+ * if needed or freeing it once there are none.
+ **/
+static void
+deadline_arm (void)
+{
+	if (deadline_polling)
+		return;
+
+	if (! deadline_heap_len) {
+		if (deadline_main_timer) {
+			nih_free (deadline_main_timer);
+			deadline_main_timer = NULL;
+		}
+		return;
+	}
+
+	if (! deadline_main_timer) {
+		deadline_main_timer = nih_timer_add_timeout (
+			NULL, 1, (NihTimerCb)deadline_timer, NULL);
+
+		/* Not fatal; the timer is added again when another
+		 * deadline is.
+		 */
+		if (! deadline_main_timer)
+			return;
+	}
+
+	deadline_main_timer->due = deadline_heap[0]->due;
+}
+
+/**
+ * deadline_timer:
+ * @data: not used,
+ * @timer: timer that caused us to be called.
+ *
+ * Called by NIH when the earliest deadline is due.
+ **/
+static void
+deadline_timer (void     *data,
+		NihTimer *timer)
+{
+	nih_assert (timer != NULL);
+	nih_assert (deadline_main_timer == timer);
+
+	/* Timer is freed by NIH on return, and another added if there
+	 * are deadlines still to run.
+	 */
+	deadline_main_timer = NULL;
+
+	deadline_poll ();
+}
+
+/**
+ * deadline_now:
+ *
+ * Returns: current monotonic time in seconds.
+ **/
+static time_t
+deadline_now (void)
+{
+	struct timespec now;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	return now.tv_sec;
+}
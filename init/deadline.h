@@ -0,0 +1,95 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_DEADLINE_H
+#define INIT_DEADLINE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * DEADLINE_NONE:
+ *
+ * Heap index of a deadline that is not waiting to be run.
+ **/
+#define DEADLINE_NONE ((size_t)-1)
+
+
+/* Predefine the typedefs as we use them in the callbacks */
+typedef struct deadline Deadline;
+
+/**
+ * DeadlineCb:
+ * @data: data pointer given when registered,
+ * @deadline: deadline that is due.
+ *
+ * A deadline callback is called whenever the deadline is due; a timeout
+ * is freed on return, a periodic deadline may be freed by the callback
+ * to stop it.
+ **/
+typedef void (*DeadlineCb) (void *data, Deadline *deadline);
+
+/**
+ * Deadline:
+ * @index: position in the heap of pending deadlines,
+ * @timeout: time to wait for a timeout,
+ * @period: time between calls of a periodic deadline, or zero,
+ * @due: monotonic time the deadline is next due,
+ * @callback: function called when due,
+ * @data: pointer passed to @callback.
+ *
+ * Deadlines are kept in a single heap ordered by @due, so that however
+ * many are pending, the only timer the main loop needs is one for the
+ * earliest of them.  @due is in seconds of CLOCK_MONOTONIC, so changes
+ * to the system clock don't make them run early or late.
+ *
+ * Freeing a deadline removes it from the heap.
+ **/
+struct deadline {
+	size_t      index;
+	time_t      timeout;
+	time_t      period;
+	time_t      due;
+
+	DeadlineCb  callback;
+	void       *data;
+};
+
+
+NIH_BEGIN_EXTERN
+
+Deadline *deadline_add_timeout  (const void *parent, time_t timeout,
+				 DeadlineCb callback, void *data)
+	__attribute__ ((warn_unused_result));
+Deadline *deadline_add_periodic (const void *parent, time_t period,
+				 DeadlineCb callback, void *data)
+	__attribute__ ((warn_unused_result));
+
+void      deadline_set_due      (Deadline *deadline, time_t due);
+
+size_t    deadline_pending      (void);
+time_t    deadline_next_due     (void);
+
+void      deadline_poll         (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_DEADLINE_H */
@@ -30,18 +30,60 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/string.h>
 #include <nih/logging.h>
 #include <nih/error.h>
 
 #include "environ.h"
+#include "intern.h"
 #include "errors.h"
 
 
+/**
+ * ENVIRON_INDEX_MIN:
+ *
+ * Number of comparisons that appending entries one at a time would need,
+ * above which environ_append() indexes the keys of the table instead.
+ **/
+#define ENVIRON_INDEX_MIN 256
+
+/**
+ * EnvironSlot:
+ * @entry: list header,
+ * @str: entry of the table,
+ * @pos: index of @str in the table.
+ *
+ * Index of an entry in an environment table by its key, used while
+ * appending one table to another.
+ **/
+typedef struct environ_slot {
+	NihList      entry;
+	const char  *str;
+	size_t       pos;
+} EnvironSlot;
+
+
 /* Prototypes for static functions */
 static char *environ_expand_until (char **str, const void *parent,
-				   size_t *len, size_t *pos, char * const *env,
-				   const char *until);
+				   size_t *size, size_t *len, size_t *pos,
+				   char * const *env, const char *until);
+static int   environ_reserve      (char **str, const void *parent,
+				   size_t *size, size_t need)
+	__attribute__ ((warn_unused_result));
+static int   environ_str          (const char *str, char **new_str)
+	__attribute__ ((warn_unused_result));
+static char **environ_append_indexed (char ***env, const void *parent,
+				      size_t *len, int replace,
+				      char * const *new_env, size_t new_len)
+	__attribute__ ((warn_unused_result));
+static const void *environ_slot_key (NihList *entry);
+static uint32_t    environ_key_hash (const void *key);
+static int         environ_key_cmp  (const void *key1, const void *key2);
+static int         environ_template_part    (EnvironTemplate *tmpl, int ref,
+					     const char *str, size_t len)
+	__attribute__ ((warn_unused_result));
 
 
 /**
@@ -55,7 +97,9 @@ static char *environ_expand_until (char **str, const void *parent,
  * Add the new environment variable @str to the table @env (which has @len
  * elements, excluding the final NULL element), either replacing an existing
  * entry or appended to the end.  Both the array and the new string within it
- * are allocated using nih_alloc().
+ * are allocated using nih_alloc(); the string is shared through the intern
+ * table with any other environment table holding the same entry, so must
+ * never be modified in place.
  *
  * @str may be in KEY=VALUE format, in which case the given key will be
  * replaced with that value or appended to the table; or it may simply
@@ -102,25 +146,10 @@ environ_add (char       ***env,
 			_len++;
 	}
 
-	/* Calculate the length of the key in the string, if we reach the
-	 * end of the string, then we lookup the value in the environment
-	 * and use that as the new value otherwise use the string given.
-	 */
 	key = strcspn (str, "=");
-	if (str[key] == '=') {
-		new_str = nih_strdup (NULL, str);
-		if (! new_str)
-			return NULL;
-	} else {
-		const char *value;
 
-		value = getenv (str);
-		if (value) {
-			new_str = nih_sprintf (NULL, "%s=%s", str, value);
-			if (! new_str)
-				return NULL;
-		}
-	}
+	if (environ_str (str, &new_str) < 0)
+		return NULL;
 
 	/* Check the environment table for an existing entry for the key,
 	 * if we find one we either finish or overwrite it instead of
@@ -128,12 +157,15 @@ environ_add (char       ***env,
 	 */
 	old_str = (char **)environ_lookup (*env, str, key);
 	if (old_str && replace) {
-		nih_unref (*old_str, *env);
-
+		/* Take the new reference before dropping the old one since
+		 * both may be the same interned string.
+		 */
 		if (new_str) {
-			*old_str = new_str;
 			nih_ref (new_str, *env);
+			nih_unref (*old_str, *env);
+			*old_str = new_str;
 		} else {
+			nih_unref (*old_str, *env);
 			memmove (old_str, old_str + 1,
 				 (char *)(*env + *len) - (char *)old_str);
 			(*len)--;
@@ -154,6 +186,56 @@ environ_add (char       ***env,
 	return *env;
 }
 
+/**
+ * environ_str:
+ * @str: string to add,
+ * @new_str: set to the interned entry for @str.
+ *
+ * Calculate the length of the key in @str, if we reach the end of the
+ * string, then we lookup the value in the environment and use that as
+ * the new value otherwise use the string given.
+ *
+ * @new_str is set to NULL if @str is a bare KEY not set in init's own
+ * environment, otherwise the caller must drop the reference to it held
+ * by the NULL parent once it has taken its own.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+environ_str (const char  *str,
+	     char       **new_str)
+{
+	size_t key;
+
+	nih_assert (str != NULL);
+	nih_assert (new_str != NULL);
+
+	*new_str = NULL;
+
+	key = strcspn (str, "=");
+	if (str[key] == '=') {
+		*new_str = intern_string (NULL, str);
+		if (! *new_str)
+			return -1;
+	} else {
+		nih_local char *tmp = NULL;
+		const char     *value;
+
+		value = getenv (str);
+		if (value) {
+			tmp = nih_sprintf (NULL, "%s=%s", str, value);
+			if (! tmp)
+				return -1;
+
+			*new_str = intern_string (NULL, tmp);
+			if (! *new_str)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * environ_remove:
  * @env: pointer to environment table,
@@ -250,6 +332,9 @@ environ_remove (char        ***env,
  * existing entries will either be replaced with the same value or
  * retained (with the same value they're supposed to have).
  *
+ * Large tables are merged through a temporary index of their keys, so
+ * that the cost is linear in the size of both rather than their product.
+ *
  * Returns: new array pointer or NULL if insufficient memory.
  **/
 char **
@@ -260,9 +345,26 @@ environ_append (char       ***env,
 		char * const *new_env)
 {
 	char * const *e;
+	size_t        _len;
+	size_t        new_len = 0;
 
 	nih_assert (env != NULL);
 
+	if (! len) {
+		len = &_len;
+
+		_len = 0;
+		for (e = *env; e && *e; e++)
+			_len++;
+	}
+
+	for (e = new_env; e && *e; e++)
+		new_len++;
+
+	if (((*len + new_len) * new_len) >= ENVIRON_INDEX_MIN)
+		return environ_append_indexed (env, parent, len, replace,
+					       new_env, new_len);
+
 	for (e = new_env; e && *e; e++)
 		if (! environ_add (env, parent, len, replace, *e))
 			return NULL;
@@ -270,6 +372,188 @@ environ_append (char       ***env,
 	return *env;
 }
 
+/**
+ * environ_append_indexed:
+ * @env: pointer to environment table,
+ * @parent: parent object for new array,
+ * @len: length of @env,
+ * @replace: TRUE if existing entries should be replaced,
+ * @new_env: environment table to append to @env,
+ * @new_len: length of @new_env.
+ *
+ * Implementation of environ_append() that finds existing entries
+ * through a hash of the keys of @env, rather than by searching @env for
+ * each entry of @new_env.  Entries removed because they are unset in
+ * init's own environment leave a hole that is closed once all of
+ * @new_env has been appended.
+ *
+ * Returns: new array pointer or NULL if insufficient memory.
+ **/
+static char **
+environ_append_indexed (char       ***env,
+			const void   *parent,
+			size_t       *len,
+			int           replace,
+			char * const *new_env,
+			size_t        new_len)
+{
+	nih_local NihHash     *index = NULL;
+	nih_local EnvironSlot *slots = NULL;
+	size_t                 num_slots = 0;
+	size_t                 removed = 0;
+	char                 **ret = NULL;
+
+	nih_assert (env != NULL);
+	nih_assert (len != NULL);
+
+	if (! *env) {
+		*env = nih_str_array_new (parent);
+		if (! *env)
+			return NULL;
+	}
+
+	index = nih_hash_new (NULL, *len + new_len, environ_slot_key,
+			      environ_key_hash, environ_key_cmp);
+	if (! index)
+		return NULL;
+
+	slots = nih_alloc (NULL, sizeof (EnvironSlot) * (*len + new_len));
+	if (! slots)
+		return NULL;
+
+	for (size_t i = 0; i < *len; i++) {
+		EnvironSlot *slot = &slots[num_slots++];
+
+		nih_list_init (&slot->entry);
+		slot->str = (*env)[i];
+		slot->pos = i;
+
+		nih_hash_add (index, &slot->entry);
+	}
+
+	for (char * const *e = new_env; e && *e; e++) {
+		nih_local char *new_str = NULL;
+		EnvironSlot    *slot;
+
+		if (environ_str (*e, &new_str) < 0)
+			goto error;
+
+		slot = (EnvironSlot *)nih_hash_lookup (index, *e);
+		if (slot && replace) {
+			/* Take the new reference before dropping the old
+			 * one since both may be the same interned string.
+			 */
+			if (new_str) {
+				nih_ref (new_str, *env);
+				nih_unref ((*env)[slot->pos], *env);
+				(*env)[slot->pos] = new_str;
+				slot->str = new_str;
+			} else {
+				nih_unref ((*env)[slot->pos], *env);
+				(*env)[slot->pos] = NULL;
+				nih_list_remove (&slot->entry);
+				removed++;
+			}
+
+			continue;
+		} else if (slot || (! new_str)) {
+			continue;
+		}
+
+		if (! nih_str_array_addp (env, parent, len, new_str))
+			goto error;
+
+		slot = &slots[num_slots++];
+
+		nih_list_init (&slot->entry);
+		slot->str = new_str;
+		slot->pos = *len - 1;
+
+		nih_hash_add (index, &slot->entry);
+	}
+
+	ret = *env;
+
+error:
+	/* Close the holes left by removed entries */
+	if (removed) {
+		size_t j = 0;
+
+		for (size_t i = 0; i < *len; i++)
+			if ((*env)[i])
+				(*env)[j++] = (*env)[i];
+
+		(*env)[j] = NULL;
+		*len = j;
+	}
+
+	return ret;
+}
+
+/**
+ * environ_slot_key:
+ * @entry: EnvironSlot.
+ *
+ * Returns: entry of the table indexed by @entry, whose key is the part
+ * of it before the first '='.
+ **/
+static const void *
+environ_slot_key (NihList *entry)
+{
+	nih_assert (entry != NULL);
+
+	return ((EnvironSlot *)entry)->str;
+}
+
+/**
+ * environ_key_hash:
+ * @key: table entry or string to add.
+ *
+ * Returns: hash of the key of @key, which ends at the first '=' or at the
+ * end of the string.
+ **/
+static uint32_t
+environ_key_hash (const void *key)
+{
+	const unsigned char *p;
+	uint32_t             hash = 2166136261U;
+
+	nih_assert (key != NULL);
+
+	for (p = key; *p && (*p != '='); p++) {
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * environ_key_cmp:
+ * @key1: table entry or string to add,
+ * @key2: table entry or string to add.
+ *
+ * Returns: zero if the keys of @key1 and @key2, which end at the first
+ * '=' or at the end of the string, are the same.
+ **/
+static int
+environ_key_cmp (const void *key1,
+		 const void *key2)
+{
+	const char *a = key1;
+	const char *b = key2;
+
+	nih_assert (a != NULL);
+	nih_assert (b != NULL);
+
+	while (*a && (*a != '=') && (*a == *b)) {
+		a++;
+		b++;
+	}
+
+	return ((! *a) || (*a == '=')) && ((! *b) || (*b == '=')) ? 0 : 1;
+}
+
 
 /**
  * environ_set:
@@ -486,7 +770,7 @@ environ_expand (const void   *parent,
 		char * const *env)
 {
 	char   *str;
-	size_t  len, pos;
+	size_t  size, len, pos;
 
 	nih_assert (string != NULL);
 
@@ -497,18 +781,117 @@ environ_expand (const void   *parent,
 	}
 
 	len = strlen (string);
+	size = len + 1;
 	pos = 0;
 
-	if (! environ_expand_until (&str, parent, &len, &pos, env, ""))
+	if (! environ_expand_until (&str, parent, &size, &len, &pos,
+				    env, "")) {
+		nih_free (str);
 		return NULL;
+	}
 
 	return str;
 }
 
+/**
+ * environ_expand_buf:
+ * @buf: pointer to buffer to expand into,
+ * @parent: parent object for @buf,
+ * @size: allocated size of @buf,
+ * @string: string to expand,
+ * @env: NULL-terminated list of environment variables to use.
+ *
+ * Expand variable references in @string as environ_expand() does, but
+ * write the result into the buffer pointed to by @buf instead of a newly
+ * allocated string, so that a caller expanding many strings can reuse
+ * the same buffer each time.
+ *
+ * @buf may point to NULL, in which case the buffer is allocated with
+ * @parent as its parent.  It is only reallocated when the result, or a
+ * step of the expansion, doesn't fit in @size bytes, and @buf and @size
+ * are updated to match.  Strings without any references are copied
+ * straight into the buffer.
+ *
+ * The buffer remains owned by the caller even when an error is raised,
+ * though its contents are then undefined.
+ *
+ * Returns: *@buf on success or NULL on raised error.
+ **/
+char *
+environ_expand_buf (char         **buf,
+		    const void    *parent,
+		    size_t        *size,
+		    const char    *string,
+		    char * const  *env)
+{
+	size_t len, pos;
+
+	nih_assert (buf != NULL);
+	nih_assert (size != NULL);
+	nih_assert (string != NULL);
+
+	len = strlen (string);
+
+	if (! environ_reserve (buf, parent, size, len + 1))
+		return NULL;
+
+	memcpy (*buf, string, len + 1);
+
+	if (! memchr (string, '$', len))
+		return *buf;
+
+	pos = 0;
+
+	return environ_expand_until (buf, parent, size, &len, &pos, env, "");
+}
+
+/**
+ * environ_reserve:
+ * @str: pointer to buffer,
+ * @parent: parent object for @str,
+ * @size: allocated size of @str,
+ * @need: number of bytes needed.
+ *
+ * Make sure the buffer pointed to by @str can hold at least @need bytes,
+ * keeping its existing contents; when it can't, it is grown to at least
+ * double its size so that repeated growth stays cheap.
+ *
+ * Returns: TRUE on success, FALSE on raised error.
+ **/
+static int
+environ_reserve (char       **str,
+		 const void  *parent,
+		 size_t      *size,
+		 size_t       need)
+{
+	char   *new_str;
+	size_t  new_size;
+
+	nih_assert (str != NULL);
+	nih_assert (size != NULL);
+
+	if (*str && (need <= *size))
+		return TRUE;
+
+	new_size = (*str && (*size * 2 > need)) ? *size * 2 : need;
+
+	new_str = nih_realloc (*str, parent, new_size);
+	if (! new_str) {
+		nih_error_raise_system ();
+		return FALSE;
+	}
+
+	*str = new_str;
+	*size = new_size;
+
+	return TRUE;
+}
+
 /**
  * environ_expand_until:
  * @str: string being expanded,
  * @parent: parent object for new string,
+ * @size: allocated size of @str,
  * @len: length of @str,
  * @pos: current position within @str,
  * @env: NULL-terminated list of environment variables to use,
@@ -527,6 +910,9 @@ environ_expand (const void   *parent,
  *
  * @pos will be likewise updated to point to the character listed in @until.
  *
+ * @str is only reallocated when an expansion doesn't fit within @size,
+ * which is then updated.  On error @str is left for the caller to free.
+ *
  * @parent is ignored, though for style reasons it is usual to pass a
  * parent of @str.
  *
@@ -535,6 +921,7 @@ environ_expand (const void   *parent,
 static char *
 environ_expand_until (char        **str,
 		      const void   *parent,
+		      size_t       *size,
 		      size_t       *len,
 		      size_t       *pos,
 		      char * const *env,
@@ -542,6 +929,7 @@ environ_expand_until (char        **str,
 {
 	nih_assert (str != NULL);
 	nih_assert (*str != NULL);
+	nih_assert (size != NULL);
 	nih_assert (len != NULL);
 	nih_assert (pos != NULL);
 	nih_assert (until != NULL);
@@ -605,7 +993,7 @@ environ_expand_until (char        **str,
 			 * name part of the reference.
 			 */
 			name_start = ++(*pos);
-			if (! environ_expand_until (str, parent, len, pos,
+			if (! environ_expand_until (str, parent, size, len, pos,
 						    env, "}:-+"))
 				return NULL;
 
@@ -635,7 +1023,7 @@ environ_expand_until (char        **str,
 				   && ((*str)[*pos] != '\0')) {
 				nih_error_raise (ENVIRON_EXPECTED_OPERATOR,
 						 _(ENVIRON_EXPECTED_OPERATOR_STR));
-				goto error;
+				return NULL;
 			}
 
 			/* Expand any argument appearing after the expression
@@ -643,7 +1031,7 @@ environ_expand_until (char        **str,
 			 * be almost a no-op, except we'll have defined values
 			 */
 			arg_start = *pos;
-			if (! environ_expand_until (str, parent, len, pos,
+			if (! environ_expand_until (str, parent, size, len, pos,
 							    env, "}"))
 				return NULL;
 
@@ -656,7 +1044,7 @@ environ_expand_until (char        **str,
 			if ((*str)[*pos] != '}') {
 				nih_error_raise (ENVIRON_MISMATCHED_BRACES,
 						 _(ENVIRON_MISMATCHED_BRACES_STR));
-				goto error;
+				return NULL;
 			}
 
 			end = ++(*pos);
@@ -681,7 +1069,7 @@ environ_expand_until (char        **str,
 					"%s: %.*s", _(ENVIRON_UNKNOWN_PARAM_STR),
 					(int)(name_end - name_start),
 					*str + name_start);
-				goto error;
+				return NULL;
 			}
 
 			value_len = strlen (value);
@@ -723,17 +1111,10 @@ environ_expand_until (char        **str,
 		 * the right gap for the value to slot in.
 		 */
 		if (value_len > end - start) {
-			char *new_str;
-
 			offset = value_len - (end - start);
-			new_str = nih_realloc (*str, parent,
-					       *len + offset + 1);
-			if (! new_str) {
-				nih_error_raise_system ();
-				goto error;
-			}
-
-			*str = new_str;
+			if (! environ_reserve (str, parent, size,
+					       *len + offset + 1))
+				return NULL;
 
 			memmove (*str + end + offset, *str + end,
 				 *len - end + 1);
@@ -756,9 +1137,221 @@ environ_expand_until (char        **str,
 	}
 
 	return *str;
+}
 
-error:
-	nih_free (*str);
-	*str = NULL;
-	return NULL;
+
+/**
+ * environ_template_new:
+ * @parent: parent object for new template,
+ * @string: string to compile.
+ *
+ * Pre-parse @string into a template that can be expanded repeatedly with
+ * environ_template_expand(), without scanning @string for references or
+ * allocating a new string each time.
+ *
+ * Only literal text, $KEY and ${KEY} references are compiled; when
+ * @string uses any other form, the template still works but each
+ * expansion falls back to environ_expand_buf().  Errors in @string are
+ * therefore not raised here but on expansion.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned template.  When all parents
+ * of the returned template are freed, the returned template will also be
+ * freed.
+ *
+ * Returns: newly allocated template or NULL on raised error.
+ **/
+EnvironTemplate *
+environ_template_new (const void *parent,
+		      const char *string)
+{
+	EnvironTemplate *tmpl;
+	const char      *s;
+
+	nih_assert (string != NULL);
+
+	tmpl = nih_new (parent, EnvironTemplate);
+	if (! tmpl) {
+		nih_error_raise_system ();
+		return NULL;
+	}
+
+	tmpl->compiled = FALSE;
+	tmpl->parts = NULL;
+	tmpl->parts_len = 0;
+	tmpl->buf = NULL;
+	tmpl->buf_size = 0;
+
+	tmpl->source = nih_strdup (tmpl, string);
+	if (! tmpl->source) {
+		nih_free (tmpl);
+		nih_error_raise_system ();
+		return NULL;
+	}
+
+	/* Parts point into our own copy of the string, so split it the
+	 * same way environ_expand_until() would walk it.
+	 */
+	s = tmpl->source;
+	while (*s) {
+		const char *start = s;
+		size_t      len;
+		int         ok;
+
+		if (*s != '$') {
+			s += strcspn (s, "$");
+			ok = environ_template_part (tmpl, FALSE,
+						    start, s - start);
+
+		} else if ((s[1] == '_')
+			   || ((s[1] >= 'A') && (s[1] <= 'Z'))
+			   || ((s[1] >= 'a') && (s[1] <= 'z'))) {
+			s += 2;
+			while ((*s == '_')
+			       || ((*s >= 'A') && (*s <= 'Z'))
+			       || ((*s >= 'a') && (*s <= 'z'))
+			       || ((*s >= '0') && (*s <= '9')))
+				s++;
+
+			ok = environ_template_part (tmpl, TRUE,
+						    start + 1, s - start - 1);
+
+		} else if ((s[1] == '{') && (s[2] == '}')) {
+			s += 3;
+			ok = environ_template_part (tmpl, FALSE, "$", 1);
+
+		} else if (s[1] == '{') {
+			/* Anything but a plain name between the braces
+			 * is left to environ_expand().
+			 */
+			len = strcspn (s + 2, "}$:-+");
+			if (s[2 + len] != '}') {
+				if (tmpl->parts)
+					nih_free (tmpl->parts);
+				tmpl->parts = NULL;
+				tmpl->parts_len = 0;
+
+				return tmpl;
+			}
+
+			s += len + 3;
+			ok = environ_template_part (tmpl, TRUE, start + 2, len);
+
+		} else {
+			/* Lone dollar sign */
+			s++;
+			ok = environ_template_part (tmpl, FALSE, "$", 1);
+		}
+
+		if (! ok) {
+			nih_free (tmpl);
+			nih_error_raise_system ();
+			return NULL;
+		}
+	}
+
+	tmpl->compiled = TRUE;
+
+	return tmpl;
+}
+
+/**
+ * environ_template_part:
+ * @tmpl: template to extend,
+ * @ref: TRUE if @str names a variable,
+ * @str: text or name,
+ * @len: length of @str.
+ *
+ * Append a part to the plan of @tmpl.
+ *
+ * Returns: TRUE on success, FALSE on insufficient memory.
+ **/
+static int
+environ_template_part (EnvironTemplate *tmpl,
+		       int              ref,
+		       const char      *str,
+		       size_t           len)
+{
+	EnvironPart *parts;
+
+	nih_assert (tmpl != NULL);
+	nih_assert (str != NULL);
+
+	parts = nih_realloc (tmpl->parts, tmpl,
+			     sizeof (EnvironPart) * (tmpl->parts_len + 1));
+	if (! parts)
+		return FALSE;
+
+	parts[tmpl->parts_len].ref = ref;
+	parts[tmpl->parts_len].str = str;
+	parts[tmpl->parts_len].len = len;
+
+	tmpl->parts = parts;
+	tmpl->parts_len++;
+
+	return TRUE;
+}
+
+/**
+ * environ_template_expand:
+ * @tmpl: template to expand,
+ * @env: NULL-terminated list of environment variables to use.
+ *
+ * Expand @tmpl using the NULL-terminated list of KEY=VALUE strings in the
+ * given @env table, exactly as environ_expand() would expand the string
+ * the template was compiled from.
+ *
+ * The result is written to a scratch buffer owned by @tmpl, which is only
+ * grown when an expansion is longer than any before it.
+ *
+ * Returns: expanded string, valid until the next expansion of @tmpl or
+ * until it is freed, or NULL on raised error.
+ **/
+const char *
+environ_template_expand (EnvironTemplate *tmpl,
+			 char * const    *env)
+{
+	size_t len = 0;
+
+	nih_assert (tmpl != NULL);
+
+	if (! tmpl->compiled)
+		return environ_expand_buf (&tmpl->buf, tmpl, &tmpl->buf_size,
+					   tmpl->source, env);
+
+	for (size_t i = 0; i < tmpl->parts_len; i++) {
+		EnvironPart *part = &tmpl->parts[i];
+		const char  *value;
+		size_t       value_len;
+
+		if (part->ref) {
+			value = environ_getn (env, part->str, part->len);
+			if (! value) {
+				nih_error_raise_printf (
+					ENVIRON_UNKNOWN_PARAM,
+					"%s: %.*s", _(ENVIRON_UNKNOWN_PARAM_STR),
+					(int)part->len, part->str);
+				return NULL;
+			}
+
+			value_len = strlen (value);
+		} else {
+			value = part->str;
+			value_len = part->len;
+		}
+
+		if (! environ_reserve (&tmpl->buf, tmpl, &tmpl->buf_size,
+				       len + value_len + 1))
+			return NULL;
+
+		memcpy (tmpl->buf + len, value, value_len);
+		len += value_len;
+	}
+
+	if (! environ_reserve (&tmpl->buf, tmpl, &tmpl->buf_size, len + 1))
+		return NULL;
+
+	tmpl->buf[len] = '\0';
+
+	return tmpl->buf;
 }
@@ -20,9 +20,51 @@
 #ifndef INIT_ENVIRON_H
 #define INIT_ENVIRON_H
 
+#include <stddef.h>
+
 #include <nih/macros.h>
 
 
+/**
+ * EnvironPart:
+ * @ref: TRUE if @str names a variable, FALSE if it is literal text,
+ * @str: start of the text or name within the template source,
+ * @len: length of @str.
+ *
+ * A single piece of a compiled EnvironTemplate.
+ **/
+typedef struct environ_part {
+	int         ref;
+	const char *str;
+	size_t      len;
+} EnvironPart;
+
+/**
+ * EnvironTemplate:
+ * @source: string the template was compiled from,
+ * @compiled: TRUE if @parts is a complete plan for @source,
+ * @parts: array of literal text and variable references,
+ * @parts_len: number of entries in @parts,
+ * @buf: scratch buffer that expansions are written to,
+ * @buf_size: allocated size of @buf.
+ *
+ * A template pre-parses a string that is expanded many times against
+ * different environments.  Strings made only of literal text and plain
+ * $KEY or ${KEY} references are compiled into @parts; anything using
+ * operators or nested references is left to environ_expand() when
+ * expanded, so the result is always the same.
+ **/
+typedef struct environ_template {
+	char        *source;
+	int          compiled;
+	EnvironPart *parts;
+	size_t       parts_len;
+
+	char        *buf;
+	size_t       buf_size;
+} EnvironTemplate;
+
+
 NIH_BEGIN_EXTERN
 
 char **       environ_add       (char ***env, const void *parent, size_t *len,
@@ -51,6 +93,17 @@ int           environ_all_valid (char * const *env);
 char *        environ_expand    (const void *parent, const char *string,
 				 char * const *env)
 	__attribute__ ((warn_unused_result));
+char *        environ_expand_buf (char **buf, const void *parent,
+				  size_t *size, const char *string,
+				  char * const *env)
+	__attribute__ ((warn_unused_result));
+
+EnvironTemplate *environ_template_new    (const void *parent,
+					  const char *string)
+	__attribute__ ((warn_unused_result));
+const char *     environ_template_expand (EnvironTemplate *tmpl,
+					  char * const *env)
+	__attribute__ ((warn_unused_result));
 
 NIH_END_EXTERN
 
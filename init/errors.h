@@ -47,6 +47,14 @@ enum {
 	PARSE_ILLEGAL_NICE,
 	PARSE_ILLEGAL_OOM,
 	PARSE_ILLEGAL_LIMIT,
+	PARSE_ILLEGAL_AMOUNT,
+	PARSE_ILLEGAL_PRIORITY,
+	PARSE_ILLEGAL_PRESSURE,
+	PARSE_ILLEGAL_POOL,
+	PARSE_ILLEGAL_CPUS,
+	PARSE_ILLEGAL_NUMA_NODE,
+	PARSE_ILLEGAL_SOCKET,
+	PARSE_TOO_MANY_SOCKETS,
 	PARSE_EXPECTED_EVENT,
 	PARSE_EXPECTED_OPERATOR,
 	PARSE_EXPECTED_VARIABLE,
@@ -75,6 +83,14 @@ enum {
 #define PARSE_ILLEGAL_OOM_STR		N_("Illegal oom adjustment, expected -16 to 15 or 'never'")
 #define PARSE_ILLEGAL_OOM_SCORE_STR	N_("Illegal oom score adjustment, expected -999 to 1000 or 'never'")
 #define PARSE_ILLEGAL_LIMIT_STR		N_("Illegal limit, expected 'unlimited' or integer")
+#define PARSE_ILLEGAL_AMOUNT_STR	N_("Illegal amount, expected number with up to three decimal places")
+#define PARSE_ILLEGAL_PRIORITY_STR	N_("Illegal priority, expected -1000 to 1000")
+#define PARSE_ILLEGAL_PRESSURE_STR	N_("Illegal pressure, expected cpu, io or memory and a percentage")
+#define PARSE_ILLEGAL_POOL_STR		N_("Illegal pool size, expected 0 to 64")
+#define PARSE_ILLEGAL_CPUS_STR		N_("Illegal CPU list, expected numbers and ranges such as 0-3,8")
+#define PARSE_ILLEGAL_NUMA_NODE_STR	N_("Illegal NUMA node, expected non-negative integer")
+#define PARSE_ILLEGAL_SOCKET_STR	N_("Illegal socket, expected PROTO=inet or inet6 with PORT, or PROTO=unix with PATH")
+#define PARSE_TOO_MANY_SOCKETS_STR	N_("Too many sockets, expected at most 6")
 #define PARSE_EXPECTED_EVENT_STR	N_("Expected event")
 #define PARSE_EXPECTED_OPERATOR_STR	N_("Expected operator")
 #define PARSE_EXPECTED_VARIABLE_STR	N_("Expected variable name before value")
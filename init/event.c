@@ -24,7 +24,9 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <fnmatch.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <nih/macros.h>
@@ -39,12 +41,15 @@
 #include "dbus/upstart.h"
 
 #include "environ.h"
+#include "intern.h"
 #include "event.h"
+#include "events.h"
 #include "job.h"
 #include "blocked.h"
 #include "control.h"
 #include "errors.h"
 #include "quiesce.h"
+#include "conf.h"
 
 #include "com.ubuntu.Upstart.h"
 
@@ -56,6 +61,17 @@
 static void event_pending              (Event *event);
 static void event_pending_handle_jobs  (Event *event);
 static void event_finished             (Event *event);
+static int  event_observed             (const char *name,
+					const Session *session);
+static StateIndex *event_index_new     (const void *parent);
+static uint64_t event_stats_elapsed    (const struct timespec *since);
+static void event_history_add          (Event *event);
+static void event_history_job          (Event *event, JobClass *class,
+					int stopped);
+static void event_history_finish       (Event *event);
+static EventHistoryRecord *event_history_find (const Event *event);
+static EventPriority event_name_priority (const char *name)
+	__attribute__ ((warn_unused_result));
 
 static const char * event_progress_enum_to_str (EventProgress progress)
 	__attribute__ ((warn_unused_result));
@@ -74,6 +90,78 @@ extern json_object *json_events;
  **/
 NihList *events = NULL;
 
+/**
+ * event_stats:
+ *
+ * Counters and histograms of the event queue, returned by the
+ * GetEventStats method.
+ **/
+EventStats event_stats;
+
+/**
+ * event_last_id:
+ *
+ * Identifier given to the most recently created event; kept apart from
+ * event_stats so that identifiers restored across a re-exec are never
+ * reused.
+ **/
+static uint64_t event_last_id = 0;
+
+/**
+ * event_history:
+ *
+ * Ring of EVENT_HISTORY_SIZE records, allocated when the first event is
+ * handled.
+ **/
+static EventHistoryRecord *event_history = NULL;
+
+/**
+ * event_history_next:
+ *
+ * Number of records ever added to event_history; the next is written at
+ * this index modulo EVENT_HISTORY_SIZE.
+ **/
+static size_t event_history_next = 0;
+
+/**
+ * event_lane:
+ *
+ * Lane of the queue event_poll() is handling pending events from; the
+ * highest priority lane when not polling.
+ **/
+static EventPriority event_lane = EVENT_PRIORITY_HIGH;
+
+/**
+ * event_preempted:
+ *
+ * Set when an event is queued in a higher priority lane than event_lane,
+ * so that event_poll() returns to that lane before handling any more
+ * events from its current one.
+ **/
+static int event_preempted = FALSE;
+
+/**
+ * event_lanes:
+ *
+ * Patterns matching the names of events queued in lanes other than the
+ * normal one; job state changes are handled ahead of other events so
+ * that jobs keep starting and stopping promptly, and the device and file
+ * events that arrive in storms from the bridges are handled after them.
+ **/
+static const struct {
+	const char    *pattern;
+	EventPriority  priority;
+} event_lanes[] = {
+	{ JOB_STARTING_EVENT, EVENT_PRIORITY_HIGH },
+	{ JOB_STARTED_EVENT,  EVENT_PRIORITY_HIGH },
+	{ JOB_STOPPING_EVENT, EVENT_PRIORITY_HIGH },
+	{ JOB_STOPPED_EVENT,  EVENT_PRIORITY_HIGH },
+	{ SESSION_END_EVENT,  EVENT_PRIORITY_HIGH },
+	{ "*-device-*",       EVENT_PRIORITY_LOW },
+	{ "file",             EVENT_PRIORITY_LOW },
+	{ NULL,               EVENT_PRIORITY_NORMAL }
+};
+
 
 /**
  * event_init:
@@ -139,6 +227,8 @@ event_new (const void  *parent,
 
 	event->session = NULL;
 	event->fd = -1;
+	event->fds = NULL;
+	event->num_fds = 0;
 
 	event->progress = EVENT_PENDING;
 	event->failed = FALSE;
@@ -146,11 +236,19 @@ event_new (const void  *parent,
 	event->blockers = 0;
 	nih_list_init (&event->blocking);
 
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &event->created) == 0);
+
+	event->id = ++event_last_id;
+	event->report = FALSE;
+
+	event->emitter = NULL;
+	event->history = 0;
+
 	nih_alloc_set_destructor (event, nih_list_destroy);
 
 
 	/* Fill in the event details */
-	event->name = nih_strdup (event, name);
+	event->name = intern_string (event, name);
 	if (! event->name) {
 		nih_free (event);
 		return NULL;
@@ -160,17 +258,90 @@ event_new (const void  *parent,
 	if (event->env)
 		nih_ref (event->env, event);
 
+	event_set_priority (event, event_name_priority (event->name));
+
 
 	/* Place it in the pending list */
 	nih_debug ("Pending %s event", name);
 	nih_list_add (events, &event->entry);
 
+	event_stats.emitted++;
+
 	nih_main_loop_interrupt ();
 
 	return event;
 }
 
 
+/**
+ * event_name_priority:
+ * @name: name of event.
+ *
+ * Returns: lane of the queue events named @name are handled in unless
+ * given another when emitted.
+ **/
+static EventPriority
+event_name_priority (const char *name)
+{
+	nih_assert (name != NULL);
+
+	for (size_t i = 0; event_lanes[i].pattern; i++)
+		if (! fnmatch (event_lanes[i].pattern, name, 0))
+			return event_lanes[i].priority;
+
+	return EVENT_PRIORITY_NORMAL;
+}
+
+/**
+ * event_set_priority:
+ * @event: pending event,
+ * @priority: lane to handle it in.
+ *
+ * Moves @event to the @priority lane of the queue, such as when the
+ * emitter is waiting for it; when event_poll() is part way through a
+ * lower priority lane, it returns to @event before continuing.
+ **/
+void
+event_set_priority (Event         *event,
+		    EventPriority  priority)
+{
+	nih_assert (event != NULL);
+	nih_assert (priority < EVENT_PRIORITY_COUNT);
+
+	event->priority = priority;
+
+	if ((event->progress == EVENT_PENDING) && (priority < event_lane))
+		event_preempted = TRUE;
+}
+
+
+/**
+ * event_set_emitter:
+ * @event: event to change,
+ * @emitter: name of what emitted the event.
+ *
+ * Records @emitter as the source of @event in the event history; should
+ * there be insufficient memory, the event is left attributed to init.
+ **/
+void
+event_set_emitter (Event      *event,
+		   const char *emitter)
+{
+	char *str;
+
+	nih_assert (event != NULL);
+	nih_assert (emitter != NULL);
+
+	str = intern_string (event, emitter);
+	if (! str)
+		return;
+
+	if (event->emitter)
+		nih_unref (event->emitter, event);
+
+	event->emitter = str;
+}
+
 /**
  * event_block:
  * @event: event to block.
@@ -227,46 +398,117 @@ event_unblock (Event *event)
 void
 event_poll (void)
 {
-	int poll_again;
+	struct timespec start;
+	int             poll_again;
 
 	event_init ();
 
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &start) == 0);
+
 	do {
 		poll_again = FALSE;
+		event_preempted = FALSE;
 
-		NIH_LIST_FOREACH_SAFE (events, iter) {
-			Event *event = (Event *)iter;
-
-			/* Ignore events that we're handling and are
-			 * blocked, there's nothing we can do to hurry them.
-			 *
-			 * Decide whether to poll again based on the state
-			 * before handling the event; that way we always loop
-			 * at least once more after finding a pending or
-			 * finished event, in case they added new events as
-			 * a side effect that we missed.
-			 */
-			switch (event->progress) {
-			case EVENT_PENDING:
-				event_pending (event);
-				poll_again = TRUE;
-
-				/* fall through */
-			case EVENT_HANDLING:
-				if (event->blockers)
+		/* Pending events are handled a lane at a time, highest
+		 * priority first; an event queued in a higher lane than
+		 * the one being handled, as a side effect or otherwise,
+		 * sends us back to the top before any more are handled.
+		 */
+		for (event_lane = EVENT_PRIORITY_HIGH;
+		     (event_lane < EVENT_PRIORITY_COUNT) && (! event_preempted);
+		     event_lane++) {
+			NIH_LIST_FOREACH_SAFE (events, iter) {
+				Event *event = (Event *)iter;
+
+				if (event_preempted)
+					continue;
+
+				if ((event->progress == EVENT_PENDING)
+				    && (event->priority != event_lane))
+					continue;
+
+				/* Ignore events that we're handling and are
+				 * blocked, there's nothing we can do to hurry
+				 * them.
+				 *
+				 * Decide whether to poll again based on the
+				 * state before handling the event; that way we
+				 * always loop at least once more after finding
+				 * a pending or finished event, in case they
+				 * added new events as a side effect that we
+				 * missed.
+				 */
+				switch (event->progress) {
+				case EVENT_PENDING:
+					event_pending (event);
+					poll_again = TRUE;
+
+					/* fall through */
+				case EVENT_HANDLING:
+					if (event->blockers)
+						break;
+
+					event->progress = EVENT_FINISHED;
+					/* fall through */
+				case EVENT_FINISHED:
+					event_finished (event);
+					poll_again = TRUE;
 					break;
-
-				event->progress = EVENT_FINISHED;
-				/* fall through */
-			case EVENT_FINISHED:
-				event_finished (event);
-				poll_again = TRUE;
-				break;
-			default:
-				nih_assert_not_reached ();
+				default:
+					nih_assert_not_reached ();
+				}
 			}
 		}
 	} while (poll_again);
+
+	event_lane = EVENT_PRIORITY_HIGH;
+
+	event_stats_record (event_stats.poll, event_stats_elapsed (&start));
+}
+
+/**
+ * event_stats_record:
+ * @histogram: array of EVENT_STATS_BUCKETS counts,
+ * @value: value to record.
+ *
+ * Counts @value in the bucket of @histogram that it falls in.
+ **/
+void
+event_stats_record (uint64_t *histogram,
+		    uint64_t  value)
+{
+	int bucket = 0;
+
+	nih_assert (histogram != NULL);
+
+	while (value && (bucket < EVENT_STATS_BUCKETS - 1)) {
+		value >>= 1;
+		bucket++;
+	}
+
+	histogram[bucket]++;
+}
+
+/**
+ * event_stats_elapsed:
+ * @since: earlier monotonic time.
+ *
+ * Returns: microseconds elapsed since @since.
+ **/
+static uint64_t
+event_stats_elapsed (const struct timespec *since)
+{
+	struct timespec now;
+	int64_t         usec;
+
+	nih_assert (since != NULL);
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	usec = (((int64_t)(now.tv_sec - since->tv_sec) * 1000000)
+		+ (now.tv_nsec - since->tv_nsec) / 1000);
+
+	return (usec > 0) ? usec : 0;
 }
 
 
@@ -290,7 +532,25 @@ event_pending (Event *event)
 	nih_info (_("Handling %s event"), event->name);
 	event->progress = EVENT_HANDLING;
 
+	/* The events of jobs are already on the timeline as their states */
+	if (strcmp (event->name, JOB_STARTING_EVENT)
+	    && strcmp (event->name, JOB_STARTED_EVENT)
+	    && strcmp (event->name, JOB_STOPPING_EVENT)
+	    && strcmp (event->name, JOB_STOPPED_EVENT))
+		job_timeline_add_event (event->name);
+
+	event_history_add (event);
+
 	event_pending_handle_jobs (event);
+
+	/* The jobs changed by the event have blocked it by now */
+	if (event->history) {
+		EventHistoryRecord *record;
+
+		record = event_history_find (event);
+		if (record)
+			record->blockers = event->blockers;
+	}
 }
 
 /**
@@ -298,12 +558,19 @@ event_pending (Event *event)
  * @event: event to be handled.
  *
  * This function is called whenever an event reaches the handling state.
- * It iterates the list of jobs and stops or starts any necessary.
+ * It looks up the job classes and instances whose start or stop
+ * conditions reference the event by name, and stops or starts any
+ * necessary.
  **/
 static void
 event_pending_handle_jobs (Event *event)
 {
-	int  empty = TRUE;
+	nih_local NihList *stop = NULL;
+	nih_local NihList *start = NULL;
+	JobSubscription   *sub = NULL;
+	EventMemo         *memo = NULL;
+	uint64_t           examined = 0;
+	int                empty = TRUE;
 
 #ifdef ENABLE_CGROUPS
 	int  warn = FALSE;
@@ -313,8 +580,29 @@ event_pending_handle_jobs (Event *event)
 
 	job_class_init ();
 
-	NIH_HASH_FOREACH_SAFE (job_classes, iter) {
-		JobClass *class = (JobClass *)iter;
+	/* Jobs that may start on this event must be parsed first */
+	conf_lazy_load_event (event->name);
+
+	/* Collect the instances and classes that subscribe to the event
+	 * before acting on any of them, since starting a class will add
+	 * subscriptions for the stop on condition of the new instance.
+	 */
+	stop = NIH_MUST (nih_list_new (NULL));
+	start = NIH_MUST (nih_list_new (NULL));
+
+	while ((sub = (JobSubscription *)nih_hash_search (
+			job_subscriptions, event->name,
+			sub ? &sub->entry : NULL)) != NULL) {
+		JobClass     *class;
+		NihListEntry *entry;
+
+		examined++;
+
+		class = sub->job ? sub->job->class : sub->class;
+
+		/* Only classes in the job classes table are considered */
+		if (NIH_LIST_EMPTY (&class->entry))
+			continue;
 
 		/* Only affect jobs within the same session as the event
 		 * unless the event has no session, in which case do them
@@ -323,54 +611,74 @@ event_pending_handle_jobs (Event *event)
 		if (event->session && (class->session != event->session))
 			continue;
 
-		/* We stop first so that if an event is listed both as a
-		 * stop and start event, it causes an active running process
-		 * to be killed, and then stop script then the start script
-		 * to be run. In any other state, it has no special effect.
-		 *
-		 * (The other way around would be just strange, it'd cause
-		 * a process's start and stop scripts to be run without the
-		 * actual process).
-		 */
-		NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
-			Job *job = (Job *)job_iter;
-
-			if (job->stop_on
-			    && event_operator_handle (job->stop_on, event,
-						      job->env)
-			    && job->stop_on->value) {
-				if (job->goal != JOB_STOP) {
-					size_t len = 0;
-
-					if (job->stop_env)
-						nih_unref (job->stop_env, job);
-					job->stop_env = NULL;
-
-					/* Collect environment that stopped
-					 * the job for the pre-stop script;
-					 * it can make a more informed
-					 * decision whether the stop is valid.
-					 * We don't add class environment
-					 * since this is appended to the
-					 * existing job environment.
-					 */
-					NIH_MUST (event_operator_environment (
-						job->stop_on, &job->stop_env,
-						job, &len, "UPSTART_STOP_EVENTS"));
+		entry = NIH_MUST (nih_list_entry_new (sub->job ? stop : start));
+		entry->data = sub->job ? (void *)sub->job : (void *)sub->class;
+
+		nih_list_add (sub->job ? stop : start, &entry->entry);
+	}
 
-					job_finished (job, FALSE);
+	event_stats_record (event_stats.examined, examined);
 
-					event_operator_events (
-						job->stop_on,
-						job, &job->blocking);
+	/* We stop first so that if an event is listed both as a stop and
+	 * start event, it causes an active running process to be killed,
+	 * and then stop script then the start script to be run. In any
+	 * other state, it has no special effect.
+	 *
+	 * (The other way around would be just strange, it'd cause a
+	 * process's start and stop scripts to be run without the actual
+	 * process).
+	 */
+	NIH_LIST_FOREACH (stop, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		Job          *job = (Job *)entry->data;
+
+		if (job->stop_on
+		    && event_operator_handle (job->stop_on, event,
+					      job->env)
+		    && job->stop_on->value) {
+			if (job->goal != JOB_STOP) {
+				size_t len = 0;
+
+				if (job->stop_env)
+					nih_unref (job->stop_env, job);
+				job->stop_env = NULL;
+
+				/* Collect environment that stopped the job
+				 * for the pre-stop script; it can make a
+				 * more informed decision whether the stop
+				 * is valid.  We don't add class environment
+				 * since this is appended to the existing
+				 * job environment.
+				 */
+				NIH_MUST (event_operator_environment (
+					job->stop_on, &job->stop_env,
+					job, &len, "UPSTART_STOP_EVENTS"));
 
-					job_change_goal (job, JOB_STOP);
-				}
+				job_finished (job, FALSE);
+
+				event_operator_events (
+					job->stop_on,
+					job, &job->blocking);
 
-				event_operator_reset (job->stop_on);
+				job_change_goal (job, JOB_STOP);
+
+				event_history_job (event, job->class, TRUE);
 			}
 
+			event_operator_reset (job->stop_on);
 		}
+	}
+
+	/* Start on conditions are matched without any environment for
+	 * expansion, so when the same event is emitted again the matches
+	 * can be reused.
+	 */
+	if (! NIH_LIST_EMPTY (start))
+		memo = event_operator_memo (event);
+
+	NIH_LIST_FOREACH (start, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		JobClass     *class = (JobClass *)entry->data;
 
 		/* If the job has specified a cgroup stanza, do not
 		 * start it until the cgroup manager is available. Also,
@@ -399,7 +707,7 @@ event_pending_handle_jobs (Event *event)
 				 * becomes available.
 				 */
 				if (! class->cgmanager_wait) {
-					if (event_operator_handle (class->start_on, event, NULL))
+					if (event_operator_handle_memo (class->start_on, event, memo))
 						class->cgmanager_wait = TRUE;
 				}
 
@@ -412,11 +720,13 @@ event_pending_handle_jobs (Event *event)
 		 * whether we need a new instance.
 		 */
 		if (class->start_on
-		    && event_operator_handle (class->start_on, event, NULL)
+		    && event_operator_handle_memo (class->start_on, event, memo)
 		    && class->start_on->value) {
 
 			if (! job_class_induct_job (class))
 				return;
+
+			event_history_job (event, class, FALSE);
 		}
 	}
 
@@ -428,6 +738,9 @@ event_pending_handle_jobs (Event *event)
 	if (! quiesce_in_progress ())
 		return;
 
+	/* Jobs may have stopped, releasing the jobs they depended on */
+	quiesce_stop_jobs ();
+
 	/* Determine if any job instances remain */
 	NIH_HASH_FOREACH_SAFE (job_classes, iter) {
 		JobClass *class = (JobClass *)iter;
@@ -455,6 +768,9 @@ event_pending_handle_jobs (Event *event)
  * state.  Subscribers and jobs are notified, then, if the event failed, a
  * new pending failed event is queued.  Finally the event is freed and
  * removed from the list.
+ *
+ * A failed event is only queued if it could affect a job; otherwise just
+ * its EventEmitted signal is sent, since handling it would do nothing.
  **/
 static void
 event_finished (Event *event)
@@ -500,6 +816,13 @@ event_finished (Event *event)
 	}
 
 	close (event->fd);
+	for (size_t i = 0; i < event->num_fds; i++)
+		close (event->fds[i]);
+
+	control_notify_event_emitted (event);
+
+	if (event->report)
+		control_notify_event_finished (event);
 
 	if (event->failed) {
 		char *name;
@@ -511,20 +834,258 @@ event_finished (Event *event)
 
 			failed = NIH_MUST (nih_sprintf (NULL, "%s/failed",
 							event->name));
-			new_event = NIH_MUST (event_new (NULL, failed, NULL));
-			new_event->session = event->session;
 
-			if (event->env)
-				new_event->env = NIH_MUST (nih_str_array_copy (
-						  new_event, NULL, event->env));
+			if (! event_observed (failed, event->session)) {
+				control_notify_event (failed, event->env);
+			} else {
+				new_event = NIH_MUST (event_new (NULL, failed,
+								 NULL));
+				new_event->session = event->session;
+
+				if (event->emitter)
+					event_set_emitter (new_event,
+							   event->emitter);
+
+				if (event->env)
+					new_event->env = NIH_MUST (
+						nih_str_array_copy (new_event,
+								    NULL,
+								    event->env));
+			}
 		}
 	}
 
-	control_notify_event_emitted (event);
+	event_stats_record (event_stats.latency,
+			    event_stats_elapsed (&event->created));
+
+	event_history_finish (event);
 
 	nih_free (event);
 }
 
+
+/**
+ * event_history_add:
+ * @event: event being handled.
+ *
+ * Appends a record of @event to the event history, replacing the oldest
+ * once EVENT_HISTORY_SIZE records are held, and notes it in @event so
+ * that the record can be completed as the event is handled.
+ *
+ * The names are interned, so records of the same event share one copy
+ * of each; every record still takes a reference to them, which
+ * allocates, since the intern table does not keep them alive.  Should
+ * that fail, the event is simply not recorded.
+ **/
+static void
+event_history_add (Event *event)
+{
+	EventHistoryRecord *record;
+	char               *name;
+	char               *emitter = NULL;
+
+	nih_assert (event != NULL);
+
+	if (! event_history)
+		event_history = NIH_MUST (nih_alloc (NULL, sizeof (EventHistoryRecord)
+						     * EVENT_HISTORY_SIZE));
+
+	name = intern_string (event_history, event->name);
+	if (event->emitter)
+		emitter = intern_string (event_history, event->emitter);
+	if (! (name && (emitter || ! event->emitter))) {
+		if (name)
+			nih_unref (name, event_history);
+		if (emitter)
+			nih_unref (emitter, event_history);
+		return;
+	}
+
+	record = &event_history[event_history_next % EVENT_HISTORY_SIZE];
+	if (event_history_next >= EVENT_HISTORY_SIZE) {
+		nih_unref (record->name, event_history);
+		if (record->emitter)
+			nih_unref (record->emitter, event_history);
+
+		for (unsigned int i = 0;
+		     (i < record->matched) && (i < EVENT_HISTORY_JOBS); i++)
+			nih_unref (record->jobs[i], event_history);
+	}
+
+	record->id = event->id;
+	record->name = name;
+	record->emitter = emitter;
+	record->progress = EVENT_HANDLING;
+	record->queued = event->created;
+	clock_gettime (CLOCK_MONOTONIC, &record->handled);
+	record->finished.tv_sec = record->finished.tv_nsec = 0;
+	record->failed = FALSE;
+	record->blockers = 0;
+	record->matched = 0;
+	record->stopped = 0;
+
+	event->history = ++event_history_next;
+}
+
+/**
+ * event_history_job:
+ * @event: event being handled,
+ * @class: job class started or stopped,
+ * @stopped: TRUE if an instance of @class was stopped.
+ *
+ * Adds @class to the record of @event in the event history, taking a
+ * reference to its interned name; should that fail, @class is left out.
+ **/
+static void
+event_history_job (Event    *event,
+		   JobClass *class,
+		   int       stopped)
+{
+	EventHistoryRecord *record;
+	unsigned int        n;
+
+	nih_assert (event != NULL);
+	nih_assert (class != NULL);
+
+	record = event_history_find (event);
+	if (! record)
+		return;
+
+	n = record->matched;
+	if (n < EVENT_HISTORY_JOBS) {
+		record->jobs[n] = intern_string (event_history, class->name);
+		if (! record->jobs[n])
+			return;
+
+		if (stopped)
+			record->stopped |= 1U << n;
+	}
+
+	record->matched++;
+}
+
+/**
+ * event_history_finish:
+ * @event: finished event.
+ *
+ * Completes the record of @event in the event history.
+ **/
+static void
+event_history_finish (Event *event)
+{
+	EventHistoryRecord *record;
+
+	nih_assert (event != NULL);
+
+	record = event_history_find (event);
+	if (! record)
+		return;
+
+	record->progress = EVENT_FINISHED;
+	record->failed = event->failed;
+	clock_gettime (CLOCK_MONOTONIC, &record->finished);
+}
+
+/**
+ * event_history_find:
+ * @event: event to look up.
+ *
+ * Returns: record of @event in the event history, or NULL if it has none
+ * or it has since been replaced.
+ **/
+static EventHistoryRecord *
+event_history_find (const Event *event)
+{
+	EventHistoryRecord *record;
+
+	nih_assert (event != NULL);
+
+	if ((! event->history)
+	    || (event->history + EVENT_HISTORY_SIZE <= event_history_next))
+		return NULL;
+
+	record = &event_history[(event->history - 1) % EVENT_HISTORY_SIZE];
+
+	return (record->id == event->id) ? record : NULL;
+}
+
+/**
+ * event_history_count:
+ *
+ * Returns: number of records held in the event history.
+ **/
+size_t
+event_history_count (void)
+{
+	return (event_history_next < EVENT_HISTORY_SIZE
+		? event_history_next : EVENT_HISTORY_SIZE);
+}
+
+/**
+ * event_history_get:
+ * @index: index of record.
+ *
+ * Records are indexed from the oldest held, up to one less than
+ * event_history_count().
+ *
+ * Returns: record or NULL if @index is out of range.
+ **/
+const EventHistoryRecord *
+event_history_get (size_t index)
+{
+	size_t count;
+
+	count = event_history_count ();
+	if (index >= count)
+		return NULL;
+
+	return &event_history[(event_history_next - count + index)
+			      % EVENT_HISTORY_SIZE];
+}
+
+/**
+ * event_observed:
+ * @name: name of event,
+ * @session: session of event.
+ *
+ * Checks whether the start on condition of any job class, or the stop on
+ * condition of any instance, could be affected by an event named @name
+ * in @session, as event_pending_handle_jobs() would find them; job files
+ * that might reference it are parsed first.
+ *
+ * Returns: TRUE if the event could affect any job, FALSE otherwise.
+ **/
+static int
+event_observed (const char    *name,
+		const Session *session)
+{
+	JobSubscription *sub = NULL;
+
+	nih_assert (name != NULL);
+
+	job_class_init ();
+
+	conf_lazy_load_event (name);
+
+	while ((sub = (JobSubscription *)nih_hash_search (
+			job_subscriptions, name,
+			sub ? &sub->entry : NULL)) != NULL) {
+		JobClass *class;
+
+		class = sub->job ? sub->job->class : sub->class;
+
+		if (NIH_LIST_EMPTY (&class->entry))
+			continue;
+
+		if (session && (class->session != session))
+			continue;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 /**
  * event_serialise:
  * @event: event to serialise.
@@ -571,6 +1132,17 @@ event_serialise (const Event *event)
 	if (! state_set_json_int_var_from_obj (json, event, fd))
 		goto error;
 
+	if (event->num_fds) {
+		json_object *json_fds;
+
+		json_fds = state_serialise_int_array (int, event->fds,
+						      event->num_fds);
+		if (! json_fds)
+			goto error;
+
+		json_object_object_add (json, "fds", json_fds);
+	}
+
 	if (! state_set_json_enum_var (json,
 				event_progress_enum_to_str,
 				"progress", event->progress))
@@ -582,6 +1154,20 @@ event_serialise (const Event *event)
 	if (! state_set_json_int_var_from_obj (json, event, blockers))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, event, id))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, event, report))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, event, priority))
+		goto error;
+
+	if (event->emitter) {
+		if (! state_set_json_string_var_from_obj (json, event, emitter))
+			goto error;
+	}
+
 	if (! NIH_LIST_EMPTY (&event->blocking)) {
 		json_object *json_blocking;
 
@@ -648,6 +1234,7 @@ Event *
 event_deserialise (json_object *json)
 {
 	json_object        *json_env;
+	json_object        *json_fds;
 	Event              *event = NULL;
 	nih_local char     *name = NULL;
         nih_local char    **env = NULL;
@@ -676,6 +1263,13 @@ event_deserialise (json_object *json)
 	if (! state_get_json_int_var_to_obj (json, event, fd))
 		goto error;
 
+	/* Only present for events with more than one file descriptor */
+	if (json_object_object_get_ex (json, "fds", &json_fds)) {
+		if (state_deserialise_int_array (event, json_fds, int,
+						 &event->fds, &event->num_fds) < 0)
+			goto error;
+	}
+
 	if (! state_get_json_int_var (json, "session", session_index))
 		goto error;
 
@@ -700,6 +1294,40 @@ event_deserialise (json_object *json)
 			goto error;
 	}
 
+	/* Not present in state from older versions, in which case the
+	 * identifier given by event_new() is kept.
+	 */
+	if (json_object_object_get_ex (json, "id", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, event, id))
+			goto error;
+
+		if (event->id > event_last_id)
+			event_last_id = event->id;
+	}
+
+	if (json_object_object_get_ex (json, "report", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, event, report))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "priority", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, event, priority))
+			goto error;
+
+		if (event->priority >= EVENT_PRIORITY_COUNT)
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "emitter", NULL)) {
+		nih_local char *emitter = NULL;
+
+		if (! state_get_json_string_var_strict (json, "emitter",
+							NULL, emitter))
+			goto error;
+
+		event_set_emitter (event, emitter);
+	}
+
 	return event;
 
 error:
@@ -793,6 +1421,30 @@ event_progress_str_to_enum (const char *progress)
 	return -1;
 }
 
+/**
+ * event_index_new:
+ *
+ * @parent: parent object for new index.
+ *
+ * StateIndexBuilder for the list of events.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+static StateIndex *
+event_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	event_init ();
+
+	index = NIH_MUST (state_index_new (parent));
+
+	NIH_LIST_FOREACH (events, iter)
+		NIH_MUST (state_index_add (index, iter));
+
+	return index;
+}
+
 /**
  * event_to_index:
  *
@@ -812,6 +1464,10 @@ event_to_index (const Event *event)
 	nih_assert (event);
 	event_init ();
 
+	if (state_context)
+		return state_context_get (&state_context->events,
+					  event_index_new, event);
+
 	NIH_LIST_FOREACH (events, iter) {
 		Event *tmp = (Event *)iter;
 
@@ -846,6 +1502,10 @@ event_from_index (int event_index)
 	nih_assert (event_index >= 0);
 	event_init ();
 
+	if (state_context)
+		return state_context_lookup (&state_context->events,
+					     event_index_new, event_index);
+
 	NIH_LIST_FOREACH (events, iter) {
 		Event *event = (Event *)iter;
 
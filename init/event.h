@@ -28,6 +28,34 @@
 
 #include <json.h>
 
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * EVENT_STATS_BUCKETS:
+ *
+ * Number of buckets in each histogram of EventStats; bucket zero counts
+ * values of zero, bucket n counts values from 2^(n-1) up to 2^n and the
+ * last bucket counts everything larger.
+ **/
+#define EVENT_STATS_BUCKETS 32
+
+/**
+ * EVENT_HISTORY_SIZE:
+ *
+ * Number of records kept in the event history; once full, each new record
+ * replaces the oldest.
+ **/
+#define EVENT_HISTORY_SIZE 1024
+
+/**
+ * EVENT_HISTORY_JOBS:
+ *
+ * Number of job classes started or stopped by an event whose names are
+ * kept in its EventHistoryRecord; no more than the bits of an int.
+ **/
+#define EVENT_HISTORY_JOBS 8
+
 /**
  * EventProgress:
  *
@@ -41,6 +69,20 @@ typedef enum event_progress {
 	EVENT_FINISHED
 } EventProgress;
 
+/**
+ * EventPriority:
+ *
+ * Lanes of the event queue; pending events in a higher priority lane are
+ * always handled before those in a lower one, while events within a lane
+ * are handled in the order they were queued.
+ **/
+typedef enum event_priority {
+	EVENT_PRIORITY_HIGH,
+	EVENT_PRIORITY_NORMAL,
+	EVENT_PRIORITY_LOW,
+	EVENT_PRIORITY_COUNT
+} EventPriority;
+
 /**
  * Event:
  * @entry: list header,
@@ -49,10 +91,19 @@ typedef enum event_progress {
  * @env: NULL-terminated array of environment variables,
  * @fd: open file descriptor associated with a particular
  *      socket-bridge socket (see socket-event(8)),
+ * @fds: further open file descriptors passed with the event,
+ * @num_fds: number of entries in @fds,
  * @progress: progress of event,
  * @failed: whether this event has failed,
  * @blockers: number of blockers for finishing,
- * @blocking: messages and jobs we're blocking.
+ * @blocking: messages and jobs we're blocking,
+ * @created: monotonic time the event was queued,
+ * @id: identifier unique to this event since startup,
+ * @report: whether the EventFinished signal is sent when it finishes,
+ * @priority: lane of the queue the event is handled in,
+ * @emitter: interned name of what emitted the event, or NULL for init,
+ * @history: one more than the sequence number of the event's record in
+ * the event history, or zero if it has none.
  *
  * Events are one of the core concepts of upstart; they occur whenever
  * something, somewhere changes state.  They are idenitied by a unique
@@ -72,30 +123,103 @@ typedef struct event {
  	char            *name;
 	char           **env;
 	int              fd;
+	int             *fds;
+	size_t           num_fds;
 
 	EventProgress    progress;
 	int              failed;
 
 	unsigned int     blockers;
 	NihList          blocking;
+
+	struct timespec  created;
+
+	uint64_t         id;
+	int              report;
+
+	EventPriority    priority;
+
+	char            *emitter;
+	size_t           history;
 } Event;
 
+/**
+ * EventStats:
+ * @emitted: number of events queued since startup,
+ * @latency: histogram of microseconds from an event being queued to
+ * being finished,
+ * @poll: histogram of microseconds taken by each event_poll() pass,
+ * @examined: histogram of the number of job subscriptions examined for
+ * each event.
+ *
+ * Counters kept to show how far behind the event queue is.
+ **/
+typedef struct event_stats {
+	uint64_t emitted;
+	uint64_t latency[EVENT_STATS_BUCKETS];
+	uint64_t poll[EVENT_STATS_BUCKETS];
+	uint64_t examined[EVENT_STATS_BUCKETS];
+} EventStats;
+
+/**
+ * EventHistoryRecord:
+ * @id: identifier of event,
+ * @name: interned name of event,
+ * @emitter: interned name of what emitted the event, or NULL for init,
+ * @progress: EVENT_HANDLING until the event finishes, then EVENT_FINISHED,
+ * @queued: CLOCK_MONOTONIC time the event was queued,
+ * @handled: CLOCK_MONOTONIC time the event began to be handled,
+ * @finished: CLOCK_MONOTONIC time the event finished,
+ * @failed: whether the event failed,
+ * @blockers: number of jobs blocking the event once it was handled,
+ * @matched: number of job classes started or instances stopped,
+ * @jobs: interned names of the first EVENT_HISTORY_JOBS of those classes,
+ * @stopped: bit n set when @jobs[n] was stopped rather than started.
+ *
+ * Single entry in the event history, which records the lifecycle of every
+ * event handled so that a stalled boot can be examined afterwards.
+ **/
+typedef struct event_history_record {
+	uint64_t         id;
+	char            *name;
+	char            *emitter;
+	EventProgress    progress;
+	struct timespec  queued;
+	struct timespec  handled;
+	struct timespec  finished;
+	int              failed;
+	unsigned int     blockers;
+	unsigned int     matched;
+	char            *jobs[EVENT_HISTORY_JOBS];
+	unsigned int     stopped;
+} EventHistoryRecord;
+
 
 NIH_BEGIN_EXTERN
 
-extern int      paused;
-extern NihList *events;
+extern int        paused;
+extern NihList *   events;
+extern EventStats  event_stats;
 
 
 void   event_init    (void);
 
 Event *event_new     (const void *parent, const char *name, char **env);
 
+void   event_set_priority (Event *event, EventPriority priority);
+
 void   event_block   (Event *event);
 void   event_unblock (Event *event);
 
 void   event_poll    (void);
 
+void   event_stats_record (uint64_t *histogram, uint64_t value);
+
+void   event_set_emitter (Event *event, const char *emitter);
+
+size_t event_history_count (void);
+const EventHistoryRecord *event_history_get (size_t index);
+
 json_object *event_serialise (const Event *event)
 	__attribute__ ((warn_unused_result));
 
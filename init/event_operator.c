@@ -25,6 +25,7 @@
 
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,16 +35,78 @@
 #include <nih/alloc.h>
 #include <nih/string.h>
 #include <nih/tree.h>
+#include <nih/hash.h>
 #include <nih/logging.h>
 #include <nih/error.h>
 
 #include "environ.h"
+#include "intern.h"
 #include "event.h"
 #include "event_operator.h"
 #include "blocked.h"
 #include "errors.h"
 
 
+/**
+ * event_memos:
+ *
+ * Hash table of the events whose matches against EVENT_MATCH operators
+ * are remembered, indexed by event name; there may be several entries
+ * for each name, differing in environment.
+ **/
+static NihHash *event_memos = NULL;
+
+/**
+ * event_memos_len:
+ *
+ * Number of entries in event_memos.
+ **/
+static size_t event_memos_len = 0;
+
+/**
+ * event_memo_seen:
+ *
+ * Hashes of recently handled events, indexed by their lowest bits.  An
+ * event is only remembered in event_memos the second time it is seen, so
+ * that events which are never repeated cost no more than the hash.
+ **/
+static uint32_t event_memo_seen[EVENT_MEMO_SEEN];
+
+/**
+ * event_memo_stale:
+ *
+ * TRUE when an operator with remembered matches has been freed, so the
+ * memo must be emptied before it is used again.
+ **/
+static int event_memo_stale = FALSE;
+
+/**
+ * event_match_buf:
+ *
+ * Buffer that operator values with variable references are expanded
+ * into while matching, kept between calls so that matching doesn't
+ * allocate for every entry; event_match_size is its allocated size.
+ **/
+static char  *event_match_buf = NULL;
+static size_t event_match_size = 0;
+
+
+/* Prototypes for static functions */
+static void event_operator_match_init (EventMatch *match, const char *env);
+static int  event_operator_handle_full (EventOperator *root, Event *event,
+				       char * const *env, EventMemo *memo);
+static int  event_operator_handle_leaf (EventOperator *oper, Event *event,
+				       char * const *env, EventMemo *memo);
+static uint32_t event_memo_hash       (const Event *event);
+static int  event_memo_env_equal      (char * const *env1,
+				       char * const *env2);
+static int  event_memo_get            (const EventMemo *memo,
+				       const EventOperator *oper, int *match);
+static void event_memo_put            (EventMemo *memo, EventOperator *oper,
+				       int match);
+static void event_operator_hold       (EventOperator *oper);
+
+
 /**
  * event_operator_new:
  * @parent: parent object for new operator,
@@ -90,22 +153,38 @@ event_operator_new (const void         *parent,
 	oper->type = type;
 	oper->value = FALSE;
 
+	oper->match = NULL;
+	oper->match_len = 0;
+
 	if (oper->type == EVENT_MATCH) {
-		oper->name = nih_strdup (oper, name);
+		oper->name = intern_string (oper, name);
 		if (! oper->name) {
 			nih_free (oper);
 			return NULL;
 		}
 
 		oper->env = env;
-		if (oper->env)
+		if (oper->env) {
+			if (event_operator_compile (oper) < 0) {
+				nih_free (nih_error_get ());
+				nih_free (oper);
+				return NULL;
+			}
+
 			nih_ref (oper->env, oper);
+		}
 	} else {
 		oper->name = NULL;
 		oper->env = NULL;
 	}
 
 	oper->event = NULL;
+	oper->held = 0;
+
+	oper->leaves = NULL;
+	oper->leaves_len = 0;
+
+	oper->memoised = FALSE;
 
 	nih_alloc_set_destructor (oper, event_operator_destroy);
 
@@ -156,6 +235,12 @@ event_operator_copy (const void          *parent,
 			nih_free (oper);
 			return NULL;
 		}
+
+		if (event_operator_compile (oper) < 0) {
+			nih_free (nih_error_get ());
+			nih_free (oper);
+			return NULL;
+		}
 	}
 
 	if (old_oper->event) {
@@ -163,6 +248,8 @@ event_operator_copy (const void          *parent,
 		event_block (oper->event);
 	}
 
+	oper->held = old_oper->held;
+
 	if (old_oper->node.left) {
 		child = event_operator_copy (
 			oper, (EventOperator *)old_oper->node.left);
@@ -186,6 +273,14 @@ event_operator_copy (const void          *parent,
 		nih_tree_add (&oper->node, &child->node, NIH_TREE_RIGHT);
 	}
 
+	if (old_oper->leaves) {
+		if (event_operator_compile_tree (oper) < 0) {
+			nih_free (nih_error_get ());
+			nih_free (oper);
+			return NULL;
+		}
+	}
+
 	return oper;
 }
 
@@ -209,12 +304,167 @@ event_operator_destroy (EventOperator *oper)
 	if (oper->event)
 		event_unblock (oper->event);
 
+	/* Another operator may later be allocated at the same address */
+	if (oper->memoised)
+		event_memo_stale = TRUE;
+
 	nih_tree_destroy (&oper->node);
 
 	return 0;
 }
 
 
+/**
+ * event_operator_match_init:
+ * @match: match to fill in,
+ * @env: operator environment entry.
+ *
+ * Parses the operator environment entry @env, which may be of the form
+ * KEY=VALUE, KEY!=VALUE or just VALUE for a positional match, into
+ * @match.  The key and value members of @match point into @env.
+ **/
+static void
+event_operator_match_init (EventMatch *match,
+			   const char *env)
+{
+	const char *value;
+
+	nih_assert (match != NULL);
+	nih_assert (env != NULL);
+
+	value = strstr (env, "!=");
+	if (! value)
+		value = strchr (env, '=');
+
+	if (value) {
+		match->key = env;
+		match->key_len = value - env;
+
+		/* != means we negate the result (and skip the !) */
+		match->negate = (*value == '!');
+		if (match->negate)
+			value++;
+
+		/* Value to match against follows the equals. */
+		value++;
+	} else {
+		/* Value to match against is the whole string. */
+		match->key = NULL;
+		match->key_len = 0;
+		match->negate = FALSE;
+	}
+
+	match->value = value ? value : env;
+	match->expand = (strchr (match->value, '$') != NULL);
+	match->glob = (strpbrk (match->value, "*?[\\") != NULL);
+}
+
+/**
+ * event_operator_compile:
+ * @oper: operator to compile.
+ *
+ * Builds the compiled form of the environment of @oper, replacing any
+ * previous compiled form.  This must be called whenever the environment
+ * array of @oper is modified, since the compiled form refers to it.
+ *
+ * This may only be called if the type of @oper is EVENT_MATCH.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+event_operator_compile (EventOperator *oper)
+{
+	EventMatch *match;
+	size_t      len = 0;
+	size_t      i;
+
+	nih_assert (oper != NULL);
+	nih_assert (oper->type == EVENT_MATCH);
+
+	if (oper->match) {
+		nih_free (oper->match);
+		oper->match = NULL;
+		oper->match_len = 0;
+	}
+
+	while (oper->env && oper->env[len])
+		len++;
+
+	if (! len)
+		return 0;
+
+	match = nih_alloc (oper, sizeof (EventMatch) * len);
+	if (! match)
+		nih_return_no_memory_error (-1);
+
+	for (i = 0; i < len; i++)
+		event_operator_match_init (&match[i], oper->env[i]);
+
+	oper->match = match;
+	oper->match_len = len;
+
+	return 0;
+}
+
+/**
+ * event_operator_compile_tree:
+ * @root: root of operator tree to compile.
+ *
+ * Builds the flattened form of the tree rooted at @root, listing each of
+ * its EVENT_MATCH operators with the name of the event it matches, and
+ * replacing any previous flattened form.  event_operator_handle() uses
+ * this to reject events that no leaf names without walking the tree.
+ *
+ * This must be called again whenever operators are added to or removed
+ * from the tree, since the flattened form refers to them.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+event_operator_compile_tree (EventOperator *root)
+{
+	EventLeaf *leaves;
+	size_t     len = 0;
+
+	nih_assert (root != NULL);
+	nih_assert (root->node.parent == NULL);
+
+	if (root->leaves) {
+		nih_free (root->leaves);
+		root->leaves = NULL;
+		root->leaves_len = 0;
+	}
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		if (oper->type == EVENT_MATCH)
+			len++;
+	}
+
+	leaves = nih_alloc (root, sizeof (EventLeaf) * len);
+	if (! leaves)
+		nih_return_no_memory_error (-1);
+
+	len = 0;
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		leaves[len].name = oper->name;
+		leaves[len].oper = oper;
+		len++;
+	}
+
+	root->leaves = leaves;
+	root->leaves_len = len;
+
+	return 0;
+}
+
+
 /**
  * event_operator_update:
  * @oper: operator to update.
@@ -275,8 +525,8 @@ event_operator_match (EventOperator *oper,
 		      Event         *event,
 		      char * const  *env)
 {
-	char * const *oenv;
 	char * const *eenv;
+	size_t        i;
 
 	nih_assert (oper != NULL);
 	nih_assert (oper->type == EVENT_MATCH);
@@ -284,43 +534,42 @@ event_operator_match (EventOperator *oper,
 	nih_assert (oper->node.right == NULL);
 	nih_assert (event != NULL);
 
-	/* Names must match */
-	if (strcmp (oper->name, event->name))
+	/* Names must match; both are interned so it's sufficient to
+	 * compare the pointers.
+	 */
+	if (oper->name != event->name)
 		return FALSE;
 
 	/* Match operator environment variables against those from the event,
-	 * starting both from the beginning.
+	 * starting both from the beginning.  Use the compiled form where we
+	 * have it, otherwise parse each entry as we go.
 	 */
-	for (oenv = oper->env, eenv = event->env; oenv && *oenv;
-	     oenv++, eenv++) {
-		nih_local char *expoval = NULL;
-		char           *oval, *eval;
-		int             negate = FALSE;
-		int             ret;
-
-		oval = strstr (*oenv, "!=");
-		if (! oval)
-			oval = strchr (*oenv, '=');
-
-		if (oval) {
-			/* Hunt through the event environment to find the
-			 * equivalent entry */
-			eenv = environ_lookup (event->env, *oenv,
-					       oval - *oenv);
-
-			/* != means we negate the result (and skip the !) */
-			if (*oval == '!') {
-				negate = TRUE;
-				oval++;
-			}
+	for (i = 0, eenv = event->env; ; i++, eenv++) {
+		const char       *expoval;
+		EventMatch        parsed;
+		const EventMatch *match;
+		const char       *eval;
+		int               ret;
+
+		if (oper->match) {
+			if (i >= oper->match_len)
+				break;
 
-			/* Value to match against follows the equals. */
-			oval++;
+			match = &oper->match[i];
 		} else {
-			/* Value to match against is the whole string. */
-			oval = *oenv;
+			if (! (oper->env && oper->env[i]))
+				break;
+
+			event_operator_match_init (&parsed, oper->env[i]);
+			match = &parsed;
 		}
 
+		/* Hunt through the event environment to find the
+		 * equivalent entry */
+		if (match->key)
+			eenv = environ_lookup (event->env, match->key,
+					       match->key_len);
+
 		/* Make sure we haven't gone off the end of the event
 		 * environment array; this catches both too many positional
 		 * matches and no such variable.
@@ -336,24 +585,36 @@ event_operator_match (EventOperator *oper,
 		nih_assert (eval != NULL);
 		eval++;
 
-		/* Expand operator value against given environment before
-		 * matching; silently discard errors, since otherwise we'd
-		 * be excessively noisy on every event.
-		 */
-		while (! (expoval = environ_expand (NULL, oval, env))) {
-			NihError *err;
-
-			err = nih_error_get ();
-			if (err->number != ENOMEM) {
+		if (match->expand) {
+			/* Expand operator value against given environment
+			 * before matching; silently discard errors, since
+			 * otherwise we'd be excessively noisy on every event.
+			 */
+			while (! (expoval = environ_expand_buf (
+					  &event_match_buf, NULL,
+					  &event_match_size,
+					  match->value, env))) {
+				NihError *err;
+
+				err = nih_error_get ();
+				if (err->number != ENOMEM) {
+					nih_free (err);
+					return FALSE;
+				}
 				nih_free (err);
-				return FALSE;
 			}
-			nih_free (err);
-		}
 
-		ret = fnmatch (expoval, eval, 0);
+			ret = fnmatch (expoval, eval, 0);
+		} else if (match->glob) {
+			ret = fnmatch (match->value, eval, 0);
+		} else {
+			/* Plain value with no wildcards, which fnmatch()
+			 * would only compare character by character.
+			 */
+			ret = strcmp (match->value, eval);
+		}
 
-		if (negate ? (! ret) : ret)
+		if (match->negate ? (! ret) : ret)
 			return FALSE;
 	}
 
@@ -361,6 +622,101 @@ event_operator_match (EventOperator *oper,
 }
 
 
+/**
+ * event_operator_leaf_may_match_job:
+ * @oper: EVENT_MATCH operator,
+ * @job: name of job class.
+ *
+ * Returns: FALSE if the first environment entry of @oper rules out a
+ * match against the events of @job, TRUE otherwise.
+ **/
+static int
+event_operator_leaf_may_match_job (EventOperator *oper,
+				   const char    *job)
+{
+	EventMatch        parsed;
+	const EventMatch *match;
+
+	nih_assert (oper != NULL);
+	nih_assert (oper->type == EVENT_MATCH);
+	nih_assert (job != NULL);
+
+	if (oper->match) {
+		match = &oper->match[0];
+	} else if (oper->env && oper->env[0]) {
+		event_operator_match_init (&parsed, oper->env[0]);
+		match = &parsed;
+	} else {
+		return TRUE;
+	}
+
+	/* Only a plain match of the job name, positionally or by the JOB
+	 * variable, can be decided without the rest of the event.
+	 */
+	if (match->negate || match->expand)
+		return TRUE;
+
+	if (match->key && ((match->key_len != 3)
+			   || strncmp (match->key, "JOB", 3)))
+		return TRUE;
+
+	if (match->glob)
+		return fnmatch (match->value, job, 0) == 0;
+
+	return strcmp (match->value, job) == 0;
+}
+
+/**
+ * event_operator_may_match_job:
+ * @root: operator tree,
+ * @name: name of job event,
+ * @job: name of job class.
+ *
+ * Checks whether the @name event of the @job class, such as "started",
+ * could match any EVENT_MATCH node of the tree rooted at @root, without
+ * constructing the event.  The check is conservative: only a node whose
+ * first entry matches a different job name is ruled out.
+ *
+ * Returns: TRUE if the event could match, FALSE if it cannot.
+ **/
+int
+event_operator_may_match_job (EventOperator *root,
+			      const char    *name,
+			      const char    *job)
+{
+	nih_assert (root != NULL);
+	nih_assert (name != NULL);
+	nih_assert (job != NULL);
+
+	if (root->leaves) {
+		for (size_t i = 0; i < root->leaves_len; i++) {
+			if (strcmp (root->leaves[i].name, name))
+				continue;
+
+			if (event_operator_leaf_may_match_job (
+				    root->leaves[i].oper, job))
+				return TRUE;
+		}
+
+		return FALSE;
+	}
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (strcmp (oper->name, name))
+			continue;
+
+		if (event_operator_leaf_may_match_job (oper, job))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 /**
  * event_operator_handle:
  * @root: operator tree to update,
@@ -390,43 +746,416 @@ int
 event_operator_handle (EventOperator *root,
 		       Event         *event,
 		       char * const  *env)
+{
+	return event_operator_handle_full (root, event, env, NULL);
+}
+
+/**
+ * event_operator_handle_memo:
+ * @root: operator tree to update,
+ * @event: event to match against,
+ * @memo: remembered matches of @event, or NULL.
+ *
+ * Handles @event in the same way as event_operator_handle() without any
+ * environment for expansion, except that the result of matching each
+ * EVENT_MATCH operator against @event is taken from @memo where it has
+ * been recorded already, and recorded there otherwise.
+ *
+ * @memo should have been returned by event_operator_memo() for @event.
+ *
+ * Returns: TRUE if @event matched an entry in the tree under @root, FALSE
+ * otherwise.
+ **/
+int
+event_operator_handle_memo (EventOperator *root,
+			    Event         *event,
+			    EventMemo     *memo)
+{
+	nih_assert ((memo == NULL) || (memo->name == event->name));
+
+	/* An operator may have been freed since the memo was looked up */
+	if (event_memo_stale)
+		memo = NULL;
+
+	return event_operator_handle_full (root, event, NULL, memo);
+}
+
+/**
+ * event_operator_handle_full:
+ * @root: operator tree to update,
+ * @event: event to match against,
+ * @env: NULL-terminated array of environment variables for expansion,
+ * @memo: remembered matches of @event, or NULL.
+ *
+ * Implements event_operator_handle() and event_operator_handle_memo().
+ *
+ * Returns: TRUE if @event matched an entry in the tree under @root, FALSE
+ * otherwise.
+ **/
+static int
+event_operator_handle_full (EventOperator *root,
+			    Event         *event,
+			    char * const  *env,
+			    EventMemo     *memo)
 {
 	int ret = FALSE;
 
 	nih_assert (root != NULL);
 	nih_assert (event != NULL);
+	nih_assert ((memo == NULL) || (env == NULL));
 
-	/* A post-order traversal will give us the nodes in exactly the
-	 * order we want.  We get a chance to update all of a node's children
-	 * before we update the node itself.  Simply iterate the tree and
-	 * update the nodes.
+	/* Only the leaves can match; when one does, walk back up the tree
+	 * updating the operators above it, which are the only ones whose
+	 * value may have changed.  Names are interned, so the flattened
+	 * form lets us pass over leaves naming other events without
+	 * visiting them at all.
 	 */
+	if (root->leaves) {
+		for (size_t i = 0; i < root->leaves_len; i++) {
+			if (root->leaves[i].name != event->name)
+				continue;
+
+			if (event_operator_handle_leaf (root->leaves[i].oper,
+							event, env, memo))
+				ret = TRUE;
+		}
+
+		return ret;
+	}
+
 	NIH_TREE_FOREACH_POST (&root->node, iter) {
 		EventOperator *oper = (EventOperator *)iter;
 
-		switch (oper->type) {
-		case EVENT_OR:
-		case EVENT_AND:
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (event_operator_handle_leaf (oper, event, env, memo))
+			ret = TRUE;
+	}
+
+	return ret;
+}
+
+/**
+ * event_operator_handle_leaf:
+ * @oper: EVENT_MATCH operator,
+ * @event: event to match against,
+ * @env: NULL-terminated array of environment variables for expansion,
+ * @memo: remembered matches of @event, or NULL.
+ *
+ * Matches @event against @oper unless it already holds an event,
+ * referencing and blocking @event and updating the tree above @oper if
+ * it does.  Operators with an environment to match are looked up in, or
+ * recorded in, @memo when it is given; the others are cheaper to match
+ * than to look up.
+ *
+ * Returns: TRUE if @event matched @oper, FALSE otherwise.
+ **/
+static int
+event_operator_handle_leaf (EventOperator *oper,
+			    Event         *event,
+			    char * const  *env,
+			    EventMemo     *memo)
+{
+	int match;
+
+	nih_assert (oper != NULL);
+	nih_assert (event != NULL);
+
+	if (oper->value)
+		return FALSE;
+
+	if (memo && oper->env) {
+		if (! event_memo_get (memo, oper, &match)) {
+			match = event_operator_match (oper, event, env);
+			event_memo_put (memo, oper, match);
+		}
+	} else {
+		match = event_operator_match (oper, event, env);
+	}
+
+	if (! match)
+		return FALSE;
+
+	oper->value = TRUE;
+
+	oper->event = event;
+	event_block (oper->event);
+
+	event_operator_hold (oper);
+
+	return TRUE;
+}
+
+/**
+ * event_operator_hold:
+ * @oper: EVENT_MATCH operator that has just matched an event.
+ *
+ * Counts the event now held by @oper in each operator between it and
+ * the root of its tree, updating their values for as long as they
+ * change.  The whole tree is updated even when only a subtree was
+ * handled, so that a later reset from the root finds the event.
+ **/
+static void
+event_operator_hold (EventOperator *oper)
+{
+	int changed = TRUE;
+
+	nih_assert (oper != NULL);
+	nih_assert (oper->event != NULL);
+
+	oper->held++;
+
+	while (oper->node.parent) {
+		oper = (EventOperator *)oper->node.parent;
+
+		oper->held++;
+
+		if (changed) {
+			int value = oper->value;
+
 			event_operator_update (oper);
-			break;
-		case EVENT_MATCH:
-			if ((! oper->value)
-			    && event_operator_match (oper, event, env)) {
-				oper->value = TRUE;
+			changed = (oper->value != value);
+		}
+	}
+}
 
-				oper->event = event;
-				event_block (oper->event);
+/**
+ * event_operator_memo:
+ * @event: event about to be handled.
+ *
+ * Looks up the matches remembered for events with the same name and
+ * environment as @event, which may be passed to
+ * event_operator_handle_memo() so that a repeated event need not be
+ * matched against every operator again.
+ *
+ * An event is only remembered the second time one with the same name and
+ * environment is seen.  The memo is emptied whenever an operator with
+ * remembered matches is freed, as happens when the configuration is
+ * reloaded, and when EVENT_MEMO_MAX events are remembered.
+ *
+ * Returns: remembered matches or NULL if @event is not remembered.
+ **/
+EventMemo *
+event_operator_memo (Event *event)
+{
+	EventMemo *memo = NULL;
+	uint32_t   hash;
+	size_t     slot;
 
-				ret = TRUE;
-			}
-			break;
-		default:
-			nih_assert_not_reached ();
+	nih_assert (event != NULL);
+
+	if (event_memo_stale)
+		event_operator_memo_flush ();
+
+	hash = event_memo_hash (event);
+
+	if (event_memos) {
+		while ((memo = (EventMemo *)nih_hash_search (
+				event_memos, event->name,
+				memo ? &memo->entry : NULL)) != NULL) {
+			if ((memo->hash == hash)
+			    && event_memo_env_equal (memo->env, event->env))
+				return memo;
 		}
+	}
+
+	slot = hash & (EVENT_MEMO_SEEN - 1);
+	if (event_memo_seen[slot] != hash) {
+		event_memo_seen[slot] = hash;
+		return NULL;
+	}
+
+	if (event_memos_len >= EVENT_MEMO_MAX)
+		event_operator_memo_flush ();
 
+	if (! event_memos) {
+		event_memos = nih_hash_string_new (NULL, 0);
+		if (! event_memos)
+			return NULL;
 	}
 
-	return ret;
+	/* Remembering the event is only an optimisation, so we do without
+	 * on failure rather than insisting.
+	 */
+	memo = nih_new (event_memos, EventMemo);
+	if (! memo)
+		return NULL;
+
+	nih_list_init (&memo->entry);
+	nih_alloc_set_destructor (memo, nih_list_destroy);
+
+	memo->name = intern_string (memo, event->name);
+	if (! memo->name) {
+		nih_free (memo);
+		return NULL;
+	}
+
+	memo->hash = hash;
+
+	memo->env = NULL;
+	if (event->env) {
+		memo->env = nih_str_array_copy (memo, NULL, event->env);
+		if (! memo->env) {
+			nih_free (memo);
+			return NULL;
+		}
+	}
+
+	memo->results = NULL;
+	memo->results_len = 0;
+
+	nih_hash_add (event_memos, &memo->entry);
+	event_memos_len++;
+
+	return memo;
+}
+
+/**
+ * event_operator_memo_flush:
+ *
+ * Forget all remembered matches.
+ **/
+void
+event_operator_memo_flush (void)
+{
+	if (event_memos) {
+		nih_free (event_memos);
+		event_memos = NULL;
+	}
+
+	event_memos_len = 0;
+	event_memo_stale = FALSE;
+}
+
+/**
+ * event_memo_hash:
+ * @event: event to hash.
+ *
+ * Returns: FNV-1a hash of the name and environment of @event.
+ **/
+static uint32_t
+event_memo_hash (const Event *event)
+{
+	uint32_t hash = 2166136261U;
+
+	nih_assert (event != NULL);
+
+	for (const char *c = event->name; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 16777619U;
+
+	for (char * const *e = event->env; e && *e; e++) {
+		hash = (hash ^ '\n') * 16777619U;
+
+		for (const char *c = *e; *c; c++)
+			hash = (hash ^ (unsigned char)*c) * 16777619U;
+	}
+
+	return hash;
+}
+
+/**
+ * event_memo_env_equal:
+ * @env1: first environment, may be NULL,
+ * @env2: second environment, may be NULL.
+ *
+ * Returns: TRUE if @env1 and @env2 hold the same entries in the same
+ * order, FALSE otherwise.
+ **/
+static int
+event_memo_env_equal (char * const *env1,
+		      char * const *env2)
+{
+	size_t i;
+
+	if (! (env1 && env2))
+		return (! (env1 && *env1)) && (! (env2 && *env2));
+
+	for (i = 0; env1[i] && env2[i]; i++)
+		if ((env1[i] != env2[i]) && strcmp (env1[i], env2[i]))
+			return FALSE;
+
+	return (env1[i] == NULL) && (env2[i] == NULL);
+}
+
+/**
+ * event_memo_get:
+ * @memo: remembered matches,
+ * @oper: EVENT_MATCH operator,
+ * @match: set to the remembered result.
+ *
+ * Looks up the result of matching @oper against the event of @memo.
+ *
+ * Returns: TRUE if it was remembered, FALSE otherwise.
+ **/
+static int
+event_memo_get (const EventMemo     *memo,
+		const EventOperator *oper,
+		int                 *match)
+{
+	size_t lo = 0, hi;
+
+	nih_assert (memo != NULL);
+	nih_assert (oper != NULL);
+	nih_assert (match != NULL);
+
+	/* Results are kept sorted by operator for a binary search */
+	hi = memo->results_len;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (memo->results[mid].oper == oper) {
+			*match = memo->results[mid].match;
+			return TRUE;
+		} else if ((uintptr_t)memo->results[mid].oper < (uintptr_t)oper) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * event_memo_put:
+ * @memo: remembered matches,
+ * @oper: EVENT_MATCH operator,
+ * @match: result of matching @oper against the event of @memo.
+ *
+ * Remembers that @oper did or did not match the event of @memo; if there
+ * is insufficient memory the result is simply not remembered.
+ **/
+static void
+event_memo_put (EventMemo     *memo,
+		EventOperator *oper,
+		int            match)
+{
+	EventMemoResult *results;
+	size_t           i;
+
+	nih_assert (memo != NULL);
+	nih_assert (oper != NULL);
+
+	results = nih_realloc (memo->results, memo,
+			       sizeof (EventMemoResult) * (memo->results_len + 1));
+	if (! results)
+		return;
+
+	memo->results = results;
+
+	for (i = memo->results_len; i > 0; i--) {
+		if ((uintptr_t)results[i - 1].oper < (uintptr_t)oper)
+			break;
+
+		results[i] = results[i - 1];
+	}
+
+	results[i].oper = oper;
+	results[i].match = match;
+	memo->results_len++;
+
+	oper->memoised = TRUE;
 }
 
 
@@ -602,20 +1331,26 @@ event_operator_fds (EventOperator  *root,
 
 		nih_assert (oper->event != NULL);
 
-		if (oper->event->fd >= 0) {
+		/* The event's first file descriptor, then any further ones */
+		for (ssize_t i = -1; i < (ssize_t)oper->event->num_fds; i++) {
+			int fd = (i < 0) ? oper->event->fd : oper->event->fds[i];
+
+			if (fd < 0)
+				continue;
+
 			*fds = nih_realloc (*fds, parent, sizeof (int) * (*num_fds + 1));
 			if (! *fds)
 				return NULL;
 
-			(*fds)[(*num_fds)++] = oper->event->fd;
+			(*fds)[(*num_fds)++] = fd;
 
 			if (evlist[strlen (evlist) - 1] != '=') {
 				if (! nih_strcat_sprintf (&evlist, NULL, " %d",
-							  oper->event->fd))
+							  fd))
 					return NULL;
 			} else {
 				if (! nih_strcat_sprintf (&evlist, NULL, "%d",
-							  oper->event->fd))
+							  fd))
 					return NULL;
 			}
 		}
@@ -684,34 +1419,38 @@ event_operator_events (EventOperator *root,
  *
  * Resets the EventOperator tree rooted at @oper, unblocking and
  * unreferencing any events that were matched by the tree and changing
- * the values of other operators to match.
+ * the values of other operators to match.  Only the operators on the
+ * paths to matched events are visited.
  **/
 void
 event_operator_reset (EventOperator *root)
 {
 	nih_assert (root != NULL);
 
-	/* A post-order iteration means we visit children first, perfect! */
-	NIH_TREE_FOREACH_POST (&root->node, iter) {
-		EventOperator *oper = (EventOperator *)iter;
-
-		switch (oper->type) {
-		case EVENT_OR:
-		case EVENT_AND:
-			event_operator_update (oper);
-			break;
-		case EVENT_MATCH:
-			oper->value = FALSE;
+	/* Nothing below an operator holding no events can be TRUE, so
+	 * only the paths leading to matched events need be cleared.
+	 */
+	if (! root->held)
+		return;
 
-			if (oper->event) {
-				event_unblock (oper->event);
-				oper->event = NULL;
-			}
-			break;
-		default:
-			nih_assert_not_reached ();
+	switch (root->type) {
+	case EVENT_OR:
+	case EVENT_AND:
+		event_operator_reset ((EventOperator *)root->node.left);
+		event_operator_reset ((EventOperator *)root->node.right);
+		break;
+	case EVENT_MATCH:
+		if (root->event) {
+			event_unblock (root->event);
+			root->event = NULL;
 		}
+		break;
+	default:
+		nih_assert_not_reached ();
 	}
+
+	root->value = FALSE;
+	root->held = 0;
 }
 
 /**
@@ -1063,6 +1802,8 @@ event_operator_deserialise (void *parent, json_object *json)
 		oper->event = event_from_index (event_index);
 		if (! oper->event)
 			goto error;
+
+		oper->held = 1;
 	}
 
 	return oper;
@@ -1143,6 +1884,8 @@ event_operator_deserialise_all (void *parent, json_object *json)
 			nih_tree_add (&oper->node, &left_oper->node, NIH_TREE_LEFT);
 			nih_tree_add (&oper->node, &right_oper->node, NIH_TREE_RIGHT);
 
+			oper->held = left_oper->held + right_oper->held;
+
 			/* FALL THROUGH:
 			 *
 			 * This will re-add the operator to the stack.
@@ -1164,6 +1907,11 @@ event_operator_deserialise_all (void *parent, json_object *json)
 	nih_list_remove (stack->next);
 	nih_assert (NIH_LIST_EMPTY (stack));
 
+	if (event_operator_compile_tree (oper) < 0) {
+		nih_free (nih_error_get ());
+		goto error;
+	}
+
 	return oper;
 
 error:
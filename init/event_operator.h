@@ -20,12 +20,32 @@
 #ifndef INIT_EVENT_OPERATOR_H
 #define INIT_EVENT_OPERATOR_H
 
+#include <stdint.h>
+
 #include <nih/macros.h>
+#include <nih/list.h>
 #include <nih/tree.h>
 
 #include "event.h"
 
 
+/**
+ * EVENT_MEMO_MAX:
+ *
+ * Maximum number of distinct events whose matches are remembered at
+ * once; the memo is emptied when it is reached.
+ **/
+#define EVENT_MEMO_MAX 64
+
+/**
+ * EVENT_MEMO_SEEN:
+ *
+ * Number of recently handled events whose hashes are kept to decide
+ * which to remember; must be a power of two.
+ **/
+#define EVENT_MEMO_SEEN 256
+
+
 /**
  * EventOperatorType:
  *
@@ -38,6 +58,47 @@ typedef enum event_operator_type {
 	EVENT_MATCH
 } EventOperatorType;
 
+/**
+ * EventMatch:
+ * @key: name of environment variable to match, or NULL if positional,
+ * @key_len: length of @key,
+ * @negate: TRUE if the result of the match should be negated,
+ * @expand: TRUE if @value contains variable references,
+ * @glob: TRUE if @value contains wildcard characters,
+ * @value: value to match against.
+ *
+ * This structure is the compiled form of a single EventOperator
+ * environment entry, prepared once so that the string need not be
+ * parsed again each time an event is matched against it.
+ *
+ * @key and @value point into the environment entry itself.  When
+ * @expand is FALSE, @value is already its own expansion and, when @glob
+ * is also FALSE, may simply be compared against the event's value.
+ **/
+typedef struct event_match {
+	const char *key;
+	size_t      key_len;
+	int         negate;
+	int         expand;
+	int         glob;
+	const char *value;
+} EventMatch;
+
+/**
+ * EventLeaf:
+ * @name: name of event matched by @oper,
+ * @oper: EVENT_MATCH operator.
+ *
+ * This structure is a single entry of the flattened form of an
+ * EventOperator tree, holding the interned name of the event a leaf
+ * matches beside the leaf itself so that the names of every leaf can be
+ * compared against an event without visiting the operators.
+ **/
+typedef struct event_leaf {
+	const char            *name;
+	struct event_operator *oper;
+} EventLeaf;
+
 /**
  * EventOperator:
  * @node: tree node,
@@ -45,7 +106,13 @@ typedef enum event_operator_type {
  * @value: operator value,
  * @name: name of event to match (EVENT_MATCH only),
  * @env: environment variables of event to match (EVENT_MATCH only),
- * @event: event matched (EVENT_MATCH only).
+ * @match: compiled form of @env (EVENT_MATCH only),
+ * @match_len: number of entries in @match,
+ * @event: event matched (EVENT_MATCH only),
+ * @held: number of events held at or below this operator,
+ * @leaves: EVENT_MATCH operators of the tree, in post-order (root only),
+ * @leaves_len: number of entries in @leaves,
+ * @memoised: TRUE if a match against this operator has been remembered.
  *
  * This structure is used to build up an event expression tree; the leaf
  * nodes are all of EVENT_MATCH type which match a specific event, the other
@@ -57,8 +124,20 @@ typedef enum event_operator_type {
  * the matched event; for EVENT_OR and EVENT_AND operators, @value is set
  * depending on the value of both immediate children.
  *
+ * @match is built from @env by event_operator_compile() and must be
+ * rebuilt whenever @env is changed; when it is NULL, @env is interpreted
+ * directly.
+ *
  * Once an event has been matched, the @event member is set and a reference
  * held until the structure is cleared.
+ *
+ * @held counts the EVENT_MATCH operators at or below this one that hold
+ * an event, so that only those paths of the tree need be visited when it
+ * is reset.
+ *
+ * @leaves is built for the root of a complete tree by
+ * event_operator_compile_tree() and must be rebuilt whenever the shape
+ * of the tree is changed; when it is NULL, the tree is walked instead.
  **/
 typedef struct event_operator {
 	NihTree             node;
@@ -69,9 +148,54 @@ typedef struct event_operator {
 	char               *name;
 	char              **env;
 
+	EventMatch         *match;
+	size_t              match_len;
+
 	Event              *event;
+	size_t              held;
+
+	EventLeaf          *leaves;
+	size_t              leaves_len;
+
+	int                 memoised;
 } EventOperator;
 
+/**
+ * EventMemoResult:
+ * @oper: EVENT_MATCH operator,
+ * @match: TRUE if @oper matched the event.
+ *
+ * Result of matching a single operator against a remembered event.
+ **/
+typedef struct event_memo_result {
+	EventOperator *oper;
+	int            match;
+} EventMemoResult;
+
+/**
+ * EventMemo:
+ * @entry: list header,
+ * @name: name of event,
+ * @env: environment of event,
+ * @hash: hash of @name and @env,
+ * @results: results of matching operators against the event,
+ * @results_len: number of entries in @results.
+ *
+ * This structure remembers which EVENT_MATCH operators of the start on
+ * conditions of job classes matched an event with a given name and
+ * environment, so that when the same event is emitted again they need
+ * not be matched again.  @results is sorted by operator.
+ **/
+typedef struct event_memo {
+	NihList          entry;
+	const char      *name;
+	char           **env;
+	uint32_t         hash;
+
+	EventMemoResult *results;
+	size_t           results_len;
+} EventMemo;
+
 
 NIH_BEGIN_EXTERN
 
@@ -85,12 +209,25 @@ EventOperator *event_operator_copy        (const void *parent,
 
 int            event_operator_destroy     (EventOperator *oper);
 
+int            event_operator_compile     (EventOperator *oper)
+	__attribute__ ((warn_unused_result));
+int            event_operator_compile_tree (EventOperator *root)
+	__attribute__ ((warn_unused_result));
+
 void           event_operator_update      (EventOperator *oper);
 int            event_operator_match       (EventOperator *oper, Event *event,
 					   char * const *env);
 
+int            event_operator_may_match_job (EventOperator *root,
+					     const char *name, const char *job)
+	__attribute__ ((warn_unused_result));
 int            event_operator_handle      (EventOperator *root, Event *event,
 					   char * const *env);
+int            event_operator_handle_memo (EventOperator *root, Event *event,
+					   EventMemo *memo);
+
+EventMemo *    event_operator_memo        (Event *event);
+void           event_operator_memo_flush  (void);
 
 char **        event_operator_environment (EventOperator *root, char ***env,
 					   const void *parent, size_t *len,
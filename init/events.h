@@ -63,6 +63,33 @@
  **/
 #define PWRSTATUS_EVENT "power-status-changed"
 
+/**
+ * TIMER_EVENT:
+ *
+ * Name of the event that we generate for each interval, and each delay
+ * after startup, named by the INTERVAL and AFTER variables of the
+ * start on and stop on conditions of jobs.
+ **/
+#define TIMER_EVENT "timer"
+
+/**
+ * CALENDAR_EVENT:
+ *
+ * Name of the event that we generate at the start of each minute of
+ * the wall clock while the start on or stop on condition of any job
+ * refers to it, with the fields of the local time as its environment.
+ **/
+#define CALENDAR_EVENT "calendar"
+
+/**
+ * PRESSURE_EVENT:
+ *
+ * Name of the event that we generate when pressure on a resource rises
+ * above, or falls back below, a threshold named by the pressure stanza
+ * of any job.
+ **/
+#define PRESSURE_EVENT "pressure"
+
 
 /**
  * JOB_STARTING_EVENT:
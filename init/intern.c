@@ -0,0 +1,134 @@
+/* upstart
+ *
+ * intern.c - shared string table
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+
+#include "intern.h"
+
+
+/**
+ * interned:
+ *
+ * This hash table holds the list of interned strings, indexed by the
+ * string itself.  The table does not hold a reference to the strings,
+ * each is removed once nothing else refers to it.
+ **/
+NihHash *interned = NULL;
+
+
+/**
+ * intern_init:
+ *
+ * Initialise the intern table.
+ **/
+void
+intern_init (void)
+{
+	if (! interned)
+		interned = NIH_MUST (nih_hash_string_new (NULL, 0));
+}
+
+/**
+ * intern_string:
+ * @parent: parent object for string,
+ * @str: string to intern.
+ *
+ * Returns the single shared copy of @str from the intern table, creating
+ * it if necessary.  Since every string returned for the same contents is
+ * the same pointer, two interned strings can be compared for equality by
+ * comparing the pointers.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be given a reference to the returned string.  The string is only
+ * freed when all of its parents are freed; since it is shared, it must
+ * never be freed with nih_free() or modified, use nih_unref() instead.
+ *
+ * Returns: interned string or NULL if insufficient memory.
+ **/
+char *
+intern_string (const void *parent,
+	       const char *str)
+{
+	InternString *intern;
+	char         *new_str;
+
+	nih_assert (str != NULL);
+
+	intern_init ();
+
+	intern = (InternString *)nih_hash_lookup (interned, str);
+	if (intern) {
+		if (parent)
+			nih_ref (intern->str, parent);
+
+		return intern->str;
+	}
+
+	new_str = nih_strdup (parent, str);
+	if (! new_str)
+		return NULL;
+
+	intern = nih_new (new_str, InternString);
+	if (! intern) {
+		nih_free (new_str);
+		return NULL;
+	}
+
+	nih_list_init (&intern->entry);
+	nih_alloc_set_destructor (intern, nih_list_destroy);
+
+	intern->str = new_str;
+
+	nih_hash_add (interned, &intern->entry);
+
+	return new_str;
+}
+
+/**
+ * intern_contains:
+ * @str: string to check.
+ *
+ * Returns: TRUE if @str is the shared copy of its contents held in the
+ * intern table, FALSE otherwise.
+ **/
+int
+intern_contains (const char *str)
+{
+	InternString *intern;
+
+	nih_assert (str != NULL);
+
+	if (! interned)
+		return FALSE;
+
+	intern = (InternString *)nih_hash_lookup (interned, str);
+
+	return (intern && (intern->str == str));
+}
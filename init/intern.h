@@ -0,0 +1,57 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_INTERN_H
+#define INIT_INTERN_H
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+
+/**
+ * InternString:
+ * @entry: list header,
+ * @str: interned string.
+ *
+ * This structure is used to index the strings in the intern table; it
+ * is allocated as a child of @str so that it is removed from the table
+ * when the last reference to @str is dropped.
+ **/
+typedef struct intern_string {
+	NihList  entry;
+	char    *str;
+} InternString;
+
+
+NIH_BEGIN_EXTERN
+
+extern NihHash *interned;
+
+
+void  intern_init   (void);
+
+char *intern_string (const void *parent, const char *str)
+	__attribute__ ((warn_unused_result));
+
+int   intern_contains (const char *str)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_INTERN_H */
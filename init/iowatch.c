@@ -0,0 +1,326 @@
+/* upstart
+ *
+ * iowatch.c - epoll backend for file descriptor watches
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/epoll.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "iowatch.h"
+
+
+/* Prototypes for static functions */
+static int  iowatch_destroy  (IoWatch *iowatch);
+static void iowatch_dispatch (void *data, NihIoWatch *watch,
+			      NihIoEvents events);
+
+
+/**
+ * use_epoll:
+ *
+ * If TRUE, init creates iowatch_epoll at startup so that the watches of
+ * job logs, process file descriptors and configuration directories are
+ * served by it rather than by the main loop's select().
+ **/
+int use_epoll = FALSE;
+
+/**
+ * iowatch_epoll:
+ *
+ * epoll instance that adopted watches are registered with, or -1 if
+ * iowatch_init() hasn't been called.
+ **/
+int iowatch_epoll = -1;
+
+/**
+ * iowatch_epoll_watch:
+ *
+ * Watch on iowatch_epoll in the main loop's select() set, which becomes
+ * readable whenever any adopted watch is ready.
+ **/
+static NihIoWatch *iowatch_epoll_watch = NULL;
+
+/**
+ * iowatch_fds:
+ *
+ * Adopted watches indexed by file descriptor, and the size of the array.
+ * Events are looked up here rather than carrying a pointer, since the
+ * registration of a descriptor closed while a forked child still shares
+ * it can outlive the watch.
+ **/
+static IoWatch **iowatch_fds = NULL;
+static size_t    iowatch_fds_size = 0;
+
+
+/**
+ * iowatch_init:
+ *
+ * Create iowatch_epoll and add it to the main loop.  Until this is
+ * called, iowatch_adopt() leaves watches in the select() set.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+iowatch_init (void)
+{
+	if (iowatch_epoll >= 0)
+		return 0;
+
+	iowatch_epoll = epoll_create1 (EPOLL_CLOEXEC);
+	if (iowatch_epoll < 0)
+		nih_return_system_error (-1);
+
+	iowatch_epoll_watch = nih_io_add_watch (NULL, iowatch_epoll,
+						NIH_IO_READ,
+						iowatch_dispatch, NULL);
+	if (! iowatch_epoll_watch) {
+		close (iowatch_epoll);
+		iowatch_epoll = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * iowatch_close:
+ *
+ * Remove iowatch_epoll from the main loop and close it, returning every
+ * adopted watch to the select() set.
+ **/
+void
+iowatch_close (void)
+{
+	if (iowatch_epoll < 0)
+		return;
+
+	for (size_t fd = 0; fd < iowatch_fds_size; fd++) {
+		IoWatch *iowatch = iowatch_fds[fd];
+
+		if (! iowatch)
+			continue;
+
+		nih_list_add (nih_io_watches, &iowatch->watch->entry);
+		nih_free (iowatch);
+	}
+
+	nih_free (iowatch_epoll_watch);
+	iowatch_epoll_watch = NULL;
+
+	close (iowatch_epoll);
+	iowatch_epoll = -1;
+}
+
+/**
+ * iowatch_adopt:
+ * @watch: watch to adopt.
+ *
+ * Take @watch out of the main loop's select() set and register its file
+ * descriptor with iowatch_epoll, edge-triggered, so that it costs nothing
+ * on each pass through the main loop until it is ready.
+ *
+ * Since readiness is only reported when it changes, @watch must only be
+ * watching for input or exceptions, and its watcher must read until the
+ * descriptor would block; the watcher of NihIo does so.
+ *
+ * @watch is left where it is if iowatch_init() hasn't been called or
+ * the descriptor can't be registered.
+ *
+ * Returns: zero on success, negative value if @watch wasn't adopted.
+ **/
+int
+iowatch_adopt (NihIoWatch *watch)
+{
+	IoWatch            *iowatch;
+	struct epoll_event  event;
+
+	nih_assert (watch != NULL);
+	nih_assert (watch->fd >= 0);
+	nih_assert (! (watch->events & NIH_IO_WRITE));
+
+	if (iowatch_epoll < 0)
+		return -1;
+
+	if ((size_t)watch->fd >= iowatch_fds_size) {
+		IoWatch **new_fds;
+		size_t    new_size;
+
+		new_size = iowatch_fds_size ? iowatch_fds_size : 64;
+		while (new_size <= (size_t)watch->fd)
+			new_size *= 2;
+
+		new_fds = nih_realloc (iowatch_fds, NULL,
+				       sizeof (IoWatch *) * new_size);
+		if (! new_fds)
+			return -1;
+
+		memset (new_fds + iowatch_fds_size, 0,
+			sizeof (IoWatch *) * (new_size - iowatch_fds_size));
+
+		iowatch_fds = new_fds;
+		iowatch_fds_size = new_size;
+	}
+
+	iowatch = nih_new (watch, IoWatch);
+	if (! iowatch)
+		return -1;
+
+	iowatch->fd = watch->fd;
+	iowatch->watch = watch;
+
+	memset (&event, 0, sizeof (event));
+	event.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLET;
+	event.data.fd = watch->fd;
+
+	/* A stale registration of an earlier descriptor with the same
+	 * number is replaced.
+	 */
+	if ((epoll_ctl (iowatch_epoll, EPOLL_CTL_ADD, watch->fd, &event) < 0)
+	    && ((errno != EEXIST)
+		|| (epoll_ctl (iowatch_epoll, EPOLL_CTL_MOD, watch->fd,
+			       &event) < 0))) {
+		nih_warn ("%s: %s", _("Unable to watch file descriptor"),
+			  strerror (errno));
+		nih_free (iowatch);
+		return -1;
+	}
+
+	if (iowatch_fds[watch->fd])
+		iowatch_fds[watch->fd]->fd = -1;
+
+	iowatch_fds[watch->fd] = iowatch;
+	nih_alloc_set_destructor (iowatch, iowatch_destroy);
+
+	nih_list_remove (&watch->entry);
+
+	return 0;
+}
+
+/**
+ * iowatch_destroy:
+ * @iowatch: adopted watch being freed.
+ *
+ * Forget @iowatch and remove its file descriptor from iowatch_epoll;
+ * the descriptor may already have been closed, in which case the kernel
+ * has removed it unless a forked child still shares it.
+ *
+ * Returns: zero.
+ **/
+static int
+iowatch_destroy (IoWatch *iowatch)
+{
+	nih_assert (iowatch != NULL);
+
+	if (iowatch->fd < 0)
+		return 0;
+
+	nih_assert ((size_t)iowatch->fd < iowatch_fds_size);
+
+	if (iowatch_fds[iowatch->fd] == iowatch) {
+		iowatch_fds[iowatch->fd] = NULL;
+
+		if (iowatch_epoll >= 0)
+			(void)epoll_ctl (iowatch_epoll, EPOLL_CTL_DEL,
+					 iowatch->fd, NULL);
+	}
+
+	return 0;
+}
+
+/**
+ * iowatch_dispatch:
+ * @data: not used,
+ * @watch: watch on iowatch_epoll,
+ * @events: events that occurred.
+ *
+ * Called when iowatch_epoll is readable, collects the adopted watches
+ * that are ready and calls their watchers, as the main loop would have
+ * after select().  Descriptors that have hung up or failed are reported
+ * as readable, since that is how select() reports them.
+ **/
+static void
+iowatch_dispatch (void        *data,
+		  NihIoWatch  *watch,
+		  NihIoEvents  events)
+{
+	struct epoll_event ready[IOWATCH_EVENTS_MAX];
+	int                count;
+
+	nih_assert (watch == iowatch_epoll_watch);
+
+	for (;;) {
+		count = epoll_wait (iowatch_epoll, ready,
+				    IOWATCH_EVENTS_MAX, 0);
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+
+			nih_warn ("%s: %s", _("Unable to poll file descriptors"),
+				  strerror (errno));
+			return;
+		}
+
+		for (int i = 0; i < count; i++) {
+			IoWatch     *iowatch;
+			NihIoEvents  ready_events = NIH_IO_NONE;
+			int          fd = ready[i].data.fd;
+
+			/* Looked up afresh each time, since an earlier
+			 * watcher may have freed this one.
+			 */
+			if ((fd < 0) || ((size_t)fd >= iowatch_fds_size))
+				continue;
+
+			iowatch = iowatch_fds[fd];
+			if (! iowatch)
+				continue;
+
+			if (ready[i].events & (EPOLLIN | EPOLLRDHUP
+					       | EPOLLHUP | EPOLLERR))
+				ready_events |= NIH_IO_READ;
+			if (ready[i].events & EPOLLPRI)
+				ready_events |= NIH_IO_EXCEPT;
+
+			ready_events &= iowatch->watch->events;
+			if (! ready_events)
+				continue;
+
+			iowatch->watch->watcher (iowatch->watch->data,
+						 iowatch->watch,
+						 ready_events);
+		}
+
+		if (count < IOWATCH_EVENTS_MAX)
+			break;
+	}
+}
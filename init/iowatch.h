@@ -0,0 +1,63 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_IOWATCH_H
+#define INIT_IOWATCH_H
+
+#include <nih/macros.h>
+#include <nih/io.h>
+
+
+/**
+ * IOWATCH_EVENTS_MAX:
+ *
+ * Number of ready file descriptors collected by each call to
+ * epoll_wait().
+ **/
+#define IOWATCH_EVENTS_MAX 64
+
+
+/**
+ * IoWatch:
+ * @fd: file descriptor registered with the epoll instance,
+ * @watch: NihIoWatch whose watcher is called.
+ *
+ * Records a NihIoWatch that has been taken out of the main loop's
+ * select() set and registered with iowatch_epoll instead.  It is
+ * allocated as a child of @watch, so is freed along with it.
+ **/
+typedef struct io_watch {
+	int         fd;
+	NihIoWatch *watch;
+} IoWatch;
+
+
+NIH_BEGIN_EXTERN
+
+extern int use_epoll;
+extern int iowatch_epoll;
+
+int  iowatch_init  (void)
+	__attribute__ ((warn_unused_result));
+void iowatch_close (void);
+
+int  iowatch_adopt (NihIoWatch *watch);
+
+NIH_END_EXTERN
+
+#endif /* INIT_IOWATCH_H */
@@ -26,7 +26,11 @@
 #include <sys/types.h>
 
 #include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -54,9 +58,13 @@
 #include "event_operator.h"
 #include "blocked.h"
 #include "control.h"
+#include "snapshot.h"
+#include "resource.h"
+#include "intern.h"
 #include "parse_job.h"
 #include "state.h"
 #include "apparmor.h"
+#include "conf.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
@@ -82,16 +90,59 @@ job_trace_state_str_to_enum (const char *state)
 	__attribute__ ((warn_unused_result));
 
 static json_object *
-job_serialise_kill_timer (NihTimer *timer)
+job_serialise_kill_timer (Deadline *timer)
 	__attribute__ ((warn_unused_result));
 
-static NihTimer *
+static Deadline *
 job_deserialise_kill_timer (json_object *json)
 	__attribute__ ((warn_unused_result));
 
 static int 
 job_destroy (Job *job);
 
+static void job_respawn_wait  (Job *job, time_t delay);
+static void job_respawn_timer (Job *job, Deadline *timer);
+
+static void job_timeline_append (const char *job, const char *instance,
+				 JobTimelineType type, JobState state,
+				 ProcessType process);
+
+static int   job_stats      (Job *job, JobStats *stats);
+static int   job_event_observed (Job *job, const char *name)
+	__attribute__ ((warn_unused_result));
+static FILE *job_stats_open (const char *dir, const char *name);
+
+static int   job_spread_slot (JobClass *class);
+
+#ifdef ENABLE_CGROUPS
+static char **job_cgroup_environment (const void *parent, Job *job)
+	__attribute__ ((warn_unused_result));
+#endif /* ENABLE_CGROUPS */
+
+/**
+ * job_quiet_events:
+ *
+ * If TRUE, the starting, started and stopped events of a job are not
+ * queued when no start on or stop on condition could match them.
+ **/
+int job_quiet_events = FALSE;
+
+/**
+ * job_timeline:
+ *
+ * Ring of JOB_TIMELINE_SIZE records, allocated by the first call to
+ * job_timeline_add().
+ **/
+static JobTimelineRecord *job_timeline = NULL;
+
+/**
+ * job_timeline_next:
+ *
+ * Number of records ever added to job_timeline; the next is written at
+ * this index modulo JOB_TIMELINE_SIZE.
+ **/
+static size_t job_timeline_next = 0;
+
 /**
  * job_destroy:
  *
@@ -120,6 +171,8 @@ job_destroy (Job *job)
 			}
 		}
 	}
+	resource_release (job);
+
 	nih_list_destroy (&job->entry);
 
 	return 0;
@@ -230,19 +283,37 @@ job_new (JobClass   *class,
 
 	job->respawn_time = 0;
 	job->respawn_count = 0;
+	job->respawn_delay = 0;
+	job->respawn_timer = NULL;
+
+	job->pooled = FALSE;
+	job->pool_timer = NULL;
 
 	job->trace_forks = 0;
 	job->trace_state = TRACE_NONE;
+	job->trace_cgroup = NULL;
+
+	job->admitted = FALSE;
+	job->admission = NULL;
+
+	job->spread_slot = (class->spread != JOB_SPREAD_NONE
+			    ? job_spread_slot (class) : -1);
 
 	nih_hash_add (class->instances, &job->entry);
 
+	job_subscription_add (job->stop_on, NULL, job);
+
 	NIH_LIST_FOREACH (control_conns, iter) {
 		NihListEntry   *entry = (NihListEntry *)iter;
 		DBusConnection *conn = (DBusConnection *)entry->data;
 
-		job_register (job, conn, TRUE);
+		if (control_register_instances (conn))
+			job_register (job, conn, TRUE);
 	}
 
+	control_change (CONTROL_CHANGE_INSTANCE_ADDED, job->path, NULL, NULL);
+	snapshot_changed ();
+
 	/* Since some job processes can run in parallel, we must ensure
 	 * that the asynchronous-spawning of such job processes is
 	 * handled by providing a handler for each pid.
@@ -268,6 +339,47 @@ error:
 	return NULL;
 }
 
+/**
+ * job_spread_slot:
+ * @class: job class.
+ *
+ * Find the lowest slot not held by an existing instance of @class, which
+ * chooses the CPU or NUMA node a new instance is placed on so that
+ * instances fill the gaps left by those that have gone.
+ *
+ * Returns: free slot.
+ **/
+static int
+job_spread_slot (JobClass *class)
+{
+	size_t count = 0;
+	int    slot;
+
+	nih_assert (class != NULL);
+
+	NIH_HASH_FOREACH (class->instances, iter)
+		count++;
+
+	{
+		char used[count + 1];
+
+		memset (used, 0, sizeof (used));
+
+		NIH_HASH_FOREACH (class->instances, iter) {
+			Job *job = (Job *)iter;
+
+			if ((job->spread_slot >= 0)
+			    && ((size_t)job->spread_slot <= count))
+				used[job->spread_slot] = TRUE;
+		}
+
+		for (slot = 0; used[slot]; slot++)
+			;
+	}
+
+	return slot;
+}
+
 /**
  * job_register:
  * @job: job to register,
@@ -285,7 +397,10 @@ job_register (Job            *job,
 	nih_assert (job != NULL);
 	nih_assert (conn != NULL);
 
-	NIH_MUST (nih_dbus_object_new (job, conn, job->path,
+	/* Attached to the path rather than the job, so that the objects
+	 * are unregistered along with it when the job is renamed.
+	 */
+	NIH_MUST (nih_dbus_object_new (job->path, conn, job->path,
 				       job_interfaces, job));
 
 	nih_debug ("Registered instance %s", job->path);
@@ -295,6 +410,140 @@ job_register (Job            *job,
 							 job->path));
 }
 
+/**
+ * job_rename:
+ * @job: job to rename,
+ * @name: new name for instance.
+ *
+ * Give @job the instance name @name, and the D-Bus object path that goes
+ * with it, as though the instance under its old name had been removed
+ * and one under @name added.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+int
+job_rename (Job        *job,
+	    const char *name)
+{
+	char *new_name;
+	char *new_path;
+
+	nih_assert (job != NULL);
+	nih_assert (name != NULL);
+
+	new_name = nih_strdup (job, name);
+	if (! new_name)
+		return -1;
+
+	if (job->class->session && job->class->session->chroot) {
+		new_path = nih_dbus_path (job, job->class->path, new_name, NULL);
+	} else {
+		new_path = nih_dbus_path (job, DBUS_PATH_UPSTART, "jobs",
+				job->class->name, new_name, NULL);
+	}
+
+	if (! new_path) {
+		nih_free (new_name);
+		return -1;
+	}
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry   *entry = (NihListEntry *)iter;
+		DBusConnection *conn = (DBusConnection *)entry->data;
+
+		if (! control_register_instances (conn))
+			continue;
+
+		NIH_ZERO (job_class_emit_instance_removed (
+				  conn, job->class->path, job->path));
+	}
+
+	control_change (CONTROL_CHANGE_INSTANCE_REMOVED, job->path,
+			NULL, NULL);
+
+	/* Freeing the old path unregisters its objects */
+	nih_free (job->path);
+	nih_free (job->name);
+
+	job->name = new_name;
+	job->path = new_path;
+
+	nih_list_remove (&job->entry);
+	nih_hash_add (job->class->instances, &job->entry);
+
+	NIH_LIST_FOREACH (control_conns, iter) {
+		NihListEntry   *entry = (NihListEntry *)iter;
+		DBusConnection *conn = (DBusConnection *)entry->data;
+
+		if (control_register_instances (conn))
+			job_register (job, conn, TRUE);
+	}
+
+	control_change (CONTROL_CHANGE_INSTANCE_ADDED, job->path, NULL, NULL);
+	snapshot_changed ();
+
+	return 0;
+}
+
+
+/**
+ * job_parked:
+ * @job: job to check.
+ *
+ * Spare instances started by job_class_pool_fill() run their pre-start
+ * process and then wait in the pre-start state, parked, until they are
+ * handed out by a start request.
+ *
+ * Returns: TRUE if @job is a parked spare instance, FALSE otherwise.
+ **/
+int
+job_parked (Job *job)
+{
+	nih_assert (job != NULL);
+
+	return (job->pooled
+		&& (job->state == JOB_PRE_START)
+		&& (job->pid[PROCESS_PRE_START] <= 0));
+}
+
+/**
+ * job_unpool:
+ * @job: spare instance being handed out.
+ *
+ * Make the spare instance @job an ordinary one, taking the environment
+ * from its start_env member, and spawn its main process now if it was
+ * parked waiting to do so.  The spare should already have been renamed
+ * with job_rename().
+ **/
+void
+job_unpool (Job *job)
+{
+	int parked;
+
+	nih_assert (job != NULL);
+	nih_assert (job->pooled);
+	nih_assert (job->goal == JOB_START);
+
+	parked = job_parked (job);
+	job->pooled = FALSE;
+
+	if (job->pool_timer) {
+		nih_free (job->pool_timer);
+		job->pool_timer = NULL;
+	}
+
+	if (job->start_env) {
+		if (job->env)
+			nih_unref (job->env, job);
+
+		job->env = job->start_env;
+		job->start_env = NULL;
+	}
+
+	if (parked)
+		job_change_state (job, job_next_state (job));
+}
+
 
 /**
  * job_change_goal:
@@ -345,13 +594,19 @@ job_change_goal (Job     *job,
 				job_goal_name (job->goal)));
 	}
 
+	control_change (CONTROL_CHANGE_STATUS, job->path,
+			job_goal_name (job->goal), job_state_name (job->state));
+	snapshot_changed ();
+
 
 	/* Normally whatever process or event is associated with the state
 	 * will finish naturally, so all we need do is change the goal and
 	 * we'll change direction through the state machine at that point.
 	 *
 	 * The exceptions are the natural rest states of waiting and a
-	 * running process; these need induction to get them moving.
+	 * running process, a job waiting for resources in starting and
+	 * a spare instance parked in pre-start; these need induction to
+	 * get them moving.
 	 */
 	switch (goal) {
 	case JOB_START:
@@ -360,7 +615,18 @@ job_change_goal (Job     *job,
 
 		break;
 	case JOB_STOP:
-		if (job->state == JOB_RUNNING)
+		/* A respawn that is yet to happen is forgotten, and one
+		 * that is waiting in post-stop is made due at once so
+		 * that the job finishes stopping, or is started again if
+		 * restarted, from the main loop; @job must remain valid
+		 * on return.
+		 */
+		job->respawn_delay = 0;
+		if (job->respawn_timer)
+			deadline_set_due (job->respawn_timer, 0);
+
+		if ((job->state == JOB_RUNNING) || resource_waiting (job)
+		    || job_parked (job))
 			job_change_state (job, job_next_state (job));
 
 		break;
@@ -398,6 +664,7 @@ job_change_state (Job      *job,
 
 	while (job->state != state) {
 		JobState old_state;
+		JobStats stats;
 		int      unused;
 
 		/* If we got blocked during async spawns, stop
@@ -406,6 +673,32 @@ job_change_state (Job      *job,
 		if (job->blocker)
 		    return;
 
+		/* Jobs that use resources wait in starting until enough
+		 * of them are available, see resource_poll().
+		 */
+		if ((job->state == JOB_STARTING)
+		    && (state == JOB_SECURITY_SPAWNING)
+		    && (! resource_acquire (job)))
+			return;
+
+		/* Spare instances wait in pre-start until they are handed
+		 * out, see job_unpool().
+		 */
+		if (job->pooled
+		    && (job->state == JOB_PRE_START)
+		    && (state == JOB_SPAWNING))
+			return;
+
+		/* Jobs respawned with a delay wait in post-stop until it
+		 * has passed, see job_respawn_timer().
+		 */
+		if ((job->state == JOB_POST_STOP)
+		    && (state == JOB_STARTING)
+		    && job->respawn_delay) {
+			job_respawn_wait (job, job->respawn_delay);
+			return;
+		}
+
 		nih_info (_("%s state changed from %s to %s"), job_name (job),
 			  job_state_name (job->state), job_state_name (state));
 
@@ -421,6 +714,13 @@ job_change_state (Job      *job,
 					job_state_name (job->state)));
 		}
 
+		control_change (CONTROL_CHANGE_STATUS, job->path,
+				job_goal_name (job->goal),
+				job_state_name (job->state));
+		snapshot_changed ();
+
+		job_timeline_add (job, JOB_TIMELINE_STATE, PROCESS_INVALID);
+
 		/* Perform whatever action is necessary to enter the new
 		 * state, such as executing a process or emitting an event.
 		 */
@@ -453,15 +753,23 @@ job_change_state (Job      *job,
 			job->failed_process = PROCESS_INVALID;
 			job->exit_status = 0;
 
+			/* Nothing observes the starting event when it's
+			 * not queued, so carry straight on.
+			 */
 			job->blocker = job_emit_event (job);
+			if (! job->blocker)
+				state = job_next_state (job);
 
 			break;
 		case JOB_SECURITY_SPAWNING:
 			nih_assert (job->goal == JOB_START);
 			nih_assert (old_state == JOB_STARTING);
 
-			if (job->class->process[PROCESS_SECURITY]
-			    && apparmor_available()) {
+			/* An unchanged profile that is already loaded
+			 * need not be loaded again.
+			 */
+			if (apparmor_load_needed (job->class)) {
+				apparmor_load_begin (job->class);
 				job_process_start (job, PROCESS_SECURITY);
 			}
 			state = job_next_state (job);
@@ -470,10 +778,8 @@ job_change_state (Job      *job,
 			nih_assert (job->goal == JOB_START);
 			nih_assert (old_state == JOB_SECURITY_SPAWNING);
 
-			if (! (job->class->process[PROCESS_SECURITY]
-			       && apparmor_available())) {
+			if (! job->pid[PROCESS_SECURITY])
 				state = job_next_state (job);
-			}
 			break;
 		case JOB_PRE_STARTING:
 			nih_assert (job->goal == JOB_START);
@@ -551,10 +857,13 @@ job_change_state (Job      *job,
 				job_emit_event (job);
 
 				/* If we're not a task, our goal is to be
-				 * running.
+				 * running; and the resources it used to
+				 * get there can go to other jobs.
 				 */
-				if (! job->class->task)
+				if (! job->class->task) {
+					resource_release (job);
 					job_finished (job, FALSE);
+				}
 			}
 
 			break;
@@ -585,6 +894,8 @@ job_change_state (Job      *job,
 				    || (old_state == JOB_RUNNING)
 				    || (old_state == JOB_PRE_STOP));
 
+			resource_release (job);
+
 			job->blocker = job_emit_event (job);
 
 			break;
@@ -623,6 +934,28 @@ job_change_state (Job      *job,
 
 			job_finished (job, FALSE);
 
+			/* Record what the job used before its cgroup goes */
+			if (job_stats (job, &stats))
+				nih_info (_("%s used %" PRIu64 "us of CPU time, "
+					    "%" PRIu64 " bytes of memory at peak, "
+					    "read %" PRIu64 " and wrote %" PRIu64
+					    " bytes"),
+					  job_name (job), stats.cpu_usec,
+					  stats.memory_peak, stats.io_read_bytes,
+					  stats.io_write_bytes);
+
+#ifdef ENABLE_CGROUPS
+			/* Cgroups managed directly are not removed for us
+			 * once empty, so remove them now.
+			 */
+			if (cgroup_root && job_class_cgroups (job->class)) {
+				nih_local char **env = NULL;
+
+				env = job_cgroup_environment (NULL, job);
+				cgroup_remove (&job->class->cgroups, env);
+			}
+#endif /* ENABLE_CGROUPS */
+
 			/* Remove the job from the list of instances and
 			 * then allow a better class to replace us
 			 * in the hash table if we have no other instances
@@ -647,12 +980,19 @@ job_change_state (Job      *job,
 					NihListEntry   *entry = (NihListEntry *)iter;
 					DBusConnection *conn = (DBusConnection *)entry->data;
 
+					if (! control_register_instances (conn))
+						continue;
+
 					NIH_ZERO (job_class_emit_instance_removed (
 							  conn,
 							  job->class->path,
 							  job->path));
 				}
 
+				control_change (CONTROL_CHANGE_INSTANCE_REMOVED,
+						job->path, NULL, NULL);
+				snapshot_changed ();
+
 				/* Destroy the instance */
 				nih_free (job);
 			}
@@ -856,6 +1196,61 @@ job_next_state (Job *job)
 }
 
 
+/**
+ * job_respawn_wait:
+ * @job: job being respawned,
+ * @delay: seconds to wait.
+ *
+ * Hold @job in the post-stop state for @delay seconds before it is
+ * started again.
+ **/
+static void
+job_respawn_wait (Job    *job,
+		  time_t  delay)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->state == JOB_POST_STOP);
+	nih_assert (job->respawn_timer == NULL);
+
+	nih_info (_("%s respawning in %ld seconds"), job_name (job),
+		  (long)delay);
+
+	job->respawn_delay = 0;
+	job->respawn_timer = NIH_MUST (deadline_add_timeout (
+			job, delay, (DeadlineCb)job_respawn_timer, job));
+}
+
+/**
+ * job_respawn_timer:
+ * @job: job being respawned,
+ * @timer: timer that is due.
+ *
+ * Called once the delay before respawning @job has passed, to start it
+ * again, or once it has been stopped while waiting, to finish stopping
+ * it; the time of a respawn is recorded so that the next delay can be
+ * chosen.
+ **/
+static void
+job_respawn_timer (Job      *job,
+		   Deadline *timer)
+{
+	struct timespec now;
+
+	nih_assert (job != NULL);
+	nih_assert (job->respawn_timer == timer);
+	nih_assert (job->state == JOB_POST_STOP);
+
+	/* Freed by our caller on return */
+	job->respawn_timer = NULL;
+
+	if (job->goal == JOB_START) {
+		nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+		job->respawn_time = now.tv_sec;
+	}
+
+	job_change_state (job, job_next_state (job));
+}
+
 /**
  * job_failed:
  * @job: job that has failed,
@@ -1023,14 +1418,19 @@ job_finished (Job *job,
  * that caused the failure and either an EXIT_STATUS or EXIT_SIGNAL
  * environment variable detailing it.
  *
- * Returns: new Event in the queue.
+ * When job_quiet_events is TRUE, the starting, started and stopped events
+ * are not queued if no start on or stop on condition could match them;
+ * only the EventEmitted signal is sent.  The stopping event is always
+ * queued since the job may be freed once it is no longer blocked.
+ *
+ * Returns: new Event in the queue, or NULL if it was not queued.
  **/
 Event *
 job_emit_event (Job *job)
 {
 	Event           *event;
 	const char      *name;
-	int              block = FALSE, stop = FALSE;
+	int              block = FALSE, stop = FALSE, quiet = FALSE;
 	nih_local char **env = NULL;
 	char           **e;
 	size_t           len;
@@ -1058,6 +1458,16 @@ job_emit_event (Job *job)
 		nih_assert_not_reached ();
 	}
 
+	if (job_quiet_events && (job->state != JOB_STOPPING)
+	    && (! job_event_observed (job, name))) {
+		quiet = TRUE;
+
+		/* Nobody to tell either */
+		control_init ();
+		if (NIH_LIST_EMPTY (control_conns))
+			return NULL;
+	}
+
 	len = 0;
 	env = NIH_MUST (nih_str_array_new (NULL));
 
@@ -1126,8 +1536,14 @@ job_emit_event (Job *job)
 			NIH_MUST (environ_add (&env, NULL, &len, FALSE, *str));
 	}
 
+	if (quiet) {
+		control_notify_event (name, env);
+		return NULL;
+	}
+
 	event = NIH_MUST (event_new (NULL, name, env));
 	event->session = job->class->session;
+	event_set_emitter (event, job_name (job));
 
 	if (block) {
 		Blocked *blocked;
@@ -1140,6 +1556,57 @@ job_emit_event (Job *job)
 }
 
 
+/**
+ * job_event_observed:
+ * @job: job generating the event,
+ * @name: name of event.
+ *
+ * Checks whether the start on condition of any job class, or the stop on
+ * condition of any instance, in the session of @job could match its
+ * @name event; job files that might reference it are parsed first.
+ *
+ * Returns: TRUE if the event could affect any job, FALSE otherwise.
+ **/
+static int
+job_event_observed (Job        *job,
+		    const char *name)
+{
+	JobSubscription *sub = NULL;
+
+	nih_assert (job != NULL);
+	nih_assert (name != NULL);
+
+	job_class_init ();
+
+	conf_lazy_load_event (name);
+
+	while ((sub = (JobSubscription *)nih_hash_search (
+			job_subscriptions, name,
+			sub ? &sub->entry : NULL)) != NULL) {
+		JobClass      *class;
+		EventOperator *root;
+
+		class = sub->job ? sub->job->class : sub->class;
+		root = sub->job ? sub->job->stop_on : sub->class->start_on;
+
+		/* As event_pending_handle_jobs() */
+		if (NIH_LIST_EMPTY (&class->entry))
+			continue;
+
+		if (job->class->session
+		    && (class->session != job->class->session))
+			continue;
+
+		if ((! root)
+		    || event_operator_may_match_job (root, name,
+						     job->class->name))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
 /**
  * job_name:
  * @job: job to return name of.
@@ -1325,6 +1792,166 @@ job_state_from_name (const char *state)
 }
 
 
+/**
+ * job_timeline_add:
+ * @job: job to record,
+ * @type: type of record,
+ * @process: process spawned or exec'd.
+ *
+ * Appends a record of @type for @job to the timeline, stamped with the
+ * current time; JOB_TIMELINE_STATE records take the current state of
+ * @job and ignore @process.
+ **/
+void
+job_timeline_add (Job             *job,
+		  JobTimelineType  type,
+		  ProcessType      process)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->class != NULL);
+	nih_assert (type != JOB_TIMELINE_EVENT);
+
+	job_timeline_append (job->class->name, job->name, type, job->state,
+			     (type == JOB_TIMELINE_STATE) ? PROCESS_INVALID : process);
+}
+
+/**
+ * job_timeline_add_event:
+ * @name: name of event.
+ *
+ * Appends a record of the event @name to the timeline, stamped with the
+ * current time; called as each event is handled so that the jobs it
+ * started can be traced back to it.
+ **/
+void
+job_timeline_add_event (const char *name)
+{
+	nih_assert (name != NULL);
+
+	job_timeline_append (name, "", JOB_TIMELINE_EVENT, JOB_WAITING,
+			     PROCESS_INVALID);
+}
+
+/**
+ * job_timeline_append:
+ * @job: name of job class or event,
+ * @instance: name of instance,
+ * @type: type of record,
+ * @state: state entered,
+ * @process: process spawned or exec'd.
+ *
+ * Appends a record to the timeline, replacing the oldest once
+ * JOB_TIMELINE_SIZE records are held.
+ *
+ * The names are interned so that the many transitions of a single job
+ * share one copy of each; every record still takes a reference to them,
+ * which allocates, since the intern table does not keep them alive.
+ **/
+static void
+job_timeline_append (const char      *job,
+		     const char      *instance,
+		     JobTimelineType  type,
+		     JobState         state,
+		     ProcessType      process)
+{
+	JobTimelineRecord *record;
+	char              *job_str;
+	char              *instance_str;
+
+	nih_assert (job != NULL);
+	nih_assert (instance != NULL);
+
+	if (! job_timeline)
+		job_timeline = NIH_MUST (nih_alloc (NULL, sizeof (JobTimelineRecord)
+						     * JOB_TIMELINE_SIZE));
+
+	job_str = intern_string (job_timeline, job);
+	instance_str = intern_string (job_timeline, instance);
+	if (! (job_str && instance_str)) {
+		if (job_str)
+			nih_unref (job_str, job_timeline);
+		if (instance_str)
+			nih_unref (instance_str, job_timeline);
+		return;
+	}
+
+	record = &job_timeline[job_timeline_next % JOB_TIMELINE_SIZE];
+	if (job_timeline_next >= JOB_TIMELINE_SIZE) {
+		nih_unref (record->job, job_timeline);
+		nih_unref (record->instance, job_timeline);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &record->time);
+	record->job = job_str;
+	record->instance = instance_str;
+	record->type = type;
+	record->state = state;
+	record->process = process;
+
+	job_timeline_next++;
+}
+
+/**
+ * job_timeline_count:
+ *
+ * Returns: number of records held in the timeline.
+ **/
+size_t
+job_timeline_count (void)
+{
+	return (job_timeline_next < JOB_TIMELINE_SIZE
+		? job_timeline_next : JOB_TIMELINE_SIZE);
+}
+
+/**
+ * job_timeline_get:
+ * @index: index of record.
+ *
+ * Records are indexed from the oldest held, up to one less than
+ * job_timeline_count().
+ *
+ * Returns: record or NULL if @index is out of range.
+ **/
+const JobTimelineRecord *
+job_timeline_get (size_t index)
+{
+	size_t count;
+
+	count = job_timeline_count ();
+	if (index >= count)
+		return NULL;
+
+	return &job_timeline[(job_timeline_next - count + index)
+			     % JOB_TIMELINE_SIZE];
+}
+
+/**
+ * job_timeline_type_name:
+ * @type: type to convert.
+ *
+ * Converts an enumerated timeline record type into the string used by
+ * the GetJobTimeline method.
+ *
+ * Returns: static string or NULL if type not known.
+ **/
+const char *
+job_timeline_type_name (JobTimelineType type)
+{
+	switch (type) {
+	case JOB_TIMELINE_STATE:
+		return N_("state");
+	case JOB_TIMELINE_SPAWN:
+		return N_("spawn");
+	case JOB_TIMELINE_EXEC:
+		return N_("exec");
+	case JOB_TIMELINE_EVENT:
+		return N_("event");
+	default:
+		return NULL;
+	}
+}
+
+
 /**
  * job_start:
  * @job: job to be started,
@@ -1780,6 +2407,218 @@ job_get_processes (Job *                  job,
 	return 0;
 }
 
+/**
+ * job_get_stats:
+ * @job: job to obtain resource usage of,
+ * @message: D-Bus connection and message received,
+ * @stats: pointer for reply array.
+ *
+ * Implements the GetStats method of the com.ubuntu.Upstart.Instance
+ * interface.
+ *
+ * Called to obtain the resources used by the processes of the given @job
+ * as an array of names and values, which will be stored in @stats; the
+ * array is empty if @job has no cgroup to read them from.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+job_get_stats (Job *                  job,
+	       NihDBusMessage *       message,
+	       JobGetStatsStatsElement ***stats)
+{
+	JobStats     usage;
+	size_t       num_stats = 0;
+	int          found;
+
+	nih_assert (job != NULL);
+	nih_assert (message != NULL);
+	nih_assert (stats != NULL);
+
+	found = job_stats (job, &usage);
+
+	const struct {
+		const char *name;
+		uint64_t    value;
+	} values[] = {
+		{ "cpu_usec",       usage.cpu_usec },
+		{ "memory_peak",    usage.memory_peak },
+		{ "io_read_bytes",  usage.io_read_bytes },
+		{ "io_write_bytes", usage.io_write_bytes },
+	};
+
+	*stats = nih_alloc (message, (sizeof (JobGetStatsStatsElement *)
+				      * ((found ? NIH_N_ELEMENTS (values) : 0) + 1)));
+	if (! *stats)
+		nih_return_no_memory_error (-1);
+
+	for (size_t i = 0; found && (i < NIH_N_ELEMENTS (values)); i++) {
+		JobGetStatsStatsElement *element;
+
+		element = nih_new (*stats, JobGetStatsStatsElement);
+		if (! element) {
+			nih_error_raise_no_memory ();
+			nih_free (*stats);
+			return -1;
+		}
+
+		element->item0 = nih_strdup (element, values[i].name);
+		if (! element->item0) {
+			nih_error_raise_no_memory ();
+			nih_free (*stats);
+			return -1;
+		}
+
+		element->item1 = values[i].value;
+
+		(*stats)[num_stats++] = element;
+	}
+
+	(*stats)[num_stats] = NULL;
+
+	return 0;
+}
+
+/**
+ * job_stats:
+ * @job: job to sample,
+ * @stats: structure to fill.
+ *
+ * Read the resources used by the processes of @job from the cgroup
+ * they run in: the one named by its cgroup stanza when init manages
+ * cgroups directly, otherwise the one its main process is followed by.
+ * This is only ever done when asked, never periodically.
+ *
+ * Values the kernel does not provide are left as zero.
+ *
+ * Returns: TRUE if @stats was filled, FALSE if @job has no cgroup that
+ * can be read.
+ **/
+static int
+job_stats (Job      *job,
+	   JobStats *stats)
+{
+	nih_local char *dir = NULL;
+	FILE           *file;
+	char            line[256];
+
+	nih_assert (job != NULL);
+	nih_assert (stats != NULL);
+
+	memset (stats, 0, sizeof (JobStats));
+
+#ifdef ENABLE_CGROUPS
+	if (cgroup_root && job_class_cgroups (job->class)) {
+		nih_local char **env = NULL;
+
+		env = job_cgroup_environment (NULL, job);
+		dir = cgroup_path (NULL, &job->class->cgroups, env);
+	}
+#endif /* ENABLE_CGROUPS */
+
+	if ((! dir) && job->trace_cgroup)
+		dir = NIH_MUST (nih_strdup (NULL, job->trace_cgroup));
+
+	if (! dir)
+		return FALSE;
+
+	/* Every cgroup has cpu.stat, so take its absence to mean that
+	 * the cgroup has gone.
+	 */
+	file = job_stats_open (dir, "cpu.stat");
+	if (! file)
+		return FALSE;
+
+	while (fgets (line, sizeof (line), file))
+		if (sscanf (line, "usage_usec %" SCNu64, &stats->cpu_usec) == 1)
+			break;
+
+	fclose (file);
+
+	file = job_stats_open (dir, "memory.peak");
+	if (file) {
+		if (fscanf (file, "%" SCNu64, &stats->memory_peak) != 1)
+			stats->memory_peak = 0;
+
+		fclose (file);
+	}
+
+	/* One line for each device, of KEY=VALUE pairs after its number */
+	file = job_stats_open (dir, "io.stat");
+	if (file) {
+		while (fgets (line, sizeof (line), file)) {
+			char *saveptr = NULL;
+
+			for (char *tok = strtok_r (line, " \n", &saveptr); tok;
+			     tok = strtok_r (NULL, " \n", &saveptr)) {
+				if (! strncmp (tok, "rbytes=", 7)) {
+					stats->io_read_bytes += strtoull (tok + 7, NULL, 10);
+				} else if (! strncmp (tok, "wbytes=", 7)) {
+					stats->io_write_bytes += strtoull (tok + 7, NULL, 10);
+				}
+			}
+		}
+
+		fclose (file);
+	}
+
+	return TRUE;
+}
+
+/**
+ * job_stats_open:
+ * @dir: cgroup directory,
+ * @name: name of file within @dir.
+ *
+ * Returns: newly opened stream for @name within @dir, or NULL if it
+ * could not be opened.
+ **/
+static FILE *
+job_stats_open (const char *dir,
+		const char *name)
+{
+	nih_local char *path = NULL;
+
+	nih_assert (dir != NULL);
+	nih_assert (name != NULL);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/%s", dir, name));
+
+	return fopen (path, "re");
+}
+
+#ifdef ENABLE_CGROUPS
+/**
+ * job_cgroup_environment:
+ * @parent: parent object for new table,
+ * @job: job.
+ *
+ * Construct the environment that the cgroup names of @job were expanded
+ * against when its processes were spawned.
+ *
+ * Returns: new environment table.
+ **/
+static char **
+job_cgroup_environment (const void *parent,
+			Job        *job)
+{
+	char   **env;
+	size_t   len = 0;
+
+	nih_assert (job != NULL);
+
+	env = NIH_MUST (nih_str_array_new (parent));
+	if (job->env)
+		NIH_MUST (environ_append (&env, parent, &len, TRUE, job->env));
+	NIH_MUST (environ_set (&env, parent, &len, TRUE,
+			       "UPSTART_JOB=%s", job->class->name));
+	NIH_MUST (environ_set (&env, parent, &len, TRUE,
+			       "UPSTART_INSTANCE=%s", job->name));
+
+	return env;
+}
+#endif /* ENABLE_CGROUPS */
+
 /**
  * job_serialise:
  * @job: job serialise.
@@ -1920,6 +2759,18 @@ job_serialise (const Job *job)
 	if (! state_set_json_int_var_from_obj (json, job, respawn_count))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, job, respawn_delay))
+		goto error;
+
+	if (job->respawn_timer) {
+		if (! state_set_json_int_var (json, "respawn_due",
+					      job->respawn_timer->due))
+			goto error;
+	}
+
+	if (! state_set_json_int_var_from_obj (json, job, pooled))
+		goto error;
+
 	if (! state_set_json_int_var_from_obj (json, job, trace_forks))
 		goto error;
 
@@ -1928,6 +2779,15 @@ job_serialise (const Job *job)
 				"trace_state", job->trace_state))
 		goto error;
 
+	if (! state_set_json_string_var_from_obj (json, job, trace_cgroup))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, job, admitted))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, job, spread_slot))
+		goto error;
+
 	json_logs = json_object_new_array ();
 
 	if (! json_logs)
@@ -2077,6 +2937,11 @@ job_deserialise (JobClass *parent, json_object *json)
 	if (! state_get_json_env_array_to_obj (json, job, stop_env))
 		goto error;
 
+	/* The stop on condition copied from the class by job_new() may be
+	 * replaced below, so the subscriptions for it must be too.
+	 */
+	job_subscription_remove (job->stop_on, NULL, job);
+
 	if (json_object_object_get_ex (json, "stop_on", &json_stop_on)) {
 
 		if (state_check_json_type (json_stop_on, array)) {
@@ -2127,6 +2992,8 @@ job_deserialise (JobClass *parent, json_object *json)
 		}
 	}
 
+	job_subscription_add (job->stop_on, NULL, job);
+
 	/* fds and num_fds handled by caller */
 	/* pid handled by caller */
 
@@ -2169,7 +3036,7 @@ job_deserialise (JobClass *parent, json_object *json)
 		 *   to give their processes the full amount of time to
 		 *   end.
 		 */
-		nih_local NihTimer *kill_timer = job_deserialise_kill_timer (json_kill_timer);
+		nih_local Deadline *kill_timer = job_deserialise_kill_timer (json_kill_timer);
 		if (! kill_timer)
 			goto error;
 
@@ -2196,6 +3063,29 @@ job_deserialise (JobClass *parent, json_object *json)
 	if (! state_get_json_int_var_to_obj (json, job, respawn_count))
 		goto error;
 
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "respawn_delay", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, respawn_delay))
+			goto error;
+	}
+
+	if (json_object_object_get_ex (json, "respawn_due", NULL)) {
+		time_t due;
+
+		if (! state_get_json_int_var (json, "respawn_due", due))
+			goto error;
+
+		job->respawn_timer = NIH_MUST (deadline_add_timeout (
+				job, 0, (DeadlineCb)job_respawn_timer, job));
+		deadline_set_due (job->respawn_timer, due);
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "pooled", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, pooled))
+			goto error;
+	}
+
 	if (! json_object_object_get_ex (json, "fds", &json_fds))
 		goto error;
 
@@ -2228,6 +3118,11 @@ job_deserialise (JobClass *parent, json_object *json)
 		goto error;
 	}
 
+	for (int i = 0; i < PROCESS_LAST; i++) {
+		if (job->pid[i] > 0)
+			job_process_set_pid (job, i, job->pid[i]);
+	}
+
 	if (! state_get_json_int_var_to_obj (json, job, trace_forks))
 			goto error;
 
@@ -2236,6 +3131,26 @@ job_deserialise (JobClass *parent, json_object *json)
 				"trace_state", job->trace_state))
 		goto error;
 
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "trace_cgroup", NULL)) {
+		if (! state_get_json_string_var_to_obj (json, job, trace_cgroup))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "admitted", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, admitted))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "spread_slot", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, job, spread_slot))
+			goto error;
+	}
+
+	resource_restore (job);
+
 	if (! json_object_object_get_ex (json, "log", &json_logs))
 		goto error;
 
@@ -2470,6 +3385,7 @@ job_trace_state_enum_to_str (TraceState state)
 	state_enum_to_str (TRACE_NEW, state);
 	state_enum_to_str (TRACE_NEW_CHILD, state);
 	state_enum_to_str (TRACE_NORMAL, state);
+	state_enum_to_str (TRACE_CGROUP, state);
 
 	return NULL;
 }
@@ -2490,6 +3406,7 @@ job_trace_state_str_to_enum (const char *state)
 	state_str_to_enum (TRACE_NEW, state);
 	state_str_to_enum (TRACE_NEW_CHILD, state);
 	state_str_to_enum (TRACE_NORMAL, state);
+	state_str_to_enum (TRACE_CGROUP, state);
 
 	return -1;
 }
@@ -2497,14 +3414,14 @@ job_trace_state_str_to_enum (const char *state)
 /**
  * job_serialise_kill_timer:
  *
- * @timer: NihTimer to serialise.
+ * @timer: Deadline to serialise.
  *
  * Serialise @timer into JSON.
  *
- * Returns: JSON-serialised NihTimer object, or NULL on error.
+ * Returns: JSON-serialised Deadline object, or NULL on error.
  **/
 static json_object *
-job_serialise_kill_timer (NihTimer *timer)
+job_serialise_kill_timer (Deadline *timer)
 {
 	json_object  *json;
 
@@ -2530,24 +3447,26 @@ error:
 /**
  * job_deserialise_kill_timer:
  *
- * @json: JSON representation of NihTimer.
+ * @json: JSON representation of Deadline.
  *
- * Deserialise @json back into an NihTimer.
+ * Deserialise @json back into a Deadline; the result is not added to
+ * the heap of pending deadlines.
  *
- * Returns: NihTimer on NULL on error.
+ * Returns: Deadline on NULL on error.
  **/
-static NihTimer *
+static Deadline *
 job_deserialise_kill_timer (json_object *json)
 {
-	NihTimer *timer;
+	Deadline *timer;
 
 	nih_assert (json);
 
-	timer = nih_new (NULL, NihTimer);
+	timer = nih_new (NULL, Deadline);
 	if (! timer)
 		return NULL;
 
-	memset (timer, '\0', sizeof (NihTimer));
+	memset (timer, '\0', sizeof (Deadline));
+	timer->index = DEADLINE_NONE;
 
 	if (! state_get_json_int_var_to_obj (json, timer, due))
 			goto error;
@@ -2605,6 +3524,42 @@ error:
 	return NULL;
 }
 
+/**
+ * job_find_by_path:
+ *
+ * @path: D-Bus object path of instance.
+ *
+ * Lookup an instance of a registered job class by the object path it
+ * was given when created.
+ *
+ * Returns: existing Job on success, or NULL if no instance has @path.
+ **/
+Job *
+job_find_by_path (const char *path)
+{
+	nih_assert (path != NULL);
+
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+		size_t    len;
+
+		len = strlen (class->path);
+		if (strncmp (path, class->path, len) || (path[len] != '/'))
+			continue;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			if (! strcmp (job->path, path))
+				return job;
+		}
+	}
+
+	return NULL;
+}
+
 /**
  * job_needs_cgroups:
  *
@@ -2645,7 +3600,7 @@ job_child_error_handler (Job *job, ProcessType process)
 	nih_assert (process > PROCESS_INVALID);
 	nih_assert (process < PROCESS_LAST);
 
-	job->pid[process] = 0;
+	job_process_set_pid (job, process, 0);
 
 	switch (process) {
 	case PROCESS_SECURITY:
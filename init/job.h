@@ -24,17 +24,18 @@
 
 #include <sys/types.h>
 
+#include <stdint.h>
 #include <time.h>
 
 #include <nih/macros.h>
 #include <nih/list.h>
-#include <nih/timer.h>
 
 #include <nih-dbus/dbus_message.h>
 
 #include "job_class.h"
 #include "event_operator.h"
 #include "log.h"
+#include "deadline.h"
 
 #include "com.ubuntu.Upstart.Instance.h"
 
@@ -89,12 +90,16 @@ typedef enum job_state {
  * We trace jobs to follow forks and detect execs in order to be able to
  * supervise daemon processes.  Unfortunately due to the "unique and arcane"
  * nature of ptrace(), we need to track some state.
+ *
+ * TRACE_CGROUP indicates that the job is instead being followed by the
+ * membership of a cgroup, see expect_cgroup.
  **/
 typedef enum trace_state {
 	TRACE_NONE,
 	TRACE_NEW,
 	TRACE_NEW_CHILD,
-	TRACE_NORMAL
+	TRACE_NORMAL,
+	TRACE_CGROUP
 } TraceState;
 
 typedef struct job_process_data JobProcessData;
@@ -124,8 +129,17 @@ typedef struct job_process_data JobProcessData;
  * @exit_status: exit status of the last failed process,
  * @respawn_time: time job was first respawned,
  * @respawn_count: number of respawns since @respawn_time,
+ * @respawn_delay: seconds to wait in post-stop before the pending respawn,
+ * @respawn_timer: timer to respawn once @respawn_delay has passed,
+ * @pooled: TRUE for a spare instance not yet handed out by a start request,
+ * @pool_timer: timer to stop a spare instance of a replaced class,
  * @trace_forks: number of forks traced,
  * @trace_state: state of trace,
+ * @trace_cgroup: cgroup the main process is followed by, or NULL,
+ * @admitted: TRUE while holding the resources used by the job class,
+ * @admission: entry in the queue of jobs waiting for resources, or NULL,
+ * @spread_slot: position among instances spread across CPUs or NUMA nodes,
+ * or -1,
  * @log: pointer to array of log objects for handling job output,
  * @process_data: transitory async job process metadata.
  *
@@ -155,7 +169,7 @@ typedef struct job {
 	Event           *blocker;
 	NihList          blocking;
 
-	NihTimer        *kill_timer;
+	Deadline        *kill_timer;
 	ProcessType      kill_process;
 
 	int              failed;
@@ -164,9 +178,21 @@ typedef struct job {
 
 	time_t           respawn_time;
 	int              respawn_count;
+	time_t           respawn_delay;
+	Deadline        *respawn_timer;
+
+	int              pooled;
+	Deadline        *pool_timer;
 
 	int              trace_forks;
 	TraceState       trace_state;
+	char            *trace_cgroup;
+
+	int              admitted;
+	NihListEntry    *admission;
+
+	int              spread_slot;
+
 	Log            **log;
 	JobProcessData **process_data;
 
@@ -199,6 +225,66 @@ typedef struct job_process_data {
 	int            valid;
 } JobProcessData;
 
+/**
+ * JOB_TIMELINE_SIZE:
+ *
+ * Number of records kept in the job timeline; once full, each new record
+ * replaces the oldest.
+ **/
+#define JOB_TIMELINE_SIZE 4096
+
+/**
+ * JobTimelineType:
+ *
+ * What happened to a job at the time given by a JobTimelineRecord.
+ **/
+typedef enum job_timeline_type {
+	JOB_TIMELINE_STATE,
+	JOB_TIMELINE_SPAWN,
+	JOB_TIMELINE_EXEC,
+	JOB_TIMELINE_EVENT,
+} JobTimelineType;
+
+/**
+ * JobTimelineRecord:
+ * @time: CLOCK_MONOTONIC time of record,
+ * @job: interned name of job class, or of the event emitted,
+ * @instance: interned name of instance, empty for events,
+ * @type: type of record,
+ * @state: state entered for JOB_TIMELINE_STATE records,
+ * @process: process spawned or exec'd for JOB_TIMELINE_SPAWN and
+ * JOB_TIMELINE_EXEC records.
+ *
+ * Single entry in the job timeline, which records when every instance
+ * entered each state, when each of its processes was spawned and exec'd
+ * and when each event other than those of jobs was handled, so that the
+ * boot can be charted afterwards.
+ **/
+typedef struct job_timeline_record {
+	struct timespec  time;
+	char            *job;
+	char            *instance;
+	JobTimelineType  type;
+	JobState         state;
+	ProcessType      process;
+} JobTimelineRecord;
+
+/**
+ * JobStats:
+ * @cpu_usec: CPU time used, in microseconds,
+ * @memory_peak: largest amount of memory used at once, in bytes,
+ * @io_read_bytes: bytes read from block devices,
+ * @io_write_bytes: bytes written to block devices.
+ *
+ * Resources used by the processes of an instance, read from its cgroup.
+ **/
+typedef struct job_stats {
+	uint64_t cpu_usec;
+	uint64_t memory_peak;
+	uint64_t io_read_bytes;
+	uint64_t io_write_bytes;
+} JobStats;
+
 /**
  * job_register_child_handler:
  *
@@ -225,9 +311,17 @@ typedef struct job_process_data {
 
 NIH_BEGIN_EXTERN
 
+extern int job_quiet_events;
+
 Job *       job_new             (JobClass *class, const char *name)
 	__attribute__ ((warn_unused_result));
 void        job_register        (Job *job, DBusConnection *conn, int signal);
+int         job_rename          (Job *job, const char *name)
+	__attribute__ ((warn_unused_result));
+
+int         job_parked          (Job *job)
+	__attribute__ ((warn_unused_result));
+void        job_unpool          (Job *job);
 
 void        job_change_goal     (Job *job, JobGoal goal);
 
@@ -241,6 +335,14 @@ Event      *job_emit_event      (Job *job);
 
 const char *job_name            (Job *job);
 
+void        job_timeline_add    (Job *job, JobTimelineType type,
+				 ProcessType process);
+void        job_timeline_add_event (const char *name);
+size_t      job_timeline_count  (void);
+const JobTimelineRecord *job_timeline_get (size_t index);
+const char *job_timeline_type_name (JobTimelineType type)
+	__attribute__ ((const));
+
 const char *job_goal_name       (JobGoal goal)
 	__attribute__ ((const));
 JobGoal     job_goal_from_name  (const char *goal);
@@ -272,6 +374,10 @@ int         job_get_processes   (Job *job, NihDBusMessage *message,
 				 JobProcessesElement ***processes)
 	__attribute__ ((warn_unused_result));
 
+int         job_get_stats       (Job *job, NihDBusMessage *message,
+				 JobGetStatsStatsElement ***stats)
+	__attribute__ ((warn_unused_result));
+
 json_object *job_serialise (const Job *job);
 Job *job_deserialise (JobClass *parent, json_object *json);
 
@@ -287,6 +393,9 @@ Job *       job_find            (const Session *session,
 				 const char     *job_name)
 	__attribute__ ((warn_unused_result));
 
+Job *       job_find_by_path    (const char *path)
+	__attribute__ ((warn_unused_result));
+
 const char *
 job_state_enum_to_str (JobState state)
 	__attribute__ ((warn_unused_result));
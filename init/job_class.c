@@ -25,6 +25,7 @@
 
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <signal.h>
 #include <sys/time.h>
@@ -54,6 +55,10 @@
 #include "blocked.h"
 #include "conf.h"
 #include "control.h"
+#include "snapshot.h"
+#include "schedule.h"
+#include "pressure.h"
+#include "listener.h"
 #include "parse_job.h"
 
 #ifdef ENABLE_CGROUPS
@@ -73,6 +78,15 @@ extern char **environ;
 /* Prototypes for static functions */
 static void  job_class_add (JobClass *class);
 static int   job_class_remove (JobClass *class, const Session *session);
+static Job  *job_class_pool_claim (JobClass *class, const char *name);
+static void  job_class_pool_timer (Job *job, Deadline *timer);
+static StateIndex *job_class_index_new (const void *parent);
+static const void *job_registration_key (JobRegistration *reg);
+static uint32_t job_registration_hash (const JobClassKey *key);
+static int   job_registration_cmp (const JobClassKey *key1,
+				   const JobClassKey *key2);
+static int   job_class_environment_base (JobClass *class)
+	__attribute__ ((warn_unused_result));
 
 /**
  * default_console:
@@ -92,6 +106,25 @@ int default_console = -1;
  **/
 NihHash *job_classes = NULL;
 
+/**
+ * job_subscriptions:
+ *
+ * This hash table indexes the start on conditions of registered job
+ * classes and the stop on conditions of their instances by the names of
+ * the events they match.  Each entry is a JobSubscription structure;
+ * multiple entries with the same name are expected.
+ **/
+NihHash *job_subscriptions = NULL;
+
+/**
+ * job_registrations:
+ *
+ * This hash table indexes the classes of the job classes table by both
+ * their session and their name.  Each entry is a JobRegistration
+ * structure; multiple entries with the same key are not permitted.
+ **/
+NihHash *job_registrations = NULL;
+
 /**
  * job_environ:
  *
@@ -100,6 +133,14 @@ NihHash *job_classes = NULL;
  **/
 static char **job_environ = NULL;
 
+/**
+ * job_environ_generation:
+ *
+ * Incremented whenever job_environ changes so that the base environment
+ * shared by the instances of each job class is rebuilt.
+ **/
+static unsigned int job_environ_generation = 0;
+
 /**
  * initial_umask:
  *
@@ -117,6 +158,235 @@ job_class_init (void)
 {
 	if (! job_classes)
 		job_classes = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	if (! job_subscriptions)
+		job_subscriptions = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	if (! job_registrations)
+		job_registrations = NIH_MUST (nih_hash_new (NULL, 0,
+			(NihKeyFunction)job_registration_key,
+			(NihHashFunction)job_registration_hash,
+			(NihCmpFunction)job_registration_cmp));
+}
+
+/**
+ * job_registration_key:
+ * @reg: entry in job_registrations.
+ *
+ * Key function for the job_registrations hash table.
+ *
+ * Returns: pointer to the session and name of the class of @reg.
+ **/
+static const void *
+job_registration_key (JobRegistration *reg)
+{
+	nih_assert (reg != NULL);
+
+	return &reg->key;
+}
+
+/**
+ * job_registration_hash:
+ * @key: session and name to hash.
+ *
+ * Hash function for the job_registrations hash table; allocations are
+ * aligned so the low bits of the session address are discarded.
+ *
+ * Returns: hash value for @key.
+ **/
+static uint32_t
+job_registration_hash (const JobClassKey *key)
+{
+	nih_assert (key != NULL);
+	nih_assert (key->name != NULL);
+
+	return (nih_hash_string_hash (key->name)
+		^ (uint32_t)((uintptr_t)key->session / sizeof (void *)));
+}
+
+/**
+ * job_registration_cmp:
+ * @key1: first session and name,
+ * @key2: second session and name.
+ *
+ * Comparison function for the job_registrations hash table.
+ *
+ * Returns: zero if @key1 and @key2 are the same session and name.
+ **/
+static int
+job_registration_cmp (const JobClassKey *key1,
+		      const JobClassKey *key2)
+{
+	nih_assert (key1 != NULL);
+	nih_assert (key2 != NULL);
+
+	if (key1->session != key2->session)
+		return 1;
+
+	return strcmp (key1->name, key2->name);
+}
+
+/**
+ * job_subscription_seen:
+ * @root: operator tree,
+ * @oper: EVENT_MATCH operator within @root.
+ *
+ * Determine whether an EVENT_MATCH operator preceding @oper in a
+ * post-order traversal of @root matches the same event name as @oper.
+ *
+ * Returns: TRUE if the name of @oper has already been visited, else FALSE.
+ **/
+static int
+job_subscription_seen (EventOperator *root,
+		       EventOperator *oper)
+{
+	nih_assert (root != NULL);
+	nih_assert (oper != NULL);
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *prev = (EventOperator *)iter;
+
+		if (prev == oper)
+			return FALSE;
+
+		if ((prev->type == EVENT_MATCH)
+		    && (! strcmp (prev->name, oper->name)))
+			return TRUE;
+	}
+
+	nih_assert_not_reached ();
+}
+
+/**
+ * job_subscription_add:
+ * @root: operator tree,
+ * @class: job class whose start on condition is @root,
+ * @job: job instance whose stop on condition is @root.
+ *
+ * Add an entry to the job_subscriptions hash table for each distinct
+ * event name matched by the EVENT_MATCH operators of @root; exactly one
+ * of @class and @job must be given, and the new entries become
+ * nih_alloc() children of it.
+ **/
+void
+job_subscription_add (EventOperator *root,
+		      JobClass      *class,
+		      Job           *job)
+{
+	nih_assert ((class != NULL) != (job != NULL));
+
+	job_class_init ();
+
+	if (! root)
+		return;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator   *oper = (EventOperator *)iter;
+		JobSubscription *sub;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (job_subscription_seen (root, oper))
+			continue;
+
+		sub = NIH_MUST (nih_new (job ? (void *)job : (void *)class,
+					 JobSubscription));
+
+		nih_list_init (&sub->entry);
+		nih_alloc_set_destructor (sub, nih_list_destroy);
+
+		sub->name = NIH_MUST (nih_strdup (sub, oper->name));
+		sub->class = class;
+		sub->job = job;
+
+		nih_hash_add (job_subscriptions, &sub->entry);
+	}
+}
+
+/**
+ * job_subscription_remove:
+ * @root: operator tree,
+ * @class: job class whose start on condition is @root,
+ * @job: job instance whose stop on condition is @root.
+ *
+ * Remove the entries added to the job_subscriptions hash table by a
+ * previous call to job_subscription_add() with the same arguments.
+ **/
+void
+job_subscription_remove (EventOperator *root,
+			 JobClass      *class,
+			 Job           *job)
+{
+	nih_assert ((class != NULL) != (job != NULL));
+
+	job_class_init ();
+
+	if (! root)
+		return;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator   *oper = (EventOperator *)iter;
+		JobSubscription *sub = NULL;
+		JobSubscription *next;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (job_subscription_seen (root, oper))
+			continue;
+
+		sub = (JobSubscription *)nih_hash_search (job_subscriptions,
+							  oper->name, NULL);
+		while (sub) {
+			next = (JobSubscription *)nih_hash_search (
+				job_subscriptions, oper->name, &sub->entry);
+
+			if ((sub->class == class) && (sub->job == job))
+				nih_free (sub);
+
+			sub = next;
+		}
+	}
+}
+
+/**
+ * job_subscription_next_class:
+ * @name: name of event,
+ * @sub: subscription to continue from, or pointing to NULL to begin.
+ *
+ * Iterate the job classes in the job classes table whose start on
+ * condition references the event named @name, using the
+ * job_subscriptions hash table rather than visiting every class.  @sub
+ * is updated to the subscription of the class returned, and should be
+ * passed again to find the next.
+ *
+ * Returns: next job class, or NULL when there are no more.
+ **/
+JobClass *
+job_subscription_next_class (const char       *name,
+			     JobSubscription **sub)
+{
+	nih_assert (name != NULL);
+	nih_assert (sub != NULL);
+
+	job_class_init ();
+
+	while ((*sub = (JobSubscription *)nih_hash_search (
+			job_subscriptions, name,
+			*sub ? &(*sub)->entry : NULL)) != NULL) {
+		/* Stop on conditions of instances are not wanted */
+		if (! (*sub)->class)
+			continue;
+
+		/* Only classes in the job classes table are considered */
+		if (NIH_LIST_EMPTY (&(*sub)->class->entry))
+			continue;
+
+		return (*sub)->class;
+	}
+
+	return NULL;
 }
 
 /**
@@ -137,6 +407,8 @@ job_class_environment_init (void)
 
 	if (user_mode && ! no_inherit_env)
 		NIH_MUST(environ_append (&job_environ, NULL, 0, TRUE, environ));
+
+	job_environ_generation++;
 }
 
 /**
@@ -165,6 +437,8 @@ job_class_environment_clear (void)
 		nih_free (job_environ);
 		job_environ = NULL;
 	}
+
+	job_environ_generation++;
 }
 
 /**
@@ -187,6 +461,8 @@ job_class_environment_set (const char *var, int replace)
 	if (! environ_add (&job_environ, NULL, NULL, replace, var))
 		return -1;
 
+	job_environ_generation++;
+
 	/* Update all running jobs */
 	NIH_HASH_FOREACH (job_classes, iter) {
 		JobClass *class = (JobClass *)iter;
@@ -220,6 +496,8 @@ job_class_environment_unset (const char *name)
 	if (! environ_remove (&job_environ, NULL, NULL, name))
 		return -1;
 
+	job_environ_generation++;
+
 	/* Update all running jobs */
 	NIH_HASH_FOREACH (job_classes, iter) {
 		JobClass *class = (JobClass *)iter;
@@ -235,6 +513,84 @@ job_class_environment_unset (const char *name)
 	return 0;
 }
 
+/**
+ * job_class_environment_set_list:
+ *
+ * @vars: NULL-terminated array of environment variables to set in form
+ *  'name=value',
+ * @replace: TRUE if existing variables should be overwritten, else
+ *  FALSE.
+ *
+ * Set all of @vars in the job environment and that of every running
+ * job, merging them into each table at once.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+job_class_environment_set_list (char * const *vars, int replace)
+{
+	nih_assert (vars);
+	nih_assert (job_environ);
+
+	if (! environ_append (&job_environ, NULL, NULL, replace, vars))
+		return -1;
+
+	job_environ_generation++;
+
+	/* Update all running jobs */
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			if (! environ_append (&job->env, job, NULL, replace, vars))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * job_class_environment_unset_list:
+ *
+ * @names: NULL-terminated array of names of environment variables to
+ *  unset.
+ *
+ * Remove all of @names from the job environment and that of every
+ * running job.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+job_class_environment_unset_list (char * const *names)
+{
+	nih_assert (names);
+	nih_assert (job_environ);
+
+	for (char * const *name = names; *name; name++)
+		if (! environ_remove (&job_environ, NULL, NULL, *name))
+			return -1;
+
+	job_environ_generation++;
+
+	/* Update all running jobs */
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			for (char * const *name = names; *name; name++)
+				if (! environ_remove (&job->env, job, NULL, *name))
+					return -1;
+		}
+	}
+
+	return 0;
+}
+
 /**
  * job_class_environment_get_all:
  *
@@ -339,6 +695,8 @@ job_class_new (const void *parent,
 	if (! class->instances)
 		goto error;
 
+	class->instance_template = NULL;
+
 	class->description = NULL;
 	class->author = NULL;
 	class->version = NULL;
@@ -346,6 +704,10 @@ job_class_new (const void *parent,
 	class->env = NULL;
 	class->export = NULL;
 
+	class->base_env = NULL;
+	class->base_env_len = 0;
+	class->base_env_generation = 0;
+
 	class->start_on = NULL;
 	class->stop_on = NULL;
 	class->emits = NULL;
@@ -368,6 +730,8 @@ job_class_new (const void *parent,
 	class->respawn = FALSE;
 	class->respawn_limit = JOB_DEFAULT_RESPAWN_LIMIT;
 	class->respawn_interval = JOB_DEFAULT_RESPAWN_INTERVAL;
+	class->respawn_delay = 0;
+	class->respawn_delay_max = JOB_DEFAULT_RESPAWN_DELAY_MAX;
 
 	class->normalexit = NULL;
 	class->normalexit_len = 0;
@@ -378,6 +742,10 @@ job_class_new (const void *parent,
 	class->nice = JOB_NICE_INVALID;
 	class->oom_score_adj = JOB_DEFAULT_OOM_SCORE_ADJ;
 
+	class->cpus = NULL;
+	class->numa_node = -1;
+	class->spread = JOB_SPREAD_NONE;
+
 	for (i = 0; i < RLIMIT_NLIMITS; i++)
 		class->limits[i] = NULL;
 
@@ -390,14 +758,32 @@ job_class_new (const void *parent,
 	class->deleted = FALSE;
 	class->debug   = FALSE;
 
+	class->shell_auto = FALSE;
+
 	class->usage = NULL;
 
 	class->apparmor_switch = NULL;
+	class->apparmor_load = NULL;
+	memset (&class->apparmor_loaded, 0, sizeof (ApparmorStamp));
+	memset (&class->apparmor_loading, 0, sizeof (ApparmorStamp));
 
 	class->cgmanager_wait = FALSE;
 
 	nih_list_init (&class->cgroups);
 
+	class->uses = NULL;
+	class->uses_amount = NULL;
+	class->uses_len = 0;
+	class->priority = 0;
+
+	class->pressure = NULL;
+	class->pressure_max = NULL;
+	class->pressure_len = 0;
+
+	class->pool = 0;
+
+	class->sockets = NULL;
+
 	return class;
 
 error:
@@ -420,13 +806,24 @@ error:
 JobClass *
 job_class_get_registered (const char *name, const Session *session)
 {
-	JobClass *registered = NULL;
+	JobClass        *registered = NULL;
+	JobRegistration *reg;
+	JobClassKey      key;
 
 	nih_assert (name);
 
 	job_class_init ();
 
-	/* If we found an entry, ensure we only consider the appropriate session */
+	key.session = session;
+	key.name = name;
+
+	reg = (JobRegistration *)nih_hash_lookup (job_registrations, &key);
+	if (reg && ! NIH_LIST_EMPTY (&reg->class->entry))
+		return reg->class;
+
+	/* Classes placed directly in the table have no registration, so
+	 * search it, ensuring we only consider the appropriate session.
+	 */
 	do {
 		registered = (JobClass *)nih_hash_search (job_classes,
 				name, registered ? &registered->entry : NULL);
@@ -508,6 +905,11 @@ job_class_reconsider (JobClass *class)
 
 	if (registered == class) {
 		if (class != best) {
+			/* Spare instances would otherwise keep a class
+			 * that is being replaced forever.
+			 */
+			job_class_pool_drain (class);
+
 			if (! job_class_remove (class, class->session))
 				return FALSE;
 
@@ -596,6 +998,149 @@ job_class_event_block (void *parent, JobClass *old, JobClass *new)
 	}
 }
 
+/**
+ * job_class_pool_fill:
+ * @class: job class to fill pool of.
+ *
+ * Start spare instances of @class until it has as many as its pool
+ * member asks for.  Spares are named "pool-N" and started with the
+ * environment of the class alone; each runs its pre-start process and
+ * then waits for job_class_start() to hand it out, so that only the
+ * main process is left to spawn when an instance is started.
+ *
+ * Only instance jobs that are the registered class for their name are
+ * filled; the pool is first filled by the first start request.
+ **/
+void
+job_class_pool_fill (JobClass *class)
+{
+	int spares = 0;
+
+	nih_assert (class != NULL);
+
+	if ((class->pool <= 0) || (! *class->instance) || class->deleted)
+		return;
+
+	if (job_class_get_registered (class->name, class->session) != class)
+		return;
+
+	NIH_HASH_FOREACH (class->instances, iter) {
+		Job *job = (Job *)iter;
+
+		if (job->pooled && (job->goal == JOB_START))
+			spares++;
+	}
+
+	for (int n = 1; spares < class->pool; n++) {
+		nih_local char *name = NULL;
+		Job            *job;
+
+		name = NIH_MUST (nih_sprintf (NULL, "pool-%d", n));
+		if (nih_hash_lookup (class->instances, name))
+			continue;
+
+		job = NIH_MUST (job_new (class, name));
+		job->pooled = TRUE;
+		job->start_env = NIH_MUST (job_class_environment (job, class,
+								  NULL));
+
+		nih_debug ("Starting spare instance %s", job_name (job));
+
+		job_change_goal (job, JOB_START);
+		spares++;
+	}
+}
+
+/**
+ * job_class_pool_drain:
+ * @class: job class to drain pool of.
+ *
+ * Stop the spare instances of @class, such as when it is being replaced
+ * or deleted.  They are stopped from the main loop, since stopping one
+ * may free @class.
+ **/
+void
+job_class_pool_drain (JobClass *class)
+{
+	nih_assert (class != NULL);
+
+	NIH_HASH_FOREACH (class->instances, iter) {
+		Job *job = (Job *)iter;
+
+		if ((! job->pooled) || (job->goal != JOB_START)
+		    || job->pool_timer)
+			continue;
+
+		job->pool_timer = NIH_MUST (deadline_add_timeout (
+				job, 0, (DeadlineCb)job_class_pool_timer, job));
+	}
+}
+
+/**
+ * job_class_pool_timer:
+ * @job: spare instance to stop,
+ * @timer: timer that is due.
+ *
+ * Called from the main loop to stop a spare instance of a class whose
+ * pool has been drained.
+ **/
+static void
+job_class_pool_timer (Job      *job,
+		      Deadline *timer)
+{
+	nih_assert (job != NULL);
+	nih_assert (job->pool_timer == timer);
+
+	/* Freed by our caller on return */
+	job->pool_timer = NULL;
+
+	job_change_goal (job, JOB_STOP);
+}
+
+/**
+ * job_class_pool_claim:
+ * @class: job class to take spare instance from,
+ * @name: name for instance.
+ *
+ * Take a spare instance of @class to be started as @name, preferring one
+ * that has finished its pre-start process, and rename it.
+ *
+ * Returns: renamed spare instance, or NULL if there isn't one.
+ **/
+static Job *
+job_class_pool_claim (JobClass   *class,
+		      const char *name)
+{
+	Job *spare = NULL;
+
+	nih_assert (class != NULL);
+	nih_assert (name != NULL);
+
+	if (class->pool <= 0)
+		return NULL;
+
+	NIH_HASH_FOREACH (class->instances, iter) {
+		Job *job = (Job *)iter;
+
+		if ((! job->pooled) || (job->goal != JOB_START)
+		    || job->pool_timer)
+			continue;
+
+		if ((! spare) || (job_parked (job) && (! job_parked (spare))))
+			spare = job;
+	}
+
+	if (! spare)
+		return NULL;
+
+	if (job_rename (spare, name) < 0)
+		return NULL;
+
+	nih_debug ("Using spare instance for %s", job_name (spare));
+
+	return spare;
+}
+
 /**
  * job_class_add:
  * @class: new class to select.
@@ -606,19 +1151,44 @@ job_class_event_block (void *parent, JobClass *old, JobClass *new)
 static void
 job_class_add (JobClass *class)
 {
+	JobRegistration *reg;
+	JobRegistration *old;
+
 	control_init ();
+	job_class_init ();
 
 	if (! class)
 		return;
 
 	nih_hash_add (job_classes, &class->entry);
 
+	reg = NIH_MUST (nih_new (class, JobRegistration));
+	nih_list_init (&reg->entry);
+	nih_alloc_set_destructor (reg, nih_list_destroy);
+
+	reg->key.session = class->session;
+	reg->key.name = class->name;
+	reg->class = class;
+
+	old = (JobRegistration *)nih_hash_replace (job_registrations,
+						   &reg->entry);
+	if (old)
+		nih_free (old);
+
+	job_subscription_add (class->start_on, class, NULL);
+
 	NIH_LIST_FOREACH (control_conns, iter) {
 		NihListEntry   *entry = (NihListEntry *)iter;
 		DBusConnection *conn = (DBusConnection *)entry->data;
 
 		job_class_register (class, conn, TRUE);
 	}
+
+	control_change (CONTROL_CHANGE_JOB_ADDED, class->path, NULL, NULL);
+	snapshot_changed ();
+	schedule_changed ();
+	pressure_changed ();
+	listener_changed ();
 }
 
 /**
@@ -661,6 +1231,9 @@ job_class_add_safe (JobClass *class)
 static int
 job_class_remove (JobClass *class, const Session *session)
 {
+	JobRegistration *reg;
+	JobClassKey      key;
+
 	nih_assert (class != NULL);
 
 	if (class->session != session)
@@ -674,6 +1247,15 @@ job_class_remove (JobClass *class, const Session *session)
 
 	nih_list_remove (&class->entry);
 
+	key.session = class->session;
+	key.name = class->name;
+
+	reg = (JobRegistration *)nih_hash_lookup (job_registrations, &key);
+	if (reg && (reg->class == class))
+		nih_free (reg);
+
+	job_subscription_remove (class->start_on, class, NULL);
+
 	NIH_LIST_FOREACH (control_conns, iter) {
 		NihListEntry   *entry = (NihListEntry *)iter;
 		DBusConnection *conn = (DBusConnection *)entry->data;
@@ -681,6 +1263,12 @@ job_class_remove (JobClass *class, const Session *session)
 		job_class_unregister (class, conn);
 	}
 
+	control_change (CONTROL_CHANGE_JOB_REMOVED, class->path, NULL, NULL);
+	snapshot_changed ();
+	schedule_changed ();
+	pressure_changed ();
+	listener_changed ();
+
 	return TRUE;
 }
 
@@ -716,7 +1304,8 @@ job_class_register (JobClass       *class,
 	NIH_HASH_FOREACH (class->instances, iter) {
 		Job *job = (Job *)iter;
 
-		job_register (job, conn, signal);
+		if (control_register_instances (conn))
+			job_register (job, conn, signal);
 	}
 }
 
@@ -758,6 +1347,10 @@ job_class_unregister (JobClass       *class,
  * This table is suitable for storing in @job's env member so that it is
  * used for all processes spawned by the job.
  *
+ * The table is copied from the base environment of @class, which is
+ * only merged again when the global job environment changes, and shares
+ * its interned strings with it and with every other instance.
+ *
  * If @len is not NULL it will be updated to contain the new array length.
  *
  * If @parent is not NULL, it should be a pointer to another object which
@@ -777,30 +1370,115 @@ job_class_environment (const void *parent,
 	nih_assert (class != NULL);
 	nih_assert (job_environ);
 
-	env = nih_str_array_new (parent);
+	if ((! class->base_env)
+	    || (class->base_env_generation != job_environ_generation)) {
+		if (job_class_environment_base (class) < 0)
+			return NULL;
+	}
+
+	env = nih_alloc (parent, sizeof (char *) * (class->base_env_len + 1));
 	if (! env)
 		return NULL;
+
+	for (size_t i = 0; i < class->base_env_len; i++) {
+		env[i] = class->base_env[i];
+		nih_ref (env[i], env);
+	}
+	env[class->base_env_len] = NULL;
+
 	if (len)
-		*len = 0;
+		*len = class->base_env_len;
+
+	return env;
+}
+
+/**
+ * job_class_environment_base:
+ * @class: job class.
+ *
+ * Merge the global job environment with that defined in @class to give
+ * the base environment of its instances, replacing any previous base
+ * environment.
+ *
+ * @class's env member must not be changed once this has been called.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+job_class_environment_base (JobClass *class)
+{
+	char   **env;
+	size_t   len = 0;
+
+	nih_assert (class != NULL);
+	nih_assert (job_environ);
+
+	env = nih_str_array_new (class);
+	if (! env)
+		return -1;
 
 	/* Copy the set of environment variables, usually these just
 	 * pick up the values from init's own environment.
 	 */
-	if (! environ_append (&env, parent, len, TRUE, job_environ))
+	if (! environ_append (&env, class, &len, TRUE, job_environ))
 		goto error;
 
 	/* Copy the set of environment variables from the job configuration,
 	 * these often have values but also often don't and we want them to
 	 * override the builtins.
 	 */
-	if (! environ_append (&env, parent, len, TRUE, class->env))
+	if (! environ_append (&env, class, &len, TRUE, class->env))
 		goto error;
 
-	return env;
+	if (class->base_env)
+		nih_unref (class->base_env, class);
+
+	class->base_env = env;
+	class->base_env_len = len;
+	class->base_env_generation = job_environ_generation;
+
+	return 0;
 
 error:
 	nih_free (env);
-	return NULL;
+	return -1;
+}
+
+/**
+ * job_class_instance_name:
+ * @class: job class,
+ * @env: NULL-terminated environment of the instance.
+ *
+ * Expand the instance name of @class against @env.  The instance pattern
+ * is compiled the first time it is needed, and again only if it changes,
+ * so requests for instance jobs don't parse it or allocate a new string
+ * each time.
+ *
+ * Returns: instance name, valid until the next call for @class, or NULL
+ * on raised error.
+ **/
+const char *
+job_class_instance_name (JobClass     *class,
+			 char * const *env)
+{
+	nih_assert (class != NULL);
+	nih_assert (class->instance != NULL);
+
+	if (! *class->instance)
+		return class->instance;
+
+	if ((! class->instance_template)
+	    || strcmp (class->instance_template->source, class->instance)) {
+		if (class->instance_template)
+			nih_free (class->instance_template);
+
+		class->instance_template = environ_template_new (
+			class, class->instance);
+		if (! class->instance_template)
+			return NULL;
+	}
+
+	return environ_template_expand (class->instance_template, env);
 }
 
 
@@ -830,7 +1508,7 @@ job_class_get_instance (JobClass        *class,
 {
 	Job             *job;
 	nih_local char **instance_env = NULL;
-	nih_local char  *name = NULL;
+	const char      *name;
 	size_t           len;
 
 	nih_assert (class != NULL);
@@ -857,7 +1535,7 @@ job_class_get_instance (JobClass        *class,
 	/* Use the environment to expand the instance name and look it up
 	 * in the job.
 	 */
-	name = environ_expand (NULL, class->instance, instance_env);
+	name = job_class_instance_name (class, instance_env);
 	if (! name) {
 		NihError *error;
 		nih_local char *error_message = NULL;
@@ -1008,6 +1686,9 @@ job_class_get_all_instances (JobClass         *class,
  * (or restarted if it is currently stopping) with @env as its new
  * environment.
  *
+ * For a class with a pool stanza, a new instance is a spare taken from
+ * the pool when there is one, and the pool is refilled afterwards.
+ *
  * If the instance goal is already start,
  * the com.ubuntu.Upstart.Error.AlreadyStarted D-Bus error will be returned
  * immediately.  If the instance fails to start, the
@@ -1030,7 +1711,7 @@ job_class_start (JobClass        *class,
 	Blocked         *blocked = NULL;
 	Job             *job;
 	nih_local char **start_env = NULL;
-	nih_local char  *name = NULL;
+	const char      *name;
 	size_t           len;
 
 	nih_assert (class != NULL);
@@ -1080,7 +1761,7 @@ job_class_start (JobClass        *class,
 	/* Use the environment to expand the instance name and look it up
 	 * in the job.
 	 */
-	name = environ_expand (NULL, class->instance, start_env);
+	name = job_class_instance_name (class, start_env);
 	if (! name) {
 		NihError *error;
 		nih_local char *error_message = NULL;
@@ -1107,16 +1788,19 @@ job_class_start (JobClass        *class,
 
 	job = (Job *)nih_hash_lookup (class->instances, name);
 
-	/* If no instance exists with the expanded name, create a new
-	 * instance.
+	/* If no instance exists with the expanded name, hand out a spare
+	 * or create a new instance.
 	 */
+	if (! job)
+		job = job_class_pool_claim (class, name);
+
 	if (! job) {
 		job = job_new (class, name);
 		if (! job)
 			nih_return_system_error (-1);
 	}
 
-	if (job->goal == JOB_START) {
+	if ((job->goal == JOB_START) && (! job->pooled)) {
 		nih_dbus_error_raise_printf (
 			DBUS_INTERFACE_UPSTART ".Error.AlreadyStarted",
 			_("Job is already running: %s"),
@@ -1138,11 +1822,18 @@ job_class_start (JobClass        *class,
 	if (blocked)
 		nih_list_add (&job->blocking, &blocked->entry);
 
-	job_change_goal (job, JOB_START);
+	if (job->pooled && (job->goal == JOB_START)) {
+		job_unpool (job);
+	} else {
+		job->pooled = FALSE;
+		job_change_goal (job, JOB_START);
+	}
 
 	if (! wait)
 		NIH_ZERO (job_class_start_reply (message, job->path));
 
+	job_class_pool_fill (class);
+
 	return 0;
 }
 
@@ -1183,7 +1874,7 @@ job_class_stop (JobClass       *class,
 	Blocked         *blocked = NULL;
 	Job             *job;
 	nih_local char **stop_env = NULL;
-	nih_local char  *name = NULL;
+	const char      *name;
 	size_t           len;
 
 	nih_assert (class != NULL);
@@ -1221,7 +1912,7 @@ job_class_stop (JobClass       *class,
 	/* Use the environment to expand the instance name and look it up
 	 * in the job.
 	 */
-	name = environ_expand (NULL, class->instance, stop_env);
+	name = job_class_instance_name (class, stop_env);
 	if (! name) {
 		NihError *error;
 
@@ -1319,7 +2010,7 @@ job_class_restart (JobClass        *class,
 	Blocked         *blocked = NULL;
 	Job             *job;
 	nih_local char **restart_env = NULL;
-	nih_local char  *name = NULL;
+	const char      *name;
 	size_t           len;
 
 	nih_assert (class != NULL);
@@ -1356,7 +2047,7 @@ job_class_restart (JobClass        *class,
 	/* Use the environment to expand the instance name and look it up
 	 * in the job.
 	 */
-	name = environ_expand (NULL, class->instance, restart_env);
+	name = job_class_instance_name (class, restart_env);
 	if (! name) {
 		NihError *error;
 
@@ -1430,26 +2121,9 @@ job_class_restart (JobClass        *class,
 JobClass *
 job_class_get (const char *name, Session *session)
 {
-	JobClass  *class = NULL;
-	NihList   *prev = NULL;
-
 	nih_assert (name);
 
-	job_class_init ();
-
-	do {
-		class = (JobClass *)nih_hash_search (job_classes, name, prev);
-		if (! class)
-			return NULL;
-		if (class && class->session == session)
-			return class;
-
-		nih_assert (class);
-
-		prev = (NihList *)class;
-	} while (TRUE);
-
-	nih_assert_not_reached ();
+	return job_class_get_registered (name, session);
 }
 
 
@@ -1887,6 +2561,8 @@ job_class_deserialise_job_environ (json_object *json)
 	if (! state_deserialise_str_array (NULL, json, &job_environ))
 		goto error;
 
+	job_environ_generation++;
+
 	return 0;
 
 error:
@@ -1911,6 +2587,8 @@ job_class_serialise (JobClass *class)
 	json_object      *json_emits;
 	json_object      *json_processes;
 	json_object      *json_normalexit;
+	json_object      *json_uses_amount;
+	json_object      *json_pressure_max;
 	json_object      *json_limits;
 	json_object      *json_jobs;
 	json_object      *json_start_on;
@@ -2027,6 +2705,12 @@ job_class_serialise (JobClass *class)
 	if (! state_set_json_int_var_from_obj (json, class, respawn_interval))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, class, respawn_delay))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, respawn_delay_max))
+		goto error;
+
 	json_normalexit = state_serialise_int_array (int, class->normalexit,
 					     class->normalexit_len);
 	if (! json_normalexit)
@@ -2071,12 +2755,18 @@ job_class_serialise (JobClass *class)
 	if (! state_set_json_int_var_from_obj (json, class, debug))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, class, shell_auto))
+		goto error;
+
 	if (! state_set_json_string_var_from_obj (json, class, usage))
 		goto error;
 
 	if (! state_set_json_string_var_from_obj (json, class, apparmor_switch))
 		goto error;
 
+	if (! state_set_json_string_var_from_obj (json, class, apparmor_load))
+		goto error;
+
 	if (! state_set_json_int_var_from_obj (json, class, cgmanager_wait))
 		goto error;
 
@@ -2088,6 +2778,46 @@ job_class_serialise (JobClass *class)
 	json_object_object_add (json, "cgroups", json_cgroups);
 #endif /* ENABLE_CGROUPS */
 
+	if (! state_set_json_str_array_from_obj (json, class, uses))
+		goto error;
+
+	json_uses_amount = state_serialise_int_array (int, class->uses_amount,
+						      class->uses_len);
+	if (! json_uses_amount)
+		goto error;
+
+	json_object_object_add (json, "uses_amount", json_uses_amount);
+
+	if (! state_set_json_int_var_from_obj (json, class, priority))
+		goto error;
+
+	if (! state_set_json_str_array_from_obj (json, class, pressure))
+		goto error;
+
+	json_pressure_max = state_serialise_int_array (int, class->pressure_max,
+						       class->pressure_len);
+	if (! json_pressure_max)
+		goto error;
+
+	json_object_object_add (json, "pressure_max", json_pressure_max);
+
+	if (! state_set_json_int_var_from_obj (json, class, pool))
+		goto error;
+
+	if (! state_set_json_str_array_from_obj (json, class, sockets))
+		goto error;
+
+	if (! state_set_json_string_var_from_obj (json, class, cpus))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, class, numa_node))
+		goto error;
+
+	if (! state_set_json_enum_var (json,
+				job_class_spread_enum_to_str,
+				"spread", class->spread))
+		goto error;
+
 	return json;
 
 error:
@@ -2159,6 +2889,8 @@ JobClass *
 job_class_deserialise (json_object *json)
 {
 	json_object    *json_normalexit;
+	json_object    *json_uses_amount;
+	json_object    *json_pressure_max;
 	JobClass       *class = NULL;
 	ConfFile       *file = NULL;
 	Session        *session;
@@ -2344,6 +3076,14 @@ job_class_deserialise (json_object *json)
 	if (! state_get_json_int_var_to_obj (json, class, respawn_interval))
 		goto error;
 
+	if (json_object_object_get_ex (json, "respawn_delay", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, respawn_delay))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, respawn_delay_max))
+			goto error;
+	}
+
 	if (! state_get_json_enum_var (json,
 				job_class_console_type_str_to_enum,
 				"console", class->console))
@@ -2376,6 +3116,12 @@ job_class_deserialise (json_object *json)
 	if (! state_get_json_int_var_to_obj (json, class, debug))
 		goto error;
 
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "shell_auto", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, shell_auto))
+			goto error;
+	}
+
 	if (! state_get_json_string_var_to_obj (json, class, usage))
 		goto error;
 
@@ -2387,6 +3133,11 @@ job_class_deserialise (json_object *json)
 			goto error;
 	}
 
+	if (json_object_object_get_ex (json, "apparmor_load", NULL)) {
+		if (! state_get_json_string_var_to_obj (json, class, apparmor_load))
+			goto error;
+	}
+
 	if (! json_object_object_get_ex (json, "normalexit", &json_normalexit))
 		goto error;
 
@@ -2401,6 +3152,66 @@ job_class_deserialise (json_object *json)
 	if (process_deserialise_all (json, class->process, class->process) < 0)
 		goto error;
 
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "uses_amount", &json_uses_amount)) {
+		if (! state_get_json_str_array_to_obj (json, class, uses))
+			goto error;
+
+		ret = state_deserialise_int_array (class, json_uses_amount,
+				int, &class->uses_amount, &class->uses_len);
+		if (ret < 0)
+			goto error;
+
+		if (class->uses_len && (! class->uses))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "priority", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, priority))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "pressure_max", &json_pressure_max)) {
+		if (! state_get_json_str_array_to_obj (json, class, pressure))
+			goto error;
+
+		ret = state_deserialise_int_array (class, json_pressure_max,
+				int, &class->pressure_max, &class->pressure_len);
+		if (ret < 0)
+			goto error;
+
+		if (class->pressure_len && (! class->pressure))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "pool", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, class, pool))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "sockets", NULL)) {
+		if (! state_get_json_str_array_to_obj (json, class, sockets))
+			goto error;
+	}
+
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "spread", NULL)) {
+		if (! state_get_json_string_var_to_obj (json, class, cpus))
+			goto error;
+
+		if (! state_get_json_int_var_to_obj (json, class, numa_node))
+			goto error;
+
+		if (! state_get_json_enum_var (json,
+					job_class_spread_str_to_enum,
+					"spread", class->spread))
+			goto error;
+	}
+
 	if (file) {
 		/* Add the class to the job_classes hash if ConfFiles were
 		 * available in the serialisation data.
@@ -2594,6 +3405,48 @@ error:
 	return -1;
 }
 
+/**
+ * job_class_spread_enum_to_str:
+ *
+ * @spread: JobSpread.
+ *
+ * Convert JobSpread to a string representation.
+ *
+ * Returns: string representation of @spread, or NULL if not known.
+ **/
+const char *
+job_class_spread_enum_to_str (JobSpread spread)
+{
+	state_enum_to_str (JOB_SPREAD_NONE, spread);
+	state_enum_to_str (JOB_SPREAD_CPUS, spread);
+	state_enum_to_str (JOB_SPREAD_NODES, spread);
+
+	return NULL;
+}
+
+/**
+ * job_class_spread_str_to_enum:
+ *
+ * @spread: string JobSpread value.
+ *
+ * Convert @spread back into enum value.
+ *
+ * Returns: JobSpread representing @spread, or -1 if not known.
+ **/
+JobSpread
+job_class_spread_str_to_enum (const char *spread)
+{
+	if (! spread)
+		goto error;
+
+	state_str_to_enum (JOB_SPREAD_NONE, spread);
+	state_str_to_enum (JOB_SPREAD_CPUS, spread);
+	state_str_to_enum (JOB_SPREAD_NODES, spread);
+
+error:
+	return -1;
+}
+
 /**
  * job_class_prepare_reexec:
  *
@@ -2680,6 +3533,29 @@ job_class_max_kill_timeout (void)
 	return kill_timeout;
 }
 
+/**
+ * job_class_index_new:
+ * @parent: parent object for new index.
+ *
+ * StateIndexBuilder for the job classes hash.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+static StateIndex *
+job_class_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	job_class_init ();
+
+	index = NIH_MUST (state_index_new (parent));
+
+	NIH_HASH_FOREACH (job_classes, iter)
+		NIH_MUST (state_index_add (index, iter));
+
+	return index;
+}
+
 /**
  * job_class_get_index:
  * @class: JobClass to search for.
@@ -2694,6 +3570,18 @@ job_class_get_index (const JobClass *class)
 
 	nih_assert (class);
 
+	/* Registered classes are found directly, otherwise fall back
+	 * to comparing by name and session.
+	 */
+	if (state_context) {
+		i = state_context_get (&state_context->job_classes,
+				       job_class_index_new, class);
+		if (i >= 0)
+			return i;
+
+		i = 0;
+	}
+
 	NIH_HASH_FOREACH (job_classes, iter) {
 		JobClass *c = (JobClass *)iter;
 
@@ -2716,7 +3604,7 @@ int
 job_class_induct_job (JobClass *class)
 {
 	nih_local char **env = NULL;
-	nih_local char  *name = NULL;
+	const char      *name;
 	size_t           len;
 	Job             *job;
 
@@ -2734,9 +3622,7 @@ job_class_induct_job (JobClass *class)
 				"UPSTART_EVENTS"));
 
 	/* Expand the instance name against the environment */
-	name = NIH_SHOULD (environ_expand (NULL,
-				class->instance,
-				env));
+	name = NIH_SHOULD (job_class_instance_name (class, env));
 	if (! name) {
 		NihError *err;
 
@@ -33,6 +33,7 @@
 
 #include <nih-dbus/dbus_message.h>
 
+#include "environ.h"
 #include "process.h"
 #include "event_operator.h"
 #include "session.h"
@@ -70,6 +71,21 @@ typedef enum console_type {
 	CONSOLE_LOG
 } ConsoleType;
 
+/**
+ * JobSpread:
+ *
+ * This is used to identify how the instances of a job are spread across
+ * the machine, each new instance being placed on the next:
+ * - JOB_SPREAD_NONE: instances are not spread,
+ * - JOB_SPREAD_CPUS: CPU of those the job may run on,
+ * - JOB_SPREAD_NODES: NUMA node.
+ **/
+typedef enum job_spread {
+	JOB_SPREAD_NONE,
+	JOB_SPREAD_CPUS,
+	JOB_SPREAD_NODES
+} JobSpread;
+
 
 /**
  * JOB_DEFAULT_KILL_TIMEOUT:
@@ -94,6 +110,14 @@ typedef enum console_type {
  **/
 #define JOB_DEFAULT_RESPAWN_INTERVAL 5
 
+/**
+ * JOB_DEFAULT_RESPAWN_DELAY_MAX:
+ *
+ * The default number of seconds that the delay before respawning a
+ * process may grow to.
+ **/
+#define JOB_DEFAULT_RESPAWN_DELAY_MAX 300
+
 /**
  * JOB_DEFAULT_UMASK:
  *
@@ -115,6 +139,13 @@ typedef enum console_type {
  **/
 #define JOB_DEFAULT_OOM_SCORE_ADJ 0
 
+/**
+ * JOB_POOL_MAX:
+ *
+ * The largest number of spare instances a job may keep started.
+ **/
+#define JOB_POOL_MAX 64
+
 /**
  * JOB_DEFAULT_ENVIRONMENT:
  *
@@ -127,6 +158,27 @@ typedef enum console_type {
 	"TERM"
 
 
+/**
+ * ApparmorStamp:
+ * @dev: device holding the profile file,
+ * @ino: inode of the profile file,
+ * @size: size of the profile file,
+ * @mtime: time the profile file was last modified,
+ * @ctime: time the profile file was last changed.
+ *
+ * Identifies the contents of an AppArmor profile file, so that a profile
+ * already loaded from it need not be loaded again; @ino is zero when no
+ * profile has been loaded.
+ **/
+typedef struct apparmor_stamp {
+	dev_t           dev;
+	ino_t           ino;
+	off_t           size;
+	struct timespec mtime;
+	struct timespec ctime;
+} ApparmorStamp;
+
+
 /**
  * JobClass:
  * @entry: list header,
@@ -135,11 +187,17 @@ typedef enum console_type {
  * @session: attached session,
  * @instance: pattern to uniquely identify multiple instances,
  * @instances: hash table of active instances,
+ * @instance_template: @instance compiled for expansion, or NULL,
  * @description: description; intended for humans,
  * @author: author; intended for humans,
  * @version: version; intended for humans,
  * @env: NULL-terminated array of default environment variables,
  * @export: NULL-terminated array of environment exported to events,
+ * @base_env: NULL-terminated array of the global environment merged with
+ *  @env, shared by instances,
+ * @base_env_len: length of @base_env,
+ * @base_env_generation: generation of the global environment merged into
+ *  @base_env,
  * @start_on: event operator expression that can start an instance,
  * @stop_on: event operator expression that stops instances,
  * @emits: NULL-terminated array of events that may be emitted by instances,
@@ -152,24 +210,47 @@ typedef enum console_type {
  * @respawn: instances should be restarted if main process fails,
  * @respawn_limit: number of respawns in @respawn_interval that we permit,
  * @respawn_interval: barrier for @respawn_limit,
+ * @respawn_delay: seconds to wait before the first respawn, or zero,
+ * @respawn_delay_max: seconds that @respawn_delay may double up to,
  * @normalexit: array of exit codes that prevent a respawn,
  * @normalexit_len: length of @normalexit array,
  * @console: how to arrange processes' stdin/out/err file descriptors,
  * @umask: file mode creation mask,
  * @nice: process priority,
  * @oom_score_adj: OOM killer score adjustment,
+ * @cpus: list of CPUs that processes may run on, or NULL,
+ * @numa_node: NUMA node whose CPUs processes may run on, or -1,
+ * @spread: how instances are spread across CPUs or NUMA nodes,
  * @limits: resource limits indexed by resource,
  * @chroot: root directory of process (implies @chdir if not set),
  * @chdir: working directory of process,
  * @setuid: user name to drop to before starting process,
  * @setgid: group name to drop to before starting process,
  * @deleted: whether job should be deleted when finished,
+ * @shell_auto: whether simple scripts may be run without a shell,
  * @usage: usage text - how to control job,
  * @apparmor_switch: AppArmor profile to switch to before starting job,
+ * @apparmor_load: AppArmor profile file loaded before starting job,
+ * @apparmor_loaded: identity of @apparmor_load when last loaded,
+ * @apparmor_loading: identity of @apparmor_load while being loaded,
  * @cgroups: list of CGroup objects representing the cgroups the
  *  job is required to run in,
  * @cgmanager_wait: TRUE if job waiting for cgroup manager to be
- * available.
+ * available,
+ * @uses: NULL-terminated array of names of resources used by instances,
+ * @uses_amount: amount of each resource in @uses, in parts of
+ *  RESOURCE_UNIT,
+ * @uses_len: length of @uses,
+ * @priority: order in which instances waiting for resources are
+ *  admitted, highest first,
+ * @pressure: NULL-terminated array of names of resources whose pressure
+ *  holds instances in the starting state,
+ * @pressure_max: percentage of time stalled on each resource in
+ *  @pressure above which instances are held,
+ * @pressure_len: length of @pressure,
+ * @pool: number of spare instances kept started ahead of start requests,
+ * @sockets: NULL-terminated array of the arguments of socket stanzas, one
+ *  for each listening socket passed to the main process, or NULL.
  *
  * This structure holds the configuration of a known task or service that
  * should be tracked by the init daemon; as tasks and services are
@@ -185,6 +266,7 @@ typedef struct job_class {
 
 	char           *instance;
 	NihHash        *instances;
+	EnvironTemplate *instance_template;
 
 	char           *description;
 	char           *author;
@@ -193,6 +275,10 @@ typedef struct job_class {
 	char          **env;
 	char          **export;
 
+	char          **base_env;
+	size_t          base_env_len;
+	unsigned int    base_env_generation;
+
 	EventOperator  *start_on;
 	EventOperator  *stop_on;
 	char          **emits;
@@ -209,6 +295,8 @@ typedef struct job_class {
 	int             respawn;
 	int             respawn_limit;
 	time_t          respawn_interval;
+	time_t          respawn_delay;
+	time_t          respawn_delay_max;
 
 	int            *normalexit;
 	size_t          normalexit_len;
@@ -218,6 +306,9 @@ typedef struct job_class {
 	mode_t          umask;
 	int             nice;
 	int             oom_score_adj;
+	char           *cpus;
+	int             numa_node;
+	JobSpread       spread;
 	struct rlimit  *limits[RLIMIT_NLIMITS];
 	char           *chroot;
 	char           *chdir;
@@ -226,21 +317,106 @@ typedef struct job_class {
 
 	int             deleted;
 	int             debug;
+	int             shell_auto;
 
 	char           *usage;
 
 	char	       *apparmor_switch;
+	char           *apparmor_load;
+	ApparmorStamp   apparmor_loaded;
+	ApparmorStamp   apparmor_loading;
+
 	NihList         cgroups;
 	int             cgmanager_wait;
+
+	char          **uses;
+	int            *uses_amount;
+	size_t          uses_len;
+	int             priority;
+
+	char          **pressure;
+	int            *pressure_max;
+	size_t          pressure_len;
+
+	int             pool;
+
+	char          **sockets;
 } JobClass;
 
+/**
+ * JobSubscription:
+ * @entry: list header,
+ * @name: name of event subscribed to,
+ * @class: job class whose start on condition references @name,
+ * @job: job instance whose stop on condition references @name.
+ *
+ * This structure records that an event named @name may change the
+ * start on condition of @class, or the stop on condition of @job;
+ * exactly one of @class and @job is set.  Subscriptions are held in the
+ * job_subscriptions hash table so that an event need only be matched
+ * against the classes and instances that reference it by name.
+ *
+ * A subscription is an nih_alloc() child of the class or job that it
+ * refers to, so it is automatically removed when that is freed.
+ **/
+typedef struct job_subscription {
+	NihList         entry;
+	char           *name;
+
+	JobClass       *class;
+	struct job     *job;
+} JobSubscription;
+
+/**
+ * JobClassKey:
+ * @session: session of job class,
+ * @name: name of job class.
+ *
+ * Key of the job_registrations hash table.
+ **/
+typedef struct job_class_key {
+	const Session  *session;
+	const char     *name;
+} JobClassKey;
+
+/**
+ * JobRegistration:
+ * @entry: list header,
+ * @key: session and name of @class,
+ * @class: job class in the job classes table.
+ *
+ * This structure records that @class is the registered class of its
+ * name for its session, so that it may be found in the
+ * job_registrations hash table without visiting the classes of the
+ * same name that belong to other sessions.
+ *
+ * A registration is an nih_alloc() child of the class that it refers
+ * to, so it is automatically removed when that is freed.
+ **/
+typedef struct job_registration {
+	NihList      entry;
+	JobClassKey  key;
+	JobClass    *class;
+} JobRegistration;
+
 
 NIH_BEGIN_EXTERN
 
 extern NihHash  *job_classes;
+extern NihHash  *job_subscriptions;
+extern NihHash  *job_registrations;
 
 void        job_class_init                 (void);
 
+void        job_subscription_add           (EventOperator *root,
+					    JobClass *class,
+					    struct job *job);
+void        job_subscription_remove        (EventOperator *root,
+					    JobClass *class,
+					    struct job *job);
+JobClass *  job_subscription_next_class    (const char *name,
+					    JobSubscription **sub);
+
 void        job_class_environment_init     (void);
 
 void        job_class_environment_reset    (void);
@@ -249,6 +425,8 @@ void        job_class_environment_clear    (void);
 
 int         job_class_environment_set      (const char *var, int replace);
 int         job_class_environment_unset    (const char *name);
+int         job_class_environment_set_list (char * const *vars, int replace);
+int         job_class_environment_unset_list (char * const *names);
 
 char **     job_class_environment_get_all  (const void *parent)
 	__attribute__ ((warn_unused_result));
@@ -274,6 +452,9 @@ void        job_class_unregister           (JobClass *class,
 char      **job_class_environment          (const void *parent,
 					    JobClass *class, size_t *len)
 	__attribute__ ((warn_unused_result));
+const char *job_class_instance_name        (JobClass *class,
+					    char * const *env)
+	__attribute__ ((warn_unused_result));
 
 
 int         job_class_get_instance         (JobClass *class,
@@ -342,6 +523,14 @@ ConsoleType
 job_class_console_type_str_to_enum (const char *name)
 	__attribute__ ((warn_unused_result));
 
+const char *
+job_class_spread_enum_to_str (JobSpread spread)
+	__attribute__ ((warn_unused_result));
+
+JobSpread
+job_class_spread_str_to_enum (const char *name)
+	__attribute__ ((warn_unused_result));
+
 const char *
 job_class_expect_type_enum_to_str (ExpectType expect)
 	__attribute__ ((warn_unused_result));
@@ -384,6 +573,9 @@ JobClass  *job_class_get_registered (const char *name, const Session *session)
 
 void       job_class_event_block (void *parent, JobClass *old, JobClass *new);
 
+void       job_class_pool_fill  (JobClass *class);
+void       job_class_pool_drain (JobClass *class);
+
 ssize_t
 job_class_get_index (const JobClass *class)
 	__attribute__ ((warn_unused_result));
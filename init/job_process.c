@@ -32,8 +32,14 @@
 #include <sys/ptrace.h>
 #include <sys/resource.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 
 #include <time.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
 #include <limits.h>
@@ -50,6 +56,8 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/string.h>
 #include <nih/signal.h>
 #include <nih/io.h>
@@ -62,25 +70,26 @@
 #include "environ.h"
 #include "process.h"
 #include "job_process.h"
+#include "pty.h"
+#include "iowatch.h"
 #include "job_class.h"
 #include "job.h"
 #include "errors.h"
 #include "control.h"
+#include "snapshot.h"
+#include "quiesce.h"
 #include "xdg.h"
 #include "apparmor.h"
+#include "listener.h"
+#include "metrics.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
 #endif /* ENABLE_CGROUPS */
 
-/**
- * SHELL_CHARS:
- *
- * This is the list of characters that, if encountered in a process, cause
- * it to always be run with a shell.
- **/
-#define SHELL_CHARS "~`!$^&*()=|\\{}[];\"'<>?"
-
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif /* P_PIDFD */
 
 /**
  * JobProcessWireError:
@@ -95,6 +104,133 @@ typedef struct job_process_wire_error {
 	int                 errnum;
 } JobProcessWireError;
 
+/**
+ * JOB_PROCESS_VFORK_STACK:
+ *
+ * Size of the stack used by a child process spawned by
+ * job_process_spawn_vfork() until it calls exec.
+ **/
+#define JOB_PROCESS_VFORK_STACK (64 * 1024)
+
+/**
+ * JobProcessVfork:
+ *
+ * @path: absolute path of binary to execute,
+ * @argv: arguments for process,
+ * @env: environment for process,
+ * @script_fd: script file descriptor, or -1,
+ * @error_fd: writing end of child setup pipe,
+ * @cwd: working directory, or NULL,
+ * @groups: supplementary groups, or NULL to leave unchanged,
+ * @ngroups: number of elements in @groups,
+ * @umask: file creation mask,
+ * @nice: process priority, or JOB_NICE_INVALID,
+ * @limits: resource limits, NULL elements are left unchanged,
+ * @orig_set: signal mask to restore before exec.
+ *
+ * Everything a child process spawned by job_process_spawn_vfork()
+ * needs, prepared by the parent since the child shares its memory and
+ * so may only make system calls.
+ **/
+typedef struct job_process_vfork {
+	const char     *path;
+	char * const   *argv;
+	char * const   *env;
+	int             script_fd;
+	int             error_fd;
+	const char     *cwd;
+	gid_t          *groups;
+	int             ngroups;
+	mode_t          umask;
+	int             nice;
+	struct rlimit * const *limits;
+	sigset_t        orig_set;
+} JobProcessVfork;
+
+/**
+ * JOB_PROCESS_SPAWNER_MAX:
+ *
+ * Maximum size of a request sent to the spawner process; processes
+ * with larger argument lists or environments are spawned by init
+ * itself.
+ **/
+#define JOB_PROCESS_SPAWNER_MAX 65536
+
+/**
+ * JobProcessSpawnerRequest:
+ * @umask: file creation mask,
+ * @nice: process priority, or JOB_NICE_INVALID,
+ * @argc: number of arguments,
+ * @envc: number of environment variables,
+ * @ngroups: number of supplementary groups, or -1 to leave unchanged,
+ * @has_cwd: TRUE if a working directory follows the environment,
+ * @has_script_fd: TRUE if a script file descriptor is passed,
+ * @limit_set: TRUE for each element of @limits to be applied,
+ * @limits: resource limits.
+ *
+ * Header of a request sent to the spawner process.  It is followed by
+ * @ngroups gid_t values and then the NUL-terminated path, arguments,
+ * environment and working directory; the writing end of the child
+ * setup pipe, and the script file descriptor if any, are passed along
+ * with it.
+ *
+ * The spawner process replies with the process id of the new process,
+ * or a negative errno value if it could not be created.
+ **/
+typedef struct job_process_spawner_request {
+	mode_t        umask;
+	int           nice;
+	int           argc;
+	int           envc;
+	int           ngroups;
+	int           has_cwd;
+	int           has_script_fd;
+	int           limit_set[RLIMIT_NLIMITS];
+	struct rlimit limits[RLIMIT_NLIMITS];
+} JobProcessSpawnerRequest;
+
+/**
+ * job_process_spawner_sock:
+ *
+ * Socket connected to the spawner process, or -1 if it is not running.
+ **/
+static int job_process_spawner_sock = -1;
+
+/**
+ * job_process_groups:
+ *
+ * Supplementary groups given to processes spawned by
+ * job_process_spawn_vfork() while we run as root, looked up by
+ * job_process_groups_reload(); NULL until they have been.
+ **/
+static gid_t *job_process_groups = NULL;
+
+/**
+ * job_process_ngroups:
+ *
+ * Number of elements in job_process_groups.
+ **/
+static int job_process_ngroups = 0;
+
+/**
+ * job_process_pidfd_supported:
+ *
+ * FALSE once the kernel has been found not to support process file
+ * descriptors, in which case processes are only tracked by way of
+ * SIGCHLD.
+ **/
+static int job_process_pidfd_supported = TRUE;
+
+/**
+ * job_processes:
+ *
+ * This hash table holds a JobProcess entry for each process currently
+ * being supervised, indexed by process id.  It's used to find the job
+ * responsible for a process without searching every instance of every
+ * class.
+ **/
+NihHash *job_processes = NULL;
+
 /**
  * log_dir:
  *
@@ -129,11 +265,47 @@ int disable_job_logging = 0;
  **/
 int no_inherit_env = FALSE;
 
+/**
+ * use_pidfd:
+ *
+ * If TRUE, reap job processes through process file descriptors watched
+ * by the main loop where the kernel supports them.
+ **/
+int use_pidfd = FALSE;
+
+/**
+ * expect_cgroup:
+ *
+ * Directory within a cgroup2 file system below which the main process of
+ * each job using "expect fork" or "expect daemon" is placed in a cgroup
+ * of its own, such that the process it forks can be found by cgroup
+ * membership once adopted by us rather than by tracing it with ptrace.
+ * If NULL, ptrace is used.
+ **/
+char *expect_cgroup = NULL;
+
 /* Prototypes for static functions */
-static void job_process_kill_timer      (Job *job, NihTimer *timer);
+static const void *job_process_key  (JobProcess *proc);
+static uint32_t    job_process_hash (const pid_t *pid);
+static int         job_process_cmp  (const pid_t *pid1, const pid_t *pid2);
+static int         job_process_destroy (JobProcess *proc);
+static void job_process_watch_pidfd     (JobProcess *proc);
+static void job_process_pidfd_watcher   (JobProcess *proc, NihIoWatch *watch,
+					 NihIoEvents events);
+static void job_process_child_event     (Job *job, ProcessType process,
+					 pid_t pid, NihChildEvents event,
+					 int status);
+static int  job_process_expect_enter    (void)
+	__attribute__ ((warn_unused_result));
+static int  job_process_expect_follow   (Job *job, ProcessType process);
+static void job_process_expect_release  (Job *job);
+static int  job_process_ppid            (pid_t pid, pid_t *ppid)
+	__attribute__ ((warn_unused_result));
+static void job_process_kill_timer      (Job *job, Deadline *timer);
 static void job_process_terminated      (Job *job, ProcessType process,
 					 int status, int state_only);
 static int  job_process_catch_runaway   (Job *job);
+static time_t job_process_respawn_delay (Job *job);
 static void job_process_stopped         (Job *job, ProcessType process);
 static void job_process_trace_new       (Job *job, ProcessType process);
 static void job_process_trace_new_child (Job *job, ProcessType process);
@@ -141,6 +313,30 @@ static void job_process_trace_signal    (Job *job, ProcessType process,
 					 int signum);
 static void job_process_trace_fork      (Job *job, ProcessType process);
 static void job_process_trace_exec      (Job *job, ProcessType process);
+static int  job_process_can_vfork       (Job *job, int trace,
+					 ProcessType process);
+static int  job_process_affinity        (Job *job, cpu_set_t *set)
+	__attribute__ ((warn_unused_result));
+static void job_process_place_fds       (const int *listen_fds,
+					 int num_listen, int *error_fd,
+					 int *pty_slave);
+static void job_process_move_fd         (int *fd, int num_listen,
+					 int error_fd);
+static pid_t job_process_spawn_vfork    (Job *job, char * const argv[],
+					 char * const *env, int script_fd,
+					 int error_fd);
+static char *job_process_find_path      (const void *parent,
+					 const char *file, char * const *env);
+static int  job_process_vfork_child     (JobProcessVfork *data);
+static pid_t job_process_spawner_request (JobProcessVfork *data);
+static void job_process_spawner_main    (int sock)
+	__attribute__ ((noreturn));
+static char **job_process_spawner_parse (char *buf, size_t len,
+					 JobProcessVfork *data,
+					 struct rlimit **limits);
+static void job_process_vfork_abort     (int fd, JobProcessErrorType type,
+					 int arg)
+	__attribute__ ((noreturn));
 
 extern char         *control_server_address;
 extern int           user_mode;
@@ -148,6 +344,273 @@ extern int           session_end;
 extern time_t        quiesce_phase_time;
 
 
+/**
+ * job_process_init:
+ *
+ * Initialise the process hash table.
+ **/
+void
+job_process_init (void)
+{
+	if (! job_processes)
+		job_processes = NIH_MUST (nih_hash_new (NULL, 0,
+			(NihKeyFunction)job_process_key,
+			(NihHashFunction)job_process_hash,
+			(NihCmpFunction)job_process_cmp));
+}
+
+/**
+ * job_process_key:
+ * @proc: entry in job_processes.
+ *
+ * Key function for the job_processes hash table.
+ *
+ * Returns: pointer to the process id of @proc.
+ **/
+static const void *
+job_process_key (JobProcess *proc)
+{
+	nih_assert (proc != NULL);
+
+	return &proc->pid;
+}
+
+/**
+ * job_process_hash:
+ * @pid: process id to hash.
+ *
+ * Hash function for the job_processes hash table; process ids are
+ * allocated sequentially so are already well distributed.
+ *
+ * Returns: hash value for @pid.
+ **/
+static uint32_t
+job_process_hash (const pid_t *pid)
+{
+	nih_assert (pid != NULL);
+
+	return (uint32_t)*pid;
+}
+
+/**
+ * job_process_cmp:
+ * @pid1: first process id,
+ * @pid2: second process id.
+ *
+ * Comparison function for the job_processes hash table.
+ *
+ * Returns: zero if @pid1 and @pid2 are the same process id.
+ **/
+static int
+job_process_cmp (const pid_t *pid1,
+		 const pid_t *pid2)
+{
+	nih_assert (pid1 != NULL);
+	nih_assert (pid2 != NULL);
+
+	return *pid1 != *pid2;
+}
+
+/**
+ * job_process_set_pid:
+ * @job: job to update,
+ * @process: process to update,
+ * @pid: new process id.
+ *
+ * Set the process id of @process in @job to @pid, replacing any entry
+ * for its previous process id in the job_processes hash table.  @pid
+ * may be zero (or negative) to record that the process is no longer
+ * running.
+ **/
+void
+job_process_set_pid (Job         *job,
+		     ProcessType  process,
+		     pid_t        pid)
+{
+	JobProcess *proc;
+	pid_t       old_pid;
+
+	nih_assert (job != NULL);
+	nih_assert (process > PROCESS_INVALID);
+	nih_assert (process < PROCESS_LAST);
+
+	job_process_init ();
+
+	old_pid = job->pid[process];
+	if (old_pid > 0) {
+		NihList *iter = NULL;
+
+		while ((iter = nih_hash_search (job_processes, &old_pid,
+						iter)) != NULL) {
+			proc = (JobProcess *)iter;
+
+			if ((proc->job == job) && (proc->process == process)) {
+				nih_free (proc);
+				break;
+			}
+		}
+	}
+
+	job->pid[process] = pid;
+
+	if (pid <= 0)
+		return;
+
+	proc = NIH_MUST (nih_new (job, JobProcess));
+
+	nih_list_init (&proc->entry);
+	nih_alloc_set_destructor (proc, job_process_destroy);
+
+	proc->pid = pid;
+	proc->job = job;
+	proc->process = process;
+	proc->pidfd = -1;
+	proc->watch = NULL;
+
+	nih_hash_add (job_processes, &proc->entry);
+
+	job_process_watch_pidfd (proc);
+}
+
+/**
+ * job_process_destroy:
+ * @proc: entry in job_processes.
+ *
+ * Removes @proc from the job_processes hash and closes its process file
+ * descriptor; the watch on it is freed along with @proc.
+ *
+ * Returns: zero.
+ **/
+static int
+job_process_destroy (JobProcess *proc)
+{
+	nih_assert (proc != NULL);
+
+	nih_list_destroy (&proc->entry);
+
+	if (proc->pidfd != -1)
+		close (proc->pidfd);
+
+	return 0;
+}
+
+/**
+ * job_process_watch_pidfd:
+ * @proc: entry in job_processes.
+ *
+ * When use_pidfd is TRUE, open a process file descriptor for the process
+ * described by @proc and add a watch for it to the main loop, so that
+ * job_process_pidfd_watcher() is called when the process exits.
+ *
+ * Since the process is our child and has not yet been reaped, its
+ * process id cannot have been reused.  Failure is not an error since
+ * the process is still tracked by way of SIGCHLD.
+ **/
+static void
+job_process_watch_pidfd (JobProcess *proc)
+{
+#ifdef SYS_pidfd_open
+	int fd;
+
+	nih_assert (proc != NULL);
+	nih_assert (proc->pidfd == -1);
+
+	if (! use_pidfd || ! job_process_pidfd_supported)
+		return;
+
+	fd = syscall (SYS_pidfd_open, proc->pid, 0);
+	if (fd < 0) {
+		if (errno == ENOSYS)
+			job_process_pidfd_supported = FALSE;
+		return;
+	}
+
+	proc->watch = nih_io_add_watch (proc, fd, NIH_IO_READ,
+					(NihIoWatcher)job_process_pidfd_watcher,
+					proc);
+	if (! proc->watch) {
+		close (fd);
+		return;
+	}
+
+	(void)iowatch_adopt (proc->watch);
+
+	proc->pidfd = fd;
+#endif /* SYS_pidfd_open */
+}
+
+/**
+ * job_process_pidfd_watcher:
+ * @proc: entry in job_processes,
+ * @watch: watch on process file descriptor,
+ * @events: events that occurred.
+ *
+ * Called when the process file descriptor of @proc becomes readable,
+ * which happens when the process exits.  The process is reaped and the
+ * event handled for the job and process recorded in @proc, without
+ * needing to look up the process id.
+ *
+ * Should the process already have been reaped by way of SIGCHLD, the
+ * watch is simply removed.
+ **/
+static void
+job_process_pidfd_watcher (JobProcess  *proc,
+			   NihIoWatch  *watch,
+			   NihIoEvents  events)
+{
+	siginfo_t       info;
+	Job            *job;
+	ProcessType     process;
+	pid_t           pid;
+	NihChildEvents  event;
+
+	nih_assert (proc != NULL);
+	nih_assert (watch != NULL);
+
+	memset (&info, '\0', sizeof (info));
+
+	if (waitid (P_PIDFD, proc->pidfd, &info, WEXITED | WNOHANG) < 0) {
+		nih_free (proc->watch);
+		proc->watch = NULL;
+
+		close (proc->pidfd);
+		proc->pidfd = -1;
+		return;
+	}
+
+	/* Not yet exited */
+	if (! info.si_pid)
+		return;
+
+	switch (info.si_code) {
+	case CLD_EXITED:
+		event = NIH_CHILD_EXITED;
+		break;
+	case CLD_KILLED:
+		event = NIH_CHILD_KILLED;
+		break;
+	case CLD_DUMPED:
+		event = NIH_CHILD_DUMPED;
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	/* Handling the event is likely to free @proc */
+	job = proc->job;
+	process = proc->process;
+	pid = proc->pid;
+
+	nih_free (proc->watch);
+	proc->watch = NULL;
+
+	/* Entry no longer describes the process */
+	if (job->pid[process] != pid)
+		return;
+
+	job_process_child_event (job, process, pid, event, info.si_status);
+}
+
 /**
  * job_process_start:
  *
@@ -161,7 +624,9 @@ extern time_t        quiesce_phase_time;
  * The process is normally executed using the system shell, unless the
  * script member of @process is FALSE and there are no typical shell
  * characters within the command member, in which case it is executed
- * directly using exec after splitting on whitespace.
+ * directly using exec after splitting on whitespace.  Scripts consisting
+ * of a single simple command are treated in the same way when the job
+ * class has requested "shell auto".
  *
  * When executed with the shell, if the command (which may be an entire
  * script) is reasonably small (less than 1KB) it is passed to the
@@ -191,12 +656,15 @@ job_process_start (Job                    *job,
 	nih_local char    **argv = NULL;
 	nih_local char    **env = NULL;
 	nih_local char     *script = NULL;
+	nih_local char     *command = NULL;
 	char              **e;
 	size_t              argc, envc;
 	int                 fds[2] = { -1, -1 };
-	int                 trace = FALSE, shell = FALSE;
+	int                 trace = FALSE, track = FALSE, shell = FALSE;
 	int                 job_process_fd = -1;
+	pid_t               pid;
 	JobProcessData     *process_data = NULL;
+	uint64_t            spawn_started;
 
 	nih_assert (job);
 	nih_assert (process > PROCESS_INVALID);
@@ -206,11 +674,20 @@ job_process_start (Job                    *job,
 	nih_assert (proc != NULL);
 	nih_assert (proc->command != NULL);
 
+	/* Scripts consisting of a single simple command are run directly,
+	 * as if they had been given with exec, when the job allows it.
+	 */
+	if (proc->script && proc->simple && job->class->shell_auto)
+		command = process_script_command (NULL, proc->command);
+
 	/* We run the process using a shell if it says it wants to be run
 	 * as such, or if it contains any shell-like characters; since that's
 	 * the best way to deal with things like variables.
 	 */
-	if ((proc->script) || strpbrk (proc->command, SHELL_CHARS)) {
+	if (command) {
+		argv = NIH_MUST (nih_str_split (NULL, command,
+						" \t\r\n", TRUE));
+	} else if ((proc->script) || strpbrk (proc->command, SHELL_CHARS)) {
 		char *nl, *p;
 
 		argc = 0;
@@ -300,17 +777,53 @@ job_process_start (Job                    *job,
 		NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
 			       "UPSTART_SESSION=%s", control_server_address));
 
+	/* The main process is passed the listening sockets of the job from
+	 * descriptor 3 on, which is where both variables say they are.
+	 */
+	if (process == PROCESS_MAIN) {
+		int             listen_fds[LISTENER_MAX];
+		int             num_listen;
+		nih_local char *fdlist = NULL;
+
+		num_listen = listener_fds (job->class, listen_fds);
+		for (int i = 0; i < num_listen; i++)
+			NIH_MUST (nih_strcat_sprintf (&fdlist, NULL, "%s%d",
+						      fdlist ? " " : "",
+						      LISTENER_FD_START + i));
+
+		if (num_listen) {
+			NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
+					       "UPSTART_FDS=%s", fdlist));
+			NIH_MUST (environ_set (&env, NULL, &envc, TRUE,
+					       "LISTEN_FDS=%d", num_listen));
+		}
+	}
+
 	/* If we're about to spawn the main job and we expect it to become
 	 * a daemon or fork before we can move out of spawned, we need to
-	 * set a trace on it.
+	 * set a trace on it, or follow it by cgroup membership.
 	 */
 	if ((process == PROCESS_MAIN)
 	    && ((job->class->expect == EXPECT_DAEMON)
-		|| (job->class->expect == EXPECT_FORK)))
-		trace = TRUE;
+		|| (job->class->expect == EXPECT_FORK))) {
+		if (expect_cgroup) {
+			track = TRUE;
+		} else {
+			trace = TRUE;
+		}
+	}
+
+	if (process == PROCESS_MAIN) {
+		job_process_expect_release (job);
+		job->trace_state = track ? TRACE_CGROUP : TRACE_NONE;
+	}
+
+	job_timeline_add (job, JOB_TIMELINE_SPAWN, process);
+
+	spawn_started = metrics_now ();
 
 	/* Spawn the process, repeat until fork() works */
-	while ((job->pid[process] = job_process_spawn_with_fd (job, argv, env,
+	while ((pid = job_process_spawn_with_fd (job, argv, env,
 					trace, fds[0], process, &job_process_fd)) < 0) {
 		NihError *err;
 
@@ -320,11 +833,19 @@ job_process_start (Job                    *job,
 		nih_free (err);
 	}
 
+	metrics_spawned (spawn_started);
+
+	job_process_set_pid (job, process, pid);
+
 	nih_info (_("%s %s process (%d)"),
 		  job_name (job), process_name (process), job->pid[process]);
 
 	job->trace_forks = 0;
-	job->trace_state = trace ? TRACE_NEW : TRACE_NONE;
+	job->trace_state = trace ? TRACE_NEW : track ? TRACE_CGROUP : TRACE_NONE;
+
+	if (track)
+		job->trace_cgroup = NIH_MUST (nih_sprintf (job, "%s/%d",
+							   expect_cgroup, pid));
 
 	if (shell) {
 		/* Clean up and close the reading end (we don't need it) */
@@ -385,6 +906,10 @@ job_process_start (Job                    *job,
  * wait for this and then may use it to set options before continuing the
  * process.
  *
+ * If the trace state of @job is TRACE_CGROUP and @process is the main
+ * process, the new process is placed in a cgroup of its own below
+ * expect_cgroup before anything else is set up.
+ *
  * If @script_fd is not -1, this file descriptor is dup()d to the special fd 9
  * (moving any other out of the way if necessary).
  *
@@ -416,7 +941,7 @@ job_process_spawn_with_fd (Job          *job,
 	int             i, fds[2] = { -1, -1 };
 	int             pty_master = -1;
 	int             pty_slave = -1;
-	char            pts_name[PATH_MAX];
+	Pty             pty;
 	char            filename[PATH_MAX];
 	FILE           *fd;
 	nih_local char *log_path = NULL;
@@ -425,6 +950,10 @@ job_process_spawn_with_fd (Job          *job,
 	gid_t           job_setgid = -1;
 	struct passwd   *pwd = NULL;
 	struct group    *grp = NULL;
+	cpu_set_t        cpus;
+	int              affinity;
+	int              listen_fds[LISTENER_MAX];
+	int              num_listen = 0;
 
 #ifdef ENABLE_CGROUPS
 	int              cgroups_needed = FALSE;
@@ -454,6 +983,16 @@ job_process_spawn_with_fd (Job          *job,
 
 #endif /* ENABLE_CGROUPS */
 
+	/* Work out which CPUs the process may run on now, since the child
+	 * must not read sysfs or look at the other instances.
+	 */
+	affinity = job_process_affinity (job, &cpus);
+	if (affinity < 0)
+		return -1;
+
+	if (process == PROCESS_MAIN)
+		num_listen = listener_fds (class, listen_fds);
+
 	/* Create a pipe to communicate with the child process until it
 	 * execs so we know whether that was successful or an error occurred.
 	 */
@@ -463,6 +1002,24 @@ job_process_spawn_with_fd (Job          *job,
 	if (class->console == CONSOLE_LOG && disable_job_logging)
 			class->console = CONSOLE_NONE;
 
+	/* Simple processes are spawned without copying our address space */
+	if (job_process_can_vfork (job, trace, process)) {
+		pid = job_process_spawn_vfork (job, argv, env, script_fd, fds[1]);
+		if (pid < 0) {
+			close (fds[0]);
+			close (fds[1]);
+			return -1;
+		} else if (pid > 0) {
+			close (fds[1]);
+
+			*job_process_fd = fds[0];
+
+			nih_io_set_cloexec (*job_process_fd);
+
+			return pid;
+		}
+	}
+
 	if (class->console == CONSOLE_LOG) {
 		NihError *err;
 
@@ -487,9 +1044,12 @@ job_process_spawn_with_fd (Job          *job,
 			nih_return_no_memory_error (-1);
 		}
 
-		pty_master = posix_openpt (O_RDWR | O_NOCTTY);
-
-		if (pty_master < 0) {
+		/* The pty comes ready to use from the pool when it can,
+		 * already granted and unlocked, and is close-on-exec to stop
+		 * any process created _before_ the log object below is freed
+		 * from inheriting it.
+		 */
+		if (pty_open (&pty) < 0) {
 			nih_error (_("Failed to create pty - disabling logging for job"));
 
 			/* Ensure that the job can still be started by
@@ -499,13 +1059,10 @@ job_process_spawn_with_fd (Job          *job,
 
 			close (fds[0]);
 			close (fds[1]);
-			nih_return_system_error (-1);
+			return -1;
 		}
 
-		/* Stop any process created _before_ the log object below is
-		 * freed from inheriting this fd.
-		 */
-		nih_io_set_cloexec (pty_master);
+		pty_master = pty.master;
 
 		/* pty_master will be closed by log_destroy() */
 		job->log[process] = log_new (job->log, log_path, pty_master, 0);
@@ -579,48 +1136,13 @@ job_process_spawn_with_fd (Job          *job,
 	nih_io_set_cloexec (fds[1]);
 
 	if (class->console == CONSOLE_LOG) {
-		struct sigaction act;
-		struct sigaction ignore;
-
 		job_process_remap_fd (&pty_master, JOB_PROCESS_SCRIPT_FD, fds[1]);
 
 		/* Child is the slave, so won't need this */
 		nih_io_set_cloexec (pty_master);
 
-		/* Temporarily disable child handler as grantpt(3) disallows one
-		 * being in effect when called.
-		 */
-		ignore.sa_handler = SIG_DFL;
-		ignore.sa_flags = 0;
-		sigemptyset (&ignore.sa_mask);
-
-		if (sigaction (SIGCHLD, &ignore, &act) < 0) {
-			nih_error_raise_system ();
-			job_process_error_abort (fds[1], JOB_PROCESS_ERROR_SIGNAL, 0);
-		}
-
-		if (grantpt (pty_master) < 0) {
-			nih_error_raise_system ();
-			job_process_error_abort (fds[1], JOB_PROCESS_ERROR_GRANTPT, 0);
-		}
-
-		/* Restore child handler */
-		if (sigaction (SIGCHLD, &act, NULL) < 0) {
-			nih_error_raise_system ();
-			job_process_error_abort (fds[1], JOB_PROCESS_ERROR_SIGNAL, 0);
-		}
-
-		if (unlockpt (pty_master) < 0) {
-			nih_error_raise_system ();
-			job_process_error_abort (fds[1], JOB_PROCESS_ERROR_UNLOCKPT, 0);
-		}
-
-		if (ptsname_r (pty_master, pts_name, sizeof(pts_name)) < 0) {
-			nih_error_raise_system ();
-			job_process_error_abort (fds[1], JOB_PROCESS_ERROR_PTSNAME, 0);
-		}
-
-		pty_slave = open (pts_name, O_RDWR | O_NOCTTY);
+		/* pty_open() already granted and unlocked the slave */
+		pty_slave = open (pty.name, O_RDWR | O_NOCTTY);
 
 		if (pty_slave < 0) {
 			nih_error_raise_system ();
@@ -643,14 +1165,34 @@ job_process_spawn_with_fd (Job          *job,
 		script_fd = tmp;
 	}
 
+	/* Pass the listening sockets of the job from descriptor 3 on */
+	if (num_listen)
+		job_process_place_fds (listen_fds, num_listen,
+				       &fds[1], &pty_slave);
+
 	/* Become the leader of a new session and process group, shedding
 	 * any controlling tty (which we shouldn't have had anyway).
 	 */
 	setsid ();
 
+	/* Enter our own cgroup, before any chroot, if the process we fork
+	 * is to be found by cgroup membership.
+	 */
+	if ((process == PROCESS_MAIN) && (job->trace_state == TRACE_CGROUP)
+	    && (job_process_expect_enter () < 0))
+		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_ENTER, 0);
+
 	/* Set the process environment from the function parameters. */
 	environ = (char **)env;
 
+	/* Only we know the process id the listening sockets are for */
+	if (num_listen) {
+		char pidstr[32];
+
+		snprintf (pidstr, sizeof (pidstr), "%d", getpid ());
+		setenv ("LISTEN_PID", pidstr, TRUE);
+	}
+
 	/* Set the standard file descriptors to an output of our chosing;
 	 * any other open descriptor must be intended for the child, or have
 	 * the FD_CLOEXEC flag so it's automatically closed when we exec()
@@ -738,6 +1280,14 @@ job_process_spawn_with_fd (Job          *job,
 						 JOB_PROCESS_ERROR_PRIORITY, 0);
 		}
 
+		/* Restrict the CPUs the process may run on.
+		 */
+		if (affinity && sched_setaffinity (0, sizeof (cpus), &cpus) < 0) {
+			nih_error_raise_system ();
+			job_process_error_abort (fds[1],
+						 JOB_PROCESS_ERROR_AFFINITY, 0);
+		}
+
 		/* Adjust the process OOM killer priority.
 		 */
 		if (class->oom_score_adj != JOB_DEFAULT_OOM_SCORE_ADJ) {
@@ -880,7 +1430,7 @@ job_process_spawn_with_fd (Job          *job,
 
 #ifdef ENABLE_CGROUPS
 		if (cgroups_needed) {
-			if (cgroup_manager_connect () < 0)
+			if ((! cgroup_root) && (cgroup_manager_connect () < 0))
 				job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_MGR_CONNECT, 0);
 
 			if (! cgroup_setup (&job->class->cgroups,
@@ -915,66 +1465,1004 @@ job_process_spawn_with_fd (Job          *job,
 		}
 	}
 
-	/* Reset all the signal handlers back to their default handling so
-	 * the child isn't unexpectedly ignoring any, and so we won't
-	 * surprisingly handle them before we've exec()d the new process.
-	 */
-	nih_signal_reset ();
-	sigprocmask (SIG_SETMASK, &orig_set, NULL);
+	/* Reset all the signal handlers back to their default handling so
+	 * the child isn't unexpectedly ignoring any, and so we won't
+	 * surprisingly handle them before we've exec()d the new process.
+	 */
+	nih_signal_reset ();
+	sigprocmask (SIG_SETMASK, &orig_set, NULL);
+
+	/* Notes:
+	 *
+	 * - we can't use pause() here since there would then be no way to
+	 *   resume the process without killing it.
+	 *
+	 * - we have to close the pipe back to the parent since if we don't,
+	 *   the parent hangs until the STOP is cleared. Although this may be
+	 *   acceptable for normal operation, this causes the test suite to
+	 *   fail. Note that closing the pipe means from this point onwards,
+	 *   the parent cannot know the true outcome of the spawn: that
+	 *   responsibility lies with the debugger.
+	 *
+	 * - note that running with the debug stanza enabled will
+	 *   unavoidably stop stateful re-exec from working correctly
+	 *   since the stopped debug child process will hold copies of
+	 *   the parents file descriptors open until it continues to
+	 *   call exec below.
+	 */
+	if (class->debug) {
+		/* Since we have not exec'd at this point, we will still
+		 * have a copy of the parents fds open. As such, re-exec
+		 * will not work.
+		 */
+		close (fds[1]);
+		raise (SIGSTOP);
+	}
+
+#ifdef ENABLE_CGROUPS
+	/* Move the pid into the appropriate cgroups now that 
+	 * the process is running with the correct group and user
+	 * ownership.
+	 */
+	if (cgroups_needed && cgroup_enter_groups (&job->class->cgroups) != TRUE)
+		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_ENTER, 0);
+
+#endif /* ENABLE_CGROUPS */
+
+	/* Set up a process trace if we need to trace forks */
+	if (trace) {
+		if (ptrace (PTRACE_TRACEME, 0, NULL, 0) < 0) {
+			nih_error_raise_system();
+			job_process_error_abort (fds[1],
+						 JOB_PROCESS_ERROR_PTRACE, 0);
+		}
+	}
+
+	/* Execute the process, if we escape from here it failed */
+	if (execvp (argv[0], argv) < 0) {
+		nih_error_raise_system ();
+		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_EXEC, 0);
+	}
+
+	nih_assert_not_reached ();
+}
+
+
+/**
+ * job_process_can_vfork:
+ * @job: job of process to be spawned,
+ * @trace: whether process is to be traced,
+ * @process: job process to spawn.
+ *
+ * Determine whether @process of @job may be spawned by
+ * job_process_spawn_vfork(): that is only possible when none of the
+ * child setup performed by job_process_spawn_with_fd() would need to
+ * allocate memory or otherwise modify our own state, so processes
+ * which are traced, logged, chrooted, run as a different user or
+ * group, confined, placed in cgroups, debugged, have their OOM score
+ * adjusted, are bound to CPUs or are passed listening sockets always
+ * take the ordinary fork() path.
+ *
+ * Returns: TRUE if the process may be spawned by
+ * job_process_spawn_vfork(), else FALSE.
+ **/
+static int
+job_process_can_vfork (Job         *job,
+		       int          trace,
+		       ProcessType  process)
+{
+	JobClass *class;
+
+	nih_assert (job != NULL);
+
+	class = job->class;
+
+	if (trace || process == PROCESS_SECURITY)
+		return FALSE;
+
+	if (process == PROCESS_MAIN && job->trace_state == TRACE_CGROUP)
+		return FALSE;
+
+	if (class->console != CONSOLE_NONE || class->debug)
+		return FALSE;
+
+	if (class->chroot || (class->session && class->session->chroot))
+		return FALSE;
+
+	if (class->setuid || class->setgid)
+		return FALSE;
+
+	if (class->apparmor_switch && process == PROCESS_MAIN)
+		return FALSE;
+
+	if (class->oom_score_adj != JOB_DEFAULT_OOM_SCORE_ADJ)
+		return FALSE;
+
+	if (class->cpus || class->numa_node >= 0
+	    || class->spread != JOB_SPREAD_NONE)
+		return FALSE;
+
+	if (class->sockets && process == PROCESS_MAIN)
+		return FALSE;
+
+#ifdef ENABLE_CGROUPS
+	if (job_needs_cgroups (job))
+		return FALSE;
+#endif /* ENABLE_CGROUPS */
+
+	return TRUE;
+}
+
+/**
+ * job_process_affinity:
+ * @job: job of process to be spawned,
+ * @set: set to fill.
+ *
+ * Work out the CPUs that processes of @job may run on from the cpus,
+ * numa-node and spread-instances stanzas of its class, starting from
+ * those we may run on ourselves.
+ *
+ * Instances spread across CPUs are each given the single CPU chosen by
+ * their slot; instances spread across NUMA nodes are given the CPUs of
+ * the node chosen by their slot, unless none of them are allowed.  No
+ * memory policy is set: since memory is allocated on the node of the
+ * CPU that first touches it, binding to the CPUs of a node is enough
+ * to keep the memory of a process local.
+ *
+ * @set may be left empty when the stanzas allow no CPU at all, in which
+ * case setting it in the child fails and is reported as usual.
+ *
+ * Returns: TRUE if @set was filled, FALSE if processes of @job are not
+ * bound to any CPUs, or negative value on raised error.
+ **/
+static int
+job_process_affinity (Job       *job,
+		      cpu_set_t *set)
+{
+	JobClass  *class;
+	cpu_set_t  other;
+	int        count;
+	int        n;
+
+	nih_assert (job != NULL);
+	nih_assert (set != NULL);
+
+	class = job->class;
+
+	if ((! class->cpus) && (class->numa_node < 0)
+	    && (class->spread == JOB_SPREAD_NONE))
+		return FALSE;
+
+	if (sched_getaffinity (0, sizeof (cpu_set_t), set) < 0)
+		nih_return_system_error (-1);
+
+	/* Checked when parsed */
+	if (class->cpus && (system_parse_cpus (class->cpus, &other) == 0))
+		CPU_AND (set, set, &other);
+
+	if (class->numa_node >= 0) {
+		if (system_node_cpus (class->numa_node, &other) < 0)
+			return -1;
+
+		CPU_AND (set, set, &other);
+	}
+
+	if (job->spread_slot < 0)
+		return TRUE;
+
+	switch (class->spread) {
+	case JOB_SPREAD_CPUS:
+		count = CPU_COUNT (set);
+		if (! count)
+			break;
+
+		n = job->spread_slot % count;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (! CPU_ISSET (cpu, set))
+				continue;
+
+			if (n--)
+				CPU_CLR (cpu, set);
+		}
+		break;
+	case JOB_SPREAD_NODES: {
+		cpu_set_t nodes;
+
+		if (system_online_nodes (&nodes) < 0)
+			return -1;
+
+		count = CPU_COUNT (&nodes);
+		nih_assert (count > 0);
+
+		n = job->spread_slot % count;
+		for (int node = 0; node < CPU_SETSIZE; node++) {
+			if (! CPU_ISSET (node, &nodes))
+				continue;
+
+			if (n--)
+				continue;
+
+			if (system_node_cpus (node, &other) < 0)
+				return -1;
+
+			CPU_AND (&other, &other, set);
+			if (CPU_COUNT (&other))
+				*set = other;
+			break;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+/**
+ * job_process_spawn_vfork:
+ * @job: job of process to be spawned,
+ * @argv: NULL-terminated list of arguments for the process,
+ * @env: NULL-terminated list of environment variables for the process,
+ * @script_fd: script file descriptor,
+ * @error_fd: writing end of child setup pipe.
+ *
+ * Spawn a process for @job in the same way as job_process_spawn_with_fd()
+ * but using clone(CLONE_VM|CLONE_VFORK) such that the time taken does
+ * not depend on the size of our own address space. The caller must have
+ * checked job_process_can_vfork() first.
+ *
+ * Everything that may allocate memory, such as the PATH search for
+ * @argv[0], is done here before the child is created; if any of it
+ * fails, or the supplementary groups have not been looked up by
+ * job_process_groups_reload(), the ordinary fork() path should be used
+ * instead since that is able to report the error.
+ *
+ * Returns: process id of new process, 0 if the ordinary fork() path
+ * should be used, or -1 on raised error.
+ **/
+static pid_t
+job_process_spawn_vfork (Job          *job,
+			 char * const  argv[],
+			 char * const *env,
+			 int           script_fd,
+			 int           error_fd)
+{
+	static char * const  empty_env[] = { NULL };
+	nih_local char      *path = NULL;
+	nih_local char      *stack = NULL;
+	JobProcessVfork      data;
+	sigset_t             child_set;
+	pid_t                pid;
+	int                  saved_errno;
+
+	nih_assert (job != NULL);
+	nih_assert (argv != NULL);
+	nih_assert (argv[0] != NULL);
+	nih_assert (error_fd >= 0);
+
+	path = job_process_find_path (NULL, argv[0], env);
+	if (! path)
+		return 0;
+
+	memset (&data, 0, sizeof (data));
+
+	data.path = path;
+	data.argv = argv;
+	data.env = env ? env : empty_env;
+	data.script_fd = script_fd;
+	data.error_fd = error_fd;
+	data.umask = job->class->umask;
+	data.nice = job->class->nice;
+	data.limits = job->class->limits;
+
+	if (job->class->chdir || user_mode == FALSE)
+		data.cwd = job->class->chdir ? job->class->chdir : "/";
+
+	/* Equivalent of the initgroups() call made in the child by
+	 * job_process_spawn_with_fd(); since the name service may block,
+	 * it isn't consulted here but only when the configuration is
+	 * reloaded, and the ordinary path is taken until it has been.
+	 */
+	if (geteuid () == 0) {
+		if (! job_process_groups)
+			return 0;
+
+		data.groups = job_process_groups;
+		data.ngroups = job_process_ngroups;
+	}
+
+	/* The child inherits a copy of our file descriptors, so make
+	 * sure the pipe is closed on exec for it to signal success.
+	 */
+	nih_io_set_cloexec (error_fd);
+
+	if (job_process_spawner_sock != -1) {
+		pid = job_process_spawner_request (&data);
+		if (pid > 0)
+			return pid;
+	}
+
+	stack = nih_alloc (NULL, JOB_PROCESS_VFORK_STACK);
+	if (! stack)
+		return 0;
+
+	/* Block all signals as job_process_spawn_with_fd() does; the
+	 * child resets them before exec.
+	 */
+	sigfillset (&child_set);
+	sigprocmask (SIG_BLOCK, &child_set, &data.orig_set);
+
+	fflush (NULL);
+
+	/* The child shares our memory, errno included, so anything it
+	 * fails at on the way to exec would otherwise be left in ours.
+	 */
+	saved_errno = errno;
+
+	/* We are suspended until the child has called exec or exited */
+	pid = clone ((int (*)(void *))job_process_vfork_child,
+		     stack + JOB_PROCESS_VFORK_STACK,
+		     CLONE_VM | CLONE_VFORK | SIGCHLD, &data);
+	if (pid > 0)
+		errno = saved_errno;
+
+	sigprocmask (SIG_SETMASK, &data.orig_set, NULL);
+
+	if (pid < 0)
+		nih_return_system_error (-1);
+
+	return pid;
+}
+
+/**
+ * job_process_groups_reload:
+ *
+ * Look up the supplementary groups of the user and group we run as,
+ * for processes spawned by job_process_spawn_vfork() to be given in
+ * place of the initgroups() call made by job_process_spawn_with_fd().
+ *
+ * Since the name service may be slow, or block altogether, this is only
+ * done when the configuration is reloaded rather than for every process
+ * spawned.  If the lookup fails, processes are spawned by the ordinary
+ * fork() path, which reports the error, until it next succeeds.
+ **/
+void
+job_process_groups_reload (void)
+{
+	struct passwd *pwd;
+	struct group  *grp;
+	gid_t         *groups;
+	int            ngroups = 0;
+
+	if (job_process_groups) {
+		nih_free (job_process_groups);
+		job_process_groups = NULL;
+		job_process_ngroups = 0;
+	}
+
+	/* initgroups() isn't called when we're not root */
+	if (geteuid () != 0)
+		return;
+
+	pwd = getpwuid (geteuid ());
+	grp = getgrgid (getegid ());
+	if (! pwd || ! grp)
+		return;
+
+	(void)getgrouplist (pwd->pw_name, grp->gr_gid, NULL, &ngroups);
+	if (ngroups < 1)
+		return;
+
+	groups = nih_alloc (NULL, ngroups * sizeof (gid_t));
+	if (! groups)
+		return;
+
+	if (getgrouplist (pwd->pw_name, grp->gr_gid, groups, &ngroups) < 0) {
+		nih_free (groups);
+		return;
+	}
+
+	job_process_groups = groups;
+	job_process_ngroups = ngroups;
+}
+
+/**
+ * job_process_find_path:
+ * @parent: parent for new string,
+ * @file: name of binary,
+ * @env: environment the binary will be executed with.
+ *
+ * Find @file in the same way as execvp() would when called with @env
+ * as its environment.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned string.  When all parents
+ * of the returned string are freed, the returned string will also be
+ * freed.
+ *
+ * Returns: newly allocated absolute path, or NULL if @file could not be
+ * found or insufficient memory.
+ **/
+static char *
+job_process_find_path (const void   *parent,
+		       const char   *file,
+		       char * const *env)
+{
+	nih_local char *dirs = NULL;
+	const char     *value;
+	char           *dir;
+	char           *saveptr = NULL;
+
+	nih_assert (file != NULL);
+
+	if (strchr (file, '/'))
+		return nih_strdup (parent, file);
+
+	value = env ? environ_get (env, "PATH") : NULL;
+	if (! value || ! *file)
+		return NULL;
+
+	dirs = nih_strdup (NULL, value);
+	if (! dirs)
+		return NULL;
+
+	for (dir = strtok_r (dirs, ":", &saveptr); dir;
+	     dir = strtok_r (NULL, ":", &saveptr)) {
+		nih_local char *path = NULL;
+
+		path = nih_sprintf (NULL, "%s/%s", dir, file);
+		if (! path)
+			return NULL;
+
+		if (! access (path, X_OK))
+			return nih_strdup (parent, path);
+	}
+
+	return NULL;
+}
+
+/**
+ * job_process_vfork_child:
+ * @data: details of process to spawn.
+ *
+ * Child side of job_process_spawn_vfork(), which sets up the process
+ * as job_process_spawn_with_fd() would for a process satisfying
+ * job_process_can_vfork() and then executes it.
+ *
+ * Since this shares memory with init, only system calls may be made
+ * and @data must not be modified; failures are reported by
+ * job_process_vfork_abort().  It is also used by the spawner process,
+ * see job_process_spawner_start().
+ *
+ * Returns: never.
+ **/
+static int
+job_process_vfork_child (JobProcessVfork *data)
+{
+	int error_fd;
+	int script_fd;
+	int fd;
+	int i;
+
+	nih_assert (data != NULL);
+
+	error_fd = data->error_fd;
+	script_fd = data->script_fd;
+
+	/* Move the error descriptor out of the way of the script fd */
+	if (error_fd == JOB_PROCESS_SCRIPT_FD) {
+		fd = fcntl (error_fd, F_DUPFD_CLOEXEC, 0);
+		if (fd < 0)
+			job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+		close (error_fd);
+		error_fd = fd;
+	}
+
+	if (script_fd != -1 && script_fd != JOB_PROCESS_SCRIPT_FD) {
+		if (dup2 (script_fd, JOB_PROCESS_SCRIPT_FD) < 0)
+			job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+		close (script_fd);
+	} else if (script_fd == JOB_PROCESS_SCRIPT_FD) {
+		/* Descriptors received by the spawner are close-on-exec */
+		if (fcntl (script_fd, F_SETFD, 0) < 0)
+			job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+	}
+
+	setsid ();
+
+	/* No console really means /dev/null */
+	for (i = 0; i < 3; i++)
+		close (i);
+
+	fd = open (DEV_NULL, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_CONSOLE, 0);
+
+	while (dup (fd) < 2)
+		;
+
+	for (i = 0; i < RLIMIT_NLIMITS; i++) {
+		if (! data->limits[i])
+			continue;
+
+		if (setrlimit (i, data->limits[i]) < 0)
+			job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_RLIMIT, i);
+	}
+
+	umask (data->umask);
+
+	if (data->nice != JOB_NICE_INVALID
+	    && setpriority (PRIO_PROCESS, 0, data->nice) < 0)
+		job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_PRIORITY, 0);
+
+	if (data->cwd && chdir (data->cwd) < 0)
+		job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_CHDIR, 0);
+
+	if (data->groups && setgroups (data->ngroups, data->groups) < 0)
+		job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_INITGROUPS, 0);
+
+	nih_signal_reset ();
+	sigprocmask (SIG_SETMASK, &data->orig_set, NULL);
+
+	execve (data->path, data->argv, data->env);
+
+	job_process_vfork_abort (error_fd, JOB_PROCESS_ERROR_EXEC, 0);
+}
+
+/**
+ * job_process_vfork_abort:
+ * @fd: writing end of pipe,
+ * @type: step that failed,
+ * @arg: argument to @type.
+ *
+ * Equivalent of job_process_error_abort() for a child process spawned
+ * by job_process_spawn_vfork(), which reports errno rather than the
+ * currently raised error and exits without running any exit handlers.
+ *
+ * This function calls the _exit() system call, so never returns.
+ **/
+static void
+job_process_vfork_abort (int                 fd,
+			 JobProcessErrorType type,
+			 int                 arg)
+{
+	JobProcessWireError  wire_err;
+
+	wire_err.type = type;
+	wire_err.arg = arg;
+	wire_err.errnum = errno;
+
+	while (write (fd, &wire_err, sizeof (wire_err)) < 0)
+		;
+
+	_exit (255);
+}
+
+/**
+ * job_process_spawner_start:
+ *
+ * Start the spawner process, a small process forked from init early
+ * in its life which then spawns processes satisfying
+ * job_process_can_vfork() on init's behalf.  Since the spawner's
+ * address space is small, and it creates processes with CLONE_PARENT
+ * so that they are still children of init, the cost of spawning such
+ * processes no longer grows with the memory used by init.
+ *
+ * Processes are spawned by init itself whenever the spawner is not
+ * running or fails to respond.
+ *
+ * Returns: process id of spawner process, or -1 on error.
+ **/
+pid_t
+job_process_spawner_start (void)
+{
+	int       socks[2];
+	pid_t     pid;
+	sigset_t  child_set;
+	sigset_t  orig_set;
+
+	nih_assert (job_process_spawner_sock == -1);
+
+	if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) < 0) {
+		nih_warn ("%s: %s", _("Failed to create spawner socket"),
+				strerror (errno));
+		return -1;
+	}
+
+	/* Block all signals while we fork to avoid the child process
+	 * running our own signal handlers before we've reset them.
+	 */
+	sigfillset (&child_set);
+	sigprocmask (SIG_BLOCK, &child_set, &orig_set);
+
+	fflush (NULL);
+
+	pid = fork ();
+	if (pid < 0) {
+		nih_warn ("%s: %s", _("Failed to start spawner process"),
+				strerror (errno));
+
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+		close (socks[0]);
+		close (socks[1]);
+		return -1;
+	} else if (! pid) {
+		nih_signal_reset ();
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+
+		system_close_fds (socks[1]);
+		job_process_spawner_main (socks[1]);
+	}
+
+	sigprocmask (SIG_SETMASK, &orig_set, NULL);
+	close (socks[1]);
+
+	job_process_spawner_sock = socks[0];
+
+	nih_debug ("Started spawner process (%d)", pid);
+
+	return pid;
+}
+
+/**
+ * job_process_spawner_stop:
+ *
+ * Stop using the spawner process, which exits once it notices that
+ * init has closed its end of the socket.
+ **/
+void
+job_process_spawner_stop (void)
+{
+	if (job_process_spawner_sock == -1)
+		return;
+
+	close (job_process_spawner_sock);
+	job_process_spawner_sock = -1;
+}
+
+/**
+ * job_process_spawner_request:
+ * @data: details of process to spawn.
+ *
+ * Ask the spawner process to spawn the process described by @data,
+ * waiting for it to reply with the process id.  Waiting is necessary
+ * since the new process is our child and we must know its process id
+ * before we next reap children.
+ *
+ * If the spawner process cannot be reached it is no longer used.
+ *
+ * Returns: process id of new process, or 0 if the process should be
+ * spawned by init itself.
+ **/
+static pid_t
+job_process_spawner_request (JobProcessVfork *data)
+{
+	nih_local char           *buf = NULL;
+	JobProcessSpawnerRequest *req;
+	struct msghdr             msg;
+	struct iovec              iov;
+	struct cmsghdr           *cmsg;
+	char                      control[CMSG_SPACE (2 * sizeof (int))];
+	int                       fds[2];
+	int                       nfds = 0;
+	size_t                    len;
+	char                     *p;
+	ssize_t                   ret;
+	pid_t                     pid;
+	int                       argc = 0;
+	int                       envc = 0;
+	int                       i;
+
+	nih_assert (data != NULL);
+	nih_assert (job_process_spawner_sock != -1);
+
+	len = sizeof (JobProcessSpawnerRequest) + strlen (data->path) + 1;
+
+	if (data->groups)
+		len += data->ngroups * sizeof (gid_t);
+
+	for (argc = 0; data->argv[argc]; argc++)
+		len += strlen (data->argv[argc]) + 1;
+
+	for (envc = 0; data->env[envc]; envc++)
+		len += strlen (data->env[envc]) + 1;
+
+	if (data->cwd)
+		len += strlen (data->cwd) + 1;
+
+	if (len > JOB_PROCESS_SPAWNER_MAX)
+		return 0;
+
+	buf = nih_alloc (NULL, len);
+	if (! buf)
+		return 0;
+
+	req = (JobProcessSpawnerRequest *)buf;
+	memset (req, '\0', sizeof (JobProcessSpawnerRequest));
+
+	req->umask = data->umask;
+	req->nice = data->nice;
+	req->argc = argc;
+	req->envc = envc;
+	req->ngroups = data->groups ? data->ngroups : -1;
+	req->has_cwd = data->cwd != NULL;
+	req->has_script_fd = data->script_fd != -1;
+
+	for (i = 0; i < RLIMIT_NLIMITS; i++) {
+		if (! data->limits[i])
+			continue;
+
+		req->limit_set[i] = TRUE;
+		req->limits[i] = *data->limits[i];
+	}
+
+	p = buf + sizeof (JobProcessSpawnerRequest);
+
+	if (data->groups) {
+		memcpy (p, data->groups, data->ngroups * sizeof (gid_t));
+		p += data->ngroups * sizeof (gid_t);
+	}
+
+	p = stpcpy (p, data->path) + 1;
+
+	for (i = 0; i < argc; i++)
+		p = stpcpy (p, data->argv[i]) + 1;
+
+	for (i = 0; i < envc; i++)
+		p = stpcpy (p, data->env[i]) + 1;
+
+	if (data->cwd)
+		p = stpcpy (p, data->cwd) + 1;
+
+	nih_assert (p == buf + len);
+
+	fds[nfds++] = data->error_fd;
+	if (data->script_fd != -1)
+		fds[nfds++] = data->script_fd;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+
+	memset (&msg, '\0', sizeof (msg));
+	memset (control, '\0', sizeof (control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE (nfds * sizeof (int));
+
+	cmsg = CMSG_FIRSTHDR (&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (nfds * sizeof (int));
+	memcpy (CMSG_DATA (cmsg), fds, nfds * sizeof (int));
+
+	do {
+		ret = sendmsg (job_process_spawner_sock, &msg, MSG_NOSIGNAL);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0 && errno == EMSGSIZE)
+		return 0;
+
+	if (ret < 0)
+		goto error;
+
+	do {
+		ret = recv (job_process_spawner_sock, &pid, sizeof (pid), 0);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		goto error;
+
+	if (ret != sizeof (pid)) {
+		errno = EPIPE;
+		goto error;
+	}
+
+	if (pid < 0) {
+		nih_debug ("Spawner process failed to spawn %s: %s",
+			   data->path, strerror (-pid));
+		return 0;
+	}
+
+	return pid;
+
+error:
+	nih_warn ("%s: %s", _("Lost connection to spawner process"),
+		  strerror (errno));
+
+	job_process_spawner_stop ();
+
+	return 0;
+}
+
+/**
+ * job_process_spawner_main:
+ * @sock: socket connected to init.
+ *
+ * Main loop of the spawner process: receive each request from init,
+ * spawn the process it describes with job_process_vfork_child() and
+ * reply with its process id.  Exits once init closes its end of
+ * @sock, which includes when it re-executes itself.
+ *
+ * Returns: never.
+ **/
+static void
+job_process_spawner_main (int sock)
+{
+	static union {
+		JobProcessSpawnerRequest req;
+		char                     data[JOB_PROCESS_SPAWNER_MAX];
+	} buf;
+	static char stack[JOB_PROCESS_VFORK_STACK];
+
+	nih_assert (sock >= 0);
+
+	prctl (PR_SET_NAME, "upstart-spawner", 0, 0, 0);
+
+	for (;;) {
+		nih_local char  **strv = NULL;
+		struct rlimit    *limits[RLIMIT_NLIMITS];
+		JobProcessVfork   data;
+		struct msghdr     msg;
+		struct iovec      iov;
+		struct cmsghdr   *cmsg;
+		char              control[CMSG_SPACE (2 * sizeof (int))];
+		int               fds[2] = { -1, -1 };
+		int               nfds = 0;
+		ssize_t           len;
+		pid_t             pid = -EINVAL;
+		int               i;
+
+		iov.iov_base = buf.data;
+		iov.iov_len = sizeof (buf.data);
+
+		memset (&msg, '\0', sizeof (msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+
+		len = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR (&msg); cmsg;
+		     cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET
+			    || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			nfds = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+			if (nfds > 2)
+				nfds = 2;
+
+			memcpy (fds, CMSG_DATA (cmsg), nfds * sizeof (int));
+		}
+
+		memset (&data, '\0', sizeof (data));
+
+		if (nfds >= 1
+		    && ! (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+			strv = job_process_spawner_parse (buf.data, len,
+							  &data, limits);
+
+		if (strv && (buf.req.has_script_fd ? nfds == 2 : nfds == 1)) {
+			data.error_fd = fds[0];
+			data.script_fd = buf.req.has_script_fd ? fds[1] : -1;
+			sigemptyset (&data.orig_set);
+
+			/* The new process is a child of init, not of us */
+			pid = clone ((int (*)(void *))job_process_vfork_child,
+				     stack + JOB_PROCESS_VFORK_STACK,
+				     CLONE_PARENT | SIGCHLD, &data);
+			if (pid < 0)
+				pid = -errno;
+		}
+
+		for (i = 0; i < nfds; i++)
+			close (fds[i]);
+
+		while (send (sock, &pid, sizeof (pid), MSG_NOSIGNAL) < 0) {
+			if (errno != EINTR)
+				_exit (1);
+		}
+	}
+
+	_exit (0);
+}
+
+/**
+ * job_process_spawner_parse:
+ * @buf: request received from init,
+ * @len: length of @buf,
+ * @data: details of process to fill in,
+ * @limits: array of RLIMIT_NLIMITS elements to fill in.
+ *
+ * Decode the request in @buf into @data, which will refer to @buf and
+ * @limits.
+ *
+ * Returns: newly allocated array which the arguments and environment
+ * in @data point into, or NULL if the request is malformed or
+ * insufficient memory.
+ **/
+static char **
+job_process_spawner_parse (char             *buf,
+			   size_t            len,
+			   JobProcessVfork  *data,
+			   struct rlimit   **limits)
+{
+	JobProcessSpawnerRequest  *req;
+	char                     **strv;
+	char                      *p;
+	char                      *end;
+	char                      *nul;
+	int                        count;
+	int                        i;
+
+	nih_assert (buf != NULL);
+	nih_assert (data != NULL);
+	nih_assert (limits != NULL);
+
+	if (len < sizeof (JobProcessSpawnerRequest))
+		return NULL;
+
+	req = (JobProcessSpawnerRequest *)buf;
+	p = buf + sizeof (JobProcessSpawnerRequest);
+	end = buf + len;
+
+	if (req->argc < 1 || req->envc < 0 || req->ngroups < -1
+	    || req->argc > JOB_PROCESS_SPAWNER_MAX
+	    || req->envc > JOB_PROCESS_SPAWNER_MAX
+	    || req->ngroups > JOB_PROCESS_SPAWNER_MAX)
+		return NULL;
 
-	/* Notes:
-	 *
-	 * - we can't use pause() here since there would then be no way to
-	 *   resume the process without killing it.
-	 *
-	 * - we have to close the pipe back to the parent since if we don't,
-	 *   the parent hangs until the STOP is cleared. Although this may be
-	 *   acceptable for normal operation, this causes the test suite to
-	 *   fail. Note that closing the pipe means from this point onwards,
-	 *   the parent cannot know the true outcome of the spawn: that
-	 *   responsibility lies with the debugger.
-	 *
-	 * - note that running with the debug stanza enabled will
-	 *   unavoidably stop stateful re-exec from working correctly
-	 *   since the stopped debug child process will hold copies of
-	 *   the parents file descriptors open until it continues to
-	 *   call exec below.
-	 */
-	if (class->debug) {
-		/* Since we have not exec'd at this point, we will still
-		 * have a copy of the parents fds open. As such, re-exec
-		 * will not work.
-		 */
-		close (fds[1]);
-		raise (SIGSTOP);
+	if (req->ngroups >= 0) {
+		if ((size_t)(end - p) < req->ngroups * sizeof (gid_t))
+			return NULL;
+
+		data->groups = (gid_t *)p;
+		data->ngroups = req->ngroups;
+		p += req->ngroups * sizeof (gid_t);
 	}
 
-#ifdef ENABLE_CGROUPS
-	/* Move the pid into the appropriate cgroups now that 
-	 * the process is running with the correct group and user
-	 * ownership.
-	 */
-	if (cgroups_needed && cgroup_enter_groups (&job->class->cgroups) != TRUE)
-		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_CGROUP_ENTER, 0);
+	/* Path, arguments, environment and working directory */
+	count = 1 + req->argc + req->envc + (req->has_cwd ? 1 : 0);
 
-#endif /* ENABLE_CGROUPS */
+	strv = nih_alloc (NULL, (count + 2) * sizeof (char *));
+	if (! strv)
+		return NULL;
 
-	/* Set up a process trace if we need to trace forks */
-	if (trace) {
-		if (ptrace (PTRACE_TRACEME, 0, NULL, 0) < 0) {
-			nih_error_raise_system();
-			job_process_error_abort (fds[1],
-						 JOB_PROCESS_ERROR_PTRACE, 0);
+	for (i = 0; i < count; i++) {
+		nul = memchr (p, '\0', end - p);
+		if (! nul) {
+			nih_free (strv);
+			return NULL;
 		}
-	}
 
-	/* Execute the process, if we escape from here it failed */
-	if (execvp (argv[0], argv) < 0) {
-		nih_error_raise_system ();
-		job_process_error_abort (fds[1], JOB_PROCESS_ERROR_EXEC, 0);
+		strv[i + (i > req->argc) + (i > req->argc + req->envc)] = p;
+		p = nul + 1;
 	}
 
-	nih_assert_not_reached ();
+	/* Terminate the arguments and environment */
+	strv[req->argc + 1] = NULL;
+	strv[req->argc + req->envc + 2] = NULL;
+
+	data->path = strv[0];
+	data->argv = strv + 1;
+	data->env = strv + req->argc + 2;
+	data->cwd = req->has_cwd ? strv[count + 1] : NULL;
+	data->umask = req->umask;
+	data->nice = req->nice;
+
+	for (i = 0; i < RLIMIT_NLIMITS; i++)
+		limits[i] = req->limit_set[i] ? &req->limits[i] : NULL;
+
+	data->limits = limits;
+
+	return strv;
 }
 
 
@@ -1140,6 +2628,11 @@ job_process_error_handler (const char *buf, size_t len)
 				  err, _("unable to set oom adjustment: %s"),
 				  strerror (err->errnum)));
 		break;
+	case JOB_PROCESS_ERROR_AFFINITY:
+		err->error.message = NIH_MUST (nih_sprintf (
+				  err, _("unable to set CPU affinity: %s"),
+				  strerror (err->errnum)));
+		break;
 	case JOB_PROCESS_ERROR_CHROOT:
 		err->error.message = NIH_MUST (nih_sprintf (
 				  err, _("unable to change root directory: %s"),
@@ -1309,7 +2802,7 @@ job_process_kill (Job         *job,
 		return;
 	}
 
-	job_process_set_kill_timer (job, process, job->class->kill_timeout);
+	job_process_set_kill_timer (job, process, quiesce_kill_timeout (job));
 }
 
 /**
@@ -1385,9 +2878,9 @@ job_process_set_kill_timer (Job          *job,
 	nih_assert (job->kill_timer == NULL);
 
 	job->kill_process = process;
-	job->kill_timer = NIH_MUST (nih_timer_add_timeout (
+	job->kill_timer = NIH_MUST (deadline_add_timeout (
 			  job, timeout,
-			  (NihTimerCb)job_process_kill_timer, job));
+			  (DeadlineCb)job_process_kill_timer, job));
 }
 
 /**
@@ -1405,7 +2898,7 @@ job_process_adj_kill_timer (Job *job, time_t due)
 	nih_assert (job->kill_timer);
 	nih_assert (due);
 
-	job->kill_timer->due = due;
+	deadline_set_due (job->kill_timer, due);
 }
 
 /**
@@ -1419,7 +2912,7 @@ job_process_adj_kill_timer (Job *job, time_t due)
  **/
 static void
 job_process_kill_timer (Job      *job,
-			NihTimer *timer)
+			Deadline *timer)
 {
 	ProcessType process;
 
@@ -1474,8 +2967,6 @@ job_process_handler (void           *data,
 {
 	Job         *job;
 	ProcessType  process;
-	NihLogLevel  priority;
-	const char  *sig;
 
 	nih_assert (pid > 0);
 
@@ -1487,6 +2978,35 @@ job_process_handler (void           *data,
 	if (! job)
 		return;
 
+	job_process_child_event (job, process, pid, event, status);
+}
+
+/**
+ * job_process_child_event:
+ * @job: job that changed,
+ * @process: specific process,
+ * @pid: process that changed,
+ * @event: event that occurred on the child,
+ * @status: exit status, signal raised or ptrace event.
+ *
+ * Take the appropriate action for @event having occurred on @process of
+ * @job, whether this was received through SIGCHLD by
+ * job_process_handler() or through a process file descriptor by
+ * job_process_pidfd_watcher().
+ **/
+static void
+job_process_child_event (Job            *job,
+			 ProcessType     process,
+			 pid_t           pid,
+			 NihChildEvents  event,
+			 int             status)
+{
+	NihLogLevel  priority;
+	const char  *sig;
+
+	nih_assert (job != NULL);
+	nih_assert (pid > 0);
+
 	/* Check the job's normal exit clauses to see whether this is a failure
 	 * worth warning about.
 	 */
@@ -1513,6 +3033,15 @@ job_process_handler (void           *data,
 				  job_name (job), process_name (process), pid);
 		}
 
+		/* Look for the process that it forked */
+		if ((process == PROCESS_MAIN) && (! status)
+		    && (job->trace_state == TRACE_CGROUP)
+		    && job_process_expect_follow (job, process))
+			break;
+
+		if (process == PROCESS_MAIN)
+			job_process_expect_release (job);
+
 		job_process_terminated (job, process, status, FALSE);
 		break;
 	case NIH_CHILD_KILLED:
@@ -1533,6 +3062,9 @@ job_process_handler (void           *data,
 				  pid, status);
 		}
 
+		if (process == PROCESS_MAIN)
+			job_process_expect_release (job);
+
 		status <<= 8;
 		job_process_terminated (job, process, status, FALSE);
 		break;
@@ -1633,6 +3165,9 @@ job_process_terminated (Job         *job,
 
 	nih_assert (job != NULL);
 
+	/* The process will no longer be listed */
+	snapshot_changed ();
+
 	if (job->state == JOB_SECURITY_SPAWNING ||
 			job->state == JOB_PRE_STARTING ||
 			job->state == JOB_SPAWNING ||
@@ -1730,17 +3265,25 @@ job_process_terminated (Job         *job,
 			 * the job isn't running away first though.
 			 */
 			if (failed && job->class->respawn && ! disable_respawn) {
-				if (job_process_catch_runaway (job)) {
+				/* Jobs with a respawn delay are slowed
+				 * down rather than given up on.
+				 */
+				if ((! job->class->respawn_delay)
+				    && job_process_catch_runaway (job)) {
 					nih_warn (_("%s respawning too fast, stopped"),
 						  job_name (job));
 
 					failed = FALSE;
 					job_failed (job, PROCESS_INVALID, 0);
 				} else {
+					if (job->class->respawn_delay)
+						job->respawn_delay = job_process_respawn_delay (job);
+
 					nih_warn (_("%s %s process ended, respawning"),
 						  job_name (job),
 						  process_name (process));
 					failed = FALSE;
+					metrics.respawned++;
 
 					/* If we're not going to change the
 					 * state because there's a post-start
@@ -1770,6 +3313,8 @@ job_process_terminated (Job         *job,
 			failed = TRUE;
 			stop = TRUE;
 		}
+
+		apparmor_load_finished (job->class, ! status);
 		break;
 	case PROCESS_PRE_START:
 		nih_assert (job->state == JOB_PRE_START);
@@ -1886,7 +3431,7 @@ job_process_terminated (Job         *job,
 		endutxent();
 
 		/* Clear the process pid field */
-		job->pid[process] = 0;
+		job_process_set_pid (job, process, 0);
 	}
 
 	/* Mark the job as failed */
@@ -1957,6 +3502,52 @@ job_process_catch_runaway (Job *job)
 	return FALSE;
 }
 
+/**
+ * job_process_respawn_delay:
+ * @job: job being respawned.
+ *
+ * Choose how long @job waits before it is respawned: the delay given in
+ * its class, doubled for each respawn since the job last stayed up for
+ * as long as the maximum delay, up to that maximum.  Up to a quarter
+ * again is added at random, so that jobs failing together don't respawn
+ * together.
+ *
+ * Returns: number of seconds to wait.
+ **/
+static time_t
+job_process_respawn_delay (Job *job)
+{
+	struct timespec now;
+	time_t          delay;
+
+	nih_assert (job != NULL);
+	nih_assert (job->class->respawn_delay > 0);
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	if (job->respawn_time
+	    && (now.tv_sec - job->respawn_time < job->class->respawn_delay_max)) {
+		job->respawn_count++;
+	} else {
+		job->respawn_count = 0;
+	}
+
+	delay = job->class->respawn_delay;
+	for (int i = 0; i < job->respawn_count; i++) {
+		if (delay >= job->class->respawn_delay_max)
+			break;
+
+		delay *= 2;
+	}
+
+	if (delay > job->class->respawn_delay_max)
+		delay = job->class->respawn_delay_max;
+
+	delay += random () % (delay / 4 + 1);
+
+	return delay;
+}
+
 
 /**
  * job_process_stopped:
@@ -2176,7 +3767,7 @@ job_process_trace_fork (Job         *job,
 	/* Update the process we're supervising which is about to get SIGSTOP
 	 * so set the trace options to capture it.
 	 */
-	job->pid[process] = (pid_t)data;
+	job_process_set_pid (job, process, (pid_t)data);
 	job->trace_state = TRACE_NEW_CHILD;
 
 	/* We may have already had the wait notification for the new child
@@ -2239,13 +3830,209 @@ job_process_trace_exec (Job         *job,
 	}
 }
 
+/**
+ * job_process_expect_enter:
+ *
+ * Called in the child process to create a cgroup named after its process
+ * id below expect_cgroup and move itself into it, so that any process it
+ * forks can be found by job_process_expect_follow() once it has exited.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+job_process_expect_enter (void)
+{
+	nih_local char *path = NULL;
+	nih_local char *procs = NULL;
+	int             fd;
+
+	nih_assert (expect_cgroup != NULL);
+
+	path = nih_sprintf (NULL, "%s/%d", expect_cgroup, getpid ());
+	if (! path)
+		nih_return_no_memory_error (-1);
+
+	if ((mkdir (path, 0755) < 0) && (errno != EEXIST))
+		nih_return_system_error (-1);
+
+	procs = nih_sprintf (NULL, "%s/cgroup.procs", path);
+	if (! procs)
+		nih_return_no_memory_error (-1);
+
+	fd = open (procs, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	if (write (fd, "0", 1) < 0) {
+		nih_error_raise_system ();
+		close (fd);
+		return -1;
+	}
+
+	close (fd);
+
+	return 0;
+}
+
+/**
+ * job_process_expect_follow:
+ * @job: job that changed,
+ * @process: specific process.
+ *
+ * This function is called when the main @process of @job, which was placed
+ * in its own cgroup rather than being traced, exits normally while we're
+ * still waiting for it to fork.
+ *
+ * Any child it left behind has been re-parented to us, so we look through
+ * the members of the cgroup for one and update the structure so that we
+ * follow that instead, counting forks in the same way as when tracing.
+ *
+ * Returns: TRUE if a new process is being followed, FALSE if there was
+ * none and the job should be considered terminated.
+ **/
+static int
+job_process_expect_follow (Job         *job,
+			   ProcessType  process)
+{
+	nih_local char *path = NULL;
+	FILE           *procs;
+	pid_t           pid = 0;
+	pid_t           ppid;
+	int             member;
+
+	nih_assert (job != NULL);
+	nih_assert (job->trace_cgroup != NULL);
+
+	if ((process != PROCESS_MAIN) || ((job->state != JOB_SPAWNING) && (job->state != JOB_SPAWNED))
+	    || (job->trace_state != TRACE_CGROUP))
+		return FALSE;
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/cgroup.procs",
+				      job->trace_cgroup));
+
+	procs = fopen (path, "re");
+	if (! procs) {
+		nih_warn (_("Failed to read cgroup of %s %s process (%d): %s"),
+			  job_name (job), process_name (process),
+			  job->pid[process], strerror (errno));
+		return FALSE;
+	}
+
+	/* Only a process we've adopted can be waited for, anything further
+	 * down the tree is somebody else's child.
+	 */
+	while (fscanf (procs, "%d", &member) == 1) {
+		if ((job_process_ppid (member, &ppid) == 0)
+		    && (ppid == getpid ())) {
+			pid = member;
+			break;
+		}
+	}
+
+	fclose (procs);
+
+	if (! pid)
+		return FALSE;
+
+	nih_info (_("%s %s process (%d) became new process (%d)"),
+		  job_name (job), process_name (process),
+		  job->pid[process], pid);
+
+	job_process_set_pid (job, process, pid);
+
+	/* We need to fork at least twice unless we're expecting a
+	 * single fork when we can finish now.
+	 */
+	job->trace_forks++;
+	if ((job->trace_forks > 1) || (job->class->expect == EXPECT_FORK)) {
+		job->trace_state = TRACE_NONE;
+		job_change_state (job, job_next_state (job));
+	}
+
+	return TRUE;
+}
+
+/**
+ * job_process_expect_release:
+ * @job: job to release.
+ *
+ * Removes the cgroup the main process of @job was placed in, if any, once
+ * it is no longer needed.  This only succeeds when the cgroup is empty,
+ * which is not an error worth reporting otherwise.
+ **/
+static void
+job_process_expect_release (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (! job->trace_cgroup)
+		return;
+
+	if ((rmdir (job->trace_cgroup) < 0) && (errno != ENOENT))
+		nih_debug ("Failed to remove cgroup %s: %s",
+			   job->trace_cgroup, strerror (errno));
+
+	nih_free (job->trace_cgroup);
+	job->trace_cgroup = NULL;
+}
+
+/**
+ * job_process_ppid:
+ * @pid: process id to examine,
+ * @ppid: pointer to place parent process id.
+ *
+ * Obtains the parent process id of @pid from its stat file in /proc.
+ *
+ * Returns: zero on success, negative value if the process could not be
+ * examined.
+ **/
+static int
+job_process_ppid (pid_t  pid,
+		  pid_t *ppid)
+{
+	char    path[PATH_MAX];
+	char    buf[1024];
+	char   *ptr;
+	int     fd;
+	ssize_t len;
+
+	nih_assert (ppid != NULL);
+
+	snprintf (path, sizeof (path), "/proc/%d/stat", pid);
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+
+	/* The command name may contain anything, including spaces and
+	 * parentheses, so skip past the last one.
+	 */
+	ptr = strrchr (buf, ')');
+	if (! ptr)
+		return -1;
+
+	if (sscanf (ptr + 1, " %*c %d", ppid) != 1)
+		return -1;
+
+	return 0;
+}
+
 
 /**
  * job_process_find:
  * @pid: process id to find,
  * @process: pointer to place process which is running @pid.
  *
- * Finds the job with a process of the given @pid in the jobs hash table.
+ * Finds the job with a process of the given @pid in the job_processes
+ * hash table.
  * If @process is not NULL, the @process variable is set to point at the
  * process entry in the table which has @pid.
  *
@@ -2255,25 +4042,22 @@ Job *
 job_process_find (pid_t        pid,
 		  ProcessType *process)
 {
+	NihList *iter = NULL;
+
 	nih_assert (pid > 0);
 
-	job_class_init ();
+	job_process_init ();
 
-	NIH_HASH_FOREACH (job_classes, iter) {
-		JobClass *class = (JobClass *)iter;
+	while ((iter = nih_hash_search (job_processes, &pid, iter)) != NULL) {
+		JobProcess *proc = (JobProcess *)iter;
 
-		NIH_HASH_FOREACH (class->instances, job_iter) {
-			Job *job = (Job *)job_iter;
-			int  i;
+		/* Skip entries that no longer describe the process */
+		if (proc->job->pid[proc->process] != pid)
+			continue;
 
-			for (i = 0; i < PROCESS_LAST; i++) {
-				if (job->pid[i] == pid) {
-					if (process)
-						*process = i;
-					return job;
-				}
-			}
-		}
+		if (process)
+			*process = proc->process;
+		return proc->job;
 	}
 
 	return NULL;
@@ -2425,6 +4209,97 @@ job_process_remap_fd (int *fd, int reserved_fd, int error_fd)
 	*fd = new;
 }
 
+/**
+ * job_process_place_fds:
+ * @listen_fds: listening sockets to pass,
+ * @num_listen: number of elements in @listen_fds,
+ * @error_fd: pointer to fd to report errors on,
+ * @pty_slave: pointer to pty slave fd, or to -1.
+ *
+ * Duplicate @listen_fds onto consecutive descriptors from
+ * LISTENER_FD_START, first moving @error_fd and @pty_slave out of the
+ * way should they be there.  The listening sockets themselves are
+ * close-on-exec, so only the copies are inherited.
+ *
+ * Errors are reported via @error_fd and are fatal.
+ **/
+static void
+job_process_place_fds (const int *listen_fds,
+		       int        num_listen,
+		       int       *error_fd,
+		       int       *pty_slave)
+{
+	int tmp[LISTENER_MAX];
+
+	nih_assert (listen_fds != NULL);
+	nih_assert ((num_listen > 0) && (num_listen <= LISTENER_MAX));
+	nih_assert (error_fd != NULL);
+	nih_assert (pty_slave != NULL);
+
+	job_process_move_fd (error_fd, num_listen, *error_fd);
+	nih_io_set_cloexec (*error_fd);
+
+	if (*pty_slave != -1)
+		job_process_move_fd (pty_slave, num_listen, *error_fd);
+
+	/* A socket may already be where another is to go */
+	for (int i = 0; i < num_listen; i++) {
+		tmp[i] = fcntl (listen_fds[i], F_DUPFD,
+				JOB_PROCESS_SCRIPT_FD + 1);
+		if (tmp[i] < 0) {
+			nih_error_raise_system ();
+			job_process_error_abort (*error_fd,
+						 JOB_PROCESS_ERROR_DUP, 0);
+		}
+	}
+
+	for (int i = 0; i < num_listen; i++) {
+		if (dup2 (tmp[i], LISTENER_FD_START + i) < 0) {
+			nih_error_raise_system ();
+			job_process_error_abort (*error_fd,
+						 JOB_PROCESS_ERROR_DUP, 0);
+		}
+
+		close (tmp[i]);
+	}
+}
+
+/**
+ * job_process_move_fd:
+ * @fd: pointer to fd to potentially move,
+ * @num_listen: number of listening sockets to be passed,
+ * @error_fd: fd to report errors on.
+ *
+ * Move @fd above JOB_PROCESS_SCRIPT_FD iff it is one of the descriptors
+ * the listening sockets are to be passed as.
+ *
+ * Errors are reported via @error_fd and are fatal; file descriptor
+ * flags are not retained.
+ **/
+static void
+job_process_move_fd (int *fd,
+		     int  num_listen,
+		     int  error_fd)
+{
+	int new;
+
+	nih_assert (fd != NULL);
+	nih_assert (error_fd >= 0);
+
+	if ((*fd < LISTENER_FD_START)
+	    || (*fd >= LISTENER_FD_START + num_listen))
+		return;
+
+	new = fcntl (*fd, F_DUPFD, JOB_PROCESS_SCRIPT_FD + 1);
+	if (new < 0) {
+		nih_error_raise_system ();
+		job_process_error_abort (error_fd, JOB_PROCESS_ERROR_DUP, 0);
+	}
+
+	close (*fd);
+	*fd = new;
+}
+
 
 /**
  * job_process_child_reader:
@@ -2556,6 +4431,10 @@ job_process_close_handler (JobProcessData  *process_data,
 	process_data->job_process_fd = -1;
 	process_data->valid = FALSE;
 
+	/* Setup is complete and the process has been exec'd */
+	if (job)
+		job_timeline_add (job, JOB_TIMELINE_EXEC, process);
+
 	job_process_run_bottom (process_data);
 
 	if (job && job->state == JOB_SPAWNED) {
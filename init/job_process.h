@@ -23,7 +23,10 @@
 #include <sys/types.h>
 
 #include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/child.h>
+#include <nih/io.h>
 #include <nih/error.h>
 
 #include "process.h"
@@ -40,29 +43,6 @@
  **/
 #define JOB_PROCESS_SCRIPT_FD 9
 
-/**
- * JOB_PROCESS_LOG_REMAP_FROM_CHAR:
- * JOB_PROCESS_LOG_REMAP_TO_CHAR:
- *
- * All logs are written to a single directory so any jobs containing
- * slashes must be remapped.
- **/
-#ifndef JOB_PROCESS_LOG_REMAP_FROM_CHAR
-#define JOB_PROCESS_LOG_REMAP_FROM_CHAR  '/'
-#endif
-#ifndef JOB_PROCESS_LOG_REMAP_TO_CHAR
-#define JOB_PROCESS_LOG_REMAP_TO_CHAR    '_'
-#endif
-
-/**
- * JOB_PROCESS_LOG_FILE_EXT:
- *
- * Extension for log files.
- **/
-#ifndef JOB_PROCESS_LOG_FILE_EXT
-#define JOB_PROCESS_LOG_FILE_EXT ".log"
-#endif
-
 /**
  * JobProcessErrorType:
  *
@@ -75,6 +55,7 @@ typedef enum job_process_error_type {
 	JOB_PROCESS_ERROR_RLIMIT,
 	JOB_PROCESS_ERROR_PRIORITY,
 	JOB_PROCESS_ERROR_OOM_ADJ,
+	JOB_PROCESS_ERROR_AFFINITY,
 	JOB_PROCESS_ERROR_CHROOT,
 	JOB_PROCESS_ERROR_CHDIR,
 	JOB_PROCESS_ERROR_PTRACE,
@@ -129,6 +110,37 @@ typedef struct job_process_error {
 } JobProcessError;
 
 
+/**
+ * JobProcess:
+ * @entry: list header,
+ * @pid: process id being supervised,
+ * @job: job the process belongs to,
+ * @process: which of @job's processes @pid is,
+ * @pidfd: process file descriptor referring to @pid, or -1,
+ * @watch: main loop watch on @pidfd, or NULL.
+ *
+ * This structure ties a running process to the job that owns it and is
+ * stored in the job_processes hash, keyed on @pid, so that we can quickly
+ * find the job responsible for a process when it changes state.
+ *
+ * Where the kernel supports it, @pidfd becomes readable when the process
+ * exits, allowing it to be reaped and dispatched to its job directly
+ * rather than by way of SIGCHLD and a lookup by process id.
+ *
+ * Entries are allocated as children of @job and are maintained by
+ * job_process_set_pid(), which should be used in place of assigning
+ * to the job's pid array directly.
+ **/
+typedef struct job_process {
+	NihList      entry;
+	pid_t        pid;
+	Job         *job;
+	ProcessType  process;
+	int          pidfd;
+	NihIoWatch  *watch;
+} JobProcess;
+
+
 /**
  * JobProcessErrorHandler:
  *
@@ -142,6 +154,11 @@ typedef void (*JobProcessErrorHandler) (Job *job, JobState state, ProcessType pr
 
 NIH_BEGIN_EXTERN
 
+extern NihHash *job_processes;
+
+
+void   job_process_init       (void);
+
 void   job_process_start      (Job *job, ProcessType process);
 void   job_process_run_bottom (JobProcessData *handler_data);
 
@@ -166,6 +183,7 @@ void   job_process_kill    (Job *job, ProcessType process);
 void   job_process_handler (void *ptr, pid_t pid,
 			    NihChildEvents event, int status);
 
+void   job_process_set_pid  (Job *job, ProcessType process, pid_t pid);
 Job   *job_process_find     (pid_t pid, ProcessType *process);
 
 char  *job_process_log_path (Job *job, int user_job)
@@ -181,6 +199,11 @@ int    job_process_jobs_running (void);
 
 void   job_process_stop_all (void);
 
+void   job_process_groups_reload (void);
+
+pid_t  job_process_spawner_start (void);
+void   job_process_spawner_stop  (void);
+
 JobProcessData *
 job_process_data_new (void *parent, Job *job, ProcessType process, int job_process_fd)
 	__attribute__ ((warn_unused_result));
@@ -0,0 +1,773 @@
+/* upstart
+ *
+ * listener.c - listening sockets of socket-activated jobs
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "conf.h"
+#include "state.h"
+#include "listener.h"
+
+
+/* Prototypes for static functions */
+static Listener *listener_new     (const char *spec, int sock);
+static int       listener_destroy (Listener *listener);
+static int       listener_open    (const ListenerAddress *address,
+				   const char *spec)
+	__attribute__ ((warn_unused_result));
+static void      listener_want    (JobClass *class, const char *spec);
+static int       listener_busy    (JobClass *class)
+	__attribute__ ((warn_unused_result));
+static void      listener_pause   (JobClass *class, int paused);
+static int       listener_start   (JobClass *class);
+static void      listener_watcher (Listener *listener, NihIoWatch *watch,
+				   NihIoEvents events);
+
+
+/**
+ * listeners:
+ *
+ * This list holds the listening sockets named by the socket stanzas of
+ * job classes; each item is a Listener structure.
+ **/
+NihList *listeners = NULL;
+
+/**
+ * listener_pending:
+ *
+ * TRUE until listeners are first matched up with job classes, and when
+ * job classes have been added or removed since they last were.
+ **/
+static int listener_pending = TRUE;
+
+
+/**
+ * listener_init:
+ *
+ * Initialise the listeners list.
+ **/
+void
+listener_init (void)
+{
+	if (! listeners)
+		listeners = NIH_MUST (nih_list_new (NULL));
+}
+
+
+/**
+ * listener_parse:
+ * @spec: socket stanza arguments,
+ * @address: address to fill.
+ *
+ * Parse @spec, space-separated KEY=VALUE pairs in the same form as the
+ * socket events of upstart-socket-bridge: PROTO=inet or PROTO=inet6 with
+ * a PORT and optional ADDR, or PROTO=unix with a PATH, which names an
+ * abstract socket when it begins with "@".
+ *
+ * Returns: zero on success, negative value if @spec is not valid.
+ **/
+int
+listener_parse (const char      *spec,
+		ListenerAddress *address)
+{
+	nih_local char  *copy = NULL;
+	const char      *proto = NULL;
+	const char      *port = NULL;
+	const char      *addr = NULL;
+	const char      *path = NULL;
+	char            *saveptr;
+
+	nih_assert (spec != NULL);
+	nih_assert (address != NULL);
+
+	copy = NIH_MUST (nih_strdup (NULL, spec));
+
+	for (char *arg = strtok_r (copy, " \t", &saveptr); arg;
+	     arg = strtok_r (NULL, " \t", &saveptr)) {
+		char *val;
+
+		val = strchr (arg, '=');
+		if (! val)
+			return -1;
+
+		*(val++) = '\0';
+
+		if (! strcmp (arg, "PROTO")) {
+			proto = val;
+		} else if (! strcmp (arg, "PORT")) {
+			port = val;
+		} else if (! strcmp (arg, "ADDR")) {
+			addr = val;
+		} else if (! strcmp (arg, "PATH")) {
+			path = val;
+		} else {
+			return -1;
+		}
+	}
+
+	if (! proto)
+		return -1;
+
+	memset (address, 0, sizeof (ListenerAddress));
+
+	if ((! strcmp (proto, "inet")) || (! strcmp (proto, "inet6"))) {
+		char *endptr;
+		long  num;
+
+		if ((! port) || path)
+			return -1;
+
+		errno = 0;
+		num = strtol (port, &endptr, 10);
+		if (errno || *endptr || (num < 1) || (num > 65535))
+			return -1;
+
+		if (! strcmp (proto, "inet")) {
+			address->len = sizeof (struct sockaddr_in);
+			address->sin.sin_family = AF_INET;
+			address->sin.sin_port = htons (num);
+			address->sin.sin_addr.s_addr = INADDR_ANY;
+
+			if (addr && (inet_pton (AF_INET, addr,
+						&address->sin.sin_addr) != 1))
+				return -1;
+		} else {
+			address->len = sizeof (struct sockaddr_in6);
+			address->sin6.sin6_family = AF_INET6;
+			address->sin6.sin6_port = htons (num);
+			address->sin6.sin6_addr = in6addr_any;
+
+			if (addr && (inet_pton (AF_INET6, addr,
+						&address->sin6.sin6_addr) != 1))
+				return -1;
+		}
+	} else if (! strcmp (proto, "unix")) {
+		size_t len;
+
+		if ((! path) || port || addr)
+			return -1;
+
+		len = strlen (path);
+		if ((len < 2) || (len >= sizeof (address->sun.sun_path)))
+			return -1;
+
+		address->sun.sun_family = AF_UNIX;
+		memcpy (address->sun.sun_path, path, len);
+
+		if (path[0] == '@') {
+			/* Abstract sockets are not terminated */
+			address->sun.sun_path[0] = '\0';
+			address->len = offsetof (struct sockaddr_un, sun_path) + len;
+		} else if (path[0] == '/') {
+			address->len = sizeof (struct sockaddr_un);
+		} else {
+			return -1;
+		}
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * listener_fds:
+ * @class: job class,
+ * @fds: array of at least LISTENER_MAX elements to fill.
+ *
+ * Fill @fds with the listening sockets of @class, in the order of its
+ * socket stanzas, skipping any that could not be created.
+ *
+ * Returns: number of sockets placed in @fds.
+ **/
+int
+listener_fds (JobClass *class,
+	      int      *fds)
+{
+	int num_fds = 0;
+
+	nih_assert (class != NULL);
+	nih_assert (fds != NULL);
+
+	if ((! class->sockets) || (! listeners))
+		return 0;
+
+	for (char **spec = class->sockets; *spec; spec++) {
+		NIH_LIST_FOREACH (listeners, iter) {
+			Listener *listener = (Listener *)iter;
+
+			if (strcmp (listener->spec, *spec))
+				continue;
+
+			nih_assert (num_fds < LISTENER_MAX);
+			fds[num_fds++] = listener->sock;
+			break;
+		}
+	}
+
+	return num_fds;
+}
+
+
+/**
+ * listener_changed:
+ *
+ * Note that job classes have been added or removed, so that listeners
+ * are matched up with them again by the next call to listener_poll();
+ * until then, connections are left waiting.
+ **/
+void
+listener_changed (void)
+{
+	listener_pending = TRUE;
+
+	if (! listeners)
+		return;
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener *listener = (Listener *)iter;
+
+		listener->class = NULL;
+	}
+}
+
+/**
+ * listener_poll:
+ *
+ * Create a listening socket for each socket stanza of the loaded job
+ * classes, and free any that they no longer name, when job classes have
+ * been added or removed since it last ran; then watch again for
+ * connections to the sockets of jobs that are no longer running.  Called
+ * once each time through the main loop.
+ **/
+void
+listener_poll (void)
+{
+	listener_init ();
+
+	if (listener_pending) {
+		job_class_init ();
+
+		/* Job files not yet parsed may have socket stanzas too */
+		if (conf_lazy)
+			conf_lazy_load_event (CONF_LAZY_SOCKET);
+
+		listener_pending = FALSE;
+
+		NIH_LIST_FOREACH (listeners, iter) {
+			Listener *listener = (Listener *)iter;
+
+			listener->seen = FALSE;
+		}
+
+		NIH_HASH_FOREACH (job_classes, iter) {
+			JobClass *class = (JobClass *)iter;
+
+			for (char **spec = class->sockets; spec && *spec; spec++)
+				listener_want (class, *spec);
+		}
+
+		NIH_LIST_FOREACH_SAFE (listeners, iter) {
+			Listener *listener = (Listener *)iter;
+
+			if (! listener->seen)
+				nih_free (listener);
+		}
+	}
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener *listener = (Listener *)iter;
+
+		if (listener->class && (! listener->watch->events)
+		    && (! listener_busy (listener->class)))
+			listener_pause (listener->class, FALSE);
+	}
+}
+
+
+/**
+ * listener_prepare_reexec:
+ *
+ * Clear the close-on-exec flag of every listening socket so that they
+ * are inherited by the new instance of init.
+ **/
+void
+listener_prepare_reexec (void)
+{
+	if (! listeners)
+		return;
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener *listener = (Listener *)iter;
+
+		if (state_modify_cloexec (listener->sock, FALSE) < 0)
+			nih_warn (_("unable to clear CLOEXEC bit on listening socket"));
+	}
+}
+
+/**
+ * listener_serialise_all:
+ *
+ * Convert the listeners list into a JSON representation, so that the
+ * listening sockets are kept across a re-exec.
+ *
+ * Returns: JSON object containing array of listeners, or NULL on error.
+ **/
+json_object *
+listener_serialise_all (void)
+{
+	json_object *json;
+
+	listener_init ();
+
+	json = json_object_new_array ();
+	if (! json)
+		return NULL;
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener    *listener = (Listener *)iter;
+		json_object *json_listener;
+
+		json_listener = json_object_new_object ();
+		if (! json_listener)
+			goto error;
+
+		json_object_array_add (json, json_listener);
+
+		if (! state_set_json_string_var_from_obj (json_listener,
+							  listener, spec))
+			goto error;
+
+		if (! state_set_json_int_var_from_obj (json_listener,
+						       listener, sock))
+			goto error;
+	}
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * listener_deserialise_all:
+ * @json: root of JSON-serialised state.
+ *
+ * Restore the listeners list from @json, taking over the listening
+ * sockets inherited across the re-exec; they are matched up with the
+ * job classes by the next call to listener_poll().  Older state data
+ * holds no listeners, in which case they are created afresh.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+listener_deserialise_all (json_object *json)
+{
+	json_object *json_listeners;
+
+	nih_assert (json != NULL);
+
+	listener_init ();
+
+	if (! json_object_object_get_ex (json, "listeners", &json_listeners))
+		return 0;
+
+	if (! state_check_json_type (json_listeners, array))
+		goto error;
+
+	for (int i = 0; i < json_object_array_length (json_listeners); i++) {
+		json_object     *json_listener;
+		nih_local char  *spec = NULL;
+		int              sock = -1;
+
+		json_listener = json_object_array_get_idx (json_listeners, i);
+		if (! json_listener)
+			goto error;
+
+		if (! state_check_json_type (json_listener, object))
+			goto error;
+
+		if (! state_get_json_string_var_strict (json_listener,
+							"spec", NULL, spec))
+			goto error;
+
+		if (! state_get_json_int_var (json_listener, "sock", sock))
+			goto error;
+
+		if (state_modify_cloexec (sock, TRUE) < 0)
+			goto error;
+
+		if (! listener_new (spec, sock)) {
+			close (sock);
+			goto error;
+		}
+	}
+
+	listener_changed ();
+
+	return 0;
+
+error:
+	return -1;
+}
+
+
+/**
+ * listener_new:
+ * @spec: socket stanza arguments,
+ * @sock: listening socket, or -1 to create one.
+ *
+ * Create a listener for @spec and add it to the listeners list, watching
+ * for connections to @sock or a socket newly created for it.
+ *
+ * Returns: new listener, or NULL if @spec is invalid or the socket could
+ * not be created.
+ **/
+static Listener *
+listener_new (const char *spec,
+	      int         sock)
+{
+	Listener        *listener;
+	ListenerAddress  address;
+
+	nih_assert (spec != NULL);
+
+	listener_init ();
+
+	if (listener_parse (spec, &address) < 0)
+		return NULL;
+
+	if (sock < 0) {
+		sock = listener_open (&address, spec);
+		if (sock < 0)
+			return NULL;
+	}
+
+	listener = NIH_MUST (nih_new (listeners, Listener));
+
+	nih_list_init (&listener->entry);
+	nih_alloc_set_destructor (listener, listener_destroy);
+
+	listener->spec = NIH_MUST (nih_strdup (listener, spec));
+	listener->address = address;
+	listener->sock = sock;
+	listener->class = NULL;
+	listener->seen = TRUE;
+
+	listener->watch = NIH_MUST (nih_io_add_watch (listener, sock,
+						      NIH_IO_READ,
+						      (NihIoWatcher)listener_watcher,
+						      listener));
+
+	nih_list_add (listeners, &listener->entry);
+
+	return listener;
+}
+
+/**
+ * listener_destroy:
+ * @listener: listener being freed.
+ *
+ * Destructor for listeners that removes @listener from the listeners
+ * list and closes its socket; the watch is freed along with it.
+ *
+ * Returns: zero.
+ **/
+static int
+listener_destroy (Listener *listener)
+{
+	nih_assert (listener != NULL);
+
+	nih_list_destroy (&listener->entry);
+
+	close (listener->sock);
+
+	return 0;
+}
+
+/**
+ * listener_open:
+ * @address: address to listen on,
+ * @spec: socket stanza arguments, for messages.
+ *
+ * Create a socket listening on @address.  A stale unix socket left
+ * behind at the path is removed first.
+ *
+ * Returns: new socket, or -1 on failure.
+ **/
+static int
+listener_open (const ListenerAddress *address,
+	       const char            *spec)
+{
+	int sock;
+	int opt = 1;
+
+	nih_assert (address != NULL);
+	nih_assert (spec != NULL);
+
+	sock = socket (address->addr.sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		nih_warn ("%s %s: %s", _("Failed to create socket"),
+			  spec, strerror (errno));
+		return -1;
+	}
+
+	if ((address->addr.sa_family != AF_UNIX)
+	    && (setsockopt (sock, SOL_SOCKET, SO_REUSEADDR,
+			    &opt, sizeof (opt)) < 0))
+		goto error;
+
+	if ((address->addr.sa_family == AF_INET6)
+	    && (setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY,
+			    &opt, sizeof (opt)) < 0))
+		goto error;
+
+	if ((address->addr.sa_family == AF_UNIX)
+	    && address->sun.sun_path[0]) {
+		struct stat statbuf;
+
+		if ((lstat (address->sun.sun_path, &statbuf) == 0)
+		    && S_ISSOCK (statbuf.st_mode))
+			unlink (address->sun.sun_path);
+	}
+
+	if (bind (sock, &address->addr, address->len) < 0)
+		goto error;
+
+	if (listen (sock, SOMAXCONN) < 0)
+		goto error;
+
+	return sock;
+
+error:
+	nih_warn ("%s %s: %s", _("Failed to listen on socket"),
+		  spec, strerror (errno));
+	close (sock);
+	return -1;
+}
+
+/**
+ * listener_want:
+ * @class: job class,
+ * @spec: socket stanza arguments of @class.
+ *
+ * Mark the listener for @spec as wanted by @class, creating it if it
+ * doesn't yet exist.  A socket may only be used by one job.
+ **/
+static void
+listener_want (JobClass   *class,
+	       const char *spec)
+{
+	Listener *listener = NULL;
+
+	nih_assert (class != NULL);
+	nih_assert (spec != NULL);
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener *l = (Listener *)iter;
+
+		if (! strcmp (l->spec, spec)) {
+			listener = l;
+			break;
+		}
+	}
+
+	if (! listener) {
+		listener = listener_new (spec, -1);
+		if (! listener)
+			return;
+	}
+
+	if (listener->class && (listener->class != class)) {
+		nih_warn (_("Socket %s of %s already used by %s"), spec,
+			  class->name, listener->class->name);
+		return;
+	}
+
+	listener->class = class;
+	listener->seen = TRUE;
+}
+
+/**
+ * listener_busy:
+ * @class: job class.
+ *
+ * Returns: TRUE if any instance of @class has a goal of start, so is
+ * serving its sockets, FALSE otherwise.
+ **/
+static int
+listener_busy (JobClass *class)
+{
+	nih_assert (class != NULL);
+
+	NIH_HASH_FOREACH (class->instances, iter) {
+		Job *job = (Job *)iter;
+
+		if (job->goal == JOB_START)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * listener_pause:
+ * @class: job class,
+ * @paused: whether to stop watching.
+ *
+ * Stop watching, or watch again, for connections to the listening
+ * sockets of @class; they're left to the running instance meanwhile.
+ **/
+static void
+listener_pause (JobClass *class,
+		int       paused)
+{
+	nih_assert (class != NULL);
+
+	NIH_LIST_FOREACH (listeners, iter) {
+		Listener *listener = (Listener *)iter;
+
+		if (listener->class == class)
+			listener->watch->events = paused ? 0 : NIH_IO_READ;
+	}
+}
+
+/**
+ * listener_start:
+ * @class: job class.
+ *
+ * Start the instance of @class named by its own environment, as the
+ * start method would without any further variables; the instance's main
+ * process is passed the listening sockets when it is spawned.
+ *
+ * Returns: zero on success, negative value if the instance name could
+ * not be expanded.
+ **/
+static int
+listener_start (JobClass *class)
+{
+	nih_local char **env = NULL;
+	const char      *name;
+	size_t           len;
+	Job             *job;
+
+	nih_assert (class != NULL);
+
+	env = NIH_MUST (job_class_environment (NULL, class, &len));
+
+	name = NIH_SHOULD (job_class_instance_name (class, env));
+	if (! name) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn (_("Failed to obtain %s instance: %s"),
+			  class->name, err->message);
+		nih_free (err);
+		return -1;
+	}
+
+	job = (Job *)nih_hash_lookup (class->instances, name);
+	if (! job)
+		job = NIH_MUST (job_new (class, name));
+
+	nih_info (_("Connection to socket of %s"), job_name (job));
+
+	if (job->start_env)
+		nih_unref (job->start_env, job);
+
+	job->start_env = env;
+	nih_ref (job->start_env, job);
+
+	job_finished (job, FALSE);
+	job_change_goal (job, JOB_START);
+
+	return 0;
+}
+
+/**
+ * listener_watcher:
+ * @listener: listener with a connection waiting,
+ * @watch: watch on listening socket,
+ * @events: events that occurred.
+ *
+ * Called when a connection to the socket of @listener is waiting and its
+ * job isn't running; the job is started and the connection left for it
+ * to accept.  Should the job not be able to start, its sockets are not
+ * watched again until job classes are next added or removed.
+ **/
+static void
+listener_watcher (Listener    *listener,
+		  NihIoWatch  *watch,
+		  NihIoEvents  events)
+{
+	JobClass *class;
+
+	nih_assert (listener != NULL);
+	nih_assert (watch != NULL);
+
+	/* Left until job classes have been scanned again */
+	class = listener->class;
+	if (! class)
+		return;
+
+	if ((! listener_busy (class)) && (listener_start (class) < 0)) {
+		listener_pause (class, TRUE);
+
+		NIH_LIST_FOREACH (listeners, iter) {
+			Listener *l = (Listener *)iter;
+
+			if (l->class == class)
+				l->class = NULL;
+		}
+
+		return;
+	}
+
+	listener_pause (class, TRUE);
+}
@@ -0,0 +1,129 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_LISTENER_H
+#define INIT_LISTENER_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/io.h>
+
+#include <json.h>
+
+#include "job_class.h"
+
+
+/**
+ * LISTENER_FD_START:
+ *
+ * File descriptor the first listening socket of a job is passed to its
+ * main process as, the rest following in order; the same as the
+ * SD_LISTEN_FDS_START of the LISTEN_FDS protocol.
+ **/
+#define LISTENER_FD_START 3
+
+/**
+ * LISTENER_MAX:
+ *
+ * Most socket stanzas a job may have, so that its listening sockets fit
+ * below JOB_PROCESS_SCRIPT_FD.
+ **/
+#define LISTENER_MAX 6
+
+
+/**
+ * ListenerAddress:
+ * @addr: generic socket address,
+ * @sin: IPv4 socket address,
+ * @sin6: IPv6 socket address,
+ * @sun: unix socket address,
+ * @len: length of the address in use.
+ *
+ * Address that a listening socket is bound to.
+ **/
+typedef struct listener_address {
+	union {
+		struct sockaddr     addr;
+		struct sockaddr_in  sin;
+		struct sockaddr_in6 sin6;
+		struct sockaddr_un  sun;
+	};
+	socklen_t len;
+} ListenerAddress;
+
+/**
+ * Listener:
+ * @entry: list header,
+ * @spec: socket stanza arguments the socket was created for,
+ * @address: address @sock is bound to,
+ * @sock: listening socket,
+ * @watch: watch on @sock for connections,
+ * @class: job class the socket is for, or NULL until job classes are
+ *         next scanned,
+ * @seen: set while job classes are being scanned.
+ *
+ * One of these exists for each distinct socket named by the socket
+ * stanzas of loaded jobs; they're held in the listeners list and kept up
+ * to date by listener_poll().  A connection to @sock while @class has no
+ * running instance starts one, which is passed @sock along with the other
+ * listening sockets of @class; @watch is left without events while the
+ * instance is running.
+ **/
+typedef struct listener {
+	NihList          entry;
+	char            *spec;
+	ListenerAddress  address;
+	int              sock;
+	NihIoWatch      *watch;
+	JobClass        *class;
+	int              seen;
+} Listener;
+
+
+NIH_BEGIN_EXTERN
+
+extern NihList *listeners;
+
+void         listener_init            (void);
+
+int          listener_parse           (const char *spec,
+				       ListenerAddress *address)
+	__attribute__ ((warn_unused_result));
+
+int          listener_fds             (JobClass *class, int *fds)
+	__attribute__ ((warn_unused_result));
+
+void         listener_changed         (void);
+void         listener_poll            (void);
+
+void         listener_prepare_reexec  (void);
+
+json_object *listener_serialise_all   (void)
+	__attribute__ ((warn_unused_result));
+int          listener_deserialise_all (json_object *json)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_LISTENER_H */
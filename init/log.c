@@ -20,22 +20,53 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */    
 
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <unistd.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <signal.h>
 #include <poll.h>
 #include <nih/signal.h>
 #include <nih/main.h>
 #include "log.h"
+#include "log_index.h"
 #include "job_process.h"
 #include "session.h"
 #include "conf.h"
 #include "paths.h"
+#include "system.h"
+#include "iowatch.h"
+#include "metrics.h"
 
 static int  log_file_open   (Log *log);
-static int  log_file_write  (Log *log, const char *buf, size_t len);
+static int  log_file_write  (Log *log, NihIoBuffer *buffer);
 static void log_read_watch  (Log *log);
 static void log_flush       (Log *log);
+static int  log_pending_flush (Log *log);
+static void log_flush_timer (Log *log, Deadline *timer);
+static ssize_t log_writev   (Log *log, const struct iovec *iov, int count);
+static int  log_writer_start (void);
+static void log_writer_main (int sock)
+	__attribute__ ((noreturn));
+static void log_writer_wait (void);
+static void log_splice      (Log *log);
+static void log_splice_drain (Log *log, int discard);
+static int  log_unflushed_push (Log *log, const char *buf, size_t len);
+static void log_unflushed_shrink (Log *log, size_t len);
+static void log_rotate_check (Log *log);
+static void log_rotate      (Log *log);
+static void log_rotate_compress (const char *src, const char *dest);
+static int  log_index_open  (Log *log);
+static void log_index_check (Log *log);
 
 /**
  * log_flushed:
@@ -57,6 +88,113 @@ int log_flushed = 0;
  **/
 NihList *log_unflushed_files = NULL;
 
+/**
+ * log_buffer_size:
+ *
+ * Number of bytes of job output to gather in the write-behind buffer
+ * of a Log before writing it to the log file. If 0, output is written
+ * as soon as it is read from the job.
+ **/
+int log_buffer_size = 0;
+
+/**
+ * log_flush_interval:
+ *
+ * Maximum number of seconds job output may remain in the write-behind
+ * buffer of a Log before it is written to the log file. If 0, the
+ * buffer is only written when it reaches log_buffer_size bytes or the
+ * log is flushed.
+ **/
+int log_flush_interval = LOG_FLUSH_INTERVAL;
+
+/**
+ * log_writer:
+ *
+ * If TRUE, job output is passed to a separate logger process which
+ * performs the writes to the log files, such that slow storage cannot
+ * stall init itself.
+ **/
+int log_writer = FALSE;
+
+/**
+ * log_unflushed_limit:
+ *
+ * Maximum number of bytes of unflushed data retained for each Log;
+ * once reached, the oldest data is discarded in favour of the newest.
+ * If 0, there is no limit.
+ **/
+int log_unflushed_limit = LOG_UNFLUSHED_LIMIT;
+
+/**
+ * log_unflushed_total_limit:
+ *
+ * Maximum number of bytes of unflushed data retained across all Log
+ * objects, enforced in the same way as log_unflushed_limit.
+ * If 0, there is no limit.
+ **/
+int log_unflushed_total_limit = LOG_UNFLUSHED_TOTAL_LIMIT;
+
+/**
+ * log_unflushed_dropped:
+ *
+ * Total number of bytes of unflushed data discarded as a result of
+ * log_unflushed_limit or log_unflushed_total_limit.
+ **/
+uint64_t log_unflushed_dropped = 0;
+
+/**
+ * log_unflushed_total:
+ *
+ * Number of bytes of unflushed data currently held by all Log objects.
+ **/
+static size_t log_unflushed_total = 0;
+
+/**
+ * log_rotate_size:
+ *
+ * Size in bytes a log file may reach before it is rotated.
+ * If 0, log files are not rotated by size.
+ **/
+int log_rotate_size = 0;
+
+/**
+ * log_rotate_age:
+ *
+ * Number of seconds a Log may write to the same log file before it is
+ * rotated. If 0, log files are not rotated by age.
+ **/
+int log_rotate_age = 0;
+
+/**
+ * log_rotate_count:
+ *
+ * Number of rotated log files retained for each job.
+ **/
+int log_rotate_count = LOG_ROTATE_COUNT;
+
+/**
+ * log_rotate_compress_files:
+ *
+ * If TRUE, rotated log files are compressed in the background.
+ **/
+int log_rotate_compress_files = FALSE;
+
+/**
+ * log_index_size:
+ *
+ * Kilobytes of output written to a log file between the checkpoints
+ * recorded in its index. If 0, no index is kept.
+ **/
+int log_index_size = 0;
+
+/**
+ * log_writer_sock:
+ *
+ * Socket connected to the logger process, or -1 if the logger process
+ * has not been started.
+ **/
+static int log_writer_sock = -1;
+
 /**
  * log_new:
  *
@@ -125,10 +263,21 @@ log_new (const void *parent,
 	log->fd            = -1;
 	log->uid           = uid;
 	log->unflushed     = NULL;
+	log->pending       = NULL;
+	log->flush_timer   = NULL;
+	log->splice_pipe[0] = -1;
+	log->splice_pipe[1] = -1;
+	log->splice_failed = 0;
+	log->unflushed_dropped = 0;
+	log->size          = 0;
+	log->created       = 0;
 	log->io            = NULL;
 	log->detached      = 0;
 	log->remote_closed = 0;
 	log->open_errno    = 0;
+	log->index_fd      = -1;
+	log->index_offset  = 0;
+	log->index_time    = 0;
 
 	log->path = nih_strndup (log, path, len);
 	if (! log->path)
@@ -138,6 +287,10 @@ log_new (const void *parent,
 	if (! log->unflushed)
 		goto error;
 
+	log->pending = nih_io_buffer_new (log);
+	if (! log->pending)
+		goto error;
+
 	log->io = nih_io_reopen (log, fd, NIH_IO_STREAM,
 			(NihIoReader)log_io_reader,
 			NULL,
@@ -151,6 +304,9 @@ log_new (const void *parent,
 		goto error;
 	}
 
+	/* Thousands of these may be open, so keep them out of select() */
+	(void)iowatch_adopt (log->io->watch);
+
 	nih_alloc_set_destructor (log, log_destroy);
 
 	return log;
@@ -191,6 +347,19 @@ log_destroy (Log *log)
 
 	log->fd = -1;
 
+	if (log->index_fd != -1)
+		close (log->index_fd);
+
+	log->index_fd = -1;
+
+	/* Any data still unflushed is now lost */
+	log_unflushed_shrink (log, log->unflushed->len);
+
+	if (log->splice_pipe[0] != -1) {
+		close (log->splice_pipe[0]);
+		close (log->splice_pipe[1]);
+	}
+
 	return 0;
 }
 
@@ -226,11 +395,13 @@ log_flush (Log *log)
 	 *
 	 * If any failures occur at this stage, we are powerless.
 	 */
-	if (log->unflushed->len) {
+	if (log->unflushed->len || log->pending->len) {
 		if (log_file_open (log) < 0)
 			goto out;
 
-		ret = log_file_write (log, NULL, 0);
+		log_writer_wait ();
+
+		ret = log_file_write (log, log->pending);
 		if (ret < 0) {
 			close (log->fd);
 			log->fd = -1;
@@ -247,9 +418,14 @@ log_flush (Log *log)
 		 * 
 		 * Therefore, attempt to read from the watch fd until we get an error.
 		 */
-		if (! log->remote_closed)
+		if (! log->remote_closed) {
 			log_read_watch (log);
 
+			/* Write out anything the final read gathered */
+			if (log->pending->len && log_file_open (log) == 0)
+				(void)log_file_write (log, log->pending);
+		}
+
 		flags = fcntl (log->io->watch->fd, F_GETFL);
 
 		if (flags < 0 && errno == EBADF) {
@@ -310,6 +486,11 @@ out:
  * necessarily buffered within init itself. This initial amount is very
  * small due to the default applied by nih_io_watcher_read().
  * All subsequent job output is buffered within USER_LOGGER.
+ *
+ * If log_buffer_size is non-zero, data is gathered in the write-behind
+ * buffer of @log and only written once log_buffer_size bytes have
+ * accumulated, log_flush_interval seconds have elapsed or @log is
+ * flushed, such that chatty jobs do not cost a write per read.
  **/
 void
 log_io_reader (Log *log, NihIo *io, const char *buf, size_t len)
@@ -331,13 +512,45 @@ log_io_reader (Log *log, NihIo *io, const char *buf, size_t len)
 	 */
 	nih_assert (sizeof (size_t) == sizeof (ssize_t));
 
+	if (log_buffer_size > 0) {
+		/* On failure, the data remains in the NihIo buffer and
+		 * will be presented to us again.
+		 */
+		if (nih_io_buffer_push (log->pending, buf, len) < 0)
+			return;
+
+		nih_io_buffer_shrink (io->recv_buf, len);
+
+		if (log->pending->len < (size_t)log_buffer_size) {
+			if (! log_flush_interval || log->flush_timer)
+				return;
+
+			log->flush_timer = deadline_add_timeout (log,
+					log_flush_interval,
+					(DeadlineCb)log_flush_timer, log);
+
+			/* If no timer could be created, write now
+			 * rather than hold the data indefinitely.
+			 */
+			if (log->flush_timer)
+				return;
+		}
+
+		ret = log_pending_flush (log);
+		if (ret < 0)
+			nih_warn ("%s %s", _("Failed to write to log file"), log->path);
+		return;
+	}
+
 	ret = log_file_open (log);
 
 	if (ret < 0) {
 		if (log->open_errno != ENOSPC) {
 			/* Add new data to unflushed buffer */
-			if (nih_io_buffer_push (log->unflushed, buf, len) < 0)
+			if (log_unflushed_push (log, buf, len) < 0)
 				return;
+		} else {
+			metrics.log_discarded += len;
 		}
 
 		/* Note that we always discard when out of space */
@@ -349,264 +562,1147 @@ log_io_reader (Log *log, NihIo *io, const char *buf, size_t len)
 		return;
 	}
 
-	ret = log_file_write (log, buf, len);
-	if (ret < 0)
-		nih_warn ("%s %s", _("Failed to write to log file"), log->path);
+	ret = log_file_write (log, io->recv_buf);
+	if (ret < 0) {
+		nih_warn ("%s %s", _("Failed to write to log file"), log->path);
+		return;
+	}
+
+	/* Move any further output straight to the log file */
+	if (! io->recv_buf->len)
+		log_splice (log);
+}
+
+/**
+ * log_splice:
+ *
+ * @log: Log.
+ *
+ * Move all output currently available from the job associated with
+ * @log to the log file using splice(2) through a pipe, such that the
+ * data never needs to be copied through init.
+ *
+ * This is only attempted when there is no unflushed or pending data,
+ * the log file is open, and output is neither being buffered nor
+ * handed to the logger process; otherwise, and on kernels which
+ * cannot splice from a pty, the buffered path in log_io_reader() is
+ * used.
+ **/
+static void
+log_splice (Log *log)
+{
+	ssize_t  in;
+	ssize_t  out;
+	int      flags;
+
+	nih_assert (log);
+
+	if (log->splice_failed || ! log->io || log->fd < 0
+			|| log_buffer_size > 0 || log_writer
+			|| log->unflushed->len || log->pending->len)
+		return;
+
+	if (log->splice_pipe[0] == -1
+			&& pipe2 (log->splice_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+		log->splice_failed = 1;
+		return;
+	}
+
+	/* splice(2) refuses to write to a file opened for appending,
+	 * so position the file at its end ourselves; since we are the
+	 * only writer, this is equivalent.
+	 */
+	flags = fcntl (log->fd, F_GETFL);
+	if (flags < 0
+			|| fcntl (log->fd, F_SETFL, flags & ~O_APPEND) < 0) {
+		log->splice_failed = 1;
+		return;
+	}
+
+	if (lseek (log->fd, 0, SEEK_END) < 0)
+		goto out;
+
+	while (TRUE) {
+		in = splice (log->io->watch->fd, NULL, log->splice_pipe[1], NULL,
+				LOG_SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (in < 0 && errno == EINTR)
+			continue;
+
+		if (in < 0) {
+			/* No (more) data, or the remote end has closed
+			 * which the NihIo will notice for itself.
+			 */
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EIO)
+				log->splice_failed = 1;
+			break;
+		}
+
+		if (! in)
+			break;
+
+		while (in > 0) {
+			out = splice (log->splice_pipe[0], NULL, log->fd, NULL,
+					in, SPLICE_F_MOVE);
+			if (out < 0 && errno == EINTR)
+				continue;
+
+			if (out < 0 && errno == EINVAL) {
+				/* Filesystem cannot be spliced to, so
+				 * retain the data and stop trying.
+				 */
+				log->splice_failed = 1;
+				log_splice_drain (log, FALSE);
+				goto out;
+			}
+
+			if (out <= 0) {
+				log_splice_drain (log, out < 0 && errno == ENOSPC);
+
+				close (log->fd);
+				log->fd = -1;
+				return;
+			}
+
+			in -= out;
+			log_index_check (log);
+			log->size += out;
+			metrics.log_written += out;
+		}
+	}
+
+out:
+	(void)fcntl (log->fd, F_SETFL, flags);
+
+	log_rotate_check (log);
+}
+
+/**
+ * log_splice_drain:
+ *
+ * @log: Log,
+ * @discard: TRUE if the data should be discarded.
+ *
+ * Called when data spliced from the job could not be written to the
+ * log file to move it from the pipe to the unflushed buffer, as would
+ * have happened had it been read normally. As elsewhere, data is
+ * discarded rather than retained if the filesystem is full.
+ **/
+static void
+log_splice_drain (Log *log,
+		  int  discard)
+{
+	char     buf[LOG_READ_SIZE];
+	ssize_t  len;
+
+	nih_assert (log);
+
+	while ((len = read (log->splice_pipe[0], buf, sizeof (buf))) > 0) {
+		if (! discard && log_unflushed_push (log, buf, len) < 0)
+			discard = TRUE;
+
+		if (discard)
+			metrics.log_discarded += len;
+	}
+}
+
+/**
+ * log_unflushed_push:
+ *
+ * @log: Log,
+ * @buf: data to add,
+ * @len: length of @buf.
+ *
+ * Add @len bytes from @buf to the unflushed data of @log. If doing so
+ * would exceed log_unflushed_limit, or log_unflushed_total_limit
+ * across all logs, the oldest data is discarded such that the newest
+ * is retained; the number of bytes discarded is recorded in both
+ * @log and log_unflushed_dropped.
+ *
+ * Returns: 0 on success, -1 on insufficient memory.
+ **/
+static int
+log_unflushed_push (Log        *log,
+		    const char *buf,
+		    size_t      len)
+{
+	size_t limit = SIZE_MAX;
+	size_t others;
+	size_t drop = 0;
+
+	nih_assert (log);
+	nih_assert (log->unflushed);
+	nih_assert (buf);
+
+	if (log_unflushed_limit > 0)
+		limit = (size_t)log_unflushed_limit;
+
+	if (log_unflushed_total_limit > 0) {
+		others = log_unflushed_total - log->unflushed->len;
+
+		if (others >= (size_t)log_unflushed_total_limit)
+			limit = 0;
+		else if ((size_t)log_unflushed_total_limit - others < limit)
+			limit = (size_t)log_unflushed_total_limit - others;
+	}
+
+	if (len > limit) {
+		drop += len - limit;
+		buf += len - limit;
+		len = limit;
+	}
+
+	if (log->unflushed->len + len > limit) {
+		size_t excess = log->unflushed->len + len - limit;
+
+		drop += excess;
+		log_unflushed_shrink (log, excess);
+	}
+
+	if (drop) {
+		if (! log->unflushed_dropped)
+			nih_warn ("%s %s", _("Discarding unflushed output for"),
+					log->path);
+
+		log->unflushed_dropped += drop;
+		log_unflushed_dropped += drop;
+	}
+
+	if (! len)
+		return 0;
+
+	if (nih_io_buffer_push (log->unflushed, buf, len) < 0)
+		return -1;
+
+	log_unflushed_total += len;
+
+	return 0;
+}
+
+/**
+ * log_unflushed_shrink:
+ *
+ * @log: Log,
+ * @len: number of bytes to remove.
+ *
+ * Remove @len bytes from the start of the unflushed data of @log.
+ **/
+static void
+log_unflushed_shrink (Log    *log,
+		      size_t  len)
+{
+	nih_assert (log);
+	nih_assert (log->unflushed);
+	nih_assert (len <= log->unflushed->len);
+	nih_assert (len <= log_unflushed_total);
+
+	nih_io_buffer_shrink (log->unflushed, len);
+
+	log_unflushed_total -= len;
+}
+
+/**
+ * log_pending_flush:
+ *
+ * @log: Log.
+ *
+ * Write all data held in the write-behind buffer of @log to the log
+ * file, along with any data we previously failed to write. If the log
+ * file cannot be opened, the data is moved to the unflushed buffer
+ * (or discarded if the filesystem is full).
+ *
+ * Returns: 0 on success, -1 on failure.
+ **/
+static int
+log_pending_flush (Log *log)
+{
+	nih_assert (log);
+	nih_assert (log->pending);
+
+	if (log->flush_timer) {
+		nih_free (log->flush_timer);
+		log->flush_timer = NULL;
+	}
+
+	if (! log->pending->len)
+		return 0;
+
+	if (log_file_open (log) < 0) {
+		if (log->open_errno != ENOSPC
+				&& log_unflushed_push (log,
+					log->pending->buf,
+					log->pending->len) < 0)
+			return -1;
+
+		/* Note that we always discard when out of space */
+		nih_io_buffer_shrink (log->pending, log->pending->len);
+
+		return -1;
+	}
+
+	return log_file_write (log, log->pending);
+}
+
+/**
+ * log_flush_timer:
+ *
+ * @log: Log associated with @timer,
+ * @timer: timer that fired.
+ *
+ * Called once job output has been held in the write-behind buffer of
+ * @log for log_flush_interval seconds to write it to the log file.
+ **/
+static void
+log_flush_timer (Log      *log,
+		 Deadline *timer)
+{
+	nih_assert (log);
+	nih_assert (timer);
+	nih_assert (log->flush_timer == timer);
+
+	/* Timer is freed on return */
+	log->flush_timer = NULL;
+
+	if (log_pending_flush (log) < 0)
+		nih_warn ("%s %s", _("Failed to write to log file"), log->path);
+}
+
+/**
+ * log_io_error_handler:
+ *
+ * @log: Log associated with this @io,
+ * @io: NihIo.
+ *
+ * Called automatically when reading the jobs stdout/stderr causes
+ * an error. This will occur when the parent attempts a read after
+ * the child has exited abnormally. Note that this error is expected,
+ * but we must provide this handler to nih_io_reopen() since we need
+ * to consume the error to ensure NIH ignores it.
+ */
+void
+log_io_error_handler (Log *log, NihIo *io)
+{
+	NihError *err;
+
+	nih_assert (log);
+	nih_assert (io);
+
+	/* User job logging not currently available */
+	nih_assert (log->uid == 0);
+
+	/* Consume */
+	err = nih_error_get ();
+
+	nih_assert (err->number == EIO);
+
+	nih_free (err);
+
+	/* Ensure the NihIo is closed */
+	nih_free (log->io);
+	log->io = NULL;
+
+	log->remote_closed = 1;
+}
+
+/**
+ * log_file_open:
+ * @log: Log.
+ *
+ * Opens log file associated with @log if not already open.
+ *
+ * Returns: 0 on success, -1 on failure.
+ **/
+static int
+log_file_open (Log *log)
+{
+	struct stat  statbuf;
+	int          ret = -1;
+	int          mode = LOG_DEFAULT_MODE;
+	mode_t       old;
+	int          flags = (O_CREAT | O_APPEND | O_WRONLY |
+			      O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+
+	nih_assert (log);
+	nih_assert (log->path);
+
+	/* User job logging not currently available */
+	nih_assert (log->uid == 0);
+
+	memset (&statbuf, '\0', sizeof (struct stat));
+
+	ret = fstat (log->fd, &statbuf);
+
+	/* Already open */
+	if (log->fd > -1 && (! ret && statbuf.st_nlink))
+		return 0;
+
+	/* File was deleted. This isn't a problem for
+	 * the logger as it is happy to keep writing the
+	 * unlinked file, but it *is* a problem for
+	 * users who expect to see some data. Therefore,
+	 * close the file and attempt to rewrite it.
+	 *
+	 * This behaviour also allows tools such as logrotate(8)
+	 * to operate without disrupting the logger.
+	 */
+	if (log->fd > -1 && ! statbuf.st_nlink) {
+		close (log->fd);
+		log->fd = -1;
+	}
+
+	nih_assert (log->fd == -1);
+
+	/* Impose some sane defaults. */
+	old = umask (LOG_DEFAULT_UMASK);
+
+	/* Non-blocking to avoid holding up the main loop. Without
+	 * this, we'd probably need to spawn a thread to handle
+	 * job logging.
+	 */
+	log->fd = open (log->path, flags, mode);
+
+	/* Restore */
+	umask (old);
+
+	log->open_errno = errno;
+
+	/* Open may have failed due to path being unaccessible
+	 * (disk might not be mounted yet).
+	 */
+	if (log->fd < 0)
+		return -1;
+
+	/* Start of a new period for rotation purposes */
+	log->size = fstat (log->fd, &statbuf) ? 0 : statbuf.st_size;
+	log->created = time (NULL);
+
+	/* The file may not be the one the index was describing, so
+	 * reopen that as well.
+	 */
+	if (log->index_fd != -1) {
+		close (log->index_fd);
+		log->index_fd = -1;
+	}
+
+	log->index_offset = 0;
+	log->index_time = 0;
+
+	return 0;
+}
+
+
+/**
+ * log_file_write:
+ *
+ * @log: Log,
+ * @buffer: buffer holding new data to write.
+ *
+ * Performs actual write to log file associated with @log. Any
+ * unflushed data is written ahead of the contents of @buffer using a
+ * single writev(2) call, with data written being removed from the
+ * respective buffer. Note that @buffer can be NULL. If so, only
+ * unflushed data will be written.
+ *
+ * Special case: the filesystem is full. We have a few options,
+ * none of them ideal. Part of the problem is that we cannot know
+ * whether the problem *will be* transitory or not.
+ *
+ * Options:
+ *
+ * (a) Ignore the problem by simply continuing
+ *     to buffer unflushed data (unsafe:
+ *     eventually we'll run out of core and crash).
+ * (b) Retain existing unflushed buffer, but
+ *     disable further appends (not reasonable
+ *     since if space does become available, the
+ *     most recent data will have been
+ *     discarded).
+ * (c) Discard all unflushed data and store *all*
+ *     new data as unflushed (potentially unsafe
+ *     - in low disk space situations, programs may
+ *     produce *more* log messages to
+ *     stdout/stderr).
+ * (d) Retain the last 'n' bytes of
+ *     data (unflushed + new), where 'n' is some
+ *     fixed value (ring buffer) What heuristic can
+ *     we use to decide upon 'n'? Since this is
+ *     output, 1024 bytes at 80 bytes per line
+ *     gives a reasonable amount of context. However,
+ *     if space later becomes available, there will
+ *     be mysterious gaps in the log files.
+ * (e) Discard all new data (not ideal, but safe)
+ *
+ * In the interests of self-preservation, we have to assume the
+ * problem is *not* transitory and as such we opt for the safest
+ * option, namely option 'e' since:
+ *
+ * - We cannot cache all data (option 'a') as it could
+ *   result in a crash.
+ * - Any other option which caches data will result in
+ *   a corrupted log file should space later become
+ *   available.
+ *
+ * Returns: 0 on success, -1 on failure.
+ **/
+static int
+log_file_write (Log *log, NihIoBuffer *buffer)
+{
+	struct iovec  iov[2];
+	int           count = 0;
+	size_t        len;
+	ssize_t       wlen;
+	int           saved;
+
+	nih_assert (log);
+	nih_assert (log->path);
+	nih_assert (log->unflushed);
+	nih_assert (log->fd != -1);
+
+	/* User job logging not currently available */
+	nih_assert (log->uid == 0);
+
+	len = buffer ? buffer->len : 0;
+
+	/* Any data we previously failed to write must precede the
+	 * new data in the log.
+	 */
+	if (log->unflushed->len) {
+		iov[count].iov_base = log->unflushed->buf;
+		iov[count].iov_len  = log->unflushed->len;
+		count++;
+	}
+
+	if (len) {
+		iov[count].iov_base = buffer->buf;
+		iov[count].iov_len  = len;
+		count++;
+	}
+
+	if (! count)
+		return 0;
+
+	wlen = log_writev (log, iov, count);
+	saved = errno;
+
+	if (wlen < 0) {
+		/* Failed to write, so add the new data to the
+		 * unflushed buffer.
+		 *
+		 * If this fails, we still want to indicate an error
+		 * condition, so no explicit return check.
+		 *
+		 * Note that data is always discarded when out of
+		 * space.
+		 */
+		if (len) {
+			if (saved == ENOSPC)
+				metrics.log_discarded += len;
+
+			if (saved != ENOSPC
+					&& log_unflushed_push (log, buffer->buf, len) < 0)
+				goto error;
+
+			nih_io_buffer_shrink (buffer, len);
+		}
+
+		/* Still need to indicate that the write failed */
+		goto error;
+	}
+
+	log_index_check (log);
+
+	log->size += wlen;
+	metrics.log_written += wlen;
+
+	/* Only managed a partial write for the unflushed data,
+	 * so don't leave the new data in place as that would
+	 * leave a gap in the log. Just store the new data for
+	 * next time.
+	 */
+	if ((size_t)wlen < log->unflushed->len) {
+		log_unflushed_shrink (log, (size_t)wlen);
+
+		if (! len)
+			goto error;
+
+		/* Save new data */
+		if (log_unflushed_push (log, buffer->buf, len) < 0)
+			goto error;
+
+		nih_io_buffer_shrink (buffer, len);
+
+		goto error;
+	}
+
+	wlen -= log->unflushed->len;
+	log_unflushed_shrink (log, log->unflushed->len);
+
+	/* Shrink buffer by amount of new data written (which handles
+	 * partial writes)
+	 */
+	if (len)
+		nih_io_buffer_shrink (buffer, (size_t)wlen);
+
+	log_rotate_check (log);
+
+	return 0;
+
+error:
+	close (log->fd);
+	log->fd = -1;
+	return -1;
+}
+
+/**
+ * log_writev:
+ *
+ * @log: Log,
+ * @iov: data to write,
+ * @count: number of elements in @iov.
+ *
+ * Write the data described by @iov to the log file associated with
+ * @log, either directly or by way of the logger process if log_writer
+ * is set.
+ *
+ * The logger process is handed at most LOG_WRITER_MAX bytes at a time
+ * and never causes us to block, so fewer bytes than requested may be
+ * accepted and the call fails with EAGAIN while the logger process is
+ * busy; both cases are handled in the same way as for a write to a
+ * slow file.
+ *
+ * Returns: number of bytes written, or -1 on failure with errno set.
+ **/
+static ssize_t
+log_writev (Log                *log,
+	    const struct iovec *iov,
+	    int                 count)
+{
+	struct iovec    vec[count];
+	struct msghdr   msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE (sizeof (int))];
+	} control;
+	size_t          len = 0;
+	ssize_t         wlen;
+	int             i;
+
+	nih_assert (log);
+	nih_assert (log->fd != -1);
+	nih_assert (iov);
+	nih_assert (count > 0);
+
+	if (! log_writer
+			|| (log_writer_sock < 0 && log_writer_start () < 0))
+		return writev (log->fd, iov, count);
+
+	for (i = 0; i < count && len < LOG_WRITER_MAX; i++) {
+		vec[i] = iov[i];
+
+		if (vec[i].iov_len > LOG_WRITER_MAX - len)
+			vec[i].iov_len = LOG_WRITER_MAX - len;
+
+		len += vec[i].iov_len;
+	}
+
+	memset (&msg, '\0', sizeof (msg));
+	memset (&control, '\0', sizeof (control));
+
+	msg.msg_iov = vec;
+	msg.msg_iovlen = i;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof (control.buf);
+
+	/* The log file fd accompanies the data so that the logger
+	 * process never needs to open files itself.
+	 */
+	cmsg = CMSG_FIRSTHDR (&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+	memcpy (CMSG_DATA (cmsg), &log->fd, sizeof (int));
+
+	do {
+		wlen = sendmsg (log_writer_sock, &msg,
+				MSG_DONTWAIT | MSG_NOSIGNAL);
+	} while (wlen < 0 && errno == EINTR);
+
+	if (wlen < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+		/* The logger process has gone away; write the data
+		 * ourselves and start a new one next time.
+		 */
+		nih_warn ("%s", _("Lost connection to logger process"));
+
+		close (log_writer_sock);
+		log_writer_sock = -1;
+
+		return writev (log->fd, iov, count);
+	}
+
+	return wlen;
+}
+
+/**
+ * log_writer_start:
+ *
+ * Start the logger process used to write job output when log_writer
+ * is set, and connect log_writer_sock to it.
+ *
+ * The logger process exits once log_writer_sock is closed, which
+ * includes when we re-exec, having first written all data it has
+ * been handed.
+ *
+ * Returns: 0 on success, -1 on failure.
+ **/
+static int
+log_writer_start (void)
+{
+	int       socks[2];
+	pid_t     pid;
+	sigset_t  child_set;
+	sigset_t  orig_set;
+
+	nih_assert (log_writer_sock == -1);
+
+	if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) < 0) {
+		nih_warn ("%s: %s", _("Failed to create logger socket"),
+				strerror (errno));
+		return -1;
+	}
+
+	/* Block all signals while we fork to avoid the child process
+	 * running our own signal handlers before we've reset them.
+	 */
+	sigfillset (&child_set);
+	sigprocmask (SIG_BLOCK, &child_set, &orig_set);
+
+	fflush (NULL);
+
+	pid = fork ();
+	if (pid < 0) {
+		nih_warn ("%s: %s", _("Failed to start logger process"),
+				strerror (errno));
+
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+		close (socks[0]);
+		close (socks[1]);
+		return -1;
+	} else if (! pid) {
+		nih_signal_reset ();
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+
+		system_close_fds (socks[1]);
+		log_writer_main (socks[1]);
+	}
+
+	sigprocmask (SIG_SETMASK, &orig_set, NULL);
+	close (socks[1]);
+
+	log_writer_sock = socks[0];
+
+	nih_debug ("Started logger process (%d)", pid);
+
+	return 0;
+}
+
+/**
+ * log_writer_main:
+ *
+ * @sock: socket connected to init.
+ *
+ * Main loop of the logger process: receive each message of job output
+ * from init along with the log file fd it must be written to, and
+ * write it. Never returns.
+ **/
+static void
+log_writer_main (int sock)
+{
+	static char     buf[LOG_WRITER_MAX];
+	struct iovec    iov;
+	struct msghdr   msg;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE (sizeof (int))];
+	} control;
+	ssize_t         len;
+	ssize_t         wlen;
+	size_t          done;
+	int             fd;
+
+	prctl (PR_SET_NAME, "upstart-logger", 0, 0, 0);
+
+	while (TRUE) {
+		memset (&msg, '\0', sizeof (msg));
+
+		iov.iov_base = buf;
+		iov.iov_len = sizeof (buf);
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof (control.buf);
+
+		len = recvmsg (sock, &msg, MSG_CMSG_CLOEXEC);
+		if (len < 0 && errno == EINTR)
+			continue;
+
+		/* init has closed its end */
+		if (len <= 0)
+			break;
+
+		cmsg = CMSG_FIRSTHDR (&msg);
+		if (! cmsg || cmsg->cmsg_level != SOL_SOCKET
+				|| cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+
+		for (done = 0; done < (size_t)len; done += wlen) {
+			wlen = write (fd, buf + done, len - done);
+			if (wlen < 0) {
+				if (errno == EINTR || errno == EAGAIN) {
+					wlen = 0;
+					continue;
+				}
+				break;
+			}
+		}
+
+		close (fd);
+	}
+
+	_exit (0);
 }
 
 /**
- * log_io_error_handler:
+ * log_writer_wait:
  *
- * @log: Log associated with this @io,
- * @io: NihIo.
- *
- * Called automatically when reading the jobs stdout/stderr causes
- * an error. This will occur when the parent attempts a read after
- * the child has exited abnormally. Note that this error is expected,
- * but we must provide this handler to nih_io_reopen() since we need
- * to consume the error to ensure NIH ignores it.
- */
-void
-log_io_error_handler (Log *log, NihIo *io)
+ * Wait up to LOG_WRITER_TIMEOUT milliseconds for the logger process
+ * to be ready to accept more data, such that output still held when a
+ * log is destroyed is not discarded simply because the logger process
+ * is momentarily busy.
+ **/
+static void
+log_writer_wait (void)
 {
-	NihError *err;
-
-	nih_assert (log);
-	nih_assert (io);
+	struct pollfd pfd;
 
-	/* User job logging not currently available */
-	nih_assert (log->uid == 0);
+	if (log_writer_sock < 0)
+		return;
 
-	/* Consume */
-	err = nih_error_get ();
+	pfd.fd = log_writer_sock;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
 
-	nih_assert (err->number == EIO);
+	while (poll (&pfd, 1, LOG_WRITER_TIMEOUT) < 0 && errno == EINTR)
+		;
+}
 
-	nih_free (err);
+/**
+ * log_rotate_check:
+ *
+ * @log: Log.
+ *
+ * Rotate the log file associated with @log if it has reached
+ * log_rotate_size bytes or has been written to for log_rotate_age
+ * seconds.
+ **/
+static void
+log_rotate_check (Log *log)
+{
+	nih_assert (log);
 
-	/* Ensure the NihIo is closed */
-	nih_free (log->io);
-	log->io = NULL;
+	if (log->fd < 0)
+		return;
 
-	log->remote_closed = 1;
+	if ((log_rotate_size > 0 && log->size >= (off_t)log_rotate_size)
+			|| (log_rotate_age > 0
+				&& time (NULL) - log->created >= log_rotate_age))
+		log_rotate (log);
 }
 
 /**
- * log_file_open:
+ * log_rotate:
+ *
  * @log: Log.
  *
- * Opens log file associated with @log if not already open.
+ * Rotate the log file associated with @log: each of the existing
+ * rotated log files "@path.N" (or "@path.N.gz" if compressed) is
+ * renamed to "@path.N+1", discarding those beyond log_rotate_count,
+ * and the log file itself becomes "@path.1".
  *
- * Returns: 0 on success, -1 on failure.
+ * The log file is closed, so will be created afresh by log_file_open()
+ * when the job next produces output. Failures to rotate are not fatal
+ * since the log file can simply continue to be written.
  **/
-static int
-log_file_open (Log *log)
+static void
+log_rotate (Log *log)
 {
-	struct stat  statbuf;
-	int          ret = -1;
-	int          mode = LOG_DEFAULT_MODE;
-	mode_t       old;
-	int          flags = (O_CREAT | O_APPEND | O_WRONLY |
-			      O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
+	const char     *suffix[] = { "", ".gz", LOG_INDEX_EXT };
+	nih_local char *rotated = NULL;
+	int             i;
+	size_t          j;
 
 	nih_assert (log);
 	nih_assert (log->path);
+	nih_assert (log->fd != -1);
 
 	/* User job logging not currently available */
 	nih_assert (log->uid == 0);
 
-	memset (&statbuf, '\0', sizeof (struct stat));
-
-	ret = fstat (log->fd, &statbuf);
+	if (log_rotate_count < 1)
+		return;
 
-	/* Already open */
-	if (log->fd > -1 && (! ret && statbuf.st_nlink))
-		return 0;
+	close (log->fd);
+	log->fd = -1;
 
-	/* File was deleted. This isn't a problem for
-	 * the logger as it is happy to keep writing the
-	 * unlinked file, but it *is* a problem for
-	 * users who expect to see some data. Therefore,
-	 * close the file and attempt to rewrite it.
-	 *
-	 * This behaviour also allows tools such as logrotate(8)
-	 * to operate without disrupting the logger.
-	 */
-	if (log->fd > -1 && ! statbuf.st_nlink) {
-		close (log->fd);
-		log->fd = -1;
+	if (log->index_fd != -1) {
+		close (log->index_fd);
+		log->index_fd = -1;
 	}
 
-	nih_assert (log->fd == -1);
+	for (i = log_rotate_count; i > 0; i--) {
+		for (j = 0; j < NIH_N_ELEMENTS (suffix); j++) {
+			nih_local char *from = NULL;
+			nih_local char *to = NULL;
 
-	/* Impose some sane defaults. */
-	old = umask (LOG_DEFAULT_UMASK);
+			from = NIH_MUST (nih_sprintf (NULL, "%s.%d%s",
+						log->path, i, suffix[j]));
 
-	/* Non-blocking to avoid holding up the main loop. Without
-	 * this, we'd probably need to spawn a thread to handle
-	 * job logging.
-	 */
-	log->fd = open (log->path, flags, mode);
+			if (i == log_rotate_count) {
+				if (unlink (from) < 0 && errno != ENOENT)
+					nih_warn ("%s %s: %s", _("Failed to remove"),
+							from, strerror (errno));
+				continue;
+			}
 
-	/* Restore */
-	umask (old);
+			to = NIH_MUST (nih_sprintf (NULL, "%s.%d%s",
+						log->path, i + 1, suffix[j]));
 
-	log->open_errno = errno;
+			if (rename (from, to) < 0 && errno != ENOENT)
+				nih_warn ("%s %s: %s", _("Failed to rename"),
+						from, strerror (errno));
+		}
+	}
 
-	/* Open may have failed due to path being unaccessible
-	 * (disk might not be mounted yet).
+	rotated = NIH_MUST (nih_sprintf (NULL, "%s.1", log->path));
+
+	if (rename (log->path, rotated) < 0) {
+		nih_warn ("%s %s: %s", _("Failed to rotate log file"),
+				log->path, strerror (errno));
+		return;
+	}
+
+	nih_debug ("Rotated log file %s", log->path);
+
+	/* The index goes with the log it describes; a missing index
+	 * simply leaves the rotated log without one.
 	 */
-	if (log->fd < 0)
-		return -1;
+	if (log_index_size > 0) {
+		nih_local char *from = NULL;
+		nih_local char *to = NULL;
+
+		from = NIH_MUST (nih_sprintf (NULL, "%s%s", log->path,
+					      LOG_INDEX_EXT));
+		to = NIH_MUST (nih_sprintf (NULL, "%s%s", rotated,
+					    LOG_INDEX_EXT));
+
+		if (rename (from, to) < 0 && errno != ENOENT)
+			nih_warn ("%s %s: %s", _("Failed to rename"),
+				  from, strerror (errno));
+	}
 
-	return 0;
-}
+	if (log_rotate_compress_files) {
+		nih_local char *dest = NULL;
 
+		dest = NIH_MUST (nih_sprintf (NULL, "%s.gz", rotated));
+		log_rotate_compress (rotated, dest);
+	}
+}
 
 /**
- * log_file_write:
- *
- * @log: Log,
- * @buf: buffer data is available in,
- * @len: bytes in @buf available for reading.
- *
- * Performs actual write to log file associated with @log. Note that
- * @buf can be NULL. If so, only unbuffered data will be written.
- * If @buf is NULL, @len is ignored.
- *
- * Special case: the filesystem is full. We have a few options,
- * none of them ideal. Part of the problem is that we cannot know
- * whether the problem *will be* transitory or not.
- *
- * Options:
- *
- * (a) Ignore the problem by simply continuing
- *     to buffer unflushed data (unsafe:
- *     eventually we'll run out of core and crash).
- * (b) Retain existing unflushed buffer, but
- *     disable further appends (not reasonable
- *     since if space does become available, the
- *     most recent data will have been
- *     discarded).
- * (c) Discard all unflushed data and store *all*
- *     new data as unflushed (potentially unsafe
- *     - in low disk space situations, programs may
- *     produce *more* log messages to
- *     stdout/stderr).
- * (d) Retain the last 'n' bytes of
- *     data (unflushed + new), where 'n' is some
- *     fixed value (ring buffer) What heuristic can
- *     we use to decide upon 'n'? Since this is
- *     output, 1024 bytes at 80 bytes per line
- *     gives a reasonable amount of context. However,
- *     if space later becomes available, there will
- *     be mysterious gaps in the log files.
- * (e) Discard all new data (not ideal, but safe)
+ * log_index_open:
  *
- * In the interests of self-preservation, we have to assume the
- * problem is *not* transitory and as such we opt for the safest
- * option, namely option 'e' since:
+ * @log: Log.
  *
- * - We cannot cache all data (option 'a') as it could
- *   result in a crash.
- * - Any other option which caches data will result in
- *   a corrupted log file should space later become
- *   available.
+ * Open the index of the log file associated with @log for appending,
+ * emptying it first if the log file is itself empty, since any
+ * checkpoints in it then describe a file that has gone.
  *
  * Returns: 0 on success, -1 on failure.
  **/
 static int
-log_file_write (Log *log, const char *buf, size_t len)
+log_index_open (Log *log)
 {
-	ssize_t      wlen = 0;
-	NihIo       *io;
-	int          saved;
+	nih_local char *path = NULL;
+	mode_t          old;
+	int             flags = (O_CREAT | O_APPEND | O_WRONLY |
+				 O_CLOEXEC | O_NOFOLLOW | O_NONBLOCK);
 
 	nih_assert (log);
 	nih_assert (log->path);
-	nih_assert (log->unflushed);
-	nih_assert (log->fd != -1);
+	nih_assert (log->index_fd == -1);
 
-	/* User job logging not currently available */
-	nih_assert (log->uid == 0);
+	path = nih_sprintf (NULL, "%s%s", log->path, LOG_INDEX_EXT);
+	if (! path)
+		return -1;
 
-	io = log->io;
+	if (! log->size)
+		flags |= O_TRUNC;
 
-	/* Flush any data we previously failed to write */
-	if (log->unflushed->len) {
-		wlen = write (log->fd, log->unflushed->buf, log->unflushed->len);
-		saved = errno;
+	old = umask (LOG_DEFAULT_UMASK);
+	log->index_fd = open (path, flags, LOG_DEFAULT_MODE);
+	umask (old);
 
-		if (wlen < 0) {
-			/* Failed to flush the unflushed data, so unlikely to be
-			 * able to flush the new data. Hence, add the new data
-			 * to the unflushed buffer.
-                         *
-			 * If this fails, we still want to indicate an error
-			 * condition, so no explicit return check.
-			 *
-			 * Note that data is always discarded when out of
-			 * space.
-			 */
-			if (saved != ENOSPC && len
-					&& nih_io_buffer_push (log->unflushed, buf, len) < 0)
-				goto error;
+	return (log->index_fd < 0) ? -1 : 0;
+}
+
+/**
+ * log_index_check:
+ *
+ * @log: Log.
+ *
+ * Called before output is added to the log file associated with @log at
+ * offset @log->size to append a checkpoint to its index once
+ * log_index_size kilobytes have been written since the last, or
+ * LOG_INDEX_INTERVAL seconds have passed.
+ *
+ * Failing to write the index never affects the log itself; the index is
+ * reopened at the next checkpoint.
+ **/
+static void
+log_index_check (Log *log)
+{
+	struct timespec now;
+	LogIndexEntry   entry;
+	ssize_t         wlen;
 
-			if (len)
-				nih_io_buffer_shrink (io->recv_buf, len);
+	nih_assert (log);
 
-			/* Still need to indicate that the write failed */
-			goto error;
-		}
+	if (log_index_size <= 0)
+		return;
+
+	clock_gettime (CLOCK_REALTIME, &now);
+
+	if ((log->size < log->index_offset)
+	    && (now.tv_sec - log->index_time < LOG_INDEX_INTERVAL))
+		return;
+
+	log->index_offset = log->size + (off_t)log_index_size * 1024;
+	log->index_time = now.tv_sec;
+
+	if (log->index_fd < 0 && log_index_open (log) < 0)
+		return;
+
+	entry.time = (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	entry.offset = log->size;
 
-		nih_io_buffer_shrink (log->unflushed, (size_t)wlen);
+	wlen = write (log->index_fd, &entry, sizeof (entry));
+	if (wlen != sizeof (entry)) {
+		off_t end;
+
+		/* Never leave part of an entry for the next to follow */
+		end = lseek (log->index_fd, 0, SEEK_END);
+		if (wlen > 0 && end >= wlen
+		    && ftruncate (log->index_fd, end - wlen) < 0)
+			nih_debug ("%s %s%s: %s", _("Failed to truncate"),
+				   log->path, LOG_INDEX_EXT, strerror (errno));
+
+		close (log->index_fd);
+		log->index_fd = -1;
 	}
+}
 
-	/* Only managed a partial write for the unflushed data,
-	 * so don't attempt to write the new data as that would
-	 * leave a gap in the log. Just store the new data for
-	 * next time.
-	 */
-	if (log->unflushed->len) {
-		if (! len)
-			goto error;
+/**
+ * log_rotate_compress:
+ *
+ * @src: path of rotated log file,
+ * @dest: path of compressed log file to create.
+ *
+ * Start LOG_COMPRESS_PROGRAM in the background to compress @src into
+ * @dest.
+ *
+ * Both files are opened here and @src is then removed immediately, such
+ * that a subsequent rotation can rename @dest while compression remains
+ * in progress. If LOG_COMPRESS_PROGRAM is not available, @src is left
+ * uncompressed.
+ **/
+static void
+log_rotate_compress (const char *src,
+		     const char *dest)
+{
+	int       in = -1;
+	int       out = -1;
+	pid_t     pid;
+	mode_t    old;
+	sigset_t  child_set;
+	sigset_t  orig_set;
 
-		/* Save new data */
-		if (nih_io_buffer_push (log->unflushed, buf, len) < 0)
-			goto error;
+	nih_assert (src);
+	nih_assert (dest);
 
-		nih_io_buffer_shrink (io->recv_buf, len);
+	if (access (LOG_COMPRESS_PROGRAM, X_OK) < 0)
+		return;
 
+	in = open (src, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (in < 0)
 		goto error;
-	}
 
-	if (! buf || ! len)
-		return 0;
+	old = umask (LOG_DEFAULT_UMASK);
+	out = open (dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+			LOG_DEFAULT_MODE);
+	umask (old);
 
-	/* Write the new data */
-	wlen = write (log->fd, buf, len);
-	saved = errno;
+	if (out < 0)
+		goto error;
 
-	if (wlen < 0) {
-		if (saved != ENOSPC && nih_io_buffer_push (log->unflushed, buf, len) < 0)
-			goto error;
+	/* Block all signals while we fork to avoid the child process
+	 * running our own signal handlers before we've reset them.
+	 */
+	sigfillset (&child_set);
+	sigprocmask (SIG_BLOCK, &child_set, &orig_set);
 
-		nih_io_buffer_shrink (io->recv_buf, len);
+	fflush (NULL);
+
+	pid = fork ();
+	if (pid < 0) {
+		int saved = errno;
 
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+		(void)unlink (dest);
+		errno = saved;
 		goto error;
+	} else if (! pid) {
+		nih_signal_reset ();
+		sigprocmask (SIG_SETMASK, &orig_set, NULL);
+
+		if (dup2 (in, STDIN_FILENO) < 0
+				|| dup2 (out, STDOUT_FILENO) < 0)
+			_exit (1);
+
+		execl (LOG_COMPRESS_PROGRAM, LOG_COMPRESS_PROGRAM, "-c", NULL);
+		_exit (1);
 	}
 
-	/* Shrink buffer by amount of data written (which handles
-	 * partial writes)
-	 */
-	nih_io_buffer_shrink (io->recv_buf, (size_t)wlen);
+	sigprocmask (SIG_SETMASK, &orig_set, NULL);
 
-	return 0;
+	close (in);
+	close (out);
+
+	(void)unlink (src);
+
+	return;
 
 error:
-	close (log->fd);
-	log->fd = -1;
-	return -1;
+	nih_warn ("%s %s: %s", _("Failed to compress log file"),
+			src, strerror (errno));
+
+	if (in != -1)
+		close (in);
+	if (out != -1)
+		close (out);
 }
 
 /**
@@ -749,6 +1845,11 @@ log_handle_unflushed (void *parent, Log *log)
 
 	log_read_watch (log);
 
+	/* Ensure output held in the write-behind buffer is either
+	 * written or considered unflushed.
+	 */
+	(void)log_pending_flush (log);
+
 	if (! log->unflushed->len)
 		return 1;
 
@@ -873,7 +1974,7 @@ log_clear_unflushed (void)
 		if (log_file_open (log) != 0)
 			return -1;
 
-		if (log_file_write (log, NULL, 0) < 0)
+		if (log_file_write (log, log->pending) < 0)
 			return -1;
 
 		/* This will handle any remaining unflushed log data */
@@ -898,13 +1999,30 @@ json_object *
 log_serialise (Log *log)
 {
 	json_object     *json;
-	nih_local char  *unflushed_hex = NULL;
 
 	json = json_object_new_object ();
 	if (! json)
 		return NULL;
 
-	if (! log || (! log->io && log->unflushed && ! log->unflushed->len))
+	if (! log)
+		goto placeholder;
+
+	/* Output held in the write-behind buffer is not encoded, so
+	 * write it now or move it to the unflushed buffer.
+	 */
+	if (log->pending && log->pending->len) {
+		(void)log_pending_flush (log);
+
+		if (log->pending->len) {
+			if (log_unflushed_push (log, log->pending->buf,
+						log->pending->len) < 0)
+				goto error;
+
+			nih_io_buffer_shrink (log->pending, log->pending->len);
+		}
+	}
+
+	if (! log->io && log->unflushed && ! log->unflushed->len)
 		goto placeholder;
 
 	/* Attempt to flush any cached data */
@@ -915,7 +2033,7 @@ log_serialise (Log *log)
 		if (log->fd < 0)
 			(void)log_file_open (log);
 		if (log->fd != -1)
-			(void)log_file_write (log, NULL, 0);
+			(void)log_file_write (log, NULL);
 	}
 
 	/* Job associated with log has ended. If we failed to write
@@ -941,18 +2059,13 @@ log_serialise (Log *log)
 	if (! state_set_json_int_var_from_obj (json, log, uid))
 		goto error;
 
-	/* Encode unflushed data as hex to ensure any embedded
-	 * nulls are handled.
+	/* Encode unflushed data such that any embedded nulls are
+	 * handled.
 	 */
 	if (log->unflushed && log->unflushed->len) {
-		unflushed_hex = state_data_to_hex (NULL,
-				log->unflushed->buf,
-				log->unflushed->len);
-
-		if (! unflushed_hex)
-			goto error;
-
-		if (! state_set_json_string_var (json, "unflushed", unflushed_hex))
+		if (! state_set_json_data_var (json, "unflushed",
+					log->unflushed->buf,
+					log->unflushed->len))
 			goto error;
 	}
 
@@ -965,6 +2078,9 @@ log_serialise (Log *log)
 	if (! state_set_json_int_var_from_obj (json, log, open_errno))
 		goto error;
 
+	if (! state_set_json_int_var_from_obj (json, log, unflushed_dropped))
+		goto error;
+
 	return json;
 
 placeholder:
@@ -993,9 +2109,7 @@ log_deserialise (const void *parent,
 		 json_object *json)
 {
 	Log             *log;
-	nih_local char  *unflushed_hex = NULL;
 	nih_local char  *unflushed = NULL;
-	int              ret;
 	size_t           len;
 	nih_local char  *path = NULL;
 	int              io_watch_fd = -1;
@@ -1040,27 +2154,27 @@ log_deserialise (const void *parent,
 	 * Note we discard return value since if this fails,
 	 * we would never close the fd.
 	 */
-	if (log->fd != -1)
+	if (log->fd != -1) {
+		struct stat statbuf;
+
 		(void)state_modify_cloexec (log->fd, TRUE);
 
+		/* Rotation period restarts from the re-exec */
+		if (! fstat (log->fd, &statbuf))
+			log->size = statbuf.st_size;
+		log->created = time (NULL);
+	}
+
 	log->unflushed = nih_io_buffer_new (log);
 	if (! log->unflushed)
 		goto error;
 
 	if (json_object_object_get_ex (json, "unflushed", NULL)) {
-		if (! state_get_json_string_var_strict (json, "unflushed", NULL, unflushed_hex))
+		if (! state_get_json_data_var (NULL, json, "unflushed",
+					&unflushed, &len))
 			goto error;
 
-		ret = state_hex_to_data (NULL,
-				unflushed_hex,
-				strlen (unflushed_hex),
-				&unflushed,
-				&len);
-
-		if (ret < 0)
-			goto error;
-
-		if (nih_io_buffer_push (log->unflushed, unflushed, len) < 0)
+		if (log_unflushed_push (log, unflushed, len) < 0)
 			goto error;
 	}
 
@@ -1073,6 +2187,14 @@ log_deserialise (const void *parent,
 	if (! state_get_json_int_var_to_obj (json, log, open_errno))
 		goto error;
 
+	/* Not present in older serialisations */
+	if (json_object_object_get_ex (json, "unflushed_dropped", NULL)) {
+		if (! state_get_json_int_var_to_obj (json, log, unflushed_dropped))
+			goto error;
+
+		log_unflushed_dropped += log->unflushed_dropped;
+	}
+
 	return log;
 
 error:
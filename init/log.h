@@ -21,6 +21,10 @@
 #ifndef INIT_LOG_H
 #define INIT_LOG_H
 
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
 #include <nih/alloc.h>
 #include <nih/list.h>
 #include <nih/io.h>
@@ -30,6 +34,7 @@
 #include <nih/error.h>
 
 #include "state.h"
+#include "deadline.h"
 
 /** LOG_DEFAULT_UMASK:
  *
@@ -49,6 +54,53 @@
  **/
 #define LOG_READ_SIZE            1024
 
+/** LOG_FLUSH_INTERVAL:
+ *
+ * Default number of seconds output may be held in the write-behind
+ * buffer of a Log before it is written to the log file.
+ **/
+#define LOG_FLUSH_INTERVAL       1
+
+/** LOG_WRITER_MAX:
+ *
+ * Maximum number of bytes handed to the logger process in one message.
+ **/
+#define LOG_WRITER_MAX           65536
+
+/** LOG_WRITER_TIMEOUT:
+ *
+ * Number of milliseconds to wait for the logger process to accept the
+ * remaining output of a log being destroyed.
+ **/
+#define LOG_WRITER_TIMEOUT       1000
+
+/** LOG_SPLICE_SIZE:
+ *
+ * Maximum number of bytes moved from a job to its log file by each
+ * splice(2) call.
+ **/
+#define LOG_SPLICE_SIZE          65536
+
+/** LOG_UNFLUSHED_LIMIT:
+ *
+ * Default maximum number of bytes of unflushed data retained for
+ * each log.
+ **/
+#define LOG_UNFLUSHED_LIMIT      (1024 * 1024)
+
+/** LOG_UNFLUSHED_TOTAL_LIMIT:
+ *
+ * Default maximum number of bytes of unflushed data retained across
+ * all logs.
+ **/
+#define LOG_UNFLUSHED_TOTAL_LIMIT (16 * 1024 * 1024)
+
+/** LOG_ROTATE_COUNT:
+ *
+ * Default number of rotated log files retained for each job.
+ **/
+#define LOG_ROTATE_COUNT         5
+
 /**
  * Log:
  *
@@ -57,9 +109,19 @@
  * @io: NihIo associated with jobs stdout and stderr,
  * @uid: User ID of caller,
  * @unflushed: Unflushed data,
+ * @pending: Data read from the job but not yet written to @path,
+ * @flush_timer: timer that writes @pending to @path,
+ * @splice_pipe: pipe used to splice job output to @path,
+ * @splice_failed: TRUE if output cannot be spliced to @path,
+ * @unflushed_dropped: number of bytes of unflushed data discarded,
+ * @size: size of @path when last written,
+ * @created: time @path was opened, for rotation purposes,
  * @detached: TRUE if log is no longer associated with a parent (job),
  * @remote_closed: TRUE if remote end of pty has been closed,
- * @open_errno: value of errno immediately after last attempt to open @path.
+ * @open_errno: value of errno immediately after last attempt to open @path,
+ * @index_fd: Write file descriptor of the index of @path, or -1,
+ * @index_offset: size @path must reach before the next checkpoint,
+ * @index_time: time of the last checkpoint.
  **/
 typedef struct log {
 	int          fd;
@@ -67,14 +129,35 @@ typedef struct log {
 	NihIo       *io;
 	uid_t        uid;
 	NihIoBuffer *unflushed;
+	NihIoBuffer *pending;
+	Deadline    *flush_timer;
+	int          splice_pipe[2];
+	int          splice_failed;
+	int64_t      unflushed_dropped;
+	off_t        size;
+	time_t       created;
 	int          detached;
 	int          remote_closed;
 	int          open_errno;
+	int          index_fd;
+	off_t        index_offset;
+	time_t       index_time;
 } Log;
 
 NIH_BEGIN_EXTERN
 
 extern NihList *log_unflushed_files;
+extern int      log_buffer_size;
+extern int      log_flush_interval;
+extern int      log_writer;
+extern int      log_unflushed_limit;
+extern int      log_unflushed_total_limit;
+extern uint64_t log_unflushed_dropped;
+extern int      log_rotate_size;
+extern int      log_rotate_age;
+extern int      log_rotate_count;
+extern int      log_rotate_compress_files;
+extern int      log_index_size;
 
 Log  *log_new                (const void *parent, const char *path,
 			      int fd, uid_t uid)
@@ -0,0 +1,59 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_LOG_INDEX_H
+#define INIT_LOG_INDEX_H
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+
+/**
+ * LOG_INDEX_EXT:
+ *
+ * Suffix appended to the path of a log file to give the path of its
+ * index.
+ **/
+#define LOG_INDEX_EXT ".idx"
+
+/**
+ * LOG_INDEX_INTERVAL:
+ *
+ * Maximum number of seconds between checkpoints in an index while the
+ * job keeps producing output, however little.
+ **/
+#define LOG_INDEX_INTERVAL 10
+
+/**
+ * LogIndexEntry:
+ * @time: wall clock time of checkpoint, in microseconds since the epoch,
+ * @offset: offset in the log file of the first byte written at or after
+ * @time.
+ *
+ * An index is a file holding an array of these in the byte order of the
+ * host, written by init alongside a log file such that output from a
+ * given time can be found without reading the log from its start; both
+ * fields only ever increase through the file.  A trailing partial entry
+ * should be ignored.
+ **/
+typedef struct log_index_entry {
+	int64_t  time;
+	uint64_t offset;
+} LogIndexEntry;
+
+#endif /* INIT_LOG_INDEX_H */
@@ -50,6 +50,7 @@
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
+#include <nih/string.h>
 #include <nih/list.h>
 #include <nih/timer.h>
 #include <nih/signal.h>
@@ -62,12 +63,21 @@
 #include "paths.h"
 #include "events.h"
 #include "system.h"
+#include "pool.h"
 #include "job_class.h"
 #include "job_process.h"
 #include "event.h"
 #include "conf.h"
 #include "control.h"
 #include "state.h"
+#include "snapshot.h"
+#include "metrics.h"
+#include "resource.h"
+#include "schedule.h"
+#include "pressure.h"
+#include "listener.h"
+#include "pty.h"
+#include "iowatch.h"
 #include "xdg.h"
 
 
@@ -91,6 +101,10 @@ static int  console_type_setter     (NihOption *option, const char *arg);
 static int  conf_dir_setter         (NihOption *option, const char *arg);
 static int  prepend_conf_dir_setter (NihOption *option, const char *arg);
 static int  append_conf_dir_setter  (NihOption *option, const char *arg);
+static int  state_format_setter     (NihOption *option, const char *arg);
+static int  resource_setter         (NihOption *option, const char *arg);
+
+static void deferred_reload (void *data, NihMainLoopFunc *func);
 
 
 /**
@@ -146,7 +160,16 @@ static int disable_startup_event = FALSE;
  **/
 static int disable_dbus = FALSE;
 
+/**
+ * use_spawner:
+ *
+ * If TRUE, spawn simple job processes from a separate spawner process.
+ **/
+static int use_spawner = FALSE;
+
+extern char        *expect_cgroup;
 extern int          no_inherit_env;
+extern int          use_pidfd;
 extern int          user_mode;
 extern int          chroot_sessions;
 extern int          disable_job_logging;
@@ -154,12 +177,24 @@ extern int          use_session_bus;
 extern int          default_console;
 extern int          write_state_file;
 extern char        *log_dir;
+extern int          log_buffer_size;
+extern int          log_flush_interval;
+extern int          log_writer;
+extern int          log_unflushed_limit;
+extern int          log_unflushed_total_limit;
+extern int          log_rotate_size;
+extern int          log_rotate_age;
+extern int          log_rotate_count;
+extern int          log_rotate_compress_files;
+extern int          log_index_size;
 extern DBusBusType  dbus_bus_type;
 extern mode_t       initial_umask;
 extern int          debug_stanza_enabled;
+extern int          parse_profile_enabled;
 
 #ifdef ENABLE_CGROUPS
 extern int          disable_cgroups;
+extern char        *cgroup_root;
 #endif /* ENABLE_CGROUPS */
 
 /**
@@ -171,18 +206,74 @@ static NihOption options[] = {
 	{ 0, "append-confdir", N_("specify additional directory to load configuration files from"),
 		NULL, "DIR", NULL, append_conf_dir_setter },
 
+#ifdef ENABLE_CGROUPS
+	{ 0, "cgroup-root", N_("manage cgroups directly below cgroup2 directory DIR instead of through the cgroup manager"),
+		NULL, "DIR", &cgroup_root, NULL },
+#endif /* ENABLE_CGROUPS */
+
 	{ 0, "chroot-sessions", N_("enable chroot sessions"),
 		NULL, NULL, &chroot_sessions, NULL },
 
 	{ 0, "confdir", N_("specify alternative directory to load configuration files from"),
 		NULL, "DIR", NULL, conf_dir_setter },
 
+	{ 0, "conf-reload-delay", N_("specify number of seconds to gather changes to configuration files before reloading them"),
+		NULL, "SECONDS", &conf_reload_delay, nih_option_int },
+
 	{ 0, "default-console", N_("default value for console stanza"),
 		NULL, "VALUE", NULL, console_type_setter },
 
+	{ 0, "epoll", N_("serve job log, process and configuration watches from epoll"),
+		NULL, NULL, &use_epoll, NULL },
+
+	{ 0, "expect-cgroup", N_("specify cgroup2 directory used to follow forking jobs instead of ptrace"),
+		NULL, "DIR", &expect_cgroup, NULL },
+
+	{ 0, "lazy-conf", N_("only parse job configuration files when first needed"),
+		NULL, NULL, &conf_lazy, NULL },
+
+	{ 0, "lazy-dbus-objects", N_("only register job instances with D-Bus clients when first used"),
+		NULL, NULL, &control_lazy_objects, NULL },
+
+	{ 0, "log-buffer-size", N_("specify number of bytes of job output to gather before writing to log"),
+		NULL, "BYTES", &log_buffer_size, nih_option_int },
+
+	{ 0, "log-flush-interval", N_("specify maximum number of seconds to hold job output before writing to log"),
+		NULL, "SECONDS", &log_flush_interval, nih_option_int },
+
+	{ 0, "log-compress", N_("compress rotated job output logs"),
+		NULL, NULL, &log_rotate_compress_files, NULL },
+
+	{ 0, "log-index", N_("specify number of kilobytes of job output between checkpoints in an index kept beside each log"),
+		NULL, "KB", &log_index_size, nih_option_int },
+
+	{ 0, "log-rotate-age", N_("specify number of seconds after which job output logs are rotated"),
+		NULL, "SECONDS", &log_rotate_age, nih_option_int },
+
+	{ 0, "log-rotate-count", N_("specify number of rotated job output logs to keep"),
+		NULL, "COUNT", &log_rotate_count, nih_option_int },
+
+	{ 0, "log-rotate-size", N_("specify size in bytes at which job output logs are rotated"),
+		NULL, "BYTES", &log_rotate_size, nih_option_int },
+
+	{ 0, "log-unflushed-limit", N_("specify maximum number of bytes of job output to retain per log before disks are writeable"),
+		NULL, "BYTES", &log_unflushed_limit, nih_option_int },
+
+	{ 0, "log-unflushed-total-limit", N_("specify maximum number of bytes of job output to retain for all logs before disks are writeable"),
+		NULL, "BYTES", &log_unflushed_total_limit, nih_option_int },
+
+	{ 0, "log-writer", N_("write job output logs from a separate process"),
+		NULL, NULL, &log_writer, NULL },
+
 	{ 0, "logdir", N_("specify alternative directory to store job output logs in"),
 		NULL, "DIR", &log_dir, NULL },
 
+	{ 0, "max-starting", N_("specify maximum number of jobs to start at once"),
+		NULL, "NUMBER", &resource_max_starting, nih_option_int },
+
+	{ 0, "metrics", N_("serve OpenMetrics counters of init internals on a unix socket"),
+		NULL, NULL, &metrics_enabled, NULL },
+
 #ifdef ENABLE_CGROUPS
 	{ 0, "no-cgroups", N_("do not support cgroups"),
 		NULL, NULL, &disable_cgroups, NULL },
@@ -200,9 +291,27 @@ static NihOption options[] = {
 	{ 0, "no-startup-event", N_("do not emit any startup event (for testing)"),
 		NULL, NULL, &disable_startup_event, NULL },
 
+	{ 0, "pidfd", N_("reap job processes through process file descriptors"),
+		NULL, NULL, &use_pidfd, NULL },
+
+	{ 0, "prefetch-conf", N_("read all configuration files ahead of parsing them"),
+		NULL, NULL, &conf_prefetch, NULL },
+
 	{ 0, "prepend-confdir", N_("specify additional initial directory to load configuration files from"),
 		NULL, "DIR", NULL, prepend_conf_dir_setter },
 
+	{ 0, "profile-config", N_("log the time taken and allocations made parsing each configuration file and stanza"),
+		NULL, NULL, &parse_profile_enabled, NULL },
+
+	{ 0, "pty-pool-size", N_("specify number of pseudo-terminals to keep ready for logged jobs"),
+		NULL, "NUMBER", &pty_pool_size, nih_option_int },
+
+	{ 0, "quiet-job-events", N_("do not queue job events that no job could be started or stopped by"),
+		NULL, NULL, &job_quiet_events, NULL },
+
+	{ 0, "resource", N_("specify amount AMOUNT of resource NAME available to jobs that use it"),
+		NULL, "NAME=AMOUNT", NULL, resource_setter },
+
 	/* Must be specified for both stateful and stateless re-exec */
 	{ 0, "restart", N_("flag a re-exec has occurred"),
 		NULL, NULL, &restart, NULL },
@@ -211,9 +320,21 @@ static NihOption options[] = {
 	{ 0, "state-fd", N_("specify file descriptor to read serialisation data from"),
 		NULL, "FD", &state_fd, nih_option_int },
 
+	{ 0, "state-format", N_("specify format of serialisation data"),
+		NULL, "FORMAT", NULL, state_format_setter },
+
 	{ 0, "session", N_("use D-Bus session bus rather than system bus (for testing)"),
 		NULL, NULL, &use_session_bus, NULL },
 
+	{ 0, "shutdown-timeout", N_("specify maximum number of seconds to wait for jobs to stop when ending the session"),
+		NULL, "SECONDS", &quiesce_timeout, nih_option_int },
+
+	{ 0, "snapshot", N_("keep a snapshot of job state that clients can read without D-Bus"),
+		NULL, NULL, &snapshot_enabled, NULL },
+
+	{ 0, "spawner", N_("spawn simple job processes from a separate process"),
+		NULL, NULL, &use_spawner, NULL },
+
 	{ 0, "startup-event", N_("specify an alternative initial event (for testing)"),
 		NULL, "NAME", &initial_event, NULL },
 
@@ -237,6 +358,9 @@ main (int   argc,
 	char **args = NULL;
 	int    ret;
 
+	/* Must come before anything is allocated */
+	pool_init ();
+
 	conf_dirs = NIH_MUST (nih_str_array_new (NULL));
 	append_conf_dirs = NIH_MUST (nih_str_array_new (NULL));
 	prepend_conf_dirs = NIH_MUST (nih_str_array_new (NULL));
@@ -519,6 +643,22 @@ main (int   argc,
 #endif /* DEBUG */
 
 
+	/* Start the spawner while our address space is still small */
+	if (use_spawner)
+		(void)job_process_spawner_start ();
+
+	/* Serve the watches of job logs and the like from a single
+	 * epoll instance, before any are created.
+	 */
+	if (use_epoll && (iowatch_init () < 0)) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("%s: %s", _("Unable to create epoll instance"),
+			  err->message);
+		nih_free (err);
+	}
+
 	/* Watch children for events */
 	NIH_MUST (nih_child_add_watch (NULL, -1, NIH_CHILD_ALL,
 				       job_process_handler, NULL));
@@ -527,6 +667,62 @@ main (int   argc,
 	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)event_poll,
 					  NULL));
 
+	/* Admit jobs waiting for the resources released by it */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)resource_poll,
+					  NULL));
+
+	/* Keep the timer and calendar events named by jobs in step with
+	 * the jobs loaded; AFTER delays are relative to now.
+	 */
+	schedule_init ();
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)schedule_poll,
+					  NULL));
+
+	/* Drop the pressure triggers that no job names any longer */
+	pressure_init ();
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)pressure_poll,
+					  NULL));
+
+	/* Listen on the sockets of socket-activated jobs, and again once
+	 * their instances have stopped.
+	 */
+	listener_init ();
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)listener_poll,
+					  NULL));
+
+	/* Replace the ptys taken by logged jobs spawned by it */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)pty_poll,
+					  NULL));
+
+	/* Send the changes to jobs made by it to change feed subscribers */
+	NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)control_changes_flush,
+					  NULL));
+
+	/* Rewrite the job state snapshot after the changes made by it */
+	if (snapshot_enabled) {
+		if (snapshot_init () < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_warn ("%s: %s", _("Unable to create job state snapshot"),
+				  err->message);
+			nih_free (err);
+		} else {
+			NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)snapshot_flush,
+							  NULL));
+		}
+	}
+
+	/* Serve metrics to monitoring without forking initctl */
+	if (metrics_enabled && (metrics_init () < 0)) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("%s: %s", _("Unable to serve metrics"),
+			  err->message);
+		nih_free (err);
+	}
+
 
 	/* Adjust our OOM priority to the default, which will be inherited
 	 * by all jobs.
@@ -601,6 +797,27 @@ main (int   argc,
 		}
 	}
 
+	/* Create a listening server for private connections.  When
+	 * restarting, this must wait until the state has been read since
+	 * the previous instance only releases the address just before
+	 * writing it; it is still done before the configuration is reloaded
+	 * so that clients are answered as soon as the main loop runs.
+	 */
+	if (use_session_bus == FALSE) {
+		while (control_server_open () < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			if (err->number != ENOMEM) {
+				nih_warn ("%s: %s", _("Unable to listen for private connections"),
+					err->message);
+				nih_free (err);
+				break;
+			}
+			nih_free (err);
+		}
+	}
+
 	/* Only honour command-line options affecting configuration
 	 * directories if not restarting, or if performing a stateless
 	 * re-exec.
@@ -648,27 +865,20 @@ main (int   argc,
 
 	job_class_environment_init ();
 
-	conf_reload ();
+	/* After a stateful re-exec the jobs are already loaded, so checking
+	 * them against the configuration on disk can wait until requests
+	 * queued during the re-exec have been answered.
+	 */
+	if (restart && state_fd != -1) {
+		NIH_MUST (nih_main_loop_add_func (NULL, (NihMainLoopCb)deferred_reload,
+						  NULL));
+	} else {
+		conf_reload ();
+	}
 
 	/* We must have atleast one source of configuration */
 	nih_assert (! NIH_LIST_EMPTY (conf_sources));
 
-	/* Create a listening server for private connections. */
-	if (use_session_bus == FALSE) {
-		while (control_server_open () < 0) {
-			NihError *err;
-
-			err = nih_error_get ();
-			if (err->number != ENOMEM) {
-				nih_warn ("%s: %s", _("Unable to listen for private connections"),
-					err->message);
-				nih_free (err);
-				break;
-			}
-			nih_free (err);
-		}
-	}
-
 	/* Open connection to the appropriate D-Bus bus; we normally expect this to
 	 * fail (since dbus-daemon probably isn't running yet) and will try again
 	 * later - don't let ENOMEM stop us though.
@@ -1061,6 +1271,32 @@ usr1_handler (void      *data,
 }
 #endif /* DEBUG */
 
+/**
+ * deferred_reload:
+ * @data: unused,
+ * @func: main loop function.
+ *
+ * Main loop function that reloads the configuration on the second
+ * iteration of the main loop after a stateful re-exec, once the D-Bus
+ * requests received during the re-exec have been dispatched, then
+ * removes itself.
+ **/
+static void
+deferred_reload (void            *data,
+		 NihMainLoopFunc *func)
+{
+	static int iterations = 0;
+
+	nih_assert (func != NULL);
+
+	if (! iterations++)
+		return;
+
+	conf_reload ();
+
+	nih_free (func);
+}
+
 /**
  * handle_confdir:
  *
@@ -1189,3 +1425,57 @@ append_conf_dir_setter (NihOption *option, const char *arg)
 
 	return 0;
 }
+
+/**
+ * NihOption setter function to handle selection of the format of
+ * serialisation data read from the state fd.
+ *
+ * Returns: 0 on success, -1 on invalid format.
+ **/
+static int
+state_format_setter (NihOption *option, const char *arg)
+{
+	StateFormat format;
+
+	nih_assert (option);
+
+	format = state_format_str_to_enum (arg);
+
+	if (format == STATE_FORMAT_INVALID) {
+		nih_fatal ("%s: %s", _("invalid state format specified"), arg);
+		return -1;
+	}
+
+	state_format = format;
+
+	return 0;
+}
+
+/**
+ * NihOption setter function to handle the amount of a resource
+ * available to jobs.
+ *
+ * Returns: 0 on success, -1 on invalid resource or amount.
+ **/
+static int
+resource_setter (NihOption *option, const char *arg)
+{
+	nih_local char *name = NULL;
+	const char     *value;
+	int             amount;
+
+	nih_assert (option);
+
+	value = strchr (arg, '=');
+	if ((! value) || (value == arg)
+	    || (resource_parse_amount (value + 1, &amount) < 0)) {
+		nih_fatal ("%s: %s", _("invalid resource specified"), arg);
+		return -1;
+	}
+
+	name = NIH_MUST (nih_strndup (NULL, arg, value - arg));
+
+	resource_set_max (name, amount);
+
+	return 0;
+}
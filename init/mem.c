@@ -0,0 +1,523 @@
+/* upstart
+ *
+ * mem.c - memory held by the data structures of init
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/tree.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+
+#include "intern.h"
+#include "session.h"
+#include "process.h"
+#include "event_operator.h"
+#include "event.h"
+#include "blocked.h"
+#include "job_class.h"
+#include "job.h"
+#include "log.h"
+#include "conf.h"
+#include "mem.h"
+
+
+/* Prototypes for static functions */
+static void mem_add          (MemUsage *usage, const void *ptr);
+static void mem_add_string   (MemUsage *usage, const char *str);
+static void mem_add_array    (MemUsage *usage, char * const *array);
+static void mem_add_hash     (MemUsage *usage, const NihHash *hash);
+static void mem_add_buffer   (MemUsage *usage, const NihIoBuffer *buffer);
+static void mem_add_operator (MemUsage *usage, EventOperator *root);
+static void mem_add_blocking (MemUsage *usage, NihList *blocking);
+static void mem_add_class    (MemUsage *usage, JobClass *class);
+static void mem_add_job      (MemUsage *usage, Job *job);
+static void mem_add_log      (MemUsage *usage, Log *log);
+
+
+/**
+ * mem_usage:
+ * @usage: array to fill in.
+ *
+ * Walk the job classes and their instances, job logs, events,
+ * configuration sources, sessions and the intern table, filling in
+ * @usage with the number and total size of the objects held by each,
+ * as given by nih_alloc_size().
+ *
+ * Interned strings are shared between the structures that reference
+ * them, so are only counted under MEM_INTERNED.  Objects owned by
+ * libnih or libraries, such as the contents of watches and timers
+ * beyond their own structures, are not counted.
+ **/
+void
+mem_usage (MemUsage usage[MEM_CATEGORIES])
+{
+	nih_assert (usage != NULL);
+
+	memset (usage, 0, sizeof (MemUsage) * MEM_CATEGORIES);
+
+	if (job_classes) {
+		mem_add_hash (&usage[MEM_JOB_CLASSES], job_classes);
+
+		NIH_HASH_FOREACH (job_classes, iter)
+			mem_add_class (usage, (JobClass *)iter);
+	}
+
+	if (job_subscriptions) {
+		mem_add_hash (&usage[MEM_JOB_CLASSES], job_subscriptions);
+
+		NIH_HASH_FOREACH (job_subscriptions, iter) {
+			JobSubscription *sub = (JobSubscription *)iter;
+
+			mem_add (&usage[sub->job ? MEM_JOBS : MEM_JOB_CLASSES],
+				 sub);
+		}
+	}
+
+	if (log_unflushed_files) {
+		mem_add (&usage[MEM_LOGS], log_unflushed_files);
+
+		NIH_LIST_FOREACH (log_unflushed_files, iter) {
+			NihListEntry *entry = (NihListEntry *)iter;
+
+			mem_add (&usage[MEM_LOGS], entry);
+			mem_add_log (usage, (Log *)entry->data);
+		}
+	}
+
+	if (events) {
+		mem_add (&usage[MEM_EVENTS], events);
+
+		NIH_LIST_FOREACH (events, iter) {
+			Event *event = (Event *)iter;
+
+			mem_add (&usage[MEM_EVENTS], event);
+			mem_add_string (&usage[MEM_EVENTS], event->name);
+			mem_add_array (&usage[MEM_EVENTS], event->env);
+			mem_add (&usage[MEM_EVENTS], event->fds);
+			mem_add_blocking (&usage[MEM_EVENTS], &event->blocking);
+		}
+	}
+
+	if (conf_sources) {
+		mem_add (&usage[MEM_CONF], conf_sources);
+
+		NIH_LIST_FOREACH (conf_sources, iter) {
+			ConfSource *source = (ConfSource *)iter;
+
+			mem_add (&usage[MEM_CONF], source);
+			mem_add_string (&usage[MEM_CONF], source->path);
+			mem_add (&usage[MEM_CONF], source->watch);
+			mem_add_hash (&usage[MEM_CONF], source->files);
+
+			NIH_HASH_FOREACH (source->files, file_iter) {
+				ConfFile *file = (ConfFile *)file_iter;
+
+				mem_add (&usage[MEM_CONF], file);
+				mem_add_string (&usage[MEM_CONF], file->path);
+				mem_add_string (&usage[MEM_CONF],
+						file->override_path);
+
+				if (file->lazy) {
+					mem_add (&usage[MEM_CONF], file->lazy);
+					mem_add_string (&usage[MEM_CONF],
+							file->lazy->name);
+				}
+
+				/* Replacement classes waiting for the
+				 * registered class to stop are not in
+				 * job_classes.
+				 */
+				if ((source->type == CONF_JOB_DIR) && file->job
+				    && NIH_LIST_EMPTY (&file->job->entry))
+					mem_add_class (usage, file->job);
+			}
+		}
+	}
+
+	if (sessions) {
+		mem_add (&usage[MEM_SESSIONS], sessions);
+		mem_add_hash (&usage[MEM_SESSIONS], session_chroots);
+
+		NIH_LIST_FOREACH (sessions, iter) {
+			Session *session = (Session *)iter;
+
+			mem_add (&usage[MEM_SESSIONS], session);
+			mem_add_string (&usage[MEM_SESSIONS], session->chroot);
+			mem_add_string (&usage[MEM_SESSIONS], session->conf_path);
+		}
+
+		NIH_HASH_FOREACH (session_chroots, iter)
+			mem_add (&usage[MEM_SESSIONS], iter);
+	}
+
+	if (interned) {
+		mem_add_hash (&usage[MEM_INTERNED], interned);
+
+		NIH_HASH_FOREACH (interned, iter) {
+			InternString *intern = (InternString *)iter;
+
+			mem_add (&usage[MEM_INTERNED], intern);
+			mem_add (&usage[MEM_INTERNED], intern->str);
+		}
+	}
+}
+
+/**
+ * mem_category_name:
+ * @category: category to name.
+ *
+ * Returns: name of @category used by the GetMemoryStats method, or NULL
+ * if not known.
+ **/
+const char *
+mem_category_name (MemCategory category)
+{
+	switch (category) {
+	case MEM_JOB_CLASSES:
+		return "job-classes";
+	case MEM_JOBS:
+		return "jobs";
+	case MEM_LOGS:
+		return "logs";
+	case MEM_EVENTS:
+		return "events";
+	case MEM_CONF:
+		return "conf";
+	case MEM_SESSIONS:
+		return "sessions";
+	case MEM_INTERNED:
+		return "interned";
+	default:
+		return NULL;
+	}
+}
+
+
+/**
+ * mem_add:
+ * @usage: usage to add to,
+ * @ptr: object allocated with nih_alloc(), or NULL.
+ *
+ * Count @ptr in @usage.
+ **/
+static void
+mem_add (MemUsage   *usage,
+	 const void *ptr)
+{
+	nih_assert (usage != NULL);
+
+	if (! ptr)
+		return;
+
+	usage->objects++;
+	usage->bytes += nih_alloc_size (ptr);
+}
+
+/**
+ * mem_add_string:
+ * @usage: usage to add to,
+ * @str: string, or NULL.
+ *
+ * Count @str in @usage unless it is interned.
+ **/
+static void
+mem_add_string (MemUsage   *usage,
+		const char *str)
+{
+	nih_assert (usage != NULL);
+
+	if ((! str) || intern_contains (str))
+		return;
+
+	mem_add (usage, str);
+}
+
+/**
+ * mem_add_array:
+ * @usage: usage to add to,
+ * @array: NULL-terminated array of strings, or NULL.
+ *
+ * Count @array and each of its strings in @usage.
+ **/
+static void
+mem_add_array (MemUsage     *usage,
+	       char * const *array)
+{
+	nih_assert (usage != NULL);
+
+	if (! array)
+		return;
+
+	mem_add (usage, array);
+
+	for (char * const *e = array; *e; e++)
+		mem_add_string (usage, *e);
+}
+
+/**
+ * mem_add_hash:
+ * @usage: usage to add to,
+ * @hash: hash table, or NULL.
+ *
+ * Count @hash and its bins, but not its entries, in @usage.
+ **/
+static void
+mem_add_hash (MemUsage      *usage,
+	      const NihHash *hash)
+{
+	nih_assert (usage != NULL);
+
+	if (! hash)
+		return;
+
+	mem_add (usage, hash);
+	mem_add (usage, hash->bins);
+}
+
+/**
+ * mem_add_buffer:
+ * @usage: usage to add to,
+ * @buffer: buffer, or NULL.
+ *
+ * Count @buffer and its contents in @usage.
+ **/
+static void
+mem_add_buffer (MemUsage          *usage,
+		const NihIoBuffer *buffer)
+{
+	nih_assert (usage != NULL);
+
+	if (! buffer)
+		return;
+
+	mem_add (usage, buffer);
+	mem_add (usage, buffer->buf);
+}
+
+/**
+ * mem_add_operator:
+ * @usage: usage to add to,
+ * @root: root of operator tree, or NULL.
+ *
+ * Count each operator of the tree under @root in @usage.
+ **/
+static void
+mem_add_operator (MemUsage      *usage,
+		  EventOperator *root)
+{
+	nih_assert (usage != NULL);
+
+	if (! root)
+		return;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		mem_add (usage, oper);
+		mem_add_string (usage, oper->name);
+		mem_add_array (usage, oper->env);
+		mem_add (usage, oper->match);
+		mem_add (usage, oper->leaves);
+	}
+}
+
+/**
+ * mem_add_blocking:
+ * @usage: usage to add to,
+ * @blocking: list of Blocked structures.
+ *
+ * Count each entry of @blocking in @usage.
+ **/
+static void
+mem_add_blocking (MemUsage *usage,
+		  NihList  *blocking)
+{
+	nih_assert (usage != NULL);
+	nih_assert (blocking != NULL);
+
+	NIH_LIST_FOREACH (blocking, iter)
+		mem_add (usage, iter);
+}
+
+/**
+ * mem_add_class:
+ * @usage: array of usage by category,
+ * @class: job class.
+ *
+ * Count @class under MEM_JOB_CLASSES and each of its instances under
+ * MEM_JOBS in @usage.
+ **/
+static void
+mem_add_class (MemUsage *usage,
+	       JobClass *class)
+{
+	MemUsage *u;
+
+	nih_assert (usage != NULL);
+	nih_assert (class != NULL);
+
+	u = &usage[MEM_JOB_CLASSES];
+
+	mem_add (u, class);
+	mem_add_string (u, class->name);
+	mem_add_string (u, class->path);
+	mem_add_string (u, class->instance);
+	mem_add_hash (u, class->instances);
+
+	if (class->instance_template) {
+		mem_add (u, class->instance_template);
+		mem_add_string (u, class->instance_template->source);
+		mem_add (u, class->instance_template->parts);
+		mem_add (u, class->instance_template->buf);
+	}
+
+	mem_add_string (u, class->description);
+	mem_add_string (u, class->author);
+	mem_add_string (u, class->version);
+	mem_add_array (u, class->env);
+	mem_add_array (u, class->export);
+	mem_add_array (u, class->base_env);
+	mem_add_operator (u, class->start_on);
+	mem_add_operator (u, class->stop_on);
+	mem_add_array (u, class->emits);
+
+	if (class->process) {
+		mem_add (u, class->process);
+
+		for (int i = 0; i < PROCESS_LAST; i++) {
+			if (! class->process[i])
+				continue;
+
+			mem_add (u, class->process[i]);
+			mem_add_string (u, class->process[i]->command);
+		}
+	}
+
+	mem_add (u, class->normalexit);
+
+	for (int i = 0; i < RLIMIT_NLIMITS; i++)
+		mem_add (u, class->limits[i]);
+
+	mem_add_string (u, class->chroot);
+	mem_add_string (u, class->chdir);
+	mem_add_string (u, class->setuid);
+	mem_add_string (u, class->setgid);
+	mem_add_string (u, class->usage);
+	mem_add_string (u, class->apparmor_switch);
+	mem_add_string (u, class->apparmor_load);
+	mem_add_array (u, class->uses);
+	mem_add (u, class->uses_amount);
+
+	if (class->instances) {
+		NIH_HASH_FOREACH (class->instances, iter)
+			mem_add_job (usage, (Job *)iter);
+	}
+}
+
+/**
+ * mem_add_job:
+ * @usage: array of usage by category,
+ * @job: job instance.
+ *
+ * Count @job under MEM_JOBS and its logs under MEM_LOGS in @usage.
+ **/
+static void
+mem_add_job (MemUsage *usage,
+	     Job      *job)
+{
+	MemUsage *u;
+
+	nih_assert (usage != NULL);
+	nih_assert (job != NULL);
+
+	u = &usage[MEM_JOBS];
+
+	mem_add (u, job);
+	mem_add_string (u, job->name);
+	mem_add_string (u, job->path);
+	mem_add_array (u, job->env);
+	mem_add_array (u, job->start_env);
+	mem_add_array (u, job->stop_env);
+	mem_add_operator (u, job->stop_on);
+	mem_add (u, job->fds);
+	mem_add (u, job->pid);
+	mem_add_blocking (u, &job->blocking);
+	mem_add (u, job->kill_timer);
+	mem_add_string (u, job->trace_cgroup);
+	mem_add (u, job->admission);
+
+	if (job->process_data) {
+		mem_add (u, job->process_data);
+
+		for (int i = 0; i < PROCESS_LAST; i++)
+			mem_add (u, job->process_data[i]);
+	}
+
+	if (job->log) {
+		mem_add (u, job->log);
+
+		for (int i = 0; i < PROCESS_LAST; i++)
+			if (job->log[i])
+				mem_add_log (usage, job->log[i]);
+	}
+}
+
+/**
+ * mem_add_log:
+ * @usage: array of usage by category,
+ * @log: job log.
+ *
+ * Count @log and the output it holds under MEM_LOGS in @usage.
+ **/
+static void
+mem_add_log (MemUsage *usage,
+	     Log      *log)
+{
+	MemUsage *u;
+
+	nih_assert (usage != NULL);
+	nih_assert (log != NULL);
+
+	u = &usage[MEM_LOGS];
+
+	mem_add (u, log);
+	mem_add_string (u, log->path);
+
+	if (log->io) {
+		mem_add (u, log->io);
+
+		if (log->io->type == NIH_IO_STREAM) {
+			mem_add_buffer (u, log->io->send_buf);
+			mem_add_buffer (u, log->io->recv_buf);
+		}
+	}
+
+	mem_add_buffer (u, log->unflushed);
+	mem_add_buffer (u, log->pending);
+	mem_add (u, log->flush_timer);
+}
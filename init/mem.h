@@ -0,0 +1,66 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_MEM_H
+#define INIT_MEM_H
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * MemCategory:
+ *
+ * Categories of the data structures of init whose memory is reported
+ * by mem_usage().
+ **/
+typedef enum mem_category {
+	MEM_JOB_CLASSES,
+	MEM_JOBS,
+	MEM_LOGS,
+	MEM_EVENTS,
+	MEM_CONF,
+	MEM_SESSIONS,
+	MEM_INTERNED,
+	MEM_CATEGORIES
+} MemCategory;
+
+/**
+ * MemUsage:
+ * @objects: number of allocated objects,
+ * @bytes: total size of those objects.
+ *
+ * Memory held by the data structures of one category.
+ **/
+typedef struct mem_usage {
+	uint64_t objects;
+	uint64_t bytes;
+} MemUsage;
+
+
+NIH_BEGIN_EXTERN
+
+void        mem_usage          (MemUsage usage[MEM_CATEGORIES]);
+
+const char *mem_category_name  (MemCategory category)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_MEM_H */
@@ -0,0 +1,661 @@
+/* upstart
+ *
+ * metrics.c - OpenMetrics exporter for init internals
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "event.h"
+#include "job_class.h"
+#include "job.h"
+#include "log.h"
+#include "state.h"
+#include "metrics.h"
+
+
+/* Prototypes for static functions */
+static void metrics_accept    (void *data, NihIoWatch *watch,
+			       NihIoEvents events);
+static void metrics_reader    (void *data, NihIo *io,
+			       const char *buf, size_t len);
+static void metrics_close     (void *data, NihIo *io);
+static void metrics_error     (void *data, NihIo *io);
+static void metrics_counter   (char **text, const char *name,
+			       const char *help, uint64_t value);
+static void metrics_gauge     (char **text, const char *name,
+			       const char *help, double value);
+static void metrics_histogram (char **text, const char *name,
+			       const char *help, const uint64_t *histogram,
+			       int usec, const uint64_t *sum);
+
+
+/**
+ * metrics_enabled:
+ *
+ * If TRUE, the init daemon serves metrics on metrics_socket().
+ **/
+int metrics_enabled = FALSE;
+
+/**
+ * metrics:
+ *
+ * Counters kept while metrics_enabled is TRUE.
+ **/
+Metrics metrics;
+
+/**
+ * metrics_methods:
+ *
+ * Hash of MetricsMethod objects counting the D-Bus method calls made to
+ * the init daemon, keyed by interface and method name.
+ **/
+NihHash *metrics_methods = NULL;
+
+
+/**
+ * metrics_socket:
+ *
+ * Returns: path of the socket metrics are served on, which may be
+ * overriden by the METRICS_SOCKET_ENV environment variable.
+ **/
+const char *
+metrics_socket (void)
+{
+	const char *path;
+
+	path = getenv (METRICS_SOCKET_ENV);
+
+	return (path && *path) ? path : METRICS_SOCKET;
+}
+
+/**
+ * metrics_init:
+ *
+ * Listen on the metrics socket, replacing any left by a previous
+ * instance of the daemon, which only root may connect to.  The socket
+ * is closed across a re-exec and opened again by the new instance.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+metrics_init (void)
+{
+	struct sockaddr_un  addr;
+	struct stat         statbuf;
+	const char         *path;
+	int                 sock;
+
+	if (! metrics_methods)
+		metrics_methods = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	path = metrics_socket ();
+
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen (path) >= sizeof (addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		nih_return_system_error (-1);
+	}
+
+	strcpy (addr.sun_path, path);
+
+	sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		nih_return_system_error (-1);
+
+	if ((lstat (path, &statbuf) == 0) && S_ISSOCK (statbuf.st_mode))
+		unlink (path);
+
+	if ((bind (sock, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+	    || (chmod (path, 0600) < 0)
+	    || (listen (sock, SOMAXCONN) < 0)) {
+		nih_error_raise_system ();
+		close (sock);
+		return -1;
+	}
+
+	if (! nih_io_add_watch (NULL, sock, NIH_IO_READ,
+				metrics_accept, NULL)) {
+		close (sock);
+		nih_return_no_memory_error (-1);
+	}
+
+	return 0;
+}
+
+/**
+ * metrics_now:
+ *
+ * Returns: monotonic time in microseconds.
+ **/
+uint64_t
+metrics_now (void)
+{
+	struct timespec now;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	return ((uint64_t)now.tv_sec * 1000000) + (now.tv_nsec / 1000);
+}
+
+/**
+ * metrics_spawned:
+ * @since: value of metrics_now() before the process was spawned.
+ *
+ * Count the time taken to spawn a job process.
+ **/
+void
+metrics_spawned (uint64_t since)
+{
+	uint64_t now;
+	uint64_t usec;
+
+	if (! metrics_enabled)
+		return;
+
+	now = metrics_now ();
+	usec = (now > since) ? now - since : 0;
+
+	event_stats_record (metrics.spawn, usec);
+	metrics.spawn_usec += usec;
+}
+
+/**
+ * metrics_method_called:
+ * @interface: D-Bus interface of method, or NULL,
+ * @member: name of method.
+ *
+ * Count a call to a D-Bus method.
+ **/
+void
+metrics_method_called (const char *interface,
+		       const char *member)
+{
+	nih_local char *name = NULL;
+	MetricsMethod  *method;
+
+	nih_assert (member != NULL);
+
+	if (! metrics_methods)
+		return;
+
+	name = NIH_MUST (nih_sprintf (NULL, "%s%s%s",
+				      interface ? interface : "",
+				      interface ? "." : "", member));
+
+	method = (MetricsMethod *)nih_hash_lookup (metrics_methods, name);
+	if (! method) {
+		method = NIH_MUST (nih_new (metrics_methods, MetricsMethod));
+		nih_list_init (&method->entry);
+		nih_alloc_set_destructor (method, nih_list_destroy);
+
+		method->name = NIH_MUST (nih_strdup (method, name));
+		method->count = 0;
+
+		nih_hash_add (metrics_methods, &method->entry);
+	}
+
+	method->count++;
+}
+
+
+/**
+ * metrics_text:
+ * @parent: parent object for new string.
+ *
+ * Format the metrics in the OpenMetrics text format.
+ *
+ * Returns: newly allocated string.
+ **/
+char *
+metrics_text (const void *parent)
+{
+	char   *text;
+	size_t  classes = 0;
+	size_t  instances = 0;
+
+	text = NIH_MUST (nih_strdup (parent, ""));
+
+	metrics_counter (&text, "upstart_events_emitted",
+			 "Events queued since startup.", event_stats.emitted);
+	metrics_histogram (&text, "upstart_event_latency_seconds",
+			   "Time from an event being queued to being finished.",
+			   event_stats.latency, TRUE, NULL);
+	metrics_histogram (&text, "upstart_event_poll_seconds",
+			   "Time taken by each pass over the event queue.",
+			   event_stats.poll, TRUE, NULL);
+	metrics_histogram (&text, "upstart_event_subscriptions_examined",
+			   "Job subscriptions examined for each event.",
+			   event_stats.examined, FALSE, NULL);
+
+	metrics_histogram (&text, "upstart_job_spawn_seconds",
+			   "Time init spent spawning each job process.",
+			   metrics.spawn, TRUE, &metrics.spawn_usec);
+	metrics_counter (&text, "upstart_job_respawns",
+			 "Job processes respawned.", metrics.respawned);
+
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		classes++;
+
+		NIH_HASH_FOREACH (class->instances, job_iter)
+			instances++;
+	}
+
+	metrics_gauge (&text, "upstart_job_classes",
+		       "Job classes loaded.", classes);
+	metrics_gauge (&text, "upstart_job_instances",
+		       "Job instances.", instances);
+
+	metrics_counter (&text, "upstart_log_written_bytes",
+			 "Bytes of job output written to logs.",
+			 metrics.log_written);
+	metrics_counter (&text, "upstart_log_dropped_bytes",
+			 "Bytes of job output discarded.",
+			 log_unflushed_dropped + metrics.log_discarded);
+
+	metrics_counter (&text, "upstart_reexecs",
+			 "Stateful re-execs of init.", metrics.reexecs);
+	metrics_gauge (&text, "upstart_reexec_duration_seconds",
+		       "Time taken by the last stateful re-exec.",
+		       metrics.reexec_usec / 1000000.0);
+
+	NIH_MUST (nih_strcat (&text, parent,
+			      "# TYPE upstart_dbus_requests counter\n"
+			      "# HELP upstart_dbus_requests D-Bus method calls.\n"));
+
+	if (metrics_methods) {
+		NIH_HASH_FOREACH (metrics_methods, iter) {
+			MetricsMethod *method = (MetricsMethod *)iter;
+
+			NIH_MUST (nih_strcat_sprintf (
+					  &text, parent,
+					  "upstart_dbus_requests_total{method=\"%s\"} %" PRIu64 "\n",
+					  method->name, method->count));
+		}
+	}
+
+	NIH_MUST (nih_strcat (&text, parent, "# EOF\n"));
+
+	return text;
+}
+
+/**
+ * metrics_counter:
+ * @text: pointer to string to append to,
+ * @name: name of metric, without the _total suffix,
+ * @help: description of metric,
+ * @value: value of metric.
+ *
+ * Append a counter to @text.
+ **/
+static void
+metrics_counter (char       **text,
+		 const char  *name,
+		 const char  *help,
+		 uint64_t     value)
+{
+	nih_assert (text != NULL);
+	nih_assert (name != NULL);
+	nih_assert (help != NULL);
+
+	NIH_MUST (nih_strcat_sprintf (text, NULL,
+				      "# TYPE %s counter\n"
+				      "# HELP %s %s\n"
+				      "%s_total %" PRIu64 "\n",
+				      name, name, help, name, value));
+}
+
+/**
+ * metrics_gauge:
+ * @text: pointer to string to append to,
+ * @name: name of metric,
+ * @help: description of metric,
+ * @value: value of metric.
+ *
+ * Append a gauge to @text.
+ **/
+static void
+metrics_gauge (char       **text,
+	       const char  *name,
+	       const char  *help,
+	       double       value)
+{
+	nih_assert (text != NULL);
+	nih_assert (name != NULL);
+	nih_assert (help != NULL);
+
+	NIH_MUST (nih_strcat_sprintf (text, NULL,
+				      "# TYPE %s gauge\n"
+				      "# HELP %s %s\n"
+				      "%s %.6f\n",
+				      name, name, help, name, value));
+}
+
+/**
+ * metrics_histogram:
+ * @text: pointer to string to append to,
+ * @name: name of metric,
+ * @help: description of metric,
+ * @histogram: array of EVENT_STATS_BUCKETS counts,
+ * @usec: TRUE if @histogram counts microseconds, given in seconds,
+ * @sum: total of the values counted, or NULL if not known.
+ *
+ * Append a histogram to @text.  Bucket n of @histogram counts values up
+ * to 2^n - 1, which is the upper bound given for it; the buckets are
+ * made cumulative.
+ **/
+static void
+metrics_histogram (char           **text,
+		   const char      *name,
+		   const char      *help,
+		   const uint64_t  *histogram,
+		   int              usec,
+		   const uint64_t  *sum)
+{
+	uint64_t count = 0;
+
+	nih_assert (text != NULL);
+	nih_assert (name != NULL);
+	nih_assert (help != NULL);
+	nih_assert (histogram != NULL);
+
+	NIH_MUST (nih_strcat_sprintf (text, NULL,
+				      "# TYPE %s histogram\n"
+				      "# HELP %s %s\n",
+				      name, name, help));
+
+	for (int i = 0; i < EVENT_STATS_BUCKETS - 1; i++) {
+		uint64_t bound = (UINT64_C (1) << i) - 1;
+
+		count += histogram[i];
+
+		if (usec) {
+			NIH_MUST (nih_strcat_sprintf (
+					  text, NULL,
+					  "%s_bucket{le=\"%.6f\"} %" PRIu64 "\n",
+					  name, bound / 1000000.0, count));
+		} else {
+			NIH_MUST (nih_strcat_sprintf (
+					  text, NULL,
+					  "%s_bucket{le=\"%" PRIu64 "\"} %" PRIu64 "\n",
+					  name, bound, count));
+		}
+	}
+
+	count += histogram[EVENT_STATS_BUCKETS - 1];
+
+	NIH_MUST (nih_strcat_sprintf (text, NULL,
+				      "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n"
+				      "%s_count %" PRIu64 "\n",
+				      name, count, name, count));
+
+	if (sum)
+		NIH_MUST (nih_strcat_sprintf (text, NULL, "%s_sum %.6f\n",
+					      name, usec ? *sum / 1000000.0
+					      : (double)*sum));
+}
+
+
+/**
+ * metrics_accept:
+ * @data: not used,
+ * @watch: watch on the metrics socket,
+ * @events: events that occurred.
+ *
+ * Accept a connection to the metrics socket, which is answered once the
+ * client has sent its request.
+ **/
+static void
+metrics_accept (void        *data,
+		NihIoWatch  *watch,
+		NihIoEvents  events)
+{
+	NihIo *io;
+	int    fd;
+
+	nih_assert (watch != NULL);
+
+	fd = accept4 (watch->fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	io = nih_io_reopen (NULL, fd, NIH_IO_STREAM,
+			    metrics_reader, metrics_close, metrics_error,
+			    NULL);
+	if (! io) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_free (err);
+
+		close (fd);
+	}
+}
+
+/**
+ * metrics_reader:
+ * @data: not used,
+ * @io: connection to client,
+ * @buf: data received,
+ * @len: length of @buf.
+ *
+ * Answer the request of a client once it ends with a blank line; an
+ * HTTP request is answered with an HTTP response, while a request of
+ * only a blank line is answered with the metrics alone.
+ **/
+static void
+metrics_reader (void       *data,
+		NihIo      *io,
+		const char *buf,
+		size_t      len)
+{
+	nih_local char *text = NULL;
+	int             plain;
+
+	nih_assert (io != NULL);
+	nih_assert (buf != NULL);
+
+	plain = ((buf[0] == '\n')
+		 || ((len >= 2) && (! strncmp (buf, "\r\n", 2))));
+
+	if ((! plain)
+	    && (! memmem (buf, len, "\n\n", 2))
+	    && (! memmem (buf, len, "\r\n\r\n", 4))) {
+		if (len > METRICS_REQUEST_MAX)
+			nih_io_close (io);
+
+		return;
+	}
+
+	/* Further data is left unread until the connection is closed */
+	io->reader = NULL;
+	nih_io_buffer_shrink (io->recv_buf, len);
+
+	text = metrics_text (NULL);
+
+	if (! plain)
+		NIH_ZERO (nih_io_printf (
+				  io, "HTTP/1.0 200 OK\r\n"
+				  "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+				  "Content-Length: %zu\r\n"
+				  "\r\n", strlen (text)));
+
+	NIH_ZERO (nih_io_write (io, text, strlen (text)));
+
+	nih_io_shutdown (io);
+}
+
+/**
+ * metrics_close:
+ * @data: not used,
+ * @io: connection to client.
+ *
+ * Called when a client closes its connection.
+ **/
+static void
+metrics_close (void  *data,
+	       NihIo *io)
+{
+	nih_assert (io != NULL);
+
+	nih_io_close (io);
+}
+
+/**
+ * metrics_error:
+ * @data: not used,
+ * @io: connection to client.
+ *
+ * Called on an error on the connection to a client, which is closed.
+ **/
+static void
+metrics_error (void  *data,
+	       NihIo *io)
+{
+	NihError *err;
+
+	nih_assert (io != NULL);
+
+	err = nih_error_get ();
+	nih_debug ("%s: %s", _("Error serving metrics"), err->message);
+	nih_free (err);
+
+	nih_io_close (io);
+}
+
+
+/**
+ * metrics_serialise:
+ *
+ * Serialise the counters of metrics that are kept across a stateful
+ * re-exec, along with the time the re-exec began.
+ *
+ * Returns: JSON-serialised counters, or NULL on error.
+ **/
+json_object *
+metrics_serialise (void)
+{
+	json_object *json;
+	Metrics     *m = &metrics;
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	if (! state_set_json_int_var_from_obj (json, m, respawned))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, m, log_written))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, m, log_discarded))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, m, reexecs))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, m, reexec_started))
+		goto error;
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * metrics_deserialise:
+ * @json: root of JSON-serialised state.
+ *
+ * Restore the counters of metrics from @json, and count the stateful
+ * re-exec that is completing along with the time it took.
+ *
+ * Returns: zero on success, -1 on error.
+ **/
+int
+metrics_deserialise (json_object *json)
+{
+	json_object *json_metrics;
+	Metrics     *m = &metrics;
+	uint64_t     now;
+
+	nih_assert (json != NULL);
+
+	/* Not present in older serialisations */
+	if (! json_object_object_get_ex (json, "metrics", &json_metrics))
+		return 0;
+
+	if (! state_check_json_type (json_metrics, object))
+		goto error;
+
+	if (! state_get_json_int_var_to_obj (json_metrics, m, respawned))
+		goto error;
+
+	if (! state_get_json_int_var_to_obj (json_metrics, m, log_written))
+		goto error;
+
+	if (! state_get_json_int_var_to_obj (json_metrics, m, log_discarded))
+		goto error;
+
+	if (! state_get_json_int_var_to_obj (json_metrics, m, reexecs))
+		goto error;
+
+	if (! state_get_json_int_var_to_obj (json_metrics, m, reexec_started))
+		goto error;
+
+	now = metrics_now ();
+
+	m->reexecs++;
+	m->reexec_usec = (now > m->reexec_started) ? now - m->reexec_started : 0;
+	m->reexec_started = 0;
+
+	return 0;
+
+error:
+	return -1;
+}
@@ -0,0 +1,131 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_METRICS_H
+#define INIT_METRICS_H
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include <json.h>
+
+#include "event.h"
+
+
+/**
+ * METRICS_SOCKET:
+ *
+ * Unix socket that metrics are served on.
+ **/
+#ifndef METRICS_SOCKET
+#define METRICS_SOCKET "/run/upstart-metrics"
+#endif
+
+/**
+ * METRICS_SOCKET_ENV:
+ *
+ * Environment variable that if set specifies an alternative socket to
+ * METRICS_SOCKET.
+ **/
+#ifndef METRICS_SOCKET_ENV
+#define METRICS_SOCKET_ENV "UPSTART_METRICS"
+#endif
+
+/**
+ * METRICS_REQUEST_MAX:
+ *
+ * Largest request read from a client before it is disconnected.
+ **/
+#define METRICS_REQUEST_MAX 8192
+
+
+/**
+ * Metrics:
+ * @spawn: histogram of microseconds spent spawning each job process,
+ * @spawn_usec: total microseconds spent spawning job processes,
+ * @respawned: number of job processes respawned,
+ * @log_written: number of bytes of job output written to logs,
+ * @log_discarded: number of bytes of job output discarded because the
+ * log filesystem was full,
+ * @reexecs: number of stateful re-execs since boot,
+ * @reexec_usec: microseconds taken by the last stateful re-exec,
+ * @reexec_started: monotonic time in microseconds that the current
+ * stateful re-exec began at, or zero.
+ *
+ * Counters served by the metrics socket in addition to event_stats; the
+ * same histogram buckets are used.
+ **/
+typedef struct metrics {
+	uint64_t spawn[EVENT_STATS_BUCKETS];
+	uint64_t spawn_usec;
+	uint64_t respawned;
+	uint64_t log_written;
+	uint64_t log_discarded;
+	uint64_t reexecs;
+	uint64_t reexec_usec;
+	uint64_t reexec_started;
+} Metrics;
+
+/**
+ * MetricsMethod:
+ * @entry: list header,
+ * @name: interface and name of method,
+ * @count: number of calls.
+ *
+ * Number of calls made to a D-Bus method, held in the metrics_methods
+ * hash.
+ **/
+typedef struct metrics_method {
+	NihList   entry;
+	char     *name;
+	uint64_t  count;
+} MetricsMethod;
+
+
+NIH_BEGIN_EXTERN
+
+extern int      metrics_enabled;
+extern Metrics  metrics;
+extern NihHash *metrics_methods;
+
+const char * metrics_socket       (void)
+	__attribute__ ((warn_unused_result));
+
+int          metrics_init         (void)
+	__attribute__ ((warn_unused_result));
+
+uint64_t     metrics_now          (void);
+
+void         metrics_spawned      (uint64_t since);
+void         metrics_method_called (const char *interface,
+				    const char *member);
+
+char *       metrics_text         (const void *parent)
+	__attribute__ ((warn_unused_result, malloc));
+
+json_object *metrics_serialise    (void)
+	__attribute__ ((warn_unused_result));
+int          metrics_deserialise  (json_object *json)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_METRICS_H */
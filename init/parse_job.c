@@ -31,6 +31,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -39,6 +40,7 @@
 #include <nih/signal.h>
 #include <nih/logging.h>
 #include <nih/error.h>
+#include <nih/errors.h>
 
 #include "process.h"
 #include "job_class.h"
@@ -46,12 +48,131 @@
 #include "parse_job.h"
 #include "errors.h"
 #include "apparmor.h"
+#include "pool.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
+#include "resource.h"
+#include "pressure.h"
+#include "system.h"
+#include "listener.h"
 #endif /* ENABLE_CGROUPS */
 
+/**
+ * PARSE_STANZA_MAX:
+ *
+ * Length of the longest stanza name.
+ **/
+#define PARSE_STANZA_MAX 16
+
+/**
+ * PARSE_ARENA_SIZE:
+ *
+ * Size of the first block of a ParseArena, which is kept on the stack;
+ * large enough for the tokens and operator stack of all but the longest
+ * event expressions.
+ **/
+#define PARSE_ARENA_SIZE 1024
+
+/**
+ * PARSE_ARENA_ALIGN:
+ *
+ * Alignment of each allocation from a ParseArena.
+ **/
+#define PARSE_ARENA_ALIGN (sizeof (void *) * 2)
+
+
+/**
+ * ParseJobStanza:
+ *
+ * Index of each stanza in the stanzas table.
+ **/
+typedef enum parse_job_stanza {
+	PARSE_STANZA_INSTANCE,
+	PARSE_STANZA_DESCRIPTION,
+	PARSE_STANZA_AUTHOR,
+	PARSE_STANZA_VERSION,
+	PARSE_STANZA_ENV,
+	PARSE_STANZA_EXPORT,
+	PARSE_STANZA_START,
+	PARSE_STANZA_STOP,
+	PARSE_STANZA_EMITS,
+	PARSE_STANZA_EXEC,
+	PARSE_STANZA_SCRIPT,
+	PARSE_STANZA_PRE_START,
+	PARSE_STANZA_POST_START,
+	PARSE_STANZA_PRE_STOP,
+	PARSE_STANZA_POST_STOP,
+	PARSE_STANZA_EXPECT,
+	PARSE_STANZA_TASK,
+	PARSE_STANZA_SHELL,
+	PARSE_STANZA_KILL,
+	PARSE_STANZA_RELOAD,
+	PARSE_STANZA_RESPAWN,
+	PARSE_STANZA_NORMAL,
+	PARSE_STANZA_CONSOLE,
+	PARSE_STANZA_UMASK,
+	PARSE_STANZA_NICE,
+	PARSE_STANZA_OOM,
+	PARSE_STANZA_LIMIT,
+	PARSE_STANZA_CHROOT,
+	PARSE_STANZA_CHDIR,
+	PARSE_STANZA_SETUID,
+	PARSE_STANZA_SETGID,
+	PARSE_STANZA_DEBUG,
+	PARSE_STANZA_MANUAL,
+	PARSE_STANZA_USAGE,
+	PARSE_STANZA_USES,
+	PARSE_STANZA_PRIORITY,
+	PARSE_STANZA_PRESSURE,
+	PARSE_STANZA_POOL,
+	PARSE_STANZA_CPUS,
+	PARSE_STANZA_NUMA_NODE,
+	PARSE_STANZA_SPREAD_INSTANCES,
+	PARSE_STANZA_SOCKET,
+	PARSE_STANZA_APPARMOR,
+	PARSE_STANZA_CGROUP,
+
+	PARSE_STANZA_LAST
+} ParseJobStanza;
+
+/**
+ * ParseArena:
+ * @block: block being allocated from,
+ * @size: size of @block,
+ * @used: number of bytes of @block allocated,
+ * @blocks: parent of further blocks once @initial is used up,
+ * @initial: first block.
+ *
+ * Allocations made while parsing an event expression that do not outlive
+ * it, such as the tokens and the operator stack, are taken from the end
+ * of @block and all freed together by parse_arena_free() rather than
+ * each allocated and freed with nih_alloc().
+ **/
+typedef struct parse_arena {
+	char   *block;
+	size_t  size;
+	size_t  used;
+	void   *blocks;
+	char    initial[PARSE_ARENA_SIZE]
+		__attribute__ ((aligned (sizeof (void *) * 2)));
+} ParseArena;
+
+
 /* Prototypes for static functions */
+static NihConfigStanza *parse_job_stanza_lookup (const char *name, size_t len);
+static int            parse_job_stanzas (JobClass *class,
+					 const char *file, size_t len,
+					 size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int            parse_job_stanza  (JobClass *class,
+					 const char *file, size_t len,
+					 size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static void           parse_arena_init  (ParseArena *arena);
+static void          *parse_arena_alloc (ParseArena *arena, size_t size)
+	__attribute__ ((warn_unused_result));
+static void           parse_arena_free  (ParseArena *arena);
 static int            parse_exec        (Process *process,
 					 NihConfigStanza *stanza,
 					 const char *file, size_t len,
@@ -72,16 +193,26 @@ static EventOperator *parse_on          (JobClass *class,
 					 const char *file, size_t len,
 					 size_t *pos, size_t *lineno)
 	__attribute__ ((warn_unused_result));
+static char          *parse_on_token    (ParseArena *arena,
+					 const char *file, size_t len,
+					 size_t *pos, size_t *lineno,
+					 int dequote)
+	__attribute__ ((warn_unused_result));
+static int            parse_on_push     (ParseArena *arena, NihList *stack,
+					 EventOperator *oper)
+	__attribute__ ((warn_unused_result));
 static int            parse_on_operator (JobClass *class,
 					 NihConfigStanza *stanza,
 					 const char *file, size_t len,
 					 size_t *pos, size_t *lineno,
+					 ParseArena *arena,
 					 NihList *stack, EventOperator **root)
 	__attribute__ ((warn_unused_result));
 static int            parse_on_paren    (JobClass *class,
 					 NihConfigStanza *stanza,
 					 const char *file, size_t len,
 					 size_t *pos, size_t *lineno,
+					 ParseArena *arena,
 					 NihList *stack, EventOperator **root,
 					 size_t *paren)
 	__attribute__ ((warn_unused_result));
@@ -89,6 +220,7 @@ static int            parse_on_operand  (JobClass *class,
 					 NihConfigStanza *stanza,
 					 const char *file, size_t len,
 					 size_t *pos, size_t *lineno,
+					 ParseArena *arena,
 					 NihList *stack, EventOperator **root)
 	__attribute__ ((warn_unused_result));
 static int            parse_on_collect  (JobClass *class,
@@ -168,6 +300,10 @@ static int stanza_task        (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
 			       size_t *pos, size_t *lineno)
 	__attribute__ ((warn_unused_result));
+static int stanza_shell       (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
 
 static int stanza_kill        (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
@@ -242,6 +378,38 @@ static int stanza_usage       (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
 			       size_t *pos, size_t *lineno)
 	__attribute__ ((warn_unused_result));
+static int stanza_uses        (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_priority    (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_pressure    (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_pool        (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_cpus        (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_numa_node   (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_spread_instances (JobClass *class, NihConfigStanza *stanza,
+				    const char *file, size_t len,
+				    size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
+static int stanza_socket      (JobClass *class, NihConfigStanza *stanza,
+			       const char *file, size_t len,
+			       size_t *pos, size_t *lineno)
+	__attribute__ ((warn_unused_result));
 
 static int stanza_cgroup      (JobClass *class, NihConfigStanza *stanza,
 			       const char *file, size_t len,
@@ -262,6 +430,29 @@ static int parse_cgroup       (JobClass        *class,
  **/
 int debug_stanza_enabled = FALSE;
 
+/**
+ * parse_profile_enabled:
+ *
+ * If TRUE, measure the time taken and allocations made parsing each
+ * configuration file and each kind of job stanza.
+ **/
+int parse_profile_enabled = FALSE;
+
+/**
+ * parse_profile_files:
+ *
+ * Cost of parsing configuration files since the last report.
+ **/
+static ParseProfile parse_profile_files = { 0, 0, 0 };
+
+/**
+ * parse_profile_stanzas:
+ *
+ * Cost of parsing each kind of job stanza since the last report, indexed
+ * as the stanzas table.
+ **/
+static ParseProfile parse_profile_stanzas[PARSE_STANZA_LAST];
+
 /**
  * stanzas:
  *
@@ -269,43 +460,52 @@ int debug_stanza_enabled = FALSE;
  * that handle parsing them.
  **/
 static NihConfigStanza stanzas[] = {
-	{ "instance",    (NihConfigHandler)stanza_instance    },
-	{ "description", (NihConfigHandler)stanza_description },
-	{ "author",      (NihConfigHandler)stanza_author      },
-	{ "version",     (NihConfigHandler)stanza_version     },
-	{ "env",         (NihConfigHandler)stanza_env         },
-	{ "export",      (NihConfigHandler)stanza_export      },
-	{ "start",       (NihConfigHandler)stanza_start       },
-	{ "stop",        (NihConfigHandler)stanza_stop        },
-	{ "emits",       (NihConfigHandler)stanza_emits       },
-	{ "exec",        (NihConfigHandler)stanza_exec        },
-	{ "script",      (NihConfigHandler)stanza_script      },
-	{ "pre-start",   (NihConfigHandler)stanza_pre_start   },
-	{ "post-start",  (NihConfigHandler)stanza_post_start  },
-	{ "pre-stop",    (NihConfigHandler)stanza_pre_stop    },
-	{ "post-stop",   (NihConfigHandler)stanza_post_stop   },
-	{ "expect",      (NihConfigHandler)stanza_expect      },
-	{ "task",        (NihConfigHandler)stanza_task        },
-	{ "kill",        (NihConfigHandler)stanza_kill        },
-	{ "reload",      (NihConfigHandler)stanza_reload      },
-	{ "respawn",     (NihConfigHandler)stanza_respawn     },
-	{ "normal",      (NihConfigHandler)stanza_normal      },
-	{ "console",     (NihConfigHandler)stanza_console     },
-	{ "umask",       (NihConfigHandler)stanza_umask       },
-	{ "nice",        (NihConfigHandler)stanza_nice        },
-	{ "oom",         (NihConfigHandler)stanza_oom         },
-	{ "limit",       (NihConfigHandler)stanza_limit       },
-	{ "chroot",      (NihConfigHandler)stanza_chroot      },
-	{ "chdir",       (NihConfigHandler)stanza_chdir       },
-	{ "setuid",      (NihConfigHandler)stanza_setuid      },
-	{ "setgid",      (NihConfigHandler)stanza_setgid      },
-	{ "debug",       (NihConfigHandler)stanza_debug       },
-	{ "manual",      (NihConfigHandler)stanza_manual      },
-	{ "usage",       (NihConfigHandler)stanza_usage       },
-	{ "apparmor",    (NihConfigHandler)stanza_apparmor    },
-	{ "cgroup",      (NihConfigHandler)stanza_cgroup      },
-
-	NIH_CONFIG_LAST
+	[PARSE_STANZA_INSTANCE]         = { "instance",         (NihConfigHandler)stanza_instance },
+	[PARSE_STANZA_DESCRIPTION]      = { "description",      (NihConfigHandler)stanza_description },
+	[PARSE_STANZA_AUTHOR]           = { "author",           (NihConfigHandler)stanza_author },
+	[PARSE_STANZA_VERSION]          = { "version",          (NihConfigHandler)stanza_version },
+	[PARSE_STANZA_ENV]              = { "env",              (NihConfigHandler)stanza_env },
+	[PARSE_STANZA_EXPORT]           = { "export",           (NihConfigHandler)stanza_export },
+	[PARSE_STANZA_START]            = { "start",            (NihConfigHandler)stanza_start },
+	[PARSE_STANZA_STOP]             = { "stop",             (NihConfigHandler)stanza_stop },
+	[PARSE_STANZA_EMITS]            = { "emits",            (NihConfigHandler)stanza_emits },
+	[PARSE_STANZA_EXEC]             = { "exec",             (NihConfigHandler)stanza_exec },
+	[PARSE_STANZA_SCRIPT]           = { "script",           (NihConfigHandler)stanza_script },
+	[PARSE_STANZA_PRE_START]        = { "pre-start",        (NihConfigHandler)stanza_pre_start },
+	[PARSE_STANZA_POST_START]       = { "post-start",       (NihConfigHandler)stanza_post_start },
+	[PARSE_STANZA_PRE_STOP]         = { "pre-stop",         (NihConfigHandler)stanza_pre_stop },
+	[PARSE_STANZA_POST_STOP]        = { "post-stop",        (NihConfigHandler)stanza_post_stop },
+	[PARSE_STANZA_EXPECT]           = { "expect",           (NihConfigHandler)stanza_expect },
+	[PARSE_STANZA_TASK]             = { "task",             (NihConfigHandler)stanza_task },
+	[PARSE_STANZA_SHELL]            = { "shell",            (NihConfigHandler)stanza_shell },
+	[PARSE_STANZA_KILL]             = { "kill",             (NihConfigHandler)stanza_kill },
+	[PARSE_STANZA_RELOAD]           = { "reload",           (NihConfigHandler)stanza_reload },
+	[PARSE_STANZA_RESPAWN]          = { "respawn",          (NihConfigHandler)stanza_respawn },
+	[PARSE_STANZA_NORMAL]           = { "normal",           (NihConfigHandler)stanza_normal },
+	[PARSE_STANZA_CONSOLE]          = { "console",          (NihConfigHandler)stanza_console },
+	[PARSE_STANZA_UMASK]            = { "umask",            (NihConfigHandler)stanza_umask },
+	[PARSE_STANZA_NICE]             = { "nice",             (NihConfigHandler)stanza_nice },
+	[PARSE_STANZA_OOM]              = { "oom",              (NihConfigHandler)stanza_oom },
+	[PARSE_STANZA_LIMIT]            = { "limit",            (NihConfigHandler)stanza_limit },
+	[PARSE_STANZA_CHROOT]           = { "chroot",           (NihConfigHandler)stanza_chroot },
+	[PARSE_STANZA_CHDIR]            = { "chdir",            (NihConfigHandler)stanza_chdir },
+	[PARSE_STANZA_SETUID]           = { "setuid",           (NihConfigHandler)stanza_setuid },
+	[PARSE_STANZA_SETGID]           = { "setgid",           (NihConfigHandler)stanza_setgid },
+	[PARSE_STANZA_DEBUG]            = { "debug",            (NihConfigHandler)stanza_debug },
+	[PARSE_STANZA_MANUAL]           = { "manual",           (NihConfigHandler)stanza_manual },
+	[PARSE_STANZA_USAGE]            = { "usage",            (NihConfigHandler)stanza_usage },
+	[PARSE_STANZA_USES]             = { "uses",             (NihConfigHandler)stanza_uses },
+	[PARSE_STANZA_PRIORITY]         = { "priority",         (NihConfigHandler)stanza_priority },
+	[PARSE_STANZA_PRESSURE]         = { "pressure",         (NihConfigHandler)stanza_pressure },
+	[PARSE_STANZA_POOL]             = { "pool",             (NihConfigHandler)stanza_pool },
+	[PARSE_STANZA_CPUS]             = { "cpus",             (NihConfigHandler)stanza_cpus },
+	[PARSE_STANZA_NUMA_NODE]        = { "numa-node",        (NihConfigHandler)stanza_numa_node },
+	[PARSE_STANZA_SPREAD_INSTANCES] = { "spread-instances", (NihConfigHandler)stanza_spread_instances },
+	[PARSE_STANZA_SOCKET]           = { "socket",           (NihConfigHandler)stanza_socket },
+	[PARSE_STANZA_APPARMOR]         = { "apparmor",         (NihConfigHandler)stanza_apparmor },
+	[PARSE_STANZA_CGROUP]           = { "cgroup",           (NihConfigHandler)stanza_cgroup },
+
+	[PARSE_STANZA_LAST] = NIH_CONFIG_LAST
 };
 
 
@@ -360,8 +560,7 @@ parse_job (const void *parent,
 			nih_return_system_error (NULL);
 	}
 
-	if (nih_config_parse_file (file, len, pos, lineno,
-				stanzas, class) < 0) {
+	if (parse_job_stanzas (class, file, len, pos, lineno) < 0) {
 		if (!update)
 			nih_free (class);
 		return NULL;
@@ -371,6 +570,465 @@ parse_job (const void *parent,
 }
 
 
+/**
+ * parse_job_stanzas:
+ * @class: job class being parsed,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * This function is used to parse the sequence of stanzas in @file into
+ * @class.  Whitespace, comments and blank lines are skipped exactly as
+ * nih_config_parse_file() would with the stanzas table; only the lookup
+ * of each stanza differs, see parse_job_stanza().
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_job_stanzas (JobClass   *class,
+		   const char *file,
+		   size_t      len,
+		   size_t     *pos,
+		   size_t     *lineno)
+{
+	size_t p;
+	int    ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	p = *pos;
+
+	while (p < len) {
+		/* Skip initial whitespace */
+		while ((p < len) && strchr (NIH_CONFIG_WS, file[p]))
+			p++;
+
+		/* Skip over comment or end of line */
+		if (nih_config_skip_comment (file, len, &p, lineno) == 0)
+			continue;
+
+		/* Must have a stanza, parse it */
+		if (parse_job_stanza (class, file, len, &p, lineno) < 0)
+			goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	*pos = p;
+
+	return ret;
+}
+
+/**
+ * parse_job_stanza:
+ * @class: job class being parsed,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * This function is used to parse a single stanza from @file, calling its
+ * handler from the stanzas table.  Unlike nih_config_parse_stanza(), the
+ * stanza name is looked up where it lies in @file rather than being
+ * copied and compared against every entry in turn; it is only copied,
+ * onto the stack, if it contains an escape.
+ *
+ * When parse_profile_enabled is TRUE, the time taken and allocations
+ * made by the handler are added to parse_profile_stanzas.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_job_stanza (JobClass   *class,
+		  const char *file,
+		  size_t      len,
+		  size_t     *pos,
+		  size_t     *lineno)
+{
+	NihConfigStanza *stanza = NULL;
+	char             name[PARSE_STANZA_MAX + 1];
+	size_t           p, name_pos, name_end, name_len;
+	uint64_t         started = 0;
+	uint64_t         allocs = 0;
+	int              ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	p = name_pos = *pos;
+
+	/* Find the extent of the stanza name without copying it */
+	if (nih_config_token (file, len, &p, lineno, NULL,
+			      NIH_CONFIG_CNLWS, FALSE, &name_len) < 0)
+		goto finish;
+
+	name_end = p;
+	if (! name_len) {
+		nih_error_raise (NIH_CONFIG_EXPECTED_TOKEN,
+				 _(NIH_CONFIG_EXPECTED_TOKEN_STR));
+		goto finish;
+	}
+
+	nih_config_skip_whitespace (file, len, &p, lineno);
+
+	if (name_end - name_pos == name_len) {
+		stanza = parse_job_stanza_lookup (file + name_pos, name_len);
+	} else if (name_len <= PARSE_STANZA_MAX) {
+		if (nih_config_token (file + name_pos, name_end - name_pos,
+				      NULL, NULL, name, NIH_CONFIG_CNLWS,
+				      FALSE, NULL) < 0)
+			goto finish;
+
+		stanza = parse_job_stanza_lookup (name, name_len);
+	}
+
+	if (! stanza) {
+		nih_error_raise (NIH_CONFIG_UNKNOWN_STANZA,
+				 _(NIH_CONFIG_UNKNOWN_STANZA_STR));
+		goto finish;
+	}
+
+	if (parse_profile_enabled) {
+		started = parse_profile_now ();
+		allocs = pool_stats.allocs;
+	}
+
+	ret = stanza->handler (class, stanza, file, len, &p, lineno);
+
+	if (parse_profile_enabled) {
+		ParseProfile *profile = &parse_profile_stanzas[stanza - stanzas];
+
+		profile->count++;
+		profile->usec += parse_profile_now () - started;
+		profile->allocs += pool_stats.allocs - allocs;
+	}
+
+finish:
+	*pos = p;
+
+	return ret;
+}
+
+/**
+ * PARSE_STANZA_IS:
+ * @_name: stanza name.
+ *
+ * Compares the @len bytes at @name with @_name in parse_job_stanza_lookup().
+ **/
+#define PARSE_STANZA_IS(_name) \
+	((len == sizeof (_name) - 1) && (! memcmp (name, _name, len)))
+
+/**
+ * parse_job_stanza_lookup:
+ * @name: stanza name, not necessarily terminated,
+ * @len: length of @name.
+ *
+ * Look up @name in the stanzas table, switching on its first character
+ * so that at most a handful of names are compared against it.
+ *
+ * Returns: entry in stanzas table, or NULL if @name is not a stanza.
+ **/
+static NihConfigStanza *
+parse_job_stanza_lookup (const char *name,
+			 size_t      len)
+{
+	ParseJobStanza found;
+
+	nih_assert (name != NULL);
+	nih_assert (len > 0);
+
+	switch (name[0]) {
+	case 'a':
+		if (PARSE_STANZA_IS ("author")) {
+			found = PARSE_STANZA_AUTHOR;
+		} else if (PARSE_STANZA_IS ("apparmor")) {
+			found = PARSE_STANZA_APPARMOR;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'c':
+		if (PARSE_STANZA_IS ("console")) {
+			found = PARSE_STANZA_CONSOLE;
+		} else if (PARSE_STANZA_IS ("chroot")) {
+			found = PARSE_STANZA_CHROOT;
+		} else if (PARSE_STANZA_IS ("chdir")) {
+			found = PARSE_STANZA_CHDIR;
+		} else if (PARSE_STANZA_IS ("cpus")) {
+			found = PARSE_STANZA_CPUS;
+		} else if (PARSE_STANZA_IS ("cgroup")) {
+			found = PARSE_STANZA_CGROUP;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'd':
+		if (PARSE_STANZA_IS ("description")) {
+			found = PARSE_STANZA_DESCRIPTION;
+		} else if (PARSE_STANZA_IS ("debug")) {
+			found = PARSE_STANZA_DEBUG;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'e':
+		if (PARSE_STANZA_IS ("exec")) {
+			found = PARSE_STANZA_EXEC;
+		} else if (PARSE_STANZA_IS ("env")) {
+			found = PARSE_STANZA_ENV;
+		} else if (PARSE_STANZA_IS ("expect")) {
+			found = PARSE_STANZA_EXPECT;
+		} else if (PARSE_STANZA_IS ("export")) {
+			found = PARSE_STANZA_EXPORT;
+		} else if (PARSE_STANZA_IS ("emits")) {
+			found = PARSE_STANZA_EMITS;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'i':
+		if (PARSE_STANZA_IS ("instance")) {
+			found = PARSE_STANZA_INSTANCE;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'k':
+		if (PARSE_STANZA_IS ("kill")) {
+			found = PARSE_STANZA_KILL;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'l':
+		if (PARSE_STANZA_IS ("limit")) {
+			found = PARSE_STANZA_LIMIT;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'm':
+		if (PARSE_STANZA_IS ("manual")) {
+			found = PARSE_STANZA_MANUAL;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'n':
+		if (PARSE_STANZA_IS ("normal")) {
+			found = PARSE_STANZA_NORMAL;
+		} else if (PARSE_STANZA_IS ("nice")) {
+			found = PARSE_STANZA_NICE;
+		} else if (PARSE_STANZA_IS ("numa-node")) {
+			found = PARSE_STANZA_NUMA_NODE;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'o':
+		if (PARSE_STANZA_IS ("oom")) {
+			found = PARSE_STANZA_OOM;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'p':
+		if (PARSE_STANZA_IS ("pre-start")) {
+			found = PARSE_STANZA_PRE_START;
+		} else if (PARSE_STANZA_IS ("post-start")) {
+			found = PARSE_STANZA_POST_START;
+		} else if (PARSE_STANZA_IS ("pre-stop")) {
+			found = PARSE_STANZA_PRE_STOP;
+		} else if (PARSE_STANZA_IS ("post-stop")) {
+			found = PARSE_STANZA_POST_STOP;
+		} else if (PARSE_STANZA_IS ("priority")) {
+			found = PARSE_STANZA_PRIORITY;
+		} else if (PARSE_STANZA_IS ("pressure")) {
+			found = PARSE_STANZA_PRESSURE;
+		} else if (PARSE_STANZA_IS ("pool")) {
+			found = PARSE_STANZA_POOL;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'r':
+		if (PARSE_STANZA_IS ("respawn")) {
+			found = PARSE_STANZA_RESPAWN;
+		} else if (PARSE_STANZA_IS ("reload")) {
+			found = PARSE_STANZA_RELOAD;
+		} else {
+			return NULL;
+		}
+		break;
+	case 's':
+		if (PARSE_STANZA_IS ("start")) {
+			found = PARSE_STANZA_START;
+		} else if (PARSE_STANZA_IS ("stop")) {
+			found = PARSE_STANZA_STOP;
+		} else if (PARSE_STANZA_IS ("script")) {
+			found = PARSE_STANZA_SCRIPT;
+		} else if (PARSE_STANZA_IS ("setuid")) {
+			found = PARSE_STANZA_SETUID;
+		} else if (PARSE_STANZA_IS ("setgid")) {
+			found = PARSE_STANZA_SETGID;
+		} else if (PARSE_STANZA_IS ("shell")) {
+			found = PARSE_STANZA_SHELL;
+		} else if (PARSE_STANZA_IS ("socket")) {
+			found = PARSE_STANZA_SOCKET;
+		} else if (PARSE_STANZA_IS ("spread-instances")) {
+			found = PARSE_STANZA_SPREAD_INSTANCES;
+		} else {
+			return NULL;
+		}
+		break;
+	case 't':
+		if (PARSE_STANZA_IS ("task")) {
+			found = PARSE_STANZA_TASK;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'u':
+		if (PARSE_STANZA_IS ("umask")) {
+			found = PARSE_STANZA_UMASK;
+		} else if (PARSE_STANZA_IS ("usage")) {
+			found = PARSE_STANZA_USAGE;
+		} else if (PARSE_STANZA_IS ("uses")) {
+			found = PARSE_STANZA_USES;
+		} else {
+			return NULL;
+		}
+		break;
+	case 'v':
+		if (PARSE_STANZA_IS ("version")) {
+			found = PARSE_STANZA_VERSION;
+		} else {
+			return NULL;
+		}
+		break;
+	default:
+		return NULL;
+	}
+
+	return &stanzas[found];
+}
+
+#undef PARSE_STANZA_IS
+
+
+/**
+ * parse_profile_now:
+ *
+ * Returns: monotonic time in microseconds, for measuring parse times.
+ **/
+uint64_t
+parse_profile_now (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * parse_profile_file:
+ * @path: path of configuration file,
+ * @started: value of parse_profile_now() before parsing began,
+ * @allocs: value of pool_stats.allocs before parsing began.
+ *
+ * Log the time taken and allocations made parsing @path, and add them to
+ * the totals given by the next parse_profile_report().
+ **/
+void
+parse_profile_file (const char *path,
+		    uint64_t    started,
+		    uint64_t    allocs)
+{
+	uint64_t usec;
+
+	nih_assert (path != NULL);
+
+	usec = parse_profile_now () - started;
+	allocs = pool_stats.allocs - allocs;
+
+	parse_profile_files.count++;
+	parse_profile_files.usec += usec;
+	parse_profile_files.allocs += allocs;
+
+	nih_message (_("%s: parsed in %llu us with %llu allocations"),
+		     path, (unsigned long long)usec,
+		     (unsigned long long)allocs);
+}
+
+/**
+ * parse_profile_compar:
+ * @a: index of stanza,
+ * @b: index of stanza.
+ *
+ * Compare the time spent parsing two kinds of stanza for qsort(), so
+ * that the most costly is sorted first.
+ *
+ * Returns: negative, zero or positive value.
+ **/
+static int
+parse_profile_compar (const void *a,
+		      const void *b)
+{
+	const ParseProfile *pa = &parse_profile_stanzas[*(const size_t *)a];
+	const ParseProfile *pb = &parse_profile_stanzas[*(const size_t *)b];
+
+	return (pb->usec > pa->usec) - (pb->usec < pa->usec);
+}
+
+/**
+ * parse_profile_report:
+ *
+ * Log the total time taken and allocations made parsing configuration
+ * files since the last report, followed by the same for each kind of
+ * job stanza, most costly first, then reset the counts.
+ **/
+void
+parse_profile_report (void)
+{
+	size_t order[PARSE_STANZA_LAST];
+
+	nih_message (_("Parsed %llu configuration files in %llu us "
+		       "with %llu allocations"),
+		     (unsigned long long)parse_profile_files.count,
+		     (unsigned long long)parse_profile_files.usec,
+		     (unsigned long long)parse_profile_files.allocs);
+
+	for (size_t i = 0; i < PARSE_STANZA_LAST; i++)
+		order[i] = i;
+
+	qsort (order, PARSE_STANZA_LAST, sizeof (size_t),
+	       parse_profile_compar);
+
+	for (size_t i = 0; i < PARSE_STANZA_LAST; i++) {
+		ParseProfile *profile = &parse_profile_stanzas[order[i]];
+
+		if (! profile->count)
+			continue;
+
+		nih_message (_("Parsed %llu %s stanzas in %llu us "
+			       "with %llu allocations"),
+			     (unsigned long long)profile->count,
+			     stanzas[order[i]].name,
+			     (unsigned long long)profile->usec,
+			     (unsigned long long)profile->allocs);
+	}
+
+	memset (&parse_profile_files, 0, sizeof (parse_profile_files));
+	memset (parse_profile_stanzas, 0, sizeof (parse_profile_stanzas));
+}
+
+
 /**
  * parse_exec:
  * @process: process being parsed.
@@ -410,6 +1068,7 @@ parse_exec (Process         *process,
 		nih_unref (process->command, process);
 
 	process->script = FALSE;
+	process->simple = FALSE;
 	process->command = nih_config_parse_command (process, file, len,
 						     pos, lineno);
 
@@ -432,6 +1091,9 @@ parse_exec (Process         *process,
  * stanza from @file.  A block terminated with "end script" is expected to
  * follow, and will be stored in the command for the job.
  *
+ * The script is also checked to see whether it could be run without a
+ * shell, for jobs which request that with the shell stanza.
+ *
  * The Process for this to be parsed into should have already been
  * allocated.
  *
@@ -445,6 +1107,8 @@ parse_script (Process         *process,
 	      size_t          *pos,
 	      size_t          *lineno)
 {
+	nih_local char *cmd = NULL;
+
 	nih_assert (process != NULL);
 	nih_assert (stanza != NULL);
 	nih_assert (file != NULL);
@@ -457,12 +1121,16 @@ parse_script (Process         *process,
 		nih_unref (process->command, process);
 
 	process->script = TRUE;
+	process->simple = FALSE;
 	process->command = nih_config_parse_block (process, file, len,
 						   pos, lineno, "script");
 
 	if (! process->command)
 		return -1;
 
+	cmd = process_script_command (NULL, process->command);
+	process->simple = cmd != NULL;
+
 	return 0;
 }
 
@@ -537,7 +1205,87 @@ finish:
 
 
 /**
- * parse_on:
+ * parse_arena_init:
+ * @arena: arena to initialise.
+ *
+ * Initialise @arena to allocate from its first block.
+ **/
+static void
+parse_arena_init (ParseArena *arena)
+{
+	nih_assert (arena != NULL);
+
+	arena->block = arena->initial;
+	arena->size = sizeof (arena->initial);
+	arena->used = 0;
+	arena->blocks = NULL;
+}
+
+/**
+ * parse_arena_alloc:
+ * @arena: arena to allocate from,
+ * @size: size of block to allocate.
+ *
+ * Allocate @size bytes from @arena, moving on to a new block allocated
+ * with nih_alloc() once the current one is used up.  The returned
+ * pointer is valid until parse_arena_free() is called.
+ *
+ * Returns: newly allocated block or NULL if insufficient memory.
+ **/
+static void *
+parse_arena_alloc (ParseArena *arena,
+		   size_t      size)
+{
+	void *ptr;
+
+	nih_assert (arena != NULL);
+
+	size = (size + PARSE_ARENA_ALIGN - 1) & ~(PARSE_ARENA_ALIGN - 1);
+
+	if (arena->size - arena->used < size) {
+		size_t  block_size = nih_max (size, (size_t)PARSE_ARENA_SIZE);
+		char   *block;
+
+		if (! arena->blocks) {
+			arena->blocks = nih_new (NULL, char);
+			if (! arena->blocks)
+				return NULL;
+		}
+
+		block = nih_alloc (arena->blocks, block_size);
+		if (! block)
+			return NULL;
+
+		arena->block = block;
+		arena->size = block_size;
+		arena->used = 0;
+	}
+
+	ptr = arena->block + arena->used;
+	arena->used += size;
+
+	return ptr;
+}
+
+/**
+ * parse_arena_free:
+ * @arena: arena to free.
+ *
+ * Free every block allocated from @arena at once.
+ **/
+static void
+parse_arena_free (ParseArena *arena)
+{
+	nih_assert (arena != NULL);
+
+	if (arena->blocks)
+		nih_free (arena->blocks);
+
+	parse_arena_init (arena);
+}
+
+/**
+ * parse_on:
  * @class: job class being parsed,
  * @stanza: stanza found,
  * @file: file or string to parse,
@@ -562,6 +1310,7 @@ parse_on (JobClass        *class,
 	  size_t          *pos,
 	  size_t          *lineno)
 {
+	ParseArena     arena;
 	NihList        stack;
 	EventOperator *root = NULL;
 	size_t         on_pos, on_lineno, paren = 0;
@@ -571,6 +1320,7 @@ parse_on (JobClass        *class,
 	nih_assert (file != NULL);
 	nih_assert (pos != NULL);
 
+	parse_arena_init (&arena);
 	nih_list_init (&stack);
 
 	on_pos = *pos;
@@ -597,7 +1347,7 @@ parse_on (JobClass        *class,
 			if ((*pos < len) && strchr ("()", file[*pos])) {
 				if (parse_on_paren (class, stanza, file, len,
 						    &on_pos, &on_lineno,
-						    &stack, &root,
+						    &arena, &stack, &root,
 						    &paren) < 0) {
 					root = NULL;
 					goto finish;
@@ -610,7 +1360,7 @@ parse_on (JobClass        *class,
 			 */
 			} else if (parse_on_operator (class, stanza, file, len,
 						      &on_pos, &on_lineno,
-						      &stack, &root) < 0) {
+						      &arena, &stack, &root) < 0) {
 				root = NULL;
 				goto finish;
 			}
@@ -629,6 +1379,7 @@ parse_on (JobClass        *class,
 	 */
 	if (parse_on_collect (class, &stack, &root) < 0) {
 		nih_list_remove (&stack);
+		parse_arena_free (&arena);
 		return NULL;
 	}
 
@@ -643,12 +1394,21 @@ parse_on (JobClass        *class,
 		goto finish;
 	}
 
+	/* Flatten the finished tree so that events can be matched against
+	 * its leaves without walking it.
+	 */
+	if (event_operator_compile_tree (root) < 0) {
+		root = NULL;
+		goto finish;
+	}
+
 
 finish:
-	/* Remove the stack pointer from the list of items, otherwise we'll
-	 * return it and we'll try and access it when freed.
+	/* Remove the stack pointer from the list of items, which are
+	 * freed along with the arena.
 	 */
 	nih_list_remove (&stack);
+	parse_arena_free (&arena);
 
 	*pos = on_pos;
 	if (lineno)
@@ -683,13 +1443,7 @@ parse_on_simple (JobClass *class, const char *stanza_name, const char *string)
 	nih_assert (string);
 
 	/* Find the appropriate config stanza */
-	for (NihConfigStanza *s = stanzas; s->name; s++) {
-		if (! strcmp (stanza_name, s->name)) {
-			stanza = s;
-			break;
-		}
-	}
-
+	stanza = parse_job_stanza_lookup (stanza_name, strlen (stanza_name));
 	nih_assert (stanza);
 
 	len = strlen (string);
@@ -707,6 +1461,7 @@ parse_on_simple (JobClass *class, const char *stanza_name, const char *string)
  * @len: length of @file,
  * @pos: offset within @file,
  * @lineno: line number,
+ * @arena: arena for tokens and stack items,
  * @stack: input operator stack,
  * @root: output operator.
  *
@@ -726,20 +1481,21 @@ parse_on_operator (JobClass         *class,
 		   size_t            len,
 		   size_t           *pos,
 		   size_t           *lineno,
+		   ParseArena       *arena,
 		   NihList          *stack,
 		   EventOperator   **root)
 {
 	size_t             a_pos, a_lineno;
-	nih_local char    *arg = NULL;
+	char              *arg;
 	EventOperatorType  type;
 	EventOperator     *oper;
-	NihListEntry      *item;
 	int                ret = -1;
 
 	nih_assert (class != NULL);
 	nih_assert (stanza != NULL);
 	nih_assert (file != NULL);
 	nih_assert (pos != NULL);
+	nih_assert (arena != NULL);
 	nih_assert (stack != NULL);
 	nih_assert (root != NULL);
 
@@ -750,8 +1506,7 @@ parse_on_operator (JobClass         *class,
 	a_pos = *pos;
 	a_lineno = (lineno ? *lineno : 1);
 
-	arg = nih_config_next_token (NULL, file, len, &a_pos, &a_lineno,
-				     "()" NIH_CONFIG_CNLWS, FALSE);
+	arg = parse_on_token (arena, file, len, &a_pos, &a_lineno, FALSE);
 	if (! arg)
 		goto finish;
 
@@ -764,7 +1519,7 @@ parse_on_operator (JobClass         *class,
 		type = EVENT_OR;
 	} else {
 		return parse_on_operand (class, stanza, file, len, pos, lineno,
-					 stack, root);
+					 arena, stack, root);
 	}
 
 	/* Before we push the new operator onto the stack, we need to collect
@@ -787,12 +1542,8 @@ parse_on_operator (JobClass         *class,
 	*root = NULL;
 
 	/* Push the new operator onto the stack */
-	item = nih_list_entry_new (class);
-	if (! item)
-		nih_return_system_error (-1);
-
-	item->data = oper;
-	nih_list_add_after (stack, &item->entry);
+	if (parse_on_push (arena, stack, oper) < 0)
+		return -1;
 
 	ret = 0;
 
@@ -812,6 +1563,7 @@ finish:
  * @len: length of @file,
  * @pos: offset within @file,
  * @lineno: line number,
+ * @arena: arena for stack items,
  * @stack: input operator stack,
  * @root: output operator,
  * @paren: number of nested parentheses.
@@ -840,6 +1592,7 @@ parse_on_paren (JobClass         *class,
 		size_t            len,
 		size_t           *pos,
 		size_t           *lineno,
+		ParseArena       *arena,
 		NihList          *stack,
 		EventOperator   **root,
 		size_t           *paren)
@@ -851,6 +1604,7 @@ parse_on_paren (JobClass         *class,
 	nih_assert (stanza != NULL);
 	nih_assert (file != NULL);
 	nih_assert (pos != NULL);
+	nih_assert (arena != NULL);
 	nih_assert (stack != NULL);
 	nih_assert (root != NULL);
 	nih_assert (paren != NULL);
@@ -875,11 +1629,8 @@ parse_on_paren (JobClass         *class,
 		 * the beginning of a parenthesis group, this prevents us
 		 * popping past it later.
 		 */
-		item = nih_list_entry_new (class);
-		if (! item)
-			nih_return_system_error (-1);
-
-		nih_list_add_after (stack, &item->entry);
+		if (parse_on_push (arena, stack, NULL) < 0)
+			return -1;
 		break;
 	case ')':
 		(*paren)--;
@@ -896,7 +1647,7 @@ parse_on_paren (JobClass         *class,
 		/* The top item on the stack should be the open parenthesis
 		 * marker, which we want to discard.
 		 */
-		nih_free (stack->next);
+		nih_list_remove (stack->next);
 		break;
 	default:
 		nih_assert_not_reached ();
@@ -917,6 +1668,7 @@ parse_on_paren (JobClass         *class,
  * @len: length of @file,
  * @pos: offset within @file,
  * @lineno: line number,
+ * @arena: arena for tokens and stack items,
  * @stack: input operator stack,
  * @root: output operator.
  *
@@ -938,22 +1690,23 @@ parse_on_operand (JobClass         *class,
 		  size_t            len,
 		  size_t           *pos,
 		  size_t           *lineno,
+		  ParseArena       *arena,
 		  NihList          *stack,
 		  EventOperator   **root)
 {
-	EventOperator  *oper;
-	NihListEntry   *item;
-	nih_local char *arg = NULL;
+	EventOperator *oper;
+	NihListEntry  *item;
+	char          *arg;
 
 	nih_assert (class != NULL);
 	nih_assert (stanza != NULL);
 	nih_assert (file != NULL);
 	nih_assert (pos != NULL);
+	nih_assert (arena != NULL);
 	nih_assert (stack != NULL);
 	nih_assert (root != NULL);
 
-	arg = nih_config_next_token (NULL, file, len, pos, lineno,
-				     "()" NIH_CONFIG_CNLWS, TRUE);
+	arg = parse_on_token (arena, file, len, pos, lineno, TRUE);
 	if (! arg)
 		return -1;
 
@@ -976,12 +1729,8 @@ parse_on_operand (JobClass         *class,
 		if (! oper)
 			nih_return_system_error (-1);
 
-		item = nih_list_entry_new (class);
-		if (! item)
-			nih_return_system_error (-1);
-
-		item->data = oper;
-		nih_list_add_after (stack, &item->entry);
+		if (parse_on_push (arena, stack, oper) < 0)
+			return -1;
 	} else {
 		char **e;
 		int    pos = TRUE;
@@ -989,7 +1738,7 @@ parse_on_operand (JobClass         *class,
 		/* Argument is an environment variable for the event on
 		 * the top of the stack, so we append it there.
 		 */
-		if (! nih_str_array_addp (&oper->env, oper, NULL, arg))
+		if (! nih_str_array_add (&oper->env, oper, NULL, arg))
 			nih_return_system_error (-1);
 
 		/* Sanity check the event's environment to ensure that no
@@ -1004,6 +1753,12 @@ parse_on_operand (JobClass         *class,
 				return -1;
 			}
 		}
+
+		/* Rebuild the compiled form of the environment so that
+		 * matching need not parse it again for each event.
+		 */
+		if (event_operator_compile (oper) < 0)
+			return -1;
 	}
 
 	return 0;
@@ -1046,7 +1801,7 @@ parse_on_collect (JobClass       *class,
 			break;
 
 		/* Remove the item from the stack */
-		nih_free (item);
+		nih_list_remove (&item->entry);
 
 		/* Make the existing root node a child of the new operator;
 		 * there must be one for operators, and must not be one for
@@ -1078,6 +1833,104 @@ parse_on_collect (JobClass       *class,
 	return 0;
 }
 
+/**
+ * parse_on_token:
+ * @arena: arena to allocate token from,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number,
+ * @dequote: remove quotes and escapes.
+ *
+ * Parse the next token from the arguments of the "on" stanza, exactly as
+ * nih_config_next_token() would, but copying it into @arena rather than
+ * allocating it with nih_alloc().  @pos is updated to point past the
+ * token and any following whitespace.
+ *
+ * Returns: token, valid until @arena is freed, or NULL on raised error.
+ **/
+static char *
+parse_on_token (ParseArena *arena,
+		const char *file,
+		size_t      len,
+		size_t     *pos,
+		size_t     *lineno,
+		int         dequote)
+{
+	size_t  p, arg_start, arg_end, arg_len;
+	char   *arg = NULL;
+
+	nih_assert (arena != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	p = arg_start = *pos;
+
+	if (nih_config_token (file, len, &p, lineno, NULL,
+			      "()" NIH_CONFIG_CNLWS, dequote, &arg_len) < 0)
+		goto finish;
+
+	arg_end = p;
+	if (! arg_len) {
+		nih_error_raise (NIH_CONFIG_EXPECTED_TOKEN,
+				 _(NIH_CONFIG_EXPECTED_TOKEN_STR));
+		goto finish;
+	}
+
+	nih_config_skip_whitespace (file, len, &p, lineno);
+
+	arg = parse_arena_alloc (arena, arg_len + 1);
+	if (! arg)
+		nih_return_system_error (NULL);
+
+	if (nih_config_token (file + arg_start, arg_end - arg_start,
+			      NULL, NULL, arg, "()" NIH_CONFIG_CNLWS,
+			      dequote, NULL) < 0) {
+		arg = NULL;
+		goto finish;
+	}
+
+	arg[arg_len] = '\0';
+
+finish:
+	*pos = p;
+
+	return arg;
+}
+
+/**
+ * parse_on_push:
+ * @arena: arena to allocate stack item from,
+ * @stack: input operator stack,
+ * @oper: operator to push, or NULL for an open parenthesis.
+ *
+ * Push @oper onto the top of @stack; the stack item is allocated from
+ * @arena, so is only ever removed from @stack, never freed.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+parse_on_push (ParseArena    *arena,
+	       NihList       *stack,
+	       EventOperator *oper)
+{
+	NihListEntry *item;
+
+	nih_assert (arena != NULL);
+	nih_assert (stack != NULL);
+
+	item = parse_arena_alloc (arena, sizeof (NihListEntry));
+	if (! item)
+		nih_return_system_error (-1);
+
+	nih_list_init (&item->entry);
+	item->data = oper;
+
+	nih_list_add_after (stack, &item->entry);
+
+	return 0;
+}
+
 /**
  * parse_cgroup:
  * @class: job class being parsed,
@@ -1960,6 +2813,64 @@ stanza_task (JobClass        *class,
 	return nih_config_skip_comment (file, len, pos, lineno);
 }
 
+/**
+ * stanza_shell:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a shell stanza from @file.  This stanza expects a single argument
+ * of either "auto", allowing scripts consisting of a single simple
+ * command to be run without a shell, or "always", the default.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_shell (JobClass        *class,
+	      NihConfigStanza *stanza,
+	      const char      *file,
+	      size_t           len,
+	      size_t          *pos,
+	      size_t          *lineno)
+{
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+	nih_local char *arg = NULL;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (! strcmp (arg, "auto")) {
+		class->shell_auto = TRUE;
+	} else if (! strcmp (arg, "always")) {
+		class->shell_auto = FALSE;
+	} else {
+		nih_return_error (-1, NIH_CONFIG_UNKNOWN_STANZA,
+				  _(NIH_CONFIG_UNKNOWN_STANZA_STR));
+	}
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
 
 /**
  * stanza_kill:
@@ -2224,6 +3135,18 @@ stanza_apparmor (JobClass        *class,
 		if (! process->command)
 			nih_return_system_error (-1);
 
+		/* Remember the profile file so that it need not be loaded
+		 * again while it is unchanged.
+		 */
+		if (class->apparmor_load)
+			nih_unref (class->apparmor_load, class);
+
+		class->apparmor_load = nih_strdup (class, aaarg);
+		if (! class->apparmor_load)
+			nih_return_system_error (-1);
+
+		memset (&class->apparmor_loaded, 0, sizeof (ApparmorStamp));
+
 	} else if (! strcmp (arg, "switch")) {
 		/* Update error position to the switch value */
 		*pos = a_pos;
@@ -2263,7 +3186,8 @@ finish:
  *
  * Parse a daemon stanza from @file.  This either has no arguments, in
  * which case it sets the respawn flag for the job, or it has the "limit"
- * argument and sets the respawn rate limit.
+ * argument and sets the respawn rate limit, or it has the "delay"
+ * argument and sets the initial and maximum delay before respawning.
  *
  * Returns: zero on success, negative value on error.
  **/
@@ -2348,6 +3272,55 @@ stanza_respawn (JobClass        *class,
 
 		ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
 
+	} else if (! strcmp (arg, "delay")) {
+		nih_local char *delayarg = NULL;
+		char           *endptr;
+
+		/* Update error position to the delay value */
+		*pos = a_pos;
+		if (lineno)
+			*lineno = a_lineno;
+
+		/* Parse the delay value */
+		delayarg = nih_config_next_arg (NULL, file, len,
+						&a_pos, &a_lineno);
+		if (! delayarg)
+			goto finish;
+
+		errno = 0;
+		class->respawn_delay = strtol (delayarg, &endptr, 10);
+		if (errno || *endptr || (class->respawn_delay < 0))
+			nih_return_error (-1, PARSE_ILLEGAL_INTERVAL,
+					  _(PARSE_ILLEGAL_INTERVAL_STR));
+
+		/* The maximum is optional, and may not be less than the
+		 * delay it starts from.
+		 */
+		if (nih_config_has_token (file, len, &a_pos, &a_lineno)) {
+			nih_local char *maxarg = NULL;
+
+			/* Update error position to the maximum value */
+			*pos = a_pos;
+			if (lineno)
+				*lineno = a_lineno;
+
+			maxarg = nih_config_next_arg (NULL, file, len,
+						      &a_pos, &a_lineno);
+			if (! maxarg)
+				goto finish;
+
+			errno = 0;
+			class->respawn_delay_max = strtol (maxarg, &endptr, 10);
+			if (errno || *endptr
+			    || (class->respawn_delay_max < class->respawn_delay))
+				nih_return_error (-1, PARSE_ILLEGAL_INTERVAL,
+						  _(PARSE_ILLEGAL_INTERVAL_STR));
+		} else if (class->respawn_delay_max < class->respawn_delay) {
+			class->respawn_delay_max = class->respawn_delay;
+		}
+
+		ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
 	} else {
 		nih_return_error (-1, NIH_CONFIG_UNKNOWN_STANZA,
 				  _(NIH_CONFIG_UNKNOWN_STANZA_STR));
@@ -3025,6 +3998,534 @@ stanza_usage (JobClass        *class,
 	return nih_config_skip_comment (file, len, pos, lineno);
 }
 
+/**
+ * stanza_uses:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a uses stanza from @file, extracting the name of a resource
+ * and an optional amount of it, one if not given, that instances take
+ * while starting.  A resource named again replaces its earlier amount.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_uses (JobClass        *class,
+	     NihConfigStanza *stanza,
+	     const char      *file,
+	     size_t           len,
+	     size_t          *pos,
+	     size_t          *lineno)
+{
+	nih_local char *name = NULL;
+	nih_local char *arg = NULL;
+	int             amount = RESOURCE_UNIT;
+	int            *new_amount;
+	size_t          uses_len;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	name = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! name)
+		goto finish;
+
+	if (nih_config_has_token (file, len, &a_pos, &a_lineno)) {
+		arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+		if (! arg)
+			goto finish;
+
+		if (resource_parse_amount (arg, &amount) < 0)
+			nih_return_error (-1, PARSE_ILLEGAL_AMOUNT,
+					  _(PARSE_ILLEGAL_AMOUNT_STR));
+	}
+
+	for (size_t i = 0; i < class->uses_len; i++) {
+		if (! strcmp (class->uses[i], name)) {
+			class->uses_amount[i] = amount;
+			goto skip;
+		}
+	}
+
+	new_amount = nih_realloc (class->uses_amount, class,
+				  sizeof (int) * (class->uses_len + 1));
+	if (! new_amount)
+		nih_return_system_error (-1);
+
+	class->uses_amount = new_amount;
+
+	uses_len = class->uses_len;
+	if (! nih_str_array_add (&class->uses, class, &uses_len, name))
+		nih_return_system_error (-1);
+
+	class->uses_amount[class->uses_len++] = amount;
+
+skip:
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_priority:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a priority stanza from @file, extracting a single argument
+ * containing the order in which instances are admitted when waiting
+ * for resources.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_priority (JobClass        *class,
+		 NihConfigStanza *stanza,
+		 const char      *file,
+		 size_t           len,
+		 size_t          *pos,
+		 size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	long            priority;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	priority = strtol (arg, &endptr, 10);
+	if (errno || *endptr || (priority < -1000) || (priority > 1000))
+		nih_return_error (-1, PARSE_ILLEGAL_PRIORITY,
+				  _(PARSE_ILLEGAL_PRIORITY_STR));
+
+	class->priority = (int)priority;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_pressure:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a pressure stanza from @file, extracting the name of a resource
+ * the kernel reports pressure stall information for and the percentage
+ * of time stalled on it above which instances wait in the starting
+ * state.  A resource named again replaces its earlier percentage.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_pressure (JobClass        *class,
+		 NihConfigStanza *stanza,
+		 const char      *file,
+		 size_t           len,
+		 size_t          *pos,
+		 size_t          *lineno)
+{
+	nih_local char *name = NULL;
+	nih_local char *arg = NULL;
+	int             threshold;
+	int            *new_max;
+	size_t          pressure_len;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	name = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! name)
+		goto finish;
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if ((! pressure_valid_resource (name))
+	    || (pressure_parse_threshold (arg, &threshold) < 0))
+		nih_return_error (-1, PARSE_ILLEGAL_PRESSURE,
+				  _(PARSE_ILLEGAL_PRESSURE_STR));
+
+	for (size_t i = 0; i < class->pressure_len; i++) {
+		if (! strcmp (class->pressure[i], name)) {
+			class->pressure_max[i] = threshold;
+			goto skip;
+		}
+	}
+
+	new_max = nih_realloc (class->pressure_max, class,
+			       sizeof (int) * (class->pressure_len + 1));
+	if (! new_max)
+		nih_return_system_error (-1);
+
+	class->pressure_max = new_max;
+
+	pressure_len = class->pressure_len;
+	if (! nih_str_array_add (&class->pressure, class, &pressure_len, name))
+		nih_return_system_error (-1);
+
+	class->pressure_max[class->pressure_len++] = threshold;
+
+skip:
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_pool:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a pool stanza from @file, extracting a single argument containing
+ * the number of spare instances to keep started ahead of start requests.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_pool (JobClass        *class,
+	     NihConfigStanza *stanza,
+	     const char      *file,
+	     size_t           len,
+	     size_t          *pos,
+	     size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	long            pool;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	pool = strtol (arg, &endptr, 10);
+	if (errno || *endptr || (pool < 0) || (pool > JOB_POOL_MAX))
+		nih_return_error (-1, PARSE_ILLEGAL_POOL,
+				  _(PARSE_ILLEGAL_POOL_STR));
+
+	class->pool = (int)pool;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_cpus:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a cpus stanza from @file, extracting a single argument containing
+ * the list of CPUs that the job's processes may run on.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_cpus (JobClass        *class,
+	     NihConfigStanza *stanza,
+	     const char      *file,
+	     size_t           len,
+	     size_t          *pos,
+	     size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	cpu_set_t       set;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (system_parse_cpus (arg, &set) < 0)
+		nih_return_error (-1, PARSE_ILLEGAL_CPUS,
+				  _(PARSE_ILLEGAL_CPUS_STR));
+
+	if (class->cpus)
+		nih_unref (class->cpus, class);
+
+	class->cpus = nih_strdup (class, arg);
+	if (! class->cpus)
+		nih_return_no_memory_error (-1);
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_numa_node:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a numa-node stanza from @file, extracting a single argument
+ * containing the NUMA node whose CPUs the job's processes may run on.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_numa_node (JobClass        *class,
+		  NihConfigStanza *stanza,
+		  const char      *file,
+		  size_t           len,
+		  size_t          *pos,
+		  size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	char           *endptr;
+	long            node;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	errno = 0;
+	node = strtol (arg, &endptr, 10);
+	if (errno || *endptr || (node < 0) || (node > INT_MAX))
+		nih_return_error (-1, PARSE_ILLEGAL_NUMA_NODE,
+				  _(PARSE_ILLEGAL_NUMA_NODE_STR));
+
+	class->numa_node = (int)node;
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_spread_instances:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a spread-instances stanza from @file, extracting a single argument
+ * of "cpus" or "numa-nodes" saying what instances are spread across.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_spread_instances (JobClass        *class,
+			 NihConfigStanza *stanza,
+			 const char      *file,
+			 size_t           len,
+			 size_t          *pos,
+			 size_t          *lineno)
+{
+	nih_local char *arg = NULL;
+	size_t          a_pos, a_lineno;
+	int             ret = -1;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	arg = nih_config_next_arg (NULL, file, len, &a_pos, &a_lineno);
+	if (! arg)
+		goto finish;
+
+	if (! strcmp (arg, "cpus")) {
+		class->spread = JOB_SPREAD_CPUS;
+	} else if (! strcmp (arg, "numa-nodes")) {
+		class->spread = JOB_SPREAD_NODES;
+	} else {
+		nih_return_error (-1, NIH_CONFIG_UNKNOWN_STANZA,
+				  _(NIH_CONFIG_UNKNOWN_STANZA_STR));
+	}
+
+	ret = nih_config_skip_comment (file, len, &a_pos, &a_lineno);
+
+finish:
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return ret;
+}
+
+/**
+ * stanza_socket:
+ * @class: job class being parsed,
+ * @stanza: stanza found,
+ * @file: file or string to parse,
+ * @len: length of @file,
+ * @pos: offset within @file,
+ * @lineno: line number.
+ *
+ * Parse a socket stanza from @file, extracting the KEY=VALUE arguments
+ * that describe a socket init listens on for the job and passes to its
+ * main process.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+stanza_socket (JobClass        *class,
+	       NihConfigStanza *stanza,
+	       const char      *file,
+	       size_t           len,
+	       size_t          *pos,
+	       size_t          *lineno)
+{
+	nih_local char **args = NULL;
+	nih_local char  *spec = NULL;
+	ListenerAddress  address;
+	size_t           a_pos, a_lineno;
+
+	nih_assert (class != NULL);
+	nih_assert (stanza != NULL);
+	nih_assert (file != NULL);
+	nih_assert (pos != NULL);
+
+	if (! nih_config_has_token (file, len, pos, lineno))
+		nih_return_error (-1, NIH_CONFIG_EXPECTED_TOKEN,
+				  _(NIH_CONFIG_EXPECTED_TOKEN_STR));
+
+	a_pos = *pos;
+	a_lineno = (lineno ? *lineno : 1);
+
+	args = nih_config_parse_args (NULL, file, len, &a_pos, &a_lineno);
+	if (! args)
+		return -1;
+
+	for (char **arg = args; *arg; arg++)
+		if (! nih_strcat_sprintf (&spec, NULL, "%s%s",
+					  spec ? " " : "", *arg))
+			nih_return_no_memory_error (-1);
+
+	if (listener_parse (spec, &address) < 0)
+		nih_return_error (-1, PARSE_ILLEGAL_SOCKET,
+				  _(PARSE_ILLEGAL_SOCKET_STR));
+
+	for (int i = 0; class->sockets && class->sockets[i]; i++)
+		if (i + 1 >= LISTENER_MAX)
+			nih_return_error (-1, PARSE_TOO_MANY_SOCKETS,
+					  _(PARSE_TOO_MANY_SOCKETS_STR));
+
+	if (! nih_str_array_addp (&class->sockets, class, NULL, spec))
+		nih_return_no_memory_error (-1);
+
+	*pos = a_pos;
+	if (lineno)
+		*lineno = a_lineno;
+
+	return 0;
+}
+
 /**
  * stanza_cgroup:
  * @class: job class being parsed,
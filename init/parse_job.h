@@ -20,6 +20,8 @@
 #ifndef INIT_PARSE_JOB_H
 #define INIT_PARSE_JOB_H
 
+#include <stdint.h>
+
 #include <nih/macros.h>
 #include <nih/config.h>
 
@@ -27,8 +29,27 @@
 #include "job_class.h"
 
 
+/**
+ * ParseProfile:
+ * @count: number of items parsed,
+ * @usec: total microseconds spent parsing them,
+ * @allocs: total number of blocks allocated while parsing them.
+ *
+ * Cost of parsing configuration files or a kind of job stanza, kept when
+ * parse_profile_enabled is TRUE.
+ **/
+typedef struct parse_profile {
+	uint64_t count;
+	uint64_t usec;
+	uint64_t allocs;
+} ParseProfile;
+
+
 NIH_BEGIN_EXTERN
 
+extern int parse_profile_enabled;
+
+
 JobClass *parse_job (const void *parent, Session *session,
 		     JobClass *update, const char *name,
 		     const char *file, size_t len,
@@ -39,6 +60,12 @@ EventOperator *
 parse_on_simple (JobClass *class, const char *stanza_name,
 		 const char *string)
 	__attribute__ ((warn_unused_result));
+
+uint64_t parse_profile_now    (void);
+void     parse_profile_file   (const char *path, uint64_t started,
+			       uint64_t allocs);
+void     parse_profile_report (void);
+
 NIH_END_EXTERN
 
 #endif /* INIT_PARSE_JOB_H */
@@ -185,6 +185,40 @@
 #define LOGDIR_ENV "UPSTART_LOGDIR" 
 #endif
 
+/**
+ * JOB_PROCESS_LOG_REMAP_FROM_CHAR:
+ * JOB_PROCESS_LOG_REMAP_TO_CHAR:
+ *
+ * All logs are written to a single directory so any jobs containing
+ * slashes must be remapped.
+ **/
+#ifndef JOB_PROCESS_LOG_REMAP_FROM_CHAR
+#define JOB_PROCESS_LOG_REMAP_FROM_CHAR  '/'
+#endif
+#ifndef JOB_PROCESS_LOG_REMAP_TO_CHAR
+#define JOB_PROCESS_LOG_REMAP_TO_CHAR    '_'
+#endif
+
+/**
+ * JOB_PROCESS_LOG_FILE_EXT:
+ *
+ * Extension for log files.
+ **/
+#ifndef JOB_PROCESS_LOG_FILE_EXT
+#define JOB_PROCESS_LOG_FILE_EXT ".log"
+#endif
+
+/**
+ * LOG_COMPRESS_PROGRAM:
+ *
+ * Program used to compress rotated log files, which must read from
+ * its standard input and write to its standard output when given
+ * the "-c" option.
+ **/
+#ifndef LOG_COMPRESS_PROGRAM
+#define LOG_COMPRESS_PROGRAM "/bin/gzip"
+#endif
+
 /**
  * SESSION_ENV:
  *
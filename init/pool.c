@@ -0,0 +1,290 @@
+/* upstart
+ *
+ * pool.c - free block pool behind nih_alloc()
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/logging.h>
+
+#include "pool.h"
+
+
+/**
+ * PoolHeader:
+ * @size: usable size of block.
+ *
+ * Placed before each block handed out.  Blocks of up to POOL_MAX_SIZE
+ * are always rounded up to their size class, so @size alone tells
+ * whether the block belongs to the pool; the union keeps the block
+ * following it aligned as malloc() would.
+ **/
+typedef union pool_header {
+	size_t       size;
+	long double  align_ld;
+	void        *align_ptr;
+} PoolHeader;
+
+/**
+ * PoolBlock:
+ * @next: next free block in the same size class.
+ *
+ * Overlays the contents of a free block kept by the pool.
+ **/
+typedef struct pool_block {
+	struct pool_block *next;
+} PoolBlock;
+
+
+/* Prototypes for static functions */
+static size_t pool_class (size_t size);
+
+
+/**
+ * pool_blocks:
+ *
+ * Free blocks of each size class, most recently freed first; the block
+ * pointers are those handed out, following the header.
+ **/
+static PoolBlock *pool_blocks[POOL_CLASSES];
+
+/**
+ * pool_blocks_len:
+ *
+ * Number of free blocks in each list of pool_blocks.
+ **/
+static size_t pool_blocks_len[POOL_CLASSES];
+
+/**
+ * pool_stats:
+ *
+ * Number and size of the blocks allocated and kept by the pool.
+ **/
+PoolStats pool_stats = { 0, 0, 0, 0, 0 };
+
+
+/**
+ * pool_init:
+ *
+ * Route every nih_alloc() allocation through the pool, so that small
+ * objects allocated and freed in quick succession, such as events,
+ * their blocking records and environment strings during a uevent storm,
+ * reuse recently freed blocks rather than going through malloc() and
+ * free() each time.
+ *
+ * This must be called before anything is allocated with nih_alloc(),
+ * since the pool must have allocated every block that it frees.
+ **/
+void
+pool_init (void)
+{
+	__nih_malloc = pool_malloc;
+	__nih_realloc = pool_realloc;
+	__nih_free = pool_free;
+}
+
+/**
+ * pool_malloc:
+ * @size: size of block to allocate.
+ *
+ * Allocate a block of at least @size bytes, reusing a free block of the
+ * same size class if there is one.
+ *
+ * Returns: newly allocated block or NULL if insufficient memory.
+ **/
+void *
+pool_malloc (size_t size)
+{
+	PoolHeader *header;
+	size_t      class;
+
+	class = pool_class (size);
+	if (class < POOL_CLASSES) {
+		PoolBlock *block = pool_blocks[class];
+
+		size = (class + 1) * POOL_CLASS_SIZE;
+
+		if (block) {
+			pool_blocks[class] = block->next;
+			pool_blocks_len[class]--;
+
+			pool_stats.cached--;
+			pool_stats.cached_bytes -= size;
+			pool_stats.used++;
+			pool_stats.used_bytes += size;
+			pool_stats.allocs++;
+
+			return block;
+		}
+	} else if (size > (size_t)-1 - sizeof (PoolHeader)) {
+		return NULL;
+	}
+
+	header = malloc (sizeof (PoolHeader) + size);
+	if (! header)
+		return NULL;
+
+	header->size = size;
+
+	pool_stats.used++;
+	pool_stats.used_bytes += size;
+	pool_stats.allocs++;
+
+	return header + 1;
+}
+
+/**
+ * pool_realloc:
+ * @ptr: block to resize, or NULL,
+ * @size: new size of block.
+ *
+ * Resize @ptr to at least @size bytes, in place if it is already large
+ * enough for the size class of @size, otherwise by allocating a new
+ * block and copying its contents.
+ *
+ * Returns: resized block or NULL if insufficient memory, in which case
+ * @ptr is left unchanged.
+ **/
+void *
+pool_realloc (void   *ptr,
+	      size_t  size)
+{
+	PoolHeader *header;
+	void       *new_ptr;
+	size_t      old_size;
+
+	if (! ptr)
+		return pool_malloc (size);
+
+	header = (PoolHeader *)ptr - 1;
+
+	if (header->size <= POOL_MAX_SIZE) {
+		if (pool_class (size) == pool_class (header->size))
+			return ptr;
+	} else if (size > POOL_MAX_SIZE) {
+		if (size > (size_t)-1 - sizeof (PoolHeader))
+			return NULL;
+
+		old_size = header->size;
+
+		header = realloc (header, sizeof (PoolHeader) + size);
+		if (! header)
+			return NULL;
+
+		header->size = size;
+
+		pool_stats.used_bytes -= old_size;
+		pool_stats.used_bytes += size;
+
+		return header + 1;
+	}
+
+	new_ptr = pool_malloc (size);
+	if (! new_ptr)
+		return NULL;
+
+	memcpy (new_ptr, ptr, nih_min (size, header->size));
+	pool_free (ptr);
+
+	return new_ptr;
+}
+
+/**
+ * pool_free:
+ * @ptr: block to free, or NULL.
+ *
+ * Free @ptr, keeping it for reuse if its size class is not already
+ * holding POOL_CACHE_MAX free blocks.
+ **/
+void
+pool_free (void *ptr)
+{
+	PoolHeader *header;
+	size_t      class;
+
+	if (! ptr)
+		return;
+
+	header = (PoolHeader *)ptr - 1;
+
+	pool_stats.used--;
+	pool_stats.used_bytes -= header->size;
+
+	class = pool_class (header->size);
+	if ((class < POOL_CLASSES)
+	    && (pool_blocks_len[class] < POOL_CACHE_MAX)) {
+		PoolBlock *block = ptr;
+
+		block->next = pool_blocks[class];
+		pool_blocks[class] = block;
+		pool_blocks_len[class]++;
+
+		pool_stats.cached++;
+		pool_stats.cached_bytes += header->size;
+
+		return;
+	}
+
+	free (header);
+}
+
+/**
+ * pool_cached:
+ * @size: size of block.
+ *
+ * Returns: number of free blocks kept for the size class of @size.
+ **/
+size_t
+pool_cached (size_t size)
+{
+	size_t class;
+
+	class = pool_class (size);
+	if (class >= POOL_CLASSES)
+		return 0;
+
+	return pool_blocks_len[class];
+}
+
+
+/**
+ * pool_class:
+ * @size: size of block.
+ *
+ * Returns: index of the size class of blocks of @size bytes, or
+ * POOL_CLASSES or more if they are not kept by the pool.
+ **/
+static size_t
+pool_class (size_t size)
+{
+	if (! size)
+		return 0;
+
+	if (size > POOL_MAX_SIZE)
+		return POOL_CLASSES;
+
+	return (size - 1) / POOL_CLASS_SIZE;
+}
@@ -0,0 +1,97 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_POOL_H
+#define INIT_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * POOL_CLASS_SIZE:
+ *
+ * Blocks handed out from the pool are rounded up to a multiple of this
+ * many bytes; each multiple is a separate size class.
+ **/
+#define POOL_CLASS_SIZE 32
+
+/**
+ * POOL_MAX_SIZE:
+ *
+ * Largest block handed out from the pool; larger blocks are always
+ * allocated and freed through malloc().
+ **/
+#define POOL_MAX_SIZE 512
+
+/**
+ * POOL_CLASSES:
+ *
+ * Number of size classes kept by the pool.
+ **/
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_CLASS_SIZE)
+
+/**
+ * POOL_CACHE_MAX:
+ *
+ * Maximum number of free blocks kept in each size class, beyond which
+ * freed blocks are returned to malloc().
+ **/
+#define POOL_CACHE_MAX 256
+
+
+/**
+ * PoolStats:
+ * @used: number of blocks allocated and not freed,
+ * @used_bytes: total usable size of @used,
+ * @cached: number of free blocks kept for reuse,
+ * @cached_bytes: total usable size of @cached,
+ * @allocs: number of blocks ever allocated.
+ *
+ * Counts kept by the pool of every block allocated through nih_alloc()
+ * once pool_init() has been called.
+ **/
+typedef struct pool_stats {
+	uint64_t used;
+	uint64_t used_bytes;
+	uint64_t cached;
+	uint64_t cached_bytes;
+	uint64_t allocs;
+} PoolStats;
+
+
+NIH_BEGIN_EXTERN
+
+extern PoolStats pool_stats;
+
+
+void  pool_init    (void);
+
+void *pool_malloc  (size_t size)
+	__attribute__ ((warn_unused_result, malloc));
+void *pool_realloc (void *ptr, size_t size)
+	__attribute__ ((warn_unused_result));
+void  pool_free    (void *ptr);
+
+size_t pool_cached (size_t size);
+
+NIH_END_EXTERN
+
+#endif /* INIT_POOL_H */
@@ -0,0 +1,520 @@
+/* upstart
+ *
+ * pressure.c - pressure stall information triggers
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+
+#include "environ.h"
+#include "event.h"
+#include "events.h"
+#include "job_class.h"
+#include "resource.h"
+#include "pressure.h"
+
+
+/* Prototypes for static functions */
+static int  pressure_destroy (PressureTrigger *trigger);
+static void pressure_open    (PressureTrigger *trigger);
+static int  pressure_read    (PressureTrigger *trigger, double *avg10)
+	__attribute__ ((warn_unused_result));
+static void pressure_set     (PressureTrigger *trigger, int high);
+static void pressure_watcher (PressureTrigger *trigger, NihIoWatch *watch,
+			      NihIoEvents events);
+static void pressure_timer   (PressureTrigger *trigger, Deadline *deadline);
+
+
+/**
+ * pressure_triggers:
+ *
+ * This list holds the triggers for the resources and thresholds named by
+ * the pressure stanzas of job classes; each item is a PressureTrigger
+ * structure.
+ **/
+NihList *pressure_triggers = NULL;
+
+/**
+ * pressure_dir:
+ *
+ * Directory the pressure files of each resource are found in.
+ **/
+const char *pressure_dir = PRESSURE_DIR;
+
+/**
+ * pressure_pending:
+ *
+ * TRUE when job classes have been added or removed since unused
+ * triggers were last freed.
+ **/
+static int pressure_pending = FALSE;
+
+
+/**
+ * pressure_init:
+ *
+ * Initialise the pressure_triggers list.
+ **/
+void
+pressure_init (void)
+{
+	if (! pressure_triggers)
+		pressure_triggers = NIH_MUST (nih_list_new (NULL));
+}
+
+
+/**
+ * pressure_valid_resource:
+ * @name: name to check.
+ *
+ * Returns: TRUE if @name is a resource the kernel reports pressure
+ * for, FALSE otherwise.
+ **/
+int
+pressure_valid_resource (const char *name)
+{
+	nih_assert (name != NULL);
+
+	return ((! strcmp (name, "cpu"))
+		|| (! strcmp (name, "io"))
+		|| (! strcmp (name, "memory")));
+}
+
+/**
+ * pressure_parse_threshold:
+ * @str: string to parse,
+ * @threshold: pointer to store threshold in.
+ *
+ * Parse @str as a whole percentage from 1 to 99, optionally followed by
+ * "%", storing it in @threshold.
+ *
+ * Returns: zero on success, negative value if @str is not a percentage.
+ **/
+int
+pressure_parse_threshold (const char *str,
+			  int        *threshold)
+{
+	long  value;
+	char *endptr;
+
+	nih_assert (str != NULL);
+	nih_assert (threshold != NULL);
+
+	if (! isdigit ((unsigned char)*str))
+		return -1;
+
+	errno = 0;
+	value = strtol (str, &endptr, 10);
+	if (errno || (value < 1) || (value > 99))
+		return -1;
+
+	if (*endptr == '%')
+		endptr++;
+
+	if (*endptr)
+		return -1;
+
+	*threshold = (int)value;
+
+	return 0;
+}
+
+
+/**
+ * pressure_get:
+ * @resource: name of resource,
+ * @threshold: percentage of time stalled.
+ *
+ * Look up the trigger for @threshold of @resource, creating it if it
+ * does not exist.  Should the kernel not support pressure stall
+ * information, the trigger is created but pressure is never high.
+ *
+ * Returns: trigger.
+ **/
+PressureTrigger *
+pressure_get (const char *resource,
+	      int         threshold)
+{
+	PressureTrigger *trigger;
+
+	nih_assert (resource != NULL);
+	nih_assert (pressure_valid_resource (resource));
+	nih_assert ((threshold > 0) && (threshold < 100));
+
+	pressure_init ();
+
+	NIH_LIST_FOREACH (pressure_triggers, iter) {
+		trigger = (PressureTrigger *)iter;
+
+		if ((trigger->threshold == threshold)
+		    && (! strcmp (trigger->resource, resource)))
+			return trigger;
+	}
+
+	trigger = NIH_MUST (nih_new (pressure_triggers, PressureTrigger));
+
+	nih_list_init (&trigger->entry);
+	nih_alloc_set_destructor (trigger, pressure_destroy);
+
+	trigger->resource = NIH_MUST (nih_strdup (trigger, resource));
+	trigger->threshold = threshold;
+	trigger->fd = -1;
+	trigger->watch = NULL;
+	trigger->check = NULL;
+	trigger->high = FALSE;
+	trigger->fired = FALSE;
+	trigger->seen = FALSE;
+
+	nih_list_add (pressure_triggers, &trigger->entry);
+
+	pressure_open (trigger);
+	pressure_update (trigger);
+
+	return trigger;
+}
+
+/**
+ * pressure_high:
+ * @resource: name of resource,
+ * @threshold: percentage of time stalled.
+ *
+ * Returns: TRUE if pressure on @resource is above @threshold, FALSE
+ * otherwise.
+ **/
+int
+pressure_high (const char *resource,
+	       int         threshold)
+{
+	return pressure_get (resource, threshold)->high;
+}
+
+/**
+ * pressure_update:
+ * @trigger: trigger to update.
+ *
+ * Check whether pressure for @trigger is high, from the ten second
+ * average of time stalled, or the trigger having fired since the last
+ * check.  Pressure is left high while it has fired, since the average
+ * lags behind the stalls that fired it.
+ **/
+void
+pressure_update (PressureTrigger *trigger)
+{
+	double avg10;
+	int    high;
+
+	nih_assert (trigger != NULL);
+
+	if (pressure_read (trigger, &avg10) < 0) {
+		high = FALSE;
+	} else {
+		high = (avg10 > trigger->threshold);
+	}
+
+	if (trigger->fired) {
+		trigger->fired = FALSE;
+		high = TRUE;
+	}
+
+	pressure_set (trigger, high);
+}
+
+/**
+ * pressure_changed:
+ *
+ * Note that job classes have been added or removed, so that triggers no
+ * job names any longer are freed by the next call to pressure_poll().
+ **/
+void
+pressure_changed (void)
+{
+	pressure_pending = TRUE;
+}
+
+/**
+ * pressure_poll:
+ *
+ * Free the triggers that the pressure stanzas of the loaded job classes
+ * no longer name.  Called once each time through the main loop; does
+ * nothing unless job classes have been added or removed since it last
+ * ran.
+ **/
+void
+pressure_poll (void)
+{
+	if ((! pressure_pending) || (! pressure_triggers))
+		return;
+
+	pressure_pending = FALSE;
+
+	job_class_init ();
+
+	NIH_LIST_FOREACH (pressure_triggers, iter) {
+		PressureTrigger *trigger = (PressureTrigger *)iter;
+
+		trigger->seen = FALSE;
+	}
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		for (size_t i = 0; i < class->pressure_len; i++) {
+			NIH_LIST_FOREACH (pressure_triggers, t_iter) {
+				PressureTrigger *trigger = (PressureTrigger *)t_iter;
+
+				if ((trigger->threshold == class->pressure_max[i])
+				    && (! strcmp (trigger->resource,
+						  class->pressure[i])))
+					trigger->seen = TRUE;
+			}
+		}
+	}
+
+	NIH_LIST_FOREACH_SAFE (pressure_triggers, iter) {
+		PressureTrigger *trigger = (PressureTrigger *)iter;
+
+		if (! trigger->seen)
+			nih_free (trigger);
+	}
+}
+
+
+/**
+ * pressure_destroy:
+ * @trigger: trigger being freed.
+ *
+ * Destructor for triggers that removes @trigger from pressure_triggers
+ * and closes its file descriptor; the watch and deadline are freed along
+ * with it.
+ *
+ * Returns: zero.
+ **/
+static int
+pressure_destroy (PressureTrigger *trigger)
+{
+	nih_assert (trigger != NULL);
+
+	nih_list_destroy (&trigger->entry);
+
+	if (trigger->fd != -1)
+		close (trigger->fd);
+
+	return 0;
+}
+
+/**
+ * pressure_open:
+ * @trigger: trigger to open.
+ *
+ * Open the pressure file of the resource of @trigger and register the
+ * trigger with the kernel, watching the file descriptor for it firing.
+ * Failure is not an error, since older kernels have no pressure stall
+ * information; pressure is then never high.
+ **/
+static void
+pressure_open (PressureTrigger *trigger)
+{
+	nih_local char *path = NULL;
+	char            buf[64];
+	int             fd;
+	int             len;
+
+	nih_assert (trigger != NULL);
+	nih_assert (trigger->fd == -1);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/%s", pressure_dir,
+				      trigger->resource));
+
+	fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		nih_debug ("%s: %s: %s", _("Unable to watch pressure"),
+			   path, strerror (errno));
+		return;
+	}
+
+	len = snprintf (buf, sizeof (buf), "some %d %d",
+			trigger->threshold * (PRESSURE_WINDOW / 100),
+			PRESSURE_WINDOW);
+	nih_assert ((len > 0) && ((size_t)len < sizeof (buf)));
+
+	if (write (fd, buf, len + 1) < 0) {
+		nih_warn ("%s: %s: %s", _("Unable to watch pressure"),
+			  path, strerror (errno));
+		close (fd);
+		return;
+	}
+
+	trigger->watch = nih_io_add_watch (trigger, fd, NIH_IO_EXCEPT,
+					   (NihIoWatcher)pressure_watcher,
+					   trigger);
+	if (! trigger->watch) {
+		close (fd);
+		return;
+	}
+
+	trigger->fd = fd;
+}
+
+/**
+ * pressure_read:
+ * @trigger: trigger to read,
+ * @avg10: pointer to store average in.
+ *
+ * Read the percentage of the last ten seconds that some tasks were
+ * stalled on the resource of @trigger.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+pressure_read (PressureTrigger *trigger,
+	       double          *avg10)
+{
+	nih_local char *path = NULL;
+	char            buf[256];
+	FILE           *file;
+	int             ret = -1;
+
+	nih_assert (trigger != NULL);
+	nih_assert (avg10 != NULL);
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/%s", pressure_dir,
+				      trigger->resource));
+
+	file = fopen (path, "re");
+	if (! file)
+		return -1;
+
+	while (fgets (buf, sizeof (buf), file)) {
+		if (sscanf (buf, "some avg10=%lf", avg10) == 1) {
+			ret = 0;
+			break;
+		}
+	}
+
+	fclose (file);
+
+	return ret;
+}
+
+/**
+ * pressure_set:
+ * @trigger: trigger to change,
+ * @high: whether pressure is now high.
+ *
+ * Record whether pressure for @trigger is @high, emitting a pressure
+ * event when it changes.  While pressure is high a periodic deadline
+ * checks whether it has fallen; once it has, jobs waiting in the
+ * starting state for it are reconsidered.
+ **/
+static void
+pressure_set (PressureTrigger *trigger,
+	      int              high)
+{
+	char   **env;
+	size_t   len = 0;
+
+	nih_assert (trigger != NULL);
+
+	if (high && (! trigger->check))
+		trigger->check = NIH_MUST (deadline_add_periodic (
+				trigger, PRESSURE_CHECK_INTERVAL,
+				(DeadlineCb)pressure_timer, trigger));
+
+	if ((! high) && trigger->check) {
+		nih_free (trigger->check);
+		trigger->check = NULL;
+	}
+
+	if (high == trigger->high)
+		return;
+
+	trigger->high = high;
+
+	nih_info (_("%s pressure %s %d%%"), trigger->resource,
+		  high ? _("above") : _("below"), trigger->threshold);
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "RESOURCE=%s", trigger->resource));
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "THRESHOLD=%d", trigger->threshold));
+	NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+			       "STATE=%s", high ? "high" : "low"));
+	NIH_MUST (event_new (NULL, PRESSURE_EVENT, env));
+
+	if (! high)
+		resource_recheck ();
+}
+
+/**
+ * pressure_watcher:
+ * @trigger: trigger that fired,
+ * @watch: watch on trigger file descriptor,
+ * @events: events that occurred.
+ *
+ * Called when the kernel notifies us that tasks have been stalled on the
+ * resource of @trigger for more than its threshold.
+ **/
+static void
+pressure_watcher (PressureTrigger *trigger,
+		  NihIoWatch      *watch,
+		  NihIoEvents      events)
+{
+	nih_assert (trigger != NULL);
+	nih_assert (watch != NULL);
+
+	trigger->fired = TRUE;
+
+	pressure_set (trigger, TRUE);
+}
+
+/**
+ * pressure_timer:
+ * @trigger: trigger to check,
+ * @deadline: deadline that caused us to be called.
+ *
+ * Called periodically while pressure for @trigger is high to check
+ * whether it has fallen.
+ **/
+static void
+pressure_timer (PressureTrigger *trigger,
+		Deadline        *deadline)
+{
+	nih_assert (trigger != NULL);
+	nih_assert (trigger->check == deadline);
+
+	pressure_update (trigger);
+}
@@ -0,0 +1,110 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_PRESSURE_H
+#define INIT_PRESSURE_H
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/io.h>
+
+#include "deadline.h"
+
+
+/**
+ * PRESSURE_DIR:
+ *
+ * Directory holding the pressure stall information files of the kernel.
+ **/
+#define PRESSURE_DIR "/proc/pressure"
+
+/**
+ * PRESSURE_WINDOW:
+ *
+ * Window in microseconds over which the kernel checks stall time against
+ * the threshold of a trigger; a multiple of two seconds, so that triggers
+ * may also be created by Session Inits.
+ **/
+#define PRESSURE_WINDOW 2000000
+
+/**
+ * PRESSURE_CHECK_INTERVAL:
+ *
+ * Seconds between checks of whether pressure has fallen back below the
+ * threshold of a trigger that has fired.
+ **/
+#define PRESSURE_CHECK_INTERVAL 2
+
+
+/**
+ * PressureTrigger:
+ * @entry: list header,
+ * @resource: name of resource, one of "cpu", "io" or "memory",
+ * @threshold: percentage of time stalled above which pressure is high,
+ * @fd: trigger file descriptor, or -1 if none could be created,
+ * @watch: watch on @fd for the trigger firing,
+ * @check: periodic deadline that checks whether pressure has fallen
+ *         while @high is TRUE,
+ * @high: TRUE while pressure is above @threshold,
+ * @fired: TRUE if the trigger has fired since it was last checked,
+ * @seen: set while job classes are being scanned.
+ *
+ * One of these exists for each resource and threshold named by the
+ * pressure stanzas of loaded jobs, and is held in the pressure_triggers
+ * list.  The kernel notifies us through @fd when tasks have been stalled
+ * on @resource for more than @threshold percent of PRESSURE_WINDOW, and
+ * pressure is deemed to have fallen once the ten second average is back
+ * below it.
+ **/
+typedef struct pressure_trigger {
+	NihList     entry;
+	char       *resource;
+	int         threshold;
+	int         fd;
+	NihIoWatch *watch;
+	Deadline   *check;
+	int         high;
+	int         fired;
+	int         seen;
+} PressureTrigger;
+
+
+NIH_BEGIN_EXTERN
+
+extern NihList    *pressure_triggers;
+extern const char *pressure_dir;
+
+void             pressure_init           (void);
+
+int              pressure_valid_resource (const char *name)
+	__attribute__ ((warn_unused_result));
+int              pressure_parse_threshold (const char *str, int *threshold)
+	__attribute__ ((warn_unused_result));
+
+PressureTrigger *pressure_get            (const char *resource,
+					  int threshold);
+int              pressure_high           (const char *resource,
+					  int threshold);
+void             pressure_update         (PressureTrigger *trigger);
+
+void             pressure_changed        (void);
+void             pressure_poll           (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_PRESSURE_H */
@@ -35,6 +35,24 @@
 #include "state.h"
 
 
+/**
+ * shell_builtins:
+ *
+ * Shell builtins and reserved words that cannot be run without a shell,
+ * since either no binary of the same name exists or the binary would
+ * not have the same effect.
+ **/
+static const char * const shell_builtins[] = {
+	".", ":", "alias", "bg", "break", "case", "cd", "command",
+	"continue", "do", "done", "elif", "else", "esac", "eval", "exec",
+	"exit", "export", "fc", "fg", "fi", "for", "function", "getopts",
+	"hash", "if", "in", "jobs", "local", "read", "readonly", "return",
+	"select", "set", "shift", "source", "then", "times", "trap", "type",
+	"ulimit", "umask", "unalias", "unset", "until", "wait", "while",
+	NULL
+};
+
+
 /**
  * process_new:
  * @parent: parent of new process.
@@ -57,11 +75,97 @@ process_new  (const void *parent)
 		return NULL;
 
 	process->script = FALSE;
+	process->simple = FALSE;
 	process->command = NULL;
 
 	return process;
 }
 
+/**
+ * process_script_command:
+ * @parent: parent for new string,
+ * @script: script to examine.
+ *
+ * Determine whether @script consists of just a single simple command,
+ * ignoring blank lines, comment lines and a leading exec, without any
+ * shell characters, builtins or reserved words; such a script has the
+ * same effect whether it is run by a shell or executed directly as if
+ * it had been given to the exec stanza.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned string.  When all parents
+ * of the returned string are freed, the returned string will also be
+ * freed.
+ *
+ * Returns: newly allocated command, or NULL if @script requires a shell
+ * or insufficient memory.
+ **/
+char *
+process_script_command (const void *parent,
+			const char *script)
+{
+	nih_local char  *line = NULL;
+	nih_local char **args = NULL;
+	const char      *start = NULL;
+	const char      *end = NULL;
+	const char      *p;
+	const char      *q;
+	const char      *name;
+	char            *cmd;
+	int              i;
+
+	nih_assert (script != NULL);
+
+	for (p = script; *p; p = (*q ? q + 1 : q)) {
+		q = strchrnul (p, '\n');
+
+		while (p < q && strchr (" \t\r", *p))
+			p++;
+
+		if (p == q || *p == '#')
+			continue;
+
+		/* More than one command */
+		if (start)
+			return NULL;
+
+		start = p;
+		end = q;
+	}
+
+	if (! start)
+		return NULL;
+
+	line = nih_strndup (NULL, start, end - start);
+	if (! line)
+		return NULL;
+
+	if (strpbrk (line, SHELL_CHARS) || strchr (line, '#'))
+		return NULL;
+
+	args = nih_str_split (NULL, line, " \t\r", TRUE);
+	if (! args || ! args[0])
+		return NULL;
+
+	/* exec is implied */
+	name = args[0];
+	cmd = line + strspn (line, " \t\r");
+	if (! strcmp (name, "exec")) {
+		name = args[1];
+		if (! name)
+			return NULL;
+
+		cmd += strlen ("exec");
+		cmd += strspn (cmd, " \t\r");
+	}
+
+	for (i = 0; shell_builtins[i]; i++)
+		if (! strcmp (name, shell_builtins[i]))
+			return NULL;
+
+	return nih_strdup (parent, cmd);
+}
+
 
 /**
  * process_name:
@@ -227,6 +331,13 @@ process_deserialise (json_object *json, const void *parent)
 	if (! state_get_json_string_var_to_obj (json, process, command))
 		goto error;
 
+	if (process->script && process->command) {
+		nih_local char *cmd = NULL;
+
+		cmd = process_script_command (NULL, process->command);
+		process->simple = cmd != NULL;
+	}
+
 	/* All Process slots have to be serialised in the JSON to
 	 * guarantee ordering on deserialisation.
 	 *
@@ -50,9 +50,19 @@ typedef enum process_type {
 } ProcessType;
 
 
+/**
+ * SHELL_CHARS:
+ *
+ * This is the list of characters that, if encountered in a process, cause
+ * it to always be run with a shell.
+ **/
+#define SHELL_CHARS "~`!$^&*()=|\\{}[];\"'<>?"
+
+
 /**
  * Process:
  * @script: whether a shell will be required,
+ * @simple: whether @command is a script that could be run without a shell,
  * @command: command or script to be run.
  *
  * This structure is used for process definitions in the job class, defining
@@ -62,9 +72,14 @@ typedef enum process_type {
  * are none, it is split on whitespace and executed directly using exec().
  * If there are shell characters, or @script is TRUE, @command is executed
  * using a shell.
+ *
+ * @simple is set when a script consists of a single command that
+ * process_script_command() can extract, allowing jobs that request it to
+ * skip the shell for that script too.
  **/
 typedef struct process {
 	int    script;
+	int    simple;
 	char  *command;
 } Process;
 
@@ -77,6 +92,9 @@ Process *   process_new       (const void *parent)
 const char *process_name      (ProcessType process)
 	__attribute__ ((const));
 
+char *      process_script_command (const void *parent, const char *script)
+	__attribute__ ((warn_unused_result));
+
 json_object *process_serialise (const Process *process)
 	__attribute__ ((warn_unused_result));
 
@@ -0,0 +1,194 @@
+/* upstart
+ *
+ * pty.c - pool of pseudo-terminals for logged jobs
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/io.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "pty.h"
+
+
+/* Prototypes for static functions */
+static int pty_create (Pty *pty)
+	__attribute__ ((warn_unused_result));
+
+
+/**
+ * pty_pool_size:
+ *
+ * Number of pseudo-terminals to keep ready, so that spawning a job whose
+ * output is logged doesn't have to wait for one to be allocated; zero
+ * disables the pool.
+ **/
+int pty_pool_size = PTY_POOL_SIZE;
+
+/**
+ * pty_pool:
+ *
+ * Pseudo-terminals kept ready by pty_poll(), the first pty_pool_used
+ * entries are valid.
+ **/
+static Pty    pty_pool[PTY_POOL_MAX];
+static size_t pty_pool_used = 0;
+
+
+/**
+ * pty_open:
+ * @pty: pseudo-terminal to fill in.
+ *
+ * Obtain a pseudo-terminal for a job whose output is logged, taking one
+ * from the pool if available or allocating a new one otherwise.  The
+ * master side is stored in @pty and marked close-on-exec, the slave side
+ * has been granted and unlocked and may be opened using the name stored
+ * in @pty.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+pty_open (Pty *pty)
+{
+	nih_assert (pty != NULL);
+
+	if (pty_pool_used) {
+		*pty = pty_pool[--pty_pool_used];
+		return 0;
+	}
+
+	return pty_create (pty);
+}
+
+/**
+ * pty_create:
+ * @pty: pseudo-terminal to fill in.
+ *
+ * Allocate a new pseudo-terminal, grant and unlock its slave side, and
+ * store it in @pty.
+ *
+ * grantpt(3) may need to reap a helper process, so SIGCHLD is blocked
+ * while it runs rather than our handler being removed; were the handler
+ * removed, the signal for any job that exited meanwhile would be lost.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+pty_create (Pty *pty)
+{
+	sigset_t child_set, orig_set;
+	int      ret;
+
+	nih_assert (pty != NULL);
+
+	pty->master = posix_openpt (O_RDWR | O_NOCTTY);
+	if (pty->master < 0)
+		nih_return_system_error (-1);
+
+	nih_io_set_cloexec (pty->master);
+
+	sigemptyset (&child_set);
+	sigaddset (&child_set, SIGCHLD);
+	sigprocmask (SIG_BLOCK, &child_set, &orig_set);
+
+	ret = grantpt (pty->master);
+
+	sigprocmask (SIG_SETMASK, &orig_set, NULL);
+
+	if (ret < 0)
+		goto error;
+
+	if (unlockpt (pty->master) < 0)
+		goto error;
+
+	errno = ptsname_r (pty->master, pty->name, sizeof (pty->name));
+	if (errno)
+		goto error;
+
+	return 0;
+
+error:
+	nih_error_raise_system ();
+	close (pty->master);
+	pty->master = -1;
+
+	return -1;
+}
+
+
+/**
+ * pty_poll:
+ *
+ * Refill the pool of pseudo-terminals up to pty_pool_size, or close
+ * those beyond it; this should be called each time through the main
+ * loop, so that ptys taken by the jobs spawned are replaced while init
+ * is otherwise idle.
+ *
+ * Allocation failures are ignored, the pool is refilled the next time
+ * through and jobs allocate their own meanwhile.
+ **/
+void
+pty_poll (void)
+{
+	size_t size;
+
+	size = pty_pool_size > 0 ? (size_t)pty_pool_size : 0;
+	if (size > PTY_POOL_MAX)
+		size = PTY_POOL_MAX;
+
+	while (pty_pool_used > size)
+		close (pty_pool[--pty_pool_used].master);
+
+	while (pty_pool_used < size) {
+		if (pty_create (&pty_pool[pty_pool_used]) < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_debug ("%s: %s", _("Unable to allocate pty"),
+				   err->message);
+			nih_free (err);
+			break;
+		}
+
+		pty_pool_used++;
+	}
+}
+
+/**
+ * pty_pool_len:
+ *
+ * Returns: number of pseudo-terminals in the pool.
+ **/
+size_t
+pty_pool_len (void)
+{
+	return pty_pool_used;
+}
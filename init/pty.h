@@ -0,0 +1,78 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_PTY_H
+#define INIT_PTY_H
+
+#include <stddef.h>
+
+#include <nih/macros.h>
+
+
+/**
+ * PTY_POOL_SIZE:
+ *
+ * Default number of pseudo-terminals kept ready for the jobs whose
+ * output is logged.
+ **/
+#define PTY_POOL_SIZE 4
+
+/**
+ * PTY_POOL_MAX:
+ *
+ * Largest number of pseudo-terminals that may be kept ready.
+ **/
+#define PTY_POOL_MAX 64
+
+/**
+ * PTY_NAME_MAX:
+ *
+ * Size of the buffer holding the path of the slave side of a
+ * pseudo-terminal; ptys whose path doesn't fit are not pooled.
+ **/
+#define PTY_NAME_MAX 32
+
+
+/**
+ * Pty:
+ * @master: file descriptor of master side,
+ * @name: path of slave side.
+ *
+ * A pseudo-terminal that has been granted and unlocked, so that its
+ * slave side may be opened by name.
+ **/
+typedef struct pty {
+	int  master;
+	char name[PTY_NAME_MAX];
+} Pty;
+
+
+NIH_BEGIN_EXTERN
+
+extern int pty_pool_size;
+
+int    pty_open     (Pty *pty)
+	__attribute__ ((warn_unused_result));
+void   pty_poll     (void);
+
+size_t pty_pool_len (void)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_PTY_H */
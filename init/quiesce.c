@@ -23,6 +23,10 @@
 # include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <fnmatch.h>
+#include <string.h>
+#include <time.h>
+
 #include "quiesce.h"
 #include "events.h"
 #include "environ.h"
@@ -62,6 +66,23 @@ static char *quiesce_reason = NULL;
  **/
 static time_t max_kill_timeout = 0;
 
+/**
+ * quiesce_timeout:
+ *
+ * Overall number of seconds allowed from the start of quiesce for all
+ * jobs to stop, or zero (or less) to allow the longest kill timeout of
+ * the running jobs after they are signalled.
+ **/
+int quiesce_timeout = 0;
+
+/**
+ * quiesce_deadline:
+ *
+ * Time by which every job must have stopped in the kill phase; jobs are
+ * signalled in time to be killed before it.
+ **/
+static time_t quiesce_deadline = 0;
+
 /**
  * quiesce_phase_time:
  *
@@ -84,8 +105,23 @@ static time_t quiesce_start_time = 0;
  **/
 static int session_end_jobs = FALSE;
 
+/**
+ * quiesce_waiters:
+ *
+ * Quiesce method calls waiting for a fast reboot quiesce to finish, as
+ * NihListEntry structures referencing each message; replied to by
+ * quiesce_finalise().
+ **/
+static NihList *quiesce_waiters = NULL;
+
 static int quiesce_event_match (Event *event)
 	__attribute__ ((warn_unused_result));
+static void quiesce_kill_phase (void);
+static time_t quiesce_now      (void);
+static int quiesce_job_needed  (Job *job)
+	__attribute__ ((warn_unused_result));
+static int quiesce_depends     (JobClass *dependent, JobClass *class)
+	__attribute__ ((warn_unused_result));
 
 /* External definitions */
 extern int disable_respawn;
@@ -101,7 +137,7 @@ void
 quiesce (QuiesceRequester requester)
 {
 	nih_local char  **env = NULL;
-	Event            *event;
+	Event            *event = NULL;
 
 	job_class_init ();
 
@@ -119,16 +155,18 @@ quiesce (QuiesceRequester requester)
 	 * the system shutdown scenario since Session Inits must not
 	 * hold up the system.
 	 */
-	quiesce_phase = (requester == QUIESCE_REQUESTER_SYSTEM)
-		? QUIESCE_PHASE_KILL
-		: QUIESCE_PHASE_WAIT;
+	quiesce_phase = (requester == QUIESCE_REQUESTER_SESSION)
+		? QUIESCE_PHASE_WAIT
+		: QUIESCE_PHASE_KILL;
 
 	quiesce_reason = (requester == QUIESCE_REQUESTER_SESSION)
-		? _("logout") : _("shutdown");
+		? _("logout")
+		: (requester == QUIESCE_REQUESTER_REBOOT)
+		? _("reboot") : _("shutdown");
 
 	nih_info (_("Quiescing due to %s request"), quiesce_reason);
 
-	quiesce_start_time = quiesce_phase_time = time (NULL);
+	quiesce_start_time = quiesce_phase_time = quiesce_now ();
 
 	/* Stop existing jobs from respawning */
 	disable_respawn = TRUE;
@@ -136,14 +174,18 @@ quiesce (QuiesceRequester requester)
 	/* Signal that the session is ending. This may start new jobs.
 	 *
 	 * Note that the event doesn't actually get emitted until the
-	 * next time the main loop gets a chance to run.
+	 * next time the main loop gets a chance to run; there is no
+	 * session to end when the system init stops its jobs for a
+	 * fast reboot.
 	 */
-	env = NIH_MUST (nih_str_array_new (NULL));
+	if (requester != QUIESCE_REQUESTER_REBOOT) {
+		env = NIH_MUST (nih_str_array_new (NULL));
 
-	NIH_MUST (environ_set (&env, NULL, NULL, TRUE,
-				"TYPE=%s", quiesce_reason));
+		NIH_MUST (environ_set (&env, NULL, NULL, TRUE,
+					"TYPE=%s", quiesce_reason));
 
-	event = NIH_MUST (event_new (NULL, SESSION_END_EVENT, env));
+		event = NIH_MUST (event_new (NULL, SESSION_END_EVENT, env));
+	}
 
 	/* Check if any jobs care about the session end event. If not,
 	 * the wait phase can be avoided entirely resulting in a much
@@ -177,54 +219,56 @@ quiesce (QuiesceRequester requester)
 		}
 	}
 
-	if (quiesce_phase == QUIESCE_PHASE_KILL) {
-		/* We'll attempt to wait for this long, but system
-		 * policy may prevent it such that we just get killed
-		 * and job processes reparented to PID 1.
-		 */
-		max_kill_timeout = job_class_max_kill_timeout ();
-
-		job_process_stop_all ();
-	}
+	if (quiesce_phase == QUIESCE_PHASE_KILL)
+		quiesce_kill_phase ();
 
 	/* Check every second to see if all jobs have finished. If so,
 	 * we can exit early.
 	 */
-	NIH_MUST (nih_timer_add_periodic (NULL, 1,
-				(NihTimerCb)quiesce_wait_callback, NULL));
+	NIH_MUST (deadline_add_periodic (NULL, 1,
+				(DeadlineCb)quiesce_wait_callback, NULL));
 }
 
 /**
  * quiesce_wait_callback:
  *
  * @data: not used,
- * @timer: timer that caused us to be called.
+ * @deadline: deadline that caused us to be called.
  *
  * Callback used to check if all jobs have finished and if so
  * finalise Session Init shutdown.
  **/
 void
-quiesce_wait_callback (void *data, NihTimer *timer)
+quiesce_wait_callback (void *data, Deadline *deadline)
 {
 	time_t now;
 
-	nih_assert (timer);
+	nih_assert (deadline);
 	nih_assert (quiesce_phase_time);
 	nih_assert (quiesce_requester != QUIESCE_REQUESTER_INVALID);
 
-	now = time (NULL);
+	now = quiesce_now ();
 
 	if (quiesce_phase == QUIESCE_PHASE_KILL) {
 		nih_assert (max_kill_timeout);
 
-		if ((now - quiesce_phase_time) > max_kill_timeout)
+		if (now > quiesce_deadline)
 			goto timed_out;
 
+		/* Catch any job whose dependents stopped without an
+		 * event being handled since.
+		 */
+		quiesce_stop_jobs ();
+
 	} else if (quiesce_phase == QUIESCE_PHASE_WAIT) {
 		int  timed_out = 0;
 
 		timed_out = ((now - quiesce_phase_time) >= QUIESCE_DEFAULT_JOB_RUNTIME);
 
+		if ((quiesce_timeout > 0)
+		    && ((now - quiesce_start_time) >= quiesce_timeout))
+			timed_out = 1;
+
 		if (timed_out
 			|| (session_end_jobs && ! job_process_jobs_running ())
 			|| ! job_process_jobs_running ()) {
@@ -232,11 +276,9 @@ quiesce_wait_callback (void *data, NihTimer *timer)
 			quiesce_phase = QUIESCE_PHASE_KILL;
 
 			/* reset for new phase */
-			quiesce_phase_time = time (NULL);
+			quiesce_phase_time = quiesce_now ();
 
-			max_kill_timeout = job_class_max_kill_timeout ();
-
-			job_process_stop_all ();
+			quiesce_kill_phase ();
 		}
 	} else {
 		nih_assert_not_reached ();
@@ -258,7 +300,216 @@ out:
 	quiesce_finalise ();
 
 	/* Deregister */
-	nih_free (timer);
+	nih_free (deadline);
+}
+
+/**
+ * quiesce_kill_phase:
+ *
+ * Begin the kill phase, setting the deadline by which all jobs must have
+ * stopped and stopping those that nothing else running depends on.
+ **/
+static void
+quiesce_kill_phase (void)
+{
+	nih_assert (quiesce_phase == QUIESCE_PHASE_KILL);
+
+	/* We'll attempt to wait for this long, but system
+	 * policy may prevent it such that we just get killed
+	 * and job processes reparented to PID 1.
+	 */
+	max_kill_timeout = job_class_max_kill_timeout ();
+
+	quiesce_deadline = quiesce_phase_time + max_kill_timeout;
+
+	if ((quiesce_timeout > 0)
+	    && (quiesce_start_time + quiesce_timeout < quiesce_deadline))
+		quiesce_deadline = quiesce_start_time + quiesce_timeout;
+
+	quiesce_stop_jobs ();
+}
+
+/**
+ * quiesce_stop_jobs:
+ *
+ * Stop each running job in the kill phase that no other running job
+ * depends on, so that jobs are stopped in the reverse of the order their
+ * start on conditions started them in while independent chains of jobs
+ * stop in parallel.  Called again as jobs stop, to stop those they
+ * depended on.
+ *
+ * A job is not held back for its dependents once there is no longer time
+ * for it to be killed before the deadline after they stop, nor when no
+ * job is stopping at all, as happens when jobs depend on each other.
+ **/
+void
+quiesce_stop_jobs (void)
+{
+	time_t remaining;
+	int    stopping = FALSE;
+	int    held = FALSE;
+
+	if (quiesce_phase != QUIESCE_PHASE_KILL)
+		return;
+
+	job_class_init ();
+
+	remaining = quiesce_deadline - quiesce_now ();
+
+	NIH_HASH_FOREACH_SAFE (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			if (job->goal == JOB_STOP) {
+				stopping = TRUE;
+				continue;
+			}
+
+			if ((remaining > class->kill_timeout)
+			    && quiesce_job_needed (job)) {
+				held = TRUE;
+				continue;
+			}
+
+			job_change_goal (job, JOB_STOP);
+			stopping = TRUE;
+		}
+	}
+
+	if ((! held) || stopping)
+		return;
+
+	/* Every job left is held back by another; they must depend on
+	 * each other, so stop them all.
+	 */
+	nih_debug ("Stopping jobs with circular dependencies");
+	job_process_stop_all ();
+}
+
+/**
+ * quiesce_kill_timeout:
+ * @job: job being killed.
+ *
+ * Determine how long to allow @job to stop after its kill signal before
+ * sending it SIGKILL; during the kill phase this is its kill timeout
+ * limited to the time left before the deadline.
+ *
+ * Returns: timeout in seconds.
+ **/
+time_t
+quiesce_kill_timeout (Job *job)
+{
+	time_t remaining;
+
+	nih_assert (job != NULL);
+
+	if (quiesce_phase != QUIESCE_PHASE_KILL)
+		return job->class->kill_timeout;
+
+	remaining = quiesce_deadline - quiesce_now ();
+	if (remaining < 1)
+		remaining = 1;
+
+	return (remaining < job->class->kill_timeout)
+		? remaining : job->class->kill_timeout;
+}
+
+/**
+ * quiesce_job_needed:
+ * @job: job to check.
+ *
+ * Returns: TRUE if an instance of another job class that is still
+ * running depends on @job, FALSE otherwise.
+ **/
+static int
+quiesce_job_needed (Job *job)
+{
+	static const char *names[] = {
+		JOB_STARTING_EVENT,
+		JOB_STARTED_EVENT,
+		NULL
+	};
+
+	nih_assert (job != NULL);
+
+	/* Only classes that wait for jobs to be starting or started can
+	 * depend on another.
+	 */
+	for (const char **name = names; *name; name++) {
+		JobSubscription *sub = NULL;
+		JobClass        *class;
+
+		while ((class = job_subscription_next_class (*name, &sub))) {
+			if (class == job->class)
+				continue;
+
+			if (! quiesce_depends (class, job->class))
+				continue;
+
+			NIH_HASH_FOREACH (class->instances, job_iter)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * quiesce_depends:
+ * @dependent: job class that may depend on @class,
+ * @class: job class.
+ *
+ * Determine whether the start on condition of @dependent waits for
+ * @class to be starting or started.  Conditions naming those events
+ * without a job, or with a job name that can only be known once
+ * expanded, are taken to depend on every job.
+ *
+ * Returns: TRUE if @dependent depends on @class, FALSE otherwise.
+ **/
+static int
+quiesce_depends (JobClass *dependent,
+		 JobClass *class)
+{
+	nih_assert (dependent != NULL);
+	nih_assert (class != NULL);
+
+	if (! dependent->start_on)
+		return FALSE;
+
+	NIH_TREE_FOREACH_POST (&dependent->start_on->node, iter) {
+		EventOperator    *oper = (EventOperator *)iter;
+		const EventMatch *job_match = NULL;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (strcmp (oper->name, JOB_STARTING_EVENT)
+		    && strcmp (oper->name, JOB_STARTED_EVENT))
+			continue;
+
+		/* The job name is either given first, or as JOB=NAME */
+		for (size_t i = 0; i < oper->match_len; i++) {
+			const EventMatch *match = &oper->match[i];
+
+			if (((i == 0) && (! match->key))
+			    || (match->key && (match->key_len == 3)
+				&& (! strncmp (match->key, "JOB", 3)))) {
+				job_match = match;
+				break;
+			}
+		}
+
+		if ((! job_match) || job_match->expand)
+			return TRUE;
+
+		if ((fnmatch (job_match->value, class->name, 0) == 0)
+		    != (job_match->negate != 0))
+			return TRUE;
+	}
+
+	return FALSE;
 }
 
 /**
@@ -308,7 +559,7 @@ quiesce_finalise (void)
 
 	finalising = TRUE;
 
-	diff = time (NULL) - quiesce_start_time;
+	diff = quiesce_now () - quiesce_start_time;
 
 	nih_info (_("Quiesce %s sequence took %s%d second%s"),
 			quiesce_reason,
@@ -316,10 +567,67 @@ quiesce_finalise (void)
 			(int)diff ? (int)diff : 1,
 			diff <= 1 ? "" : "s");
 
+	/* The system init must keep running once its jobs are stopped
+	 * for a fast reboot, so only tells those waiting for it.
+	 */
+	if (quiesce_requester == QUIESCE_REQUESTER_REBOOT) {
+		if (! quiesce_waiters)
+			return;
+
+		NIH_LIST_FOREACH_SAFE (quiesce_waiters, iter) {
+			NihListEntry *entry = (NihListEntry *)iter;
+
+			NIH_ZERO (control_quiesce_reply (
+					  (NihDBusMessage *)entry->data));
+			nih_free (entry);
+		}
+
+		return;
+	}
+
 	nih_main_loop_exit (0);
 
 }
 
+/**
+ * quiesce_wait:
+ * @message: Quiesce method call.
+ *
+ * Reply to @message once the jobs stopped by a fast reboot quiesce have
+ * all stopped, or immediately if they already have.
+ *
+ * Returns: zero on success, negative value on insufficient memory.
+ **/
+int
+quiesce_wait (NihDBusMessage *message)
+{
+	NihListEntry *entry;
+
+	nih_assert (message != NULL);
+
+	if (quiesce_phase == QUIESCE_PHASE_CLEANUP) {
+		NIH_ZERO (control_quiesce_reply (message));
+		return 0;
+	}
+
+	if (! quiesce_waiters) {
+		quiesce_waiters = nih_list_new (NULL);
+		if (! quiesce_waiters)
+			return -1;
+	}
+
+	entry = nih_list_entry_new (quiesce_waiters);
+	if (! entry)
+		return -1;
+
+	entry->data = message;
+	nih_ref (message, entry);
+
+	nih_list_add (quiesce_waiters, &entry->entry);
+
+	return 0;
+}
+
 /**
  * quiesce_complete:
  *
@@ -348,19 +656,19 @@ quiesce_complete (void)
 static int
 quiesce_event_match (Event *event)
 {
-	nih_assert (event);
-
-	job_class_init ();
+	JobSubscription *sub = NULL;
+	JobClass        *class;
 
-	NIH_HASH_FOREACH (job_classes, iter) {
-		JobClass *class = (JobClass *)iter;
+	nih_assert (event);
 
+	/* Only the classes whose start on condition names the event need
+	 * be considered; note that only the jobs start on condition is
+	 * relevant.
+	 */
+	while ((class = job_subscription_next_class (event->name, &sub))) {
 		if (! class->start_on)
 			continue;
 
-		/* Note that only the jobs start on condition is
-		 * relevant.
-		 */
 		NIH_TREE_FOREACH_POST (&class->start_on->node, iter) {
 			EventOperator *oper = (EventOperator *)iter;
 
@@ -394,3 +702,22 @@ quiesce_in_progress (void)
 {
 	return quiesce_phase != QUIESCE_PHASE_NOT_QUIESCED;
 }
+
+/**
+ * quiesce_now:
+ *
+ * The phase times and deadline are kept in monotonic time, as are job
+ * kill timers, so that the system clock being set during shutdown
+ * doesn't cut it short or hold it up.
+ *
+ * Returns: current monotonic time in seconds.
+ **/
+static time_t
+quiesce_now (void)
+{
+	struct timespec now;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	return now.tv_sec;
+}
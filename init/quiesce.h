@@ -20,7 +20,13 @@
 #ifndef INIT_QUIESCE_H
 #define INIT_QUIESCE_H
 
-#include <nih/timer.h>
+#include <time.h>
+
+#include <nih-dbus/dbus_message.h>
+
+#include "deadline.h"
+
+#include "job.h"
 
 /**
  * QUIESCE_DEFAULT_JOB_RUNTIME:
@@ -36,11 +42,15 @@
  * Reason for Session Init wishing to shutdown; either the Session Init
  * has been notified the system is being shutdown, or the session has
  * requested it be ended (for example due to a user logout request).
+ *
+ * The system init may also be asked to stop all jobs ahead of a fast
+ * reboot, in which case it does not exit once they have stopped.
  **/
 typedef enum quiesce_requester {
 	QUIESCE_REQUESTER_INVALID = -1,
 	QUIESCE_REQUESTER_SYSTEM = 0,
 	QUIESCE_REQUESTER_SESSION,
+	QUIESCE_REQUESTER_REBOOT,
 } QuiesceRequester;
 
 /**
@@ -66,11 +76,18 @@ typedef enum quiesce_phase {
 
 NIH_BEGIN_EXTERN
 
+extern int quiesce_timeout;
+
 void    quiesce                (QuiesceRequester requester);
-void    quiesce_wait_callback  (void *data, NihTimer *timer);
+int     quiesce_wait           (NihDBusMessage *message)
+	__attribute__ ((warn_unused_result));
+void    quiesce_wait_callback  (void *data, Deadline *deadline);
 void    quiesce_show_slow_jobs (void);
 void    quiesce_finalise       (void);
 void    quiesce_complete       (void);
+void    quiesce_stop_jobs      (void);
+time_t  quiesce_kill_timeout   (Job *job)
+	__attribute__ ((warn_unused_result));
 int     quiesce_in_progress    (void)
 	__attribute__ ((warn_unused_result));
 
@@ -0,0 +1,504 @@
+/* upstart
+ *
+ * resource.c - admission of jobs against resource budgets
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/main.h>
+#include <nih/logging.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "resource.h"
+#include "pressure.h"
+
+
+/* Prototypes for static functions */
+static int  resource_fits    (Job *job);
+static void resource_charge  (Job *job, int sign);
+static void resource_enqueue (Job *job);
+static int  resource_gated   (Job *job);
+
+
+/**
+ * resources:
+ *
+ * This hash table holds the budget of each resource that has been named
+ * by a job or the --resource option, indexed by name.
+ **/
+NihHash *resources = NULL;
+
+/**
+ * resource_queue:
+ *
+ * List of jobs waiting in the starting state for resources, highest
+ * priority first and otherwise in the order they asked for them; each
+ * entry is an NihListEntry with the job as its data, and is a child of
+ * that job.
+ **/
+static NihList *resource_queue = NULL;
+
+/**
+ * resource_max_starting:
+ *
+ * Maximum number of jobs admitted at once, or zero (or less) for no
+ * maximum.
+ **/
+int resource_max_starting = 0;
+
+/**
+ * resource_starting:
+ *
+ * Number of jobs admitted that have not yet released their resources.
+ **/
+static int resource_starting = 0;
+
+/**
+ * resource_pending:
+ *
+ * TRUE when resources have been released, or budgets raised, since
+ * resource_queue was last checked.
+ **/
+static int resource_pending = FALSE;
+
+
+/**
+ * resource_init:
+ *
+ * Initialise the resources hash table and queue.
+ **/
+void
+resource_init (void)
+{
+	if (! resources)
+		resources = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	if (! resource_queue)
+		resource_queue = NIH_MUST (nih_list_new (NULL));
+}
+
+/**
+ * resource_get:
+ * @name: name of resource.
+ *
+ * Look up the budget of the resource named @name, creating it with
+ * RESOURCE_DEFAULT_MAX available if it has not been seen before.
+ *
+ * Returns: resource.
+ **/
+Resource *
+resource_get (const char *name)
+{
+	Resource *resource;
+
+	nih_assert (name != NULL);
+
+	resource_init ();
+
+	resource = (Resource *)nih_hash_lookup (resources, name);
+	if (resource)
+		return resource;
+
+	resource = NIH_MUST (nih_new (resources, Resource));
+
+	nih_list_init (&resource->entry);
+	nih_alloc_set_destructor (resource, nih_list_destroy);
+
+	resource->name = NIH_MUST (nih_strdup (resource, name));
+	resource->max = RESOURCE_DEFAULT_MAX;
+	resource->used = 0;
+
+	nih_hash_add (resources, &resource->entry);
+
+	return resource;
+}
+
+/**
+ * resource_set_max:
+ * @name: name of resource,
+ * @max: amount available.
+ *
+ * Set the amount of the resource named @name available to jobs, in
+ * parts of RESOURCE_UNIT.  The budget applies to jobs admitted from now
+ * on; jobs already holding more than @max keep it until they release it.
+ **/
+void
+resource_set_max (const char *name,
+		  int         max)
+{
+	Resource *resource;
+
+	nih_assert (name != NULL);
+	nih_assert (max >= 0);
+
+	resource = resource_get (name);
+	resource->max = max;
+
+	resource_pending = TRUE;
+}
+
+/**
+ * resource_set_max_starting:
+ * @max: maximum number of jobs, or zero.
+ *
+ * Set the maximum number of jobs that may be admitted at once, whether
+ * or not they use any resources; zero removes the maximum.
+ **/
+void
+resource_set_max_starting (int max)
+{
+	nih_assert (max >= 0);
+
+	resource_max_starting = max;
+
+	resource_pending = TRUE;
+}
+
+/**
+ * resource_parse_amount:
+ * @str: string to parse,
+ * @amount: pointer to store amount in.
+ *
+ * Parse @str as a decimal amount of a resource with up to three places,
+ * such as "1" or "0.25", storing it in @amount in parts of RESOURCE_UNIT.
+ *
+ * Returns: zero on success, negative value if @str is not such an amount.
+ **/
+int
+resource_parse_amount (const char *str,
+		       int        *amount)
+{
+	unsigned long  whole;
+	int            frac = 0;
+	int            scale = RESOURCE_UNIT;
+	char          *endptr;
+
+	nih_assert (str != NULL);
+	nih_assert (amount != NULL);
+
+	if (! isdigit ((unsigned char)*str))
+		return -1;
+
+	errno = 0;
+	whole = strtoul (str, &endptr, 10);
+	if (errno || (whole > (INT_MAX / RESOURCE_UNIT) - 1))
+		return -1;
+
+	if (*endptr == '.') {
+		endptr++;
+		if (! isdigit ((unsigned char)*endptr))
+			return -1;
+
+		for (; isdigit ((unsigned char)*endptr); endptr++) {
+			if (scale == 1)
+				return -1;
+
+			scale /= 10;
+			frac += (*endptr - '0') * scale;
+		}
+	}
+
+	if (*endptr)
+		return -1;
+
+	*amount = (int)whole * RESOURCE_UNIT + frac;
+
+	return 0;
+}
+
+/**
+ * resource_acquire:
+ * @job: job leaving the starting state.
+ *
+ * Called before @job leaves the starting state to take the resources
+ * named by the uses stanza of its class, and a place among the jobs
+ * admitted at once when resource_max_starting is set.
+ *
+ * Unless it has already been admitted @job is queued in order of the
+ * priority of its class, and left in the starting state until
+ * resource_poll() admits it; so that when many jobs are started
+ * together, those with the highest priority are admitted first.
+ *
+ * Returns: TRUE if @job may continue, FALSE if it must wait.
+ **/
+int
+resource_acquire (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (job->admitted)
+		return TRUE;
+
+	if (! resource_gated (job))
+		return TRUE;
+
+	if (! job->admission) {
+		resource_enqueue (job);
+
+		nih_info (_("%s waiting for resources"), job_name (job));
+	}
+
+	resource_pending = TRUE;
+	nih_main_loop_interrupt ();
+
+	return FALSE;
+}
+
+/**
+ * resource_release:
+ * @job: job to release resources of.
+ *
+ * Return the resources held by @job to their budgets, or remove it from
+ * the queue if it is still waiting for them.  Queued jobs are admitted
+ * by the next call to resource_poll().
+ **/
+void
+resource_release (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (job->admission) {
+		nih_free (job->admission);
+		job->admission = NULL;
+	}
+
+	if (! job->admitted)
+		return;
+
+	resource_charge (job, -1);
+	job->admitted = FALSE;
+
+	resource_pending = TRUE;
+	nih_main_loop_interrupt ();
+}
+
+/**
+ * resource_restore:
+ * @job: deserialised job.
+ *
+ * Account for the resources held by @job after a re-exec, or queue it
+ * again if it was waiting for them.
+ **/
+void
+resource_restore (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if (job->admitted) {
+		resource_charge (job, 1);
+	} else if ((job->state == JOB_STARTING) && (! job->admission)
+		   && resource_gated (job)) {
+		resource_enqueue (job);
+
+		resource_pending = TRUE;
+	}
+}
+
+/**
+ * resource_recheck:
+ *
+ * Note that something other than the budgets, such as pressure on a
+ * resource falling, may let queued jobs be admitted, so that the next
+ * call to resource_poll() checks them again.
+ **/
+void
+resource_recheck (void)
+{
+	resource_pending = TRUE;
+	nih_main_loop_interrupt ();
+}
+
+/**
+ * resource_waiting:
+ * @job: job to check.
+ *
+ * Returns: TRUE if @job is queued waiting for resources, FALSE otherwise.
+ **/
+int
+resource_waiting (Job *job)
+{
+	nih_assert (job != NULL);
+
+	return job->admission != NULL;
+}
+
+/**
+ * resource_poll:
+ *
+ * Admit each queued job, in the order they were queued, that now fits
+ * within the budget and move it on out of the starting state.  Called
+ * once each time through the main loop; does nothing unless resources
+ * have been released since it last ran.
+ **/
+void
+resource_poll (void)
+{
+	if ((! resource_pending) || (! resource_queue))
+		return;
+
+	resource_pending = FALSE;
+
+	NIH_LIST_FOREACH_SAFE (resource_queue, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		Job          *job = (Job *)entry->data;
+
+		/* Still waiting for its starting event after a re-exec */
+		if (job->blocker)
+			continue;
+
+		if (! resource_fits (job))
+			continue;
+
+		nih_free (job->admission);
+		job->admission = NULL;
+
+		resource_charge (job, 1);
+		job->admitted = TRUE;
+
+		job_change_state (job, job_next_state (job));
+	}
+}
+
+/**
+ * resource_enqueue:
+ * @job: job to queue.
+ *
+ * Add @job to resource_queue after every job of the same or a higher
+ * priority.
+ **/
+static void
+resource_enqueue (Job *job)
+{
+	NihList *before = NULL;
+
+	nih_assert (job != NULL);
+	nih_assert (job->admission == NULL);
+
+	resource_init ();
+
+	NIH_LIST_FOREACH (resource_queue, iter) {
+		NihListEntry *entry = (NihListEntry *)iter;
+		Job          *queued = (Job *)entry->data;
+
+		if (queued->class->priority < job->class->priority) {
+			before = &entry->entry;
+			break;
+		}
+	}
+
+	job->admission = NIH_MUST (nih_list_entry_new (job));
+	job->admission->data = job;
+
+	nih_list_add (before ? before : resource_queue,
+		      &job->admission->entry);
+}
+
+
+/**
+ * resource_gated:
+ * @job: job to check.
+ *
+ * Returns: TRUE if @job must be admitted before it leaves the starting
+ * state, FALSE otherwise.
+ **/
+static int
+resource_gated (Job *job)
+{
+	nih_assert (job != NULL);
+
+	return (job->class->uses_len || job->class->pressure_len
+		|| (resource_max_starting > 0));
+}
+
+/**
+ * resource_fits:
+ * @job: job to check.
+ *
+ * Returns: TRUE if the resources used by @job are available and the
+ * pressure on those named by its pressure stanzas is not high, FALSE
+ * otherwise.
+ **/
+static int
+resource_fits (Job *job)
+{
+	nih_assert (job != NULL);
+
+	if ((resource_max_starting > 0)
+	    && (resource_starting >= resource_max_starting))
+		return FALSE;
+
+	for (size_t i = 0; i < job->class->uses_len; i++) {
+		Resource *resource;
+
+		resource = resource_get (job->class->uses[i]);
+
+		if (resource->used
+		    && (resource->used + job->class->uses_amount[i] > resource->max))
+			return FALSE;
+	}
+
+	for (size_t i = 0; i < job->class->pressure_len; i++) {
+		if (pressure_high (job->class->pressure[i],
+				   job->class->pressure_max[i]))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * resource_charge:
+ * @job: job to charge,
+ * @sign: 1 to take the resources used by @job, -1 to return them.
+ *
+ * Adjust the amount used of each resource named by the class of @job,
+ * and the number of jobs admitted.
+ **/
+static void
+resource_charge (Job *job,
+		 int  sign)
+{
+	nih_assert (job != NULL);
+	nih_assert ((sign == 1) || (sign == -1));
+
+	resource_starting += sign;
+	nih_assert (resource_starting >= 0);
+
+	for (size_t i = 0; i < job->class->uses_len; i++) {
+		Resource *resource;
+
+		resource = resource_get (job->class->uses[i]);
+		resource->used += sign * job->class->uses_amount[i];
+
+		nih_assert (resource->used >= 0);
+	}
+}
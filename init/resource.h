@@ -0,0 +1,88 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_RESOURCE_H
+#define INIT_RESOURCE_H
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job.h"
+
+
+/**
+ * RESOURCE_UNIT:
+ *
+ * Amounts of resources are held as fixed-point numbers of this many
+ * parts to the unit, so that "uses cpu 0.5" is an amount of 500.
+ **/
+#define RESOURCE_UNIT 1000
+
+/**
+ * RESOURCE_DEFAULT_MAX:
+ *
+ * Amount available of a resource that has not been otherwise given by
+ * the --resource option.
+ **/
+#define RESOURCE_DEFAULT_MAX RESOURCE_UNIT
+
+
+/**
+ * Resource:
+ * @entry: list header,
+ * @name: name of resource,
+ * @max: amount available,
+ * @used: amount held by admitted jobs.
+ *
+ * Budget of a resource named by the uses stanza of jobs; these are
+ * created as needed and held in the resources hash table.
+ **/
+typedef struct resource {
+	NihList  entry;
+	char    *name;
+	int      max;
+	int      used;
+} Resource;
+
+
+NIH_BEGIN_EXTERN
+
+extern NihHash *resources;
+extern int      resource_max_starting;
+
+void      resource_init         (void);
+
+Resource *resource_get          (const char *name);
+void      resource_set_max      (const char *name, int max);
+void      resource_set_max_starting (int max);
+
+int       resource_parse_amount (const char *str, int *amount)
+	__attribute__ ((warn_unused_result));
+
+int       resource_acquire      (Job *job);
+void      resource_release      (Job *job);
+void      resource_restore      (Job *job);
+void      resource_recheck      (void);
+int       resource_waiting      (Job *job);
+
+void      resource_poll         (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_RESOURCE_H */
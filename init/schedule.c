@@ -0,0 +1,746 @@
+/* upstart
+ *
+ * schedule.c - timer and calendar events
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/tree.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+
+#include "environ.h"
+#include "event.h"
+#include "events.h"
+#include "event_operator.h"
+#include "job_class.h"
+#include "conf.h"
+#include "state.h"
+#include "schedule.h"
+
+
+/* Prototypes for static functions */
+static Schedule *schedule_new           (ScheduleType type, const char *spec,
+					 time_t period);
+static void      schedule_want          (ScheduleType type, const char *spec);
+static void      schedule_scan          (EventOperator *root);
+static void      schedule_arm_calendar  (Schedule *schedule);
+static void      schedule_timer         (Schedule *schedule,
+					 Deadline *deadline);
+static void      schedule_emit          (Schedule *schedule);
+static time_t    schedule_now           (void);
+static json_object *schedule_serialise  (const Schedule *schedule)
+	__attribute__ ((warn_unused_result));
+static const char *schedule_type_enum_to_str (ScheduleType type)
+	__attribute__ ((warn_unused_result));
+static ScheduleType schedule_type_str_to_enum (const char *type)
+	__attribute__ ((warn_unused_result));
+
+
+/**
+ * schedules:
+ *
+ * This list holds the timers named by the conditions of the loaded job
+ * classes; each item is a Schedule structure.
+ **/
+NihList *schedules = NULL;
+
+/**
+ * schedule_start_time:
+ *
+ * Monotonic time init started, which AFTER delays are relative to; kept
+ * across a stateful re-exec.
+ **/
+time_t schedule_start_time = 0;
+
+/**
+ * schedule_pending:
+ *
+ * TRUE when job classes have been added or removed since the schedules
+ * list was last brought up to date.
+ **/
+static int schedule_pending = FALSE;
+
+
+/**
+ * schedule_init:
+ *
+ * Initialise the schedules list, and the time init started.
+ **/
+void
+schedule_init (void)
+{
+	if (! schedules)
+		schedules = NIH_MUST (nih_list_new (NULL));
+
+	if (! schedule_start_time)
+		schedule_start_time = schedule_now ();
+}
+
+
+/**
+ * schedule_parse_duration:
+ * @str: string to parse,
+ * @secs: pointer to store duration in.
+ *
+ * Parse @str as a whole number of seconds, optionally followed by one of
+ * the units "s", "m", "h" or "d", such as "90" or "5m", storing it in
+ * @secs.
+ *
+ * Returns: zero on success, negative value if @str is not a duration.
+ **/
+int
+schedule_parse_duration (const char *str,
+			 time_t     *secs)
+{
+	unsigned long  value;
+	unsigned long  unit;
+	char          *endptr;
+
+	nih_assert (str != NULL);
+	nih_assert (secs != NULL);
+
+	if (! isdigit ((unsigned char)*str))
+		return -1;
+
+	errno = 0;
+	value = strtoul (str, &endptr, 10);
+	if (errno || (! value))
+		return -1;
+
+	switch (*endptr) {
+	case '\0':
+	case 's':
+		unit = 1;
+		break;
+	case 'm':
+		unit = 60;
+		break;
+	case 'h':
+		unit = 60 * 60;
+		break;
+	case 'd':
+		unit = 24 * 60 * 60;
+		break;
+	default:
+		return -1;
+	}
+
+	if (*endptr && endptr[1])
+		return -1;
+
+	if (value > INT_MAX / unit)
+		return -1;
+
+	*secs = (time_t)(value * unit);
+
+	return 0;
+}
+
+
+/**
+ * schedule_get:
+ * @type: kind of schedule,
+ * @spec: duration as given, or NULL for SCHEDULE_CALENDAR.
+ *
+ * Returns: existing schedule of @type for @spec, or NULL if there is
+ * none.
+ **/
+Schedule *
+schedule_get (ScheduleType  type,
+	      const char   *spec)
+{
+	nih_assert ((type == SCHEDULE_CALENDAR) == (spec == NULL));
+
+	schedule_init ();
+
+	NIH_LIST_FOREACH (schedules, iter) {
+		Schedule *schedule = (Schedule *)iter;
+
+		if (schedule->type != type)
+			continue;
+
+		if (spec && strcmp (schedule->spec, spec))
+			continue;
+
+		return schedule;
+	}
+
+	return NULL;
+}
+
+/**
+ * schedule_changed:
+ *
+ * Note that job classes have been added or removed, so that the
+ * schedules list is brought up to date by the next call to
+ * schedule_poll().
+ **/
+void
+schedule_changed (void)
+{
+	schedule_pending = TRUE;
+}
+
+/**
+ * schedule_poll:
+ *
+ * Create a schedule for each timer that the start on and stop on
+ * conditions of the loaded job classes name, and free any that they no
+ * longer do.  Called once each time through the main loop; does nothing
+ * unless job classes have been added or removed since it last ran.
+ **/
+void
+schedule_poll (void)
+{
+	if (! schedule_pending)
+		return;
+
+	schedule_init ();
+	job_class_init ();
+
+	/* Job files not yet parsed may name timers too */
+	if (conf_lazy) {
+		conf_lazy_load_event (TIMER_EVENT);
+		conf_lazy_load_event (CALENDAR_EVENT);
+	}
+
+	schedule_pending = FALSE;
+
+	NIH_LIST_FOREACH (schedules, iter) {
+		Schedule *schedule = (Schedule *)iter;
+
+		schedule->seen = FALSE;
+	}
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		schedule_scan (class->start_on);
+		schedule_scan (class->stop_on);
+	}
+
+	NIH_LIST_FOREACH_SAFE (schedules, iter) {
+		Schedule *schedule = (Schedule *)iter;
+
+		if (! schedule->seen)
+			nih_free (schedule);
+	}
+}
+
+
+/**
+ * schedule_scan:
+ * @root: operator tree to scan.
+ *
+ * Mark the schedule for each timer named by the tree rooted at @root as
+ * wanted, creating those that don't yet exist.
+ **/
+static void
+schedule_scan (EventOperator *root)
+{
+	if (! root)
+		return;
+
+	NIH_TREE_FOREACH_POST (&root->node, iter) {
+		EventOperator *oper = (EventOperator *)iter;
+
+		if (oper->type != EVENT_MATCH)
+			continue;
+
+		if (! strcmp (oper->name, CALENDAR_EVENT)) {
+			schedule_want (SCHEDULE_CALENDAR, NULL);
+			continue;
+		}
+
+		if (strcmp (oper->name, TIMER_EVENT))
+			continue;
+
+		for (char **e = oper->env; e && *e; e++) {
+			if (! strncmp (*e, "INTERVAL=", 9)) {
+				schedule_want (SCHEDULE_INTERVAL, *e + 9);
+			} else if (! strncmp (*e, "AFTER=", 6)) {
+				schedule_want (SCHEDULE_AFTER, *e + 6);
+			}
+		}
+	}
+}
+
+/**
+ * schedule_want:
+ * @type: kind of schedule,
+ * @spec: duration as given, or NULL for SCHEDULE_CALENDAR.
+ *
+ * Mark the schedule of @type for @spec as wanted, creating it if it
+ * doesn't exist.  Durations that can't be parsed are ignored with a
+ * warning, since they can never match an event.
+ **/
+static void
+schedule_want (ScheduleType  type,
+	       const char   *spec)
+{
+	Schedule *schedule;
+	time_t    period = 0;
+
+	schedule = schedule_get (type, spec);
+	if (! schedule) {
+		if (spec && (schedule_parse_duration (spec, &period) < 0)) {
+			nih_warn (_("Ignoring invalid duration for %s event: %s"),
+				  TIMER_EVENT, spec);
+			return;
+		}
+
+		schedule = schedule_new (type, spec, period);
+	}
+
+	schedule->seen = TRUE;
+}
+
+/**
+ * schedule_new:
+ * @type: kind of schedule,
+ * @spec: duration as given, or NULL for SCHEDULE_CALENDAR,
+ * @period: @spec in seconds.
+ *
+ * Allocate a schedule, add it to the schedules list and arrange for its
+ * event to be emitted.  A SCHEDULE_AFTER whose delay has already passed
+ * is never emitted.
+ *
+ * Returns: new schedule.
+ **/
+static Schedule *
+schedule_new (ScheduleType  type,
+	      const char   *spec,
+	      time_t        period)
+{
+	Schedule *schedule;
+	time_t    due;
+
+	schedule_init ();
+
+	schedule = NIH_MUST (nih_new (schedules, Schedule));
+
+	nih_list_init (&schedule->entry);
+	nih_alloc_set_destructor (schedule, nih_list_destroy);
+
+	schedule->type = type;
+	schedule->spec = spec ? NIH_MUST (nih_strdup (schedule, spec)) : NULL;
+	schedule->period = period;
+	schedule->deadline = NULL;
+	schedule->last = 0;
+	schedule->seen = FALSE;
+
+	switch (type) {
+	case SCHEDULE_INTERVAL:
+		schedule->deadline = NIH_MUST (deadline_add_periodic (
+				schedule, period,
+				(DeadlineCb)schedule_timer, schedule));
+		break;
+	case SCHEDULE_AFTER:
+		due = schedule_start_time + period;
+		if (due <= schedule_now ())
+			break;
+
+		schedule->deadline = NIH_MUST (deadline_add_timeout (
+				schedule, period,
+				(DeadlineCb)schedule_timer, schedule));
+		deadline_set_due (schedule->deadline, due);
+		break;
+	case SCHEDULE_CALENDAR:
+		schedule_arm_calendar (schedule);
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+
+	nih_list_add (schedules, &schedule->entry);
+
+	return schedule;
+}
+
+/**
+ * schedule_arm_calendar:
+ * @schedule: calendar schedule.
+ *
+ * Arrange for @schedule to be due at the start of the next minute of
+ * the wall clock.  The deadline itself is in monotonic time, so a
+ * change to the system clock is noticed at the next minute.
+ **/
+static void
+schedule_arm_calendar (Schedule *schedule)
+{
+	time_t now;
+
+	nih_assert (schedule != NULL);
+	nih_assert (schedule->type == SCHEDULE_CALENDAR);
+	nih_assert (schedule->deadline == NULL);
+
+	now = time (NULL);
+
+	schedule->deadline = NIH_MUST (deadline_add_timeout (
+			schedule, 60 - (now % 60),
+			(DeadlineCb)schedule_timer, schedule));
+}
+
+/**
+ * schedule_timer:
+ * @schedule: schedule that is due,
+ * @deadline: deadline that caused us to be called.
+ *
+ * Emit the event of @schedule, and for a calendar schedule arrange for
+ * it to be due again at the next minute.
+ **/
+static void
+schedule_timer (Schedule *schedule,
+		Deadline *deadline)
+{
+	nih_assert (schedule != NULL);
+	nih_assert (deadline != NULL);
+	nih_assert (schedule->deadline == deadline);
+
+	/* Timeouts are freed on return */
+	if (schedule->type != SCHEDULE_INTERVAL)
+		schedule->deadline = NULL;
+
+	schedule_emit (schedule);
+
+	if (schedule->type == SCHEDULE_CALENDAR)
+		schedule_arm_calendar (schedule);
+}
+
+/**
+ * schedule_emit:
+ * @schedule: schedule to emit event of.
+ *
+ * Emit a timer event with INTERVAL or AFTER set to the duration named
+ * in the conditions of jobs, or a calendar event for the minute just
+ * begun with the MINUTE, HOUR, DAY, MONTH and WEEKDAY fields of local
+ * time in that order, so that they may be matched positionally as the
+ * fields of a crontab are, followed by YEAR.  Calendar events are only
+ * emitted once for each minute even if the clock is slewed back into
+ * the same minute.
+ **/
+static void
+schedule_emit (Schedule *schedule)
+{
+	char       **env;
+	size_t       len = 0;
+	time_t       now;
+	struct tm    tm;
+
+	nih_assert (schedule != NULL);
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+
+	switch (schedule->type) {
+	case SCHEDULE_INTERVAL:
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "INTERVAL=%s", schedule->spec));
+		NIH_MUST (event_new (NULL, TIMER_EVENT, env));
+		break;
+	case SCHEDULE_AFTER:
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "AFTER=%s", schedule->spec));
+		NIH_MUST (event_new (NULL, TIMER_EVENT, env));
+		break;
+	case SCHEDULE_CALENDAR:
+		now = time (NULL);
+		now -= now % 60;
+
+		if (now == schedule->last) {
+			nih_free (env);
+			return;
+		}
+
+		schedule->last = now;
+
+		nih_assert (localtime_r (&now, &tm) != NULL);
+
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "MINUTE=%d", tm.tm_min));
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "HOUR=%d", tm.tm_hour));
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "DAY=%d", tm.tm_mday));
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "MONTH=%d", tm.tm_mon + 1));
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "WEEKDAY=%d", tm.tm_wday));
+		NIH_MUST (environ_set (&env, NULL, &len, TRUE,
+				       "YEAR=%d", tm.tm_year + 1900));
+		NIH_MUST (event_new (NULL, CALENDAR_EVENT, env));
+		break;
+	default:
+		nih_assert_not_reached ();
+	}
+}
+
+/**
+ * schedule_now:
+ *
+ * Returns: current monotonic time in seconds.
+ **/
+static time_t
+schedule_now (void)
+{
+	struct timespec now;
+
+	nih_assert (clock_gettime (CLOCK_MONOTONIC, &now) == 0);
+
+	return now.tv_sec;
+}
+
+
+/**
+ * schedule_serialise:
+ * @schedule: schedule to serialise.
+ *
+ * Convert @schedule into a JSON representation for serialisation.
+ *
+ * Returns: JSON-serialised Schedule object, or NULL on error.
+ **/
+static json_object *
+schedule_serialise (const Schedule *schedule)
+{
+	json_object *json;
+
+	nih_assert (schedule != NULL);
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	if (! state_set_json_enum_var (json,
+				schedule_type_enum_to_str,
+				"type", schedule->type))
+		goto error;
+
+	if (schedule->spec
+	    && (! state_set_json_string_var_from_obj (json, schedule, spec)))
+		goto error;
+
+	if (schedule->deadline
+	    && (! state_set_json_int_var (json, "due",
+					  schedule->deadline->due)))
+		goto error;
+
+	if (! state_set_json_int_var_from_obj (json, schedule, last))
+		goto error;
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * schedule_serialise_all:
+ *
+ * Convert the schedules list, and the time init started, into a JSON
+ * representation.
+ *
+ * Returns: JSON object encoding the schedules, or NULL on error.
+ **/
+json_object *
+schedule_serialise_all (void)
+{
+	json_object *json;
+	json_object *json_timers;
+
+	schedule_init ();
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	if (! state_set_json_int_var (json, "start_time", schedule_start_time))
+		goto error;
+
+	json_timers = json_object_new_array ();
+	if (! json_timers)
+		goto error;
+
+	json_object_object_add (json, "timers", json_timers);
+
+	NIH_LIST_FOREACH (schedules, iter) {
+		Schedule    *schedule = (Schedule *)iter;
+		json_object *json_schedule;
+
+		json_schedule = schedule_serialise (schedule);
+		if (! json_schedule)
+			goto error;
+
+		json_object_array_add (json_timers, json_schedule);
+	}
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * schedule_deserialise_all:
+ * @json: root of JSON-serialised state.
+ *
+ * Restore the schedules list, and the time init started, from @json so
+ * that intervals keep their phase, delays after startup that have been
+ * emitted are not emitted again and calendar events are not repeated
+ * for the same minute.  Older state data holds no schedules, in which
+ * case they are created afresh by schedule_poll().
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+schedule_deserialise_all (json_object *json)
+{
+	json_object *json_schedules;
+	json_object *json_timers;
+
+	nih_assert (json != NULL);
+
+	schedule_init ();
+
+	if (! json_object_object_get_ex (json, "schedules", &json_schedules))
+		return 0;
+
+	if (! state_check_json_type (json_schedules, object))
+		goto error;
+
+	if (! state_get_json_int_var (json_schedules, "start_time",
+				      schedule_start_time))
+		goto error;
+
+	if (! json_object_object_get_ex (json_schedules, "timers", &json_timers))
+		goto error;
+
+	if (! state_check_json_type (json_timers, array))
+		goto error;
+
+	for (int i = 0; i < json_object_array_length (json_timers); i++) {
+		json_object     *json_schedule;
+		Schedule        *schedule;
+		ScheduleType     type = -1;
+		nih_local char  *spec = NULL;
+		time_t           period = 0;
+		time_t           due = 0;
+
+		json_schedule = json_object_array_get_idx (json_timers, i);
+		if (! json_schedule)
+			goto error;
+
+		if (! state_check_json_type (json_schedule, object))
+			goto error;
+
+		if (! state_get_json_enum_var (json_schedule,
+					schedule_type_str_to_enum,
+					"type", type))
+			goto error;
+
+		if (json_object_object_get_ex (json_schedule, "spec", NULL)) {
+			if (! state_get_json_string_var_strict (json_schedule,
+						"spec", NULL, spec))
+				goto error;
+
+			if (schedule_parse_duration (spec, &period) < 0)
+				goto error;
+		}
+
+		if ((type == SCHEDULE_CALENDAR) != (spec == NULL))
+			goto error;
+
+		if (schedule_get (type, spec))
+			continue;
+
+		schedule = schedule_new (type, spec, period);
+
+		if (! state_get_json_int_var_to_obj (json_schedule, schedule, last))
+			goto error;
+
+		if (json_object_object_get_ex (json_schedule, "due", NULL)) {
+			if (! state_get_json_int_var (json_schedule, "due", due))
+				goto error;
+
+			if (schedule->deadline)
+				deadline_set_due (schedule->deadline, due);
+		} else if (schedule->deadline) {
+			/* Emitted before the re-exec */
+			nih_free (schedule->deadline);
+			schedule->deadline = NULL;
+		}
+	}
+
+	schedule_changed ();
+
+	return 0;
+
+error:
+	return -1;
+}
+
+/**
+ * schedule_type_enum_to_str:
+ * @type: ScheduleType.
+ *
+ * Convert ScheduleType to a string representation.
+ *
+ * Returns: string representation of @type, or NULL if not known.
+ **/
+static const char *
+schedule_type_enum_to_str (ScheduleType type)
+{
+	state_enum_to_str (SCHEDULE_INTERVAL, type);
+	state_enum_to_str (SCHEDULE_AFTER, type);
+	state_enum_to_str (SCHEDULE_CALENDAR, type);
+
+	return NULL;
+}
+
+/**
+ * schedule_type_str_to_enum:
+ * @type: string ScheduleType value.
+ *
+ * Convert @type back into an enum value.
+ *
+ * Returns: ScheduleType representing @type, or -1 if not known.
+ **/
+static ScheduleType
+schedule_type_str_to_enum (const char *type)
+{
+	state_str_to_enum (SCHEDULE_INTERVAL, type);
+	state_str_to_enum (SCHEDULE_AFTER, type);
+	state_str_to_enum (SCHEDULE_CALENDAR, type);
+
+	return -1;
+}
@@ -0,0 +1,96 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_SCHEDULE_H
+#define INIT_SCHEDULE_H
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+
+#include <json.h>
+
+#include "deadline.h"
+
+
+/**
+ * ScheduleType:
+ *
+ * Kinds of timer-driven event: SCHEDULE_INTERVAL emits a timer event
+ * every so often, SCHEDULE_AFTER emits one once, so long after init
+ * started, and SCHEDULE_CALENDAR emits a calendar event at the start of
+ * each minute of the wall clock.
+ **/
+typedef enum schedule_type {
+	SCHEDULE_INTERVAL,
+	SCHEDULE_AFTER,
+	SCHEDULE_CALENDAR,
+} ScheduleType;
+
+/**
+ * Schedule:
+ * @entry: list header,
+ * @type: kind of event emitted,
+ * @spec: duration as given in the start on or stop on condition,
+ *        or NULL for SCHEDULE_CALENDAR,
+ * @period: @spec in seconds,
+ * @deadline: deadline at which the event is next emitted, or NULL once
+ *            a SCHEDULE_AFTER has been,
+ * @last: wall clock minute a SCHEDULE_CALENDAR event was last emitted
+ *        for,
+ * @seen: set while job classes are being scanned.
+ *
+ * One of these exists for each distinct timer that the start on and
+ * stop on conditions of loaded jobs refer to; they're held in the
+ * schedules list and kept up to date by schedule_poll().
+ **/
+typedef struct schedule {
+	NihList       entry;
+	ScheduleType  type;
+	char         *spec;
+	time_t        period;
+	Deadline     *deadline;
+	time_t        last;
+	int           seen;
+} Schedule;
+
+
+NIH_BEGIN_EXTERN
+
+extern NihList *schedules;
+extern time_t   schedule_start_time;
+
+void         schedule_init            (void);
+
+int          schedule_parse_duration  (const char *str, time_t *secs)
+	__attribute__ ((warn_unused_result));
+
+Schedule    *schedule_get             (ScheduleType type, const char *spec);
+
+void         schedule_changed         (void);
+void         schedule_poll            (void);
+
+json_object *schedule_serialise_all   (void)
+	__attribute__ ((warn_unused_result));
+int          schedule_deserialise_all (json_object *json)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* INIT_SCHEDULE_H */
@@ -37,6 +37,7 @@
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/string.h>
 #include <nih/logging.h>
 #include <nih/error.h>
@@ -53,6 +54,7 @@ extern json_object *json_sessions;
 static json_object  *session_serialise   (const Session *session)
 	__attribute__ ((warn_unused_result));
 
+static StateIndex *session_index_new (const void *parent);
 static Session *session_deserialise (json_object *json)
 	__attribute__ ((warn_unused_result));
 
@@ -65,6 +67,31 @@ static Session *session_deserialise (json_object *json)
  **/
 NihList *sessions = NULL;
 
+/**
+ * session_chroots:
+ *
+ * This hash table indexes the sessions in the sessions list by the path
+ * of their chroot; each item is a SessionChroot structure.
+ **/
+NihHash *session_chroots = NULL;
+
+/**
+ * session_conn_slot:
+ *
+ * D-Bus connection data slot holding the session of the client at the
+ * other end of the connection once it has been resolved, or -1 until
+ * the slot is allocated.
+ **/
+static dbus_int32_t session_conn_slot = -1;
+
+/**
+ * session_conn_none:
+ *
+ * Stored in session_conn_slot for connections whose client is not in a
+ * chroot, so that they can be told apart from those not yet resolved.
+ **/
+static int session_conn_none;
+
 /**
  * chroot_sessions:
  *
@@ -76,6 +103,7 @@ int chroot_sessions = FALSE;
 
 /* Prototypes for static functions */
 static void session_create_conf_source (Session *sesson, int deserialised);
+static void session_remember (DBusConnection *conn, Session *session);
 
 /**
  * session_init:
@@ -87,6 +115,9 @@ session_init (void)
 {
 	if (! sessions)
 		sessions = NIH_MUST (nih_list_new (NULL));
+
+	if (! session_chroots)
+		session_chroots = NIH_MUST (nih_hash_string_new (NULL, 0));
 }
 
 /**
@@ -115,7 +146,8 @@ Session *
 session_new (const void *parent,
 	     const char *chroot)
 {
-	Session *session;
+	Session       *session;
+	SessionChroot *index;
 
 	nih_assert (chroot);
 
@@ -135,9 +167,22 @@ session_new (const void *parent,
 
 	session->conf_path = NULL;
 
+	index = nih_new (session, SessionChroot);
+	if (! index) {
+		nih_free (session);
+		return NULL;
+	}
+
+	nih_list_init (&index->entry);
+	nih_alloc_set_destructor (index, nih_list_destroy);
+
+	index->chroot = session->chroot;
+	index->session = session;
+
 	nih_alloc_set_destructor (session, nih_list_destroy);
 
 	nih_list_add (sessions, &session->entry);
+	nih_hash_add (session_chroots, &index->entry);
 
 	return session;
 }
@@ -149,6 +194,10 @@ session_new (const void *parent,
  *
  * Create a new session, based on the specified D-Bus message.
  *
+ * The client at the other end of a D-Bus connection doesn't change, so
+ * its session is only resolved by the first message received over the
+ * connection and remembered for the rest.
+ *
  * Returns: new Session, or NULL on error.
  **/
 Session *
@@ -159,9 +208,11 @@ session_from_dbus (const void     *parent,
 	unsigned long    unix_process_id;
 	char             root[PATH_MAX];
 	Session         *session;
+	SessionChroot   *index;
 	nih_local char  *conf_path = NULL;
 	nih_local char  *symlink = NULL;
 	ssize_t          len;
+	void            *data;
 
 	nih_assert (message != NULL);
 
@@ -173,6 +224,22 @@ session_from_dbus (const void     *parent,
 
 	session_init ();
 
+	/* Use the session resolved for an earlier message received over
+	 * the same connection.
+	 */
+	if (session_conn_slot < 0)
+		dbus_connection_allocate_data_slot (&session_conn_slot);
+
+	if (session_conn_slot >= 0) {
+		data = dbus_connection_get_data (message->connection,
+						 session_conn_slot);
+		if (data == &session_conn_none)
+			return NULL;
+
+		if (data)
+			return (Session *)data;
+	}
+
 	dbus_error_init (&dbus_error);
 
 	/* Query origin pid of the caller */
@@ -191,30 +258,52 @@ session_from_dbus (const void     *parent,
 	root[len] = '\0';
 
 	/* Path is not inside a chroot */
-	if (! strcmp (root, "/"))
+	if (! strcmp (root, "/")) {
+		session_remember (message->connection, NULL);
 		return NULL;
+	}
 
-	/* Now find in the existing Sessions list */
-	NIH_LIST_FOREACH_SAFE (sessions, iter) {
-		Session *session = (Session *)iter;
-
-		if (strcmp (session->chroot, root))
-			/* ignore sessions relating to other chroots */
-			continue;
+	/* Now find in the existing Sessions, or make a new one */
+	index = (SessionChroot *)nih_hash_lookup (session_chroots, root);
+	if (index) {
+		session = index->session;
 
 		if (! session->conf_path)
 			session_create_conf_source (session, FALSE);
-
-		return session;
+	} else {
+		session = NIH_MUST (session_new (parent, root));
+		session_create_conf_source (session, FALSE);
 	}
 
-	/* Didn't find one, make a new one */
-	session = NIH_MUST (session_new (parent, root));
-	session_create_conf_source (session, FALSE);
+	session_remember (message->connection, session);
 
 	return session;
 }
 
+/**
+ * session_remember:
+ * @conn: D-Bus connection,
+ * @session: session of the client at the other end of @conn, or NULL.
+ *
+ * Remember @session as the session of the client connected by @conn,
+ * for the life of the connection.  Sessions are only freed on shutdown,
+ * so the connection may safely point to it.  If there is insufficient
+ * memory, the session will simply be resolved again next time.
+ **/
+static void
+session_remember (DBusConnection *conn,
+		  Session        *session)
+{
+	nih_assert (conn != NULL);
+
+	if (session_conn_slot < 0)
+		return;
+
+	dbus_connection_set_data (conn, session_conn_slot,
+				  session ? (void *)session
+				  : (void *)&session_conn_none, NULL);
+}
+
 /**
  * session_create_conf_source:
  * @session: Session,
@@ -445,6 +534,30 @@ error:
 	return -1;
 }
 
+/**
+ * session_index_new:
+ *
+ * @parent: parent object for new index.
+ *
+ * StateIndexBuilder for the list of sessions.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+static StateIndex *
+session_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	session_init ();
+
+	index = NIH_MUST (state_index_new (parent));
+
+	NIH_LIST_FOREACH (sessions, iter)
+		NIH_MUST (state_index_add (index, iter));
+
+	return index;
+}
+
 /**
  * session_get_index:
  *
@@ -463,6 +576,13 @@ session_get_index (const Session *session)
 	if (! session)
 		return 0;
 
+	if (state_context) {
+		i = state_context_get (&state_context->sessions,
+				       session_index_new, session);
+
+		return i < 0 ? -1 : i + 1;
+	}
+
 	/* Sessions are serialised in order, so just return the list
 	 * index.
 	 */
@@ -500,6 +620,14 @@ session_from_index (int idx)
 	if (! idx)
 		return NULL;
 
+	if (state_context) {
+		session = state_context_lookup (&state_context->sessions,
+						session_index_new, idx - 1);
+		nih_assert (session);
+
+		return session;
+	}
+
 	i = 1;
 	NIH_LIST_FOREACH (sessions, iter) {
 		session = (Session *)iter;
@@ -24,6 +24,7 @@
 
 #include <nih/macros.h>
 #include <nih/list.h>
+#include <nih/hash.h>
 
 #include <nih-dbus/dbus_message.h>
 
@@ -72,10 +73,27 @@ typedef struct session {
 	char *  conf_path;
 } Session;
 
+/**
+ * SessionChroot:
+ * @entry: list header,
+ * @chroot: chroot path of @session,
+ * @session: session.
+ *
+ * This structure indexes @session by its chroot in the session_chroots
+ * hash table.  It is an nih_alloc() child of the session, so it is
+ * automatically removed when that is freed.
+ **/
+typedef struct session_chroot {
+	NihList  entry;
+	char    *chroot;
+	Session *session;
+} SessionChroot;
+
 
 NIH_BEGIN_EXTERN
 
 extern NihList *sessions;
+extern NihHash *session_chroots;
 
 void           session_init        (void);
 void           session_destroy     (void);
@@ -0,0 +1,273 @@
+/* upstart
+ *
+ * snapshot.c - memory-mapped snapshot of job state
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include <nih/macros.h>
+#include <nih/hash.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "process.h"
+#include "job_class.h"
+#include "job.h"
+#include "snapshot.h"
+
+
+/* Prototypes for static functions */
+static void snapshot_add (JobClass *class, Job *job);
+
+
+/**
+ * snapshot_enabled:
+ *
+ * If TRUE, the init daemon keeps a snapshot of job state mapped from
+ * snapshot_file() for clients to read without D-Bus.
+ **/
+int snapshot_enabled = FALSE;
+
+/**
+ * snapshot:
+ *
+ * Mapped snapshot, NULL until snapshot_init() has been called.
+ **/
+static Snapshot *snapshot = NULL;
+
+/**
+ * snapshot_pending:
+ *
+ * TRUE when job state has changed since the snapshot was last written.
+ **/
+static int snapshot_pending = FALSE;
+
+
+/**
+ * snapshot_file:
+ *
+ * Returns: path of the snapshot, which may be overriden by the
+ * SNAPSHOT_FILE_ENV environment variable.
+ **/
+const char *
+snapshot_file (void)
+{
+	const char *path;
+
+	path = getenv (SNAPSHOT_FILE_ENV);
+
+	return (path && *path) ? path : SNAPSHOT_FILE;
+}
+
+/**
+ * snapshot_init:
+ *
+ * Create the snapshot file and map it.  The file is created under a
+ * temporary name and renamed into place so that readers never see a
+ * partially initialised header, replacing any left by a previous
+ * instance of the daemon.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+snapshot_init (void)
+{
+	const char *path;
+	char        tmp[PATH_MAX];
+	void       *map;
+	int         fd;
+
+	nih_assert (PROCESS_LAST <= SNAPSHOT_MAX_PROCESSES);
+
+	if (snapshot)
+		return 0;
+
+	path = snapshot_file ();
+
+	if (snprintf (tmp, sizeof (tmp), "%s.new", path) >= (int)sizeof (tmp)) {
+		errno = ENAMETOOLONG;
+		nih_return_system_error (-1);
+	}
+
+	fd = open (tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	if (ftruncate (fd, sizeof (Snapshot)) < 0)
+		goto error;
+
+	map = mmap (NULL, sizeof (Snapshot), PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto error;
+
+	close (fd);
+
+	snapshot = map;
+	snapshot->magic = SNAPSHOT_MAGIC;
+	snapshot->version = SNAPSHOT_VERSION;
+	snapshot->pid = getpid ();
+	snapshot->seq = 0;
+	snapshot->complete = FALSE;
+	snapshot->num_entries = 0;
+
+	if (rename (tmp, path) < 0) {
+		nih_error_raise_system ();
+		munmap (snapshot, sizeof (Snapshot));
+		snapshot = NULL;
+		unlink (tmp);
+		return -1;
+	}
+
+	snapshot_pending = TRUE;
+
+	return 0;
+
+error:
+	nih_error_raise_system ();
+	close (fd);
+	unlink (tmp);
+	return -1;
+}
+
+/**
+ * snapshot_changed:
+ *
+ * Called whenever a job class is added or removed, or the goal, state or
+ * processes of an instance change, to have the snapshot rewritten by the
+ * next call to snapshot_flush().
+ **/
+void
+snapshot_changed (void)
+{
+	snapshot_pending = TRUE;
+}
+
+/**
+ * snapshot_flush:
+ *
+ * Rewrite the snapshot if job state has changed since it was last
+ * written; this is called once each time through the main loop so that
+ * the many transitions made by a single job_change_state() call cost a
+ * single rewrite.
+ *
+ * The sequence count is made odd for the duration of the rewrite, and
+ * even again afterwards, so that readers can detect that their copy was
+ * torn and retry.
+ **/
+void
+snapshot_flush (void)
+{
+	if ((! snapshot) || (! snapshot_pending))
+		return;
+
+	snapshot_pending = FALSE;
+
+	__atomic_store_n (&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	snapshot->complete = TRUE;
+	snapshot->num_entries = 0;
+
+	job_class_init ();
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+		int       found = FALSE;
+
+		/* Only the jobs seen by clients outside of any chroot */
+		if (class->session)
+			continue;
+
+		NIH_HASH_FOREACH (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			found = TRUE;
+			snapshot_add (class, job);
+		}
+
+		if (! found)
+			snapshot_add (class, NULL);
+	}
+
+	__atomic_store_n (&snapshot->seq, snapshot->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * snapshot_add:
+ * @class: job class,
+ * @job: instance of @class, or NULL.
+ *
+ * Appends an entry for @job, or for @class without any instance when
+ * @job is NULL, to the snapshot; the snapshot is marked incomplete if
+ * the entry does not fit.
+ **/
+static void
+snapshot_add (JobClass *class,
+	      Job      *job)
+{
+	SnapshotEntry *entry;
+
+	nih_assert (snapshot != NULL);
+	nih_assert (class != NULL);
+
+	if ((snapshot->num_entries >= SNAPSHOT_MAX_ENTRIES)
+	    || (strlen (class->name) >= SNAPSHOT_NAME_MAX)
+	    || (job && (strlen (job->name) >= SNAPSHOT_NAME_MAX))) {
+		snapshot->complete = FALSE;
+		return;
+	}
+
+	entry = &snapshot->entries[snapshot->num_entries++];
+	memset (entry, 0, sizeof (SnapshotEntry));
+
+	strcpy (entry->job, class->name);
+	strcpy (entry->instance, job ? job->name : "");
+	entry->has_instance = (class->instance && *class->instance);
+
+	strncpy (entry->goal, job_goal_name (job ? job->goal : JOB_STOP),
+		 SNAPSHOT_WORD_MAX - 1);
+	strncpy (entry->state, job_state_name (job ? job->state : JOB_WAITING),
+		 SNAPSHOT_WORD_MAX - 1);
+
+	for (int i = 0; job && (i < PROCESS_LAST); i++) {
+		SnapshotProcess *process;
+
+		if (job->pid[i] <= 0)
+			continue;
+
+		process = &entry->processes[entry->num_processes++];
+		strncpy (process->name, process_name (i),
+			 SNAPSHOT_WORD_MAX - 1);
+		process->pid = job->pid[i];
+	}
+}
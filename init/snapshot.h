@@ -0,0 +1,165 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef INIT_SNAPSHOT_H
+#define INIT_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+
+/**
+ * SNAPSHOT_FILE:
+ *
+ * File that the job state snapshot is mapped from.
+ **/
+#ifndef SNAPSHOT_FILE
+#define SNAPSHOT_FILE "/run/upstart-snapshot"
+#endif
+
+/**
+ * SNAPSHOT_FILE_ENV:
+ *
+ * Environment variable that if set specifies an alternative file to
+ * SNAPSHOT_FILE.
+ **/
+#ifndef SNAPSHOT_FILE_ENV
+#define SNAPSHOT_FILE_ENV "UPSTART_SNAPSHOT"
+#endif
+
+/**
+ * SNAPSHOT_MAGIC:
+ *
+ * Value at the start of a snapshot that identifies it as one.
+ **/
+#define SNAPSHOT_MAGIC 0x55535350
+
+/**
+ * SNAPSHOT_VERSION:
+ *
+ * Version of the snapshot layout, incremented whenever Snapshot or
+ * SnapshotEntry change.
+ **/
+#define SNAPSHOT_VERSION 1
+
+/**
+ * SNAPSHOT_MAX_ENTRIES:
+ *
+ * Maximum number of job classes and instances held in the snapshot.
+ **/
+#define SNAPSHOT_MAX_ENTRIES 2048
+
+/**
+ * SNAPSHOT_MAX_PROCESSES:
+ *
+ * Maximum number of processes given for each instance, one for each
+ * process type.
+ **/
+#define SNAPSHOT_MAX_PROCESSES 6
+
+/**
+ * SNAPSHOT_NAME_MAX:
+ *
+ * Size of the buffers holding job and instance names, including the
+ * terminating NUL; jobs with longer names are left out.
+ **/
+#define SNAPSHOT_NAME_MAX 256
+
+/**
+ * SNAPSHOT_WORD_MAX:
+ *
+ * Size of the buffers holding goal, state and process names.
+ **/
+#define SNAPSHOT_WORD_MAX 16
+
+
+/**
+ * SnapshotProcess:
+ * @name: name of process,
+ * @pid: process id.
+ **/
+typedef struct snapshot_process {
+	char    name[SNAPSHOT_WORD_MAX];
+	int32_t pid;
+} SnapshotProcess;
+
+/**
+ * SnapshotEntry:
+ * @job: name of job class,
+ * @instance: name of instance, empty for the entry of a class without any,
+ * @has_instance: TRUE if the class has an instance stanza,
+ * @goal: goal of instance,
+ * @state: state of instance,
+ * @num_processes: number of entries in @processes,
+ * @processes: running processes of instance.
+ *
+ * Status of a single job instance, or of a job class without any
+ * instances, as returned by the GetAllJobStatus method.
+ **/
+typedef struct snapshot_entry {
+	char            job[SNAPSHOT_NAME_MAX];
+	char            instance[SNAPSHOT_NAME_MAX];
+	int32_t         has_instance;
+	char            goal[SNAPSHOT_WORD_MAX];
+	char            state[SNAPSHOT_WORD_MAX];
+	int32_t         num_processes;
+	SnapshotProcess processes[SNAPSHOT_MAX_PROCESSES];
+} SnapshotEntry;
+
+/**
+ * Snapshot:
+ * @magic: always SNAPSHOT_MAGIC,
+ * @version: always SNAPSHOT_VERSION,
+ * @pid: process id of the init daemon writing the snapshot,
+ * @seq: sequence lock,
+ * @complete: FALSE if some jobs were left out,
+ * @num_entries: number of entries in @entries,
+ * @entries: status of each instance.
+ *
+ * Layout of the memory-mapped snapshot of job state written by the init
+ * daemon for clients to read without any IPC.
+ *
+ * @seq is odd while the init daemon is rewriting the snapshot; readers
+ * must copy what they need and retry if @seq was odd, or differs
+ * afterwards from its value beforehand.
+ **/
+typedef struct snapshot {
+	uint32_t      magic;
+	uint32_t      version;
+	int32_t       pid;
+	uint32_t      seq;
+	int32_t       complete;
+	uint32_t      num_entries;
+	SnapshotEntry entries[SNAPSHOT_MAX_ENTRIES];
+} Snapshot;
+
+
+NIH_BEGIN_EXTERN
+
+extern int snapshot_enabled;
+
+const char *snapshot_file    (void);
+
+int         snapshot_init    (void)
+	__attribute__ ((warn_unused_result));
+void        snapshot_changed (void);
+void        snapshot_flush   (void);
+
+NIH_END_EXTERN
+
+#endif /* INIT_SNAPSHOT_H */
@@ -23,18 +23,23 @@
 # include <config.h>
 #endif /* HAVE_CONFIG_H */
 
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #include <nih/macros.h>
+#include <nih/alloc.h>
 #include <nih/logging.h>
 #include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
 #include <nih/io.h>
 
 #include "paths.h"
@@ -47,6 +52,9 @@
 #include "blocked.h"
 #include "conf.h"
 #include "control.h"
+#include "schedule.h"
+#include "listener.h"
+#include "metrics.h"
 
 #ifdef ENABLE_CGROUPS
 #include "cgroup.h"
@@ -88,16 +96,73 @@ int restart = FALSE;
  **/
 int write_state_file = FALSE;
 
+/**
+ * state_context:
+ *
+ * Indices of objects for the serialisation or deserialisation in
+ * progress, or NULL outside of either.
+ **/
+StateContext *state_context = NULL;
+
+/**
+ * state_format:
+ *
+ * Format of the serialisation data to read when restarting, as
+ * specified on the command-line by the previous instance.
+ **/
+StateFormat state_format = STATE_FORMAT_JSON;
+
 /* Prototypes for static functions */
-static void state_write_file (NihIoBuffer *buffer);
+static void         state_stream_init       (StateStream *stream, int fd);
+static int          state_write_all         (int fd, const char *data,
+					     size_t len)
+	__attribute__ ((warn_unused_result));
+static ssize_t      state_stream_read       (StateStream *stream, void *buf,
+					     size_t len)
+	__attribute__ ((warn_unused_result));
+static ssize_t      state_stream_read_full  (StateStream *stream, void *buf,
+					     size_t len)
+	__attribute__ ((warn_unused_result));
+static int          state_stream_write      (StateStream *stream,
+					     const void *data, size_t len)
+	__attribute__ ((warn_unused_result));
+static int          state_stream_flush      (StateStream *stream)
+	__attribute__ ((warn_unused_result));
+static int          state_stream_write_value (StateStream *stream,
+					      json_object *json)
+	__attribute__ ((warn_unused_result));
+static int          state_stream_write_array (StateStream *stream,
+					      json_object *json)
+	__attribute__ ((warn_unused_result));
+static int          state_stream_write_json (StateStream *stream,
+					     json_object *json)
+	__attribute__ ((warn_unused_result));
+static json_object *state_stream_read_json  (StateStream *stream,
+					     const char *prefix,
+					     size_t prefix_len)
+	__attribute__ ((warn_unused_result));
+static int          state_read_stream       (StateStream *stream)
+	__attribute__ ((warn_unused_result));
+static int          state_write_binary      (StateStream *stream,
+					     json_object *json)
+	__attribute__ ((warn_unused_result));
+static int          state_read_binary       (StateStream *stream)
+	__attribute__ ((warn_unused_result));
+static int          state_read_mapped       (StateStream *stream,
+					     const StateBinarySection *section)
+	__attribute__ ((warn_unused_result));
+static const void *state_index_key  (StateIndexEntry *entry);
+static uint32_t    state_index_hash (const void * const *object);
+static int         state_index_cmp  (const void * const *object1,
+				     const void * const *object2);
 
 /**
  * state_read:
  *
- * @fd: Open file descriptor to read JSON from.
+ * @fd: Open file descriptor to read serialisation data from.
  *
- * Read JSON-encoded state from specified file descriptor and recreate
- * all internal objects based on JSON representation. The read will
+ * Read serialised state from specified file descriptor and recreate
+ * all internal objects based on its representation. The read will
  * timeout, resulting in a failure after STATE_WAIT_SECS seconds
  * indicating a problem with the child.
  *
@@ -144,11 +209,11 @@ state_read (int fd)
 /**
  * state_write:
  *
- * @fd: Open file descriptor to write JSON to,
- * @state_data: JSON string representing internal object state,
- * @len: length of @state_data.
+ * @fd: Open file descriptor to write serialisation data to,
+ * @format: format to write,
+ * @json: JSON object tree representing internal object state.
  *
- * Write internal state to specified file descriptor in JSON format.
+ * Write internal state to specified file descriptor in @format.
  *
  * Signals are assumed to be blocked when this call is made.
  *
@@ -161,7 +226,7 @@ state_read (int fd)
  * Returns: 0 on success, or -1 on error.
  **/
 int
-state_write (int fd, const char *state_data, size_t len)
+state_write (int fd, StateFormat format, json_object *json)
 {
 	int             nfds;
 	int             ret;
@@ -169,8 +234,7 @@ state_write (int fd, const char *state_data, size_t len)
 	struct timeval  timeout;
 
 	nih_assert (fd != -1);
-	nih_assert (state_data);
-	nih_assert (len);
+	nih_assert (json);
 
 	/* must be called from child process */
 	nih_assert (getpid () != (pid_t)1);
@@ -196,7 +260,7 @@ state_write (int fd, const char *state_data, size_t len)
 
 	nih_assert (ret == 1);
 
-	if (state_write_objects (fd, state_data, len) < 0)
+	if (state_write_objects (fd, format, json) < 0)
 		return -1;
 
 	return 0;
@@ -208,295 +272,1503 @@ state_write (int fd, const char *state_data, size_t len)
  *
  * @fd: file descriptor to read serialisation data from.
  *
- * Read serialisation data from specified file descriptor.
- * @fd is assumed to be open and readable.
+ * Read serialisation data from specified file descriptor, a chunk at a
+ * time.  @fd is assumed to be open and readable.
+ *
+ * The data is copied to STATE_FILE below log_dir as it is read, and
+ * that file is retained if the internal state cannot be reconstructed
+ * to allow for manual post re-exec analysis, or if requested.
  *
  * Returns: 0 on success, -1 on error.
  **/
 int
 state_read_objects (int fd)
 {
-	ssize_t                  ret;
-	int                      initial_size = 4096;
-	nih_local NihIoBuffer   *buffer = NULL;
-	nih_local char          *buf = NULL;
+	StateStream      stream;
+	nih_local char  *state_file = NULL;
+	int              ret;
 
 	nih_assert (fd != -1);
 
-	buffer = nih_io_buffer_new (NULL);
+	state_stream_init (&stream, fd);
 
-	buf = nih_alloc (NULL, initial_size);
-	if (! buf)
-		goto error;
+	if (log_dir)
+		state_file = nih_sprintf (NULL, "%s/%s", log_dir, STATE_FILE);
 
-	/* Read the JSON data into the buffer */
-	do {
-		if (nih_io_buffer_resize (buffer, initial_size) < 0)
-			goto error;
+	/* Note the very restrictive permissions */
+	if (state_file)
+		stream.tee_fd = open (state_file,
+				(O_CREAT|O_WRONLY|O_TRUNC|O_CLOEXEC), S_IRUSR);
+
+	ret = state_read_stream (&stream);
+
+	if (stream.tee_fd != -1) {
+		close (stream.tee_fd);
+
+		if (! ret && ! (write_state_file || getenv (STATE_FILE_ENV)))
+			(void)unlink (state_file);
+	}
+
+	return ret;
+}
+
+/**
+ * state_write_objects:
+ *
+ * @fd: file descriptor to write serialisation data on,
+ * @format: format to write,
+ * @json: JSON object tree representing internal object state.
+ *
+ * Write serialisation data to specified file descriptor a chunk at a
+ * time.  @fd is assumed to be open and valid to write to.
+ *
+ * Members of @json are released as they are written to bound the
+ * memory used, so @json is only fit to be freed afterwards.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+state_write_objects (int fd, StateFormat format, json_object *json)
+{
+	StateStream stream;
+
+	nih_assert (fd != -1);
+	nih_assert (json);
+
+	state_stream_init (&stream, fd);
+
+	if (format == STATE_FORMAT_BINARY) {
+		if (state_write_binary (&stream, json) < 0)
+			return -1;
+	} else if (state_stream_write_json (&stream, json) < 0) {
+		return -1;
+	}
+
+	return state_stream_flush (&stream);
+}
+
+/**
+ * state_stream_init:
+ * @stream: stream to initialise,
+ * @fd: file descriptor to read or write, or -1.
+ *
+ * Initialise @stream to read or write @fd; when @fd is -1 the caller
+ * must set either the data or buffer members.
+ **/
+static void
+state_stream_init (StateStream *stream, int fd)
+{
+	nih_assert (stream);
+
+	stream->fd = fd;
+	stream->data = NULL;
+	stream->len = 0;
+	stream->pos = 0;
+	stream->buffer = NULL;
+	stream->chunk_len = 0;
+	stream->tee_fd = -1;
+}
+
+/**
+ * state_write_all:
+ * @fd: file descriptor to write to,
+ * @data: data to write,
+ * @len: length of @data.
+ *
+ * Write all of @data to @fd, retrying short and interrupted writes.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_write_all (int fd, const char *data, size_t len)
+{
+	ssize_t ret;
 
-		ret = read (fd, buf, initial_size);
+	nih_assert (fd != -1);
+	nih_assert (data || ! len);
+
+	while (len) {
+		ret = write (fd, data, len);
 		if (ret < 0) {
-			if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
-				goto error;
-			continue;
-		} else if (! ret)
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += ret;
+		len -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+/**
+ * state_stream_read:
+ * @stream: stream to read from,
+ * @buf: buffer to read into,
+ * @len: size of @buf.
+ *
+ * Read up to @len bytes from @stream into @buf.
+ *
+ * Returns: number of bytes read, zero at the end of the data, or -1 on
+ * error.
+ **/
+static ssize_t
+state_stream_read (StateStream *stream, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	nih_assert (stream);
+	nih_assert (buf);
+
+	if (stream->fd == -1) {
+		nih_assert (stream->pos <= stream->len);
+
+		if (len > stream->len - stream->pos)
+			len = stream->len - stream->pos;
+
+		memcpy (buf, stream->data + stream->pos, len);
+		stream->pos += len;
+		ret = (ssize_t)len;
+	} else {
+		do {
+			ret = read (stream->fd, buf, len);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN
+					|| errno == EWOULDBLOCK));
+
+		if (ret < 0)
+			return -1;
+	}
+
+	/* Failures are ignored since the copy is only for analysis */
+	if (ret > 0 && stream->tee_fd != -1
+			&& state_write_all (stream->tee_fd, buf, (size_t)ret) < 0) {
+		close (stream->tee_fd);
+		stream->tee_fd = -1;
+	}
+
+	return ret;
+}
+
+/**
+ * state_stream_read_full:
+ * @stream: stream to read from,
+ * @buf: buffer to read into,
+ * @len: number of bytes to read.
+ *
+ * Read @len bytes from @stream into @buf, returning early only at the
+ * end of the data.
+ *
+ * Returns: number of bytes read, or -1 on error.
+ **/
+static ssize_t
+state_stream_read_full (StateStream *stream, void *buf, size_t len)
+{
+	size_t   done = 0;
+	ssize_t  ret;
+
+	nih_assert (stream);
+	nih_assert (buf);
+
+	while (done < len) {
+		ret = state_stream_read (stream, (char *)buf + done, len - done);
+		if (ret < 0)
+			return -1;
+		else if (! ret)
 			break;
 
-		if (nih_io_buffer_push (buffer, buf, ret) < 0)
-			goto error;
-	} while (TRUE);
+		done += (size_t)ret;
+	}
 
-	/* Recreate internal state from JSON */
-	if (state_from_string (buffer->buf) < 0)
-		goto error;
+	return (ssize_t)done;
+}
+
+/**
+ * state_stream_write:
+ * @stream: stream to write to,
+ * @data: data to write,
+ * @len: length of @data.
+ *
+ * Write @data to @stream; writes to a file descriptor are gathered into
+ * chunks so that the many small fragments of a JSON document do not
+ * each result in a system call.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_stream_write (StateStream *stream, const void *data, size_t len)
+{
+	nih_assert (stream);
+	nih_assert (data || ! len);
 
-	if (write_state_file || getenv (STATE_FILE_ENV))
-		state_write_file (buffer);
+	if (stream->fd == -1) {
+		nih_assert (stream->buffer);
+
+		return nih_io_buffer_push (stream->buffer, data, len);
+	}
+
+	if (stream->chunk_len + len > sizeof (stream->chunk)
+			&& state_stream_flush (stream) < 0)
+		return -1;
+
+	if (len >= sizeof (stream->chunk))
+		return state_write_all (stream->fd, data, len);
+
+	memcpy (stream->chunk + stream->chunk_len, data, len);
+	stream->chunk_len += len;
 
 	return 0;
+}
 
-error:
-	/* Failed to reconstruct internal state so attempt to write
-	 * the JSON state data to a file to allow for manual post
-	 * re-exec analysis.
-	 */
-	if (buffer->len && log_dir)
-		state_write_file (buffer);
+/**
+ * state_stream_flush:
+ * @stream: stream to flush.
+ *
+ * Write any data pending in @stream.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_stream_flush (StateStream *stream)
+{
+	nih_assert (stream);
 
-	return -1;
+	if (stream->fd == -1 || ! stream->chunk_len)
+		return 0;
+
+	if (state_write_all (stream->fd, stream->chunk, stream->chunk_len) < 0)
+		return -1;
+
+	stream->chunk_len = 0;
+
+	return 0;
+}
+
+/**
+ * state_stream_write_value:
+ * @stream: stream to write to,
+ * @json: JSON value to write, or NULL.
+ *
+ * Write the JSON representation of @json to @stream.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_stream_write_value (StateStream *stream, json_object *json)
+{
+	const char *value;
+
+	nih_assert (stream);
+
+	/* Note that the returned value is managed by json-c! */
+	value = json ? json_object_to_json_string (json) : "null";
+	if (! value)
+		return -1;
+
+	return state_stream_write (stream, value, strlen (value));
+}
+
+/**
+ * state_stream_write_array:
+ * @stream: stream to write to,
+ * @json: JSON array to write.
+ *
+ * Write @json to @stream an element at a time, releasing each element
+ * once written such that only the string form of a single element is
+ * held in memory alongside the object tree.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_stream_write_array (StateStream *stream, json_object *json)
+{
+	int len;
+
+	nih_assert (stream);
+	nih_assert (json);
+
+	if (state_stream_write (stream, "[", 1) < 0)
+		return -1;
+
+	len = json_object_array_length (json);
+
+	for (int i = 0; i < len; i++) {
+		if (i && state_stream_write (stream, ",", 1) < 0)
+			return -1;
+
+		if (state_stream_write_value (stream,
+					json_object_array_get_idx (json, i)) < 0)
+			return -1;
+
+		/* Replacing the element frees it along with its string */
+		json_object_array_put_idx (json, i, NULL);
+	}
+
+	return state_stream_write (stream, "]", 1);
+}
+
+/**
+ * state_stream_write_json:
+ * @stream: stream to write to,
+ * @json: JSON object tree to write.
+ *
+ * Write @json to @stream, streaming the arrays that hold the bulk of
+ * the internal state with state_stream_write_array() rather than
+ * generating the string form of the whole tree at once.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_stream_write_json (StateStream *stream, json_object *json)
+{
+	int first = TRUE;
+
+	nih_assert (stream);
+	nih_assert (json);
+
+	if (! json_object_is_type (json, json_type_object))
+		return state_stream_write_value (stream, json);
+
+	if (state_stream_write (stream, "{", 1) < 0)
+		return -1;
+
+	json_object_object_foreach (json, key, value) {
+		json_object *json_key;
+		int          ret;
+
+		if (! first && state_stream_write (stream, ",", 1) < 0)
+			return -1;
+		first = FALSE;
+
+		/* Use json-c to quote the key */
+		json_key = json_object_new_string (key);
+		if (! json_key)
+			return -1;
+
+		ret = state_stream_write_value (stream, json_key);
+		json_object_put (json_key);
+
+		if (ret < 0 || state_stream_write (stream, ":", 1) < 0)
+			return -1;
+
+		if (value && json_object_is_type (value, json_type_array)) {
+			if (state_stream_write_array (stream, value) < 0)
+				return -1;
+		} else if (state_stream_write_value (stream, value) < 0) {
+			return -1;
+		}
+	}
+
+	return state_stream_write (stream, "}", 1);
+}
+
+/**
+ * state_stream_read_json:
+ * @stream: stream to read from,
+ * @prefix: data already read from @stream, or NULL,
+ * @prefix_len: length of @prefix.
+ *
+ * Parse a JSON object tree from @prefix followed by the remainder of
+ * @stream, feeding the tokeniser a chunk at a time.
+ *
+ * Returns: new JSON object tree, or NULL on error.
+ **/
+static json_object *
+state_stream_read_json (StateStream *stream, const char *prefix,
+			size_t prefix_len)
+{
+	struct json_tokener      *tok;
+	json_object              *json = NULL;
+	enum json_tokener_error   error = json_tokener_continue;
+	char                      buf[STATE_CHUNK_SIZE];
+	ssize_t                   len;
+
+	nih_assert (stream);
+
+	tok = json_tokener_new ();
+	if (! tok)
+		return NULL;
+
+	if (prefix_len) {
+		json = json_tokener_parse_ex (tok, prefix, (int)prefix_len);
+		error = json_tokener_get_error (tok);
+	}
+
+	while (! json && error == json_tokener_continue) {
+		len = state_stream_read (stream, buf, sizeof (buf));
+		if (len < 0) {
+			nih_error ("%s", _("Failed to read serialisation data"));
+			goto out;
+		} else if (! len) {
+			break;
+		}
+
+		json = json_tokener_parse_ex (tok, buf, (int)len);
+		error = json_tokener_get_error (tok);
+	}
+
+	if (! json)
+		nih_error ("%s: %s",
+				_("Detected invalid serialisation data"),
+				json_tokener_error_desc (error));
+
+out:
+	json_tokener_free (tok);
+
+	return json;
+}
+
+/**
+ * state_read_stream:
+ * @stream: stream to read from.
+ *
+ * Read serialisation data from @stream and recreate internal state.
+ *
+ * The format is determined from the data itself since binary data
+ * begins with STATE_BINARY_MAGIC, which can never begin a JSON
+ * document; this handles a previous instance that did not specify the
+ * format, or a state_format that was ignored.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_read_stream (StateStream *stream)
+{
+	char          magic[STATE_BINARY_MAGIC_LEN];
+	ssize_t       len;
+	json_object  *json;
+	int           ret;
+
+	nih_assert (stream);
+
+	len = state_stream_read_full (stream, magic, sizeof (magic));
+	if (len < 0)
+		return -1;
+
+	if ((size_t)len == sizeof (magic)
+			&& ! memcmp (magic, STATE_BINARY_MAGIC, sizeof (magic)))
+		return state_read_binary (stream);
+
+	if (state_format == STATE_FORMAT_BINARY) {
+		nih_error ("%s", _("Detected invalid serialisation data"));
+		return -1;
+	}
+
+	json = state_stream_read_json (stream, magic, (size_t)len);
+	if (! json)
+		return -1;
+
+	ret = state_deserialise_objects (json);
+
+	/* Only need to free the root JSON node */
+	json_object_put (json);
+
+	return ret;
+}
+
+/**
+ * state_write_binary:
+ * @stream: stream to write to,
+ * @json: JSON object tree to write.
+ *
+ * Write @json to @stream in the binary format: a StateBinaryHeader, a
+ * STATE_SECTION_DATA section for each item of bulk data in the current
+ * state context, then a STATE_SECTION_OBJECTS section holding @json.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_write_binary (StateStream *stream, json_object *json)
+{
+	StateBinaryHeader   header;
+	StateBinarySection  section;
+
+	nih_assert (stream);
+	nih_assert (json);
+	nih_assert (state_context);
+	nih_assert (state_context->data);
+
+	memset (&header, '\0', sizeof (header));
+	memcpy (header.magic, STATE_BINARY_MAGIC, STATE_BINARY_MAGIC_LEN);
+	header.version = STATE_BINARY_VERSION;
+
+	if (state_context->data_fd >= 0) {
+		header.sections = 1 + (state_context->data->len ? 1 : 0);
+	} else {
+		header.sections = 1 + state_context->data->len;
+	}
+
+	if (state_stream_write (stream, &header, sizeof (header)) < 0)
+		return -1;
+
+	if (state_context->data_fd >= 0 && state_context->data->len) {
+		StateMappedHeader mapped;
+
+		/* Nothing may change the data once it has been described */
+#ifdef F_ADD_SEALS
+		(void)fcntl (state_context->data_fd, F_ADD_SEALS,
+			     F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE
+			     | F_SEAL_SEAL);
+#endif /* F_ADD_SEALS */
+
+		section.type = STATE_SECTION_MAPPED;
+		section.flags = 0;
+		section.len = sizeof (mapped)
+			+ state_context->data->len * sizeof (StateMappedItem);
+
+		if (state_stream_write (stream, &section, sizeof (section)) < 0)
+			return -1;
+
+		mapped.fd = state_context->data_fd;
+		mapped.items = state_context->data->len;
+		mapped.size = state_context->data_size;
+
+		if (state_stream_write (stream, &mapped, sizeof (mapped)) < 0)
+			return -1;
+
+		for (size_t i = 0; i < state_context->data->len; i++) {
+			StateData       *item = state_context->data->objects[i];
+			StateMappedItem  location;
+
+			location.offset = item->offset;
+			location.len = item->len;
+
+			if (state_stream_write (stream, &location,
+						sizeof (location)) < 0)
+				return -1;
+		}
+	}
+
+	for (size_t i = 0; state_context->data_fd < 0
+			&& i < state_context->data->len; i++) {
+		StateData *item = state_context->data->objects[i];
+
+		section.type = STATE_SECTION_DATA;
+		section.flags = 0;
+		section.len = item->len;
+
+		if (state_stream_write (stream, &section, sizeof (section)) < 0)
+			return -1;
+
+		if (state_stream_write (stream, item->data, item->len) < 0)
+			return -1;
+	}
+
+	section.type = STATE_SECTION_OBJECTS;
+	section.flags = 0;
+	section.len = STATE_SECTION_LEN_TO_END;
+
+	if (state_stream_write (stream, &section, sizeof (section)) < 0)
+		return -1;
+
+	return state_stream_write_json (stream, json);
+}
+
+/**
+ * state_read_binary:
+ * @stream: stream to read from, positioned after STATE_BINARY_MAGIC.
+ *
+ * Read binary serialisation data from @stream and recreate internal
+ * state.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_read_binary (StateStream *stream)
+{
+	StateBinaryHeader   header;
+	size_t              rest;
+	json_object        *json;
+	int                 ret = -1;
+
+	nih_assert (stream);
+
+	rest = sizeof (header) - STATE_BINARY_MAGIC_LEN;
+
+	if (state_stream_read_full (stream, (char *)&header + STATE_BINARY_MAGIC_LEN,
+				rest) != (ssize_t)rest) {
+		nih_error ("%s", _("Detected invalid serialisation data"));
+		return -1;
+	}
+
+	if (header.version > STATE_BINARY_VERSION) {
+		nih_error ("%s: %u", _("Unsupported serialisation data version"),
+				(unsigned int)header.version);
+		return -1;
+	}
+
+	state_context_begin ();
+
+	state_context->data = NIH_MUST (state_index_new (state_context));
+
+	for (uint32_t i = 0; i < header.sections; i++) {
+		StateBinarySection  section;
+		StateData          *item;
+		char               *data;
+		char                buf[STATE_CHUNK_SIZE];
+
+		if (state_stream_read_full (stream, &section, sizeof (section))
+				!= (ssize_t)sizeof (section))
+			goto invalid;
+
+		switch (section.type) {
+		case STATE_SECTION_OBJECTS:
+			if (section.len != STATE_SECTION_LEN_TO_END)
+				goto invalid;
+
+			json = state_stream_read_json (stream, NULL, 0);
+			if (! json)
+				goto out;
+
+			ret = state_deserialise_objects (json);
+			json_object_put (json);
+			goto out;
+
+		case STATE_SECTION_DATA:
+			if ((uint64_t)(size_t)section.len != section.len)
+				goto invalid;
+
+			item = nih_new (state_context->data, StateData);
+			if (! item)
+				goto out;
+
+			/* Don't NIH_MUST since a corrupt length could never
+			 * be satisfied.
+			 */
+			data = nih_alloc (item, section.len ? section.len : 1);
+			if (! data)
+				goto out;
+
+			if (state_stream_read_full (stream, data, section.len)
+					!= (ssize_t)section.len)
+				goto invalid;
+
+			item->data = data;
+			item->len = section.len;
+			item->offset = 0;
+
+			NIH_MUST (state_index_add (state_context->data, item));
+			break;
+
+		case STATE_SECTION_MAPPED:
+			if (state_read_mapped (stream, &section) < 0)
+				goto invalid;
+			break;
+
+		default:
+			/* Written by a newer version, skip it */
+			if (section.len == STATE_SECTION_LEN_TO_END)
+				goto invalid;
+
+			while (section.len) {
+				size_t   want;
+				ssize_t  len;
+
+				want = section.len < sizeof (buf)
+					? (size_t)section.len : sizeof (buf);
+
+				len = state_stream_read_full (stream, buf, want);
+				if (len != (ssize_t)want)
+					goto invalid;
+
+				section.len -= want;
+			}
+			break;
+		}
+	}
+
+invalid:
+	nih_error ("%s", _("Detected invalid serialisation data"));
+
+out:
+	state_context_end ();
+
+	return ret;
+}
+
+/**
+ * state_read_mapped:
+ * @stream: stream to read from, positioned after the section header,
+ * @section: header of STATE_SECTION_MAPPED section.
+ *
+ * Read the payload of @section, mapping the data file it names into the
+ * current state context and adding an item for each location given.  The
+ * data file is closed once mapped; the mapping is released along with
+ * the context.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+static int
+state_read_mapped (StateStream               *stream,
+		   const StateBinarySection  *section)
+{
+	StateMappedHeader  header;
+	void              *map = NULL;
+
+	nih_assert (stream);
+	nih_assert (section);
+	nih_assert (state_context);
+	nih_assert (state_context->data);
+
+	if (section->len < sizeof (header))
+		return -1;
+
+	if (state_stream_read_full (stream, &header, sizeof (header))
+			!= (ssize_t)sizeof (header))
+		return -1;
+
+	if (section->len != sizeof (header)
+			+ (uint64_t)header.items * sizeof (StateMappedItem))
+		return -1;
+
+	if ((uint64_t)(size_t)header.size != header.size)
+		return -1;
+
+	/* Only one data file is ever passed */
+	if (state_context->map || ! state_fd_valid (header.fd))
+		return -1;
+
+	if (header.size) {
+		map = mmap (NULL, header.size, PROT_READ, MAP_PRIVATE,
+			    header.fd, 0);
+		if (map == MAP_FAILED) {
+			close (header.fd);
+			return -1;
+		}
+	}
+
+	close (header.fd);
+
+	state_context->map = map;
+	state_context->map_len = header.size;
+
+	for (uint32_t i = 0; i < header.items; i++) {
+		StateMappedItem  location;
+		StateData       *item;
+
+		if (state_stream_read_full (stream, &location, sizeof (location))
+				!= (ssize_t)sizeof (location))
+			return -1;
+
+		if (location.offset > header.size
+				|| location.len > header.size - location.offset)
+			return -1;
+
+		item = nih_new (state_context->data, StateData);
+		if (! item)
+			return -1;
+
+		item->data = (const char *)map + location.offset;
+		item->len = location.len;
+		item->offset = location.offset;
+
+		NIH_MUST (state_index_add (state_context->data, item));
+	}
+
+	return 0;
+}
+
+/**
+ * state_index_key:
+ * @entry: entry in a StateIndex hash.
+ *
+ * Key function for StateIndex hash tables.
+ *
+ * Returns: pointer to the object of @entry.
+ **/
+static const void *
+state_index_key (StateIndexEntry *entry)
+{
+	nih_assert (entry);
+
+	return &entry->object;
+}
+
+/**
+ * state_index_hash:
+ * @object: pointer to object to hash.
+ *
+ * Hash function for StateIndex hash tables; allocations are aligned
+ * so the low bits of the address are discarded.
+ *
+ * Returns: hash value for @object.
+ **/
+static uint32_t
+state_index_hash (const void * const *object)
+{
+	nih_assert (object);
+
+	return (uint32_t)((uintptr_t)*object / sizeof (void *));
+}
+
+/**
+ * state_index_cmp:
+ * @object1: pointer to first object,
+ * @object2: pointer to second object.
+ *
+ * Comparison function for StateIndex hash tables.
+ *
+ * Returns: zero if @object1 and @object2 are the same object.
+ **/
+static int
+state_index_cmp (const void * const *object1,
+		 const void * const *object2)
+{
+	nih_assert (object1);
+	nih_assert (object2);
+
+	return *object1 != *object2;
+}
+
+/**
+ * state_index_new:
+ * @parent: parent object for new index.
+ *
+ * Allocates and returns a new empty StateIndex.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned index.  When all parents
+ * of the returned index are freed, the returned index will also be
+ * freed.
+ *
+ * Returns: newly allocated StateIndex, or NULL if insufficient memory.
+ **/
+StateIndex *
+state_index_new (const void *parent)
+{
+	StateIndex *index;
+
+	index = nih_new (parent, StateIndex);
+	if (! index)
+		return NULL;
+
+	index->objects = NULL;
+	index->len = 0;
+
+	index->hash = nih_hash_new (index, 0,
+				    (NihKeyFunction)state_index_key,
+				    (NihHashFunction)state_index_hash,
+				    (NihCmpFunction)state_index_cmp);
+	if (! index->hash) {
+		nih_free (index);
+		return NULL;
+	}
+
+	return index;
+}
+
+/**
+ * state_index_add:
+ * @index: index to add to,
+ * @object: object to add.
+ *
+ * Appends @object to @index, giving it the next index number.
+ *
+ * Returns: new entry, or NULL if insufficient memory.
+ **/
+StateIndexEntry *
+state_index_add (StateIndex *index,
+		 void       *object)
+{
+	StateIndexEntry *entry;
+
+	nih_assert (index);
+
+	/* Grow the array by doubling whenever the length reaches a
+	 * power of two.
+	 */
+	if (! (index->len & (index->len - 1))) {
+		void **objects;
+
+		objects = nih_realloc (index->objects, index,
+				       sizeof (void *) * (index->len ? index->len * 2 : 1));
+		if (! objects)
+			return NULL;
+
+		index->objects = objects;
+	}
+
+	entry = nih_new (index->hash, StateIndexEntry);
+	if (! entry)
+		return NULL;
+
+	nih_list_init (&entry->entry);
+	nih_alloc_set_destructor (entry, nih_list_destroy);
+
+	entry->object = object;
+	entry->index = index->len;
+
+	nih_hash_add (index->hash, &entry->entry);
+
+	index->objects[index->len++] = object;
+
+	return entry;
+}
+
+/**
+ * state_index_get:
+ * @index: index to search,
+ * @object: object to find.
+ *
+ * Returns: index number of @object, or -1 if not found.
+ **/
+ssize_t
+state_index_get (const StateIndex *index,
+		 const void       *object)
+{
+	StateIndexEntry *entry;
+
+	nih_assert (index);
+
+	entry = (StateIndexEntry *)nih_hash_lookup (index->hash, &object);
+
+	return entry ? (ssize_t)entry->index : -1;
+}
+
+/**
+ * state_index_lookup:
+ * @index: index to search,
+ * @idx: index number.
+ *
+ * Returns: object with index number @idx, or NULL if out of range.
+ **/
+void *
+state_index_lookup (const StateIndex *index,
+		    size_t            idx)
+{
+	nih_assert (index);
+
+	return idx < index->len ? index->objects[idx] : NULL;
+}
+
+/**
+ * state_context_begin:
+ *
+ * Create the state context used to resolve object indices, which is
+ * freed by state_context_end().
+ **/
+void
+state_context_begin (void)
+{
+	nih_assert (! state_context);
+
+	state_context = NIH_MUST (nih_new (NULL, StateContext));
+
+	state_context->sessions = NULL;
+	state_context->events = NULL;
+	state_context->conf_sources = NULL;
+	state_context->job_classes = NULL;
+	state_context->conns = NULL;
+	state_context->data = NULL;
+	state_context->data_fd = -1;
+	state_context->data_size = 0;
+	state_context->map = NULL;
+	state_context->map_len = 0;
+}
+
+/**
+ * state_context_end:
+ *
+ * Free the state context and all of its indices, and release any
+ * mapping of a data file.  The data file written when serialising is
+ * not closed, since it must outlive the context to be passed on.
+ **/
+void
+state_context_end (void)
+{
+	nih_assert (state_context);
+
+	if (state_context->map)
+		munmap (state_context->map, state_context->map_len);
+
+	nih_free (state_context);
+	state_context = NULL;
+}
+
+/**
+ * state_data_fd_new:
+ *
+ * Create a memory file for bulk serialisation data to be written to,
+ * so that it can be passed to the new instance by inheritance instead of
+ * through the serialisation data.  The file is deliberately not
+ * close-on-exec.
+ *
+ * Returns: file descriptor, or -1 if memory files are not supported.
+ **/
+int
+state_data_fd_new (void)
+{
+#ifdef HAVE_MEMFD_CREATE
+	return memfd_create ("upstart-state", MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif /* HAVE_MEMFD_CREATE */
+}
+
+/**
+ * state_context_get:
+ * @index: pointer to index within state_context,
+ * @builder: function to build @index,
+ * @object: object to find.
+ *
+ * Find the index number of @object in @index, building @index with
+ * @builder if it does not yet exist, or rebuilding it if @object is not
+ * found since the list it describes may have grown.
+ *
+ * Returns: index number of @object, or -1 if not found.
+ **/
+ssize_t
+state_context_get (StateIndex        **index,
+		   StateIndexBuilder   builder,
+		   const void         *object)
+{
+	ssize_t idx;
+
+	nih_assert (state_context);
+	nih_assert (index);
+	nih_assert (builder);
+
+	if (*index) {
+		idx = state_index_get (*index, object);
+		if (idx >= 0)
+			return idx;
+
+		nih_free (*index);
+	}
+
+	*index = builder (state_context);
+
+	return state_index_get (*index, object);
+}
+
+/**
+ * state_context_lookup:
+ * @index: pointer to index within state_context,
+ * @builder: function to build @index,
+ * @idx: index number.
+ *
+ * Find the object with index number @idx in @index, building or
+ * rebuilding @index with @builder as for state_context_get().
+ *
+ * Returns: object, or NULL if not found.
+ **/
+void *
+state_context_lookup (StateIndex        **index,
+		      StateIndexBuilder   builder,
+		      size_t              idx)
+{
+	nih_assert (state_context);
+	nih_assert (index);
+	nih_assert (builder);
+
+	if (*index) {
+		if (idx < (*index)->len)
+			return (*index)->objects[idx];
+
+		nih_free (*index);
+	}
+
+	*index = builder (state_context);
+
+	return state_index_lookup (*index, idx);
+}
+
+/**
+ * state_serialise_objects:
+ *
+ * Serialise internal data structures to a JSON object tree.
+ *
+ * Must be called with a state context, which must remain until the tree
+ * has been written if it has a data index.
+ *
+ * Returns: JSON object on success, NULL on error.
+ **/
+json_object *
+state_serialise_objects (void)
+{
+	json_object  *json;
+	json_object  *json_job_environ;
+	json_object  *json_control_bus_address;
+	json_object  *json_schedules;
+	json_object  *json_listeners;
+	json_object  *json_metrics;
+
+#ifdef ENABLE_CGROUPS
+	json_object  *json_cgroup_manager_address;
+#endif /* ENABLE_CGROUPS */
+
+	nih_assert (state_context);
+
+	json = json_object_new_object ();
+
+	if (! json)
+		return NULL;
+
+	json_sessions = session_serialise_all ();
+	if (! json_sessions) {
+		nih_error ("%s Sessions", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "sessions", json_sessions);
+
+	json_events = event_serialise_all ();
+	if (! json_events) {
+		nih_error ("%s Events", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "events", json_events);
+
+	json_control_bus_address = control_serialise_bus_address ();
+
+	/* Take care to distinguish between memory failure and an
+	 * as-yet-not-set control bus address.
+	 */
+	if (! json_control_bus_address && control_bus_address) {
+		nih_error ("%s %s",
+				_("Failed to serialise"),
+			       _("control bus address"));
+		goto error;
+	}
+
+	json_object_object_add (json, "control_bus_address", json_control_bus_address);
+
+#ifdef ENABLE_CGROUPS
+	json_cgroup_manager_address = cgroup_manager_serialise ();
+
+	/* Take care to distinguish between memory failure and an
+	 * as-yet-not-set cgroup manager address.
+	 */
+	if (! json_cgroup_manager_address && cgroup_manager_address) {
+		nih_error ("%s %s",
+				_("Failed to serialise"),
+			       _("cgroup manager address"));
+		goto error;
+	}
+
+	json_object_object_add (json, "cgroup_manager_address", json_cgroup_manager_address);
+#endif /* ENABLE_CGROUPS */
+
+	json_job_environ = job_class_serialise_job_environ ();
+
+	if (! json_job_environ) {
+		nih_error ("%s global job environment",
+				_("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "job_environment", json_job_environ);
+
+	json_classes = job_class_serialise_all ();
+
+	if (! json_classes) {
+		nih_error ("%s JobClasses", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "job_classes", json_classes);
+
+	json_conf_sources = conf_source_serialise_all ();
+
+	if (! json_conf_sources) {
+		nih_error ("%s ConfSources", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "conf_sources", json_conf_sources);
+
+	json_schedules = schedule_serialise_all ();
+
+	if (! json_schedules) {
+		nih_error ("%s Schedules", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "schedules", json_schedules);
+
+	json_listeners = listener_serialise_all ();
+
+	if (! json_listeners) {
+		nih_error ("%s Listeners", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "listeners", json_listeners);
+
+	json_metrics = metrics_serialise ();
+
+	if (! json_metrics) {
+		nih_error ("%s Metrics", _("Failed to serialise"));
+		goto error;
+	}
+
+	json_object_object_add (json, "metrics", json_metrics);
+
+	return json;
+
+error:
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * state_to_string:
+ *
+ * @json_string; newly-allocated string,
+ * @len: length of @json_string.
+ *
+ * Serialise internal data structures to a JSON string.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+state_to_string (char **json_string, size_t *len)
+{
+	json_object  *json;
+	const char   *value;
+
+	nih_assert (json_string);
+	nih_assert (len);
+
+	state_context_begin ();
+
+	json = state_serialise_objects ();
+
+	state_context_end ();
+
+	if (! json)
+		return -1;
+
+	/* Note that the returned value is managed by json-c! */
+	value = json_object_to_json_string (json);
+	if (! value)
+		goto error;
+
+	*len = strlen (value);
+
+	*json_string = NIH_MUST (nih_strndup (NULL, value, *len));
+
+	json_object_put (json);
+
+	return 0;
+
+error:
+	json_object_put (json);
+	return -1;
+}
+
+/**
+ * state_to_binary:
+ *
+ * @data: newly-allocated serialisation data,
+ * @len: length of @data.
+ *
+ * Serialise internal data structures to the binary format: a
+ * StateBinaryHeader followed by a STATE_SECTION_DATA section for each
+ * item of bulk data, then a STATE_SECTION_OBJECTS section holding the
+ * JSON object tree.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+state_to_binary (char **data, size_t *len)
+{
+	json_object            *json;
+	StateStream             stream;
+	nih_local NihIoBuffer  *buffer = NULL;
+	int                     ret = -1;
+
+	nih_assert (data);
+	nih_assert (len);
+
+	buffer = nih_io_buffer_new (NULL);
+	if (! buffer)
+		return -1;
+
+	state_stream_init (&stream, -1);
+	stream.buffer = buffer;
+
+	state_context_begin ();
+
+	state_context->data = NIH_MUST (state_index_new (state_context));
+
+	json = state_serialise_objects ();
+	if (! json)
+		goto out;
+
+	if (state_write_binary (&stream, json) < 0)
+		goto out;
+
+	*data = nih_alloc (NULL, buffer->len);
+	if (! *data)
+		goto out;
+
+	memcpy (*data, buffer->buf, buffer->len);
+	*len = buffer->len;
+
+	ret = 0;
+
+out:
+	if (json)
+		json_object_put (json);
+	state_context_end ();
+
+	return ret;
+}
+
+/**
+ * state_from_binary:
+ *
+ * @data: binary serialisation data,
+ * @len: length of @data.
+ *
+ * Convert binary serialisation data produced by state_to_binary() back
+ * to an internal representation.
+ *
+ * Returns: 0 on success, -1 on error.
+ **/
+int
+state_from_binary (const char *data, size_t len)
+{
+	StateStream  stream;
+	char         magic[STATE_BINARY_MAGIC_LEN];
+
+	nih_assert (data);
+
+	state_stream_init (&stream, -1);
+	stream.data = data;
+	stream.len = len;
+
+	if (state_stream_read_full (&stream, magic, sizeof (magic))
+			!= (ssize_t)sizeof (magic)
+			|| memcmp (magic, STATE_BINARY_MAGIC, sizeof (magic))) {
+		nih_error ("%s", _("Detected invalid serialisation data"));
+		return -1;
+	}
+
+	return state_read_binary (&stream);
 }
 
 /**
- * state_write_file:
+ * state_format_enum_to_str:
  *
- * @buffer: NihIoBuffer containing JSON data.
+ * @format: StateFormat.
  *
- * Write JSON data contained in @buffer to STATE_FILE below log_dir.
+ * Convert StateFormat to the name used on the command-line.
  *
- * Failures are ignored since this is designed to be called in an error
- * scenario anyway.
+ * Returns: string representation of @format, or NULL if not known.
  **/
-void
-state_write_file (NihIoBuffer *buffer)
+const char *
+state_format_enum_to_str (StateFormat format)
 {
-	int              fd;
-	ssize_t          bytes;
-	nih_local char  *state_file = NULL;
-
-	nih_assert (buffer);
-
-	state_file = nih_sprintf (NULL, "%s/%s", log_dir, STATE_FILE);
-	if (! state_file)
-		return;
-
-	/* Note the very restrictive permissions */
-	fd = open (state_file, (O_CREAT|O_WRONLY|O_TRUNC), S_IRUSR);
-	if (fd < 0)
-		return;
-
-	while (TRUE) {
-		bytes = write (fd, buffer->buf, buffer->len);
-
-		if (! bytes)
-			break;
-		else if (bytes > 0)
-			nih_io_buffer_shrink (buffer, (size_t)bytes);
-		else if (bytes < 0 && errno != EINTR)
-			break;
+	switch (format) {
+	case STATE_FORMAT_JSON:
+		return "json";
+	case STATE_FORMAT_BINARY:
+		return "binary";
+	default:
+		return NULL;
 	}
-
-	close (fd);
 }
 
 /**
- * state_write_objects:
+ * state_format_str_to_enum:
  *
- * @fd: file descriptor to write serialisation data on,
- * @state_data: JSON string representing internal object state,
- * @len: length of @state_data.
+ * @format: name of format used on the command-line.
  *
- * Write serialisation data to specified file descriptor.
- * @fd is assumed to be open and valid to write to.
+ * Convert @format to a StateFormat.
  *
- * Returns: 0 on success, -1 on error.
+ * Returns: StateFormat, or STATE_FORMAT_INVALID if not known.
  **/
-int
-state_write_objects (int fd, const char *state_data, size_t len)
+StateFormat
+state_format_str_to_enum (const char *format)
 {
-	ssize_t   ret;
-
-	nih_assert (fd != -1);
-	nih_assert (state_data);
-	nih_assert (len);
+	nih_assert (format);
 
-	ret = write (fd, state_data, len);
+	if (! strcmp (format, "json"))
+		return STATE_FORMAT_JSON;
+	if (! strcmp (format, "binary"))
+		return STATE_FORMAT_BINARY;
 
-	return (ret < 0 ? -1 : 0);
+	return STATE_FORMAT_INVALID;
 }
 
 /**
- * state_to_string:
+ * state_from_string:
  *
- * @json_string; newly-allocated string,
- * @len: length of @json_string.
+ * @state: JSON-encoded state.
  *
- * Serialise internal data structures to a JSON string.
+ * Convert JSON string back to an internal representation.
  *
  * Returns: 0 on success, -1 on error.
  **/
 int
-state_to_string (char **json_string, size_t *len)
+state_from_string (const char *state)
 {
-	json_object  *json;
-	json_object  *json_job_environ;
-	json_object  *json_control_bus_address;
-	const char   *value;
-
-#ifdef ENABLE_CGROUPS
-	json_object  *json_cgroup_manager_address;
-#endif /* ENABLE_CGROUPS */
+	int                       ret;
+	json_object              *json;
+	enum json_tokener_error   error;
 
-	nih_assert (json_string);
-	nih_assert (len);
+	nih_assert (state);
 
-	json = json_object_new_object ();
+	json = json_tokener_parse_verbose (state, &error);
 
-	if (! json)
+	if (! json) {
+		nih_error ("%s: %s",
+				_("Detected invalid serialisation data"),
+				json_tokener_error_desc (error));
 		return -1;
-
-	json_sessions = session_serialise_all ();
-	if (! json_sessions) {
-		nih_error ("%s Sessions", _("Failed to serialise"));
-		goto error;
-	}
-
-	json_object_object_add (json, "sessions", json_sessions);
-
-	json_events = event_serialise_all ();
-	if (! json_events) {
-		nih_error ("%s Events", _("Failed to serialise"));
-		goto error;
 	}
 
-	json_object_object_add (json, "events", json_events);
-
-	json_control_bus_address = control_serialise_bus_address ();
-
-	/* Take care to distinguish between memory failure and an
-	 * as-yet-not-set control bus address.
-	 */
-	if (! json_control_bus_address && control_bus_address) {
-		nih_error ("%s %s",
-				_("Failed to serialise"),
-			       _("control bus address"));
-		goto error;
-	}
-
-	json_object_object_add (json, "control_bus_address", json_control_bus_address);
-
-#ifdef ENABLE_CGROUPS
-	json_cgroup_manager_address = cgroup_manager_serialise ();
-
-	/* Take care to distinguish between memory failure and an
-	 * as-yet-not-set cgroup manager address.
-	 */
-	if (! json_cgroup_manager_address && cgroup_manager_address) {
-		nih_error ("%s %s",
-				_("Failed to serialise"),
-			       _("cgroup manager address"));
-		goto error;
-	}
-
-	json_object_object_add (json, "cgroup_manager_address", json_cgroup_manager_address);
-#endif /* ENABLE_CGROUPS */
-
-	json_job_environ = job_class_serialise_job_environ ();
-
-	if (! json_job_environ) {
-		nih_error ("%s global job environment",
-				_("Failed to serialise"));
-		goto error;
-	}
-
-	json_object_object_add (json, "job_environment", json_job_environ);
-
-	json_classes = job_class_serialise_all ();
-
-	if (! json_classes) {
-		nih_error ("%s JobClasses", _("Failed to serialise"));
-		goto error;
-	}
-
-	json_object_object_add (json, "job_classes", json_classes);
-
-	json_conf_sources = conf_source_serialise_all ();
-
-	if (! json_conf_sources) {
-		nih_error ("%s ConfSources", _("Failed to serialise"));
-		goto error;
-	}
-
-	json_object_object_add (json, "conf_sources", json_conf_sources);
-
-	/* Note that the returned value is managed by json-c! */
-	value = json_object_to_json_string (json);
-	if (! value)
-		goto error;
-
-	*len = strlen (value);
-
-	*json_string = NIH_MUST (nih_strndup (NULL, value, *len));
+	ret = state_deserialise_objects (json);
 
+	/* Only need to free the root JSON node */
 	json_object_put (json);
 
-	return 0;
-
-error:
-	json_object_put (json);
-	return -1;
+	return ret;
 }
 
 /**
- * state_from_string:
+ * state_deserialise_objects:
  *
- * @state: JSON-encoded state.
+ * @json: JSON object tree representing internal object state.
  *
- * Convert JSON string back to an internal representation.
+ * Recreate internal data structures from @json.
  *
  * Returns: 0 on success, -1 on error.
  **/
 int
-state_from_string (const char *state)
+state_deserialise_objects (json_object *json)
 {
 	int                       ret = -1;
-	json_object              *json;
 	json_object              *json_job_environ;
 	json_object              *json_control_bus_address;
-	enum json_tokener_error   error;
+	int                       own_context = FALSE;
 
 #ifdef ENABLE_CGROUPS
 	json_object              *json_cgroup_manager_address;
 #endif /* ENABLE_CGROUPS */
 
-	nih_assert (state);
+	nih_assert (json);
 
 	/* This function is called before conf_source_new (), so setup
 	 * the environment.
 	 */
 	conf_init ();
 
-	json = json_tokener_parse_verbose (state, &error);
+	if (! state_check_json_type (json, object))
+		return -1;
 
-	if (! json) {
-		nih_error ("%s: %s",
-				_("Detected invalid serialisation data"),
-				json_tokener_error_desc (error));
-		return ret;
+	/* state_read_binary() will already have created a context
+	 * holding the bulk data.
+	 */
+	if (! state_context) {
+		state_context_begin ();
+		own_context = TRUE;
 	}
 
-	if (! state_check_json_type (json, object))
-		goto out;
-
 	if (session_deserialise_all (json) < 0) {
 		nih_error ("%s Sessions", _("Failed to deserialise"));
 		goto out;
@@ -563,6 +1835,27 @@ state_from_string (const char *state)
 		goto out;
 	}
 
+	/* Older JSON state data has no schedules, which are then
+	 * created afresh.
+	 */
+	if (schedule_deserialise_all (json) < 0) {
+		nih_error ("%s Schedules", _("Failed to deserialise"));
+		goto out;
+	}
+
+	/* Older JSON state data has no listeners either, so they are
+	 * created afresh; that fails for the sockets of running jobs.
+	 */
+	if (listener_deserialise_all (json) < 0) {
+		nih_error ("%s Listeners", _("Failed to deserialise"));
+		goto out;
+	}
+
+	if (metrics_deserialise (json) < 0) {
+		nih_error ("%s Metrics", _("Failed to deserialise"));
+		goto out;
+	}
+
 	if (state_deserialise_resolve_deps (json) < 0) {
 		nih_error (_("Failed to resolve deserialisation dependencies"));
 		goto out;
@@ -571,8 +1864,8 @@ state_from_string (const char *state)
 	ret = 0;
 
 out:
-	/* Only need to free the root JSON node */
-	json_object_put (json);
+	if (own_context)
+		state_context_end ();
 
 	return ret;
 }
@@ -1496,8 +2789,8 @@ state_serialise_blocked (const Blocked *blocked)
 			DBusMessage     *message;
 			DBusConnection  *connection;
 			char            *dbus_message_data_raw = NULL;
-			char            *dbus_message_data_str = NULL;
 			int              len = 0;
+			int              ok;
 			int              conn_index;
 			dbus_uint32_t    serial;
 
@@ -1514,19 +2807,15 @@ state_serialise_blocked (const Blocked *blocked)
 			if (! dbus_message_marshal (message, &dbus_message_data_raw, &len))
 				goto error;
 
-			dbus_message_data_str = state_data_to_hex (NULL,
+			ok = state_set_json_data_var (json_blocked_data,
+					"msg-data",
 					dbus_message_data_raw,
-					len);
-
-			if (! dbus_message_data_str)
-				goto error;
+					(size_t)len);
 
 			/* returned memory is managed by D-Bus, not NIH */
 			dbus_free (dbus_message_data_raw);
 
-			if (! state_set_json_string_var (json_blocked_data,
-						"msg-data",
-						dbus_message_data_str))
+			if (! ok)
 				goto error;
 
 			conn_index = control_conn_to_index (connection);
@@ -1626,7 +2915,6 @@ state_deserialise_blocked (void *parent, json_object *json,
 	Blocked         *blocked = NULL;
 	nih_local char  *blocked_type_str = NULL;
 	BlockedType      blocked_type;
-	int              ret;
 
 	nih_assert (parent);
 	nih_assert (json);
@@ -1717,29 +3005,19 @@ state_deserialise_blocked (void *parent, json_object *json,
 			DBusError        error;
 			dbus_uint32_t    serial = 0;
 			size_t           raw_len;
-			nih_local char  *dbus_message_data_str = NULL;
 			nih_local char  *dbus_message_data_raw = NULL;
 			int              conn_index = -1;
 
-			if (! state_get_json_string_var_strict (json_blocked_data,
+			if (! state_get_json_data_var (NULL, json_blocked_data,
 						"msg-data",
-						NULL,
-						dbus_message_data_str))
+						&dbus_message_data_raw,
+						&raw_len))
 				goto error;
 
 			if (! state_get_json_int_var (json_blocked_data,
 						"msg-id", serial))
 				goto error;
 
-			ret = state_hex_to_data (NULL,
-					dbus_message_data_str,
-					strlen (dbus_message_data_str),
-					&dbus_message_data_raw,
-					&raw_len);
-
-			if (ret < 0)
-				goto error;
-
 			if (! state_get_json_int_var (json_blocked_data, "msg-connection", conn_index))
 				goto error;
 
@@ -1844,6 +3122,169 @@ error:
 	return -1;
 }
 
+/**
+ * state_set_json_data_var:
+ *
+ * @json: json_object pointer,
+ * @name: string name of element to add to @json,
+ * @data: data to serialise,
+ * @len: length of @data.
+ *
+ * Add @name to @json representing @data, which may contain embedded
+ * nuls.  When serialising to the binary format @data is copied into its
+ * own section, or written to the data file of the state context if it
+ * has one, and @name holds its index; otherwise @name holds @data
+ * hex-encoded.
+ *
+ * Returns: TRUE on success, or FALSE on error.
+ **/
+int
+state_set_json_data_var (json_object  *json,
+			 const char   *name,
+			 const void   *data,
+			 size_t        len)
+{
+	nih_local char *hex = NULL;
+
+	nih_assert (json);
+	nih_assert (name);
+	nih_assert (data);
+	nih_assert (len);
+
+	if (state_context && state_context->data) {
+		StateData        *item;
+		char             *copy;
+		StateIndexEntry  *entry;
+
+		item = nih_new (state_context->data, StateData);
+		if (! item)
+			return FALSE;
+
+		if (state_context->data_fd >= 0) {
+			/* Written straight to the data file, so the data
+			 * is neither copied nor passed over the pipe.
+			 */
+			if (state_write_all (state_context->data_fd,
+					     data, len) < 0) {
+				nih_free (item);
+				return FALSE;
+			}
+
+			item->data = NULL;
+			item->offset = state_context->data_size;
+			state_context->data_size += len;
+		} else {
+			copy = nih_alloc (item, len);
+			if (! copy) {
+				nih_free (item);
+				return FALSE;
+			}
+
+			memcpy (copy, data, len);
+			item->data = copy;
+			item->offset = 0;
+		}
+
+		item->len = len;
+
+		entry = state_index_add (state_context->data, item);
+		if (! entry) {
+			nih_free (item);
+			return FALSE;
+		}
+
+		if (! state_set_json_int_var (json, name, entry->index))
+			return FALSE;
+
+		return TRUE;
+	}
+
+	hex = state_data_to_hex (NULL, data, len);
+	if (! hex)
+		return FALSE;
+
+	return state_set_json_string_var (json, name, hex);
+}
+
+/**
+ * state_get_json_data_var:
+ *
+ * @parent: parent object for new data,
+ * @json: json_object pointer,
+ * @name: string name to search for in @json,
+ * @data: newly-allocated data,
+ * @len: length of @data.
+ *
+ * Extract the data encoded by state_set_json_data_var() as @name from
+ * @json; an integer value refers to a binary data section, a string
+ * value contains the data hex-encoded.
+ *
+ * Returns: TRUE on success, or FALSE on error.
+ **/
+int
+state_get_json_data_var (void         *parent,
+			 json_object  *json,
+			 const char   *name,
+			 char        **data,
+			 size_t       *len)
+{
+	json_object *json_var;
+
+	nih_assert (json);
+	nih_assert (name);
+	nih_assert (data);
+	nih_assert (len);
+
+	if (! json_object_object_get_ex (json, name, &json_var))
+		return FALSE;
+
+	if (state_check_json_type (json_var, int)) {
+		int        idx;
+		StateData *item;
+
+		if (! (state_context && state_context->data))
+			return FALSE;
+
+		idx = json_object_get_int (json_var);
+		if (idx < 0)
+			return FALSE;
+
+		item = state_index_lookup (state_context->data, idx);
+		if (! item)
+			return FALSE;
+
+		*data = nih_alloc (parent, item->len);
+		if (! *data)
+			return FALSE;
+
+		if (item->data) {
+			memcpy (*data, item->data, item->len);
+		} else if (pread (state_context->data_fd, *data, item->len,
+				  item->offset) != (ssize_t)item->len) {
+			nih_free (*data);
+			*data = NULL;
+			return FALSE;
+		}
+
+		*len = item->len;
+
+		return TRUE;
+	}
+
+	if (state_check_json_type (json_var, string)) {
+		const char *hex;
+
+		hex = json_object_get_string (json_var);
+		if (! hex || ! *hex)
+			return FALSE;
+
+		return state_hex_to_data (parent, hex, strlen (hex),
+					  data, len) == 0;
+	}
+
+	return FALSE;
+}
+
 /**
  * state_data_to_hex:
  *
@@ -2041,8 +3482,10 @@ stateful_reexec (void)
 	int             fds[2] = { -1, -1 };
 	pid_t           pid;
 	sigset_t        mask, oldmask;
-	nih_local char *state_data = NULL;
-	size_t          len;
+	json_object    *json = NULL;
+	StateFormat     format = STATE_FORMAT_BINARY;
+	int             data_fd = -1;
+	int             handed_off = FALSE;
 
 
 	/* Block signals while we work.  We're the last signal handler
@@ -2054,7 +3497,24 @@ stateful_reexec (void)
 	sigfillset (&mask);
 	sigprocmask (SIG_BLOCK, &mask, &oldmask);
 
-	if (state_to_string (&state_data, &len) < 0) {
+	metrics.reexec_started = metrics_now ();
+
+	/* Serialise the object tree now so that any failure can still
+	 * revert to a stateless re-exec, but leave the child to generate
+	 * the serialisation data itself as it streams it over the pipe.
+	 * The context is retained since the tree refers to its data index.
+	 */
+	state_context_begin ();
+	state_context->data = NIH_MUST (state_index_new (state_context));
+
+	/* Bulk data such as log buffers is written to a memory file that
+	 * the new instance inherits and maps, where supported, so the time
+	 * taken does not grow with the amount of it.
+	 */
+	data_fd = state_context->data_fd = state_data_fd_new ();
+
+	json = state_serialise_objects ();
+	if (! json) {
 		nih_error ("%s - %s",
 				_("Failed to generate serialisation data"),
 				_("reverting to stateless re-exec"));
@@ -2072,6 +3532,9 @@ stateful_reexec (void)
 	/* Clear CLOEXEC flag for any job log objects prior to re-exec */
 	job_class_prepare_reexec ();
 
+	/* and for the listening sockets of socket-activated jobs */
+	listener_prepare_reexec ();
+
 	pid = fork ();
 
 	if (pid < 0)
@@ -2082,18 +3545,18 @@ stateful_reexec (void)
 		/* Parent */
 		close (fds[1]);
 
+		handed_off = TRUE;
+
 		/* Tidy up from any previous re-exec */
 		clean_args (&args_copy);
 
 		/* Tell the new instance where to read the
 		 * serialisation data from.
 		 *
-		 * Note that if the "new" instance is actually an older
-		 * version of Upstart (that does not understand stateful
-		 * re-exec), due to the way NIH handles command-line
-		 * paring, this option will be ignored and the new instance
-		 * will therefore not be able to read the state and overall
-		 * a stateless re-exec will therefore be performed.
+		 * The format is deliberately not passed: the new instance
+		 * recognises binary data by its magic, and an instance
+		 * predating --state-format would reject its command-line
+		 * and exit rather than ignore an option it does not know.
 		 */
 		arg = NIH_MUST (nih_strdup (NULL, "--state-fd"));
 		NIH_MUST (nih_str_array_add (&args_copy, NULL, NULL, arg));
@@ -2120,7 +3583,7 @@ stateful_reexec (void)
 
 		control_server_close ();
 
-		if (state_write (fds[1], state_data, len) < 0) {
+		if (state_write (fds[1], format, json) < 0) {
 			nih_error ("%s",
 				_("Failed to write serialisation data"));
 			exit (1);
@@ -2131,9 +3594,23 @@ stateful_reexec (void)
 	}
 
 reexec:
+	if (json)
+		json_object_put (json);
+	if (state_context)
+		state_context_end ();
+
+	/* Don't leak the data file into a stateless re-exec */
+	if (data_fd >= 0 && ! handed_off) {
+		close (data_fd);
+		data_fd = -1;
+	}
+
 	/* Attempt stateful re-exec */
 	perform_reexec ();
 
+	if (data_fd >= 0)
+		close (data_fd);
+
 	/* We should never end up here since it likely indicates the
 	 * new init binary is damaged.
 	 *
@@ -2150,7 +3627,8 @@ reexec:
  *
  * @argsp: pointer to pointer to array of string arguments.
  *
- * Remove any existing state fd and log-level-altering arguments.
+ * Remove any existing state fd, state format and log-level-altering
+ * arguments.
  *
  * This stops command-line exhaustion if stateful re-exec is
  * performed many times.
@@ -2166,8 +3644,9 @@ clean_args (char ***argsp)
 	for (args = *argsp, i = 0; args && args[i]; i++) {
 		int tmp = i;
 
-		if (! strcmp (args[i], "--state-fd")) {
-			/* Remove existing entry and fd value */
+		if ((! strcmp (args[i], "--state-fd")) ||
+				(! strcmp (args[i], "--state-format"))) {
+			/* Remove existing entry and its value */
 			nih_free (args[tmp]);
 			nih_free (args[tmp+1]);
 
@@ -328,6 +328,7 @@
 #define INIT_STATE_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <errno.h>
 
 #include <sys/time.h>
@@ -336,6 +337,8 @@
 #include <nih/macros.h>
 #include <nih/alloc.h>
 #include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/io.h>
 
 #include <json.h>
 
@@ -372,6 +375,48 @@
  **/
 #define STATE_FILE "upstart.state"
 
+/**
+ * STATE_BINARY_MAGIC:
+ *
+ * Bytes that begin binary serialisation data; the leading nul ensures
+ * it can never be mistaken for JSON.
+ **/
+#define STATE_BINARY_MAGIC "\0UPSTATE"
+
+/**
+ * STATE_BINARY_MAGIC_LEN:
+ *
+ * Length of STATE_BINARY_MAGIC.
+ **/
+#define STATE_BINARY_MAGIC_LEN 8
+
+/**
+ * STATE_BINARY_VERSION:
+ *
+ * Version of the binary serialisation format written by this instance;
+ * data with a higher version is rejected.  Version 2 added the
+ * STATE_SECTION_MAPPED section.
+ **/
+#define STATE_BINARY_VERSION 2
+
+/**
+ * STATE_SECTION_LEN_TO_END:
+ *
+ * Section length denoting a section that extends to the end of the
+ * serialisation data, allowing it to be written before its length is
+ * known.  Only the final STATE_SECTION_OBJECTS section may use this.
+ **/
+#define STATE_SECTION_LEN_TO_END UINT64_MAX
+
+/**
+ * STATE_CHUNK_SIZE:
+ *
+ * Size of the chunks in which serialisation data is read and written,
+ * such that the serialised document is never held in memory in its
+ * entirety.
+ **/
+#define STATE_CHUNK_SIZE 4096
+
 /**
  * state_get_timeout:
  *
@@ -1102,8 +1147,218 @@
 	 ? state_deserialise_int32_array (parent, json, (int32_t **)array, len) \
 	 : state_deserialise_int64_array (parent, json, (int64_t **)array, len))
 
+/**
+ * StateFormat:
+ *
+ * Format of the serialisation data passed across a stateful re-exec.
+ *
+ * STATE_FORMAT_JSON is a single JSON document; STATE_FORMAT_BINARY
+ * wraps the JSON object tree in a StateBinaryHeader followed by
+ * length-prefixed sections, with bulk data such as log buffers and
+ * D-Bus messages carried in raw STATE_SECTION_DATA sections rather than
+ * being hex-encoded within the JSON.
+ **/
+typedef enum state_format {
+	STATE_FORMAT_INVALID = -1,
+	STATE_FORMAT_JSON,
+	STATE_FORMAT_BINARY,
+} StateFormat;
+
+/**
+ * StateSectionType:
+ *
+ * Types of section within binary serialisation data.  Readers skip
+ * sections of unknown type.
+ **/
+typedef enum state_section_type {
+	STATE_SECTION_OBJECTS = 1,
+	STATE_SECTION_DATA,
+	STATE_SECTION_MAPPED,
+} StateSectionType;
+
+/**
+ * StateBinaryHeader:
+ * @magic: STATE_BINARY_MAGIC,
+ * @version: STATE_BINARY_VERSION of the writer,
+ * @sections: number of sections that follow.
+ *
+ * Header of binary serialisation data.  Since the data is only ever
+ * passed between instances on the same host, integers are in native
+ * byte order.
+ **/
+typedef struct state_binary_header {
+	char      magic[STATE_BINARY_MAGIC_LEN];
+	uint32_t  version;
+	uint32_t  sections;
+} StateBinaryHeader;
+
+/**
+ * StateBinarySection:
+ * @type: StateSectionType of section,
+ * @flags: reserved, zero,
+ * @len: length of data following this header, or
+ * STATE_SECTION_LEN_TO_END.
+ *
+ * Header of each section within binary serialisation data.  The JSON
+ * object tree is always the last section, following the data sections
+ * it refers to, and is written as it is generated.
+ **/
+typedef struct state_binary_section {
+	uint32_t  type;
+	uint32_t  flags;
+	uint64_t  len;
+} StateBinarySection;
+
+/**
+ * StateMappedHeader:
+ * @fd: file descriptor of the data file, inherited across the re-exec,
+ * @items: number of StateMappedItem entries that follow,
+ * @size: size of the data file.
+ *
+ * Payload of a STATE_SECTION_MAPPED section, which takes the place of
+ * STATE_SECTION_DATA sections when the bulk data was written to a sealed
+ * memory file rather than the serialisation data itself.  The reader
+ * maps the file, so the data is never copied through the pipe.
+ **/
+typedef struct state_mapped_header {
+	int32_t   fd;
+	uint32_t  items;
+	uint64_t  size;
+} StateMappedHeader;
+
+/**
+ * StateMappedItem:
+ * @offset: offset of data within the data file,
+ * @len: length of data.
+ *
+ * Location of an item of bulk data within the data file of a
+ * STATE_SECTION_MAPPED section, in index order.
+ **/
+typedef struct state_mapped_item {
+	uint64_t  offset;
+	uint64_t  len;
+} StateMappedItem;
+
+/**
+ * StateData:
+ * @data: data, or NULL if held in the data file of the state context,
+ * @len: length of @data,
+ * @offset: offset of data within the data file.
+ *
+ * Bulk data carried in a STATE_SECTION_DATA section or a data file, and
+ * referred to by its index from the JSON object tree.
+ **/
+typedef struct state_data {
+	const char  *data;
+	size_t       len;
+	size_t       offset;
+} StateData;
+
+/**
+ * StateStream:
+ * @fd: file descriptor to read or write, or -1,
+ * @data: data to read if @fd is -1,
+ * @len: length of @data,
+ * @pos: offset of next byte to read from @data,
+ * @buffer: buffer to write to if @fd is -1,
+ * @chunk: pending data to write to @fd,
+ * @chunk_len: length of @chunk,
+ * @tee_fd: file descriptor that all data read is copied to, or -1.
+ *
+ * Source or destination of serialisation data, read or written in
+ * chunks of at most STATE_CHUNK_SIZE bytes.
+ **/
+typedef struct state_stream {
+	int           fd;
+	const char   *data;
+	size_t        len;
+	size_t        pos;
+	NihIoBuffer  *buffer;
+	char          chunk[STATE_CHUNK_SIZE];
+	size_t        chunk_len;
+	int           tee_fd;
+} StateStream;
+
+/**
+ * StateIndex:
+ * @objects: objects in serialisation order,
+ * @len: number of entries in @objects,
+ * @hash: StateIndexEntry objects indexed by object.
+ *
+ * Maps between objects and their index in the serialised state in both
+ * directions, so that cross-references between objects can be resolved
+ * without searching the list the objects are held in each time.
+ **/
+typedef struct state_index {
+	void    **objects;
+	size_t    len;
+	NihHash  *hash;
+} StateIndex;
+
+/**
+ * StateIndexEntry:
+ * @entry: list header,
+ * @object: object,
+ * @index: index of @object.
+ *
+ * Entry in the hash of a StateIndex.
+ **/
+typedef struct state_index_entry {
+	NihList      entry;
+	const void  *object;
+	size_t       index;
+} StateIndexEntry;
+
+/**
+ * StateContext:
+ * @sessions: index of sessions,
+ * @events: index of events,
+ * @conf_sources: index of configuration sources,
+ * @job_classes: index of job classes,
+ * @conns: index of control connections,
+ * @data: index of StateData sections, or NULL if the JSON format is in
+ * use,
+ * @data_fd: memory file that bulk data is written to when serialising,
+ * or -1 to carry it in STATE_SECTION_DATA sections,
+ * @data_size: number of bytes written to @data_fd,
+ * @map: mapping of the data file when deserialising, or NULL,
+ * @map_len: length of @map.
+ *
+ * Indices used while serialising or deserialising the state.  Each is
+ * built on first use from the list it describes and rebuilt if an object
+ * is not found, which happens when the list grows during
+ * deserialisation.  Objects must not be freed while a context exists.
+ **/
+typedef struct state_context {
+	StateIndex  *sessions;
+	StateIndex  *events;
+	StateIndex  *conf_sources;
+	StateIndex  *job_classes;
+	StateIndex  *conns;
+	StateIndex  *data;
+	int          data_fd;
+	size_t       data_size;
+	void        *map;
+	size_t       map_len;
+} StateContext;
+
+/**
+ * StateIndexBuilder:
+ *
+ * @parent: parent object for new index.
+ *
+ * Function that builds a new index of an object list, in serialisation
+ * order.
+ *
+ * Returns: newly allocated StateIndex.
+ **/
+typedef StateIndex *(*StateIndexBuilder) (const void *parent);
+
 NIH_BEGIN_EXTERN
 
+extern StateContext *state_context;
+extern StateFormat   state_format;
+
 /**
  * EnumSerialiser:
  *
@@ -1129,18 +1384,64 @@ typedef int (*EnumDeserialiser) (const char *name);
 int  state_read          (int fd)
 	__attribute__ ((warn_unused_result));
 
-int  state_write         (int fd, const char *state_data, size_t len)
+int  state_write         (int fd, StateFormat format, json_object *json)
 	__attribute__ ((warn_unused_result));
 
 int  state_read_objects  (int fd)
 	__attribute__ ((warn_unused_result));
 
-int  state_write_objects (int fd, const char *state_data, size_t len)
+int  state_write_objects (int fd, StateFormat format, json_object *json)
+	__attribute__ ((warn_unused_result));
+
+StateIndex *state_index_new (const void *parent)
+	__attribute__ ((warn_unused_result));
+
+StateIndexEntry *state_index_add (StateIndex *index, void *object)
+	__attribute__ ((warn_unused_result));
+
+ssize_t state_index_get (const StateIndex *index, const void *object);
+
+void *state_index_lookup (const StateIndex *index, size_t idx);
+
+void state_context_begin (void);
+void state_context_end   (void);
+
+int  state_data_fd_new   (void);
+
+ssize_t state_context_get    (StateIndex **index, StateIndexBuilder builder,
+			      const void *object);
+void *  state_context_lookup (StateIndex **index, StateIndexBuilder builder,
+			      size_t idx);
+
+json_object *state_serialise_objects (void)
+	__attribute__ ((warn_unused_result));
+
+int  state_deserialise_objects (json_object *json)
 	__attribute__ ((warn_unused_result));
 
 int  state_to_string (char **json_string, size_t *len)
 	__attribute__ ((warn_unused_result));
 
+int  state_to_binary (char **data, size_t *len)
+	__attribute__ ((warn_unused_result));
+
+int  state_from_binary (const char *data, size_t len)
+	__attribute__ ((warn_unused_result));
+
+const char *state_format_enum_to_str (StateFormat format)
+	__attribute__ ((warn_unused_result));
+
+StateFormat state_format_str_to_enum (const char *format)
+	__attribute__ ((warn_unused_result));
+
+int  state_set_json_data_var (json_object *json, const char *name,
+			      const void *data, size_t len)
+	__attribute__ ((warn_unused_result));
+
+int  state_get_json_data_var (void *parent, json_object *json,
+			      const char *name, char **data, size_t *len)
+	__attribute__ ((warn_unused_result));
+
 int    state_from_string (const char *state)
 	__attribute__ ((warn_unused_result));
 
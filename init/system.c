@@ -28,8 +28,13 @@
 #include <sys/stat.h>
 #include <sys/mount.h>
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
@@ -269,3 +274,222 @@ system_check_file (const char *path, mode_t type, dev_t dev)
 
 	return 0;
 }
+
+/**
+ * system_close_fds:
+ * @keep: file descriptor to retain.
+ *
+ * Close every file descriptor inherited from init other than the
+ * standard streams and @keep; used by helper processes forked from
+ * init so that they do not, for example, hold open the pty masters
+ * of running jobs.
+ **/
+void
+system_close_fds (int keep)
+{
+	DIR           *dir;
+	struct dirent *ent;
+	long           max;
+	int            fd;
+
+	dir = opendir ("/proc/self/fd");
+	if (! dir) {
+		max = sysconf (_SC_OPEN_MAX);
+
+		for (fd = STDERR_FILENO + 1; fd < max; fd++)
+			if (fd != keep)
+				close (fd);
+		return;
+	}
+
+	while ((ent = readdir (dir)) != NULL) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		fd = atoi (ent->d_name);
+
+		if (fd <= STDERR_FILENO || fd == keep || fd == dirfd (dir))
+			continue;
+
+		close (fd);
+	}
+
+	closedir (dir);
+}
+
+/**
+ * system_parse_cpus:
+ * @str: list of CPUs,
+ * @set: set to fill.
+ *
+ * Parse @str, a comma-separated list of CPU numbers and ranges such as
+ * "0-3,8" in the format the kernel uses for cpulist files, into @set.
+ * The same format is used for lists of NUMA nodes.
+ *
+ * Returns: zero on success, negative value if @str is not a valid
+ * list or names a CPU beyond CPU_SETSIZE.
+ **/
+int
+system_parse_cpus (const char *str,
+		   cpu_set_t  *set)
+{
+	const char *p;
+
+	nih_assert (str != NULL);
+	nih_assert (set != NULL);
+
+	CPU_ZERO (set);
+
+	p = str;
+	while (*p && *p != '\n') {
+		char          *endptr;
+		unsigned long  first;
+		unsigned long  last;
+
+		if (*p < '0' || *p > '9')
+			return -1;
+
+		errno = 0;
+		first = last = strtoul (p, &endptr, 10);
+		if (errno)
+			return -1;
+		p = endptr;
+
+		if (*p == '-') {
+			p++;
+			if (*p < '0' || *p > '9')
+				return -1;
+
+			last = strtoul (p, &endptr, 10);
+			if (errno || last < first)
+				return -1;
+			p = endptr;
+		}
+
+		if (last >= CPU_SETSIZE)
+			return -1;
+
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+			CPU_SET (cpu, set);
+
+		if (*p == ',') {
+			p++;
+			if (! *p)
+				return -1;
+		} else if (*p && *p != '\n') {
+			return -1;
+		}
+	}
+
+	if (! CPU_COUNT (set))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * system_read_cpus:
+ * @path: path of cpulist file,
+ * @set: set to fill.
+ *
+ * Read the cpulist file @path from sysfs into @set.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+system_read_cpus (const char *path,
+		  cpu_set_t  *set)
+{
+	char    buf[4096];
+	ssize_t len;
+	int     fd;
+
+	nih_assert (path != NULL);
+	nih_assert (set != NULL);
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		nih_return_system_error (-1);
+
+	len = read (fd, buf, sizeof (buf) - 1);
+	close (fd);
+
+	if (len < 0)
+		nih_return_system_error (-1);
+
+	buf[len] = '\0';
+
+	if (system_parse_cpus (buf, set) < 0) {
+		errno = EINVAL;
+		nih_return_system_error (-1);
+	}
+
+	return 0;
+}
+
+/**
+ * system_node_cpus:
+ * @node: NUMA node,
+ * @set: set to fill.
+ *
+ * Fill @set with the CPUs of NUMA node @node; a kernel without NUMA
+ * support is treated as having every online CPU in node 0.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+system_node_cpus (int        node,
+		  cpu_set_t *set)
+{
+	char      path[PATH_MAX];
+	NihError *err;
+
+	nih_assert (node >= 0);
+	nih_assert (set != NULL);
+
+	snprintf (path, sizeof (path),
+		  "/sys/devices/system/node/node%d/cpulist", node);
+
+	if (system_read_cpus (path, set) == 0)
+		return 0;
+
+	err = nih_error_get ();
+	if (node || err->number != ENOENT) {
+		nih_error_raise_error (err);
+		return -1;
+	}
+	nih_free (err);
+
+	return system_read_cpus ("/sys/devices/system/cpu/online", set);
+}
+
+/**
+ * system_online_nodes:
+ * @nodes: set to fill.
+ *
+ * Fill @nodes with the numbers of the NUMA nodes that are online; a
+ * kernel without NUMA support is treated as having the single node 0.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+system_online_nodes (cpu_set_t *nodes)
+{
+	nih_assert (nodes != NULL);
+
+	if (system_read_cpus ("/sys/devices/system/node/online", nodes) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		if (err->number != ENOENT) {
+			nih_error_raise_error (err);
+			return -1;
+		}
+		nih_free (err);
+
+		CPU_ZERO (nodes);
+		CPU_SET (0, nodes);
+	}
+
+	return 0;
+}
@@ -22,6 +22,8 @@
 
 #include <sys/types.h>
 
+#include <sched.h>
+
 #include <nih/macros.h>
 
 #include "job_class.h"
@@ -44,6 +46,15 @@ void system_mknod        (const char *path, mode_t mode, dev_t dev);
 int  system_check_file   (const char *path, mode_t type, dev_t dev)
 	__attribute__ ((warn_unused_result));
 
+void system_close_fds    (int keep);
+
+int  system_parse_cpus   (const char *str, cpu_set_t *set)
+	__attribute__ ((warn_unused_result));
+int  system_node_cpus    (int node, cpu_set_t *set)
+	__attribute__ ((warn_unused_result));
+int  system_online_nodes (cpu_set_t *nodes)
+	__attribute__ ((warn_unused_result));
+
 NIH_END_EXTERN
 
 #endif /* INIT_SYSTEM_H */
@@ -0,0 +1,445 @@
+/* upstart
+ *
+ * bench_event.c - benchmark of event dispatch and job churn
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/main.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "environ.h"
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "event_operator.h"
+#include "parse_job.h"
+#include "control.h"
+
+
+/**
+ * BENCH_CLASSES:
+ *
+ * Number of job classes synthesised when not given on the command-line.
+ **/
+#define BENCH_CLASSES 500
+
+/**
+ * BENCH_EVENTS:
+ *
+ * Number of events emitted when not given on the command-line.
+ **/
+#define BENCH_EVENTS 10000
+
+/**
+ * BENCH_DEVICES:
+ *
+ * Number of distinct network interfaces and block devices named by the
+ * job classes and events.
+ **/
+#define BENCH_DEVICES 64
+
+
+/**
+ * Bench:
+ * @name: name of benchmark,
+ * @start: time benchmark started,
+ * @allocs: allocations counted when benchmark started.
+ *
+ * Running measurement of throughput and allocations.
+ **/
+typedef struct bench {
+	const char      *name;
+	struct timespec  start;
+	size_t           allocs;
+} Bench;
+
+
+/**
+ * bench_allocs:
+ *
+ * Number of calls made to nih_alloc's malloc since startup.
+ **/
+static size_t bench_allocs = 0;
+
+/**
+ * bench_malloc_real:
+ *
+ * malloc() function that nih_alloc used before bench_malloc() was
+ * installed.
+ **/
+static void *(*bench_malloc_real) (size_t size) = NULL;
+
+
+/**
+ * bench_malloc:
+ * @size: size of allocation.
+ *
+ * Counting replacement for the malloc() function used by nih_alloc.
+ *
+ * Returns: newly allocated block or NULL.
+ **/
+static void *
+bench_malloc (size_t size)
+{
+	bench_allocs++;
+
+	return bench_malloc_real (size);
+}
+
+/**
+ * bench_start:
+ * @bench: benchmark to start,
+ * @name: name of benchmark.
+ *
+ * Begin measuring @bench.
+ **/
+static void
+bench_start (Bench      *bench,
+	     const char *name)
+{
+	nih_assert (bench != NULL);
+	nih_assert (name != NULL);
+
+	bench->name = name;
+	bench->allocs = bench_allocs;
+	clock_gettime (CLOCK_MONOTONIC, &bench->start);
+}
+
+/**
+ * bench_finish:
+ * @bench: benchmark to finish,
+ * @count: number of operations performed,
+ * @unit: name of operation.
+ *
+ * Output the elapsed time, throughput and allocations per operation of
+ * @bench.
+ **/
+static void
+bench_finish (Bench      *bench,
+	      size_t      count,
+	      const char *unit)
+{
+	struct timespec now;
+	double          elapsed;
+	size_t          allocs;
+
+	nih_assert (bench != NULL);
+	nih_assert (unit != NULL);
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	allocs = bench_allocs - bench->allocs;
+
+	elapsed = ((now.tv_sec - bench->start.tv_sec)
+		   + (now.tv_nsec - bench->start.tv_nsec) / 1e9);
+
+	printf ("%-24s %8zu %-8s %10.3f ms %12.0f %s/s %10.2f allocs/%s\n",
+		bench->name, count, unit, elapsed * 1000.0,
+		elapsed > 0 ? count / elapsed : 0.0, unit,
+		count ? (double)allocs / count : 0.0, unit);
+}
+
+/**
+ * bench_classes:
+ * @num_classes: number of job classes to create.
+ *
+ * Synthesise @num_classes job classes with start on and stop on
+ * conditions like those shipped by distributions: device jobs started
+ * by udev events, instance jobs, and service jobs started by
+ * others and by the filesystem and runlevel events.  None have any
+ * processes, so starting them causes only state changes and events.
+ **/
+static void
+bench_classes (size_t num_classes)
+{
+	for (size_t i = 0; i < num_classes; i++) {
+		nih_local char *name = NULL;
+		nih_local char *file = NULL;
+		JobClass       *class;
+		size_t          pos = 0;
+		size_t          lineno = 1;
+		size_t          dev = i % BENCH_DEVICES;
+
+		name = NIH_MUST (nih_sprintf (NULL, "bench-%zu", i));
+
+		switch (i % 4) {
+		case 0:
+			file = NIH_MUST (nih_sprintf (
+				NULL,
+				"start on net-device-up IFACE=eth%zu\n"
+				"stop on net-device-down IFACE=eth%zu\n",
+				dev, dev));
+			break;
+		case 1:
+			file = NIH_MUST (nih_sprintf (
+				NULL,
+				"start on block-device-added DEVNAME=/dev/sd%c%zu"
+				" ID_FS_TYPE=ext4\n"
+				"stop on block-device-removed DEVNAME=/dev/sd%c%zu\n",
+				'a' + (char)(dev % 26), dev / 26,
+				'a' + (char)(dev % 26), dev / 26));
+			break;
+		case 2:
+			file = NIH_MUST (nih_sprintf (
+				NULL,
+				"instance $IFACE\n"
+				"start on net-device-up IFACE!=lo\n"
+				"stop on net-device-down IFACE=$IFACE\n"));
+			break;
+		default:
+			file = NIH_MUST (nih_sprintf (
+				NULL,
+				"start on (filesystem and started bench-%zu)"
+				" or runlevel [2345]\n"
+				"stop on runlevel [!2345] or stopping bench-%zu\n",
+				i - 3, i - 3));
+			break;
+		}
+
+		file = NIH_MUST (nih_strcat (&file, NULL, "console none\n"));
+
+		class = parse_job (NULL, NULL, NULL, name, file, strlen (file),
+				   &pos, &lineno);
+		if (! class) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_fatal ("%s: %s", name, err->message);
+			exit (1);
+		}
+
+		job_class_add_safe (class);
+	}
+}
+
+/**
+ * bench_event_new:
+ * @index: index of event.
+ *
+ * Returns: new udev-like event, the index-th of a sequence that adds
+ * and removes each device in turn.
+ **/
+static Event *
+bench_event_new (size_t index)
+{
+	char  **env = NULL;
+	size_t  dev = (index / 4) % BENCH_DEVICES;
+	int     add = ((index / 2) % 2) == 0;
+
+	env = NIH_MUST (nih_str_array_new (NULL));
+
+	if (index % 2) {
+		NIH_MUST (environ_set (&env, NULL, NULL, TRUE,
+				       "DEVNAME=/dev/sd%c%zu",
+				       'a' + (char)(dev % 26), dev / 26));
+		NIH_MUST (environ_set (&env, NULL, NULL, TRUE,
+				       "DEVPATH=/devices/pci0000:00/block/sd%c%zu",
+				       'a' + (char)(dev % 26), dev / 26));
+		NIH_MUST (environ_add (&env, NULL, NULL, TRUE, "SUBSYSTEM=block"));
+		NIH_MUST (environ_add (&env, NULL, NULL, TRUE, "DEVTYPE=partition"));
+		NIH_MUST (environ_add (&env, NULL, NULL, TRUE, "ID_FS_TYPE=ext4"));
+		NIH_MUST (environ_set (&env, NULL, NULL, TRUE, "ACTION=%s",
+				       add ? "add" : "remove"));
+
+		return NIH_MUST (event_new (NULL, (add ? "block-device-added"
+						   : "block-device-removed"),
+					    env));
+	}
+
+	NIH_MUST (environ_set (&env, NULL, NULL, TRUE, "IFACE=eth%zu", dev));
+	NIH_MUST (environ_set (&env, NULL, NULL, TRUE, "INTERFACE=eth%zu", dev));
+	NIH_MUST (environ_set (&env, NULL, NULL, TRUE,
+			       "DEVPATH=/devices/virtual/net/eth%zu", dev));
+	NIH_MUST (environ_add (&env, NULL, NULL, TRUE, "SUBSYSTEM=net"));
+	NIH_MUST (environ_set (&env, NULL, NULL, TRUE, "ACTION=%s",
+			       add ? "add" : "remove"));
+
+	return NIH_MUST (event_new (NULL, (add ? "net-device-up"
+					   : "net-device-down"),
+				    env));
+}
+
+/**
+ * bench_operator_handle:
+ * @num_events: number of events to match.
+ *
+ * Measure matching each of @num_events events against the start on
+ * and stop on conditions of every job class, without dispatching.
+ **/
+static void
+bench_operator_handle (size_t num_events)
+{
+	nih_local Event **events = NULL;
+	Bench             bench;
+	size_t            handled = 0;
+
+	events = NIH_MUST (nih_alloc (NULL, sizeof (Event *) * num_events));
+	for (size_t i = 0; i < num_events; i++) {
+		events[i] = bench_event_new (i);
+		nih_list_remove (&events[i]->entry);
+	}
+
+	bench_start (&bench, "event_operator_handle");
+
+	for (size_t i = 0; i < num_events; i++) {
+		NIH_HASH_FOREACH (job_classes, iter) {
+			JobClass *class = (JobClass *)iter;
+
+			if (class->start_on) {
+				event_operator_handle (class->start_on,
+						       events[i], NULL);
+				handled++;
+			}
+
+			if (class->stop_on) {
+				event_operator_handle (class->stop_on,
+						       events[i], NULL);
+				handled++;
+			}
+		}
+
+		NIH_HASH_FOREACH (job_classes, iter) {
+			JobClass *class = (JobClass *)iter;
+
+			if (class->start_on)
+				event_operator_reset (class->start_on);
+			if (class->stop_on)
+				event_operator_reset (class->stop_on);
+		}
+	}
+
+	bench_finish (&bench, handled, "match");
+
+	for (size_t i = 0; i < num_events; i++)
+		nih_free (events[i]);
+}
+
+/**
+ * bench_poll:
+ * @num_events: number of events to emit.
+ *
+ * Measure emitting @num_events events and running the event queue
+ * after each, including starting and stopping the jobs they match.
+ **/
+static void
+bench_poll (size_t num_events)
+{
+	Bench bench;
+
+	bench_start (&bench, "event_poll");
+
+	for (size_t i = 0; i < num_events; i++) {
+		bench_event_new (i);
+		event_poll ();
+	}
+
+	bench_finish (&bench, num_events, "event");
+}
+
+/**
+ * bench_induct:
+ *
+ * Measure starting a new instance of every job class directly, then
+ * stop them again outside of the measurement.
+ **/
+static void
+bench_induct (void)
+{
+	Bench  bench;
+	size_t inducted = 0;
+
+	bench_start (&bench, "job_class_induct_job");
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		if (! class->start_on)
+			continue;
+
+		if (job_class_induct_job (class))
+			inducted++;
+	}
+
+	bench_finish (&bench, inducted, "job");
+
+	NIH_HASH_FOREACH (job_classes, iter) {
+		JobClass *class = (JobClass *)iter;
+
+		NIH_HASH_FOREACH_SAFE (class->instances, job_iter) {
+			Job *job = (Job *)job_iter;
+
+			job_change_goal (job, JOB_STOP);
+		}
+	}
+
+	event_poll ();
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	size_t num_classes = BENCH_CLASSES;
+	size_t num_events = BENCH_EVENTS;
+
+	if (argc > 1)
+		num_classes = strtoul (argv[1], NULL, 10);
+	if (argc > 2)
+		num_events = strtoul (argv[2], NULL, 10);
+
+	/* run in legacy (pre-session support) mode, as the tests do */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	nih_main_init (argv[0]);
+	nih_log_set_priority (NIH_LOG_FATAL);
+
+	bench_malloc_real = __nih_malloc;
+	__nih_malloc = bench_malloc;
+
+	job_class_environment_init ();
+	job_class_init ();
+	event_init ();
+	control_init ();
+
+	bench_classes (num_classes);
+
+	printf ("%zu job classes, %zu events\n", num_classes, num_events);
+
+	bench_operator_handle (num_events);
+
+	/* Start the service jobs so that later events stop and restart
+	 * the device jobs around them.
+	 */
+	NIH_MUST (event_new (NULL, "filesystem", NULL));
+	event_poll ();
+
+	bench_poll (num_events);
+	bench_induct ();
+
+	return 0;
+}
@@ -22,6 +22,27 @@
 #include <nih/string.h>
 #include <nih/file.h>
 #include <nih/test.h>
+#include <nih/main.h>
+#include <nih/timer.h>
+#include <nih/error.h>
+
+#include <nih-dbus/dbus_connection.h>
+#include <nih-dbus/dbus_error.h>
+#include <nih-dbus/dbus_proxy.h>
+#include <nih-dbus/errors.h>
+
+#include <dbus/dbus.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cgroup.h"
 
@@ -29,6 +50,26 @@
 
 extern NihHash *cgroup_paths;
 
+extern char         *cgroup_manager_address;
+extern NihDBusProxy *cgroup_manager;
+
+/**
+ * FAKE_CGMANAGER_HELD_MAX:
+ *
+ * Most requests the fake cgroup manager holds the replies to.
+ **/
+#define FAKE_CGMANAGER_HELD_MAX 16
+
+/* Number of requests in each batch the fake cgroup manager waits to
+ * receive in full before replying to any of them, ending with zero.
+ */
+static const size_t *fake_cgmanager_batches = NULL;
+
+static FILE        *fake_cgmanager_log = NULL;
+static DBusMessage *fake_cgmanager_held[FAKE_CGMANAGER_HELD_MAX];
+static size_t       fake_cgmanager_held_len = 0;
+static NihTimer    *fake_cgmanager_timer = NULL;
+
 void
 test_cgroup_new (void)
 {
@@ -375,6 +416,608 @@ test_cgroup_job_start (void)
 
 }
 
+/**
+ * fake_cgmanager_reply:
+ * @conn: connection to client.
+ *
+ * Replies to each request held, with an error for those naming the
+ * cgroup "fail".
+ **/
+static void
+fake_cgmanager_reply (DBusConnection *conn)
+{
+	for (size_t i = 0; i < fake_cgmanager_held_len; i++) {
+		DBusMessage *message = fake_cgmanager_held[i];
+		DBusMessage *reply;
+		const char  *controller;
+		const char  *path;
+		int32_t      existed = 0;
+
+		assert (dbus_message_get_args (message, NULL,
+					       DBUS_TYPE_STRING, &controller,
+					       DBUS_TYPE_STRING, &path,
+					       DBUS_TYPE_INVALID));
+
+		if (! strcmp (path, "fail")) {
+			reply = dbus_message_new_error (
+				message, "org.linuxcontainers.cgmanager.Error",
+				"Injected failure");
+		} else {
+			reply = dbus_message_new_method_return (message);
+
+			if (! strcmp (dbus_message_get_member (message),
+				      "Create"))
+				assert (dbus_message_append_args (
+						reply,
+						DBUS_TYPE_INT32, &existed,
+						DBUS_TYPE_INVALID));
+		}
+
+		assert (reply != NULL);
+		assert (dbus_connection_send (conn, reply, NULL));
+
+		dbus_message_unref (reply);
+		dbus_message_unref (message);
+	}
+
+	dbus_connection_flush (conn);
+
+	fake_cgmanager_held_len = 0;
+
+	if (fake_cgmanager_timer) {
+		nih_free (fake_cgmanager_timer);
+		fake_cgmanager_timer = NULL;
+	}
+}
+
+/**
+ * fake_cgmanager_timeout:
+ * @conn: connection to client,
+ * @timer: timer that fired.
+ *
+ * Called should the client wait for a reply before sending the rest of
+ * a batch; the replies are sent anyway, after noting the fact in the log.
+ **/
+static void
+fake_cgmanager_timeout (DBusConnection *conn,
+			NihTimer       *timer)
+{
+	fake_cgmanager_timer = NULL;
+
+	fprintf (fake_cgmanager_log, "timeout\n");
+	fflush (fake_cgmanager_log);
+
+	fake_cgmanager_reply (conn);
+
+	if (*fake_cgmanager_batches)
+		fake_cgmanager_batches++;
+}
+
+/**
+ * fake_cgmanager_filter:
+ *
+ * Logs each request received from the client and holds it until the
+ * whole of the current batch has been received.
+ **/
+static DBusHandlerResult
+fake_cgmanager_filter (DBusConnection *conn,
+		       DBusMessage    *message,
+		       void           *data)
+{
+	const char *controller;
+	const char *path;
+
+	if (dbus_message_get_type (message) != DBUS_MESSAGE_TYPE_METHOD_CALL)
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	assert (dbus_message_get_args (message, NULL,
+				       DBUS_TYPE_STRING, &controller,
+				       DBUS_TYPE_STRING, &path,
+				       DBUS_TYPE_INVALID));
+
+	fprintf (fake_cgmanager_log, "%s %s %s\n",
+		 dbus_message_get_member (message), controller, path);
+	fflush (fake_cgmanager_log);
+
+	assert (fake_cgmanager_held_len < FAKE_CGMANAGER_HELD_MAX);
+	fake_cgmanager_held[fake_cgmanager_held_len++] = dbus_message_ref (message);
+
+	if (fake_cgmanager_held_len >= *fake_cgmanager_batches) {
+		fake_cgmanager_reply (conn);
+
+		if (*fake_cgmanager_batches)
+			fake_cgmanager_batches++;
+	} else if (! fake_cgmanager_timer) {
+		fake_cgmanager_timer = NIH_MUST (nih_timer_add_timeout (
+				NULL, 5,
+				(NihTimerCb)fake_cgmanager_timeout, conn));
+	}
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+static int
+fake_cgmanager_connect (DBusServer     *server,
+			DBusConnection *conn)
+{
+	assert (dbus_connection_add_filter (conn, fake_cgmanager_filter,
+					    NULL, NULL));
+
+	return TRUE;
+}
+
+/**
+ * fake_cgmanager_start:
+ * @address: address to listen on,
+ * @batches: zero-terminated sizes of batches of requests,
+ * @log: set to stream of requests received.
+ *
+ * Starts a child process acting as the cgroup manager, which does not
+ * reply to any request of a batch until it has received all of them;
+ * a client that waits for each reply in turn is only answered after a
+ * timeout, which is logged.
+ *
+ * Returns: pid of child.
+ **/
+static pid_t
+fake_cgmanager_start (const char    *address,
+		      const size_t  *batches,
+		      FILE         **log)
+{
+	DBusServer *server;
+	pid_t       pid;
+	int         fds[2];
+	int         wait_fd = -1;
+
+	assert0 (pipe (fds));
+
+	fake_cgmanager_batches = batches;
+
+	TEST_CHILD_WAIT (pid, wait_fd) {
+		close (fds[0]);
+		fake_cgmanager_log = fdopen (fds[1], "w");
+		assert (fake_cgmanager_log != NULL);
+
+		server = nih_dbus_server (address, fake_cgmanager_connect,
+					  NULL);
+		assert (server != NULL);
+
+		TEST_CHILD_RELEASE (wait_fd);
+
+		nih_main_loop ();
+
+		_exit (0);
+	}
+
+	close (fds[1]);
+	*log = fdopen (fds[0], "r");
+	assert (*log != NULL);
+
+	return pid;
+}
+
+void
+test_cgroup_requests (void)
+{
+	char            address[PATH_MAX];
+	const size_t    batches[] = { 4, 5, 3, 2, 2, 0 };
+	NihList         cgroups;
+	char           *env[] = {
+		"UPSTART_JOB=test",
+		"UPSTART_INSTANCE=",
+		NULL
+	};
+	NihError       *err;
+	NihDBusError   *dbus_err;
+	DBusConnection *conn;
+	CGroupName     *cgname;
+	FILE           *log;
+	pid_t           pid;
+	char            line[PATH_MAX];
+	int             ret;
+	int             status;
+
+	TEST_FUNCTION ("cgroup_setup");
+
+	sprintf (address, "unix:abstract=/com/ubuntu/upstart/test/cgmanager-%d",
+		 getpid ());
+
+	pid = fake_cgmanager_start (address, batches, &log);
+
+	TEST_TRUE (cgroup_manager_set_address (address));
+	assert0 (cgroup_manager_connect ());
+	TEST_NE_P (cgroup_manager, NULL);
+
+	nih_list_init (&cgroups);
+
+
+	/* Check that every request made to set up a cgroup is sent before
+	 * any reply is waited for, so the cgroup manager receives the
+	 * whole batch without having replied to any of it, and in the
+	 * order they depend on each other.
+	 */
+	TEST_FEATURE ("with cgroup owned by caller");
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+			       "limit_in_bytes", "1024"));
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+			       "swappiness", "0"));
+
+	ret = cgroup_setup (&cgroups, env, geteuid (), getegid ());
+	TEST_TRUE (ret);
+
+	cgname = (CGroupName *)((CGroup *)cgroups.next)->names.next;
+	TEST_EQ_STR (cgname->expanded, "upstart/test");
+
+	TEST_FILE_EQ (log, "MovePidAbs memory /\n");
+	TEST_FILE_EQ (log, "Create memory upstart/test\n");
+	TEST_FILE_EQ (log, "SetValue memory upstart/test\n");
+	TEST_FILE_EQ (log, "SetValue memory upstart/test\n");
+
+
+	/* Check that the chown of a cgroup owned by another user is sent
+	 * in the same batch, after the settings.
+	 */
+	TEST_FEATURE ("with cgroup owned by other user");
+	ret = cgroup_setup (&cgroups, env, geteuid () + 1, getegid ());
+	TEST_TRUE (ret);
+
+	TEST_FILE_EQ (log, "MovePidAbs memory /\n");
+	TEST_FILE_EQ (log, "Create memory upstart/test\n");
+	TEST_FILE_EQ (log, "SetValue memory upstart/test\n");
+	TEST_FILE_EQ (log, "SetValue memory upstart/test\n");
+	TEST_FILE_EQ (log, "Chown memory upstart/test\n");
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter)
+		nih_free (iter);
+
+
+	/* Check that an error reply to one request is raised once the
+	 * replies to all of the requests sent have been received, and that
+	 * it is the first error that is raised.
+	 */
+	TEST_FEATURE ("with error reply");
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "fail",
+			       "limit_in_bytes", "1024"));
+
+	ret = cgroup_setup (&cgroups, env, geteuid (), getegid ());
+	TEST_FALSE (ret);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_DBUS_ERROR);
+	dbus_err = (NihDBusError *)err;
+	TEST_EQ_STR (dbus_err->name, "org.linuxcontainers.cgmanager.Error");
+	TEST_EQ_STR (err->message, "Injected failure");
+	nih_free (err);
+
+	TEST_FILE_EQ (log, "MovePidAbs memory /\n");
+	TEST_FILE_EQ (log, "Create memory fail\n");
+	TEST_FILE_EQ (log, "SetValue memory fail\n");
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter)
+		nih_free (iter);
+
+
+	/* Check that the requests to enter each cgroup are sent together,
+	 * and that no reply was left behind by the failed setup.
+	 */
+	TEST_FUNCTION ("cgroup_enter_groups");
+	TEST_FEATURE ("with two cgroups");
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", "mem", NULL, NULL));
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "cpu", "cpu", NULL, NULL));
+
+	ret = cgroup_enter_groups (&cgroups);
+	TEST_TRUE (ret);
+
+	TEST_FILE_EQ (log, "MovePid memory mem\n");
+	TEST_FILE_EQ (log, "MovePid cpu cpu\n");
+
+
+	/* Check that the requests to remove each cgroup once empty are
+	 * sent together.
+	 */
+	TEST_FUNCTION ("cgroup_clear");
+	TEST_FEATURE ("with two cgroups");
+	ret = cgroup_clear (&cgroups);
+	TEST_TRUE (ret);
+
+	TEST_FILE_EQ (log, "RemoveOnEmpty memory mem\n");
+	TEST_FILE_EQ (log, "RemoveOnEmpty cpu cpu\n");
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter)
+		nih_free (iter);
+
+	conn = dbus_connection_ref (cgroup_manager->connection);
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+
+	/* Nothing else, in particular no timeout, was logged */
+	TEST_FALSE (fgets (line, sizeof (line), log));
+	fclose (log);
+
+	/* Check that the cgroup manager is forgotten once it has gone. */
+	TEST_FUNCTION ("cgroup_manager_disconnected");
+	TEST_FEATURE ("with cgroup manager gone");
+	while (cgroup_manager
+	       && dbus_connection_read_write_dispatch (conn, -1))
+		;
+
+	dbus_connection_unref (conn);
+
+	TEST_EQ_P (cgroup_manager, NULL);
+	TEST_EQ_P (cgroup_manager_address, NULL);
+}
+
+
+/**
+ * fake_cgroup_dir:
+ * @root: fake cgroup2 mount point,
+ * @path: cgroup below @root, or "",
+ * @files: NULL-terminated list of further files the kernel provides.
+ *
+ * Creates the cgroup @path below @root with the files the kernel would
+ * provide within it, since a directory made in an ordinary file system
+ * has none.
+ **/
+static void
+fake_cgroup_dir (const char  *root,
+		 const char  *path,
+		 const char **files)
+{
+	const char *common[] = {
+		"cgroup.procs",
+		"cgroup.threads",
+		"cgroup.subtree_control",
+		NULL
+	};
+	char        dir[PATH_MAX];
+	char        filename[PATH_MAX];
+	FILE       *f;
+
+	sprintf (dir, "%s/%s", root, path);
+	if ((mkdir (dir, 0755) < 0) && (errno != EEXIST))
+		TEST_FAILED ("unable to create %s: %s", dir, strerror (errno));
+
+	for (const char **file = common; *file; file++) {
+		sprintf (filename, "%s/%s", dir, *file);
+		f = fopen (filename, "w");
+		TEST_NE_P (f, NULL);
+		fclose (f);
+	}
+
+	for (const char **file = files; file && *file; file++) {
+		sprintf (filename, "%s/%s", dir, *file);
+		f = fopen (filename, "w");
+		TEST_NE_P (f, NULL);
+		fclose (f);
+	}
+}
+
+/**
+ * fake_cgroup_dir_remove:
+ * @root: fake cgroup2 mount point,
+ * @path: cgroup below @root.
+ *
+ * Removes the files created by fake_cgroup_dir() within @path, leaving
+ * the empty directory as the kernel would once it is removable.
+ **/
+static void
+fake_cgroup_dir_remove (const char *root,
+			const char *path)
+{
+	char dir[PATH_MAX];
+	DIR *d;
+
+	sprintf (dir, "%s/%s", root, path);
+
+	d = opendir (dir);
+	TEST_NE_P (d, NULL);
+
+	for (struct dirent *ent = readdir (d); ent; ent = readdir (d)) {
+		char filename[PATH_MAX];
+
+		if (ent->d_type != DT_REG)
+			continue;
+
+		sprintf (filename, "%s/%s", dir, ent->d_name);
+		assert0 (unlink (filename));
+	}
+
+	closedir (d);
+}
+
+void
+test_cgroup_native (void)
+{
+	char            root[PATH_MAX];
+	char            filename[PATH_MAX];
+	const char     *memory_files[] = {
+		"memory.max",
+		"memory.swap.max",
+		NULL
+	};
+	char           *env[] = {
+		"UPSTART_JOB=test",
+		"UPSTART_INSTANCE=",
+		NULL
+	};
+	NihList         cgroups;
+	NihError       *err;
+	nih_local char *dir = NULL;
+	struct stat     statbuf;
+	FILE           *f;
+	char            pid[32];
+	int             ret;
+
+	TEST_FUNCTION ("cgroup_setup");
+
+	TEST_FILENAME (root);
+	fake_cgroup_dir (root, "", NULL);
+	fake_cgroup_dir (root, "upstart", NULL);
+	fake_cgroup_dir (root, "upstart/test", memory_files);
+
+	cgroup_root = root;
+	TEST_TRUE (cgroup_manager_available ());
+
+	nih_list_init (&cgroups);
+
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+			       "max", "1048576"));
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+			       "swap.max", "0"));
+
+
+	/* Check that without the cgroup manager, the cgroup is created
+	 * directly with its controller enabled in each of its parents and
+	 * the settings written to its files.
+	 */
+	TEST_FEATURE ("with cgroup root");
+	ret = cgroup_setup (&cgroups, env, geteuid (), getegid ());
+	TEST_TRUE (ret);
+
+	sprintf (filename, "%s/cgroup.subtree_control", root);
+	f = fopen (filename, "r");
+	TEST_NE_P (f, NULL);
+	TEST_FILE_EQ (f, "+memory");
+	TEST_FILE_END (f);
+	fclose (f);
+
+	sprintf (filename, "%s/upstart/cgroup.subtree_control", root);
+	f = fopen (filename, "r");
+	TEST_NE_P (f, NULL);
+	TEST_FILE_EQ (f, "+memory");
+	TEST_FILE_END (f);
+	fclose (f);
+
+	sprintf (filename, "%s/upstart/test/memory.max", root);
+	f = fopen (filename, "r");
+	TEST_NE_P (f, NULL);
+	TEST_FILE_EQ (f, "1048576");
+	TEST_FILE_END (f);
+	fclose (f);
+
+	sprintf (filename, "%s/upstart/test/memory.swap.max", root);
+	f = fopen (filename, "r");
+	TEST_NE_P (f, NULL);
+	TEST_FILE_EQ (f, "0");
+	TEST_FILE_END (f);
+	fclose (f);
+
+
+	/* Check that a setting the controller lacks is an error. */
+	TEST_FEATURE ("with unknown setting");
+	TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+			       "wibble", "1"));
+
+	ret = cgroup_setup (&cgroups, env, geteuid (), getegid ());
+	TEST_FALSE (ret);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, ENOENT);
+	nih_free (err);
+
+
+	/* Check that, when run as root, a cgroup for another user is
+	 * handed over to them along with the files that manage it.
+	 */
+	if (geteuid () == 0) {
+		TEST_FEATURE ("with cgroup owned by other user");
+		NIH_LIST_FOREACH_SAFE (&cgroups, iter)
+			nih_free (iter);
+		TEST_TRUE (cgroup_add (NULL, &cgroups, "memory", NULL,
+				       "max", "1048576"));
+
+		ret = cgroup_setup (&cgroups, env, 1, 1);
+		TEST_TRUE (ret);
+
+		sprintf (filename, "%s/upstart/test", root);
+		assert0 (stat (filename, &statbuf));
+		TEST_EQ (statbuf.st_uid, 1);
+		TEST_EQ (statbuf.st_gid, 1);
+
+		sprintf (filename, "%s/upstart/test/cgroup.procs", root);
+		assert0 (stat (filename, &statbuf));
+		TEST_EQ (statbuf.st_uid, 1);
+
+		sprintf (filename, "%s/upstart/test/memory.max", root);
+		assert0 (stat (filename, &statbuf));
+		TEST_EQ (statbuf.st_uid, 0);
+	} else {
+		printf ("INFO: skipping %s ownership test as not running as root\n",
+			__func__);
+		fflush (NULL);
+	}
+
+
+	/* Check that the caller enters the cgroup by writing its pid to
+	 * the cgroup.procs file.
+	 */
+	TEST_FUNCTION ("cgroup_enter_groups");
+	TEST_FEATURE ("with cgroup root");
+	ret = cgroup_enter_groups (&cgroups);
+	TEST_TRUE (ret);
+
+	sprintf (pid, "%d", getpid ());
+
+	sprintf (filename, "%s/upstart/test/cgroup.procs", root);
+	f = fopen (filename, "r");
+	TEST_NE_P (f, NULL);
+	TEST_FILE_EQ (f, pid);
+	TEST_FILE_END (f);
+	fclose (f);
+
+
+	/* Check that the directory of the cgroup is given for the job. */
+	TEST_FUNCTION ("cgroup_path");
+	TEST_FEATURE ("with cgroup root");
+	dir = cgroup_path (NULL, &cgroups, env);
+
+	sprintf (filename, "%s/upstart/test", root);
+	TEST_EQ_STR (dir, filename);
+
+
+	/* Check that the cgroup manager is not asked to remove the cgroup
+	 * once empty, since cgroup2 has no such thing.
+	 */
+	TEST_FUNCTION ("cgroup_clear");
+	TEST_FEATURE ("with cgroup root");
+	TEST_EQ_P (cgroup_manager, NULL);
+	TEST_TRUE (cgroup_clear (&cgroups));
+
+
+	/* Check that a cgroup still in use is left alone, but removed once
+	 * it can be.
+	 */
+	TEST_FUNCTION ("cgroup_remove");
+	TEST_FEATURE ("with cgroup in use");
+	cgroup_remove (&cgroups, env);
+
+	sprintf (filename, "%s/upstart/test", root);
+	assert0 (stat (filename, &statbuf));
+
+	TEST_FEATURE ("with cgroup no longer in use");
+	fake_cgroup_dir_remove (root, "upstart/test");
+
+	cgroup_remove (&cgroups, env);
+
+	TEST_LT (stat (filename, &statbuf), 0);
+	TEST_EQ (errno, ENOENT);
+
+	sprintf (filename, "%s/upstart", root);
+	assert0 (stat (filename, &statbuf));
+
+	NIH_LIST_FOREACH_SAFE (&cgroups, iter)
+		nih_free (iter);
+
+	cgroup_root = NULL;
+
+	fake_cgroup_dir_remove (root, "upstart");
+	assert0 (rmdir (filename));
+	fake_cgroup_dir_remove (root, "");
+	assert0 (rmdir (root));
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -382,6 +1025,8 @@ main (int   argc,
 	test_cgroup_new ();
 	test_cgroup_name_new ();
 	test_cgroup_setting_new ();
+	test_cgroup_requests ();
+	test_cgroup_native ();
 	test_cgroup_job_start ();
 
 	return 0;
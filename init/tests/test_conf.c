@@ -4579,6 +4579,7 @@ test_source_reload (void)
 {
 	FILE           *f;
 	ConfSource     *source1, *source2, *source3;
+	ConfFile       *file;
 	char            dirname[PATH_MAX], filename[PATH_MAX], filename2[PATH_MAX];
 	Event          *event1;
 	Event          *event2;
@@ -4659,6 +4660,126 @@ test_source_reload (void)
 
 	rmdir (dirname);
 
+	/* Check that prefetching the sources does not affect what is
+	 * loaded.
+	 */
+	TEST_FEATURE ("with prefetch");
+	conf_prefetch = TRUE;
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+
+	source1 = conf_source_new (NULL, dirname, CONF_JOB_DIR);
+
+	strcpy (filename, dirname);
+	strcat (filename, "/foo.conf");
+
+	f = fopen (filename, "w");
+	fprintf (f, "exec /sbin/daemon\n");
+	fclose (f);
+
+	strcpy (filename2, dirname);
+	strcat (filename2, "/foo.override");
+
+	f = fopen (filename2, "w");
+	fprintf (f, "respawn\n");
+	fclose (f);
+
+	conf_reload ();
+
+	TEST_HASH_NOT_EMPTY (source1->files);
+
+	class1 = job_class_get_registered ("foo", NULL);
+	TEST_NE_P (class1, NULL);
+	TEST_TRUE (class1->respawn);
+
+	nih_free (source1);
+
+	unlink (filename);
+	unlink (filename2);
+	rmdir (dirname);
+
+	conf_prefetch = FALSE;
+
+	/* Check that a reload retains files that have not changed or
+	 * that have been rewritten with the same contents, but still
+	 * reloads those that have changed.
+	 */
+	TEST_FEATURE ("with unchanged files");
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+
+	source1 = conf_source_new (NULL, dirname, CONF_JOB_DIR);
+
+	strcpy (filename, dirname);
+	strcat (filename, "/foo.conf");
+
+	f = fopen (filename, "w");
+	fprintf (f, "exec /sbin/daemon\n");
+	fclose (f);
+
+	strcpy (filename2, dirname);
+	strcat (filename2, "/bar.conf");
+
+	f = fopen (filename2, "w");
+	fprintf (f, "exec /sbin/tool\n");
+	fclose (f);
+
+	/* Files changed within the current clock tick are always
+	 * reloaded.
+	 */
+	usleep (50000);
+
+	conf_reload ();
+
+	file = (ConfFile *)nih_hash_lookup (source1->files, filename);
+	TEST_NE_P (file, NULL);
+	TEST_TRUE (file->stamped);
+	class1 = file->job;
+	TEST_NE_P (class1, NULL);
+
+	file = (ConfFile *)nih_hash_lookup (source1->files, filename2);
+	TEST_NE_P (file, NULL);
+	class2 = file->job;
+	TEST_NE_P (class2, NULL);
+
+	TEST_FREE_TAG (class1);
+	TEST_FREE_TAG (class2);
+
+	/* Rewrite foo with the same contents, which changes its stamp
+	 * but not its digest.
+	 */
+	f = fopen (filename, "w");
+	fprintf (f, "exec /sbin/daemon\n");
+	fclose (f);
+
+	f = fopen (filename2, "w");
+	fprintf (f, "exec /sbin/tool --foo\n");
+	fclose (f);
+
+	conf_reload ();
+
+	TEST_NOT_FREE (class1);
+	file = (ConfFile *)nih_hash_lookup (source1->files, filename);
+	TEST_NE_P (file, NULL);
+	TEST_EQ (file->flag, source1->flag);
+	TEST_EQ_P (file->job, class1);
+	TEST_EQ_P (job_class_get_registered ("foo", NULL), class1);
+
+	TEST_FREE (class2);
+	file = (ConfFile *)nih_hash_lookup (source1->files, filename2);
+	TEST_NE_P (file, NULL);
+	TEST_EQ (file->flag, source1->flag);
+	TEST_NE_P (file->job, NULL);
+	TEST_EQ_STR (file->job->process[PROCESS_MAIN]->command,
+		     "/sbin/tool --foo");
+
+	nih_free (source1);
+
+	unlink (filename);
+	unlink (filename2);
+	rmdir (dirname);
+
 	nih_log_set_priority (NIH_LOG_MESSAGE);
 
 	/************************************************************/
@@ -5095,12 +5216,283 @@ test_select_job (void)
 	TEST_EQ_P (ptr, NULL);
 
 
+	/* Check that the files of each source are found by the name of
+	 * the job they define.
+	 */
+	TEST_FEATURE ("with jobs hash");
+	TEST_EQ_P (file3->named->file, file3);
+	TEST_EQ_STR (file3->named->name, "drogo");
+	TEST_EQ_P (nih_hash_lookup (source2->jobs, "drogo"), file3->named);
+	TEST_EQ_P (nih_hash_lookup (source1->jobs, "drogo"), NULL);
+
+
+	/* Check that a file no longer in its source is not selected.
+	 */
+	TEST_FEATURE ("with file removed from source");
+	file3->job = NULL;
+	nih_free (file3);
+
+	ptr = conf_select_job ("drogo", NULL);
+
+	TEST_EQ_P (ptr, NULL);
+	TEST_EQ_P (nih_hash_lookup (source2->jobs, "drogo"), NULL);
+
+	nih_free (class2);
+
+
 	nih_free (source3);
 	nih_free (source2);
 	nih_free (source1);
 }
 
 
+void
+test_lazy (void)
+{
+	ConfSource *source;
+	ConfFile   *file;
+	JobClass   *job;
+	FILE       *f;
+	int         ret;
+	char        dirname[PATH_MAX];
+	char        foo[PATH_MAX], bar[PATH_MAX];
+
+	TEST_FUNCTION ("conf_lazy_load");
+	program_name = "test";
+	nih_log_set_priority (NIH_LOG_FATAL);
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+
+	strcpy (foo, dirname);
+	strcat (foo, "/foo.conf");
+
+	f = fopen (foo, "w");
+	fprintf (f, "start on (wibble FOO=\"and wobble\" or\n");
+	fprintf (f, "          starting bar)\n");
+	fprintf (f, "exec /sbin/daemon\n");
+	fclose (f);
+
+	strcpy (bar, dirname);
+	strcat (bar, "/bar.conf");
+
+	f = fopen (bar, "w");
+	fprintf (f, "task\n");
+	fprintf (f, "exec /bin/tool\n");
+	fclose (f);
+
+	conf_lazy = TRUE;
+
+	source = conf_source_new (NULL, dirname, CONF_JOB_DIR);
+	ret = conf_source_reload (source);
+
+	TEST_EQ (ret, 0);
+
+
+	/* Check that in lazy mode job files are indexed without being
+	 * parsed, and no job is registered for them.
+	 */
+	TEST_FEATURE ("with indexed files");
+	file = (ConfFile *)nih_hash_lookup (source->files, foo);
+
+	TEST_ALLOC_PARENT (file, source);
+	TEST_EQ (file->flag, source->flag);
+	TEST_EQ_P (file->job, NULL);
+	TEST_ALLOC_PARENT (file->lazy, file);
+	TEST_EQ_STR (file->lazy->name, "foo");
+
+	file = (ConfFile *)nih_hash_lookup (source->files, bar);
+
+	TEST_EQ_P (file->job, NULL);
+	TEST_NE_P (file->lazy, NULL);
+
+	TEST_HASH_EMPTY (job_classes);
+
+
+	/* Check that an event not named in a start on condition leaves
+	 * the jobs alone, including words that are part of values.
+	 */
+	TEST_FUNCTION ("conf_lazy_load_event");
+	TEST_FEATURE ("with unreferenced event");
+	conf_lazy_load_event ("wobble");
+	conf_lazy_load_event ("and");
+
+	TEST_HASH_EMPTY (job_classes);
+
+
+	/* Check that an event named on a continued line of a start on
+	 * condition causes that job to be parsed and registered.
+	 */
+	TEST_FEATURE ("with referenced event");
+	conf_lazy_load_event ("starting");
+
+	file = (ConfFile *)nih_hash_lookup (source->files, foo);
+
+	TEST_EQ_P (file->lazy, NULL);
+	TEST_NE_P (file->job, NULL);
+
+	job = (JobClass *)nih_hash_lookup (job_classes, "foo");
+	TEST_EQ_P (job, file->job);
+	TEST_NE_P (job->start_on, NULL);
+
+	TEST_EQ_P (nih_hash_lookup (job_classes, "bar"), NULL);
+
+
+	/* Check that a job without a start on condition is parsed once it
+	 * is asked for by name.
+	 */
+	TEST_FUNCTION ("conf_lazy_load");
+	TEST_FEATURE ("with job name");
+	conf_lazy_load ("bar");
+
+	file = (ConfFile *)nih_hash_lookup (source->files, bar);
+
+	TEST_EQ_P (file->lazy, NULL);
+	TEST_NE_P (file->job, NULL);
+
+	job = (JobClass *)nih_hash_lookup (job_classes, "bar");
+	TEST_EQ_P (job, file->job);
+	TEST_TRUE (job->task);
+
+	nih_free (source);
+
+	conf_lazy = FALSE;
+
+	unlink (foo);
+	unlink (bar);
+	rmdir (dirname);
+
+	nih_log_set_priority (NIH_LOG_MESSAGE);
+}
+
+
+void
+test_reload_dirty (void)
+{
+	ConfSource *source;
+	ConfFile   *file, *old_file;
+	FILE       *f;
+	int         ret, fd, nfds;
+	char        dirname[PATH_MAX];
+	char        filename[PATH_MAX];
+	fd_set      readfds, writefds, exceptfds;
+
+	TEST_FUNCTION ("conf_reload_dirty");
+	program_name = "test";
+	nih_log_set_priority (NIH_LOG_FATAL);
+
+	/* Make sure that we have inotify before performing some tests... */
+	if ((fd = inotify_init ()) < 0) {
+		printf ("SKIP: inotify not available\n");
+		return;
+	}
+	close (fd);
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+
+	strcpy (filename, dirname);
+	strcat (filename, "/foo.conf");
+
+	conf_reload_delay = 1;
+
+	source = conf_source_new (NULL, dirname, CONF_JOB_DIR);
+	ret = conf_source_reload (source);
+
+	TEST_EQ (ret, 0);
+	TEST_HASH_EMPTY (source->files);
+
+
+	/* Check that a file created and rewritten while the delay runs
+	 * isn't loaded when the changes are seen, but only once when
+	 * they are handled together.
+	 */
+	TEST_FEATURE ("with file changed several times");
+	for (int i = 0; i < 3; i++) {
+		f = fopen (filename, "w");
+		fprintf (f, "exec /sbin/daemon %d\n", i);
+		fclose (f);
+
+		nfds = 0;
+		FD_ZERO (&readfds);
+		FD_ZERO (&writefds);
+		FD_ZERO (&exceptfds);
+
+		nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+		nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+	}
+
+	TEST_HASH_EMPTY (source->files);
+
+	conf_reload_dirty ();
+
+	file = (ConfFile *)nih_hash_lookup (source->files, filename);
+
+	TEST_ALLOC_SIZE (file, sizeof (ConfFile));
+	TEST_ALLOC_PARENT (file, source);
+	TEST_NE_P (file->job, NULL);
+	TEST_EQ_STR (file->job->process[PROCESS_MAIN]->command,
+		     "/sbin/daemon 2");
+
+	old_file = file;
+
+
+	/* Check that a file deleted while the delay runs is left loaded
+	 * until the changes are handled.
+	 */
+	TEST_FEATURE ("with deleted file");
+	TEST_FREE_TAG (old_file);
+
+	unlink (filename);
+
+	nfds = 0;
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+
+	nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	TEST_NOT_FREE (old_file);
+
+	conf_reload_dirty ();
+
+	TEST_FREE (old_file);
+	TEST_HASH_EMPTY (source->files);
+
+
+	/* Check that a file created and deleted again while the delay
+	 * runs is never loaded.
+	 */
+	TEST_FEATURE ("with file created and deleted");
+	f = fopen (filename, "w");
+	fprintf (f, "exec /sbin/daemon\n");
+	fclose (f);
+
+	unlink (filename);
+
+	nfds = 0;
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+
+	nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+	nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+
+	conf_reload_dirty ();
+
+	TEST_HASH_EMPTY (source->files);
+
+	nih_free (source);
+
+	conf_reload_delay = 0;
+
+	rmdir (dirname);
+
+	nih_log_set_priority (NIH_LOG_MESSAGE);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -5117,6 +5509,8 @@ main (int   argc,
 	test_override ();
 	test_file_destroy ();
 	test_select_job ();
+	test_lazy ();
+	test_reload_dirty ();
 
 	return 0;
 }
@@ -212,6 +212,138 @@ test_conf_get_best_override (void)
 	}
 }
 
+void
+test_conf_file_map (void)
+{
+	char        dirname[PATH_MAX];
+	char        filename[PATH_MAX];
+	const char *contents = "exec /bin/true\n";
+	const char *path;
+	ConfSource *source;
+	JobClass   *class;
+	struct stat statbuf;
+	FILE       *f;
+	char       *buf;
+	char       *expected;
+	size_t      expected_len;
+	size_t      len;
+	int         mapped;
+
+	TEST_FUNCTION ("conf_file_map");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	sprintf (filename, "%s/foo.conf", dirname);
+	f = fopen (filename, "w");
+	TEST_NE_P (f, NULL);
+	fprintf (f, "%s", contents);
+	TEST_EQ (fclose (f), 0);
+
+
+	/* Check that in system mode a file is always read into memory. */
+	TEST_FEATURE ("with system init");
+	user_mode = FALSE;
+
+	buf = conf_file_map (NULL, filename, &len, &mapped);
+	TEST_NE_P (buf, NULL);
+	TEST_FALSE (mapped);
+	TEST_EQ (len, strlen (contents));
+	TEST_EQ_MEM (buf, contents, len);
+
+	conf_file_unmap (buf, len, mapped);
+
+
+	/* Check that a session init reads a file that it owns into memory,
+	 * since its editors may truncate it while parsed.
+	 */
+	TEST_FEATURE ("with session init and own file");
+	user_mode = TRUE;
+
+	buf = conf_file_map (NULL, filename, &len, &mapped);
+	TEST_NE_P (buf, NULL);
+	TEST_FALSE (mapped);
+	TEST_EQ (len, strlen (contents));
+	TEST_EQ_MEM (buf, contents, len);
+
+	conf_file_unmap (buf, len, mapped);
+
+
+	/* Check that a session init maps a file owned by another user,
+	 * with the same contents as reading it would give.  Without root
+	 * we cannot give a file away, so use one of the system's instead.
+	 */
+	TEST_FEATURE ("with session init and shared file");
+	if (geteuid () == 0) {
+		TEST_EQ (chown (filename, 1, 1), 0);
+		path = filename;
+	} else {
+		path = "/etc/passwd";
+	}
+
+	if ((stat (path, &statbuf) == 0)
+	    && (statbuf.st_uid != getuid ())
+	    && (statbuf.st_size > 0)) {
+		expected = nih_file_read (NULL, path, &expected_len);
+		TEST_NE_P (expected, NULL);
+
+		buf = conf_file_map (NULL, path, &len, &mapped);
+		TEST_NE_P (buf, NULL);
+		TEST_TRUE (mapped);
+		TEST_EQ (len, expected_len);
+		TEST_EQ_MEM (buf, expected, len);
+
+		conf_file_unmap (buf, len, mapped);
+		nih_free (expected);
+	} else {
+		printf ("INFO: skipping %s shared file test as no file "
+			"owned by another user\n", __func__);
+		fflush (NULL);
+	}
+
+
+	/* Check that a job is parsed from a mapped file, which unlike a
+	 * file read into memory is not terminated.
+	 */
+	if (geteuid () == 0) {
+		TEST_FUNCTION ("conf_reload_path");
+		TEST_FEATURE ("with session init and shared file");
+		job_class_init ();
+
+		source = conf_source_new (NULL, dirname, CONF_JOB_DIR);
+		TEST_NE_P (source, NULL);
+		TEST_EQ (conf_source_reload (source), 0);
+
+		class = (JobClass *)nih_hash_lookup (job_classes, "foo");
+		TEST_NE_P (class, NULL);
+		TEST_NE_P (class->process[PROCESS_MAIN], NULL);
+		TEST_EQ_STR (class->process[PROCESS_MAIN]->command,
+			     "/bin/true");
+
+		nih_free (source);
+	}
+
+
+	/* Check that an empty file is read, there being nothing to map. */
+	TEST_FUNCTION ("conf_file_map");
+	TEST_FEATURE ("with session init and empty file");
+	f = fopen (filename, "w");
+	TEST_NE_P (f, NULL);
+	TEST_EQ (fclose (f), 0);
+
+	buf = conf_file_map (NULL, filename, &len, &mapped);
+	TEST_NE_P (buf, NULL);
+	TEST_FALSE (mapped);
+	TEST_EQ (len, 0);
+
+	conf_file_unmap (buf, len, mapped);
+
+	user_mode = FALSE;
+
+	TEST_EQ (unlink (filename), 0);
+	TEST_EQ (rmdir (dirname), 0);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -219,6 +351,7 @@ main (int   argc,
 	test_toggle_conf_name ();
 	test_conf_to_job_name ();
 	test_conf_get_best_override ();
+	test_conf_file_map ();
 
 	return 0;
 }
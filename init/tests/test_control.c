@@ -57,9 +57,11 @@
 #include "blocked.h"
 #include "job_class.h"
 #include "job.h"
+#include "event_operator.h"
 #include "conf.h"
 #include "control.h"
 #include "errors.h"
+#include "mem.h"
 
 #include "test_util_common.h"
 
@@ -331,6 +333,112 @@ test_server_connect (void)
 
 	nih_free (entry);
 
+
+	/* Check that with lazy objects, the instances are not registered
+	 * with the new connection but the first message sent to the path
+	 * of one registers it and is answered by it.
+	 */
+	TEST_FEATURE ("with lazy instance objects");
+	control_lazy_objects = TRUE;
+
+	TEST_CHILD_WAIT (pid, wait_fd) {
+		DBusConnection *conn;
+		DBusMessage    *method;
+		DBusMessage    *reply;
+		DBusMessageIter iter;
+		DBusMessageIter variter;
+		const char     *interface = DBUS_INTERFACE_UPSTART_INSTANCE;
+		const char     *property = "name";
+		const char     *value;
+
+		control_server_close ();
+
+		nih_signal_set_handler (SIGTERM, nih_signal_handler);
+		assert (nih_signal_add_handler (NULL, SIGTERM,
+						nih_main_term_signal, NULL));
+
+		conn = nih_dbus_connect ("unix:abstract=/com/ubuntu/upstart/test", NULL);
+		assert (conn != NULL);
+
+		TEST_CHILD_RELEASE (wait_fd);
+
+		method = dbus_message_new_method_call (
+			NULL,
+			DBUS_PATH_UPSTART "/jobs/bar/test1",
+			DBUS_INTERFACE_PROPERTIES,
+			"Get");
+		assert (dbus_message_append_args (method,
+						  DBUS_TYPE_STRING, &interface,
+						  DBUS_TYPE_STRING, &property,
+						  DBUS_TYPE_INVALID));
+
+		reply = dbus_connection_send_with_reply_and_block (conn, method,
+								   -1, NULL);
+		assert (reply != NULL);
+		assert (dbus_message_get_type (reply)
+			== DBUS_MESSAGE_TYPE_METHOD_RETURN);
+
+		dbus_message_iter_init (reply, &iter);
+		assert (dbus_message_iter_get_arg_type (&iter)
+			== DBUS_TYPE_VARIANT);
+		dbus_message_iter_recurse (&iter, &variter);
+		dbus_message_iter_get_basic (&variter, &value);
+		assert (! strcmp (value, "test1"));
+
+		dbus_message_unref (reply);
+		dbus_message_unref (method);
+
+		nih_main_loop ();
+
+		dbus_connection_unref (conn);
+
+		dbus_shutdown ();
+
+		exit (0);
+	}
+
+	assert (nih_timer_add_timeout (NULL, 1,
+				       (NihTimerCb)nih_main_term_signal, NULL));
+
+	nih_main_loop ();
+
+	TEST_LIST_NOT_EMPTY (control_conns);
+	entry = (NihListEntry *)control_conns->next;
+
+	conn = entry->data;
+
+	TEST_TRUE (dbus_connection_get_object_path_data (conn,
+							 DBUS_PATH_UPSTART "/jobs/bar",
+							 (void **)&object));
+
+	TEST_ALLOC_SIZE (object, sizeof (NihDBusObject));
+	TEST_EQ_P (object->data, class2);
+
+	TEST_TRUE (dbus_connection_get_object_path_data (conn,
+							 DBUS_PATH_UPSTART "/jobs/bar/test1",
+							 (void **)&object));
+
+	TEST_ALLOC_SIZE (object, sizeof (NihDBusObject));
+	TEST_EQ_STR (object->path, DBUS_PATH_UPSTART "/jobs/bar/test1");
+	TEST_EQ_P (object->data, job1);
+
+	TEST_TRUE (dbus_connection_get_object_path_data (conn,
+							 DBUS_PATH_UPSTART "/jobs/bar/test2",
+							 (void **)&object));
+	TEST_EQ_P (object, NULL);
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+	dbus_connection_close (conn);
+	dbus_connection_unref (conn);
+
+	nih_free (entry);
+
+	control_lazy_objects = FALSE;
+
 	nih_free (class1);
 	nih_free (class2);
 
@@ -890,6 +998,214 @@ test_disconnected (void)
 }
 
 
+void
+test_get_origin_uid (void)
+{
+	FILE              *output;
+	DBusConnection    *client_conn;
+	DBusConnection    *other_conn;
+	DBusMessage       *method;
+	NihDBusMessage    *message;
+	ControlCredential *credential;
+	ControlCredential *fake = NULL;
+	nih_local char    *name = NULL;
+	pid_t              dbus_pid;
+	uid_t              uid;
+	int                ret;
+	int                i;
+
+	TEST_FUNCTION ("control_get_origin_uid");
+	program_name = "test";
+	output = tmpfile ();
+	control_init ();
+
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (client_conn);
+	TEST_DBUS_OPEN (other_conn);
+
+	assert0 (control_bus_open ());
+	assert (control_bus != NULL);
+
+	TEST_HASH_EMPTY (control_credentials);
+	TEST_EQ (control_credentials_len, 0);
+
+	name = NIH_MUST (nih_strdup (NULL,
+				     dbus_bus_get_unique_name (client_conn)));
+
+	method = dbus_message_new_method_call (DBUS_SERVICE_UPSTART,
+					       DBUS_PATH_UPSTART,
+					       DBUS_INTERFACE_UPSTART,
+					       "ReloadConfiguration");
+	assert (method != NULL);
+	assert (dbus_message_set_sender (method, name));
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = control_bus;
+	message->message = method;
+
+
+	/* Check that the user of a client on the bus is requested from
+	 * the bus the first time, and kept for the connection.
+	 */
+	TEST_FEATURE ("with client not yet seen");
+	uid = (uid_t)-1;
+	ret = control_get_origin_uid (message, &uid);
+
+	TEST_TRUE (ret);
+	TEST_EQ (uid, getuid ());
+
+	credential = (ControlCredential *)nih_hash_lookup (control_credentials,
+							  name);
+	TEST_NE_P (credential, NULL);
+	TEST_EQ_P (credential->conn, control_bus);
+	TEST_EQ (credential->uid, getuid ());
+	TEST_EQ (control_credentials_len, 1);
+
+
+	/* Check that the kept user is returned for a later call from the
+	 * same client, without asking the bus again; we change the kept
+	 * user to tell the two apart.
+	 */
+	TEST_FEATURE ("with client already seen");
+	credential->uid = getuid () + 1;
+
+	uid = (uid_t)-1;
+	ret = control_get_origin_uid (message, &uid);
+
+	TEST_TRUE (ret);
+	TEST_EQ (uid, getuid () + 1);
+	TEST_EQ_P (nih_hash_lookup (control_credentials, name), credential);
+	TEST_EQ (control_credentials_len, 1);
+
+
+	/* Check that the user kept for a unique name on one connection is
+	 * not returned for the same name on another connection, where it
+	 * may be a different client, but that the bus is asked instead
+	 * and the kept user replaced.
+	 */
+	TEST_FEATURE ("with same name on other connection");
+	TEST_FREE_TAG (credential);
+
+	message->connection = other_conn;
+
+	uid = (uid_t)-1;
+	ret = control_get_origin_uid (message, &uid);
+
+	TEST_TRUE (ret);
+	TEST_EQ (uid, getuid ());
+
+	TEST_FREE (credential);
+
+	credential = (ControlCredential *)nih_hash_lookup (control_credentials,
+							  name);
+	TEST_NE_P (credential, NULL);
+	TEST_EQ_P (credential->conn, other_conn);
+	TEST_EQ (credential->uid, getuid ());
+	TEST_EQ (control_credentials_len, 1);
+
+	message->connection = control_bus;
+
+	nih_free (credential);
+	control_credentials_len--;
+
+
+	/* Check that once CONTROL_CREDENTIALS_MAX users are kept, they are
+	 * all forgotten before the next is kept.
+	 */
+	TEST_FEATURE ("with too many clients");
+	for (i = 0; i < CONTROL_CREDENTIALS_MAX; i++) {
+		fake = nih_new (control_credentials, ControlCredential);
+		nih_list_init (&fake->entry);
+		nih_alloc_set_destructor (fake, nih_list_destroy);
+
+		fake->conn = control_bus;
+		fake->uid = 0;
+		fake->name = nih_sprintf (fake, ":fake.%d", i);
+
+		nih_hash_add (control_credentials, &fake->entry);
+		control_credentials_len++;
+	}
+
+	TEST_FREE_TAG (fake);
+
+	uid = (uid_t)-1;
+	ret = control_get_origin_uid (message, &uid);
+
+	TEST_TRUE (ret);
+	TEST_EQ (uid, getuid ());
+
+	TEST_FREE (fake);
+	TEST_EQ_P (nih_hash_lookup (control_credentials, ":fake.0"), NULL);
+
+	credential = (ControlCredential *)nih_hash_lookup (control_credentials,
+							  name);
+	TEST_NE_P (credential, NULL);
+	TEST_EQ_P (credential->conn, control_bus);
+	TEST_EQ (control_credentials_len, 1);
+
+
+	/* Check that the user of a client is forgotten once the bus says
+	 * with NameOwnerChanged that the client has no new owner.
+	 */
+	TEST_FEATURE ("with client leaving the bus");
+	TEST_FREE_TAG (credential);
+
+	TEST_DBUS_CLOSE (client_conn);
+
+	while (nih_hash_lookup (control_credentials, name)
+	       && dbus_connection_read_write_dispatch (control_bus, -1))
+		;
+
+	TEST_FREE (credential);
+	TEST_HASH_EMPTY (control_credentials);
+	TEST_EQ (control_credentials_len, 0);
+
+
+	/* Check that the users of clients on the bus are forgotten when
+	 * the connection to the bus is lost.
+	 */
+	TEST_FEATURE ("with connection dropped");
+	nih_discard (name);
+	name = NIH_MUST (nih_strdup (NULL,
+				     dbus_bus_get_unique_name (other_conn)));
+	assert (dbus_message_set_sender (method, name));
+
+	uid = (uid_t)-1;
+	ret = control_get_origin_uid (message, &uid);
+
+	TEST_TRUE (ret);
+	TEST_EQ (uid, getuid ());
+
+	credential = (ControlCredential *)nih_hash_lookup (control_credentials,
+							  name);
+	TEST_NE_P (credential, NULL);
+	TEST_FREE_TAG (credential);
+
+	TEST_DIVERT_STDERR (output) {
+		control_bus_close ();
+	}
+	rewind (output);
+
+	TEST_FREE (credential);
+	TEST_HASH_EMPTY (control_credentials);
+	TEST_EQ (control_credentials_len, 0);
+
+	TEST_FILE_EQ (output, "test: Disconnected from D-Bus system bus\n");
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+	TEST_DBUS_CLOSE (other_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	fclose (output);
+
+	dbus_shutdown ();
+}
+
+
 void
 test_reload_configuration (void)
 {
@@ -1201,61 +1517,48 @@ test_get_all_jobs (void)
 }
 
 void
-test_emit_event (void)
+test_get_all_job_status (void)
 {
-	DBusConnection  *conn, *client_conn;
-	pid_t            dbus_pid;
-	DBusMessage     *method, *reply;
-	NihDBusMessage  *message = NULL;
-	dbus_uint32_t    serial;
-	char           **env;
-	int              ret;
-	Event           *event;
-	Blocked *        blocked;
-	NihError        *error;
-	NihDBusError    *dbus_error;
-
-	TEST_FUNCTION ("control_emit_event");
+	NihDBusMessage                     *message = NULL;
+	JobClass                           *class1, *class2;
+	Job                                *job;
+	NihError                           *error;
+	ControlGetAllJobStatusJobsElement **jobs;
+	int                                 ret;
+
+	TEST_FUNCTION ("control_get_all_job_status");
 	nih_error_init ();
-	nih_main_loop_init ();
-	event_init ();
-
-	TEST_DBUS (dbus_pid);
-	TEST_DBUS_OPEN (conn);
-	TEST_DBUS_OPEN (client_conn);
+	job_class_init ();
 
 
-	/* Check that we can emit an event with an empty environment list
-	 * which will be added to the event queue while the message is
-	 * blocked.  When the event is finished, the reply will be sent
-	 * and the message structure freed.
+	/* Check that an element is returned for each instance of each job,
+	 * giving the goal, state and processes, and that a job without
+	 * instances is returned once as stopped.
 	 */
-	TEST_FEATURE ("with empty environment list");
-	TEST_ALLOC_FAIL {
-		method = dbus_message_new_method_call (
-			dbus_bus_get_unique_name (conn),
-			DBUS_PATH_UPSTART,
-			DBUS_INTERFACE_UPSTART,
-			"EmitEvent");
+	TEST_FEATURE ("with registered jobs");
+	class1 = job_class_new (NULL, "frodo", NULL);
+	nih_hash_add (job_classes, &class1->entry);
 
-		dbus_connection_send (client_conn, method, &serial);
-		dbus_connection_flush (client_conn);
-		dbus_message_unref (method);
+	class2 = job_class_new (NULL, "bilbo", NULL);
+	nih_hash_add (job_classes, &class2->entry);
 
-		TEST_DBUS_MESSAGE (conn, method);
-		assert (dbus_message_get_serial (method) == serial);
+	job = job_new (class2, "foo");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+	job->pid[PROCESS_MAIN] = 1000;
+	job->pid[PROCESS_POST_START] = 1001;
+
+	TEST_ALLOC_FAIL {
+		ControlGetAllJobStatusJobsElement *stopped = NULL;
+		ControlGetAllJobStatusJobsElement *running = NULL;
 
 		TEST_ALLOC_SAFE {
 			message = nih_new (NULL, NihDBusMessage);
-			message->connection = conn;
-			message->message = method;
-
-			TEST_FREE_TAG (message);
-
-			env = nih_str_array_new (message);
+			message->connection = NULL;
+			message->message = NULL;
 		}
 
-		ret = control_emit_event (NULL, message, "test", env, TRUE);
+		ret = control_get_all_job_status (NULL, message, &jobs);
 
 		if (test_alloc_failed) {
 			TEST_LT (ret, 0);
@@ -1265,51 +1568,297 @@ test_emit_event (void)
 			nih_free (error);
 
 			nih_free (message);
-			dbus_message_unref (method);
+
 			continue;
 		}
 
 		TEST_EQ (ret, 0);
 
-		TEST_LIST_NOT_EMPTY (events);
+		TEST_ALLOC_PARENT (jobs, message);
+		TEST_NE_P (jobs[0], NULL);
+		TEST_NE_P (jobs[1], NULL);
+		TEST_EQ_P (jobs[2], NULL);
 
-		event = (Event *)events->next;
-		TEST_ALLOC_SIZE (event, sizeof (Event));
-		TEST_EQ_STR (event->name, "test");
-		TEST_EQ_P (event->env[0], NULL);
+		for (int i = 0; i < 2; i++) {
+			if (! strcmp (jobs[i]->item0, "frodo"))
+				stopped = jobs[i];
+			if (! strcmp (jobs[i]->item0, "bilbo"))
+				running = jobs[i];
+		}
 
-		TEST_LIST_NOT_EMPTY (&event->blocking);
+		TEST_NE_P (stopped, NULL);
+		TEST_EQ_STR (stopped->item1, "");
+		TEST_EQ_STR (stopped->item2, "stop");
+		TEST_EQ_STR (stopped->item3, "waiting");
+		TEST_EQ_P (stopped->item4[0], NULL);
+
+		TEST_NE_P (running, NULL);
+		TEST_EQ_STR (running->item1, "foo");
+		TEST_EQ_STR (running->item2, "start");
+		TEST_EQ_STR (running->item3, "running");
+		TEST_NE_P (running->item4[0], NULL);
+		TEST_EQ_STR (running->item4[0]->item0, "main");
+		TEST_EQ (running->item4[0]->item1, 1000);
+		TEST_NE_P (running->item4[1], NULL);
+		TEST_EQ_STR (running->item4[1]->item0, "post-start");
+		TEST_EQ (running->item4[1]->item1, 1001);
+		TEST_EQ_P (running->item4[2], NULL);
 
-		blocked = (Blocked *)event->blocking.next;
-		TEST_ALLOC_SIZE (blocked, sizeof (Blocked));
-		TEST_ALLOC_PARENT (blocked, event);
-		TEST_EQ (blocked->type, BLOCKED_EMIT_METHOD);
-		TEST_EQ_P (blocked->message, message);
+		nih_free (message);
+	}
 
-		TEST_ALLOC_PARENT (blocked->message, blocked);
+	nih_free (class2);
+	nih_free (class1);
 
-		TEST_FREE_TAG (blocked);
 
-		nih_discard (message);
-		TEST_NOT_FREE (message);
+	/* Check that when no jobs are registered, an empty array is
+	 * returned instead of an error.
+	 */
+	TEST_FEATURE ("with no registered jobs");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
 
+		ret = control_get_all_job_status (NULL, message, &jobs);
 
-		event_poll ();
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
 
-		TEST_LIST_EMPTY (events);
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
 
-		TEST_FREE (blocked);
+			nih_free (message);
 
-		TEST_FREE (message);
-		dbus_message_unref (method);
+			continue;
+		}
 
-		dbus_connection_flush (conn);
+		TEST_EQ (ret, 0);
 
-		TEST_DBUS_MESSAGE (client_conn, reply);
+		TEST_ALLOC_PARENT (jobs, message);
+		TEST_EQ_P (jobs[0], NULL);
 
-		TEST_EQ (dbus_message_get_type (reply),
-			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
-		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+		nih_free (message);
+	}
+}
+
+void
+test_changes (void)
+{
+	NihDBusMessage                   *message = NULL;
+	ControlGetChangesChangesElement **changes;
+	NihError                         *error;
+	NihDBusError                     *dbus_error;
+	uint64_t                          base, seq;
+	int                               ret;
+
+	TEST_FUNCTION ("control_get_changes");
+	nih_error_init ();
+	control_init ();
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
+
+	ret = control_get_changes (NULL, message, 0, &base, &changes);
+	TEST_EQ (ret, 0);
+
+	control_changes_flush ();
+
+
+	/* Check that changes recorded since a sequence number are returned
+	 * in order, and that a later status of an instance replaces one
+	 * that has not yet been sent.
+	 */
+	TEST_FEATURE ("with unsent changes");
+	control_change (CONTROL_CHANGE_STATUS, DBUS_PATH_UPSTART "/jobs/test/_",
+			"start", "starting");
+	control_change (CONTROL_CHANGE_STATUS, DBUS_PATH_UPSTART "/jobs/test/_",
+			"start", "running");
+	control_change (CONTROL_CHANGE_JOB_ADDED, DBUS_PATH_UPSTART "/jobs/foo",
+			NULL, NULL);
+
+	ret = control_get_changes (NULL, message, base, &seq, &changes);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (seq, base + 3);
+
+	TEST_ALLOC_PARENT (changes, message);
+	TEST_NE_P (changes[0], NULL);
+	TEST_EQ (changes[0]->item0, base + 2);
+	TEST_EQ_STR (changes[0]->item1, "status");
+	TEST_EQ_STR (changes[0]->item2, DBUS_PATH_UPSTART "/jobs/test/_");
+	TEST_EQ_STR (changes[0]->item3, "start/running");
+	TEST_NE_P (changes[1], NULL);
+	TEST_EQ (changes[1]->item0, base + 3);
+	TEST_EQ_STR (changes[1]->item1, "job-added");
+	TEST_EQ_STR (changes[1]->item2, DBUS_PATH_UPSTART "/jobs/foo");
+	TEST_EQ_STR (changes[1]->item3, "");
+	TEST_EQ_P (changes[2], NULL);
+
+	nih_free (changes);
+
+
+	/* Check that a status change is no longer replaced once the
+	 * earlier one has been sent.
+	 */
+	TEST_FEATURE ("with sent changes");
+	control_changes_flush ();
+
+	control_change (CONTROL_CHANGE_STATUS, DBUS_PATH_UPSTART "/jobs/test/_",
+			"stop", "stopping");
+
+	ret = control_get_changes (NULL, message, base, &seq, &changes);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (seq, base + 4);
+
+	TEST_NE_P (changes[0], NULL);
+	TEST_EQ_STR (changes[0]->item3, "start/running");
+	TEST_NE_P (changes[1], NULL);
+	TEST_NE_P (changes[2], NULL);
+	TEST_EQ (changes[2]->item0, base + 4);
+	TEST_EQ_STR (changes[2]->item3, "stop/stopping");
+	TEST_EQ_P (changes[3], NULL);
+
+	nih_free (changes);
+
+
+	/* Check that asking for changes since a sequence number that has
+	 * not been reached raises the ChangesLost error.
+	 */
+	TEST_FEATURE ("with unknown sequence number");
+	ret = control_get_changes (NULL, message, seq + 100, &seq, &changes);
+
+	TEST_LT (ret, 0);
+
+	error = nih_error_get ();
+	TEST_EQ (error->number, NIH_DBUS_ERROR);
+	TEST_ALLOC_SIZE (error, sizeof (NihDBusError));
+
+	dbus_error = (NihDBusError *)error;
+	TEST_EQ_STR (dbus_error->name, DBUS_INTERFACE_UPSTART ".Error.ChangesLost");
+
+	nih_free (dbus_error);
+
+	control_changes_flush ();
+
+	nih_free (message);
+}
+
+void
+test_emit_event (void)
+{
+	DBusConnection  *conn, *client_conn;
+	pid_t            dbus_pid;
+	DBusMessage     *method, *reply;
+	NihDBusMessage  *message = NULL;
+	dbus_uint32_t    serial;
+	char           **env;
+	int              ret;
+	Event           *event;
+	Blocked *        blocked;
+	NihError        *error;
+	NihDBusError    *dbus_error;
+
+	TEST_FUNCTION ("control_emit_event");
+	nih_error_init ();
+	nih_main_loop_init ();
+	event_init ();
+
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (conn);
+	TEST_DBUS_OPEN (client_conn);
+
+
+	/* Check that we can emit an event with an empty environment list
+	 * which will be added to the event queue while the message is
+	 * blocked.  When the event is finished, the reply will be sent
+	 * and the message structure freed.
+	 */
+	TEST_FEATURE ("with empty environment list");
+	TEST_ALLOC_FAIL {
+		method = dbus_message_new_method_call (
+			dbus_bus_get_unique_name (conn),
+			DBUS_PATH_UPSTART,
+			DBUS_INTERFACE_UPSTART,
+			"EmitEvent");
+
+		dbus_connection_send (client_conn, method, &serial);
+		dbus_connection_flush (client_conn);
+		dbus_message_unref (method);
+
+		TEST_DBUS_MESSAGE (conn, method);
+		assert (dbus_message_get_serial (method) == serial);
+
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = conn;
+			message->message = method;
+
+			TEST_FREE_TAG (message);
+
+			env = nih_str_array_new (message);
+		}
+
+		ret = control_emit_event (NULL, message, "test", env, TRUE);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+
+			nih_free (message);
+			dbus_message_unref (method);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_LIST_NOT_EMPTY (events);
+
+		event = (Event *)events->next;
+		TEST_ALLOC_SIZE (event, sizeof (Event));
+		TEST_EQ_STR (event->name, "test");
+		TEST_EQ_P (event->env[0], NULL);
+
+		TEST_LIST_NOT_EMPTY (&event->blocking);
+
+		blocked = (Blocked *)event->blocking.next;
+		TEST_ALLOC_SIZE (blocked, sizeof (Blocked));
+		TEST_ALLOC_PARENT (blocked, event);
+		TEST_EQ (blocked->type, BLOCKED_EMIT_METHOD);
+		TEST_EQ_P (blocked->message, message);
+
+		TEST_ALLOC_PARENT (blocked->message, blocked);
+
+		TEST_FREE_TAG (blocked);
+
+		nih_discard (message);
+		TEST_NOT_FREE (message);
+
+
+		event_poll ();
+
+		TEST_LIST_EMPTY (events);
+
+		TEST_FREE (blocked);
+
+		TEST_FREE (message);
+		dbus_message_unref (method);
+
+		dbus_connection_flush (conn);
+
+		TEST_DBUS_MESSAGE (client_conn, reply);
+
+		TEST_EQ (dbus_message_get_type (reply),
+			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
+		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
 
 		dbus_message_unref (reply);
 	}
@@ -1390,54 +1939,728 @@ test_emit_event (void)
 
 		event_poll ();
 
-		TEST_LIST_EMPTY (events);
+		TEST_LIST_EMPTY (events);
+
+		TEST_FREE (blocked);
+
+		TEST_FREE (message);
+		dbus_message_unref (method);
+
+		dbus_connection_flush (conn);
+
+		TEST_DBUS_MESSAGE (client_conn, reply);
+
+		TEST_EQ (dbus_message_get_type (reply),
+			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
+		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+
+		dbus_message_unref (reply);
+	}
+
+
+	/* Check that we can emit an event without waiting for it to
+	 * finish, we should get the reply straight away.
+	 */
+	TEST_FEATURE ("with no wait");
+	TEST_ALLOC_FAIL {
+		method = dbus_message_new_method_call (
+			dbus_bus_get_unique_name (conn),
+			DBUS_PATH_UPSTART,
+			DBUS_INTERFACE_UPSTART,
+			"EmitEvent");
+
+		dbus_connection_send (client_conn, method, &serial);
+		dbus_connection_flush (client_conn);
+		dbus_message_unref (method);
+
+		TEST_DBUS_MESSAGE (conn, method);
+		assert (dbus_message_get_serial (method) == serial);
+
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = conn;
+			message->message = method;
+
+			TEST_FREE_TAG (message);
+
+			env = nih_str_array_new (message);
+		}
+
+		ret = control_emit_event (NULL, message, "test", env, FALSE);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+
+			nih_free (message);
+			dbus_message_unref (method);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_LIST_NOT_EMPTY (events);
+
+		event = (Event *)events->next;
+		TEST_ALLOC_SIZE (event, sizeof (Event));
+		TEST_EQ_STR (event->name, "test");
+		TEST_EQ_P (event->env[0], NULL);
+
+		TEST_LIST_EMPTY (&event->blocking);
+
+		nih_discard (message);
+		TEST_FREE (message);
+		dbus_message_unref (method);
+
+		dbus_connection_flush (conn);
+
+		TEST_DBUS_MESSAGE (client_conn, reply);
+
+		TEST_EQ (dbus_message_get_type (reply),
+			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
+		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+
+		dbus_message_unref (reply);
+
+
+		event_poll ();
+
+		TEST_LIST_EMPTY (events);
+	}
+
+
+	/* Check that if the event is marked as failed, an ordinary reply
+	 * is not sent when its finished, but an error instead.
+	 */
+	TEST_FEATURE ("with failed event");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvent");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	TEST_FREE_TAG (message);
+
+	env = nih_str_array_new (NULL);
+
+	ret = control_emit_event (NULL, message, "test", env, TRUE);
+	nih_discard (env);
+
+	TEST_EQ (ret, 0);
+
+	TEST_LIST_NOT_EMPTY (events);
+
+	event = (Event *)events->next;
+	TEST_ALLOC_SIZE (event, sizeof (Event));
+	TEST_EQ_STR (event->name, "test");
+	TEST_EQ_P (event->env[0], NULL);
+
+	nih_discard (message);
+	TEST_NOT_FREE (message);
+
+
+	event->failed = TRUE;
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+	TEST_FREE (message);
+	dbus_message_unref (method);
+
+	dbus_connection_flush (conn);
+
+	TEST_DBUS_MESSAGE (client_conn, reply);
+
+	TEST_TRUE (dbus_message_is_error (reply,
+					  DBUS_INTERFACE_UPSTART ".Error.EventFailed"));
+	TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+
+	dbus_message_unref (reply);
+
+
+	/* Check that if the event name is empty, an error is returned
+	 * immediately.
+	 */
+	TEST_FEATURE ("with empty name");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvent");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+
+	ret = control_emit_event (NULL, message, "", env, TRUE);
+
+	TEST_LT (ret, 0);
+
+	dbus_error = (NihDBusError *)nih_error_get ();
+	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
+	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
+	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
+	nih_free (dbus_error);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+
+	/* Check that if an entry in the environment list is missing an
+	 * equals, an error is returned immediately.
+	 */
+	TEST_FEATURE ("with missing equals in environment list");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvent");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+	assert (nih_str_array_add (&env, message, NULL, "FOO_BAR"));
+
+	ret = control_emit_event (NULL, message, "test", env, TRUE);
+
+	TEST_LT (ret, 0);
+
+	dbus_error = (NihDBusError *)nih_error_get ();
+	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
+	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
+	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
+	nih_free (dbus_error);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+
+	TEST_DBUS_CLOSE (conn);
+	TEST_DBUS_CLOSE (client_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+
+void
+test_emit_event_with_files (void)
+{
+	DBusConnection  *conn, *client_conn;
+	pid_t            dbus_pid;
+	DBusMessage     *method, *reply;
+	NihDBusMessage  *message = NULL;
+	dbus_uint32_t    serial;
+	char           **env;
+	int              files[2];
+	int              fds[2];
+	int              ret;
+	Event           *event;
+
+	TEST_FUNCTION ("control_emit_event_with_files");
+	nih_error_init ();
+	nih_main_loop_init ();
+	event_init ();
+
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (conn);
+	TEST_DBUS_OPEN (client_conn);
+
+
+	/* Check that an event emitted with several files holds the first
+	 * as its file descriptor and the rest in its further ones, with
+	 * close-on-exec cleared so that jobs inherit them, and that all
+	 * are closed when the event finishes.
+	 */
+	TEST_FEATURE ("with several files");
+	assert0 (pipe (fds));
+	files[0] = fds[0];
+	files[1] = fds[1];
+	fcntl (files[1], F_SETFD, FD_CLOEXEC);
+
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEventWithFiles");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+
+	ret = control_emit_event_with_files (NULL, message, "test", env, TRUE,
+					     files, 2);
+
+	TEST_EQ (ret, 0);
+
+	TEST_LIST_NOT_EMPTY (events);
+
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, "test");
+	TEST_EQ (event->fd, files[0]);
+	TEST_EQ (event->num_fds, 1);
+	TEST_ALLOC_PARENT (event->fds, event);
+	TEST_EQ (event->fds[0], files[1]);
+	TEST_EQ (fcntl (files[1], F_GETFD) & FD_CLOEXEC, 0);
+
+	nih_discard (message);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+	TEST_LT (fcntl (files[0], F_GETFD), 0);
+	TEST_LT (fcntl (files[1], F_GETFD), 0);
+
+	dbus_message_unref (method);
+
+	dbus_connection_flush (conn);
+
+	TEST_DBUS_MESSAGE (client_conn, reply);
+
+	TEST_EQ (dbus_message_get_type (reply),
+		 DBUS_MESSAGE_TYPE_METHOD_RETURN);
+	TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+
+	dbus_message_unref (reply);
+
+
+	TEST_DBUS_CLOSE (conn);
+	TEST_DBUS_CLOSE (client_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+void
+test_emit_events (void)
+{
+	DBusConnection                  *conn, *client_conn;
+	pid_t                            dbus_pid;
+	DBusMessage                     *method;
+	NihDBusMessage                  *message = NULL;
+	dbus_uint32_t                    serial;
+	ControlEmitEventsEventsElement **elements;
+	int                              ret;
+	Event                           *event;
+	NihDBusError                    *dbus_error;
+
+	TEST_FUNCTION ("control_emit_events");
+	nih_error_init ();
+	nih_main_loop_init ();
+	event_init ();
+
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (conn);
+	TEST_DBUS_OPEN (client_conn);
+
+
+	/* Check that an event is queued for each element, in order and
+	 * with its environment, without blocking the message.
+	 */
+	TEST_FEATURE ("with multiple events");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvents");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	elements = nih_alloc (message, sizeof (ControlEmitEventsEventsElement *) * 3);
+	elements[0] = nih_new (elements, ControlEmitEventsEventsElement);
+	elements[0]->item0 = "foo";
+	elements[0]->item1 = nih_str_array_new (elements[0]);
+	NIH_MUST (nih_str_array_add (&elements[0]->item1, elements[0], NULL, "KERNEL=sda"));
+	elements[1] = nih_new (elements, ControlEmitEventsEventsElement);
+	elements[1]->item0 = "bar";
+	elements[1]->item1 = nih_str_array_new (elements[1]);
+	elements[2] = NULL;
+
+	ret = control_emit_events (NULL, message, elements);
+
+	TEST_EQ (ret, 0);
+
+	TEST_LIST_NOT_EMPTY (events);
+
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, "foo");
+	TEST_EQ_STR (event->env[0], "KERNEL=sda");
+	TEST_EQ_P (event->env[1], NULL);
+	TEST_LIST_EMPTY (&event->blocking);
+
+	event = (Event *)event->entry.next;
+	TEST_NE_P (event, (Event *)events);
+	TEST_EQ_STR (event->name, "bar");
+	TEST_EQ_P (event->env[0], NULL);
+
+	TEST_EQ_P (event->entry.next, events);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that no event is queued when any one of them has an
+	 * invalid environment, and that an invalid arguments error is
+	 * returned instead.
+	 */
+	TEST_FEATURE ("with invalid environment");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEvents");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	elements = nih_alloc (message, sizeof (ControlEmitEventsEventsElement *) * 3);
+	elements[0] = nih_new (elements, ControlEmitEventsEventsElement);
+	elements[0]->item0 = "foo";
+	elements[0]->item1 = nih_str_array_new (elements[0]);
+	elements[1] = nih_new (elements, ControlEmitEventsEventsElement);
+	elements[1]->item0 = "bar";
+	elements[1]->item1 = nih_str_array_new (elements[1]);
+	NIH_MUST (nih_str_array_add (&elements[1]->item1, elements[1], NULL, "WIBBLE"));
+	elements[2] = NULL;
+
+	ret = control_emit_events (NULL, message, elements);
+
+	TEST_LT (ret, 0);
+
+	TEST_LIST_EMPTY (events);
+
+	dbus_error = (NihDBusError *)nih_error_get ();
+	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
+	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
+	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
+	nih_free (dbus_error);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+
+	TEST_DBUS_CLOSE (conn);
+	TEST_DBUS_CLOSE (client_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+void
+test_emit_event_async (void)
+{
+	DBusConnection *conn, *client_conn;
+	pid_t           dbus_pid;
+	DBusMessage    *method;
+	NihDBusMessage *message = NULL;
+	dbus_uint32_t   serial;
+	char          **env;
+	uint64_t        id1, id2;
+	uint32_t        pending;
+	int             ret;
+	Event          *event;
+	NihDBusError   *dbus_error;
+
+	TEST_FUNCTION ("control_emit_event_async");
+	nih_error_init ();
+	nih_main_loop_init ();
+	event_init ();
+
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (conn);
+	TEST_DBUS_OPEN (client_conn);
+
+
+	/* Check that each event is queued to be reported when it finishes,
+	 * that its identifier is returned and that the number of events
+	 * pending includes it.
+	 */
+	TEST_FEATURE ("with multiple events");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEventAsync");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+	NIH_MUST (nih_str_array_add (&env, message, NULL, "KERNEL=sda"));
+
+	ret = control_emit_event_async (NULL, message, "foo", env,
+					&id1, &pending);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (pending, 1);
+
+	ret = control_emit_event_async (NULL, message, "bar", env,
+					&id2, &pending);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (pending, 2);
+	TEST_GT (id2, id1);
+
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, "foo");
+	TEST_EQ (event->id, id1);
+	TEST_TRUE (event->report);
+	TEST_EQ_STR (event->env[0], "KERNEL=sda");
+	TEST_LIST_EMPTY (&event->blocking);
+
+	event = (Event *)event->entry.next;
+	TEST_EQ_STR (event->name, "bar");
+	TEST_EQ (event->id, id2);
+	TEST_TRUE (event->report);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that no event is queued when the environment is invalid,
+	 * and that an invalid arguments error is returned instead.
+	 */
+	TEST_FEATURE ("with invalid environment");
+	method = dbus_message_new_method_call (
+		dbus_bus_get_unique_name (conn),
+		DBUS_PATH_UPSTART,
+		DBUS_INTERFACE_UPSTART,
+		"EmitEventAsync");
+
+	dbus_connection_send (client_conn, method, &serial);
+	dbus_connection_flush (client_conn);
+	dbus_message_unref (method);
+
+	TEST_DBUS_MESSAGE (conn, method);
+	assert (dbus_message_get_serial (method) == serial);
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = conn;
+	message->message = method;
+
+	env = nih_str_array_new (message);
+	NIH_MUST (nih_str_array_add (&env, message, NULL, "WIBBLE"));
+
+	ret = control_emit_event_async (NULL, message, "foo", env,
+					&id1, &pending);
+
+	TEST_LT (ret, 0);
+
+	TEST_LIST_EMPTY (events);
+
+	dbus_error = (NihDBusError *)nih_error_get ();
+	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
+	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
+	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
+	nih_free (dbus_error);
+
+	nih_free (message);
+	dbus_message_unref (method);
+
+
+	TEST_DBUS_CLOSE (conn);
+	TEST_DBUS_CLOSE (client_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+void
+test_get_event_stats (void)
+{
+	NihDBusMessage *message = NULL;
+	uint64_t        emitted;
+	uint32_t        pending, handling, finished;
+	uint64_t       *latency, *poll, *examined;
+	size_t          latency_len, poll_len, examined_len;
+	Event          *event1, *event2;
+	NihError       *error;
+	int             ret;
+
+	/* Check that the function returns the number of events emitted,
+	 * the number queued by progress and a full histogram of each
+	 * kind, as newly allocated children of the message structure.
+	 */
+	TEST_FUNCTION ("control_get_event_stats");
+	nih_error_init ();
+	event_init ();
+
+	memset (&event_stats, 0, sizeof (event_stats));
+
+	event1 = event_new (NULL, "foo", NULL);
+	event2 = event_new (NULL, "bar", NULL);
+	event2->progress = EVENT_HANDLING;
+
+	event_stats_record (event_stats.latency, 0);
+	event_stats_record (event_stats.latency, 1);
+	event_stats_record (event_stats.latency, 3);
+	event_stats_record (event_stats.latency, UINT64_MAX);
+
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
+
+		ret = control_get_event_stats (NULL, message, &emitted,
+					       &pending, &handling, &finished,
+					       &latency, &latency_len,
+					       &poll, &poll_len,
+					       &examined, &examined_len);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+
+			nih_free (message);
+
+			continue;
+		}
 
-		TEST_FREE (blocked);
+		TEST_EQ (ret, 0);
 
-		TEST_FREE (message);
-		dbus_message_unref (method);
+		TEST_EQ (emitted, 2);
+		TEST_EQ (pending, 1);
+		TEST_EQ (handling, 1);
+		TEST_EQ (finished, 0);
 
-		dbus_connection_flush (conn);
+		TEST_ALLOC_PARENT (latency, message);
+		TEST_EQ (latency_len, EVENT_STATS_BUCKETS);
+		TEST_EQ (latency[0], 1);
+		TEST_EQ (latency[1], 1);
+		TEST_EQ (latency[2], 1);
+		TEST_EQ (latency[EVENT_STATS_BUCKETS - 1], 1);
 
-		TEST_DBUS_MESSAGE (client_conn, reply);
+		TEST_ALLOC_PARENT (poll, message);
+		TEST_EQ (poll_len, EVENT_STATS_BUCKETS);
 
-		TEST_EQ (dbus_message_get_type (reply),
-			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
-		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+		TEST_ALLOC_PARENT (examined, message);
+		TEST_EQ (examined_len, EVENT_STATS_BUCKETS);
 
-		dbus_message_unref (reply);
+		nih_free (message);
 	}
 
+	nih_free (event1);
+	nih_free (event2);
+}
 
-	/* Check that we can emit an event without waiting for it to
-	 * finish, we should get the reply straight away.
+void
+test_get_job_timeline (void)
+{
+	NihDBusMessage                       *message = NULL;
+	ControlGetJobTimelineRecordsElement **records;
+	JobClass                             *class;
+	Job                                  *job;
+	NihError                             *error;
+	size_t                                count;
+	int                                   ret;
+
+	/* Check that the function returns an array with an element for
+	 * each record in the timeline, giving the time, names, type and
+	 * the state entered or process spawned, as newly allocated
+	 * children of the message structure.
 	 */
-	TEST_FEATURE ("with no wait");
-	TEST_ALLOC_FAIL {
-		method = dbus_message_new_method_call (
-			dbus_bus_get_unique_name (conn),
-			DBUS_PATH_UPSTART,
-			DBUS_INTERFACE_UPSTART,
-			"EmitEvent");
+	TEST_FUNCTION ("control_get_job_timeline");
+	nih_error_init ();
+	job_class_init ();
 
-		dbus_connection_send (client_conn, method, &serial);
-		dbus_connection_flush (client_conn);
-		dbus_message_unref (method);
+	class = job_class_new (NULL, "foo", NULL);
+	job = job_new (class, "");
 
-		TEST_DBUS_MESSAGE (conn, method);
-		assert (dbus_message_get_serial (method) == serial);
+	job->state = JOB_STARTING;
+	job_timeline_add (job, JOB_TIMELINE_STATE, PROCESS_INVALID);
+	job_timeline_add (job, JOB_TIMELINE_SPAWN, PROCESS_PRE_START);
+
+	count = job_timeline_count ();
+	TEST_GE (count, 2);
 
+	TEST_ALLOC_FAIL {
 		TEST_ALLOC_SAFE {
 			message = nih_new (NULL, NihDBusMessage);
-			message->connection = conn;
-			message->message = method;
-
-			TEST_FREE_TAG (message);
-
-			env = nih_str_array_new (message);
+			message->connection = NULL;
+			message->message = NULL;
 		}
 
-		ret = control_emit_event (NULL, message, "test", env, FALSE);
+		ret = control_get_job_timeline (NULL, message, &records);
 
 		if (test_alloc_failed) {
 			TEST_LT (ret, 0);
@@ -1447,182 +2670,295 @@ test_emit_event (void)
 			nih_free (error);
 
 			nih_free (message);
-			dbus_message_unref (method);
+
 			continue;
 		}
 
 		TEST_EQ (ret, 0);
 
-		TEST_LIST_NOT_EMPTY (events);
-
-		event = (Event *)events->next;
-		TEST_ALLOC_SIZE (event, sizeof (Event));
-		TEST_EQ_STR (event->name, "test");
-		TEST_EQ_P (event->env[0], NULL);
+		TEST_ALLOC_PARENT (records, message);
+		TEST_EQ_P (records[count], NULL);
 
-		TEST_LIST_EMPTY (&event->blocking);
+		TEST_ALLOC_PARENT (records[count - 2], records);
+		TEST_GT (records[count - 2]->item0, 0);
+		TEST_EQ_STR (records[count - 2]->item1, "foo");
+		TEST_EQ_STR (records[count - 2]->item2, "");
+		TEST_EQ_STR (records[count - 2]->item3, "state");
+		TEST_EQ_STR (records[count - 2]->item4, "starting");
 
-		nih_discard (message);
-		TEST_FREE (message);
-		dbus_message_unref (method);
+		TEST_ALLOC_PARENT (records[count - 1], records);
+		TEST_GE (records[count - 1]->item0, records[count - 2]->item0);
+		TEST_EQ_STR (records[count - 1]->item1, "foo");
+		TEST_EQ_STR (records[count - 1]->item2, "");
+		TEST_EQ_STR (records[count - 1]->item3, "spawn");
+		TEST_EQ_STR (records[count - 1]->item4, "pre-start");
 
-		dbus_connection_flush (conn);
+		nih_free (message);
+	}
 
-		TEST_DBUS_MESSAGE (client_conn, reply);
+	nih_free (class);
+}
 
-		TEST_EQ (dbus_message_get_type (reply),
-			 DBUS_MESSAGE_TYPE_METHOD_RETURN);
-		TEST_EQ (dbus_message_get_reply_serial (reply), serial);
 
-		dbus_message_unref (reply);
+void
+test_get_dependency_graph (void)
+{
+	NihDBusMessage                               *message = NULL;
+	ControlGetDependencyGraphEmitsElement       **emits;
+	ControlGetDependencyGraphConsumesElement    **consumes;
+	ControlGetDependencyGraphUnreachableElement **unreachable;
+	JobClass                                     *foo, *bar, *qux;
+	EventOperator                                *oper, *and_oper, *or_oper;
+	NihError                                     *error;
+	char                                        **env;
+	char                                         *no_events[] = { NULL };
+	char                                         *ignored[] = { "frodo", "hello", NULL };
+	size_t                                        i;
+	int                                           ret;
+
+	TEST_FUNCTION ("control_get_dependency_graph");
+	nih_error_init ();
+	job_class_init ();
 
+	/* foo emits wibble and wob*, bar starts on
+	 * (starting foo and (hello or wobble)) and stops on
+	 * (stopped baz or wibble), and qux starts on frodo.
+	 */
+	foo = job_class_new (NULL, "foo", NULL);
+	foo->emits = nih_str_array_new (foo);
+	NIH_MUST (nih_str_array_add (&foo->emits, foo, NULL, "wibble"));
+	NIH_MUST (nih_str_array_add (&foo->emits, foo, NULL, "wob*"));
+	nih_hash_add (job_classes, &foo->entry);
 
-		event_poll ();
+	bar = job_class_new (NULL, "bar", NULL);
+	bar->start_on = and_oper = event_operator_new (bar, EVENT_AND,
+						       NULL, NULL);
 
-		TEST_LIST_EMPTY (events);
-	}
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "foo"));
+	oper = event_operator_new (bar->start_on, EVENT_MATCH,
+				   "starting", env);
+	nih_tree_add (&and_oper->node, &oper->node, NIH_TREE_LEFT);
 
+	or_oper = event_operator_new (bar->start_on, EVENT_OR, NULL, NULL);
+	nih_tree_add (&and_oper->node, &or_oper->node, NIH_TREE_RIGHT);
 
-	/* Check that if the event is marked as failed, an ordinary reply
-	 * is not sent when its finished, but an error instead.
-	 */
-	TEST_FEATURE ("with failed event");
-	method = dbus_message_new_method_call (
-		dbus_bus_get_unique_name (conn),
-		DBUS_PATH_UPSTART,
-		DBUS_INTERFACE_UPSTART,
-		"EmitEvent");
+	oper = event_operator_new (bar->start_on, EVENT_MATCH, "hello", NULL);
+	nih_tree_add (&or_oper->node, &oper->node, NIH_TREE_LEFT);
 
-	dbus_connection_send (client_conn, method, &serial);
-	dbus_connection_flush (client_conn);
-	dbus_message_unref (method);
+	oper = event_operator_new (bar->start_on, EVENT_MATCH, "wobble", NULL);
+	nih_tree_add (&or_oper->node, &oper->node, NIH_TREE_RIGHT);
 
-	TEST_DBUS_MESSAGE (conn, method);
-	assert (dbus_message_get_serial (method) == serial);
+	bar->stop_on = or_oper = event_operator_new (bar, EVENT_OR, NULL, NULL);
 
-	message = nih_new (NULL, NihDBusMessage);
-	message->connection = conn;
-	message->message = method;
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "JOB=baz"));
+	oper = event_operator_new (bar->stop_on, EVENT_MATCH,
+				   "stopped", env);
+	nih_tree_add (&or_oper->node, &oper->node, NIH_TREE_LEFT);
 
-	TEST_FREE_TAG (message);
+	oper = event_operator_new (bar->stop_on, EVENT_MATCH, "wibble", NULL);
+	nih_tree_add (&or_oper->node, &oper->node, NIH_TREE_RIGHT);
 
-	env = nih_str_array_new (NULL);
+	nih_hash_add (job_classes, &bar->entry);
 
-	ret = control_emit_event (NULL, message, "test", env, TRUE);
-	nih_discard (env);
+	qux = job_class_new (NULL, "qux", NULL);
+	qux->start_on = event_operator_new (qux, EVENT_MATCH, "frodo", NULL);
+	nih_hash_add (job_classes, &qux->entry);
 
-	TEST_EQ (ret, 0);
 
-	TEST_LIST_NOT_EMPTY (events);
+	/* Check that the events emitted and named by each job are
+	 * returned, and that only an unknown event named by a condition
+	 * that cannot otherwise be satisfied is unreachable; the arrays
+	 * are allocated as children of the message structure.
+	 */
+	TEST_FEATURE ("with registered jobs");
+	TEST_ALLOC_FAIL {
+		int found_wibble = FALSE, found_wob = FALSE;
+		int found_starting = FALSE, found_stopped = FALSE;
 
-	event = (Event *)events->next;
-	TEST_ALLOC_SIZE (event, sizeof (Event));
-	TEST_EQ_STR (event->name, "test");
-	TEST_EQ_P (event->env[0], NULL);
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
 
-	nih_discard (message);
-	TEST_NOT_FREE (message);
+		ret = control_get_dependency_graph (NULL, message, no_events,
+						    FALSE, &emits, &consumes,
+						    &unreachable);
 
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
 
-	event->failed = TRUE;
-	event_poll ();
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
 
-	TEST_LIST_EMPTY (events);
+			nih_free (message);
 
-	TEST_FREE (message);
-	dbus_message_unref (method);
+			continue;
+		}
 
-	dbus_connection_flush (conn);
+		TEST_EQ (ret, 0);
 
-	TEST_DBUS_MESSAGE (client_conn, reply);
+		TEST_ALLOC_PARENT (emits, message);
+		for (i = 0; emits[i]; i++) {
+			TEST_EQ_STR (emits[i]->item0, "foo");
 
-	TEST_TRUE (dbus_message_is_error (reply,
-					  DBUS_INTERFACE_UPSTART ".Error.EventFailed"));
-	TEST_EQ (dbus_message_get_reply_serial (reply), serial);
+			if (! strcmp (emits[i]->item1, "wibble"))
+				found_wibble = TRUE;
+			if (! strcmp (emits[i]->item1, "wob*"))
+				found_wob = TRUE;
+		}
+		TEST_EQ (i, 2);
+		TEST_TRUE (found_wibble);
+		TEST_TRUE (found_wob);
+
+		TEST_ALLOC_PARENT (consumes, message);
+		for (i = 0; consumes[i]; i++) {
+			if (! strcmp (consumes[i]->item2, "starting")) {
+				TEST_EQ_STR (consumes[i]->item0, "bar");
+				TEST_EQ_STR (consumes[i]->item1, "start on");
+				TEST_EQ_STR (consumes[i]->item3, "foo");
+				found_starting = TRUE;
+			} else if (! strcmp (consumes[i]->item2, "stopped")) {
+				TEST_EQ_STR (consumes[i]->item0, "bar");
+				TEST_EQ_STR (consumes[i]->item1, "stop on");
+				TEST_EQ_STR (consumes[i]->item3, "baz");
+				found_stopped = TRUE;
+			} else {
+				TEST_EQ_STR (consumes[i]->item3, "");
+			}
+		}
+		TEST_EQ (i, 6);
+		TEST_TRUE (found_starting);
+		TEST_TRUE (found_stopped);
+
+		TEST_ALLOC_PARENT (unreachable, message);
+		TEST_NE_P (unreachable[0], NULL);
+		TEST_EQ_STR (unreachable[0]->item0, "qux");
+		TEST_EQ_STR (unreachable[0]->item1, "start on");
+		TEST_EQ_STR (unreachable[0]->item2, "event");
+		TEST_EQ_STR (unreachable[0]->item3, "frodo");
+		TEST_EQ_P (unreachable[1], NULL);
 
-	dbus_message_unref (reply);
+		nih_free (message);
+	}
 
 
-	/* Check that if the event name is empty, an error is returned
-	 * immediately.
+	/* Check that with warnings, an unknown event or job on either side
+	 * of an "or" is unreachable, and that ignored events are not.
 	 */
-	TEST_FEATURE ("with empty name");
-	method = dbus_message_new_method_call (
-		dbus_bus_get_unique_name (conn),
-		DBUS_PATH_UPSTART,
-		DBUS_INTERFACE_UPSTART,
-		"EmitEvent");
+	TEST_FEATURE ("with warnings and ignored events");
+	message = nih_new (NULL, NihDBusMessage);
+	message->connection = NULL;
+	message->message = NULL;
 
-	dbus_connection_send (client_conn, method, &serial);
-	dbus_connection_flush (client_conn);
-	dbus_message_unref (method);
+	ret = control_get_dependency_graph (NULL, message, ignored, TRUE,
+					    &emits, &consumes, &unreachable);
 
-	TEST_DBUS_MESSAGE (conn, method);
-	assert (dbus_message_get_serial (method) == serial);
+	TEST_EQ (ret, 0);
 
-	message = nih_new (NULL, NihDBusMessage);
-	message->connection = conn;
-	message->message = method;
+	TEST_NE_P (unreachable[0], NULL);
+	TEST_EQ_STR (unreachable[0]->item0, "bar");
+	TEST_EQ_STR (unreachable[0]->item1, "stop on");
+	TEST_EQ_STR (unreachable[0]->item2, "job");
+	TEST_EQ_STR (unreachable[0]->item3, "baz");
+	TEST_EQ_P (unreachable[1], NULL);
 
-	env = nih_str_array_new (message);
+	nih_free (message);
 
-	ret = control_emit_event (NULL, message, "", env, TRUE);
+	nih_free (foo);
+	nih_free (bar);
+	nih_free (qux);
+}
 
-	TEST_LT (ret, 0);
 
-	dbus_error = (NihDBusError *)nih_error_get ();
-	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
-	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
-	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
-	nih_free (dbus_error);
+void
+test_get_memory_stats (void)
+{
+	NihDBusMessage                          *message = NULL;
+	ControlGetMemoryStatsCategoriesElement **categories;
+	uint64_t                                 allocated, allocated_bytes;
+	uint64_t                                 cached, cached_bytes;
+	MemUsage                                 before[MEM_CATEGORIES];
+	JobClass                                *class;
+	Event                                   *event;
+	NihError                                *error;
+	int                                      ret;
+
+	/* Check that the function returns an element for each category
+	 * naming it and giving the objects and bytes held, counting new
+	 * job classes and events under their categories, as newly
+	 * allocated children of the message structure.
+	 */
+	TEST_FUNCTION ("control_get_memory_stats");
+	nih_error_init ();
+	job_class_init ();
+	event_init ();
 
-	nih_free (message);
-	dbus_message_unref (method);
+	mem_usage (before);
 
+	class = job_class_new (NULL, "foo", NULL);
+	nih_hash_add (job_classes, &class->entry);
 
-	/* Check that if an entry in the environment list is missing an
-	 * equals, an error is returned immediately.
-	 */
-	TEST_FEATURE ("with missing equals in environment list");
-	method = dbus_message_new_method_call (
-		dbus_bus_get_unique_name (conn),
-		DBUS_PATH_UPSTART,
-		DBUS_INTERFACE_UPSTART,
-		"EmitEvent");
+	event = event_new (NULL, "wibble", NULL);
 
-	dbus_connection_send (client_conn, method, &serial);
-	dbus_connection_flush (client_conn);
-	dbus_message_unref (method);
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
 
-	TEST_DBUS_MESSAGE (conn, method);
-	assert (dbus_message_get_serial (method) == serial);
+		ret = control_get_memory_stats (NULL, message, &categories,
+						&allocated, &allocated_bytes,
+						&cached, &cached_bytes);
 
-	message = nih_new (NULL, NihDBusMessage);
-	message->connection = conn;
-	message->message = method;
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
 
-	env = nih_str_array_new (message);
-	assert (nih_str_array_add (&env, message, NULL, "FOO_BAR"));
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
 
-	ret = control_emit_event (NULL, message, "test", env, TRUE);
+			nih_free (message);
 
-	TEST_LT (ret, 0);
+			continue;
+		}
 
-	dbus_error = (NihDBusError *)nih_error_get ();
-	TEST_ALLOC_SIZE (dbus_error, sizeof (NihDBusError));
-	TEST_EQ (dbus_error->number, NIH_DBUS_ERROR);
-	TEST_EQ_STR (dbus_error->name, DBUS_ERROR_INVALID_ARGS);
-	nih_free (dbus_error);
+		TEST_EQ (ret, 0);
 
-	nih_free (message);
-	dbus_message_unref (method);
+		TEST_ALLOC_PARENT (categories, message);
+		for (int i = 0; i < MEM_CATEGORIES; i++) {
+			TEST_NE_P (categories[i], NULL);
+			TEST_EQ_STR (categories[i]->item0,
+				     mem_category_name (i));
+		}
+		TEST_EQ_P (categories[MEM_CATEGORIES], NULL);
 
+		TEST_EQ_STR (categories[MEM_JOB_CLASSES]->item0,
+			     "job-classes");
+		TEST_GT (categories[MEM_JOB_CLASSES]->item1,
+			 before[MEM_JOB_CLASSES].objects);
+		TEST_GE (categories[MEM_JOB_CLASSES]->item2,
+			 before[MEM_JOB_CLASSES].bytes + sizeof (JobClass));
 
-	TEST_DBUS_CLOSE (conn);
-	TEST_DBUS_CLOSE (client_conn);
-	TEST_DBUS_END (dbus_pid);
+		TEST_EQ_STR (categories[MEM_EVENTS]->item0, "events");
+		TEST_EQ (categories[MEM_EVENTS]->item1,
+			 before[MEM_EVENTS].objects + 1);
+		TEST_EQ (categories[MEM_EVENTS]->item2,
+			 before[MEM_EVENTS].bytes + sizeof (Event));
 
-	dbus_shutdown ();
+		/* The pool is only used by init itself */
+		TEST_EQ (allocated, 0);
+		TEST_EQ (cached, 0);
+
+		nih_free (message);
+	}
+
+	nih_free (event);
+	nih_free (class);
 }
 
 
@@ -2177,6 +3513,40 @@ test_set_log_priority (void)
 	nih_log_priority = NIH_LOG_UNKNOWN;
 }
 
+
+void
+test_get_log_unflushed_dropped (void)
+{
+	NihDBusMessage *message = NULL;
+	uint64_t        dropped;
+	int             ret;
+
+	/* Check that the function returns the number of bytes of
+	 * unflushed job output that have been discarded.
+	 */
+	TEST_FUNCTION ("control_get_log_unflushed_dropped");
+	nih_error_init ();
+	job_class_init ();
+
+	log_unflushed_dropped = 1234;
+
+	message = nih_new (NULL, NihDBusMessage);
+	TEST_NE_P (message, NULL);
+	message->connection = NULL;
+	message->message = NULL;
+
+	dropped = 0;
+	ret = control_get_log_unflushed_dropped (NULL, message, &dropped);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (dropped, 1234);
+
+	nih_free (message);
+
+	log_unflushed_dropped = 0;
+}
+
+
 void
 test_list_env (void)
 {
@@ -2711,18 +4081,29 @@ main (int   argc,
 	test_bus_close ();
 
 	test_disconnected ();
+	test_get_origin_uid ();
 
 	test_reload_configuration ();
 
 	test_get_job_by_name ();
 	test_get_all_jobs ();
+	test_get_all_job_status ();
+	test_changes ();
 
 	test_emit_event ();
+	test_emit_event_with_files ();
+	test_emit_events ();
+	test_emit_event_async ();
+	test_get_event_stats ();
+	test_get_memory_stats ();
+	test_get_dependency_graph ();
+	test_get_job_timeline ();
 
 	test_get_version ();
 
 	test_get_log_priority ();
 	test_set_log_priority ();
+	test_get_log_unflushed_dropped ();
 
 	test_list_env ();
 	test_get_env ();
@@ -0,0 +1,226 @@
+/* upstart
+ *
+ * test_deadline.c - test suite for init/deadline.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/timer.h>
+
+#include "deadline.h"
+
+
+static int  calls = 0;
+static int  order[4];
+static void *last_data = NULL;
+
+static void
+my_callback (void     *data,
+	     Deadline *deadline)
+{
+	order[calls++ % 4] = *(int *)data;
+	last_data = data;
+}
+
+static void
+my_free_callback (void     *data,
+		  Deadline *deadline)
+{
+	calls++;
+	nih_free (data);
+}
+
+static size_t
+count_timers (void)
+{
+	size_t count = 0;
+
+	if (! nih_timers)
+		return 0;
+
+	NIH_LIST_FOREACH (nih_timers, iter)
+		count++;
+
+	return count;
+}
+
+static time_t
+now_monotonic (void)
+{
+	struct timespec now;
+
+	assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
+
+	return now.tv_sec;
+}
+
+
+void
+test_add_timeout (void)
+{
+	Deadline *deadline1, *deadline2, *deadline3;
+	int       data1 = 1, data2 = 2, data3 = 3;
+	time_t    now;
+
+	TEST_FUNCTION ("deadline_add_timeout");
+
+
+	/* Check that deadlines are ordered by when they are due whatever
+	 * order they were added in, and that only a single NIH timer is
+	 * registered for all of them, due when the earliest is.
+	 */
+	TEST_FEATURE ("with several deadlines");
+	now = now_monotonic ();
+
+	deadline1 = deadline_add_timeout (NULL, 30, my_callback, &data1);
+	deadline2 = deadline_add_timeout (NULL, 10, my_callback, &data2);
+	deadline3 = deadline_add_timeout (NULL, 20, my_callback, &data3);
+
+	TEST_ALLOC_SIZE (deadline1, sizeof (Deadline));
+	TEST_EQ (deadline1->timeout, 30);
+	TEST_EQ (deadline1->period, 0);
+	TEST_GE (deadline1->due, now + 30);
+	TEST_LE (deadline1->due, now + 31);
+
+	TEST_EQ (deadline_pending (), 3);
+	TEST_EQ (deadline_next_due (), deadline2->due);
+
+	TEST_EQ (count_timers (), 1);
+	TEST_EQ (((NihTimer *)nih_timers->next)->due, deadline2->due);
+
+
+	/* Check that freeing a deadline removes it, and moves the timer
+	 * on to the next.
+	 */
+	TEST_FEATURE ("with freed deadline");
+	nih_free (deadline2);
+
+	TEST_EQ (deadline_pending (), 2);
+	TEST_EQ (deadline_next_due (), deadline3->due);
+	TEST_EQ (((NihTimer *)nih_timers->next)->due, deadline3->due);
+
+
+	/* Check that moving deadlines into the past runs them, earliest
+	 * first, and frees them once they have run; and that the timer
+	 * is removed once no deadlines remain.
+	 */
+	TEST_FUNCTION ("deadline_poll");
+	TEST_FEATURE ("with due deadlines");
+	deadline_set_due (deadline1, now - 2);
+	deadline_set_due (deadline3, now - 1);
+
+	TEST_EQ (deadline_next_due (), now - 2);
+
+	TEST_FREE_TAG (deadline1);
+	TEST_FREE_TAG (deadline3);
+
+	calls = 0;
+	deadline_poll ();
+
+	TEST_EQ (calls, 2);
+	TEST_EQ (order[0], 1);
+	TEST_EQ (order[1], 3);
+
+	TEST_FREE (deadline1);
+	TEST_FREE (deadline3);
+
+	TEST_EQ (deadline_pending (), 0);
+	TEST_EQ (deadline_next_due (), 0);
+	TEST_EQ (count_timers (), 0);
+
+
+	/* Check that a deadline freed along with its parent by its own
+	 * callback is not freed again.
+	 */
+	TEST_FEATURE ("with deadline freed by callback");
+	{
+		void *parent;
+
+		parent = nih_alloc (NULL, 1);
+		deadline1 = deadline_add_timeout (parent, 10,
+						  my_free_callback, parent);
+		deadline_set_due (deadline1, now - 1);
+
+		TEST_FREE_TAG (deadline1);
+
+		calls = 0;
+		deadline_poll ();
+
+		TEST_EQ (calls, 1);
+		TEST_FREE (deadline1);
+		TEST_EQ (deadline_pending (), 0);
+	}
+}
+
+void
+test_add_periodic (void)
+{
+	Deadline *deadline;
+	int       data = 4;
+	time_t    now;
+
+	TEST_FUNCTION ("deadline_add_periodic");
+
+
+	/* Check that a periodic deadline is kept once it has run, and is
+	 * next due a period later.
+	 */
+	TEST_FEATURE ("with due deadline");
+	now = now_monotonic ();
+
+	deadline = deadline_add_periodic (NULL, 5, my_callback, &data);
+
+	TEST_EQ (deadline->period, 5);
+	TEST_GE (deadline->due, now + 5);
+
+	deadline_set_due (deadline, now - 1);
+
+	TEST_FREE_TAG (deadline);
+
+	calls = 0;
+	deadline_poll ();
+
+	TEST_EQ (calls, 1);
+	TEST_EQ_P (last_data, &data);
+	TEST_NOT_FREE (deadline);
+
+	TEST_EQ (deadline_pending (), 1);
+	TEST_GE (deadline->due, now + 5);
+	TEST_EQ (count_timers (), 1);
+
+	nih_free (deadline);
+
+	TEST_EQ (deadline_pending (), 0);
+	TEST_EQ (count_timers (), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_add_timeout ();
+	test_add_periodic ();
+
+	return 0;
+}
@@ -1108,6 +1108,93 @@ test_append (void)
 	}
 
 	nih_free (new_env);
+
+
+	/* Check that large tables are merged with the same result as
+	 * when appending entries one at a time, including later entries
+	 * of the new table replacing earlier ones and unset variables
+	 * named without a value removing the existing entry.
+	 */
+	TEST_FEATURE ("with large tables");
+	assert0 (unsetenv ("UNSET_KEY"));
+
+	new_env = nih_str_array_new (NULL);
+	for (int i = 16; i < 48; i++)
+		assert (nih_str_array_addp (&new_env, NULL, NULL,
+					    NIH_MUST (nih_sprintf (NULL, "VAR%d=new", i))));
+	assert (nih_str_array_add (&new_env, NULL, NULL, "VAR0=first"));
+	assert (nih_str_array_add (&new_env, NULL, NULL, "VAR0=second"));
+	assert (nih_str_array_add (&new_env, NULL, NULL, "UNSET_KEY"));
+
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			len = 0;
+			env = nih_str_array_new (NULL);
+			for (int i = 0; i < 32; i++)
+				assert (environ_set (&env, NULL, &len, TRUE,
+						     "VAR%d=old", i));
+			assert (environ_add (&env, NULL, &len, TRUE, "UNSET_KEY=set"));
+		}
+
+		ret = environ_append (&env, NULL, &len, TRUE, new_env);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (ret, NULL);
+			nih_free (env);
+			continue;
+		}
+
+		TEST_EQ_P (ret, env);
+		TEST_EQ (len, 48);
+
+		TEST_EQ_STR (env[0], "VAR0=second");
+		TEST_EQ_STR (env[15], "VAR15=old");
+		TEST_EQ_STR (env[16], "VAR16=new");
+		TEST_EQ_STR (env[31], "VAR31=new");
+		TEST_EQ_STR (env[32], "VAR32=new");
+		TEST_EQ_STR (env[47], "VAR47=new");
+		TEST_EQ_P (env[48], NULL);
+
+		nih_free (env);
+	}
+
+
+	/* Check that large tables preserve existing entries when asked,
+	 * only appending those with new keys.
+	 */
+	TEST_FEATURE ("with large tables and preserve existing entries");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			len = 0;
+			env = nih_str_array_new (NULL);
+			for (int i = 0; i < 32; i++)
+				assert (environ_set (&env, NULL, &len, TRUE,
+						     "VAR%d=old", i));
+			assert (environ_add (&env, NULL, &len, TRUE, "UNSET_KEY=set"));
+		}
+
+		ret = environ_append (&env, NULL, &len, FALSE, new_env);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (ret, NULL);
+			nih_free (env);
+			continue;
+		}
+
+		TEST_EQ_P (ret, env);
+		TEST_EQ (len, 49);
+
+		TEST_EQ_STR (env[0], "VAR0=old");
+		TEST_EQ_STR (env[31], "VAR31=old");
+		TEST_EQ_STR (env[32], "UNSET_KEY=set");
+		TEST_EQ_STR (env[33], "VAR32=new");
+		TEST_EQ_STR (env[48], "VAR47=new");
+		TEST_EQ_P (env[49], NULL);
+
+		nih_free (env);
+	}
+
+	nih_free (new_env);
 }
 
 
@@ -1991,6 +2078,222 @@ test_expand (void)
 }
 
 
+void
+test_expand_buf (void)
+{
+	NihError *error;
+	char     *env[4], *buf, *str;
+	size_t    size;
+
+	TEST_FUNCTION ("environ_expand_buf");
+	env[0] = "FOO=frodo";
+	env[1] = "BAR=bilbo";
+	env[2] = "HOBBIT=FOO";
+	env[3] = NULL;
+
+
+	/* Check that a string with no references is copied into a newly
+	 * allocated buffer, which is returned.
+	 */
+	TEST_FEATURE ("with no expansion");
+	TEST_ALLOC_FAIL {
+		buf = NULL;
+		size = 0;
+
+		str = environ_expand_buf (&buf, NULL, &size,
+					  "this is a test", env);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (str, NULL);
+			TEST_EQ_P (buf, NULL);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+			continue;
+		}
+
+		TEST_EQ_P (str, buf);
+		TEST_EQ_STR (str, "this is a test");
+		TEST_EQ (size, 15);
+
+		nih_free (buf);
+	}
+
+
+	/* Check that the same buffer is reused by expansions that fit,
+	 * and grown by those that don't.
+	 */
+	TEST_FEATURE ("with reused buffer");
+	buf = NULL;
+	size = 0;
+
+	str = environ_expand_buf (&buf, NULL, &size,
+				  "this is a long test string", env);
+	TEST_EQ_STR (str, "this is a long test string");
+	TEST_EQ (size, 27);
+
+	str = environ_expand_buf (&buf, NULL, &size, "$FOO and ${$HOBBIT}",
+				  env);
+	TEST_EQ_P (str, buf);
+	TEST_EQ_STR (str, "frodo and frodo");
+	TEST_EQ (size, 27);
+
+	str = environ_expand_buf (&buf, NULL, &size,
+				  "$FOO $BAR $FOO $BAR $FOO $BAR", env);
+	TEST_EQ_P (str, buf);
+	TEST_EQ_STR (str, "frodo bilbo frodo bilbo frodo bilbo");
+	TEST_EQ (size, 54);
+
+
+	/* Check that an error leaves the buffer with the caller.
+	 */
+	TEST_FEATURE ("with unknown reference");
+	str = environ_expand_buf (&buf, NULL, &size, "$MEEP", env);
+
+	TEST_EQ_P (str, NULL);
+	TEST_NE_P (buf, NULL);
+	TEST_EQ (size, 54);
+
+	error = nih_error_get ();
+	TEST_EQ (error->number, ENVIRON_UNKNOWN_PARAM);
+	nih_free (error);
+
+	nih_free (buf);
+}
+
+
+void
+test_template (void)
+{
+	EnvironTemplate *tmpl;
+	NihError        *error;
+	const char      *str;
+	char            *env[5];
+
+	TEST_FUNCTION ("environ_template_expand");
+	env[0] = "FOO=frodo";
+	env[1] = "BAR=bilbo";
+	env[2] = "HOBBIT=FOO";
+	env[3] = "NULL=";
+	env[4] = NULL;
+
+
+	/* Check that a string of plain and bracketed references is
+	 * compiled, and expands to the same string environ_expand() gives.
+	 */
+	TEST_FEATURE ("with simple references");
+	TEST_ALLOC_FAIL {
+		tmpl = environ_template_new (NULL, "$FOO-${BAR}$$NULL${}");
+
+		if (! tmpl) {
+			TEST_TRUE (test_alloc_failed);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+			continue;
+		}
+
+		TEST_TRUE (tmpl->compiled);
+		TEST_EQ (tmpl->parts_len, 6);
+
+		str = environ_template_expand (tmpl, env);
+
+		if (! str) {
+			TEST_TRUE (test_alloc_failed);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+			nih_free (tmpl);
+			continue;
+		}
+
+		TEST_EQ_STR (str, "frodo-bilbo$$");
+
+		nih_free (tmpl);
+	}
+
+
+	/* Check that the scratch buffer is reused by later expansions,
+	 * and grown when a longer value doesn't fit.
+	 */
+	TEST_FEATURE ("with repeated expansion");
+	tmpl = environ_template_new (NULL, "$FOO");
+	TEST_NE_P (tmpl, NULL);
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_STR (str, "frodo");
+	TEST_EQ_P (str, tmpl->buf);
+
+	env[0] = "FOO=frodo baggins of bag end, hobbiton, the shire, middle earth";
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_STR (str, "frodo baggins of bag end, hobbiton, the shire, "
+		     "middle earth");
+	TEST_GT (tmpl->buf_size, strlen (str));
+
+	env[0] = "FOO=frodo";
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_STR (str, "frodo");
+
+	nih_free (tmpl);
+
+
+	/* Check that an unknown reference raises the same error as
+	 * environ_expand().
+	 */
+	TEST_FEATURE ("with unknown reference");
+	tmpl = environ_template_new (NULL, "${MEEP}");
+	TEST_NE_P (tmpl, NULL);
+	TEST_TRUE (tmpl->compiled);
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_P (str, NULL);
+
+	error = nih_error_get ();
+	TEST_EQ (error->number, ENVIRON_UNKNOWN_PARAM);
+	TEST_EQ_STR (error->message, "Unknown parameter: MEEP");
+	nih_free (error);
+
+	nih_free (tmpl);
+
+
+	/* Check that a string using operators and nested references is
+	 * not compiled, but still expands as environ_expand() would.
+	 */
+	TEST_FEATURE ("with operators");
+	tmpl = environ_template_new (NULL, "${$HOBBIT}-${NULL:-sam}");
+	TEST_NE_P (tmpl, NULL);
+	TEST_FALSE (tmpl->compiled);
+	TEST_EQ_P (tmpl->parts, NULL);
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_STR (str, "frodo-sam");
+
+	nih_free (tmpl);
+
+
+	/* Check that a malformed string is only reported when expanded.
+	 */
+	TEST_FEATURE ("with missing close brace");
+	tmpl = environ_template_new (NULL, "${FOO");
+	TEST_NE_P (tmpl, NULL);
+	TEST_FALSE (tmpl->compiled);
+
+	str = environ_template_expand (tmpl, env);
+	TEST_EQ_P (str, NULL);
+
+	error = nih_error_get ();
+	TEST_EQ (error->number, ENVIRON_MISMATCHED_BRACES);
+	nih_free (error);
+
+	nih_free (tmpl);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -2007,6 +2310,8 @@ main (int   argc,
 	test_getn ();
 	test_all_valid ();
 	test_expand ();
+	test_expand_buf ();
+	test_template ();
 
 	return 0;
 }
@@ -80,6 +80,7 @@ test_new (void)
 
 		TEST_EQ (event->progress, EVENT_PENDING);
 		TEST_EQ (event->failed, FALSE);
+		TEST_EQ (event->priority, EVENT_PRIORITY_NORMAL);
 
 		TEST_EQ (event->blockers, 0);
 		TEST_LIST_EMPTY (&event->blocking);
@@ -143,6 +144,8 @@ test_poll (void)
 	DBusConnection *conn, *client_conn;
 	DBusMessage    *message;
 	NihListEntry   *entry;
+	size_t          count;
+	const JobTimelineRecord *record;
 
 	TEST_FUNCTION ("event_poll");
 	nih_error_init ();
@@ -251,6 +254,37 @@ test_poll (void)
 		TEST_FREE (event);
 	}
 
+
+	/* Check that pending events are handled a lane at a time, highest
+	 * priority first, regardless of the order they were queued in.
+	 */
+	TEST_FEATURE ("with events in several lanes");
+	event = event_new (NULL, "block-device-added", NULL);
+	TEST_EQ (event->priority, EVENT_PRIORITY_LOW);
+
+	event = event_new (NULL, "wibble", NULL);
+	TEST_EQ (event->priority, EVENT_PRIORITY_NORMAL);
+
+	event = event_new (NULL, "wobble", NULL);
+	event_set_priority (event, EVENT_PRIORITY_HIGH);
+
+	count = job_timeline_count ();
+
+	event_poll ();
+
+	TEST_LIST_EMPTY (events);
+
+	TEST_EQ (job_timeline_count (), count + 3);
+
+	record = job_timeline_get (count);
+	TEST_EQ_STR (record->job, "wobble");
+
+	record = job_timeline_get (count + 1);
+	TEST_EQ_STR (record->job, "wibble");
+
+	record = job_timeline_get (count + 2);
+	TEST_EQ_STR (record->job, "block-device-added");
+
 	nih_free (entry);
 
 	TEST_DBUS_CLOSE (conn);
@@ -287,7 +321,7 @@ test_pending (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "test", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -345,7 +379,7 @@ test_pending_handle_jobs (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "wibble", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -391,7 +425,7 @@ test_pending_handle_jobs (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -456,7 +490,7 @@ test_pending_handle_jobs (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -573,7 +607,7 @@ test_pending_handle_jobs (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 
@@ -700,7 +734,7 @@ test_pending_handle_jobs (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 
 			job = job_new (class, "");
 			job->goal = JOB_STOP;
@@ -869,7 +903,7 @@ test_pending_handle_jobs (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 
 			job = job_new (class, "");
 			job->goal = JOB_START;
@@ -981,7 +1015,7 @@ test_pending_handle_jobs (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "wibble", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1061,7 +1095,7 @@ test_pending_handle_jobs (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "wibble", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 
 			job = job_new (class, "brandybuck");
 			job->goal = JOB_STOP;
@@ -1146,7 +1180,7 @@ test_pending_handle_jobs (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "wibble", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		TEST_DIVERT_STDERR (output) {
@@ -1196,7 +1230,7 @@ test_pending_handle_jobs (void)
 			job->goal = JOB_START;
 			job->state = JOB_RUNNING;
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1245,7 +1279,7 @@ test_pending_handle_jobs (void)
 			job->goal = JOB_START;
 			job->state = JOB_RUNNING;
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1321,7 +1355,7 @@ test_pending_handle_jobs (void)
 			job->goal = JOB_START;
 			job->state = JOB_RUNNING;
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1425,7 +1459,7 @@ test_pending_handle_jobs (void)
 			TEST_FREE_TAG (blocked2);
 			TEST_FREE_TAG (event4);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1536,7 +1570,7 @@ test_pending_handle_jobs (void)
 			TEST_FREE_TAG (blocked2);
 			TEST_FREE_TAG (event4);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1607,7 +1641,7 @@ test_pending_handle_jobs (void)
 			assert (nih_str_array_add (&(job->env), job,
 						   NULL, "COLOUR=GOLD"));
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1692,7 +1726,7 @@ test_finished (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "test/failed", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1727,7 +1761,7 @@ test_finished (void)
 			class->start_on = event_operator_new (
 				class, EVENT_MATCH, "test/failed", NULL);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1780,13 +1814,52 @@ test_finished (void)
 			nih_tree_add (&class->start_on->node, &oper->node,
 				      NIH_TREE_RIGHT);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
+		}
+
+		event_poll ();
+
+		TEST_FREE (event);
+
+		TEST_HASH_EMPTY (class->instances);
+
+		nih_free (class);
+	}
+
+
+	/* Check that a failed event that no job could be affected by is
+	 * not followed by a queued failed event.
+	 */
+	TEST_FEATURE ("with unobserved failed event");
+	TEST_ALLOC_FAIL {
+		uint64_t emitted;
+
+		TEST_ALLOC_SAFE {
+			event = event_new (NULL, "test", NULL);
+			event->failed = TRUE;
+			event->progress = EVENT_FINISHED;
+
+			TEST_FREE_TAG (event);
+
+			class = job_class_new (NULL, "test", NULL);
+			class->console = CONSOLE_NONE;
+			class->process[PROCESS_MAIN] = process_new (class->process);
+			class->process[PROCESS_MAIN]->command = "echo";
+
+			class->start_on = event_operator_new (
+				class, EVENT_MATCH, "wibble/failed", NULL);
+
+			job_class_add_safe (class);
 		}
 
+		emitted = event_stats.emitted;
+
 		event_poll ();
 
 		TEST_FREE (event);
 
+		TEST_EQ (event_stats.emitted, emitted);
+		TEST_LIST_EMPTY (events);
 		TEST_HASH_EMPTY (class->instances);
 
 		nih_free (class);
@@ -1812,7 +1885,7 @@ test_finished (void)
 			job->state = JOB_STOPPING;
 			job->blocker = NULL;
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1846,7 +1919,7 @@ test_finished (void)
 			job->state = JOB_STARTING;
 			job->blocker = NULL;
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1886,7 +1959,7 @@ test_finished (void)
 
 			TEST_FREE_TAG (blocked);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1929,7 +2002,7 @@ test_finished (void)
 
 			TEST_FREE_TAG (blocked);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -1974,7 +2047,7 @@ test_finished (void)
 
 			TEST_FREE_TAG (blocked);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -2020,7 +2093,7 @@ test_finished (void)
 
 			TEST_FREE_TAG (blocked);
 
-			nih_hash_add (job_classes, &class->entry);
+			job_class_add_safe (class);
 		}
 
 		event_poll ();
@@ -2040,6 +2113,107 @@ test_finished (void)
 }
 
 
+void
+test_history (void)
+{
+	JobClass                 *class;
+	Job                      *job;
+	Event                    *event;
+	Blocked                  *blocked;
+	const EventHistoryRecord *record;
+	uint64_t                  id;
+	size_t                    count;
+
+	TEST_FUNCTION ("event_history_get");
+	program_name = "test";
+
+
+	/* Check that an event which affects no job is recorded with its
+	 * name and emitter once it has been handled, and that the record
+	 * is finished as the event is.
+	 */
+	TEST_FEATURE ("with event affecting no jobs");
+	event = event_new (NULL, "biscuit", NULL);
+	event_set_emitter (event, "foo[42]");
+	id = event->id;
+
+	TEST_FREE_TAG (event);
+
+	event_poll ();
+
+	TEST_FREE (event);
+
+	count = event_history_count ();
+	TEST_GT (count, 0);
+	TEST_EQ_P (event_history_get (count), NULL);
+
+	record = event_history_get (count - 1);
+	TEST_NE_P (record, NULL);
+	TEST_EQ (record->id, id);
+	TEST_EQ_STR (record->name, "biscuit");
+	TEST_EQ_STR (record->emitter, "foo[42]");
+	TEST_EQ (record->progress, EVENT_FINISHED);
+	TEST_EQ (record->failed, FALSE);
+	TEST_EQ (record->blockers, 0);
+	TEST_EQ (record->matched, 0);
+
+
+	/* Check that an event which starts a job is recorded with the job
+	 * class and the blocker held by the job, and remains handling
+	 * until the job releases it.
+	 */
+	TEST_FEATURE ("with event starting a job");
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	class->task = TRUE;
+	class->start_on = event_operator_new (class, EVENT_MATCH,
+					      "wibble", NULL);
+	job_class_add_safe (class);
+
+	event = event_new (NULL, "wibble", NULL);
+	id = event->id;
+
+	TEST_FREE_TAG (event);
+
+	event_poll ();
+
+	TEST_NOT_FREE (event);
+	TEST_EQ (event->blockers, 1);
+
+	record = NULL;
+	for (size_t i = 0; i < event_history_count (); i++) {
+		if (event_history_get (i)->id == id)
+			record = event_history_get (i);
+	}
+
+	TEST_NE_P (record, NULL);
+	TEST_EQ_STR (record->name, "wibble");
+	TEST_EQ_P (record->emitter, NULL);
+	TEST_EQ (record->progress, EVENT_HANDLING);
+	TEST_EQ (record->blockers, 1);
+	TEST_EQ (record->matched, 1);
+	TEST_EQ_STR (record->jobs[0], "test");
+	TEST_EQ (record->stopped, 0);
+
+	job = (Job *)nih_hash_lookup (class->instances, "");
+	TEST_NE_P (job, NULL);
+
+	NIH_LIST_FOREACH_SAFE (&job->blocking, iter) {
+		blocked = (Blocked *)iter;
+		nih_free (blocked);
+	}
+
+	event_unblock (event);
+	nih_free (class);
+
+	event_poll ();
+
+	TEST_FREE (event);
+	TEST_EQ (record->id, id);
+	TEST_EQ (record->progress, EVENT_FINISHED);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -2057,6 +2231,7 @@ main (int   argc,
 	test_pending ();
 	test_pending_handle_jobs ();
 	test_finished ();
+	test_history ();
 
 	return 0;
 }
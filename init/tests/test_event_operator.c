@@ -64,7 +64,9 @@ test_operator_new (void)
 		TEST_ALLOC_PARENT (oper->name, oper);
 
 		TEST_EQ_P (oper->env, NULL);
+		TEST_EQ_P (oper->match, NULL);
 		TEST_EQ_P (oper->event, NULL);
+		TEST_EQ (oper->held, 0);
 
 		nih_free (oper);
 	}
@@ -105,6 +107,14 @@ test_operator_new (void)
 		TEST_EQ_P (oper->env, env);
 		TEST_ALLOC_PARENT (oper->env, oper);
 
+		TEST_EQ (oper->match_len, 2);
+		TEST_ALLOC_PARENT (oper->match, oper);
+		TEST_EQ_P (oper->match[0].key, NULL);
+		TEST_EQ_STR (oper->match[0].value, "foo");
+		TEST_EQ_P (oper->match[1].key, env[1]);
+		TEST_EQ (oper->match[1].key_len, 3);
+		TEST_EQ_STR (oper->match[1].value, "frodo");
+
 		TEST_EQ_P (oper->event, NULL);
 
 		nih_free (oper);
@@ -385,6 +395,53 @@ test_operator_copy (void)
 		nih_free (oper);
 	}
 
+
+	/* Check that the copy of a flattened tree is flattened in turn,
+	 * referring to its own leaves.
+	 */
+	TEST_FEATURE ("with flattened tree");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			oper = event_operator_new (NULL, EVENT_OR, NULL, NULL);
+
+			oper1 = event_operator_new (oper, EVENT_MATCH,
+						    "foo", NULL);
+			nih_tree_add (&oper->node, &oper1->node,
+				      NIH_TREE_LEFT);
+
+			oper2 = event_operator_new (oper, EVENT_MATCH,
+						    "bar", NULL);
+			nih_tree_add (&oper->node, &oper2->node,
+				      NIH_TREE_RIGHT);
+
+			assert0 (event_operator_compile_tree (oper));
+		}
+
+		copy = event_operator_copy (NULL, oper);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (copy, NULL);
+			nih_free (oper);
+			continue;
+		}
+
+		copy1 = (EventOperator *)copy->node.left;
+		copy2 = (EventOperator *)copy->node.right;
+
+		TEST_ALLOC_PARENT (copy->leaves, copy);
+		TEST_EQ (copy->leaves_len, 2);
+		TEST_EQ_P (copy->leaves[0].oper, copy1);
+		TEST_EQ_P (copy->leaves[0].name, copy1->name);
+		TEST_EQ_P (copy->leaves[1].oper, copy2);
+		TEST_EQ_P (copy->leaves[1].name, copy2->name);
+
+		TEST_EQ_P (copy1->leaves, NULL);
+		TEST_EQ_P (copy2->leaves, NULL);
+
+		nih_free (copy);
+		nih_free (oper);
+	}
+
 	event_poll ();
 }
 
@@ -427,6 +484,142 @@ test_operator_destroy (void)
 }
 
 
+void
+test_operator_compile_tree (void)
+{
+	EventOperator *oper1, *oper2, *oper3, *oper4, *oper5;
+	int            ret;
+
+	/* Check that the flattened form of a tree lists each of its leaves
+	 * in post-order, with the name of the event matched, and that it
+	 * belongs to the root of the tree.
+	 */
+	TEST_FUNCTION ("event_operator_compile_tree");
+	oper1 = event_operator_new (NULL, EVENT_OR, NULL, NULL);
+	oper2 = event_operator_new (NULL, EVENT_AND, NULL, NULL);
+	oper3 = event_operator_new (NULL, EVENT_MATCH, "foo", NULL);
+	oper4 = event_operator_new (NULL, EVENT_MATCH, "bar", NULL);
+	oper5 = event_operator_new (NULL, EVENT_MATCH, "baz", NULL);
+
+	nih_tree_add (&oper1->node, &oper2->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper3->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper2->node, &oper4->node, NIH_TREE_RIGHT);
+	nih_tree_add (&oper1->node, &oper5->node, NIH_TREE_RIGHT);
+
+	TEST_ALLOC_FAIL {
+		ret = event_operator_compile_tree (oper1);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+			TEST_EQ_P (oper1->leaves, NULL);
+			TEST_EQ (oper1->leaves_len, 0);
+
+			nih_free (nih_error_get ());
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_ALLOC_SIZE (oper1->leaves, sizeof (EventLeaf) * 3);
+		TEST_ALLOC_PARENT (oper1->leaves, oper1);
+		TEST_EQ (oper1->leaves_len, 3);
+
+		TEST_EQ_P (oper1->leaves[0].oper, oper3);
+		TEST_EQ_P (oper1->leaves[0].name, oper3->name);
+		TEST_EQ_P (oper1->leaves[1].oper, oper4);
+		TEST_EQ_P (oper1->leaves[1].name, oper4->name);
+		TEST_EQ_P (oper1->leaves[2].oper, oper5);
+		TEST_EQ_P (oper1->leaves[2].name, oper5->name);
+
+		TEST_EQ_P (oper2->leaves, NULL);
+	}
+
+	nih_free (oper1);
+	nih_free (oper2);
+	nih_free (oper3);
+	nih_free (oper4);
+	nih_free (oper5);
+}
+
+
+void
+test_operator_may_match_job (void)
+{
+	EventOperator  *oper1, *oper2, *oper3;
+	char          **env;
+
+	TEST_FUNCTION ("event_operator_may_match_job");
+	oper1 = event_operator_new (NULL, EVENT_OR, NULL, NULL);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "foo"));
+	oper2 = event_operator_new (oper1, EVENT_MATCH, "started", env);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "JOB=b*"));
+	oper3 = event_operator_new (oper1, EVENT_MATCH, "stopped", env);
+
+	nih_tree_add (&oper1->node, &oper2->node, NIH_TREE_LEFT);
+	nih_tree_add (&oper1->node, &oper3->node, NIH_TREE_RIGHT);
+
+
+	/* Check that an event of a job named positionally, or matching a
+	 * JOB glob, could match; and those of other jobs or without a leaf
+	 * could not.  The tree is walked before it is compiled and its
+	 * flattened form is used after.
+	 */
+	for (int compiled = 0; compiled < 2; compiled++) {
+		TEST_FEATURE (compiled ? "with compiled tree"
+			      : "with uncompiled tree");
+		if (compiled)
+			assert0 (event_operator_compile_tree (oper1));
+
+		TEST_TRUE (event_operator_may_match_job (oper1, "started", "foo"));
+		TEST_FALSE (event_operator_may_match_job (oper1, "started", "bar"));
+		TEST_TRUE (event_operator_may_match_job (oper1, "stopped", "bar"));
+		TEST_FALSE (event_operator_may_match_job (oper1, "stopped", "foo"));
+		TEST_FALSE (event_operator_may_match_job (oper1, "starting", "foo"));
+	}
+
+	nih_free (oper1);
+
+
+	/* Check that a leaf without environment, or whose first entry
+	 * doesn't plainly name the job, could match any job.
+	 */
+	TEST_FEATURE ("with undecidable leaves");
+	oper1 = event_operator_new (NULL, EVENT_MATCH, "started", NULL);
+
+	TEST_TRUE (event_operator_may_match_job (oper1, "started", "foo"));
+
+	nih_free (oper1);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "JOB!=foo"));
+	oper1 = event_operator_new (NULL, EVENT_MATCH, "started", env);
+
+	TEST_TRUE (event_operator_may_match_job (oper1, "started", "bar"));
+
+	nih_free (oper1);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "INSTANCE=foo"));
+	oper1 = event_operator_new (NULL, EVENT_MATCH, "started", env);
+
+	TEST_TRUE (event_operator_may_match_job (oper1, "started", "bar"));
+
+	nih_free (oper1);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "$JOB"));
+	oper1 = event_operator_new (NULL, EVENT_MATCH, "started", env);
+
+	TEST_TRUE (event_operator_may_match_job (oper1, "started", "bar"));
+
+	nih_free (oper1);
+}
+
+
 void
 test_operator_update (void)
 {
@@ -831,6 +1024,80 @@ test_operator_match (void)
 	TEST_FALSE (event_operator_match (oper, event, env));
 
 
+	/* Check that a compiled operator environment matches plain values
+	 * by name and by position, and honours negation.
+	 */
+	TEST_FEATURE ("with compiled environment");
+	event->env = env1;
+	event->env[0] = "FRODO=foo";
+	event->env[1] = "BILBO=bar";
+	event->env[2] = "MERRY=baz";
+	event->env[3] = NULL;
+
+	oper->env = env2;
+	oper->env[0] = "foo";
+	oper->env[1] = "MERRY=baz";
+	oper->env[2] = "BILBO!=baz";
+	oper->env[3] = NULL;
+
+	TEST_EQ (event_operator_compile (oper), 0);
+	TEST_EQ (oper->match_len, 3);
+	TEST_ALLOC_PARENT (oper->match, oper);
+
+	TEST_EQ_P (oper->match[0].key, NULL);
+	TEST_FALSE (oper->match[0].negate);
+	TEST_EQ_STR (oper->match[0].value, "foo");
+	TEST_FALSE (oper->match[0].expand);
+	TEST_FALSE (oper->match[0].glob);
+
+	TEST_EQ_P (oper->match[1].key, oper->env[1]);
+	TEST_EQ (oper->match[1].key_len, 5);
+	TEST_FALSE (oper->match[1].negate);
+	TEST_EQ_STR (oper->match[1].value, "baz");
+
+	TEST_EQ_P (oper->match[2].key, oper->env[2]);
+	TEST_EQ (oper->match[2].key_len, 5);
+	TEST_TRUE (oper->match[2].negate);
+	TEST_EQ_STR (oper->match[2].value, "baz");
+
+	TEST_TRUE (event_operator_match (oper, event, NULL));
+
+	event->env[1] = "BILBO=baz";
+
+	TEST_FALSE (event_operator_match (oper, event, NULL));
+
+
+	/* Check that a compiled operator environment still matches globs
+	 * and expands variable references.
+	 */
+	TEST_FEATURE ("with compiled globs and variable references");
+	event->env = env1;
+	event->env[0] = "FRODO=foo";
+	event->env[1] = "BILBO=bar";
+	event->env[2] = NULL;
+
+	oper->env = env2;
+	oper->env[0] = "FRODO=$FOO";
+	oper->env[1] = "BILBO=b?r";
+	oper->env[2] = NULL;
+
+	TEST_EQ (event_operator_compile (oper), 0);
+	TEST_EQ (oper->match_len, 2);
+	TEST_TRUE (oper->match[0].expand);
+	TEST_FALSE (oper->match[1].expand);
+	TEST_TRUE (oper->match[1].glob);
+
+	env[0] = "FOO=f*";
+	env[1] = NULL;
+
+	TEST_TRUE (event_operator_match (oper, event, env));
+
+	env[0] = "FOO=bar";
+	env[1] = NULL;
+
+	TEST_FALSE (event_operator_match (oper, event, env));
+
+
 	nih_free (oper);
 	nih_free (event);
 }
@@ -975,6 +1242,45 @@ test_operator_handle (void)
 
 	TEST_EQ (event->blockers, 1);
 
+	event_operator_reset (oper1);
+
+
+	/* Check that once the tree is flattened, events are matched
+	 * against its leaves in the same way; a non-matching event should
+	 * not touch the tree.
+	 */
+	TEST_FEATURE ("with flattened tree");
+	TEST_EQ (event_operator_compile_tree (oper1), 0);
+
+	event = event_new (NULL, "frodo", NULL);
+	ret = event_operator_handle (oper1, event, NULL);
+
+	TEST_EQ (ret, FALSE);
+	TEST_EQ (oper1->value, FALSE);
+	TEST_EQ (oper1->held, 0);
+	TEST_EQ (event->blockers, 0);
+
+	event = event_new (NULL, "foo", NULL);
+	ret = event_operator_handle (oper1, event, NULL);
+
+	TEST_EQ (ret, TRUE);
+	TEST_EQ (oper1->value, FALSE);
+	TEST_EQ (oper3->value, TRUE);
+	TEST_EQ_P (oper3->event, event);
+
+	event = event_new (NULL, "bar", NULL);
+	ret = event_operator_handle (oper1, event, NULL);
+
+	TEST_EQ (ret, TRUE);
+	TEST_EQ (oper1->value, TRUE);
+	TEST_EQ (oper2->value, TRUE);
+	TEST_EQ (oper4->value, TRUE);
+	TEST_EQ_P (oper4->event, event);
+	TEST_EQ (oper5->value, FALSE);
+	TEST_EQ (oper1->held, 2);
+
+	TEST_EQ (event->blockers, 1);
+
 
 	event_operator_reset (oper1);
 
@@ -988,6 +1294,125 @@ test_operator_handle (void)
 }
 
 
+void
+test_operator_memo (void)
+{
+	EventOperator  *oper;
+	EventMemo      *memo, *memo2;
+	Event          *event;
+	char          **env;
+	int             ret;
+
+	TEST_FUNCTION ("event_operator_memo");
+	event_operator_memo_flush ();
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "IFACE=lo"));
+
+	oper = event_operator_new (NULL, EVENT_MATCH, "foo", env);
+	assert0 (event_operator_compile_tree (oper));
+
+
+	/* Check that an event seen for the first time is not remembered,
+	 * but is still matched.
+	 */
+	TEST_FEATURE ("with first event");
+	event = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event->env, event, NULL, "IFACE=lo"));
+
+	memo = event_operator_memo (event);
+	TEST_EQ_P (memo, NULL);
+
+	ret = event_operator_handle_memo (oper, event, memo);
+	TEST_EQ (ret, TRUE);
+	TEST_EQ_P (oper->event, event);
+	TEST_FALSE (oper->memoised);
+
+	event_operator_reset (oper);
+	nih_free (event);
+
+
+	/* Check that the same event seen again is remembered, and the
+	 * result of matching the operator recorded.
+	 */
+	TEST_FEATURE ("with repeated event");
+	event = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event->env, event, NULL, "IFACE=lo"));
+
+	memo = event_operator_memo (event);
+	TEST_NE_P (memo, NULL);
+	TEST_EQ_P (memo->name, event->name);
+	TEST_EQ (memo->results_len, 0);
+
+	ret = event_operator_handle_memo (oper, event, memo);
+	TEST_EQ (ret, TRUE);
+	TEST_EQ_P (oper->event, event);
+
+	TEST_EQ (memo->results_len, 1);
+	TEST_EQ_P (memo->results[0].oper, oper);
+	TEST_EQ (memo->results[0].match, TRUE);
+	TEST_TRUE (oper->memoised);
+
+	event_operator_reset (oper);
+	nih_free (event);
+
+
+	/* Check that the recorded result is used for the event after that,
+	 * rather than matching the operator again.
+	 */
+	TEST_FEATURE ("with remembered event");
+	event = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event->env, event, NULL, "IFACE=lo"));
+
+	memo2 = event_operator_memo (event);
+	TEST_EQ_P (memo2, memo);
+
+	memo->results[0].match = FALSE;
+
+	ret = event_operator_handle_memo (oper, event, memo);
+	TEST_EQ (ret, FALSE);
+	TEST_EQ_P (oper->event, NULL);
+
+	memo->results[0].match = TRUE;
+
+	nih_free (event);
+
+
+	/* Check that an event with a different environment is not taken
+	 * for the one remembered.
+	 */
+	TEST_FEATURE ("with different environment");
+	event = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event->env, event, NULL, "IFACE=eth0"));
+
+	memo = event_operator_memo (event);
+	TEST_EQ_P (memo, NULL);
+
+	ret = event_operator_handle_memo (oper, event, memo);
+	TEST_EQ (ret, FALSE);
+
+	nih_free (event);
+
+
+	/* Check that freeing an operator whose result was remembered
+	 * empties the memo.
+	 */
+	TEST_FEATURE ("with freed operator");
+	nih_free (oper);
+
+	event = event_new (NULL, "foo", NULL);
+	NIH_MUST (nih_str_array_add (&event->env, event, NULL, "IFACE=lo"));
+
+	memo = event_operator_memo (event);
+	TEST_NE_P (memo, NULL);
+	TEST_EQ (memo->results_len, 0);
+
+	nih_free (event);
+
+	event_operator_memo_flush ();
+}
+
+
 void
 test_operator_environment (void)
 {
@@ -1298,6 +1723,12 @@ test_operator_reset (void)
 	TEST_EQ (oper4->event, event2);
 	TEST_EQ (oper5->value, FALSE);
 
+	TEST_EQ (oper1->held, 2);
+	TEST_EQ (oper2->held, 2);
+	TEST_EQ (oper3->held, 1);
+	TEST_EQ (oper4->held, 1);
+	TEST_EQ (oper5->held, 0);
+
 	TEST_EQ (event1->blockers, 1);
 	TEST_EQ (event2->blockers, 1);
 
@@ -1311,6 +1742,12 @@ test_operator_reset (void)
 	TEST_EQ (oper4->event, NULL);
 	TEST_EQ (oper5->value, FALSE);
 
+	TEST_EQ (oper1->held, 0);
+	TEST_EQ (oper2->held, 0);
+	TEST_EQ (oper3->held, 0);
+	TEST_EQ (oper4->held, 0);
+	TEST_EQ (oper5->held, 0);
+
 	TEST_EQ (event1->blockers, 0);
 	TEST_EQ (event2->blockers, 0);
 
@@ -1442,9 +1879,12 @@ main (int   argc,
 	test_operator_new ();
 	test_operator_copy ();
 	test_operator_destroy ();
+	test_operator_compile_tree ();
+	test_operator_may_match_job ();
 	test_operator_update ();
 	test_operator_match ();
 	test_operator_handle ();
+	test_operator_memo ();
 	test_operator_environment ();
 	test_operator_events ();
 	test_operator_reset ();
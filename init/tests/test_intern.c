@@ -0,0 +1,105 @@
+/* upstart
+ *
+ * test_intern.c - test suite for init/intern.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/hash.h>
+
+#include "intern.h"
+
+
+void
+test_string (void)
+{
+	void *parent1, *parent2;
+	char *str1, *str2, *str3;
+
+	TEST_FUNCTION ("intern_string");
+	intern_init ();
+
+
+	/* Check that a new string is copied into the table, and that the
+	 * parent is given a reference to it.
+	 */
+	TEST_FEATURE ("with new string");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			parent1 = nih_alloc (NULL, 1);
+		}
+
+		str1 = intern_string (parent1, "frodo");
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (str1, NULL);
+			TEST_EQ_P (nih_hash_lookup (interned, "frodo"), NULL);
+			nih_free (parent1);
+			continue;
+		}
+
+		TEST_EQ_STR (str1, "frodo");
+		TEST_ALLOC_PARENT (str1, parent1);
+		TEST_NE_P (nih_hash_lookup (interned, "frodo"), NULL);
+
+		nih_free (parent1);
+
+		TEST_EQ_P (nih_hash_lookup (interned, "frodo"), NULL);
+	}
+
+
+	/* Check that interning the same string again returns the same
+	 * pointer with an extra reference, and that it remains in the table
+	 * until all references are dropped.
+	 */
+	TEST_FEATURE ("with existing string");
+	parent1 = nih_alloc (NULL, 1);
+	parent2 = nih_alloc (NULL, 1);
+
+	str1 = intern_string (parent1, "bilbo");
+	str2 = intern_string (parent2, "bilbo");
+	str3 = intern_string (parent1, "merry");
+
+	TEST_EQ_P (str1, str2);
+	TEST_NE_P (str1, str3);
+	TEST_ALLOC_PARENT (str1, parent1);
+	TEST_ALLOC_PARENT (str1, parent2);
+
+	nih_free (parent1);
+
+	TEST_NE_P (nih_hash_lookup (interned, "bilbo"), NULL);
+	TEST_EQ_P (nih_hash_lookup (interned, "merry"), NULL);
+	TEST_EQ_STR (str2, "bilbo");
+
+	nih_free (parent2);
+
+	TEST_EQ_P (nih_hash_lookup (interned, "bilbo"), NULL);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_string ();
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* upstart
+ *
+ * test_iowatch.c - test suite for init/iowatch.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/select.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/list.h>
+#include <nih/io.h>
+#include <nih/error.h>
+
+#include "iowatch.h"
+
+
+static int          watcher_called = 0;
+static NihIoEvents  watcher_events = NIH_IO_NONE;
+
+static void
+my_watcher (void        *data,
+	    NihIoWatch  *watch,
+	    NihIoEvents  events)
+{
+	char buf[16];
+
+	watcher_called++;
+	watcher_events = events;
+
+	/* Drain, as edge-triggered watchers must */
+	while (read (watch->fd, buf, sizeof (buf)) > 0)
+		;
+}
+
+static void
+run_loop (void)
+{
+	struct timeval timeout;
+	fd_set         readfds, writefds, exceptfds;
+	int            nfds = 0;
+
+	FD_ZERO (&readfds);
+	FD_ZERO (&writefds);
+	FD_ZERO (&exceptfds);
+
+	nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 100000;
+
+	if (select (nfds, &readfds, &writefds, &exceptfds, &timeout) > 0)
+		nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+}
+
+
+void
+test_adopt (void)
+{
+	NihIoWatch *watch;
+	int         fds[2];
+	int         ret;
+
+	TEST_FUNCTION ("iowatch_adopt");
+	nih_io_init ();
+
+	assert0 (pipe (fds));
+	fcntl (fds[0], F_SETFL, O_NONBLOCK);
+
+
+	/* Check that a watch is left in the select() set when there is
+	 * no epoll instance.
+	 */
+	TEST_FEATURE ("without epoll instance");
+	watch = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				  my_watcher, NULL);
+
+	ret = iowatch_adopt (watch);
+
+	TEST_LT (ret, 0);
+	TEST_LIST_NOT_EMPTY (&watch->entry);
+
+	nih_free (watch);
+
+
+	/* Check that an adopted watch is taken out of the select() set
+	 * and its watcher is called through the epoll instance when the
+	 * descriptor becomes readable.
+	 */
+	TEST_FEATURE ("with readable descriptor");
+	assert0 (iowatch_init ());
+	TEST_GE (iowatch_epoll, 0);
+
+	watch = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				  my_watcher, NULL);
+
+	ret = iowatch_adopt (watch);
+
+	TEST_EQ (ret, 0);
+	TEST_LIST_EMPTY (&watch->entry);
+
+	watcher_called = 0;
+	watcher_events = NIH_IO_NONE;
+
+	assert (write (fds[1], "test", 4) == 4);
+	run_loop ();
+
+	TEST_EQ (watcher_called, 1);
+	TEST_EQ (watcher_events, NIH_IO_READ);
+
+
+	/* Check that, being edge-triggered, the watcher isn't called
+	 * again until more data arrives.
+	 */
+	TEST_FEATURE ("with no further data");
+	watcher_called = 0;
+
+	run_loop ();
+
+	TEST_EQ (watcher_called, 0);
+
+
+	/* Check that the watcher is no longer called once the watch has
+	 * been freed.
+	 */
+	TEST_FEATURE ("with freed watch");
+	nih_free (watch);
+
+	watcher_called = 0;
+
+	assert (write (fds[1], "test", 4) == 4);
+	run_loop ();
+
+	TEST_EQ (watcher_called, 0);
+
+
+	/* Check that closing the epoll instance returns adopted watches
+	 * to the select() set.
+	 */
+	TEST_FEATURE ("with epoll instance closed");
+	watch = nih_io_add_watch (NULL, fds[0], NIH_IO_READ,
+				  my_watcher, NULL);
+	assert0 (iowatch_adopt (watch));
+
+	iowatch_close ();
+
+	TEST_LT (iowatch_epoll, 0);
+	TEST_LIST_NOT_EMPTY (&watch->entry);
+
+	watcher_called = 0;
+
+	run_loop ();
+
+	TEST_EQ (watcher_called, 1);
+
+	nih_free (watch);
+
+	close (fds[0]);
+	close (fds[1]);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	nih_error_init ();
+
+	test_adopt ();
+
+	return 0;
+}
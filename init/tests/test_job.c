@@ -533,7 +533,7 @@ test_change_goal (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_START);
 
@@ -558,7 +558,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_START);
 
@@ -583,7 +583,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job_change_goal (job, JOB_STOP);
 
@@ -653,7 +653,7 @@ test_change_goal (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		job_change_goal (job, JOB_STOP);
 
@@ -708,6 +708,7 @@ test_change_state (void)
 	char             dirname[PATH_MAX], filename[PATH_MAX];
 	char           **env1, **env2, **env3;
 	Process         *tmp, *fail;
+	Deadline        *timer;
 	pid_t            pid, dbus_pid;
 	DBusError        dbus_error;
 	DBusConnection  *conn, *client_conn;
@@ -1066,7 +1067,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SECURITY;
-		job->pid[PROCESS_PRE_START] = 0;
+		job_process_set_pid (job, PROCESS_PRE_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1133,7 +1134,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SECURITY;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1209,7 +1210,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SECURITY;
-		job->pid[PROCESS_PRE_START] = 0;
+		job_process_set_pid (job, PROCESS_PRE_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1297,7 +1298,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1367,7 +1368,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1449,7 +1450,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1590,7 +1591,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1679,7 +1680,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1747,8 +1748,8 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1815,7 +1816,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1879,7 +1880,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -1951,7 +1952,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2012,7 +2013,7 @@ test_change_state (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2080,8 +2081,8 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 0;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2148,7 +2149,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2221,7 +2222,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2306,7 +2307,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -2387,7 +2388,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -3061,7 +3062,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_STOPPING;
-		job->pid[PROCESS_POST_STOP] = 0;
+		job_process_set_pid (job, PROCESS_POST_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -3125,7 +3126,7 @@ test_change_state (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_POST_STOP] = 0;
+		job_process_set_pid (job, PROCESS_POST_STOP, 0);
 
 		job->blocker = NULL;
 		cause->failed = FALSE;
@@ -3782,6 +3783,55 @@ test_change_state (void)
 	}
 
 
+	/* Check that a job respawned with a delay waits in post-stop
+	 * rather than moving to starting, with a timer to start it once
+	 * the delay has passed, and that stopping it then makes the
+	 * timer due so that the job finishes stopping from the main
+	 * loop rather than being freed under the caller.
+	 */
+	TEST_FEATURE ("post-stop to starting with respawn delay");
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_POST_STOP;
+	job->respawn_delay = 5;
+
+	TEST_FREE_TAG (job);
+
+	job_change_state (job, JOB_STARTING);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_POST_STOP);
+	TEST_EQ (job->respawn_delay, 0);
+
+	TEST_ALLOC_SIZE (job->respawn_timer, sizeof (Deadline));
+	TEST_ALLOC_PARENT (job->respawn_timer, job);
+	TEST_EQ (job->respawn_timer->timeout, 5);
+
+	TEST_EQ_P (job->blocker, NULL);
+	TEST_LIST_EMPTY (events);
+
+	timer = job->respawn_timer;
+	TEST_FREE_TAG (timer);
+
+	job_change_goal (job, JOB_STOP);
+
+	TEST_NOT_FREE (job);
+	TEST_EQ (job->state, JOB_POST_STOP);
+	TEST_EQ_P (job->respawn_timer, timer);
+
+	deadline_poll ();
+
+	TEST_FREE (timer);
+	TEST_FREE (job);
+
+	event = (Event *)events->next;
+	TEST_ALLOC_SIZE (event, sizeof (Event));
+	TEST_EQ_STR (event->name, "stopped");
+	nih_free (event);
+
+	TEST_LIST_EMPTY (events);
+
+
 	/* Check that a job which has a better replacement can move from
 	 * post-stop to waiting, and be removed from the jobs hash table
 	 * and replaced by the better one.
@@ -4188,7 +4238,7 @@ test_next_state (void)
 	TEST_FEATURE ("with running job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_RUNNING;
-	job->pid[PROCESS_MAIN] = 1;
+	job_process_set_pid (job, PROCESS_MAIN, 1);
 
 	TEST_EQ (job_next_state (job), JOB_PRE_STOPPING);
 
@@ -4199,7 +4249,7 @@ test_next_state (void)
 	TEST_FEATURE ("with pre-stopping job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_PRE_STOPPING;
-	job->pid[PROCESS_MAIN] = 1;
+	job_process_set_pid (job, PROCESS_MAIN, 1);
 
 	TEST_EQ (job_next_state (job), JOB_PRE_STOP);
 
@@ -4211,7 +4261,7 @@ test_next_state (void)
 	TEST_FEATURE ("with dead running job and a goal of stop");
 	job->goal = JOB_STOP;
 	job->state = JOB_RUNNING;
-	job->pid[PROCESS_MAIN] = 0;
+	job_process_set_pid (job, PROCESS_MAIN, 0);
 
 	TEST_EQ (job_next_state (job), JOB_STOPPING);
 
@@ -4544,10 +4594,11 @@ test_finished (void)
 void
 test_emit_event (void)
 {
-	JobClass *class;
+	JobClass *class, *other;
 	Job      *job;
 	Event    *event;
 	Blocked  *blocked;
+	char    **env;
 
 	TEST_FUNCTION ("job_emit_event");
 
@@ -5673,6 +5724,76 @@ test_emit_event (void)
 	}
 
 	nih_free (class);
+
+
+	/* Check that, with quiet job events, the started event of a job
+	 * that no start on condition names is not queued.
+	 */
+	TEST_FEATURE ("with quiet unobserved event");
+	job_quiet_events = TRUE;
+
+	class = job_class_new (NULL, "test", NULL);
+	job_class_add_safe (class);
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+
+	other = job_class_new (NULL, "other", NULL);
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "wibble"));
+	other->start_on = event_operator_new (other, EVENT_MATCH,
+					      "started", env);
+	job_class_add_safe (other);
+
+	TEST_LIST_EMPTY (events);
+
+	event = job_emit_event (job);
+
+	TEST_EQ_P (event, NULL);
+	TEST_LIST_EMPTY (events);
+
+	nih_free (other);
+
+
+	/* Check that the event is queued as usual when a start on condition
+	 * could match it.
+	 */
+	TEST_FEATURE ("with quiet observed event");
+	other = job_class_new (NULL, "other", NULL);
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "test"));
+	other->start_on = event_operator_new (other, EVENT_MATCH,
+					      "started", env);
+	job_class_add_safe (other);
+
+	event = job_emit_event (job);
+
+	TEST_NE_P (event, NULL);
+	TEST_EQ_STR (event->name, "started");
+	TEST_EQ_STR (event->env[0], "JOB=test");
+
+	nih_free (event);
+	nih_free (other);
+
+
+	/* Check that the stopping event, which blocks the job, is always
+	 * queued.
+	 */
+	TEST_FEATURE ("with quiet stopping event");
+	job->goal = JOB_STOP;
+	job->state = JOB_STOPPING;
+
+	event = job_emit_event (job);
+
+	TEST_NE_P (event, NULL);
+	TEST_EQ_STR (event->name, "stopping");
+	TEST_LIST_NOT_EMPTY (&event->blocking);
+
+	nih_free (event);
+	nih_free (class);
+
+	job_quiet_events = FALSE;
 }
 
 
@@ -5988,6 +6109,110 @@ test_state_from_name (void)
 	TEST_EQ (state, (JobState)-1);
 }
 
+void
+test_timeline (void)
+{
+	JobClass                *class;
+	Job                     *job;
+	const JobTimelineRecord *record;
+	size_t                   count;
+
+	TEST_FUNCTION ("job_timeline_add");
+	class = job_class_new (NULL, "foo", NULL);
+	job = job_new (class, "bar");
+	job->state = JOB_STARTING;
+
+
+	/* Check that a state record takes the current state of the job,
+	 * and is appended to the timeline with the names of the job and
+	 * instance.
+	 */
+	TEST_FEATURE ("with state record");
+	count = job_timeline_count ();
+
+	job_timeline_add (job, JOB_TIMELINE_STATE, PROCESS_MAIN);
+
+	if (count < JOB_TIMELINE_SIZE)
+		count++;
+
+	TEST_EQ (job_timeline_count (), count);
+
+	record = job_timeline_get (count - 1);
+	TEST_NE_P (record, NULL);
+	TEST_EQ_STR (record->job, "foo");
+	TEST_EQ_STR (record->instance, "bar");
+	TEST_EQ (record->type, JOB_TIMELINE_STATE);
+	TEST_EQ (record->state, JOB_STARTING);
+	TEST_EQ (record->process, PROCESS_INVALID);
+
+	TEST_EQ_P (job_timeline_get (count), NULL);
+
+
+	/* Check that a spawn record gives the process spawned. */
+	TEST_FEATURE ("with spawn record");
+	job_timeline_add (job, JOB_TIMELINE_SPAWN, PROCESS_MAIN);
+
+	if (count < JOB_TIMELINE_SIZE)
+		count++;
+
+	record = job_timeline_get (count - 1);
+	TEST_NE_P (record, NULL);
+	TEST_EQ (record->type, JOB_TIMELINE_SPAWN);
+	TEST_EQ (record->process, PROCESS_MAIN);
+
+
+	/* Check that an event record gives the name of the event in place
+	 * of the job, with an empty instance.
+	 */
+	TEST_FEATURE ("with event record");
+	job_timeline_add_event ("wibble");
+
+	if (count < JOB_TIMELINE_SIZE)
+		count++;
+
+	record = job_timeline_get (count - 1);
+	TEST_NE_P (record, NULL);
+	TEST_EQ_STR (record->job, "wibble");
+	TEST_EQ_STR (record->instance, "");
+	TEST_EQ (record->type, JOB_TIMELINE_EVENT);
+	TEST_EQ (record->process, PROCESS_INVALID);
+
+
+	/* Check that once the timeline is full, the oldest records are
+	 * replaced so that the count never exceeds JOB_TIMELINE_SIZE and
+	 * the newest record is still last.
+	 */
+	TEST_FEATURE ("with full timeline");
+	job->state = JOB_RUNNING;
+
+	for (int i = 0; i < JOB_TIMELINE_SIZE; i++)
+		job_timeline_add (job, JOB_TIMELINE_EXEC, PROCESS_MAIN);
+
+	job_timeline_add (job, JOB_TIMELINE_STATE, PROCESS_INVALID);
+
+	TEST_EQ (job_timeline_count (), JOB_TIMELINE_SIZE);
+
+	record = job_timeline_get (JOB_TIMELINE_SIZE - 1);
+	TEST_EQ (record->type, JOB_TIMELINE_STATE);
+	TEST_EQ (record->state, JOB_RUNNING);
+
+	record = job_timeline_get (0);
+	TEST_EQ (record->type, JOB_TIMELINE_EXEC);
+
+	TEST_EQ_P (job_timeline_get (JOB_TIMELINE_SIZE), NULL);
+
+
+	/* Check that the records keep their names after the job and its
+	 * class have been freed.
+	 */
+	TEST_FEATURE ("with freed job");
+	nih_free (class);
+
+	record = job_timeline_get (JOB_TIMELINE_SIZE - 1);
+	TEST_EQ_STR (record->job, "foo");
+	TEST_EQ_STR (record->instance, "bar");
+}
+
 
 void
 test_start (void)
@@ -7066,6 +7291,149 @@ test_get_state (void)
 }
 
 
+void
+test_get_stats (void)
+{
+	NihDBusMessage           *message = NULL;
+	JobClass                 *class = NULL;
+	Job                      *job = NULL;
+	NihError                 *error;
+	JobGetStatsStatsElement **stats;
+	char                      dirname[PATH_MAX];
+	char                      filename[PATH_MAX];
+	FILE                     *output;
+	int                       ret;
+
+	TEST_FUNCTION ("job_get_stats");
+	nih_error_init ();
+	job_class_init ();
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0700);
+
+	sprintf (filename, "%s/cpu.stat", dirname);
+	output = fopen (filename, "w");
+	fprintf (output, "usage_usec 1234\n");
+	fprintf (output, "user_usec 1000\n");
+	fprintf (output, "system_usec 234\n");
+	fclose (output);
+
+	sprintf (filename, "%s/memory.peak", dirname);
+	output = fopen (filename, "w");
+	fprintf (output, "8192\n");
+	fclose (output);
+
+	sprintf (filename, "%s/io.stat", dirname);
+	output = fopen (filename, "w");
+	fprintf (output, "8:0 rbytes=100 wbytes=20 rios=1 wios=1\n");
+	fprintf (output, "8:16 rbytes=50 wbytes=5 rios=1 wios=1\n");
+	fclose (output);
+
+
+	/* Check that the resources used by an instance followed in a
+	 * cgroup are read from it and returned as an array of name and
+	 * value pairs, as a child of the message, with the amounts for
+	 * each device summed.
+	 */
+	TEST_FEATURE ("with cgroup");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			class = job_class_new (NULL, "test", NULL);
+			job = job_new (class, "");
+			job->goal = JOB_START;
+			job->state = JOB_RUNNING;
+			job->trace_cgroup = nih_strdup (job, dirname);
+
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
+
+		stats = NULL;
+
+		ret = job_get_stats (job, message, &stats);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+
+			nih_free (message);
+			nih_free (class);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_ALLOC_PARENT (stats, message);
+		TEST_ALLOC_SIZE (stats, sizeof (JobGetStatsStatsElement *) * 5);
+
+		TEST_EQ_STR (stats[0]->item0, "cpu_usec");
+		TEST_EQ (stats[0]->item1, 1234);
+		TEST_EQ_STR (stats[1]->item0, "memory_peak");
+		TEST_EQ (stats[1]->item1, 8192);
+		TEST_EQ_STR (stats[2]->item0, "io_read_bytes");
+		TEST_EQ (stats[2]->item1, 150);
+		TEST_EQ_STR (stats[3]->item0, "io_write_bytes");
+		TEST_EQ (stats[3]->item1, 25);
+		TEST_EQ_P (stats[4], NULL);
+
+		nih_free (message);
+		nih_free (class);
+	}
+
+
+	/* Check that an instance without any cgroup returns an empty
+	 * array.
+	 */
+	TEST_FEATURE ("without cgroup");
+	TEST_ALLOC_FAIL {
+		TEST_ALLOC_SAFE {
+			class = job_class_new (NULL, "test", NULL);
+			job = job_new (class, "");
+
+			message = nih_new (NULL, NihDBusMessage);
+			message->connection = NULL;
+			message->message = NULL;
+		}
+
+		stats = NULL;
+
+		ret = job_get_stats (job, message, &stats);
+
+		if (test_alloc_failed) {
+			TEST_LT (ret, 0);
+
+			error = nih_error_get ();
+			TEST_EQ (error->number, ENOMEM);
+			nih_free (error);
+
+			nih_free (message);
+			nih_free (class);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_ALLOC_PARENT (stats, message);
+		TEST_EQ_P (stats[0], NULL);
+
+		nih_free (message);
+		nih_free (class);
+	}
+
+	sprintf (filename, "%s/cpu.stat", dirname);
+	unlink (filename);
+	sprintf (filename, "%s/memory.peak", dirname);
+	unlink (filename);
+	sprintf (filename, "%s/io.stat", dirname);
+	unlink (filename);
+	rmdir (dirname);
+}
+
+
 void
 test_get_processes (void)
 {
@@ -7138,7 +7506,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_START;
-			job->pid[PROCESS_PRE_START] = 1014;
+			job_process_set_pid (job, PROCESS_PRE_START, 1014);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7193,7 +7561,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_START;
-			job->pid[PROCESS_POST_START] = 2137;
+			job_process_set_pid (job, PROCESS_POST_START, 2137);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7247,7 +7615,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_RUNNING;
-			job->pid[PROCESS_MAIN] = 3648;
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7304,8 +7672,8 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_START;
-			job->pid[PROCESS_POST_START] = 2137;
-			job->pid[PROCESS_MAIN] = 3648;
+			job_process_set_pid (job, PROCESS_POST_START, 2137);
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7368,8 +7736,8 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_STOP;
-			job->pid[PROCESS_MAIN] = 3648;
-			job->pid[PROCESS_PRE_STOP] = 7864;
+			job_process_set_pid (job, PROCESS_MAIN, 3648);
+			job_process_set_pid (job, PROCESS_PRE_STOP, 7864);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7430,7 +7798,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_PRE_STOP;
-			job->pid[PROCESS_PRE_STOP] = 7864;
+			job_process_set_pid (job, PROCESS_PRE_STOP, 7864);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7484,7 +7852,7 @@ test_get_processes (void)
 			job = job_new (class, "");
 			job->goal = JOB_START;
 			job->state = JOB_POST_STOP;
-			job->pid[PROCESS_POST_STOP] = 9764;
+			job_process_set_pid (job, PROCESS_POST_STOP, 9764);
 
 			message = nih_new (NULL, NihDBusMessage);
 			message->connection = NULL;
@@ -7587,7 +7955,7 @@ test_deserialise_ptrace (void)
 		TEST_NE_P (job, NULL);
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 		job->trace_forks = 0;
 		job->trace_state = TRACE_NORMAL;
 
@@ -7979,6 +8347,7 @@ main (int   argc,
 	test_goal_from_name ();
 	test_state_name ();
 	test_state_from_name ();
+	test_timeline ();
 
 	test_start ();
 	test_stop ();
@@ -7988,6 +8357,7 @@ main (int   argc,
 	test_get_name ();
 	test_get_goal ();
 	test_get_state ();
+	test_get_stats ();
 
 	test_get_processes ();
 
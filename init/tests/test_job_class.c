@@ -158,6 +158,187 @@ test_new (void)
 }
 
 
+void
+test_subscription (void)
+{
+	JobClass        *class;
+	Job             *job;
+	EventOperator   *oper;
+	JobSubscription *sub;
+
+	TEST_FUNCTION ("job_subscription_add");
+	job_class_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+
+	class->start_on = event_operator_new (class, EVENT_OR, NULL, NULL);
+
+	oper = event_operator_new (class->start_on, EVENT_MATCH,
+				   "wibble", NULL);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_LEFT);
+
+	oper = event_operator_new (class->start_on, EVENT_MATCH,
+				   "wibble", NULL);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_RIGHT);
+
+	class->stop_on = event_operator_new (class, EVENT_MATCH,
+					     "wobble", NULL);
+
+
+	/* Check that each distinct event name in a start on condition
+	 * results in a single subscription for the class.
+	 */
+	TEST_FEATURE ("with class");
+	job_subscription_add (class->start_on, class, NULL);
+
+	sub = (JobSubscription *)nih_hash_search (job_subscriptions,
+						  "wibble", NULL);
+	TEST_NE_P (sub, NULL);
+	TEST_ALLOC_PARENT (sub, class);
+	TEST_EQ_STR (sub->name, "wibble");
+	TEST_EQ_P (sub->class, class);
+	TEST_EQ_P (sub->job, NULL);
+
+	TEST_EQ_P (nih_hash_search (job_subscriptions, "wibble", &sub->entry),
+		   NULL);
+	TEST_EQ_P (nih_hash_lookup (job_subscriptions, "wobble"), NULL);
+
+
+	/* Check that a new instance subscribes to the events in its copy
+	 * of the stop on condition.
+	 */
+	TEST_FEATURE ("with job");
+	job = job_new (class, "");
+
+	sub = (JobSubscription *)nih_hash_lookup (job_subscriptions,
+						  "wobble");
+	TEST_NE_P (sub, NULL);
+	TEST_ALLOC_PARENT (sub, job);
+	TEST_EQ_P (sub->class, NULL);
+	TEST_EQ_P (sub->job, job);
+
+
+	/* Check that freeing a job removes its subscriptions.
+	 */
+	TEST_FEATURE ("with freed job");
+	nih_free (job);
+
+	TEST_EQ_P (nih_hash_lookup (job_subscriptions, "wobble"), NULL);
+
+
+	/* Check that only classes in the job classes table are found by
+	 * the event names in their start on conditions, and that instance
+	 * subscriptions are passed over.
+	 */
+	TEST_FUNCTION ("job_subscription_next_class");
+	TEST_FEATURE ("with class not in table");
+	sub = NULL;
+	TEST_EQ_P (job_subscription_next_class ("wibble", &sub), NULL);
+
+
+	TEST_FEATURE ("with class in table");
+	nih_hash_add (job_classes, &class->entry);
+
+	sub = NULL;
+	TEST_EQ_P (job_subscription_next_class ("wibble", &sub), class);
+	TEST_NE_P (sub, NULL);
+	TEST_EQ_P (job_subscription_next_class ("wibble", &sub), NULL);
+	TEST_EQ_P (sub, NULL);
+
+
+	TEST_FEATURE ("with job");
+	job = job_new (class, "");
+
+	sub = NULL;
+	TEST_EQ_P (job_subscription_next_class ("wobble", &sub), NULL);
+
+	nih_free (job);
+	nih_list_remove (&class->entry);
+
+
+	/* Check that removing the subscriptions of a class leaves no
+	 * entries behind.
+	 */
+	TEST_FUNCTION ("job_subscription_remove");
+	job_subscription_remove (class->start_on, class, NULL);
+
+	TEST_EQ_P (nih_hash_lookup (job_subscriptions, "wibble"), NULL);
+
+	nih_free (class);
+}
+
+
+void
+test_get_registered (void)
+{
+	Session         *session;
+	JobClass        *class1, *class2;
+	JobRegistration *reg;
+	JobClassKey      key;
+
+	TEST_FUNCTION ("job_class_get_registered");
+	session = session_new (NULL, "/abc");
+
+	class1 = job_class_new (NULL, "foo", NULL);
+	class2 = job_class_new (NULL, "foo", session);
+
+
+	/* Check that classes of the same name added for different
+	 * sessions are each registered under their own session, and are
+	 * found by it.
+	 */
+	TEST_FEATURE ("with registered classes");
+	job_class_add_safe (class1);
+	job_class_add_safe (class2);
+
+	key.session = session;
+	key.name = "foo";
+
+	reg = (JobRegistration *)nih_hash_lookup (job_registrations, &key);
+	TEST_NE_P (reg, NULL);
+	TEST_ALLOC_PARENT (reg, class2);
+	TEST_EQ_P (reg->class, class2);
+
+	TEST_EQ_P (job_class_get_registered ("foo", NULL), class1);
+	TEST_EQ_P (job_class_get_registered ("foo", session), class2);
+	TEST_EQ_P (job_class_get_registered ("bar", session), NULL);
+
+
+	/* Check that freeing a class removes its registration.
+	 */
+	TEST_FEATURE ("with freed class");
+	nih_free (class2);
+
+	TEST_EQ_P (nih_hash_lookup (job_registrations, &key), NULL);
+	TEST_EQ_P (job_class_get_registered ("foo", session), NULL);
+
+
+	/* Check that a class placed directly in the job classes table,
+	 * without a registration, is still found.
+	 */
+	TEST_FEATURE ("with class not registered");
+	class2 = job_class_new (NULL, "foo", session);
+	nih_hash_add (job_classes, &class2->entry);
+
+	TEST_EQ_P (job_class_get_registered ("foo", session), class2);
+	TEST_EQ_P (job_class_get_registered ("foo", NULL), class1);
+
+
+	/* Check that a registered class taken out of the table is no
+	 * longer found.
+	 */
+	TEST_FEATURE ("with class removed from table");
+	nih_list_remove (&class1->entry);
+
+	TEST_EQ_P (job_class_get_registered ("foo", NULL), NULL);
+	TEST_EQ_P (job_class_get_registered ("foo", session), class2);
+
+	nih_free (class2);
+	nih_free (class1);
+	nih_free (session);
+}
+
+
 void
 test_consider (void)
 {
@@ -963,6 +1144,7 @@ void
 test_environment (void)
 {
 	JobClass  *class;
+	Job       *job;
 	char     **env;
 	size_t     len;
 
@@ -975,10 +1157,11 @@ test_environment (void)
 	class = job_class_new (NULL, "test", NULL);
 	class->console = CONSOLE_NONE;
 
-	/* necessary to call this initially to avoid disrupting
+	/* necessary to call these initially to avoid disrupting
 	 * TEST_ALLOC_FAIL()'s bookkeeping.
 	 */
 	job_class_environment_init ();
+	nih_free (NIH_MUST (job_class_environment (NULL, class, NULL)));
 
 	TEST_ALLOC_FAIL {
 		env = job_class_environment (NULL, class, &len);
@@ -1015,6 +1198,8 @@ test_environment (void)
 	assert (nih_str_array_add (&(class->env), class, NULL, "FOO=BAR"));
 	assert (nih_str_array_add (&(class->env), class, NULL, "BAR=BAZ"));
 
+	nih_free (NIH_MUST (job_class_environment (NULL, class, NULL)));
+
 	TEST_ALLOC_FAIL {
 		env = job_class_environment (NULL, class, &len);
 
@@ -1054,6 +1239,8 @@ test_environment (void)
 	assert (nih_str_array_add (&(class->env), class, NULL, "BAR=BAZ"));
 	assert (nih_str_array_add (&(class->env), class, NULL, "TERM=elmo"));
 
+	nih_free (NIH_MUST (job_class_environment (NULL, class, NULL)));
+
 	TEST_ALLOC_FAIL {
 		env = job_class_environment (NULL, class, &len);
 
@@ -1080,6 +1267,132 @@ test_environment (void)
 	}
 
 	nih_free (class);
+
+
+	/* Check that instances share the strings of the environment, and
+	 * that changes to the global job environment are picked up.
+	 */
+	TEST_FEATURE ("with changed global environment");
+	job_class_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+
+	class->env = nih_str_array_new (class);
+	assert (nih_str_array_add (&(class->env), class, NULL, "FOO=BAR"));
+
+	env = job_class_environment (NULL, class, &len);
+	TEST_EQ (len, 3);
+
+	{
+		nih_local char **env2 = NULL;
+
+		env2 = job_class_environment (NULL, class, NULL);
+		TEST_EQ_P (env2[2], env[2]);
+	}
+
+	nih_free (env);
+
+	assert0 (job_class_environment_set ("WIBBLE=wobble", TRUE));
+
+	env = job_class_environment (NULL, class, &len);
+	TEST_EQ (len, 4);
+	TEST_EQ_STR (env[2], "WIBBLE=wobble");
+	TEST_EQ_STR (env[3], "FOO=BAR");
+	TEST_EQ_P (env[4], NULL);
+	nih_free (env);
+
+	assert0 (job_class_environment_unset ("WIBBLE"));
+
+	env = job_class_environment (NULL, class, &len);
+	TEST_EQ (len, 3);
+	TEST_EQ_STR (env[2], "FOO=BAR");
+	nih_free (env);
+
+	nih_free (class);
+
+
+	/* Check that a list of variables is set in and then removed from
+	 * both the global job environment and that of running jobs, an
+	 * existing variable only being replaced if requested.
+	 */
+	TEST_FEATURE ("with list of global environment changes");
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	nih_hash_add (job_classes, &class->entry);
+
+	job = job_new (class, "");
+	job->env = nih_str_array_new (job);
+	assert (nih_str_array_add (&job->env, job, NULL, "WIBBLE=old"));
+
+	{
+		char *vars[] = { "WIBBLE=wobble", "WOBBLE=wibble", NULL };
+		char *names[] = { "WIBBLE", "WOBBLE", NULL };
+
+		assert0 (job_class_environment_set_list (vars, FALSE));
+
+		TEST_EQ_STR (job_class_environment_get ("WIBBLE"), "wobble");
+		TEST_EQ_STR (job_class_environment_get ("WOBBLE"), "wibble");
+
+		TEST_EQ_STR (job->env[0], "WIBBLE=old");
+		TEST_EQ_STR (job->env[1], "WOBBLE=wibble");
+		TEST_EQ_P (job->env[2], NULL);
+
+		assert0 (job_class_environment_set_list (vars, TRUE));
+
+		TEST_EQ_STR (job->env[0], "WIBBLE=wobble");
+
+		assert0 (job_class_environment_unset_list (names));
+
+		TEST_EQ_P (job_class_environment_get ("WIBBLE"), NULL);
+		TEST_EQ_P (job_class_environment_get ("WOBBLE"), NULL);
+		TEST_EQ_P (job->env[0], NULL);
+	}
+
+	nih_free (class);
+}
+
+
+void
+test_instance_name (void)
+{
+	JobClass   *class;
+	const char *name;
+	char       *env[3];
+
+	TEST_FUNCTION ("job_class_instance_name");
+	env[0] = "FOO=foo";
+	env[1] = "BAR=bar";
+	env[2] = NULL;
+
+	/* Check that the instance pattern is compiled on first use and
+	 * the name expanded into the template's buffer.
+	 */
+	TEST_FEATURE ("with new class");
+	class = job_class_new (NULL, "test", NULL);
+	class->instance = "$FOO";
+
+	TEST_EQ_P (class->instance_template, NULL);
+
+	name = job_class_instance_name (class, env);
+
+	TEST_EQ_STR (name, "foo");
+	TEST_NE_P (class->instance_template, NULL);
+	TEST_ALLOC_PARENT (class->instance_template, class);
+	TEST_EQ_P (name, class->instance_template->buf);
+
+
+	/* Check that a changed instance pattern is compiled again.
+	 */
+	TEST_FEATURE ("with changed pattern");
+	class->instance = "$FOO-$BAR";
+
+	name = job_class_instance_name (class, env);
+
+	TEST_EQ_STR (name, "foo-bar");
+	TEST_EQ_STR (class->instance_template->source, "$FOO-$BAR");
+
+	nih_free (class);
 }
 
 
@@ -3026,6 +3339,102 @@ test_restart (void)
 }
 
 
+static JobClass *
+event_block_class (void)
+{
+	JobClass      *class;
+	EventOperator *oper;
+
+	class = job_class_new (NULL, "test", NULL);
+
+	class->start_on = event_operator_new (class, EVENT_AND, NULL, NULL);
+
+	oper = event_operator_new (class->start_on, EVENT_MATCH, "foo", NULL);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_LEFT);
+
+	oper = event_operator_new (class->start_on, EVENT_MATCH, "bar", NULL);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_RIGHT);
+
+	return class;
+}
+
+void
+test_event_block (void)
+{
+	JobClass *old;
+	JobClass *new;
+	Event    *event;
+
+	TEST_FUNCTION ("job_class_event_block");
+	job_class_init ();
+	event_init ();
+
+
+	/* Check that an event blocked by the start on condition of the
+	 * class being replaced is also blocked by the matching operator of
+	 * the new class, and counted all the way to its root, so that once
+	 * the old class is released a reset of the new condition unblocks
+	 * the event rather than skipping it.
+	 */
+	TEST_FEATURE ("with event blocked by old class");
+	event = event_new (NULL, "foo", NULL);
+
+	old = event_block_class ();
+	new = event_block_class ();
+
+	TEST_TRUE (event_operator_handle (old->start_on, event, NULL));
+	TEST_EQ (event->blockers, 1);
+
+	job_class_event_block (NULL, old, new);
+
+	TEST_EQ (event->blockers, 2);
+	TEST_EQ_P (((EventOperator *)new->start_on->node.left)->event, event);
+	TEST_EQ (new->start_on->held, 1);
+	TEST_FALSE (new->start_on->value);
+
+	nih_free (old);
+
+	TEST_EQ (event->blockers, 1);
+
+	event_operator_reset (new->start_on);
+
+	TEST_EQ (event->blockers, 0);
+	TEST_EQ_P (((EventOperator *)new->start_on->node.left)->event, NULL);
+
+	nih_free (new);
+
+	TEST_EQ (event->blockers, 0);
+
+	nih_free (event);
+
+
+	/* Check that no event is blocked by the new class when the old one
+	 * still has instances, since it will not be replaced.
+	 */
+	TEST_FEATURE ("with instances of old class");
+	event = event_new (NULL, "foo", NULL);
+
+	old = event_block_class ();
+	new = event_block_class ();
+
+	TEST_TRUE (event_operator_handle (old->start_on, event, NULL));
+	job_new (old, "");
+
+	job_class_event_block (NULL, old, new);
+
+	TEST_EQ (event->blockers, 1);
+	TEST_EQ_P (((EventOperator *)new->start_on->node.left)->event, NULL);
+	TEST_EQ (new->start_on->held, 0);
+
+	nih_free (new);
+	nih_free (old);
+
+	TEST_EQ (event->blockers, 0);
+
+	nih_free (event);
+}
+
+
 void
 test_get_name (void)
 {
@@ -3776,6 +4185,99 @@ test_get_emits (void)
 }
 
 
+void
+test_pool (void)
+{
+	JobClass *class;
+	Job      *job1, *job2;
+
+	TEST_FUNCTION ("job_class_pool_fill");
+	nih_error_init ();
+	nih_main_loop_init ();
+	event_init ();
+	job_class_init ();
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	class->instance = nih_strdup (class, "$ID");
+	class->pool = 2;
+
+
+	/* Check that a class that isn't registered isn't filled, since
+	 * it may be about to be replaced.
+	 */
+	TEST_FEATURE ("with unregistered class");
+	job_class_pool_fill (class);
+
+	TEST_HASH_EMPTY (class->instances);
+
+
+	/* Check that filling a registered class starts as many spare
+	 * instances as its pool asks for, each marked as such and given
+	 * a name of its own.
+	 */
+	TEST_FEATURE ("with registered class");
+	job_class_add_safe (class);
+
+	job_class_pool_fill (class);
+
+	job1 = (Job *)nih_hash_lookup (class->instances, "pool-1");
+	TEST_NE_P (job1, NULL);
+	TEST_TRUE (job1->pooled);
+	TEST_EQ (job1->goal, JOB_START);
+	TEST_EQ (job1->state, JOB_STARTING);
+	TEST_FALSE (job_parked (job1));
+
+	job2 = (Job *)nih_hash_lookup (class->instances, "pool-2");
+	TEST_NE_P (job2, NULL);
+	TEST_TRUE (job2->pooled);
+	TEST_EQ (job2->goal, JOB_START);
+
+
+	/* Check that filling a pool that is already full does nothing.
+	 */
+	TEST_FEATURE ("with full pool");
+	job_class_pool_fill (class);
+
+	TEST_EQ_P (nih_hash_lookup (class->instances, "pool-3"), NULL);
+
+
+	/* Check that renaming a spare moves it to the new name in the
+	 * instances table, with a path to match.
+	 */
+	TEST_FUNCTION ("job_rename");
+	TEST_EQ (job_rename (job1, "foo"), 0);
+
+	TEST_EQ_STR (job1->name, "foo");
+	TEST_EQ_STR (job1->path, DBUS_PATH_UPSTART "/jobs/test/foo");
+	TEST_EQ_P (nih_hash_lookup (class->instances, "foo"), job1);
+	TEST_EQ_P (nih_hash_lookup (class->instances, "pool-1"), NULL);
+
+
+	/* Check that draining the pool stops the spares from the main
+	 * loop rather than at once.
+	 */
+	TEST_FUNCTION ("job_class_pool_drain");
+	job_class_pool_drain (class);
+
+	TEST_ALLOC_PARENT (job1->pool_timer, job1);
+	TEST_ALLOC_PARENT (job2->pool_timer, job2);
+	TEST_EQ (job1->goal, JOB_START);
+
+	deadline_poll ();
+
+	TEST_EQ_P (job1->pool_timer, NULL);
+	TEST_EQ_P (job2->pool_timer, NULL);
+	TEST_EQ (job1->goal, JOB_STOP);
+	TEST_EQ (job2->goal, JOB_STOP);
+
+	while (! NIH_LIST_EMPTY (events))
+		nih_free (events->next);
+
+	nih_free (class);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -3784,11 +4286,14 @@ main (int   argc,
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
 	test_new ();
+	test_subscription ();
+	test_get_registered ();
 	test_consider ();
 	test_reconsider ();
 	test_register ();
 	test_unregister ();
 	test_environment ();
+	test_instance_name ();
 
 	test_get_instance ();
 	test_get_instance_by_name ();
@@ -3797,6 +4302,8 @@ main (int   argc,
 	test_start ();
 	test_stop ();
 	test_restart ();
+	test_pool ();
+	test_event_block ();
 
 	test_get_name ();
 	test_get_description ();
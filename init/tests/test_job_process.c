@@ -224,6 +224,9 @@ static void close_all_files (void);
 static int child_exit_status[PROCESS_LAST];
 static int child_exit_after;
 
+extern int use_pidfd;
+extern char *expect_cgroup;
+
 /**
  * test_job_process_handler:
  *
@@ -495,6 +498,7 @@ test_start (void)
 	struct stat      statbuf;
 	char             filename[PATH_MAX], buf[80];
 	char             fifoname[PATH_MAX];
+	char             cgroupdir[PATH_MAX];
 	char             function[PATH_MAX];
 	int              status;
 	siginfo_t        info;
@@ -638,6 +642,54 @@ test_start (void)
 	}
 
 
+	/* Check that a script consisting of a single simple command is
+	 * executed directly rather than by a shell when the job class
+	 * allows it.
+	 */
+	TEST_FEATURE ("with simple script and shell auto");
+	TEST_HASH_EMPTY (job_classes);
+	{
+		ssize_t len;
+		int     fd;
+
+		class = job_class_new (NULL, "test", NULL);
+		class->console = CONSOLE_NONE;
+		class->shell_auto = TRUE;
+		class->process[PROCESS_MAIN] = process_new (class);
+		class->process[PROCESS_MAIN]->script = TRUE;
+		class->process[PROCESS_MAIN]->simple = TRUE;
+		class->process[PROCESS_MAIN]->command = nih_strdup (
+			class->process[PROCESS_MAIN],
+			"# comment\nexec sleep 999\n");
+
+		job = job_new (class, "");
+		job->goal = JOB_START;
+		job->state = JOB_SPAWNED;
+
+		job_process_start (job, PROCESS_MAIN);
+
+		TEST_NE (job->pid[PROCESS_MAIN], 0);
+
+		/* Spawned without copying our address space, so the
+		 * process has already been executed.
+		 */
+		sprintf (buf, "/proc/%d/cmdline", job->pid[PROCESS_MAIN]);
+		fd = open (buf, O_RDONLY);
+		TEST_GE (fd, 0);
+		len = read (fd, filebuf, sizeof (filebuf));
+		close (fd);
+
+		TEST_EQ (len, sizeof ("sleep\0" "999"));
+		TEST_EQ_MEM (filebuf, "sleep\0" "999", len);
+
+		kill (job->pid[PROCESS_MAIN], SIGTERM);
+		waitpid (job->pid[PROCESS_MAIN], &status, 0);
+		TEST_TRUE (WIFSIGNALED (status));
+
+		nih_free (class);
+	}
+
+
 	/* Check that we can run a small shell script that has many newlines
 	 * to be stripped from the end before passing it on the command-line.
 	 */
@@ -1162,6 +1214,60 @@ test_start (void)
 	}
 
 
+	/* Check that a forking job is not traced when expect_cgroup is
+	 * set, but that the main process creates a cgroup named after
+	 * itself below that directory before anything else, and that the
+	 * job remembers it.  The directory here is not a cgroup, so
+	 * moving into it fails and the process exits.
+	 */
+	TEST_FEATURE ("with forking job followed by cgroup");
+	TEST_HASH_EMPTY (job_classes);
+
+	TEST_FILENAME (cgroupdir);
+	assert0 (mkdir (cgroupdir, 0755));
+	expect_cgroup = cgroupdir;
+
+	class = job_class_new (NULL, "test", NULL);
+	class->console = CONSOLE_NONE;
+	class->expect = EXPECT_FORK;
+	class->process[PROCESS_MAIN] = process_new (class);
+	class->process[PROCESS_MAIN]->script = FALSE;
+	class->process[PROCESS_MAIN]->command = "true";
+
+	job = job_new (class, "");
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+
+	job->trace_forks = 2;
+	job->trace_state = TRACE_NORMAL;
+
+	job_process_start (job, PROCESS_MAIN);
+
+	TEST_EQ (job->trace_forks, 0);
+	TEST_EQ (job->trace_state, TRACE_CGROUP);
+
+	pid = job->pid[PROCESS_MAIN];
+	TEST_NE (pid, 0);
+
+	sprintf (filename, "%s/%d", cgroupdir, pid);
+	TEST_EQ_STR (job->trace_cgroup, filename);
+
+	assert0 (waitid (P_PID, pid, &info, WEXITED | WSTOPPED));
+	TEST_EQ (info.si_pid, pid);
+	TEST_EQ (info.si_code, CLD_EXITED);
+	TEST_NE (info.si_status, 0);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_TRUE (S_ISDIR (statbuf.st_mode));
+
+	nih_free (class);
+
+	expect_cgroup = NULL;
+
+	assert0 (rmdir (filename));
+	assert0 (rmdir (cgroupdir));
+
+
 	/* Check that if we try and run a command that doesn't exist,
 	 * job_process_start() raises a ProcessError and the command doesn't
 	 * have any stored process id for it.
@@ -4557,6 +4663,98 @@ test_spawn (void)
 	nih_free (class);
 
 
+	/* Check that a simple process spawned without copying our address
+	 * space reports a failure to exec the binary over the child setup
+	 * pipe in the same way as a fork()ed one.
+	 */
+	TEST_FEATURE ("with no such file and no console");
+	TEST_HASH_EMPTY (job_classes);
+	{
+		JobProcessError *perr;
+		char            *missing[2];
+
+		missing[0] = filename;
+		missing[1] = NULL;
+
+		class = job_class_new (NULL, "test", NULL);
+		class->console = CONSOLE_NONE;
+		job   = job_new (class, "");
+
+		pid = job_process_spawn_with_fd (job, missing, NULL, FALSE, -1,
+				PROCESS_MAIN, &job_process_fd);
+		TEST_GT (pid, 0);
+
+		assert0 (waitid (P_PID, pid, &info, WEXITED));
+		TEST_EQ (info.si_code, CLD_EXITED);
+		TEST_EQ (info.si_status, 255);
+
+		buffer = read_from_fd (NULL, job_process_fd);
+		TEST_NE_P (buffer, NULL);
+		job_process_error_handler (buffer->buf, buffer->len);
+
+		err = nih_error_get ();
+		TEST_EQ (err->number, JOB_PROCESS_ERROR);
+
+		perr = (JobProcessError *)err;
+		TEST_EQ (perr->type, JOB_PROCESS_ERROR_EXEC);
+		TEST_EQ (perr->arg, 0);
+		TEST_EQ (perr->errnum, ENOENT);
+		nih_free (perr);
+		nih_free (buffer);
+		buffer = NULL;
+
+		close (job_process_fd);
+		nih_free (class);
+	}
+
+
+	/* Check that a simple process may be spawned by the spawner
+	 * process, and that it is our child rather than the spawner's.
+	 */
+	TEST_FEATURE ("with spawner process");
+	TEST_HASH_EMPTY (job_classes);
+	{
+		char  *simple[4];
+		pid_t  spawner;
+		int    status;
+
+		simple[0] = "/bin/sh";
+		simple[1] = "-c";
+		simple[2] = "exit 42";
+		simple[3] = NULL;
+
+		spawner = job_process_spawner_start ();
+		TEST_GT (spawner, 0);
+
+		class = job_class_new (NULL, "test", NULL);
+		class->console = CONSOLE_NONE;
+		job   = job_new (class, "");
+
+		pid = job_process_spawn_with_fd (job, simple, NULL, FALSE, -1,
+				PROCESS_MAIN, &job_process_fd);
+		TEST_GT (pid, 0);
+		TEST_NE (pid, spawner);
+
+		assert0 (waitid (P_PID, pid, &info, WEXITED));
+		TEST_EQ (info.si_code, CLD_EXITED);
+		TEST_EQ (info.si_status, 42);
+
+		buffer = read_from_fd (NULL, job_process_fd);
+		TEST_NE_P (buffer, NULL);
+		TEST_EQ (buffer->len, 0);
+		nih_free (buffer);
+		buffer = NULL;
+
+		nih_free (class);
+
+		job_process_spawner_stop ();
+
+		TEST_EQ (waitpid (spawner, &status, 0), spawner);
+		TEST_TRUE (WIFEXITED (status));
+		TEST_EQ (WEXITSTATUS (status), 0);
+	}
+
+
 #if 0
 	/* Check that attempting to spawn a binary that doesn't exist returns
 	 * an error immediately with all of the expected information in the
@@ -5450,7 +5648,7 @@ test_kill (void)
 {
 	JobClass *      class;
 	Job *           job = NULL;
-	NihTimer *      timer;
+	Deadline *      timer;
 	struct timespec now;
 	pid_t           pid;
 	int             status;
@@ -5499,7 +5697,7 @@ test_kill (void)
 		assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
 
 		TEST_NE_P (job->kill_timer, NULL);
-		TEST_ALLOC_SIZE (job->kill_timer, sizeof (NihTimer));
+		TEST_ALLOC_SIZE (job->kill_timer, sizeof (Deadline));
 		TEST_ALLOC_PARENT (job->kill_timer, job);
 		TEST_GE (job->kill_timer->due, now.tv_sec + 950);
 		TEST_LE (job->kill_timer->due, now.tv_sec + 1000);
@@ -5557,7 +5755,7 @@ test_kill (void)
 		assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
 
 		TEST_NE_P (job->kill_timer, NULL);
-		TEST_ALLOC_SIZE (job->kill_timer, sizeof (NihTimer));
+		TEST_ALLOC_SIZE (job->kill_timer, sizeof (Deadline));
 		TEST_ALLOC_PARENT (job->kill_timer, job);
 		TEST_GE (job->kill_timer->due, now.tv_sec + 950);
 		TEST_LE (job->kill_timer->due, now.tv_sec + 1000);
@@ -5589,6 +5787,35 @@ test_kill (void)
 }
 
 
+/**
+ * expect_cgroup_procs:
+ *
+ * @path: directory standing in for a cgroup,
+ * @pid: process to list as a member, or 0.
+ *
+ * Write a cgroup.procs file in @path listing init, which is never our
+ * child, followed by @pid.
+ **/
+static void
+expect_cgroup_procs (const char *path,
+		     pid_t       pid)
+{
+	nih_local char *procs = NULL;
+	FILE           *f;
+
+	procs = NIH_MUST (nih_sprintf (NULL, "%s/cgroup.procs", path));
+
+	f = fopen (procs, "w");
+	assert (f);
+
+	fprintf (f, "1\n");
+	if (pid)
+		fprintf (f, "%d\n", pid);
+
+	assert0 (fclose (f));
+}
+
+
 void
 test_handler (void)
 {
@@ -5611,6 +5838,8 @@ test_handler (void)
 	int             fds[2] = { -1, -1};
 	NihIo          *io = NULL;
 	nih_local NihIoBuffer    *buffer= NULL;
+	char            cgroupdir[PATH_MAX];
+	pid_t           child;
 
 	TEST_FILENAME (dirname);       
 	TEST_EQ (mkdir (dirname, 0755), 0);
@@ -5654,7 +5883,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5705,7 +5934,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5751,6 +5980,60 @@ test_handler (void)
 	}
 
 
+	/* Check that when process file descriptors are used, the exit of
+	 * the running process is handled from the main loop without the
+	 * child handler being called.
+	 */
+	TEST_FEATURE ("with exit seen through pidfd");
+	use_pidfd = TRUE;
+	{
+		JobProcess *proc;
+		fd_set      readfds, writefds, exceptfds;
+		int         nfds;
+
+		job = job_new (class, "");
+		job->goal = JOB_START;
+		job->state = JOB_RUNNING;
+
+		TEST_CHILD (pid) {
+			exit (0);
+		}
+
+		job_process_set_pid (job, PROCESS_MAIN, pid);
+
+		proc = (JobProcess *)nih_hash_lookup (job_processes, &pid);
+		TEST_NE_P (proc, NULL);
+		TEST_EQ_P (proc->job, job);
+		TEST_EQ (proc->process, PROCESS_MAIN);
+		TEST_GE (proc->pidfd, 0);
+		TEST_NE_P (proc->watch, NULL);
+
+		while (job->pid[PROCESS_MAIN] == pid) {
+			nfds = 0;
+			FD_ZERO (&readfds);
+			FD_ZERO (&writefds);
+			FD_ZERO (&exceptfds);
+
+			nih_io_select_fds (&nfds, &readfds, &writefds, &exceptfds);
+			if (select (nfds, &readfds, &writefds, &exceptfds,
+				    NULL) > 0)
+				nih_io_handle_fds (&readfds, &writefds, &exceptfds);
+		}
+
+		/* Already reaped */
+		TEST_EQ (waitpid (pid, NULL, WNOHANG), -1);
+		TEST_EQ (errno, ECHILD);
+
+		TEST_EQ (job->goal, JOB_STOP);
+		TEST_EQ (job->state, JOB_STOPPING);
+		TEST_EQ (job->pid[PROCESS_MAIN], 0);
+		TEST_EQ (job->failed, FALSE);
+
+		nih_free (job);
+	}
+	use_pidfd = FALSE;
+
+
 	/* Check that we can handle a running task of the job after it's been
 	 * sent the TERM signal and a kill timer set.  The kill timer should
 	 * be cancelled and freed, and since we killed it, the job should
@@ -5758,7 +6041,7 @@ test_handler (void)
 	 */
 	TEST_FEATURE ("with kill timer");
 	TEST_ALLOC_FAIL {
-		NihTimer *timer = NULL;
+		Deadline *timer = NULL;
 
 		TEST_ALLOC_SAFE {
 			job = job_new (class, "");
@@ -5770,7 +6053,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5809,7 +6092,7 @@ test_handler (void)
 	 */
 	TEST_FEATURE ("with restarting process");
 	TEST_ALLOC_FAIL {
-		NihTimer *timer = NULL;
+		Deadline *timer = NULL;
 
 		TEST_ALLOC_SAFE {
 			job = job_new (class, "");
@@ -5821,7 +6104,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5905,8 +6188,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_MAIN] = 0;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 0);
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -5970,7 +6253,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6045,7 +6328,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_START;
-		job->pid[PROCESS_PRE_START] = 1;
+		job_process_set_pid (job, PROCESS_PRE_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6124,7 +6407,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6212,7 +6495,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6302,7 +6585,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6379,7 +6662,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6449,7 +6732,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6530,7 +6813,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6598,7 +6881,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6669,7 +6952,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_KILLED;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6720,7 +7003,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6788,7 +7071,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6860,7 +7143,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6924,7 +7207,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -6969,7 +7252,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7022,7 +7305,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_POST_STOP;
-		job->pid[PROCESS_POST_STOP] = 1;
+		job_process_set_pid (job, PROCESS_POST_STOP, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7077,8 +7360,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7142,7 +7425,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7211,8 +7494,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7271,8 +7554,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7362,8 +7645,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7462,8 +7745,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7569,8 +7852,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7647,7 +7930,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7715,8 +7998,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7779,8 +8062,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7889,8 +8172,8 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_PRE_STOP;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_PRE_STOP] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_PRE_STOP, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -7988,7 +8271,7 @@ test_handler (void)
 
 		job->goal = JOB_STOP;
 		job->state = JOB_STOPPING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8060,8 +8343,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = 1;
-		job->pid[PROCESS_POST_START] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
+		job_process_set_pid (job, PROCESS_POST_START, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8133,8 +8416,8 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_POST_START;
-		job->pid[PROCESS_MAIN] = pid;
-		job->pid[PROCESS_POST_START] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
+		job_process_set_pid (job, PROCESS_POST_START, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8204,7 +8487,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8273,7 +8556,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8345,7 +8628,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_FREE_TAG (blocked);
 
@@ -8411,7 +8694,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8458,7 +8741,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8506,7 +8789,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8555,7 +8838,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8605,7 +8888,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid,
@@ -8680,7 +8963,7 @@ test_handler (void)
 		/* Now carry on with the test */
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8749,7 +9032,7 @@ test_handler (void)
 		/* Now carry on with the test */
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8808,7 +9091,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8863,7 +9146,7 @@ test_handler (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_SPAWNED;
-		job->pid[PROCESS_MAIN] = pid;
+		job_process_set_pid (job, PROCESS_MAIN, pid);
 
 		TEST_DIVERT_STDERR (output) {
 			job_process_handler (NULL, pid, NIH_CHILD_PTRACE,
@@ -8891,6 +9174,197 @@ test_handler (void)
 #endif
 
 
+	/* Check that when the main process of a forking job followed by
+	 * cgroup membership exits normally, the child it left in the cgroup
+	 * and that we adopted is followed instead, ending the wait for the
+	 * fork and moving the job into the running state.
+	 */
+	TEST_FEATURE ("with adopted child of forking process in cgroup");
+	class->expect = EXPECT_FORK;
+
+	TEST_FILENAME (cgroupdir);
+	assert0 (mkdir (cgroupdir, 0755));
+
+	job = job_new (class, "");
+	job->trace_forks = 0;
+	job->trace_state = TRACE_CGROUP;
+	job->trace_cgroup = NIH_MUST (nih_strdup (job, cgroupdir));
+
+	TEST_CHILD (pid) {
+		exit (0);
+	}
+	waitpid (pid, &status, 0);
+
+	TEST_CHILD (child) {
+		pause ();
+		exit (0);
+	}
+
+	expect_cgroup_procs (cgroupdir, child);
+
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_handler (NULL, pid, NIH_CHILD_EXITED, 0);
+	}
+	rewind (output);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_RUNNING);
+	TEST_EQ (job->pid[PROCESS_MAIN], child);
+	TEST_EQ_P (job_process_find (pid, NULL), NULL);
+	TEST_EQ_P (job_process_find (child, NULL), job);
+
+	TEST_EQ (job->trace_forks, 1);
+	TEST_EQ (job->trace_state, TRACE_NONE);
+	TEST_EQ_STR (job->trace_cgroup, cgroupdir);
+
+
+	/* Check that the cgroup is let go of once the process that was
+	 * followed finally goes.
+	 */
+	TEST_FEATURE ("with followed process of forking job killed");
+	kill (child, SIGTERM);
+	waitpid (child, &status, 0);
+	TEST_TRUE (WIFSIGNALED (status));
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_handler (NULL, child, NIH_CHILD_KILLED, SIGTERM);
+	}
+	rewind (output);
+
+	TEST_EQ (job->pid[PROCESS_MAIN], 0);
+	TEST_EQ_P (job->trace_cgroup, NULL);
+
+	nih_free (job);
+
+	class->expect = EXPECT_NONE;
+
+
+	/* Check that the first adopted child of a daemon process followed
+	 * by cgroup membership is followed, but that we carry on waiting
+	 * for the second fork.
+	 */
+	TEST_FEATURE ("with adopted first child of daemon process in cgroup");
+	class->expect = EXPECT_DAEMON;
+
+	job = job_new (class, "");
+	job->trace_forks = 0;
+	job->trace_state = TRACE_CGROUP;
+	job->trace_cgroup = NIH_MUST (nih_strdup (job, cgroupdir));
+
+	TEST_CHILD (pid) {
+		exit (0);
+	}
+	waitpid (pid, &status, 0);
+
+	TEST_CHILD (child) {
+		pause ();
+		exit (0);
+	}
+
+	expect_cgroup_procs (cgroupdir, child);
+
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_handler (NULL, pid, NIH_CHILD_EXITED, 0);
+	}
+	rewind (output);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_SPAWNED);
+	TEST_EQ (job->pid[PROCESS_MAIN], child);
+
+	TEST_EQ (job->trace_forks, 1);
+	TEST_EQ (job->trace_state, TRACE_CGROUP);
+
+
+	/* Check that the second adopted child of a daemon process ends the
+	 * wait, moving the job into the running state.
+	 */
+	TEST_FEATURE ("with adopted second child of daemon process in cgroup");
+	pid = child;
+
+	TEST_CHILD (child) {
+		pause ();
+		exit (0);
+	}
+
+	expect_cgroup_procs (cgroupdir, child);
+
+	kill (pid, SIGKILL);
+	waitpid (pid, &status, 0);
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_handler (NULL, pid, NIH_CHILD_EXITED, 0);
+	}
+	rewind (output);
+
+	TEST_EQ (job->goal, JOB_START);
+	TEST_EQ (job->state, JOB_RUNNING);
+	TEST_EQ (job->pid[PROCESS_MAIN], child);
+
+	TEST_EQ (job->trace_forks, 2);
+	TEST_EQ (job->trace_state, TRACE_NONE);
+
+	kill (child, SIGTERM);
+	waitpid (child, &status, 0);
+
+	nih_free (job);
+
+	class->expect = EXPECT_NONE;
+
+
+	/* Check that when the main process of a forking job exits normally
+	 * leaving nothing we adopted in its cgroup, only processes that
+	 * belong to somebody else, the job is stopped and the cgroup let go
+	 * of.
+	 */
+	TEST_FEATURE ("with no adopted process in cgroup");
+	class->expect = EXPECT_FORK;
+
+	job = job_new (class, "");
+	job->trace_forks = 0;
+	job->trace_state = TRACE_CGROUP;
+	job->trace_cgroup = NIH_MUST (nih_strdup (job, cgroupdir));
+
+	TEST_CHILD (pid) {
+		exit (0);
+	}
+	waitpid (pid, &status, 0);
+
+	expect_cgroup_procs (cgroupdir, 0);
+
+	job->goal = JOB_START;
+	job->state = JOB_SPAWNED;
+	job_process_set_pid (job, PROCESS_MAIN, pid);
+
+	TEST_DIVERT_STDERR (output) {
+		job_process_handler (NULL, pid, NIH_CHILD_EXITED, 0);
+	}
+	rewind (output);
+
+	TEST_EQ (job->goal, JOB_STOP);
+	TEST_EQ (job->state, JOB_STOPPING);
+	TEST_EQ (job->pid[PROCESS_MAIN], 0);
+	TEST_EQ (job->failed, FALSE);
+
+	TEST_EQ (job->trace_forks, 0);
+	TEST_EQ_P (job->trace_cgroup, NULL);
+
+	nih_free (job);
+
+	class->expect = EXPECT_NONE;
+
+	DELETE_FILE (cgroupdir, "cgroup.procs");
+	assert0 (rmdir (cgroupdir));
+
+
 	fclose (output);
 
 	nih_free (event);
@@ -9206,20 +9680,20 @@ test_find (void)
 	nih_hash_add (job_classes, &class3->entry);
 
 	job1 = job_new (class1, "foo");
-	job1->pid[PROCESS_MAIN] = 10;
-	job1->pid[PROCESS_POST_START] = 15;
+	job_process_set_pid (job1, PROCESS_MAIN, 10);
+	job_process_set_pid (job1, PROCESS_POST_START, 15);
 
 	job2 = job_new (class1, "bar");
 
 	job3 = job_new (class2, "foo");
-	job3->pid[PROCESS_PRE_START] = 20;
+	job_process_set_pid (job3, PROCESS_PRE_START, 20);
 
 	job4 = job_new (class2, "bar");
-	job4->pid[PROCESS_MAIN] = 25;
-	job4->pid[PROCESS_PRE_STOP] = 30;
+	job_process_set_pid (job4, PROCESS_MAIN, 25);
+	job_process_set_pid (job4, PROCESS_PRE_STOP, 30);
 
 	job5 = job_new (class3, "");
-	job5->pid[PROCESS_POST_STOP] = 35;
+	job_process_set_pid (job5, PROCESS_POST_STOP, 35);
 
 
 	/* Check that we can find a job that exists by the pid of its
@@ -9272,6 +9746,35 @@ test_find (void)
 	TEST_EQ (process, PROCESS_POST_STOP);
 
 
+	/* Check that changing the pid of a process, as happens when we
+	 * follow a fork, replaces the old pid in the table with the new.
+	 */
+	TEST_FEATURE ("with replaced pid");
+	job_process_set_pid (job4, PROCESS_MAIN, 40);
+
+	ptr = job_process_find (25, NULL);
+
+	TEST_EQ_P (ptr, NULL);
+
+	ptr = job_process_find (40, &process);
+
+	TEST_EQ_P (ptr, job4);
+	TEST_EQ (process, PROCESS_MAIN);
+
+
+	/* Check that clearing the pid of a process removes it from the
+	 * table.
+	 */
+	TEST_FEATURE ("with cleared pid");
+	job_process_set_pid (job4, PROCESS_MAIN, 0);
+
+	TEST_EQ (job4->pid[PROCESS_MAIN], 0);
+
+	ptr = job_process_find (40, NULL);
+
+	TEST_EQ_P (ptr, NULL);
+
+
 	/* Check that we get NULL if no job has a process with that pid. */
 	TEST_FEATURE ("with pid we do not expect to find");
 	ptr = job_process_find (100, NULL);
@@ -9355,7 +9858,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -9420,7 +9923,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 1;
+		job_process_set_pid (job, PROCESS_MAIN, 1);
 
 		TEST_FREE_TAG (blocked);
 
@@ -9488,7 +9991,7 @@ test_utmp (void)
 
 		job->goal = JOB_START;
 		job->state = JOB_RUNNING;
-		job->pid[PROCESS_MAIN] = 2;
+		job_process_set_pid (job, PROCESS_MAIN, 2);
 
 		TEST_FREE_TAG (blocked);
 
@@ -0,0 +1,202 @@
+/* upstart
+ *
+ * test_listener.c - test suite for init/listener.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "listener.h"
+
+
+void
+test_parse (void)
+{
+	ListenerAddress address;
+
+	TEST_FUNCTION ("listener_parse");
+
+	/* Check that an inet socket with only a port is bound to any
+	 * address.
+	 */
+	TEST_FEATURE ("with inet port");
+	TEST_EQ (listener_parse ("PROTO=inet PORT=80", &address), 0);
+	TEST_EQ (address.sin.sin_family, AF_INET);
+	TEST_EQ (address.sin.sin_port, htons (80));
+	TEST_EQ (address.sin.sin_addr.s_addr, INADDR_ANY);
+	TEST_EQ (address.len, sizeof (struct sockaddr_in));
+
+
+	/* Check that an inet socket may be given an address. */
+	TEST_FEATURE ("with inet address");
+	TEST_EQ (listener_parse ("PROTO=inet PORT=80 ADDR=127.0.0.1",
+				 &address), 0);
+	TEST_EQ (address.sin.sin_addr.s_addr, htonl (INADDR_LOOPBACK));
+
+
+	/* Check that an inet6 socket is accepted. */
+	TEST_FEATURE ("with inet6 address");
+	TEST_EQ (listener_parse ("PROTO=inet6 PORT=8080 ADDR=::1",
+				 &address), 0);
+	TEST_EQ (address.sin6.sin6_family, AF_INET6);
+	TEST_EQ (address.sin6.sin6_port, htons (8080));
+	TEST_EQ (address.len, sizeof (struct sockaddr_in6));
+
+
+	/* Check that a unix socket with an absolute path is accepted. */
+	TEST_FEATURE ("with unix path");
+	TEST_EQ (listener_parse ("PROTO=unix PATH=/run/foo.sock",
+				 &address), 0);
+	TEST_EQ (address.sun.sun_family, AF_UNIX);
+	TEST_EQ_STR (address.sun.sun_path, "/run/foo.sock");
+
+
+	/* Check that a path beginning with "@" names an abstract socket
+	 * whose length covers only the name.
+	 */
+	TEST_FEATURE ("with abstract unix path");
+	TEST_EQ (listener_parse ("PROTO=unix PATH=@foo", &address), 0);
+	TEST_EQ (address.sun.sun_path[0], '\0');
+	TEST_EQ_MEM (address.sun.sun_path + 1, "foo", 3);
+	TEST_EQ (address.len, offsetof (struct sockaddr_un, sun_path) + 4);
+
+
+	/* Check that invalid specifications are rejected. */
+	TEST_FEATURE ("with invalid specifications");
+	TEST_LT (listener_parse ("PORT=80", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet PORT=0", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet PORT=65536", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet PORT=http", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet PORT=80 ADDR=::1", &address), 0);
+	TEST_LT (listener_parse ("PROTO=unix PATH=foo.sock", &address), 0);
+	TEST_LT (listener_parse ("PROTO=unix PORT=80", &address), 0);
+	TEST_LT (listener_parse ("PROTO=udp PORT=80", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet PORT=80 QUEUE=5", &address), 0);
+	TEST_LT (listener_parse ("PROTO=inet 80", &address), 0);
+}
+
+void
+test_poll (void)
+{
+	JobClass *class;
+	Listener *listener;
+	char      dirname[PATH_MAX];
+	char      spec[PATH_MAX + 32];
+	char      filename[PATH_MAX];
+	int       fds[LISTENER_MAX];
+	int       sock;
+
+	TEST_FUNCTION ("listener_poll");
+	job_class_init ();
+	listener_init ();
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+	sprintf (filename, "%s/foo.sock", dirname);
+	sprintf (spec, "PROTO=unix PATH=%s", filename);
+
+
+	/* Check that a listening socket is created for a job with a socket
+	 * stanza, and that it is among the sockets passed to the job.
+	 */
+	TEST_FEATURE ("with socket named by job");
+	class = job_class_new (NULL, "foo", NULL);
+	class->sockets = nih_str_array_new (class);
+	NIH_MUST (nih_str_array_add (&class->sockets, class, NULL, spec));
+	nih_hash_add (job_classes, &class->entry);
+
+	listener_changed ();
+	listener_poll ();
+
+	TEST_LIST_NOT_EMPTY (listeners);
+	listener = (Listener *)listeners->next;
+	TEST_EQ_P (listener->entry.next, listeners);
+	TEST_EQ_STR (listener->spec, spec);
+	TEST_EQ_P (listener->class, class);
+	TEST_EQ (listener->watch->events, NIH_IO_READ);
+	TEST_EQ (access (filename, F_OK), 0);
+
+	TEST_EQ (listener_fds (class, fds), 1);
+	TEST_EQ (fds[0], listener->sock);
+	TEST_TRUE (fcntl (listener->sock, F_GETFD) & FD_CLOEXEC);
+
+	sock = listener->sock;
+
+
+	/* Check that the socket is kept when the job is replaced by one
+	 * naming the same socket.
+	 */
+	TEST_FEATURE ("with socket named by replacement job");
+	TEST_FREE_TAG (listener);
+
+	nih_free (class);
+
+	class = job_class_new (NULL, "foo", NULL);
+	class->sockets = nih_str_array_new (class);
+	NIH_MUST (nih_str_array_add (&class->sockets, class, NULL, spec));
+	nih_hash_add (job_classes, &class->entry);
+
+	listener_changed ();
+	listener_poll ();
+
+	TEST_NOT_FREE (listener);
+	TEST_EQ_P (listener->class, class);
+	TEST_EQ (listener->sock, sock);
+
+
+	/* Check that the socket is closed once no job names it. */
+	TEST_FEATURE ("with socket no longer named");
+	nih_free (class);
+
+	listener_changed ();
+	listener_poll ();
+
+	TEST_FREE (listener);
+	TEST_LIST_EMPTY (listeners);
+	TEST_LT (fcntl (sock, F_GETFD), 0);
+
+	unlink (filename);
+	rmdir (dirname);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_parse ();
+	test_poll ();
+
+	return 0;
+}
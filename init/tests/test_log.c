@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pty.h>
 #include <libgen.h>
 #include <sys/types.h>
@@ -32,6 +33,7 @@
 #include <nih/signal.h>
 #include <nih/main.h>
 #include "job.h"
+#include "log_index.h"
 #include "test_util_common.h"
 
 extern int log_flushed;
@@ -40,7 +42,7 @@ extern int log_flushed;
  * To help with understanding the TEST_ALLOC_FAIL peculiarities
  * below...
  *
- * log_new() calls __nih_*alloc() *seven* times:
+ * log_new() calls __nih_*alloc() *eight* times:
  *
  * log_new
  *   log = nih_new
@@ -53,20 +55,24 @@ extern int log_flushed;
  *     nih_new
  *       nih_alloc
  *         __nih_alloc # XXX: call 3
+ *   log->pending = nih_io_buffer_new
+ *     nih_new
+ *       nih_alloc
+ *         __nih_alloc # XXX: call 4
  *   log->io = nih_io_reopen
  *     io = nih_new
- *       __nih_alloc # XXX: call 4
+ *       __nih_alloc # XXX: call 5
  *     io->send_buf = nih_io_buffer_new
  *       nih_new
- *         __nih_alloc # XXX: call 5
+ *         __nih_alloc # XXX: call 6
  *     io->recv_buf = nih_io_buffer_new
  *       nih_new
- *         __nih_alloc # XXX: call 6
+ *         __nih_alloc # XXX: call 7
  *     io->watch = nih_io_add_watch
  *       nih_new
- *         __nih_alloc # XXX: call 7
+ *         __nih_alloc # XXX: call 8
  *
- * (There is actually an 8th call to log_unflushed_init(), but we handle
+ * (There is actually a 9th call to log_unflushed_init(), but we handle
  * that by calling log_unflushed_init() prior to any tests).
  *
  * XXX: Unfortunately, having created a log, we cannot intelligently test the
@@ -74,7 +80,7 @@ extern int log_flushed;
  * underlying complexities of the way NIH re-allocs memory at particular
  * points.
  */
-#define LOG_NEW_ALLOC_CALLS    7
+#define LOG_NEW_ALLOC_CALLS    8
 void
 test_log_new (void)
 {
@@ -148,6 +154,8 @@ test_log_new (void)
 		TEST_EQ (log->io->watch->fd, pty_master);
 		TEST_EQ (log->uid, 0);
 		TEST_LT (log->fd, 0);
+		TEST_EQ (log->splice_pipe[0], -1);
+		TEST_EQ (log->splice_pipe[1], -1);
 		TEST_NE (log_unflushed_files, NULL);
 		TEST_TRUE (NIH_LIST_EMPTY (log_unflushed_files));
 
@@ -1446,6 +1454,380 @@ test_log_destroy (void)
 	TEST_FREE (log->unflushed);
 }
 
+void
+test_log_io_reader (void)
+{
+	Log          *log;
+	Deadline     *timer;
+	char          str[] = "hello, world!";
+	char          filename[1024];
+	char         *p;
+	char          large[LOG_READ_SIZE * 3];
+	char          str2[] = "goodbye";
+	char          rotated[1024];
+	char          index[1024];
+	int           i;
+	int           fd;
+	time_t        before;
+	LogIndexEntry entry;
+	struct stat   statbuf;
+	FILE         *output;
+	int           pty_master;
+	int           pty_slave;
+	ssize_t       ret;
+
+	TEST_FUNCTION ("log_io_reader");
+
+	/************************************************************/
+	TEST_FEATURE ("output held in write-behind buffer with uid 0");
+
+	TEST_FILENAME (filename);
+
+	log_buffer_size = 1024;
+	log_flush_interval = 0;
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	/* Nothing should have been written yet */
+	TEST_EQ (log->pending->len, strlen (str));
+	TEST_EQ_P (log->flush_timer, NULL);
+	TEST_LT (stat (filename, &statbuf), 0);
+
+	close (pty_slave);
+	nih_free (log);
+
+	/* Destroying the log must write the buffered output */
+	TEST_EQ (stat (filename, &statbuf), 0);
+
+	output = fopen (filename, "r");
+	TEST_NE_P (output, NULL);
+
+	TEST_FILE_EQ (output, str);
+	TEST_FILE_END (output);
+	fclose (output);
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("flush timer armed for write-behind buffer with uid 0");
+
+	log_flush_interval = 1;
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	TEST_EQ (log->pending->len, strlen (str));
+	TEST_NE_P (log->flush_timer, NULL);
+	TEST_ALLOC_PARENT (log->flush_timer, log);
+	TEST_LT (stat (filename, &statbuf), 0);
+
+	/* Simulate the timer expiring */
+	timer = log->flush_timer;
+	TEST_FREE_TAG (timer);
+	timer->callback (timer->data, timer);
+	TEST_EQ_P (log->flush_timer, NULL);
+	nih_free (timer);
+	TEST_FREE (timer);
+
+	TEST_EQ (log->pending->len, 0);
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str));
+
+	close (pty_slave);
+	nih_free (log);
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("write-behind buffer written when full with uid 0");
+
+	log_buffer_size = 4;
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	TEST_EQ (log->pending->len, 0);
+	TEST_EQ_P (log->flush_timer, NULL);
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str));
+
+	close (pty_slave);
+	nih_free (log);
+
+	output = fopen (filename, "r");
+	TEST_NE_P (output, NULL);
+
+	TEST_FILE_EQ (output, str);
+	TEST_FILE_END (output);
+	fclose (output);
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("write-behind buffer moved to unflushed with uid 0");
+
+	log_buffer_size = 1024;
+	log_flush_interval = 0;
+
+	/* Make file inaccessible to ensure data cannot be written
+	 * and will thus be added to the unflushed buffer.
+	 */
+	ret = open (filename, O_CREAT | O_EXCL, 0);
+	TEST_NE (ret, -1);
+	close (ret);
+
+	p = nih_strdup (NULL, "hello");
+	TEST_NE_P (p, NULL);
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (p, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+	close (pty_slave);
+
+	TEST_EQ (log->pending->len, strlen (str));
+	TEST_EQ (log->unflushed->len, 0);
+
+	/* reset */
+	log_flushed = 0;
+
+	ret = log_handle_unflushed (p, log);
+	TEST_EQ (ret, 0);
+	nih_free (p);
+
+	TEST_EQ (log->pending->len, 0);
+	TEST_EQ (log->unflushed->len, strlen (str));
+
+	assert0 (chmod (filename, 0755));
+
+	ret = log_clear_unflushed ();
+	assert0 (ret);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str));
+
+	TEST_TRUE (NIH_LIST_EMPTY (log_unflushed_files));
+
+	/* full reset */
+	log_flushed = 0;
+	log_buffer_size = 0;
+	log_flush_interval = LOG_FLUSH_INTERVAL;
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("writing output larger than a single read with uid 0");
+
+	memset (large, 'a', sizeof (large));
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	/* Some of this output may be spliced straight to the log file */
+	ret = write (pty_slave, large, sizeof (large));
+	TEST_EQ (ret, sizeof (large));
+
+	TEST_WATCH_UPDATE ();
+
+	close (pty_slave);
+	nih_free (log);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, sizeof (large));
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("unflushed data limited to newest output with uid 0");
+
+	log_unflushed_limit = 5;
+	log_unflushed_dropped = 0;
+
+	/* Make file inaccessible to ensure data cannot be written
+	 * and will thus be added to the unflushed buffer.
+	 */
+	ret = open (filename, O_CREAT | O_EXCL, 0);
+	TEST_NE (ret, -1);
+	close (ret);
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	TEST_EQ (log->unflushed->len, 5);
+	TEST_EQ_MEM (log->unflushed->buf, "orld!", 5);
+	TEST_EQ (log->unflushed_dropped, strlen (str) - 5);
+	TEST_EQ (log_unflushed_dropped, strlen (str) - 5);
+
+	close (pty_slave);
+	nih_free (log);
+
+	log_unflushed_limit = LOG_UNFLUSHED_LIMIT;
+	log_unflushed_dropped = 0;
+
+	TEST_EQ (unlink (filename), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("log file rotated by size with uid 0");
+
+	log_rotate_size = 10;
+
+	TEST_GT (sprintf (rotated, "%s.1", filename), 0);
+	TEST_LT (stat (rotated, &statbuf), 0);
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	/* Log file should have been rotated and not yet recreated */
+	TEST_LT (log->fd, 0);
+	TEST_LT (stat (filename, &statbuf), 0);
+	TEST_EQ (stat (rotated, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str));
+
+	ret = write (pty_slave, str2, strlen (str2));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	close (pty_slave);
+	nih_free (log);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str2));
+
+	log_rotate_size = 0;
+
+	TEST_EQ (unlink (filename), 0);
+	TEST_EQ (unlink (rotated), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("log file indexed with uid 0");
+
+	log_index_size = 1;
+
+	TEST_GT (sprintf (index, "%s%s", filename, LOG_INDEX_EXT), 0);
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	before = time (NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	/* Too little output, too soon, for a second checkpoint */
+	ret = write (pty_slave, str2, strlen (str2));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	close (pty_slave);
+	nih_free (log);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, strlen (str) + strlen (str2));
+
+	TEST_EQ (stat (index, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, sizeof (LogIndexEntry));
+
+	fd = open (index, O_RDONLY);
+	TEST_GE (fd, 0);
+	TEST_EQ (read (fd, &entry, sizeof (entry)), sizeof (entry));
+	close (fd);
+
+	TEST_EQ (entry.offset, 0);
+	TEST_GE (entry.time, (int64_t)before * 1000000);
+	TEST_LE (entry.time, (int64_t)time (NULL) * 1000000 + 1000000);
+
+	log_index_size = 0;
+
+	TEST_EQ (unlink (filename), 0);
+	TEST_EQ (unlink (index), 0);
+
+	/************************************************************/
+	TEST_FEATURE ("with logger process and uid 0");
+
+	log_writer = TRUE;
+
+	TEST_EQ (openpty (&pty_master, &pty_slave, NULL, NULL, NULL), 0);
+
+	log = log_new (NULL, filename, pty_master, 0);
+	TEST_NE_P (log, NULL);
+
+	ret = write (pty_slave, str, strlen (str));
+	TEST_GT (ret, 0);
+
+	TEST_WATCH_UPDATE ();
+
+	close (pty_slave);
+	nih_free (log);
+
+	/* The logger process writes the file asynchronously */
+	for (i = 0; i < 50; i++) {
+		TEST_EQ (stat (filename, &statbuf), 0);
+		if (statbuf.st_size == strlen (str))
+			break;
+		usleep (100000);
+	}
+
+	output = fopen (filename, "r");
+	TEST_NE_P (output, NULL);
+
+	TEST_FILE_EQ (output, str);
+	TEST_FILE_END (output);
+	fclose (output);
+
+	log_writer = FALSE;
+
+	TEST_EQ (unlink (filename), 0);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -1455,6 +1837,7 @@ main (int   argc,
 
 	test_log_new ();
 	test_log_destroy ();
+	test_log_io_reader ();
 
 	return 0;
 }
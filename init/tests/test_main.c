@@ -28,7 +28,9 @@
 #include <nih/test.h>
 
 #include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -1126,6 +1128,173 @@ test_confdir (void)
 	assert0 (unsetenv ("UPSTART_CONFDIR"));
 }
 
+void
+test_reexec (void)
+{
+	char             confdir[PATH_MAX];
+	char             srcdir[PATH_MAX];
+	char             logdir[PATH_MAX];
+	char             src_path[PATH_MAX];
+	char             conf_path[PATH_MAX];
+	char            *xdg_runtime_dir;
+	pid_t            upstart_pid = 0;
+	pid_t            dbus_pid = 0;
+	char           **output;
+	size_t           lines;
+	nih_local char  *cmd = NULL;
+	nih_local char  *session_file = NULL;
+	nih_local char  *running = NULL;
+	int              reloaded;
+
+	xdg_runtime_dir = getenv ("XDG_RUNTIME_DIR");
+	TEST_NE_P (xdg_runtime_dir, NULL);
+
+	TEST_GROUP ("stateful re-exec");
+
+	TEST_FILENAME (confdir);
+	assert0 (mkdir (confdir, 0755));
+
+	TEST_FILENAME (srcdir);
+	assert0 (mkdir (srcdir, 0755));
+
+	TEST_FILENAME (logdir);
+	assert0 (mkdir (logdir, 0755));
+
+	/* The configuration for "foo" is a hard link into another
+	 * directory, so that rewriting it through that directory is not
+	 * seen by the inotify watch on the configuration directory and is
+	 * only picked up by a reload.
+	 */
+	CREATE_FILE (srcdir, "foo.conf", "emits hello\nexec true");
+	CREATE_FILE (confdir, "bar.conf", "exec sleep 999");
+
+	sprintf (src_path, "%s/foo.conf", srcdir);
+	sprintf (conf_path, "%s/foo.conf", confdir);
+	assert0 (link (src_path, conf_path));
+
+	assert0 (setenv ("UPSTART_NO_SYSTEM_USERCONFDIR", "1", 1));
+
+	TEST_DBUS (dbus_pid);
+
+	start_upstart_common (&upstart_pid, TRUE, FALSE, confdir, logdir, NULL);
+
+	/* Should be running */
+	assert0 (kill (upstart_pid, 0));
+
+	session_file = get_session_file (xdg_runtime_dir, upstart_pid);
+
+	cmd = nih_sprintf (NULL, "%s start bar 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 1);
+	TEST_STR_MATCH (output[0], "bar start/running, process *");
+	running = NIH_MUST (nih_strdup (NULL, output[0]));
+	nih_free (output);
+
+	CREATE_FILE (srcdir, "foo.conf", "emits world\nexec true");
+
+	cmd = nih_sprintf (NULL, "%s show-config foo 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 2);
+	TEST_STR_MATCH (output[1], "  emits hello");
+	nih_free (output);
+
+	REEXEC_UPSTART (upstart_pid, TRUE);
+
+	/* Should still be running */
+	assert0 (kill (upstart_pid, 0));
+
+
+	/************************************************************/
+	/* Check that a job running before the re-exec is still known,
+	 * and that requests are answered straight away.
+	 */
+	TEST_FEATURE ("with running job");
+
+	cmd = nih_sprintf (NULL, "%s status bar 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 1);
+	TEST_EQ_STR (output[0], running);
+	nih_free (output);
+
+
+	/************************************************************/
+	/* Check that the private server is listening again after each of
+	 * several re-execs, rather than the new instance finding the
+	 * address still held by the previous one and giving up on it.
+	 */
+	TEST_FEATURE ("with private server after repeated re-exec");
+
+	for (int i = 0; i < 3; i++) {
+		REEXEC_UPSTART (upstart_pid, TRUE);
+
+		assert0 (kill (upstart_pid, 0));
+
+		cmd = nih_sprintf (NULL, "%s status bar 2>&1", get_initctl ());
+		TEST_NE_P (cmd, NULL);
+		RUN_COMMAND (NULL, cmd, &output, &lines);
+		TEST_EQ (lines, 1);
+		TEST_EQ_STR (output[0], running);
+		nih_free (output);
+	}
+
+
+	/************************************************************/
+	/* Check that the configuration is still reloaded after the
+	 * re-exec, though it is deferred until the main loop has run.
+	 */
+	TEST_FEATURE ("with configuration changed before re-exec");
+
+	reloaded = FALSE;
+	for (int i = 0; i < 5 && ! reloaded; i++) {
+		cmd = nih_sprintf (NULL, "%s show-config foo 2>&1", get_initctl ());
+		TEST_NE_P (cmd, NULL);
+		RUN_COMMAND (NULL, cmd, &output, &lines);
+		TEST_EQ (lines, 2);
+		TEST_STR_MATCH (output[0], "foo");
+
+		if (! strcmp (output[1], "  emits world")) {
+			reloaded = TRUE;
+		} else {
+			TEST_STR_MATCH (output[1], "  emits hello");
+			sleep (1);
+		}
+		nih_free (output);
+	}
+	TEST_TRUE (reloaded);
+
+	cmd = nih_sprintf (NULL, "%s list 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+
+	qsort (output, lines, sizeof (output[0]), strcmp_compar);
+
+	TEST_EQ (lines, 2);
+	TEST_EQ_STR (output[0], running);
+	TEST_STR_MATCH (output[1], "foo stop/waiting");
+	nih_free (output);
+
+	cmd = nih_sprintf (NULL, "%s stop bar >/dev/null 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	assert0 (system (cmd));
+
+	STOP_UPSTART (upstart_pid);
+	assert0 (unlink (session_file));
+
+	TEST_DBUS_END (dbus_pid);
+
+	assert0 (unlink (conf_path));
+	DELETE_FILE (confdir, "bar.conf");
+	DELETE_FILE (srcdir, "foo.conf");
+
+	assert0 (rmdir (confdir));
+	assert0 (rmdir (srcdir));
+	assert0 (rmdir (logdir));
+	assert0 (unsetenv ("UPSTART_NO_SYSTEM_USERCONFDIR"));
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -1133,6 +1302,7 @@ main (int   argc,
 	test_common_setup ();
 
 	test_confdir ();
+	test_reexec ();
 
 	test_common_cleanup ();
 
@@ -0,0 +1,123 @@
+/* upstart
+ *
+ * test_metrics.c - test suite for init/metrics.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "metrics.h"
+
+
+void
+test_text (void)
+{
+	JobClass *class;
+	Job      *job;
+	char     *text;
+
+	TEST_FUNCTION ("metrics_text");
+	job_class_init ();
+	metrics_enabled = TRUE;
+	metrics_methods = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+
+	/* Check that the number of job classes and instances is given,
+	 * and that the text ends with the OpenMetrics terminator.
+	 */
+	TEST_FEATURE ("with job classes and instances");
+	class = job_class_new (NULL, "foo", NULL);
+	nih_hash_add (job_classes, &class->entry);
+	job = job_new (class, "");
+
+	text = metrics_text (NULL);
+
+	TEST_NE_P (strstr (text, "upstart_job_classes 1.000000\n"), NULL);
+	TEST_NE_P (strstr (text, "upstart_job_instances 1.000000\n"), NULL);
+
+	TEST_GE (strlen (text), 6);
+	TEST_EQ_STR (text + strlen (text) - 6, "# EOF\n");
+
+	nih_free (text);
+
+	nih_free (job);
+	nih_free (class);
+
+
+	/* Check that calls to D-Bus methods are counted by interface and
+	 * name.
+	 */
+	TEST_FEATURE ("with D-Bus method calls");
+	metrics_method_called ("com.ubuntu.Upstart0_6", "EmitEvent");
+	metrics_method_called ("com.ubuntu.Upstart0_6", "EmitEvent");
+	metrics_method_called ("com.ubuntu.Upstart0_6", "GetJobByName");
+
+	text = metrics_text (NULL);
+
+	TEST_NE_P (strstr (text, "upstart_dbus_requests_total{method="
+			   "\"com.ubuntu.Upstart0_6.EmitEvent\"} 2\n"), NULL);
+	TEST_NE_P (strstr (text, "upstart_dbus_requests_total{method="
+			   "\"com.ubuntu.Upstart0_6.GetJobByName\"} 1\n"), NULL);
+
+	nih_free (text);
+
+
+	/* Check that spawn times are counted in the histogram, which is
+	 * cumulative and whose count includes every process.
+	 */
+	TEST_FEATURE ("with spawned processes");
+	metrics_spawned (metrics_now ());
+	metrics_spawned (metrics_now ());
+
+	text = metrics_text (NULL);
+
+	TEST_NE_P (strstr (text, "upstart_job_spawn_seconds_bucket{le=\"+Inf\"} 2\n"),
+		   NULL);
+	TEST_NE_P (strstr (text, "upstart_job_spawn_seconds_count 2\n"),
+		   NULL);
+
+	nih_free (text);
+
+	nih_free (metrics_methods);
+	metrics_methods = NULL;
+	metrics_enabled = FALSE;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_text ();
+
+	return 0;
+}
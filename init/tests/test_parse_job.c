@@ -36,7 +36,9 @@
 #include "conf.h"
 #include "parse_job.h"
 #include "errors.h"
+#include "resource.h"
 #include "apparmor.h"
+#include "listener.h"
 
 #ifdef ENABLE_CGROUPS
 
@@ -179,6 +181,60 @@ test_parse_job (void)
 
 		nih_free (job);
 	}
+
+
+	/* Check that an unknown stanza results in a syntax error, with
+	 * the position following its name.
+	 */
+	TEST_FEATURE ("with unknown stanza");
+	strcpy (buf, "wibble foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNKNOWN_STANZA);
+	TEST_EQ (pos, 7);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a stanza name must match in full, so that neither
+	 * a prefix nor an extension of one is accepted.
+	 */
+	TEST_FEATURE ("with prefix of stanza name");
+	strcpy (buf, "description foo\n");
+	strcat (buf, "exe /sbin/daemon\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNKNOWN_STANZA);
+	TEST_EQ (pos, 20);
+	TEST_EQ (lineno, 2);
+	nih_free (err);
+
+	TEST_FEATURE ("with extension of stanza name");
+	strcpy (buf, "execs /sbin/daemon\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNKNOWN_STANZA);
+	TEST_EQ (pos, 6);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
 }
 
 void
@@ -518,6 +574,9 @@ test_stanza_apparmor (void)
 	strcat (buf, " /etc/apparmor.d/usr.sbin.cupsd");
 	TEST_EQ_STR (process->command, buf);
 
+	TEST_ALLOC_PARENT (job->apparmor_load, job);
+	TEST_EQ_STR (job->apparmor_load, "/etc/apparmor.d/usr.sbin.cupsd");
+
 	nih_free (job);
 
 
@@ -551,6 +610,9 @@ test_stanza_apparmor (void)
 	strcat (buf, " /etc/apparmor.d/usr.sbin.cupsd");
 	TEST_EQ_STR (process->command, buf);
 
+	TEST_ALLOC_PARENT (job->apparmor_load, job);
+	TEST_EQ_STR (job->apparmor_load, "/etc/apparmor.d/usr.sbin.cupsd");
+
 	nih_free (job);
 
 
@@ -2386,6 +2448,15 @@ test_stanza_start (void)
 		TEST_EQ_P (oper->node.left, NULL);
 		TEST_EQ_P (oper->node.right, NULL);
 
+		TEST_ALLOC_PARENT (job->start_on->leaves, job->start_on);
+		TEST_EQ (job->start_on->leaves_len, 3);
+		TEST_EQ_P (job->start_on->leaves[0].oper,
+			   job->start_on->node.left->left);
+		TEST_EQ_P (job->start_on->leaves[1].oper,
+			   job->start_on->node.left->right);
+		TEST_EQ_P (job->start_on->leaves[2].oper,
+			   job->start_on->node.right);
+
 		nih_free (job);
 	}
 
@@ -2835,6 +2906,59 @@ test_stanza_start (void)
 	TEST_EQ (pos, 31);
 	TEST_EQ (lineno, 1);
 	nih_free (err);
+
+
+	/* Check that an expression with more tokens than fit in the first
+	 * block of the parsing arena is parsed in full.
+	 */
+	TEST_FEATURE ("with long expression");
+	{
+		char   long_buf[4096];
+		size_t i;
+
+		strcpy (long_buf, "start on (");
+		for (i = 0; i < 100; i++)
+			sprintf (long_buf + strlen (long_buf), "%sevent-%zu IFACE=eth%zu",
+				 i ? " or " : "", i, i);
+		strcat (long_buf, ")\n");
+
+		TEST_ALLOC_FAIL {
+			pos = 0;
+			lineno = 1;
+			job = parse_job (NULL, NULL, NULL, "test", long_buf,
+					 strlen (long_buf), &pos, &lineno);
+
+			if (test_alloc_failed) {
+				TEST_EQ_P (job, NULL);
+
+				err = nih_error_get ();
+				TEST_EQ (err->number, ENOMEM);
+				nih_free (err);
+
+				continue;
+			}
+
+			TEST_EQ (pos, strlen (long_buf));
+			TEST_EQ (lineno, 2);
+
+			TEST_EQ (job->start_on->type, EVENT_OR);
+			TEST_EQ (job->start_on->leaves_len, 100);
+
+			oper = job->start_on->leaves[0].oper;
+			TEST_EQ_STR (oper->name, "event-0");
+			TEST_ALLOC_PARENT (oper->env, oper);
+			TEST_ALLOC_PARENT (oper->env[0], oper->env);
+			TEST_EQ_STR (oper->env[0], "IFACE=eth0");
+			TEST_EQ_P (oper->env[1], NULL);
+
+			oper = job->start_on->leaves[99].oper;
+			TEST_EQ_STR (oper->name, "event-99");
+			TEST_EQ_STR (oper->env[0], "IFACE=eth99");
+			TEST_EQ_P (oper->env[1], NULL);
+
+			nih_free (job);
+		}
+	}
 }
 
 void
@@ -4594,6 +4718,146 @@ test_stanza_respawn (void)
 	}
 
 
+	/* Check that a respawn stanza with the delay argument results in
+	 * it being stored in the job, with the default maximum.
+	 */
+	TEST_FEATURE ("with delay");
+	strcpy (buf, "respawn delay 2\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->respawn_delay, 2);
+		TEST_EQ (job->respawn_delay_max, JOB_DEFAULT_RESPAWN_DELAY_MAX);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a respawn delay stanza may be followed by the maximum
+	 * that the delay may grow to.
+	 */
+	TEST_FEATURE ("with delay and maximum");
+	strcpy (buf, "respawn delay 2 60\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->respawn_delay, 2);
+		TEST_EQ (job->respawn_delay_max, 60);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a respawn delay stanza with a delay above the default
+	 * maximum raises the maximum to match.
+	 */
+	TEST_FEATURE ("with delay above default maximum");
+	strcpy (buf, "respawn delay 600\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->respawn_delay, 600);
+		TEST_EQ (job->respawn_delay_max, 600);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a respawn delay stanza with a non-integer argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with delay and non-integer argument");
+	strcpy (buf, "respawn delay foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_INTERVAL);
+	TEST_EQ (pos, 14);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a respawn delay stanza with a maximum less than the
+	 * delay results in a syntax error.
+	 */
+	TEST_FEATURE ("with delay and maximum below delay");
+	strcpy (buf, "respawn delay 10 5\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_INTERVAL);
+	TEST_EQ (pos, 17);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
 	/* Check that the most recent of multiple respawn stanzas is used. */
 	TEST_FEATURE ("with multiple limit and two argument stanzas");
 	strcpy (buf, "respawn limit 5 60\n");
@@ -5066,20 +5330,20 @@ test_stanza_instance (void)
 }
 
 void
-test_stanza_kill (void)
+test_stanza_shell (void)
 {
-	JobClass*job;
+	JobClass *job;
 	NihError *err;
 	size_t    pos, lineno;
 	char      buf[1024];
 
-	TEST_FUNCTION ("stanza_kill");
+	TEST_FUNCTION ("stanza_shell");
 
-	/* Check that a kill stanza with the timeout argument and a numeric
-	 * timeout results in it being stored in the job.
+	/* Check that a shell stanza with the auto argument sets the job's
+	 * shell_auto flag.
 	 */
-	TEST_FEATURE ("with timeout and single argument");
-	strcpy (buf, "kill timeout 10\n");
+	TEST_FEATURE ("with auto argument");
+	strcpy (buf, "shell auto\n");
 
 	TEST_ALLOC_FAIL {
 		pos = 0;
@@ -5102,17 +5366,18 @@ test_stanza_kill (void)
 
 		TEST_ALLOC_SIZE (job, sizeof (JobClass));
 
-		TEST_EQ (job->kill_timeout, 10);
+		TEST_TRUE (job->shell_auto);
 
 		nih_free (job);
 	}
 
 
-	/* Check that a kill stanza with the signal argument and signal,
-	 * sets the right signal on the jobs class.
+	/* Check that the most recent of multiple shell stanzas is used,
+	 * and that the always argument clears the flag.
 	 */
-	TEST_FEATURE ("with signal and single argument");
-	strcpy (buf, "kill signal INT\n");
+	TEST_FEATURE ("with always argument");
+	strcpy (buf, "shell auto\n");
+	strcat (buf, "shell always\n");
 
 	TEST_ALLOC_FAIL {
 		pos = 0;
@@ -5131,66 +5396,212 @@ test_stanza_kill (void)
 		}
 
 		TEST_EQ (pos, strlen (buf));
-		TEST_EQ (lineno, 2);
+		TEST_EQ (lineno, 3);
 
 		TEST_ALLOC_SIZE (job, sizeof (JobClass));
 
-		TEST_EQ (job->kill_signal, SIGINT);
+		TEST_FALSE (job->shell_auto);
 
 		nih_free (job);
 	}
 
-	/* Check that a kill stanza with the signal argument and numeric signal,
-	 * sets the right signal on the jobs class.
-	 */
-	TEST_FEATURE ("with signal and single numeric argument");
-	strcpy (buf, "kill signal 30\n");
 
-	TEST_ALLOC_FAIL {
-		pos = 0;
-		lineno = 1;
-		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
-				 &pos, &lineno);
+	/* Check that a script consisting of a single simple command is
+	 * marked as one that may be run without a shell, while one using
+	 * shell features is not.
+	 */
+	TEST_FEATURE ("with simple and complex scripts");
+	strcpy (buf, "shell auto\n");
+	strcat (buf, "pre-start script\n");
+	strcat (buf, "    # make the directory\n");
+	strcat (buf, "    mkdir -p /run/test\n");
+	strcat (buf, "end script\n");
+	strcat (buf, "post-stop script\n");
+	strcat (buf, "    rm -rf /run/test/*\n");
+	strcat (buf, "end script\n");
 
-		if (test_alloc_failed) {
-			TEST_EQ_P (job, NULL);
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+			 &pos, &lineno);
 
-			err = nih_error_get ();
-			TEST_EQ (err->number, ENOMEM);
-			nih_free (err);
+	TEST_NE_P (job, NULL);
+	TEST_EQ (pos, strlen (buf));
+	TEST_EQ (lineno, 9);
 
-			continue;
-		}
+	TEST_TRUE (job->shell_auto);
+	TEST_TRUE (job->process[PROCESS_PRE_START]->script);
+	TEST_TRUE (job->process[PROCESS_PRE_START]->simple);
+	TEST_TRUE (job->process[PROCESS_POST_STOP]->script);
+	TEST_FALSE (job->process[PROCESS_POST_STOP]->simple);
 
-		TEST_EQ (pos, strlen (buf));
-		TEST_EQ (lineno, 2);
+	nih_free (job);
 
-		TEST_ALLOC_SIZE (job, sizeof (JobClass));
 
-		/* Don't check symbolic here since different
-		 * architectures have different mappings.
-		 */
-		TEST_EQ (job->kill_signal, 30);
+	/* Check that a shell stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "shell\n");
 
-		nih_free (job);
-	}
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
 
-	/* Check that the last of multiple kill stanzas is used.
-	 */
-	TEST_FEATURE ("with multiple timeout and single argument stanzas");
-	strcpy (buf, "kill timeout 5\n");
-	strcat (buf, "kill timeout 10\n");
+	TEST_EQ_P (job, NULL);
 
-	TEST_ALLOC_FAIL {
-		pos = 0;
-		lineno = 1;
-		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
-				 &pos, &lineno);
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
 
-		if (test_alloc_failed) {
-			TEST_EQ_P (job, NULL);
 
-			err = nih_error_get ();
+	/* Check that a shell stanza with an unknown argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with unknown argument");
+	strcpy (buf, "shell foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNKNOWN_STANZA);
+	TEST_EQ (pos, 6);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_kill (void)
+{
+	JobClass*job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_kill");
+
+	/* Check that a kill stanza with the timeout argument and a numeric
+	 * timeout results in it being stored in the job.
+	 */
+	TEST_FEATURE ("with timeout and single argument");
+	strcpy (buf, "kill timeout 10\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->kill_timeout, 10);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a kill stanza with the signal argument and signal,
+	 * sets the right signal on the jobs class.
+	 */
+	TEST_FEATURE ("with signal and single argument");
+	strcpy (buf, "kill signal INT\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->kill_signal, SIGINT);
+
+		nih_free (job);
+	}
+
+	/* Check that a kill stanza with the signal argument and numeric signal,
+	 * sets the right signal on the jobs class.
+	 */
+	TEST_FEATURE ("with signal and single numeric argument");
+	strcpy (buf, "kill signal 30\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		/* Don't check symbolic here since different
+		 * architectures have different mappings.
+		 */
+		TEST_EQ (job->kill_signal, 30);
+
+		nih_free (job);
+	}
+
+	/* Check that the last of multiple kill stanzas is used.
+	 */
+	TEST_FEATURE ("with multiple timeout and single argument stanzas");
+	strcpy (buf, "kill timeout 5\n");
+	strcat (buf, "kill timeout 10\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
 			TEST_EQ (err->number, ENOMEM);
 			nih_free (err);
 
@@ -8826,6 +9237,943 @@ test_stanza_usage (void)
 	nih_free (err);
 }
 
+void
+test_stanza_uses (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_uses");
+
+	/* Check that a uses stanza without an amount results in one of
+	 * the resource being stored in the job.
+	 */
+	TEST_FEATURE ("with single argument");
+	strcpy (buf, "uses cpu\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->uses_len, 1);
+		TEST_ALLOC_PARENT (job->uses, job);
+		TEST_EQ_STR (job->uses[0], "cpu");
+		TEST_EQ_P (job->uses[1], NULL);
+		TEST_ALLOC_PARENT (job->uses_amount, job);
+		TEST_EQ (job->uses_amount[0], RESOURCE_UNIT);
+
+		nih_free (job);
+	}
+
+
+	/* Check that multiple uses stanzas add each resource, and that
+	 * naming a resource again replaces its amount.
+	 */
+	TEST_FEATURE ("with multiple stanzas");
+	strcpy (buf, "uses cpu 0.5\n");
+	strcat (buf, "uses disk 2\n");
+	strcat (buf, "uses cpu 0.25\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 4);
+
+		TEST_EQ (job->uses_len, 2);
+		TEST_EQ_STR (job->uses[0], "cpu");
+		TEST_EQ (job->uses_amount[0], 250);
+		TEST_EQ_STR (job->uses[1], "disk");
+		TEST_EQ (job->uses_amount[1], 2000);
+		TEST_EQ_P (job->uses[2], NULL);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a uses stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "uses\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 4);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a uses stanza with an illegal amount results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with illegal amount");
+	strcpy (buf, "uses cpu lots\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_AMOUNT);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a uses stanza with an extra argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with extra argument");
+	strcpy (buf, "uses cpu 1 foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNEXPECTED_TOKEN);
+	TEST_EQ (pos, 11);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_pressure (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_pressure");
+
+	/* Check that multiple pressure stanzas add each resource and its
+	 * threshold, and that naming a resource again replaces it.
+	 */
+	TEST_FEATURE ("with multiple stanzas");
+	strcpy (buf, "pressure io 20%\n");
+	strcat (buf, "pressure cpu 50\n");
+	strcat (buf, "pressure io 10%\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 4);
+
+		TEST_EQ (job->pressure_len, 2);
+		TEST_ALLOC_PARENT (job->pressure, job);
+		TEST_EQ_STR (job->pressure[0], "io");
+		TEST_EQ_STR (job->pressure[1], "cpu");
+		TEST_EQ_P (job->pressure[2], NULL);
+		TEST_ALLOC_PARENT (job->pressure_max, job);
+		TEST_EQ (job->pressure_max[0], 10);
+		TEST_EQ (job->pressure_max[1], 50);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a pressure stanza without a threshold results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing threshold");
+	strcpy (buf, "pressure io\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 11);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a pressure stanza naming an unknown resource results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with unknown resource");
+	strcpy (buf, "pressure disk 20%\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_PRESSURE);
+	TEST_EQ (pos, 9);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a pressure stanza with an illegal threshold results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with illegal threshold");
+	strcpy (buf, "pressure io 100%\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_PRESSURE);
+	TEST_EQ (pos, 9);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_priority (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_priority");
+
+	/* Check that a priority stanza results in it being stored in the
+	 * job.
+	 */
+	TEST_FEATURE ("with argument");
+	strcpy (buf, "priority 10\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->priority, 10);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a priority stanza with a negative argument results
+	 * in it being stored in the job.
+	 */
+	TEST_FEATURE ("with negative argument");
+	strcpy (buf, "priority -10\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->priority, -10);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a priority stanza without an argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "priority\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 8);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a priority stanza with an overly large argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with overly large argument");
+	strcpy (buf, "priority 1001\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_PRIORITY);
+	TEST_EQ (pos, 9);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a priority stanza with a non-integer argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "priority high\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_PRIORITY);
+	TEST_EQ (pos, 9);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_pool (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_pool");
+
+	/* Check that a pool stanza results in it being stored in the
+	 * job.
+	 */
+	TEST_FEATURE ("with argument");
+	strcpy (buf, "instance $ID\n");
+	strcat (buf, "pool 4\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 3);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_EQ (job->pool, 4);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a pool stanza without an argument results in a syntax
+	 * error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "pool\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 4);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a pool stanza with an argument above JOB_POOL_MAX
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with overly large argument");
+	strcpy (buf, "pool 65\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_POOL);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a pool stanza with a negative argument results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with negative argument");
+	strcpy (buf, "pool -1\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_POOL);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a pool stanza with a non-integer argument results in
+	 * a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "pool foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_POOL);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_cpus (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_cpus");
+
+	/* Check that a cpus stanza results in the list being stored in
+	 * the job.
+	 */
+	TEST_FEATURE ("with argument");
+	strcpy (buf, "cpus 0-3,8\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_SIZE (job, sizeof (JobClass));
+
+		TEST_ALLOC_PARENT (job->cpus, job);
+		TEST_EQ_STR (job->cpus, "0-3,8");
+
+		nih_free (job);
+	}
+
+
+	/* Check that the last of multiple cpus stanzas is used.
+	 */
+	TEST_FEATURE ("with multiple stanzas");
+	strcpy (buf, "cpus 0-3\n");
+	strcat (buf, "cpus 4\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 3);
+
+		TEST_EQ_STR (job->cpus, "4");
+
+		nih_free (job);
+	}
+
+
+	/* Check that a cpus stanza without an argument results in a syntax
+	 * error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "cpus\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 4);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a cpus stanza with a backwards range results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with backwards range");
+	strcpy (buf, "cpus 3-1\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CPUS);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a cpus stanza with something other than numbers
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with non-numeric argument");
+	strcpy (buf, "cpus all\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_CPUS);
+	TEST_EQ (pos, 5);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_numa_node (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_numa_node");
+
+	/* Check that a numa-node stanza results in the node being stored
+	 * in the job.
+	 */
+	TEST_FEATURE ("with argument");
+	strcpy (buf, "numa-node 1\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->numa_node, 1);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a numa-node stanza with a negative argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with negative argument");
+	strcpy (buf, "numa-node -1\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_NUMA_NODE);
+	TEST_EQ (pos, 10);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a numa-node stanza with a non-integer argument results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with non-integer argument");
+	strcpy (buf, "numa-node foo\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_NUMA_NODE);
+	TEST_EQ (pos, 10);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_spread_instances (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_spread_instances");
+
+	/* Check that a spread-instances stanza with the cpus argument sets
+	 * the job to spread its instances across CPUs.
+	 */
+	TEST_FEATURE ("with cpus argument");
+	strcpy (buf, "spread-instances cpus\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->spread, JOB_SPREAD_CPUS);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a spread-instances stanza with the numa-nodes argument
+	 * sets the job to spread its instances across NUMA nodes.
+	 */
+	TEST_FEATURE ("with numa-nodes argument");
+	strcpy (buf, "spread-instances numa-nodes\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_EQ (job->spread, JOB_SPREAD_NODES);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a spread-instances stanza with an unknown argument
+	 * results in a syntax error.
+	 */
+	TEST_FEATURE ("with unknown argument");
+	strcpy (buf, "spread-instances sockets\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_UNKNOWN_STANZA);
+	TEST_EQ (pos, 17);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+}
+
+void
+test_stanza_socket (void)
+{
+	JobClass *job;
+	NihError *err;
+	size_t    pos, lineno;
+	char      buf[1024];
+
+	TEST_FUNCTION ("stanza_socket");
+
+	/* Check that a socket stanza results in its arguments being
+	 * stored in the job.
+	 */
+	TEST_FEATURE ("with inet socket");
+	strcpy (buf, "socket PROTO=inet PORT=80\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 2);
+
+		TEST_ALLOC_PARENT (job->sockets, job);
+		TEST_EQ_STR (job->sockets[0], "PROTO=inet PORT=80");
+		TEST_EQ_P (job->sockets[1], NULL);
+
+		nih_free (job);
+	}
+
+
+	/* Check that multiple socket stanzas are stored in order. */
+	TEST_FEATURE ("with multiple sockets");
+	strcpy (buf, "socket PROTO=inet6 PORT=80 ADDR=::1\n");
+	strcat (buf, "socket PROTO=unix PATH=/run/foo.sock\n");
+
+	TEST_ALLOC_FAIL {
+		pos = 0;
+		lineno = 1;
+		job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf),
+				 &pos, &lineno);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (job, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+
+			continue;
+		}
+
+		TEST_EQ (pos, strlen (buf));
+		TEST_EQ (lineno, 3);
+
+		TEST_EQ_STR (job->sockets[0], "PROTO=inet6 PORT=80 ADDR=::1");
+		TEST_EQ_STR (job->sockets[1], "PROTO=unix PATH=/run/foo.sock");
+		TEST_EQ_P (job->sockets[2], NULL);
+
+		nih_free (job);
+	}
+
+
+	/* Check that a socket stanza without arguments results in a
+	 * syntax error.
+	 */
+	TEST_FEATURE ("with missing argument");
+	strcpy (buf, "socket\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, NIH_CONFIG_EXPECTED_TOKEN);
+	TEST_EQ (pos, 6);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that a socket stanza with an unsupported protocol results
+	 * in a syntax error.
+	 */
+	TEST_FEATURE ("with illegal socket");
+	strcpy (buf, "socket PROTO=udp PORT=80\n");
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_ILLEGAL_SOCKET);
+	TEST_EQ (pos, 7);
+	TEST_EQ (lineno, 1);
+	nih_free (err);
+
+
+	/* Check that more socket stanzas than can be passed to the job
+	 * result in a syntax error.
+	 */
+	TEST_FEATURE ("with too many sockets");
+	buf[0] = '\0';
+	for (int i = 0; i <= LISTENER_MAX; i++)
+		sprintf (buf + strlen (buf), "socket PROTO=inet PORT=8%d\n", i);
+
+	pos = 0;
+	lineno = 1;
+	job = parse_job (NULL, NULL, NULL, "test", buf, strlen (buf), &pos, &lineno);
+
+	TEST_EQ_P (job, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, PARSE_TOO_MANY_SOCKETS);
+	TEST_EQ (pos, LISTENER_MAX * 26 + 7);
+	TEST_EQ (lineno, LISTENER_MAX + 1);
+	nih_free (err);
+}
+
 #ifdef ENABLE_CGROUPS
 
 void
@@ -9735,6 +11083,7 @@ main (int   argc,
 
 	test_stanza_expect ();
 	test_stanza_task ();
+	test_stanza_shell ();
 
 	test_stanza_kill ();
 
@@ -9754,6 +11103,14 @@ main (int   argc,
 	test_stanza_setuid ();
 	test_stanza_setgid ();
 	test_stanza_usage ();
+	test_stanza_uses ();
+	test_stanza_priority ();
+	test_stanza_pressure ();
+	test_stanza_pool ();
+	test_stanza_cpus ();
+	test_stanza_numa_node ();
+	test_stanza_spread_instances ();
+	test_stanza_socket ();
 
 #ifdef ENABLE_CGROUPS
 	test_stanza_cgroup ();
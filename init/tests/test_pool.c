@@ -0,0 +1,165 @@
+/* upstart
+ *
+ * test_pool.c - test suite for init/pool.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <string.h>
+
+#include <nih/macros.h>
+
+#include "pool.h"
+
+
+void
+test_malloc (void)
+{
+	void     *ptr1, *ptr2, *ptr3;
+	size_t    cached;
+	uint64_t  allocs;
+
+	TEST_FUNCTION ("pool_malloc");
+
+
+	/* Check that a freed block is kept, and handed out again for an
+	 * allocation of the same size class; both allocations are counted.
+	 */
+	TEST_FEATURE ("with freed block");
+	allocs = pool_stats.allocs;
+
+	ptr1 = pool_malloc (40);
+	TEST_NE_P (ptr1, NULL);
+	memset (ptr1, 'x', 40);
+
+	cached = pool_cached (40);
+	pool_free (ptr1);
+	TEST_EQ (pool_cached (40), cached + 1);
+
+	ptr2 = pool_malloc (64);
+	TEST_EQ_P (ptr2, ptr1);
+	TEST_EQ (pool_cached (40), cached);
+	TEST_EQ (pool_stats.allocs, allocs + 2);
+
+
+	/* Check that a block of a different size class is not reused. */
+	TEST_FEATURE ("with different size class");
+	pool_free (ptr2);
+
+	ptr3 = pool_malloc (100);
+	TEST_NE_P (ptr3, ptr2);
+	TEST_EQ (pool_cached (40), cached + 1);
+
+	pool_free (ptr3);
+	ptr1 = pool_malloc (40);
+	TEST_EQ_P (ptr1, ptr2);
+	pool_free (ptr1);
+
+
+	/* Check that large blocks are never kept. */
+	TEST_FEATURE ("with large block");
+	ptr1 = pool_malloc (POOL_MAX_SIZE + 1);
+	TEST_NE_P (ptr1, NULL);
+	memset (ptr1, 'x', POOL_MAX_SIZE + 1);
+
+	pool_free (ptr1);
+	TEST_EQ (pool_cached (POOL_MAX_SIZE + 1), 0);
+
+
+	/* Check that no more than POOL_CACHE_MAX blocks are kept in a size
+	 * class.
+	 */
+	TEST_FEATURE ("with full size class");
+	{
+		void *ptrs[POOL_CACHE_MAX + 1];
+
+		for (size_t i = 0; i < POOL_CACHE_MAX + 1; i++)
+			ptrs[i] = pool_malloc (200);
+
+		for (size_t i = 0; i < POOL_CACHE_MAX + 1; i++)
+			pool_free (ptrs[i]);
+
+		TEST_EQ (pool_cached (200), POOL_CACHE_MAX);
+	}
+}
+
+void
+test_realloc (void)
+{
+	char *ptr1, *ptr2;
+
+	TEST_FUNCTION ("pool_realloc");
+
+
+	/* Check that a block is resized in place within its size class. */
+	TEST_FEATURE ("within size class");
+	ptr1 = pool_malloc (10);
+	strcpy (ptr1, "frodo");
+
+	ptr2 = pool_realloc (ptr1, POOL_CLASS_SIZE);
+	TEST_EQ_P (ptr2, ptr1);
+	TEST_EQ_STR (ptr2, "frodo");
+
+
+	/* Check that growing a block into a larger size class copies its
+	 * contents into a new block.
+	 */
+	TEST_FEATURE ("into larger size class");
+	ptr1 = pool_realloc (ptr2, 300);
+	TEST_NE_P (ptr1, NULL);
+	TEST_EQ_STR (ptr1, "frodo");
+	memset (ptr1 + 6, 'x', 294);
+
+
+	/* Check that a block can grow beyond and shrink back into the
+	 * pool, keeping its contents.
+	 */
+	TEST_FEATURE ("beyond pool");
+	ptr2 = pool_realloc (ptr1, POOL_MAX_SIZE * 4);
+	TEST_NE_P (ptr2, NULL);
+	TEST_EQ_STR (ptr2, "frodo");
+
+	ptr2 = pool_realloc (ptr2, POOL_MAX_SIZE * 8);
+	TEST_NE_P (ptr2, NULL);
+	TEST_EQ_STR (ptr2, "frodo");
+
+	ptr1 = pool_realloc (ptr2, 10);
+	TEST_NE_P (ptr1, NULL);
+	TEST_EQ_STR (ptr1, "frodo");
+
+	pool_free (ptr1);
+
+
+	/* Check that a NULL block is allocated. */
+	TEST_FEATURE ("with NULL block");
+	ptr1 = pool_realloc (NULL, 20);
+	TEST_NE_P (ptr1, NULL);
+
+	pool_free (ptr1);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_malloc ();
+	test_realloc ();
+
+	return 0;
+}
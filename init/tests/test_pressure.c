@@ -0,0 +1,257 @@
+/* upstart
+ *
+ * test_pressure.c - test suite for init/pressure.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "event.h"
+#include "events.h"
+#include "deadline.h"
+#include "pressure.h"
+
+
+static void
+write_pressure (const char *dirname,
+		const char *resource,
+		const char *avg10)
+{
+	char  filename[PATH_MAX];
+	FILE *f;
+
+	sprintf (filename, "%s/%s", dirname, resource);
+
+	f = fopen (filename, "w");
+	TEST_NE_P (f, NULL);
+	fprintf (f, "some avg10=%s avg60=0.00 avg300=0.00 total=0\n", avg10);
+	fprintf (f, "full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n");
+	fclose (f);
+}
+
+
+void
+test_parse_threshold (void)
+{
+	int threshold;
+
+	TEST_FUNCTION ("pressure_parse_threshold");
+
+	/* Check that a whole percentage is accepted with or without the
+	 * percent sign.
+	 */
+	TEST_FEATURE ("with valid thresholds");
+	TEST_EQ (pressure_parse_threshold ("20", &threshold), 0);
+	TEST_EQ (threshold, 20);
+
+	TEST_EQ (pressure_parse_threshold ("5%", &threshold), 0);
+	TEST_EQ (threshold, 5);
+
+	TEST_EQ (pressure_parse_threshold ("99%", &threshold), 0);
+	TEST_EQ (threshold, 99);
+
+
+	/* Check that anything else is rejected. */
+	TEST_FEATURE ("with invalid thresholds");
+	TEST_LT (pressure_parse_threshold ("", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("0", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("100%", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("-5", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("%", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("20%%", &threshold), 0);
+	TEST_LT (pressure_parse_threshold ("2.5", &threshold), 0);
+}
+
+
+void
+test_valid_resource (void)
+{
+	TEST_FUNCTION ("pressure_valid_resource");
+
+	TEST_TRUE (pressure_valid_resource ("cpu"));
+	TEST_TRUE (pressure_valid_resource ("io"));
+	TEST_TRUE (pressure_valid_resource ("memory"));
+
+	TEST_FALSE (pressure_valid_resource (""));
+	TEST_FALSE (pressure_valid_resource ("irq"));
+	TEST_FALSE (pressure_valid_resource ("IO"));
+}
+
+
+void
+test_update (void)
+{
+	char             dirname[PATH_MAX];
+	char             filename[PATH_MAX];
+	JobClass        *class;
+	PressureTrigger *trigger;
+	Event           *event;
+
+	TEST_FUNCTION ("pressure_update");
+	job_class_init ();
+	event_init ();
+	pressure_init ();
+
+	TEST_FILENAME (dirname);
+	mkdir (dirname, 0755);
+	pressure_dir = dirname;
+
+	write_pressure (dirname, "io", "0.00");
+
+
+	/* Check that a trigger is created the first time a resource and
+	 * threshold are asked for, and found again after that.
+	 */
+	TEST_FEATURE ("with new trigger");
+	trigger = pressure_get ("io", 20);
+	TEST_NE_P (trigger, NULL);
+	TEST_EQ_STR (trigger->resource, "io");
+	TEST_EQ (trigger->threshold, 20);
+	TEST_FALSE (trigger->high);
+	TEST_EQ_P (trigger->check, NULL);
+
+	TEST_EQ_P (pressure_get ("io", 20), trigger);
+	TEST_NE_P (pressure_get ("io", 50), trigger);
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that pressure is high when the ten second average is
+	 * above the threshold, that a pressure event is emitted, and that
+	 * a deadline is added to check it again.
+	 */
+	TEST_FEATURE ("with pressure above threshold");
+	write_pressure (dirname, "io", "35.50");
+	pressure_update (trigger);
+
+	TEST_TRUE (trigger->high);
+	TEST_TRUE (pressure_high ("io", 20));
+	TEST_NE_P (trigger->check, NULL);
+	TEST_EQ (trigger->check->period, PRESSURE_CHECK_INTERVAL);
+
+	TEST_LIST_NOT_EMPTY (events);
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, PRESSURE_EVENT);
+	TEST_EQ_STR (event->env[0], "RESOURCE=io");
+	TEST_EQ_STR (event->env[1], "THRESHOLD=20");
+	TEST_EQ_STR (event->env[2], "STATE=high");
+	TEST_EQ_P (event->env[3], NULL);
+	nih_free (event);
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that pressure remaining high emits nothing more. */
+	TEST_FEATURE ("with pressure still above threshold");
+	pressure_update (trigger);
+
+	TEST_TRUE (trigger->high);
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that pressure falling below the threshold emits a
+	 * pressure event and removes the deadline.
+	 */
+	TEST_FEATURE ("with pressure below threshold");
+	write_pressure (dirname, "io", "4.20");
+	pressure_update (trigger);
+
+	TEST_FALSE (trigger->high);
+	TEST_EQ_P (trigger->check, NULL);
+
+	TEST_LIST_NOT_EMPTY (events);
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, PRESSURE_EVENT);
+	TEST_EQ_STR (event->env[0], "RESOURCE=io");
+	TEST_EQ_STR (event->env[1], "THRESHOLD=20");
+	TEST_EQ_STR (event->env[2], "STATE=low");
+	nih_free (event);
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that pressure is never high for a resource whose file
+	 * cannot be read.
+	 */
+	TEST_FEATURE ("with missing pressure file");
+	TEST_FALSE (pressure_high ("memory", 10));
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that triggers no job names any longer are freed, and
+	 * those that one does are kept.
+	 */
+	TEST_FEATURE ("with triggers not named by jobs");
+	class = job_class_new (NULL, "foo", NULL);
+	class->pressure = nih_str_array_new (class);
+	NIH_MUST (nih_str_array_add (&class->pressure, class, NULL, "io"));
+	class->pressure_max = nih_alloc (class, sizeof (int));
+	class->pressure_max[0] = 20;
+	class->pressure_len = 1;
+	nih_hash_add (job_classes, &class->entry);
+
+	TEST_FREE_TAG (trigger);
+
+	pressure_changed ();
+	pressure_poll ();
+
+	TEST_NOT_FREE (trigger);
+	TEST_EQ_P (pressure_triggers->next, &trigger->entry);
+	TEST_EQ_P (trigger->entry.next, pressure_triggers);
+
+	nih_free (class);
+
+	pressure_changed ();
+	pressure_poll ();
+
+	TEST_FREE (trigger);
+	TEST_LIST_EMPTY (pressure_triggers);
+	TEST_EQ (deadline_pending (), 0);
+
+	sprintf (filename, "%s/io", dirname);
+	unlink (filename);
+	rmdir (dirname);
+
+	pressure_dir = PRESSURE_DIR;
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_parse_threshold ();
+	test_valid_resource ();
+	test_update ();
+
+	return 0;
+}
@@ -47,6 +47,7 @@ test_new (void)
 		TEST_ALLOC_SIZE (process, sizeof (Process));
 
 		TEST_EQ (process->script, FALSE);
+		TEST_EQ (process->simple, FALSE);
 		TEST_EQ_P (process->command, NULL);
 
 		nih_free (process);
@@ -167,6 +168,79 @@ test_from_name (void)
 }
 
 
+void
+test_script_command (void)
+{
+	char *cmd;
+
+	TEST_FUNCTION ("process_script_command");
+
+	/* Check that a script consisting of a single command has that
+	 * command returned, ignoring blank lines and comments.
+	 */
+	TEST_FEATURE ("with single command");
+	TEST_ALLOC_FAIL {
+		cmd = process_script_command (NULL,
+			"\n  # comment\n\t/sbin/ifup -a --force\n\n");
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (cmd, NULL);
+			continue;
+		}
+
+		TEST_EQ_STR (cmd, "/sbin/ifup -a --force");
+		nih_free (cmd);
+	}
+
+
+	/* Check that a leading exec is dropped from the command. */
+	TEST_FEATURE ("with exec");
+	cmd = process_script_command (NULL, "exec  sleep 10\n");
+
+	TEST_EQ_STR (cmd, "sleep 10");
+	nih_free (cmd);
+
+
+	/* Check that a script with more than one command needs a shell. */
+	TEST_FEATURE ("with multiple commands");
+	cmd = process_script_command (NULL, "mkdir /run/foo\nmkdir /run/bar\n");
+
+	TEST_EQ_P (cmd, NULL);
+
+
+	/* Check that a script using shell characters needs a shell. */
+	TEST_FEATURE ("with shell characters");
+	cmd = process_script_command (NULL, "echo $UPSTART_JOB\n");
+
+	TEST_EQ_P (cmd, NULL);
+
+
+	/* Check that a trailing comment needs a shell. */
+	TEST_FEATURE ("with trailing comment");
+	cmd = process_script_command (NULL, "sleep 10 # wait\n");
+
+	TEST_EQ_P (cmd, NULL);
+
+
+	/* Check that a shell builtin needs a shell, with or without exec. */
+	TEST_FEATURE ("with builtin");
+	cmd = process_script_command (NULL, "cd /tmp\n");
+
+	TEST_EQ_P (cmd, NULL);
+
+	cmd = process_script_command (NULL, "exec ulimit -c 0\n");
+
+	TEST_EQ_P (cmd, NULL);
+
+
+	/* Check that an empty script has no command. */
+	TEST_FEATURE ("with empty script");
+	cmd = process_script_command (NULL, "\n# nothing\n");
+
+	TEST_EQ_P (cmd, NULL);
+}
+
+
 int
 main (int   argc,
       char *argv[])
@@ -178,6 +252,7 @@ main (int   argc,
 
 	test_name ();
 	test_from_name ();
+	test_script_command ();
 
 	return 0;
 }
@@ -0,0 +1,141 @@
+/* upstart
+ *
+ * test_pty.c - test suite for init/pty.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/error.h>
+
+#include "pty.h"
+
+
+void
+test_open (void)
+{
+	Pty  pty;
+	int  ret, slave;
+	char buf[8];
+
+	TEST_FUNCTION ("pty_open");
+
+
+	/* Check that with an empty pool a new pty is allocated, with the
+	 * master close-on-exec and the slave ready to be opened by name
+	 * and connected to it.
+	 */
+	TEST_FEATURE ("with empty pool");
+	pty_pool_size = 0;
+	pty_poll ();
+
+	ret = pty_open (&pty);
+
+	TEST_EQ (ret, 0);
+	TEST_GE (pty.master, 0);
+	TEST_TRUE (fcntl (pty.master, F_GETFD) & FD_CLOEXEC);
+	TEST_EQ_STRN (pty.name, "/dev/pts/");
+
+	slave = open (pty.name, O_RDWR | O_NOCTTY);
+	TEST_GE (slave, 0);
+
+	TEST_EQ (write (slave, "x", 1), 1);
+	TEST_EQ (read (pty.master, buf, sizeof (buf)), 1);
+	TEST_EQ (buf[0], 'x');
+
+	close (slave);
+	close (pty.master);
+
+
+	/* Check that a pty is taken from the pool when there is one. */
+	TEST_FEATURE ("with filled pool");
+	pty_pool_size = 2;
+	pty_poll ();
+
+	TEST_EQ (pty_pool_len (), 2);
+
+	ret = pty_open (&pty);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (pty_pool_len (), 1);
+	TEST_GE (pty.master, 0);
+
+	slave = open (pty.name, O_RDWR | O_NOCTTY);
+	TEST_GE (slave, 0);
+
+	close (slave);
+	close (pty.master);
+
+	pty_pool_size = 0;
+	pty_poll ();
+}
+
+void
+test_poll (void)
+{
+	TEST_FUNCTION ("pty_poll");
+
+
+	/* Check that the pool is refilled up to its size. */
+	TEST_FEATURE ("with pool to refill");
+	pty_pool_size = 3;
+	pty_poll ();
+
+	TEST_EQ (pty_pool_len (), 3);
+
+
+	/* Check that ptys beyond the size of the pool are closed. */
+	TEST_FEATURE ("with pool shrunk");
+	pty_pool_size = 1;
+	pty_poll ();
+
+	TEST_EQ (pty_pool_len (), 1);
+
+
+	/* Check that the pool is never filled beyond its maximum. */
+	TEST_FEATURE ("with size beyond maximum");
+	pty_pool_size = PTY_POOL_MAX * 2;
+	pty_poll ();
+
+	TEST_LE (pty_pool_len (), PTY_POOL_MAX);
+
+
+	/* Check that a size of zero empties the pool. */
+	TEST_FEATURE ("with pool disabled");
+	pty_pool_size = 0;
+	pty_poll ();
+
+	TEST_EQ (pty_pool_len (), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	nih_error_init ();
+
+	test_open ();
+	test_poll ();
+
+	return 0;
+}
@@ -0,0 +1,410 @@
+/* upstart
+ *
+ * test_quiesce.c - test suite for init/quiesce.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/hash.h>
+#include <nih/main.h>
+
+#include "job_process.h"
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "event_operator.h"
+#include "quiesce.h"
+
+
+/**
+ * new_class:
+ * @name: name of class,
+ * @depends: name of job whose start @name waits for, or NULL,
+ * @kill_timeout: kill timeout of class.
+ *
+ * Returns: newly registered job class.
+ **/
+static JobClass *
+new_class (const char *name,
+	   const char *depends,
+	   time_t      kill_timeout)
+{
+	JobClass  *class;
+	char     **env;
+
+	class = NIH_MUST (job_class_new (NULL, name, NULL));
+	class->kill_timeout = kill_timeout;
+
+	if (depends) {
+		env = NIH_MUST (nih_str_array_new (class));
+		NIH_MUST (nih_str_array_add (&env, class, NULL, depends));
+
+		class->start_on = NIH_MUST (event_operator_new (
+				class, EVENT_MATCH, JOB_STARTED_EVENT, env));
+	}
+
+	job_class_add_safe (class);
+
+	return class;
+}
+
+/**
+ * new_running_job:
+ * @class: class of job.
+ *
+ * Returns: new instance of @class that is running without a process.
+ **/
+static Job *
+new_running_job (JobClass *class)
+{
+	Job *job;
+
+	job = NIH_MUST (job_new (class, ""));
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+
+	return job;
+}
+
+
+/* A quiesce can't be undone, so each of these is run in a child process
+ * of its own with a fresh set of job classes.
+ */
+
+void
+test_stop_jobs (void)
+{
+	JobClass *foo, *bar, *baz;
+	Job      *foo_job, *bar_job, *baz_job;
+	pid_t     pid;
+	int       status;
+
+	TEST_FUNCTION ("quiesce_stop_jobs");
+	program_name = "test";
+
+
+	/* Check that a job that another running job waits for to be
+	 * started is not stopped until that job has stopped, and that it
+	 * is stopped once it has.
+	 */
+	TEST_FEATURE ("with job depended on by another");
+	TEST_CHILD (pid) {
+		foo = new_class ("foo", NULL, 5);
+		bar = new_class ("bar", "foo", 20);
+
+		foo_job = new_running_job (foo);
+		bar_job = new_running_job (bar);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		TEST_EQ (bar_job->goal, JOB_STOP);
+		TEST_EQ (bar_job->state, JOB_STOPPING);
+
+		TEST_EQ (foo_job->goal, JOB_START);
+		TEST_EQ (foo_job->state, JOB_RUNNING);
+
+		TEST_FREE_TAG (bar_job);
+		TEST_FREE_TAG (foo_job);
+
+		event_poll ();
+
+		TEST_FREE (bar_job);
+		TEST_FREE (foo_job);
+
+		TEST_HASH_EMPTY (foo->instances);
+		TEST_HASH_EMPTY (bar->instances);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that a job is held back for as long as a job that depends
+	 * on it is still running, even while that job is itself held back
+	 * for another, and that a job nothing depends on is stopped at
+	 * once.
+	 */
+	TEST_FEATURE ("with job still needed by running job");
+	TEST_CHILD (pid) {
+		foo = new_class ("foo", NULL, 5);
+		bar = new_class ("bar", "foo", 10);
+		baz = new_class ("baz", "bar", 20);
+
+		foo_job = new_running_job (foo);
+		bar_job = new_running_job (bar);
+		baz_job = new_running_job (baz);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		TEST_EQ (baz_job->goal, JOB_STOP);
+		TEST_EQ (baz_job->state, JOB_STOPPING);
+
+		TEST_EQ (bar_job->goal, JOB_START);
+		TEST_EQ (bar_job->state, JOB_RUNNING);
+
+		TEST_EQ (foo_job->goal, JOB_START);
+		TEST_EQ (foo_job->state, JOB_RUNNING);
+
+		/* Running the scheduler again while baz is still stopping
+		 * must not release either of the jobs it holds back.
+		 */
+		quiesce_stop_jobs ();
+
+		TEST_EQ (bar_job->goal, JOB_START);
+		TEST_EQ (foo_job->goal, JOB_START);
+
+		event_poll ();
+
+		TEST_HASH_EMPTY (foo->instances);
+		TEST_HASH_EMPTY (bar->instances);
+		TEST_HASH_EMPTY (baz->instances);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that a job whose dependent waits for some other job is not
+	 * held back by it.
+	 */
+	TEST_FEATURE ("with job not depended on");
+	TEST_CHILD (pid) {
+		foo = new_class ("foo", NULL, 5);
+		bar = new_class ("bar", "baz", 20);
+
+		foo_job = new_running_job (foo);
+		bar_job = new_running_job (bar);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		TEST_EQ (foo_job->goal, JOB_STOP);
+		TEST_EQ (foo_job->state, JOB_STOPPING);
+
+		TEST_EQ (bar_job->goal, JOB_STOP);
+		TEST_EQ (bar_job->state, JOB_STOPPING);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that a job is not held back for its dependents when the
+	 * shutdown timeout leaves no time to kill it after them.
+	 */
+	TEST_FEATURE ("with shutdown timeout");
+	TEST_CHILD (pid) {
+		quiesce_timeout = 3;
+
+		foo = new_class ("foo", NULL, 5);
+		bar = new_class ("bar", "foo", 20);
+
+		foo_job = new_running_job (foo);
+		bar_job = new_running_job (bar);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		TEST_EQ (bar_job->goal, JOB_STOP);
+		TEST_EQ (bar_job->state, JOB_STOPPING);
+
+		TEST_EQ (foo_job->goal, JOB_STOP);
+		TEST_EQ (foo_job->state, JOB_STOPPING);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+}
+
+
+void
+test_kill_timeout (void)
+{
+	JobClass        *class;
+	Job             *job;
+	Deadline        *timer;
+	struct timespec  now;
+	pid_t            pid;
+	int              status;
+
+	TEST_FUNCTION ("quiesce_kill_timeout");
+	program_name = "test";
+
+
+	/* Check that outside of quiesce a job is given its own kill
+	 * timeout.
+	 */
+	TEST_FEATURE ("without quiesce");
+	class = job_class_new (NULL, "test", NULL);
+	class->kill_timeout = 20;
+
+	job = job_new (class, "");
+
+	TEST_EQ (quiesce_kill_timeout (job), 20);
+
+	nih_free (class);
+
+
+	/* Check that a job that ignores its kill signal during quiesce is
+	 * given its kill timeout, since it is the longest, and that it is
+	 * sent SIGKILL when the kill timer fires.
+	 */
+	TEST_FEATURE ("with job ignoring kill signal");
+	TEST_CHILD (pid) {
+		int wait_fd = 0;
+		int child_status;
+
+		class = new_class ("foo", NULL, 20);
+		job = new_running_job (class);
+
+		TEST_CHILD_WAIT (job->pid[PROCESS_MAIN], wait_fd) {
+			struct sigaction act;
+
+			act.sa_handler = SIG_IGN;
+			act.sa_flags = 0;
+			sigemptyset (&act.sa_mask);
+			sigaction (SIGTERM, &act, NULL);
+
+			TEST_CHILD_RELEASE (wait_fd);
+
+			for (;;)
+				pause ();
+		}
+		setpgid (job->pid[PROCESS_MAIN], job->pid[PROCESS_MAIN]);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		TEST_EQ (job->goal, JOB_STOP);
+		TEST_EQ (job->state, JOB_STOPPING);
+
+		event_poll ();
+
+		TEST_EQ (job->goal, JOB_STOP);
+		TEST_EQ (job->state, JOB_KILLED);
+		TEST_EQ (kill (job->pid[PROCESS_MAIN], 0), 0);
+
+		TEST_EQ (clock_gettime (CLOCK_MONOTONIC, &now), 0);
+
+		TEST_NE_P (job->kill_timer, NULL);
+		TEST_GE (job->kill_timer->due, now.tv_sec + 18);
+		TEST_LE (job->kill_timer->due, now.tv_sec + 20);
+		TEST_EQ (job->kill_process, PROCESS_MAIN);
+
+		/* Run the kill timer */
+		timer = job->kill_timer;
+		timer->callback (timer->data, timer);
+		nih_free (timer);
+
+		waitpid (job->pid[PROCESS_MAIN], &child_status, 0);
+		TEST_TRUE (WIFSIGNALED (child_status));
+		TEST_EQ (WTERMSIG (child_status), SIGKILL);
+
+		TEST_EQ_P (job->kill_timer, NULL);
+		TEST_EQ (job->kill_process, PROCESS_INVALID);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that the shutdown timeout, as set by --shutdown-timeout,
+	 * overrides the kill timeout of a job when it is shorter, so that
+	 * it is sent SIGKILL by the deadline.
+	 */
+	TEST_FEATURE ("with shutdown timeout");
+	TEST_CHILD (pid) {
+		int wait_fd = 0;
+		int child_status;
+
+		quiesce_timeout = 2;
+
+		class = new_class ("foo", NULL, 20);
+		job = new_running_job (class);
+
+		TEST_CHILD_WAIT (job->pid[PROCESS_MAIN], wait_fd) {
+			struct sigaction act;
+
+			act.sa_handler = SIG_IGN;
+			act.sa_flags = 0;
+			sigemptyset (&act.sa_mask);
+			sigaction (SIGTERM, &act, NULL);
+
+			TEST_CHILD_RELEASE (wait_fd);
+
+			for (;;)
+				pause ();
+		}
+		setpgid (job->pid[PROCESS_MAIN], job->pid[PROCESS_MAIN]);
+
+		quiesce (QUIESCE_REQUESTER_REBOOT);
+
+		event_poll ();
+
+		TEST_EQ (job->goal, JOB_STOP);
+		TEST_EQ (job->state, JOB_KILLED);
+
+		TEST_EQ (clock_gettime (CLOCK_MONOTONIC, &now), 0);
+
+		TEST_NE_P (job->kill_timer, NULL);
+		TEST_GE (job->kill_timer->due, now.tv_sec);
+		TEST_LE (job->kill_timer->due, now.tv_sec + 2);
+
+		TEST_LE (quiesce_kill_timeout (job), 2);
+
+		/* Run the kill timer */
+		timer = job->kill_timer;
+		timer->callback (timer->data, timer);
+		nih_free (timer);
+
+		waitpid (job->pid[PROCESS_MAIN], &child_status, 0);
+		TEST_TRUE (WIFSIGNALED (child_status));
+		TEST_EQ (WTERMSIG (child_status), SIGKILL);
+	}
+
+	waitpid (pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_stop_jobs ();
+	test_kill_timeout ();
+
+	return 0;
+}
@@ -0,0 +1,308 @@
+/* upstart
+ *
+ * test_resource.c - test suite for init/resource.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdlib.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "event.h"
+#include "resource.h"
+
+
+static JobClass *
+new_class (const char *name,
+	   const char *resource,
+	   int         amount)
+{
+	JobClass *class;
+	size_t    len = 0;
+
+	class = job_class_new (NULL, name, NULL);
+	class->task = TRUE;
+
+	NIH_MUST (nih_str_array_add (&class->uses, class, &len, resource));
+	class->uses_amount = NIH_MUST (nih_alloc (class, sizeof (int)));
+	class->uses_amount[0] = amount;
+	class->uses_len = 1;
+
+	nih_hash_add (job_classes, &class->entry);
+
+	return class;
+}
+
+static Job *
+new_job (JobClass   *class,
+	 const char *name)
+{
+	Job *job;
+
+	job = job_new (class, name);
+	job->goal = JOB_START;
+	job->state = JOB_STARTING;
+
+	return job;
+}
+
+
+void
+test_parse_amount (void)
+{
+	int amount;
+
+	TEST_FUNCTION ("resource_parse_amount");
+
+	/* Check that whole numbers are returned in parts of the unit. */
+	TEST_FEATURE ("with whole number");
+	TEST_EQ (resource_parse_amount ("2", &amount), 0);
+	TEST_EQ (amount, 2 * RESOURCE_UNIT);
+
+
+	/* Check that up to three decimal places are accepted. */
+	TEST_FEATURE ("with decimal places");
+	TEST_EQ (resource_parse_amount ("0.5", &amount), 0);
+	TEST_EQ (amount, 500);
+
+	TEST_EQ (resource_parse_amount ("1.25", &amount), 0);
+	TEST_EQ (amount, 1250);
+
+	TEST_EQ (resource_parse_amount ("0.125", &amount), 0);
+	TEST_EQ (amount, 125);
+
+
+	/* Check that anything else is rejected. */
+	TEST_FEATURE ("with invalid amounts");
+	TEST_LT (resource_parse_amount ("", &amount), 0);
+	TEST_LT (resource_parse_amount ("-1", &amount), 0);
+	TEST_LT (resource_parse_amount (".5", &amount), 0);
+	TEST_LT (resource_parse_amount ("1.", &amount), 0);
+	TEST_LT (resource_parse_amount ("0.1234", &amount), 0);
+	TEST_LT (resource_parse_amount ("1x", &amount), 0);
+	TEST_LT (resource_parse_amount ("99999999999", &amount), 0);
+}
+
+
+void
+test_acquire (void)
+{
+	JobClass *class1;
+	JobClass *class2;
+	Job      *job1;
+	Job      *job2;
+	Job      *job3;
+	Job      *job4;
+
+	TEST_FUNCTION ("resource_acquire");
+	job_class_init ();
+	resource_init ();
+
+
+	/* Check that a job whose class uses no resources is always
+	 * admitted, without holding anything.
+	 */
+	TEST_FEATURE ("without resources");
+	class1 = job_class_new (NULL, "foo", NULL);
+	job1 = new_job (class1, "");
+
+	TEST_TRUE (resource_acquire (job1));
+	TEST_FALSE (job1->admitted);
+	TEST_FALSE (resource_waiting (job1));
+
+	nih_free (class1);
+
+
+	/* Check that jobs using resources are queued, and admitted by
+	 * resource_poll() while what they use fits within the budget,
+	 * which moves them out of the starting state.
+	 */
+	TEST_FEATURE ("with budget");
+	class1 = new_class ("foo", "disk", 500);
+	job1 = new_job (class1, "");
+
+	class2 = new_class ("bar", "disk", 500);
+	job2 = new_job (class2, "");
+
+	job3 = new_job (class1, "baz");
+
+	TEST_FALSE (resource_acquire (job1));
+	TEST_FALSE (resource_acquire (job2));
+	TEST_FALSE (resource_acquire (job3));
+	TEST_TRUE (resource_waiting (job1));
+	TEST_TRUE (resource_waiting (job2));
+	TEST_TRUE (resource_waiting (job3));
+
+	resource_poll ();
+
+	TEST_TRUE (job1->admitted);
+	TEST_EQ (job1->state, JOB_RUNNING);
+	TEST_TRUE (job2->admitted);
+	TEST_EQ (job2->state, JOB_RUNNING);
+	TEST_EQ (resource_get ("disk")->used, 1000);
+
+	TEST_FALSE (job3->admitted);
+	TEST_TRUE (resource_waiting (job3));
+	TEST_EQ (job3->state, JOB_STARTING);
+
+
+	/* Check that a job stopped while waiting for resources leaves the
+	 * queue.
+	 */
+	TEST_FUNCTION ("resource_release");
+	TEST_FEATURE ("with queued job");
+	job4 = new_job (class2, "qux");
+
+	TEST_FALSE (resource_acquire (job4));
+	TEST_TRUE (resource_waiting (job4));
+
+	resource_release (job4);
+
+	TEST_FALSE (resource_waiting (job4));
+	TEST_FALSE (job4->admitted);
+	TEST_EQ (resource_get ("disk")->used, 1000);
+
+
+	/* Check that releasing the resources of a job leaves queued jobs
+	 * alone until resource_poll() admits them.
+	 */
+	TEST_FUNCTION ("resource_poll");
+	TEST_FEATURE ("with released resources");
+	resource_release (job1);
+
+	TEST_FALSE (job1->admitted);
+	TEST_EQ (resource_get ("disk")->used, 500);
+	TEST_TRUE (resource_waiting (job3));
+	TEST_EQ (job3->state, JOB_STARTING);
+
+	resource_poll ();
+
+	TEST_FALSE (resource_waiting (job3));
+	TEST_TRUE (job3->admitted);
+	TEST_EQ (job3->state, JOB_RUNNING);
+
+	nih_free (class1);
+	nih_free (class2);
+
+	TEST_EQ (resource_get ("disk")->used, 0);
+
+
+	/* Check that a job using more of a resource than there is at all
+	 * is admitted once nothing else holds any of it.
+	 */
+	TEST_FEATURE ("with amount over budget");
+	class1 = new_class ("foo", "net", 2000);
+	job1 = new_job (class1, "");
+
+	TEST_FALSE (resource_acquire (job1));
+
+	resource_poll ();
+
+	TEST_TRUE (job1->admitted);
+	TEST_EQ (resource_get ("net")->used, 2000);
+
+	nih_free (class1);
+
+	TEST_EQ (resource_get ("net")->used, 0);
+
+
+	/* Check that raising the budget of a resource lets more jobs be
+	 * admitted together.
+	 */
+	TEST_FEATURE ("with raised budget");
+	class1 = new_class ("foo", "cpu", 1000);
+	job1 = new_job (class1, "");
+
+	class2 = new_class ("bar", "cpu", 1000);
+	job2 = new_job (class2, "");
+
+	resource_set_max ("cpu", 2000);
+
+	TEST_FALSE (resource_acquire (job1));
+	TEST_FALSE (resource_acquire (job2));
+
+	resource_poll ();
+
+	TEST_TRUE (job1->admitted);
+	TEST_TRUE (job2->admitted);
+	TEST_EQ (resource_get ("cpu")->used, 2000);
+
+	nih_free (class1);
+	nih_free (class2);
+
+
+	/* Check that with a maximum number of jobs starting at once, even
+	 * jobs that use no resources are queued, and that they are
+	 * admitted highest priority first regardless of the order they
+	 * were queued in.
+	 */
+	TEST_FEATURE ("with priority");
+	resource_set_max_starting (1);
+
+	class1 = job_class_new (NULL, "foo", NULL);
+	class1->task = TRUE;
+	nih_hash_add (job_classes, &class1->entry);
+	job1 = new_job (class1, "");
+
+	class2 = job_class_new (NULL, "bar", NULL);
+	class2->task = TRUE;
+	class2->priority = 10;
+	nih_hash_add (job_classes, &class2->entry);
+	job2 = new_job (class2, "");
+
+	TEST_FALSE (resource_acquire (job1));
+	TEST_FALSE (resource_acquire (job2));
+
+	resource_poll ();
+
+	TEST_TRUE (job2->admitted);
+	TEST_EQ (job2->state, JOB_RUNNING);
+	TEST_FALSE (job1->admitted);
+	TEST_EQ (job1->state, JOB_STARTING);
+
+	resource_release (job2);
+	resource_poll ();
+
+	TEST_TRUE (job1->admitted);
+	TEST_EQ (job1->state, JOB_RUNNING);
+
+	nih_free (class1);
+	nih_free (class2);
+
+	resource_set_max_starting (0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_parse_amount ();
+	test_acquire ();
+
+	return 0;
+}
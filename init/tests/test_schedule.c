@@ -0,0 +1,361 @@
+/* upstart
+ *
+ * test_schedule.c - test suite for init/schedule.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/tree.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "event.h"
+#include "events.h"
+#include "event_operator.h"
+#include "deadline.h"
+#include "schedule.h"
+
+
+static JobClass *
+new_class (const char *name)
+{
+	JobClass      *class;
+	EventOperator *oper;
+	char         **env;
+
+	class = job_class_new (NULL, name, NULL);
+
+	class->start_on = event_operator_new (class, EVENT_OR, NULL, NULL);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "INTERVAL=5m"));
+	oper = event_operator_new (class->start_on, EVENT_MATCH,
+				   TIMER_EVENT, env);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_LEFT);
+
+	oper = event_operator_new (class->start_on, EVENT_MATCH,
+				   CALENDAR_EVENT, NULL);
+	nih_tree_add (&class->start_on->node, &oper->node, NIH_TREE_RIGHT);
+
+	env = nih_str_array_new (NULL);
+	NIH_MUST (nih_str_array_add (&env, NULL, NULL, "AFTER=1d"));
+	class->stop_on = event_operator_new (class, EVENT_MATCH,
+					     TIMER_EVENT, env);
+
+	nih_hash_add (job_classes, &class->entry);
+
+	return class;
+}
+
+static time_t
+now_monotonic (void)
+{
+	struct timespec now;
+
+	assert0 (clock_gettime (CLOCK_MONOTONIC, &now));
+
+	return now.tv_sec;
+}
+
+
+void
+test_parse_duration (void)
+{
+	time_t secs;
+
+	TEST_FUNCTION ("schedule_parse_duration");
+
+	/* Check that a plain number is in seconds, and that each unit
+	 * is accepted.
+	 */
+	TEST_FEATURE ("with valid durations");
+	TEST_EQ (schedule_parse_duration ("90", &secs), 0);
+	TEST_EQ (secs, 90);
+
+	TEST_EQ (schedule_parse_duration ("30s", &secs), 0);
+	TEST_EQ (secs, 30);
+
+	TEST_EQ (schedule_parse_duration ("5m", &secs), 0);
+	TEST_EQ (secs, 300);
+
+	TEST_EQ (schedule_parse_duration ("2h", &secs), 0);
+	TEST_EQ (secs, 7200);
+
+	TEST_EQ (schedule_parse_duration ("1d", &secs), 0);
+	TEST_EQ (secs, 86400);
+
+
+	/* Check that anything else is rejected. */
+	TEST_FEATURE ("with invalid durations");
+	TEST_LT (schedule_parse_duration ("", &secs), 0);
+	TEST_LT (schedule_parse_duration ("0", &secs), 0);
+	TEST_LT (schedule_parse_duration ("-5", &secs), 0);
+	TEST_LT (schedule_parse_duration ("m", &secs), 0);
+	TEST_LT (schedule_parse_duration ("5x", &secs), 0);
+	TEST_LT (schedule_parse_duration ("5mm", &secs), 0);
+	TEST_LT (schedule_parse_duration ("99999999999d", &secs), 0);
+}
+
+
+void
+test_poll (void)
+{
+	JobClass *class;
+	Schedule *interval;
+	Schedule *after;
+	Schedule *calendar;
+	Deadline *deadline;
+	Event    *event;
+	time_t    now;
+
+	TEST_FUNCTION ("schedule_poll");
+	job_class_init ();
+	event_init ();
+	schedule_init ();
+
+
+	/* Check that a schedule is created for each timer named by the
+	 * start on and stop on conditions of a job class.
+	 */
+	TEST_FEATURE ("with timers named by job");
+	class = new_class ("foo");
+	now = now_monotonic ();
+
+	schedule_changed ();
+	schedule_poll ();
+
+	interval = schedule_get (SCHEDULE_INTERVAL, "5m");
+	TEST_NE_P (interval, NULL);
+	TEST_EQ (interval->period, 300);
+	TEST_NE_P (interval->deadline, NULL);
+	TEST_EQ (interval->deadline->period, 300);
+
+	after = schedule_get (SCHEDULE_AFTER, "1d");
+	TEST_NE_P (after, NULL);
+	TEST_NE_P (after->deadline, NULL);
+	TEST_EQ (after->deadline->due, schedule_start_time + 86400);
+
+	calendar = schedule_get (SCHEDULE_CALENDAR, NULL);
+	TEST_NE_P (calendar, NULL);
+	TEST_NE_P (calendar->deadline, NULL);
+	TEST_LE (calendar->deadline->due, now + 61);
+
+	TEST_EQ (deadline_pending (), 3);
+
+
+	/* Check that a due interval emits a timer event naming it and
+	 * remains due again.
+	 */
+	TEST_FEATURE ("with due interval");
+	deadline = interval->deadline;
+	deadline_set_due (deadline, now - 1);
+	deadline_poll ();
+
+	TEST_EQ_P (interval->deadline, deadline);
+	TEST_GE (deadline->due, now + 300);
+
+	TEST_LIST_NOT_EMPTY (events);
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, TIMER_EVENT);
+	TEST_EQ_STR (event->env[0], "INTERVAL=5m");
+	TEST_EQ_P (event->env[1], NULL);
+	nih_free (event);
+
+	TEST_LIST_EMPTY (events);
+
+
+	/* Check that a due calendar schedule emits a calendar event with
+	 * the fields of the time, and is due again the next minute, but
+	 * not twice for the same minute.
+	 */
+	TEST_FEATURE ("with due calendar");
+	deadline_set_due (calendar->deadline, now - 1);
+	deadline_poll ();
+
+	TEST_NE_P (calendar->deadline, NULL);
+	TEST_NE (calendar->last, 0);
+
+	TEST_LIST_NOT_EMPTY (events);
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, CALENDAR_EVENT);
+	TEST_EQ_STRN (event->env[0], "MINUTE=");
+	TEST_EQ_STRN (event->env[1], "HOUR=");
+	TEST_EQ_STRN (event->env[2], "DAY=");
+	TEST_EQ_STRN (event->env[3], "MONTH=");
+	TEST_EQ_STRN (event->env[4], "WEEKDAY=");
+	TEST_EQ_STRN (event->env[5], "YEAR=");
+	TEST_EQ_P (event->env[6], NULL);
+	nih_free (event);
+
+	if (time (NULL) - calendar->last < 59) {
+		deadline_set_due (calendar->deadline, now - 1);
+		deadline_poll ();
+
+		TEST_LIST_EMPTY (events);
+	}
+
+
+	/* Check that a due delay after startup emits a timer event just
+	 * the once.
+	 */
+	TEST_FEATURE ("with due delay");
+	deadline = after->deadline;
+	TEST_FREE_TAG (deadline);
+
+	deadline_set_due (deadline, now - 1);
+	deadline_poll ();
+
+	TEST_FREE (deadline);
+	TEST_EQ_P (after->deadline, NULL);
+
+	TEST_LIST_NOT_EMPTY (events);
+	event = (Event *)events->next;
+	TEST_EQ_STR (event->name, TIMER_EVENT);
+	TEST_EQ_STR (event->env[0], "AFTER=1d");
+	nih_free (event);
+
+	schedule_changed ();
+	schedule_poll ();
+
+	TEST_EQ_P (schedule_get (SCHEDULE_AFTER, "1d"), after);
+	TEST_EQ_P (after->deadline, NULL);
+
+
+	/* Check that schedules no job names any longer are freed, along
+	 * with their deadlines.
+	 */
+	TEST_FEATURE ("with job removed");
+	TEST_FREE_TAG (interval);
+	TEST_FREE_TAG (after);
+	TEST_FREE_TAG (calendar);
+
+	nih_free (class);
+
+	schedule_changed ();
+	schedule_poll ();
+
+	TEST_FREE (interval);
+	TEST_FREE (after);
+	TEST_FREE (calendar);
+
+	TEST_LIST_EMPTY (schedules);
+	TEST_EQ (deadline_pending (), 0);
+}
+
+
+void
+test_serialise (void)
+{
+	JobClass    *class;
+	Schedule    *interval;
+	json_object *json;
+	json_object *json_schedules;
+	time_t       start_time;
+	time_t       due;
+
+	TEST_FUNCTION ("schedule_deserialise_all");
+	job_class_init ();
+	schedule_init ();
+
+
+	/* Check that schedules are restored with the time they were next
+	 * due and the time init started, and that one already emitted is
+	 * not due again.
+	 */
+	TEST_FEATURE ("with schedules");
+	class = new_class ("foo");
+
+	schedule_changed ();
+	schedule_poll ();
+
+	interval = schedule_get (SCHEDULE_INTERVAL, "5m");
+	deadline_set_due (interval->deadline, interval->deadline->due + 100);
+	due = interval->deadline->due;
+
+	nih_free (schedule_get (SCHEDULE_AFTER, "1d")->deadline);
+	schedule_get (SCHEDULE_AFTER, "1d")->deadline = NULL;
+
+	start_time = schedule_start_time;
+
+	json_schedules = schedule_serialise_all ();
+	TEST_NE_P (json_schedules, NULL);
+
+	json = json_object_new_object ();
+	json_object_object_add (json, "schedules", json_schedules);
+
+	NIH_LIST_FOREACH_SAFE (schedules, iter)
+		nih_free (iter);
+	schedule_start_time = 0;
+
+	TEST_EQ (deadline_pending (), 0);
+
+	TEST_EQ (schedule_deserialise_all (json), 0);
+
+	TEST_EQ (schedule_start_time, start_time);
+
+	interval = schedule_get (SCHEDULE_INTERVAL, "5m");
+	TEST_NE_P (interval, NULL);
+	TEST_EQ (interval->deadline->due, due);
+
+	TEST_NE_P (schedule_get (SCHEDULE_AFTER, "1d"), NULL);
+	TEST_EQ_P (schedule_get (SCHEDULE_AFTER, "1d")->deadline, NULL);
+
+	TEST_NE_P (schedule_get (SCHEDULE_CALENDAR, NULL), NULL);
+
+	TEST_EQ (deadline_pending (), 2);
+
+	json_object_put (json);
+
+
+	/* Check that older state data without schedules is accepted. */
+	TEST_FEATURE ("without schedules");
+	json = json_object_new_object ();
+
+	TEST_EQ (schedule_deserialise_all (json), 0);
+
+	json_object_put (json);
+
+	nih_free (class);
+
+	schedule_changed ();
+	schedule_poll ();
+
+	TEST_LIST_EMPTY (schedules);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_parse_duration ();
+	test_poll ();
+	test_serialise ();
+
+	return 0;
+}
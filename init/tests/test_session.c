@@ -0,0 +1,255 @@
+/* upstart
+ *
+ * test_session.c - test suite for init/session.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <dbus/dbus.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/timer.h>
+#include <nih/signal.h>
+#include <nih/main.h>
+#include <nih/io.h>
+
+#include <nih-dbus/dbus_connection.h>
+#include <nih-dbus/dbus_message.h>
+
+#include "session.h"
+#include "control.h"
+#include "conf.h"
+#include "job_class.h"
+
+
+extern int   chroot_sessions;
+extern char *control_server_address;
+
+
+/**
+ * client_start:
+ * @chroot_path: directory to chroot into after connecting, or NULL.
+ * @conn: set to the connection accepted from the client.
+ *
+ * Starts a child process that connects to our control server, then
+ * enters @chroot_path, until killed.
+ *
+ * Returns: pid of child.
+ **/
+static pid_t
+client_start (const char      *chroot_path,
+	      DBusConnection **conn)
+{
+	pid_t pid;
+	int   wait_fd = -1;
+
+	TEST_CHILD_WAIT (pid, wait_fd) {
+		DBusConnection *client_conn;
+
+		control_server_close ();
+
+		nih_signal_set_handler (SIGTERM, nih_signal_handler);
+		assert (nih_signal_add_handler (NULL, SIGTERM,
+						nih_main_term_signal, NULL));
+
+		client_conn = nih_dbus_connect (control_server_address, NULL);
+		assert (client_conn != NULL);
+
+		if (chroot_path)
+			assert0 (chroot (chroot_path));
+
+		TEST_CHILD_RELEASE (wait_fd);
+
+		nih_main_loop ();
+
+		exit (0);
+	}
+
+	/* Accept the connection */
+	assert (nih_timer_add_timeout (NULL, 1,
+				       (NihTimerCb)nih_main_term_signal, NULL));
+	nih_main_loop ();
+
+	TEST_LIST_NOT_EMPTY (control_conns);
+	*conn = ((NihListEntry *)control_conns->prev)->data;
+
+	return pid;
+}
+
+static void
+client_stop (pid_t pid)
+{
+	int status;
+
+	kill (pid, SIGTERM);
+	waitpid (pid, &status, 0);
+}
+
+
+void
+test_from_dbus (void)
+{
+	char            dirname[PATH_MAX];
+	nih_local char *conf_path = NULL;
+	NihDBusMessage *message;
+	DBusConnection *conn;
+	DBusConnection *other_conn;
+	Session        *session;
+	SessionChroot  *index;
+	pid_t           pid;
+	pid_t           other_pid;
+
+	TEST_FUNCTION ("session_from_dbus");
+	program_name = "test";
+	control_init ();
+	job_class_init ();
+	session_init ();
+	nih_io_init ();
+
+	control_server_address = "unix:abstract=/com/ubuntu/upstart/test-session";
+	assert0 (control_server_open ());
+
+	unsetenv ("UPSTART_NO_SESSIONS");
+	chroot_sessions = TRUE;
+
+	message = nih_new (NULL, NihDBusMessage);
+	message->message = NULL;
+
+
+	/* Check that a client outside of a chroot has no session, and that
+	 * none is created for it.
+	 */
+	TEST_FEATURE ("with client outside chroot");
+	pid = client_start (NULL, &conn);
+
+	message->connection = conn;
+	session = session_from_dbus (NULL, message);
+
+	TEST_EQ_P (session, NULL);
+	TEST_LIST_EMPTY (sessions);
+	TEST_HASH_EMPTY (session_chroots);
+
+
+	/* Check that later messages over the same connection still have
+	 * no session, even once the client is gone and could not be
+	 * looked up again.
+	 */
+	TEST_FEATURE ("with later message from client outside chroot");
+	client_stop (pid);
+
+	session = session_from_dbus (NULL, message);
+
+	TEST_EQ_P (session, NULL);
+	TEST_LIST_EMPTY (sessions);
+
+	if (geteuid ()) {
+		printf ("INFO: skipping %s chroot tests as not running as root\n",
+			__func__);
+		fflush (NULL);
+		goto out;
+	}
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	conf_path = NIH_MUST (nih_sprintf (NULL, "%s%s", dirname, CONFDIR));
+
+
+	/* Check that a client in a chroot is given a new session for that
+	 * chroot, indexed by the path of the chroot.
+	 */
+	TEST_FEATURE ("with client in chroot");
+	pid = client_start (dirname, &conn);
+
+	message->connection = conn;
+	session = session_from_dbus (NULL, message);
+
+	TEST_NE_P (session, NULL);
+	TEST_EQ_STR (session->chroot, dirname);
+	TEST_EQ_STR (session->conf_path, conf_path);
+
+	TEST_LIST_NOT_EMPTY (sessions);
+	TEST_EQ_P (sessions->next, &session->entry);
+	TEST_EQ_P (session->entry.next, sessions);
+
+	index = (SessionChroot *)nih_hash_lookup (session_chroots, dirname);
+	TEST_NE_P (index, NULL);
+	TEST_EQ_P (index->session, session);
+	TEST_ALLOC_PARENT (index, session);
+
+
+	/* Check that a second client in the same chroot, over another
+	 * connection, is given the same session rather than a new one.
+	 */
+	TEST_FEATURE ("with second client in same chroot");
+	other_pid = client_start (dirname, &other_conn);
+	TEST_NE_P (other_conn, conn);
+
+	message->connection = other_conn;
+	TEST_EQ_P (session_from_dbus (NULL, message), session);
+	TEST_EQ_P (session->entry.next, sessions);
+
+	client_stop (other_pid);
+
+
+	/* Check that the session resolved for a connection is remembered,
+	 * so that it is returned for a later message even once the client
+	 * is gone and its chroot could no longer be looked up.
+	 */
+	TEST_FEATURE ("with later message from client in chroot");
+	client_stop (pid);
+
+	message->connection = conn;
+	TEST_EQ_P (session_from_dbus (NULL, message), session);
+	TEST_EQ_P (session->entry.next, sessions);
+
+	TEST_EQ (rmdir (dirname), 0);
+
+out:
+	nih_free (message);
+
+	control_server_close ();
+
+	chroot_sessions = FALSE;
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_from_dbus ();
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/* upstart
+ *
+ * test_snapshot.c - test suite for init/snapshot.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/hash.h>
+
+#include "job_class.h"
+#include "job.h"
+#include "snapshot.h"
+
+
+void
+test_snapshot (void)
+{
+	char            filename[PATH_MAX];
+	struct stat     statbuf;
+	const Snapshot *snapshot;
+	JobClass *      class1;
+	JobClass *      class2;
+	Job *           job;
+	uint32_t        seq;
+	int             fd;
+
+	TEST_FUNCTION ("snapshot_init");
+	TEST_FILENAME (filename);
+	assert0 (setenv (SNAPSHOT_FILE_ENV, filename, 1));
+
+	job_class_init ();
+
+
+	/* Check that the snapshot file is created at the size of the
+	 * layout with a valid header and no entries.
+	 */
+	TEST_FEATURE ("with new file");
+	TEST_EQ_STR (snapshot_file (), filename);
+	TEST_EQ (snapshot_init (), 0);
+
+	TEST_EQ (stat (filename, &statbuf), 0);
+	TEST_EQ (statbuf.st_size, sizeof (Snapshot));
+
+	fd = open (filename, O_RDONLY);
+	TEST_GE (fd, 0);
+
+	snapshot = mmap (NULL, sizeof (Snapshot), PROT_READ, MAP_SHARED, fd, 0);
+	TEST_NE_P (snapshot, MAP_FAILED);
+	close (fd);
+
+	TEST_EQ (snapshot->magic, SNAPSHOT_MAGIC);
+	TEST_EQ (snapshot->version, SNAPSHOT_VERSION);
+	TEST_EQ (snapshot->pid, getpid ());
+	TEST_EQ (snapshot->num_entries, 0);
+
+
+	/* Check that flushing the snapshot writes an entry for each
+	 * instance, and one for each job class without any, leaving the
+	 * sequence count even and advanced.
+	 */
+	TEST_FUNCTION ("snapshot_flush");
+	TEST_FEATURE ("with jobs and instances");
+	class1 = job_class_new (NULL, "foo", NULL);
+	nih_hash_add (job_classes, &class1->entry);
+
+	class2 = job_class_new (NULL, "bar", NULL);
+	nih_hash_add (job_classes, &class2->entry);
+
+	job = job_new (class2, "");
+	job->goal = JOB_START;
+	job->state = JOB_RUNNING;
+	job->pid[PROCESS_MAIN] = 1000;
+	job->pid[PROCESS_POST_START] = 1001;
+
+	seq = snapshot->seq;
+
+	snapshot_changed ();
+	snapshot_flush ();
+
+	TEST_EQ (snapshot->seq, seq + 2);
+	TEST_TRUE (snapshot->complete);
+	TEST_EQ (snapshot->num_entries, 2);
+
+	for (uint32_t i = 0; i < snapshot->num_entries; i++) {
+		const SnapshotEntry *entry = &snapshot->entries[i];
+
+		if (! strcmp (entry->job, "foo")) {
+			TEST_EQ_STR (entry->instance, "");
+			TEST_EQ_STR (entry->goal, "stop");
+			TEST_EQ_STR (entry->state, "waiting");
+			TEST_EQ (entry->num_processes, 0);
+		} else {
+			TEST_EQ_STR (entry->job, "bar");
+			TEST_EQ_STR (entry->instance, "");
+			TEST_EQ_STR (entry->goal, "start");
+			TEST_EQ_STR (entry->state, "running");
+			TEST_EQ (entry->num_processes, 2);
+			TEST_EQ_STR (entry->processes[0].name, "main");
+			TEST_EQ (entry->processes[0].pid, 1000);
+			TEST_EQ_STR (entry->processes[1].name, "post-start");
+			TEST_EQ (entry->processes[1].pid, 1001);
+		}
+	}
+
+
+	/* Check that flushing again without any change leaves the
+	 * snapshot alone.
+	 */
+	TEST_FEATURE ("without change");
+	seq = snapshot->seq;
+
+	snapshot_flush ();
+
+	TEST_EQ (snapshot->seq, seq);
+
+	nih_free (class1);
+	nih_free (class2);
+
+	munmap ((void *)snapshot, sizeof (Snapshot));
+	unlink (filename);
+	assert0 (unsetenv (SNAPSHOT_FILE_ENV));
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	/* run tests in legacy (pre-session support) mode */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	test_snapshot ();
+
+	return 0;
+}
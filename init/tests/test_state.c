@@ -131,7 +131,7 @@ int process_diff (const Process *a, const Process *b)
 int event_diff (const Event *a, const Event *b, AlreadySeen seen)
 	__attribute__ ((warn_unused_result));
 
-int nih_timer_diff (const NihTimer *a, const NihTimer *b)
+int deadline_diff (const Deadline *a, const Deadline *b)
 	__attribute__ ((warn_unused_result));
 
 int log_diff (const Log *a, const Log *b)
@@ -285,6 +285,9 @@ process_diff (const Process *a, const Process *b)
 	if (obj_num_check (a, b, script))
 		goto fail;
 
+	if (obj_num_check (a, b, simple))
+		goto fail;
+
 	if (obj_string_check (a, b, command))
 		goto fail;
 
@@ -356,16 +359,16 @@ fail:
 }
 
 /**
- * nih_timer_diff:
- * @a: first NihTimer,
- * @b: second NihTimer.
+ * deadline_diff:
+ * @a: first Deadline,
+ * @b: second Deadline.
  *
- * Compare two NihTimer objects for equivalence.
+ * Compare two Deadline objects for equivalence.
  *
  * Returns: 0 if @a and @b are identical, else 1.
  **/
 int
-nih_timer_diff (const NihTimer *a, const NihTimer *b)
+deadline_diff (const Deadline *a, const Deadline *b)
 {
 	if ((a == b) && !a)
 		return 0;
@@ -437,6 +440,9 @@ log_diff (const Log *a, const Log *b)
 	if (obj_num_check (a, b, open_errno))
 		goto fail;
 
+	if (obj_num_check (a, b, unflushed_dropped))
+		goto fail;
+
 	return 0;
 
 fail:
@@ -657,12 +663,40 @@ job_class_diff (const JobClass *a, const JobClass *b,
 	if (obj_num_check (a, b, debug))
 		goto fail;
 
+	if (obj_num_check (a, b, shell_auto))
+		goto fail;
+
 	if (obj_string_check (a, b, usage))
 		goto fail;
 
 	if (obj_string_check (a, b, apparmor_switch))
 		goto fail;
 
+	if (obj_num_check (a, b, uses_len))
+		goto fail;
+
+	if (obj_num_check (a, b, priority))
+		goto fail;
+
+	for (size_t i = 0; i < a->uses_len; i++) {
+		if (strcmp (a->uses[i], b->uses[i]))
+			goto fail;
+
+		if (a->uses_amount[i] != b->uses_amount[i])
+			goto fail;
+	}
+
+	if (obj_num_check (a, b, pressure_len))
+		goto fail;
+
+	for (size_t i = 0; i < a->pressure_len; i++) {
+		if (strcmp (a->pressure[i], b->pressure[i]))
+			goto fail;
+
+		if (a->pressure_max[i] != b->pressure_max[i])
+			goto fail;
+	}
+
 	return 0;
 
 fail:
@@ -763,7 +797,7 @@ job_diff (const Job *a, const Job *b, AlreadySeen seen, int check_class)
 	if (blocking_diff (&a->blocking, &b->blocking, seen))
 		goto fail;
 
-	if (nih_timer_diff (a->kill_timer, b->kill_timer))
+	if (deadline_diff (a->kill_timer, b->kill_timer))
 		goto fail;
 
 	if (obj_num_check (a, b, kill_process))
@@ -790,6 +824,12 @@ job_diff (const Job *a, const Job *b, AlreadySeen seen, int check_class)
 	if (obj_num_check (a, b, trace_state))
 		goto fail;
 
+	if (obj_string_check (a, b, trace_cgroup))
+		goto fail;
+
+	if (obj_num_check (a, b, admitted))
+		goto fail;
+
 	for (i = 0; i < PROCESS_LAST; i++) {
 		if (! a->log[i] && ! b->log[i])
 			continue;
@@ -2794,6 +2834,91 @@ test_string_arrays (void)
 	/*******************************/
 }
 
+void
+test_index (void)
+{
+	StateIndex  *index;
+	Event       *event1, *event2, *event3;
+	int          idx1, idx2, idx3;
+	char        *obj1, *obj2;
+
+	TEST_GROUP ("object indices");
+
+	/*******************************/
+	TEST_FEATURE ("with index");
+
+	TEST_ALLOC_FAIL {
+		index = state_index_new (NULL);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (index, NULL);
+			continue;
+		}
+
+		TEST_EQ (index->len, 0);
+		TEST_EQ_P (state_index_lookup (index, 0), NULL);
+
+		nih_free (index);
+	}
+
+	index = state_index_new (NULL);
+	TEST_NE_P (index, NULL);
+
+	obj1 = nih_strdup (index, "foo");
+	obj2 = nih_strdup (index, "bar");
+
+	TEST_NE_P (state_index_add (index, obj1), NULL);
+	TEST_NE_P (state_index_add (index, obj2), NULL);
+
+	TEST_EQ (index->len, 2);
+	TEST_EQ (state_index_get (index, obj1), 0);
+	TEST_EQ (state_index_get (index, obj2), 1);
+	TEST_EQ (state_index_get (index, index), -1);
+	TEST_EQ_P (state_index_lookup (index, 0), obj1);
+	TEST_EQ_P (state_index_lookup (index, 1), obj2);
+	TEST_EQ_P (state_index_lookup (index, 2), NULL);
+
+	nih_free (index);
+
+	/*******************************/
+	TEST_FEATURE ("with context");
+
+	event1 = event_new (NULL, "foo", NULL);
+	event2 = event_new (NULL, "bar", NULL);
+
+	idx1 = event_to_index (event1);
+	idx2 = event_to_index (event2);
+	TEST_GE (idx1, 0);
+	TEST_GE (idx2, 0);
+
+	state_context_begin ();
+	TEST_NE_P (state_context, NULL);
+
+	TEST_EQ (event_to_index (event1), idx1);
+	TEST_EQ (event_to_index (event2), idx2);
+	TEST_EQ_P (event_from_index (idx1), event1);
+	TEST_EQ_P (event_from_index (idx2), event2);
+	TEST_NE_P (state_context->events, NULL);
+
+	/* Objects added after the index was built must still be found */
+	event3 = event_new (NULL, "baz", NULL);
+
+	idx3 = event_to_index (event3);
+	TEST_GE (idx3, 0);
+	TEST_NE (idx3, idx1);
+	TEST_NE (idx3, idx2);
+	TEST_EQ_P (event_from_index (idx3), event3);
+
+	state_context_end ();
+	TEST_EQ_P (state_context, NULL);
+
+	TEST_EQ (event_to_index (event3), idx3);
+
+	nih_free (event1);
+	nih_free (event2);
+	nih_free (event3);
+}
+
 void
 test_hex_encoding (void)
 {
@@ -2827,6 +2952,234 @@ test_hex_encoding (void)
 	TEST_EQ (ret, 0);
 }
 
+void
+test_binary_encoding (void)
+{
+	json_object        *json;
+	nih_local char     *new_data = NULL;
+	size_t              new_data_len;
+	nih_local char     *state_data = NULL;
+	size_t              len;
+	size_t              test_data_len;
+	Event              *event;
+	Event              *new_event;
+	char              **env = NULL;
+	size_t              env_len = 0;
+	int                 data_fd;
+
+	test_data_len = TEST_ARRAY_SIZE (test_data);
+
+	TEST_GROUP ("binary data encoding");
+
+	conf_init ();
+	session_init ();
+	event_init ();
+	control_init ();
+	job_class_init ();
+
+	/*******************************/
+	TEST_FEATURE ("data variable without context");
+
+	json = json_object_new_object ();
+	TEST_NE_P (json, NULL);
+
+	TEST_TRUE (state_set_json_data_var (json, "data",
+				test_data, test_data_len));
+	TEST_TRUE (json_object_object_get_ex (json, "data", NULL));
+	TEST_TRUE (state_check_json_type (json_object_object_get (json, "data"),
+				string));
+
+	TEST_TRUE (state_get_json_data_var (NULL, json, "data",
+				&new_data, &new_data_len));
+	TEST_EQ (TEST_CMP_INT_ARRAYS (test_data, new_data,
+				test_data_len, new_data_len), 0);
+	nih_free (new_data);
+	new_data = NULL;
+
+	TEST_FALSE (state_get_json_data_var (NULL, json, "missing",
+				&new_data, &new_data_len));
+
+	json_object_put (json);
+
+	/*******************************/
+	TEST_FEATURE ("data variable with data context");
+
+	json = json_object_new_object ();
+	TEST_NE_P (json, NULL);
+
+	state_context_begin ();
+	state_context->data = state_index_new (state_context);
+	TEST_NE_P (state_context->data, NULL);
+
+	TEST_TRUE (state_set_json_data_var (json, "data",
+				test_data, test_data_len));
+	TEST_TRUE (state_check_json_type (json_object_object_get (json, "data"),
+				int));
+	TEST_EQ (state_context->data->len, 1);
+
+	TEST_TRUE (state_get_json_data_var (NULL, json, "data",
+				&new_data, &new_data_len));
+	TEST_EQ (TEST_CMP_INT_ARRAYS (test_data, new_data,
+				test_data_len, new_data_len), 0);
+	nih_free (new_data);
+	new_data = NULL;
+
+	state_context_end ();
+
+	/* A section index is meaningless without the sections */
+	TEST_FALSE (state_get_json_data_var (NULL, json, "data",
+				&new_data, &new_data_len));
+
+	json_object_put (json);
+
+	/*******************************/
+	TEST_FEATURE ("data variable with data file");
+
+	data_fd = state_data_fd_new ();
+	if (data_fd >= 0) {
+		json = json_object_new_object ();
+		TEST_NE_P (json, NULL);
+
+		state_context_begin ();
+		state_context->data = state_index_new (state_context);
+		TEST_NE_P (state_context->data, NULL);
+		state_context->data_fd = data_fd;
+
+		TEST_TRUE (state_set_json_data_var (json, "data",
+					test_data, test_data_len));
+		TEST_EQ (state_context->data->len, 1);
+		TEST_EQ (state_context->data_size, test_data_len);
+
+		/* Read back from the data file */
+		TEST_TRUE (state_get_json_data_var (NULL, json, "data",
+					&new_data, &new_data_len));
+		TEST_EQ (TEST_CMP_INT_ARRAYS (test_data, new_data,
+					test_data_len, new_data_len), 0);
+		nih_free (new_data);
+		new_data = NULL;
+
+		state_context_end ();
+		json_object_put (json);
+		close (data_fd);
+	}
+
+	/*******************************/
+	TEST_FEATURE ("serialisation and deserialisation");
+
+	TEST_LIST_EMPTY (events);
+
+	NIH_MUST (environ_add (&env, NULL, &env_len, TRUE, "FOO=BAR"));
+	event = event_new (NULL, "Christmas", env);
+	TEST_NE_P (event, NULL);
+
+	assert0 (state_to_binary (&state_data, &len));
+	TEST_GT (len, sizeof (StateBinaryHeader));
+	TEST_EQ (memcmp (state_data, STATE_BINARY_MAGIC,
+				STATE_BINARY_MAGIC_LEN), 0);
+
+	nih_list_remove (&event->entry);
+	TEST_LIST_EMPTY (events);
+
+	assert0 (state_from_binary (state_data, len));
+	TEST_EQ_P (state_context, NULL);
+
+	TEST_LIST_NOT_EMPTY (events);
+	new_event = (Event *)nih_list_remove (events->next);
+	TEST_LIST_EMPTY (events);
+	assert0 (event_diff (event, new_event, ALREADY_SEEN_SET));
+
+	nih_free (event);
+	nih_free (new_event);
+
+	/*******************************/
+	TEST_FEATURE ("with invalid data");
+
+	TEST_LT (state_from_binary ("{}", 2), 0);
+
+	/* Truncate the data within the first section */
+	TEST_LT (state_from_binary (state_data,
+				sizeof (StateBinaryHeader)
+				+ sizeof (StateBinarySection) + 1), 0);
+	TEST_LIST_EMPTY (events);
+	TEST_EQ_P (state_context, NULL);
+
+	/*******************************/
+	for (int i = 0; i < 3; i++) {
+		StateFormat  format;
+		int          fds[2] = { -1, -1 };
+
+		format = i ? STATE_FORMAT_BINARY : STATE_FORMAT_JSON;
+
+		TEST_FEATURE (i == 2 ? "with binary stream and data file"
+				: i ? "with binary stream"
+				: "with JSON stream");
+
+		env = NULL;
+		env_len = 0;
+		NIH_MUST (environ_add (&env, NULL, &env_len, TRUE, "FOO=BAR"));
+
+		event = event_new (NULL, "Christmas", env);
+		TEST_NE_P (event, NULL);
+
+		assert0 (pipe (fds));
+
+		state_context_begin ();
+		state_context->data = state_index_new (state_context);
+		TEST_NE_P (state_context->data, NULL);
+
+		/* Bulk data is passed in a data file when there is one */
+		data_fd = -1;
+		if (i == 2) {
+			json_object *json_data;
+
+			data_fd = state_data_fd_new ();
+			state_context->data_fd = data_fd;
+
+			json_data = json_object_new_object ();
+			TEST_NE_P (json_data, NULL);
+			TEST_TRUE (state_set_json_data_var (json_data, "data",
+						test_data, test_data_len));
+			json_object_put (json_data);
+		}
+
+		json = state_serialise_objects ();
+		TEST_NE_P (json, NULL);
+
+		assert0 (state_write_objects (fds[1], format, json));
+		close (fds[1]);
+
+		json_object_put (json);
+		state_context_end ();
+
+		nih_list_remove (&event->entry);
+		TEST_LIST_EMPTY (events);
+
+		/* The format is detected from the data */
+		assert0 (state_read_objects (fds[0]));
+		close (fds[0]);
+
+		/* The reader closes the data file once mapped */
+		if (data_fd >= 0)
+			TEST_FALSE (state_fd_valid (data_fd));
+
+		TEST_LIST_NOT_EMPTY (events);
+		new_event = (Event *)nih_list_remove (events->next);
+		TEST_LIST_EMPTY (events);
+		assert0 (event_diff (event, new_event, ALREADY_SEEN_SET));
+
+		nih_free (event);
+		nih_free (new_event);
+	}
+
+	/*******************************/
+	TEST_FEATURE ("format names");
+
+	TEST_EQ (state_format_str_to_enum ("json"), STATE_FORMAT_JSON);
+	TEST_EQ (state_format_str_to_enum ("binary"), STATE_FORMAT_BINARY);
+	TEST_EQ (state_format_str_to_enum ("xml"), STATE_FORMAT_INVALID);
+	TEST_EQ_STR (state_format_enum_to_str (STATE_FORMAT_BINARY), "binary");
+}
+
 void
 test_rlimit_encoding (void)
 {
@@ -3265,6 +3618,26 @@ test_clean_args (void)
 	TEST_EQ_STR (args[4], "/etc/init");
 	TEST_EQ_P (args[5], NULL);
 
+	/*******************************/
+	TEST_FEATURE ("state format arguments");
+
+	len = 0;
+	args = nih_str_array_new (NULL);
+	TEST_NE_P (args, NULL);
+
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "/sbin/init"));
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "--state-fd"));
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "3"));
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "--state-format"));
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "binary"));
+	NIH_MUST (nih_str_array_add (&args, NULL, &len, "--no-startup-event"));
+
+	clean_args (&args);
+
+	TEST_EQ_STR (args[0], "/sbin/init");
+	TEST_EQ_STR (args[1], "--no-startup-event");
+	TEST_EQ_P (args[2], NULL);
+
 	/*******************************/
 }
 
@@ -4749,6 +5122,8 @@ main (int   argc,
 	test_int_arrays ();
 	test_string_arrays ();
 	test_hex_encoding ();
+	test_index ();
+	test_binary_encoding ();
 	test_rlimit_encoding ();
 	test_session_serialise ();
 	test_process_serialise ();
@@ -19,6 +19,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
 #include <nih/test.h>
 
 #include <sys/types.h>
@@ -128,6 +132,70 @@ test_kill (void)
 	TEST_EQ (WTERMSIG (status), SIGTERM);
 }
 
+void
+test_parse_cpus (void)
+{
+	cpu_set_t set;
+	int       ret;
+
+	TEST_FUNCTION ("system_parse_cpus");
+
+	/* Check that a single CPU is parsed into a set containing it.
+	 */
+	TEST_FEATURE ("with single cpu");
+	ret = system_parse_cpus ("2", &set);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (CPU_COUNT (&set), 1);
+	TEST_TRUE (CPU_ISSET (2, &set));
+
+
+	/* Check that ranges and single CPUs may be mixed, and that the
+	 * trailing newline found in sysfs files is accepted.
+	 */
+	TEST_FEATURE ("with ranges");
+	ret = system_parse_cpus ("0-3,8\n", &set);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (CPU_COUNT (&set), 5);
+	TEST_TRUE (CPU_ISSET (0, &set));
+	TEST_TRUE (CPU_ISSET (3, &set));
+	TEST_TRUE (CPU_ISSET (8, &set));
+	TEST_FALSE (CPU_ISSET (4, &set));
+
+
+	/* Check that a range that runs backwards is rejected.
+	 */
+	TEST_FEATURE ("with backwards range");
+	ret = system_parse_cpus ("3-1", &set);
+
+	TEST_LT (ret, 0);
+
+
+	/* Check that a trailing comma is rejected.
+	 */
+	TEST_FEATURE ("with trailing comma");
+	ret = system_parse_cpus ("1,", &set);
+
+	TEST_LT (ret, 0);
+
+
+	/* Check that an empty list is rejected.
+	 */
+	TEST_FEATURE ("with empty list");
+	ret = system_parse_cpus ("", &set);
+
+	TEST_LT (ret, 0);
+
+
+	/* Check that a CPU beyond the size of the set is rejected.
+	 */
+	TEST_FEATURE ("with cpu out of range");
+	ret = system_parse_cpus ("100000", &set);
+
+	TEST_LT (ret, 0);
+}
+
 
 int
 main (int   argc,
@@ -137,6 +205,7 @@ main (int   argc,
 	setenv ("UPSTART_NO_SESSIONS", "1", 1);
 
 	test_kill ();
+	test_parse_cpus ();
 
 	return 0;
 }
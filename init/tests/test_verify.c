@@ -0,0 +1,257 @@
+/* upstart
+ *
+ * test_verify.c - test suite for init/verify.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+
+#include "test_util_common.h"
+
+#ifndef INIT_VERIFY_BINARY
+#error unable to find init-verify binary as INIT_VERIFY_BINARY not defined
+#endif /* INIT_VERIFY_BINARY */
+
+
+/**
+ * run_verify:
+ * @args: arguments to init-verify,
+ * @output: set to array of lines output,
+ * @lines: set to number of lines in @output.
+ *
+ * Runs init-verify with @args, collecting both its standard output and
+ * standard error.
+ *
+ * Returns: exit status of init-verify.
+ **/
+static int
+run_verify (const char   *args,
+	    char       ***output,
+	    size_t       *lines)
+{
+	nih_local char *cmd = NULL;
+	char            buffer[BUFFER_SIZE];
+	FILE           *f;
+	int             status;
+
+	cmd = NIH_MUST (nih_sprintf (NULL, "%s %s 2>&1",
+				     INIT_VERIFY_BINARY, args));
+
+	*output = NIH_MUST (nih_str_array_new (NULL));
+	*lines = 0;
+
+	f = popen (cmd, "r");
+	TEST_NE_P (f, NULL);
+
+	while (fgets (buffer, sizeof (buffer), f)) {
+		size_t len = strlen (buffer);
+
+		if (len && (buffer[len - 1] == '\n'))
+			buffer[len - 1] = '\0';
+
+		NIH_MUST (nih_str_array_add (output, NULL, lines, buffer));
+	}
+
+	status = pclose (f);
+	TEST_TRUE (WIFEXITED (status));
+
+	return WEXITSTATUS (status);
+}
+
+
+void
+test_verify (void)
+{
+	char             dirname[PATH_MAX];
+	char             other_dirname[PATH_MAX];
+	nih_local char  *args = NULL;
+	char           **output;
+	size_t           lines;
+	int              ret;
+
+	TEST_GROUP ("init-verify");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	TEST_FILENAME (other_dirname);
+	TEST_EQ (mkdir (other_dirname, 0755), 0);
+
+
+	/* Check that nothing is reported, and the exit status is zero,
+	 * when every job parses and every condition can be satisfied.
+	 */
+	TEST_FEATURE ("with valid jobs");
+	CREATE_FILE (dirname, "foo.conf",
+		     "start on starting bar\n"
+		     "exec true");
+	CREATE_FILE (dirname, "bar.conf",
+		     "start on started baz or wibble\n"
+		     "task\n"
+		     "exec true");
+	CREATE_FILE (dirname, "baz.conf",
+		     "emits wibble\n"
+		     "exec true");
+
+	args = NIH_MUST (nih_sprintf (NULL, "%s", dirname));
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+
+	/* Check that a condition no job can satisfy is reported against
+	 * the job, as initctl check-config would, with a non-zero exit
+	 * status; and that an override is parsed along with its job.
+	 */
+	TEST_FEATURE ("with unreachable event in override");
+	CREATE_FILE (dirname, "foo.override",
+		     "start on starting bar and hello");
+
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (lines, 2);
+	TEST_EQ_STR (output[0], "foo");
+	TEST_EQ_STR (output[1], "  start on: unknown event hello");
+	nih_free (output);
+
+
+	/* Check that an event given to --ignore-events is not reported. */
+	TEST_FEATURE ("with ignored event");
+	nih_free (args);
+	args = NIH_MUST (nih_sprintf (NULL, "--ignore-events=hello %s",
+				      dirname));
+
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+	DELETE_FILE (dirname, "foo.override");
+
+
+	/* Check that errors are reported with the path and line of each
+	 * file in the order of the paths, however the files are shared
+	 * out between the workers parsing them.
+	 */
+	TEST_FEATURE ("with errors in several files");
+	CREATE_FILE (dirname, "aaa.conf",
+		     "wibble");
+	CREATE_FILE (dirname, "ccc.conf",
+		     "exec true\n"
+		     "wobble");
+	CREATE_FILE (dirname, "eee.conf",
+		     "exec true\n"
+		     "\n"
+		     "wubble");
+
+	for (int jobs = 1; jobs <= 4; jobs++) {
+		nih_free (args);
+		args = NIH_MUST (nih_sprintf (NULL, "--jobs=%d %s",
+					      jobs, dirname));
+
+		ret = run_verify (args, &output, &lines);
+
+		TEST_EQ (ret, 1);
+		TEST_EQ (lines, 3);
+		TEST_STR_MATCH (output[0], "*/aaa.conf:1: Unknown stanza");
+		TEST_STR_MATCH (output[1], "*/ccc.conf:2: Unknown stanza");
+		TEST_STR_MATCH (output[2], "*/eee.conf:3: Unknown stanza");
+		nih_free (output);
+	}
+
+	DELETE_FILE (dirname, "aaa.conf");
+	DELETE_FILE (dirname, "ccc.conf");
+	DELETE_FILE (dirname, "eee.conf");
+
+
+	/* Check that a job found in more than one directory is taken from
+	 * the first, so that its conditions are checked from there.
+	 */
+	TEST_FEATURE ("with job in two directories");
+	CREATE_FILE (other_dirname, "foo.conf",
+		     "start on hello\n"
+		     "exec true");
+
+	nih_free (args);
+	args = NIH_MUST (nih_sprintf (NULL, "%s %s", dirname, other_dirname));
+
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 0);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+	nih_free (args);
+	args = NIH_MUST (nih_sprintf (NULL, "%s %s", other_dirname, dirname));
+
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (lines, 2);
+	TEST_EQ_STR (output[0], "foo");
+	TEST_EQ_STR (output[1], "  start on: unknown event hello");
+	nih_free (output);
+
+	DELETE_FILE (other_dirname, "foo.conf");
+
+
+	/* Check that a missing directory is an error. */
+	TEST_FEATURE ("with missing directory");
+	nih_free (args);
+	args = NIH_MUST (nih_sprintf (NULL, "%s/missing", dirname));
+
+	ret = run_verify (args, &output, &lines);
+
+	TEST_EQ (ret, 1);
+	TEST_EQ (lines, 1);
+	TEST_STR_MATCH (output[0], "*/missing: *");
+	nih_free (output);
+
+	DELETE_FILE (dirname, "foo.conf");
+	DELETE_FILE (dirname, "bar.conf");
+	DELETE_FILE (dirname, "baz.conf");
+
+	TEST_EQ (rmdir (other_dirname), 0);
+	TEST_EQ (rmdir (dirname), 0);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	test_verify ();
+
+	return 0;
+}
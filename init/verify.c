@@ -0,0 +1,829 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/file.h>
+#include <nih/option.h>
+#include <nih/main.h>
+#include <nih/error.h>
+#include <nih/logging.h>
+
+#include <json.h>
+
+#include "paths.h"
+#include "job_class.h"
+#include "event_operator.h"
+#include "parse_job.h"
+#include "control.h"
+#include "state.h"
+
+
+/* Prototypes for static functions */
+static int    jobs_setter      (NihOption *option, const char *arg);
+static int    ignored_setter   (NihOption *option, const char *arg);
+static int    verify_filter    (const char *dir, const char *path,
+				int is_dir);
+static int    verify_visitor   (const char *dir, const char *dirname,
+				const char *path, struct stat *statbuf);
+static int    verify_compare   (const void *a, const void *b);
+static char * verify_name      (const void *parent, const char *dir,
+				const char *path)
+	__attribute__ ((warn_unused_result));
+static json_object *verify_file (size_t index)
+	__attribute__ ((warn_unused_result));
+static void   verify_worker    (size_t worker, size_t workers, FILE *out)
+	__attribute__ ((noreturn));
+static int    verify_collect   (FILE *in);
+static int    verify_report    (json_object *result);
+static int    verify_graph     (void);
+
+
+/**
+ * VerifyFile:
+ * @dir: configuration directory @path was found in,
+ * @path: full path to job configuration file.
+ *
+ * A job configuration file to be checked; @dir is kept so that the job
+ * name can be derived from @path the way init does.
+ **/
+typedef struct verify_file {
+	const char *dir;
+	char       *path;
+} VerifyFile;
+
+
+/**
+ * files:
+ *
+ * Job configuration files found beneath the directories given on the
+ * command-line, sorted by path, and the number of them.
+ **/
+static VerifyFile *files = NULL;
+static size_t      files_len = 0;
+
+/**
+ * names:
+ *
+ * Names of the jobs defined by files, as NihListEntry structures.
+ **/
+static NihHash *names = NULL;
+
+/**
+ * results:
+ *
+ * Result of parsing each entry in files, as returned by the workers.
+ **/
+static json_object **results = NULL;
+
+/**
+ * jobs:
+ *
+ * Number of worker processes to parse files with.
+ **/
+static long jobs = 0;
+
+/**
+ * ignored_events:
+ *
+ * Events that are emitted by something other than a job or init itself,
+ * and so should not be reported as unknown.
+ **/
+static char **ignored_events = NULL;
+
+/**
+ * warn:
+ *
+ * If TRUE, report unknown events and jobs on either side of an "or".
+ **/
+static int warn = FALSE;
+
+/**
+ * show_graph:
+ *
+ * If TRUE, print the events emitted and consumed by each job.
+ **/
+static int show_graph = FALSE;
+
+extern int user_mode;
+
+
+/**
+ * options:
+ *
+ * Command-line options we accept.
+ **/
+static NihOption options[] = {
+	{ 'j', "jobs", N_("number of files to parse in parallel"),
+		NULL, "NUM", NULL, jobs_setter },
+	{ 'i', "ignore-events", N_("comma-separated list of events to ignore"),
+		NULL, "EVENT_LIST", NULL, ignored_setter },
+	{ 'w', "warn", N_("report unknown events and jobs on either side of an \"or\""),
+		NULL, NULL, &warn, NULL },
+	{ 'g', "graph", N_("print the events emitted and consumed by each job"),
+		NULL, NULL, &show_graph, NULL },
+	{ 0, "user", N_("check jobs as run by a Session Init"),
+		NULL, NULL, &user_mode, NULL },
+
+	NIH_OPTION_LAST
+};
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	char  **args;
+	FILE  **out;
+	pid_t  *pids;
+	int     ret = 0;
+
+	nih_main_init (argv[0]);
+
+	nih_option_set_usage (_("DIR..."));
+	nih_option_set_synopsis (_("Check job configuration files."));
+	nih_option_set_help (
+		_("Parses every job configuration file beneath each DIR, "
+		  "in the same way as init, reporting any errors along with "
+		  "the conditions of each job that cannot be satisfied by "
+		  "the events emitted by the other jobs.\n\n"
+		  "Where a job is found in more than one DIR, the first "
+		  "is used.  The exit status is non-zero if any problem "
+		  "is reported."));
+
+	args = nih_option_parser (NULL, argc, argv, options, FALSE);
+	if (! args)
+		exit (1);
+
+	if (! args[0]) {
+		fprintf (stderr, _("%s: missing directory\n"), program_name);
+		nih_main_suggest_help ();
+		exit (1);
+	}
+
+	/* Parse the files as init itself would, which includes the
+	 * legacy mode in which jobs belong to no session.
+	 */
+	setenv ("UPSTART_NO_SESSIONS", "1", 1);
+
+	job_class_init ();
+
+	for (char **dir = args; *dir; dir++) {
+		if (nih_dir_walk (*dir, (NihFileFilter)verify_filter,
+				  (NihFileVisitor)verify_visitor, NULL,
+				  *dir) < 0) {
+			NihError *err;
+
+			err = nih_error_get ();
+			nih_error ("%s: %s", *dir, err->message);
+			nih_free (err);
+
+			exit (1);
+		}
+	}
+
+	if (files_len)
+		qsort (files, files_len, sizeof (VerifyFile), verify_compare);
+
+	if (jobs <= 0) {
+		jobs = sysconf (_SC_NPROCESSORS_ONLN);
+		if (jobs <= 0)
+			jobs = 1;
+	}
+	if ((size_t)jobs > files_len)
+		jobs = files_len ? files_len : 1;
+
+	results = NIH_MUST (nih_alloc (NULL, sizeof (json_object *)
+				       * (files_len + 1)));
+	memset (results, 0, sizeof (json_object *) * (files_len + 1));
+
+	out = NIH_MUST (nih_alloc (NULL, sizeof (FILE *) * jobs));
+	pids = NIH_MUST (nih_alloc (NULL, sizeof (pid_t) * jobs));
+
+	/* The parser and the allocator it uses are not thread-safe, so
+	 * each worker is a separate process that writes its results to
+	 * an anonymous file, read back once every worker has finished.
+	 */
+	fflush (NULL);
+	for (long i = 0; i < jobs; i++) {
+		out[i] = tmpfile ();
+		if (! out[i]) {
+			nih_fatal ("%s: %s", _("Unable to create temporary file"),
+				   strerror (errno));
+			exit (1);
+		}
+
+		pids[i] = fork ();
+		if (pids[i] < 0) {
+			nih_fatal ("%s: %s", _("Unable to fork"),
+				   strerror (errno));
+			exit (1);
+		} else if (! pids[i]) {
+			verify_worker (i, jobs, out[i]);
+		}
+	}
+
+	for (long i = 0; i < jobs; i++) {
+		int status;
+
+		while (waitpid (pids[i], &status, 0) < 0) {
+			if (errno != EINTR) {
+				nih_fatal ("%s: %s", _("Unable to wait for worker"),
+					   strerror (errno));
+				exit (1);
+			}
+		}
+
+		if ((! WIFEXITED (status)) || WEXITSTATUS (status)) {
+			nih_error (_("Worker %ld failed"), i);
+			ret = 1;
+		}
+
+		rewind (out[i]);
+		if (verify_collect (out[i]) < 0)
+			ret = 1;
+
+		fclose (out[i]);
+	}
+
+	for (size_t i = 0; i < files_len; i++) {
+		if (! results[i]) {
+			nih_error ("%s: %s", files[i].path,
+				   _("Not checked"));
+			ret = 1;
+			continue;
+		}
+
+		if (verify_report (results[i]) < 0)
+			ret = 1;
+	}
+
+	if (verify_graph () < 0)
+		ret = 1;
+
+	return ret;
+}
+
+
+/**
+ * jobs_setter:
+ * @option: NihOption invoked,
+ * @arg: argument to parse.
+ *
+ * Parse the number of worker processes to use.
+ *
+ * Returns: zero on success, non-zero on error.
+ **/
+static int
+jobs_setter (NihOption  *option,
+	     const char *arg)
+{
+	char *endptr;
+
+	nih_assert (option != NULL);
+	nih_assert (arg != NULL);
+
+	errno = 0;
+	jobs = strtol (arg, &endptr, 10);
+	if (errno || *endptr || (jobs <= 0) || (jobs > 1024)) {
+		fprintf (stderr, _("%s: illegal argument: %s\n"),
+			 program_name, arg);
+		nih_main_suggest_help ();
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * ignored_setter:
+ * @option: NihOption invoked,
+ * @arg: argument to parse.
+ *
+ * Add each event named in the comma-separated list @arg to
+ * ignored_events.
+ *
+ * Returns: zero on success, non-zero on error.
+ **/
+static int
+ignored_setter (NihOption  *option,
+		const char *arg)
+{
+	nih_local char **events = NULL;
+
+	nih_assert (option != NULL);
+	nih_assert (arg != NULL);
+
+	if (! ignored_events)
+		ignored_events = NIH_MUST (nih_str_array_new (NULL));
+
+	events = NIH_MUST (nih_str_split (NULL, arg, ",", TRUE));
+	NIH_MUST (nih_str_array_append (&ignored_events, NULL, NULL, events));
+
+	return 0;
+}
+
+
+/**
+ * verify_filter:
+ * @dir: configuration directory being walked,
+ * @path: path to check,
+ * @is_dir: TRUE if @path is a directory.
+ *
+ * Only job configuration files are visited, override files being
+ * found from them; directories that match nih_file_ignore() are skipped,
+ * as init does.
+ *
+ * Returns: FALSE if @path should be visited, TRUE otherwise.
+ **/
+static int
+verify_filter (const char *dir,
+	       const char *path,
+	       int         is_dir)
+{
+	const char *ext;
+
+	nih_assert (dir != NULL);
+	nih_assert (path != NULL);
+
+	if (is_dir)
+		return nih_file_ignore (NULL, path);
+
+	ext = strrchr (path, '.');
+	if (ext && IS_CONF_EXT_STD (ext))
+		return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * verify_visitor:
+ * @dir: configuration directory being walked,
+ * @dirname: directory containing @path,
+ * @path: path of job configuration file,
+ * @statbuf: stat of @path.
+ *
+ * Add @path to files unless a job of the same name was found in an
+ * earlier directory.
+ *
+ * Returns: zero.
+ **/
+static int
+verify_visitor (const char  *dir,
+		const char  *dirname,
+		const char  *path,
+		struct stat *statbuf)
+{
+	NihListEntry *entry;
+
+	nih_assert (dir != NULL);
+	nih_assert (path != NULL);
+	nih_assert (statbuf != NULL);
+
+	if (! S_ISREG (statbuf->st_mode))
+		return 0;
+
+	if (! names)
+		names = NIH_MUST (nih_hash_string_new (NULL, 0));
+
+	entry = NIH_MUST (nih_list_entry_new (names));
+	entry->str = verify_name (entry, dir, path);
+
+	if (nih_hash_lookup (names, entry->str)) {
+		nih_free (entry);
+		return 0;
+	}
+
+	nih_hash_add (names, &entry->entry);
+
+	files = NIH_MUST (nih_realloc (files, NULL,
+				       sizeof (VerifyFile) * (files_len + 1)));
+	files[files_len].dir = dir;
+	files[files_len].path = NIH_MUST (nih_strdup (files, path));
+	files_len++;
+
+	return 0;
+}
+
+/**
+ * verify_compare:
+ * @a: first file,
+ * @b: second file.
+ *
+ * qsort() comparison function ordering files by path, so that problems
+ * are reported in the same order whatever the number of workers.
+ *
+ * Returns: less than, equal to or greater than zero.
+ **/
+static int
+verify_compare (const void *a,
+		const void *b)
+{
+	return strcmp (((const VerifyFile *)a)->path,
+		       ((const VerifyFile *)b)->path);
+}
+
+/**
+ * verify_name:
+ * @parent: parent object for new string,
+ * @dir: configuration directory @path was found in,
+ * @path: path of job configuration file.
+ *
+ * Derive the name of the job defined by @path, which is its path
+ * relative to @dir without the extension.
+ *
+ * Returns: newly allocated name.
+ **/
+static char *
+verify_name (const void *parent,
+	     const char *dir,
+	     const char *path)
+{
+	const char *start, *end;
+	size_t      dir_len;
+
+	nih_assert (dir != NULL);
+	nih_assert (path != NULL);
+
+	start = path;
+	dir_len = strlen (dir);
+
+	if (! strncmp (start, dir, dir_len))
+		start += dir_len;
+
+	while (*start == '/')
+		start++;
+
+	end = strrchr (start, '.');
+	if (end && IS_CONF_EXT (end))
+		return NIH_MUST (nih_strndup (parent, start, end - start));
+
+	return NIH_MUST (nih_strdup (parent, start));
+}
+
+
+/**
+ * verify_file:
+ * @index: index of file in files.
+ *
+ * Parse the job configuration file at @index in files, along with its
+ * override file if there is one.
+ *
+ * Returns: JSON object holding the job name with either the error that
+ * occurred, or the conditions of the job and the events it emits.
+ **/
+static json_object *
+verify_file (size_t index)
+{
+	nih_local char *name = NULL;
+	nih_local char *override_path = NULL;
+	JobClass       *class = NULL;
+	json_object    *json;
+	struct stat     statbuf;
+
+	nih_assert (index < files_len);
+
+	name = verify_name (NULL, files[index].dir, files[index].path);
+
+	override_path = NIH_MUST (nih_strndup (NULL, files[index].path,
+					       strlen (files[index].path)
+					       - strlen (CONF_EXT_STD)));
+	NIH_MUST (nih_strcat (&override_path, NULL, CONF_EXT_OVERRIDE));
+
+	json = json_object_new_object ();
+	if (! json)
+		return NULL;
+
+	if (! state_set_json_int_var (json, "index", index))
+		goto error;
+
+	if (! state_set_json_string_var (json, "name", name))
+		goto error;
+
+	for (int override = FALSE; override <= TRUE; override++) {
+		const char      *path = override ? override_path : files[index].path;
+		nih_local char  *buf = NULL;
+		size_t           len;
+		size_t           pos = 0;
+		size_t           lineno = 1;
+
+		if (override && (stat (path, &statbuf) < 0))
+			break;
+
+		buf = nih_file_read (NULL, path, &len);
+		if (buf)
+			class = parse_job (NULL, NULL, class, name,
+					   buf, len, &pos, &lineno);
+
+		if ((! buf) || (! class)) {
+			NihError *err;
+
+			err = nih_error_get ();
+
+			if ((! state_set_json_string_var (json, "path", path))
+			    || (! state_set_json_string_var (json, "error",
+							     err->message))
+			    || (! state_set_json_int_var (json, "lineno",
+							  buf ? lineno : 0))) {
+				nih_free (err);
+				goto error;
+			}
+
+			nih_free (err);
+
+			return json;
+		}
+	}
+
+	if (class->start_on) {
+		json_object *json_start_on;
+
+		json_start_on = event_operator_serialise_all (class->start_on);
+		if (! json_start_on)
+			goto error;
+
+		json_object_object_add (json, "start_on", json_start_on);
+	}
+
+	if (class->stop_on) {
+		json_object *json_stop_on;
+
+		json_stop_on = event_operator_serialise_all (class->stop_on);
+		if (! json_stop_on)
+			goto error;
+
+		json_object_object_add (json, "stop_on", json_stop_on);
+	}
+
+	if (! state_set_json_str_array_from_obj (json, class, emits))
+		goto error;
+
+	nih_free (class);
+
+	return json;
+
+error:
+	if (class)
+		nih_free (class);
+	json_object_put (json);
+	return NULL;
+}
+
+/**
+ * verify_worker:
+ * @worker: number of this worker,
+ * @workers: total number of workers,
+ * @out: file to write results to.
+ *
+ * Parse every @workers'th file in files starting with @worker, writing
+ * the result for each to @out as a line of JSON, then exit.
+ **/
+static void
+verify_worker (size_t  worker,
+	       size_t  workers,
+	       FILE   *out)
+{
+	nih_assert (workers > 0);
+	nih_assert (out != NULL);
+
+	for (size_t i = worker; i < files_len; i += workers) {
+		json_object *json;
+
+		json = verify_file (i);
+		if (! json)
+			_exit (1);
+
+		fprintf (out, "%s\n", json_object_to_json_string_ext (
+				 json, JSON_C_TO_STRING_PLAIN));
+		json_object_put (json);
+	}
+
+	if (fflush (out) || ferror (out))
+		_exit (1);
+
+	_exit (0);
+}
+
+/**
+ * verify_collect:
+ * @in: file written by a worker.
+ *
+ * Read each result written to @in into results.
+ *
+ * Returns: zero on success, negative value if @in could not be read.
+ **/
+static int
+verify_collect (FILE *in)
+{
+	char    *line = NULL;
+	size_t   size = 0;
+	ssize_t  len;
+	int      ret = 0;
+
+	nih_assert (in != NULL);
+
+	while ((len = getline (&line, &size, in)) > 0) {
+		json_object *json;
+		size_t       index;
+
+		json = json_tokener_parse (line);
+		if ((! json)
+		    || (! state_get_json_int_var (json, "index", index))
+		    || (index >= files_len)) {
+			if (json)
+				json_object_put (json);
+
+			nih_error (_("Unable to read worker result"));
+			ret = -1;
+			continue;
+		}
+
+		if (results[index])
+			json_object_put (results[index]);
+		results[index] = json;
+	}
+
+	free (line);
+
+	return ret;
+}
+
+/**
+ * verify_report:
+ * @result: result of parsing a file.
+ *
+ * Report the error in @result, or otherwise create a job class from it
+ * and register it so that its conditions may be checked.
+ *
+ * Returns: zero if the file was parsed, negative value otherwise.
+ **/
+static int
+verify_report (json_object *result)
+{
+	nih_local char *name = NULL;
+	JobClass       *class;
+	json_object    *json_on;
+
+	nih_assert (result != NULL);
+
+	if (json_object_object_get_ex (result, "error", NULL)) {
+		nih_local char *path = NULL;
+		nih_local char *message = NULL;
+		size_t          lineno = 0;
+
+		if ((! state_get_json_string_var_strict (result, "path",
+							 NULL, path))
+		    || (! state_get_json_string_var_strict (result, "error",
+							    NULL, message))
+		    || (! state_get_json_int_var (result, "lineno", lineno)))
+			goto error;
+
+		if (lineno) {
+			nih_error ("%s:%zi: %s", path, lineno, message);
+		} else {
+			nih_error ("%s: %s", path, message);
+		}
+
+		return -1;
+	}
+
+	if (! state_get_json_string_var_strict (result, "name", NULL, name))
+		goto error;
+
+	class = NIH_MUST (job_class_new (NULL, name, NULL));
+
+	if (json_object_object_get_ex (result, "start_on", &json_on)) {
+		class->start_on = event_operator_deserialise_all (class, json_on);
+		if (! class->start_on)
+			goto error;
+	}
+
+	if (json_object_object_get_ex (result, "stop_on", &json_on)) {
+		class->stop_on = event_operator_deserialise_all (class, json_on);
+		if (! class->stop_on)
+			goto error;
+	}
+
+	if (! state_get_json_str_array_to_obj (result, class, emits))
+		goto error;
+
+	nih_hash_add (job_classes, &class->entry);
+
+	return 0;
+
+error:
+	nih_error (_("Unable to read worker result"));
+	return -1;
+}
+
+/**
+ * verify_graph:
+ *
+ * Check the conditions of each registered job class against the events
+ * emitted by the others, just as initctl check-config does against a
+ * running init, and print any that cannot be satisfied; with --graph,
+ * the events emitted and consumed by each job are printed first.
+ *
+ * Returns: zero if every condition can be satisfied, negative value
+ * otherwise.
+ **/
+static int
+verify_graph (void)
+{
+	nih_local NihDBusMessage *message = NULL;
+	ControlGetDependencyGraphEmitsElement       **emits;
+	ControlGetDependencyGraphConsumesElement    **consumes;
+	ControlGetDependencyGraphUnreachableElement **unreachable;
+	const char               *displayed = NULL;
+	int                       ret = 0;
+
+	if (! ignored_events)
+		ignored_events = NIH_MUST (nih_str_array_new (NULL));
+
+	/* There is no caller to derive a session from, so the message
+	 * has neither a connection nor a D-Bus message.
+	 */
+	message = NIH_MUST (nih_new (NULL, NihDBusMessage));
+	message->connection = NULL;
+	message->message = NULL;
+
+	if (control_get_dependency_graph (NULL, message, ignored_events, warn,
+					  &emits, &consumes,
+					  &unreachable) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_error ("%s", err->message);
+		nih_free (err);
+
+		return -1;
+	}
+
+	if (show_graph) {
+		for (ControlGetDependencyGraphEmitsElement **e = emits;
+		     e && *e; e++)
+			nih_message ("%s emits %s", (*e)->item0, (*e)->item1);
+
+		for (ControlGetDependencyGraphConsumesElement **c = consumes;
+		     c && *c; c++) {
+			if (*(*c)->item3) {
+				nih_message ("%s %s %s %s", (*c)->item0,
+					     (*c)->item1, (*c)->item2,
+					     (*c)->item3);
+			} else {
+				nih_message ("%s %s %s", (*c)->item0,
+					     (*c)->item1, (*c)->item2);
+			}
+		}
+	}
+
+	for (ControlGetDependencyGraphUnreachableElement **u = unreachable;
+	     u && *u; u++) {
+		if ((! displayed) || strcmp (displayed, (*u)->item0)) {
+			nih_message ("%s", (*u)->item0);
+			displayed = (*u)->item0;
+		}
+
+		nih_message ("  %s: %s %s", (*u)->item1,
+			     strcmp ((*u)->item2, "job")
+			     ? _("unknown event") : _("unknown job"),
+			     (*u)->item3);
+		ret = -1;
+	}
+
+	return ret;
+}
@@ -87,10 +87,24 @@ upstart_open (const void *parent)
 	return upstart;
 }
 
+static int client_replied;
+static int client_error;
+
+static void
+client_reply (void *         data,
+	      UpstartClient *client,
+	      const char *   instance,
+	      NihError *     error)
+{
+	client_replied = TRUE;
+	client_error = (error != NULL);
+}
+
 void
 test_libupstart (void)
 {
 	nih_local NihDBusProxy  *upstart = NULL;
+	UpstartClient           *client;
 	nih_local char          *version = NULL;
 	int                      ret;
 	pid_t                    upstart_pid;
@@ -135,6 +149,38 @@ test_libupstart (void)
 	nih_message ("Running instance version: '%s'", version);
 	assert0 (fnmatch ("init (upstart*)", version, 0x0));
 
+	/* Check that the asynchronous client loads its mirror of job
+	 * status, and that a request is answered through its handler;
+	 * one for a job that does not exist fails.
+	 */
+	TEST_FEATURE ("asynchronous client");
+
+	client = upstart_client_new (NULL, NULL, NULL, NULL);
+	TEST_NE_P (client, NULL);
+
+	ret = upstart_client_connect (client);
+	TEST_EQ (ret, 0);
+
+	while (! client->synced)
+		assert (dbus_connection_read_write_dispatch (client->connection, -1));
+
+	TEST_EQ_P (upstart_client_lookup (client, "no-such-job", NULL), NULL);
+
+	client_replied = FALSE;
+	client_error = FALSE;
+
+	ret = upstart_client_start (client, "no-such-job", NULL, TRUE,
+				    client_reply, NULL);
+	TEST_EQ (ret, 0);
+
+	while (! client_replied)
+		assert (dbus_connection_read_write_dispatch (client->connection, -1));
+
+	TEST_TRUE (client_error);
+	TEST_LIST_EMPTY (client->calls);
+
+	nih_free (client);
+
 	STOP_UPSTART (upstart_pid);
 	TEST_DBUS_END (dbus_pid);
 
@@ -0,0 +1,1343 @@
+/* upstart
+ *
+ * upstart-client.c - asynchronous client with a local mirror of job state
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <dbus/dbus.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/timer.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include <nih-dbus/dbus_connection.h>
+#include <nih-dbus/dbus_error.h>
+#include <nih-dbus/dbus_path.h>
+#include <nih-dbus/dbus_proxy.h>
+#include <nih-dbus/errors.h>
+
+#include "upstart.h"
+#include "upstart-client.h"
+
+
+/**
+ * UpstartClientCall:
+ * @entry: list header,
+ * @client: client the call was made through,
+ * @pending: pending D-Bus call,
+ * @proxy: proxy for the job the call was made on, or NULL,
+ * @full: TRUE if the mirror is being loaded in full,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Tracks a call waiting for a reply from Upstart, so that it can be
+ * cancelled should the client be freed first.  Calls the client makes
+ * to keep its mirror up to date have no @handler.
+ **/
+typedef struct upstart_client_call {
+	NihList             entry;
+	UpstartClient      *client;
+	DBusPendingCall    *pending;
+	NihDBusProxy       *proxy;
+	int                 full;
+
+	UpstartClientReply  handler;
+	void               *data;
+} UpstartClientCall;
+
+
+/* Prototypes for static functions */
+static int   upstart_client_destroy      (UpstartClient *client);
+static void  upstart_client_disconnected (DBusConnection *connection);
+static void  upstart_client_retry        (UpstartClient *client);
+static void  upstart_client_reconnect    (UpstartClient *client,
+					  NihTimer *timer);
+static int   upstart_client_sync         (UpstartClient *client, int full);
+static int   upstart_client_load         (UpstartClient *client)
+	__attribute__ ((warn_unused_result));
+static void  upstart_client_apply        (UpstartClient *client,
+					  uint64_t seq, const char *type,
+					  const char *path, const char *status);
+static void  upstart_client_update       (UpstartClient *client,
+					  const char *path,
+					  const char *job, const char *name,
+					  const char *goal, const char *state);
+static void  upstart_client_remove       (UpstartClient *client,
+					  UpstartClientInstance *instance);
+static char *upstart_client_path_element (const void *parent,
+					  const char *str, size_t len)
+	__attribute__ ((warn_unused_result));
+
+static UpstartClientCall *upstart_client_call_new (UpstartClient *client,
+						   UpstartClientReply handler,
+						   void *data)
+	__attribute__ ((warn_unused_result));
+static int   upstart_client_call_destroy (UpstartClientCall *call);
+static void  upstart_client_call_done    (UpstartClientCall *call);
+static UpstartClientCall *upstart_client_request (UpstartClient *client,
+						  const char *job,
+						  UpstartClientReply handler,
+						  void *data)
+	__attribute__ ((warn_unused_result));
+
+static void  upstart_client_changes      (UpstartClient *client,
+					  NihDBusMessage *message,
+					  UpstartChangesChangesElement * const *changes);
+static void  upstart_client_restarted    (UpstartClient *client,
+					  NihDBusMessage *message);
+static void  upstart_client_subscribed   (UpstartClientCall *call,
+					  NihDBusMessage *message,
+					  uint64_t seq);
+static void  upstart_client_got_changes  (UpstartClientCall *call,
+					  NihDBusMessage *message,
+					  uint64_t seq,
+					  UpstartGetChangesChangesElement * const *changes);
+static void  upstart_client_got_changes_error (UpstartClientCall *call,
+					       NihDBusMessage *message);
+static void  upstart_client_loaded       (UpstartClientCall *call,
+					  NihDBusMessage *message,
+					  UpstartGetAllJobStatusJobsElement * const *jobs);
+static void  upstart_client_sync_error   (UpstartClientCall *call,
+					  NihDBusMessage *message);
+static void  upstart_client_instance_reply (UpstartClientCall *call,
+					    NihDBusMessage *message,
+					    const char *instance);
+static void  upstart_client_reply        (UpstartClientCall *call,
+					  NihDBusMessage *message);
+static void  upstart_client_reply_error  (UpstartClientCall *call,
+					  NihDBusMessage *message);
+
+
+/**
+ * upstart_clients:
+ *
+ * Clients with an open connection; the disconnect handler is given only
+ * the connection, so this is used to find the clients that used it.
+ **/
+static NihList *upstart_clients = NULL;
+
+
+/**
+ * upstart_client_new:
+ * @parent: parent object for new client,
+ * @address: D-Bus address of Upstart, or NULL,
+ * @changed: function to call when the mirror changes, or NULL,
+ * @data: pointer to pass to @changed.
+ *
+ * Allocates and returns a new client for the instance of Upstart listening
+ * on @address; when NULL, the Session Init named by the UPSTART_SESSION
+ * environment variable is used if set, otherwise the system init daemon.
+ *
+ * The client is not connected until upstart_client_connect() is called,
+ * and relies on the main loop to dispatch the connection and run the
+ * reconnect timer.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned client.  When all parents
+ * of the returned client are freed, the returned client will also be
+ * freed.
+ *
+ * Returns: newly allocated client or NULL if insufficient memory.
+ **/
+UpstartClient *
+upstart_client_new (const void          *parent,
+		    const char          *address,
+		    UpstartClientChanged changed,
+		    void                *data)
+{
+	UpstartClient *client;
+
+	if (! upstart_clients) {
+		upstart_clients = nih_list_new (NULL);
+		if (! upstart_clients)
+			return NULL;
+	}
+
+	if (! address)
+		address = getenv ("UPSTART_SESSION");
+	if (! address)
+		address = DBUS_ADDRESS_UPSTART;
+
+	client = nih_new (parent, UpstartClient);
+	if (! client)
+		return NULL;
+
+	nih_list_init (&client->entry);
+
+	client->address = nih_strdup (client, address);
+	if (! client->address)
+		goto error;
+
+	client->connection = NULL;
+	client->upstart = NULL;
+
+	client->instances = nih_hash_string_new (client, 0);
+	if (! client->instances)
+		goto error;
+
+	client->seq = 0;
+	client->subscribed = 0;
+	client->synced = FALSE;
+
+	client->calls = nih_list_new (client);
+	if (! client->calls)
+		goto error;
+
+	client->reconnect_timer = NULL;
+	client->reconnect_delay = UPSTART_CLIENT_RECONNECT_MIN;
+
+	client->changed = changed;
+	client->data = data;
+
+	nih_alloc_set_destructor (client, upstart_client_destroy);
+
+	return client;
+
+error:
+	nih_free (client);
+	return NULL;
+}
+
+/**
+ * upstart_client_destroy:
+ * @client: client being destroyed.
+ *
+ * Drops the reference to the connection held by @client; outstanding
+ * calls are cancelled as they are freed along with it.
+ *
+ * Returns: zero.
+ **/
+static int
+upstart_client_destroy (UpstartClient *client)
+{
+	nih_assert (client != NULL);
+
+	nih_list_destroy (&client->entry);
+
+	if (client->connection)
+		dbus_connection_unref (client->connection);
+
+	return 0;
+}
+
+
+/**
+ * upstart_client_connect:
+ * @client: client to connect.
+ *
+ * Connects @client to Upstart, subscribes to the change feed and begins
+ * loading the mirror; @synced is set once the reply arrives.  Does nothing
+ * if @client is already connected.
+ *
+ * Should connecting fail, another attempt is made by a timer, waiting
+ * longer after each failure, just as when the connection is later lost.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+upstart_client_connect (UpstartClient *client)
+{
+	DBusConnection *connection;
+	NihDBusProxy *  upstart;
+
+	nih_assert (client != NULL);
+
+	if (client->connection)
+		return 0;
+
+	if (client->reconnect_timer) {
+		nih_free (client->reconnect_timer);
+		client->reconnect_timer = NULL;
+	}
+
+	connection = nih_dbus_connect (client->address,
+				       upstart_client_disconnected);
+	if (! connection)
+		goto error;
+
+	upstart = nih_dbus_proxy_new (client, connection, NULL,
+				      DBUS_PATH_UPSTART, NULL, NULL);
+	if (! upstart) {
+		dbus_connection_unref (connection);
+		goto error;
+	}
+
+	if ((! nih_dbus_proxy_connect (upstart, &upstart_com_ubuntu_Upstart0_6,
+				       "Changes",
+				       (NihDBusSignalHandler)upstart_client_changes,
+				       client))
+	    || (! nih_dbus_proxy_connect (upstart, &upstart_com_ubuntu_Upstart0_6,
+					  "Restarted",
+					  (NihDBusSignalHandler)upstart_client_restarted,
+					  client))) {
+		nih_free (upstart);
+		dbus_connection_unref (connection);
+		goto error;
+	}
+
+	client->connection = connection;
+	client->upstart = upstart;
+	nih_list_add (upstart_clients, &client->entry);
+
+	/* Changes missed while disconnected can be asked for only if the
+	 * mirror was loaded before.
+	 */
+	if (upstart_client_sync (client, client->seq == 0) < 0) {
+		nih_list_remove (&client->entry);
+		nih_free (client->upstart);
+		client->upstart = NULL;
+		client->connection = NULL;
+		dbus_connection_unref (connection);
+		goto error;
+	}
+
+	client->reconnect_delay = UPSTART_CLIENT_RECONNECT_MIN;
+
+	return 0;
+
+error:
+	upstart_client_retry (client);
+	return -1;
+}
+
+/**
+ * upstart_client_disconnected:
+ * @connection: connection that was lost.
+ *
+ * Called when the connection to Upstart is lost; each client that was
+ * using @connection drops it and waits to reconnect.  The mirror is kept
+ * as it was, but @synced is cleared until the client catches up again.
+ **/
+static void
+upstart_client_disconnected (DBusConnection *connection)
+{
+	nih_assert (connection != NULL);
+
+	if (! upstart_clients)
+		return;
+
+	NIH_LIST_FOREACH_SAFE (upstart_clients, iter) {
+		UpstartClient *client = (UpstartClient *)iter;
+
+		if (client->connection != connection)
+			continue;
+
+		nih_list_remove (&client->entry);
+
+		nih_free (client->upstart);
+		client->upstart = NULL;
+		client->connection = NULL;
+		client->synced = FALSE;
+
+		upstart_client_retry (client);
+	}
+}
+
+/**
+ * upstart_client_retry:
+ * @client: client to reconnect.
+ *
+ * Arranges for another attempt to connect @client once the current delay
+ * has passed, doubling the delay for the attempt after that.
+ **/
+static void
+upstart_client_retry (UpstartClient *client)
+{
+	nih_assert (client != NULL);
+
+	if (client->reconnect_timer)
+		return;
+
+	client->reconnect_timer = nih_timer_add_timeout (
+		client, client->reconnect_delay,
+		(NihTimerCb)upstart_client_reconnect, client);
+	if (! client->reconnect_timer)
+		nih_warn ("Unable to reconnect to Upstart: %s",
+			  strerror (ENOMEM));
+
+	client->reconnect_delay = nih_min (client->reconnect_delay * 2,
+					   UPSTART_CLIENT_RECONNECT_MAX);
+}
+
+/**
+ * upstart_client_reconnect:
+ * @client: client to reconnect,
+ * @timer: timer that fired.
+ *
+ * Timer callback that attempts to connect @client again; a failure
+ * arranges the next attempt.
+ **/
+static void
+upstart_client_reconnect (UpstartClient *client,
+			  NihTimer *     timer)
+{
+	nih_assert (client != NULL);
+
+	/* Timeouts are freed once they have fired */
+	client->reconnect_timer = NULL;
+
+	if (upstart_client_connect (client) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_free (err);
+	}
+}
+
+
+/**
+ * upstart_client_lookup:
+ * @client: client to look in,
+ * @job: name of job,
+ * @name: name of instance, or NULL.
+ *
+ * Looks up instance @name of @job in the mirror of @client, without
+ * asking Upstart; @name may be NULL or empty for jobs without an instance
+ * stanza.
+ *
+ * Returns: instance found, or NULL if not known to be running.
+ **/
+UpstartClientInstance *
+upstart_client_lookup (UpstartClient *client,
+		       const char *   job,
+		       const char *   name)
+{
+	nih_local char *path = NULL;
+
+	nih_assert (client != NULL);
+	nih_assert (job != NULL);
+
+	path = nih_dbus_path (NULL, DBUS_PATH_UPSTART, "jobs", job,
+			      name ? name : "", NULL);
+	if (! path)
+		return NULL;
+
+	return (UpstartClientInstance *)nih_hash_lookup (client->instances,
+							  path);
+}
+
+
+/**
+ * upstart_client_sync:
+ * @client: connected client,
+ * @full: TRUE to load the mirror in full.
+ *
+ * Subscribes @client to the change feed, then either asks for the changes
+ * since the last one applied or, when @full is TRUE, loads the mirror
+ * in full.  Both calls are sent together, the subscription first so that
+ * no change can fall between them.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+upstart_client_sync (UpstartClient *client,
+		     int            full)
+{
+	UpstartClientCall *call;
+
+	nih_assert (client != NULL);
+	nih_assert (client->upstart != NULL);
+
+	client->synced = FALSE;
+
+	call = upstart_client_call_new (client, NULL, NULL);
+	if (! call)
+		return -1;
+
+	call->full = full;
+	call->pending = upstart_subscribe_changes (
+		client->upstart,
+		(UpstartSubscribeChangesReply)upstart_client_subscribed,
+		(NihDBusErrorHandler)upstart_client_sync_error,
+		call, NIH_DBUS_TIMEOUT_DEFAULT);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	if (full)
+		return upstart_client_load (client);
+
+	call = upstart_client_call_new (client, NULL, NULL);
+	if (! call)
+		return -1;
+
+	call->pending = upstart_get_changes (
+		client->upstart, client->seq,
+		(UpstartGetChangesReply)upstart_client_got_changes,
+		(NihDBusErrorHandler)upstart_client_got_changes_error,
+		call, NIH_DBUS_TIMEOUT_DEFAULT);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_load:
+ * @client: connected client.
+ *
+ * Asks for the goal and state of every instance with a single
+ * GetAllJobStatus call, to replace the mirror of @client.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+upstart_client_load (UpstartClient *client)
+{
+	UpstartClientCall *call;
+
+	nih_assert (client != NULL);
+	nih_assert (client->upstart != NULL);
+
+	call = upstart_client_call_new (client, NULL, NULL);
+	if (! call)
+		return -1;
+
+	call->full = TRUE;
+	call->pending = upstart_get_all_job_status (
+		client->upstart,
+		(UpstartGetAllJobStatusReply)upstart_client_loaded,
+		(NihDBusErrorHandler)upstart_client_sync_error,
+		call, NIH_DBUS_TIMEOUT_DEFAULT);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_subscribed:
+ * @call: call context,
+ * @message: D-Bus message received,
+ * @seq: sequence number of the latest change.
+ *
+ * Reply to SubscribeChanges; when the mirror is being loaded in full the
+ * sequence number restarts from @seq, since Upstart may have been
+ * restarted and begun numbering again.
+ **/
+static void
+upstart_client_subscribed (UpstartClientCall *call,
+			   NihDBusMessage *   message,
+			   uint64_t           seq)
+{
+	UpstartClient *client;
+
+	nih_assert (call != NULL);
+
+	client = call->client;
+
+	client->subscribed = seq;
+	if (call->full)
+		client->seq = seq;
+
+	upstart_client_call_done (call);
+}
+
+/**
+ * upstart_client_got_changes:
+ * @call: call context,
+ * @message: D-Bus message received,
+ * @seq: sequence number of the latest change,
+ * @changes: changes since the one last applied.
+ *
+ * Reply to GetChanges, applying the changes missed while disconnected.
+ **/
+static void
+upstart_client_got_changes (UpstartClientCall *                      call,
+			    NihDBusMessage *                         message,
+			    uint64_t                                 seq,
+			    UpstartGetChangesChangesElement * const *changes)
+{
+	UpstartClient *client;
+
+	nih_assert (call != NULL);
+	nih_assert (changes != NULL);
+
+	client = call->client;
+	upstart_client_call_done (call);
+
+	for (UpstartGetChangesChangesElement * const *change = changes;
+	     *change; change++)
+		upstart_client_apply (client, (*change)->item0,
+				      (*change)->item1, (*change)->item2,
+				      (*change)->item3);
+
+	client->synced = TRUE;
+}
+
+/**
+ * upstart_client_got_changes_error:
+ * @call: call context,
+ * @message: D-Bus message received.
+ *
+ * Error reply to GetChanges, normally because Upstart no longer has the
+ * changes missed or was restarted; the mirror is loaded in full instead,
+ * numbering changes from the subscription.
+ **/
+static void
+upstart_client_got_changes_error (UpstartClientCall *call,
+				  NihDBusMessage *   message)
+{
+	UpstartClient *client;
+	NihError *     err;
+
+	nih_assert (call != NULL);
+
+	client = call->client;
+	upstart_client_call_done (call);
+
+	err = nih_error_get ();
+	nih_free (err);
+
+	if (! client->connection)
+		return;
+
+	client->seq = client->subscribed;
+
+	if (upstart_client_load (client) < 0) {
+		err = nih_error_get ();
+		nih_warn ("Unable to load job status: %s", err->message);
+		nih_free (err);
+	}
+}
+
+/**
+ * upstart_client_loaded:
+ * @call: call context,
+ * @message: D-Bus message received,
+ * @jobs: status of every instance.
+ *
+ * Reply to GetAllJobStatus, replacing the mirror of the client with
+ * @jobs; instances are moved across so that only those whose goal or
+ * state differ, or that have gone, are reported to the changed function.
+ **/
+static void
+upstart_client_loaded (UpstartClientCall *                        call,
+		       NihDBusMessage *                           message,
+		       UpstartGetAllJobStatusJobsElement * const *jobs)
+{
+	UpstartClient *client;
+	NihHash *      old;
+	NihHash *      instances;
+
+	nih_assert (call != NULL);
+	nih_assert (jobs != NULL);
+
+	client = call->client;
+	upstart_client_call_done (call);
+
+	instances = nih_hash_string_new (client, 0);
+	if (! instances) {
+		nih_warn ("Unable to load job status: %s", strerror (ENOMEM));
+		return;
+	}
+
+	old = client->instances;
+	client->instances = instances;
+
+	for (UpstartGetAllJobStatusJobsElement * const *job = jobs;
+	     *job; job++) {
+		nih_local char *       path = NULL;
+		UpstartClientInstance *instance;
+
+		if ((! strcmp ((*job)->item2, "stop"))
+		    && (! strcmp ((*job)->item3, "waiting")))
+			continue;
+
+		path = nih_dbus_path (NULL, DBUS_PATH_UPSTART, "jobs",
+				      (*job)->item0, (*job)->item1, NULL);
+		if (! path)
+			continue;
+
+		instance = (UpstartClientInstance *)nih_hash_lookup (old, path);
+		if (instance) {
+			nih_list_remove (&instance->entry);
+			nih_hash_add (client->instances, &instance->entry);
+		}
+
+		upstart_client_update (client, path, (*job)->item0,
+				       (*job)->item1, (*job)->item2,
+				       (*job)->item3);
+	}
+
+	NIH_HASH_FOREACH_SAFE (old, iter)
+		upstart_client_remove (client, (UpstartClientInstance *)iter);
+
+	nih_free (old);
+
+	client->synced = TRUE;
+}
+
+/**
+ * upstart_client_sync_error:
+ * @call: call context,
+ * @message: D-Bus message received.
+ *
+ * Error reply to SubscribeChanges or GetAllJobStatus; the mirror is left
+ * unsynced until the connection is next made.
+ **/
+static void
+upstart_client_sync_error (UpstartClientCall *call,
+			   NihDBusMessage *   message)
+{
+	NihError *err;
+
+	nih_assert (call != NULL);
+
+	upstart_client_call_done (call);
+
+	err = nih_error_get ();
+	nih_warn ("Unable to load job status: %s", err->message);
+	nih_free (err);
+}
+
+/**
+ * upstart_client_changes:
+ * @client: client subscribed,
+ * @message: D-Bus message received,
+ * @changes: batch of changes.
+ *
+ * Handles the Changes signal, applying each change to the mirror.
+ **/
+static void
+upstart_client_changes (UpstartClient *                       client,
+			NihDBusMessage *                      message,
+			UpstartChangesChangesElement * const *changes)
+{
+	nih_assert (client != NULL);
+	nih_assert (changes != NULL);
+
+	for (UpstartChangesChangesElement * const *change = changes;
+	     *change; change++)
+		upstart_client_apply (client, (*change)->item0,
+				      (*change)->item1, (*change)->item2,
+				      (*change)->item3);
+}
+
+/**
+ * upstart_client_restarted:
+ * @client: client subscribed,
+ * @message: D-Bus message received.
+ *
+ * Handles the Restarted signal; since the change feed was lost when
+ * Upstart restarted, the mirror is loaded again in full.
+ **/
+static void
+upstart_client_restarted (UpstartClient * client,
+			  NihDBusMessage *message)
+{
+	nih_assert (client != NULL);
+
+	if (! client->upstart)
+		return;
+
+	if (upstart_client_sync (client, TRUE) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn ("Unable to load job status: %s", err->message);
+		nih_free (err);
+	}
+}
+
+
+/**
+ * upstart_client_apply:
+ * @client: client to update,
+ * @seq: sequence number of change,
+ * @type: type of change,
+ * @path: object path of job or instance changed,
+ * @status: "goal/state" of the instance, for a status change.
+ *
+ * Applies a single change from the change feed to the mirror of @client,
+ * ignoring those already applied.  Instances are added by their first
+ * status change rather than when created, since they are created stopped.
+ **/
+static void
+upstart_client_apply (UpstartClient *client,
+		      uint64_t       seq,
+		      const char *   type,
+		      const char *   path,
+		      const char *   status)
+{
+	UpstartClientInstance *instance;
+
+	nih_assert (client != NULL);
+	nih_assert (type != NULL);
+	nih_assert (path != NULL);
+
+	if (seq <= client->seq)
+		return;
+	client->seq = seq;
+
+	if (! strcmp (type, "status")) {
+		nih_local char *job = NULL;
+		nih_local char *name = NULL;
+		nih_local char *goal = NULL;
+		const char *    jobs;
+		const char *    sep;
+		const char *    state;
+
+		nih_assert (status != NULL);
+
+		state = strchr (status, '/');
+		if (! state)
+			return;
+		goal = nih_strndup (NULL, status, state - status);
+		if (! goal)
+			return;
+		state++;
+
+		if ((! strcmp (goal, "stop")) && (! strcmp (state, "waiting"))) {
+			instance = (UpstartClientInstance *)nih_hash_lookup (
+				client->instances, path);
+			if (instance)
+				upstart_client_remove (client, instance);
+			return;
+		}
+
+		/* Instance paths are DBUS_PATH_UPSTART/jobs/JOB/INSTANCE */
+		jobs = DBUS_PATH_UPSTART "/jobs/";
+		if (strncmp (path, jobs, strlen (jobs)))
+			return;
+
+		sep = strchr (path + strlen (jobs), '/');
+		if (! sep)
+			return;
+
+		job = upstart_client_path_element (NULL, path + strlen (jobs),
+						   sep - path - strlen (jobs));
+		name = upstart_client_path_element (NULL, sep + 1,
+						    strlen (sep + 1));
+		if ((! job) || (! name))
+			return;
+
+		upstart_client_update (client, path, job, name, goal, state);
+
+	} else if (! strcmp (type, "instance-removed")) {
+		instance = (UpstartClientInstance *)nih_hash_lookup (
+			client->instances, path);
+		if (instance)
+			upstart_client_remove (client, instance);
+
+	} else if (! strcmp (type, "job-removed")) {
+		size_t len = strlen (path);
+
+		NIH_HASH_FOREACH_SAFE (client->instances, iter) {
+			instance = (UpstartClientInstance *)iter;
+
+			if ((! strncmp (instance->path, path, len))
+			    && (instance->path[len] == '/'))
+				upstart_client_remove (client, instance);
+		}
+	}
+}
+
+/**
+ * upstart_client_update:
+ * @client: client to update,
+ * @path: object path of instance,
+ * @job: name of job,
+ * @name: name of instance,
+ * @goal: goal of instance,
+ * @state: state of instance.
+ *
+ * Adds the instance at @path to the mirror of @client, or updates its goal
+ * and state, calling the changed function if anything differs.
+ **/
+static void
+upstart_client_update (UpstartClient *client,
+		       const char *   path,
+		       const char *   job,
+		       const char *   name,
+		       const char *   goal,
+		       const char *   state)
+{
+	UpstartClientInstance *instance;
+	char *                 new_goal;
+	char *                 new_state;
+
+	nih_assert (client != NULL);
+	nih_assert (path != NULL);
+	nih_assert (job != NULL);
+	nih_assert (name != NULL);
+	nih_assert (goal != NULL);
+	nih_assert (state != NULL);
+
+	instance = (UpstartClientInstance *)nih_hash_lookup (client->instances,
+							      path);
+	if (instance) {
+		if ((! strcmp (instance->goal, goal))
+		    && (! strcmp (instance->state, state)))
+			return;
+	} else {
+		instance = nih_new (client, UpstartClientInstance);
+		if (! instance)
+			return;
+
+		nih_list_init (&instance->entry);
+		nih_alloc_set_destructor (instance, nih_list_destroy);
+
+		instance->path = nih_strdup (instance, path);
+		instance->job = nih_strdup (instance, job);
+		instance->name = nih_strdup (instance, name);
+		instance->goal = NULL;
+		instance->state = NULL;
+
+		if ((! instance->path) || (! instance->job)
+		    || (! instance->name)) {
+			nih_free (instance);
+			return;
+		}
+
+		nih_hash_add (client->instances, &instance->entry);
+	}
+
+	new_goal = nih_strdup (instance, goal);
+	new_state = nih_strdup (instance, state);
+	if ((! new_goal) || (! new_state)) {
+		if (new_goal)
+			nih_free (new_goal);
+		if (new_state)
+			nih_free (new_state);
+		if (! instance->goal)
+			nih_free (instance);
+		return;
+	}
+
+	if (instance->goal)
+		nih_unref (instance->goal, instance);
+	if (instance->state)
+		nih_unref (instance->state, instance);
+
+	instance->goal = new_goal;
+	instance->state = new_state;
+
+	if (client->changed)
+		client->changed (client->data, client, instance, FALSE);
+}
+
+/**
+ * upstart_client_remove:
+ * @client: client to update,
+ * @instance: instance to remove.
+ *
+ * Removes @instance from the mirror of @client, calling the changed
+ * function first.
+ **/
+static void
+upstart_client_remove (UpstartClient *        client,
+		       UpstartClientInstance *instance)
+{
+	nih_assert (client != NULL);
+	nih_assert (instance != NULL);
+
+	if (client->changed)
+		client->changed (client->data, client, instance, TRUE);
+
+	nih_free (instance);
+}
+
+/**
+ * upstart_client_path_element:
+ * @parent: parent object for new string,
+ * @str: escaped path element,
+ * @len: length of @str.
+ *
+ * Reverses the escaping applied by nih_dbus_path() to a single element
+ * of an object path.
+ *
+ * Returns: newly allocated string or NULL if insufficient memory.
+ **/
+static char *
+upstart_client_path_element (const void *parent,
+			     const char *str,
+			     size_t      len)
+{
+	char * element;
+	size_t i;
+	size_t j;
+
+	nih_assert (str != NULL);
+
+	/* An empty element is written as a single underscore */
+	if ((len == 1) && (str[0] == '_'))
+		return nih_strdup (parent, "");
+
+	element = nih_alloc (parent, len + 1);
+	if (! element)
+		return NULL;
+
+	for (i = 0, j = 0; i < len; i++) {
+		if ((str[i] == '_') && (i + 2 < len)) {
+			char hex[3] = { str[i + 1], str[i + 2], '\0' };
+
+			element[j++] = (char)strtoul (hex, NULL, 16);
+			i += 2;
+		} else {
+			element[j++] = str[i];
+		}
+	}
+	element[j] = '\0';
+
+	return element;
+}
+
+
+/**
+ * upstart_client_call_new:
+ * @client: client making the call,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Allocates a context for a call made through @client, tracked until
+ * the reply arrives or the client is freed.
+ *
+ * Returns: newly allocated call or NULL on raised error.
+ **/
+static UpstartClientCall *
+upstart_client_call_new (UpstartClient *    client,
+			 UpstartClientReply handler,
+			 void *             data)
+{
+	UpstartClientCall *call;
+
+	nih_assert (client != NULL);
+
+	call = nih_new (client, UpstartClientCall);
+	if (! call)
+		nih_return_no_memory_error (NULL);
+
+	nih_list_init (&call->entry);
+
+	call->client = client;
+	call->pending = NULL;
+	call->proxy = NULL;
+	call->full = FALSE;
+
+	call->handler = handler;
+	call->data = data;
+
+	nih_alloc_set_destructor (call, upstart_client_call_destroy);
+
+	nih_list_add (client->calls, &call->entry);
+
+	return call;
+}
+
+/**
+ * upstart_client_call_destroy:
+ * @call: call being destroyed.
+ *
+ * Cancels the pending call if the reply has not yet arrived.
+ *
+ * Returns: zero.
+ **/
+static int
+upstart_client_call_destroy (UpstartClientCall *call)
+{
+	nih_assert (call != NULL);
+
+	nih_list_destroy (&call->entry);
+
+	if (call->pending) {
+		dbus_pending_call_cancel (call->pending);
+		dbus_pending_call_unref (call->pending);
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_call_done:
+ * @call: call whose reply arrived.
+ *
+ * Frees @call once its reply has been received.
+ **/
+static void
+upstart_client_call_done (UpstartClientCall *call)
+{
+	nih_assert (call != NULL);
+
+	dbus_pending_call_unref (call->pending);
+	call->pending = NULL;
+
+	nih_free (call);
+}
+
+
+/**
+ * upstart_client_request:
+ * @client: client to make request through,
+ * @job: name of job,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Allocates a context for a request on @job, with a proxy for the job
+ * object.  Its path is derived from the name, so no round trip is needed
+ * to look it up first.
+ *
+ * Returns: newly allocated call or NULL on raised error.
+ **/
+static UpstartClientCall *
+upstart_client_request (UpstartClient *    client,
+			const char *       job,
+			UpstartClientReply handler,
+			void *             data)
+{
+	UpstartClientCall *call;
+	nih_local char *   path = NULL;
+
+	nih_assert (client != NULL);
+	nih_assert (job != NULL);
+
+	if (! client->connection) {
+		nih_dbus_error_raise (DBUS_ERROR_DISCONNECTED,
+				      "Not connected to Upstart");
+		return NULL;
+	}
+
+	call = upstart_client_call_new (client, handler, data);
+	if (! call)
+		return NULL;
+
+	path = nih_dbus_path (NULL, DBUS_PATH_UPSTART, "jobs", job, NULL);
+	if (! path) {
+		nih_free (call);
+		nih_return_no_memory_error (NULL);
+	}
+
+	call->proxy = nih_dbus_proxy_new (call, client->connection, NULL,
+					  path, NULL, NULL);
+	if (! call->proxy) {
+		nih_free (call);
+		return NULL;
+	}
+
+	return call;
+}
+
+/**
+ * upstart_client_start:
+ * @client: client to make request through,
+ * @job: name of job,
+ * @env: environment for the instance, or NULL,
+ * @wait: TRUE to reply once the instance is running,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Asks Upstart to start an instance of @job without waiting for the
+ * reply; any number of requests may be outstanding at once.  @handler
+ * is called with the path of the instance, or the error raised.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+upstart_client_start (UpstartClient *    client,
+		      const char *       job,
+		      char * const *     env,
+		      int                wait,
+		      UpstartClientReply handler,
+		      void *             data)
+{
+	char * const       no_env[] = { NULL };
+	UpstartClientCall *call;
+
+	call = upstart_client_request (client, job, handler, data);
+	if (! call)
+		return -1;
+
+	call->pending = job_class_start (
+		call->proxy, env ? env : no_env, wait,
+		(JobClassStartReply)upstart_client_instance_reply,
+		(NihDBusErrorHandler)upstart_client_reply_error,
+		call, NIH_DBUS_TIMEOUT_NEVER);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_stop:
+ * @client: client to make request through,
+ * @job: name of job,
+ * @env: environment to select the instance, or NULL,
+ * @wait: TRUE to reply once the instance has stopped,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Asks Upstart to stop an instance of @job without waiting for the
+ * reply; @handler is called with the error raised, if any.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+upstart_client_stop (UpstartClient *    client,
+		     const char *       job,
+		     char * const *     env,
+		     int                wait,
+		     UpstartClientReply handler,
+		     void *             data)
+{
+	char * const       no_env[] = { NULL };
+	UpstartClientCall *call;
+
+	call = upstart_client_request (client, job, handler, data);
+	if (! call)
+		return -1;
+
+	call->pending = job_class_stop (
+		call->proxy, env ? env : no_env, wait,
+		(JobClassStopReply)upstart_client_reply,
+		(NihDBusErrorHandler)upstart_client_reply_error,
+		call, NIH_DBUS_TIMEOUT_NEVER);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_restart:
+ * @client: client to make request through,
+ * @job: name of job,
+ * @env: environment for the instance, or NULL,
+ * @wait: TRUE to reply once the instance is running again,
+ * @handler: function to call with the reply, or NULL,
+ * @data: pointer to pass to @handler.
+ *
+ * Asks Upstart to restart an instance of @job without waiting for the
+ * reply; @handler is called with the path of the instance, or the error
+ * raised.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+upstart_client_restart (UpstartClient *    client,
+			const char *       job,
+			char * const *     env,
+			int                wait,
+			UpstartClientReply handler,
+			void *             data)
+{
+	char * const       no_env[] = { NULL };
+	UpstartClientCall *call;
+
+	call = upstart_client_request (client, job, handler, data);
+	if (! call)
+		return -1;
+
+	call->pending = job_class_restart (
+		call->proxy, env ? env : no_env, wait,
+		(JobClassRestartReply)upstart_client_instance_reply,
+		(NihDBusErrorHandler)upstart_client_reply_error,
+		call, NIH_DBUS_TIMEOUT_NEVER);
+	if (! call->pending) {
+		nih_free (call);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * upstart_client_instance_reply:
+ * @call: call context,
+ * @message: D-Bus message received,
+ * @instance: object path of instance.
+ *
+ * Reply to a start or restart request.
+ **/
+static void
+upstart_client_instance_reply (UpstartClientCall *call,
+			       NihDBusMessage *   message,
+			       const char *       instance)
+{
+	nih_assert (call != NULL);
+
+	if (call->handler)
+		call->handler (call->data, call->client, instance, NULL);
+
+	upstart_client_call_done (call);
+}
+
+/**
+ * upstart_client_reply:
+ * @call: call context,
+ * @message: D-Bus message received.
+ *
+ * Reply to a stop request.
+ **/
+static void
+upstart_client_reply (UpstartClientCall *call,
+		      NihDBusMessage *   message)
+{
+	nih_assert (call != NULL);
+
+	if (call->handler)
+		call->handler (call->data, call->client, NULL, NULL);
+
+	upstart_client_call_done (call);
+}
+
+/**
+ * upstart_client_reply_error:
+ * @call: call context,
+ * @message: D-Bus message received.
+ *
+ * Error reply to a request, passed on to its handler.
+ **/
+static void
+upstart_client_reply_error (UpstartClientCall *call,
+			    NihDBusMessage *   message)
+{
+	NihError *err;
+
+	nih_assert (call != NULL);
+
+	err = nih_error_get ();
+
+	if (call->handler)
+		call->handler (call->data, call->client, NULL, err);
+
+	nih_free (err);
+	upstart_client_call_done (call);
+}
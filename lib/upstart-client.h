@@ -0,0 +1,191 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef LIB_UPSTART_CLIENT_H
+#define LIB_UPSTART_CLIENT_H
+
+#include <dbus/dbus.h>
+
+#include <stdint.h>
+
+#include <nih/macros.h>
+#include <nih/list.h>
+#include <nih/hash.h>
+#include <nih/timer.h>
+#include <nih/error.h>
+
+#include <nih-dbus/dbus_proxy.h>
+
+
+/**
+ * UPSTART_CLIENT_RECONNECT_MIN:
+ *
+ * Seconds to wait before reconnecting after the connection to Upstart is
+ * lost; doubled after each failed attempt.
+ **/
+#define UPSTART_CLIENT_RECONNECT_MIN 1
+
+/**
+ * UPSTART_CLIENT_RECONNECT_MAX:
+ *
+ * Longest time in seconds to wait between attempts to reconnect.
+ **/
+#define UPSTART_CLIENT_RECONNECT_MAX 30
+
+
+/* Predefine the typedefs as we use them in the callbacks */
+typedef struct upstart_client UpstartClient;
+typedef struct upstart_client_instance UpstartClientInstance;
+
+/**
+ * UpstartClientChanged:
+ * @data: data pointer given when the client was created,
+ * @client: client whose mirror changed,
+ * @instance: instance that changed,
+ * @removed: TRUE if @instance is about to be removed from the mirror.
+ *
+ * Called whenever an instance in the mirror of @client is added, changes
+ * goal or state, or is removed.  @instance may not be kept beyond the
+ * call when @removed is TRUE.
+ **/
+typedef void (*UpstartClientChanged) (void *data, UpstartClient *client,
+				      const UpstartClientInstance *instance,
+				      int removed);
+
+/**
+ * UpstartClientReply:
+ * @data: data pointer given with the request,
+ * @client: client the request was made through,
+ * @instance: object path of the instance for a start or restart request,
+ * or NULL,
+ * @error: error raised by Upstart, or NULL on success.
+ *
+ * Called when a request made with upstart_client_start(),
+ * upstart_client_stop() or upstart_client_restart() completes.  @error
+ * is freed on return; @client may not be freed by the handler.
+ **/
+typedef void (*UpstartClientReply) (void *data, UpstartClient *client,
+				    const char *instance, NihError *error);
+
+/**
+ * UpstartClientInstance:
+ * @entry: hash list header,
+ * @path: D-Bus object path of instance,
+ * @job: name of job,
+ * @name: name of instance, empty for jobs without an instance stanza,
+ * @goal: goal of instance,
+ * @state: state of instance.
+ *
+ * An entry in the local mirror of a client, giving the latest known goal
+ * and state of an instance.  Instances that are stopped and waiting are
+ * not kept, so a job without an entry is stopped.
+ **/
+struct upstart_client_instance {
+	NihList  entry;
+	char    *path;
+
+	char    *job;
+	char    *name;
+
+	char    *goal;
+	char    *state;
+};
+
+/**
+ * UpstartClient:
+ * @entry: list header,
+ * @address: D-Bus address of Upstart,
+ * @connection: connection to Upstart, or NULL while disconnected,
+ * @upstart: proxy for the Upstart manager object, or NULL,
+ * @instances: local mirror of instances, indexed by object path,
+ * @seq: sequence number of the last change applied to @instances,
+ * @subscribed: sequence number given when last subscribing to changes,
+ * @synced: TRUE once @instances reflects the state of Upstart,
+ * @calls: requests waiting for a reply,
+ * @reconnect_timer: timer to reconnect after the connection is lost,
+ * @reconnect_delay: seconds to wait before the next attempt to reconnect,
+ * @changed: function called when the mirror changes,
+ * @data: pointer passed to @changed.
+ *
+ * A client keeps a connection to Upstart, reconnecting when it is lost,
+ * and a mirror of the goal and state of every instance that is kept up
+ * to date from the change feed.  Clients may read @instances, or use
+ * upstart_client_lookup(), rather than asking Upstart.
+ *
+ * After reconnecting, only the changes missed are asked for; the mirror
+ * is loaded again in full, with a single GetAllJobStatus call, only when
+ * Upstart no longer has them.
+ **/
+struct upstart_client {
+	NihList           entry;
+	char             *address;
+	DBusConnection   *connection;
+	NihDBusProxy     *upstart;
+
+	NihHash          *instances;
+	uint64_t          seq;
+	uint64_t          subscribed;
+	int               synced;
+
+	NihList          *calls;
+
+	NihTimer         *reconnect_timer;
+	int               reconnect_delay;
+
+	UpstartClientChanged changed;
+	void             *data;
+};
+
+
+NIH_BEGIN_EXTERN
+
+UpstartClient *        upstart_client_new     (const void *parent,
+					       const char *address,
+					       UpstartClientChanged changed,
+					       void *data)
+	__attribute__ ((warn_unused_result));
+
+int                    upstart_client_connect (UpstartClient *client)
+	__attribute__ ((warn_unused_result));
+
+UpstartClientInstance *upstart_client_lookup  (UpstartClient *client,
+					       const char *job,
+					       const char *name);
+
+int                    upstart_client_start   (UpstartClient *client,
+					       const char *job,
+					       char * const *env, int wait,
+					       UpstartClientReply handler,
+					       void *data)
+	__attribute__ ((warn_unused_result));
+int                    upstart_client_stop    (UpstartClient *client,
+					       const char *job,
+					       char * const *env, int wait,
+					       UpstartClientReply handler,
+					       void *data)
+	__attribute__ ((warn_unused_result));
+int                    upstart_client_restart (UpstartClient *client,
+					       const char *job,
+					       char * const *env, int wait,
+					       UpstartClientReply handler,
+					       void *data)
+	__attribute__ ((warn_unused_result));
+
+NIH_END_EXTERN
+
+#endif /* LIB_UPSTART_CLIENT_H */
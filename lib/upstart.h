@@ -29,6 +29,8 @@ NIH_BEGIN_EXTERN
 #include "upstart/com.ubuntu.Upstart.Instance.h"
 #include "upstart/com.ubuntu.Upstart.Job.h"
 
+#include "upstart-client.h"
+
 NIH_END_EXTERN
 
 #endif /* LIB_UPSTART_H */
@@ -0,0 +1,1156 @@
+/* upstart
+ *
+ * bench_sessions.c - stress benchmark of Session Inits and chroot sessions
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <dbus/dbus.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/signal.h>
+#include <nih/logging.h>
+
+#include "dbus/upstart.h"
+
+#include "test_util_common.h"
+
+
+/**
+ * BENCH_SESSIONS:
+ *
+ * Number of Session Inits and of chroot sessions started when not given
+ * on the command-line.
+ **/
+#define BENCH_SESSIONS 200
+
+/**
+ * BENCH_EVENTS:
+ *
+ * Number of rounds of events emitted into each session when not given on
+ * the command-line.
+ **/
+#define BENCH_EVENTS 50
+
+/**
+ * BENCH_INSTANCES:
+ *
+ * Number of distinct instances of the service job started by the
+ * events of each session.
+ **/
+#define BENCH_INSTANCES 8
+
+/**
+ * BENCH_JOBS:
+ *
+ * Number of job classes written for each session; a session is ready
+ * once all of them are visible over D-Bus.
+ **/
+#define BENCH_JOBS 2
+
+/**
+ * BENCH_CALL_TIMEOUT:
+ *
+ * Milliseconds to wait for the reply to each D-Bus method call.
+ **/
+#define BENCH_CALL_TIMEOUT 10000
+
+/**
+ * BENCH_READY_TIMEOUT:
+ *
+ * Seconds to wait for all sessions to become ready before those that
+ * have not are counted as failed.
+ **/
+#define BENCH_READY_TIMEOUT 60
+
+/**
+ * BENCH_POLL_INTERVAL:
+ *
+ * Microseconds to sleep between polls of sessions that are not yet
+ * ready or not yet quiesced.
+ **/
+#define BENCH_POLL_INTERVAL 1000
+
+
+/**
+ * BenchSession:
+ * @pid: process id of Session Init, or of client in chroot,
+ * @started: monotonic time in microseconds the session was started,
+ * @conn: private D-Bus connection to Session Init,
+ * @ready: microseconds from start until the session's jobs were visible,
+ * @churn: microseconds taken to emit the session's events,
+ * @rss_ready: resident set size in kB once ready,
+ * @rss: resident set size in kB after the events,
+ * @ended: monotonic time in microseconds the session was ended,
+ * @quiesce: microseconds from end until the Session Init exited,
+ * @failed: TRUE if the session did not complete.
+ *
+ * Measurements of a single session.
+ **/
+typedef struct bench_session {
+	pid_t           pid;
+	uint64_t        started;
+	DBusConnection *conn;
+	uint64_t        ready;
+	uint64_t        churn;
+	uint64_t        rss_ready;
+	uint64_t        rss;
+	uint64_t        ended;
+	uint64_t        quiesce;
+	int             failed;
+} BenchSession;
+
+/**
+ * BenchChrootResult:
+ * @ready: microseconds from start until the session's jobs were visible,
+ * @churn: microseconds taken to emit the session's events,
+ * @failed: TRUE if the session did not complete.
+ *
+ * Measurements written back by the client in each chroot.
+ **/
+typedef struct bench_chroot_result {
+	uint64_t ready;
+	uint64_t churn;
+	int      failed;
+} BenchChrootResult;
+
+/**
+ * BenchSystem:
+ * @pid: process id of the init serving the sessions,
+ * @started: monotonic time in microseconds the phase began,
+ * @cpu: user and system CPU microseconds used by @pid when the phase
+ * began,
+ * @rss: resident set size in kB of @pid when the phase began.
+ *
+ * Baseline of the init daemon that is not itself a session, so that the
+ * cost of the sessions to it can be reported.
+ **/
+typedef struct bench_system {
+	pid_t    pid;
+	uint64_t started;
+	uint64_t cpu;
+	uint64_t rss;
+} BenchSystem;
+
+
+/**
+ * bench_now:
+ *
+ * Returns: monotonic time in microseconds.
+ **/
+static uint64_t
+bench_now (void)
+{
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * bench_rss:
+ * @pid: process to examine.
+ *
+ * Returns: resident set size of @pid in kB, or zero if unknown.
+ **/
+static uint64_t
+bench_rss (pid_t pid)
+{
+	char                path[64];
+	char                line[256];
+	unsigned long long  rss = 0;
+	FILE               *f;
+
+	snprintf (path, sizeof (path), "/proc/%d/status", (int)pid);
+
+	f = fopen (path, "re");
+	if (! f)
+		return 0;
+
+	while (fgets (line, sizeof (line), f)) {
+		if (sscanf (line, "VmRSS: %llu kB", &rss) == 1)
+			break;
+	}
+
+	fclose (f);
+
+	return rss;
+}
+
+/**
+ * bench_cpu:
+ * @pid: process to examine.
+ *
+ * Returns: user and system CPU time used by @pid in microseconds, or
+ * zero if unknown.
+ **/
+static uint64_t
+bench_cpu (pid_t pid)
+{
+	char           path[64];
+	char           buf[1024];
+	char          *p;
+	unsigned long  utime;
+	unsigned long  stime;
+	long           ticks;
+	FILE          *f;
+
+	snprintf (path, sizeof (path), "/proc/%d/stat", (int)pid);
+
+	f = fopen (path, "re");
+	if (! f)
+		return 0;
+
+	p = fgets (buf, sizeof (buf), f);
+	fclose (f);
+
+	/* The command name may itself contain spaces and parentheses */
+	if (! p || ! (p = strrchr (buf, ')')))
+		return 0;
+
+	if (sscanf (p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		    &utime, &stime) != 2)
+		return 0;
+
+	ticks = sysconf (_SC_CLK_TCK);
+	if (ticks <= 0)
+		return 0;
+
+	return (uint64_t)(utime + stime) * 1000000 / ticks;
+}
+
+/**
+ * bench_system_start:
+ * @sysinit: baseline to fill in,
+ * @pid: process id of init.
+ *
+ * Record the time, CPU and RSS of @pid at the start of a phase.
+ **/
+static void
+bench_system_start (BenchSystem *sysinit,
+		    pid_t        pid)
+{
+	nih_assert (sysinit != NULL);
+
+	sysinit->pid = pid;
+	sysinit->started = bench_now ();
+	sysinit->cpu = bench_cpu (pid);
+	sysinit->rss = bench_rss (pid);
+}
+
+/**
+ * bench_write_conf:
+ * @dir: directory to write job into,
+ * @name: name of job,
+ * @contents: job configuration.
+ *
+ * Write a job configuration file for @name into @dir.
+ **/
+static void
+bench_write_conf (const char *dir,
+		  const char *name,
+		  const char *contents)
+{
+	nih_local char *path = NULL;
+	FILE           *f;
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/%s.conf", dir, name));
+
+	f = fopen (path, "w");
+	TEST_NE_P (f, NULL);
+	fputs (contents, f);
+	TEST_EQ (fclose (f), 0);
+}
+
+/**
+ * bench_write_jobs:
+ * @dir: directory to write jobs into,
+ * @processes: TRUE if jobs may run processes.
+ *
+ * Write the jobs of a session into @dir: an instance service started
+ * and stopped by the bench-up and bench-down events, and a task run on
+ * every bench-churn event.  The service has no process so that its
+ * churn is all state changes and events; the task runs one when
+ * @processes is TRUE, which it cannot be for a chroot without binaries.
+ **/
+static void
+bench_write_jobs (const char *dir,
+		  int         processes)
+{
+	nih_assert (dir != NULL);
+
+	bench_write_conf (dir, "bench-service",
+			  "instance $N\n"
+			  "start on bench-up\n"
+			  "stop on bench-down N=$N\n");
+
+	bench_write_conf (dir, "bench-task",
+			  (processes
+			   ? "start on bench-churn\n"
+			     "task\n"
+			     "exec true\n"
+			   : "start on bench-churn\n"
+			     "task\n"));
+}
+
+/**
+ * bench_connect:
+ * @address: D-Bus address to connect to,
+ * @bus: TRUE if @address is that of a message bus.
+ *
+ * Open a private connection to @address without any main loop, since
+ * the benchmark only makes blocking calls.
+ *
+ * Returns: new connection or NULL.
+ **/
+static DBusConnection *
+bench_connect (const char *address,
+	       int         bus)
+{
+	DBusConnection *conn;
+	DBusError       error;
+
+	nih_assert (address != NULL);
+
+	dbus_error_init (&error);
+
+	conn = dbus_connection_open_private (address, &error);
+	if (! conn) {
+		dbus_error_free (&error);
+		return NULL;
+	}
+
+	dbus_connection_set_exit_on_disconnect (conn, FALSE);
+
+	if (bus && ! dbus_bus_register (conn, &error)) {
+		dbus_error_free (&error);
+		dbus_connection_close (conn);
+		dbus_connection_unref (conn);
+		return NULL;
+	}
+
+	return conn;
+}
+
+/**
+ * bench_disconnect:
+ * @conn: connection to close.
+ **/
+static void
+bench_disconnect (DBusConnection *conn)
+{
+	nih_assert (conn != NULL);
+
+	dbus_connection_close (conn);
+	dbus_connection_unref (conn);
+}
+
+/**
+ * bench_call:
+ * @conn: connection to init,
+ * @destination: bus name of init, or NULL for a direct connection,
+ * @method: name of method to call,
+ * @first_arg_type: type of first argument, followed by arguments as
+ * for dbus_message_append_args().
+ *
+ * Call @method of the com.ubuntu.Upstart interface and wait for the
+ * reply.
+ *
+ * Returns: reply, or NULL on error.
+ **/
+static DBusMessage *
+bench_call (DBusConnection *conn,
+	    const char     *destination,
+	    const char     *method,
+	    int             first_arg_type,
+	    ...)
+{
+	DBusMessage *message;
+	DBusMessage *reply;
+	DBusError    error;
+	va_list      args;
+
+	nih_assert (conn != NULL);
+	nih_assert (method != NULL);
+
+	message = dbus_message_new_method_call (destination,
+						DBUS_PATH_UPSTART,
+						DBUS_INTERFACE_UPSTART,
+						method);
+	if (! message)
+		return NULL;
+
+	va_start (args, first_arg_type);
+	if (! dbus_message_append_args_valist (message, first_arg_type,
+					       args)) {
+		va_end (args);
+		dbus_message_unref (message);
+		return NULL;
+	}
+	va_end (args);
+
+	dbus_error_init (&error);
+
+	reply = dbus_connection_send_with_reply_and_block (
+		conn, message, BENCH_CALL_TIMEOUT, &error);
+	dbus_message_unref (message);
+
+	if (! reply)
+		dbus_error_free (&error);
+
+	return reply;
+}
+
+/**
+ * bench_jobs:
+ * @conn: connection to init,
+ * @destination: bus name of init, or NULL for a direct connection.
+ *
+ * Returns: number of job classes visible to the caller, or -1 on error.
+ **/
+static int
+bench_jobs (DBusConnection *conn,
+	    const char     *destination)
+{
+	DBusMessage  *reply;
+	char        **paths = NULL;
+	int           num_paths = 0;
+
+	reply = bench_call (conn, destination, "GetAllJobs",
+			    DBUS_TYPE_INVALID);
+	if (! reply)
+		return -1;
+
+	if (! dbus_message_get_args (reply, NULL,
+				     DBUS_TYPE_ARRAY, DBUS_TYPE_OBJECT_PATH,
+				     &paths, &num_paths,
+				     DBUS_TYPE_INVALID)) {
+		dbus_message_unref (reply);
+		return -1;
+	}
+
+	dbus_free_string_array (paths);
+	dbus_message_unref (reply);
+
+	return num_paths;
+}
+
+/**
+ * bench_emit:
+ * @conn: connection to init,
+ * @destination: bus name of init, or NULL for a direct connection,
+ * @name: name of event,
+ * @env: single environment variable for event, or NULL.
+ *
+ * Emit @name without waiting for it to finish.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+bench_emit (DBusConnection *conn,
+	    const char     *destination,
+	    const char     *name,
+	    const char     *env)
+{
+	DBusMessage  *reply;
+	const char   *env_array[1] = { env };
+	const char  **env_ptr = env_array;
+	dbus_bool_t   wait = FALSE;
+
+	nih_assert (name != NULL);
+
+	reply = bench_call (conn, destination, "EmitEvent",
+			    DBUS_TYPE_STRING, &name,
+			    DBUS_TYPE_ARRAY, DBUS_TYPE_STRING,
+			    &env_ptr, env ? 1 : 0,
+			    DBUS_TYPE_BOOLEAN, &wait,
+			    DBUS_TYPE_INVALID);
+	if (! reply)
+		return -1;
+
+	dbus_message_unref (reply);
+
+	return 0;
+}
+
+/**
+ * bench_churn:
+ * @conn: connection to init,
+ * @destination: bus name of init, or NULL for a direct connection,
+ * @num_events: number of rounds of events.
+ *
+ * Drive a session with @num_events rounds of events, each starting an
+ * instance of the service, running the task, and stopping an instance.
+ *
+ * Returns: microseconds taken (at least one), or zero on error.
+ **/
+static uint64_t
+bench_churn (DBusConnection *conn,
+	     const char     *destination,
+	     size_t          num_events)
+{
+	uint64_t started;
+
+	started = bench_now ();
+
+	for (size_t i = 0; i < num_events; i++) {
+		char env[32];
+
+		snprintf (env, sizeof (env), "N=%zu", i % BENCH_INSTANCES);
+
+		if ((bench_emit (conn, destination, "bench-up", env) < 0)
+		    || (bench_emit (conn, destination, "bench-churn", NULL) < 0)
+		    || (bench_emit (conn, destination, "bench-down", env) < 0))
+			return 0;
+	}
+
+	/* Wait for the final events to be queued before returning */
+	if (bench_jobs (conn, destination) < 0)
+		return 0;
+
+	return bench_now () - started + 1;
+}
+
+/**
+ * bench_session_address:
+ * @pid: process id of Session Init.
+ *
+ * Read the address of the Session Init from its session file.
+ *
+ * Returns: newly allocated address, or NULL if not yet written.
+ **/
+static char *
+bench_session_address (pid_t pid)
+{
+	nih_local char *path = NULL;
+	char            line[PATH_MAX];
+	char           *address = NULL;
+	FILE           *f;
+
+	path = get_session_file (getenv ("XDG_RUNTIME_DIR"), pid);
+
+	f = fopen (path, "re");
+	if (! f)
+		return NULL;
+
+	if (fgets (line, sizeof (line), f)
+	    && ! strncmp (line, "UPSTART_SESSION=", 16)
+	    && strchr (line, '\n')) {
+		line[strcspn (line, "\n")] = '\0';
+		address = NIH_MUST (nih_strdup (NULL, line + 16));
+	}
+
+	fclose (f);
+
+	return address;
+}
+
+/**
+ * bench_spawn:
+ * @args: arguments to init.
+ *
+ * Start init with @args without waiting for it to become ready.
+ *
+ * Returns: process id of init.
+ **/
+static pid_t
+bench_spawn (char * const *args)
+{
+	nih_local char **argv = NULL;
+	pid_t            pid;
+
+	argv = NIH_MUST (nih_str_array_new (NULL));
+	NIH_MUST (nih_str_array_add (&argv, NULL, NULL,
+				     get_upstart_binary ()));
+	NIH_MUST (nih_str_array_append (&argv, NULL, NULL, args));
+
+	TEST_NE (pid = fork (), -1);
+
+	if (! pid) {
+		int fd;
+
+		nih_signal_reset ();
+
+		if (! getenv ("UPSTART_TEST_VERBOSE")) {
+			fd = open ("/dev/null", O_RDWR);
+			assert (fd >= 0);
+			assert (dup2 (fd, STDIN_FILENO) != -1);
+			assert (dup2 (fd, STDOUT_FILENO) != -1);
+			assert (dup2 (fd, STDERR_FILENO) != -1);
+		}
+
+		execvp (argv[0], argv);
+		_exit (255);
+	}
+
+	return pid;
+}
+
+/**
+ * bench_compar:
+ *
+ * Compare two uint64_t values for qsort().
+ **/
+static int
+bench_compar (const void *a,
+	      const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * bench_print_dist:
+ * @key: name of measurement,
+ * @values: values measured,
+ * @num_values: number of entries in @values.
+ *
+ * Output the 50th and 95th percentile and maximum of @values as a JSON
+ * object member; @values is sorted in place.
+ **/
+static void
+bench_print_dist (const char *key,
+		  uint64_t   *values,
+		  size_t      num_values)
+{
+	nih_assert (key != NULL);
+
+	if (! num_values) {
+		printf (",\"%s\":null", key);
+		return;
+	}
+
+	qsort (values, num_values, sizeof (uint64_t), bench_compar);
+
+	printf (",\"%s\":{\"p50\":%llu,\"p95\":%llu,\"max\":%llu}", key,
+		(unsigned long long)values[(num_values - 1) * 50 / 100],
+		(unsigned long long)values[(num_values - 1) * 95 / 100],
+		(unsigned long long)values[num_values - 1]);
+}
+
+/**
+ * bench_print_phase:
+ * @phase: name of phase,
+ * @sessions: sessions measured,
+ * @num_sessions: number of entries in @sessions,
+ * @num_events: number of rounds of events per session,
+ * @sysinit: baseline of init that is not a session.
+ *
+ * Output a JSON object summarising @phase: the number of sessions that
+ * failed, the distribution of each per-session measurement, and the
+ * CPU and RSS cost to the init described by @sysinit.
+ **/
+static void
+bench_print_phase (const char         *phase,
+		   const BenchSession *sessions,
+		   size_t              num_sessions,
+		   size_t              num_events,
+		   const BenchSystem  *sysinit)
+{
+	nih_local uint64_t *ready = NULL;
+	nih_local uint64_t *churn = NULL;
+	nih_local uint64_t *rss = NULL;
+	nih_local uint64_t *quiesce = NULL;
+	size_t              num_ready = 0;
+	size_t              num_churn = 0;
+	size_t              num_rss = 0;
+	size_t              num_quiesce = 0;
+	size_t              failed = 0;
+	uint64_t            cpu;
+	uint64_t            system_rss;
+
+	nih_assert (phase != NULL);
+	nih_assert (sysinit != NULL);
+
+	ready = NIH_MUST (nih_alloc (NULL, sizeof (uint64_t) * (num_sessions + 1)));
+	churn = NIH_MUST (nih_alloc (NULL, sizeof (uint64_t) * (num_sessions + 1)));
+	rss = NIH_MUST (nih_alloc (NULL, sizeof (uint64_t) * (num_sessions + 1)));
+	quiesce = NIH_MUST (nih_alloc (NULL, sizeof (uint64_t) * (num_sessions + 1)));
+
+	for (size_t i = 0; i < num_sessions; i++) {
+		if (sessions[i].failed)
+			failed++;
+		if (sessions[i].ready)
+			ready[num_ready++] = sessions[i].ready;
+		if (sessions[i].churn)
+			churn[num_churn++] = sessions[i].churn;
+		if (sessions[i].rss)
+			rss[num_rss++] = sessions[i].rss;
+		if (sessions[i].quiesce)
+			quiesce[num_quiesce++] = sessions[i].quiesce;
+	}
+
+	cpu = bench_cpu (sysinit->pid);
+	system_rss = bench_rss (sysinit->pid);
+
+	printf ("{\"phase\":\"%s\",\"sessions\":%zu,\"events\":%zu,"
+		"\"failed\":%zu,\"elapsed_usec\":%llu",
+		phase, num_sessions, num_events, failed,
+		(unsigned long long)(bench_now () - sysinit->started));
+
+	bench_print_dist ("ready_usec", ready, num_ready);
+	bench_print_dist ("churn_usec", churn, num_churn);
+	bench_print_dist ("rss_kb", rss, num_rss);
+	bench_print_dist ("quiesce_usec", quiesce, num_quiesce);
+
+	printf (",\"system_pid\":%d,\"system_cpu_usec\":%llu,"
+		"\"system_rss_kb\":%llu,\"system_rss_delta_kb\":%lld}\n",
+		(int)sysinit->pid,
+		(unsigned long long)(cpu > sysinit->cpu ? cpu - sysinit->cpu : 0),
+		(unsigned long long)system_rss,
+		(long long)system_rss - (long long)sysinit->rss);
+}
+
+/**
+ * bench_print_session:
+ * @phase: name of phase,
+ * @index: index of session,
+ * @session: session measured.
+ *
+ * Output a JSON object of the measurements of a single session.
+ **/
+static void
+bench_print_session (const char         *phase,
+		     size_t              index,
+		     const BenchSession *session)
+{
+	nih_assert (phase != NULL);
+	nih_assert (session != NULL);
+
+	printf ("{\"phase\":\"%s\",\"session\":%zu,\"pid\":%d,"
+		"\"failed\":%s,\"ready_usec\":%llu,\"churn_usec\":%llu,"
+		"\"rss_ready_kb\":%llu,\"rss_kb\":%llu,\"quiesce_usec\":%llu}\n",
+		phase, index, (int)session->pid,
+		session->failed ? "true" : "false",
+		(unsigned long long)session->ready,
+		(unsigned long long)session->churn,
+		(unsigned long long)session->rss_ready,
+		(unsigned long long)session->rss,
+		(unsigned long long)session->quiesce);
+}
+
+/**
+ * bench_user_sessions:
+ * @num_sessions: number of Session Inits to start,
+ * @num_events: number of rounds of events per session,
+ * @verbose: TRUE to output each session as well as the summary.
+ *
+ * Start @num_sessions Session Inits together, as at a login storm, and
+ * measure the time until each has loaded its jobs and answers on its
+ * private D-Bus socket.  Drive each with @num_events rounds of events,
+ * measuring its RSS before and after, then end every session and
+ * measure the time until each Session Init has exited.  The CPU used by
+ * PID 1 meanwhile is reported as the cost to the system init.
+ **/
+static void
+bench_user_sessions (size_t num_sessions,
+		     size_t num_events,
+		     int    verbose)
+{
+	nih_local BenchSession  *sessions = NULL;
+	nih_local char         **args = NULL;
+	nih_local char          *cmd = NULL;
+	char                     confdir[PATH_MAX];
+	BenchSystem              sysinit;
+	size_t                   pending;
+	uint64_t                 deadline;
+
+	TEST_FILENAME (confdir);
+	TEST_EQ (mkdir (confdir, TEST_DIR_MODE), 0);
+	bench_write_jobs (confdir, TRUE);
+
+	args = NIH_MUST (nih_str_array_new (NULL));
+	NIH_MUST (nih_str_array_add (&args, NULL, NULL, "--user"));
+	NIH_MUST (nih_str_array_add (&args, NULL, NULL, "--no-inherit-env"));
+	NIH_MUST (nih_str_array_add (&args, NULL, NULL, "--no-log"));
+	NIH_MUST (nih_str_array_add (&args, NULL, NULL, "--confdir"));
+	NIH_MUST (nih_str_array_add (&args, NULL, NULL, confdir));
+
+	sessions = NIH_MUST (nih_alloc (NULL, sizeof (BenchSession)
+					* (num_sessions + 1)));
+	memset (sessions, 0, sizeof (BenchSession) * (num_sessions + 1));
+
+	bench_system_start (&sysinit, 1);
+
+	/* Log in */
+	for (size_t i = 0; i < num_sessions; i++) {
+		sessions[i].started = bench_now ();
+		sessions[i].pid = bench_spawn (args);
+	}
+
+	pending = num_sessions;
+	deadline = bench_now () + BENCH_READY_TIMEOUT * 1000000ULL;
+
+	while (pending && (bench_now () < deadline)) {
+		for (size_t i = 0; i < num_sessions; i++) {
+			BenchSession   *session = &sessions[i];
+			nih_local char *address = NULL;
+
+			if (session->ready)
+				continue;
+
+			if (! session->conn) {
+				address = bench_session_address (session->pid);
+				if (! address)
+					continue;
+
+				session->conn = bench_connect (address, FALSE);
+				if (! session->conn)
+					continue;
+			}
+
+			if (bench_jobs (session->conn, NULL) < BENCH_JOBS)
+				continue;
+
+			session->ready = bench_now () - session->started;
+			session->rss_ready = bench_rss (session->pid);
+			pending--;
+		}
+
+		if (pending)
+			usleep (BENCH_POLL_INTERVAL);
+	}
+
+	/* Churn */
+	for (size_t i = 0; i < num_sessions; i++) {
+		BenchSession *session = &sessions[i];
+
+		if (! session->ready) {
+			session->failed = TRUE;
+			continue;
+		}
+
+		session->churn = bench_churn (session->conn, NULL, num_events);
+		if (! session->churn)
+			session->failed = TRUE;
+
+		session->rss = bench_rss (session->pid);
+	}
+
+	/* Log out */
+	for (size_t i = 0; i < num_sessions; i++) {
+		BenchSession *session = &sessions[i];
+		DBusMessage  *reply = NULL;
+
+		session->ended = bench_now ();
+
+		if (session->conn) {
+			reply = bench_call (session->conn, NULL, "EndSession",
+					    DBUS_TYPE_INVALID);
+			bench_disconnect (session->conn);
+			session->conn = NULL;
+		}
+
+		if (reply) {
+			dbus_message_unref (reply);
+		} else {
+			kill (session->pid, SIGTERM);
+			session->failed = TRUE;
+		}
+	}
+
+	pending = num_sessions;
+	deadline = bench_now () + TEST_QUIESCE_TOTAL_WAIT_TIME * 2000000ULL;
+
+	while (pending && (bench_now () < deadline)) {
+		for (size_t i = 0; i < num_sessions; i++) {
+			BenchSession *session = &sessions[i];
+
+			if (! session->pid)
+				continue;
+
+			if (waitpid (session->pid, NULL, WNOHANG) != session->pid)
+				continue;
+
+			session->quiesce = bench_now () - session->ended + 1;
+			session->pid = 0;
+			pending--;
+		}
+
+		if (pending)
+			usleep (BENCH_POLL_INTERVAL);
+	}
+
+	for (size_t i = 0; i < num_sessions; i++) {
+		BenchSession *session = &sessions[i];
+
+		if (! session->pid)
+			continue;
+
+		kill (session->pid, SIGKILL);
+		waitpid (session->pid, NULL, 0);
+		session->failed = TRUE;
+	}
+
+	if (verbose) {
+		for (size_t i = 0; i < num_sessions; i++)
+			bench_print_session ("user", i, &sessions[i]);
+	}
+
+	bench_print_phase ("user", sessions, num_sessions, num_events,
+			   &sysinit);
+
+	cmd = NIH_MUST (nih_sprintf (NULL, "rm -rf %s", confdir));
+	assert0 (system (cmd));
+}
+
+/**
+ * bench_chroot_client:
+ * @root: chroot of session,
+ * @started: monotonic time in microseconds the session was started,
+ * @num_events: number of rounds of events,
+ * @fd: file descriptor to write result to.
+ *
+ * Enter @root and measure the time until the init serving chroot
+ * sessions shows the jobs of the session in @root, then drive it with
+ * @num_events rounds of events.  Called in a child process, which exits
+ * once the result has been written to @fd.
+ **/
+static void
+bench_chroot_client (const char *root,
+		     uint64_t    started,
+		     size_t      num_events,
+		     int         fd)
+{
+	BenchChrootResult  result;
+	DBusConnection    *conn = NULL;
+	const char        *address;
+	uint64_t           deadline;
+
+	nih_assert (root != NULL);
+
+	memset (&result, 0, sizeof (result));
+	result.failed = TRUE;
+
+	/* The private bus listens on an abstract socket, so may still be
+	 * reached from inside the chroot.
+	 */
+	address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+
+	if (address && ! chroot (root) && ! chdir ("/"))
+		conn = bench_connect (address, TRUE);
+
+	deadline = bench_now () + BENCH_READY_TIMEOUT * 1000000ULL;
+
+	while (conn && (bench_now () < deadline)) {
+		if (bench_jobs (conn, DBUS_SERVICE_UPSTART) >= BENCH_JOBS) {
+			result.ready = bench_now () - started;
+			break;
+		}
+
+		usleep (BENCH_POLL_INTERVAL);
+	}
+
+	if (result.ready) {
+		result.churn = bench_churn (conn, DBUS_SERVICE_UPSTART,
+					    num_events);
+		result.failed = result.churn ? FALSE : TRUE;
+	}
+
+	if (conn)
+		bench_disconnect (conn);
+
+	if (write (fd, &result, sizeof (result)) != sizeof (result))
+		_exit (1);
+
+	_exit (0);
+}
+
+/**
+ * bench_chroot_sessions:
+ * @num_sessions: number of chroot sessions to create,
+ * @num_events: number of rounds of events per session,
+ * @verbose: TRUE to output each session as well as the summary.
+ *
+ * Start an init serving chroot sessions on a private bus, then create
+ * @num_sessions chroots each with their own jobs and enter them all
+ * together.  Measure the time until the jobs of each chroot are visible
+ * from inside it and to drive it with @num_events rounds of events; the
+ * CPU and RSS used by the init meanwhile are reported as the cost of
+ * the sessions to the system init.
+ *
+ * Chroot sessions have no process of their own, nor can they be ended,
+ * so no RSS or quiesce time is measured for each.
+ **/
+static void
+bench_chroot_sessions (size_t num_sessions,
+		       size_t num_events,
+		       int    verbose)
+{
+	nih_local BenchSession  *sessions = NULL;
+	nih_local int           *fds = NULL;
+	nih_local char          *cmd = NULL;
+	char                    *extra[] = { "--chroot-sessions", "--no-log", NULL };
+	char                     dirname[PATH_MAX];
+	char                     confdir[PATH_MAX];
+	BenchSystem              sysinit;
+	pid_t                    dbus_pid;
+	pid_t                    upstart_pid;
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, TEST_DIR_MODE), 0);
+
+	snprintf (confdir, sizeof (confdir), "%s/init", dirname);
+	TEST_EQ (mkdir (confdir, TEST_DIR_MODE), 0);
+
+	for (size_t i = 0; i < num_sessions; i++) {
+		nih_local char *path = NULL;
+
+		path = NIH_MUST (nih_sprintf (NULL, "%s/chroot-%zu", dirname, i));
+		TEST_EQ (mkdir (path, TEST_DIR_MODE), 0);
+		NIH_MUST (nih_strcat (&path, NULL, "/etc"));
+		TEST_EQ (mkdir (path, TEST_DIR_MODE), 0);
+		NIH_MUST (nih_strcat (&path, NULL, "/init"));
+		TEST_EQ (mkdir (path, TEST_DIR_MODE), 0);
+
+		bench_write_jobs (path, FALSE);
+	}
+
+	TEST_DBUS (dbus_pid);
+	start_upstart_common (&upstart_pid, FALSE, FALSE, confdir, NULL, extra);
+
+	sessions = NIH_MUST (nih_alloc (NULL, sizeof (BenchSession)
+					* (num_sessions + 1)));
+	memset (sessions, 0, sizeof (BenchSession) * (num_sessions + 1));
+
+	fds = NIH_MUST (nih_alloc (NULL, sizeof (int) * (num_sessions + 1)));
+
+	bench_system_start (&sysinit, upstart_pid);
+
+	for (size_t i = 0; i < num_sessions; i++) {
+		nih_local char *root = NULL;
+		int             pipefd[2];
+
+		root = NIH_MUST (nih_sprintf (NULL, "%s/chroot-%zu", dirname, i));
+
+		TEST_EQ (pipe (pipefd), 0);
+
+		sessions[i].started = bench_now ();
+		TEST_NE (sessions[i].pid = fork (), -1);
+
+		if (! sessions[i].pid) {
+			close (pipefd[0]);
+			bench_chroot_client (root, sessions[i].started,
+					     num_events, pipefd[1]);
+		}
+
+		close (pipefd[1]);
+		fds[i] = pipefd[0];
+	}
+
+	for (size_t i = 0; i < num_sessions; i++) {
+		BenchChrootResult result;
+
+		if (read (fds[i], &result, sizeof (result)) == sizeof (result)) {
+			sessions[i].ready = result.ready;
+			sessions[i].churn = result.churn;
+			sessions[i].failed = result.failed;
+		} else {
+			sessions[i].failed = TRUE;
+		}
+
+		close (fds[i]);
+		waitpid (sessions[i].pid, NULL, 0);
+	}
+
+	if (verbose) {
+		for (size_t i = 0; i < num_sessions; i++)
+			bench_print_session ("chroot", i, &sessions[i]);
+	}
+
+	bench_print_phase ("chroot", sessions, num_sessions, num_events,
+			   &sysinit);
+
+	assert0 (kill (upstart_pid, SIGTERM));
+	waitpid (upstart_pid, NULL, 0);
+
+	TEST_DBUS_END (dbus_pid);
+
+	cmd = NIH_MUST (nih_sprintf (NULL, "rm -rf %s", dirname));
+	assert0 (system (cmd));
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	size_t num_sessions = BENCH_SESSIONS;
+	size_t num_events = BENCH_EVENTS;
+	size_t num_chroots;
+	int    verbose;
+
+	if (argc > 1)
+		num_sessions = strtoul (argv[1], NULL, 10);
+	if (argc > 2)
+		num_events = strtoul (argv[2], NULL, 10);
+
+	num_chroots = num_sessions;
+	if (argc > 3)
+		num_chroots = strtoul (argv[3], NULL, 10);
+
+	verbose = getenv ("UPSTART_BENCH_VERBOSE") ? TRUE : FALSE;
+
+	nih_main_init (argv[0]);
+	nih_log_set_priority (NIH_LOG_FATAL);
+
+	/* One JSON object per line, so output is never interleaved with
+	 * that of children.
+	 */
+	setvbuf (stdout, NULL, _IOLBF, 0);
+
+	test_common_setup ();
+
+	bench_user_sessions (num_sessions, num_events, verbose);
+
+	/* Chroot sessions need root both to enter the chroots and for the
+	 * init serving them to resolve their roots.
+	 */
+	if (! num_chroots) {
+		/* nothing to do */
+	} else if (geteuid ()) {
+		printf ("{\"phase\":\"chroot\",\"skipped\":\"not root\"}\n");
+	} else if (in_chroot () && ! dbus_configured ()) {
+		printf ("{\"phase\":\"chroot\",\"skipped\":\"no D-Bus\"}\n");
+	} else {
+		bench_chroot_sessions (num_chroots, num_events, verbose);
+	}
+
+	test_common_cleanup ();
+
+	return 0;
+}
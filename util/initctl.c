@@ -25,14 +25,21 @@
 #include <dbus/dbus.h>
 
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
-#include <fnmatch.h>
 #include <pwd.h>
 #include <dirent.h>
 #include <ctype.h>
+#include <fnmatch.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -43,7 +50,6 @@
 #include <nih/logging.h>
 #include <nih/error.h>
 #include <nih/hash.h>
-#include <nih/tree.h>
 #include <nih/file.h>
 
 #include <nih-dbus/dbus_error.h>
@@ -59,6 +65,8 @@
 
 #include "init/events.h"
 #include "init/xdg.h"
+#include "init/snapshot.h"
+#include "init/log_index.h"
 #include "initctl.h"
 
 
@@ -78,6 +86,74 @@ static void   start_reply_handler (char **job_path, NihDBusMessage *message,
 static void   reply_handler       (int *ret, NihDBusMessage *message);
 static void   error_handler       (void *data, NihDBusMessage *message);
 
+static BatchRequest *batch_request_add (NihList *requests,
+					NihDBusProxy *upstart,
+					char * const *args)
+	__attribute__ ((warn_unused_result));
+static void   batch_request_send  (BatchRequest *req);
+static void   batch_job_reply_handler (BatchRequest *req,
+				       NihDBusMessage *message,
+				       const char *job_class_path);
+static void   batch_reply_handler (BatchRequest *req,
+				   NihDBusMessage *message);
+static void   batch_instance_reply_handler (BatchRequest *req,
+					    NihDBusMessage *message,
+					    const char *instance);
+static void   batch_error_handler (void *data, NihDBusMessage *message);
+static char * job_status_string   (const void *parent,
+				   const char *job_class_name,
+				   const char *name, const char *goal,
+				   const char *state)
+	__attribute__ ((warn_unused_result));
+static int    job_status_add_process (char **str, const void *parent,
+				      int first, const char *name,
+				      int32_t pid)
+	__attribute__ ((warn_unused_result));
+static int    list_all_job_status (NihDBusProxy *upstart)
+	__attribute__ ((warn_unused_result));
+static int    job_status_fast     (const void *parent, const char *job_name,
+				   const char *instance, char **status)
+	__attribute__ ((warn_unused_result));
+
+static void   stats_histogram    (const char *name, const char *unit,
+				  const uint64_t *histogram, size_t len);
+
+static int    log_time_parse     (const char *arg, int64_t *usec)
+	__attribute__ ((warn_unused_result));
+static int    log_index_first    (const char *path, int64_t *time);
+static int    log_index_range    (const char *path, int64_t since,
+				  int64_t until, off_t *start, off_t *end);
+static int    log_copy           (const char *path, off_t start, off_t end,
+				  int follow);
+
+static char * boot_trace_quote   (const void *parent, const char *str)
+	__attribute__ ((warn_unused_result));
+static int    boot_trace_same    (UpstartGetJobTimelineRecordsElement *a,
+				  UpstartGetJobTimelineRecordsElement *b);
+
+static int    critical_path_find (UpstartGetJobTimelineRecordsElement **records,
+				  int limit, const char *type, const char *job,
+				  const char *instance, const char *value);
+static int    critical_path_cause (UpstartGetJobTimelineRecordsElement **records,
+				   NihHash *classes, int index);
+static int    critical_path_condition (UpstartGetJobTimelineRecordsElement **records,
+				       int limit, char ** const *start_on);
+static char * critical_path_step (const void *parent,
+				  UpstartGetJobTimelineRecordsElement *record)
+	__attribute__ ((warn_unused_result));
+
+static GraphNode *graph_node    (NihHash *nodes, GraphNode ***order,
+				  size_t *order_len, int job, const char *name)
+	__attribute__ ((warn_unused_result));
+static int    graph_edge         (GraphEdge **edges, size_t *edges_len,
+				  GraphNode *from, GraphNode *to,
+				  const char *type, const char *event)
+	__attribute__ ((warn_unused_result));
+static void   graph_dot          (GraphNode **order, size_t order_len,
+				  GraphEdge *edges, size_t edges_len);
+static void   graph_json         (GraphNode **order, size_t order_len,
+				  GraphEdge *edges, size_t edges_len);
+
 static void   job_class_condition_handler (void *data,
 		NihDBusMessage *message,
 		char ** const *value);
@@ -94,20 +170,6 @@ static void   job_class_show_emits (const void *parent,
 static void   job_class_show_conditions (NihDBusProxy *job_class_proxy,
 		const char *job_class_name);
 
-static void   eval_expr_tree (const char *expr, NihList **stack);
-
-static int    check_condition (const char *job_class,
-		const char *condition, NihList *condition_list,
-		int *job_class_displayed)
-	__attribute__ ((warn_unused_result));
-
-static int    tree_filter (void *data, NihTree *node);
-
-static void   display_check_errors (const char *job_class,
-		const char *condition, NihTree *node);
-
-static int    allow_job (const char *job);
-static int    allow_event (const char *event);
 static char **get_job_details (void)
 	__attribute__ ((warn_unused_result));
 
@@ -125,12 +187,21 @@ int restart_action                       (NihCommand *command, char * const *arg
 int reload_action                        (NihCommand *command, char * const *args);
 int status_action                        (NihCommand *command, char * const *args);
 int list_action                          (NihCommand *command, char * const *args);
+int batch_action                         (NihCommand *command, char * const *args);
+int shell_action                         (NihCommand *command, char * const *args);
 int emit_action                          (NihCommand *command, char * const *args);
 int reload_configuration_action          (NihCommand *command, char * const *args);
 int version_action                       (NihCommand *command, char * const *args);
+int stats_action                         (NihCommand *command, char * const *args);
+int mem_stats_action                     (NihCommand *command, char * const *args);
+int events_action                        (NihCommand *command, char * const *args);
+int log_action                           (NihCommand *command, char * const *args);
+int boot_trace_action                    (NihCommand *command, char * const *args);
+int critical_path_action                 (NihCommand *command, char * const *args);
 int log_priority_action                  (NihCommand *command, char * const *args);
 int show_config_action                   (NihCommand *command, char * const *args);
 int check_config_action                  (NihCommand *command, char * const *args);
+int graph_action                         (NihCommand *command, char * const *args);
 int usage_action                         (NihCommand *command, char * const *args);
 int notify_disk_writeable_action         (NihCommand *command, char * const *args);
 int notify_dbus_address_action           (NihCommand *command, char * const *args);
@@ -189,6 +260,87 @@ const char *dest_address = DBUS_ADDRESS_UPSTART;
  **/
 int no_wait = FALSE;
 
+/**
+ * emit_async:
+ *
+ * If TRUE, the emit command outputs the identifier of the event and the
+ * number of events pending rather than waiting for it.
+ **/
+int emit_async = FALSE;
+
+/**
+ * fast:
+ *
+ * If TRUE, the status command reads the state of the job from the
+ * snapshot kept by init rather than asking it over D-Bus.
+ **/
+int fast = FALSE;
+
+/**
+ * show_stats:
+ *
+ * If TRUE, the status command also outputs the resources used by the
+ * instance.
+ **/
+int show_stats = FALSE;
+
+/**
+ * events_since:
+ *
+ * Identifier of the last event already seen, only those after it are
+ * output by the events command.
+ **/
+char *events_since = NULL;
+
+/**
+ * log_since:
+ * log_until:
+ *
+ * Times between which output is shown by the log command, or NULL.
+ **/
+char *log_since = NULL;
+char *log_until = NULL;
+
+/**
+ * log_follow:
+ *
+ * If TRUE, the log command waits for further output once it has shown
+ * all the job has written.
+ **/
+int log_follow = FALSE;
+
+/**
+ * log_logdir:
+ *
+ * Directory the log command reads job logs from, or NULL for the
+ * default.
+ **/
+char *log_logdir = NULL;
+
+/**
+ * batch_pending:
+ *
+ * Number of method calls made by the batch command that have not yet
+ * been replied to.
+ **/
+static int batch_pending = 0;
+
+/**
+ * upstart_connection:
+ *
+ * Connection kept open by the shell command, reused by upstart_open() for
+ * each command run by it rather than connecting again.
+ **/
+static DBusConnection *upstart_connection = NULL;
+
+/**
+ * shell_status:
+ *
+ * If TRUE, the shell command outputs the exit status of each command
+ * after its output.
+ **/
+int shell_status = FALSE;
+
 /**
  * enumerate_events:
  *
@@ -208,14 +360,6 @@ int enumerate_events = FALSE;
  **/
 int retain_var = FALSE;
 
-/**
- * check_config_mode:
- *
- * If TRUE, parse all job configuration files looking for unreachable
- * jobs/events.
- **/
-int check_config_mode = FALSE;
-
 /**
  * check_config_warn:
  *
@@ -225,11 +369,18 @@ int check_config_mode = FALSE;
 int check_config_warn = FALSE;
 
 /**
- * check_config_data:
+ * check_config_ignored_events:
+ *
+ * Events that check-config treats as emitted although no job does.
+ **/
+char **check_config_ignored_events = NULL;
+
+/**
+ * graph_format:
  *
- * Used to record details of all known jobs and events.
+ * Output format of the graph command, "dot" or "json".
  **/
-CheckConfigData check_config_data;
+char *graph_format = "dot";
 
 /**
  * apply_globally:
@@ -274,14 +425,12 @@ ignored_events_setter (NihOption *option, const char *arg)
 {
 	NihError     *err;
 	char        **events;
-	char        **event;
-	NihListEntry *entry;
 
 	nih_assert (option);
 	nih_assert (arg);
 
-	if (! check_config_data.ignored_events_hash)
-		check_config_data.ignored_events_hash = NIH_MUST (nih_hash_string_new (NULL, 0));
+	if (! check_config_ignored_events)
+		check_config_ignored_events = NIH_MUST (nih_str_array_new (NULL));
 
 	events = nih_str_split (NULL, arg, ",", TRUE);
 
@@ -289,11 +438,8 @@ ignored_events_setter (NihOption *option, const char *arg)
 		goto error;
 	}
 
-	for (event = events; event && *event; ++event) {
-		entry = NIH_MUST (nih_list_entry_new (check_config_data.ignored_events_hash));
-		entry->str = NIH_MUST (nih_strdup (entry, *event));
-		nih_hash_add (check_config_data.ignored_events_hash, &entry->entry);
-	}
+	NIH_MUST (nih_str_array_append (&check_config_ignored_events, NULL,
+					NULL, events));
 
 	nih_free (events);
 
@@ -309,29 +455,25 @@ error:
 
 
 /**
- * upstart_open:
- * @parent: parent object for new proxy.
+ * upstart_connect:
  *
- * Opens a connection to the init daemon and returns a proxy to the manager
- * object.  If @dest_name is not NULL, a connection is instead opened to
- * the system bus and the proxy linked to the well-known name given.
+ * Opens a connection to the init daemon.  Unless a bus was chosen with
+ * a command-line option, root connects to the private socket of the init
+ * daemon, falling back to the system bus only when that socket can't be
+ * connected to, so that commands don't queue behind other traffic on a
+ * busy bus.
  *
  * Error messages are output to standard error.
  *
- * If @parent is not NULL, it should be a pointer to another object which
- * will be used as a parent for the returned proxy.  When all parents
- * of the returned proxy are freed, the returned proxy will also be
- * freed.
- *
- * Returns: newly allocated D-Bus proxy or NULL on error.
+ * Returns: new connection or NULL on error.
  **/
-NihDBusProxy *
-upstart_open (const void *parent)
+static DBusConnection *
+upstart_connect (void)
 {
 	DBusError       dbus_error;
 	DBusConnection *connection;
-	NihDBusProxy *  upstart;
-	char * user_addr;
+	char *          user_addr;
+	int             fallback = FALSE;
 
 	user_addr = getenv ("UPSTART_SESSION");
 
@@ -340,8 +482,11 @@ upstart_open (const void *parent)
 	}
 
 	if (! user_mode) {
-		if (use_dbus < 0)
+		if (use_dbus < 0) {
 			use_dbus = getuid () ? TRUE : FALSE;
+			fallback = ((! use_dbus) && (! dest_name)
+				    && (dbus_bus_type < 0));
+		}
 		if (use_dbus >= 0 && dbus_bus_type < 0)
 			dbus_bus_type = DBUS_BUS_SYSTEM;
 	} else {
@@ -355,23 +500,7 @@ upstart_open (const void *parent)
 	}
 
 	dbus_error_init (&dbus_error);
-	if (use_dbus) {
-		if (! dest_name)
-			dest_name = DBUS_SERVICE_UPSTART;
-
-		connection = dbus_bus_get (dbus_bus_type, &dbus_error);
-		if (! connection) {
-			nih_error ("%s: %s",
-				dbus_bus_type == DBUS_BUS_SYSTEM
-				? _("Unable to connect to system bus")
-				: _("Unable to connect to session bus"),
-				   dbus_error.message);
-			dbus_error_free (&dbus_error);
-			return NULL;
-		}
-
-		dbus_connection_set_exit_on_disconnect (connection, FALSE);
-	} else {
+	if (! use_dbus) {
 		if (dest_name && ! user_mode) {
 			fprintf (stderr, _("%s: --dest given without --system\n"),
 				 program_name);
@@ -380,16 +509,80 @@ upstart_open (const void *parent)
 		}
 
 		connection = dbus_connection_open (dest_address, &dbus_error);
-		if (! connection) {
+		if (connection) {
+			dbus_error_free (&dbus_error);
+			return connection;
+		}
+
+		if (! fallback) {
 			nih_error ("%s: %s", _("Unable to connect to Upstart"),
 				   dbus_error.message);
 			dbus_error_free (&dbus_error);
 			return NULL;
 		}
+
+		nih_debug ("%s: %s", _("Unable to connect to Upstart"),
+			   dbus_error.message);
+		dbus_error_free (&dbus_error);
+
+		use_dbus = TRUE;
 	}
 
+	if (! dest_name)
+		dest_name = DBUS_SERVICE_UPSTART;
+
+	connection = dbus_bus_get (dbus_bus_type, &dbus_error);
+	if (! connection) {
+		nih_error ("%s: %s",
+			dbus_bus_type == DBUS_BUS_SYSTEM
+			? _("Unable to connect to system bus")
+			: _("Unable to connect to session bus"),
+			   dbus_error.message);
+		dbus_error_free (&dbus_error);
+		return NULL;
+	}
+
+	dbus_connection_set_exit_on_disconnect (connection, FALSE);
+
 	dbus_error_free (&dbus_error);
 
+	return connection;
+}
+
+/**
+ * upstart_open:
+ * @parent: parent object for new proxy.
+ *
+ * Opens a connection to the init daemon and returns a proxy to the manager
+ * object.  If @dest_name is not NULL, a connection is instead opened to
+ * the system bus and the proxy linked to the well-known name given.  The
+ * connection kept open by the shell command is used instead when there
+ * is one.
+ *
+ * Error messages are output to standard error.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned proxy.  When all parents
+ * of the returned proxy are freed, the returned proxy will also be
+ * freed.
+ *
+ * Returns: newly allocated D-Bus proxy or NULL on error.
+ **/
+NihDBusProxy *
+upstart_open (const void *parent)
+{
+	DBusConnection *connection;
+	NihDBusProxy *  upstart;
+
+	if (upstart_connection
+	    && dbus_connection_get_is_connected (upstart_connection)) {
+		connection = dbus_connection_ref (upstart_connection);
+	} else {
+		connection = upstart_connect ();
+		if (! connection)
+			return NULL;
+	}
+
 	upstart = nih_dbus_proxy_new (parent, connection,
 				      dest_name,
 				      DBUS_PATH_UPSTART,
@@ -414,6 +607,98 @@ upstart_open (const void *parent)
 }
 
 
+/**
+ * job_status_string:
+ * @parent: parent object for new string,
+ * @job_class_name: name of job class,
+ * @name: name of instance, or NULL,
+ * @goal: goal of instance,
+ * @state: state of instance.
+ *
+ * Constructs the first line of the status of an instance, containing the
+ * @job_class_name, any instance @name and the @goal and @state, to
+ * which processes may be appended with job_status_add_process().
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned string.  When all parents
+ * of the returned string are freed, the returned string will also be
+ * freed.
+ *
+ * Returns: newly allocated string or NULL on raised error.
+ **/
+static char *
+job_status_string (const void *parent,
+		   const char *job_class_name,
+		   const char *name,
+		   const char *goal,
+		   const char *state)
+{
+	char *str;
+
+	nih_assert (job_class_name != NULL);
+	nih_assert (goal != NULL);
+	nih_assert (state != NULL);
+
+	if (name && *name) {
+		str = nih_sprintf (parent, "%s (%s) %s/%s",
+				   job_class_name, name, goal, state);
+	} else {
+		str = nih_sprintf (parent, "%s %s/%s",
+				   job_class_name, goal, state);
+	}
+
+	if (! str)
+		nih_return_no_memory_error (NULL);
+
+	return str;
+}
+
+/**
+ * job_status_add_process:
+ * @str: pointer to status string,
+ * @parent: parent of @str,
+ * @first: TRUE for the first process of the instance,
+ * @name: name of process,
+ * @pid: process id.
+ *
+ * Appends the process @name with @pid to the status string @str.
+ *
+ * The first process is always the main process, which is the process we
+ * always want to display alongside the state if there is one; it is
+ * prefixed if it's not one of the standard processes.  Additional
+ * processes are given a line each.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+job_status_add_process (char **     str,
+			const void *parent,
+			int         first,
+			const char *name,
+			int32_t     pid)
+{
+	nih_assert (str != NULL);
+	nih_assert (*str != NULL);
+	nih_assert (name != NULL);
+
+	if (! first) {
+		if (! nih_strcat_sprintf (str, parent, "\n\t%s process %d",
+					  name, pid))
+			nih_return_no_memory_error (-1);
+	} else if (strcmp (name, "main")
+		   && strcmp (name, "pre-start")
+		   && strcmp (name, "post-stop")) {
+		if (! nih_strcat_sprintf (str, parent, ", (%s) process %d",
+					  name, pid))
+			nih_return_no_memory_error (-1);
+	} else {
+		if (! nih_strcat_sprintf (str, parent, ", process %d", pid))
+			nih_return_no_memory_error (-1);
+	}
+
+	return 0;
+}
+
 /**
  * job_status:
  * @parent: parent object for new string,
@@ -466,68 +751,25 @@ job_status (const void *  parent,
 		}
 	}
 
-	if (props && *props->name) {
-		str = nih_sprintf (parent, "%s (%s)",
-				   job_class_name, props->name);
-		if (! str)
-			nih_return_no_memory_error (NULL);
-	} else {
-		str = nih_strdup (parent, job_class_name);
-		if (! str)
-			nih_return_no_memory_error (NULL);
-	}
-
 	if (props) {
-		if (! nih_strcat_sprintf (&str, parent, " %s/%s",
-					  props->goal, props->state)) {
-			nih_error_raise_no_memory ();
-			nih_free (str);
+		str = job_status_string (parent, job_class_name, props->name,
+					 props->goal, props->state);
+		if (! str)
 			return NULL;
-		}
-
-		/* The first process returned is always the main process,
-		 * which is the process we always want to display alongside
-		 * the state if there is one.  Prefix if it's not one of
-		 * the standard processes.
-		 */
-		if (props->processes[0]) {
-			if (strcmp (props->processes[0]->item0, "main")
-			    && strcmp (props->processes[0]->item0, "pre-start")
-			    && strcmp (props->processes[0]->item0, "post-stop")) {
-				if (! nih_strcat_sprintf (&str, parent, ", (%s) process %d",
-							  props->processes[0]->item0,
-							  props->processes[0]->item1)) {
-					nih_error_raise_no_memory ();
-					nih_free (str);
-					return NULL;
-				}
-			} else {
-				if (! nih_strcat_sprintf (&str, parent, ", process %d",
-							  props->processes[0]->item1)) {
-					nih_error_raise_no_memory ();
-					nih_free (str);
-					return NULL;
-				}
-			}
 
-			/* Append a line for each additional process */
-			for (JobProcessesElement **p = &props->processes[1];
-			     p && *p; p++) {
-				if (! nih_strcat_sprintf (&str, parent, "\n\t%s process %d",
-							  (*p)->item0,
-							  (*p)->item1)) {
-					nih_error_raise_no_memory ();
-					nih_free (str);
-					return NULL;
-				}
+		for (JobProcessesElement **p = props->processes; p && *p; p++) {
+			if (job_status_add_process (&str, parent,
+						    p == props->processes,
+						    (*p)->item0, (*p)->item1) < 0) {
+				nih_free (str);
+				return NULL;
 			}
 		}
 	} else {
-		if (! nih_strcat (&str, parent, " stop/waiting")) {
-			nih_error_raise_no_memory ();
-			nih_free (str);
+		str = job_status_string (parent, job_class_name, NULL,
+					 "stop", "waiting");
+		if (! str)
 			return NULL;
-		}
 	}
 
 	return str;
@@ -1113,6 +1355,24 @@ status_action (NihCommand *  command,
 		}
 	}
 
+	/* The snapshot can only answer for instances named without any
+	 * environment, and doesn't hold resource usage; anything it can't
+	 * answer falls back to D-Bus.
+	 */
+	if (fast && (! show_stats) && (! (args[0] && args[1]))) {
+		int ret;
+
+		ret = job_status_fast (NULL, upstart_job, upstart_instance,
+				       &status);
+		if (ret < 0)
+			goto error;
+
+		if (ret > 0) {
+			nih_message ("%s", status);
+			return 0;
+		}
+	}
+
 	upstart = upstart_open (NULL);
 	if (! upstart)
 		return 1;
@@ -1170,6 +1430,16 @@ status_action (NihCommand *  command,
 
 	nih_message ("%s", status);
 
+	if (show_stats && job) {
+		nih_local JobGetStatsStatsElement **stats = NULL;
+
+		if (job_get_stats_sync (NULL, job, &stats) < 0)
+			goto error;
+
+		for (JobGetStatsStatsElement **s = stats; s && *s; s++)
+			nih_message ("\t%s %" PRIu64, (*s)->item0, (*s)->item1);
+	}
+
 	return 0;
 
 error:
@@ -1182,67 +1452,273 @@ error:
 
 
 /**
- * list_action:
- * @command: NihCommand invoked,
- * @args: command-line arguments.
+ * job_status_fast:
+ * @parent: parent object for new string,
+ * @job_name: name of job,
+ * @instance: name of instance, or NULL,
+ * @status: pointer for status string.
  *
- * This function is called for the "list" command.
+ * Looks up @job_name in the snapshot of job state kept by init when run
+ * with its --snapshot option, and constructs the same string as
+ * job_status() for @instance, or for the instance named without any
+ * environment when @instance is NULL, storing it in @status.
  *
- * Returns: command exit status.
+ * The snapshot is read under its sequence lock without any IPC; it can't
+ * answer when it doesn't exist, init has exited, the job isn't listed or
+ * the instance name depends on the environment.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned string.  When all parents
+ * of the returned string are freed, the returned string will also be
+ * freed.
+ *
+ * Returns: 1 when @status was set, zero when the snapshot can't answer
+ * or negative value on raised error.
  **/
-int
-list_action (NihCommand *  command,
-	     char * const *args)
+static int
+job_status_fast (const void *parent,
+		 const char *job_name,
+		 const char *instance,
+		 char      **status)
 {
-	nih_local NihDBusProxy *upstart = NULL;
-	nih_local char **       job_class_paths = NULL;
-	NihError *              err;
-	NihDBusError *          dbus_err;
+	const char     *path;
+	struct stat     statbuf;
+	const Snapshot *snapshot;
+	SnapshotEntry   entry;
+	int             fd;
+	int             consistent = FALSE;
+	int             known = FALSE;
+	int             found = FALSE;
+	int             has_instance = FALSE;
+	char           *str;
+
+	nih_assert (job_name != NULL);
+	nih_assert (status != NULL);
+
+	path = getenv (SNAPSHOT_FILE_ENV);
+	if (! (path && *path))
+		path = SNAPSHOT_FILE;
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
 
-	nih_assert (command != NULL);
-	nih_assert (args != NULL);
+	if ((fstat (fd, &statbuf) < 0)
+	    || (statbuf.st_size < (off_t)sizeof (Snapshot))) {
+		close (fd);
+		return 0;
+	}
 
-	upstart = upstart_open (NULL);
-	if (! upstart)
-		return 1;
+	snapshot = mmap (NULL, sizeof (Snapshot), PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
 
-	/* Obtain a list of jobs */
-	if (upstart_get_all_jobs_sync (NULL, upstart, &job_class_paths) < 0)
-		goto error;
+	if (snapshot == MAP_FAILED)
+		return 0;
 
-	for (char **job_class_path = job_class_paths;
-	     job_class_path && *job_class_path; job_class_path++) {
-		nih_local NihDBusProxy *job_class = NULL;
-		nih_local char **       job_paths = NULL;
+	if ((snapshot->magic != SNAPSHOT_MAGIC)
+	    || (snapshot->version != SNAPSHOT_VERSION)
+	    || ((kill (snapshot->pid, 0) < 0) && (errno != EPERM)))
+		goto out;
 
-		job_class = nih_dbus_proxy_new (NULL, upstart->connection,
-						upstart->name, *job_class_path,
-						NULL, NULL);
-		if (! job_class)
-			goto error;
+	for (int tries = 0; (! consistent) && (tries < 100); tries++) {
+		uint32_t seq;
+		uint32_t num_entries;
 
-		job_class->auto_start = FALSE;
+		seq = __atomic_load_n (&snapshot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
 
-		/* Obtain a list of instances, catch an error from the
-		 * command and assume the job just went away.
-		 */
-		if (job_class_get_all_instances_sync (NULL, job_class,
-						      &job_paths) < 0) {
-			dbus_err = (NihDBusError *)nih_error_get ();
-			if ((dbus_err->number != NIH_DBUS_ERROR)
-			    || strcmp (dbus_err->name, DBUS_ERROR_UNKNOWN_METHOD))
-				goto error;
+		known = found = has_instance = FALSE;
 
-			nih_free (dbus_err);
-			continue;
-		}
+		num_entries = snapshot->num_entries;
+		if (num_entries > SNAPSHOT_MAX_ENTRIES)
+			num_entries = SNAPSHOT_MAX_ENTRIES;
 
-		/* Handle no running instances by assuming that the
-		 * job is just stopped, again catch an error and assume
-		 * the job went away.
-		 */
-		if (! *job_paths) {
-			nih_local char *status = NULL;
+		for (uint32_t i = 0; i < num_entries; i++) {
+			const SnapshotEntry *e = &snapshot->entries[i];
+
+			if (strncmp (e->job, job_name, SNAPSHOT_NAME_MAX))
+				continue;
+
+			known = TRUE;
+			has_instance = e->has_instance;
+
+			if (! strncmp (e->instance, instance ? instance : "",
+				       SNAPSHOT_NAME_MAX)) {
+				memcpy (&entry, e, sizeof (SnapshotEntry));
+				found = TRUE;
+				break;
+			}
+		}
+
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		consistent = (__atomic_load_n (&snapshot->seq, __ATOMIC_RELAXED) == seq);
+	}
+
+out:
+	munmap ((void *)snapshot, sizeof (Snapshot));
+
+	if (! (consistent && known))
+		return 0;
+
+	/* Mirror status treating the unknown instance of a job without an
+	 * instance stanza as not running.
+	 */
+	if (! found) {
+		if (instance || has_instance)
+			return 0;
+
+		*status = job_status_string (parent, job_name, NULL,
+					     "stop", "waiting");
+		return *status ? 1 : -1;
+	}
+
+	entry.job[SNAPSHOT_NAME_MAX - 1] = '\0';
+	entry.instance[SNAPSHOT_NAME_MAX - 1] = '\0';
+	entry.goal[SNAPSHOT_WORD_MAX - 1] = '\0';
+	entry.state[SNAPSHOT_WORD_MAX - 1] = '\0';
+
+	str = job_status_string (parent, entry.job, entry.instance,
+				 entry.goal, entry.state);
+	if (! str)
+		return -1;
+
+	for (int i = 0;
+	     (i < entry.num_processes) && (i < SNAPSHOT_MAX_PROCESSES); i++) {
+		entry.processes[i].name[SNAPSHOT_WORD_MAX - 1] = '\0';
+
+		if (job_status_add_process (&str, parent, i == 0,
+					    entry.processes[i].name,
+					    entry.processes[i].pid) < 0) {
+			nih_free (str);
+			return -1;
+		}
+	}
+
+	*status = str;
+
+	return 1;
+}
+
+/**
+ * list_all_job_status:
+ * @upstart: proxy for the manager object.
+ *
+ * Outputs the status of every instance of every job, in the same form as
+ * job_status(), obtained with a single GetAllJobStatus method call rather
+ * than a call for each job and instance.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+static int
+list_all_job_status (NihDBusProxy *upstart)
+{
+	nih_local UpstartGetAllJobStatusJobsElement **jobs = NULL;
+
+	nih_assert (upstart != NULL);
+
+	if (upstart_get_all_job_status_sync (NULL, upstart, &jobs) < 0)
+		return -1;
+
+	for (UpstartGetAllJobStatusJobsElement **job = jobs;
+	     job && *job; job++) {
+		nih_local char *status = NULL;
+
+		status = job_status_string (NULL, (*job)->item0, (*job)->item1,
+					    (*job)->item2, (*job)->item3);
+		if (! status)
+			return -1;
+
+		for (UpstartGetAllJobStatusJobsElementItem4Element **p = (*job)->item4;
+		     p && *p; p++) {
+			if (job_status_add_process (&status, NULL,
+						    p == (*job)->item4,
+						    (*p)->item0, (*p)->item1) < 0)
+				return -1;
+		}
+
+		nih_message ("%s", status);
+	}
+
+	return 0;
+}
+
+/**
+ * list_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "list" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+list_action (NihCommand *  command,
+	     char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char **       job_class_paths = NULL;
+	NihError *              err;
+	NihDBusError *          dbus_err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	/* Obtain the status of every job in a single call, falling back
+	 * to querying each job and instance in turn when the init daemon
+	 * is too old to know the method.
+	 */
+	if (list_all_job_status (upstart) == 0)
+		return 0;
+
+	dbus_err = (NihDBusError *)nih_error_get ();
+	if ((dbus_err->number != NIH_DBUS_ERROR)
+	    || strcmp (dbus_err->name, DBUS_ERROR_UNKNOWN_METHOD))
+		goto error;
+
+	nih_free (dbus_err);
+
+	/* Obtain a list of jobs */
+	if (upstart_get_all_jobs_sync (NULL, upstart, &job_class_paths) < 0)
+		goto error;
+
+	for (char **job_class_path = job_class_paths;
+	     job_class_path && *job_class_path; job_class_path++) {
+		nih_local NihDBusProxy *job_class = NULL;
+		nih_local char **       job_paths = NULL;
+
+		job_class = nih_dbus_proxy_new (NULL, upstart->connection,
+						upstart->name, *job_class_path,
+						NULL, NULL);
+		if (! job_class)
+			goto error;
+
+		job_class->auto_start = FALSE;
+
+		/* Obtain a list of instances, catch an error from the
+		 * command and assume the job just went away.
+		 */
+		if (job_class_get_all_instances_sync (NULL, job_class,
+						      &job_paths) < 0) {
+			dbus_err = (NihDBusError *)nih_error_get ();
+			if ((dbus_err->number != NIH_DBUS_ERROR)
+			    || strcmp (dbus_err->name, DBUS_ERROR_UNKNOWN_METHOD))
+				goto error;
+
+			nih_free (dbus_err);
+			continue;
+		}
+
+		/* Handle no running instances by assuming that the
+		 * job is just stopped, again catch an error and assume
+		 * the job went away.
+		 */
+		if (! *job_paths) {
+			nih_local char *status = NULL;
 
 			status = job_status (NULL, job_class, NULL);
 			if (! status) {
@@ -1299,6 +1775,104 @@ error:
 	return 1;
 }
 
+/**
+ * batch_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "batch" command.
+ *
+ * The command given as the first argument is applied to each of the jobs
+ * that follow it or, if there are no arguments, each line read from
+ * standard input is taken as a command, job name and environment.  All of
+ * the method calls are made asynchronously, with up to BATCH_MAX_PENDING
+ * of them in flight at once, so that the cost of a round trip is not paid
+ * for each job in turn.
+ *
+ * Returns: command exit status.
+ **/
+int
+batch_action (NihCommand *  command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local NihList *     requests = NULL;
+	NihList *               next;
+	int                     ret = 0;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (args[0] && (! args[1])) {
+		fprintf (stderr, _("%s: missing job name\n"), program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	requests = NIH_MUST (nih_list_new (NULL));
+
+	if (args[0]) {
+		for (char * const *arg = &args[1]; *arg; arg++) {
+			char *req_args[] = { args[0], *arg, NULL };
+
+			if (! batch_request_add (requests, upstart, req_args))
+				return 1;
+		}
+	} else {
+		char *  line = NULL;
+		size_t  len = 0;
+
+		while (getline (&line, &len, stdin) > 0) {
+			nih_local char **req_args = NULL;
+
+			req_args = NIH_MUST (nih_str_split (NULL, line,
+							    " \t\r\n", TRUE));
+
+			/* Skip blank lines and comments */
+			if ((! req_args[0]) || (req_args[0][0] == '#'))
+				continue;
+
+			if (! batch_request_add (requests, upstart, req_args)) {
+				free (line);
+				return 1;
+			}
+		}
+
+		free (line);
+	}
+
+	/* Send requests while there's room for them in flight, and wait
+	 * for replies, which may make further calls, until everything has
+	 * been answered.
+	 */
+	next = requests->next;
+	while ((next != requests) || batch_pending) {
+		while ((next != requests) && (batch_pending < BATCH_MAX_PENDING)) {
+			batch_request_send ((BatchRequest *)next);
+			next = next->next;
+		}
+
+		if (batch_pending
+		    && (! dbus_connection_read_write_dispatch (upstart->connection, -1))) {
+			nih_error (_("Disconnected from the init daemon"));
+			break;
+		}
+	}
+
+	NIH_LIST_FOREACH (requests, iter) {
+		BatchRequest *req = (BatchRequest *)iter;
+
+		if (req->ret)
+			ret = 1;
+	}
+
+	return ret;
+}
+
 /**
  * show_config_action:
  * @command: NihCommand invoked,
@@ -1355,26 +1929,10 @@ show_config_action (NihCommand *  command,
 		if (job_class_get_name_sync (NULL, job_class, &job_class_name) < 0)
 			goto error;
 
-		if (! check_config_mode)
-			nih_message ("%s", job_class_name);
+		nih_message ("%s", job_class_name);
 
 		job_class_show_emits (NULL, job_class, job_class_name);
 		job_class_show_conditions (job_class, job_class_name);
-
-		/* Add any jobs *without* "start on"/"stop on" conditions
-		 * to ensure we have a complete list of jobs for check-config to work with.
-		 */
-		if (check_config_mode) {
-			JobCondition *entry;
-
-			entry = (JobCondition *)nih_hash_lookup (check_config_data.job_class_hash,
-					job_class_name);
-			if (!entry) {
-				MAKE_JOB_CONDITION (check_config_data.job_class_hash,
-						entry, job_class_name);
-				nih_hash_add (check_config_data.job_class_hash, &entry->list);
-			}
-		}
 	}
 
 	return 0;
@@ -1749,6 +2307,20 @@ emit_action (NihCommand *  command,
 	if (! upstart)
 		return 1;
 
+	if (emit_async) {
+		uint64_t id;
+		uint32_t pending;
+
+		if (upstart_emit_event_async_sync (NULL, upstart, args[0],
+						   &args[1], &id, &pending) < 0)
+			goto error;
+
+		nih_message ("%llu %u", (unsigned long long)id,
+			     (unsigned int)pending);
+
+		return 0;
+	}
+
 	pending_call = upstart_emit_event (upstart, args[0], &args[1], (! no_wait),
 					   (UpstartEmitEventReply)reply_handler,
 					   error_handler, &ret,
@@ -1848,19 +2420,32 @@ error:
 
 
 /**
- * log_priority_action:
+ * stats_action:
  * @command: NihCommand invoked,
  * @args: command-line arguments.
  *
- * This function is called for the "log-priority" command.
+ * This function is called for the "stats" command.
+ *
+ * Outputs the number of events emitted and queued by the init daemon,
+ * followed by the non-empty buckets of each of its histograms.
  *
  * Returns: command exit status.
  **/
 int
-log_priority_action (NihCommand *  command,
-		     char * const *args)
+stats_action (NihCommand *  command,
+	      char * const *args)
 {
 	nih_local NihDBusProxy *upstart = NULL;
+	nih_local uint64_t *    latency = NULL;
+	nih_local uint64_t *    poll = NULL;
+	nih_local uint64_t *    examined = NULL;
+	size_t                  latency_len;
+	size_t                  poll_len;
+	size_t                  examined_len;
+	uint64_t                emitted;
+	uint32_t                pending;
+	uint32_t                handling;
+	uint32_t                finished;
 	NihError *              err;
 
 	nih_assert (command != NULL);
@@ -1870,18 +2455,22 @@ log_priority_action (NihCommand *  command,
 	if (! upstart)
 		return 1;
 
-	if (args[0]) {
-		if (upstart_set_log_priority_sync (NULL, upstart, args[0]) < 0)
-			goto error;
-	} else {
-		nih_local char *log_priority = NULL;
+	if (upstart_get_event_stats_sync (NULL, upstart, &emitted,
+					  &pending, &handling, &finished,
+					  &latency, &latency_len,
+					  &poll, &poll_len,
+					  &examined, &examined_len) < 0)
+		goto error;
 
-		if (upstart_get_log_priority_sync (NULL, upstart,
-						   &log_priority) < 0)
-			goto error;
+	nih_message ("events emitted: %llu", (unsigned long long)emitted);
+	nih_message ("events pending: %u", (unsigned int)pending);
+	nih_message ("events handling: %u", (unsigned int)handling);
+	nih_message ("events finished: %u", (unsigned int)finished);
 
-		nih_message ("%s", log_priority);
-	}
+	stats_histogram (_("event latency"), "us", latency, latency_len);
+	stats_histogram (_("queue pass duration"), "us", poll, poll_len);
+	stats_histogram (_("subscriptions examined per event"), NULL,
+			 examined, examined_len);
 
 	return 0;
 
@@ -1893,95 +2482,77 @@ error:
 	return 1;
 }
 
-
 /**
- * check_config_action:
- * @command: NihCommand invoked,
- * @args: command-line arguments.
- *
- * This function is called for the "check-config" command.
- *
- * Returns: command exit status.
+ * stats_histogram:
+ * @name: name of histogram,
+ * @unit: unit of values, or NULL,
+ * @histogram: bucket counts,
+ * @len: number of buckets in @histogram.
+ *
+ * Outputs @name followed by a line for each non-empty bucket of
+ * @histogram giving the range of values counted in it; bucket zero holds
+ * zero, bucket n values from 2^(n-1) to 2^n - 1 and the last bucket all
+ * larger values.
  **/
-int
-check_config_action (NihCommand *command,
-		char * const *args)
+static void
+stats_histogram (const char *    name,
+		 const char *    unit,
+		 const uint64_t *histogram,
+		 size_t          len)
 {
-	int              ret;
-	char            *no_args[1] = { NULL };
-	char            *job_class  = NULL;
-
-	check_config_data.job_class_hash = NIH_MUST (nih_hash_string_new (NULL, 0));
-	check_config_data.event_hash     = NIH_MUST (nih_hash_string_new (NULL, 0));
-
-	if (! check_config_data.ignored_events_hash)
-		check_config_data.ignored_events_hash =
-			NIH_MUST (nih_hash_string_new (NULL, 0));
-
-	/* Tell other functions we are running in a special mode */
-	check_config_mode = TRUE;
-
-	/* Obtain emits, start on and stop on data.
-	 *
-	 * Note: we pass null args since we always want details of all jobs.
-	 */
-	ret = show_config_action (command, no_args);
-
-	if (ret)
-		return 0;
+	nih_assert (name != NULL);
+	nih_assert (histogram != NULL || len == 0);
 
-	if (args[0]) {
-		NihList *entry;
-		job_class = args[0];
-
-		entry = nih_hash_lookup (check_config_data.job_class_hash, job_class);
-
-		if (! entry) {
-			nih_error ("%s: %s", _("Invalid job class"), job_class);
-			return 1;
-		}
-	}
+	nih_message ("%s:", name);
 
-	NIH_HASH_FOREACH (check_config_data.job_class_hash, iter) {
-		JobCondition *j = (JobCondition *)iter;
-		int job_class_displayed = FALSE;
+	for (size_t i = 0; i < len; i++) {
+		unsigned long long low, high;
 
-		if (job_class && strcmp (job_class, j->job_class) != 0) {
-			/* user specified a job on the command-line,
-			 * so only show that one.
-			 */
+		if (! histogram[i])
 			continue;
-		}
 
-		ret += check_condition (j->job_class, "start on", j->start_on,
-				&job_class_displayed);
-
-		ret += check_condition (j->job_class, "stop on" , j->stop_on,
-				&job_class_displayed);
+		low = i ? (1ULL << (i - 1)) : 0;
+		high = i ? ((1ULL << i) - 1) : 0;
+
+		if (i == len - 1) {
+			nih_message ("\t%llu+%s%s\t%llu", low,
+				     unit ? " " : "", unit ? unit : "",
+				     (unsigned long long)histogram[i]);
+		} else if (low == high) {
+			nih_message ("\t%llu%s%s\t%llu", low,
+				     unit ? " " : "", unit ? unit : "",
+				     (unsigned long long)histogram[i]);
+		} else {
+			nih_message ("\t%llu-%llu%s%s\t%llu", low, high,
+				     unit ? " " : "", unit ? unit : "",
+				     (unsigned long long)histogram[i]);
+		}
 	}
-
-	nih_free (check_config_data.job_class_hash);
-	nih_free (check_config_data.event_hash);
-	if (check_config_data.ignored_events_hash)
-		nih_free (check_config_data.ignored_events_hash);
-
-	return ret ? 1 : 0;
 }
 
 /**
- * notify_disk_writeable_action:
+ * mem_stats_action:
  * @command: NihCommand invoked,
  * @args: command-line arguments.
  *
- * This function is called for the "notify-disk-writeable" command.
+ * This function is called for the "mem-stats" command.
+ *
+ * Outputs the number of objects and bytes held by each category of data
+ * structure in the init daemon, followed by the totals of the blocks it
+ * has allocated and keeps for reuse.
  *
  * Returns: command exit status.
  **/
 int
-notify_disk_writeable_action (NihCommand *command,
-		char * const *args)
+mem_stats_action (NihCommand *  command,
+		  char * const *args)
 {
 	nih_local NihDBusProxy *upstart = NULL;
+	nih_local UpstartGetMemoryStatsCategoriesElement **categories = NULL;
+	uint64_t                allocated;
+	uint64_t                allocated_bytes;
+	uint64_t                cached;
+	uint64_t                cached_bytes;
 	NihError *              err;
 
 	nih_assert (command != NULL);
@@ -1991,9 +2562,24 @@ notify_disk_writeable_action (NihCommand *command,
 	if (! upstart)
 		return 1;
 
-	if (upstart_notify_disk_writeable_sync (NULL, upstart) < 0)
+	if (upstart_get_memory_stats_sync (NULL, upstart, &categories,
+					   &allocated, &allocated_bytes,
+					   &cached, &cached_bytes) < 0)
 		goto error;
 
+	for (UpstartGetMemoryStatsCategoriesElement **category = categories;
+	     category && *category; category++)
+		nih_message ("%s: %llu objects, %llu bytes", (*category)->item0,
+			     (unsigned long long)(*category)->item1,
+			     (unsigned long long)(*category)->item2);
+
+	nih_message ("allocated: %llu blocks, %llu bytes",
+		     (unsigned long long)allocated,
+		     (unsigned long long)allocated_bytes);
+	nih_message ("cached: %llu blocks, %llu bytes",
+		     (unsigned long long)cached,
+		     (unsigned long long)cached_bytes);
+
 	return 0;
 
 error:
@@ -2004,32 +2590,1795 @@ error:
 	return 1;
 }
 
-
 /**
- * notify_dbus_address_action:
+ * events_action:
  * @command: NihCommand invoked,
  * @args: command-line arguments.
  *
- * This function is called for the "notify-dbus-address" command.
+ * This function is called for the "events" command.
+ *
+ * Outputs the event history kept by the init daemon: for each event its
+ * identifier, name and emitter followed by the time it was queued, the
+ * time it was pending and then handling, the jobs blocking it, whether
+ * it failed, and the jobs it started and stopped.
  *
  * Returns: command exit status.
  **/
 int
-notify_dbus_address_action (NihCommand    *command,
-			    char * const  *args)
+events_action (NihCommand *  command,
+	       char * const *args)
 {
-	nih_local NihDBusProxy   *upstart = NULL;
-	NihError                 *err;
-	char                     *address = NULL;
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local UpstartGetEventHistoryRecordsElement **records = NULL;
+	uint64_t                since = 0;
+	struct timespec         now;
+	uint64_t                now_usec;
+	NihError *              err;
 
 	nih_assert (command != NULL);
 	nih_assert (args != NULL);
 
-	if (! args[0]) {
-		fprintf (stderr, _("%s: missing D-Bus address\n"), program_name);
-		nih_main_suggest_help ();
-		return 1;
-	}
+	if (events_since) {
+		char *endptr;
+
+		errno = 0;
+		since = strtoull (events_since, &endptr, 10);
+		if (errno || (! *events_since) || *endptr) {
+			fprintf (stderr, _("%s: illegal event identifier: %s\n"),
+				 program_name, events_since);
+			nih_main_suggest_help ();
+			return 1;
+		}
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_event_history_sync (NULL, upstart, since, &records) < 0)
+		goto error;
+
+	/* Events still being handled are timed up to now; init stamps its
+	 * records with the same clock.
+	 */
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	now_usec = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+	for (UpstartGetEventHistoryRecordsElement **record = records;
+	     record && *record; record++) {
+		UpstartGetEventHistoryRecordsElement *r = *record;
+		nih_local char *started = NULL;
+		nih_local char *stopped = NULL;
+		size_t          shown = 0;
+
+		nih_message ("%llu %s from %s", (unsigned long long)r->item0,
+			     r->item1, r->item2);
+		nih_message ("\tqueued: %llu.%06llus",
+			     (unsigned long long)(r->item3 / 1000000),
+			     (unsigned long long)(r->item3 % 1000000));
+		nih_message ("\tpending: %llu us",
+			     (unsigned long long)(r->item4 - r->item3));
+
+		if (r->item5) {
+			nih_message ("\thandling: %llu us",
+				     (unsigned long long)(r->item5 - r->item4));
+		} else {
+			nih_message ("\thandling: %llu us so far",
+				     (unsigned long long)(now_usec > r->item4
+							  ? now_usec - r->item4
+							  : 0));
+		}
+
+		nih_message ("\tblockers: %u", (unsigned int)r->item7);
+
+		if (r->item6)
+			nih_message ("\tfailed");
+
+		for (char **job = r->item9; job && *job; job++, shown++)
+			NIH_MUST (nih_strcat_sprintf (&started, NULL, "%s%s",
+						      started ? ", " : "", *job));
+		for (char **job = r->item10; job && *job; job++, shown++)
+			NIH_MUST (nih_strcat_sprintf (&stopped, NULL, "%s%s",
+						      stopped ? ", " : "", *job));
+
+		if (started)
+			nih_message ("\tstarted: %s", started);
+		if (stopped)
+			nih_message ("\tstopped: %s", stopped);
+		if (r->item8 > shown)
+			nih_message ("\t(%u more jobs)",
+				     (unsigned int)(r->item8 - shown));
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * log_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "log" command.
+ *
+ * Outputs the log of the job named in @args, or only that written between
+ * log_since and log_until.  Each log is only read from the checkpoint in
+ * its index at or before log_since up to the first checkpoint after
+ * log_until, so output from up to the interval between checkpoints
+ * either side of the range may be included; rotated logs are only read
+ * when they hold output from the range.
+ *
+ * Returns: command exit status.
+ **/
+int
+log_action (NihCommand *  command,
+	    char * const *args)
+{
+	nih_local char * path = NULL;
+	nih_local char * name = NULL;
+	nih_local char **paths = NULL;
+	const char *     dir;
+	int64_t          since = INT64_MIN;
+	int64_t          until = INT64_MAX;
+	size_t           len = 0;
+	int              ret = 0;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (! args[0]) {
+		fprintf (stderr, _("%s: missing job name\n"), program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	if (log_since && (log_time_parse (log_since, &since) < 0)) {
+		fprintf (stderr, _("%s: illegal time: %s\n"), program_name,
+			 log_since);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	if (log_until && (log_time_parse (log_until, &until) < 0)) {
+		fprintf (stderr, _("%s: illegal time: %s\n"), program_name,
+			 log_until);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	if (log_follow && log_until) {
+		fprintf (stderr, _("%s: --follow may not be given with --until\n"),
+			 program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	/* Named as job_process_log_path() does */
+	name = NIH_MUST (args[1]
+			 ? nih_sprintf (NULL, "%s-%s", args[0], args[1])
+			 : nih_strdup (NULL, args[0]));
+	for (char *p = name; *p; p++)
+		if (*p == JOB_PROCESS_LOG_REMAP_FROM_CHAR)
+			*p = JOB_PROCESS_LOG_REMAP_TO_CHAR;
+
+	dir = log_logdir ? log_logdir : getenv (LOGDIR_ENV);
+	if (! dir)
+		dir = JOB_LOGDIR;
+
+	path = NIH_MUST (nih_sprintf (NULL, "%s/%s%s", dir, name,
+				      JOB_PROCESS_LOG_FILE_EXT));
+
+	if (access (path, R_OK) < 0) {
+		nih_error ("%s: %s", path, strerror (errno));
+		return 1;
+	}
+
+	if (! (log_since || log_until))
+		return log_copy (path, 0, -1, log_follow) < 0 ? 1 : 0;
+
+	/* Gather the rotated logs that have an index, oldest first,
+	 * followed by the log itself.
+	 */
+	paths = NIH_MUST (nih_str_array_new (NULL));
+
+	for (int i = 1; ; i++) {
+		nih_local char *rotated = NULL;
+		nih_local char *index = NULL;
+
+		rotated = NIH_MUST (nih_sprintf (NULL, "%s.%d", path, i));
+		index = NIH_MUST (nih_sprintf (NULL, "%s%s", rotated,
+					       LOG_INDEX_EXT));
+
+		if (access (rotated, R_OK) < 0 || access (index, R_OK) < 0)
+			break;
+
+		NIH_MUST (nih_str_array_add (&paths, NULL, &len, rotated));
+	}
+
+	for (size_t i = 0; i < len / 2; i++) {
+		char *tmp = paths[i];
+
+		paths[i] = paths[len - 1 - i];
+		paths[len - 1 - i] = tmp;
+	}
+
+	NIH_MUST (nih_str_array_add (&paths, NULL, &len, path));
+
+	for (size_t i = 0; i < len; i++) {
+		int64_t first;
+		off_t   start;
+		off_t   end;
+
+		/* A later log beginning by the start of the range holds
+		 * all of it that this one might.
+		 */
+		if ((i + 1 < len)
+		    && (log_index_first (paths[i + 1], &first) == 0)
+		    && (first <= since))
+			continue;
+
+		if (log_index_range (paths[i], since, until, &start, &end) < 0) {
+			nih_error (_("%s: no index, start init with --log-index"),
+				   paths[i]);
+			ret = 1;
+			break;
+		}
+
+		if (start == end)
+			continue;
+
+		if (log_copy (paths[i], start, end,
+			      (i + 1 == len) && log_follow) < 0) {
+			ret = 1;
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * log_time_parse:
+ * @arg: time given on the command-line,
+ * @usec: pointer for microseconds since the epoch.
+ *
+ * Parses @arg as HH:MM[:SS] today, YYYY-MM-DD HH:MM[:SS] or @SECONDS, the
+ * former two in local time.
+ *
+ * Returns: zero on success, negative value if @arg is not a time.
+ **/
+static int
+log_time_parse (const char *arg,
+		int64_t    *usec)
+{
+	const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M",
+				  "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M",
+				  "%H:%M:%S", "%H:%M", NULL };
+	struct tm   tm;
+	time_t      now;
+	time_t      t;
+
+	nih_assert (arg != NULL);
+	nih_assert (usec != NULL);
+
+	if (arg[0] == '@') {
+		char      *endptr;
+		long long  seconds;
+
+		errno = 0;
+		seconds = strtoll (arg + 1, &endptr, 10);
+		if (errno || (! arg[1]) || *endptr)
+			return -1;
+
+		*usec = (int64_t)seconds * 1000000;
+		return 0;
+	}
+
+	for (const char **format = formats; *format; format++) {
+		const char *end;
+
+		now = time (NULL);
+		localtime_r (&now, &tm);
+
+		end = strptime (arg, *format, &tm);
+		if ((! end) || *end)
+			continue;
+
+		/* Times alone leave today's date in place */
+		if (! strchr (*format, 'S'))
+			tm.tm_sec = 0;
+		tm.tm_isdst = -1;
+
+		t = mktime (&tm);
+		if (t == (time_t)-1)
+			return -1;
+
+		*usec = (int64_t)t * 1000000;
+		return 0;
+	}
+
+	return -1;
+}
+
+/**
+ * log_index_first:
+ * @path: path of log file,
+ * @time: pointer for time of first checkpoint.
+ *
+ * Returns: zero on success, negative value if the log has no index or
+ * it is empty.
+ **/
+static int
+log_index_first (const char *path,
+		 int64_t    *time)
+{
+	nih_local char *index = NULL;
+	LogIndexEntry   entry;
+	int             fd;
+	ssize_t         ret;
+
+	nih_assert (path != NULL);
+	nih_assert (time != NULL);
+
+	index = NIH_MUST (nih_sprintf (NULL, "%s%s", path, LOG_INDEX_EXT));
+
+	fd = open (index, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	ret = pread (fd, &entry, sizeof (entry), 0);
+	close (fd);
+
+	if (ret != sizeof (entry))
+		return -1;
+
+	*time = entry.time;
+	return 0;
+}
+
+/**
+ * log_index_range:
+ * @path: path of log file,
+ * @since: earliest time of output wanted,
+ * @until: time before which output is wanted,
+ * @start: pointer for offset to read from,
+ * @end: pointer for offset to read to, or -1 for the end of the file.
+ *
+ * Searches the index of @path for the last checkpoint at or before
+ * @since and the first after @until, such that all output written
+ * between them lies between @start and @end.
+ *
+ * Returns: zero on success, negative value if the log has no index.
+ **/
+static int
+log_index_range (const char *path,
+		 int64_t     since,
+		 int64_t     until,
+		 off_t      *start,
+		 off_t      *end)
+{
+	nih_local char *index = NULL;
+	struct stat     statbuf;
+	LogIndexEntry   entry;
+	size_t          count;
+	size_t          low;
+	size_t          high;
+	int             fd;
+
+	nih_assert (path != NULL);
+	nih_assert (start != NULL);
+	nih_assert (end != NULL);
+
+	index = NIH_MUST (nih_sprintf (NULL, "%s%s", path, LOG_INDEX_EXT));
+
+	fd = open (index, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat (fd, &statbuf) < 0) {
+		close (fd);
+		return -1;
+	}
+
+	count = statbuf.st_size / sizeof (LogIndexEntry);
+
+	*start = 0;
+	*end = -1;
+
+	/* Entries are in time order, so find the first after @since and
+	 * begin at the one before it.
+	 */
+	low = 0;
+	high = count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (pread (fd, &entry, sizeof (entry),
+			   mid * sizeof (entry)) != sizeof (entry))
+			break;
+
+		if (entry.time <= since) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if (low > 0
+	    && pread (fd, &entry, sizeof (entry),
+		      (low - 1) * sizeof (entry)) == sizeof (entry))
+		*start = entry.offset;
+
+	/* Then the first after @until, which is where output ends */
+	low = 0;
+	high = count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (pread (fd, &entry, sizeof (entry),
+			   mid * sizeof (entry)) != sizeof (entry))
+			break;
+
+		if (entry.time < until) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	if (low < count
+	    && pread (fd, &entry, sizeof (entry),
+		      low * sizeof (entry)) == sizeof (entry))
+		*end = entry.offset;
+
+	close (fd);
+
+	if (*end >= 0 && *end < *start)
+		*end = *start;
+
+	return 0;
+}
+
+/**
+ * log_copy:
+ * @path: path of log file,
+ * @start: offset to read from,
+ * @end: offset to read to, or -1 for the end of the file,
+ * @follow: TRUE to wait for further output at the end of the file.
+ *
+ * Writes the part of @path between @start and @end to standard output.
+ * When following, the file is reopened from its start should it be
+ * rotated or replaced.
+ *
+ * Returns: zero on success, negative value on error.
+ **/
+static int
+log_copy (const char *path,
+	  off_t       start,
+	  off_t       end,
+	  int         follow)
+{
+	char        buf[65536];
+	struct stat statbuf;
+	struct stat pathbuf;
+	off_t       offset = start;
+	int         fd;
+
+	nih_assert (path != NULL);
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat (fd, &statbuf) < 0)
+		goto error;
+
+	fflush (stdout);
+
+	while ((end < 0) || (offset < end)) {
+		size_t  want = sizeof (buf);
+		ssize_t got;
+
+		if ((end >= 0) && ((off_t)want > end - offset))
+			want = end - offset;
+
+		got = pread (fd, buf, want, offset);
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0)
+			goto error;
+
+		if (got > 0) {
+			for (ssize_t done = 0, wlen; done < got; done += wlen) {
+				wlen = write (STDOUT_FILENO, buf + done,
+					      got - done);
+				if (wlen < 0 && errno == EINTR) {
+					wlen = 0;
+				} else if (wlen < 0) {
+					close (fd);
+					return -1;
+				}
+			}
+
+			offset += got;
+			continue;
+		}
+
+		if (! follow)
+			break;
+
+		/* Rotated away or replaced: start on the new file */
+		if ((stat (path, &pathbuf) == 0)
+		    && ((pathbuf.st_ino != statbuf.st_ino)
+			|| (pathbuf.st_dev != statbuf.st_dev))) {
+			close (fd);
+
+			fd = open (path, O_RDONLY | O_CLOEXEC);
+			if (fd < 0 || fstat (fd, &statbuf) < 0)
+				goto error;
+
+			offset = 0;
+			continue;
+		}
+
+		usleep (250000);
+	}
+
+	close (fd);
+	return 0;
+
+error:
+	nih_error ("%s: %s", path, strerror (errno));
+	if (fd >= 0)
+		close (fd);
+	return -1;
+}
+
+/**
+ * boot_trace_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "boot-trace" command.
+ *
+ * Outputs the job timeline kept by the init daemon in the Trace Event
+ * Format read by chrome://tracing and similar viewers, with a track for
+ * each instance holding a span for each state it passed through and each
+ * process it spawned, the latter lasting until the process was exec'd,
+ * and a mark across all tracks for each event.
+ *
+ * Returns: command exit status.
+ **/
+int
+boot_trace_action (NihCommand *  command,
+		   char * const *args)
+{
+	nih_local NihDBusProxy *                         upstart = NULL;
+	nih_local UpstartGetJobTimelineRecordsElement ** records = NULL;
+	nih_local char **                                events = NULL;
+	NihError *                                       err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_job_timeline_sync (NULL, upstart, &records) < 0)
+		goto error;
+
+	events = nih_str_array_new (NULL);
+	if (! events)
+		goto enomem;
+
+	for (size_t i = 0; records[i]; i++) {
+		UpstartGetJobTimelineRecordsElement *record = records[i];
+		UpstartGetJobTimelineRecordsElement *end = NULL;
+		nih_local char *                     name = NULL;
+		nih_local char *                     event = NULL;
+		size_t                               tid;
+
+		/* Events are shown across all tracks */
+		if (! strcmp (record->item3, "event")) {
+			name = boot_trace_quote (NULL, record->item1);
+			if (! name)
+				goto enomem;
+
+			event = nih_sprintf (NULL, "{\"name\": %s, \"cat\": \"event\", "
+					     "\"ph\": \"i\", \"s\": \"g\", "
+					     "\"pid\": 1, \"tid\": 0, "
+					     "\"ts\": %llu}",
+					     name, (unsigned long long)record->item0);
+			if ((! event) || (! nih_str_array_addp (&events, NULL,
+								NULL, event)))
+				goto enomem;
+
+			event = NULL;
+			continue;
+		}
+
+		/* Each instance is its own track, numbered by the first
+		 * record seen for it, which also names the track.
+		 */
+		for (tid = 0; ! boot_trace_same (records[tid], record); tid++)
+			;
+
+		if (tid == i) {
+			nih_local char *track = NULL;
+
+			track = (*record->item2
+				 ? nih_sprintf (NULL, "%s (%s)", record->item1,
+						record->item2)
+				 : nih_strdup (NULL, record->item1));
+			if (! track)
+				goto enomem;
+
+			name = boot_trace_quote (NULL, track);
+			if (! name)
+				goto enomem;
+
+			event = nih_sprintf (NULL, "{\"name\": \"thread_name\", "
+					     "\"ph\": \"M\", \"pid\": 1, "
+					     "\"tid\": %zu, "
+					     "\"args\": {\"name\": %s}}",
+					     tid + 1, name);
+			if ((! event) || (! nih_str_array_addp (&events, NULL,
+								NULL, event)))
+				goto enomem;
+
+			nih_discard (name);
+			name = NULL;
+			event = NULL;
+		}
+
+		/* A state lasts until the next state of the same instance,
+		 * a spawn until the process is exec'd; spans are not shown
+		 * for waiting, nor for exec records themselves.
+		 */
+		if (! strcmp (record->item3, "state")) {
+			if (! strcmp (record->item4, "waiting"))
+				continue;
+
+			for (size_t j = i + 1; records[j]; j++) {
+				if (boot_trace_same (records[j], record)
+				    && (! strcmp (records[j]->item3, "state"))) {
+					end = records[j];
+					break;
+				}
+			}
+
+			name = boot_trace_quote (NULL, record->item4);
+		} else if (! strcmp (record->item3, "spawn")) {
+			nih_local char *spawn = NULL;
+
+			for (size_t j = i + 1; records[j]; j++) {
+				if ((! boot_trace_same (records[j], record))
+				    || strcmp (records[j]->item4, record->item4))
+					continue;
+
+				if (! strcmp (records[j]->item3, "exec"))
+					end = records[j];
+				break;
+			}
+
+			spawn = nih_sprintf (NULL, "%s spawn", record->item4);
+			if (! spawn)
+				goto enomem;
+
+			name = boot_trace_quote (NULL, spawn);
+		} else {
+			continue;
+		}
+
+		if (! name)
+			goto enomem;
+
+		if (end) {
+			event = nih_sprintf (NULL, "{\"name\": %s, \"cat\": \"%s\", "
+					     "\"ph\": \"X\", \"pid\": 1, "
+					     "\"tid\": %zu, \"ts\": %llu, "
+					     "\"dur\": %llu}",
+					     name, record->item3, tid + 1,
+					     (unsigned long long)record->item0,
+					     (unsigned long long)(end->item0
+								  - record->item0));
+		} else {
+			event = nih_sprintf (NULL, "{\"name\": %s, \"cat\": \"%s\", "
+					     "\"ph\": \"i\", \"s\": \"t\", "
+					     "\"pid\": 1, \"tid\": %zu, "
+					     "\"ts\": %llu}",
+					     name, record->item3, tid + 1,
+					     (unsigned long long)record->item0);
+		}
+
+		if ((! event) || (! nih_str_array_addp (&events, NULL,
+							NULL, event)))
+			goto enomem;
+
+		event = NULL;
+	}
+
+	nih_message ("{\"traceEvents\": [");
+
+	for (char **event = events; event && *event; event++)
+		nih_message ("%s%s", *event, *(event + 1) ? "," : "");
+
+	nih_message ("]}");
+
+	return 0;
+
+enomem:
+	nih_error_raise_no_memory ();
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * boot_trace_quote:
+ * @parent: parent object for new string,
+ * @str: string to quote.
+ *
+ * Returns: newly allocated JSON string literal of @str, or NULL if
+ * insufficient memory.
+ **/
+static char *
+boot_trace_quote (const void *parent,
+		  const char *str)
+{
+	char *quoted;
+
+	nih_assert (str != NULL);
+
+	quoted = nih_strdup (parent, "\"");
+	if (! quoted)
+		return NULL;
+
+	for (const char *c = str; *c; c++) {
+		int ok;
+
+		if ((*c == '"') || (*c == '\\')) {
+			ok = nih_strcat_sprintf (&quoted, parent, "\\%c", *c) != NULL;
+		} else if ((unsigned char)*c < 0x20) {
+			ok = nih_strcat_sprintf (&quoted, parent, "\\u%04x",
+						 (unsigned char)*c) != NULL;
+		} else {
+			ok = nih_strcat_sprintf (&quoted, parent, "%c", *c) != NULL;
+		}
+
+		if (! ok) {
+			nih_free (quoted);
+			return NULL;
+		}
+	}
+
+	if (! nih_strcat (&quoted, parent, "\"")) {
+		nih_free (quoted);
+		return NULL;
+	}
+
+	return quoted;
+}
+
+/**
+ * boot_trace_same:
+ * @a: timeline record,
+ * @b: timeline record.
+ *
+ * Returns: TRUE if @a and @b are records of the same instance, FALSE
+ * if they are not or either is the record of an event.
+ **/
+static int
+boot_trace_same (UpstartGetJobTimelineRecordsElement *a,
+		 UpstartGetJobTimelineRecordsElement *b)
+{
+	nih_assert (a != NULL);
+	nih_assert (b != NULL);
+
+	return (strcmp (a->item3, "event")
+		&& strcmp (b->item3, "event")
+		&& (! strcmp (a->item1, b->item1))
+		&& (! strcmp (a->item2, b->item2)));
+}
+
+
+/**
+ * critical_path_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "critical-path" command.
+ *
+ * Starting from the first time the job named in @args started, or the
+ * event named was emitted (by default the runlevel event), walks back
+ * through the job timeline kept by the init daemon to what caused it:
+ * a job is caused by the operand of its start on condition that was
+ * satisfied last, its state by its own starting state and an event by
+ * the most recently changed job class that emits it.  The chain is
+ * output oldest first, with the delay added by each step, followed by
+ * the step that added the most.
+ *
+ * Returns: command exit status.
+ **/
+int
+critical_path_action (NihCommand *  command,
+		      char * const *args)
+{
+	nih_local NihDBusProxy *                         upstart = NULL;
+	nih_local UpstartGetJobTimelineRecordsElement ** records = NULL;
+	nih_local char **                                job_class_paths = NULL;
+	nih_local NihHash *                              classes = NULL;
+	nih_local int *                                  steps = NULL;
+	const char *                                     target;
+	int                                              num_steps = 0;
+	int                                              longest = -1;
+	uint64_t                                         longest_delay = 0;
+	int                                              index = -1;
+	int                                              is_job;
+	NihError *                                       err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	target = args[0] ? args[0] : "runlevel";
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_get_job_timeline_sync (NULL, upstart, &records) < 0)
+		goto error;
+
+	if (upstart_get_all_jobs_sync (NULL, upstart, &job_class_paths) < 0)
+		goto error;
+
+	classes = nih_hash_string_new (NULL, 0);
+	if (! classes)
+		goto enomem;
+
+	for (char **job_class_path = job_class_paths;
+	     job_class_path && *job_class_path; job_class_path++) {
+		nih_local NihDBusProxy *job_class = NULL;
+		CriticalPathClass *     class;
+
+		job_class = nih_dbus_proxy_new (NULL, upstart->connection,
+						upstart->name, *job_class_path,
+						NULL, NULL);
+		if (! job_class)
+			goto error;
+
+		job_class->auto_start = FALSE;
+
+		class = nih_new (classes, CriticalPathClass);
+		if (! class)
+			goto enomem;
+
+		nih_list_init (&class->entry);
+		nih_alloc_set_destructor (class, nih_list_destroy);
+
+		if ((job_class_get_name_sync (class, job_class, &class->name) < 0)
+		    || (job_class_get_start_on_sync (class, job_class,
+						     &class->start_on) < 0)
+		    || (job_class_get_emits_sync (class, job_class,
+						  &class->emits) < 0)) {
+			nih_free (class);
+			goto error;
+		}
+
+		nih_hash_add (classes, &class->entry);
+	}
+
+	/* The target is when the job first started or the event was first
+	 * emitted.
+	 */
+	is_job = (nih_hash_lookup (classes, target) != NULL);
+
+	for (int i = 0; records[i]; i++) {
+		if (is_job
+		    ? ((! strcmp (records[i]->item3, "state"))
+		       && (! strcmp (records[i]->item1, target))
+		       && (! strcmp (records[i]->item4, "running")))
+		    : ((! strcmp (records[i]->item3, "event"))
+		       && (! strcmp (records[i]->item1, target)))) {
+			index = i;
+			break;
+		}
+	}
+
+	if (index < 0) {
+		nih_error (_("%s: not found in job timeline"), target);
+		return 1;
+	}
+
+	/* Causes are always earlier records, so the walk must end */
+	steps = nih_alloc (NULL, sizeof (int) * (index + 1));
+	if (! steps)
+		goto enomem;
+
+	while (index >= 0) {
+		steps[num_steps++] = index;
+		index = critical_path_cause (records, classes, index);
+	}
+
+	for (int i = num_steps - 1; i >= 0; i--) {
+		UpstartGetJobTimelineRecordsElement *record = records[steps[i]];
+		nih_local char *                     step = NULL;
+		uint64_t                             delay;
+
+		delay = ((i < num_steps - 1)
+			 ? record->item0 - records[steps[i + 1]]->item0
+			 : 0);
+
+		if ((i < num_steps - 1) && ((longest < 0)
+					    || (delay > longest_delay))) {
+			longest = steps[i];
+			longest_delay = delay;
+		}
+
+		step = critical_path_step (NULL, record);
+		if (! step)
+			goto enomem;
+
+		nih_message ("%llu.%03llus\t+%llu.%03llus\t%s",
+			     (unsigned long long)(record->item0 / 1000000),
+			     (unsigned long long)(record->item0 / 1000 % 1000),
+			     (unsigned long long)(delay / 1000000),
+			     (unsigned long long)(delay / 1000 % 1000),
+			     step);
+	}
+
+	if (longest >= 0) {
+		nih_local char *step = NULL;
+
+		step = critical_path_step (NULL, records[longest]);
+		if (! step)
+			goto enomem;
+
+		nih_message (_("longest delay: %s (+%llu.%03llus)"), step,
+			     (unsigned long long)(longest_delay / 1000000),
+			     (unsigned long long)(longest_delay / 1000 % 1000));
+	}
+
+	return 0;
+
+enomem:
+	nih_error_raise_no_memory ();
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * critical_path_find:
+ * @records: job timeline,
+ * @limit: index to search before,
+ * @type: type of record,
+ * @job: name of job class or event, or NULL for any,
+ * @instance: name of instance, or NULL for any,
+ * @value: state or process of record, or NULL for any.
+ *
+ * Returns: index of the latest record in @records before @limit that
+ * matches, or -1 if none do.
+ **/
+static int
+critical_path_find (UpstartGetJobTimelineRecordsElement **records,
+		    int                                   limit,
+		    const char *                          type,
+		    const char *                          job,
+		    const char *                          instance,
+		    const char *                          value)
+{
+	nih_assert (records != NULL);
+	nih_assert (type != NULL);
+
+	for (int i = limit - 1; i >= 0; i--) {
+		if (strcmp (records[i]->item3, type))
+			continue;
+		if (job && strcmp (records[i]->item1, job))
+			continue;
+		if (instance && strcmp (records[i]->item2, instance))
+			continue;
+		if (value && strcmp (records[i]->item4, value))
+			continue;
+
+		return i;
+	}
+
+	return -1;
+}
+
+/**
+ * critical_path_cause:
+ * @records: job timeline,
+ * @classes: hash of CriticalPathClass,
+ * @index: index of record in @records.
+ *
+ * Returns: index of the record in @records that caused the one at
+ * @index, or -1 if it is not known.
+ **/
+static int
+critical_path_cause (UpstartGetJobTimelineRecordsElement **records,
+		     NihHash *                             classes,
+		     int                                   index)
+{
+	UpstartGetJobTimelineRecordsElement *record;
+	CriticalPathClass *                  class;
+	int                                  cause = -1;
+
+	nih_assert (records != NULL);
+	nih_assert (classes != NULL);
+
+	record = records[index];
+
+	if (! strcmp (record->item3, "event")) {
+		/* Assume the event came from whichever job class that
+		 * emits it changed state most recently.
+		 */
+		NIH_HASH_FOREACH (classes, iter) {
+			class = (CriticalPathClass *)iter;
+
+			for (char **emit = class->emits; emit && *emit; emit++) {
+				int found;
+
+				if (strcmp (*emit, record->item1))
+					continue;
+
+				found = critical_path_find (records, index, "state",
+							    class->name, NULL, NULL);
+				if (found > cause)
+					cause = found;
+				break;
+			}
+		}
+
+		return cause;
+	}
+
+	if (strcmp (record->item3, "state"))
+		return -1;
+
+	if (strcmp (record->item4, "starting"))
+		return critical_path_find (records, index, "state",
+					   record->item1, record->item2,
+					   "starting");
+
+	class = (CriticalPathClass *)nih_hash_lookup (classes, record->item1);
+	if (! class)
+		return -1;
+
+	return critical_path_condition (records, index,
+					(char ** const *)class->start_on);
+}
+
+/**
+ * critical_path_condition:
+ * @records: job timeline,
+ * @limit: index to search before,
+ * @start_on: start on condition in Reverse Polish Notation.
+ *
+ * Evaluates @start_on against the records in @records before @limit;
+ * the matching record of each operand is the latest before @limit, an
+ * "and" is satisfied by the later of its operands and an "or" by the
+ * earlier of those satisfied.
+ *
+ * Returns: index of the record in @records that satisfied @start_on, or
+ * -1 if it was not satisfied.
+ **/
+static int
+critical_path_condition (UpstartGetJobTimelineRecordsElement **records,
+			 int                                   limit,
+			 char ** const *                       start_on)
+{
+	nih_local int *stack = NULL;
+	size_t         depth = 0;
+	size_t         len = 0;
+
+	nih_assert (records != NULL);
+
+	for (char ** const *variant = start_on; variant && *variant; variant++)
+		len++;
+
+	if (! len)
+		return -1;
+
+	stack = NIH_MUST (nih_alloc (NULL, sizeof (int) * len));
+
+	for (char ** const *variant = start_on; variant && *variant; variant++) {
+		const char *token = **variant;
+
+		if (IS_OPERATOR (token)) {
+			int first, second;
+
+			nih_assert (depth >= 2);
+
+			first = stack[--depth];
+			second = stack[--depth];
+
+			if (IS_OP_AND (token)) {
+				stack[depth++] = ((first < 0) || (second < 0)
+						  ? -1
+						  : (first > second ? first : second));
+			} else {
+				stack[depth++] = (first < 0 ? second
+						  : second < 0 ? first
+						  : (first < second ? first : second));
+			}
+		} else if (IS_JOB_EVENT (token)) {
+			const char *state;
+			char *      name = NULL;
+
+			for (int i = 0; (*variant)[i + 1] && (! name); i++)
+				GET_JOB_NAME (name, i, (*variant)[i + 1]);
+
+			state = (! strcmp (token, JOB_STARTING_EVENT) ? "starting"
+				 : ! strcmp (token, JOB_STARTED_EVENT) ? "running"
+				 : ! strcmp (token, JOB_STOPPING_EVENT) ? "stopping"
+				 : "waiting");
+
+			stack[depth++] = critical_path_find (records, limit, "state",
+							     name, NULL, state);
+		} else {
+			stack[depth++] = critical_path_find (records, limit, "event",
+							     token, NULL, NULL);
+		}
+	}
+
+	nih_assert (depth == 1);
+
+	return stack[0];
+}
+
+/**
+ * critical_path_step:
+ * @parent: parent object for new string,
+ * @record: timeline record.
+ *
+ * Returns: newly allocated description of @record, or NULL if
+ * insufficient memory.
+ **/
+static char *
+critical_path_step (const void *                         parent,
+		    UpstartGetJobTimelineRecordsElement *record)
+{
+	nih_assert (record != NULL);
+
+	if (! strcmp (record->item3, "event"))
+		return nih_sprintf (parent, "event %s", record->item1);
+
+	if (*record->item2)
+		return nih_sprintf (parent, "%s (%s) %s", record->item1,
+				    record->item2, record->item4);
+
+	return nih_sprintf (parent, "%s %s", record->item1, record->item4);
+}
+
+
+/**
+ * log_priority_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "log-priority" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+log_priority_action (NihCommand *  command,
+		     char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	NihError *              err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (args[0]) {
+		if (upstart_set_log_priority_sync (NULL, upstart, args[0]) < 0)
+			goto error;
+	} else {
+		nih_local char *log_priority = NULL;
+
+		if (upstart_get_log_priority_sync (NULL, upstart,
+						   &log_priority) < 0)
+			goto error;
+
+		nih_message ("%s", log_priority);
+	}
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+
+/**
+ * check_config_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "check-config" command.
+ *
+ * Requests the dependency graph of the loaded jobs from the init daemon,
+ * which has already found the events and jobs named by their start on
+ * and stop on conditions that no job emits or defines, and outputs them
+ * under the name of each job, or just the job given.
+ *
+ * Returns: command exit status.
+ **/
+int
+check_config_action (NihCommand *command,
+		char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local char         *job_class_path = NULL;
+	nih_local UpstartGetDependencyGraphEmitsElement **emits = NULL;
+	nih_local UpstartGetDependencyGraphConsumesElement **consumes = NULL;
+	nih_local UpstartGetDependencyGraphUnreachableElement **unreachable = NULL;
+	const char             *job_class = NULL;
+	const char             *displayed = NULL;
+	int                     ret = 0;
+	NihError               *err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (args[0]) {
+		job_class = args[0];
+
+		if (upstart_get_job_by_name_sync (NULL, upstart, job_class,
+						  &job_class_path) < 0) {
+			err = nih_error_get ();
+			nih_free (err);
+
+			nih_error ("%s: %s", _("Invalid job class"), job_class);
+			return 1;
+		}
+	}
+
+	if (! check_config_ignored_events)
+		check_config_ignored_events = NIH_MUST (nih_str_array_new (NULL));
+
+	if (upstart_get_dependency_graph_sync (NULL, upstart,
+					       check_config_ignored_events,
+					       check_config_warn, &emits,
+					       &consumes, &unreachable) < 0)
+		goto error;
+
+	for (UpstartGetDependencyGraphUnreachableElement **u = unreachable;
+	     u && *u; u++) {
+		if (job_class && strcmp (job_class, (*u)->item0))
+			continue;
+
+		if ((! displayed) || strcmp (displayed, (*u)->item0)) {
+			nih_message ("%s", (*u)->item0);
+			displayed = (*u)->item0;
+		}
+
+		nih_message ("  %s: %s %s", (*u)->item1,
+			     strcmp ((*u)->item2, "job")
+			     ? _("unknown event") : _("unknown job"),
+			     (*u)->item3);
+		ret = 1;
+	}
+
+	return ret;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * graph_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "graph" command.
+ *
+ * Requests the dependency graph of the loaded jobs from the init daemon
+ * and outputs it in the format given by the --format option.  Each job
+ * named in @args, or otherwise event, limits the output to itself and
+ * everything that must happen before it: the jobs and events named by
+ * the start on condition of a job, the jobs emitting an event, and so on.
+ *
+ * Returns: command exit status.
+ **/
+int
+graph_action (NihCommand *command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	nih_local UpstartGetDependencyGraphEmitsElement **emits = NULL;
+	nih_local UpstartGetDependencyGraphConsumesElement **consumes = NULL;
+	nih_local UpstartGetDependencyGraphUnreachableElement **unreachable = NULL;
+	nih_local char        **no_events = NULL;
+	nih_local NihHash      *nodes = NULL;
+	nih_local GraphNode   **order = NULL;
+	nih_local GraphEdge    *edges = NULL;
+	size_t                  order_len = 0;
+	size_t                  edges_len = 0;
+	size_t                  patterns_len;
+	int                     changed;
+	NihError               *err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (strcmp (graph_format, "dot") && strcmp (graph_format, "json")) {
+		fprintf (stderr, _("%s: invalid format: %s\n"),
+			 program_name, graph_format);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	no_events = nih_str_array_new (NULL);
+	if (! no_events)
+		goto enomem;
+
+	if (upstart_get_dependency_graph_sync (NULL, upstart, no_events, FALSE,
+					       &emits, &consumes,
+					       &unreachable) < 0)
+		goto error;
+
+	nodes = nih_hash_string_new (NULL, 0);
+	if (! nodes)
+		goto enomem;
+
+	for (UpstartGetDependencyGraphEmitsElement **e = emits;
+	     e && *e; e++) {
+		GraphNode *job, *event;
+
+		job = graph_node (nodes, &order, &order_len, TRUE, (*e)->item0);
+		event = graph_node (nodes, &order, &order_len, FALSE, (*e)->item1);
+		if ((! job) || (! event))
+			goto enomem;
+
+		if (graph_edge (&edges, &edges_len, job, event,
+				"emits", NULL) < 0)
+			goto enomem;
+	}
+
+	/* A condition on starting, started, stopping or stopped of a job
+	 * is an edge from that job, labelled with the event.
+	 */
+	for (UpstartGetDependencyGraphConsumesElement **c = consumes;
+	     c && *c; c++) {
+		GraphNode *job, *from;
+
+		job = graph_node (nodes, &order, &order_len, TRUE, (*c)->item0);
+		from = (*(*c)->item3
+			? graph_node (nodes, &order, &order_len, TRUE, (*c)->item3)
+			: graph_node (nodes, &order, &order_len, FALSE, (*c)->item2));
+		if ((! job) || (! from))
+			goto enomem;
+
+		if (graph_edge (&edges, &edges_len, from, job, (*c)->item1,
+				*(*c)->item3 ? (*c)->item2 : NULL) < 0)
+			goto enomem;
+	}
+
+	/* Join each pattern a job emits to the events that it matches */
+	patterns_len = order_len;
+	for (size_t i = 0; i < patterns_len; i++) {
+		if (! order[i]->glob)
+			continue;
+
+		for (size_t j = 0; j < patterns_len; j++) {
+			if (order[j]->job || order[j]->glob
+			    || fnmatch (order[i]->name, order[j]->name, 0))
+				continue;
+
+			if (graph_edge (&edges, &edges_len, order[i], order[j],
+					"matches", NULL) < 0)
+				goto enomem;
+		}
+	}
+
+	/* Without arguments the whole graph is output; otherwise only
+	 * the nodes upstream of those named, found by following edges
+	 * backwards until no more are added.  Stop on conditions are not
+	 * followed since they do not need to be met for a job to start.
+	 */
+	for (size_t i = 0; i < order_len; i++)
+		order[i]->kept = ! args[0];
+
+	for (char * const *arg = args; *arg; arg++) {
+		nih_local char *job_class_path = NULL;
+		GraphNode      *node;
+		int             job;
+
+		job = upstart_get_job_by_name_sync (NULL, upstart, *arg,
+						    &job_class_path) == 0;
+		if (! job) {
+			err = nih_error_get ();
+			nih_free (err);
+		}
+
+		node = graph_node (nodes, &order, &order_len, job, *arg);
+		if (! node)
+			goto enomem;
+
+		node->kept = TRUE;
+	}
+
+	do {
+		changed = FALSE;
+
+		for (size_t i = 0; i < edges_len; i++) {
+			if ((! edges[i].to->kept) || edges[i].from->kept
+			    || (! strcmp (edges[i].type, "stop on")))
+				continue;
+
+			edges[i].from->kept = TRUE;
+			changed = TRUE;
+		}
+	} while (changed);
+
+	if (! strcmp (graph_format, "json")) {
+		graph_json (order, order_len, edges, edges_len);
+	} else {
+		graph_dot (order, order_len, edges, edges_len);
+	}
+
+	return 0;
+
+enomem:
+	nih_error_raise_no_memory ();
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+/**
+ * graph_node:
+ * @nodes: hash of nodes,
+ * @order: pointer to array of nodes in the order they were found,
+ * @order_len: pointer to length of @order,
+ * @job: TRUE if @name is a job, FALSE if an event,
+ * @name: name of job or event.
+ *
+ * Look up the node for the job or event @name in @nodes, adding it to
+ * both @nodes and @order if not found.
+ *
+ * Returns: node, or NULL if insufficient memory.
+ **/
+static GraphNode *
+graph_node (NihHash      *nodes,
+	    GraphNode  ***order,
+	    size_t       *order_len,
+	    int           job,
+	    const char   *name)
+{
+	nih_local char *key = NULL;
+	GraphNode      *node;
+	GraphNode     **new_order;
+
+	nih_assert (nodes != NULL);
+	nih_assert (order != NULL);
+	nih_assert (order_len != NULL);
+	nih_assert (name != NULL);
+
+	key = nih_sprintf (NULL, "%s:%s", job ? "job" : "event", name);
+	if (! key)
+		return NULL;
+
+	node = (GraphNode *)nih_hash_lookup (nodes, key);
+	if (node)
+		return node;
+
+	new_order = nih_realloc (*order, NULL,
+				 sizeof (GraphNode *) * (*order_len + 1));
+	if (! new_order)
+		return NULL;
+	*order = new_order;
+
+	node = nih_new (nodes, GraphNode);
+	if (! node)
+		return NULL;
+
+	nih_list_init (&node->entry);
+	nih_alloc_set_destructor (node, nih_list_destroy);
+
+	node->key = nih_strdup (node, key);
+	node->name = nih_strdup (node, name);
+	if ((! node->key) || (! node->name)) {
+		nih_free (node);
+		return NULL;
+	}
+
+	node->job = job;
+	node->glob = (! job) && strpbrk (name, "*?[");
+	node->index = *order_len;
+	node->kept = FALSE;
+
+	nih_hash_add (nodes, &node->entry);
+
+	(*order)[(*order_len)++] = node;
+
+	return node;
+}
+
+/**
+ * graph_edge:
+ * @edges: pointer to array of edges,
+ * @edges_len: pointer to length of @edges,
+ * @from: node that leads to @to,
+ * @to: node that depends on @from,
+ * @type: type of edge,
+ * @event: event of @from when both nodes are jobs, or NULL.
+ *
+ * Append an edge to @edges; @type and @event are not copied.
+ *
+ * Returns: zero on success, negative value if insufficient memory.
+ **/
+static int
+graph_edge (GraphEdge  **edges,
+	    size_t      *edges_len,
+	    GraphNode   *from,
+	    GraphNode   *to,
+	    const char  *type,
+	    const char  *event)
+{
+	GraphEdge *new_edges;
+
+	nih_assert (edges != NULL);
+	nih_assert (edges_len != NULL);
+	nih_assert (from != NULL);
+	nih_assert (to != NULL);
+	nih_assert (type != NULL);
+
+	new_edges = nih_realloc (*edges, NULL,
+				 sizeof (GraphEdge) * (*edges_len + 1));
+	if (! new_edges)
+		return -1;
+	*edges = new_edges;
+
+	(*edges)[*edges_len].from = from;
+	(*edges)[*edges_len].to = to;
+	(*edges)[*edges_len].type = type;
+	(*edges)[*edges_len].event = event;
+	(*edges_len)++;
+
+	return 0;
+}
+
+/**
+ * graph_dot:
+ * @order: array of nodes,
+ * @order_len: length of @order,
+ * @edges: array of edges,
+ * @edges_len: length of @edges.
+ *
+ * Output the kept nodes and the edges between them in the DOT language
+ * read by dot(1), coloured as by initctl2dot: jobs are boxes, events
+ * diamonds, dotted for patterns, with emits edges green, start on edges
+ * blue and stop on edges red.
+ **/
+static void
+graph_dot (GraphNode **order,
+	   size_t      order_len,
+	   GraphEdge  *edges,
+	   size_t      edges_len)
+{
+	nih_message ("digraph upstart {");
+	nih_message ("  rankdir=LR;");
+
+	/* DOT and JSON quote strings alike, and names of jobs and
+	 * events contain no control characters.
+	 */
+	for (size_t i = 0; i < order_len; i++) {
+		nih_local char *key = NULL;
+		nih_local char *name = NULL;
+
+		if (! order[i]->kept)
+			continue;
+
+		key = NIH_MUST (boot_trace_quote (NULL, order[i]->key));
+		name = NIH_MUST (boot_trace_quote (NULL, order[i]->name));
+
+		nih_message ("  %s [label=%s, shape=%s, style=%s];", key, name,
+			     order[i]->job ? "box" : "diamond",
+			     order[i]->glob ? "dotted" : "filled");
+	}
+
+	for (size_t i = 0; i < edges_len; i++) {
+		nih_local char *from = NULL;
+		nih_local char *to = NULL;
+		nih_local char *event = NULL;
+		const char     *attrs;
+
+		if ((! edges[i].from->kept) || (! edges[i].to->kept))
+			continue;
+
+		from = NIH_MUST (boot_trace_quote (NULL, edges[i].from->key));
+		to = NIH_MUST (boot_trace_quote (NULL, edges[i].to->key));
+
+		if (! strcmp (edges[i].type, "emits")) {
+			attrs = "color=green";
+		} else if (! strcmp (edges[i].type, "start on")) {
+			attrs = "color=blue";
+		} else if (! strcmp (edges[i].type, "stop on")) {
+			attrs = "color=red";
+		} else {
+			attrs = "style=dotted";
+		}
+
+		if (edges[i].event) {
+			event = NIH_MUST (boot_trace_quote (NULL, edges[i].event));
+			nih_message ("  %s -> %s [%s, label=%s];", from, to,
+				     attrs, event);
+		} else {
+			nih_message ("  %s -> %s [%s];", from, to, attrs);
+		}
+	}
+
+	nih_message ("}");
+}
+
+/**
+ * graph_json:
+ * @order: array of nodes,
+ * @order_len: length of @order,
+ * @edges: array of edges,
+ * @edges_len: length of @edges.
+ *
+ * Output the kept nodes and the edges between them as a JSON object,
+ * with each edge naming its nodes by their position in the "nodes"
+ * array.
+ **/
+static void
+graph_json (GraphNode **order,
+	    size_t      order_len,
+	    GraphEdge  *edges,
+	    size_t      edges_len)
+{
+	nih_local size_t *position = NULL;
+	size_t            kept = 0;
+	int               first = TRUE;
+
+	position = NIH_MUST (nih_alloc (NULL, sizeof (size_t) * (order_len + 1)));
+
+	nih_message ("{\"nodes\": [");
+
+	for (size_t i = 0; i < order_len; i++) {
+		nih_local char *name = NULL;
+
+		if (! order[i]->kept)
+			continue;
+
+		name = NIH_MUST (boot_trace_quote (NULL, order[i]->name));
+
+		nih_message ("%s{\"type\": \"%s\", \"name\": %s}",
+			     kept ? "," : "",
+			     order[i]->job ? "job" : "event", name);
+
+		position[i] = kept++;
+	}
+
+	nih_message ("], \"edges\": [");
+
+	for (size_t i = 0; i < edges_len; i++) {
+		nih_local char *quoted = NULL;
+		nih_local char *event = NULL;
+
+		if ((! edges[i].from->kept) || (! edges[i].to->kept))
+			continue;
+
+		if (edges[i].event) {
+			quoted = NIH_MUST (boot_trace_quote (NULL, edges[i].event));
+			event = NIH_MUST (nih_sprintf (NULL, ", \"event\": %s",
+						       quoted));
+		}
+
+		nih_message ("%s{\"from\": %zu, \"to\": %zu, \"type\": \"%s\"%s}",
+			     first ? "" : ",",
+			     position[edges[i].from->index],
+			     position[edges[i].to->index],
+			     edges[i].type, event ? event : "");
+		first = FALSE;
+	}
+
+	nih_message ("]}");
+}
+
+/**
+ * notify_disk_writeable_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "notify-disk-writeable" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+notify_disk_writeable_action (NihCommand *command,
+		char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	NihError *              err;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	if (upstart_notify_disk_writeable_sync (NULL, upstart) < 0)
+		goto error;
+
+	return 0;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+
+	return 1;
+}
+
+
+/**
+ * notify_dbus_address_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "notify-dbus-address" command.
+ *
+ * Returns: command exit status.
+ **/
+int
+notify_dbus_address_action (NihCommand    *command,
+			    char * const  *args)
+{
+	nih_local NihDBusProxy   *upstart = NULL;
+	NihError                 *err;
+	char                     *address = NULL;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (! args[0]) {
+		fprintf (stderr, _("%s: missing D-Bus address\n"), program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
 
 	address = args[0];
 
@@ -2234,11 +4583,224 @@ error_handler (void *          data,
 {
 	NihError *err;
 
-	nih_assert (message != NULL);
+	nih_assert (message != NULL);
+
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+}
+
+/**
+ * batch_request_add:
+ * @requests: list of requests,
+ * @upstart: proxy for the manager object,
+ * @args: command, job name and environment.
+ *
+ * Appends a new request to @requests to run the command given as the
+ * first element of @args for the job named by the second, with the
+ * remaining elements as its environment.
+ *
+ * An unknown command or missing job name is reported to the user.
+ *
+ * Returns: new request or NULL if @args were invalid.
+ **/
+static BatchRequest *
+batch_request_add (NihList *     requests,
+		   NihDBusProxy *upstart,
+		   char * const *args)
+{
+	BatchRequest *req;
+	size_t        len = 0;
+
+	nih_assert (requests != NULL);
+	nih_assert (upstart != NULL);
+	nih_assert (args != NULL);
+	nih_assert (args[0] != NULL);
+
+	if (strcmp (args[0], "start")
+	    && strcmp (args[0], "stop")
+	    && strcmp (args[0], "restart")) {
+		fprintf (stderr, _("%s: invalid batch command: %s\n"),
+			 program_name, args[0]);
+		nih_main_suggest_help ();
+		return NULL;
+	}
+
+	if (! args[1]) {
+		fprintf (stderr, _("%s: missing job name\n"), program_name);
+		nih_main_suggest_help ();
+		return NULL;
+	}
+
+	req = NIH_MUST (nih_new (requests, BatchRequest));
+
+	nih_list_init (&req->entry);
+
+	req->upstart = upstart;
+	req->command = NIH_MUST (nih_strdup (req, args[0]));
+	req->name = NIH_MUST (nih_strdup (req, args[1]));
+
+	req->env = NIH_MUST (nih_str_array_new (req));
+	for (char * const *arg = &args[2]; *arg; arg++)
+		NIH_MUST (nih_str_array_add (&req->env, req, &len, *arg));
+
+	req->job_class = NULL;
+	req->ret = 1;
+
+	nih_list_add (requests, &req->entry);
+
+	return req;
+}
+
+/**
+ * batch_request_send:
+ * @req: request to send.
+ *
+ * Makes the asynchronous method call to look up the job of @req, the
+ * reply to which is handled by batch_job_reply_handler().
+ **/
+static void
+batch_request_send (BatchRequest *req)
+{
+	DBusPendingCall *pending_call;
+	NihError *       err;
+
+	nih_assert (req != NULL);
+
+	pending_call = upstart_get_job_by_name (req->upstart, req->name,
+						(UpstartGetJobByNameReply)batch_job_reply_handler,
+						batch_error_handler, req,
+						NIH_DBUS_TIMEOUT_NEVER);
+	if (! pending_call) {
+		err = nih_error_get ();
+		nih_error ("%s", err->message);
+		nih_free (err);
+		return;
+	}
+
+	/* The connection keeps its own reference until the reply arrives */
+	dbus_pending_call_unref (pending_call);
+	batch_pending++;
+}
+
+/**
+ * batch_job_reply_handler:
+ * @req: request,
+ * @message: D-Bus message received,
+ * @job_class_path: path of job class.
+ *
+ * Called with the path of the job class of @req, makes the asynchronous
+ * method call to start, stop or restart it.
+ **/
+static void
+batch_job_reply_handler (BatchRequest *  req,
+			 NihDBusMessage *message,
+			 const char *    job_class_path)
+{
+	DBusPendingCall *pending_call = NULL;
+	NihError *       err;
+
+	nih_assert (req != NULL);
+	nih_assert (message != NULL);
+	nih_assert (job_class_path != NULL);
+
+	batch_pending--;
+
+	req->job_class = nih_dbus_proxy_new (req, req->upstart->connection,
+					     req->upstart->name, job_class_path,
+					     NULL, NULL);
+	if (! req->job_class)
+		goto error;
+
+	req->job_class->auto_start = FALSE;
+
+	if (! strcmp (req->command, "start")) {
+		pending_call = job_class_start (req->job_class, req->env, (! no_wait),
+						(JobClassStartReply)batch_instance_reply_handler,
+						batch_error_handler, req,
+						NIH_DBUS_TIMEOUT_NEVER);
+	} else if (! strcmp (req->command, "stop")) {
+		pending_call = job_class_stop (req->job_class, req->env, (! no_wait),
+					       (JobClassStopReply)batch_reply_handler,
+					       batch_error_handler, req,
+					       NIH_DBUS_TIMEOUT_NEVER);
+	} else {
+		pending_call = job_class_restart (req->job_class, req->env, (! no_wait),
+						  (JobClassRestartReply)batch_instance_reply_handler,
+						  batch_error_handler, req,
+						  NIH_DBUS_TIMEOUT_NEVER);
+	}
+
+	if (! pending_call)
+		goto error;
+
+	dbus_pending_call_unref (pending_call);
+	batch_pending++;
+
+	return;
+
+error:
+	err = nih_error_get ();
+	nih_error ("%s", err->message);
+	nih_free (err);
+}
+
+/**
+ * batch_reply_handler:
+ * @req: request,
+ * @message: D-Bus message received.
+ *
+ * Called when the job of @req has been stopped.
+ **/
+static void
+batch_reply_handler (BatchRequest *  req,
+		     NihDBusMessage *message)
+{
+	nih_assert (req != NULL);
+
+	batch_pending--;
+
+	reply_handler (&req->ret, message);
+}
+
+/**
+ * batch_instance_reply_handler:
+ * @req: request,
+ * @message: D-Bus message received,
+ * @instance: path of instance.
+ *
+ * Called when the job of @req has been started or restarted.
+ **/
+static void
+batch_instance_reply_handler (BatchRequest *  req,
+			      NihDBusMessage *message,
+			      const char *    instance)
+{
+	nih_assert (req != NULL);
+	nih_assert (instance != NULL);
+
+	batch_pending--;
+
+	reply_handler (&req->ret, message);
+}
+
+/**
+ * batch_error_handler:
+ * @data: request,
+ * @message: D-Bus message received.
+ *
+ * Called when any method call made for a request fails, outputs the
+ * error, leaving the request marked as failed.
+ **/
+static void
+batch_error_handler (void *          data,
+		     NihDBusMessage *message)
+{
+	nih_assert (data != NULL);
+
+	batch_pending--;
 
-	err = nih_error_get ();
-	nih_error ("%s", err->message);
-	nih_free (err);
+	error_handler (data, message);
 }
 
 /**
@@ -2272,12 +4834,10 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 	nih_local NihList      *rpn_stack = NULL;
 	char                   *name = NULL;
 	const char             *stanza_name;
-	const char             *job_class_name;
 
 	nih_assert (data);
 
 	stanza_name    = ((ConditionHandlerData *)data)->condition_name;
-	job_class_name = ((ConditionHandlerData *)data)->job_class_name;
 
 	if (! variant_array || ! *variant_array || ! **variant_array)
 		return;
@@ -2304,13 +4864,6 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 				continue;
 			}
 
-			if (check_config_mode) {
-				/* Save token verbatim. */
-				new_token = NIH_MUST (nih_strdup (NULL, token));
-				STACK_PUSH_NEW_ELEM (rpn_stack, new_token);
-				continue;
-			}
-
 			first  = NIH_MUST (nih_list_new (NULL));
 			second = NIH_MUST (nih_list_new (NULL));
 
@@ -2345,7 +4898,7 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 			arg = (*variant)+1;
 
 			for (i=0; arg[i] && *arg[i]; i++) {
-				if ((enumerate_events || check_config_mode) && IS_JOB_EVENT (token)) {
+				if (enumerate_events && IS_JOB_EVENT (token)) {
 					if (!name) {
 						GET_JOB_NAME (name, i, arg[i]);
 						if (name)
@@ -2353,10 +4906,8 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 					}
 				}
 
-				if (! check_config_mode) {
-					element = NIH_MUST (nih_strcat (&element, NULL, " "));
-					element = NIH_MUST (nih_strcat (&element, NULL, arg[i]));
-				}
+				element = NIH_MUST (nih_strcat (&element, NULL, " "));
+				element = NIH_MUST (nih_strcat (&element, NULL, arg[i]));
 			}
 
 			if (enumerate_events) {
@@ -2367,12 +4918,6 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 						name ? name : "",
 						element);
 			} else {
-				if (check_config_mode) {
-					element = NIH_MUST (nih_sprintf (NULL, "%s%s%s",
-								token,
-								name ? " " : "",
-								name ? name : ""));
-				}
 				STACK_PUSH_NEW_ELEM (rpn_stack, element);
 			}
 
@@ -2382,37 +4927,6 @@ job_class_parse_events (const ConditionHandlerData *data, char ** const *variant
 	if (enumerate_events)
 		return;
 
-	if (check_config_mode) {
-		int add = 0;
-		JobCondition *entry;
-
-		/* Create job class entry if necessary */
-		entry = (JobCondition *)nih_hash_lookup (check_config_data.job_class_hash, job_class_name);
-
-		if (!entry) {
-			add = 1;
-			MAKE_JOB_CONDITION (check_config_data.job_class_hash, entry, job_class_name);
-		}
-
-		/* Unstitch the conditions from the stack and stash them
-		 * in the appropriate list for the job in question.
-		 */
-		NIH_LIST_FOREACH_SAFE (rpn_stack, iter) {
-			NihListEntry *node = (NihListEntry *)iter; 
-			NihList *l = !strcmp (stanza_name, "start on")
-				? entry->start_on
-				: entry->stop_on;
-			nih_ref (node, l);
-			nih_unref (node, rpn_stack);
-			nih_list_add_after (l, &node->entry);
-		}
-
-		if (add)
-			nih_hash_add (check_config_data.job_class_hash, &entry->list);
-
-		return;
-	}
-
 	/* Handle case where a single event was specified (there
 	 * was no operator to pop the entry off the stack).
 	 */
@@ -2506,15 +5020,7 @@ job_class_show_emits (const void *parent, NihDBusProxy *job_class_proxy, const c
 	if (job_emits && *job_emits) {
 		char **p = job_emits;
 		while (*p) {
-			if (check_config_mode) {
-				/* Record event for later */
-				NihListEntry *node = NIH_MUST (nih_list_entry_new (check_config_data.event_hash));
-				node->str = NIH_MUST (nih_strdup (node, *p));
-				nih_hash_add_unique (check_config_data.event_hash, &node->entry);
-			}
-			else {
-				nih_message ("  emits %s", *p);
-			}
+			nih_message ("  emits %s", *p);
 			p++;
 		}
 	}
@@ -2559,317 +5065,6 @@ job_class_condition_err_handler (void *data, NihDBusMessage *message)
 }
 
 
-/**
- * eval_expr_tree:
- *
- * @expr: expression to consider (see ExprNode),
- * @stack: stack used to hold evaluated expressions.
- *
- * Evaluate @expr, in the context of @stack, creating ExprNode
- * nodes as necessary.
- *
- * See ExprNode for details of @token.
- **/
-void
-eval_expr_tree (const char *expr, NihList **stack)
-{
-	NihList *s;
-
-	nih_assert (stack);
-
-	s = *stack;
-
-	if (IS_OPERATOR (expr)) {
-		ExprNode *node, *first, *second;
-		NihListEntry *tmp = NULL;
-		NihListEntry *le;
-
-		/* make node for operator */
-		MAKE_EXPR_NODE (NULL, node, expr);
-
-		/* pop */
-		nih_assert (! NIH_LIST_EMPTY (s));
-		tmp = (NihListEntry *)nih_list_remove (s->next);
-
-		/* re-parent */
-		nih_ref (tmp, node);
-		nih_unref (tmp, s);
-
-		first = (ExprNode *)tmp->data;
-		nih_assert (first->value != -1);
-
-		/* attach to operator node */
-		nih_tree_add (&node->node, &first->node, NIH_TREE_LEFT);
-
-
-		/* pop */
-		nih_assert (! NIH_LIST_EMPTY (s));
-		tmp = (NihListEntry *)nih_list_remove (s->next);
-
-		/* re-parent */
-		nih_ref (tmp, node);
-		nih_unref (tmp, s);
-
-		second = (ExprNode *)tmp->data;
-		nih_assert (second->value != -1);
-
-		/* attach to operator node */
-		nih_tree_add (&node->node, &second->node, NIH_TREE_RIGHT);
-
-
-		/* Determine truth value for
-		 * this node based on children
-		 * and type of operator.
-		 */
-		if (IS_OP_AND (expr) || check_config_warn)
-			node->value = first->value && second->value;
-		else
-			node->value = first->value || second->value;
-
-		/* Create list entry and hook
-		 * node onto it.
-		 */
-		le = NIH_MUST (nih_new (s, NihListEntry));
-		nih_list_init (&le->entry);
-		le->data = node;
-
-		/* push operator node */
-		nih_list_add_after (s, &le->entry);
-
-	} else {
-		char *event = NULL;
-		char *job   = NULL;
-		NihListEntry *le;
-		ExprNode *en;
-		int errors = 0;
-
-		le = NIH_MUST (nih_new (s, NihListEntry));
-		nih_list_init (&le->entry);
-
-		MAKE_EXPR_NODE (le, en, expr);
-		le->data = en;
-
-		event = en->expr;
-
-		/* Determine the type of operand node we
-		 * have.
-		 */
-		job = strchr (en->expr, ' ');
-
-		/* found a job */
-		if (job) {
-			job++;
-			*(job-1) = '\0';
-
-			if (! allow_job (job)) {
-				errors++;
-
-				/* remember the error for later */
-				en->job_in_error = job;
-			}
-		}
-
-		/* handle event */
-		if (! allow_event (event)) {
-			errors++;
-			/* remember the error for later */
-			en->event_in_error = en->expr;
-		}
-
-		/* Determine if this this node is in error (0 means yes) */
-		en->value = errors ? 0 : 1;
-
-		nih_list_add_after (s, &le->entry);
-	}
-}
-
-
-/**
- * check_condition:
- *
- * @job_class: name of job class,
- * @condition: name of condition,
- * @condition_list: conditions to check.
- * @job_class_displayed: Will be set to TRUE when an error node is found
- * and the job class has been displayed to the user.
- *
- * Evaluate all expression tree nodes in @condition_list looking for
- * errors.
- *
- * Returns error count.
- **/
-int
-check_condition (const char *job_class, const char *condition, NihList *condition_list,
-		int *job_class_displayed)
-{
-	nih_local NihList *stack  = NULL;
-	NihTree           *root   = NULL;
-	int                errors = 0;
-
-	nih_assert (job_class);
-	nih_assert (condition);
-
-	if (! condition_list || NIH_LIST_EMPTY (condition_list))
-		return 0;
-
-	STACK_CREATE (stack);
-	STACK_SHOW (stack);
-
-	NIH_LIST_FOREACH (condition_list, iter) {
-		NihListEntry *e = (NihListEntry *)iter; 
-
-		eval_expr_tree (e->str, &stack);
-	}
-
-	root = &(((ExprNode *)((NihListEntry *)stack->next)->data)->node);
-
-	if (! root)
-		/* no conditions found */
-		return 0;
-
-	/* Look through the expression tree for nodes in error and
-	 * display them.
-	 */
-	NIH_TREE_FOREACH_PRE_FULL (root, iter, tree_filter, root) {
-		ExprNode *e = (ExprNode *)iter;
-
-		if ( e->value != 1 ) {
-			errors++;
-			if ( *job_class_displayed == FALSE) {
-				nih_message ("%s", job_class);
-				*job_class_displayed = TRUE;
-			}
-
-			display_check_errors (job_class, condition, iter);
-			break;
-		}
-	}
-	return errors;
-}
-
-/**
- * display_check_errors:
- *
- * @job_class: name of job class,
- * @condition: name of condition,
- * @node: tree node that is in error.
- *
- * Display error details from expression tree nodes
- * that are in error.
- *
- * Note that this function should only be passed operand nodes or the
- * root node.
- **/
-void
-display_check_errors (const char *job_class, const char *condition, NihTree *node)
-{
-	nih_assert (job_class);
-	nih_assert (node);
-
-	NIH_TREE_FOREACH_POST (node, iter) {
-		ExprNode   *expr  = (ExprNode *)iter;
-		const char *event = expr->event_in_error;
-		const char *job   = expr->job_in_error;
-
-		if (event)
-			nih_message ("  %s: %s %s", condition,
-				_("unknown event"), event);
-
-		if (job)
-			nih_message ("  %s: %s %s", condition,
-				_("unknown job"), job);
-	}
-}
-
-
-/**
- * tree_filter:
- *
- * @data: node representing root of tree,
- * @node: node to consider.
- *
- * Node filter for NIH_TREE_FOREACH_PRE_FULL that ensures only 
- * operator nodes and the root node are to be considered.
- *
- * Returns FALSE if node should be considered, else TRUE.
- *
- **/
-int
-tree_filter (void *data, NihTree *node)
-{
-	NihTree  *root = (NihTree *)data;
-	ExprNode *e    = (ExprNode *)node;
-
-	nih_assert (root);
-	nih_assert (e);
-
-	if (IS_OPERATOR (e->expr) || node == root)
-		return FALSE;
-
-	/* ignore */
-	return TRUE;
-}
-
-
-/**
- * allow_job:
- *
- * @job: name of job to check.
- *
- * Returns TRUE if @job is recognized or can be ignored,
- * else FALSE.
- **/
-int
-allow_job (const char *job)
-{
-	NihList *found;
-
-	nih_assert (job);
-
-	found = nih_hash_lookup (check_config_data.job_class_hash, job);
-
-	/* The second part of this test ensures we ignore the (unusual)
-	 * situation whereby the condition references a
-	 * variable (for example an instance).
-	 */
-	if (!found && job[0] != '$')
-		return FALSE;
-
-	return TRUE;
-}
-
-
-/**
- * allow_event:
- *
- * @event: name of event to check.
- *
- * Returns TRUE if @event is recognized or can be ignored,
- * else FALSE.
- **/
-int
-allow_event (const char *event)
-{
-	nih_assert (event);
-
-	NIH_HASH_FOREACH (check_config_data.event_hash, iter) {
-		NihListEntry *entry = (NihListEntry *)iter;
-
-		/* handles expansion of any globs */
-		if (fnmatch (entry->str, event, 0) == 0)
-			goto out;
-	}
-
-	if (IS_INIT_EVENT (event) ||
-		nih_hash_lookup (check_config_data.ignored_events_hash, event))
-		goto out;
-
-	return FALSE;
-
-out:
-	return TRUE;
-}
-
 /**
  * get_job_details:
  *
@@ -3000,6 +5195,11 @@ NihOption reload_options[] = {
  * Command-line options accepted for the status command.
  **/
 NihOption status_options[] = {
+	{ 0, "fast", N_("read job state from the snapshot kept by init where possible"),
+	  NULL, NULL, &fast, NULL },
+	{ 0, "stats", N_("also show the resources used by the instance"),
+	  NULL, NULL, &show_stats, NULL },
+
 	NIH_OPTION_LAST
 };
 
@@ -3012,6 +5212,30 @@ NihOption list_options[] = {
 	NIH_OPTION_LAST
 };
 
+/**
+ * batch_options:
+ *
+ * Command-line options accepted for the batch command.
+ **/
+NihOption batch_options[] = {
+	{ 'n', "no-wait", N_("do not wait for jobs to change state before exiting"),
+	  NULL, NULL, &no_wait, NULL },
+
+	NIH_OPTION_LAST
+};
+
+/**
+ * shell_options:
+ *
+ * Command-line options accepted for the shell command.
+ **/
+NihOption shell_options[] = {
+	{ 's', "status", N_("output the exit status of each command after its output"),
+	  NULL, NULL, &shell_status, NULL },
+
+	NIH_OPTION_LAST
+};
+
 /**
  * emit_options:
  *
@@ -3020,6 +5244,8 @@ NihOption list_options[] = {
 NihOption emit_options[] = {
 	{ 'n', "no-wait", N_("do not wait for event to finish before exiting"),
 	  NULL, NULL, &no_wait, NULL },
+	{ 0, "async", N_("output event identifier and number of events pending rather than waiting"),
+	  NULL, NULL, &emit_async, NULL },
 
 	NIH_OPTION_LAST
 };
@@ -3042,6 +5268,72 @@ NihOption version_options[] = {
 	NIH_OPTION_LAST
 };
 
+/**
+ * stats_options:
+ *
+ * Command-line options accepted for the stats command.
+ **/
+NihOption stats_options[] = {
+	NIH_OPTION_LAST
+};
+
+/**
+ * mem_stats_options:
+ *
+ * Command-line options accepted for the mem-stats command.
+ **/
+NihOption mem_stats_options[] = {
+	NIH_OPTION_LAST
+};
+
+/**
+ * events_options:
+ *
+ * Command-line options accepted for the events command.
+ **/
+NihOption events_options[] = {
+	{ 0, "since", N_("only show events after the one with identifier ID"),
+	  NULL, "ID", &events_since, NULL },
+
+	NIH_OPTION_LAST
+};
+
+/**
+ * log_options:
+ *
+ * Command-line options accepted for the log command.
+ **/
+NihOption log_options[] = {
+	{ 0, "since", N_("only show output written at or after TIME"),
+	  NULL, "TIME", &log_since, NULL },
+	{ 0, "until", N_("only show output written before TIME"),
+	  NULL, "TIME", &log_until, NULL },
+	{ 'f', "follow", N_("wait for and show further output"),
+	  NULL, NULL, &log_follow, NULL },
+	{ 0, "logdir", N_("read job logs from DIR"),
+	  NULL, "DIR", &log_logdir, NULL },
+
+	NIH_OPTION_LAST
+};
+
+/**
+ * boot_trace_options:
+ *
+ * Command-line options accepted for the boot-trace command.
+ **/
+NihOption boot_trace_options[] = {
+	NIH_OPTION_LAST
+};
+
+/**
+ * critical_path_options:
+ *
+ * Command-line options accepted for the critical-path command.
+ **/
+NihOption critical_path_options[] = {
+	NIH_OPTION_LAST
+};
+
 /**
  * log_priority_options:
  *
@@ -3079,6 +5371,17 @@ NihOption check_config_options[] = {
 	NIH_OPTION_LAST
 };
 
+/**
+ * graph_options:
+ *
+ * Command-line options accepted for the graph command.
+ **/
+NihOption graph_options[] = {
+	{ 0, "format", N_("output format, `dot' (the default) or `json'"),
+	  NULL, "FORMAT", &graph_format, NULL },
+	NIH_OPTION_LAST
+};
+
 /**
  * set_env_options:
  *
@@ -3225,11 +5528,35 @@ static NihCommand commands[] = {
 	  N_("The known jobs and their current status will be output."),
 	  &job_commands, list_options, list_action },
 
+	{ "batch", N_("[COMMAND JOB...]"),
+	  N_("Start, stop or restart many jobs at once."),
+	  N_("COMMAND is one of start, stop or restart and is applied to "
+	     "each JOB given.  Without arguments, lines of the form "
+	     "\"COMMAND JOB [KEY=VALUE]...\" are read from standard input "
+	     "instead.\n"
+	     "\n"
+	     "Requests for the jobs are not made one after another but are "
+	     "all in flight at once, and an error is output for each job "
+	     "that fails."),
+	  &job_commands, batch_options, batch_action },
+
+	{ "shell", NULL,
+	  N_("Run commands read from standard input."),
+	  N_("Each line read from standard input is run as an initctl "
+	     "command with its options and arguments, all of them over a "
+	     "single connection to the init daemon, such that scripts "
+	     "making many requests may keep one initctl running as a "
+	     "coprocess."),
+	  NULL, shell_options, shell_action },
+
 	{ "emit", N_("EVENT [KEY=VALUE]..."),
 	  N_("Emit an event."),
 	  N_("EVENT is the name of an event the init daemon should emit, "
 	     "this may be followed by zero or more environment variables "
-	     "to be included in the event.\n"),
+	     "to be included in the event.\n\n"
+	     "With --async, the identifier of the event and the number of "
+	     "events pending in the queue are output; the EventFinished "
+	     "signal carries the identifier once the event finishes.\n"),
 	  &event_commands, emit_options, emit_action },
 
 	{ "reload-configuration", NULL,
@@ -3240,6 +5567,57 @@ static NihCommand commands[] = {
 	  N_("Request the version of the init daemon."),
 	  NULL,
 	  NULL, version_options, version_action },
+	{ "stats", NULL,
+	  N_("Show event queue statistics of the init daemon."),
+	  N_("Outputs the number of events emitted and still queued, "
+	     "followed by histograms of the time taken for each event to "
+	     "finish, the time taken by each pass of the event queue and "
+	     "the number of job subscriptions examined for each event."),
+	  NULL, stats_options, stats_action },
+	{ "mem-stats", NULL,
+	  N_("Show memory held by the init daemon."),
+	  N_("Outputs the number of objects and bytes held by the job "
+	     "classes, job instances, job logs, events, configuration, "
+	     "sessions and shared strings of the init daemon, followed by "
+	     "the number and size of all blocks it has allocated and of "
+	     "the free blocks it keeps for reuse."),
+	  NULL, mem_stats_options, mem_stats_action },
+	{ "events", NULL,
+	  N_("Show the history of events handled by the init daemon."),
+	  N_("Outputs the most recent events handled by the init daemon, "
+	     "each with its identifier, name and emitter, the time it was "
+	     "queued, how long it waited to be handled and how long it was "
+	     "then held by the jobs blocking it, and the jobs it started "
+	     "and stopped.\n\n"
+	     "With --since, only events after the one with identifier ID "
+	     "are output, so that a later call shows only new events."),
+	  NULL, events_options, events_action },
+	{ "log", N_("JOB [INSTANCE]"),
+	  N_("Show the output logged by a job."),
+	  N_("JOB is the name of the job and INSTANCE the name of an "
+	     "instance of it.  Outputs the log file of the job, or with "
+	     "--since and --until only the output written between those "
+	     "times, found using the index kept by the init daemon when "
+	     "started with --log-index; rotated logs are searched too.  "
+	     "TIME may be given as HH:MM[:SS] today, as "
+	     "YYYY-MM-DD HH:MM[:SS], or as @SECONDS since the epoch.\n\n"
+	     "With --follow, output written later is shown as it arrives."),
+	  NULL, log_options, log_action },
+	{ "boot-trace", NULL,
+	  N_("Show the timeline of job state changes."),
+	  N_("Outputs the time at which each job entered each state, and "
+	     "spawned and exec'd each process, as kept by the init daemon "
+	     "since boot, in the Trace Event Format read by "
+	     "chrome://tracing."),
+	  NULL, boot_trace_options, boot_trace_action },
+	{ "critical-path", N_("[JOB|EVENT]"),
+	  N_("Show what delayed a job or event the most."),
+	  N_("JOB is the name of a job and EVENT the name of an event, by "
+	     "default the runlevel event.  Outputs the chain of events and "
+	     "job states that led to JOB first starting or EVENT first being "
+	     "emitted, with the delay added by each, as recorded by the init "
+	     "daemon since boot."),
+	  NULL, critical_path_options, critical_path_action },
 	{ "log-priority", N_("[PRIORITY]"),
 	  N_("Change the minimum priority of log messages from the init "
 	     "daemon."),
@@ -3272,6 +5650,15 @@ static NihCommand commands[] = {
 	     "currently available job configuration files."),
 	  NULL, check_config_options, check_config_action },
 
+	{ "graph", N_("[JOB|EVENT]..."),
+	  N_("Output the graph of jobs and events."),
+	  N_("Outputs each job and event, the events each job emits and the "
+	     "jobs and events named by their start on and stop on "
+	     "conditions, in the DOT language read by dot(1) or as JSON.  "
+	     "If JOB or EVENT is given, only it and the jobs and events "
+	     "that must happen before it are output."),
+	  NULL, graph_options, graph_action },
+
 	{ "get-env", N_("VARIABLE"),
 	  N_("Retrieve value of a job environment variable."),
 	  N_("Display the value of a variable from the job environment table."),
@@ -3327,6 +5714,106 @@ static NihCommand commands[] = {
 };
 
 
+/**
+ * shell_action:
+ * @command: NihCommand invoked,
+ * @args: command-line arguments.
+ *
+ * This function is called for the "shell" command.
+ *
+ * Each line read from standard input is split into words and run as if
+ * given on the command-line, with the connection opened for the first
+ * reused for the rest; options of commands only apply to the line they
+ * are given on.  Output is flushed after each command so that initctl
+ * may be used as a coprocess.
+ *
+ * Returns: command exit status.
+ **/
+int
+shell_action (NihCommand *  command,
+	      char * const *args)
+{
+	nih_local NihDBusProxy *upstart = NULL;
+	char *                  line = NULL;
+	size_t                  len = 0;
+	int                     ret = 0;
+
+	nih_assert (command != NULL);
+	nih_assert (args != NULL);
+
+	if (args[0]) {
+		fprintf (stderr, _("%s: unexpected argument\n"), program_name);
+		nih_main_suggest_help ();
+		return 1;
+	}
+
+	upstart = upstart_open (NULL);
+	if (! upstart)
+		return 1;
+
+	upstart_connection = dbus_connection_ref (upstart->connection);
+
+	while (getline (&line, &len, stdin) > 0) {
+		nih_local char **cmd_args = NULL;
+		nih_local char **cmd_argv = NULL;
+		size_t           cmd_argc = 0;
+		int              status;
+
+		cmd_args = NIH_MUST (nih_str_split (NULL, line,
+						    " \t\r\n", TRUE));
+
+		/* Skip blank lines and comments */
+		if ((! cmd_args[0]) || (cmd_args[0][0] == '#'))
+			continue;
+
+		if (! strcmp (cmd_args[0], "shell")) {
+			fprintf (stderr, _("%s: shell may not be nested\n"),
+				 program_name);
+			status = 1;
+			goto done;
+		}
+
+		/* The options of the previous command don't carry over */
+		no_wait = FALSE;
+		fast = FALSE;
+		show_stats = FALSE;
+		enumerate_events = FALSE;
+		check_config_warn = FALSE;
+		retain_var = FALSE;
+		apply_globally = FALSE;
+
+		/* Parse the words as if they were our own arguments */
+		NIH_MUST (nih_str_array_add (&cmd_argv, NULL, &cmd_argc,
+					     program_name));
+		for (char **arg = cmd_args; *arg; arg++)
+			NIH_MUST (nih_str_array_add (&cmd_argv, NULL, &cmd_argc,
+						     *arg));
+
+		status = nih_command_parser (NULL, cmd_argc, cmd_argv,
+					     options, commands);
+		if (status < 0)
+			status = 1;
+
+	done:
+		if (status)
+			ret = 1;
+
+		if (shell_status)
+			printf ("%d\n", status);
+
+		fflush (stdout);
+		fflush (stderr);
+	}
+
+	free (line);
+
+	dbus_connection_unref (upstart_connection);
+	upstart_connection = NULL;
+
+	return ret;
+}
+
+
 
 
 
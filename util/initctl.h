@@ -112,27 +112,6 @@
 	 !strcmp (token, JOB_STOPPING_EVENT) || \
 	 !strcmp (token, JOB_STOPPED_EVENT))
 
-/**
- * IS_INIT_EVENT:
- * @token: string to check.
- *
- * Return TRUE if specified token refers to an event emitted internally,
- * else FALSE.
- *
- * Note: the raw string entries below are required to accommodate
- * production versus debug builds (STARTUP_EVENT changes name depending
- * on build type).
- **/
-#define IS_INIT_EVENT(token)                                  \
-	(!strcmp (token, STARTUP_EVENT)                    || \
-	 !strcmp (token, "debug")                          || \
-	 !strcmp (token, "startup")                        || \
-	 !strcmp (token, CTRLALTDEL_EVENT)                 || \
-	 !strcmp (token, KBDREQUEST_EVENT)                 || \
-	 !strcmp (token, PWRSTATUS_EVENT)                  || \
-	 (!strcmp (token, SESSION_END_EVENT) && user_mode) || \
-	 IS_JOB_EVENT (token))
-
 /**
  * STACK_EMPTY:
  * @stack: address of stack to check.
@@ -314,57 +293,6 @@
 #define STACK_PEEK(stack) \
 	(((NihListEntry *)(stack)->next)->str)
 
-/**
- * JobCondition:
- *
- * @list: list that @list lives on,
- * @job_class: name of job class,
- * @start_on: start on conditions,
- * @stop_on: stop on conditions.
- *
- * Structure used to represent a job classes start on and stop on
- * conditions.
- *
- * Note that @start_on and @stop_on are lists of NihListEntry
- * objects containing string data.
- *
- *
- **/
-typedef struct condition {
-	NihList      list;
-
-	const char  *job_class;
-	NihList     *start_on;
-	NihList     *stop_on;
-} JobCondition;
-
-/**
- * CheckConfigData:
- *
- * @job_class_hash: Job classes (.conf files)
- *   currently installed,
- * @event_hash: Events that are documented
- *   as being emitted,
- * @ignored_events_hash: Rvents we wish to ignore.
- *
- * Notes:
- *
- * Keys for @job_class_hash are job class names and values
- * are of type JobCondition.
- *
- * Keys of @event_hash are event names and values are of type
- * NihListEntry holding the event name as a string.
- *
- * Keys of @ignored_events_hash are event names and values are of type
- * NihListEntry holding the event name as a string.
- **/
-typedef struct check_config_data {
-	NihHash *job_class_hash;
-	NihHash *event_hash;
-	NihHash *ignored_events_hash;
-} CheckConfigData;
-
-
 /**
  * ConditionHandlerData:
  *
@@ -382,78 +310,100 @@ typedef struct condition_handler_data {
 
 
 /**
- * ExprNode:
- *
- * @node: tree which node lives in,
- * @expr: string representing the expression,
- * @job_in_error: if not NULL, points to the appropriate portion of
- *   @expr where the erroneous job is,
- * @event_in_error: if not NULL, points to the appropriate portion of
- *   @expr where the erroneous event is,
- * @value: Truth value of this node (and its children, if any).
- *
- * Node representing an expression.
- *
- * Notes:
+ * BATCH_MAX_PENDING:
  *
- * @expr can be one of:
- *
- * - operator:
- *   - IS_OP_AND()
- *   - IS_OP_OR()
- * - operand:
- *   - "<event>"
- *   - "<event> <job>"
- *
- * @value can be:
- *
- *  -  0 denoting node (and its children) are in error.
- *  -  1 denoting no errors in this node or its children.
- *  - -1 denoting an uninitialized value.
- */
-typedef struct expression_node {
-	NihTree       node;
+ * Maximum number of method calls the batch command has in flight at once.
+ **/
+#define BATCH_MAX_PENDING 64
 
-	char         *expr;
-	const char   *job_in_error;
-	const char   *event_in_error;
-	int           value;
-} ExprNode;
+/**
+ * BatchRequest:
+ *
+ * @entry: list header,
+ * @upstart: proxy for the manager object,
+ * @command: command to run, one of "start", "stop" or "restart",
+ * @name: name of job,
+ * @env: NULL-terminated environment for the job,
+ * @job_class: proxy for the job class once it is known,
+ * @ret: exit status of the request.
+ *
+ * Structure used to represent a single command of the batch command,
+ * passed as the data pointer of each method call made for it.
+ **/
+typedef struct batch_request {
+	NihList        entry;
 
+	NihDBusProxy  *upstart;
+	char          *command;
+	char          *name;
+	char         **env;
+	NihDBusProxy  *job_class;
+	int            ret;
+} BatchRequest;
 
 /**
- * MAKE_EXPR_NODE:
+ * CriticalPathClass:
  *
- * @parent: parent object,
- * @entry: pointer to ExprNode to initialize,
- * @str: string expression which will be copied into @entry.
+ * @entry: list header,
+ * @name: name of job class,
+ * @start_on: start on condition in Reverse Polish Notation, as returned
+ * by the start_on property,
+ * @emits: NULL-terminated list of events the job class emits.
  *
- * Allocate storage for an ExprNode pointer and initialize.
+ * Structure used by the critical-path command to hold the conditions of
+ * each job class, in a hash keyed by @name.
  **/
-#define MAKE_EXPR_NODE(parent, entry, str)                                 \
-	entry = NIH_MUST (nih_new (parent, ExprNode));                     \
-	nih_tree_init (&(entry)->node);                                    \
-	(entry)->expr  = (str)                                             \
-		? NIH_MUST (nih_strdup (entry, (str)))                     \
-		: NULL;                                                    \
-	(entry)->job_in_error   = NULL;                                    \
-	(entry)->event_in_error = NULL;                                    \
-	(entry)->value          = -1
+typedef struct critical_path_class {
+	NihList    entry;
+
+	char      *name;
+	char    ***start_on;
+	char     **emits;
+} CriticalPathClass;
 
 /**
- * MAKE_JOB_CONDITION:
- *
- * @parent: parent object,
- * @entry: pointer to JobCondition to initialize,
- * @str: string expression which will be copied into @entry.
- *
- * Allocate storage for an JobCondition pointer and initialize.
+ * GraphNode:
+ * @entry: list header,
+ * @key: name prefixed by "job:" or "event:",
+ * @name: name of job or event,
+ * @job: TRUE if a job, FALSE if an event,
+ * @glob: TRUE if an event pattern emitted by a job,
+ * @index: position in the order nodes were found,
+ * @kept: TRUE if to be output.
+ *
+ * Structure used by the graph command for each job and event of the
+ * dependency graph, in a hash keyed by @key since jobs and events may
+ * share names.
  **/
-#define MAKE_JOB_CONDITION(parent, entry, str)                             \
-	entry = NIH_MUST (nih_new (parent, JobCondition));                 \
-	nih_list_init (&(entry)->list);                                    \
-	(entry)->job_class  = NIH_MUST (nih_strdup (entry, str));          \
-	(entry)->start_on   = NIH_MUST (nih_list_new (entry));             \
-	(entry)->stop_on    = NIH_MUST (nih_list_new (entry))
+typedef struct graph_node {
+	NihList  entry;
+
+	char    *key;
+	char    *name;
+	int      job;
+	int      glob;
+	size_t   index;
+	int      kept;
+} GraphNode;
+
+/**
+ * GraphEdge:
+ * @from: node that leads to @to,
+ * @to: node that depends on @from,
+ * @type: "emits", "start on", "stop on" or "matches" for a pattern
+ * matching an event,
+ * @event: event of @from that satisfies the condition of @to when both
+ * are jobs, or NULL.
+ *
+ * Structure used by the graph command for each edge of the dependency
+ * graph.
+ **/
+typedef struct graph_edge {
+	GraphNode  *from;
+	GraphNode  *to;
+	const char *type;
+	const char *event;
+} GraphEdge;
+
 
 #endif /* INITCTL_H */
@@ -0,0 +1,363 @@
+/* upstart
+ *
+ * mounts.c - concurrent unmounting of filesystems
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+
+#include <sys/types.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+
+#include <time.h>
+#include <errno.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/string.h>
+#include <nih/logging.h>
+#include <nih/error.h>
+
+#include "mounts.h"
+
+
+/* Prototypes for static functions */
+static int  mounts_skip  (const struct mntent *mnt)
+	__attribute__ ((warn_unused_result));
+static int  mounts_depth (const char *path)
+	__attribute__ ((warn_unused_result));
+static int  mounts_cmp   (const void *a, const void *b)
+	__attribute__ ((warn_unused_result));
+static void mounts_child (const MountPoint *point)
+	__attribute__ ((noreturn));
+
+
+/**
+ * mounts_virtual:
+ *
+ * Types of filesystem that have no backing store, and so are never
+ * unmounted; the kernel discards them when it reboots.
+ **/
+static const char *mounts_virtual[] = {
+	"autofs",
+	"binfmt_misc",
+	"bpf",
+	"cgroup",
+	"cgroup2",
+	"configfs",
+	"debugfs",
+	"devpts",
+	"devtmpfs",
+	"efivarfs",
+	"fusectl",
+	"hugetlbfs",
+	"mqueue",
+	"proc",
+	"pstore",
+	"ramfs",
+	"rootfs",
+	"securityfs",
+	"sysfs",
+	"tmpfs",
+	"tracefs",
+	NULL
+};
+
+
+/**
+ * mounts_read:
+ * @parent: parent object for new array,
+ * @mounts_file: file listing mounted filesystems, or NULL for MOUNTS_FILE.
+ *
+ * Read the filesystems listed in @mounts_file that should be unmounted
+ * before the system is rebooted; the root filesystem and those with no
+ * backing store are excluded.
+ *
+ * The array is ordered with the most deeply nested mount points first,
+ * so that each filesystem follows all of those mounted beneath it.
+ *
+ * If @parent is not NULL, it should be a pointer to another object which
+ * will be used as a parent for the returned array.  When all parents
+ * of the returned array are freed, the returned array will also be
+ * freed.
+ *
+ * Returns: newly allocated NULL-terminated array, or NULL on raised
+ * error.
+ **/
+MountPoint **
+mounts_read (const void *parent,
+	     const char *mounts_file)
+{
+	MountPoint    **mounts;
+	size_t          len = 0;
+	FILE           *file;
+	struct mntent  *mnt;
+
+	file = setmntent (mounts_file ?: MOUNTS_FILE, "r");
+	if (! file)
+		nih_return_system_error (NULL);
+
+	mounts = nih_alloc (parent, sizeof (MountPoint *));
+	if (! mounts) {
+		endmntent (file);
+		nih_return_no_memory_error (NULL);
+	}
+	mounts[0] = NULL;
+
+	while ((mnt = getmntent (file)) != NULL) {
+		MountPoint  *point;
+		MountPoint **new_mounts;
+
+		if (mounts_skip (mnt))
+			continue;
+
+		new_mounts = nih_realloc (mounts, parent,
+					  sizeof (MountPoint *) * (len + 2));
+		if (! new_mounts)
+			goto error;
+		mounts = new_mounts;
+
+		point = nih_new (mounts, MountPoint);
+		if (! point)
+			goto error;
+
+		point->path = nih_strdup (point, mnt->mnt_dir);
+		point->type = nih_strdup (point, mnt->mnt_type);
+		if ((! point->path) || (! point->type)) {
+			nih_free (point);
+			goto error;
+		}
+
+		point->depth = mounts_depth (point->path);
+
+		mounts[len++] = point;
+		mounts[len] = NULL;
+	}
+
+	endmntent (file);
+
+	qsort (mounts, len, sizeof (MountPoint *), mounts_cmp);
+
+	return mounts;
+
+error:
+	endmntent (file);
+	nih_free (mounts);
+	nih_return_no_memory_error (NULL);
+}
+
+/**
+ * mounts_skip:
+ * @mnt: entry read from mounts file.
+ *
+ * Returns: TRUE if @mnt is the root filesystem or has no backing store,
+ * FALSE if it should be unmounted.
+ **/
+static int
+mounts_skip (const struct mntent *mnt)
+{
+	nih_assert (mnt != NULL);
+
+	if (! strcmp (mnt->mnt_dir, "/"))
+		return TRUE;
+
+	for (const char **type = mounts_virtual; *type; type++)
+		if (! strcmp (mnt->mnt_type, *type))
+			return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * mounts_depth:
+ * @path: mount point.
+ *
+ * Returns: number of components in @path.
+ **/
+static int
+mounts_depth (const char *path)
+{
+	int depth = 0;
+
+	nih_assert (path != NULL);
+
+	for (const char *ptr = path; *ptr; ptr++)
+		if ((*ptr != '/') && ((ptr == path) || (ptr[-1] == '/')))
+			depth++;
+
+	return depth;
+}
+
+/**
+ * mounts_cmp:
+ * @a: pointer to first mount point,
+ * @b: pointer to second mount point.
+ *
+ * Comparison function to order mount points most deeply nested first.
+ *
+ * Returns: negative if @a should be unmounted before @b, positive if
+ * after, zero if they may be unmounted together.
+ **/
+static int
+mounts_cmp (const void *a,
+	    const void *b)
+{
+	const MountPoint *mount_a = *(const MountPoint * const *)a;
+	const MountPoint *mount_b = *(const MountPoint * const *)b;
+
+	return mount_b->depth - mount_a->depth;
+}
+
+
+/**
+ * mounts_unmount:
+ * @mounts: NULL-terminated array from mounts_read(),
+ * @timeout: seconds to wait for the filesystems at each depth.
+ *
+ * Unmount each filesystem in @mounts, starting a process for each so
+ * that all of the filesystems at the same depth, which cannot be mounted
+ * on one another, are unmounted concurrently; only once those have
+ * finished, or @timeout expires, are the filesystems they were mounted
+ * on unmounted.  A filesystem that is still busy is remounted read-only
+ * instead.
+ *
+ * Finally the root filesystem is remounted read-only.
+ *
+ * Returns: number of filesystems neither unmounted nor remounted
+ * read-only in time.
+ **/
+int
+mounts_unmount (MountPoint * const *mounts,
+		int                 timeout)
+{
+	int failed = 0;
+
+	nih_assert (mounts != NULL);
+
+	for (size_t first = 0; mounts[first]; ) {
+		size_t  last;
+		pid_t  *pids;
+		size_t  running = 0;
+		time_t  deadline;
+
+		for (last = first; mounts[last]; last++)
+			if (mounts[last]->depth != mounts[first]->depth)
+				break;
+
+		pids = NIH_MUST (nih_alloc (NULL, sizeof (pid_t)
+					    * (last - first)));
+
+		for (size_t i = first; i < last; i++) {
+			pid_t pid;
+
+			pid = fork ();
+			if (pid == 0)
+				mounts_child (mounts[i]);
+
+			if (pid < 0) {
+				nih_warn ("%s: %s", mounts[i]->path,
+					  strerror (errno));
+				failed++;
+				continue;
+			}
+
+			pids[running++] = pid;
+		}
+
+		deadline = time (NULL) + timeout;
+
+		while (running) {
+			int   status;
+			pid_t pid;
+
+			pid = waitpid (-1, &status, WNOHANG);
+			if (pid < 0)
+				break;
+
+			if (pid == 0) {
+				if (time (NULL) >= deadline)
+					break;
+
+				usleep (10000);
+				continue;
+			}
+
+			for (size_t i = 0; i < running; i++) {
+				if (pids[i] != pid)
+					continue;
+
+				pids[i] = pids[--running];
+
+				if ((! WIFEXITED (status))
+				    || WEXITSTATUS (status))
+					failed++;
+				break;
+			}
+		}
+
+		/* Those still running are abandoned */
+		failed += running;
+
+		nih_free (pids);
+
+		first = last;
+	}
+
+	if (mount (NULL, "/", NULL, MS_REMOUNT | MS_RDONLY, NULL) < 0) {
+		nih_warn ("/: %s", strerror (errno));
+		failed++;
+	}
+
+	return failed;
+}
+
+/**
+ * mounts_child:
+ * @point: filesystem to unmount.
+ *
+ * Unmount @point, or remount it read-only if it is busy, in a child
+ * process started by mounts_unmount().
+ *
+ * This does not return.
+ **/
+static void
+mounts_child (const MountPoint *point)
+{
+	nih_assert (point != NULL);
+
+	if (umount2 (point->path, 0) == 0)
+		_exit (0);
+
+	if (mount (NULL, point->path, NULL, MS_REMOUNT | MS_RDONLY,
+		   NULL) == 0) {
+		nih_warn ("%s: %s", point->path,
+			  _("busy, remounted read-only"));
+		_exit (0);
+	}
+
+	nih_warn ("%s: %s", point->path, strerror (errno));
+	_exit (1);
+}
@@ -0,0 +1,58 @@
+/* upstart
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef UTIL_MOUNTS_H
+#define UTIL_MOUNTS_H
+
+#include <nih/macros.h>
+
+
+/**
+ * MOUNTS_FILE:
+ *
+ * File listing the filesystems mounted in our namespace.
+ **/
+#ifndef MOUNTS_FILE
+#define MOUNTS_FILE "/proc/self/mounts"
+#endif
+
+/**
+ * MountPoint:
+ * @path: directory filesystem is mounted on,
+ * @type: type of filesystem,
+ * @depth: number of components in @path.
+ *
+ * A filesystem to be unmounted by mounts_unmount().
+ **/
+typedef struct mount_point {
+	char *path;
+	char *type;
+	int   depth;
+} MountPoint;
+
+
+NIH_BEGIN_EXTERN
+
+MountPoint **mounts_read    (const void *parent, const char *mounts_file)
+	__attribute__ ((warn_unused_result, malloc));
+
+int          mounts_unmount (MountPoint * const *mounts, int timeout);
+
+NIH_END_EXTERN
+
+#endif /* UTIL_MOUNTS_H */
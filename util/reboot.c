@@ -27,6 +27,8 @@
 #include <sys/syscall.h>
 
 #include <errno.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -39,6 +41,8 @@
 #include <nih/error.h>
 
 #include "utmp.h"
+#include "sysv.h"
+#include "mounts.h"
 
 
 /**
@@ -68,6 +72,34 @@
 #define SHUTDOWN SBINDIR "/shutdown"
 #endif
 
+/**
+ * KEXEC_LOADED:
+ *
+ * File indicating whether a kernel has been staged with kexec.
+ **/
+#ifndef KEXEC_LOADED
+#define KEXEC_LOADED "/sys/kernel/kexec_loaded"
+#endif
+
+/**
+ * KILL_DELAY:
+ *
+ * Seconds remaining processes are given to exit after SIGTERM before
+ * they are sent SIGKILL by --fast.
+ **/
+#ifndef KILL_DELAY
+#define KILL_DELAY 2
+#endif
+
+/**
+ * UNMOUNT_TIMEOUT:
+ *
+ * Seconds the filesystems at each depth are given to unmount by --fast.
+ **/
+#ifndef UNMOUNT_TIMEOUT
+#define UNMOUNT_TIMEOUT 10
+#endif
+
 
 /* Operation modes */
 enum {
@@ -106,6 +138,27 @@ static int poweroff = FALSE;
  **/
 static int exit_only = FALSE;
 
+/**
+ * fast:
+ *
+ * TRUE to stop jobs and unmount filesystems ourselves rather than
+ * calling shutdown.
+ **/
+static int fast = FALSE;
+
+/**
+ * use_kexec:
+ *
+ * TRUE to reboot into the kernel staged with kexec.
+ **/
+static int use_kexec = FALSE;
+
+
+/* Prototypes for static functions */
+static int  kexec_loaded (void)
+	__attribute__ ((warn_unused_result));
+static void fast_stop    (void);
+
 
 /**
  * options:
@@ -121,6 +174,10 @@ static NihOption options[] = {
 	  NULL, NULL, &poweroff, NULL },
 	{ 'w', "wtmp-only", N_("don't actually reboot or halt, just write wtmp record"),
 	  NULL, NULL, &exit_only, NULL },
+	{ 0, "fast", N_("stop jobs and unmount filesystems in parallel, don't call shutdown(8)"),
+	  NULL, NULL, &fast, NULL },
+	{ 0, "kexec", N_("reboot into the kernel loaded with kexec"),
+	  NULL, NULL, &use_kexec, NULL },
 
 	/* Compatibility options, all ignored */
 	{ 'd', NULL, NULL, NULL, NULL, NULL, NULL },
@@ -187,8 +244,27 @@ main (int   argc,
 	if ((mode == HALT) && poweroff)
 		mode = POWEROFF;
 
+	/* The fast path does shutdown's work itself */
+	if (fast)
+		force = TRUE;
+
+	/* Refuse to kexec before doing any damage if there's nothing
+	 * staged to boot into.
+	 */
+	if (use_kexec) {
+		if (mode != REBOOT) {
+			nih_fatal (_("--kexec may only be used to reboot"));
+			exit (1);
+		}
+
+		if (! kexec_loaded ()) {
+			nih_fatal (_("No kernel has been loaded with kexec"));
+			exit (1);
+		}
+	}
+
 	/* Check for rebootcommand to pass in the syscall */
-	if ((mode == REBOOT) && force && args && *args) {
+	if ((mode == REBOOT) && force && (! use_kexec) && args && *args) {
 		mode = REBOOTCOMMAND;
 		rebootcommand = *args;
 	}
@@ -234,6 +310,9 @@ main (int   argc,
 	if (exit_only)
 		exit (0);
 
+	if (fast)
+		fast_stop ();
+
 	if (! no_sync)
 		sync ();
 
@@ -243,6 +322,11 @@ main (int   argc,
 	/* Do the syscall */
 	switch (mode) {
 	case REBOOT:
+		if (use_kexec) {
+			nih_info (_("Rebooting with kexec"));
+			reboot (RB_KEXEC);
+		}
+
 		nih_info (_("Rebooting"));
 		reboot (RB_AUTOBOOT);
 		break;
@@ -268,3 +352,76 @@ main (int   argc,
 
 	return 0;
 }
+
+
+/**
+ * kexec_loaded:
+ *
+ * Returns: TRUE if a kernel has been staged with kexec, FALSE otherwise.
+ **/
+static int
+kexec_loaded (void)
+{
+	FILE *file;
+	int   loaded = 0;
+
+	file = fopen (KEXEC_LOADED, "r");
+	if (! file)
+		return FALSE;
+
+	if (fscanf (file, "%d", &loaded) != 1)
+		loaded = 0;
+
+	fclose (file);
+
+	return loaded ? TRUE : FALSE;
+}
+
+/**
+ * fast_stop:
+ *
+ * Do the work of shutdown and the rc scripts as quickly as possible:
+ * init is asked to stop its jobs using its quiesce scheduler, which
+ * stops independent jobs in parallel, then any remaining processes are
+ * killed and the filesystems unmounted concurrently.
+ *
+ * Failures are warned about, but never prevent the reboot.
+ **/
+static void
+fast_stop (void)
+{
+	nih_local MountPoint **mounts = NULL;
+
+	nih_info (_("Stopping jobs"));
+	if (sysv_quiesce (0) < 0) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn (_("Unable to stop jobs: %s"), err->message);
+		nih_free (err);
+	}
+
+	nih_info (_("Killing remaining processes"));
+	kill (-1, SIGTERM);
+	kill (-1, SIGCONT);
+	sleep (KILL_DELAY);
+	kill (-1, SIGKILL);
+
+	if (! no_sync)
+		sync ();
+
+	nih_info (_("Unmounting filesystems"));
+	mounts = mounts_read (NULL, NULL);
+	if (! mounts) {
+		NihError *err;
+
+		err = nih_error_get ();
+		nih_warn (_("Unable to read mounted filesystems: %s"),
+			  err->message);
+		nih_free (err);
+		return;
+	}
+
+	if (mounts_unmount (mounts, UNMOUNT_TIMEOUT) > 0)
+		nih_warn (_("Some filesystems could not be unmounted"));
+}
@@ -185,6 +185,68 @@ sysv_change_runlevel (int           runlevel,
 	return 0;
 }
 
+/**
+ * sysv_quiesce:
+ * @timeout: seconds jobs are given to stop, or zero for the default.
+ *
+ * Ask init to stop all jobs in dependency order and wait until it has
+ * done so, or @timeout has expired and the remaining jobs were killed.
+ *
+ * Returns: zero on success, negative value on raised error.
+ **/
+int
+sysv_quiesce (int timeout)
+{
+	DBusError               dbus_error;
+	DBusConnection *        connection;
+	nih_local NihDBusProxy *upstart = NULL;
+	DBusPendingCall *       pending_call;
+	NihError *              err;
+
+	nih_assert (timeout >= 0);
+
+	dbus_error_init (&dbus_error);
+	connection = dbus_connection_open (dest_address, &dbus_error);
+	if (! connection) {
+		nih_dbus_error_raise (dbus_error.name, dbus_error.message);
+		dbus_error_free (&dbus_error);
+		return -1;
+	}
+	dbus_error_free (&dbus_error);
+
+	upstart = nih_dbus_proxy_new (NULL, connection,
+				      NULL, DBUS_PATH_UPSTART,
+				      NULL, NULL);
+	if (! upstart) {
+		dbus_connection_unref (connection);
+		return -1;
+	}
+
+	upstart->auto_start = FALSE;
+
+	dbus_connection_unref (connection);
+
+	err = NULL;
+	pending_call = NIH_SHOULD (upstart_quiesce (
+					   upstart, timeout,
+					   NULL,
+					   (NihDBusErrorHandler)error_handler,
+					   &err,
+					   NIH_DBUS_TIMEOUT_NEVER));
+	if (! pending_call)
+		return -1;
+
+	dbus_pending_call_block (pending_call);
+	dbus_pending_call_unref (pending_call);
+
+	if (err) {
+		nih_error_raise_error (err);
+		return -1;
+	}
+
+	return 0;
+}
+
 /**
  * error_handler:
  * @err: pointer to store error into,
@@ -29,6 +29,9 @@ int sysv_change_runlevel (int runlevel, char * const *env,
 			  const char *utmp_file, const char *wtmp_file)
 	__attribute__ ((warn_unused_result));
 
+int sysv_quiesce         (int timeout)
+	__attribute__ ((warn_unused_result));
+
 NIH_END_EXTERN
 
 #endif /* UTIL_SYSV_H */
@@ -53,6 +53,8 @@
 
 #include "com.ubuntu.Upstart.h"
 
+#include "init/snapshot.h"
+
 #include "test_util_common.h"
 
 extern int use_dbus;
@@ -61,6 +63,7 @@ extern int dbus_bus_type;
 extern char *dest_name;
 extern const char *dest_address;
 extern int no_wait;
+extern int fast;
 
 extern NihDBusProxy *upstart_open (const void *parent)
 	__attribute__ ((warn_unused_result));
@@ -74,9 +77,12 @@ extern int restart_action              (NihCommand *command, char * const *args)
 extern int reload_action               (NihCommand *command, char * const *args);
 extern int status_action               (NihCommand *command, char * const *args);
 extern int list_action                 (NihCommand *command, char * const *args);
+extern int batch_action                (NihCommand *command, char * const *args);
 extern int emit_action                 (NihCommand *command, char * const *args);
 extern int reload_configuration_action (NihCommand *command, char * const *args);
 extern int version_action              (NihCommand *command, char * const *args);
+extern int stats_action                (NihCommand *command, char * const *args);
+extern int boot_trace_action           (NihCommand *command, char * const *args);
 extern int log_priority_action         (NihCommand *command, char * const *args);
 extern int usage_action                (NihCommand *command, char * const *args);
 
@@ -459,6 +465,51 @@ test_upstart_open (void)
 	}
 
 
+	/* Check that when root has chosen neither the private connection
+	 * nor a bus, and the private connection isn't listening, the
+	 * system bus is tried instead.
+	 */
+	TEST_FEATURE ("with fallback to system bus");
+	if (getuid ()) {
+		printf ("SKIP: not running as root\n");
+		goto no_fallback;
+	}
+
+	TEST_ALLOC_FAIL {
+		use_dbus = -1;
+		dbus_bus_type = -1;
+		dest_name = NULL;
+		dest_address = "unix:abstract=/com/ubuntu/upstart/test";
+
+		assert0 (setenv ("DBUS_SYSTEM_BUS_ADDRESS",
+				 "unix:abstract=/com/ubuntu/upstart/test",
+				 TRUE));
+
+		TEST_DIVERT_STDERR (output) {
+			proxy = upstart_open (NULL);
+		}
+		rewind (output);
+
+		TEST_EQ_P (proxy, NULL);
+		TEST_EQ (use_dbus, TRUE);
+
+		TEST_FILE_EQ (output, ("test: Unable to connect to system bus: "
+				       "Failed to connect to socket /com/ubuntu/upstart/test: "
+				       "Connection refused\n"));
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		dbus_shutdown ();
+
+		unsetenv ("DBUS_SYSTEM_BUS_ADDRESS");
+	}
+
+	use_dbus = -1;
+	dbus_bus_type = -1;
+
+no_fallback:
+
+
 	/* Check that an error and suggestion for help is output
 	 * when --dest is given without --system.
 	 */
@@ -9438,6 +9489,9 @@ test_status_action (void)
 	char *          args[4];
 	int             ret = 0;
 	int             status;
+	char            filename[PATH_MAX];
+	Snapshot *      snapshot;
+	FILE *          file;
 
 	TEST_FUNCTION ("status_action");
 	TEST_DBUS (dbus_pid);
@@ -10935,6 +10989,119 @@ test_status_action (void)
 	}
 
 
+	/* Check that the status action with the --fast option reads the
+	 * status of the instance from the snapshot kept by init, without
+	 * making any method calls at all, and gives a job in the snapshot
+	 * without an instance as not running.
+	 */
+	TEST_FEATURE ("with snapshot");
+	TEST_FILENAME (filename);
+
+	snapshot = calloc (1, sizeof (Snapshot));
+	assert (snapshot);
+
+	snapshot->magic = SNAPSHOT_MAGIC;
+	snapshot->version = SNAPSHOT_VERSION;
+	snapshot->pid = getpid ();
+	snapshot->seq = 2;
+	snapshot->complete = TRUE;
+	snapshot->num_entries = 2;
+
+	strcpy (snapshot->entries[0].job, "test");
+	strcpy (snapshot->entries[0].goal, "start");
+	strcpy (snapshot->entries[0].state, "running");
+	snapshot->entries[0].num_processes = 1;
+	strcpy (snapshot->entries[0].processes[0].name, "main");
+	snapshot->entries[0].processes[0].pid = 3648;
+
+	strcpy (snapshot->entries[1].job, "other");
+	strcpy (snapshot->entries[1].goal, "stop");
+	strcpy (snapshot->entries[1].state, "waiting");
+
+	file = fopen (filename, "w");
+	assert (file);
+	assert (fwrite (snapshot, sizeof (Snapshot), 1, file) == 1);
+	fclose (file);
+	free (snapshot);
+
+	assert0 (setenv (SNAPSHOT_FILE_ENV, filename, 1));
+	fast = TRUE;
+
+	TEST_ALLOC_FAIL {
+		memset (&command, 0, sizeof command);
+
+		args[0] = "test";
+		args[1] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = status_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		if (test_alloc_failed
+		    && (ret != 0)) {
+			TEST_FILE_END (output);
+			TEST_FILE_RESET (output);
+
+			TEST_FILE_EQ (errors, "test: Cannot allocate memory\n");
+			TEST_FILE_END (errors);
+			TEST_FILE_RESET (errors);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_FILE_EQ (output, "test start/running, process 3648\n");
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+	}
+
+	TEST_ALLOC_FAIL {
+		memset (&command, 0, sizeof command);
+
+		args[0] = "other";
+		args[1] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = status_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		if (test_alloc_failed
+		    && (ret != 0)) {
+			TEST_FILE_END (output);
+			TEST_FILE_RESET (output);
+
+			TEST_FILE_EQ (errors, "test: Cannot allocate memory\n");
+			TEST_FILE_END (errors);
+			TEST_FILE_RESET (errors);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_FILE_EQ (output, "other stop/waiting\n");
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+	}
+
+	fast = FALSE;
+	assert0 (unsetenv (SNAPSHOT_FILE_ENV));
+	unlink (filename);
+
+
 	fclose (errors);
 	fclose (output);
 
@@ -13003,6 +13170,93 @@ test_show_config (void)
         TEST_EQ (rmdir (dirname), 0);
 }
 
+void
+test_critical_path (void)
+{
+	char             dirname[PATH_MAX];
+	nih_local char  *cmd = NULL;
+	pid_t            upstart_pid = 0;
+	pid_t            dbus_pid    = 0;
+	char           **output;
+	size_t           lines;
+
+	TEST_GROUP ("critical_path");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	/* Use the "secret" interface */
+	TEST_EQ (setenv ("UPSTART_CONFDIR", dirname, 1), 0);
+
+	TEST_DBUS (dbus_pid);
+	START_UPSTART (upstart_pid, FALSE);
+
+	CREATE_FILE (dirname, "foo.conf",
+			"start on wibble\n"
+			"task\n"
+			"exec sleep 1");
+
+	CREATE_FILE (dirname, "bar.conf",
+			"start on started foo\n"
+			"task\n"
+			"exec true");
+
+	cmd = nih_sprintf (NULL, "%s reload-configuration 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+	cmd = nih_sprintf (NULL, "%s emit wibble 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+	/* Check that the chain leading to a job starting is traced back
+	 * through the job that started it to the event that started that,
+	 * followed by the step with the longest delay.
+	 */
+	TEST_FEATURE ("with job");
+	cmd = nih_sprintf (NULL, "%s critical-path bar 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 6);
+	TEST_STR_MATCH (output[0], "*s\t+0.000s\tevent wibble");
+	TEST_STR_MATCH (output[1], "*s\t+*s\tfoo starting");
+	TEST_STR_MATCH (output[2], "*s\t+*s\tfoo running");
+	TEST_STR_MATCH (output[3], "*s\t+*s\tbar starting");
+	TEST_STR_MATCH (output[4], "*s\t+*s\tbar running");
+	TEST_STR_MATCH (output[5], "longest delay: * (+*s)");
+	nih_free (output);
+
+	/* Check that an event is found by name. */
+	TEST_FEATURE ("with event");
+	cmd = nih_sprintf (NULL, "%s critical-path wibble 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 1);
+	TEST_STR_MATCH (output[0], "*s\t+0.000s\tevent wibble");
+	nih_free (output);
+
+	/* Check that a job or event not in the timeline is an error. */
+	TEST_FEATURE ("with unknown job or event");
+	cmd = nih_sprintf (NULL, "%s critical-path wobble 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 1);
+	TEST_STR_MATCH (output[0], "*: wobble: not found in job timeline");
+	nih_free (output);
+
+	DELETE_FILE (dirname, "foo.conf");
+	DELETE_FILE (dirname, "bar.conf");
+
+	STOP_UPSTART (upstart_pid);
+	TEST_EQ (unsetenv ("UPSTART_CONFDIR"), 0);
+	TEST_DBUS_END (dbus_pid);
+	TEST_EQ (rmdir (dirname), 0);
+}
+
 void
 test_check_config (void)
 {
@@ -13538,6 +13792,111 @@ test_check_config (void)
         TEST_EQ (rmdir (dirname), 0);
 }
 
+void
+test_graph (void)
+{
+	char             dirname[PATH_MAX];
+	nih_local char  *cmd = NULL;
+	pid_t            upstart_pid = 0;
+	pid_t            dbus_pid    = 0;
+	char           **output;
+	size_t           lines;
+	const char      *expected[] = {
+		"  \"job:foo\" [label=\"foo\", shape=box, style=filled];",
+		"  \"job:bar\" [label=\"bar\", shape=box, style=filled];",
+		"  \"job:baz\" [label=\"baz\", shape=box, style=filled];",
+		"  \"event:wibble\" [label=\"wibble\", shape=diamond, style=filled];",
+		"  \"job:baz\" -> \"event:wibble\" [color=green];",
+		"  \"job:bar\" -> \"job:foo\" [color=blue, label=\"started\"];",
+		"  \"event:wibble\" -> \"job:bar\" [color=blue];",
+		NULL
+	};
+
+	TEST_GROUP ("graph");
+
+	TEST_FILENAME (dirname);
+	TEST_EQ (mkdir (dirname, 0755), 0);
+
+	/* Use the "secret" interface */
+	TEST_EQ (setenv ("UPSTART_CONFDIR", dirname, 1), 0);
+
+	TEST_DBUS (dbus_pid);
+	START_UPSTART (upstart_pid, FALSE);
+
+	CREATE_FILE (dirname, "foo.conf", "start on started bar");
+	CREATE_FILE (dirname, "bar.conf", "start on wibble");
+	CREATE_FILE (dirname, "baz.conf", "emits wibble");
+	CREATE_FILE (dirname, "qux.conf", "start on wobble");
+
+	cmd = nih_sprintf (NULL, "%s reload-configuration 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 0);
+	nih_free (output);
+
+	/* Check that a job is output with the job it starts on, the event
+	 * that job starts on and the job that emits it, but not with
+	 * unrelated jobs and events; the order of jobs is not defined.
+	 */
+	TEST_FEATURE ("with job in DOT format");
+	cmd = nih_sprintf (NULL, "%s graph foo 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 10);
+	TEST_EQ_STR (output[0], "digraph upstart {");
+	TEST_EQ_STR (output[1], "  rankdir=LR;");
+	TEST_EQ_STR (output[9], "}");
+
+	for (const char **line = expected; *line; line++) {
+		int found = FALSE;
+
+		for (size_t i = 0; i < lines; i++) {
+			if (! strcmp (output[i], *line))
+				found = TRUE;
+		}
+
+		if (! found)
+			TEST_FAILED ("missing line: %s", *line);
+	}
+	nih_free (output);
+
+	/* Check that an event is output with the job that emits it as
+	 * JSON, the edge naming its nodes by position.
+	 */
+	TEST_FEATURE ("with event in JSON format");
+	cmd = nih_sprintf (NULL, "%s graph --format=json wibble 2>&1",
+			   get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_EQ (lines, 6);
+	TEST_EQ_STR (output[0], "{\"nodes\": [");
+	TEST_EQ_STR (output[1], "{\"type\": \"job\", \"name\": \"baz\"}");
+	TEST_EQ_STR (output[2], ",{\"type\": \"event\", \"name\": \"wibble\"}");
+	TEST_EQ_STR (output[3], "], \"edges\": [");
+	TEST_EQ_STR (output[4], "{\"from\": 0, \"to\": 1, \"type\": \"emits\"}");
+	TEST_EQ_STR (output[5], "]}");
+	nih_free (output);
+
+	/* Check that an unknown format is rejected. */
+	TEST_FEATURE ("with invalid format");
+	cmd = nih_sprintf (NULL, "%s graph --format=svg 2>&1", get_initctl ());
+	TEST_NE_P (cmd, NULL);
+	RUN_COMMAND (NULL, cmd, &output, &lines);
+	TEST_GE (lines, 1);
+	TEST_STR_MATCH (output[0], "*: invalid format: svg");
+	nih_free (output);
+
+	DELETE_FILE (dirname, "foo.conf");
+	DELETE_FILE (dirname, "bar.conf");
+	DELETE_FILE (dirname, "baz.conf");
+	DELETE_FILE (dirname, "qux.conf");
+
+	STOP_UPSTART (upstart_pid);
+	TEST_EQ (unsetenv ("UPSTART_CONFDIR"), 0);
+	TEST_DBUS_END (dbus_pid);
+	TEST_EQ (rmdir (dirname), 0);
+}
+
 void
 test_notify_disk_writeable (void)
 {
@@ -13658,7 +14017,7 @@ test_notify_disk_writeable (void)
 
 
 void
-test_list_action (void)
+test_batch_action (void)
 {
 	pid_t           dbus_pid;
 	DBusConnection *server_conn;
@@ -13667,22 +14026,17 @@ test_list_action (void)
 	pid_t           server_pid;
 	DBusMessage *   method_call;
 	DBusMessage *   reply = NULL;
+	const char *    name_value;
+	char **         args_value;
+	int             args_elements;
+	int             wait_value;
 	const char *    str_value;
-	const char *    interface;
-	const char *    property;
-	DBusMessageIter iter;
-	DBusMessageIter subiter;
-	DBusMessageIter arrayiter;
-	DBusMessageIter dictiter;
-	DBusMessageIter prociter;
-	DBusMessageIter structiter;
-	int32_t         int32_value;
 	NihCommand      command;
-	char *          args[1];
+	char *          args[4];
 	int             ret = 0;
 	int             status;
 
-	TEST_FUNCTION ("list_action");
+	TEST_FUNCTION ("batch_action");
 	TEST_DBUS (dbus_pid);
 	TEST_DBUS_OPEN (server_conn);
 
@@ -13695,6 +14049,7 @@ test_list_action (void)
 					"NameAcquired"));
 	dbus_message_unref (method_call);
 
+	use_dbus = TRUE;
 	dbus_bus_type = DBUS_BUS_SYSTEM;
 	dest_name = DBUS_SERVICE_UPSTART;
 	dest_address = DBUS_ADDRESS_UPSTART;
@@ -13703,21 +14058,656 @@ test_list_action (void)
 	errors = tmpfile ();
 
 
-	/* Check that the list action makes the GetAllJobs method call
-	 * to obtain a list of paths, then for each job calls the
-	 * GetAllInstances method call to obtain a list of the instances.
-	 * If there are instances, the job name and instance properties are
-	 * requested and output; if there are not instances, only the
-	 * job name is requested and output.
+	/* Check that the batch action with a command and several job names
+	 * looks up each job and then calls the Start command for it as
+	 * the path is received, outputting nothing when all succeed.
 	 */
-	TEST_FEATURE ("with valid reply");
-	TEST_ALLOC_FAIL {
-		TEST_CHILD (server_pid) {
-			/* Expect the GetAllJobs method call on the
-			 * manager object, reply with a list of interesting
-			 * paths.
-			 */
-			TEST_DBUS_MESSAGE (server_conn, method_call);
+	TEST_FEATURE ("with command and job names");
+	TEST_CHILD (server_pid) {
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART,
+							"GetJobByName"));
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_STRING, &name_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ_STR (name_value, "frodo");
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+
+			str_value = DBUS_PATH_UPSTART "/jobs/frodo";
+
+			dbus_message_append_args (reply,
+						  DBUS_TYPE_OBJECT_PATH, &str_value,
+						  DBUS_TYPE_INVALID);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART,
+							"GetJobByName"));
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_STRING, &name_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ_STR (name_value, "bilbo");
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+
+			str_value = DBUS_PATH_UPSTART "/jobs/bilbo";
+
+			dbus_message_append_args (reply,
+						  DBUS_TYPE_OBJECT_PATH, &str_value,
+						  DBUS_TYPE_INVALID);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART_JOB,
+							"Start"));
+
+		TEST_EQ_STR (dbus_message_get_path (method_call),
+						    DBUS_PATH_UPSTART "/jobs/frodo");
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &args_value, &args_elements,
+						  DBUS_TYPE_BOOLEAN, &wait_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ (args_elements, 0);
+		dbus_free_string_array (args_value);
+
+		TEST_TRUE (wait_value);
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+
+			str_value = DBUS_PATH_UPSTART "/jobs/frodo/_";
+
+			dbus_message_append_args (reply,
+						  DBUS_TYPE_OBJECT_PATH, &str_value,
+						  DBUS_TYPE_INVALID);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART_JOB,
+							"Start"));
+
+		TEST_EQ_STR (dbus_message_get_path (method_call),
+						    DBUS_PATH_UPSTART "/jobs/bilbo");
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &args_value, &args_elements,
+						  DBUS_TYPE_BOOLEAN, &wait_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ (args_elements, 0);
+		dbus_free_string_array (args_value);
+
+		TEST_TRUE (wait_value);
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+
+			str_value = DBUS_PATH_UPSTART "/jobs/bilbo/_";
+
+			dbus_message_append_args (reply,
+						  DBUS_TYPE_OBJECT_PATH, &str_value,
+						  DBUS_TYPE_INVALID);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_CLOSE (server_conn);
+
+		dbus_shutdown ();
+
+		exit (0);
+		}
+
+	memset (&command, 0, sizeof command);
+
+	args[0] = "start";
+	args[1] = "frodo";
+	args[2] = "bilbo";
+	args[3] = NULL;
+
+	TEST_DIVERT_STDOUT (output) {
+		TEST_DIVERT_STDERR (errors) {
+			ret = batch_action (&command, args);
+		}
+	}
+	rewind (output);
+	rewind (errors);
+
+	TEST_EQ (ret, 0);
+
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	TEST_FILE_END (errors);
+	TEST_FILE_RESET (errors);
+
+	waitpid (server_pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that an error for one job is output without affecting the
+	 * other jobs, and that the batch action then returns a non-zero
+	 * exit status.
+	 */
+	TEST_FEATURE ("with error reply for one job");
+	TEST_CHILD (server_pid) {
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART,
+							"GetJobByName"));
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_STRING, &name_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ_STR (name_value, "frodo");
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_error (method_call,
+							DBUS_INTERFACE_UPSTART ".Error.UnknownJob",
+							"Unknown job: frodo");
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART,
+							"GetJobByName"));
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_STRING, &name_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ_STR (name_value, "bilbo");
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+
+			str_value = DBUS_PATH_UPSTART "/jobs/bilbo";
+
+			dbus_message_append_args (reply,
+						  DBUS_TYPE_OBJECT_PATH, &str_value,
+						  DBUS_TYPE_INVALID);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_MESSAGE (server_conn, method_call);
+
+		TEST_TRUE (dbus_message_is_method_call (method_call,
+							DBUS_INTERFACE_UPSTART_JOB,
+							"Stop"));
+
+		TEST_EQ_STR (dbus_message_get_path (method_call),
+						    DBUS_PATH_UPSTART "/jobs/bilbo");
+
+		TEST_TRUE (dbus_message_get_args (method_call, NULL,
+						  DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &args_value, &args_elements,
+						  DBUS_TYPE_BOOLEAN, &wait_value,
+						  DBUS_TYPE_INVALID));
+
+		TEST_EQ (args_elements, 0);
+		dbus_free_string_array (args_value);
+
+		TEST_TRUE (wait_value);
+
+		TEST_ALLOC_SAFE {
+			reply = dbus_message_new_method_return (method_call);
+		}
+
+		dbus_connection_send (server_conn, reply, NULL);
+		dbus_connection_flush (server_conn);
+
+		dbus_message_unref (method_call);
+		dbus_message_unref (reply);
+
+		TEST_DBUS_CLOSE (server_conn);
+
+		dbus_shutdown ();
+
+		exit (0);
+		}
+
+	memset (&command, 0, sizeof command);
+
+	args[0] = "stop";
+	args[1] = "frodo";
+	args[2] = "bilbo";
+	args[3] = NULL;
+
+	TEST_DIVERT_STDOUT (output) {
+		TEST_DIVERT_STDERR (errors) {
+			ret = batch_action (&command, args);
+		}
+	}
+	rewind (output);
+	rewind (errors);
+
+	TEST_GT (ret, 0);
+
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	TEST_FILE_EQ (errors, "test: Unknown job: frodo\n");
+	TEST_FILE_END (errors);
+	TEST_FILE_RESET (errors);
+
+	waitpid (server_pid, &status, 0);
+	TEST_TRUE (WIFEXITED (status));
+	TEST_EQ (WEXITSTATUS (status), 0);
+
+
+	/* Check that an unknown command is rejected before any method
+	 * call is made.
+	 */
+	TEST_FEATURE ("with unknown command");
+	memset (&command, 0, sizeof command);
+
+	args[0] = "frobnicate";
+	args[1] = "frodo";
+	args[2] = NULL;
+
+	TEST_DIVERT_STDOUT (output) {
+		TEST_DIVERT_STDERR (errors) {
+			ret = batch_action (&command, args);
+		}
+	}
+	rewind (output);
+	rewind (errors);
+
+	TEST_GT (ret, 0);
+
+	TEST_FILE_END (output);
+	TEST_FILE_RESET (output);
+
+	TEST_FILE_EQ (errors, "test: invalid batch command: frobnicate\n");
+	TEST_FILE_EQ (errors, "Try `test --help' for more information.\n");
+	TEST_FILE_END (errors);
+	TEST_FILE_RESET (errors);
+
+
+	fclose (errors);
+	fclose (output);
+
+	TEST_DBUS_CLOSE (server_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+
+void
+test_list_action (void)
+{
+	pid_t           dbus_pid;
+	DBusConnection *server_conn;
+	FILE *          output;
+	FILE *          errors;
+	pid_t           server_pid;
+	DBusMessage *   method_call;
+	DBusMessage *   reply = NULL;
+	const char *    str_value;
+	const char *    interface;
+	const char *    property;
+	DBusMessageIter iter;
+	DBusMessageIter subiter;
+	DBusMessageIter arrayiter;
+	DBusMessageIter dictiter;
+	DBusMessageIter prociter;
+	DBusMessageIter structiter;
+	int32_t         int32_value;
+	NihCommand      command;
+	char *          args[1];
+	int             ret = 0;
+	int             status;
+
+	TEST_FUNCTION ("list_action");
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (server_conn);
+
+	assert (dbus_bus_request_name (server_conn, DBUS_SERVICE_UPSTART,
+				       0, NULL)
+			== DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER);
+
+	TEST_DBUS_MESSAGE (server_conn, method_call);
+	assert (dbus_message_is_signal (method_call, DBUS_INTERFACE_DBUS,
+					"NameAcquired"));
+	dbus_message_unref (method_call);
+
+	dbus_bus_type = DBUS_BUS_SYSTEM;
+	dest_name = DBUS_SERVICE_UPSTART;
+	dest_address = DBUS_ADDRESS_UPSTART;
+
+	output = tmpfile ();
+	errors = tmpfile ();
+
+
+	/* Check that the list action makes the GetAllJobStatus method call
+	 * to obtain the status of every job and instance at once, and
+	 * outputs each of them without making any further calls.
+	 */
+	TEST_FEATURE ("with valid reply to GetAllJobStatus");
+	TEST_ALLOC_FAIL {
+		TEST_CHILD (server_pid) {
+			/* Expect the GetAllJobStatus method call on the
+			 * manager object, reply with the status of some
+			 * jobs and instances.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"GetAllJobStatus"));
+
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_method_return (method_call);
+
+				dbus_message_iter_init_append (reply, &iter);
+
+				dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+								  (DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_ARRAY_AS_STRING
+								   DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_INT32_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING),
+								  &arrayiter);
+
+				dbus_message_iter_open_container (&arrayiter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &dictiter);
+
+				str_value = "frodo";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "stop";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "waiting";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				dbus_message_iter_open_container (&dictiter, DBUS_TYPE_ARRAY,
+								  (DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_INT32_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING),
+								  &prociter);
+
+				dbus_message_iter_close_container (&dictiter, &prociter);
+
+				dbus_message_iter_close_container (&arrayiter, &dictiter);
+
+				dbus_message_iter_open_container (&arrayiter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &dictiter);
+
+				str_value = "bilbo";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "start";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "running";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				dbus_message_iter_open_container (&dictiter, DBUS_TYPE_ARRAY,
+								  (DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_INT32_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING),
+								  &prociter);
+
+				dbus_message_iter_open_container (&prociter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &structiter);
+
+				str_value = "main";
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				int32_value = 3648;
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_INT32,
+								&int32_value);
+
+				dbus_message_iter_close_container (&prociter, &structiter);
+
+				dbus_message_iter_close_container (&dictiter, &prociter);
+
+				dbus_message_iter_close_container (&arrayiter, &dictiter);
+
+				dbus_message_iter_open_container (&arrayiter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &dictiter);
+
+				str_value = "drogo";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "foo";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "stop";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				str_value = "pre-stop";
+				dbus_message_iter_append_basic (&dictiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				dbus_message_iter_open_container (&dictiter, DBUS_TYPE_ARRAY,
+								  (DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_INT32_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING),
+								  &prociter);
+
+				dbus_message_iter_open_container (&prociter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &structiter);
+
+				str_value = "main";
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				int32_value = 6312;
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_INT32,
+								&int32_value);
+
+				dbus_message_iter_close_container (&prociter, &structiter);
+
+				dbus_message_iter_open_container (&prociter, DBUS_TYPE_STRUCT,
+								  NULL,
+								  &structiter);
+
+				str_value = "pre-stop";
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				int32_value = 8609;
+				dbus_message_iter_append_basic (&structiter, DBUS_TYPE_INT32,
+								&int32_value);
+
+				dbus_message_iter_close_container (&prociter, &structiter);
+
+				dbus_message_iter_close_container (&dictiter, &prociter);
+
+				dbus_message_iter_close_container (&arrayiter, &dictiter);
+
+				dbus_message_iter_close_container (&iter, &arrayiter);
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
+			TEST_DBUS_CLOSE (server_conn);
+
+			dbus_shutdown ();
+
+			exit (0);
+		}
+
+		memset (&command, 0, sizeof command);
+
+		args[0] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = list_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		if (test_alloc_failed
+		    && (ret != 0)) {
+			/* May have had some output */
+			TEST_FILE_RESET (output);
+
+			TEST_FILE_EQ (errors, "test: Cannot allocate memory\n");
+			TEST_FILE_END (errors);
+			TEST_FILE_RESET (errors);
+
+			kill (server_pid, SIGTERM);
+			waitpid (server_pid, NULL, 0);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_FILE_EQ (output, "frodo stop/waiting\n");
+		TEST_FILE_EQ (output, "bilbo start/running, process 3648\n");
+		TEST_FILE_EQ (output, "drogo (foo) stop/pre-stop, process 6312\n");
+		TEST_FILE_EQ (output, "\tpre-stop process 8609\n");
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+
+		waitpid (server_pid, &status, 0);
+		TEST_TRUE (WIFEXITED (status));
+		TEST_EQ (WEXITSTATUS (status), 0);
+	}
+
+
+	/* Check that when the GetAllJobStatus method is unknown, the list
+	 * action makes the GetAllJobs method call to obtain a list of
+	 * paths, then for each job calls the GetAllInstances method call
+	 * to obtain a list of the instances.
+	 * If there are instances, the job name and instance properties are
+	 * requested and output; if there are not instances, only the
+	 * job name is requested and output.
+	 */
+	TEST_FEATURE ("with valid reply");
+	TEST_ALLOC_FAIL {
+		TEST_CHILD (server_pid) {
+			/* Expect the GetAllJobStatus method call on the
+			 * manager object, reply with an unknown method error
+			 * as an older init daemon would.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"GetAllJobStatus"));
+
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_error (method_call,
+								DBUS_ERROR_UNKNOWN_METHOD,
+								"Unknown method");
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
+			/* Expect the GetAllJobs method call on the
+			 * manager object, reply with a list of interesting
+			 * paths.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
 
 			TEST_TRUE (dbus_message_is_method_call (method_call,
 								DBUS_INTERFACE_UPSTART,
@@ -14544,6 +15534,31 @@ test_list_action (void)
 	TEST_FEATURE ("with error reply to GetAllInstances");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
+			/* Expect the GetAllJobStatus method call on the
+			 * manager object, reply with an unknown method error
+			 * as an older init daemon would.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"GetAllJobStatus"));
+
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_error (method_call,
+								DBUS_ERROR_UNKNOWN_METHOD,
+								"Unknown method");
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
 			/* Expect the GetAllJobs method call on the
 			 * manager object, reply with a list of interesting
 			 * paths.
@@ -14887,6 +15902,31 @@ test_list_action (void)
 	TEST_FEATURE ("with error reply to GetAllJobs");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
+			/* Expect the GetAllJobStatus method call on the
+			 * manager object, reply with an unknown method error
+			 * as an older init daemon would.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"GetAllJobStatus"));
+
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_error (method_call,
+								DBUS_ERROR_UNKNOWN_METHOD,
+								"Unknown method");
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
 			/* Expect the GetAllJobs method call on the
 			 * manager object, reply with an error.
 			 */
@@ -15302,10 +16342,225 @@ test_emit_action (void)
 
 			TEST_EQ_STR (name_value, "wibble");
 
-			TEST_EQ (args_elements, 0);
-			dbus_free_string_array (args_value);
+			TEST_EQ (args_elements, 0);
+			dbus_free_string_array (args_value);
+
+			TEST_TRUE (wait_value);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_error (method_call,
+								DBUS_ERROR_UNKNOWN_METHOD,
+								"Unknown method");
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
+			TEST_DBUS_CLOSE (server_conn);
+
+			dbus_shutdown ();
+
+			exit (0);
+		}
+
+		memset (&command, 0, sizeof command);
+
+		args[0] = "wibble";
+		args[1] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = emit_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		TEST_GT (ret, 0);
+
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_MATCH (errors, "test: *\n");
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+
+		kill (server_pid, SIGTERM);
+		waitpid (server_pid, NULL, 0);
+	}
+
+
+	/* Check that a missing argument results in an error being output
+	 * to stderr along with a suggestion of help.
+	 */
+	TEST_FEATURE ("with missing argument");
+	TEST_ALLOC_FAIL {
+		memset (&command, 0, sizeof command);
+
+		args[0] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = emit_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		TEST_GT (ret, 0);
+
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_EQ (errors, "test: missing event name\n");
+		TEST_FILE_EQ (errors, "Try `test --help' for more information.\n");
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+	}
+
+
+	fclose (errors);
+	fclose (output);
+
+	TEST_DBUS_CLOSE (server_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+
+void
+test_reload_configuration_action (void)
+{
+	pid_t           dbus_pid;
+	DBusConnection *server_conn;
+	FILE *          output;
+	FILE *          errors;
+	pid_t           server_pid;
+	DBusMessage *   method_call;
+	DBusMessage *   reply = NULL;
+	NihCommand      command;
+	char *          args[1];
+	int             ret = 0;
+	int             status;
+
+	TEST_FUNCTION ("reload_configuration_action");
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (server_conn);
+
+	assert (dbus_bus_request_name (server_conn, DBUS_SERVICE_UPSTART,
+				       0, NULL)
+			== DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER);
+
+	TEST_DBUS_MESSAGE (server_conn, method_call);
+	assert (dbus_message_is_signal (method_call, DBUS_INTERFACE_DBUS,
+					"NameAcquired"));
+	dbus_message_unref (method_call);
+
+	dbus_bus_type = DBUS_BUS_SYSTEM;
+	dest_name = DBUS_SERVICE_UPSTART;
+	dest_address = DBUS_ADDRESS_UPSTART;
+
+	output = tmpfile ();
+	errors = tmpfile ();
+
+
+	/* Check that the reload_configuration sends the method call to the
+	 * server.
+	 */
+	TEST_FEATURE ("with command");
+	TEST_ALLOC_FAIL {
+		TEST_CHILD (server_pid) {
+			/* Expect the ReloadConfiguration method call for
+			 * the manager object, reply to acknowledge.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"ReloadConfiguration"));
+
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
+
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_method_return (method_call);
+			}
+
+			dbus_connection_send (server_conn, reply, NULL);
+			dbus_connection_flush (server_conn);
+
+			dbus_message_unref (method_call);
+			dbus_message_unref (reply);
+
+			TEST_DBUS_CLOSE (server_conn);
+
+			dbus_shutdown ();
+
+			exit (0);
+		}
+
+		memset (&command, 0, sizeof command);
+
+		args[0] = NULL;
+
+		TEST_DIVERT_STDOUT (output) {
+			TEST_DIVERT_STDERR (errors) {
+				ret = reload_configuration_action (&command, args);
+			}
+		}
+		rewind (output);
+		rewind (errors);
+
+		if (test_alloc_failed
+		    && (ret != 0)) {
+			TEST_FILE_END (output);
+			TEST_FILE_RESET (output);
+
+			TEST_FILE_EQ (errors, "test: Cannot allocate memory\n");
+			TEST_FILE_END (errors);
+			TEST_FILE_RESET (errors);
+
+			kill (server_pid, SIGTERM);
+			waitpid (server_pid, NULL, 0);
+			continue;
+		}
+
+		TEST_EQ (ret, 0);
+
+		TEST_FILE_END (output);
+		TEST_FILE_RESET (output);
+
+		TEST_FILE_END (errors);
+		TEST_FILE_RESET (errors);
+
+		waitpid (server_pid, &status, 0);
+		TEST_TRUE (WIFEXITED (status));
+		TEST_EQ (WEXITSTATUS (status), 0);
+	}
+
+
+	/* Check that if an error is received from the command,
+	 * the message attached is printed to standard error and the
+	 * command exits.
+	 */
+	TEST_FEATURE ("with error reply");
+	TEST_ALLOC_FAIL {
+		TEST_CHILD (server_pid) {
+			/* Expect the ReloadConfiguration method call for
+			 * the manager object, reply with an error.
+			 */
+			TEST_DBUS_MESSAGE (server_conn, method_call);
+
+			TEST_TRUE (dbus_message_is_method_call (method_call,
+								DBUS_INTERFACE_UPSTART,
+								"ReloadConfiguration"));
 
-			TEST_TRUE (wait_value);
+			TEST_EQ_STR (dbus_message_get_path (method_call),
+							    DBUS_PATH_UPSTART);
 
 			TEST_ALLOC_SAFE {
 				reply = dbus_message_new_error (method_call,
@@ -15328,12 +16583,11 @@ test_emit_action (void)
 
 		memset (&command, 0, sizeof command);
 
-		args[0] = "wibble";
-		args[1] = NULL;
+		args[0] = NULL;
 
 		TEST_DIVERT_STDOUT (output) {
 			TEST_DIVERT_STDERR (errors) {
-				ret = emit_action (&command, args);
+				ret = reload_configuration_action (&command, args);
 			}
 		}
 		rewind (output);
@@ -15353,35 +16607,6 @@ test_emit_action (void)
 	}
 
 
-	/* Check that a missing argument results in an error being output
-	 * to stderr along with a suggestion of help.
-	 */
-	TEST_FEATURE ("with missing argument");
-	TEST_ALLOC_FAIL {
-		memset (&command, 0, sizeof command);
-
-		args[0] = NULL;
-
-		TEST_DIVERT_STDOUT (output) {
-			TEST_DIVERT_STDERR (errors) {
-				ret = emit_action (&command, args);
-			}
-		}
-		rewind (output);
-		rewind (errors);
-
-		TEST_GT (ret, 0);
-
-		TEST_FILE_END (output);
-		TEST_FILE_RESET (output);
-
-		TEST_FILE_EQ (errors, "test: missing event name\n");
-		TEST_FILE_EQ (errors, "Try `test --help' for more information.\n");
-		TEST_FILE_END (errors);
-		TEST_FILE_RESET (errors);
-	}
-
-
 	fclose (errors);
 	fclose (output);
 
@@ -15393,7 +16618,7 @@ test_emit_action (void)
 
 
 void
-test_reload_configuration_action (void)
+test_version_action (void)
 {
 	pid_t           dbus_pid;
 	DBusConnection *server_conn;
@@ -15401,13 +16626,18 @@ test_reload_configuration_action (void)
 	FILE *          errors;
 	pid_t           server_pid;
 	DBusMessage *   method_call;
+	const char *    interface;
+	const char *    property;
 	DBusMessage *   reply = NULL;
+	DBusMessageIter iter;
+	DBusMessageIter subiter;
+	const char *    str_value;
 	NihCommand      command;
 	char *          args[1];
 	int             ret = 0;
 	int             status;
 
-	TEST_FUNCTION ("reload_configuration_action");
+	TEST_FUNCTION ("version_action");
 	TEST_DBUS (dbus_pid);
 	TEST_DBUS_OPEN (server_conn);
 
@@ -15428,26 +16658,46 @@ test_reload_configuration_action (void)
 	errors = tmpfile ();
 
 
-	/* Check that the reload_configuration sends the method call to the
-	 * server.
+	/* Check that the version action queries the server for its
+	 * version property, and prints the result to standard output.
 	 */
-	TEST_FEATURE ("with command");
+	TEST_FEATURE ("with valid reply");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
-			/* Expect the ReloadConfiguration method call for
-			 * the manager object, reply to acknowledge.
+			/* Expect the Get call for the version property,
+			 * reply with the string we want printed.
 			 */
 			TEST_DBUS_MESSAGE (server_conn, method_call);
 
 			TEST_TRUE (dbus_message_is_method_call (method_call,
-								DBUS_INTERFACE_UPSTART,
-								"ReloadConfiguration"));
+								DBUS_INTERFACE_PROPERTIES,
+								"Get"));
 
 			TEST_EQ_STR (dbus_message_get_path (method_call),
 							    DBUS_PATH_UPSTART);
 
+			TEST_TRUE (dbus_message_get_args (method_call, NULL,
+							  DBUS_TYPE_STRING, &interface,
+							  DBUS_TYPE_STRING, &property,
+							  DBUS_TYPE_INVALID));
+
+			TEST_EQ_STR (interface, DBUS_INTERFACE_UPSTART);
+			TEST_EQ_STR (property, "version");
+
 			TEST_ALLOC_SAFE {
 				reply = dbus_message_new_method_return (method_call);
+
+				dbus_message_iter_init_append (reply, &iter);
+
+				dbus_message_iter_open_container (&iter, DBUS_TYPE_VARIANT,
+								  DBUS_TYPE_STRING_AS_STRING,
+								  &subiter);
+
+				str_value = "init (upstart 1.0.0)";
+				dbus_message_iter_append_basic (&subiter, DBUS_TYPE_STRING,
+								&str_value);
+
+				dbus_message_iter_close_container (&iter, &subiter);
 			}
 
 			dbus_connection_send (server_conn, reply, NULL);
@@ -15469,7 +16719,7 @@ test_reload_configuration_action (void)
 
 		TEST_DIVERT_STDOUT (output) {
 			TEST_DIVERT_STDERR (errors) {
-				ret = reload_configuration_action (&command, args);
+				ret = version_action (&command, args);
 			}
 		}
 		rewind (output);
@@ -15491,6 +16741,7 @@ test_reload_configuration_action (void)
 
 		TEST_EQ (ret, 0);
 
+		TEST_FILE_EQ (output, "init (upstart 1.0.0)\n");
 		TEST_FILE_END (output);
 		TEST_FILE_RESET (output);
 
@@ -15503,25 +16754,33 @@ test_reload_configuration_action (void)
 	}
 
 
-	/* Check that if an error is received from the command,
+	/* Check that if an error is received from the query command,
 	 * the message attached is printed to standard error and the
 	 * command exits.
 	 */
 	TEST_FEATURE ("with error reply");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
-			/* Expect the ReloadConfiguration method call for
-			 * the manager object, reply with an error.
+			/* Expect the Get call for the version property,
+			 * reply with an error.
 			 */
 			TEST_DBUS_MESSAGE (server_conn, method_call);
 
 			TEST_TRUE (dbus_message_is_method_call (method_call,
-								DBUS_INTERFACE_UPSTART,
-								"ReloadConfiguration"));
+								DBUS_INTERFACE_PROPERTIES,
+								"Get"));
 
 			TEST_EQ_STR (dbus_message_get_path (method_call),
 							    DBUS_PATH_UPSTART);
 
+			TEST_TRUE (dbus_message_get_args (method_call, NULL,
+							  DBUS_TYPE_STRING, &interface,
+							  DBUS_TYPE_STRING, &property,
+							  DBUS_TYPE_INVALID));
+
+			TEST_EQ_STR (interface, DBUS_INTERFACE_UPSTART);
+			TEST_EQ_STR (property, "version");
+
 			TEST_ALLOC_SAFE {
 				reply = dbus_message_new_error (method_call,
 								DBUS_ERROR_UNKNOWN_METHOD,
@@ -15547,7 +16806,7 @@ test_reload_configuration_action (void)
 
 		TEST_DIVERT_STDOUT (output) {
 			TEST_DIVERT_STDERR (errors) {
-				ret = reload_configuration_action (&command, args);
+				ret = version_action (&command, args);
 			}
 		}
 		rewind (output);
@@ -15576,9 +16835,8 @@ test_reload_configuration_action (void)
 	dbus_shutdown ();
 }
 
-
 void
-test_version_action (void)
+test_stats_action (void)
 {
 	pid_t           dbus_pid;
 	DBusConnection *server_conn;
@@ -15586,18 +16844,17 @@ test_version_action (void)
 	FILE *          errors;
 	pid_t           server_pid;
 	DBusMessage *   method_call;
-	const char *    interface;
-	const char *    property;
 	DBusMessage *   reply = NULL;
 	DBusMessageIter iter;
-	DBusMessageIter subiter;
-	const char *    str_value;
+	DBusMessageIter arrayiter;
+	uint64_t        uint64_value;
+	uint32_t        uint32_value;
 	NihCommand      command;
 	char *          args[1];
 	int             ret = 0;
 	int             status;
 
-	TEST_FUNCTION ("version_action");
+	TEST_FUNCTION ("stats_action");
 	TEST_DBUS (dbus_pid);
 	TEST_DBUS_OPEN (server_conn);
 
@@ -15610,6 +16867,7 @@ test_version_action (void)
 					"NameAcquired"));
 	dbus_message_unref (method_call);
 
+	use_dbus = TRUE;
 	dbus_bus_type = DBUS_BUS_SYSTEM;
 	dest_name = DBUS_SERVICE_UPSTART;
 	dest_address = DBUS_ADDRESS_UPSTART;
@@ -15618,46 +16876,60 @@ test_version_action (void)
 	errors = tmpfile ();
 
 
-	/* Check that the version action queries the server for its
-	 * version property, and prints the result to standard output.
+	/* Check that the stats action calls the GetEventStats method and
+	 * prints the counts, followed by only the non-empty buckets of
+	 * each histogram with the range of values they hold.
 	 */
 	TEST_FEATURE ("with valid reply");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
-			/* Expect the Get call for the version property,
-			 * reply with the string we want printed.
+			/* Expect the GetEventStats method call on the
+			 * manager object, reply with the counts and
+			 * histograms.
 			 */
 			TEST_DBUS_MESSAGE (server_conn, method_call);
 
 			TEST_TRUE (dbus_message_is_method_call (method_call,
-								DBUS_INTERFACE_PROPERTIES,
-								"Get"));
+								DBUS_INTERFACE_UPSTART,
+								"GetEventStats"));
 
 			TEST_EQ_STR (dbus_message_get_path (method_call),
 							    DBUS_PATH_UPSTART);
 
-			TEST_TRUE (dbus_message_get_args (method_call, NULL,
-							  DBUS_TYPE_STRING, &interface,
-							  DBUS_TYPE_STRING, &property,
-							  DBUS_TYPE_INVALID));
-
-			TEST_EQ_STR (interface, DBUS_INTERFACE_UPSTART);
-			TEST_EQ_STR (property, "version");
-
 			TEST_ALLOC_SAFE {
 				reply = dbus_message_new_method_return (method_call);
 
 				dbus_message_iter_init_append (reply, &iter);
 
-				dbus_message_iter_open_container (&iter, DBUS_TYPE_VARIANT,
-								  DBUS_TYPE_STRING_AS_STRING,
-								  &subiter);
+				uint64_value = 42;
+				dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT64,
+								&uint64_value);
+
+				uint32_value = 3;
+				dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32,
+								&uint32_value);
+				uint32_value = 2;
+				dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32,
+								&uint32_value);
+				uint32_value = 0;
+				dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32,
+								&uint32_value);
+
+				for (int h = 0; h < 3; h++) {
+					dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+									  DBUS_TYPE_UINT64_AS_STRING,
+									  &arrayiter);
 
-				str_value = "init (upstart 1.0.0)";
-				dbus_message_iter_append_basic (&subiter, DBUS_TYPE_STRING,
-								&str_value);
+					for (int i = 0; i < 4; i++) {
+						uint64_value = ((h == 0) && (i != 1)) ? i + 1
+							: ((h == 1) && (i == 3)) ? 7
+							: 0;
+						dbus_message_iter_append_basic (&arrayiter, DBUS_TYPE_UINT64,
+										&uint64_value);
+					}
 
-				dbus_message_iter_close_container (&iter, &subiter);
+					dbus_message_iter_close_container (&iter, &arrayiter);
+				}
 			}
 
 			dbus_connection_send (server_conn, reply, NULL);
@@ -15679,7 +16951,7 @@ test_version_action (void)
 
 		TEST_DIVERT_STDOUT (output) {
 			TEST_DIVERT_STDERR (errors) {
-				ret = version_action (&command, args);
+				ret = stats_action (&command, args);
 			}
 		}
 		rewind (output);
@@ -15701,7 +16973,17 @@ test_version_action (void)
 
 		TEST_EQ (ret, 0);
 
-		TEST_FILE_EQ (output, "init (upstart 1.0.0)\n");
+		TEST_FILE_EQ (output, "events emitted: 42\n");
+		TEST_FILE_EQ (output, "events pending: 3\n");
+		TEST_FILE_EQ (output, "events handling: 2\n");
+		TEST_FILE_EQ (output, "events finished: 0\n");
+		TEST_FILE_EQ (output, "event latency:\n");
+		TEST_FILE_EQ (output, "\t0 us\t1\n");
+		TEST_FILE_EQ (output, "\t2-3 us\t3\n");
+		TEST_FILE_EQ (output, "\t4+ us\t4\n");
+		TEST_FILE_EQ (output, "queue pass duration:\n");
+		TEST_FILE_EQ (output, "\t4+ us\t7\n");
+		TEST_FILE_EQ (output, "subscriptions examined per event:\n");
 		TEST_FILE_END (output);
 		TEST_FILE_RESET (output);
 
@@ -15714,37 +16996,126 @@ test_version_action (void)
 	}
 
 
-	/* Check that if an error is received from the query command,
-	 * the message attached is printed to standard error and the
-	 * command exits.
+	fclose (errors);
+	fclose (output);
+
+	TEST_DBUS_CLOSE (server_conn);
+	TEST_DBUS_END (dbus_pid);
+
+	dbus_shutdown ();
+}
+
+
+void
+test_boot_trace_action (void)
+{
+	pid_t           dbus_pid;
+	DBusConnection *server_conn;
+	FILE *          output;
+	FILE *          errors;
+	pid_t           server_pid;
+	DBusMessage *   method_call;
+	DBusMessage *   reply = NULL;
+	DBusMessageIter iter;
+	DBusMessageIter arrayiter;
+	DBusMessageIter structiter;
+	NihCommand      command;
+	char *          args[1];
+	int             ret = 0;
+	int             status;
+	struct {
+		uint64_t    time;
+		const char *job;
+		const char *instance;
+		const char *type;
+		const char *value;
+	} records[] = {
+		{ 50, "startup", "", "event", "" },
+		{ 100, "foo", "", "state", "starting" },
+		{ 150, "foo", "", "spawn", "main" },
+		{ 160, "foo", "", "state", "spawned" },
+		{ 170, "bar", "tty\"1", "state", "starting" },
+		{ 190, "foo", "", "exec", "main" },
+		{ 200, "foo", "", "state", "running" },
+	};
+
+	TEST_FUNCTION ("boot_trace_action");
+	TEST_DBUS (dbus_pid);
+	TEST_DBUS_OPEN (server_conn);
+
+	assert (dbus_bus_request_name (server_conn, DBUS_SERVICE_UPSTART,
+				       0, NULL)
+			== DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER);
+
+	TEST_DBUS_MESSAGE (server_conn, method_call);
+	assert (dbus_message_is_signal (method_call, DBUS_INTERFACE_DBUS,
+					"NameAcquired"));
+	dbus_message_unref (method_call);
+
+	use_dbus = TRUE;
+	dbus_bus_type = DBUS_BUS_SYSTEM;
+	dest_name = DBUS_SERVICE_UPSTART;
+	dest_address = DBUS_ADDRESS_UPSTART;
+
+	output = tmpfile ();
+	errors = tmpfile ();
+
+
+	/* Check that the boot-trace action calls the GetJobTimeline method
+	 * and prints a trace with a named track for each instance, a span
+	 * for each state lasting until the next and for each spawn lasting
+	 * until the exec, an instant for those with no end and a global
+	 * instant for each event.
 	 */
-	TEST_FEATURE ("with error reply");
+	TEST_FEATURE ("with valid reply");
 	TEST_ALLOC_FAIL {
 		TEST_CHILD (server_pid) {
-			/* Expect the Get call for the version property,
-			 * reply with an error.
+			/* Expect the GetJobTimeline method call on the
+			 * manager object, reply with the records.
 			 */
 			TEST_DBUS_MESSAGE (server_conn, method_call);
 
 			TEST_TRUE (dbus_message_is_method_call (method_call,
-								DBUS_INTERFACE_PROPERTIES,
-								"Get"));
+								DBUS_INTERFACE_UPSTART,
+								"GetJobTimeline"));
 
 			TEST_EQ_STR (dbus_message_get_path (method_call),
 							    DBUS_PATH_UPSTART);
 
-			TEST_TRUE (dbus_message_get_args (method_call, NULL,
-							  DBUS_TYPE_STRING, &interface,
-							  DBUS_TYPE_STRING, &property,
-							  DBUS_TYPE_INVALID));
+			TEST_ALLOC_SAFE {
+				reply = dbus_message_new_method_return (method_call);
 
-			TEST_EQ_STR (interface, DBUS_INTERFACE_UPSTART);
-			TEST_EQ_STR (property, "version");
+				dbus_message_iter_init_append (reply, &iter);
 
-			TEST_ALLOC_SAFE {
-				reply = dbus_message_new_error (method_call,
-								DBUS_ERROR_UNKNOWN_METHOD,
-								"Unknown method");
+				dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+								  (DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+								   DBUS_TYPE_UINT64_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_TYPE_STRING_AS_STRING
+								   DBUS_STRUCT_END_CHAR_AS_STRING),
+								  &arrayiter);
+
+				for (size_t i = 0; i < sizeof (records) / sizeof (records[0]); i++) {
+					dbus_message_iter_open_container (&arrayiter, DBUS_TYPE_STRUCT,
+									  NULL, &structiter);
+
+					dbus_message_iter_append_basic (&structiter, DBUS_TYPE_UINT64,
+									&records[i].time);
+					dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+									&records[i].job);
+					dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+									&records[i].instance);
+					dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+									&records[i].type);
+					dbus_message_iter_append_basic (&structiter, DBUS_TYPE_STRING,
+									&records[i].value);
+
+					dbus_message_iter_close_container (&arrayiter, &structiter);
+				}
+
+				dbus_message_iter_close_container (&iter, &arrayiter);
 			}
 
 			dbus_connection_send (server_conn, reply, NULL);
@@ -15766,23 +17137,63 @@ test_version_action (void)
 
 		TEST_DIVERT_STDOUT (output) {
 			TEST_DIVERT_STDERR (errors) {
-				ret = version_action (&command, args);
+				ret = boot_trace_action (&command, args);
 			}
 		}
 		rewind (output);
 		rewind (errors);
 
-		TEST_GT (ret, 0);
+		if (test_alloc_failed
+		    && (ret != 0)) {
+			TEST_FILE_END (output);
+			TEST_FILE_RESET (output);
+
+			TEST_FILE_EQ (errors, "test: Cannot allocate memory\n");
+			TEST_FILE_END (errors);
+			TEST_FILE_RESET (errors);
+
+			kill (server_pid, SIGTERM);
+			waitpid (server_pid, NULL, 0);
+			continue;
+		}
 
+		TEST_EQ (ret, 0);
+
+		TEST_FILE_EQ (output, "{\"traceEvents\": [\n");
+		TEST_FILE_EQ (output, ("{\"name\": \"startup\", \"cat\": \"event\", "
+				       "\"ph\": \"i\", \"s\": \"g\", \"pid\": 1, "
+				       "\"tid\": 0, \"ts\": 50},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"thread_name\", \"ph\": \"M\", "
+				       "\"pid\": 1, \"tid\": 2, "
+				       "\"args\": {\"name\": \"foo\"}},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"starting\", \"cat\": \"state\", "
+				       "\"ph\": \"X\", \"pid\": 1, \"tid\": 2, "
+				       "\"ts\": 100, \"dur\": 60},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"main spawn\", \"cat\": \"spawn\", "
+				       "\"ph\": \"X\", \"pid\": 1, \"tid\": 2, "
+				       "\"ts\": 150, \"dur\": 40},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"spawned\", \"cat\": \"state\", "
+				       "\"ph\": \"X\", \"pid\": 1, \"tid\": 2, "
+				       "\"ts\": 160, \"dur\": 40},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"thread_name\", \"ph\": \"M\", "
+				       "\"pid\": 1, \"tid\": 5, "
+				       "\"args\": {\"name\": \"bar (tty\\\"1)\"}},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"starting\", \"cat\": \"state\", "
+				       "\"ph\": \"i\", \"s\": \"t\", \"pid\": 1, "
+				       "\"tid\": 5, \"ts\": 170},\n"));
+		TEST_FILE_EQ (output, ("{\"name\": \"running\", \"cat\": \"state\", "
+				       "\"ph\": \"i\", \"s\": \"t\", \"pid\": 1, "
+				       "\"tid\": 2, \"ts\": 200}\n"));
+		TEST_FILE_EQ (output, "]}\n");
 		TEST_FILE_END (output);
 		TEST_FILE_RESET (output);
 
-		TEST_FILE_MATCH (errors, "test: *\n");
 		TEST_FILE_END (errors);
 		TEST_FILE_RESET (errors);
 
-		kill (server_pid, SIGTERM);
-		waitpid (server_pid, NULL, 0);
+		waitpid (server_pid, &status, 0);
+		TEST_TRUE (WIFEXITED (status));
+		TEST_EQ (WEXITSTATUS (status), 0);
 	}
 
 
@@ -18413,9 +19824,12 @@ main (int   argc,
 	test_reload_action ();
 	test_status_action ();
 	test_list_action ();
+	test_batch_action ();
 	test_emit_action ();
 	test_reload_configuration_action ();
 	test_version_action ();
+	test_stats_action ();
+	test_boot_trace_action ();
 	test_log_priority_action ();
 	test_usage ();
 
@@ -18444,7 +19858,9 @@ main (int   argc,
 	} else {
 		test_list ();
 		test_show_config ();
+		test_critical_path ();
 		test_check_config ();
+		test_graph ();
 		test_notify_disk_writeable ();
 	}
 
@@ -0,0 +1,156 @@
+/* upstart
+ *
+ * test_mounts.c - test suite for util/mounts.c
+ *
+ * Copyright © 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <nih/test.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <nih/macros.h>
+#include <nih/alloc.h>
+#include <nih/error.h>
+
+#include "mounts.h"
+
+
+void
+test_read (void)
+{
+	char         filename[PATH_MAX];
+	FILE *       file;
+	MountPoint **mounts;
+	NihError *   err;
+
+	TEST_FUNCTION ("mounts_read");
+	TEST_FILENAME (filename);
+
+
+	/* Check that the root filesystem and those without backing store
+	 * are omitted, and that the remainder are ordered with the most
+	 * deeply nested first.
+	 */
+	TEST_FEATURE ("with mixed filesystems");
+	file = fopen (filename, "w");
+	fprintf (file, "/dev/sda1 / ext4 rw,relatime 0 0\n");
+	fprintf (file, "proc /proc proc rw,nosuid,nodev,noexec 0 0\n");
+	fprintf (file, "/dev/sda2 /home ext4 rw,relatime 0 0\n");
+	fprintf (file, "tmpfs /run tmpfs rw,nosuid,nodev 0 0\n");
+	fprintf (file, "/dev/sdb1 /home/user/data xfs rw 0 0\n");
+	fprintf (file, "/dev/sda3 /var ext4 rw,relatime 0 0\n");
+	fprintf (file, "/dev/sda4 /var/lib ext4 rw,relatime 0 0\n");
+	fclose (file);
+
+	TEST_ALLOC_FAIL {
+		mounts = mounts_read (NULL, filename);
+
+		if (test_alloc_failed) {
+			TEST_EQ_P (mounts, NULL);
+
+			err = nih_error_get ();
+			TEST_EQ (err->number, ENOMEM);
+			nih_free (err);
+			continue;
+		}
+
+		TEST_NE_P (mounts, NULL);
+		TEST_ALLOC_SIZE (mounts, sizeof (MountPoint *) * 5);
+
+		TEST_EQ_STR (mounts[0]->path, "/home/user/data");
+		TEST_EQ_STR (mounts[0]->type, "xfs");
+		TEST_EQ (mounts[0]->depth, 3);
+
+		TEST_EQ_STR (mounts[1]->path, "/var/lib");
+		TEST_EQ (mounts[1]->depth, 2);
+
+		TEST_EQ (mounts[2]->depth, 1);
+		TEST_EQ (mounts[3]->depth, 1);
+		if (! strcmp (mounts[2]->path, "/home")) {
+			TEST_EQ_STR (mounts[3]->path, "/var");
+		} else {
+			TEST_EQ_STR (mounts[2]->path, "/var");
+			TEST_EQ_STR (mounts[3]->path, "/home");
+		}
+
+		TEST_EQ_P (mounts[4], NULL);
+
+		nih_free (mounts);
+	}
+
+
+	/* Check that escaped characters in mount points are decoded. */
+	TEST_FEATURE ("with escaped mount point");
+	file = fopen (filename, "w");
+	fprintf (file, "/dev/sdc1 /media/My\\040Disk vfat rw 0 0\n");
+	fclose (file);
+
+	mounts = mounts_read (NULL, filename);
+
+	TEST_NE_P (mounts, NULL);
+	TEST_EQ_STR (mounts[0]->path, "/media/My Disk");
+	TEST_EQ (mounts[0]->depth, 2);
+	TEST_EQ_P (mounts[1], NULL);
+
+	nih_free (mounts);
+
+
+	/* Check that an empty array is returned when there's nothing to
+	 * unmount.
+	 */
+	TEST_FEATURE ("with only root filesystem");
+	file = fopen (filename, "w");
+	fprintf (file, "/dev/sda1 / ext4 rw,relatime 0 0\n");
+	fprintf (file, "sysfs /sys sysfs rw 0 0\n");
+	fclose (file);
+
+	mounts = mounts_read (NULL, filename);
+
+	TEST_NE_P (mounts, NULL);
+	TEST_EQ_P (mounts[0], NULL);
+
+	nih_free (mounts);
+
+
+	/* Check that an error is raised if the file doesn't exist. */
+	TEST_FEATURE ("with missing file");
+	unlink (filename);
+
+	mounts = mounts_read (NULL, filename);
+
+	TEST_EQ_P (mounts, NULL);
+
+	err = nih_error_get ();
+	TEST_EQ (err->number, ENOENT);
+	nih_free (err);
+}
+
+
+int
+main (int   argc,
+      char *argv[])
+{
+	nih_error_init ();
+
+	test_read ();
+
+	return 0;
+}
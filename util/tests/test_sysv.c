@@ -30,6 +30,7 @@
 #include <sys/utsname.h>
 
 #include <utmpx.h>
+#include <stdio.h>
 #include <limits.h>
 #include <signal.h>
 #include <unistd.h>
@@ -85,6 +86,7 @@ test_change_runlevel (void)
 	int             wait_value;
 	char            utmp_file[PATH_MAX];
 	char            wtmp_file[PATH_MAX];
+	char            cache_file[PATH_MAX];
 	struct utmpx    record;
 	struct utmpx *  utmp;
 	struct utsname  uts;
@@ -101,6 +103,7 @@ test_change_runlevel (void)
 
 	TEST_FILENAME (utmp_file);
 	TEST_FILENAME (wtmp_file);
+	sprintf (cache_file, "%s%s", utmp_file, UTMP_RUNLEVEL_EXT);
 
 
 	/* Check that we can change the runlevel, the previous runlevel
@@ -189,6 +192,7 @@ test_change_runlevel (void)
 
 
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -427,6 +431,7 @@ test_change_runlevel (void)
 
 
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -612,6 +617,7 @@ test_change_runlevel (void)
 
 
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -794,6 +800,7 @@ test_change_runlevel (void)
 
 
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -963,6 +970,7 @@ test_change_runlevel (void)
 	TEST_FEATURE ("with error connecting");
 	TEST_ALLOC_FAIL {
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -1082,6 +1090,7 @@ test_change_runlevel (void)
 		}
 
 		unlink (utmp_file);
+		unlink (cache_file);
 		fclose (fopen (utmp_file, "w"));
 
 		unlink (wtmp_file);
@@ -1120,6 +1129,7 @@ test_change_runlevel (void)
 
 
 	unlink (utmp_file);
+	unlink (cache_file);
 	unlink (wtmp_file);
 }
 
@@ -328,6 +328,7 @@ void
 test_get_runlevel (void)
 {
 	char           filename[PATH_MAX];
+	char           cache_file[PATH_MAX];
 	FILE *         file;
 	struct utmpx   utmp;
 	struct utsname uts;
@@ -338,6 +339,7 @@ test_get_runlevel (void)
 
 	TEST_FUNCTION ("utmp_get_runlevel");
 	TEST_FILENAME (filename);
+	sprintf (cache_file, "%s%s", filename, UTMP_RUNLEVEL_EXT);
 
 
 	/* Check that the function returns the contents of the environment
@@ -349,6 +351,7 @@ test_get_runlevel (void)
 
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -393,6 +396,7 @@ test_get_runlevel (void)
 	TEST_FEATURE ("with runlevel and previous");
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -437,6 +441,7 @@ test_get_runlevel (void)
 
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -484,6 +489,7 @@ test_get_runlevel (void)
 
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -530,6 +536,7 @@ test_get_runlevel (void)
 
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -567,6 +574,76 @@ test_get_runlevel (void)
 	unsetenv ("PREVLEVEL");
 
 
+	/* Check that the runlevel read from the utmp file is cached
+	 * alongside it and returned from there while the utmp file is
+	 * unchanged, but that a change to the utmp file is noticed.
+	 */
+	TEST_FEATURE ("with cached runlevel");
+	unlink (filename);
+	unlink (cache_file);
+
+	file = fopen (filename, "w");
+	fclose (file);
+
+	memset (&utmp, 0, sizeof utmp);
+
+	utmp.ut_type = RUN_LVL;
+	utmp.ut_pid = '2' + 'S' * 256;
+
+	strcpy (utmp.ut_line, "~");
+	strcpy (utmp.ut_id, "~~");
+	strncpy (utmp.ut_user, "runlevel", sizeof utmp.ut_user);
+
+	gettimeofday (&tv, NULL);
+	utmp.ut_tv.tv_sec = tv.tv_sec;
+	utmp.ut_tv.tv_usec = tv.tv_usec;
+
+	utmpxname (filename);
+
+	setutxent ();
+	pututxline (&utmp);
+	endutxent ();
+
+	prevlevel = 0;
+
+	runlevel = utmp_get_runlevel (filename, &prevlevel);
+
+	TEST_EQ (runlevel, '2');
+	TEST_EQ (prevlevel, 'S');
+
+	file = fopen (cache_file, "r+");
+	TEST_NE_P (file, NULL);
+	TEST_NE (fputs ("5 3", file), EOF);
+	fclose (file);
+
+	prevlevel = 0;
+
+	runlevel = utmp_get_runlevel (filename, &prevlevel);
+
+	TEST_EQ (runlevel, '5');
+	TEST_EQ (prevlevel, '3');
+
+	memset (&utmp, 0, sizeof utmp);
+
+	utmp.ut_type = USER_PROCESS;
+	utmp.ut_pid = 1;
+
+	strcpy (utmp.ut_line, "tty1");
+	strcpy (utmp.ut_id, "1");
+	strncpy (utmp.ut_user, "root", sizeof utmp.ut_user);
+
+	setutxent ();
+	pututxline (&utmp);
+	endutxent ();
+
+	prevlevel = 0;
+
+	runlevel = utmp_get_runlevel (filename, &prevlevel);
+
+	TEST_EQ (runlevel, '2');
+	TEST_EQ (prevlevel, 'S');
+
+
 	/* Check that the function returns the contents of the environment
 	 * even if the utmp file is empty.
 	 */
@@ -576,6 +653,7 @@ test_get_runlevel (void)
 
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		prevlevel = 0;
 
@@ -595,6 +673,7 @@ test_get_runlevel (void)
 	TEST_FEATURE ("with no record");
 	TEST_ALLOC_FAIL {
 		unlink (filename);
+		unlink (cache_file);
 
 		file = fopen (filename, "w");
 		fclose (file);
@@ -613,6 +692,7 @@ test_get_runlevel (void)
 
 
 	unlink (filename);
+	unlink (cache_file);
 }
 
 
@@ -621,6 +701,7 @@ test_write_runlevel (void)
 {
 	char           utmp_file[PATH_MAX];
 	char           wtmp_file[PATH_MAX];
+	char           cache_file[PATH_MAX];
 	struct utmpx * utmp;
 	struct utmpx   record;
 	struct utsname uts;
@@ -631,6 +712,7 @@ test_write_runlevel (void)
 	TEST_FUNCTION ("utmp_write_runlevel");
 	TEST_FILENAME (utmp_file);
 	TEST_FILENAME (wtmp_file);
+	sprintf (cache_file, "%s%s", utmp_file, UTMP_RUNLEVEL_EXT);
 
 
 	/* Check that we can write a runlevel record to both the utmp
@@ -1262,6 +1344,7 @@ test_write_runlevel (void)
 
 	unlink (utmp_file);
 	unlink (wtmp_file);
+	unlink (cache_file);
 }
 
 void
@@ -1269,6 +1352,7 @@ test_write_shutdown (void)
 {
 	char           utmp_file[PATH_MAX];
 	char           wtmp_file[PATH_MAX];
+	char           cache_file[PATH_MAX];
 	struct utmpx * utmp;
 	struct utmpx   record;
 	struct utsname uts;
@@ -1279,6 +1363,7 @@ test_write_shutdown (void)
 	TEST_FUNCTION ("utmp_write_shutdown");
 	TEST_FILENAME (utmp_file);
 	TEST_FILENAME (wtmp_file);
+	sprintf (cache_file, "%s%s", utmp_file, UTMP_RUNLEVEL_EXT);
 
 
 	/* Check that we can write a shutdown record to both the utmp
@@ -1506,6 +1591,7 @@ test_write_shutdown (void)
 
 	unlink (utmp_file);
 	unlink (wtmp_file);
+	unlink (cache_file);
 }
 
 
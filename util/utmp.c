@@ -24,12 +24,19 @@
 #endif /* HAVE_CONFIG_H */
 
 
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/types.h>
 #include <sys/utsname.h>
 
+#include <fcntl.h>
 #include <utmpx.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <nih/macros.h>
 #include <nih/alloc.h>
@@ -46,6 +53,13 @@ static void utmp_entry      (struct utmpx *utmp, short type, pid_t pid,
 static int  utmp_write      (const char *utmp_file, const struct utmpx *utmp)
 	__attribute__ ((warn_unused_result));
 static void wtmp_write      (const char *wtmp_file, const struct utmpx *utmp);
+static int  utmp_cache_path (char *path, size_t len, const char *utmp_file,
+			     const char *suffix)
+	__attribute__ ((warn_unused_result));
+static int  utmp_cache_read (const char *utmp_file, int *prevlevel)
+	__attribute__ ((warn_unused_result));
+static void utmp_cache_write (const char *utmp_file, int runlevel,
+			      int prevlevel);
 
 
 /**
@@ -113,9 +127,10 @@ utmp_read_runlevel (const char *utmp_file,
  * @prevlevel: pointer to store previous runlevel in.
  *
  * If the RUNLEVEL and PREVLEVEL environment variables are set, returns
- * the current and previous runlevels from those otherwise calls
- * utmp_read_runlevel() to read the most recent runlevel entry from
- * @utmp_file.
+ * the current and previous runlevels from those otherwise returns those
+ * cached alongside @utmp_file, so long as it has not changed since they
+ * were cached, or calls utmp_read_runlevel() to read the most recent
+ * runlevel entry from @utmp_file and caches that.
  *
  * Returns: runlevel on success, negative value on raised error.
  **/
@@ -125,6 +140,8 @@ utmp_get_runlevel (const char *utmp_file,
 {
 	const char *renv;
 	const char *penv;
+	int         runlevel;
+	int         savedlevel;
 
 	renv = getenv ("RUNLEVEL");
 	penv = getenv ("PREVLEVEL");
@@ -136,7 +153,20 @@ utmp_get_runlevel (const char *utmp_file,
 		return renv[0] ?: 'N';
 	}
 
-	return utmp_read_runlevel (utmp_file, prevlevel);
+	runlevel = utmp_cache_read (utmp_file, prevlevel);
+	if (runlevel > 0)
+		return runlevel;
+
+	runlevel = utmp_read_runlevel (utmp_file, &savedlevel);
+	if (runlevel < 0)
+		return runlevel;
+
+	utmp_cache_write (utmp_file, runlevel, savedlevel);
+
+	if (prevlevel)
+		*prevlevel = savedlevel;
+
+	return runlevel;
 }
 
 
@@ -151,7 +181,8 @@ utmp_get_runlevel (const char *utmp_file,
  * or /var/run/utmp if @utmp_file is NULL, and to @wtmp_file, or /var/log/wtmp
  * if @wtmp_file is NULL.
  *
- * Errors writing to the wtmp file are ignored.
+ * Errors writing to the wtmp file are ignored, as are those updating the
+ * runlevel cached alongside the utmp file.
  *
  * Returns: zero on success, negative value on raised error.
  **/
@@ -206,6 +237,9 @@ utmp_write_runlevel (const char *utmp_file,
 	ret = utmp_write (utmp_file, &utmp);
 	wtmp_write (wtmp_file, &utmp);
 
+	if (ret == 0)
+		utmp_cache_write (utmp_file, runlevel, prevlevel ?: 'N');
+
 	return ret;
 }
 
@@ -219,7 +253,8 @@ utmp_write_runlevel (const char *utmp_file,
  * @utmp_file is NULL, and to @wtmp_file, or /var/log/wtmp if @wtmp_file
  * is NULL.
  *
- * Errors writing to the wtmp file are ignored.
+ * Errors writing to the wtmp file are ignored, as are those updating the
+ * runlevel cached alongside the utmp file.
  *
  * Returns: zero on success, negative value on raised error.
  **/
@@ -235,6 +270,10 @@ utmp_write_shutdown (const char *utmp_file,
 	ret = utmp_write (utmp_file, &utmp);
 	wtmp_write (wtmp_file, &utmp);
 
+	/* The shutdown record replaces the runlevel record */
+	if (ret == 0)
+		utmp_cache_write (utmp_file, 'N', 'N');
+
 	return ret;
 }
 
@@ -362,3 +401,166 @@ wtmp_write (const char *        wtmp_file,
 
 	updwtmpx (wtmp_file ?: _PATH_WTMPX, utmp);
 }
+
+
+/**
+ * utmp_cache_path:
+ * @path: buffer to store path in,
+ * @len: size of @path,
+ * @utmp_file: utmp file, or NULL for /var/run/utmp,
+ * @suffix: string to append after UTMP_RUNLEVEL_EXT.
+ *
+ * Store the path of the file caching the runlevel of @utmp_file, followed
+ * by @suffix, in @path.  No memory is allocated so that callers need not
+ * handle failure beyond falling back to reading @utmp_file itself.
+ *
+ * Returns: zero on success, negative value if @path is too small.
+ **/
+static int
+utmp_cache_path (char *      path,
+		 size_t      len,
+		 const char *utmp_file,
+		 const char *suffix)
+{
+	int ret;
+
+	nih_assert (path != NULL);
+	nih_assert (suffix != NULL);
+
+	ret = snprintf (path, len, "%s%s%s", utmp_file ?: _PATH_UTMPX,
+			UTMP_RUNLEVEL_EXT, suffix);
+	if ((ret < 0) || ((size_t)ret >= len))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * utmp_cache_read:
+ * @utmp_file: utmp file, or NULL for /var/run/utmp,
+ * @prevlevel: pointer to store previous runlevel in.
+ *
+ * Read the runlevel cached by utmp_cache_write() for @utmp_file, so long
+ * as the device, inode, size and modification time of @utmp_file are
+ * those recorded with it; otherwise @utmp_file has been written since,
+ * perhaps by another program, and must be read instead.
+ *
+ * If @prevlevel is not NULL, the previous runlevel will be stored in that
+ * variable.
+ *
+ * Returns: runlevel on success, negative value if there is no usable
+ * cache; no error is raised.
+ **/
+static int
+utmp_cache_read (const char *utmp_file,
+		 int *       prevlevel)
+{
+	char        path[PATH_MAX];
+	char        buf[128];
+	struct stat statbuf;
+	char        runlevel;
+	char        savedlevel;
+	uintmax_t   dev;
+	uintmax_t   ino;
+	intmax_t    size;
+	intmax_t    sec;
+	long        nsec;
+	ssize_t     len;
+	int         fd;
+
+	if (utmp_cache_path (path, sizeof path, utmp_file, "") < 0)
+		return -1;
+
+	if (stat (utmp_file ?: _PATH_UTMPX, &statbuf) < 0)
+		return -1;
+
+	fd = open (path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read (fd, buf, sizeof buf - 1);
+	close (fd);
+
+	if (len <= 0)
+		return -1;
+	buf[len] = '\0';
+
+	if (sscanf (buf, "%c %c %ju %ju %jd %jd %ld", &runlevel, &savedlevel,
+		    &dev, &ino, &size, &sec, &nsec) != 7)
+		return -1;
+
+	if ((dev != (uintmax_t)statbuf.st_dev)
+	    || (ino != (uintmax_t)statbuf.st_ino)
+	    || (size != (intmax_t)statbuf.st_size)
+	    || (sec != (intmax_t)statbuf.st_mtim.tv_sec)
+	    || (nsec != statbuf.st_mtim.tv_nsec))
+		return -1;
+
+	if ((runlevel <= 0) || (savedlevel <= 0))
+		return -1;
+
+	if (prevlevel)
+		*prevlevel = savedlevel;
+
+	return runlevel;
+}
+
+/**
+ * utmp_cache_write:
+ * @utmp_file: utmp file, or NULL for /var/run/utmp,
+ * @runlevel: runlevel of most recent record,
+ * @prevlevel: previous runlevel of most recent record.
+ *
+ * Cache @runlevel and @prevlevel, just read from or written to
+ * @utmp_file, in a file alongside it together with the device, inode,
+ * size and modification time of @utmp_file, so that utmp_get_runlevel()
+ * need not search @utmp_file again until it changes.
+ *
+ * The file is replaced atomically; errors are ignored since the cache
+ * is an optimisation, and most users may not write to it anyway.
+ **/
+static void
+utmp_cache_write (const char *utmp_file,
+		  int         runlevel,
+		  int         prevlevel)
+{
+	char        path[PATH_MAX];
+	char        new_path[PATH_MAX];
+	char        buf[128];
+	struct stat statbuf;
+	int         len;
+	int         fd;
+
+	nih_assert (runlevel > 0);
+	nih_assert (prevlevel > 0);
+
+	if ((utmp_cache_path (path, sizeof path, utmp_file, "") < 0)
+	    || (utmp_cache_path (new_path, sizeof new_path,
+				 utmp_file, ".new") < 0))
+		return;
+
+	if (stat (utmp_file ?: _PATH_UTMPX, &statbuf) < 0)
+		return;
+
+	len = snprintf (buf, sizeof buf, "%c %c %ju %ju %jd %jd %ld\n",
+			runlevel, prevlevel,
+			(uintmax_t)statbuf.st_dev, (uintmax_t)statbuf.st_ino,
+			(intmax_t)statbuf.st_size,
+			(intmax_t)statbuf.st_mtim.tv_sec,
+			(long)statbuf.st_mtim.tv_nsec);
+	if ((len < 0) || ((size_t)len >= sizeof buf))
+		return;
+
+	fd = open (new_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+
+	if (write (fd, buf, len) != len) {
+		close (fd);
+		unlink (new_path);
+		return;
+	}
+
+	if ((close (fd) < 0) || (rename (new_path, path) < 0))
+		unlink (new_path);
+}
@@ -23,6 +23,15 @@
 #include <nih/macros.h>
 
 
+/**
+ * UTMP_RUNLEVEL_EXT:
+ *
+ * Extension appended to the name of a utmp file to give the name of the
+ * file caching the runlevel recorded in it.
+ **/
+#define UTMP_RUNLEVEL_EXT ".runlevel"
+
+
 NIH_BEGIN_EXTERN
 
 int utmp_read_runlevel  (const char *utmp_file, int *prevlevel)